@@ -197,6 +197,30 @@ pm_backto_wakeup(struct vmctx *ctx)
 	pm1_status |= PM1_WAK_STS;
 }
 
+/*
+ * The PM1 registers of a sleeping VM go into its snapshot, the SLP_TYP
+ * left in pm1_control tells the firmware to take the resume path.
+ */
+void
+pm1_get_state(struct pm1_state *state)
+{
+	pthread_mutex_lock(&pm_lock);
+	state->status = pm1_status;
+	state->enable = pm1_enable;
+	state->control = pm1_control;
+	pthread_mutex_unlock(&pm_lock);
+}
+
+void
+pm1_set_state(const struct pm1_state *state)
+{
+	pthread_mutex_lock(&pm_lock);
+	pm1_status = state->status;
+	pm1_enable = state->enable;
+	pm1_control = state->control;
+	pthread_mutex_unlock(&pm_lock);
+}
+
 static int
 pm1_enable_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		   uint32_t *eax, void *arg)
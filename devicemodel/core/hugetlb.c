@@ -34,11 +34,16 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
 #include <log.h>
 
 #include "vmmapi.h"
+#include "dm.h"
 
 extern char *vmname;
 
@@ -56,11 +61,27 @@ extern char *vmname;
 #define PATH_HUGETLB_LV2 "/run/hugepage/acrn/huge_lv2/"
 #define OPT_HUGETLB_LV2 "pagesize=1G"
 
-#define SYS_PATH_LV1  "/sys/kernel/mm/hugepages/hugepages-2048kB/"
-#define SYS_PATH_LV2  "/sys/kernel/mm/hugepages/hugepages-1048576kB/"
+/*
+ * 2M hugetlbfs shared by all the acrn-dm instances, for the memory shared
+ * between VMs. It stays mounted when they exit, so that, like the files of
+ * /dev/shm, its files outlive the VMs.
+ */
+#define PATH_HUGETLB_SHARED "/run/hugepage/acrn/shared/"
+
+/* from linux/mempolicy.h, whose RECLAIM_* flags clash with vhm_ioctl_defs.h */
+#define MPOL_BIND	2
+
+#define SYS_PATH_HUGEPAGES  "/sys/kernel/mm/hugepages/"
+#define SYS_PATH_NODE  "/sys/devices/system/node/"
+#define SYS_PATH_CPU  "/sys/devices/system/cpu/"
+#define SYS_DIR_LV1  "hugepages-2048kB/"
+#define SYS_DIR_LV2  "hugepages-1048576kB/"
 #define SYS_NR_HUGEPAGES  "nr_hugepages"
 #define SYS_FREE_HUGEPAGES  "free_hugepages"
 
+/* a pool directory leaves room for the longest file name appended to it */
+#define MAX_DIR_LEN  (MAX_PATH_LEN - sizeof(SYS_FREE_HUGEPAGES))
+
 /* File used for lock between different processes access to hugetlbfs.
  * We observed when access hugetlbfs from different process to allocate
  * huge page at the same time could fail. So use file lock here to make
@@ -82,6 +103,7 @@ extern char *vmname;
  * - highmem: highmem of this hugetlbfs need allocate
  *.- pages_delta: its value equals needed pages - free pages,
  *.---if > 0: it's the gap for needed page; if < 0, more free than needed.
+ * - sys_dir: sys directory of this page size, in the global or node pool
  * - nr_pages_path: sys path for total number of pages
  *.- free_pages_path: sys path for number of free pages
  */
@@ -98,8 +120,9 @@ struct hugetlb_info {
 	size_t highmem;
 
 	int pages_delta;
-	char *nr_pages_path;
-	char *free_pages_path;
+	char *sys_dir;
+	char nr_pages_path[MAX_PATH_LEN];
+	char free_pages_path[MAX_PATH_LEN];
 };
 
 static struct hugetlb_info hugetlb_priv[HUGETLB_LV_MAX] = {
@@ -114,8 +137,7 @@ static struct hugetlb_info hugetlb_priv[HUGETLB_LV_MAX] = {
 		.highmem = 0,
 
 		.pages_delta = 0,
-		.nr_pages_path = SYS_PATH_LV1 SYS_NR_HUGEPAGES,
-		.free_pages_path = SYS_PATH_LV1 SYS_FREE_HUGEPAGES,
+		.sys_dir = SYS_DIR_LV1,
 	},
 	{
 		.mounted = false,
@@ -128,8 +150,7 @@ static struct hugetlb_info hugetlb_priv[HUGETLB_LV_MAX] = {
 		.highmem = 0,
 
 		.pages_delta = 0,
-		.nr_pages_path = SYS_PATH_LV2 SYS_NR_HUGEPAGES,
-		.free_pages_path = SYS_PATH_LV2 SYS_FREE_HUGEPAGES,
+		.sys_dir = SYS_DIR_LV2,
 	},
 };
 
@@ -138,6 +159,61 @@ static size_t total_size;
 static int hugetlb_lv_max;
 static int lock_fd;
 
+/* lowmem, highmem and biosmem may each be split over all levels */
+#define HUGETLB_MAX_REGIONS	(3 * HUGETLB_LV_MAX)
+static struct vm_mem_region hugetlb_regions[HUGETLB_MAX_REGIONS];
+static int hugetlb_nregions;
+
+/*
+ * NUMA node of the pCPUs running the VM, the huge pages are reserved from
+ * and the guest memory is bound to that node. -1 if the VM spans nodes or
+ * it is unknown.
+ */
+static int hugetlb_node = -1;
+
+/* guest memory is pre-faulted by up to that many threads */
+#define HUGETLB_PREFAULT_THREADS	8
+/* and each of them touches at least that much */
+#define HUGETLB_PREFAULT_MIN_SIZE	(512 * MB)
+
+struct prefault_arg {
+	char *addr;
+	size_t len;
+	size_t pg_size;
+};
+
+/*
+ * Guest memory given back to the host, one bit per HUGETLB_RECLAIM_SIZE
+ * block of [0, total_size). The lock also keeps a block from being mapped
+ * back while its pages are being freed.
+ */
+static uint64_t *reclaimed_blocks;
+static pthread_mutex_t reclaim_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Guest memory backed by a read-only file of the shared hugetlbfs, which the
+ * VMs loading the same image map too. vm_shared_blocks are the blocks whose
+ * content still is the file's, they are copied back to the guest memory
+ * when the guest memory is restored, on the first write of the guest to
+ * them or the first time a device maps them.
+ */
+#define MAX_SHARED_MEM		4
+
+struct shared_mem {
+	vm_paddr_t gpa;
+	size_t len;
+	char *addr;
+	int fd;
+	char name[64];
+};
+
+static struct shared_mem shared_mem[MAX_SHARED_MEM];
+static int nr_shared_mem;
+uint64_t *vm_shared_blocks;
+
+static void copy_shared_blocks(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+static void unshare_memory(void);
+
 static int lock_acrn_hugetlb(void)
 {
 	int ret;
@@ -256,18 +332,96 @@ static bool should_enable_hugetlb_level(int level)
 	        hugetlb_priv[level].highmem > 0);
 }
 
+static void *prefault_thread(void *param)
+{
+	struct prefault_arg *arg = param;
+	char *addr = arg->addr;
+	size_t i;
+
+	for (i = 0; i < arg->len / arg->pg_size; i++) {
+		*(volatile char *)addr = *addr;
+		addr += arg->pg_size;
+	}
+
+	return NULL;
+}
+
+/*
+ * Pre-allocate the hugepages by touching them. Zeroing a huge page on the
+ * first touch is what takes time, so the region is split between several
+ * threads; the pages are still allocated from the VMA policy.
+ */
+static void prefault_memory(char *addr, size_t len, size_t pg_size)
+{
+	struct prefault_arg args[HUGETLB_PREFAULT_THREADS];
+	pthread_t tids[HUGETLB_PREFAULT_THREADS];
+	size_t npages, chunk;
+	long ncpus;
+	int i, nthreads, started;
+
+	npages = len / pg_size;
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = len / HUGETLB_PREFAULT_MIN_SIZE;
+	if (nthreads > HUGETLB_PREFAULT_THREADS)
+		nthreads = HUGETLB_PREFAULT_THREADS;
+	if (nthreads > ncpus)
+		nthreads = ncpus;
+	if (nthreads > npages)
+		nthreads = npages;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	pr_info("touch %ld pages with pagesz 0x%lx by %d threads\n",
+		npages, pg_size, nthreads);
+
+	chunk = (npages + nthreads - 1) / nthreads;
+	for (i = 0, started = 0; i < nthreads; i++) {
+		args[i].addr = addr + i * chunk * pg_size;
+		args[i].pg_size = pg_size;
+		args[i].len = (npages - i * chunk < chunk ?
+			npages - i * chunk : chunk) * pg_size;
+
+		/* the last chunk is done by this thread */
+		if (i == nthreads - 1 ||
+		    pthread_create(&tids[i], NULL, prefault_thread, &args[i]))
+			prefault_thread(&args[i]);
+		else
+			started |= 1 << i;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (started & (1 << i))
+			pthread_join(tids[i], NULL);
+	}
+}
+
+/* bind the pages of a mapping to a NUMA node, nothing if node < 0 */
+static void bind_memory(void *addr, size_t len, int node)
+{
+	unsigned long nodemask[4] = { 0 };
+
+	if (node < 0 || (size_t)node >= sizeof(nodemask) * 8)
+		return;
+
+	nodemask[node / 64] = 1UL << (node % 64);
+	if (syscall(SYS_mbind, addr, len, MPOL_BIND, nodemask,
+		    sizeof(nodemask) * 8, 0) < 0)
+		pr_warn("bind memory to node %d failed with errno: %d\n",
+			node, errno);
+}
+
 /*
  * level  : hugepage level
  * len	  : region length for mmap
  * offset : region start offset from ctx->baseaddr
  * skip   : skip offset in different level hugetlbfs fd
+ * prefault: allocate the hugepages now rather than on first access
  */
 static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
-		size_t offset, size_t skip)
+		size_t offset, size_t skip, bool prefault)
 {
 	char *addr;
-	size_t pagesz = 0;
-	int fd, i;
+	int fd;
 
 	if (level >= HUGETLB_LV_MAX) {
 		pr_err("exceed max hugetlb level");
@@ -282,22 +436,28 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 
 	pr_info("mmap 0x%lx@%p\n", len, addr);
 
-	/* pre-allocate hugepages by touch them */
-	pagesz = hugetlb_priv[level].pg_size;
-
-	pr_info("touch %ld pages with pagesz 0x%lx\n", len/pagesz, pagesz);
-
-	for (i = 0; i < len/pagesz; i++) {
-		*(volatile char *)addr = *addr;
-		addr += pagesz;
+	if (hugetlb_nregions < HUGETLB_MAX_REGIONS) {
+		hugetlb_regions[hugetlb_nregions].gpa = offset;
+		hugetlb_regions[hugetlb_nregions].len = len;
+		hugetlb_regions[hugetlb_nregions].hva = addr;
+		hugetlb_regions[hugetlb_nregions].fd = fd;
+		hugetlb_regions[hugetlb_nregions].fd_offset = skip;
+		hugetlb_regions[hugetlb_nregions].pg_size =
+			hugetlb_priv[level].pg_size;
+		hugetlb_nregions++;
 	}
 
+	bind_memory(addr, len, hugetlb_node);
+	if (prefault)
+		prefault_memory(addr, len, hugetlb_priv[level].pg_size);
+
 	return 0;
 }
 
 static int mmap_hugetlbfs(struct vmctx *ctx, size_t offset,
 		void (*get_param)(struct hugetlb_info *, size_t *, size_t *),
-		size_t (*adj_param)(struct hugetlb_info *, struct hugetlb_info *, int))
+		size_t (*adj_param)(struct hugetlb_info *, struct hugetlb_info *, int),
+		bool prefault)
 {
 	size_t len, skip;
 	int level, ret = 0, pg_size;
@@ -307,7 +467,8 @@ static int mmap_hugetlbfs(struct vmctx *ctx, size_t offset,
 		pg_size = hugetlb_priv[level].pg_size;
 
 		while (len > 0) {
-			ret = mmap_hugetlbfs_from_level(ctx, level, len, offset, skip);
+			ret = mmap_hugetlbfs_from_level(ctx, level, len, offset, skip,
+					prefault);
 
 			if (ret < 0 && level > HUGETLB_LV1) {
 				len = adj_param(
@@ -491,6 +652,111 @@ static int read_sys_info(const char *sys_path)
 	return pages;
 }
 
+static int write_sys_info(const char *sys_path, int pages)
+{
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen(sys_path, "w");
+	if (fp == NULL) {
+		pr_err("can't open: %s, err: %s\n", sys_path, strerror(errno));
+		return -1;
+	}
+
+	/* the kernel allocates or frees the pages when the file is written */
+	if (fprintf(fp, "%d", pages) < 0 || fflush(fp) != 0) {
+		pr_err("write %d to %s, error: %s\n",
+			pages, sys_path, strerror(errno));
+		ret = -1;
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+/* use the huge page pool of the NUMA node, or the global one if node < 0 */
+static void set_sys_paths(int node)
+{
+	char dir[MAX_DIR_LEN];
+	int level;
+
+	for (level = HUGETLB_LV1; level < HUGETLB_LV_MAX; level++) {
+		if (node < 0)
+			snprintf(dir, MAX_DIR_LEN, "%s%s", SYS_PATH_HUGEPAGES,
+				hugetlb_priv[level].sys_dir);
+		else
+			snprintf(dir, MAX_DIR_LEN, "%snode%d/hugepages/%s",
+				SYS_PATH_NODE, node, hugetlb_priv[level].sys_dir);
+
+		snprintf(hugetlb_priv[level].nr_pages_path, MAX_PATH_LEN,
+			"%s%s", dir, SYS_NR_HUGEPAGES);
+		snprintf(hugetlb_priv[level].free_pages_path, MAX_PATH_LEN,
+			"%s%s", dir, SYS_FREE_HUGEPAGES);
+	}
+
+	hugetlb_node = node;
+}
+
+static int get_cpu_node(int cpu)
+{
+	char path[MAX_PATH_LEN];
+	struct dirent *entry;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, MAX_PATH_LEN, "%scpu%d/", SYS_PATH_CPU, cpu);
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (sscanf(entry->d_name, "node%d", &node) == 1)
+			break;
+	}
+
+	closedir(dir);
+	return node;
+}
+
+/*
+ * Find the NUMA node of the pCPUs the VM runs on, taken the same way as
+ * for the MADT. The pCPUs offlined from the SOS for the VM keep their
+ * sysfs node link.
+ */
+static int hugetlb_find_node(struct vmctx *ctx)
+{
+	struct acrn_vm_config vm_cfg;
+	struct platform_info plat_info;
+	uint64_t dm_cpu_bitmask, cpu_bitmask;
+	int cpu, node = -1, cpu_node;
+
+	if (vm_get_config(ctx, &vm_cfg, &plat_info))
+		return -1;
+
+	dm_cpu_bitmask = vm_get_cpu_affinity_dm();
+	if ((dm_cpu_bitmask != 0) &&
+	    ((dm_cpu_bitmask & ~vm_cfg.cpu_affinity) == 0))
+		cpu_bitmask = dm_cpu_bitmask;
+	else
+		cpu_bitmask = vm_cfg.cpu_affinity;
+
+	for (cpu = 0; cpu < 64; cpu++) {
+		if ((cpu_bitmask & (1UL << cpu)) == 0)
+			continue;
+
+		cpu_node = get_cpu_node(cpu);
+		if (cpu_node < 0 || (node >= 0 && cpu_node != node))
+			return -1;
+		node = cpu_node;
+	}
+
+	/* nothing to choose from on a single node platform */
+	if (node >= 256 || access(SYS_PATH_NODE "node1", F_OK) != 0)
+		return -1;
+
+	return node;
+}
+
 /* check if enough free huge pages for the UOS */
 static bool hugetlb_check_memgap(void)
 {
@@ -518,57 +784,50 @@ static bool hugetlb_check_memgap(void)
 static void reserve_more_pages(int level)
 {
 	int total_pages, orig_pages, cur_pages;
-	char cmd_buf[MAX_PATH_LEN];
-	FILE *fp;
 
 	orig_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
 	total_pages = orig_pages + hugetlb_priv[level].pages_delta;
-	snprintf(cmd_buf, MAX_PATH_LEN, "echo %d > %s",
-		total_pages, hugetlb_priv[level].nr_pages_path);
 
-	/* system cmd to reserve needed huge pages */
-	fp = popen(cmd_buf, "r");
-	if (fp == NULL) {
-		pr_err("cmd: %s failed!\n", cmd_buf);
+	pr_info("to reserve pages (+orig %d): %d in %s\n", orig_pages,
+		total_pages, hugetlb_priv[level].nr_pages_path);
+	if (write_sys_info(hugetlb_priv[level].nr_pages_path, total_pages) < 0)
 		return;
-	}
-	pclose(fp);
 
-	pr_info("to reserve pages (+orig %d): %s\n", orig_pages, cmd_buf);
 	cur_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
 	hugetlb_priv[level].pages_delta = total_pages - cur_pages;
 }
 
-/* try to release larger free page */
+/* try to release larger free pages for the gap of level_limit - 1 */
 static bool release_larger_freepage(int level_limit)
 {
-	int level;
+	int level, nr_free;
 	int total_pages, orig_pages, cur_pages;
-	char cmd_buf[MAX_PATH_LEN];
-	FILE *fp;
+	size_t gap_size;
+
+	gap_size = (size_t)hugetlb_priv[level_limit - 1].pages_delta *
+		hugetlb_priv[level_limit - 1].pg_size;
 
 	for (level = hugetlb_lv_max - 1; level >= level_limit; level--) {
 		if (hugetlb_priv[level].pages_delta >= 0)
 			continue;
 
-		/* free one unsed larger page */
-		orig_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
-		total_pages = orig_pages - 1;
-		snprintf(cmd_buf, MAX_PATH_LEN, "echo %d > %s",
-			total_pages, hugetlb_priv[level].nr_pages_path);
+		/* free the unused larger pages covering the gap at once */
+		nr_free = (gap_size + hugetlb_priv[level].pg_size - 1) /
+			hugetlb_priv[level].pg_size;
+		if (nr_free > -hugetlb_priv[level].pages_delta)
+			nr_free = -hugetlb_priv[level].pages_delta;
 
-		fp = popen(cmd_buf, "r");
-		if (fp == NULL) {
-			pr_err("cmd to free mem: %s failed!\n", cmd_buf);
+		orig_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
+		total_pages = orig_pages - nr_free;
+		if (write_sys_info(hugetlb_priv[level].nr_pages_path,
+				total_pages) < 0)
 			return false;
-		}
-		pclose(fp);
 
 		cur_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
 
 		/* release page successfully */
 		if (cur_pages < orig_pages) {
-			hugetlb_priv[level].pages_delta++;
+			hugetlb_priv[level].pages_delta += orig_pages - cur_pages;
 			break;
 		}
 	}
@@ -684,6 +943,181 @@ void uninit_hugetlb(void)
 	close(lock_fd);
 }
 
+/*
+ * Open a file of the shared hugetlbfs, mounting it first if needed.
+ * Return the file descriptor, or -1 with errno set.
+ */
+int hugetlb_open_shared(const char *name, int flags)
+{
+	char path[MAX_PATH_LEN];
+	struct statfs fs;
+	int err = 0;
+
+	if (strchr(name, '/') != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	lock_acrn_hugetlb();
+	if (mkdir(PATH_HUGETLB_SHARED, 0755) < 0 && errno != EEXIST)
+		err = errno;
+	else if (statfs(PATH_HUGETLB_SHARED, &fs) < 0)
+		err = errno;
+	else if (fs.f_type != HUGETLBFS_MAGIC &&
+		 mount("none", PATH_HUGETLB_SHARED, "hugetlbfs", 0,
+		       OPT_HUGETLB_LV1) < 0)
+		err = errno;
+	unlock_acrn_hugetlb();
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	snprintf(path, MAX_PATH_LEN, "%s%s", PATH_HUGETLB_SHARED, name);
+	return open(path, flags, 0600);
+}
+
+int hugetlb_unlink_shared(const char *name)
+{
+	char path[MAX_PATH_LEN];
+
+	snprintf(path, MAX_PATH_LEN, "%s%s", PATH_HUGETLB_SHARED, name);
+	return unlink(path);
+}
+
+/* grow the 2M pool of the node, or the global one if node < 0, to have pages free */
+static bool reserve_shared_pages(int node, int pages)
+{
+	char dir[MAX_DIR_LEN], path[MAX_PATH_LEN];
+	int free_pages;
+
+	if (node < 0)
+		snprintf(dir, MAX_DIR_LEN, "%s%s", SYS_PATH_HUGEPAGES,
+			SYS_DIR_LV1);
+	else
+		snprintf(dir, MAX_DIR_LEN, "%snode%d/hugepages/%s",
+			SYS_PATH_NODE, node, SYS_DIR_LV1);
+
+	snprintf(path, MAX_PATH_LEN, "%s%s", dir, SYS_FREE_HUGEPAGES);
+	free_pages = read_sys_info(path);
+	if (free_pages >= pages)
+		return true;
+
+	snprintf(path, MAX_PATH_LEN, "%s%s", dir, SYS_NR_HUGEPAGES);
+	pr_info("to reserve %d more pages in %s\n", pages - free_pages, path);
+	if (write_sys_info(path, read_sys_info(path) + pages - free_pages) < 0)
+		return false;
+
+	snprintf(path, MAX_PATH_LEN, "%s%s", dir, SYS_FREE_HUGEPAGES);
+	return read_sys_info(path) >= pages;
+}
+
+/*
+ * Map len bytes of a file of the shared hugetlbfs. Its creator reserves the
+ * pages on the node, or on the node of the VM if node < 0, binds them to that
+ * node and allocates them at once, before the region is mapped into a guest.
+ * If the node runs short of pages, they come from any node.
+ */
+void *hugetlb_map_shared(int fd, size_t len, int node, bool creator)
+{
+	void *addr;
+	int pages = len / (2 * MB);
+
+	if (node < 0)
+		node = hugetlb_node;
+
+	if (creator) {
+		lock_acrn_hugetlb();
+		if (node >= 0 && !reserve_shared_pages(node, pages)) {
+			pr_warn("not enough memory on node %d, shared memory not bound\n",
+				node);
+			node = -1;
+		}
+		if (node < 0 && !reserve_shared_pages(-1, pages))
+			pr_warn("not enough huge pages for the shared memory\n");
+		unlock_acrn_hugetlb();
+	}
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	if (creator) {
+		bind_memory(addr, len, node);
+		prefault_memory(addr, len, 2 * MB);
+	}
+
+	return addr;
+}
+
+static bool alloc_blocks(uint64_t **blocks)
+{
+	if (*blocks == NULL)
+		*blocks = calloc(total_size / HUGETLB_RECLAIM_SIZE / 64 + 1,
+				sizeof(uint64_t));
+
+	return *blocks != NULL;
+}
+
+static bool alloc_reclaimed_blocks(void)
+{
+	return alloc_blocks(&reclaimed_blocks);
+}
+
+static void
+set_blocks(uint64_t *blocks, vm_paddr_t gpa, size_t len, bool set)
+{
+	uint64_t block;
+
+	for (block = gpa / HUGETLB_RECLAIM_SIZE;
+			block < (gpa + len) / HUGETLB_RECLAIM_SIZE; block++) {
+		if (set)
+			blocks[block / 64] |= 1UL << (block % 64);
+		else
+			blocks[block / 64] &= ~(1UL << (block % 64));
+	}
+}
+
+static bool
+test_block(uint64_t *blocks, vm_paddr_t gpa)
+{
+	uint64_t block = gpa / HUGETLB_RECLAIM_SIZE;
+
+	return blocks && gpa < total_size &&
+		(blocks[block / 64] & (1UL << (block % 64)));
+}
+
+static void
+set_reclaimed(vm_paddr_t gpa, size_t len, bool reclaimed)
+{
+	set_blocks(reclaimed_blocks, gpa, len, reclaimed);
+}
+
+/*
+ * Map the guest RAM [gpa, gpa + len) in the EPT. With lazy_mem it's only
+ * recorded as reclaimed instead, the hugepages are then allocated and mapped
+ * block by block as the guest touches them, like reclaimed memory.
+ */
+static int map_ram(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	if (lazy_mem) {
+		if (alloc_reclaimed_blocks() &&
+				vm_unpopulate_memory(ctx, gpa, len) == 0) {
+			set_reclaimed(gpa, len, true);
+			return 0;
+		}
+
+		/* e.g. beyond what the hypervisor can track, populate it now */
+		pr_warn("0x%lx@0x%lx can't be populated on demand\n", len, gpa);
+		prefault_memory(ctx->baseaddr + gpa, len,
+				hugetlb_priv[HUGETLB_LV1].pg_size);
+	}
+
+	return vm_map_memseg_vma(ctx, len, gpa, (uint64_t)(ctx->baseaddr + gpa),
+			PROT_ALL);
+}
+
 int hugetlb_setup_memory(struct vmctx *ctx)
 {
 	int level;
@@ -695,6 +1129,8 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		goto err;
 	}
 
+	hugetlb_nregions = 0;
+
 	/* open hugetlbfs and get pagesize for two level */
 	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
 		if (open_hugetlbfs(ctx, level) < 0) {
@@ -737,12 +1173,23 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		}
 	}
 
+	/* reserve the pages from the node local to the VM first */
+	set_sys_paths(hugetlb_find_node(ctx));
+	if (hugetlb_node >= 0)
+		pr_info("bind guest memory to node %d\n", hugetlb_node);
+
 	lock_acrn_hugetlb();
 
 	/* it will check each level memory need */
 	has_gap = hugetlb_check_memgap();
-	if (has_gap) {
-		if (!hugetlb_reserve_pages())
+	if (has_gap && !hugetlb_reserve_pages()) {
+		if (hugetlb_node < 0)
+			goto err_lock;
+
+		pr_warn("not enough memory on node %d, guest memory not bound\n",
+			hugetlb_node);
+		set_sys_paths(-1);
+		if (hugetlb_check_memgap() && !hugetlb_reserve_pages())
 			goto err_lock;
 	}
 
@@ -784,21 +1231,22 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	pr_info("mmap ptr 0x%p -> baseaddr 0x%p\n", ptr, ctx->baseaddr);
 
 	/* mmap lowmem */
-	if (mmap_hugetlbfs(ctx, 0, get_lowmem_param, adj_lowmem_param) < 0) {
+	if (mmap_hugetlbfs(ctx, 0, get_lowmem_param, adj_lowmem_param,
+				!lazy_mem) < 0) {
 		pr_err("lowmem mmap failed");
 		goto err_lock;
 	}
 
 	/* mmap highmem */
 	if (mmap_hugetlbfs(ctx, ctx->highmem_gpa_base,
-				get_highmem_param, adj_highmem_param) < 0) {
+				get_highmem_param, adj_highmem_param, !lazy_mem) < 0) {
 		pr_err("highmem mmap failed");
 		goto err_lock;
 	}
 
 	/* mmap biosmem */
 	if (mmap_hugetlbfs(ctx, 4 * GB - ctx->biosmem,
-				get_biosmem_param, adj_biosmem_param) < 0) {
+				get_biosmem_param, adj_biosmem_param, true) < 0) {
 		pr_err("biosmem mmap failed");
 		goto err_lock;
 	}
@@ -816,8 +1264,7 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	}
 
 	/* map ept for lowmem */
-	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
-		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
+	if (map_ram(ctx, 0, ctx->lowmem) < 0)
 		goto err;
 
 	/* map ept for biosmem */
@@ -835,9 +1282,7 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 
 	/* map ept for highmem */
 	if (ctx->highmem > 0) {
-		if (vm_map_memseg_vma(ctx, ctx->highmem, ctx->highmem_gpa_base,
-			(uint64_t)(ctx->baseaddr + ctx->highmem_gpa_base),
-			PROT_ALL) < 0)
+		if (map_ram(ctx, ctx->highmem_gpa_base, ctx->highmem) < 0)
 			goto err;
 	}
 
@@ -866,8 +1311,340 @@ void hugetlb_unsetup_memory(struct vmctx *ctx)
 		total_size = 0;
 		ptr = NULL;
 	}
+	hugetlb_nregions = 0;
+
+	free(reclaimed_blocks);
+	reclaimed_blocks = NULL;
+	unshare_memory();
 
 	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
 		close_hugetlbfs(level);
 	}
 }
+
+/*
+ * Report the hugetlbfs mappings backing the guest memory, so that the
+ * memory can be shared with another process (e.g. a vhost-user backend)
+ * by passing the fds. Returns the number of regions filled in.
+ */
+int hugetlb_get_mem_regions(struct vm_mem_region *regions, int max)
+{
+	int i;
+
+	for (i = 0; i < hugetlb_nregions && i < max; i++)
+		regions[i] = hugetlb_regions[i];
+
+	return i;
+}
+
+static struct vm_mem_region *
+find_mem_region(vm_paddr_t gpa, size_t len)
+{
+	int i;
+
+	if (len == 0 || (gpa % HUGETLB_RECLAIM_SIZE) ||
+			(len % HUGETLB_RECLAIM_SIZE))
+		return NULL;
+
+	for (i = 0; i < hugetlb_nregions; i++) {
+		if (gpa >= hugetlb_regions[i].gpa && gpa + len <=
+				hugetlb_regions[i].gpa + hugetlb_regions[i].len)
+			return &hugetlb_regions[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Give the huge pages backing [gpa, gpa + len) back to the host. They are
+ * unmapped from the guest first, the guest faults them in again the next
+ * time it touches them. A huge page can only be freed as a whole, so the
+ * memory backed by 1G pages can't be given back in 2M blocks.
+ */
+int
+hugetlb_reclaim_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct vm_mem_region *region;
+	int error = -1;
+
+	region = find_mem_region(gpa, len);
+	if (region == NULL || ((gpa - region->gpa) % region->pg_size) ||
+			(len % region->pg_size))
+		return -1;
+
+	pthread_mutex_lock(&reclaim_mtx);
+	if (alloc_reclaimed_blocks() && vm_reclaim_memory(ctx, gpa, len) == 0) {
+		set_reclaimed(gpa, len, true);
+		error = fallocate(region->fd,
+				FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				region->fd_offset + (gpa - region->gpa), len);
+		if (error)
+			pr_err("%s: failed to free 0x%lx@0x%lx: %s\n",
+				__func__, len, gpa, strerror(errno));
+	}
+	pthread_mutex_unlock(&reclaim_mtx);
+
+	return error;
+}
+
+/*
+ * Allocate huge pages for the reclaimed memory of [gpa, gpa + len) and map
+ * them to the guest. The blocks which are not reclaimed are left as is.
+ */
+int
+hugetlb_restore_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct vm_mem_region *region;
+	int error;
+
+	region = find_mem_region(gpa, len);
+	if (region == NULL)
+		return -1;
+
+	pthread_mutex_lock(&reclaim_mtx);
+	/* fail here rather than with a SIGBUS once the pool is exhausted */
+	error = fallocate(region->fd, FALLOC_FL_KEEP_SIZE,
+			region->fd_offset + (gpa - region->gpa), len);
+	if (error)
+		pr_err("%s: failed to allocate 0x%lx@0x%lx: %s\n",
+			__func__, len, gpa, strerror(errno));
+	else {
+		copy_shared_blocks(ctx, gpa, len);
+		error = vm_restore_memory(ctx, gpa, len);
+	}
+
+	if (!error && reclaimed_blocks)
+		set_reclaimed(gpa, len, false);
+	if (!error && vm_shared_blocks)
+		set_blocks(vm_shared_blocks, gpa, len, false);
+	pthread_mutex_unlock(&reclaim_mtx);
+
+	return error;
+}
+
+bool
+hugetlb_is_reclaimed(vm_paddr_t gpa)
+{
+	/* unlocked, it's for walking the memory of a VM which doesn't run */
+	return test_block(reclaimed_blocks, gpa);
+}
+
+static struct shared_mem *
+find_shared_mem(vm_paddr_t gpa)
+{
+	int i;
+
+	for (i = 0; i < nr_shared_mem; i++) {
+		if (gpa >= shared_mem[i].gpa &&
+				gpa < shared_mem[i].gpa + shared_mem[i].len)
+			return &shared_mem[i];
+	}
+
+	return NULL;
+}
+
+/* Return the shared copy of the block of gpa, NULL if it isn't shared. */
+void *
+hugetlb_shared_hva(vm_paddr_t gpa)
+{
+	struct shared_mem *sm;
+
+	if (!test_block(vm_shared_blocks, gpa))
+		return NULL;
+
+	sm = find_shared_mem(gpa);
+	return sm ? sm->addr + ALIGN_DOWN(gpa - sm->gpa, HUGETLB_RECLAIM_SIZE) :
+		NULL;
+}
+
+/* called with reclaim_mtx held, the pages of [gpa, gpa + len) allocated */
+static void
+copy_shared_blocks(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	vm_paddr_t addr;
+	char *src;
+
+	for (addr = gpa; addr < gpa + len; addr += HUGETLB_RECLAIM_SIZE) {
+		src = hugetlb_shared_hva(addr);
+		if (src)
+			memcpy(ctx->baseaddr + addr, src, HUGETLB_RECLAIM_SIZE);
+	}
+}
+
+/*
+ * Give the devices a private copy of the shared blocks of [gpa, gpa + len)
+ * before they access them: their pages were given back, a read would find
+ * a zeroed page and a write would be lost when the block is copied back.
+ */
+int
+hugetlb_unshare_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	vm_paddr_t block;
+	int error = 0;
+
+	/* unlocked, the blocks are only shared before the VM starts */
+	for (block = ALIGN_DOWN(gpa, HUGETLB_RECLAIM_SIZE);
+			!error && block < gpa + len;
+			block += HUGETLB_RECLAIM_SIZE) {
+		if (test_block(vm_shared_blocks, block))
+			error = hugetlb_restore_memory(ctx, block,
+					HUGETLB_RECLAIM_SIZE);
+	}
+
+	return error;
+}
+
+static void
+release_shared_mem(struct shared_mem *sm)
+{
+	munmap(sm->addr, sm->len);
+	/* the last VM using the image removes it */
+	if (flock(sm->fd, LOCK_EX | LOCK_NB) == 0)
+		hugetlb_unlink_shared(sm->name);
+	close(sm->fd);
+}
+
+static void
+unshare_memory(void)
+{
+	int i;
+
+	for (i = 0; i < nr_shared_mem; i++)
+		release_shared_mem(&shared_mem[i]);
+	nr_shared_mem = 0;
+
+	free(vm_shared_blocks);
+	vm_shared_blocks = NULL;
+}
+
+static uint64_t
+hash_memory(const char *addr, size_t len)
+{
+	const uint64_t *p = (const uint64_t *)addr;
+	uint64_t hash = 0xcbf29ce484222325UL;	/* FNV-1a, on 64-bit words */
+	size_t i;
+
+	for (i = 0; i < len / sizeof(uint64_t); i++)
+		hash = (hash ^ p[i]) * 0x100000001b3UL;
+
+	return hash;
+}
+
+/*
+ * Map the file of the shared hugetlbfs holding the image src, creating it
+ * if no other VM did. An image is only found under its name once complete.
+ * The file is locked shared for as long as it's used.
+ */
+static char *
+map_shared_image(const char *name, const char *src, size_t len, int *pfd)
+{
+	char tmp[64], path[MAX_PATH_LEN], tmp_path[MAX_PATH_LEN];
+	struct stat st;
+	char *addr = NULL;
+	int fd;
+
+	fd = hugetlb_open_shared(name, O_RDWR);
+	if (fd >= 0) {
+		if (fstat(fd, &st) == 0 && st.st_size == len)
+			addr = hugetlb_map_shared(fd, len, -1, false);
+		/* the name is a hash, the content must match too */
+		if (addr && memcmp(addr, src, len) != 0) {
+			munmap(addr, len);
+			addr = NULL;
+		}
+		if (addr == NULL || flock(fd, LOCK_SH) < 0)
+			goto fail;
+		*pfd = fd;
+		return addr;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", name, getpid());
+	fd = hugetlb_open_shared(tmp, O_CREAT | O_EXCL | O_RDWR);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, len) == 0)
+		addr = hugetlb_map_shared(fd, len, -1, true);
+	if (addr == NULL)
+		goto fail_tmp;
+
+	memcpy(addr, src, len);
+	snprintf(path, MAX_PATH_LEN, "%s%s", PATH_HUGETLB_SHARED, name);
+	snprintf(tmp_path, MAX_PATH_LEN, "%s%s", PATH_HUGETLB_SHARED, tmp);
+	if (flock(fd, LOCK_SH) < 0 || rename(tmp_path, path) < 0)
+		goto fail_tmp;
+
+	*pfd = fd;
+	return addr;
+
+fail_tmp:
+	hugetlb_unlink_shared(tmp);
+fail:
+	if (addr)
+		munmap(addr, len);
+	close(fd);
+	return NULL;
+}
+
+/*
+ * Back the guest memory [gpa, gpa + len), an image loaded by the DM, with a
+ * read-only copy shared by all the VMs loading the same image, and give its
+ * own pages back to the host. The first write to a block maps a private
+ * copy of it back. Only the 2M blocks fully in the range are shared.
+ */
+int
+hugetlb_share_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct vm_mem_region *region;
+	struct shared_mem *sm;
+	vm_paddr_t start, end;
+
+	start = roundup2(gpa, HUGETLB_RECLAIM_SIZE);
+	end = ALIGN_DOWN(gpa + len, HUGETLB_RECLAIM_SIZE);
+	if (end <= start)
+		return 0;
+	len = end - start;
+
+	region = find_mem_region(start, len);
+	if (region == NULL || ((start - region->gpa) % region->pg_size) ||
+			(len % region->pg_size))
+		return -1;
+
+	/* reloaded on a reset, the image is still shared */
+	if (find_shared_mem(start) || find_shared_mem(end - 1))
+		return 0;
+
+	if (nr_shared_mem >= MAX_SHARED_MEM || !alloc_blocks(&vm_shared_blocks))
+		return -1;
+
+	sm = &shared_mem[nr_shared_mem];
+	snprintf(sm->name, sizeof(sm->name), "image_%016lx_%lx",
+		hash_memory(ctx->baseaddr + start, len), len);
+	sm->addr = map_shared_image(sm->name, ctx->baseaddr + start, len,
+			&sm->fd);
+	if (sm->addr == NULL) {
+		pr_warn("%s: can't share 0x%lx@0x%lx: %s\n", __func__, len,
+			start, strerror(errno));
+		return -1;
+	}
+	sm->gpa = start;
+	sm->len = len;
+	nr_shared_mem++;
+
+	/* from now on, restoring a block copies the shared content back */
+	set_blocks(vm_shared_blocks, start, len, true);
+	if (hugetlb_reclaim_memory(ctx, start, len) != 0 ||
+			vm_share_memory(ctx, start, sm->addr, len) != 0) {
+		pr_warn("%s: failed to share 0x%lx@0x%lx\n", __func__, len,
+			start);
+		/* copy the image back while it is still mapped, then drop it */
+		hugetlb_restore_memory(ctx, start, len);
+		set_blocks(vm_shared_blocks, start, len, false);
+		release_shared_mem(sm);
+		nr_shared_mem--;
+		return -1;
+	}
+
+	pr_info("0x%lx@0x%lx shared as %s\n", len, start, sm->name);
+	return 0;
+}
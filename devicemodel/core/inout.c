@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "inout.h"
 #include "log.h"
@@ -38,12 +39,29 @@ SET_DECLARE(inout_port_set, struct inout_port);
 #define	VERIFY_IOPORT(port, size) \
 	((port) >= 0 && (size) > 0 && ((port) + (size)) <= MAX_IOPORTS)
 
-static struct {
-	const char	*name;
-	int		flags;
+/*
+ * Each port holds the 16-bit index of the descriptor of its handler, so the
+ * whole table fits in 128KB and the ports of a device share one descriptor.
+ * A descriptor is never changed once published, and a registration with the
+ * same handler, argument and flags reuses it, so a lookup racing with a
+ * registration always reads a consistent descriptor.
+ */
+#define	INOUT_DESC_MAX		1024
+#define	INOUT_DESC_DEFAULT	0
+
+struct inout_desc {
 	inout_func_t	handler;
 	void		*arg;
-} inout_handlers[MAX_IOPORTS];
+	int		flags;
+	const char	*name;
+};
+
+static struct inout_desc inout_descs[INOUT_DESC_MAX];
+static int inout_ndescs;
+static pthread_mutex_t inout_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint16_t inout_handlers[MAX_IOPORTS];
+static uint32_t inout_hits[MAX_IOPORTS];
 
 static int
 default_inout(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
@@ -66,6 +84,49 @@ default_inout(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	return 0;
 }
 
+/*
+ * Find or add the descriptor of a registration, -1 if the table is full.
+ * Called with inout_mtx held.
+ */
+static int
+inout_desc_get(const char *name, int flags, inout_func_t handler, void *arg)
+{
+	struct inout_desc *desc;
+	int i;
+
+	for (i = 0; i < inout_ndescs; i++) {
+		desc = &inout_descs[i];
+		if (desc->handler == handler && desc->arg == arg &&
+		    desc->flags == flags && desc->name == name)
+			return i;
+	}
+
+	if (inout_ndescs == INOUT_DESC_MAX) {
+		pr_err("%s: too many i/o handlers, %s not registered\n",
+				__func__, name);
+		return -1;
+	}
+
+	desc = &inout_descs[inout_ndescs];
+	desc->name = name;
+	desc->flags = flags;
+	desc->handler = handler;
+	desc->arg = arg;
+
+	return inout_ndescs++;
+}
+
+static void
+inout_set_range(int start, int size, int idx)
+{
+	int i;
+
+	for (i = start; i < start + size; i++) {
+		__atomic_store_n(&inout_handlers[i], idx, __ATOMIC_RELEASE);
+		inout_hits[i] = 0;
+	}
+}
+
 static void
 register_default_iohandler(int start, int size)
 {
@@ -94,6 +155,8 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 	void *arg;
 	int retval;
 
+	struct inout_desc *desc;
+
 	bytes = pio_request->size;
 	in = (pio_request->direction == REQUEST_READ);
 	port = pio_request->address;
@@ -102,9 +165,12 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 		((bytes != 1) && (bytes != 2) && (bytes != 4)))
 		return -1;
 
-	handler = inout_handlers[port].handler;
-	flags = inout_handlers[port].flags;
-	arg = inout_handlers[port].arg;
+	__atomic_fetch_add(&inout_hits[port], 1, __ATOMIC_RELAXED);
+	desc = &inout_descs[__atomic_load_n(&inout_handlers[port],
+			__ATOMIC_ACQUIRE)];
+	handler = desc->handler;
+	flags = desc->flags;
+	arg = desc->arg;
 
 	if (pio_request->direction == REQUEST_READ) {
 		if (!(flags & IOPORT_F_IN))
@@ -122,9 +188,11 @@ void
 init_inout(void)
 {
 	struct inout_port **iopp, *iop;
+	int idx;
 
 	/*
-	 * Set up the default handler for all ports
+	 * Set up the default handler for all ports, it takes descriptor
+	 * INOUT_DESC_DEFAULT
 	 */
 	register_default_iohandler(0, MAX_IOPORTS);
 
@@ -138,17 +206,18 @@ init_inout(void)
 			continue;
 		}
 
-		inout_handlers[iop->port].name = iop->name;
-		inout_handlers[iop->port].flags = iop->flags;
-		inout_handlers[iop->port].handler = iop->handler;
-		inout_handlers[iop->port].arg = NULL;
+		pthread_mutex_lock(&inout_mtx);
+		idx = inout_desc_get(iop->name, iop->flags, iop->handler, NULL);
+		if (idx >= 0)
+			inout_set_range(iop->port, 1, idx);
+		pthread_mutex_unlock(&inout_mtx);
 	}
 }
 
 int
 register_inout(struct inout_port *iop)
 {
-	int i;
+	int i, idx;
 
 	if (!VERIFY_IOPORT(iop->port, iop->size)) {
 		pr_err("invalid input: port:0x%x, size:%d",
@@ -160,18 +229,66 @@ register_inout(struct inout_port *iop)
 	 * Verify that the new registration is not overwriting an already
 	 * allocated i/o range.
 	 */
+	pthread_mutex_lock(&inout_mtx);
 	if ((iop->flags & IOPORT_F_DEFAULT) == 0) {
 		for (i = iop->port; i < iop->port + iop->size; i++) {
-			if ((inout_handlers[i].flags & IOPORT_F_DEFAULT) == 0)
+			if ((inout_descs[inout_handlers[i]].flags &
+			     IOPORT_F_DEFAULT) == 0) {
+				pthread_mutex_unlock(&inout_mtx);
 				return -1;
+			}
 		}
 	}
 
-	for (i = iop->port; i < iop->port + iop->size; i++) {
-		inout_handlers[i].name = iop->name;
-		inout_handlers[i].flags = iop->flags;
-		inout_handlers[i].handler = iop->handler;
-		inout_handlers[i].arg = iop->arg;
+	idx = inout_desc_get(iop->name, iop->flags, iop->handler, iop->arg);
+	if (idx >= 0)
+		inout_set_range(iop->port, iop->size, idx);
+	pthread_mutex_unlock(&inout_mtx);
+
+	return (idx >= 0) ? 0 : -1;
+}
+
+/*
+ * Print the nr ports with the most accesses since their handler was set, as
+ * "port:name:count" separated by spaces, into buf.
+ */
+int
+inout_get_stats(char *buf, size_t len, int nr)
+{
+	uint32_t prev = UINT32_MAX, best;
+	int i, port, prev_port = -1, n = 0;
+
+	if (len == 0)
+		return -1;
+	buf[0] = '\0';
+
+	/* anything equal to prev and below prev_port was already printed */
+	while (nr-- > 0) {
+		best = 0;
+		port = -1;
+		for (i = 0; i < MAX_IOPORTS; i++) {
+			uint32_t hits = inout_hits[i];
+
+			if (hits == 0 || hits > prev ||
+			    (hits == prev && i <= prev_port))
+				continue;
+			if (hits > best) {
+				best = hits;
+				port = i;
+			}
+		}
+		if (port < 0)
+			break;
+
+		n += snprintf(buf + n, len - n, "%s0x%x:%s:%u", n ? " " : "",
+				port, inout_descs[inout_handlers[port]].name,
+				best);
+		if (n >= len) {
+			buf[len - 1] = '\0';
+			break;
+		}
+		prev = best;
+		prev_port = port;
 	}
 
 	return 0;
@@ -67,6 +67,9 @@
 #include "pm_vuart.h"
 #include "log.h"
 #include "pci_util.h"
+#include "dm_string.h"
+#include "snapshot.h"
+#include "migrate.h"
 
 #define GUEST_NIO_PORT		0x488	/* guest upcalls via i/o port */
 
@@ -95,13 +98,38 @@ bool pt_tpm2;
 bool pt_rtct;
 bool vtpm2;
 bool is_winvm;
+bool timer_mux;
+bool hv_hpet;
+bool hv_pmtmr;
+bool hv_rtc;
+bool pv_ipi;
+bool pv_tlb_flush;
+bool pv_steal_time;
+bool vpmu;
+bool wbinvd_range;
+bool mwait_pt;
+bool hide_rdrand;
+uint32_t vm_tsc_khz;
+char *restore_file_name;
+char *incoming_addr;
+bool lazy_mem;
+bool share_image;
 bool skip_pci_mem64bar_workaround = false;
 
 static int guest_ncpus;
 static int virtio_msix = 1;
 static bool debugexit_enabled;
+static bool fast_reset;
 static char mac_seed_str[50];
 static int pm_notify_channel;
+static uint64_t ioreq_poll_max;		/* TSC cycles, 0 if not polling */
+
+#define PIO_PT_MAX	8
+static struct {
+	uint16_t base;
+	uint16_t len;
+} pio_pt[PIO_PT_MAX];			/* port ranges accessed natively */
+static int pio_pt_num;
 
 static int acpi;
 
@@ -145,12 +173,18 @@ usage(int code)
 		"       %*s [-l lpc] [-m mem] [-r ramdisk_image_path]\n"
 		"       %*s [-s pci] [-U uuid] [--vsbl vsbl_file_name] [--ovmf ovmf_file_path]\n"
 		"       %*s [--part_info part_info_name] [--enable_trusty] [--intr_monitor param_setting]\n"
+		"       %*s [--intr_coalesce param_setting]\n"
 		"       %*s [--acpidev_pt HID] [--mmiodev_pt MMIO_Regions]\n"
 		"       %*s [--vtpm2 sock_path] [--virtio_poll interval] [--mac_seed seed_string]\n"
 		"       %*s [--cpu_affinity pCPUs] [--lapic_pt] [--rtvm] [--windows]\n"
 		"       %*s [--debugexit] [--logger_setting param_setting]\n"
 		"       %*s [--pm_notify_channel channel] [--pm_by_vuart vuart_node]\n"
-		"       %*s [--ssram] <vm>\n"
+		"       %*s [--ssram] [--ioreq_poll cycles]\n"
+		"       %*s [--timer_mux] [--hv_hpet] [--hv_pmtmr] [--hv_rtc]\n"
+		"       %*s [--restore snapshot_file] [--lazy_mem] [--pv_ipi] [--wbinvd_range]\n"
+		"       %*s [--pv_tlb_flush] [--pv_steal_time] [--vpmu] [--pio_pt base:len]\n"
+		"       %*s [--mwait_pt] [--tsc_khz frequency] [--fast_reset] [--hide_rdrand]\n"
+		"       %*s [--share_image] [--incoming [host:]port] <vm>\n"
 		"       -A: create ACPI tables\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
@@ -176,7 +210,28 @@ usage(int code)
 		"       --debugexit: enable debug exit function\n"
 		"       --intr_monitor: enable interrupt storm monitor\n"
 		"            its params: threshold/s,probe-period(s),delay_time(ms),delay_duration(ms)\n"
+		"       --intr_coalesce: merge pass-through device interrupts into fewer injections\n"
+		"            its params: window(us),threshold/window[,max_merged]\n"
 		"       --virtio_poll: enable virtio poll mode with poll interval with ns\n"
+		"       --ioreq_poll: poll for ioreqs and their completion up to the given TSC cycles\n"
+		"       --timer_mux: share one timerfd among the emulated timers of a clock\n"
+		"       --hv_hpet: emulate the HPET in the hypervisor instead of the device model\n"
+		"       --hv_pmtmr: expose an ACPI PM timer emulated in the hypervisor\n"
+		"       --hv_rtc: serve the RTC time from the hypervisor, the device model keeps the CMOS\n"
+		"       --restore: wake the VM up from an S3 snapshot instead of booting it\n"
+		"       --lazy_mem: allocate the guest memory as the guest touches it\n"
+		"       --pv_ipi: let the guest send IPIs to several vCPUs with one hypercall\n"
+		"       --pv_tlb_flush: let the guest defer the TLB shootdowns of preempted vCPUs\n"
+		"       --pv_steal_time: report the steal time and the preemptions of the vCPUs\n"
+		"       --vpmu: let the guest use the architectural PMU\n"
+		"       --wbinvd_range: serve the guest WBINVDs by flushing its memory only\n"
+		"       --mwait_pt: let the guest idle with MONITOR/MWAIT natively\n"
+		"       --tsc_khz: TSC frequency of the guest in kHz, e.g. the one of the host of a snapshot\n"
+		"       --fast_reset: reset the devices in place on a VM reset, if they all support it\n"
+		"       --hide_rdrand: hide RDRAND/RDSEED from the guest, which then uses virtio-rnd\n"
+		"       --share_image: map the kernel and ramdisk read-only to the VMs loading the same, copied on write\n"
+		"       --incoming: wake the VM up from a migration received on the address\n"
+		"       --pio_pt: let the guest access a port range natively, if SOS owns it\n"
 		"       --acpidev_pt: acpi device ID args: HID in ACPI Table\n"
 		"       --mmiodev_pt: MMIO resources args: physical MMIO regions\n"
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
@@ -191,6 +246,9 @@ usage(int code)
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "");
 
 	exit(code);
@@ -376,6 +434,17 @@ vmexit_pci_emul(struct vmctx *ctx, struct vhm_request *vhm_req, int *pvcpu)
 	}
 }
 
+static void
+vmexit_reclaimed(struct vmctx *ctx, struct vhm_request *vhm_req, int *pvcpu)
+{
+	vm_paddr_t gpa;
+
+	/* the access is retried once the memory is back */
+	gpa = ALIGN_DOWN(vhm_req->reqs.mmio.address, HUGETLB_RECLAIM_SIZE);
+	if (hugetlb_restore_memory(ctx, gpa, HUGETLB_RECLAIM_SIZE))
+		pr_err("Failed to map back guest memory at 0x%lx\n", gpa);
+}
+
 #define	DEBUG_EPT_MISCONFIG
 
 #ifdef DEBUG_EPT_MISCONFIG
@@ -390,6 +459,7 @@ static vmexit_handler_t handler[VM_EXITCODE_MAX] = {
 	[VM_EXITCODE_INOUT]  = vmexit_inout,
 	[VM_EXITCODE_MMIO_EMUL] = vmexit_mmio_emul,
 	[VM_EXITCODE_PCI_CFG] = vmexit_pci_emul,
+	[VM_EXITCODE_RECLAIMED] = vmexit_reclaimed,
 };
 
 static void
@@ -563,6 +633,32 @@ vm_reset_vdevs(struct vmctx *ctx)
 	 */
 	acrn_writeback_ovmf_nvstorage(ctx);
 
+	/*
+	 * The PCI devices that all define vdev_reset are reset in place:
+	 * their BARs, interrupts and backends stay, so the PCI irq and
+	 * ioapic allocations do too. The guest memory is kept as is, the
+	 * software is loaded again anyway.
+	 */
+	if (fast_reset && pci_warm_reset_supported()) {
+		pr_info("%s: resetting the devices in place\n", __func__);
+		atkbdc_deinit(ctx);
+		vhpet_deinit(ctx);
+		vpit_deinit(ctx);
+		vrtc_deinit(ctx);
+
+		reset_pci(ctx);
+
+		atkbdc_init(ctx);
+		vrtc_init(ctx);
+		vpit_init(ctx);
+		vhpet_init(ctx);
+
+		if (acpi) {
+			acpi_build(ctx, guest_ncpus);
+		}
+		return;
+	}
+
 	/*
 	 * The current virtual devices doesn't define virtual
 	 * device reset function. So we call vdev deinit/init
@@ -676,10 +772,169 @@ vm_suspend_resume(struct vmctx *ctx)
 	vm_run(ctx);
 }
 
+static inline uint64_t
+rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t ioreq_poll_avg;		/* average ioreq interval in cycles */
+static uint64_t nr_ioreqs[VM_EXITCODE_MAX];	/* ioreqs handled */
+static uint64_t ioreq_cycles[VM_EXITCODE_MAX];	/* cycles spent on them */
+
+static inline bool
+is_ioreq_ready(struct vmctx *ctx, int vcpu_id)
+{
+	return (atomic_load(&vhm_req_buf[vcpu_id].processed) == REQ_STATE_PROCESSING)
+		&& (vhm_req_buf[vcpu_id].client == ctx->ioreq_client);
+}
+
+static bool
+vm_has_ioreq(struct vmctx *ctx)
+{
+	uint64_t pending;
+
+	pending = atomic_load(&vhm_req_buf[0].pending_bitmap);
+	while (pending) {
+		if (is_ioreq_ready(ctx, __builtin_ctzll(pending)))
+			return true;
+		pending &= pending - 1;
+	}
+
+	return false;
+}
+
+static void
+vm_handle_ioreqs(struct vmctx *ctx)
+{
+	uint64_t pending, start;
+	uint32_t type;
+	int vcpu_id;
+
+	/* the hypervisor flags every slot that got a request */
+	pending = atomic_load(&vhm_req_buf[0].pending_bitmap);
+	while (pending) {
+		vcpu_id = __builtin_ctzll(pending);
+		pending &= pending - 1;
+		if (!is_ioreq_ready(ctx, vcpu_id))
+			continue;
+
+		type = vhm_req_buf[vcpu_id].type;
+		start = rdtsc();
+		handle_vmexit(ctx, &vhm_req_buf[vcpu_id], vcpu_id);
+		if (type < VM_EXITCODE_MAX) {
+			nr_ioreqs[type]++;
+			ioreq_cycles[type] += rdtsc() - start;
+		}
+	}
+}
+
+/*
+ * Get the ioreqs handled and the TSC cycles they took, from the fetch to
+ * the completion notification, by type into nr and cycles of
+ * VM_EXITCODE_MAX entries each.
+ */
+void
+vm_get_ioreq_stats(uint64_t *nr, uint64_t *cycles)
+{
+	int type;
+
+	for (type = 0; type < VM_EXITCODE_MAX; type++) {
+		nr[type] = atomic_load(&nr_ioreqs[type]);
+		cycles[type] = atomic_load(&ioreq_cycles[type]);
+	}
+}
+
+/*
+ * Spin for the next ioreq for up to twice the average ioreq interval, or not
+ * at all when that is beyond the max polling budget. Intervals of ioreqs
+ * found after blocking are accounted too, so polling resumes with the load.
+ *
+ * Return true if an ioreq is found, the caller may skip blocking then.
+ */
+static bool
+vm_poll_ioreq(struct vmctx *ctx, uint64_t start)
+{
+	uint64_t budget;
+	bool found = false;
+
+	if (ioreq_poll_avg == 0)
+		budget = ioreq_poll_max;
+	else if (ioreq_poll_avg <= (ioreq_poll_max >> 1))
+		budget = ioreq_poll_avg << 1;
+	else
+		budget = 0;
+
+	while ((rdtsc() - start) < budget) {
+		if (vm_has_ioreq(ctx)) {
+			found = true;
+			break;
+		}
+		asm volatile("pause" ::: "memory");
+	}
+
+	return found;
+}
+
+static void
+vm_account_ioreq_interval(uint64_t start)
+{
+	uint64_t interval = rdtsc() - start;
+
+	/* clamp the sample, so an idle period does not disable polling for long */
+	if (interval > (ioreq_poll_max << 1))
+		interval = ioreq_poll_max << 1;
+	ioreq_poll_avg = ioreq_poll_avg - (ioreq_poll_avg >> 3) + (interval >> 3);
+}
+
+/*
+ * Wait for the next ioreqs, start is the end of the last pass.
+ *
+ * Return 0 on success, or the error of vm_attach_ioreq_client().
+ */
+static int
+vm_wait_ioreq(struct vmctx *ctx, uint64_t start)
+{
+	int error = 0;
+
+	if (!ioreq_poll_max || !vm_poll_ioreq(ctx, start))
+		error = vm_attach_ioreq_client(ctx);
+	if (!error && ioreq_poll_max && start)
+		vm_account_ioreq_interval(start);
+
+	return error;
+}
+
+/* base:len, both in hex or decimal */
+static int
+parse_pio_pt(const char *opt)
+{
+	unsigned long base, len;
+	char *end;
+
+	if (pio_pt_num >= PIO_PT_MAX)
+		return -1;
+	if (dm_strtoul(opt, &end, 0, &base) != 0 || *end != ':')
+		return -1;
+	if (dm_strtoul(end + 1, NULL, 0, &len) != 0)
+		return -1;
+	if (len == 0 || len > 0xffff || base + len > 0x10000)
+		return -1;
+
+	pio_pt[pio_pt_num].base = (uint16_t)base;
+	pio_pt[pio_pt_num].len = (uint16_t)len;
+	pio_pt_num++;
+	return 0;
+}
+
 static void
 vm_loop(struct vmctx *ctx)
 {
-	int error;
+	uint64_t start = 0;
+	int i;
 
 	ctx->ioreq_client = vm_create_ioreq_client(ctx);
 	if (ctx->ioreq_client <= 0) {
@@ -687,25 +942,22 @@ vm_loop(struct vmctx *ctx)
 		return;
 	}
 
+	if (ioreq_poll_max && vm_set_ioreq_poll(ctx, ioreq_poll_max) != 0)
+		pr_warn("%s, failed to set ioreq poll budget.\n", __func__);
+
+	for (i = 0; i < pio_pt_num; i++) {
+		if (vm_set_pio_region(ctx, pio_pt[i].base, pio_pt[i].len, true) != 0)
+			pr_warn("%s, ports 0x%x-0x%x still trap.\n", __func__,
+				pio_pt[i].base, pio_pt[i].base + pio_pt[i].len - 1);
+	}
+
 	if (vm_run(ctx) != 0) {
 		pr_err("%s, failed to run VM.\n", __func__);
 		return;
 	}
 
-	while (1) {
-		int vcpu_id;
-		struct vhm_request *vhm_req;
-
-		error = vm_attach_ioreq_client(ctx);
-		if (error)
-			break;
-
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			vhm_req = &vhm_req_buf[vcpu_id];
-			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
-				&& (vhm_req->client == ctx->ioreq_client))
-				handle_vmexit(ctx, vhm_req, vcpu_id);
-		}
+	while (vm_wait_ioreq(ctx, start) == 0) {
+		vm_handle_ioreqs(ctx);
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
 		    VM_SUSPEND_POWEROFF == vm_get_suspend_mode()) {
@@ -720,6 +972,9 @@ vm_loop(struct vmctx *ctx)
 		if (VM_SUSPEND_SUSPEND == vm_get_suspend_mode()) {
 			vm_suspend_resume(ctx);
 		}
+
+		if (ioreq_poll_max)
+			start = rdtsc();
 	}
 	pr_err("VM loop exit\n");
 }
@@ -764,6 +1019,26 @@ enum {
 	CMD_OPT_PM_NOTIFY_CHANNEL,
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
+	CMD_OPT_IOREQ_POLL,
+	CMD_OPT_TIMER_MUX,
+	CMD_OPT_HV_HPET,
+	CMD_OPT_HV_PMTMR,
+	CMD_OPT_HV_RTC,
+	CMD_OPT_RESTORE,
+	CMD_OPT_LAZY_MEM,
+	CMD_OPT_INTR_COALESCE,
+	CMD_OPT_PV_IPI,
+	CMD_OPT_PV_TLB_FLUSH,
+	CMD_OPT_PV_STEAL_TIME,
+	CMD_OPT_VPMU,
+	CMD_OPT_PIO_PT,
+	CMD_OPT_WBINVD_RANGE,
+	CMD_OPT_MWAIT_PT,
+	CMD_OPT_TSC_KHZ,
+	CMD_OPT_FAST_RESET,
+	CMD_OPT_HIDE_RDRAND,
+	CMD_OPT_SHARE_IMAGE,
+	CMD_OPT_INCOMING,
 };
 
 static struct option long_options[] = {
@@ -806,6 +1081,26 @@ static struct option long_options[] = {
 	{"pm_notify_channel",	required_argument,	0, CMD_OPT_PM_NOTIFY_CHANNEL},
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
+	{"ioreq_poll",		required_argument,	0, CMD_OPT_IOREQ_POLL},
+	{"timer_mux",		no_argument,		0, CMD_OPT_TIMER_MUX},
+	{"hv_hpet",		no_argument,		0, CMD_OPT_HV_HPET},
+	{"hv_pmtmr",		no_argument,		0, CMD_OPT_HV_PMTMR},
+	{"hv_rtc",		no_argument,		0, CMD_OPT_HV_RTC},
+	{"restore",		required_argument,	0, CMD_OPT_RESTORE},
+	{"lazy_mem",		no_argument,		0, CMD_OPT_LAZY_MEM},
+	{"intr_coalesce",	required_argument,	0, CMD_OPT_INTR_COALESCE},
+	{"pv_ipi",		no_argument,		0, CMD_OPT_PV_IPI},
+	{"pv_tlb_flush",	no_argument,		0, CMD_OPT_PV_TLB_FLUSH},
+	{"pv_steal_time",	no_argument,		0, CMD_OPT_PV_STEAL_TIME},
+	{"vpmu",		no_argument,		0, CMD_OPT_VPMU},
+	{"pio_pt",		required_argument,	0, CMD_OPT_PIO_PT},
+	{"wbinvd_range",	no_argument,		0, CMD_OPT_WBINVD_RANGE},
+	{"mwait_pt",		no_argument,		0, CMD_OPT_MWAIT_PT},
+	{"tsc_khz",		required_argument,	0, CMD_OPT_TSC_KHZ},
+	{"fast_reset",		no_argument,		0, CMD_OPT_FAST_RESET},
+	{"hide_rdrand",		no_argument,		0, CMD_OPT_HIDE_RDRAND},
+	{"share_image",		no_argument,		0, CMD_OPT_SHARE_IMAGE},
+	{"incoming",		required_argument,	0, CMD_OPT_INCOMING},
 	{0,			0,			0,  0  },
 };
 
@@ -816,6 +1111,7 @@ main(int argc, char *argv[])
 {
 	int c, error, ret=1;
 	int max_vcpus, mptgen;
+	bool warm;
 	struct vmctx *ctx;
 	size_t memsize;
 	int option_idx = 0;
@@ -966,6 +1262,10 @@ main(int argc, char *argv[])
 			if (acrn_parse_intr_monitor(optarg) != 0)
 				errx(EX_USAGE, "invalid intr-monitor params %s", optarg);
 			break;
+		case CMD_OPT_INTR_COALESCE:
+			if (acrn_parse_intr_coalesce(optarg) != 0)
+				errx(EX_USAGE, "invalid intr-coalesce params %s", optarg);
+			break;
 		case CMD_OPT_LOGGER_SETTING:
 			if (init_logger_setting(optarg) != 0)
 				errx(EX_USAGE, "invalid logger setting params %s", optarg);
@@ -993,6 +1293,66 @@ main(int argc, char *argv[])
 		case CMD_OPT_WINDOWS:
 			is_winvm = true;
 			break;
+		case CMD_OPT_IOREQ_POLL:
+			if (dm_strtoul(optarg, NULL, 0, &ioreq_poll_max) != 0)
+				errx(EX_USAGE, "invalid ioreq poll cycles %s", optarg);
+			break;
+		case CMD_OPT_TIMER_MUX:
+			timer_mux = true;
+			break;
+		case CMD_OPT_HV_HPET:
+			hv_hpet = true;
+			break;
+		case CMD_OPT_HV_PMTMR:
+			hv_pmtmr = true;
+			break;
+		case CMD_OPT_HV_RTC:
+			hv_rtc = true;
+			break;
+		case CMD_OPT_RESTORE:
+			restore_file_name = optarg;
+			break;
+		case CMD_OPT_LAZY_MEM:
+			lazy_mem = true;
+			break;
+		case CMD_OPT_PV_IPI:
+			pv_ipi = true;
+			break;
+		case CMD_OPT_PV_TLB_FLUSH:
+			pv_tlb_flush = true;
+			break;
+		case CMD_OPT_PV_STEAL_TIME:
+			pv_steal_time = true;
+			break;
+		case CMD_OPT_VPMU:
+			vpmu = true;
+			break;
+		case CMD_OPT_PIO_PT:
+			if (parse_pio_pt(optarg) != 0)
+				errx(EX_USAGE, "invalid pio_pt range %s", optarg);
+			break;
+		case CMD_OPT_WBINVD_RANGE:
+			wbinvd_range = true;
+			break;
+		case CMD_OPT_MWAIT_PT:
+			mwait_pt = true;
+			break;
+		case CMD_OPT_TSC_KHZ:
+			if (dm_strtoui(optarg, NULL, 0, &vm_tsc_khz) != 0 || vm_tsc_khz == 0)
+				errx(EX_USAGE, "invalid TSC frequency %s", optarg);
+			break;
+		case CMD_OPT_FAST_RESET:
+			fast_reset = true;
+			break;
+		case CMD_OPT_HIDE_RDRAND:
+			hide_rdrand = true;
+			break;
+		case CMD_OPT_SHARE_IMAGE:
+			share_image = true;
+			break;
+		case CMD_OPT_INCOMING:
+			incoming_addr = optarg;
+			break;
 		case 'h':
 			usage(0);
 		default:
@@ -1005,6 +1365,9 @@ main(int argc, char *argv[])
 	if (argc != 1)
 		usage(1);
 
+	/* overlap the hand-off of the SOS CPUs with the rest of the setup */
+	vm_handoff_cpus_start();
+
 	vmname = argv[0];
 	if (strnlen(vmname, MAX_VMNAME_LEN) >= MAX_VMNAME_LEN) {
 		pr_err("vmname size exceed %u\n", MAX_VMNAME_LEN);
@@ -1016,6 +1379,12 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	/*
+	 * A launch script run by the manager for a warm pool gets this
+	 * variable, whatever the acrn-dm options it passes.
+	 */
+	warm = (getenv("ACRN_DM_WARM") != NULL);
+
 	for (;;) {
 		pr_notice("vm_create: %s\n", vmname);
 		ctx = vm_create(vmname, (unsigned long)vhm_req_buf, &guest_ncpus);
@@ -1056,28 +1425,51 @@ main(int argc, char *argv[])
 		}
 
 		/*
-		 * build the guest tables, MP etc.
+		 * A snapshot or a migration brings back the guest memory with
+		 * the tables and the software in it, the VM wakes up from S3.
 		 */
-		if (mptgen) {
-			error = mptable_build(ctx, guest_ncpus);
+		if (restore_file_name) {
+			pr_notice("vm_snapshot_restore\n");
+			error = vm_snapshot_restore(ctx, restore_file_name);
 			if (error) {
+				pr_err("vm_snapshot_restore failed, error=%d\n", error);
 				goto vm_fail;
 			}
-		}
-
-		if (acpi) {
-			error = acpi_build(ctx, guest_ncpus);
+			/* a reset boots the VM again */
+			restore_file_name = NULL;
+		} else if (incoming_addr) {
+			pr_notice("vm_migrate_incoming\n");
+			error = vm_migrate_incoming(ctx, incoming_addr);
 			if (error) {
-				pr_err("acpi_build failed, error=%d\n", error);
+				pr_err("vm_migrate_incoming failed, error=%d\n", error);
 				goto vm_fail;
 			}
-		}
+			incoming_addr = NULL;
+		} else {
+			/*
+			 * build the guest tables, MP etc.
+			 */
+			if (mptgen) {
+				error = mptable_build(ctx, guest_ncpus);
+				if (error) {
+					goto vm_fail;
+				}
+			}
 
-		pr_notice("acrn_sw_load\n");
-		error = acrn_sw_load(ctx);
-		if (error) {
-			pr_err("acrn_sw_load failed, error=%d\n", error);
-			goto vm_fail;
+			if (acpi) {
+				error = acpi_build(ctx, guest_ncpus);
+				if (error) {
+					pr_err("acpi_build failed, error=%d\n", error);
+					goto vm_fail;
+				}
+			}
+
+			pr_notice("acrn_sw_load\n");
+			error = acrn_sw_load(ctx);
+			if (error) {
+				pr_err("acrn_sw_load failed, error=%d\n", error);
+				goto vm_fail;
+			}
 		}
 
 		/*
@@ -1085,6 +1477,19 @@ main(int argc, char *argv[])
 		 */
 		/*setproctitle("%s", vmname);*/
 
+		/*
+		 * A warm VM waits here for the manager, with its memory
+		 * and devices set up, until it's started or stopped.
+		 */
+		if (warm) {
+			warm = false;
+			pr_notice("wait_for_warm_start\n");
+			if (wait_for_warm_start(ctx) < 0) {
+				ret = 0;
+				goto vm_fail;
+			}
+		}
+
 		/*
 		 * Add CPU 0
 		 */
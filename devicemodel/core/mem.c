@@ -30,6 +30,11 @@
  * Memory ranges are represented with an RB tree. On insertion, the range
  * is checked for overlaps. On lookup, the key has the same base and limit
  * so it can be searched within the range.
+ *
+ * The trees are only used by the writers. Lookups take no lock: they search
+ * an immutable snapshot of both trees, a sorted array rebuilt and swapped on
+ * every (un)registration. A removed range is freed once no reader which may
+ * still see it is left, see mmio_synchronize().
  */
 
 #include <errno.h>
@@ -37,6 +42,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include "vmm.h"
 #include "mem.h"
@@ -54,14 +60,40 @@ struct mmio_rb_range {
 static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
 RB_PROTOTYPE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+struct mmio_snapshot {
+	uint64_t		gen;
+	int			nr_ranges;
+	int			nr_fallback;	/* following the nr_ranges ones */
+	struct mmio_rb_range	*ranges[];	/* sorted by address */
+};
+
+/* the trees and mmio_snap_gen are protected by mmio_mtx */
+static pthread_mutex_t		mmio_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct mmio_snapshot	*mmio_snap;
+static uint64_t			mmio_snap_gen;
+
 /*
- * Per-VM cache. Since most accesses from a vCPU will be to
- * consecutive addresses in a range, it makes sense to cache the
- * result of a lookup.
+ * Each thread looking ranges up owns a reader slot. On entry it stores the
+ * current grace period in its slot, and clears the slot on exit. Threads past
+ * MMIO_READERS_MAX take mmio_mtx instead.
  */
-static struct mmio_rb_range	*mmio_hint __aligned(sizeof(struct mmio_rb_range *));
+#define MMIO_READERS_MAX	64
+#define MMIO_READER_LOCKED	MMIO_READERS_MAX
 
-static pthread_rwlock_t mmio_rwlock;
+static struct {
+	uint64_t gp;
+} __aligned(64) mmio_readers[MMIO_READERS_MAX];
+static uint64_t mmio_gp = 1;
+static int mmio_nr_readers;
+static __thread int mmio_reader_id = -1;
+
+/*
+ * Per-thread cache. Since most accesses from a vCPU will be to
+ * consecutive addresses in a range, it makes sense to cache the
+ * result of a lookup. It is only used with the snapshot it came from.
+ */
+static __thread struct mmio_rb_range	*mmio_hint;
+static __thread uint64_t		mmio_hint_gen;
 
 static int
 mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
@@ -117,17 +149,134 @@ mmio_rb_dump(struct mmio_rb_tree *rbt)
 {
 	struct mmio_rb_range *np;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	RB_FOREACH(np, mmio_rb_tree, rbt) {
 		pr_dbg(" %lx:%lx, %s\n", np->mr_base, np->mr_end,
 		       np->mr_param.name);
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 }
 #endif
 
 RB_GENERATE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+static struct mmio_snapshot *
+mmio_read_lock(void)
+{
+	int id = mmio_reader_id;
+
+	if (id < 0) {
+		id = __atomic_fetch_add(&mmio_nr_readers, 1, __ATOMIC_SEQ_CST);
+		if (id >= MMIO_READERS_MAX)
+			id = MMIO_READER_LOCKED;
+		mmio_reader_id = id;
+	}
+
+	if (id == MMIO_READER_LOCKED) {
+		pthread_mutex_lock(&mmio_mtx);
+		return mmio_snap;
+	}
+
+	__atomic_store_n(&mmio_readers[id].gp,
+			__atomic_load_n(&mmio_gp, __ATOMIC_SEQ_CST),
+			__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&mmio_snap, __ATOMIC_SEQ_CST);
+}
+
+static void
+mmio_read_unlock(void)
+{
+	int id = mmio_reader_id;
+
+	if (id == MMIO_READER_LOCKED)
+		pthread_mutex_unlock(&mmio_mtx);
+	else
+		__atomic_store_n(&mmio_readers[id].gp, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait for the readers which may have got a snapshot older than the one just
+ * published. A reader which stored a grace period older than the new one may
+ * still see it, one which stored the new one or none cannot.
+ *
+ * Called with mmio_mtx held.
+ */
+static void
+mmio_synchronize(void)
+{
+	uint64_t gp, cur;
+	int i, nr;
+
+	gp = __atomic_add_fetch(&mmio_gp, 1, __ATOMIC_SEQ_CST);
+	nr = __atomic_load_n(&mmio_nr_readers, __ATOMIC_SEQ_CST);
+	if (nr > MMIO_READERS_MAX)
+		nr = MMIO_READERS_MAX;
+
+	for (i = 0; i < nr; i++) {
+		while (1) {
+			cur = __atomic_load_n(&mmio_readers[i].gp,
+					__ATOMIC_SEQ_CST);
+			if (cur == 0 || cur >= gp)
+				break;
+			sched_yield();
+		}
+	}
+}
+
+/*
+ * Publish a snapshot of the trees as they are now, and free the old one once
+ * nobody can use it any more. Called with mmio_mtx held.
+ */
+static int
+mmio_snapshot_update(void)
+{
+	struct mmio_snapshot *snap, *old;
+	struct mmio_rb_range *np;
+	int n = 0;
+
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_root)
+		n++;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_fallback)
+		n++;
+
+	snap = malloc(sizeof(*snap) + n * sizeof(snap->ranges[0]));
+	if (snap == NULL)
+		return -1;
+
+	snap->gen = ++mmio_snap_gen;
+	snap->nr_ranges = 0;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_root)
+		snap->ranges[snap->nr_ranges++] = np;
+	snap->nr_fallback = 0;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_fallback)
+		snap->ranges[snap->nr_ranges + snap->nr_fallback++] = np;
+
+	old = mmio_snap;
+	__atomic_store_n(&mmio_snap, snap, __ATOMIC_SEQ_CST);
+	mmio_synchronize();
+	free(old);
+
+	return 0;
+}
+
+static struct mmio_rb_range *
+mmio_snapshot_find(struct mmio_rb_range **ranges, int nr, uint64_t addr)
+{
+	int lo = 0, hi = nr - 1, mid;
+
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if (addr < ranges[mid]->mr_base)
+			hi = mid - 1;
+		else if (addr > ranges[mid]->mr_end)
+			lo = mid + 1;
+		else
+			return ranges[mid];
+	}
+
+	return NULL;
+}
+
 static int
 mem_read(void *ctx, int vcpu, uint64_t gpa, uint64_t *rval, int size, void *arg)
 {
@@ -150,35 +299,51 @@ mem_write(void *ctx, int vcpu, uint64_t gpa, uint64_t wval, int size, void *arg)
 	return error;
 }
 
-int
-emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
+static int
+mmio_lookup(struct mmio_snapshot *snap, uint64_t paddr,
+		struct mmio_rb_range **entry)
 {
-	uint64_t paddr = mmio_req->address;
-	int size = mmio_req->size;
-	struct mmio_rb_range *hint, *entry = NULL;
-	int err;
+	struct mmio_rb_range *hint;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	if (snap == NULL)
+		return -ESRCH;
 
 	/*
-	 * First check the per-VM cache
+	 * First check the per-thread cache
 	 */
 	hint = mmio_hint;
 
-	if (hint && paddr >= hint->mr_base && paddr <= hint->mr_end)
-		entry = hint;
-	else if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-		/* Update the per-VM cache */
-		mmio_hint = entry;
-	else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-		pthread_rwlock_unlock(&mmio_rwlock);
+	if (hint && mmio_hint_gen == snap->gen &&
+	    paddr >= hint->mr_base && paddr <= hint->mr_end)
+		*entry = hint;
+	else if ((*entry = mmio_snapshot_find(snap->ranges, snap->nr_ranges,
+			paddr)) != NULL) {
+		/* Update the per-thread cache */
+		mmio_hint = *entry;
+		mmio_hint_gen = snap->gen;
+	} else if ((*entry = mmio_snapshot_find(
+			snap->ranges + snap->nr_ranges, snap->nr_fallback,
+			paddr)) == NULL)
 		return -ESRCH;
-	}
 
-	pthread_rwlock_unlock(&mmio_rwlock);
+	return 0;
+}
+
+int
+emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
+{
+	uint64_t paddr = mmio_req->address;
+	int size = mmio_req->size;
+	struct mmio_snapshot *snap;
+	struct mmio_rb_range *entry = NULL;
+	int err;
+
+	snap = mmio_read_lock();
+	err = mmio_lookup(snap, paddr, &entry);
+	mmio_read_unlock();
 
-	if (entry == NULL)
-		return -EINVAL;
+	if (err)
+		return err;
 
 	if (mmio_req->direction == REQUEST_READ)
 		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
@@ -204,10 +369,14 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		mrp->mr_param = *memp;
 		mrp->mr_base = memp->base;
 		mrp->mr_end = memp->base + memp->size - 1;
-		pthread_rwlock_wrlock(&mmio_rwlock);
+		pthread_mutex_lock(&mmio_mtx);
 		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
 			err = mmio_rb_add(rbt, mrp);
-		pthread_rwlock_unlock(&mmio_rwlock);
+		if (err == 0 && mmio_snapshot_update() != 0) {
+			RB_REMOVE(mmio_rb_tree, rbt, mrp);
+			err = -1;
+		}
+		pthread_mutex_unlock(&mmio_mtx);
 		if (err)
 			free(mrp);
 	}
@@ -234,7 +403,7 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 	struct mmio_rb_range *entry = NULL;
 	int err;
 
-	pthread_rwlock_wrlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	err = mmio_rb_lookup(rbt, memp->base, &entry);
 	if (err == 0) {
 		mr = &entry->mr_param;
@@ -245,14 +414,19 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		} else {
 			RB_REMOVE(mmio_rb_tree, rbt, entry);
 
-			/* flush Per-VM cache */
-			if (mmio_hint == entry)
-				mmio_hint = NULL;
-
-			free(entry);
+			/*
+			 * The per-thread caches went stale with the snapshot,
+			 * which only returns once no reader can see the range.
+			 */
+			if (mmio_snapshot_update() == 0) {
+				free(entry);
+			} else {
+				mmio_rb_add(rbt, entry);
+				err = -1;
+			}
 		}
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 
 	return err;
 }
@@ -274,5 +448,4 @@ init_mem(void)
 {
 	RB_INIT(&mmio_rb_root);
 	RB_INIT(&mmio_rb_fallback);
-	pthread_rwlock_init(&mmio_rwlock, NULL);
 }
@@ -29,11 +29,17 @@
 /*
  * Micro event library for FreeBSD, designed for a single i/o thread
  * using EPOLL, and having events be persistent by default.
+ *
+ * Besides the main loop run by mevent_dispatch(), named loops can be
+ * created with mevent_loop_get(); each has its own epoll fd and thread,
+ * so a busy device pinned to one loop doesn't delay the events of the
+ * others.
  */
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/epoll.h>
@@ -42,20 +48,17 @@
 
 #include "mevent.h"
 #include "vmmapi.h"
+#include "atomic.h"
 #include "log.h"
 
 #define	MEVENT_MAX	64
+#define	MEVENT_MAX_LOOPS	8
 
 #define	MEV_ADD		1
 #define	MEV_ENABLE	2
 #define	MEV_DISABLE	3
 #define	MEV_DEL_PENDING	4
 
-static int epoll_fd;
-static pthread_t mevent_tid;
-static int mevent_pipefd[2];
-static pthread_mutex_t mevent_lmutex = PTHREAD_MUTEX_INITIALIZER;
-
 struct mevent {
 	void			(*run)(int, enum ev_type, void *);
 	void			*run_param;
@@ -68,29 +71,52 @@ struct mevent {
 	int			me_state;
 
 	int			closefd;
+	struct mevent_loop	*me_loop;
 	LIST_ENTRY(mevent)	me_list;
+	struct mevent		*me_del_next;
+};
+
+struct mevent_loop {
+	const char		*name;
+	int			epoll_fd;
+	pthread_t		tid;
+	int			pipefd[2];
+	bool			closing;
+	pthread_mutex_t		lmutex;
+	LIST_HEAD(listhead, mevent) head;
+	/*
+	 * The mevent nodes requested to be deleted from other threads,
+	 * a lock-free stack pushed by those threads and emptied by the
+	 * loop thread.
+	 */
+	struct mevent		*del_head;
+};
+
+static struct mevent_loop mevent_main = {
+	.name = "mevent",
+	.lmutex = PTHREAD_MUTEX_INITIALIZER,
 };
 
-static LIST_HEAD(listhead, mevent) global_head;
-/* List holds the mevent node which is requested to deleted */
-static LIST_HEAD(del_listhead, mevent) del_head;
+static struct mevent_loop *mevent_loops[MEVENT_MAX_LOOPS];
+static int mevent_nloops;
+static pthread_mutex_t mevent_loops_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void
-mevent_qlock(void)
+mevent_qlock(struct mevent_loop *loop)
 {
-	pthread_mutex_lock(&mevent_lmutex);
+	pthread_mutex_lock(&loop->lmutex);
 }
 
 static void
-mevent_qunlock(void)
+mevent_qunlock(struct mevent_loop *loop)
 {
-	pthread_mutex_unlock(&mevent_lmutex);
+	pthread_mutex_unlock(&loop->lmutex);
 }
 
 static bool
-is_dispatch_thread(void)
+is_dispatch_thread(struct mevent_loop *loop)
 {
-	return (pthread_self() == mevent_tid);
+	return (pthread_self() == loop->tid);
 }
 
 static void
@@ -108,9 +134,8 @@ mevent_pipe_read(int fd, enum ev_type type, void *param)
 	} while (status == MEVENT_MAX);
 }
 
-/* On error, -1 is returned, else return zero */
-int
-mevent_notify(void)
+static int
+mevent_loop_notify(struct mevent_loop *loop)
 {
 	char c = 0;
 
@@ -118,12 +143,19 @@ mevent_notify(void)
 	 * If calling from outside the i/o thread, write a byte on the
 	 * pipe to force the i/o thread to exit the blocking epoll call.
 	 */
-	if (mevent_pipefd[1] != 0 && !is_dispatch_thread())
-		if (write(mevent_pipefd[1], &c, 1) <= 0)
+	if (loop->pipefd[1] != 0 && !is_dispatch_thread(loop))
+		if (write(loop->pipefd[1], &c, 1) <= 0)
 			return -1;
 	return 0;
 }
 
+/* On error, -1 is returned, else return zero */
+int
+mevent_notify(void)
+{
+	return mevent_loop_notify(&mevent_main);
+}
+
 static int
 mevent_kq_filter(struct mevent *mevp)
 {
@@ -147,47 +179,43 @@ mevent_kq_filter(struct mevent *mevp)
 }
 
 static void
-mevent_destroy(void)
+mevent_free(struct mevent *mevp)
 {
-	struct mevent *mevp, *tmpp;
+	if ((mevp->me_type == EVF_READ ||
+	     mevp->me_type == EVF_READ_ET ||
+	     mevp->me_type == EVF_WRITE ||
+	     mevp->me_type == EVF_WRITE_ET) &&
+	     mevp->me_fd != STDIN_FILENO)
+		close(mevp->me_fd);
 
-	mevent_qlock();
-	list_foreach_safe(mevp, &global_head, me_list, tmpp) {
-		LIST_REMOVE(mevp, me_list);
-		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
+	if (mevp->teardown)
+		mevp->teardown(mevp->teardown_param);
 
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
+	free(mevp);
+}
 
-		if (mevp->teardown)
-			mevp->teardown(mevp->teardown_param);
+static void
+mevent_destroy(struct mevent_loop *loop)
+{
+	struct mevent *mevp, *tmpp;
 
-		free(mevp);
+	mevent_qlock(loop);
+	list_foreach_safe(mevp, &loop->head, me_list, tmpp) {
+		LIST_REMOVE(mevp, me_list);
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
+		mevent_free(mevp);
 	}
+	mevent_qunlock(loop);
 
-	/* the mevp in del_head was removed from epoll when add it
-	 * to del_head already.
+	/* the mevp on del_head was removed from epoll when it was
+	 * pushed to del_head already.
 	 */
-	list_foreach_safe(mevp, &del_head, me_list, tmpp) {
-		LIST_REMOVE(mevp, me_list);
-
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
-
-		if (mevp->teardown)
-			mevp->teardown(mevp->teardown_param);
-
-		free(mevp);
+	mevp = atomic_xchg(&loop->del_head, NULL);
+	while (mevp) {
+		tmpp = mevp->me_del_next;
+		mevent_free(mevp);
+		mevp = tmpp;
 	}
-	mevent_qunlock();
 }
 
 static void
@@ -196,18 +224,24 @@ mevent_handle(struct epoll_event *kev, int numev)
 	int i;
 	struct mevent *mevp;
 
+	/* inject the interrupts the handlers raise at once */
+	vm_intr_batch_begin();
 	for (i = 0; i < numev; i++) {
 		mevp = kev[i].data.ptr;
 
 		if (mevp->me_state)
 			(*mevp->run)(mevp->me_fd, mevp->me_type, mevp->run_param);
 	}
+	vm_intr_batch_end();
 }
 
+/**
+ * Add an event on the given loop, NULL is the main loop.
+ */
 struct mevent *
-mevent_add(int tfd, enum ev_type type,
-	   void (*run)(int, enum ev_type, void *), void *run_param,
-	   void (*teardown)(void *), void *teardown_param)
+mevent_add_loop(struct mevent_loop *loop, int tfd, enum ev_type type,
+		void (*run)(int, enum ev_type, void *), void *run_param,
+		void (*teardown)(void *), void *teardown_param)
 {
 	int ret;
 	struct epoll_event ee;
@@ -219,15 +253,18 @@ mevent_add(int tfd, enum ev_type type,
 	if (type == EVF_TIMER)
 		return NULL;
 
-	mevent_qlock();
+	if (loop == NULL)
+		loop = &mevent_main;
+
+	mevent_qlock(loop);
 	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
+	LIST_FOREACH(lp, &loop->head, me_list) {
 		if (lp->me_fd == tfd && lp->me_type == type) {
-			mevent_qunlock();
+			mevent_qunlock(loop);
 			return lp;
 		}
 	}
-	mevent_qunlock();
+	mevent_qunlock(loop);
 
 	/*
 	 * Allocate an entry, populate it, and add it to the list.
@@ -239,20 +276,25 @@ mevent_add(int tfd, enum ev_type type,
 	mevp->me_fd = tfd;
 	mevp->me_type = type;
 	mevp->me_state = 1;
+	mevp->me_loop = loop;
 
 	mevp->run = run;
 	mevp->run_param = run_param;
 	mevp->teardown = teardown;
 	mevp->teardown_param = teardown_param;
 
+	/*
+	 * epoll_ctl() is safe against a concurrent epoll_wait(), the loop
+	 * thread picks the new fd up without being woken.
+	 */
 	ee.events = mevent_kq_filter(mevp);
 	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
 
 	if (ret == 0) {
-		mevent_qlock();
-		LIST_INSERT_HEAD(&global_head, mevp, me_list);
-		mevent_qunlock();
+		mevent_qlock(loop);
+		LIST_INSERT_HEAD(&loop->head, mevp, me_list);
+		mevent_qunlock(loop);
 
 		return mevp;
 	} else {
@@ -261,29 +303,39 @@ mevent_add(int tfd, enum ev_type type,
 	}
 }
 
+struct mevent *
+mevent_add(int tfd, enum ev_type type,
+	   void (*run)(int, enum ev_type, void *), void *run_param,
+	   void (*teardown)(void *), void *teardown_param)
+{
+	return mevent_add_loop(NULL, tfd, type, run, run_param,
+			       teardown, teardown_param);
+}
+
 int
 mevent_enable(struct mevent *evp)
 {
 	int ret;
 	struct epoll_event ee;
+	struct mevent_loop *loop = evp->me_loop;
 	struct mevent *lp, *mevp = NULL;
 
-	mevent_qlock();
+	mevent_qlock(loop);
 	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
+	LIST_FOREACH(lp, &loop->head, me_list) {
 		if (lp == evp) {
 			mevp = lp;
 			break;
 		}
 	}
-	mevent_qunlock();
+	mevent_qunlock(loop);
 
 	if (!mevp)
 		return -1;
 
 	ee.events = mevent_kq_filter(mevp);
 	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
 	if (ret < 0 && errno == EEXIST)
 		ret = 0;
 
@@ -295,7 +347,7 @@ mevent_disable(struct mevent *evp)
 {
 	int ret;
 
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	ret = epoll_ctl(evp->me_loop->epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
 	if (ret < 0 && errno == ENOENT)
 		ret = 0;
 
@@ -305,21 +357,25 @@ mevent_disable(struct mevent *evp)
 static void
 mevent_add_to_del_list(struct mevent *evp, int closefd)
 {
-	mevent_qlock();
-	LIST_INSERT_HEAD(&del_head, evp, me_list);
-	mevent_qunlock();
+	struct mevent_loop *loop = evp->me_loop;
+	struct mevent *head;
+
+	head = atomic_load(&loop->del_head);
+	do {
+		evp->me_del_next = head;
+	} while (!atomic_cmpxchg(&loop->del_head, &head, evp));
 
-	mevent_notify();
+	mevent_loop_notify(loop);
 }
 
 static void
-mevent_drain_del_list(void)
+mevent_drain_del_list(struct mevent_loop *loop)
 {
 	struct mevent *evp, *tmpp;
 
-	mevent_qlock();
-	list_foreach_safe(evp, &del_head, me_list, tmpp) {
-		LIST_REMOVE(evp, me_list);
+	evp = atomic_xchg(&loop->del_head, NULL);
+	while (evp) {
+		tmpp = evp->me_del_next;
 		if (evp->closefd) {
 			close(evp->me_fd);
 		}
@@ -327,21 +383,23 @@ mevent_drain_del_list(void)
 		if (evp->teardown)
 			evp->teardown(evp->teardown_param);
 		free(evp);
+		evp = tmpp;
 	}
-	mevent_qunlock();
 }
 
 static int
 mevent_delete_event(struct mevent *evp, int closefd)
 {
-	mevent_qlock();
+	struct mevent_loop *loop = evp->me_loop;
+
+	mevent_qlock(loop);
 	LIST_REMOVE(evp, me_list);
-	mevent_qunlock();
+	mevent_qunlock(loop);
 	evp->me_state = 0;
 	evp->closefd = closefd;
 
-	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
-	if (!is_dispatch_thread() && evp->teardown != NULL) {
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	if (!is_dispatch_thread(loop) && evp->teardown != NULL) {
 		mevent_add_to_del_list(evp, closefd);
 	} else {
 		if (evp->closefd) {
@@ -367,79 +425,197 @@ mevent_delete_close(struct mevent *evp)
 	return mevent_delete_event(evp, 1);
 }
 
+static int
+mevent_loop_open(struct mevent_loop *loop)
+{
+	LIST_INIT(&loop->head);
+	loop->del_head = NULL;
+	loop->closing = false;
+	loop->pipefd[0] = loop->pipefd[1] = 0;
+	loop->epoll_fd = epoll_create1(0);
+
+	return (loop->epoll_fd >= 0) ? 0 : -1;
+}
+
+/*
+ * Open the pipe that will be used for other threads to force
+ * the blocking epoll call to exit by writing to it. Set the
+ * descriptor to non-blocking.
+ */
+static int
+mevent_loop_add_pipe(struct mevent_loop *loop)
+{
+	int fds[2];
+
+	if (pipe2(fds, O_NONBLOCK) < 0) {
+		pr_err("pipe");
+		return -1;
+	}
+
+	/*
+	 * Add internal event handler for the pipe write fd
+	 */
+	if (!mevent_add_loop(loop, fds[0], EVF_READ, mevent_pipe_read,
+			     NULL, NULL, NULL)) {
+		pr_err("pipefd mevent_add failed\n");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	loop->pipefd[0] = fds[0];
+	loop->pipefd[1] = fds[1];
+
+	return 0;
+}
+
+static void
+mevent_loop_wait(struct mevent_loop *loop)
+{
+	struct epoll_event eventlist[MEVENT_MAX];
+	int ret;
+
+	/*
+	 * Block awaiting events
+	 */
+	ret = epoll_wait(loop->epoll_fd, eventlist, MEVENT_MAX, -1);
+
+	if (ret == -1 && errno != EINTR)
+		pr_err("Error return from epoll_wait");
+
+	/*
+	 * Handle reported events
+	 */
+	mevent_handle(eventlist, ret);
+	mevent_drain_del_list(loop);
+}
+
+static void *
+mevent_loop_thread(void *param)
+{
+	struct mevent_loop *loop = param;
+
+	loop->tid = pthread_self();
+	while (!atomic_load(&loop->closing))
+		mevent_loop_wait(loop);
+
+	return NULL;
+}
+
+/**
+ * Get the event loop with the given name, creating it along with its
+ * thread on first use. Returns NULL, meaning the main loop, on failure.
+ */
+struct mevent_loop *
+mevent_loop_get(const char *name)
+{
+	struct mevent_loop *loop = NULL;
+	char tname[16];
+	int i;
+
+	pthread_mutex_lock(&mevent_loops_mutex);
+	for (i = 0; i < mevent_nloops; i++) {
+		if (strcmp(mevent_loops[i]->name, name) == 0) {
+			loop = mevent_loops[i];
+			goto done;
+		}
+	}
+
+	if (mevent_nloops == MEVENT_MAX_LOOPS) {
+		pr_err("mevent: too many loops, %s uses the main loop\n", name);
+		goto done;
+	}
+
+	loop = calloc(1, sizeof(struct mevent_loop));
+	if (!loop)
+		goto done;
+	loop->name = strdup(name);
+	if (!loop->name)
+		goto fail;
+	pthread_mutex_init(&loop->lmutex, NULL);
+	if (mevent_loop_open(loop) < 0)
+		goto fail;
+	if (mevent_loop_add_pipe(loop) < 0)
+		goto fail_epoll;
+
+	if (pthread_create(&loop->tid, NULL, mevent_loop_thread, loop) != 0)
+		goto fail_pipe;
+	snprintf(tname, sizeof(tname), "mevent-%s", name);
+	pthread_setname_np(loop->tid, tname);
+
+	mevent_loops[mevent_nloops++] = loop;
+	goto done;
+
+fail_pipe:
+	mevent_destroy(loop);
+	close(loop->pipefd[1]);
+fail_epoll:
+	close(loop->epoll_fd);
+fail:
+	free((void *)loop->name);
+	free(loop);
+	loop = NULL;
+done:
+	pthread_mutex_unlock(&mevent_loops_mutex);
+	return loop;
+}
+
+static void
+mevent_loop_close(struct mevent_loop *loop)
+{
+	atomic_store(&loop->closing, true);
+	mevent_loop_notify(loop);
+	pthread_join(loop->tid, NULL);
+
+	mevent_destroy(loop);
+	close(loop->epoll_fd);
+	close(loop->pipefd[1]);
+	pthread_mutex_destroy(&loop->lmutex);
+	free((void *)loop->name);
+	free(loop);
+}
+
 static void
 mevent_set_name(void)
 {
-	pthread_setname_np(mevent_tid, "mevent");
+	pthread_setname_np(mevent_main.tid, mevent_main.name);
 }
 
 int
 mevent_init(void)
 {
-	epoll_fd = epoll_create1(0);
-
-	if (epoll_fd >= 0)
-		return 0;
-	else
-		return -1;
+	return mevent_loop_open(&mevent_main);
 }
 
 void
 mevent_deinit(void)
 {
-	mevent_destroy();
-	close(epoll_fd);
-	if (mevent_pipefd[1] != 0)
-		close(mevent_pipefd[1]);
+	int i;
+
+	pthread_mutex_lock(&mevent_loops_mutex);
+	for (i = 0; i < mevent_nloops; i++)
+		mevent_loop_close(mevent_loops[i]);
+	mevent_nloops = 0;
+	pthread_mutex_unlock(&mevent_loops_mutex);
+
+	mevent_destroy(&mevent_main);
+	close(mevent_main.epoll_fd);
+	if (mevent_main.pipefd[1] != 0)
+		close(mevent_main.pipefd[1]);
 }
 
 void
 mevent_dispatch(void)
 {
-	struct epoll_event eventlist[MEVENT_MAX];
-
-	struct mevent *pipev;
-	int ret;
-
-	mevent_tid = pthread_self();
+	mevent_main.tid = pthread_self();
 	mevent_set_name();
 
-	/*
-	 * Open the pipe that will be used for other threads to force
-	 * the blocking kqueue call to exit by writing to it. Set the
-	 * descriptor to non-blocking.
-	 */
-	ret = pipe2(mevent_pipefd, O_NONBLOCK);
-	if (ret < 0) {
-		pr_err("pipe");
+	if (mevent_loop_add_pipe(&mevent_main) < 0)
 		exit(0);
-	}
-
-	/*
-	 * Add internal event handler for the pipe write fd
-	 */
-	pipev = mevent_add(mevent_pipefd[0], EVF_READ, mevent_pipe_read, NULL, NULL, NULL);
-	if (!pipev) {
-		pr_err("pipefd mevent_add failed\n");
-		exit(0);
-	}
 
 	for (;;) {
 		int suspend_mode;
 
-		/*
-		 * Block awaiting events
-		 */
-		ret = epoll_wait(epoll_fd, eventlist, MEVENT_MAX, -1);
-
-		if (ret == -1 && errno != EINTR)
-			pr_err("Error return from epoll_wait");
-
-		/*
-		 * Handle reported events
-		 */
-		mevent_handle(eventlist, ret);
-		mevent_drain_del_list();
+		mevent_loop_wait(&mevent_main);
 
 		suspend_mode = vm_get_suspend_mode();
 		if ((suspend_mode != VM_SUSPEND_NONE) &&
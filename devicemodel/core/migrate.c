@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Live migration of a VM by pre-copy of its memory. While the VM runs, its
+ * memory is sent to the DM of the destination, then over and over the pages
+ * written in the meantime, as tracked by the dirty log of the hypervisor.
+ * The vCPUs and the devices can't be saved while they run, so the cutover
+ * waits for the guest to sleep in S3, as for a snapshot: the last dirty
+ * pages and the state of a snapshot are sent, the destination VM wakes up
+ * from S3 and the source one is powered off. The guest is asked to sleep
+ * by the manager, once the rounds are short.
+ *
+ * The device models write the guest memory behind the dirty log, the pages
+ * they map are recorded in vm_dm_dirty and sent again by the last round, as
+ * are the pages of the rings they keep mapped, at each write.
+ *
+ * Stream, in host byte order, both ends run the same DM:
+ *   struct migrate_rec HELLO, gpa the magic, len the top of the memory
+ *   struct migrate_rec MEM followed by the len bytes of memory at gpa, or
+ *     ZERO for len blank bytes at gpa, as many as needed
+ *   struct migrate_rec STATE followed by the len bytes of the snapshot state
+ * The destination acks the STATE with an int, 0 once it restored it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "vmmapi.h"
+#include "dm.h"
+#include "pm.h"
+#include "snapshot.h"
+#include "migrate.h"
+#include "log.h"
+
+#define MIGRATE_MAGIC		0x5447494d4e524341UL	/* "ACRNMIGT" */
+#define MIGRATE_PAGE_SIZE	4096UL
+#define MIGRATE_PAGE_SHIFT	12
+#define MIGRATE_ROUND_MS	100	/* shortest round */
+#define MIGRATE_TIMEOUT		600	/* for the guest to sleep, in s */
+#define MIGRATE_STATE_MAX	(1 * MB)
+
+/* the HSM needs the dirty bitmap in one huge page */
+#define MIGRATE_BITMAP_SIZE	(2 * MB)
+
+#define MIGRATE_HELLO		0U
+#define MIGRATE_MEM		1U
+#define MIGRATE_ZERO		2U
+#define MIGRATE_STATE		3U
+
+struct migrate_rec {
+	uint32_t	type;
+	uint32_t	reserved;
+	uint64_t	gpa;
+	uint64_t	len;
+};
+
+struct migrate {
+	struct vmctx	*ctx;
+	int		fd;
+	uint64_t	top;		/* end of the tracked memory */
+	uint64_t	*bitmap;	/* set by the hypervisor */
+	uint64_t	pages;		/* sent by the round */
+};
+
+static pthread_mutex_t migrate_mtx = PTHREAD_MUTEX_INITIALIZER;
+static bool migrating;
+
+static int
+migrate_send(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+migrate_recv(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = recv(fd, buf, len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		buf = (char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* "[host:]port", the host being the local one for a listening socket */
+static int
+migrate_socket(const char *addr, bool server)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int fd = -1, on = 1;
+
+	port = strrchr(addr, ':');
+	if (port) {
+		snprintf(host, sizeof(host), "%.*s", (int)(port - addr), addr);
+		port++;
+	} else {
+		host[0] = '\0';
+		port = addr;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = server ? AI_PASSIVE : 0;
+	if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res) != 0) {
+		pr_err("%s: can't resolve %s\n", __func__, addr);
+		return -1;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (server) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+				sizeof(on));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+					listen(fd, 1) == 0)
+				break;
+		} else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		pr_err("%s: can't %s %s (%d)\n", __func__,
+			server ? "listen on" : "connect to", addr, errno);
+	return fd;
+}
+
+static uint64_t
+migrate_top(struct vmctx *ctx)
+{
+	return ctx->highmem ? ctx->highmem_gpa_base + ctx->highmem : 4 * GB;
+}
+
+static bool
+is_ram(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	if (gpa + len <= ctx->lowmem)
+		return true;
+	if (gpa >= 4 * GB - ctx->biosmem && gpa + len <= 4 * GB)
+		return true;
+
+	return ctx->highmem && gpa >= ctx->highmem_gpa_base &&
+		gpa + len <= ctx->highmem_gpa_base + ctx->highmem;
+}
+
+static bool
+page_is_blank(const char *page)
+{
+	const uint64_t *p = (const uint64_t *)page;
+	size_t i;
+
+	for (i = 0; i < MIGRATE_PAGE_SIZE / sizeof(uint64_t); i++) {
+		if (p[i] != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Where the content of the page at gpa is, NULL if blank. Reclaimed memory
+ * is blank, but the blocks of a shared image.
+ */
+static const char *
+page_src(struct vmctx *ctx, vm_paddr_t gpa)
+{
+	char *hva;
+
+	if (hugetlb_is_reclaimed(gpa)) {
+		hva = hugetlb_shared_hva(gpa);
+		return hva ? hva + (gpa & (HUGETLB_RECLAIM_SIZE - 1)) : NULL;
+	}
+
+	hva = ctx->baseaddr + gpa;
+	return page_is_blank(hva) ? NULL : hva;
+}
+
+static int
+send_pages(struct migrate *m, vm_paddr_t gpa, size_t len, const char *src)
+{
+	struct migrate_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = src ? MIGRATE_MEM : MIGRATE_ZERO;
+	rec.gpa = gpa;
+	rec.len = len;
+	if (migrate_send(m->fd, &rec, sizeof(rec)) < 0 ||
+			(src && migrate_send(m->fd, src, len) < 0))
+		return -1;
+
+	m->pages += len / MIGRATE_PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Send the pages found dirty, in runs of contiguous blank or not pages.
+ * The last round adds those the device models mapped since the start.
+ */
+static int
+send_dirty(struct migrate *m, bool last)
+{
+	struct vmctx *ctx = m->ctx;
+	uint64_t i, bits, nwords = m->top >> (MIGRATE_PAGE_SHIFT + 6);
+	vm_paddr_t gpa;
+	const char *src, *next;
+	int b, e;
+
+	m->pages = 0;
+	for (i = 0; i < nwords; i++) {
+		/* the hypervisor only sets bits, take those we consume */
+		bits = m->bitmap[i] ?
+			__atomic_exchange_n(&m->bitmap[i], 0, __ATOMIC_SEQ_CST) : 0;
+		if (last && vm_dm_dirty[i])
+			bits |= __atomic_exchange_n(&vm_dm_dirty[i], 0,
+					__ATOMIC_SEQ_CST);
+
+		for (b = 0; b < 64; b = e) {
+			e = b + 1;
+			gpa = (i * 64 + b) << MIGRATE_PAGE_SHIFT;
+			if (!(bits & (1UL << b)) ||
+					!is_ram(ctx, gpa, MIGRATE_PAGE_SIZE))
+				continue;
+
+			src = page_src(ctx, gpa);
+			for (; e < 64 && (bits & (1UL << e)); e++) {
+				if (!is_ram(ctx, gpa + (e - b) * MIGRATE_PAGE_SIZE,
+						MIGRATE_PAGE_SIZE))
+					break;
+				next = page_src(ctx,
+					gpa + (e - b) * MIGRATE_PAGE_SIZE);
+				if (src ? next != src + (e - b) * MIGRATE_PAGE_SIZE :
+						next != NULL)
+					break;
+			}
+
+			if (send_pages(m, gpa, (e - b) * MIGRATE_PAGE_SIZE,
+					src) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+send_state(struct migrate *m)
+{
+	struct migrate_rec rec;
+	void *state;
+	ssize_t len;
+	int ack = -1;
+
+	len = snapshot_save_state(m->ctx, &state);
+	if (len < 0)
+		return -1;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = MIGRATE_STATE;
+	rec.len = len;
+	if (migrate_send(m->fd, &rec, sizeof(rec)) == 0 &&
+			migrate_send(m->fd, state, len) == 0 &&
+			migrate_recv(m->fd, &ack, sizeof(ack)) == 0 && ack)
+		pr_err("%s: the destination failed to restore the state\n",
+			__func__);
+	free(state);
+
+	return ack;
+}
+
+static void *
+migrate_thread(void *arg)
+{
+	struct migrate *m = arg;
+	struct vmctx *ctx = m->ctx;
+	time_t deadline = time(NULL) + MIGRATE_TIMEOUT;
+	bool held = false, done = false;
+	int round;
+
+	/* the first round sends all the memory */
+	memset(m->bitmap, 0xff, MIGRATE_BITMAP_SIZE);
+	for (round = 0; !held; round++) {
+		/* the VM sleeping, it stays so for the last round */
+		held = vm_hold_suspend();
+		if (vm_dirty_log_sync(ctx) < 0 || send_dirty(m, held) < 0) {
+			pr_err("%s: round %d failed (%d)\n", __func__, round,
+				errno);
+			goto out;
+		}
+		pr_info("%s: round %d sent %lu pages\n", __func__, round,
+			m->pages);
+
+		if (!held && time(NULL) > deadline) {
+			pr_err("%s: the VM didn't sleep in %d s\n", __func__,
+				MIGRATE_TIMEOUT);
+			goto out;
+		}
+		if (!held)
+			usleep(MIGRATE_ROUND_MS * 1000);
+	}
+
+	done = (send_state(m) == 0);
+
+out:
+	vm_dirty_log_stop(ctx);
+	if (held)
+		vm_release_suspend(done);
+	if (done)
+		pr_notice("%s: VM moved after %d rounds\n", __func__, round);
+	else
+		pr_err("%s: migration canceled\n", __func__);
+
+	close(m->fd);
+	munmap(m->bitmap, MIGRATE_BITMAP_SIZE);
+	/* kept for the next migration, a device may still be marking it */
+	vm_dm_dirty = NULL;
+	free(m);
+
+	pthread_mutex_lock(&migrate_mtx);
+	migrating = false;
+	pthread_mutex_unlock(&migrate_mtx);
+	return NULL;
+}
+
+static int
+migrate_start(struct vmctx *ctx, const char *dest)
+{
+	static uint64_t *dm_dirty;
+	struct migrate_rec rec;
+	struct migrate *m;
+	pthread_t tid;
+	void *state;
+	uint64_t top = migrate_top(ctx);
+
+	/* fail now rather than at the cutover, e.g. for a passthrough device */
+	if (snapshot_save_state(ctx, &state) < 0)
+		return -1;
+	free(state);
+
+	if (top / MIGRATE_PAGE_SIZE / 8 > MIGRATE_BITMAP_SIZE) {
+		pr_err("%s: the VM memory is too large to track\n", __func__);
+		return -1;
+	}
+
+	if (dm_dirty == NULL)
+		dm_dirty = calloc(top / MIGRATE_PAGE_SIZE / 64, sizeof(uint64_t));
+	m = calloc(1, sizeof(*m));
+	if (dm_dirty == NULL || m == NULL) {
+		free(m);
+		return -1;
+	}
+	m->ctx = ctx;
+	m->top = top;
+
+	m->bitmap = mmap(NULL, MIGRATE_BITMAP_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+			-1, 0);
+	if (m->bitmap == MAP_FAILED) {
+		pr_err("%s: no huge page for the dirty bitmap\n", __func__);
+		free(m);
+		return -1;
+	}
+
+	m->fd = migrate_socket(dest, false);
+	if (m->fd < 0)
+		goto err;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = MIGRATE_HELLO;
+	rec.gpa = MIGRATE_MAGIC;
+	rec.len = top;
+	if (migrate_send(m->fd, &rec, sizeof(rec)) < 0)
+		goto err;
+
+	memset(dm_dirty, 0, top / MIGRATE_PAGE_SIZE / 8);
+	vm_dm_dirty = dm_dirty;
+	if (vm_dirty_log_start(ctx, 0, top, m->bitmap) < 0) {
+		pr_err("%s: failed to track the VM memory (%d)\n", __func__,
+			errno);
+		goto err;
+	}
+
+	if (pthread_create(&tid, NULL, migrate_thread, m) != 0) {
+		vm_dirty_log_stop(ctx);
+		goto err;
+	}
+	pthread_setname_np(tid, "migrate");
+	pthread_detach(tid);
+	return 0;
+
+err:
+	vm_dm_dirty = NULL;
+	if (m->fd >= 0)
+		close(m->fd);
+	munmap(m->bitmap, MIGRATE_BITMAP_SIZE);
+	free(m);
+	return -1;
+}
+
+int
+vm_monitor_migrate(void *arg, char *dest)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+	int ret = -1;
+
+	pthread_mutex_lock(&migrate_mtx);
+	if (migrating)
+		pr_err("%s: the VM is already migrating\n", __func__);
+	else if (vm_get_suspend_mode() != VM_SUSPEND_NONE)
+		pr_err("%s: the VM is not running\n", __func__);
+	else {
+		ret = migrate_start(ctx, dest);
+		migrating = (ret == 0);
+	}
+	pthread_mutex_unlock(&migrate_mtx);
+
+	if (ret == 0)
+		pr_notice("%s: migrating to %s\n", __func__, dest);
+	return ret;
+}
+
+static int
+recv_state(struct vmctx *ctx, int fd, size_t len)
+{
+	void *state;
+	int ret = -1;
+
+	if (len > MIGRATE_STATE_MAX)
+		return -1;
+
+	state = malloc(len);
+	if (state && migrate_recv(fd, state, len) == 0)
+		ret = snapshot_restore_state(ctx, state, len);
+	free(state);
+
+	/* a failure is told to the source, which then keeps the VM */
+	if (migrate_send(fd, &ret, sizeof(ret)) < 0)
+		ret = -1;
+	return ret;
+}
+
+int
+vm_migrate_incoming(struct vmctx *ctx, const char *addr)
+{
+	struct migrate_rec rec;
+	int lfd, fd, ret = -1;
+
+	lfd = migrate_socket(addr, true);
+	if (lfd < 0)
+		return -1;
+
+	pr_notice("%s: waiting on %s\n", __func__, addr);
+	do {
+		fd = accept(lfd, NULL, NULL);
+	} while (fd < 0 && errno == EINTR);
+	close(lfd);
+	if (fd < 0)
+		return -1;
+
+	if (migrate_recv(fd, &rec, sizeof(rec)) < 0 ||
+			rec.type != MIGRATE_HELLO || rec.gpa != MIGRATE_MAGIC ||
+			rec.len != migrate_top(ctx)) {
+		pr_err("%s: not a migration of a VM of this layout\n",
+			__func__);
+		goto done;
+	}
+
+	while (migrate_recv(fd, &rec, sizeof(rec)) == 0) {
+		if ((rec.type == MIGRATE_MEM || rec.type == MIGRATE_ZERO) &&
+				!is_ram(ctx, rec.gpa, rec.len)) {
+			pr_err("%s: 0x%lx@0x%lx is not guest memory\n",
+				__func__, rec.len, rec.gpa);
+			break;
+		}
+
+		if (rec.type == MIGRATE_MEM) {
+			if (migrate_recv(fd, ctx->baseaddr + rec.gpa,
+					rec.len) < 0)
+				break;
+		} else if (rec.type == MIGRATE_ZERO) {
+			memset(ctx->baseaddr + rec.gpa, 0, rec.len);
+		} else {
+			if (rec.type == MIGRATE_STATE)
+				ret = recv_state(ctx, fd, rec.len);
+			break;
+		}
+	}
+
+done:
+	if (ret)
+		pr_err("%s: migration failed (%d)\n", __func__, errno);
+	else
+		pr_notice("%s: VM received\n", __func__);
+	close(fd);
+	return ret;
+}
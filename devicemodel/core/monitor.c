@@ -15,14 +15,21 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <errno.h>
 #include "dm.h"
 #include "dm_string.h"
 #include "monitor.h"
 #include "acrn_mngr.h"
 #include "pm.h"
+#include "migrate.h"
 #include "vmmapi.h"
+#include "inout.h"
+#include "pci_core.h"
+#include "virtio.h"
 #include "log.h"
 
 #define INTR_STORM_MONITOR_PERIOD	10 /* 10 seconds */
@@ -46,13 +53,23 @@ union intr_monitor_t {
 } __aligned(4096);
 
 static union intr_monitor_t intr_data;
-static uint64_t intr_cnt_buf[MAX_PTDEV_NUM * 2];
 static pthread_t intr_storm_monitor_pid;
 
 static struct intr_monitor_setting_t intr_monitor_setting = {
 	.enable = false,
 };
 
+struct intr_coalesce_setting_t {
+	bool enable;
+	uint32_t window;	/* us: interrupts within it are merged into one injection */
+	uint32_t threshold;	/* intr count in a window that turns coalescing on */
+	uint32_t max_merged;	/* most intrs merged into one injection, 0 for no limit */
+};
+
+static struct intr_coalesce_setting_t intr_coalesce_setting = {
+	.enable = false,
+};
+
 /* switch macro, just open in debug */
 /* #define INTR_MONITOR_DBG */
 
@@ -83,24 +100,34 @@ static void write_intr_data_to_file(const struct acrn_intr_monitor *hdr)
 #define DPRINTF(format, arg...)
 #endif
 
+/*
+ * Get the ptdevs which took more than @threshold interrupts since the last
+ * call, the hypervisor keeps the counts of the previous call.
+ */
+static int intr_monitor_get_delta(struct vmctx *ctx, struct acrn_intr_monitor *hdr,
+				  uint64_t threshold)
+{
+	hdr->cmd = INTR_CMD_GET_DELTA;
+	hdr->buf_cnt = MAX_PTDEV_NUM * 2;
+	memset(hdr->buffer, 0, sizeof(uint64_t) * hdr->buf_cnt);
+	hdr->buffer[0] = threshold + 1UL;
+
+	return vm_intr_monitor(ctx, hdr);
+}
+
 static void *intr_storm_monitor_thread(void *arg)
 {
 	struct vmctx *ctx = (struct vmctx *)arg;
 	struct acrn_intr_monitor *hdr = &intr_data.monitor;
-	uint64_t delta = 0UL;
-	int ret, i;
+	int ret;
 
 #ifdef INTR_MONITOR_DBG
 	dbg_file = fopen("/tmp/intr_log", "w+");
 #endif
 	sleep(intr_monitor_setting.probe_period);
 
-	/* first to get interrupt data */
-	hdr->cmd = INTR_CMD_GET_DATA;
-	hdr->buf_cnt = MAX_PTDEV_NUM * 2;
-	memset(hdr->buffer, 0, sizeof(uint64_t) * hdr->buf_cnt);
-
-	ret = vm_intr_monitor(ctx, hdr);
+	/* first to start counting from now, nothing is reported */
+	ret = intr_monitor_get_delta(ctx, hdr, UINT64_MAX - 1UL);
 	if (ret) {
 		DPRINTF("first get intr data failed, ret: %d\n", ret);
 		intr_storm_monitor_pid = 0;
@@ -108,47 +135,22 @@ static void *intr_storm_monitor_thread(void *arg)
 	}
 
 	while (1) {
-#ifdef INTR_MONITOR_DBG
-		write_intr_data_to_file(hdr);
-#endif
-		memcpy(intr_cnt_buf, hdr->buffer, sizeof(uint64_t) * hdr->buf_cnt);
 		sleep(intr_monitor_setting.probe_period);
 
-		/* next time to get interrupt data */
-		memset(hdr->buffer, 0, sizeof(uint64_t) * hdr->buf_cnt);
-		ret = vm_intr_monitor(ctx, hdr);
+		/* only the ptdevs above the threshold are reported */
+		ret = intr_monitor_get_delta(ctx, hdr, intr_monitor_setting.threshold);
 		if (ret) {
 			pr_err("next get intr data failed, ret: %d\n", ret);
 			intr_storm_monitor_pid = 0;
 			break;
 		}
 
-		/*
-		 * calc the delta of the two times count of interrupt;
-		 * compare the IRQ num first, if not same just drop it,
-		 * for it just happens rarelly when devices dynamically
-		 * allocation in SOS or UOS, it can be calc next time
-		 */
-		for (i = 0; i < hdr->buf_cnt; i += 2) {
-			if (hdr->buffer[i] != intr_cnt_buf[i])
-				continue;
-
-			/* avoid delta overflow */
-			if (hdr->buffer[i + 1] < intr_cnt_buf[i + 1])
-				continue;
-
-			delta = hdr->buffer[i + 1] - intr_cnt_buf[i + 1];
-			if (delta > intr_monitor_setting.threshold) {
+		/* storm detected, handle the intr abnormal status */
+		if (hdr->buf_cnt != 0) {
 #ifdef INTR_MONITOR_DBG
-				write_intr_data_to_file(hdr);
+			write_intr_data_to_file(hdr);
 #endif
-				break;
-			}
-		}
-
-		/* storm detected, handle the intr abnormal status */
-		if (i < hdr->buf_cnt) {
-			pr_notice("irq=%ld, delta=%ld\n", intr_cnt_buf[i], delta);
+			pr_notice("irq=%ld, delta=%ld\n", hdr->buffer[0], hdr->buffer[1]);
 
 			hdr->cmd = INTR_CMD_DELAY_INT;
 			hdr->buffer[0] = intr_monitor_setting.delay_time;
@@ -158,10 +160,7 @@ static void *intr_storm_monitor_thread(void *arg)
 			vm_intr_monitor(ctx, hdr);
 
 			sleep(TIME_TO_CHECK_AGAIN); /* time to get data again */
-			hdr->cmd = INTR_CMD_GET_DATA;
-			hdr->buf_cnt = MAX_PTDEV_NUM * 2;
-			memset(hdr->buffer, 0, sizeof(uint64_t) * hdr->buf_cnt);
-			vm_intr_monitor(ctx, hdr);
+			intr_monitor_get_delta(ctx, hdr, UINT64_MAX - 1UL);
 		}
 	}
 
@@ -182,6 +181,23 @@ static void start_intr_storm_monitor(struct vmctx *ctx)
 	}
 }
 
+static void set_intr_coalesce(struct vmctx *ctx)
+{
+	struct acrn_intr_monitor *hdr = &intr_data.monitor;
+
+	if (!intr_coalesce_setting.enable)
+		return;
+
+	hdr->cmd = INTR_CMD_COALESCE_INT;
+	hdr->buf_cnt = 4;
+	hdr->buffer[0] = INTR_COALESCE_ALL_IRQS;
+	hdr->buffer[1] = intr_coalesce_setting.window;
+	hdr->buffer[2] = intr_coalesce_setting.threshold;
+	hdr->buffer[3] = intr_coalesce_setting.max_merged;
+	if (vm_intr_monitor(ctx, hdr))
+		pr_err("failed to set the interrupt coalescing policy\n");
+}
+
 static void stop_intr_storm_monitor(void)
 {
 	if (intr_storm_monitor_pid) {
@@ -226,6 +242,41 @@ int acrn_parse_intr_monitor(const char *opt)
 	return 0;
 }
 
+/*
+.* interrupt coalescing setting params, the pass-through devices' interrupts
+.* arriving within a window are merged into one injection at its end:
+.* window: us -- the coalescing window;
+.* threshold: intr count in a window that turns coalescing on, it goes off
+.*            again after a window with fewer;
+.* max_merged: optional, most intrs merged into one injection.
+.*/
+int acrn_parse_intr_coalesce(const char *opt)
+{
+	uint32_t window, threshold, max_merged = 0;
+	char *cp;
+
+	if ((!dm_strtoui(opt, &cp, 10, &window) && *cp == ',') &&
+		(!dm_strtoui(cp + 1, &cp, 10, &threshold)) &&
+		((*cp == '\0') || (*cp == ',' && !dm_strtoui(cp + 1, &cp, 10, &max_merged)))) {
+		pr_dbg("interrupt coalescing params: %d, %d, %d\n", window, threshold, max_merged);
+	} else {
+		pr_err("%s: not correct, it should be like: --intr_coalesce 100,4,16, please check!\n", opt);
+		return -1;
+	}
+
+	if (window == 0) {
+		pr_err("interrupt coalescing window can't be 0\n");
+		return -1;
+	}
+
+	intr_coalesce_setting.enable = true;
+	intr_coalesce_setting.window = window;
+	intr_coalesce_setting.threshold = threshold;
+	intr_coalesce_setting.max_merged = max_merged;
+
+	return 0;
+}
+
 struct vm_ops {
 	char name[16];
 	void *arg;
@@ -308,6 +359,35 @@ static int monitor_fd = -1;
 /* handlers */
 #define ACK_TIMEOUT	1
 
+/*
+ * Push the new state of the VM to acrnd when it launched this acrn-dm, so
+ * that acrnd keeps the states of its VMs without querying them.
+ */
+void monitor_notify_state(int state)
+{
+	int acrnd_fd;
+	struct mngr_msg req;
+
+	if (getenv("ACRN_DM_NOTIFY") == NULL)
+		return;
+
+	acrnd_fd = mngr_open_un("acrnd", MNGR_CLIENT);
+	if (acrnd_fd < 0)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_NOTIFY;
+	req.timestamp = time(NULL);
+	strncpy(req.data.dm_notify.name, vmname,
+			sizeof(req.data.dm_notify.name) - 1);
+	req.data.dm_notify.pid = getpid();
+	req.data.dm_notify.state = state;
+
+	mngr_send_msg(acrnd_fd, &req, NULL, ACK_TIMEOUT);
+	mngr_close(acrnd_fd);
+}
+
 #define DEFINE_HANDLER(name, func)				\
 static void name(struct mngr_msg *msg, int client_fd, void *param)	\
 {									\
@@ -350,7 +430,9 @@ static void handle_stop(struct mngr_msg *msg, int client_fd, void *param)
 	ack.msgid = msg->msgid;
 	ack.timestamp = msg->timestamp;
 
-	if (msg->data.acrnd_stop.force && !is_rtvm) {
+	if (vm_stop_warm()) {
+		ack.data.err = 0;
+	} else if (msg->data.acrnd_stop.force && !is_rtvm) {
 		pr_info("%s: setting VM state to %s\n", __func__, vm_state_to_str(VM_SUSPEND_POWEROFF));
 		vm_set_suspend_mode(VM_SUSPEND_POWEROFF);
 		ack.data.err = 0;
@@ -450,6 +532,468 @@ static void handle_blkrescan(struct mngr_msg *msg, int client_fd, void *param)
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
 
+/*
+ * The devargs of DM_START are empty or "slot,newpath" to attach a disk image
+ * to a virtio-blk device of the warm VM before its vCPUs start, as DM_BLKRESCAN.
+ */
+static void handle_start(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	msg->data.devargs[PARAM_LEN - 1] = '\0';
+	if (msg->data.devargs[0] != '\0') {
+		LIST_FOREACH(ops, &vm_ops_head, list) {
+			if (ops->ops->rescan) {
+				ret += ops->ops->rescan(ops->arg, msg->data.devargs);
+				count++;
+			}
+		}
+		if (!count)
+			ret = -1;
+	}
+
+	count = 0;
+	if (!ret) {
+		LIST_FOREACH(ops, &vm_ops_head, list) {
+			if (ops->ops->start) {
+				ret += ops->ops->start(ops->arg);
+				count++;
+			}
+		}
+	}
+
+	if (!ret && !count) {
+		ack.data.err = -1;
+		pr_err("No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_blkthrottle(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->throttle) {
+			ret += ops->ops->throttle(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		pr_err("No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_snapshot(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	msg->data.devargs[PARAM_LEN - 1] = '\0';
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->snapshot) {
+			ret += ops->ops->snapshot(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		pr_err("No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+/*
+ * DM_MIGRATE is acked once the migration is started, the VM is powered
+ * off when it's done.
+ */
+static void handle_migrate(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	msg->data.devargs[PARAM_LEN - 1] = '\0';
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->migrate) {
+			ret += ops->ops->migrate(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		pr_err("No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_balloon(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	msg->data.devargs[PARAM_LEN - 1] = '\0';
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->balloon) {
+			ret += ops->ops->balloon(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		pr_err("No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+/*
+ * The devargs of DM_RDT are "vcpu_id[,l3=mask][,l2=mask][,mba=delay]", the
+ * ack carries the settings and counters of the CLOS of the vCPU as a string,
+ * or an error message starting with "error".
+ */
+static int parse_rdt_args(char *devargs, struct acrn_rdt_clos *rdt)
+{
+	char *str, *nstr, *opt;
+	unsigned int vcpu_id;
+	int ret = -1;
+
+	nstr = str = strdup(devargs);
+	if (!str)
+		return -1;
+
+	opt = strsep(&str, ",");
+	if (!dm_strtoui(opt, &opt, 10, &vcpu_id) && *opt == '\0') {
+		rdt->vcpu_id = vcpu_id;
+		ret = 0;
+	}
+	while (!ret && (opt = strsep(&str, ",")) != NULL) {
+		if (!strncmp(opt, "l3=", 3) &&
+				!dm_strtoui(opt + 3, NULL, 0, &rdt->l3_mask))
+			rdt->set_flags |= ACRN_RDT_L3_MASK;
+		else if (!strncmp(opt, "l2=", 3) &&
+				!dm_strtoui(opt + 3, NULL, 0, &rdt->l2_mask))
+			rdt->set_flags |= ACRN_RDT_L2_MASK;
+		else if (!strncmp(opt, "mba=", 4) &&
+				!dm_strtoui(opt + 4, NULL, 0, &rdt->mba_delay))
+			rdt->set_flags |= ACRN_RDT_MBA_DELAY;
+		else
+			ret = -1;
+	}
+
+	free(nstr);
+	return ret;
+}
+
+static void handle_rdt(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct vmctx *ctx = param;
+	struct acrn_rdt_clos rdt;
+	struct mngr_msg ack;
+	char *buf = ack.data.devargs;
+	size_t len = PARAM_LEN;
+	int n;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	msg->data.devargs[PARAM_LEN - 1] = '\0';
+	bzero(&rdt, sizeof(rdt));
+	if (parse_rdt_args(msg->data.devargs, &rdt)) {
+		/* the echoed arguments may not fit after the prefix */
+		if (snprintf(buf, len, "error: invalid arguments %s",
+				msg->data.devargs) >= len)
+			pr_dbg("%s: truncated the echoed arguments\n", __func__);
+	} else if (vm_rdt_clos(ctx, &rdt)) {
+		snprintf(buf, len, "error: RDT of vcpu %u failed: %s",
+				rdt.vcpu_id, strerror(errno));
+	} else {
+		n = snprintf(buf, len, "vcpu %u clos %u", rdt.vcpu_id, rdt.clos);
+		if (n > 0 && (rdt.flags & ACRN_RDT_L3_MASK))
+			n += snprintf(buf + n, len - n, " l3=0x%x", rdt.l3_mask);
+		if (n > 0 && (rdt.flags & ACRN_RDT_L2_MASK))
+			n += snprintf(buf + n, len - n, " l2=0x%x", rdt.l2_mask);
+		if (n > 0 && (rdt.flags & ACRN_RDT_MBA_DELAY))
+			n += snprintf(buf + n, len - n, " mba=%u", rdt.mba_delay);
+		if (n > 0 && (rdt.flags & ACRN_RDT_L3_OCCUPANCY))
+			n += snprintf(buf + n, len - n, " l3_occupancy=%lu",
+					rdt.l3_occupancy);
+		if (n > 0 && (rdt.flags & ACRN_RDT_MBM_TOTAL))
+			n += snprintf(buf + n, len - n, " mbm_total=%lu",
+					rdt.mbm_total);
+		if (n > 0 && (rdt.flags & ACRN_RDT_MBM_LOCAL))
+			snprintf(buf + n, len - n, " mbm_local=%lu",
+					rdt.mbm_local);
+	}
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+/*
+ * The ack of DM_PIOSTAT carries the most accessed I/O ports of the UOS as a
+ * string, see inout_get_stats().
+ */
+#define PIOSTAT_PORTS	8
+
+static void handle_piostat(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	if (inout_get_stats(ack.data.devargs, PARAM_LEN, PIOSTAT_PORTS))
+		snprintf(ack.data.devargs, PARAM_LEN, "error: no statistics");
+	else if (ack.data.devargs[0] == '\0')
+		snprintf(ack.data.devargs, PARAM_LEN, "no port accessed");
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+/*
+ * The subscribers of DM_SUBSCRIBE share one frame per period. A subscriber
+ * that can't take a whole frame at once, by disconnecting or falling
+ * behind, is dropped, so nobody stalls the stream.
+ */
+#define STATS_MAX_SUBS		16
+#define STATS_FRAME_LEN		8192
+#define STATS_MAX_VQS		16
+
+static int stats_fds[STATS_MAX_SUBS];
+static int stats_nr_subs;
+static pthread_mutex_t stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t stats_tid;
+static uint8_t stats_frame[STATS_FRAME_LEN];
+
+struct stats_buf {
+	uint8_t *buf;
+	size_t len;
+	uint16_t nr_recs;
+};
+
+static void *
+stats_add_rec(struct stats_buf *sb, uint8_t type, uint16_t id, size_t len)
+{
+	struct dm_stats_rec *rec;
+
+	if (len > UINT8_MAX || sb->len + len > STATS_FRAME_LEN)
+		return NULL;
+
+	rec = (struct dm_stats_rec *)(sb->buf + sb->len);
+	rec->type = type;
+	rec->len = len;
+	rec->id = id;
+	sb->len += len;
+	sb->nr_recs++;
+
+	return rec;
+}
+
+static int
+stats_add_vdev(struct pci_vdev *dev, void *arg)
+{
+	struct stats_buf *sb = arg;
+	struct dm_stats_dev *drec;
+	struct dm_stats_vq *vrec;
+	uint16_t depth[STATS_MAX_VQS];
+	uint16_t bdf = PCI_BDF(dev->bus, dev->slot, dev->func);
+	int nr;
+
+	drec = stats_add_rec(sb, DM_STATS_DEV, bdf, sizeof(*drec));
+	if (drec == NULL)
+		return -1;
+	drec->accesses = dev->bar_accesses;
+
+	nr = virtio_get_vq_depths(dev, depth, STATS_MAX_VQS);
+	if (nr < 0)
+		return 0;
+
+	vrec = stats_add_rec(sb, DM_STATS_VQ, bdf,
+			sizeof(*vrec) + nr * sizeof(uint16_t));
+	if (vrec == NULL)
+		return -1;
+	vrec->nr_vqs = nr;
+	memcpy(vrec->depth, depth, nr * sizeof(uint16_t));
+
+	return 0;
+}
+
+/* Return the length of the frame, a full frame just misses the last records */
+static size_t
+stats_build_frame(uint32_t seq)
+{
+	struct dm_stats_hdr *hdr = (struct dm_stats_hdr *)stats_frame;
+	struct dm_stats_ioreq *irec;
+	struct stats_buf sb;
+	struct timespec ts;
+	uint64_t nr[VM_EXITCODE_MAX], cycles[VM_EXITCODE_MAX];
+	int type;
+
+	sb.buf = stats_frame;
+	sb.len = sizeof(*hdr);
+	sb.nr_recs = 0;
+
+	vm_get_ioreq_stats(nr, cycles);
+	for (type = 0; type < VM_EXITCODE_MAX; type++) {
+		if (nr[type] == 0)
+			continue;
+		irec = stats_add_rec(&sb, DM_STATS_IOREQ, type, sizeof(*irec));
+		if (irec == NULL)
+			break;
+		irec->count = nr[type];
+		irec->cycles = cycles[type];
+	}
+	pci_walk_vdevs(stats_add_vdev, &sb);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	hdr->magic = DM_STATS_MAGIC;
+	hdr->version = DM_STATS_VERSION;
+	hdr->nr_recs = sb.nr_recs;
+	hdr->len = sb.len;
+	hdr->seq = seq;
+	hdr->timestamp = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+
+	return sb.len;
+}
+
+static void *
+stats_thread(void *arg)
+{
+	uint32_t seq = 0;
+	size_t len;
+	int i;
+
+	while (1) {
+		usleep(DM_STATS_PERIOD_MS * 1000);
+
+		/* a stale count just skips or wastes one frame */
+		if (stats_nr_subs == 0)
+			continue;
+
+		len = stats_build_frame(seq++);
+
+		pthread_mutex_lock(&stats_mtx);
+		for (i = 0; i < stats_nr_subs; ) {
+			if (send(stats_fds[i], stats_frame, len,
+				 MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)len) {
+				i++;
+				continue;
+			}
+			pr_info("%s: drop stats subscriber %d\n", __func__,
+				stats_fds[i]);
+			close(stats_fds[i]);
+			stats_fds[i] = stats_fds[--stats_nr_subs];
+		}
+		pthread_mutex_unlock(&stats_mtx);
+	}
+
+	return NULL;
+}
+
+static void handle_subscribe(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	int fd = -1;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	ack.data.err = -1;
+
+	pthread_mutex_lock(&stats_mtx);
+	if (stats_nr_subs >= STATS_MAX_SUBS) {
+		pr_err("%s: too many stats subscribers\n", __func__);
+		goto out;
+	}
+
+	if (!stats_tid) {
+		if (pthread_create(&stats_tid, NULL, stats_thread, NULL)) {
+			pr_err("%s: failed to create the stats thread\n", __func__);
+			stats_tid = 0;
+			goto out;
+		}
+		pthread_setname_np(stats_tid, "stats_monitor");
+	}
+
+	/* the connection outlives the fd of the manager by this */
+	fd = dup(client_fd);
+	if (fd < 0) {
+		pr_err("%s: failed to dup %d\n", __func__, client_fd);
+		goto out;
+	}
+	ack.data.err = 0;
+
+ out:
+	/* the ack goes first, no frame can be sent to fd yet */
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+	if (fd >= 0)
+		stats_fds[stats_nr_subs++] = fd;
+	pthread_mutex_unlock(&stats_mtx);
+}
+
+static void stop_stats_monitor(void)
+{
+	int i;
+
+	if (stats_tid) {
+		pthread_cancel(stats_tid);
+		pthread_join(stats_tid, NULL);
+		stats_tid = 0;
+	}
+
+	for (i = 0; i < stats_nr_subs; i++)
+		close(stats_fds[i]);
+	stats_nr_subs = 0;
+}
+
 static struct monitor_vm_ops pmc_ops = {
 	.stop       = NULL,
 	.resume     = vm_monitor_resume,
@@ -457,6 +1001,9 @@ static struct monitor_vm_ops pmc_ops = {
 	.pause      = NULL,
 	.unpause    = NULL,
 	.query      = vm_monitor_query,
+	.snapshot   = vm_monitor_snapshot,
+	.start      = vm_monitor_start,
+	.migrate    = vm_monitor_migrate,
 };
 
 int monitor_init(struct vmctx *ctx)
@@ -490,6 +1037,14 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_RESUME, handle_resume, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_BLKRESCAN, handle_blkrescan, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BLKTHROTTLE, handle_blkthrottle, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_SNAPSHOT, handle_snapshot, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BALLOON, handle_balloon, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_RDT, handle_rdt, ctx);
+	ret += mngr_add_handler(monitor_fd, DM_START, handle_start, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_PIOSTAT, handle_piostat, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_SUBSCRIBE, handle_subscribe, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_MIGRATE, handle_migrate, NULL);
 
 	if (ret) {
 		pr_err("%s %d\r\n", __func__, __LINE__);
@@ -498,6 +1053,10 @@ int monitor_init(struct vmctx *ctx)
 
 	monitor_register_vm_ops(&pmc_ops, ctx, "PMC_VM_OPs");
 
+	/* the monitor can be found now, tell acrnd where the VM stands */
+	monitor_notify_state(vm_get_suspend_mode());
+
+	set_intr_coalesce(ctx);
 	start_intr_storm_monitor(ctx);
 
 	return 0;
@@ -516,4 +1075,5 @@ void monitor_close(void)
 		mngr_close(monitor_fd);
 
 	stop_intr_storm_monitor();
+	stop_stats_monitor();
 }
@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <time.h>
 #include "vmmapi.h"
+#include "snapshot.h"
 #include "log.h"
 
 static pthread_cond_t suspend_cond = PTHREAD_COND_INITIALIZER;
@@ -50,3 +52,120 @@ vm_monitor_query(void *arg)
 {
 	return vm_get_suspend_mode();
 }
+
+/*
+ * A warm VM is fully set up but its vCPUs are not started until the
+ * manager asks for it, so that the launch only costs the start request.
+ * The wait times out every second to catch a termination signal, which
+ * sets the VM state without waking us up.
+ *
+ * Return 0 once started, -1 if the VM was stopped instead.
+ */
+int
+wait_for_warm_start(struct vmctx *ctx)
+{
+	struct timespec ts;
+	int ret;
+
+	pthread_mutex_lock(&suspend_mutex);
+	pr_info("%s: setting VM state to %s\n", __func__, vm_state_to_str(VM_SUSPEND_WARM));
+	vm_set_suspend_mode(VM_SUSPEND_WARM);
+	while (vm_get_suspend_mode() == VM_SUSPEND_WARM) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&suspend_cond, &suspend_mutex, &ts);
+	}
+	ret = (vm_get_suspend_mode() == VM_SUSPEND_NONE) ? 0 : -1;
+	pthread_mutex_unlock(&suspend_mutex);
+
+	return ret;
+}
+
+int
+vm_monitor_start(void *arg)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&suspend_mutex);
+	if (vm_get_suspend_mode() == VM_SUSPEND_WARM) {
+		pr_info("%s: setting VM state to %s\n", __func__, vm_state_to_str(VM_SUSPEND_NONE));
+		vm_set_suspend_mode(VM_SUSPEND_NONE);
+		pthread_cond_signal(&suspend_cond);
+		ret = 0;
+	} else
+		pr_err("%s: VM is not warm\n", __func__);
+	pthread_mutex_unlock(&suspend_mutex);
+
+	return ret;
+}
+
+/*
+ * Stop a warm VM, there is no guest yet to ask for a shutdown.
+ *
+ * Return true if the VM was warm.
+ */
+bool
+vm_stop_warm(void)
+{
+	bool warm = false;
+
+	pthread_mutex_lock(&suspend_mutex);
+	if (vm_get_suspend_mode() == VM_SUSPEND_WARM) {
+		pr_info("%s: setting VM state to %s\n", __func__, vm_state_to_str(VM_SUSPEND_POWEROFF));
+		vm_set_suspend_mode(VM_SUSPEND_POWEROFF);
+		pthread_cond_signal(&suspend_cond);
+		warm = true;
+	}
+	pthread_mutex_unlock(&suspend_mutex);
+
+	return warm;
+}
+
+/*
+ * Keep a VM sleeping in S3 from being resumed until vm_release_suspend(),
+ * for the state saved to match its memory.
+ *
+ * Return false, holding nothing, if the VM is not sleeping.
+ */
+bool
+vm_hold_suspend(void)
+{
+	pthread_mutex_lock(&suspend_mutex);
+	if (vm_get_suspend_mode() == VM_SUSPEND_SUSPEND)
+		return true;
+	pthread_mutex_unlock(&suspend_mutex);
+
+	return false;
+}
+
+/* Let a held VM be resumed, or power it off, e.g. once it moved elsewhere */
+void
+vm_release_suspend(bool poweroff)
+{
+	if (poweroff) {
+		pr_info("%s: setting VM state to %s\n", __func__, vm_state_to_str(VM_SUSPEND_POWEROFF));
+		vm_set_suspend_mode(VM_SUSPEND_POWEROFF);
+		pthread_cond_signal(&suspend_cond);
+	}
+	pthread_mutex_unlock(&suspend_mutex);
+}
+
+/*
+ * Only a VM sleeping in S3 can be saved, holding suspend_mutex keeps a
+ * resume request from waking it up while the snapshot is taken.
+ */
+int
+vm_monitor_snapshot(void *arg, char *path)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+	int ret = -1;
+
+	pthread_mutex_lock(&suspend_mutex);
+	if (vm_get_suspend_mode() == VM_SUSPEND_SUSPEND)
+		ret = vm_snapshot_save(ctx, path);
+	else
+		pr_err("%s: VM is not suspended\n", __func__);
+	pthread_mutex_unlock(&suspend_mutex);
+
+	return ret;
+}
@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * VM snapshots are taken while the guest sleeps in S3: the guest has
+ * parked its own CPU and device state in memory and a resume only
+ * needs the firmware entry state, the platform registers and the memory
+ * back. A VM restored from a snapshot boots straight into the S3 resume
+ * path instead of going through acrn_sw_load() and the guest OS boot.
+ *
+ * File layout:
+ *   struct snapshot_header
+ *   struct snapshot_pci_dev * ndevs
+ *   guest memory at mem_offset: lowmem, highmem, then biosmem
+ *
+ * Blank guest pages are left as holes, so the file is as large as the
+ * memory the guest really uses and a restore only reads that part.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "vmmapi.h"
+#include "dm.h"
+#include "macros.h"
+#include "pci_core.h"
+#include "acpi.h"
+#include "rtc.h"
+#include "snapshot.h"
+#include "log.h"
+
+#define SNAPSHOT_MAGIC		0x50414e534e524341UL	/* "ACRNSNAP" */
+#define SNAPSHOT_VERSION	1U
+#define SNAPSHOT_PAGE_SIZE	4096UL
+#define SNAPSHOT_CMOS_SIZE	128
+#define SNAPSHOT_MEM_REGIONS	3
+
+struct snapshot_header {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	ndevs;		/* PCI device records after the header */
+	uint64_t	lowmem;
+	uint64_t	biosmem;
+	uint64_t	highmem;
+	uint64_t	highmem_gpa_base;
+	uint64_t	mem_offset;	/* file offset of guest memory */
+	struct acrn_set_vcpu_regs bsp_regs;
+	struct pm1_state pm1;
+	uint8_t		cmos[SNAPSHOT_CMOS_SIZE];
+};
+
+struct snapshot_pci_dev {
+	uint8_t		bus;
+	uint8_t		slot;
+	uint8_t		func;
+	uint8_t		reserved[5];
+	uint8_t		cfgdata[PCI_REGMAX + 1];
+};
+
+struct snapshot_mem {
+	uint64_t	gpa;
+	size_t		len;
+};
+
+struct snapshot_devs {
+	struct vmctx	*ctx;
+	uint32_t	ndevs;
+	uint32_t	found;
+	struct snapshot_pci_dev *recs;
+};
+
+static int
+snapshot_write(int fd, const void *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+static int
+snapshot_read(int fd, void *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		buf = (char *)buf + n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+static int
+snapshot_mem_regions(struct vmctx *ctx, struct snapshot_mem *mem)
+{
+	int n = 0;
+
+	mem[n].gpa = 0;
+	mem[n++].len = ctx->lowmem;
+	if (ctx->highmem > 0) {
+		mem[n].gpa = ctx->highmem_gpa_base;
+		mem[n++].len = ctx->highmem;
+	}
+	if (ctx->biosmem > 0) {
+		mem[n].gpa = 4 * GB - ctx->biosmem;
+		mem[n++].len = ctx->biosmem;
+	}
+
+	return n;
+}
+
+static bool
+page_is_blank(const char *page)
+{
+	const uint64_t *p = (const uint64_t *)page;
+	size_t i;
+
+	for (i = 0; i < SNAPSHOT_PAGE_SIZE / sizeof(uint64_t); i++) {
+		if (p[i] != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static int
+snapshot_save_mem(struct vmctx *ctx, int fd, off_t off)
+{
+	struct snapshot_mem mem[SNAPSHOT_MEM_REGIONS];
+	size_t pg, end;
+	char *hva, *shared;
+	int i, n;
+
+	n = snapshot_mem_regions(ctx, mem);
+	for (i = 0; i < n; i++) {
+		hva = ctx->baseaddr + mem[i].gpa;
+
+		/*
+		 * write the runs of used pages, the blank ones stay holes, as
+		 * the memory given back to the host which isn't even read
+		 */
+		for (pg = 0; pg < mem[i].len; pg = end) {
+			if (hugetlb_is_reclaimed(mem[i].gpa + pg)) {
+				end = ALIGN_DOWN(pg, HUGETLB_RECLAIM_SIZE) +
+					HUGETLB_RECLAIM_SIZE;
+				/* a shared image block, its content is the copy's */
+				shared = hugetlb_shared_hva(mem[i].gpa + pg);
+				if (shared && snapshot_write(fd, shared, end - pg,
+						off + pg) < 0)
+					return -1;
+				continue;
+			}
+			end = pg + SNAPSHOT_PAGE_SIZE;
+			if (page_is_blank(hva + pg))
+				continue;
+			while (end < mem[i].len && !page_is_blank(hva + end) &&
+					!hugetlb_is_reclaimed(mem[i].gpa + end))
+				end += SNAPSHOT_PAGE_SIZE;
+			if (snapshot_write(fd, hva + pg, end - pg, off + pg) < 0)
+				return -1;
+		}
+		off += mem[i].len;
+	}
+
+	/* trailing blank pages */
+	return ftruncate(fd, off);
+}
+
+/*
+ * The hugetlb pages are pinned by the EPT mappings, so the image can't be
+ * mapped in and faulted lazily. Only the data extents are read, straight
+ * into the guest memory, the holes are already blank there.
+ */
+static int
+snapshot_restore_mem(struct vmctx *ctx, int fd, off_t off)
+{
+	struct snapshot_mem mem[SNAPSHOT_MEM_REGIONS];
+	off_t data, hole, end;
+	char *hva;
+	int i, n;
+
+	n = snapshot_mem_regions(ctx, mem);
+	for (i = 0; i < n; i++) {
+		hva = ctx->baseaddr + mem[i].gpa;
+		end = off + mem[i].len;
+
+		for (data = off; data < end; data = hole) {
+			data = lseek(fd, data, SEEK_DATA);
+			if (data < 0) {
+				if (errno == ENXIO)
+					break;
+				return -1;
+			}
+			if (data >= end)
+				break;
+			hole = lseek(fd, data, SEEK_HOLE);
+			if (hole < 0)
+				return -1;
+			if (hole > end)
+				hole = end;
+			if (snapshot_read(fd, hva + (data - off), hole - data,
+					data) < 0)
+				return -1;
+		}
+		off = end;
+	}
+
+	return 0;
+}
+
+static int
+snapshot_save_vdev(struct pci_vdev *dev, void *arg)
+{
+	struct snapshot_devs *s = arg;
+	struct snapshot_pci_dev *rec;
+
+	/* the state of a physical device is out of our reach */
+	if (!strcmp(dev->dev_ops->class_name, "passthru")) {
+		pr_err("%s: can't save passthrough device %x:%x.%x\n",
+			__func__, dev->bus, dev->slot, dev->func);
+		return -1;
+	}
+
+	rec = realloc(s->recs, (s->ndevs + 1) * sizeof(*rec));
+	if (rec == NULL)
+		return -1;
+	s->recs = rec;
+	rec += s->ndevs++;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->bus = dev->bus;
+	rec->slot = dev->slot;
+	rec->func = dev->func;
+	memcpy(rec->cfgdata, dev->cfgdata, sizeof(rec->cfgdata));
+
+	return 0;
+}
+
+static int
+snapshot_restore_vdev(struct pci_vdev *dev, void *arg)
+{
+	struct snapshot_devs *s = arg;
+	struct snapshot_pci_dev *rec;
+	uint32_t i;
+
+	for (i = 0; i < s->ndevs; i++) {
+		rec = &s->recs[i];
+		if (rec->bus != dev->bus || rec->slot != dev->slot ||
+				rec->func != dev->func)
+			continue;
+
+		/* vendor and device id */
+		if (memcmp(rec->cfgdata, dev->cfgdata, PCIR_COMMAND)) {
+			pr_err("%s: device %x:%x.%x differs from the snapshot\n",
+				__func__, dev->bus, dev->slot, dev->func);
+			return -1;
+		}
+		pci_restore_cfgdata(s->ctx, dev, rec->cfgdata);
+		s->found++;
+		return 0;
+	}
+
+	pr_err("%s: device %x:%x.%x is not in the snapshot\n",
+		__func__, dev->bus, dev->slot, dev->func);
+	return -1;
+}
+
+ssize_t
+snapshot_save_state(struct vmctx *ctx, void **state)
+{
+	struct snapshot_header *hdr;
+	struct snapshot_devs devs;
+	size_t len;
+	int i;
+
+	memset(&devs, 0, sizeof(devs));
+	devs.ctx = ctx;
+	if (pci_walk_vdevs(snapshot_save_vdev, &devs)) {
+		free(devs.recs);
+		return -1;
+	}
+
+	len = sizeof(*hdr) + devs.ndevs * sizeof(struct snapshot_pci_dev);
+	hdr = calloc(1, len);
+	if (hdr == NULL) {
+		free(devs.recs);
+		return -1;
+	}
+
+	hdr->magic = SNAPSHOT_MAGIC;
+	hdr->version = SNAPSHOT_VERSION;
+	hdr->ndevs = devs.ndevs;
+	hdr->lowmem = ctx->lowmem;
+	hdr->biosmem = ctx->biosmem;
+	hdr->highmem = ctx->highmem;
+	hdr->highmem_gpa_base = ctx->highmem_gpa_base;
+	hdr->bsp_regs = ctx->bsp_regs;
+	pm1_get_state(&hdr->pm1);
+	if (ctx->vrtc) {
+		for (i = 0; i < SNAPSHOT_CMOS_SIZE; i++)
+			(void)vrtc_nvram_read(ctx->vrtc, i, &hdr->cmos[i]);
+	}
+	if (devs.ndevs > 0)
+		memcpy(hdr + 1, devs.recs,
+			devs.ndevs * sizeof(struct snapshot_pci_dev));
+	free(devs.recs);
+
+	*state = hdr;
+	return len;
+}
+
+static int
+snapshot_check_header(struct vmctx *ctx, const struct snapshot_header *hdr)
+{
+	if (hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION) {
+		pr_err("%s: not a snapshot\n", __func__);
+		return -1;
+	}
+
+	if (hdr->lowmem != ctx->lowmem || hdr->biosmem != ctx->biosmem ||
+			hdr->highmem != ctx->highmem ||
+			hdr->highmem_gpa_base != ctx->highmem_gpa_base) {
+		pr_err("%s: memory layout differs from the snapshot\n",
+			__func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+snapshot_restore_state(struct vmctx *ctx, void *state, size_t len)
+{
+	struct snapshot_header *hdr = state;
+	struct snapshot_devs devs;
+	int i;
+
+	if (len < sizeof(*hdr) || snapshot_check_header(ctx, hdr) ||
+			len != sizeof(*hdr) +
+			hdr->ndevs * sizeof(struct snapshot_pci_dev))
+		return -1;
+
+	memset(&devs, 0, sizeof(devs));
+	devs.ctx = ctx;
+	devs.ndevs = hdr->ndevs;
+	devs.recs = (struct snapshot_pci_dev *)(hdr + 1);
+	if (pci_walk_vdevs(snapshot_restore_vdev, &devs))
+		return -1;
+	if (devs.found != devs.ndevs) {
+		pr_err("%s: devices differ from the snapshot\n", __func__);
+		return -1;
+	}
+
+	if (ctx->vrtc) {
+		for (i = 0; i < SNAPSHOT_CMOS_SIZE; i++)
+			(void)vrtc_nvram_write(ctx->vrtc, i, hdr->cmos[i]);
+	}
+	pm1_set_state(&hdr->pm1);
+	pm_backto_wakeup(ctx);
+
+	ctx->bsp_regs = hdr->bsp_regs;
+	return 0;
+}
+
+int
+vm_snapshot_save(struct vmctx *ctx, const char *path)
+{
+	struct snapshot_header *hdr = NULL;
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	if (fd < 0) {
+		pr_err("%s: failed to open %s (%d)\n", __func__, path, errno);
+		return -1;
+	}
+
+	len = snapshot_save_state(ctx, (void **)&hdr);
+	if (len < 0)
+		goto err;
+
+	hdr->mem_offset = roundup2(len, SNAPSHOT_PAGE_SIZE);
+	if (snapshot_write(fd, hdr + 1, len - sizeof(*hdr), sizeof(*hdr)) < 0 ||
+			snapshot_save_mem(ctx, fd, hdr->mem_offset) < 0)
+		goto err;
+
+	/* the header goes last, a partial file never looks valid */
+	if (snapshot_write(fd, hdr, sizeof(*hdr), 0) < 0 || fsync(fd) < 0)
+		goto err;
+
+	free(hdr);
+	close(fd);
+	pr_notice("%s: saved %s\n", __func__, path);
+	return 0;
+
+err:
+	pr_err("%s: failed to save %s (%d)\n", __func__, path, errno);
+	free(hdr);
+	close(fd);
+	unlink(path);
+	return -1;
+}
+
+int
+vm_snapshot_restore(struct vmctx *ctx, const char *path)
+{
+	struct snapshot_header hdr, *state = NULL;
+	size_t len;
+	int fd, ret = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		pr_err("%s: failed to open %s (%d)\n", __func__, path, errno);
+		return -1;
+	}
+
+	if (snapshot_read(fd, &hdr, sizeof(hdr), 0) < 0 ||
+			snapshot_check_header(ctx, &hdr))
+		goto done;
+
+	len = sizeof(hdr) + hdr.ndevs * sizeof(struct snapshot_pci_dev);
+	state = malloc(len);
+	if (state == NULL || snapshot_read(fd, state, len, 0) < 0)
+		goto done;
+
+	if (snapshot_restore_mem(ctx, fd, hdr.mem_offset) < 0 ||
+			snapshot_restore_state(ctx, state, len) < 0)
+		goto done;
+
+	ret = 0;
+	pr_notice("%s: restored %s\n", __func__, path);
+
+done:
+	if (ret)
+		pr_err("%s: failed to restore %s (%d)\n", __func__, path, errno);
+	free(state);
+	close(fd);
+	return ret;
+}
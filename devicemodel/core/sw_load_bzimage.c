@@ -364,6 +364,16 @@ acrn_sw_load_bzimage(struct vmctx *ctx)
 
 	ctx->bsp_regs.vcpu_regs.gprs.rsi = ZEROPAGE_LOAD_OFF(ctx);
 
+	/* once loaded, the images are shared read-only with the other VMs */
+	if (share_image) {
+		if (with_kernel && hugetlb_share_memory(ctx,
+				KERNEL_LOAD_OFF(ctx), kernel_size) != 0)
+			pr_warn("SW_LOAD: kernel image not shared\n");
+		if (with_ramdisk && hugetlb_share_memory(ctx,
+				RAMDISK_LOAD_OFF(ctx), ramdisk_size) != 0)
+			pr_warn("SW_LOAD: ramdisk image not shared\n");
+	}
+
 	return 0;
 }
 
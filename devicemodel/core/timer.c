@@ -4,11 +4,15 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/timerfd.h>
 
+#include "dm.h"
 #include "vmmapi.h"
 #include "mevent.h"
 #include "timer.h"
@@ -22,8 +26,331 @@
  * Please note timerfd and epoll are all Linux specific. If the code need to be
  * ported to other OS, we can modify the api with POSIX timers and sigevent
  * mechanism.
+ *
+ * With --timer_mux, the timers are multiplexed instead: all timers of a
+ * clock share one timerfd, armed for the earliest expiration of a
+ * min-heap, which saves fds, epoll wakeups and syscalls when a VM has
+ * many timers.
  */
 
+#define TIMER_MUX_BATCH	16	/* expirations handled per wakeup */
+
+struct acrn_timer_mux {
+	int32_t clockid;
+	int32_t fd;
+	struct mevent *mevp;
+	pthread_mutex_t mtx;
+	struct acrn_timer **heap;
+	int32_t nheap;
+	int32_t size;
+	int32_t refs;
+};
+
+static struct acrn_timer_mux timer_muxes[] = {
+	{ .clockid = CLOCK_REALTIME, .fd = -1,
+	  .mtx = PTHREAD_MUTEX_INITIALIZER },
+	{ .clockid = CLOCK_MONOTONIC, .fd = -1,
+	  .mtx = PTHREAD_MUTEX_INITIALIZER },
+};
+
+static inline uint64_t
+ts_to_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+static inline void
+ns_to_ts(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / NS_PER_SEC;
+	ts->tv_nsec = ns % NS_PER_SEC;
+}
+
+static uint64_t
+timer_mux_now(struct acrn_timer_mux *mux)
+{
+	struct timespec now;
+
+	clock_gettime(mux->clockid, &now);
+	return ts_to_ns(&now);
+}
+
+static void
+timer_heap_set(struct acrn_timer_mux *mux, int32_t i, struct acrn_timer *timer)
+{
+	mux->heap[i] = timer;
+	timer->heap_idx = i;
+}
+
+static void
+timer_heap_up(struct acrn_timer_mux *mux, int32_t i)
+{
+	struct acrn_timer *timer = mux->heap[i];
+	int32_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (mux->heap[parent]->expires <= timer->expires)
+			break;
+		timer_heap_set(mux, i, mux->heap[parent]);
+		i = parent;
+	}
+	timer_heap_set(mux, i, timer);
+}
+
+static void
+timer_heap_down(struct acrn_timer_mux *mux, int32_t i)
+{
+	struct acrn_timer *timer = mux->heap[i];
+	int32_t child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= mux->nheap)
+			break;
+		if (child + 1 < mux->nheap &&
+		    mux->heap[child + 1]->expires < mux->heap[child]->expires)
+			child++;
+		if (timer->expires <= mux->heap[child]->expires)
+			break;
+		timer_heap_set(mux, i, mux->heap[child]);
+		i = child;
+	}
+	timer_heap_set(mux, i, timer);
+}
+
+static int32_t
+timer_heap_insert(struct acrn_timer_mux *mux, struct acrn_timer *timer)
+{
+	struct acrn_timer **heap;
+	int32_t size;
+
+	if (mux->nheap == mux->size) {
+		size = mux->size ? mux->size * 2 : 16;
+		heap = realloc(mux->heap, size * sizeof(*heap));
+		if (heap == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		mux->heap = heap;
+		mux->size = size;
+	}
+
+	timer_heap_set(mux, mux->nheap++, timer);
+	timer_heap_up(mux, timer->heap_idx);
+	return 0;
+}
+
+static void
+timer_heap_remove(struct acrn_timer_mux *mux, struct acrn_timer *timer)
+{
+	int32_t i = timer->heap_idx;
+
+	timer->heap_idx = -1;
+	if (--mux->nheap == i)
+		return;
+
+	timer_heap_set(mux, i, mux->heap[mux->nheap]);
+	timer_heap_up(mux, i);
+	timer_heap_down(mux, mux->heap[i]->heap_idx);
+}
+
+/* arm the shared timerfd for the earliest expiration, mtx held */
+static int32_t
+timer_mux_arm(struct acrn_timer_mux *mux)
+{
+	struct itimerspec its = { 0 };
+
+	if (mux->nheap > 0)
+		ns_to_ts(mux->heap[0]->expires, &its.it_value);
+
+	return timerfd_settime(mux->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void
+timer_mux_handler(int fd, enum ev_type t __attribute__((unused)), void *arg)
+{
+	struct acrn_timer_mux *mux = arg;
+	struct acrn_timer *expired[TIMER_MUX_BATCH], *timer;
+	uint64_t nexps[TIMER_MUX_BATCH], nexp, now;
+	void (*cb)(void *, uint64_t);
+	int32_t i, n = 0;
+
+	if (read(fd, &nexp, sizeof(nexp)) < 0 && errno != EAGAIN)
+		pr_err("acrn_timer read timerfd error");
+
+	pthread_mutex_lock(&mux->mtx);
+	now = timer_mux_now(mux);
+	while (mux->nheap > 0 && mux->heap[0]->expires <= now &&
+	       n < TIMER_MUX_BATCH) {
+		timer = mux->heap[0];
+		nexp = 1;
+		if (timer->interval != 0) {
+			nexp += (now - timer->expires) / timer->interval;
+			timer->expires += nexp * timer->interval;
+			timer_heap_down(mux, 0);
+		} else
+			timer_heap_remove(mux, timer);
+
+		expired[n] = timer;
+		nexps[n++] = nexp;
+	}
+	/* the rest, if any, is still due and fires right away */
+	timer_mux_arm(mux);
+	pthread_mutex_unlock(&mux->mtx);
+
+	for (i = 0; i < n; i++) {
+		if ((cb = expired[i]->callback) != NULL)
+			(*cb)(expired[i]->callback_param, nexps[i]);
+	}
+}
+
+static int32_t
+timer_mux_attach(struct acrn_timer *timer)
+{
+	struct acrn_timer_mux *mux = NULL;
+	int32_t i, ret = 0;
+
+	for (i = 0; i < (int32_t)ARRAY_SIZE(timer_muxes); i++) {
+		if (timer_muxes[i].clockid == timer->clockid)
+			mux = &timer_muxes[i];
+	}
+
+	if (mux == NULL) {
+		pr_err("acrn_timer clockid is not supported.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&mux->mtx);
+	if (mux->refs == 0) {
+		mux->fd = timerfd_create(mux->clockid,
+					 TFD_NONBLOCK | TFD_CLOEXEC);
+		if (mux->fd < 0) {
+			pr_err("acrn_timer create failed.\n");
+			ret = -1;
+			goto done;
+		}
+
+		mux->mevp = mevent_add_loop(mevent_loop_get("timer"), mux->fd,
+					    EVF_READ, timer_mux_handler, mux,
+					    NULL, NULL);
+		if (mux->mevp == NULL) {
+			close(mux->fd);
+			mux->fd = -1;
+			pr_err("acrn_timer mevent add failed.\n");
+			ret = -1;
+			goto done;
+		}
+	}
+	mux->refs++;
+	timer->mux = mux;
+	timer->heap_idx = -1;
+
+done:
+	pthread_mutex_unlock(&mux->mtx);
+	return ret;
+}
+
+static void
+timer_mux_detach(struct acrn_timer *timer)
+{
+	struct acrn_timer_mux *mux = timer->mux;
+
+	pthread_mutex_lock(&mux->mtx);
+	if (timer->heap_idx >= 0) {
+		timer_heap_remove(mux, timer);
+		timer_mux_arm(mux);
+	}
+	if (--mux->refs == 0) {
+		mevent_delete_close(mux->mevp);
+		mux->mevp = NULL;
+		mux->fd = -1;
+		free(mux->heap);
+		mux->heap = NULL;
+		mux->size = 0;
+	}
+	pthread_mutex_unlock(&mux->mtx);
+	timer->mux = NULL;
+}
+
+static int32_t
+timer_mux_settime(struct acrn_timer *timer, const struct itimerspec *new_value,
+		bool abs)
+{
+	struct acrn_timer_mux *mux = timer->mux;
+	uint64_t expires;
+	int32_t ret = 0;
+
+	pthread_mutex_lock(&mux->mtx);
+	if (timer->heap_idx >= 0)
+		timer_heap_remove(mux, timer);
+
+	expires = ts_to_ns(&new_value->it_value);
+	if (expires != 0) {
+		if (!abs)
+			expires += timer_mux_now(mux);
+		timer->expires = expires;
+		timer->interval = ts_to_ns(&new_value->it_interval);
+		ret = timer_heap_insert(mux, timer);
+	}
+
+	if (ret == 0)
+		ret = timer_mux_arm(mux);
+	pthread_mutex_unlock(&mux->mtx);
+
+	return ret;
+}
+
+static int32_t
+timer_mux_gettime(struct acrn_timer *timer, struct itimerspec *cur_value)
+{
+	struct acrn_timer_mux *mux = timer->mux;
+	uint64_t now;
+
+	memset(cur_value, 0, sizeof(*cur_value));
+
+	pthread_mutex_lock(&mux->mtx);
+	if (timer->heap_idx >= 0) {
+		now = timer_mux_now(mux);
+		/* an overdue timer is still armed, report it as due now */
+		ns_to_ts(timer->expires > now ? timer->expires - now : 1,
+			 &cur_value->it_value);
+		ns_to_ts(timer->interval, &cur_value->it_interval);
+	}
+	pthread_mutex_unlock(&mux->mtx);
+
+	return 0;
+}
+
+/*
+ * Expirations that happened and are not yet delivered to the callback;
+ * they are consumed and won't be delivered.
+ */
+static uint64_t
+timer_mux_expirations(struct acrn_timer *timer)
+{
+	struct acrn_timer_mux *mux = timer->mux;
+	uint64_t now, nexp = 0;
+
+	pthread_mutex_lock(&mux->mtx);
+	if (timer->heap_idx >= 0) {
+		now = timer_mux_now(mux);
+		if (timer->expires <= now) {
+			nexp = 1;
+			if (timer->interval != 0) {
+				nexp += (now - timer->expires) / timer->interval;
+				timer->expires += nexp * timer->interval;
+				timer_heap_down(mux, timer->heap_idx);
+			} else
+				timer_heap_remove(mux, timer);
+			timer_mux_arm(mux);
+		}
+	}
+	pthread_mutex_unlock(&mux->mtx);
+
+	return nexp;
+}
+
 static void
 timer_handler(int fd __attribute__((unused)),
 		  enum ev_type t __attribute__((unused)),
@@ -69,6 +396,15 @@ acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *, uint64_t),
 	}
 
 	timer->fd = -1;
+	if (timer_mux) {
+		if (timer_mux_attach(timer) < 0)
+			return -1;
+
+		timer->callback = cb;
+		timer->callback_param = param;
+		return 0;
+	}
+
 	if ((timer->clockid == CLOCK_REALTIME) ||
 			(timer->clockid == CLOCK_MONOTONIC)) {
 		timer->fd = timerfd_create(timer->clockid,
@@ -82,7 +418,8 @@ acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *, uint64_t),
 		return -1;
 	}
 
-	timer->mevp = mevent_add(timer->fd, EVF_READ, timer_handler, timer, NULL, NULL);
+	timer->mevp = mevent_add_loop(mevent_loop_get("timer"), timer->fd,
+				      EVF_READ, timer_handler, timer, NULL, NULL);
 	if (timer->mevp == NULL) {
 		close(timer->fd);
 		pr_err("acrn_timer mevent add failed.\n");
@@ -102,6 +439,9 @@ acrn_timer_deinit(struct acrn_timer *timer)
 		return;
 	}
 
+	if (timer->mux != NULL)
+		timer_mux_detach(timer);
+
 	if (timer->mevp != NULL) {
 		mevent_delete_close(timer->mevp);
 		timer->mevp = NULL;
@@ -120,6 +460,9 @@ acrn_timer_settime(struct acrn_timer *timer, const struct itimerspec *new_value)
 		return -1;
 	}
 
+	if (timer->mux != NULL)
+		return timer_mux_settime(timer, new_value, false);
+
 	return timerfd_settime(timer->fd, 0, new_value, NULL);
 }
 
@@ -132,6 +475,9 @@ acrn_timer_settime_abs(struct acrn_timer *timer,
 		return -1;
 	}
 
+	if (timer->mux != NULL)
+		return timer_mux_settime(timer, new_value, true);
+
 	return timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, new_value, NULL);
 }
 
@@ -143,5 +489,24 @@ acrn_timer_gettime(struct acrn_timer *timer, struct itimerspec *cur_value)
 		return -1;
 	}
 
+	if (timer->mux != NULL)
+		return timer_mux_gettime(timer, cur_value);
+
 	return timerfd_gettime(timer->fd, cur_value);
 }
+
+uint64_t
+acrn_timer_expirations(struct acrn_timer *timer)
+{
+	uint64_t nexp;
+
+	if (timer == NULL)
+		return 0;
+
+	if (timer->mux != NULL)
+		return timer_mux_expirations(timer);
+
+	if (read(timer->fd, &nexp, sizeof(nexp)) > 0)
+		return nexp;
+	return 0;
+}
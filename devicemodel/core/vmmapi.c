@@ -33,7 +33,9 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -47,6 +49,7 @@
 #include "pci_core.h"
 #include "log.h"
 #include "sw_load.h"
+#include "monitor.h"
 
 #define MAP_NOCORE 0
 #define MAP_ALIGNED_SUPER 0
@@ -69,7 +72,8 @@ static const char vm_state_str[VM_SUSPEND_LAST][VM_STATE_STR_LEN] = {
 	[VM_SUSPEND_POWEROFF]		= "POWEROFF",
 	[VM_SUSPEND_SUSPEND]		= "SUSPEND",
 	[VM_SUSPEND_HALT]		= "HALT",
-	[VM_SUSPEND_TRIPLEFAULT]	= "TRIPLEFAULT"
+	[VM_SUSPEND_TRIPLEFAULT]	= "TRIPLEFAULT",
+	[VM_SUSPEND_WARM]		= "WARM"
 };
 
 const char *vm_state_to_str(enum vm_suspend_how idx)
@@ -185,6 +189,128 @@ uint64_t vm_get_cpu_affinity_dm(void)
 	return cpu_affinity_bitmap;
 }
 
+/*
+ * The pCPUs of --cpu_affinity the SOS still runs on are handed off by
+ * acrn-dm in the background from startup: each is offlined from the SOS
+ * kernel, then from the hypervisor, while acrn-dm gets on with its setup.
+ * vm_create() only waits for what is left of it. The pCPUs the SOS does
+ * not run on, left out of its configuration or handed off by an earlier
+ * launch, make up the pool a VM takes without any hand-off.
+ */
+#define SYS_CPU_PATH		"/sys/devices/system/cpu"
+#define HSM_REMOVE_CPU_PATH	"/sys/devices/virtual/misc/acrn_hsm/remove_cpu"
+#define VHM_OFFLINE_CPU_PATH	"/sys/class/vhm/acrn_vhm/offline_cpu"
+
+static pthread_t handoff_tid;
+static bool handoff_started;
+static int handoff_error;
+
+static int write_sysfs(const char *path, int val)
+{
+	char buf[16];
+	int fd, len, ret = 0;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	len = snprintf(buf, sizeof(buf), "%d", val);
+	if (write(fd, buf, len) != len)
+		ret = -1;
+	close(fd);
+	return ret;
+}
+
+/* 1 if the SOS runs on pcpu_id, 0 if not, -1 if it cannot be offlined */
+static int sos_cpu_online(int pcpu_id)
+{
+	char path[64], c;
+	int fd, ret = -1;
+
+	snprintf(path, sizeof(path), SYS_CPU_PATH "/cpu%d/online", pcpu_id);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		/* no such CPU in the SOS */
+		if (errno == ENOENT && access(SYS_CPU_PATH, F_OK) == 0) {
+			snprintf(path, sizeof(path), SYS_CPU_PATH "/cpu%d", pcpu_id);
+			if (access(path, F_OK) != 0)
+				ret = 0;
+		}
+		return ret;
+	}
+
+	if (read(fd, &c, 1) == 1)
+		ret = (c == '1') ? 1 : 0;
+	close(fd);
+	return ret;
+}
+
+static int handoff_one_cpu(int pcpu_id)
+{
+	char path[64];
+	const char *remove;
+
+	snprintf(path, sizeof(path), SYS_CPU_PATH "/cpu%d/online", pcpu_id);
+	if (write_sysfs(path, 0) != 0) {
+		pr_err("%s: cannot offline cpu%d from the SOS\n", __func__, pcpu_id);
+		return -1;
+	}
+
+	remove = (access(HSM_REMOVE_CPU_PATH, F_OK) == 0) ?
+		HSM_REMOVE_CPU_PATH : VHM_OFFLINE_CPU_PATH;
+	if (write_sysfs(remove, pcpu_id) != 0) {
+		pr_err("%s: cannot remove cpu%d from the SOS\n", __func__, pcpu_id);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *handoff_thread(void *param)
+{
+	uint64_t pcpus = cpu_affinity_bitmap;
+	int pcpu_id, online;
+
+	while (pcpus != 0) {
+		pcpu_id = ffs64(pcpus);
+		bitmap_clear_nolock(pcpu_id, &pcpus);
+
+		online = sos_cpu_online(pcpu_id);
+		if (online < 0) {
+			pr_err("%s: the SOS cannot give up cpu%d\n", __func__, pcpu_id);
+			handoff_error = -1;
+		} else if (online > 0 && handoff_one_cpu(pcpu_id) != 0) {
+			handoff_error = -1;
+		}
+	}
+
+	return NULL;
+}
+
+void
+vm_handoff_cpus_start(void)
+{
+	if (cpu_affinity_bitmap == 0 || handoff_started)
+		return;
+
+	handoff_error = 0;
+	if (pthread_create(&handoff_tid, NULL, handoff_thread, NULL) == 0)
+		handoff_started = true;
+	else
+		handoff_thread(NULL);
+}
+
+static int
+vm_handoff_cpus_wait(void)
+{
+	if (handoff_started) {
+		pthread_join(handoff_tid, NULL);
+		handoff_started = false;
+	}
+
+	return handoff_error;
+}
+
 struct vmctx *
 vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 {
@@ -257,7 +383,47 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 		create_vm.vm_flag |= GUEST_FLAG_IO_COMPLETION_POLLING;
 	}
 
+	if (hv_hpet)
+		create_vm.vm_flag |= GUEST_FLAG_VHPET;
+
+	if (hv_pmtmr)
+		create_vm.vm_flag |= GUEST_FLAG_VPM_TMR;
+
+	if (hv_rtc)
+		create_vm.vm_flag |= GUEST_FLAG_VRTC;
+
+	if (pv_ipi)
+		create_vm.vm_flag |= GUEST_FLAG_PV_IPI;
+
+	if (pv_tlb_flush)
+		create_vm.vm_flag |= GUEST_FLAG_PV_TLB_FLUSH;
+
+	if (pv_steal_time)
+		create_vm.vm_flag |= GUEST_FLAG_PV_STEAL_TIME;
+
+	if (vpmu)
+		create_vm.vm_flag |= GUEST_FLAG_VPMU;
+
+	if (wbinvd_range)
+		create_vm.vm_flag |= GUEST_FLAG_WBINVD_RANGE;
+
+	if (mwait_pt)
+		create_vm.vm_flag |= GUEST_FLAG_MWAIT_PASSTHRU;
+
+	if (hide_rdrand)
+		create_vm.vm_flag |= GUEST_FLAG_HIDE_RDRAND;
+
+	create_vm.tsc_khz = vm_tsc_khz;
+
 	create_vm.req_buf = req_buf;
+
+	/* the SOS must be off the pCPUs of the VM before its vCPUs are created */
+	vm_handoff_cpus_start();
+	if (vm_handoff_cpus_wait() != 0) {
+		pr_err("failed to take the pCPUs of VM %s from the SOS\n", ctx->name);
+		goto err;
+	}
+
 	while (retry > 0) {
 		error = ioctl(ctx->fd, IC_CREATE_VM, &create_vm);
 		if (error == 0)
@@ -401,6 +567,22 @@ vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	return ioctl(ctx->fd, IC_SET_MEMSEG, &memmap);
 }
 
+int
+vm_unmap_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
+	uint64_t vma, int prot)
+{
+	struct vm_memmap memmap;
+
+	bzero(&memmap, sizeof(struct vm_memmap));
+	memmap.type = VM_MEMMAP_SYSMEM;
+	memmap.using_vma = 1;
+	memmap.vma_base = vma;
+	memmap.len = len;
+	memmap.gpa = gpa;
+	memmap.prot = prot;
+	return ioctl(ctx->fd, IC_UNSET_MEMSEG, &memmap);
+}
+
 int
 vm_setup_memory(struct vmctx *ctx, size_t memsize)
 {
@@ -421,6 +603,22 @@ vm_setup_memory(struct vmctx *ctx, size_t memsize)
 	return hugetlb_setup_memory(ctx);
 }
 
+/*
+ * The memory given back to the host is blank already, and clearing it would
+ * just allocate it again.
+ */
+static void
+vm_clear_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	vm_paddr_t end = gpa + len;
+
+	for (; gpa < end; gpa += HUGETLB_RECLAIM_SIZE) {
+		if (!hugetlb_is_reclaimed(gpa))
+			bzero((void *)(ctx->baseaddr + gpa),
+					HUGETLB_RECLAIM_SIZE);
+	}
+}
+
 void
 vm_unsetup_memory(struct vmctx *ctx)
 {
@@ -438,9 +636,9 @@ vm_unsetup_memory(struct vmctx *ctx)
 	 */
 
 	if (!is_rtvm) {
-		bzero((void *)ctx->baseaddr, ctx->lowmem);
+		vm_clear_memory(ctx, 0, ctx->lowmem);
 		if (ctx->highmem > 0) {
-			bzero((void *)(ctx->baseaddr + ctx->highmem_gpa_base),
+			vm_clear_memory(ctx, ctx->highmem_gpa_base,
 					ctx->highmem);
 		}
 	}
@@ -448,6 +646,8 @@ vm_unsetup_memory(struct vmctx *ctx)
 	hugetlb_unsetup_memory(ctx);
 }
 
+uint64_t *vm_dm_dirty;
+
 /*
  * Returns a non-NULL pointer if [gaddr, gaddr+len) is entirely contained in
  * the lowmem or highmem regions.
@@ -455,27 +655,18 @@ vm_unsetup_memory(struct vmctx *ctx)
  * In particular return NULL if [gaddr, gaddr+len) falls in guest MMIO region.
  * The instruction emulation code depends on this behavior.
  */
+
 void *
 vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len)
 {
-
-	if (ctx->lowmem > 0) {
-		if (gaddr < ctx->lowmem && len <= ctx->lowmem &&
-		    gaddr + len <= ctx->lowmem)
-			return (ctx->baseaddr + gaddr);
-	}
-
-	if (ctx->highmem > 0) {
-		if (gaddr >= ctx->highmem_gpa_base) {
-			if (gaddr < ctx->highmem_gpa_base + ctx->highmem &&
-			    len <= ctx->highmem &&
-			    gaddr + len <= ctx->highmem_gpa_base + ctx->highmem)
-				return (ctx->baseaddr + gaddr);
-		}
-	}
-
-	pr_dbg("%s context memory is not valid!\n", __func__);
-	return NULL;
+	struct vm_gpa_map mm;
+	void *hva;
+
+	vm_get_gpa_map(ctx, &mm);
+	hva = vm_gpa_map_hva(&mm, gaddr, len);
+	if (!hva)
+		pr_dbg("%s context memory is not valid!\n", __func__);
+	return hva;
 }
 
 size_t
@@ -525,6 +716,7 @@ vm_set_suspend_mode(enum vm_suspend_how how)
 {
 	pr_notice("VM state changed from[ %s ] to [ %s ]\n", vm_state_to_str(suspend_mode), vm_state_to_str(how));
 	suspend_mode = how;
+	monitor_notify_state(how);
 }
 
 int
@@ -543,10 +735,113 @@ vm_suspend(struct vmctx *ctx, enum vm_suspend_how how)
 	return 0;
 }
 
+/*
+ * Interrupts raised by the handlers of one event loop iteration are
+ * collected per thread and injected by one IC_INJECT_INTR_BATCH ioctl at the
+ * end of the iteration. Kernels without the ioctl get them one by one.
+ *
+ * Only MSIs and irqline pulses are queued: they do not depend on the order
+ * they reach the VM in. A line set high or low by another thread meanwhile
+ * must not be overridden by a stale level, so the level changes flush the
+ * batch and are injected right away.
+ */
+struct intr_batch {
+	struct vmctx *ctx;
+	int depth;
+	struct acrn_intr_batch batch;
+};
+
+static __thread struct intr_batch intr_batch;
+static bool intr_batch_unsupported;
+
+static void
+intr_batch_replay(struct vmctx *ctx, struct acrn_intr_batch *batch)
+{
+	struct acrn_intr_op *op;
+	uint64_t *req;
+	uint32_t i;
+
+	for (i = 0; i < batch->count; i++) {
+		op = &batch->ops[i];
+		if (op->type == ACRN_INTR_OP_MSI) {
+			ioctl(ctx->fd, IC_INJECT_MSI, &op->msi);
+		} else {
+			req = (uint64_t *)&op->irqline;
+			ioctl(ctx->fd, IC_SET_IRQLINE, *req);
+		}
+	}
+}
+
+static void
+intr_batch_flush(void)
+{
+	struct intr_batch *b = &intr_batch;
+
+	if (b->batch.count == 0)
+		return;
+
+	if (!intr_batch_unsupported &&
+	    ioctl(b->ctx->fd, IC_INJECT_INTR_BATCH, &b->batch) < 0 &&
+	    (errno == ENOTTY || errno == EINVAL)) {
+		pr_info("%s: no batched interrupt injection, injecting one by one\n",
+			__func__);
+		intr_batch_unsupported = true;
+	}
+	if (intr_batch_unsupported)
+		intr_batch_replay(b->ctx, &b->batch);
+
+	b->batch.count = 0;
+}
+
+/*
+ * Queue an interrupt if the calling thread is in a batch, return the entry to
+ * fill in or NULL to inject it right away.
+ */
+static struct acrn_intr_op *
+intr_batch_add(struct vmctx *ctx, uint32_t type)
+{
+	struct intr_batch *b = &intr_batch;
+	struct acrn_intr_op *op;
+
+	if (b->depth == 0 || intr_batch_unsupported)
+		return NULL;
+
+	if (b->batch.count == ACRN_INTR_BATCH_MAX ||
+	    (b->batch.count != 0 && b->ctx != ctx))
+		intr_batch_flush();
+
+	b->ctx = ctx;
+	op = &b->batch.ops[b->batch.count++];
+	bzero(op, sizeof(*op));
+	op->type = type;
+	return op;
+}
+
+void
+vm_intr_batch_begin(void)
+{
+	intr_batch.depth++;
+}
+
+void
+vm_intr_batch_end(void)
+{
+	if (--intr_batch.depth == 0)
+		intr_batch_flush();
+}
+
 int
 vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
 {
 	struct acrn_msi_entry msi;
+	struct acrn_intr_op *op;
+
+	op = intr_batch_add(ctx, ACRN_INTR_OP_MSI);
+	if (op != NULL) {
+		op->msi.msi_addr = addr;
+		op->msi.msi_data = msg;
+		return 0;
+	}
 
 	bzero(&msi, sizeof(msi));
 	msi.msi_addr = addr;
@@ -559,8 +854,21 @@ int
 vm_set_gsi_irq(struct vmctx *ctx, int gsi, uint32_t operation)
 {
 	struct acrn_irqline_ops op;
+	struct acrn_intr_op *bop;
 	uint64_t *req =  (uint64_t *)&op;
 
+	if (operation == GSI_RAISING_PULSE || operation == GSI_FALLING_PULSE) {
+		bop = intr_batch_add(ctx, ACRN_INTR_OP_IRQLINE);
+	} else {
+		intr_batch_flush();
+		bop = NULL;
+	}
+	if (bop != NULL) {
+		bop->irqline.op = operation;
+		bop->irqline.gsi = (uint32_t)gsi;
+		return 0;
+	}
+
 	op.op = operation;
 	op.gsi = (uint32_t)gsi;
 
@@ -699,6 +1007,130 @@ vm_intr_monitor(struct vmctx *ctx, void *intr_buf)
 	return ioctl(ctx->fd, IC_VM_INTR_MONITOR, intr_buf);
 }
 
+int
+vm_set_posted_io_range(struct vmctx *ctx, uint32_t type, uint64_t start,
+		uint64_t end, bool assign)
+{
+	struct acrn_posted_io_range range;
+
+	bzero(&range, sizeof(range));
+	range.type = type;
+	range.flags = assign ? 0U : POSTED_IO_RANGE_DEASSIGN;
+	range.start = start;
+	range.end = end;
+
+	return ioctl(ctx->fd, IC_SET_POSTED_IO_RANGE, &range);
+}
+
+int
+vm_set_ioreq_poll(struct vmctx *ctx, uint64_t max_cycles)
+{
+	return ioctl(ctx->fd, IC_SET_IOREQ_POLL, max_cycles);
+}
+
+int
+vm_set_pio_region(struct vmctx *ctx, uint16_t base, uint16_t len,
+		bool passthru)
+{
+	struct acrn_pio_region region;
+
+	bzero(&region, sizeof(region));
+	region.flags = passthru ? ACRN_PIO_REGION_FLAG_PASSTHRU : 0U;
+	region.base = base;
+	region.len = len;
+
+	return ioctl(ctx->fd, IC_SET_PIO_REGION, &region);
+}
+
+int
+vm_dirty_log_start(struct vmctx *ctx, vm_paddr_t gpa, size_t len, uint64_t *bitmap)
+{
+	struct acrn_dirty_log log;
+
+	bzero(&log, sizeof(log));
+	log.op = DIRTY_LOG_START;
+	log.gpa = gpa;
+	log.len = len;
+	log.bitmap = (uint64_t)bitmap;
+	return ioctl(ctx->fd, IC_VM_DIRTY_LOG, &log);
+}
+
+int
+vm_dirty_log_sync(struct vmctx *ctx)
+{
+	struct acrn_dirty_log log;
+
+	bzero(&log, sizeof(log));
+	log.op = DIRTY_LOG_SYNC;
+	return ioctl(ctx->fd, IC_VM_DIRTY_LOG, &log);
+}
+
+int
+vm_dirty_log_stop(struct vmctx *ctx)
+{
+	struct acrn_dirty_log log;
+
+	bzero(&log, sizeof(log));
+	log.op = DIRTY_LOG_STOP;
+	return ioctl(ctx->fd, IC_VM_DIRTY_LOG, &log);
+}
+
+int
+vm_rdt_clos(struct vmctx *ctx, struct acrn_rdt_clos *rdt)
+{
+	return ioctl(ctx->fd, IC_VM_RDT_CLOS, rdt);
+}
+
+int
+vm_reclaim_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct acrn_reclaim_region region;
+
+	bzero(&region, sizeof(region));
+	region.op = RECLAIM_UNMAP;
+	region.gpa = gpa;
+	region.len = len;
+	return ioctl(ctx->fd, IC_VM_RECLAIM_MEMORY, &region);
+}
+
+int
+vm_unpopulate_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct acrn_reclaim_region region;
+
+	bzero(&region, sizeof(region));
+	region.op = RECLAIM_UNPOPULATED;
+	region.gpa = gpa;
+	region.len = len;
+	return ioctl(ctx->fd, IC_VM_RECLAIM_MEMORY, &region);
+}
+
+int
+vm_restore_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct acrn_reclaim_region region;
+
+	bzero(&region, sizeof(region));
+	region.op = RECLAIM_REMAP;
+	region.gpa = gpa;
+	region.vma_base = (uint64_t)(ctx->baseaddr + gpa);
+	region.len = len;
+	return ioctl(ctx->fd, IC_VM_RECLAIM_MEMORY, &region);
+}
+
+int
+vm_share_memory(struct vmctx *ctx, vm_paddr_t gpa, void *hva, size_t len)
+{
+	struct acrn_reclaim_region region;
+
+	bzero(&region, sizeof(region));
+	region.op = RECLAIM_SHARE;
+	region.gpa = gpa;
+	region.vma_base = (uint64_t)hva;
+	region.len = len;
+	return ioctl(ctx->fd, IC_VM_RECLAIM_MEMORY, &region);
+}
+
 int
 vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args)
 {
@@ -711,6 +1143,12 @@ vm_irqfd(struct vmctx *ctx, struct acrn_irqfd *args)
 	return ioctl(ctx->fd, IC_EVENT_IRQFD, args);
 }
 
+int
+vm_resamplefd(struct vmctx *ctx, struct acrn_resamplefd *args)
+{
+	return ioctl(ctx->fd, IC_EVENT_RESAMPLEFD, args);
+}
+
 int
 vm_get_config(struct vmctx *ctx, struct acrn_vm_config *vm_cfg, struct platform_info *plat_info)
 {
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Copy-on-write overlay of a read-only base image.
+ *
+ * The overlay file starts with a header, followed by the cluster map and
+ * the data clusters. Each map entry is the offset of the cluster in the
+ * overlay, or one of COW_BASE (the data is in the base image) and COW_ZERO
+ * (discarded, reads as zeros). The map is kept in memory, a cluster is
+ * allocated on the first write to it and its entry is written after the
+ * data. A guest flush syncs the overlay, with the data and the map.
+ *
+ * The overlay is created if it doesn't exist, it is sparse until the guest
+ * writes, so a new VM only costs the size of its map.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+
+#include "block_cow.h"
+#include "log.h"
+
+#define COW_MAGIC		0x31574f434e524341UL	/* "ACRNCOW1" */
+#define COW_VERSION		1U
+#define COW_CLUSTER_BITS	16U			/* 64KB clusters */
+#define COW_HDR_SIZE		4096U
+
+#define COW_BASE		0UL
+#define COW_ZERO		1UL
+
+#define WPRINTF(params) (pr_err params)
+
+struct cow_header {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	cluster_bits;
+	uint64_t	size;		/* size of the disk, the base image */
+	uint64_t	nclusters;
+	uint64_t	map_offset;
+	uint64_t	data_offset;	/* first data cluster */
+} __attribute__((packed));
+
+struct blockif_cow {
+	int		base_fd;
+	int		fd;
+	int		rdonly;
+	off_t		size;
+	uint32_t	cluster_bits;
+	size_t		cluster_sz;
+	uint64_t	nclusters;
+	uint64_t	*map;
+	off_t		map_offset;
+	off_t		next_free;	/* where the next cluster is allocated */
+	pthread_mutex_t	mtx;		/* serializes the map updates */
+};
+
+static int
+cow_create(struct blockif_cow *cow, struct cow_header *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = COW_MAGIC;
+	hdr->version = COW_VERSION;
+	hdr->cluster_bits = COW_CLUSTER_BITS;
+	hdr->size = cow->size;
+	hdr->nclusters = (cow->size + (1UL << COW_CLUSTER_BITS) - 1) >>
+			COW_CLUSTER_BITS;
+	hdr->map_offset = COW_HDR_SIZE;
+	hdr->data_offset = roundup(hdr->map_offset + hdr->nclusters *
+			sizeof(uint64_t), 1UL << COW_CLUSTER_BITS);
+
+	/* the map is a hole, all the clusters are in the base image */
+	if (ftruncate(cow->fd, hdr->data_offset) < 0 ||
+			pwrite(cow->fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+			fsync(cow->fd) < 0) {
+		WPRINTF(("cow: failed to create the overlay: %s\n",
+			strerror(errno)));
+		return -1;
+	}
+	return 0;
+}
+
+struct blockif_cow *
+blockif_cow_open(int base_fd, off_t size, const char *path, int rdonly)
+{
+	struct blockif_cow *cow;
+	struct cow_header hdr;
+	struct stat sbuf;
+	size_t map_sz;
+	uint64_t i;
+
+	cow = calloc(1, sizeof(struct blockif_cow));
+	if (cow == NULL) {
+		WPRINTF(("cow: calloc returns NULL\n"));
+		return NULL;
+	}
+	cow->base_fd = base_fd;
+	cow->size = size;
+	cow->rdonly = rdonly;
+	pthread_mutex_init(&cow->mtx, NULL);
+
+	cow->fd = open(path, rdonly ? O_RDONLY : (O_RDWR | O_CREAT), 0600);
+	if (cow->fd < 0 || fstat(cow->fd, &sbuf) < 0) {
+		WPRINTF(("cow: could not open overlay %s\n", path));
+		goto fail;
+	}
+
+	if (sbuf.st_size == 0 && !rdonly) {
+		if (cow_create(cow, &hdr) < 0)
+			goto fail;
+		sbuf.st_size = hdr.data_offset;
+	} else if (pread(cow->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		WPRINTF(("cow: could not read the header of %s\n", path));
+		goto fail;
+	}
+
+	if (hdr.magic != COW_MAGIC || hdr.version != COW_VERSION ||
+			hdr.cluster_bits < 12 || hdr.cluster_bits > 24) {
+		WPRINTF(("cow: %s is not an overlay\n", path));
+		goto fail;
+	}
+	if (hdr.size != size) {
+		WPRINTF(("cow: overlay %s is for a base of %lu bytes, not %lu\n",
+			path, hdr.size, size));
+		goto fail;
+	}
+
+	cow->cluster_bits = hdr.cluster_bits;
+	cow->cluster_sz = 1UL << hdr.cluster_bits;
+	cow->nclusters = hdr.nclusters;
+	cow->map_offset = hdr.map_offset;
+	cow->next_free = MAX(roundup(sbuf.st_size, cow->cluster_sz),
+			hdr.data_offset);
+
+	map_sz = cow->nclusters * sizeof(uint64_t);
+	cow->map = malloc(map_sz);
+	if (cow->map == NULL) {
+		WPRINTF(("cow: malloc returns NULL\n"));
+		goto fail;
+	}
+	if (pread(cow->fd, cow->map, map_sz, cow->map_offset) != map_sz) {
+		WPRINTF(("cow: could not read the map of %s\n", path));
+		goto fail;
+	}
+
+	for (i = 0; i < cow->nclusters; i++) {
+		if (cow->map[i] > COW_ZERO && (cow->map[i] < hdr.data_offset ||
+				(cow->map[i] & (cow->cluster_sz - 1)))) {
+			WPRINTF(("cow: invalid map entry %lu of %s\n", i, path));
+			goto fail;
+		}
+	}
+
+	return cow;
+fail:
+	free(cow->map);
+	if (cow->fd >= 0)
+		close(cow->fd);
+	free(cow);
+	return NULL;
+}
+
+void
+blockif_cow_close(struct blockif_cow *cow)
+{
+	close(cow->fd);
+	close(cow->base_fd);
+	free(cow->map);
+	free(cow);
+}
+
+/* The overlay is where the writes go, syncing it makes them durable */
+int
+blockif_cow_fd(struct blockif_cow *cow)
+{
+	return cow->fd;
+}
+
+/* Fill out with the bytes [skip, skip + len) of iov, return the count */
+static int
+cow_iov_slice(const struct iovec *iov, int iovcnt, size_t skip, size_t len,
+	      struct iovec *out)
+{
+	int i, n = 0;
+
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		out[n].iov_base = (char *)iov[i].iov_base + skip;
+		out[n].iov_len = MIN(iov[i].iov_len - skip, len);
+		len -= out[n].iov_len;
+		skip = 0;
+		n++;
+	}
+	return n;
+}
+
+static size_t
+cow_iov_len(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	return len;
+}
+
+static inline uint64_t
+cow_entry(struct blockif_cow *cow, uint64_t cl)
+{
+	return __atomic_load_n(&cow->map[cl], __ATOMIC_ACQUIRE);
+}
+
+/* Write a map entry, with cow->mtx held */
+static int
+cow_set_entry(struct blockif_cow *cow, uint64_t cl, uint64_t entry)
+{
+	if (pwrite(cow->fd, &entry, sizeof(entry), cow->map_offset +
+			cl * sizeof(entry)) != sizeof(entry))
+		return -1;
+	__atomic_store_n(&cow->map[cl], entry, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ * First write to a cluster: fill a new cluster with the base data and the
+ * written bytes, then point the map to it.
+ */
+static ssize_t
+cow_alloc_write(struct blockif_cow *cow, uint64_t cl, size_t off,
+		const struct iovec *iov, int iovcnt, size_t len)
+{
+	uint64_t entry;
+	off_t base_off;
+	ssize_t n;
+	char *buf;
+	int i;
+
+	pthread_mutex_lock(&cow->mtx);
+	entry = cow_entry(cow, cl);
+	if (entry > COW_ZERO) {
+		/* allocated by another request meanwhile */
+		pthread_mutex_unlock(&cow->mtx);
+		return pwritev(cow->fd, iov, iovcnt, entry + off);
+	}
+
+	buf = calloc(1, cow->cluster_sz);
+	if (buf == NULL) {
+		pthread_mutex_unlock(&cow->mtx);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (entry == COW_BASE && len < cow->cluster_sz) {
+		/* the last cluster may be partial, the rest stays zeroed */
+		base_off = cl << cow->cluster_bits;
+		n = pread(cow->base_fd, buf, MIN(cow->cluster_sz,
+				cow->size - base_off), base_off);
+		if (n < 0)
+			goto out;
+	}
+	for (i = 0, n = off; i < iovcnt; i++) {
+		memcpy(buf + n, iov[i].iov_base, iov[i].iov_len);
+		n += iov[i].iov_len;
+	}
+
+	n = pwrite(cow->fd, buf, cow->cluster_sz, cow->next_free);
+	if (n < 0)
+		goto out;
+	if (n != cow->cluster_sz) {
+		errno = ENOSPC;
+		n = -1;
+		goto out;
+	}
+	if (cow_set_entry(cow, cl, cow->next_free) < 0) {
+		n = -1;
+		goto out;
+	}
+	cow->next_free += cow->cluster_sz;
+	n = len;
+out:
+	pthread_mutex_unlock(&cow->mtx);
+	free(buf);
+	return n;
+}
+
+static ssize_t
+cow_rw(struct blockif_cow *cow, const struct iovec *iov, int iovcnt,
+       off_t offset, int write)
+{
+	struct iovec sl[iovcnt];
+	size_t total, done, len, off;
+	uint64_t cl, entry;
+	ssize_t n;
+	int i, cnt;
+
+	total = cow_iov_len(iov, iovcnt);
+	if (offset < 0 || offset >= cow->size)
+		return 0;
+	total = MIN(total, cow->size - offset);
+
+	for (done = 0; done < total; done += n) {
+		cl = (offset + done) >> cow->cluster_bits;
+		off = (offset + done) & (cow->cluster_sz - 1);
+		len = MIN(cow->cluster_sz - off, total - done);
+		cnt = cow_iov_slice(iov, iovcnt, done, len, sl);
+		entry = cow_entry(cow, cl);
+
+		if (write) {
+			if (entry > COW_ZERO)
+				n = pwritev(cow->fd, sl, cnt, entry + off);
+			else
+				n = cow_alloc_write(cow, cl, off, sl, cnt, len);
+		} else if (entry == COW_BASE) {
+			n = preadv(cow->base_fd, sl, cnt, offset + done);
+		} else if (entry == COW_ZERO) {
+			for (i = 0; i < cnt; i++)
+				memset(sl[i].iov_base, 0, sl[i].iov_len);
+			n = len;
+		} else {
+			n = preadv(cow->fd, sl, cnt, entry + off);
+		}
+
+		if (n < 0)
+			return done ? done : -1;
+		if (n < len)
+			return done + n;
+	}
+	return done;
+}
+
+ssize_t
+blockif_cow_preadv(struct blockif_cow *cow, const struct iovec *iov,
+		   int iovcnt, off_t offset)
+{
+	return cow_rw(cow, iov, iovcnt, offset, 0);
+}
+
+ssize_t
+blockif_cow_pwritev(struct blockif_cow *cow, const struct iovec *iov,
+		    int iovcnt, off_t offset)
+{
+	if (cow->rdonly) {
+		errno = EROFS;
+		return -1;
+	}
+	return cow_rw(cow, iov, iovcnt, offset, 1);
+}
+
+/*
+ * The clusters fully in the range read as zeros from now on, and the space
+ * of the allocated ones is given back to the host. Partial clusters are
+ * kept as they are, a discard doesn't promise anything about the data.
+ */
+int
+blockif_cow_discard(struct blockif_cow *cow, off_t offset, off_t len)
+{
+	uint64_t cl, last, entry;
+	int err = 0;
+
+	if (cow->rdonly)
+		return EROFS;
+
+	cl = roundup(offset, cow->cluster_sz) >> cow->cluster_bits;
+	last = MIN(offset + len, cow->size) >> cow->cluster_bits;
+	if (offset + len >= cow->size)
+		last = cow->nclusters;
+
+	pthread_mutex_lock(&cow->mtx);
+	for (; cl < last; cl++) {
+		entry = cow_entry(cow, cl);
+		if (entry == COW_ZERO)
+			continue;
+		if (cow_set_entry(cow, cl, COW_ZERO) < 0) {
+			err = errno;
+			break;
+		}
+		if (entry > COW_ZERO && fallocate(cow->fd,
+				FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				entry, cow->cluster_sz) < 0)
+			WPRINTF(("cow: failed to release cluster %lu\n", cl));
+	}
+	pthread_mutex_unlock(&cow->mtx);
+
+	return err;
+}
@@ -30,8 +30,11 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <linux/falloc.h>
 #include <linux/fs.h>
+#include <linux/io_uring.h>
 #include <errno.h>
 #include <err.h>
 #include <fcntl.h>
@@ -40,10 +43,12 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "dm.h"
 #include "block_if.h"
+#include "block_cow.h"
 #include "ahci.h"
 #include "dm_string.h"
 #include "log.h"
@@ -64,8 +69,22 @@
 
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
+#define BLOCKIF_MAXQ	16
 #define MAX_DISCARD_SEGMENT	256
 
+/*
+ * io_uring engine: each element takes at most 2 SQEs (a write linked to a
+ * fsync) and 2 more to cancel it, so the rings never fill up.
+ */
+#define BLOCKIF_URING_ENTRIES	512
+#define BLOCKIF_URING_SQ_IDLE	1000		/* ms before the SQPOLL thread sleeps */
+#define BLOCKIF_URING_LINK	1UL		/* user_data tag of a write linked to a fsync */
+#define BLOCKIF_MAXBUF		64
+#define BLOCKIF_DIO_ALIGN	512		/* O_DIRECT alignment of files */
+#define BLOCKIF_BOUNCE_ALIGN	4096
+#define BLOCKIF_RA_STREAK	2		/* sequential reads to read ahead */
+#define BLOCKIF_BUF_MAXSZ	(1UL << 30)	/* kernel limit of one registered buffer */
+
 /*
  * Debug printf
  */
@@ -80,6 +99,15 @@ enum blockop {
 	BOP_DISCARD
 };
 
+enum blockengine {
+	BLOCKIF_THREADS,	/* synchronous I/O from a pool of threads */
+	BLOCKIF_IO_URING,	/* asynchronous I/O through io_uring */
+	BLOCKIF_NULL		/* no backing file, completed at once */
+};
+
+/* size of the null device, unless size= */
+#define BLOCKIF_NULL_SIZE	(1024LL * 1024 * 1024)
+
 enum blockstat {
 	BST_FREE,
 	BST_BLOCK,
@@ -95,6 +123,89 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+	int		     linked;	/* io_uring: write linked to a fsync */
+	ssize_t		     res;	/* io_uring: result of the linked write */
+	struct blockif_elem  *merged;	/* next request done by the same I/O */
+};
+
+enum {
+	BLOCKIF_TB_IOPS_RD,
+	BLOCKIF_TB_IOPS_WR,
+	BLOCKIF_TB_BPS_RD,
+	BLOCKIF_TB_BPS_WR,
+	BLOCKIF_TB_NUM
+};
+
+struct blockif_bucket {
+	uint64_t		rate;		/* tokens per second, 0 is unlimited */
+	uint64_t		burst;		/* most tokens the bucket holds */
+	double			level;		/* tokens left, negative in debt */
+};
+
+struct blockif_throttle {
+	pthread_mutex_t		mtx;
+	int			enabled;
+	uint64_t		last_ns;	/* last refill */
+	struct blockif_bucket	tbs[BLOCKIF_TB_NUM];
+};
+
+/* group commit of the writethru writes */
+struct blockif_flusher {
+	pthread_mutex_t		mtx;
+	pthread_cond_t		cond;
+	int			window_us;	/* -1 syncs each write alone */
+	int			syncing;	/* a writer is syncing for the others */
+	int			err;		/* result of the last sync */
+	uint64_t		written;	/* writes waiting or synced */
+	uint64_t		synced;		/* writes made durable */
+};
+
+struct blockif_uring {
+	int			fd;
+	int			sqpoll;
+	int			plugged;
+	pthread_t		tid;		/* completion thread */
+
+	void			*sq_ptr;
+	size_t			sq_sz;
+	void			*cq_ptr;
+	size_t			cq_sz;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_sz;
+
+	unsigned int		*sq_head;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_flags;
+	unsigned int		*sq_array;
+	unsigned int		sq_entries;
+	unsigned int		sqe_tail;	/* next SQE to fill */
+	unsigned int		sqe_submitted;	/* SQEs handed to the kernel */
+
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+/*
+ * Submission queue, each one with its own lock, request elements and worker
+ * threads, so the requests of different virtqueues never contend.
+ */
+struct blockif_queue {
+	struct blockif_ctxt	*bc;
+	int			nthr;
+	pthread_t		btid[BLOCKIF_NUMTHR];
+	pthread_mutex_t		mtx;
+	pthread_cond_t		cond;
+
+	/* Request elements and free/pending/busy queues */
+	TAILQ_HEAD(, blockif_elem) freeq;
+	TAILQ_HEAD(, blockif_elem) pendq;
+	TAILQ_HEAD(, blockif_elem) busyq;
+	struct blockif_elem	reqs[BLOCKIF_MAXREQ];
+
+	struct blockif_uring	ring;
 };
 
 struct blockif_ctxt {
@@ -113,15 +224,24 @@ struct blockif_ctxt {
 	int			max_discard_seg;
 	int			discard_sector_alignment;
 	int			closing;
-	pthread_t		btid[BLOCKIF_NUMTHR];
-	pthread_mutex_t		mtx;
-	pthread_cond_t		cond;
-
-	/* Request elements and free/pending/busy queues */
-	TAILQ_HEAD(, blockif_elem) freeq;
-	TAILQ_HEAD(, blockif_elem) pendq;
-	TAILQ_HEAD(, blockif_elem) busyq;
-	struct blockif_elem	reqs[BLOCKIF_MAXREQ];
+	int			nqueues;
+	struct blockif_queue	*bqs;
+	enum blockengine	engine;
+	int			merge;		/* merge contiguous requests */
+	struct blockif_throttle	throttle;
+	struct blockif_flusher	flusher;
+	struct blockif_cow	*cow;		/* overlay on a read-only base */
+	int			direct;		/* opened with O_DIRECT */
+	int			dio_align;
+
+	/* read-ahead of the sequential reads */
+	pthread_mutex_t		ra_mtx;
+	off_t			ra_bytes;
+	off_t			ra_next;	/* where the stream continues */
+	off_t			ra_end;		/* end of the last hint */
+	int			ra_streak;
+	int			nbufs;		/* registered with the io_uring rings */
+	struct iovec		bufs[BLOCKIF_MAXBUF];
 
 	/* write cache enable */
 	uint8_t			wce;
@@ -157,20 +277,238 @@ blockif_flush_cache(struct blockif_ctxt *bc)
 	return err;
 }
 
+/*
+ * Make a write durable when the write cache is off. With a flush window, the
+ * writes done close together share one fdatasync: the first writer waits for
+ * the window to let others in, then syncs on behalf of all the writes done so
+ * far. Every writer returns only once its write is covered by a sync.
+ */
+static int
+blockif_flush_write(struct blockif_ctxt *bc)
+{
+	struct blockif_flusher *fl = &bc->flusher;
+	uint64_t ticket, target;
+	int err;
+
+	if (bc->wce || fl->window_us < 0)
+		return blockif_flush_cache(bc);
+
+	pthread_mutex_lock(&fl->mtx);
+	ticket = ++fl->written;
+	while (fl->synced < ticket) {
+		if (fl->syncing) {
+			pthread_cond_wait(&fl->cond, &fl->mtx);
+			continue;
+		}
+
+		fl->syncing = 1;
+		if (fl->window_us > 0) {
+			pthread_mutex_unlock(&fl->mtx);
+			usleep(fl->window_us);
+			pthread_mutex_lock(&fl->mtx);
+		}
+		target = fl->written;
+		pthread_mutex_unlock(&fl->mtx);
+
+		err = fdatasync(bc->fd) ? errno : 0;
+
+		pthread_mutex_lock(&fl->mtx);
+		fl->synced = target;
+		fl->err = err;
+		fl->syncing = 0;
+		pthread_cond_broadcast(&fl->cond);
+	}
+	err = fl->err;
+	pthread_mutex_unlock(&fl->mtx);
+
+	return err;
+}
+
+/*
+ * I/O throttling: token buckets of the read and write IOPS and bandwidth,
+ * shared by all the queues. A read or write stays in the pendq until its
+ * buckets have tokens, a bucket may go in debt for a request bigger than
+ * its burst.
+ */
+static uint64_t
+blockif_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Parse "<rate>[/<burst>]" of a bucket, a rate of 0 is unlimited */
+static int
+blockif_parse_bucket(const char *str, struct blockif_bucket *tb)
+{
+	char *cp;
+	long rate, burst;
+
+	if (dm_strtol(str, &cp, 10, &rate) || rate < 0)
+		return -1;
+	burst = rate;
+	if (*cp == '/' && (dm_strtol(cp + 1, &cp, 10, &burst) || burst < 1))
+		return -1;
+	if (*cp != '\0')
+		return -1;
+
+	tb->rate = rate;
+	tb->burst = burst;
+	tb->level = burst;
+	return 0;
+}
+
+/*
+ * Parse a throttling option into tbs.
+ * Return 1 if it is one, 0 if it isn't and -1 if it's invalid.
+ */
+static int
+blockif_parse_throttle(const char *opt, struct blockif_bucket *tbs)
+{
+	static const char * const names[BLOCKIF_TB_NUM] = {
+		[BLOCKIF_TB_IOPS_RD] = "iops_rd=",
+		[BLOCKIF_TB_IOPS_WR] = "iops_wr=",
+		[BLOCKIF_TB_BPS_RD] = "bps_rd=",
+		[BLOCKIF_TB_BPS_WR] = "bps_wr=",
+	};
+	int i;
+
+	for (i = 0; i < BLOCKIF_TB_NUM; i++) {
+		if (!strncmp(opt, names[i], strlen(names[i])))
+			return blockif_parse_bucket(opt + strlen(names[i]),
+					&tbs[i]) ? -1 : 1;
+	}
+	return 0;
+}
+
+static void
+blockif_throttle_refill(struct blockif_throttle *thr, uint64_t now)
+{
+	struct blockif_bucket *tb;
+	double elapsed;
+	int i;
+
+	elapsed = (now - thr->last_ns) / 1e9;
+	thr->last_ns = now;
+	for (i = 0; i < BLOCKIF_TB_NUM; i++) {
+		tb = &thr->tbs[i];
+		if (tb->rate == 0)
+			continue;
+		tb->level += tb->rate * elapsed;
+		if (tb->level > tb->burst)
+			tb->level = tb->burst;
+	}
+}
+
+/*
+ * Take the tokens of a read or write with bq->mtx held. Return 0 if it has
+ * to wait, and lower *wait_ns to the time until it can go.
+ */
+static int
+blockif_throttle_admit(struct blockif_ctxt *bc, struct blockif_elem *be,
+		uint64_t *wait_ns)
+{
+	struct blockif_throttle *thr = &bc->throttle;
+	struct blockif_bucket *iops, *bps;
+	uint64_t wait = 0;
+
+	if (!thr->enabled || (be->op != BOP_READ && be->op != BOP_WRITE))
+		return 1;
+
+	if (be->op == BOP_READ) {
+		iops = &thr->tbs[BLOCKIF_TB_IOPS_RD];
+		bps = &thr->tbs[BLOCKIF_TB_BPS_RD];
+	} else {
+		iops = &thr->tbs[BLOCKIF_TB_IOPS_WR];
+		bps = &thr->tbs[BLOCKIF_TB_BPS_WR];
+	}
+
+	pthread_mutex_lock(&thr->mtx);
+	blockif_throttle_refill(thr, blockif_now_ns());
+	if (iops->rate && iops->level < 1.0)
+		wait = (1.0 - iops->level) * 1e9 / iops->rate + 1;
+	if (bps->rate && bps->level <= 0.0)
+		wait = MAX(wait, (uint64_t)((1.0 - bps->level) * 1e9 / bps->rate) + 1);
+	if (wait == 0) {
+		if (iops->rate)
+			iops->level -= 1.0;
+		if (bps->rate)
+			bps->level -= be->block - be->req->offset;
+	}
+	pthread_mutex_unlock(&thr->mtx);
+
+	if (wait) {
+		*wait_ns = MIN(*wait_ns, wait);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Change the limits at runtime, optstr is a list of the throttling options
+ * of blockif_open(). The buckets that aren't in it keep their limits.
+ */
+int
+blockif_set_throttle(struct blockif_ctxt *bc, const char *optstr)
+{
+	struct blockif_throttle *thr = &bc->throttle;
+	struct blockif_bucket tbs[BLOCKIF_TB_NUM];
+	char *nopt, *xopts, *cp;
+	int i, enabled, err = 0;
+
+	nopt = xopts = strdup(optstr);
+	if (!nopt)
+		return -1;
+
+	pthread_mutex_lock(&thr->mtx);
+	memcpy(tbs, thr->tbs, sizeof(tbs));
+	pthread_mutex_unlock(&thr->mtx);
+
+	while ((cp = strsep(&xopts, ",")) != NULL) {
+		if (blockif_parse_throttle(cp, tbs) != 1) {
+			pr_err("Invalid throttling option \"%s\"\n", cp);
+			err = -1;
+			goto out;
+		}
+	}
+
+	enabled = 0;
+	for (i = 0; i < BLOCKIF_TB_NUM; i++)
+		enabled |= (tbs[i].rate != 0);
+
+	pthread_mutex_lock(&thr->mtx);
+	memcpy(thr->tbs, tbs, sizeof(tbs));
+	thr->last_ns = blockif_now_ns();
+	thr->enabled = enabled;
+	pthread_mutex_unlock(&thr->mtx);
+
+	/* let the workers look at the pendq again with the new limits */
+	for (i = 0; i < bc->nqueues; i++) {
+		pthread_mutex_lock(&bc->bqs[i].mtx);
+		pthread_cond_broadcast(&bc->bqs[i].cond);
+		pthread_mutex_unlock(&bc->bqs[i].mtx);
+	}
+out:
+	free(nopt);
+	return err;
+}
+
 static int
-blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
+blockif_enqueue(struct blockif_queue *bq, struct blockif_req *breq,
 		enum blockop op)
 {
 	struct blockif_elem *be, *tbe;
 	off_t off;
 	int i;
 
-	be = TAILQ_FIRST(&bc->freeq);
+	be = TAILQ_FIRST(&bq->freeq);
 	if (be == NULL || be->status != BST_FREE) {
 		WPRINTF(("%s: failed to get element from freeq\n", __func__));
 		return 0;
 	}
-	TAILQ_REMOVE(&bc->freeq, be, link);
+	TAILQ_REMOVE(&bq->freeq, be, link);
 	be->req = breq;
 	be->op = op;
 	switch (op) {
@@ -186,12 +524,12 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		off = 1 << (sizeof(off_t) - 1);
 	}
 	be->block = off;
-	TAILQ_FOREACH(tbe, &bc->pendq, link) {
+	TAILQ_FOREACH(tbe, &bq->pendq, link) {
 		if (tbe->block == breq->offset)
 			break;
 	}
 	if (tbe == NULL) {
-		TAILQ_FOREACH(tbe, &bc->busyq, link) {
+		TAILQ_FOREACH(tbe, &bq->busyq, link) {
 			if (tbe->block == breq->offset)
 				break;
 		}
@@ -200,46 +538,173 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		be->status = BST_PEND;
 	else
 		be->status = BST_BLOCK;
-	TAILQ_INSERT_TAIL(&bc->pendq, be, link);
+	TAILQ_INSERT_TAIL(&bq->pendq, be, link);
 	return (be->status == BST_PEND);
 }
 
 static int
-blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
+blockif_dequeue(struct blockif_queue *bq, pthread_t t, struct blockif_elem **bep,
+		uint64_t *wait_ns)
 {
 	struct blockif_elem *be;
 
-	TAILQ_FOREACH(be, &bc->pendq, link) {
-		if (be->status == BST_PEND)
+	/* a throttled request doesn't hold back the ones of other buckets */
+	TAILQ_FOREACH(be, &bq->pendq, link) {
+		if (be->status == BST_PEND &&
+				blockif_throttle_admit(bq->bc, be, wait_ns))
 			break;
 	}
 	if (be == NULL)
 		return 0;
-	TAILQ_REMOVE(&bc->pendq, be, link);
+	TAILQ_REMOVE(&bq->pendq, be, link);
 	be->status = BST_BUSY;
 	be->tid = t;
-	TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+	TAILQ_INSERT_TAIL(&bq->busyq, be, link);
 	*bep = be;
 	return 1;
 }
 
 static void
-blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
+blockif_complete(struct blockif_queue *bq, struct blockif_elem *be)
 {
 	struct blockif_elem *tbe;
 
 	if (be->status == BST_DONE || be->status == BST_BUSY)
-		TAILQ_REMOVE(&bc->busyq, be, link);
+		TAILQ_REMOVE(&bq->busyq, be, link);
 	else
-		TAILQ_REMOVE(&bc->pendq, be, link);
-	TAILQ_FOREACH(tbe, &bc->pendq, link) {
+		TAILQ_REMOVE(&bq->pendq, be, link);
+	TAILQ_FOREACH(tbe, &bq->pendq, link) {
 		if (tbe->req->offset == be->block)
 			tbe->status = BST_PEND;
 	}
 	be->tid = 0;
 	be->status = BST_FREE;
 	be->req = NULL;
-	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
+	TAILQ_INSERT_TAIL(&bq->freeq, be, link);
+}
+
+/* Whether O_DIRECT can use the guest buffers as they are */
+static int
+blockif_iov_aligned(struct blockif_ctxt *bc, const struct iovec *iov,
+		    int iovcnt)
+{
+	int i;
+
+	if (!bc->direct)
+		return 1;
+	for (i = 0; i < iovcnt; i++) {
+		if (((uintptr_t)iov[i].iov_base | iov[i].iov_len) &
+				(bc->dio_align - 1))
+			return 0;
+	}
+	return 1;
+}
+
+/* O_DIRECT I/O of unaligned guest buffers through an aligned bounce buffer */
+static ssize_t
+blockif_bounce_rw(struct blockif_ctxt *bc, const struct iovec *iov,
+		  int iovcnt, off_t offset, int write)
+{
+	size_t len, done;
+	ssize_t n;
+	void *buf;
+	int i;
+
+	for (i = 0, len = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	/* the offset and length are in sectors, which are multiples of dio_align */
+	if (len & (bc->dio_align - 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (posix_memalign(&buf, MAX(bc->dio_align, BLOCKIF_BOUNCE_ALIGN), len)) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (write) {
+		for (i = 0, done = 0; i < iovcnt; i++) {
+			memcpy(buf + done, iov[i].iov_base, iov[i].iov_len);
+			done += iov[i].iov_len;
+		}
+		n = pwrite(bc->fd, buf, len, offset);
+	} else {
+		n = pread(bc->fd, buf, len, offset);
+		for (i = 0, done = 0; i < iovcnt && n > 0 && done < n; i++) {
+			memcpy(iov[i].iov_base, buf + done,
+			       MIN(iov[i].iov_len, n - done));
+			done += iov[i].iov_len;
+		}
+	}
+
+	free(buf);
+	return n;
+}
+
+/*
+ * Detect sequential reads and ask the host to read ahead of them, so that
+ * the next reads of the stream find their data in the page cache.
+ */
+static void
+blockif_readahead(struct blockif_ctxt *bc, off_t offset, ssize_t len)
+{
+	off_t start, end;
+
+	if (bc->ra_bytes == 0 || len <= 0)
+		return;
+
+	start = end = 0;
+	pthread_mutex_lock(&bc->ra_mtx);
+	if (offset == bc->ra_next) {
+		bc->ra_streak++;
+	} else {
+		bc->ra_streak = 0;
+		bc->ra_end = 0;
+	}
+	bc->ra_next = offset + len;
+	/* hint the next window once half of the last one is read */
+	if (bc->ra_streak >= BLOCKIF_RA_STREAK &&
+			bc->ra_next + bc->ra_bytes / 2 > bc->ra_end) {
+		start = MAX(bc->ra_next, bc->ra_end);
+		end = bc->ra_next + bc->ra_bytes;
+		bc->ra_end = end;
+	}
+	pthread_mutex_unlock(&bc->ra_mtx);
+
+	if (end > start && end <= bc->size)
+		posix_fadvise(bc->fd, start + bc->sub_file_start_lba,
+			      end - start, POSIX_FADV_WILLNEED);
+}
+
+static ssize_t
+blockif_preadv(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+	       off_t offset)
+{
+	ssize_t len;
+
+	if (bc->cow)
+		return blockif_cow_preadv(bc->cow, iov, iovcnt, offset);
+	if (!blockif_iov_aligned(bc, iov, iovcnt))
+		len = blockif_bounce_rw(bc, iov, iovcnt,
+				offset + bc->sub_file_start_lba, 0);
+	else
+		len = preadv(bc->fd, iov, iovcnt,
+				offset + bc->sub_file_start_lba);
+	blockif_readahead(bc, offset, len);
+	return len;
+}
+
+static ssize_t
+blockif_pwritev(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	if (bc->cow)
+		return blockif_cow_pwritev(bc->cow, iov, iovcnt, offset);
+	if (!blockif_iov_aligned(bc, iov, iovcnt))
+		return blockif_bounce_rw(bc, iov, iovcnt,
+				offset + bc->sub_file_start_lba, 1);
+	return pwritev(bc->fd, iov, iovcnt, offset + bc->sub_file_start_lba);
 }
 
 static int
@@ -300,7 +765,9 @@ blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
 		segment = 1;
 	}
 	for (i = 0; i < segment; i++) {
-		if (bc->isblk) {
+		if (bc->cow) {
+			err = blockif_cow_discard(bc->cow, arg[i][0], arg[i][1]);
+		} else if (bc->isblk) {
 			err = ioctl(bc->fd, BLKDISCARD, arg[i]);
 		} else {
 			/* FALLOC_FL_PUNCH_HOLE:
@@ -337,8 +804,7 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 	err = 0;
 	switch (be->op) {
 	case BOP_READ:
-		len = preadv(bc->fd, br->iov, br->iovcnt,
-				 br->offset + bc->sub_file_start_lba);
+		len = blockif_preadv(bc, br->iov, br->iovcnt, br->offset);
 		if (len < 0)
 			err = errno;
 		else
@@ -350,13 +816,12 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 			break;
 		}
 
-		len = pwritev(bc->fd, br->iov, br->iovcnt,
-				  br->offset + bc->sub_file_start_lba);
+		len = blockif_pwritev(bc, br->iov, br->iovcnt, br->offset);
 		if (len < 0)
 			err = errno;
 		else {
 			br->resid -= len;
-			err = blockif_flush_cache(bc);
+			err = blockif_flush_write(bc);
 		}
 		break;
 	case BOP_FLUSH:
@@ -376,32 +841,566 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 	(*br->callback)(br, err);
 }
 
+/*
+ * io_uring engine. Reads, writes and flushes are queued on the ring of the
+ * submission queue and completed by one thread per ring. Discards and writes
+ * on a read-only backend still go to the worker thread of the queue.
+ */
+static inline int
+io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, NULL, 0);
+}
+
+static inline int
+io_uring_register(int fd, unsigned int opcode, const void *arg,
+		unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int
+blockif_uring_use(struct blockif_ctxt *bc, enum blockop op,
+		  struct blockif_req *br)
+{
+	if (bc->engine != BLOCKIF_IO_URING)
+		return 0;
+	if (op == BOP_DISCARD)
+		return 0;
+	if (op == BOP_WRITE && bc->rdonly)
+		return 0;
+	/* the unaligned buffers of O_DIRECT are bounced by the workers */
+	if ((op == BOP_READ || op == BOP_WRITE) &&
+			!blockif_iov_aligned(bc, br->iov, br->iovcnt))
+		return 0;
+	return 1;
+}
+
+/* Hand the filled SQEs to the kernel, with bq->mtx held */
+static void
+blockif_uring_submit(struct blockif_uring *ring)
+{
+	unsigned int n;
+	int ret;
+
+	n = ring->sqe_tail - ring->sqe_submitted;
+	if (n == 0)
+		return;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	if (ring->sqpoll) {
+		/* the kernel thread picks up the new tail unless it is asleep */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) &
+				IORING_SQ_NEED_WAKEUP)
+			io_uring_enter(ring->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+		ring->sqe_submitted = ring->sqe_tail;
+		return;
+	}
+
+	ret = io_uring_enter(ring->fd, n, 0, 0);
+	if (ret < 0) {
+		/* keep them queued, they are submitted with the next request */
+		WPRINTF(("io_uring_enter failed: %s\n", strerror(errno)));
+		return;
+	}
+	ring->sqe_submitted += ret;
+}
+
+/* Get an SQE for the backing file, with bq->mtx held */
+static struct io_uring_sqe *
+blockif_uring_get_sqe(struct blockif_uring *ring, uint8_t opcode, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, idx;
+
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sqe_tail - head >= ring->sq_entries)
+		return NULL;
+
+	idx = ring->sqe_tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	if (opcode != IORING_OP_NOP && opcode != IORING_OP_ASYNC_CANCEL) {
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->fd = 0;	/* the backing file is the only registered file */
+	}
+	sqe->user_data = data;
+	ring->sq_array[idx] = idx;
+	ring->sqe_tail++;
+
+	return sqe;
+}
+
+/* Index of the registered buffer containing [base, base + len), or -1 */
+static int
+blockif_uring_find_buf(struct blockif_ctxt *bc, void *base, size_t len)
+{
+	uintptr_t start, end, bstart;
+	int i;
+
+	start = (uintptr_t)base;
+	end = start + len;
+	for (i = 0; i < bc->nbufs; i++) {
+		bstart = (uintptr_t)bc->bufs[i].iov_base;
+		if (start >= bstart && end <= bstart + bc->bufs[i].iov_len)
+			return i;
+	}
+	return -1;
+}
+
+static void
+blockif_uring_prep_rw(struct blockif_ctxt *bc, struct io_uring_sqe *sqe,
+		struct blockif_req *br, int write)
+{
+	int idx = -1;
+
+	if (br->iovcnt == 1)
+		idx = blockif_uring_find_buf(bc, br->iov[0].iov_base,
+				br->iov[0].iov_len);
+	if (idx >= 0) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->addr = (uintptr_t)br->iov[0].iov_base;
+		sqe->len = br->iov[0].iov_len;
+		sqe->buf_index = idx;
+	} else {
+		sqe->addr = (uintptr_t)br->iov;
+		sqe->len = br->iovcnt;
+	}
+	sqe->off = br->offset + bc->sub_file_start_lba;
+}
+
+/*
+ * Queue the SQEs of a busy element on the ring, with bq->mtx held. Return
+ * E2BIG if there is no room for them.
+ */
+static int
+blockif_uring_queue(struct blockif_queue *bq, struct blockif_elem *be)
+{
+	struct blockif_ctxt *bc = bq->bc;
+	struct blockif_uring *ring = &bq->ring;
+	struct io_uring_sqe *sqe;
+	unsigned int nsqe, head;
+	uint64_t data;
+
+	be->linked = (be->op == BOP_WRITE && !bc->wce);
+	nsqe = be->linked ? 2 : 1;
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sqe_tail - head + nsqe > ring->sq_entries)
+		return E2BIG;
+
+	be->res = 0;
+	be->tid = 0;
+
+	data = (uintptr_t)be;
+	switch (be->op) {
+	case BOP_READ:
+		sqe = blockif_uring_get_sqe(ring, IORING_OP_READV, data);
+		blockif_uring_prep_rw(bc, sqe, be->req, 0);
+		break;
+	case BOP_WRITE:
+		sqe = blockif_uring_get_sqe(ring, IORING_OP_WRITEV,
+				be->linked ? (data | BLOCKIF_URING_LINK) : data);
+		blockif_uring_prep_rw(bc, sqe, be->req, 1);
+		if (be->linked) {
+			/* emulate writethru, see blockif_flush_cache() */
+			sqe->flags |= IOSQE_IO_LINK;
+			blockif_uring_get_sqe(ring, IORING_OP_FSYNC, data);
+		}
+		break;
+	default:
+		blockif_uring_get_sqe(ring, IORING_OP_FSYNC, data);
+		break;
+	}
+
+	if (!ring->plugged)
+		blockif_uring_submit(ring);
+	return 0;
+}
+
+/* Queue a request on the ring, with bq->mtx held */
+static int
+blockif_uring_enqueue(struct blockif_queue *bq, struct blockif_req *breq,
+		enum blockop op)
+{
+	struct blockif_elem *be;
+	int err;
+
+	be = TAILQ_FIRST(&bq->freeq);
+	if (be == NULL || be->status != BST_FREE) {
+		WPRINTF(("%s: failed to get element from freeq\n", __func__));
+		return E2BIG;
+	}
+
+	TAILQ_REMOVE(&bq->freeq, be, link);
+	be->req = breq;
+	be->op = op;
+	be->block = -1;
+	be->status = BST_BUSY;
+	TAILQ_INSERT_TAIL(&bq->busyq, be, link);
+
+	err = blockif_uring_queue(bq, be);
+	if (err) {
+		TAILQ_REMOVE(&bq->busyq, be, link);
+		be->status = BST_FREE;
+		be->req = NULL;
+		TAILQ_INSERT_HEAD(&bq->freeq, be, link);
+	}
+	return err;
+}
+
+static void
+blockif_uring_complete(struct blockif_queue *bq, uint64_t data, int res)
+{
+	struct blockif_ctxt *bc = bq->bc;
+	struct blockif_elem *be;
+	struct blockif_req *br;
+	int err;
+
+	be = (struct blockif_elem *)(uintptr_t)(data & ~BLOCKIF_URING_LINK);
+	if (be == NULL)		/* nop or cancel */
+		return;
+	if (data & BLOCKIF_URING_LINK) {
+		be->res = res;
+		return;
+	}
+
+	br = be->req;
+	err = 0;
+	switch (be->op) {
+	case BOP_READ:
+		if (res < 0)
+			err = -res;
+		else
+			br->resid -= res;
+		break;
+	case BOP_WRITE:
+		if (!be->linked) {
+			if (res < 0)
+				err = -res;
+			else
+				br->resid -= res;
+			break;
+		}
+		if (be->res < 0) {
+			err = -be->res;
+			break;
+		}
+		br->resid -= be->res;
+		if (res == -ECANCELED) {
+			/* a short write breaks the link */
+			if (fsync(bc->fd))
+				err = errno;
+		} else if (res < 0) {
+			err = -res;
+		}
+		break;
+	default:
+		if (res < 0)
+			err = -res;
+		break;
+	}
+
+	be->status = BST_DONE;
+
+	(*br->callback)(br, err);
+
+	pthread_mutex_lock(&bq->mtx);
+	blockif_complete(bq, be);
+	pthread_mutex_unlock(&bq->mtx);
+}
+
+static void *
+blockif_uring_thr(void *arg)
+{
+	struct blockif_queue *bq;
+	struct blockif_uring *ring;
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	uint64_t data;
+	int res;
+
+	bq = arg;
+	ring = &bq->ring;
+
+	for (;;) {
+		head = *ring->cq_head;
+		if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			/* blockif_close() posts a nop to wake us up */
+			if (bq->bc->closing)
+				break;
+			if (io_uring_enter(ring->fd, 0, 1,
+					IORING_ENTER_GETEVENTS) < 0 &&
+					errno != EINTR) {
+				WPRINTF(("io_uring wait failed: %s\n",
+					strerror(errno)));
+				break;
+			}
+			continue;
+		}
+
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		data = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+		blockif_uring_complete(bq, data, res);
+	}
+
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static void
+blockif_uring_deinit(struct blockif_uring *ring)
+{
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_sz);
+	if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED)
+		munmap(ring->cq_ptr, ring->cq_sz);
+	if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_sz);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	ring->fd = -1;
+}
+
+static int
+blockif_uring_init(struct blockif_uring *ring, int fd, int sqpoll)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	if (sqpoll) {
+		p.flags = IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = BLOCKIF_URING_SQ_IDLE;
+	}
+
+	ring->sqpoll = sqpoll;
+	ring->fd = io_uring_setup(BLOCKIF_URING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		pr_err("io_uring_setup failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	ring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED ||
+			ring->sqes == MAP_FAILED) {
+		pr_err("io_uring mmap failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	ring->sq_head = ring->sq_ptr + p.sq_off.head;
+	ring->sq_tail = ring->sq_ptr + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ptr + p.sq_off.ring_mask;
+	ring->sq_flags = ring->sq_ptr + p.sq_off.flags;
+	ring->sq_array = ring->sq_ptr + p.sq_off.array;
+	ring->sq_entries = p.sq_entries;
+	ring->sqe_tail = *ring->sq_tail;
+	ring->sqe_submitted = ring->sqe_tail;
+	ring->cq_head = ring->cq_ptr + p.cq_off.head;
+	ring->cq_tail = ring->cq_ptr + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ptr + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ptr + p.cq_off.cqes;
+
+	/* saves the file lookup of each request, and is needed by SQPOLL */
+	if (io_uring_register(ring->fd, IORING_REGISTER_FILES, &fd, 1) < 0) {
+		pr_err("io_uring file register failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	return 0;
+fail:
+	blockif_uring_deinit(ring);
+	return -1;
+}
+
+/* Wake up the completion thread of a closing queue */
+static void
+blockif_uring_stop(struct blockif_queue *bq)
+{
+	struct blockif_uring *ring = &bq->ring;
+
+	pthread_mutex_lock(&bq->mtx);
+	if (blockif_uring_get_sqe(ring, IORING_OP_NOP, 0) == NULL)
+		WPRINTF(("%s: io_uring is full\n", __func__));
+	blockif_uring_submit(ring);
+	pthread_mutex_unlock(&bq->mtx);
+}
+
+/*
+ * Take the pending requests that continue the read or write of be off the
+ * pendq, so that they are done with the same vectored I/O. They are chained
+ * from be through the merged field. Called with bq->mtx held.
+ */
+static void
+blockif_merge(struct blockif_queue *bq, struct blockif_elem *be, pthread_t t)
+{
+	struct blockif_elem *last, *tbe, *obe;
+	uint64_t wait_ns = UINT64_MAX;
+	int iovcnt;
+
+	if (be->op != BOP_READ && be->op != BOP_WRITE)
+		return;
+
+	last = be;
+	iovcnt = be->req->iovcnt;
+	for (;;) {
+		TAILQ_FOREACH(tbe, &bq->pendq, link) {
+			if (tbe->op == be->op && tbe->req->offset == last->block)
+				break;
+		}
+		if (tbe == NULL || iovcnt + tbe->req->iovcnt > BLOCKIF_IOV_MAX)
+			break;
+
+		/* it must not be reordered with another request ending there */
+		TAILQ_FOREACH(obe, &bq->pendq, link) {
+			if (obe != tbe && obe->block == tbe->req->offset)
+				break;
+		}
+		if (obe == NULL) {
+			TAILQ_FOREACH(obe, &bq->busyq, link) {
+				if (obe != last && obe->block == tbe->req->offset)
+					break;
+			}
+		}
+		if (obe != NULL || !blockif_throttle_admit(bq->bc, tbe, &wait_ns))
+			break;
+
+		TAILQ_REMOVE(&bq->pendq, tbe, link);
+		tbe->status = BST_BUSY;
+		tbe->tid = t;
+		TAILQ_INSERT_TAIL(&bq->busyq, tbe, link);
+		last->merged = tbe;
+		last = tbe;
+		iovcnt += tbe->req->iovcnt;
+	}
+}
+
+/* Do a chain of merged requests and complete each of them */
+static void
+blockif_proc_merged(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct iovec iov[BLOCKIF_IOV_MAX];
+	struct blockif_elem *tbe, *next;
+	struct blockif_req *br;
+	ssize_t len, n;
+	int err, iovcnt;
+
+	iovcnt = 0;
+	for (tbe = be; tbe != NULL; tbe = tbe->merged) {
+		memcpy(&iov[iovcnt], tbe->req->iov,
+		       tbe->req->iovcnt * sizeof(struct iovec));
+		iovcnt += tbe->req->iovcnt;
+	}
+
+	err = 0;
+	if (be->op == BOP_READ) {
+		len = blockif_preadv(bc, iov, iovcnt, be->req->offset);
+	} else if (bc->rdonly) {
+		len = 0;
+		err = EROFS;
+	} else {
+		len = blockif_pwritev(bc, iov, iovcnt, be->req->offset);
+		if (len >= 0)
+			err = blockif_flush_write(bc);
+	}
+	if (len < 0) {
+		err = errno;
+		len = 0;
+	}
+
+	/* hand the transferred bytes out to the requests in order */
+	for (tbe = be; tbe != NULL; tbe = next) {
+		next = tbe->merged;
+		br = tbe->req;
+		n = MIN(len, tbe->block - br->offset);
+		br->resid -= n;
+		len -= n;
+
+		tbe->status = BST_DONE;
+
+		(*br->callback)(br, err);
+	}
+}
+
 static void *
 blockif_thr(void *arg)
 {
+	struct blockif_queue *bq;
 	struct blockif_ctxt *bc;
-	struct blockif_elem *be;
+	struct blockif_elem *be, *next;
+	struct timespec ts;
+	uint64_t wait_ns;
 	pthread_t t;
 
-	bc = arg;
+	bq = arg;
+	bc = bq->bc;
 	t = pthread_self();
 
-	pthread_mutex_lock(&bc->mtx);
+	pthread_mutex_lock(&bq->mtx);
 
 	for (;;) {
-		while (blockif_dequeue(bc, t, &be)) {
-			pthread_mutex_unlock(&bc->mtx);
-			blockif_proc(bc, be);
-			pthread_mutex_lock(&bc->mtx);
-			blockif_complete(bc, be);
+		wait_ns = UINT64_MAX;
+		while (blockif_dequeue(bq, t, &be, &wait_ns)) {
+			if (blockif_uring_use(bc, be->op, be->req)) {
+				/* throttled io_uring request, it may go now */
+				if (blockif_uring_queue(bq, be)) {
+					be->status = BST_DONE;
+					pthread_mutex_unlock(&bq->mtx);
+					(*be->req->callback)(be->req, EBUSY);
+					pthread_mutex_lock(&bq->mtx);
+					blockif_complete(bq, be);
+				}
+				continue;
+			}
+			if (bc->merge)
+				blockif_merge(bq, be, t);
+			pthread_mutex_unlock(&bq->mtx);
+			if (be->merged)
+				blockif_proc_merged(bc, be);
+			else
+				blockif_proc(bc, be);
+			pthread_mutex_lock(&bq->mtx);
+			for (; be != NULL; be = next) {
+				next = be->merged;
+				be->merged = NULL;
+				blockif_complete(bq, be);
+			}
 		}
 		/* Check ctxt status here to see if exit requested */
 		if (bc->closing)
 			break;
-		pthread_cond_wait(&bc->cond, &bc->mtx);
+		if (wait_ns == UINT64_MAX) {
+			pthread_cond_wait(&bq->cond, &bq->mtx);
+		} else {
+			/* wake up when the throttled requests get tokens */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			wait_ns += ts.tv_nsec;
+			ts.tv_sec += wait_ns / 1000000000UL;
+			ts.tv_nsec = wait_ns % 1000000000UL;
+			pthread_cond_timedwait(&bq->cond, &bq->mtx, &ts);
+		}
 	}
 
-	pthread_mutex_unlock(&bc->mtx);
+	pthread_mutex_unlock(&bq->mtx);
 	pthread_exit(NULL);
 	return NULL;
 }
@@ -488,17 +1487,24 @@ sub_file_unlock(struct blockif_ctxt *bc)
 
 
 struct blockif_ctxt *
-blockif_open(const char *optstr, const char *ident)
+blockif_open(const char *optstr, const char *ident, int nqueues)
 {
 	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
+	struct blockif_queue *bq;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
-	int writeback, ro, candiscard, ssopt, pssopt;
+	int fd, i, j, rc, sectsz;
+	int writeback, ro, candiscard, ssopt, pssopt, sqpoll, merge;
+	struct blockif_bucket tbs[BLOCKIF_TB_NUM];
+	int throttle, flushwin;
+	struct blockif_cow *cow;
+	char *overlay;
+	int direct, fadvise, readahead, dio_align;
+	enum blockengine engine;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -506,10 +1512,22 @@ blockif_open(const char *optstr, const char *ident)
 	int sub_file_assign;
 	int max_discard_sectors, max_discard_seg, discard_sector_alignment;
 	off_t probe_arg[] = {0, 0};
+	int null_dev;
+	long null_size_mb;
 
 	pthread_once(&blockif_once, blockif_init);
 
+	if (nqueues < 1 || nqueues > BLOCKIF_MAXQ) {
+		pr_err("Invalid number of blockif queues %d\n", nqueues);
+		return NULL;
+	}
+
 	fd = -1;
+	cow = NULL;
+	overlay = NULL;
+	direct = 0;
+	fadvise = -1;
+	readahead = 0;
 	ssopt = 0;
 	pssopt = 0;
 	ro = 0;
@@ -526,6 +1544,14 @@ blockif_open(const char *optstr, const char *ident)
 
 	candiscard = 0;
 
+	engine = BLOCKIF_THREADS;
+	sqpoll = 0;
+	merge = 0;
+	flushwin = -1;
+	throttle = 0;
+	memset(tbs, 0, sizeof(tbs));
+	null_size_mb = 0;
+
 	/*
 	 * The first element in the optstring is always a pathname.
 	 * Optional elements follow
@@ -535,6 +1561,8 @@ blockif_open(const char *optstr, const char *ident)
 		WPRINTF(("block_if.c: strdup retruns NULL\n"));
 		return NULL;
 	}
+	null_dev = !strncmp(nopt, "null", strlen("null")) &&
+		   (nopt[4] == ',' || nopt[4] == '\0');
 	while (xopts != NULL) {
 		cp = strsep(&xopts, ",");
 		if (cp == nopt)		/* file or device pathname */
@@ -545,6 +1573,57 @@ blockif_open(const char *optstr, const char *ident)
 			writeback = 0;
 		else if (!strcmp(cp, "ro"))
 			ro = 1;
+		else if (!strncmp(cp, "mq=", strlen("mq=")))
+			continue;	/* number of queues, parsed by the frontend */
+		else if (!strcmp(cp, "aio=threads"))
+			engine = BLOCKIF_THREADS;
+		else if (!strcmp(cp, "aio=io_uring"))
+			engine = BLOCKIF_IO_URING;
+		else if (!strcmp(cp, "sqpoll"))
+			sqpoll = 1;
+		else if (!strcmp(cp, "merge"))
+			merge = 1;
+		else if (!strncmp(cp, "overlay=", strlen("overlay=")))
+			overlay = cp + strlen("overlay=");
+		else if (!strcmp(cp, "direct"))
+			direct = 1;
+		else if (!strcmp(cp, "fadvise=normal"))
+			fadvise = POSIX_FADV_NORMAL;
+		else if (!strcmp(cp, "fadvise=sequential"))
+			fadvise = POSIX_FADV_SEQUENTIAL;
+		else if (!strcmp(cp, "fadvise=random"))
+			fadvise = POSIX_FADV_RANDOM;
+		else if (null_dev && !strncmp(cp, "size=", strlen("size="))) {
+			/* size=<MB> of the null device */
+			if (dm_strtol(cp + strlen("size="), &cp, 10, &null_size_mb) ||
+					*cp != '\0' || null_size_mb <= 0) {
+				pr_err("Invalid size, shall be a size in MB\n");
+				goto err;
+			}
+		}
+		else if (!strncmp(cp, "readahead=", strlen("readahead="))) {
+			/* readahead=<KB> */
+			if (dm_strtoi(cp + strlen("readahead="), &cp, 10, &readahead) ||
+					*cp != '\0' || readahead < 0) {
+				pr_err("Invalid readahead, shall be a size in KB\n");
+				goto err;
+			}
+		}
+		else if (!strncmp(cp, "flushwin=", strlen("flushwin="))) {
+			/* flushwin=<window in us> */
+			if (dm_strtoi(cp + strlen("flushwin="), &cp, 10, &flushwin) ||
+					*cp != '\0' || flushwin < 0) {
+				pr_err("Invalid flushwin, shall be a window in us\n");
+				goto err;
+			}
+		}
+		else if ((rc = blockif_parse_throttle(cp, tbs)) != 0) {
+			if (rc < 0) {
+				pr_err("Invalid throttling option \"%s\"\n", cp);
+				goto err;
+			}
+			throttle = 1;
+		}
 		else if (!strncmp(cp, "discard", strlen("discard"))) {
 			strsep(&cp, "=");
 			if (cp != NULL) {
@@ -585,6 +1664,49 @@ blockif_open(const char *optstr, const char *ident)
 		}
 	}
 
+	/*
+	 * The null device completes the requests in the caller's context
+	 * without touching their data, so that a benchmark in the guest
+	 * measures the virtio path alone.
+	 */
+	if (null_dev) {
+		if (engine != BLOCKIF_THREADS || overlay || direct || readahead ||
+		    fadvise >= 0 || sub_file_assign || throttle || candiscard ||
+		    ssopt) {
+			pr_err("null supports no backend option but size and ro\n");
+			goto err;
+		}
+		engine = BLOCKIF_NULL;
+		size = null_size_mb ? (off_t)null_size_mb * 1024 * 1024 :
+			BLOCKIF_NULL_SIZE;
+		sectsz = DEV_BSIZE;
+		psectsz = DEV_BSIZE;
+		psectoff = 0;
+		dio_align = BLOCKIF_DIO_ALIGN;
+		memset(&sbuf, 0, sizeof(sbuf));
+		goto alloc;
+	}
+
+	if (sqpoll && engine != BLOCKIF_IO_URING) {
+		pr_err("sqpoll requires aio=io_uring\n");
+		goto err;
+	}
+
+	if (overlay != NULL && (engine != BLOCKIF_THREADS || sub_file_assign)) {
+		pr_err("overlay requires aio=threads and no range\n");
+		goto err;
+	}
+
+	/* the page cache options are for the host file, not an overlay */
+	if (overlay != NULL && (direct || readahead || fadvise >= 0)) {
+		pr_err("overlay doesn't support direct, readahead and fadvise\n");
+		goto err;
+	}
+	if (direct && readahead) {
+		pr_err("readahead is useless with direct\n");
+		goto err;
+	}
+
 	/*
 	 * To support "writeback" and "writethru" mode switch during runtime,
 	 * O_SYNC is not used directly, as O_SYNC flag cannot dynamic change
@@ -592,10 +1714,12 @@ blockif_open(const char *optstr, const char *ident)
 	 * operation to emulate it.
 	 */
 
-	fd = open(nopt, ro ? O_RDONLY : O_RDWR);
+	/* with an overlay, the base is never written */
+	fd = open(nopt, ((ro || overlay) ? O_RDONLY : O_RDWR) |
+			(direct ? O_DIRECT : 0));
 	if (fd < 0 && !ro) {
 		/* Attempt a r/w fail with a r/o open */
-		fd = open(nopt, O_RDONLY);
+		fd = open(nopt, O_RDONLY | (direct ? O_DIRECT : 0));
 		ro = 1;
 	}
 
@@ -649,7 +1773,7 @@ blockif_open(const char *optstr, const char *ident)
 		DPRINTF(("block partition physical sector size is 0x%lx\n",
 			 psectsz));
 
-		if (candiscard) {
+		if (candiscard && !overlay) {
 			err_code = ioctl(fd, BLKDISCARD, probe_arg);
 			if (err_code) {
 				WPRINTF(("not support DISCARD\n"));
@@ -694,11 +1818,41 @@ blockif_open(const char *optstr, const char *ident)
 		psectoff = 0;
 	}
 
+	dio_align = BLOCKIF_DIO_ALIGN;
+	if (direct) {
+		if (S_ISBLK(sbuf.st_mode) && ioctl(fd, BLKSSZGET, &dio_align))
+			dio_align = BLOCKIF_DIO_ALIGN;
+		/* the guest requests are in sectors, keep them aligned */
+		if (sectsz % dio_align) {
+			pr_err("direct requires a sector size multiple of %d\n",
+				dio_align);
+			goto err;
+		}
+	}
+
+	if (fadvise >= 0 && posix_fadvise(fd, 0, 0, fadvise))
+		WPRINTF(("fadvise is not supported by %s\n", nopt));
+
+	if (overlay != NULL) {
+		cow = blockif_cow_open(fd, size, overlay, ro);
+		if (cow == NULL)
+			goto err;
+		/* the writes and flushes go to the overlay */
+		fd = blockif_cow_fd(cow);
+	}
+
+alloc:
 	bc = calloc(1, sizeof(struct blockif_ctxt));
 	if (bc == NULL) {
 		pr_err("calloc");
 		goto err;
 	}
+	bc->bqs = calloc(nqueues, sizeof(struct blockif_queue));
+	if (bc->bqs == NULL) {
+		pr_err("calloc");
+		free(bc);
+		goto err;
+	}
 
 	if (sub_file_assign) {
 		DPRINTF(("sector size is %d\n", sectsz));
@@ -720,6 +1874,7 @@ blockif_open(const char *optstr, const char *ident)
 	}
 
 	bc->fd = fd;
+	bc->cow = cow;
 	bc->isblk = S_ISBLK(sbuf.st_mode);
 	bc->candiscard = candiscard;
 	if (candiscard) {
@@ -737,23 +1892,78 @@ blockif_open(const char *optstr, const char *ident)
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
-
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
-					ident, i) >= sizeof(tname)) {
-			pr_err("blk thread name too long");
+	bc->nqueues = nqueues;
+	bc->direct = direct;
+	bc->dio_align = dio_align;
+	pthread_mutex_init(&bc->ra_mtx, NULL);
+	bc->ra_bytes = (off_t)readahead * 1024;
+	bc->engine = engine;
+	bc->merge = merge;
+	pthread_mutex_init(&bc->throttle.mtx, NULL);
+	pthread_mutex_init(&bc->flusher.mtx, NULL);
+	pthread_cond_init(&bc->flusher.cond, NULL);
+	bc->flusher.window_us = flushwin;
+	memcpy(bc->throttle.tbs, tbs, sizeof(tbs));
+	bc->throttle.last_ns = blockif_now_ns();
+	for (i = 0; i < BLOCKIF_TB_NUM; i++)
+		bc->throttle.enabled |= throttle && (tbs[i].rate != 0);
+
+	if (engine == BLOCKIF_IO_URING) {
+		for (j = 0; j < nqueues; j++) {
+			if (blockif_uring_init(&bc->bqs[j].ring, fd, sqpoll) < 0) {
+				while (--j >= 0)
+					blockif_uring_deinit(&bc->bqs[j].ring);
+				free(bc->bqs);
+				free(bc);
+				goto err;
+			}
+		}
+	}
+
+	/*
+	 * The worker threads are shared out among the queues. With io_uring
+	 * a single one per queue is kept for the discards.
+	 */
+	for (j = 0; j < nqueues; j++) {
+		bq = &bc->bqs[j];
+		bq->bc = bc;
+		if (engine == BLOCKIF_NULL)
+			bq->nthr = 0;
+		else if (engine == BLOCKIF_IO_URING)
+			bq->nthr = 1;
+		else
+			bq->nthr = MAX(BLOCKIF_NUMTHR / nqueues, 1);
+		pthread_mutex_init(&bq->mtx, NULL);
+		pthread_cond_init(&bq->cond, NULL);
+		TAILQ_INIT(&bq->freeq);
+		TAILQ_INIT(&bq->pendq);
+		TAILQ_INIT(&bq->busyq);
+		for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+			bq->reqs[i].status = BST_FREE;
+			TAILQ_INSERT_HEAD(&bq->freeq, &bq->reqs[i], link);
+		}
+
+		for (i = 0; i < bq->nthr; i++) {
+			if (nqueues == 1)
+				rc = snprintf(tname, sizeof(tname), "blk-%s-%d", ident, i);
+			else
+				rc = snprintf(tname, sizeof(tname), "blk-%s-%d-%d", ident, j, i);
+			if (rc >= sizeof(tname))
+				pr_err("blk thread name too long");
+			pthread_create(&bq->btid[i], NULL, blockif_thr, bq);
+			pthread_setname_np(bq->btid[i], tname);
+		}
+
+		if (engine == BLOCKIF_IO_URING) {
+			if (nqueues == 1)
+				rc = snprintf(tname, sizeof(tname), "blk-%s-cq", ident);
+			else
+				rc = snprintf(tname, sizeof(tname), "blk-%s-%d-cq", ident, j);
+			if (rc >= sizeof(tname))
+				pr_err("blk thread name too long");
+			pthread_create(&bq->ring.tid, NULL, blockif_uring_thr, bq);
+			pthread_setname_np(bq->ring.tid, tname);
 		}
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		pthread_setname_np(bc->btid[i], tname);
 	}
 
 	/* free strdup memory */
@@ -768,7 +1978,9 @@ err:
 	if (nopt)
 		free(nopt);
 
-	if (fd >= 0)
+	if (cow)
+		blockif_cow_close(cow);
+	else if (fd >= 0)
 		close(fd);
 	return NULL;
 }
@@ -777,18 +1989,31 @@ static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
+	struct blockif_queue *bq;
 	int err;
 
 	err = 0;
 
-	pthread_mutex_lock(&bc->mtx);
-	if (!TAILQ_EMPTY(&bc->freeq)) {
+	if (breq->qidx < 0 || breq->qidx >= bc->nqueues)
+		return EINVAL;
+	bq = &bc->bqs[breq->qidx];
+
+	if (bc->engine == BLOCKIF_NULL) {
+		breq->resid = 0;
+		(*breq->callback)(breq, 0);
+		return 0;
+	}
+
+	pthread_mutex_lock(&bq->mtx);
+	if (blockif_uring_use(bc, op, breq) && !bc->throttle.enabled) {
+		err = blockif_uring_enqueue(bq, breq, op);
+	} else if (!TAILQ_EMPTY(&bq->freeq)) {
 		/*
 		 * Enqueue and inform the block i/o thread
 		 * that there is work available
 		 */
-		if (blockif_enqueue(bc, breq, op))
-			pthread_cond_signal(&bc->cond);
+		if (blockif_enqueue(bq, breq, op))
+			pthread_cond_signal(&bq->cond);
 	} else {
 		/*
 		 * Callers are not allowed to enqueue more than
@@ -798,7 +2023,7 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		 */
 		err = E2BIG;
 	}
-	pthread_mutex_unlock(&bc->mtx);
+	pthread_mutex_unlock(&bq->mtx);
 
 	return err;
 }
@@ -830,13 +2055,18 @@ blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq)
 int
 blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
+	struct blockif_queue *bq;
 	struct blockif_elem *be;
 
-	pthread_mutex_lock(&bc->mtx);
+	if (breq->qidx < 0 || breq->qidx >= bc->nqueues)
+		return -1;
+	bq = &bc->bqs[breq->qidx];
+
+	pthread_mutex_lock(&bq->mtx);
 	/*
 	 * Check pending requests.
 	 */
-	TAILQ_FOREACH(be, &bc->pendq, link) {
+	TAILQ_FOREACH(be, &bq->pendq, link) {
 		if (be->req == breq)
 			break;
 	}
@@ -844,8 +2074,8 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		/*
 		 * Found it.
 		 */
-		blockif_complete(bc, be);
-		pthread_mutex_unlock(&bc->mtx);
+		blockif_complete(bq, be);
+		pthread_mutex_unlock(&bq->mtx);
 
 		return 0;
 	}
@@ -853,7 +2083,7 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 	/*
 	 * Check in-flight requests.
 	 */
-	TAILQ_FOREACH(be, &bc->busyq, link) {
+	TAILQ_FOREACH(be, &bq->busyq, link) {
 		if (be->req == breq)
 			break;
 	}
@@ -861,10 +2091,32 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		/*
 		 * Didn't find it.
 		 */
-		pthread_mutex_unlock(&bc->mtx);
+		pthread_mutex_unlock(&bq->mtx);
 		return -1;
 	}
 
+	/*
+	 * An io_uring request has no processing thread, ask the kernel to
+	 * cancel it. It completes with ECANCELED via the normal callback path
+	 * unless it's already done.
+	 */
+	if (be->tid == 0 && blockif_uring_use(bc, be->op, be->req)) {
+		struct io_uring_sqe *sqe;
+
+		sqe = blockif_uring_get_sqe(&bq->ring, IORING_OP_ASYNC_CANCEL, 0);
+		if (sqe != NULL)
+			sqe->addr = (uintptr_t)be;
+		if (be->linked) {
+			sqe = blockif_uring_get_sqe(&bq->ring,
+					IORING_OP_ASYNC_CANCEL, 0);
+			if (sqe != NULL)
+				sqe->addr = (uintptr_t)be | BLOCKIF_URING_LINK;
+		}
+		blockif_uring_submit(&bq->ring);
+		pthread_mutex_unlock(&bq->mtx);
+		return -EBUSY;
+	}
+
 	/*
 	 * Interrupt the processing thread to force it return
 	 * prematurely via it's normal callback path.
@@ -893,7 +2145,7 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		pthread_mutex_unlock(&bse.mtx);
 	}
 
-	pthread_mutex_unlock(&bc->mtx);
+	pthread_mutex_unlock(&bq->mtx);
 
 	/*
 	 * The processing thread has been interrupted.  Since it's not
@@ -905,33 +2157,131 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 int
 blockif_close(struct blockif_ctxt *bc)
 {
+	struct blockif_queue *bq;
 	void *jval;
-	int i;
+	int i, j;
 
 	sub_file_unlock(bc);
 
 	/*
-	 * Stop the block i/o thread
+	 * Stop the block i/o threads
 	 */
-	pthread_mutex_lock(&bc->mtx);
 	bc->closing = 1;
-	pthread_cond_broadcast(&bc->cond);
-	pthread_mutex_unlock(&bc->mtx);
+	for (j = 0; j < bc->nqueues; j++) {
+		bq = &bc->bqs[j];
+		pthread_mutex_lock(&bq->mtx);
+		pthread_cond_broadcast(&bq->cond);
+		pthread_mutex_unlock(&bq->mtx);
+	}
 
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
-		pthread_join(bc->btid[i], &jval);
+	for (j = 0; j < bc->nqueues; j++) {
+		bq = &bc->bqs[j];
+		for (i = 0; i < bq->nthr; i++)
+			pthread_join(bq->btid[i], &jval);
+		if (bc->engine == BLOCKIF_IO_URING) {
+			blockif_uring_stop(bq);
+			pthread_join(bq->ring.tid, &jval);
+			blockif_uring_deinit(&bq->ring);
+		}
+	}
 
 	/* XXX Cancel queued i/o's ??? */
 
 	/*
 	 * Release resources
 	 */
-	close(bc->fd);
+	if (bc->cow)
+		blockif_cow_close(bc->cow);
+	else if (bc->fd >= 0)
+		close(bc->fd);
+	free(bc->bqs);
 	free(bc);
 
 	return 0;
 }
 
+/*
+ * Hold the submission of the following requests on a queue until
+ * blockif_unplug(), so that a batch of them costs a single system call.
+ * Only io_uring batches the requests, it is a no-op otherwise.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc, int qidx)
+{
+	struct blockif_queue *bq;
+
+	if (bc->engine != BLOCKIF_IO_URING || qidx < 0 || qidx >= bc->nqueues)
+		return;
+	bq = &bc->bqs[qidx];
+
+	pthread_mutex_lock(&bq->mtx);
+	bq->ring.plugged = 1;
+	pthread_mutex_unlock(&bq->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc, int qidx)
+{
+	struct blockif_queue *bq;
+
+	if (bc->engine != BLOCKIF_IO_URING || qidx < 0 || qidx >= bc->nqueues)
+		return;
+	bq = &bc->bqs[qidx];
+
+	pthread_mutex_lock(&bq->mtx);
+	bq->ring.plugged = 0;
+	blockif_uring_submit(&bq->ring);
+	pthread_mutex_unlock(&bq->mtx);
+}
+
+/*
+ * Register the memory the request buffers come from, usually the guest
+ * memory, so that io_uring doesn't map the pages of each request again.
+ * It's only an optimization, the requests still work if it fails.
+ */
+int
+blockif_register_bufs(struct blockif_ctxt *bc, const struct iovec *iov,
+		int iovcnt)
+{
+	struct iovec bufs[BLOCKIF_MAXBUF];
+	size_t len, off;
+	int i, j, n;
+
+	if (bc->engine != BLOCKIF_IO_URING)
+		return 0;
+
+	n = 0;
+	for (i = 0; i < iovcnt; i++) {
+		for (off = 0; off < iov[i].iov_len; off += len) {
+			if (n == BLOCKIF_MAXBUF) {
+				WPRINTF(("too many buffers to register\n"));
+				return -1;
+			}
+			len = MIN(iov[i].iov_len - off, BLOCKIF_BUF_MAXSZ);
+			bufs[n].iov_base = (char *)iov[i].iov_base + off;
+			bufs[n].iov_len = len;
+			n++;
+		}
+	}
+
+	for (j = 0; j < bc->nqueues; j++) {
+		if (io_uring_register(bc->bqs[j].ring.fd,
+				IORING_REGISTER_BUFFERS, bufs, n) < 0) {
+			WPRINTF(("io_uring buffer register failed: %s\n",
+				strerror(errno)));
+			while (--j >= 0)
+				io_uring_register(bc->bqs[j].ring.fd,
+					IORING_UNREGISTER_BUFFERS, NULL, 0);
+			return -1;
+		}
+	}
+
+	/* the rings are idle, no request looks up the buffers yet */
+	memcpy(bc->bufs, bufs, n * sizeof(struct iovec));
+	bc->nbufs = n;
+	return 0;
+}
+
 /*
  * Return virtual C/H/S values for a given block. Use the algorithm
  * outlined in the VHD specification to calculate values.
@@ -1055,7 +2405,7 @@ blockif_flush_all(struct blockif_ctxt *bc)
 	int err;
 
 	err=0;
-	if (fsync(bc->fd))
+	if (bc->fd >= 0 && fsync(bc->fd))
 		err = errno;
 	return err;
 }
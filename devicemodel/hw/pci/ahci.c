@@ -40,10 +40,20 @@
 #include "ahci.h"
 #include "block_if.h"
 #include "ata.h"
+#include "timer.h"
+#include "vmmapi.h"
 
 #define	DEF_PORTS	6	/* Intel ICH8 AHCI supports 6 ports */
 #define	MAX_PORTS	32	/* AHCI supports 32 ports */
 
+/*
+ * NCQ completions are reported in one Set Device Bits FIS while other NCQ
+ * commands of the port are in flight, up to AHCI_SDB_BATCH of them and for
+ * at most AHCI_SDB_DELAY_NS.
+ */
+#define	AHCI_SDB_BATCH		8
+#define	AHCI_SDB_DELAY_NS	100000
+
 #define	PxSIG_ATA	0x00000101 /* ATA drive */
 #define	PxSIG_ATAPI	0xeb140101 /* ATAPI drive */
 
@@ -129,6 +139,9 @@ struct ahci_port {
 	uint8_t asc;
 	u_int ccs;
 	uint32_t pending;
+	uint32_t sdb_done;	/* NCQ slots completed, not reported yet */
+	bool sdb_timer_armed;
+	struct acrn_timer sdb_timer;
 
 	uint32_t clb;
 	uint32_t clbu;
@@ -297,6 +310,21 @@ ahci_port_intr(struct ahci_port *p)
 	}
 }
 
+/*
+ * The command list and the received FIS area stay mapped while the port
+ * runs, their pages are recorded for a migration at each write.
+ */
+static void
+ahci_set_prdbc(struct ahci_port *p, int slot, uint32_t prdbc)
+{
+	struct ahci_cmd_hdr *hdr;
+
+	hdr = (struct ahci_cmd_hdr *)(p->cmd_lst + slot * AHCI_CL_SIZE);
+	hdr->prdbc = prdbc;
+	vm_gpa_mark_dirty(((uint64_t)p->clbu << 32 | p->clb) +
+			  slot * AHCI_CL_SIZE, sizeof(*hdr));
+}
+
 static void
 ahci_write_fis(struct ahci_port *p, enum sata_fis_type ft, uint8_t *fis)
 {
@@ -330,6 +358,7 @@ ahci_write_fis(struct ahci_port *p, enum sata_fis_type ft, uint8_t *fis)
 		irq |= AHCI_P_IX_TFE;
 	}
 	memcpy(p->rfis + offset, fis, len);
+	vm_gpa_mark_dirty(((uint64_t)p->fbu << 32 | p->fb) + offset, len);
 	if (irq) {
 		if (~p->is & irq) {
 			p->is |= irq;
@@ -348,12 +377,74 @@ ahci_write_fis_piosetup(struct ahci_port *p)
 	ahci_write_fis(p, FIS_TYPE_PIOSETUP, fis);
 }
 
+/*
+ * Report the batched NCQ completions of a port.
+ */
+static void
+ahci_flush_sdb(struct ahci_port *p)
+{
+	uint8_t fis[8];
+
+	if (p->sdb_done == 0)
+		return;
+
+	memset(fis, 0, sizeof(fis));
+	fis[0] = FIS_TYPE_SETDEVBITS;
+	fis[1] = (1 << 6);
+	fis[2] = (ATA_S_READY | ATA_S_DSC) & 0x77;
+	*(uint32_t *)(fis + 4) = p->sdb_done;
+	p->sact &= ~p->sdb_done;
+	p->sdb_done = 0;
+	p->tfd &= ~0x77;
+	p->tfd |= fis[2];
+	ahci_write_fis(p, FIS_TYPE_SETDEVBITS, fis);
+}
+
+static void
+ahci_sdb_timer_handler(void *arg, uint64_t nexp)
+{
+	struct ahci_port *p = arg;
+
+	pthread_mutex_lock(&p->ahci_dev->mtx);
+	p->sdb_timer_armed = false;
+	ahci_flush_sdb(p);
+	pthread_mutex_unlock(&p->ahci_dev->mtx);
+}
+
+/*
+ * Complete a NCQ command without error. Hold its report while other NCQ
+ * commands of the port are still in flight, their completions will likely
+ * follow shortly and share the FIS and the interrupt.
+ */
+static void
+ahci_complete_ncq(struct ahci_port *p, int slot)
+{
+	struct itimerspec its;
+
+	p->sdb_done |= (1 << slot);
+
+	if ((p->pending & p->sact & ~p->sdb_done) == 0 ||
+	    __builtin_popcount(p->sdb_done) >= AHCI_SDB_BATCH) {
+		ahci_flush_sdb(p);
+	} else if (!p->sdb_timer_armed) {
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_nsec = AHCI_SDB_DELAY_NS;
+		if (acrn_timer_settime(&p->sdb_timer, &its) == 0)
+			p->sdb_timer_armed = true;
+		else
+			ahci_flush_sdb(p);
+	}
+}
+
 static void
 ahci_write_fis_sdb(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t tfd)
 {
 	uint8_t fis[8];
 	uint8_t error;
 
+	/* report the batched completions apart, before this one */
+	ahci_flush_sdb(p);
+
 	error = (tfd >> 8) & 0xff;
 	tfd &= 0x77;
 	memset(fis, 0, sizeof(fis));
@@ -454,6 +545,7 @@ ahci_check_stopped(struct ahci_port *p)
 			p->cmd &= ~(AHCI_P_CMD_CR | AHCI_P_CMD_CCS_MASK);
 			p->ci = 0;
 			p->sact = 0;
+			p->sdb_done = 0;
 			p->waitforclear = 0;
 		}
 	}
@@ -510,6 +602,7 @@ ahci_port_reset(struct ahci_port *pr)
 {
 	pr->serr = 0;
 	pr->sact = 0;
+	pr->sdb_done = 0;
 	pr->xfermode = ATA_UDMA6;
 	pr->mult_sectors = 128;
 
@@ -584,16 +677,21 @@ atapi_string(uint8_t *dest, const char *src, int len)
 }
 
 /*
- * Build up the iovec based on the PRDT, 'done' and 'len'.
+ * Build up the iovec based on the PRDT, 'done' and 'len'.  The entries
+ * adjacent in guest memory share an iovec, so the guests splitting their
+ * buffers in pages still get large I/Os.
  */
 static void
 ahci_build_iov(struct ahci_port *p, struct ahci_ioreq *aior,
 	       struct ahci_prdt_entry *prdt, uint16_t prdtl)
 {
 	struct blockif_req *breq = &aior->io_req;
-	int i, j, skip, todo, left, extra;
+	struct vm_gpa_map mm;
+	int i, j, n, skip, todo, left, extra;
 	uint32_t dbcsz;
 
+	vm_get_gpa_map(ahci_ctx(p->ahci_dev), &mm);
+
 	/* Copy part of PRDT between 'done' and 'len' bytes into the iov. */
 	skip = aior->done;
 	left = aior->len - aior->done;
@@ -609,13 +707,18 @@ ahci_build_iov(struct ahci_port *p, struct ahci_ioreq *aior,
 		dbcsz -= skip;
 		if (dbcsz > left)
 			dbcsz = left;
-		breq->iov[j].iov_base = paddr_guest2host(ahci_ctx(p->ahci_dev),
+		n = vm_gpa_map_iov_add(&mm, breq->iov, j, BLOCKIF_IOV_MAX,
 		    prdt->dba + skip, dbcsz);
-		breq->iov[j].iov_len = dbcsz;
+		if (n < 0) {
+			/* not guest memory, the backend fails the request */
+			breq->iov[j].iov_base = NULL;
+			breq->iov[j].iov_len = dbcsz;
+			n = j + 1;
+		}
+		j = n;
 		todo += dbcsz;
 		left -= dbcsz;
 		skip = 0;
-		j++;
 	}
 
 	/* If we got limited by IOV length, round I/O down to sector size. */
@@ -919,7 +1022,7 @@ write_prdt(struct ahci_port *p, int slot, uint8_t *cfis,
 		from += sublen;
 		prdt++;
 	}
-	hdr->prdbc = size - len;
+	ahci_set_prdbc(p, slot, size - len);
 }
 
 static void
@@ -1889,7 +1992,6 @@ ahci_handle_port(struct ahci_port *p)
 static void
 ata_ioreq_cb(struct blockif_req *br, int err)
 {
-	struct ahci_cmd_hdr *hdr;
 	struct ahci_ioreq *aior;
 	struct ahci_port *p;
 	struct pci_ahci_vdev *ahci_dev;
@@ -1905,7 +2007,6 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 	cfis = aior->cfis;
 	slot = aior->slot;
 	ahci_dev = p->ahci_dev;
-	hdr = (struct ahci_cmd_hdr *)(p->cmd_lst + slot * AHCI_CL_SIZE);
 
 	if (cfis[2] == ATA_WRITE_FPDMA_QUEUED ||
 	    cfis[2] == ATA_READ_FPDMA_QUEUED ||
@@ -1929,7 +2030,7 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 	STAILQ_INSERT_TAIL(&p->iofhd, aior, io_flist);
 
 	if (!err)
-		hdr->prdbc = aior->done;
+		ahci_set_prdbc(p, slot, aior->done);
 
 	if (!err && aior->more) {
 		if (dsm)
@@ -1943,7 +2044,9 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 		tfd = ATA_S_READY | ATA_S_DSC;
 	else
 		tfd = (ATA_E_ABORT << 8) | ATA_S_READY | ATA_S_ERROR;
-	if (ncq)
+	if (ncq && !err)
+		ahci_complete_ncq(p, slot);
+	else if (ncq)
 		ahci_write_fis_sdb(p, slot, cfis, tfd);
 	else
 		ahci_write_fis_d2h(p, slot, cfis, tfd);
@@ -1963,7 +2066,6 @@ out:
 static void
 atapi_ioreq_cb(struct blockif_req *br, int err)
 {
-	struct ahci_cmd_hdr *hdr;
 	struct ahci_ioreq *aior;
 	struct ahci_port *p;
 	struct pci_ahci_vdev *ahci_dev;
@@ -1978,7 +2080,6 @@ atapi_ioreq_cb(struct blockif_req *br, int err)
 	cfis = aior->cfis;
 	slot = aior->slot;
 	ahci_dev = p->ahci_dev;
-	hdr = (struct ahci_cmd_hdr *)(p->cmd_lst + aior->slot * AHCI_CL_SIZE);
 
 	pthread_mutex_lock(&ahci_dev->mtx);
 
@@ -1993,7 +2094,7 @@ atapi_ioreq_cb(struct blockif_req *br, int err)
 	STAILQ_INSERT_TAIL(&p->iofhd, aior, io_flist);
 
 	if (!err)
-		hdr->prdbc = aior->done;
+		ahci_set_prdbc(p, slot, aior->done);
 
 	if (!err && aior->more) {
 		atapi_read(p, slot, cfis, aior->done);
@@ -2053,6 +2154,13 @@ pci_ahci_ioreq_init(struct ahci_port *pr)
 	}
 
 	TAILQ_INIT(&pr->iobhd);
+
+	if (acrn_timer_init(&pr->sdb_timer, ahci_sdb_timer_handler, pr) != 0) {
+		WPRINTF("%s: failed to init the SDB timer\n", __func__);
+		free(pr->ioreq);
+		pr->ioreq = NULL;
+		return -1;
+	}
 	return 0;
 }
 
@@ -2403,7 +2511,7 @@ pci_ahci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts, int atapi)
 		 */
 		snprintf(bident, sizeof(bident), "%02x:%02x:%02x", dev->slot,
 		    dev->func, p);
-		bctxt = blockif_open(opts, bident);
+		bctxt = blockif_open(opts, bident, 1);
 		if (bctxt == NULL) {
 			ahci_dev->ports = p;
 			ret = 1;
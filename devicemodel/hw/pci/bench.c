@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Benchmark device, the counterpart of acrnbench (misc/debug_tools/acrn_bench)
+ * in the guest.
+ *
+ * It does nothing but complete its accesses, so that the guest can time the
+ * round trip of an I/O request through the hypervisor and the DM, and raise
+ * its INTx on request, so that the guest can time a doorbell to the interrupt
+ * it gets. BAR0 (MMIO) and BAR1 (port I/O) hold the same registers:
+ *
+ *   0x0  ID       RO  BENCH_MAGIC
+ *   0x4  SCRATCH  RW  any value
+ *   0x8  DOORBELL WO  asserts INTx
+ *   0xc  ACK      WO  deasserts INTx
+ *
+ * The INTx state is reported in the status register, as uio_pci_generic
+ * requires to take the interrupt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pci_core.h"
+#include "dm.h"
+
+#define BENCH_VENDOR		0x8086
+#define BENCH_DEV		0x86f0
+#define BENCH_MAGIC		0x48434e42	/* "BNCH" */
+
+#define BENCH_REG_ID		0x0
+#define BENCH_REG_SCRATCH	0x4
+#define BENCH_REG_DOORBELL	0x8
+#define BENCH_REG_ACK		0xc
+
+#define BENCH_MMIO_BAR_SIZE	0x1000
+#define BENCH_IO_BAR_SIZE	0x10
+
+struct pci_bench_vdev {
+	struct pci_vdev *dev;
+	uint32_t scratch;
+};
+
+static void
+pci_bench_set_intx_state(struct pci_vdev *dev, bool asserted)
+{
+	uint16_t sts = pci_get_cfgdata16(dev, PCIR_STATUS);
+
+	if (asserted)
+		sts |= PCIM_STATUS_INTxSTATE;
+	else
+		sts &= ~PCIM_STATUS_INTxSTATE;
+	pci_set_cfgdata16(dev, PCIR_STATUS, sts);
+}
+
+static void
+pci_bench_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		int baridx, uint64_t offset, int size, uint64_t value)
+{
+	struct pci_bench_vdev *bench = dev->arg;
+
+	switch (offset) {
+	case BENCH_REG_SCRATCH:
+		bench->scratch = value;
+		break;
+	case BENCH_REG_DOORBELL:
+		pci_bench_set_intx_state(dev, true);
+		pci_lintr_assert(dev);
+		break;
+	case BENCH_REG_ACK:
+		pci_lintr_deassert(dev);
+		pci_bench_set_intx_state(dev, false);
+		break;
+	default:
+		break;
+	}
+}
+
+static uint64_t
+pci_bench_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+	       int baridx, uint64_t offset, int size)
+{
+	struct pci_bench_vdev *bench = dev->arg;
+
+	switch (offset) {
+	case BENCH_REG_ID:
+		return BENCH_MAGIC;
+	case BENCH_REG_SCRATCH:
+		return bench->scratch;
+	default:
+		return 0;
+	}
+}
+
+static int
+pci_bench_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct pci_bench_vdev *bench;
+
+	bench = calloc(1, sizeof(*bench));
+	if (!bench) {
+		pr_err("%s: out of memory\n", __func__);
+		return -1;
+	}
+	bench->dev = dev;
+	dev->arg = bench;
+
+	pci_set_cfgdata16(dev, PCIR_VENDOR, BENCH_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_DEVICE, BENCH_DEV);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_OTHER);
+
+	if (pci_emul_alloc_bar(dev, 0, PCIBAR_MEM32, BENCH_MMIO_BAR_SIZE) ||
+	    pci_emul_alloc_bar(dev, 1, PCIBAR_IO, BENCH_IO_BAR_SIZE)) {
+		pr_err("%s: failed to allocate the BARs\n", __func__);
+		free(bench);
+		dev->arg = NULL;
+		return -1;
+	}
+	pci_lintr_request(dev);
+
+	return 0;
+}
+
+static void
+pci_bench_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	free(dev->arg);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_bench = {
+	.class_name	= "bench",
+	.vdev_init	= pci_bench_init,
+	.vdev_deinit	= pci_bench_deinit,
+	.vdev_barwrite	= pci_bench_write,
+	.vdev_barread	= pci_bench_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_bench);
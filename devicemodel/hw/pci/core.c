@@ -35,6 +35,8 @@
 #include <strings.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "dm.h"
 #include "vmmapi.h"
@@ -47,6 +49,7 @@
 #include "lpc.h"
 #include "sw_load.h"
 #include "log.h"
+#include "mevent.h"
 
 #define CONF1_ADDR_PORT    0x0cf8
 #define CONF1_DATA_PORT    0x0cfc
@@ -493,6 +496,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		    port >= pdi->bar[i].addr &&
 		    port + bytes <= pdi->bar[i].addr + pdi->bar[i].size) {
 			offset = port - pdi->bar[i].addr;
+			pdi->bar_accesses++;
 			if (in) {
 				*eax = (*ops->vdev_barread)(ctx, vcpu, pdi, i,
 				                            offset, bytes);
@@ -522,6 +526,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 
 	offset = addr - pdi->bar[bidx].addr;
 
+	pdi->bar_accesses++;
 	if (dir == MEM_F_WRITE) {
 		if (size == 8) {
 			(*ops->vdev_barwrite)(ctx, vcpu, pdi, bidx, offset,
@@ -597,6 +602,28 @@ pci_emul_alloc_bar(struct pci_vdev *pdi, int idx, enum pcibar_type type,
 	return pci_emul_alloc_pbar(pdi, idx, 0, type, size);
 }
 
+/*
+ * Tell the hypervisor that guest writes to the posted window of the BAR
+ * 'idx' need not wait for their completion. Failures are not fatal, the
+ * writes are then handled as normal requests.
+ */
+static void
+modify_bar_posted_range(struct pci_vdev *dev, int idx, uint32_t type,
+		int registration)
+{
+	uint64_t start;
+	struct pcibar *bar = &dev->bar[idx];
+
+	if (bar->posted_size == 0)
+		return;
+
+	start = bar->addr + bar->posted_offset;
+	if (vm_set_posted_io_range(dev->vmctx, type, start,
+			start + bar->posted_size, registration != 0) != 0)
+		pr_dbg("%s: failed to %s posted range 0x%lx of %s\n", __func__,
+			registration ? "set" : "clear", start, dev->name);
+}
+
 /*
  * Register (or unregister) the MMIO or I/O region associated with the BAR
  * register 'idx' of an emulated pci device.
@@ -626,6 +653,8 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 			error = register_inout(&iop);
 		} else
 			error = unregister_inout(&iop);
+		if (error == 0)
+			modify_bar_posted_range(dev, idx, REQ_PORTIO, registration);
 		break;
 	case PCIBAR_MEM32:
 	case PCIBAR_MEM64:
@@ -641,6 +670,8 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 			error = register_mem(&mr);
 		} else
 			error = unregister_mem(&mr);
+		if (error == 0)
+			modify_bar_posted_range(dev, idx, REQ_MMIO, registration);
 		break;
 	default:
 		error = EINVAL;
@@ -872,6 +903,19 @@ pci_emul_alloc_pbar(struct pci_vdev *pdi, int idx, uint64_t hostbase,
 	return 0;
 }
 
+/*
+ * Mark [offset, offset + size) of the BAR 'idx' as write-only registers
+ * whose writes can be posted, e.g. doorbells. Shall be called before the
+ * BAR is allocated.
+ */
+void
+pci_emul_set_bar_posted(struct pci_vdev *pdi, int idx, uint64_t offset,
+		uint64_t size)
+{
+	pdi->bar[idx].posted_offset = offset;
+	pdi->bar[idx].posted_size = size;
+}
+
 void
 pci_emul_free_bar(struct pci_vdev *pdi, int idx)
 {
@@ -1017,6 +1061,7 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	pdi->lintr.state = IDLE;
 	pdi->lintr.pirq_pin = 0;
 	pdi->lintr.ioapic_irq = 0;
+	pdi->lintr.resample_fd = -1;
 	pdi->dev_ops = ops;
 	snprintf(pdi->name, PI_NAMESZ, "%s-pci-%d", ops->class_name, slot);
 
@@ -1050,6 +1095,7 @@ pci_emul_deinit(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		free(fi->fi_param);
 
 	if (fi->fi_devi) {
+		free(fi->fi_devi->reset_cfgdata);
 		pci_lintr_release(fi->fi_devi);
 		pci_emul_free_bars(fi->fi_devi);
 		pci_emul_free_msixcap(fi->fi_devi);
@@ -1165,9 +1211,108 @@ pci_emul_add_msixcap(struct pci_vdev *dev, int msgnum, int barnum)
 					sizeof(msixcap)));
 }
 
+static void
+pci_msix_irqfd_bind(struct pci_vdev *dev, struct msix_irqfd *route,
+		    bool assign)
+{
+	struct acrn_irqfd irqfd = {0};
+
+	irqfd.fd = route->fd;
+	irqfd.flags = assign ? 0 : ACRN_IRQFD_FLAG_DEASSIGN;
+	irqfd.msi.msi_addr = route->addr;
+	irqfd.msi.msi_data = route->msg_data;
+	if (vm_irqfd(dev->vmctx, &irqfd) < 0) {
+		if (assign) {
+			close(route->fd);
+			route->fd = -1;
+			route->bind_failed = true;
+		}
+		pr_dbg("%s: irqfd %s of %x:%x.%x failed, errno = %d\n",
+			__func__, assign ? "assign" : "deassign", dev->bus,
+			dev->slot, dev->func, errno);
+	}
+}
+
+/*
+ * Signal the eventfd bound to the current message of the entry, rebinding it
+ * if the guest has reprogrammed the entry since the last interrupt.
+ *
+ * Return 0 on success and -1 if the interrupt has to take the ioctl path.
+ */
+static int
+pci_msix_irqfd_signal(struct pci_vdev *dev, int index,
+		      struct msix_table_entry *mte)
+{
+	struct msix_irqfd *route = &dev->msix.irqfd[index];
+	uint64_t cnt = 1;
+	int rc = -1;
+
+	pthread_mutex_lock(&dev->msix.irqfd_mtx);
+	if (route->addr != mte->addr || route->msg_data != mte->msg_data) {
+		if (route->fd >= 0) {
+			pci_msix_irqfd_bind(dev, route, false);
+			close(route->fd);
+			route->fd = -1;
+		}
+		/* a new message may bind where the old one failed */
+		route->bind_failed = false;
+	}
+
+	if (route->fd < 0 && !route->bind_failed) {
+		route->addr = mte->addr;
+		route->msg_data = mte->msg_data;
+		route->fd = eventfd(0, EFD_NONBLOCK);
+		if (route->fd >= 0)
+			pci_msix_irqfd_bind(dev, route, true);
+		else
+			route->bind_failed = true;
+	}
+
+	if (route->fd >= 0 && write(route->fd, &cnt, sizeof(cnt)) == sizeof(cnt))
+		rc = 0;
+	pthread_mutex_unlock(&dev->msix.irqfd_mtx);
+
+	return rc;
+}
+
+int
+pci_msix_irqfd_init(struct pci_vdev *dev)
+{
+	int i;
+
+	if (!dev->msix.table || dev->msix.irqfd)
+		return -1;
+
+	dev->msix.irqfd = calloc(dev->msix.table_count,
+			sizeof(struct msix_irqfd));
+	if (!dev->msix.irqfd)
+		return -1;
+
+	for (i = 0; i < dev->msix.table_count; i++)
+		dev->msix.irqfd[i].fd = -1;
+	pthread_mutex_init(&dev->msix.irqfd_mtx, NULL);
+
+	return 0;
+}
+
 static void
 pci_emul_free_msixcap(struct pci_vdev *pdi)
 {
+	int i;
+
+	if (pdi->msix.irqfd) {
+		for (i = 0; i < pdi->msix.table_count; i++) {
+			if (pdi->msix.irqfd[i].fd >= 0) {
+				pci_msix_irqfd_bind(pdi, &pdi->msix.irqfd[i],
+					false);
+				close(pdi->msix.irqfd[i].fd);
+			}
+		}
+		pthread_mutex_destroy(&pdi->msix.irqfd_mtx);
+		free(pdi->msix.irqfd);
+		pdi->msix.irqfd = NULL;
+	}
+
 	if (pdi->msix.table) {
 		free(pdi->msix.table);
 		pdi->msix.table = NULL;
@@ -1373,6 +1518,19 @@ pci_emul_ecfg_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 #define	BUSIO_ROUNDUP		32
 #define	BUSMEM_ROUNDUP		(1024 * 1024)
 
+static int
+pci_save_reset_cfgdata(struct pci_vdev *dev, void *arg)
+{
+	if (dev->dev_ops->vdev_reset) {
+		dev->reset_cfgdata = malloc(sizeof(dev->cfgdata));
+		if (dev->reset_cfgdata)
+			memcpy(dev->reset_cfgdata, dev->cfgdata,
+			       sizeof(dev->cfgdata));
+	}
+
+	return 0;
+}
+
 int
 init_pci(struct vmctx *ctx)
 {
@@ -1540,6 +1698,9 @@ init_pci(struct vmctx *ctx)
 	if (error != 0)
 		goto pci_emul_init_fail;
 
+	/* the INTx routing is part of the image */
+	pci_walk_vdevs(pci_save_reset_cfgdata, NULL);
+
 	return 0;
 
 pci_emul_init_fail:
@@ -1883,6 +2044,8 @@ pci_generate_msix(struct pci_vdev *dev, int index)
 	mte = &dev->msix.table[index];
 	if ((mte->vector_control & PCIM_MSIX_VCTRL_MASK) == 0) {
 		/* XXX Set PBA bit if interrupt is disabled */
+		if (dev->msix.irqfd && pci_msix_irqfd_signal(dev, index, mte) == 0)
+			return;
 		vm_lapic_msi(dev->vmctx, mte->addr, mte->msg_data);
 	}
 }
@@ -1946,6 +2109,80 @@ pci_lintr_request(struct pci_vdev *dev)
 	pci_set_cfgdata8(dev, PCIR_INTPIN, bestpin + 1);
 }
 
+/*
+ * The hypervisor deasserts a resampled line at the guest EOI and then signals
+ * its eventfd: the line is asserted again here if the device still needs
+ * service, so that a device dropping its INTx costs no hypercall.
+ */
+static void
+pci_lintr_resample(int fd, enum ev_type t, void *arg)
+{
+	struct pci_vdev *dev = arg;
+	uint64_t cnt;
+
+	if (read(fd, &cnt, sizeof(cnt)) < 0)
+		return;
+
+	pthread_mutex_lock(&dev->lintr.lock);
+	if (dev->lintr.state == ASSERTED)
+		pci_irq_assert(dev);
+	pthread_mutex_unlock(&dev->lintr.lock);
+}
+
+/* called with the lintr lock held, on the first assertion of the line */
+static void
+pci_lintr_resample_init(struct pci_vdev *dev)
+{
+	struct acrn_resamplefd resamplefd = {0};
+	int fd;
+
+	dev->lintr.resample_tried = true;
+
+	/* the lines below 16 may be routed to the vPIC as well */
+	if (dev->lintr.ioapic_irq < 16)
+		return;
+
+	fd = eventfd(0, EFD_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	resamplefd.fd = fd;
+	resamplefd.gsi = dev->lintr.ioapic_irq;
+	if (vm_resamplefd(dev->vmctx, &resamplefd) < 0) {
+		pr_dbg("%s: resamplefd of %x:%x.%x failed, errno = %d\n",
+			__func__, dev->bus, dev->slot, dev->func, errno);
+		close(fd);
+		return;
+	}
+
+	dev->lintr.resample_mevp = mevent_add(fd, EVF_READ,
+			pci_lintr_resample, dev, NULL, NULL);
+	if (dev->lintr.resample_mevp == NULL) {
+		resamplefd.flags = ACRN_RESAMPLEFD_FLAG_DEASSIGN;
+		vm_resamplefd(dev->vmctx, &resamplefd);
+		close(fd);
+		return;
+	}
+	dev->lintr.resample_fd = fd;
+}
+
+static void
+pci_lintr_resample_deinit(struct pci_vdev *dev)
+{
+	struct acrn_resamplefd resamplefd = {0};
+
+	if (dev->lintr.resample_fd < 0)
+		return;
+
+	resamplefd.fd = dev->lintr.resample_fd;
+	resamplefd.flags = ACRN_RESAMPLEFD_FLAG_DEASSIGN;
+	resamplefd.gsi = dev->lintr.ioapic_irq;
+	vm_resamplefd(dev->vmctx, &resamplefd);
+	mevent_delete_close(dev->lintr.resample_mevp);
+	dev->lintr.resample_mevp = NULL;
+	dev->lintr.resample_fd = -1;
+}
+
 void
 pci_lintr_release(struct pci_vdev *dev)
 {
@@ -1953,6 +2190,8 @@ pci_lintr_release(struct pci_vdev *dev)
 	struct slotinfo *si;
 	int pin;
 
+	pci_lintr_resample_deinit(dev);
+
 	bi = pci_businfo[dev->bus];
 	if (bi == NULL) {
 		pr_err("%s: pci [%s] has wrong bus %d info!\n", __func__, dev->name, dev->bus);
@@ -2019,6 +2258,8 @@ pci_lintr_assert(struct pci_vdev *dev)
 	}
 
 	pthread_mutex_lock(&dev->lintr.lock);
+	if (!dev->lintr.resample_tried)
+		pci_lintr_resample_init(dev);
 	if (dev->lintr.state == IDLE) {
 		if (pci_lintr_permitted(dev)) {
 			dev->lintr.state = ASSERTED;
@@ -2047,7 +2288,9 @@ pci_lintr_deassert(struct pci_vdev *dev)
 	pthread_mutex_lock(&dev->lintr.lock);
 	if (dev->lintr.state == ASSERTED) {
 		dev->lintr.state = IDLE;
-		pci_irq_deassert(dev);
+		/* a resampled line is deasserted by the hypervisor at EOI */
+		if (dev->lintr.resample_fd < 0)
+			pci_irq_deassert(dev);
 	} else if (dev->lintr.state == PENDING)
 		dev->lintr.state = IDLE;
 	pthread_mutex_unlock(&dev->lintr.lock);
@@ -2109,6 +2352,39 @@ pci_walk_lintr(int bus, pci_lintr_cb cb, void *arg)
 	}
 }
 
+/*
+ * Call 'cb' for each emulated device on all the buses, stop at the first
+ * non-zero return and pass it up.
+ */
+int
+pci_walk_vdevs(pci_vdev_cb cb, void *arg)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	struct pci_vdev *dev;
+	int bus, slot, func, ret;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				dev = si->si_funcs[func].fi_devi;
+				if (dev == NULL)
+					continue;
+				ret = cb(dev, arg);
+				if (ret != 0)
+					return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Return 1 if the emulated device in 'slot' is a multi-function device.
  * Return 0 otherwise.
@@ -2423,6 +2699,102 @@ emulate_pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot,
 	return 0;
 }
 
+static void
+pci_cfgrestore(struct vmctx *ctx, struct pci_vdev *dev, int coff, int bytes,
+	       uint32_t val)
+{
+	pci_cfgrw(ctx, 0, 0, dev->bus, dev->slot, dev->func, coff, bytes, &val);
+}
+
+/*
+ * Bring the config space of 'dev' back to a saved image. The writes are
+ * replayed through the emulation so that the BARs get registered at the
+ * saved addresses and the MSI/MSI-X capabilities take effect. Decoding
+ * stays off while the BARs move, the command register goes last.
+ */
+void
+pci_restore_cfgdata(struct vmctx *ctx, struct pci_vdev *dev,
+		    const uint8_t *cfgdata)
+{
+	uint16_t cmd;
+	int coff;
+
+	cmd = pci_get_cfgdata16(dev, PCIR_COMMAND);
+	pci_cfgrestore(ctx, dev, PCIR_COMMAND, 2,
+		       cmd & ~(PCIM_CMD_PORTEN | PCIM_CMD_MEMEN));
+
+	for (coff = PCIR_BAR(0); coff < PCIR_BAR(PCI_BARMAX + 1); coff += 4)
+		pci_cfgrestore(ctx, dev, coff, 4,
+			       *(const uint32_t *)(cfgdata + coff));
+
+	pci_cfgrestore(ctx, dev, PCIR_INTLINE, 1, cfgdata[PCIR_INTLINE]);
+
+	for (coff = CAP_START_OFFSET; coff <= PCI_REGMAX; coff += 4)
+		pci_cfgrestore(ctx, dev, coff, 4,
+			       *(const uint32_t *)(cfgdata + coff));
+
+	pci_cfgrestore(ctx, dev, PCIR_COMMAND, 2,
+		       *(const uint16_t *)(cfgdata + PCIR_COMMAND));
+}
+
+static int
+pci_vdev_no_warm_reset(struct pci_vdev *dev, void *arg)
+{
+	return (dev->dev_ops->vdev_reset == NULL || dev->reset_cfgdata == NULL);
+}
+
+/*
+ * Return true if all the devices can be reset in place by reset_pci().
+ */
+bool
+pci_warm_reset_supported(void)
+{
+	return (pci_walk_vdevs(pci_vdev_no_warm_reset, NULL) == 0);
+}
+
+static int
+pci_warm_reset_vdev(struct pci_vdev *dev, void *arg)
+{
+	struct vmctx *ctx = arg;
+	int i;
+
+	(*dev->dev_ops->vdev_reset)(ctx, dev);
+
+	if (dev->lintr.pin > 0)
+		pci_lintr_deassert(dev);
+
+	/* the MSI-X table is not part of the config space */
+	for (i = 0; i < dev->msix.table_count && dev->msix.table; i++) {
+		dev->msix.table[i].addr = 0;
+		dev->msix.table[i].msg_data = 0;
+		dev->msix.table[i].vector_control = PCIM_MSIX_VCTRL_MASK;
+	}
+
+	pci_restore_cfgdata(ctx, dev, dev->reset_cfgdata);
+
+	return 0;
+}
+
+/*
+ * Reset all the devices in place: the instances, their BARs, interrupt
+ * routing and backends stay, so do the ACPI tables describing them.
+ *
+ * @pre pci_warm_reset_supported() == true
+ */
+void
+reset_pci(struct vmctx *ctx)
+{
+	pci_walk_vdevs(pci_warm_reset_vdev, ctx);
+}
+
+/*
+ * vdev_reset of the devices with no state beyond their config space.
+ */
+void
+pci_vdev_reset_nop(struct vmctx *ctx, struct pci_vdev *dev)
+{
+}
+
 #define PCI_EMUL_TEST
 #ifdef PCI_EMUL_TEST
 /*
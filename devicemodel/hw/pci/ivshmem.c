@@ -78,9 +78,57 @@ struct pci_ivshmem_vdev {
 	bool		is_hv_land;
 };
 
+/*
+ * Open the shared memory in the shared 2M hugetlbfs, so that both the SOS
+ * and the EPT map it with 2M pages. The creator falls back to /dev/shm when
+ * there are not enough huge pages, the other peers use the backing of the
+ * creator as they look for the hugetlbfs file first.
+ *
+ * Return the file descriptor, -ENOENT to fall back to /dev/shm, or -EINVAL
+ * if the hugetlbfs file of another peer can't be used.
+ */
+static int
+open_ivshmem_hugetlb(const char *name, uint32_t size, int node, void **addr)
+{
+	struct stat st;
+	int fd;
+
+	*addr = NULL;
+	fd = hugetlb_open_shared(name, O_CREAT | O_EXCL | O_RDWR);
+	if (fd >= 0) {
+		if (ftruncate(fd, size) < 0 ||
+		    (*addr = hugetlb_map_shared(fd, size, node, true)) == NULL) {
+			pr_info("no huge pages for %s, use /dev/shm\n", name);
+			close(fd);
+			hugetlb_unlink_shared(name);
+			return -ENOENT;
+		}
+		return fd;
+	}
+	if (errno != EEXIST)
+		return -ENOENT;
+
+	fd = hugetlb_open_shared(name, O_RDWR);
+	if (fd < 0)
+		return -EINVAL;
+	if ((fstat(fd, &st) < 0) || st.st_size != size) {
+		pr_warn("shm size is different, cur %u, creator %ld\n",
+			size, st.st_size);
+		close(fd);
+		return -EINVAL;
+	}
+	*addr = hugetlb_map_shared(fd, size, node, false);
+	if (*addr == NULL) {
+		pr_warn("failed to map %s, error %s\n", name, strerror(errno));
+		close(fd);
+		return -EINVAL;
+	}
+	return fd;
+}
+
 static int
 create_ivshmem_from_dm(struct vmctx *ctx, struct pci_vdev *vdev,
-		const char *name, uint32_t size)
+		const char *name, uint32_t size, int node)
 {
 	struct stat st;
 	int fd = -1;
@@ -89,6 +137,12 @@ create_ivshmem_from_dm(struct vmctx *ctx, struct pci_vdev *vdev,
 	struct pci_ivshmem_vdev *ivshmem_vdev = (struct pci_ivshmem_vdev *) vdev->arg;
 	uint64_t bar_addr;
 
+	fd = open_ivshmem_hugetlb(name, size, node, &addr);
+	if (fd >= 0)
+		goto map;
+	else if (fd != -ENOENT)
+		goto err;
+
 	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
 	if (fd > 0)
 		is_shm_creator = true;
@@ -115,6 +169,13 @@ create_ivshmem_from_dm(struct vmctx *ctx, struct pci_vdev *vdev,
 
 	addr = (void *)mmap(NULL, size, PROT_READ | PROT_WRITE,
 			MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		addr = NULL;
+	else if (is_shm_creator)
+		/* transparent huge pages, if shmem_enabled allows them */
+		madvise(addr, size, MADV_HUGEPAGE);
+
+map:
 	bar_addr = pci_get_cfgdata32(vdev, PCIR_BAR(IVSHMEM_MEM_BAR));
 	bar_addr |= ((uint64_t)pci_get_cfgdata32(vdev, PCIR_BAR(IVSHMEM_MEM_BAR + 1)) << 32);
 	bar_addr &= PCIM_BAR_MEM_BASE;
@@ -253,9 +314,9 @@ pci_ivshmem_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *tmp, *name, *orig;
 	struct pci_ivshmem_vdev *ivshmem_vdev = NULL;
 	bool is_hv_land;
-	int rc;
+	int rc, node = -1;
 
-	/* ivshmem device usage: "-s N,ivshmem,shm_name,shm_size" */
+	/* ivshmem device usage: "-s N,ivshmem,shm_name,shm_size[,node=N]" */
 	tmp = orig = strdup(opts);
 	if (!orig) {
 		pr_warn("No memory for strdup\n");
@@ -289,6 +350,16 @@ pci_ivshmem_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto err;
 	}
 
+	if (!strncmp(tmp, ",node=", strlen(",node="))) {
+		if (dm_strtoi(tmp + strlen(",node="), &tmp, 10, &node) != 0 ||
+				node < 0) {
+			pr_warn("the NUMA node of the shared memory is incorrect\n");
+			goto err;
+		}
+		if (is_hv_land)
+			pr_warn("the NUMA node of hv-land shared memory is ignored\n");
+	}
+
 	ivshmem_vdev = calloc(1, sizeof(struct pci_ivshmem_vdev));
 	if (!ivshmem_vdev) {
 		pr_warn("failed to allocate ivshmem device\n");
@@ -317,7 +388,7 @@ pci_ivshmem_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		 * unavailable for UOS, so we need to remap GPA and HPA of shared
 		 * memory in this case.
 		 */
-		rc = create_ivshmem_from_dm(ctx, dev, name, size);
+		rc = create_ivshmem_from_dm(ctx, dev, name, size, node);
 	}
 	if (rc < 0)
 		goto err;
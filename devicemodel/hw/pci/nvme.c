@@ -0,0 +1,1655 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * NVMe controller emulation, with a single namespace on a blockif backend.
+ *
+ * For the guests without virtio drivers, e.g. Windows or the firmware, the
+ * inbox NVMe drivers get a multi-queue controller in place of AHCI:
+ * - each I/O queue pair, normally one per vCPU of the guest, is served by a
+ *   blockif queue of its own (mq=<n> pairs; with aio=io_uring, a ring each),
+ *   and interrupts the guest with the MSI-X vector the guest assigned to it;
+ * - the doorbells are posted writes, the vCPU does not wait for the
+ *   commands it submits to be fetched;
+ * - the shadow doorbells of the Doorbell Buffer Config command let the
+ *   guest skip the doorbell writes: the tails and heads are read from the
+ *   guest memory, and the event indexes only ask for a doorbell when the
+ *   controller has nothing left in flight to pick up the new commands with.
+ *
+ * usage: -s <slot>,nvme,<blockif options>[,mq=<number of I/O queue pairs>]
+ */
+
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <openssl/md5.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "block_if.h"
+#include "nvme.h"
+#include "atomic.h"
+#include "dm_string.h"
+
+#define	NVME_MAX_IOQ		16	/* I/O queue pairs */
+#define	NVME_QUEUES		(NVME_MAX_IOQ + 1)
+#define	NVME_MQES		1024	/* max entries of a queue */
+#define	NVME_PAGE_SIZE		4096	/* CC.MPS 0, the only one supported */
+#define	NVME_MDTS		7	/* transfers of up to 512K */
+#define	NVME_MAX_PRP		((1 << NVME_MDTS) + 1)	/* pages of a transfer */
+#define	NVME_AERL		4	/* async event requests kept */
+#define	NVME_NSID		1
+
+#define	NVME_BAR_REGS		0
+#define	NVME_BAR_MSIX		4
+#define	NVME_REGS_SIZE		0x4000
+
+#define	NVME_VENDOR		0x8086
+#define	NVME_DEVICE		0x5845
+#define	NVME_FW_REV		"1.0"
+#define	NVME_MAX_OPTS_LEN	1024
+
+/* 343 K, the default temperature threshold */
+#define	NVME_TEMP_THRESHOLD	0x157
+#define	NVME_TEMPERATURE	0x143
+
+/*
+ * Debug printf
+ */
+#ifdef NVME_DEBUG
+#define DPRINTF(format, arg...) do { pr_dbg(format, ##arg); } while (0)
+#else
+#define DPRINTF(format, arg...)
+#endif
+#define WPRINTF(format, arg...) pr_err(format, ##arg)
+
+/* status of a command still in execution */
+#define	NVME_PENDING		0xffff
+
+struct nvme_vdev;
+struct nvme_sq;
+
+struct nvme_ioreq {
+	struct blockif_req	io_req;
+	struct nvme_sq		*sq;
+	uint16_t		cid;
+	uint8_t			opc;
+	uint32_t		nlb;
+	struct nvme_dsm_range	*ranges;	/* of a dataset management */
+	int			nranges;
+	int			range;
+	STAILQ_ENTRY(nvme_ioreq) link;
+};
+
+struct nvme_cq {
+	struct nvme_completion	*ring;
+	uint64_t		gpa;		/* of the ring */
+	uint32_t		size;
+	uint16_t		qid;
+	uint16_t		head;
+	uint16_t		tail;
+	uint16_t		iv;
+	uint8_t			phase;
+	bool			ien;
+	bool			enabled;
+	bool			stalled;	/* an SQ waits for entries */
+	int			reserved;	/* for the commands fetched */
+	pthread_mutex_t		mtx;
+};
+
+struct nvme_sq {
+	struct nvme_vdev	*nvme;
+	struct nvme_command	*ring;
+	uint32_t		size;
+	uint16_t		qid;
+	uint16_t		cqid;
+	uint16_t		head;
+	uint16_t		tail;		/* of the last doorbell */
+	bool			enabled;
+	bool			fetching;
+	bool			kick;		/* fetch again once done */
+	int			inflight;
+	struct nvme_ioreq	*reqs;
+	STAILQ_HEAD(, nvme_ioreq) freeq;
+	pthread_mutex_t		mtx;
+	pthread_cond_t		idle;
+};
+
+struct nvme_vdev {
+	struct pci_vdev		*dev;
+	struct vmctx		*ctx;
+	struct blockif_ctxt	*bc;
+	pthread_mutex_t		mtx;
+
+	uint64_t		cap;
+	uint32_t		vs;
+	uint32_t		intms;
+	uint32_t		cc;
+	uint32_t		csts;
+	uint32_t		aqa;
+	uint64_t		asq;
+	uint64_t		acq;
+	int			lintr;
+
+	int			nioq;		/* I/O queue pairs */
+	int			ioqsz;		/* commands in flight per SQ */
+	struct nvme_sq		sq[NVME_QUEUES];
+	struct nvme_cq		cq[NVME_QUEUES];
+
+	/* shadow doorbells and event indexes, in the guest memory */
+	volatile uint32_t	*dbbuf_db;
+	volatile uint32_t	*dbbuf_ei;
+	uint64_t		dbbuf_gpa[2];
+
+	int			aer_count;
+	uint32_t		feat[NVME_FEAT_MAX];
+	uint64_t		sectors_read;	/* in 512 bytes */
+	uint64_t		sectors_written;
+	uint64_t		read_commands;
+	uint64_t		write_commands;
+
+	int			sectsz;
+	uint64_t		nsze;
+	struct nvme_controller_data ctrldata;
+	struct nvme_namespace_data nsdata;
+};
+
+static void nvme_process_sq(struct nvme_vdev *nvme, struct nvme_sq *sq);
+
+static void
+nvme_init_mutex(pthread_mutex_t *mtx)
+{
+	pthread_mutexattr_t attr;
+
+	/* blockif may complete a request within the submission */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void
+nvme_strpad(char *dst, const char *src, size_t len)
+{
+	size_t n = strnlen(src, len);
+
+	memcpy(dst, src, n);
+	memset(dst + n, ' ', len - n);
+}
+
+/*
+ * Shadow doorbells, only used by the I/O queues.
+ */
+static inline bool
+nvme_dbbuf(struct nvme_vdev *nvme, uint16_t qid)
+{
+	return nvme->dbbuf_db != NULL && qid != 0;
+}
+
+static uint16_t
+nvme_sq_tail(struct nvme_vdev *nvme, struct nvme_sq *sq)
+{
+	uint32_t tail;
+
+	if (!nvme_dbbuf(nvme, sq->qid))
+		return sq->tail;
+
+	tail = nvme->dbbuf_db[2 * sq->qid];
+	atomic_thread_fence();
+	return (tail < sq->size) ? tail : sq->tail;
+}
+
+/*
+ * The queues and the shadow doorbells stay mapped while they are enabled,
+ * their pages are recorded for a migration at each write of the device.
+ */
+static void
+nvme_dbbuf_dirty(struct nvme_vdev *nvme)
+{
+	vm_gpa_mark_dirty(nvme->dbbuf_gpa[0], NVME_PAGE_SIZE);
+	vm_gpa_mark_dirty(nvme->dbbuf_gpa[1], NVME_PAGE_SIZE);
+}
+
+static void
+nvme_cq_update_head(struct nvme_vdev *nvme, struct nvme_cq *cq)
+{
+	uint32_t head;
+
+	if (!nvme_dbbuf(nvme, cq->qid))
+		return;
+
+	head = nvme->dbbuf_db[2 * cq->qid + 1];
+	atomic_thread_fence();
+	if (head < cq->size)
+		cq->head = head;
+}
+
+/*
+ * Hold an entry of the CQ for the completion of a command before it is
+ * fetched, so that the completions never find the CQ full.
+ */
+static bool
+nvme_cq_reserve(struct nvme_vdev *nvme, struct nvme_cq *cq)
+{
+	uint32_t used;
+	bool ret = true;
+
+	pthread_mutex_lock(&cq->mtx);
+	nvme_cq_update_head(nvme, cq);
+	used = (cq->tail + cq->size - cq->head) % cq->size;
+	if (used + cq->reserved >= cq->size - 1 && nvme_dbbuf(nvme, cq->qid)) {
+		/* ask for a doorbell once the guest consumes an entry */
+		nvme->dbbuf_ei[2 * cq->qid + 1] = cq->head;
+		nvme_dbbuf_dirty(nvme);
+		atomic_thread_fence();
+		nvme_cq_update_head(nvme, cq);
+		used = (cq->tail + cq->size - cq->head) % cq->size;
+	}
+	if (used + cq->reserved >= cq->size - 1) {
+		cq->stalled = true;
+		ret = false;
+	} else {
+		cq->reserved++;
+	}
+	pthread_mutex_unlock(&cq->mtx);
+
+	return ret;
+}
+
+static void
+nvme_cq_unreserve(struct nvme_cq *cq)
+{
+	pthread_mutex_lock(&cq->mtx);
+	cq->reserved--;
+	pthread_mutex_unlock(&cq->mtx);
+}
+
+static void
+nvme_cq_intr(struct nvme_vdev *nvme, struct nvme_cq *cq)
+{
+	if (!cq->ien)
+		return;
+
+	if (pci_msix_enabled(nvme->dev)) {
+		pci_generate_msix(nvme->dev, cq->iv);
+	} else if (!(nvme->intms & 0x1) && !nvme->lintr) {
+		nvme->lintr = 1;
+		pci_lintr_assert(nvme->dev);
+	}
+}
+
+/* post the completion of a command, on the entry it reserved */
+static void
+nvme_complete(struct nvme_vdev *nvme, struct nvme_sq *sq, uint16_t cid,
+	      uint32_t cdw0, uint16_t status)
+{
+	struct nvme_cq *cq = &nvme->cq[sq->cqid];
+	struct nvme_completion *cqe;
+
+	pthread_mutex_lock(&cq->mtx);
+	cqe = &cq->ring[cq->tail];
+	cqe->cdw0 = cdw0;
+	cqe->sqhd = sq->head;
+	cqe->sqid = sq->qid;
+	cqe->cid = cid;
+	/* the phase tag makes the entry valid, it goes last */
+	atomic_thread_fence();
+	cqe->status = status | cq->phase;
+	vm_gpa_mark_dirty(cq->gpa + cq->tail * sizeof(*cqe), sizeof(*cqe));
+	if (++cq->tail == cq->size) {
+		cq->tail = 0;
+		cq->phase ^= NVME_STATUS_PHASE;
+	}
+	cq->reserved--;
+	pthread_mutex_unlock(&cq->mtx);
+
+	nvme_cq_intr(nvme, cq);
+}
+
+/*
+ * Guest memory of the PRPs of a transfer, merged into as few iovecs as
+ * the host mappings allow.
+ */
+static int
+nvme_prp_add(struct nvme_vdev *nvme, struct iovec *iov, int *iovcnt,
+	     int max, uint64_t gpa, size_t len)
+{
+	void *hva;
+
+	hva = paddr_guest2host(nvme->ctx, gpa, len);
+	if (hva == NULL)
+		return -1;
+
+	if (*iovcnt > 0 &&
+	    (uint8_t *)iov[*iovcnt - 1].iov_base + iov[*iovcnt - 1].iov_len == hva) {
+		iov[*iovcnt - 1].iov_len += len;
+		return 0;
+	}
+	if (*iovcnt == max)
+		return -1;
+
+	iov[*iovcnt].iov_base = hva;
+	iov[*iovcnt].iov_len = len;
+	(*iovcnt)++;
+	return 0;
+}
+
+static int
+nvme_prp_iov(struct nvme_vdev *nvme, uint64_t prp1, uint64_t prp2,
+	     size_t len, struct iovec *iov, int *iovcnt, int max)
+{
+	uint64_t *list, entry;
+	size_t size;
+	int i, n;
+
+	*iovcnt = 0;
+	if (len == 0)
+		return 0;
+	if (prp1 & 0x3)
+		return -1;
+
+	size = MIN(len, NVME_PAGE_SIZE - (prp1 & (NVME_PAGE_SIZE - 1)));
+	if (nvme_prp_add(nvme, iov, iovcnt, max, prp1, size) < 0)
+		return -1;
+	len -= size;
+	if (len == 0)
+		return 0;
+
+	if (len <= NVME_PAGE_SIZE) {
+		if (prp2 & (NVME_PAGE_SIZE - 1))
+			return -1;
+		return nvme_prp_add(nvme, iov, iovcnt, max, prp2, len);
+	}
+
+	/* prp2 is a PRP list, the last entry of each page links the next */
+	while (len > 0) {
+		if (prp2 & 0x7)
+			return -1;
+		n = (NVME_PAGE_SIZE - (prp2 & (NVME_PAGE_SIZE - 1))) / 8;
+		list = paddr_guest2host(nvme->ctx, prp2, n * 8);
+		if (list == NULL)
+			return -1;
+		for (i = 0; i < n && len > 0; i++) {
+			entry = list[i];
+			if (i == n - 1 && len > NVME_PAGE_SIZE) {
+				prp2 = entry;
+				break;
+			}
+			if (entry & (NVME_PAGE_SIZE - 1))
+				return -1;
+			size = MIN(len, NVME_PAGE_SIZE);
+			if (nvme_prp_add(nvme, iov, iovcnt, max, entry, size) < 0)
+				return -1;
+			len -= size;
+		}
+	}
+
+	return 0;
+}
+
+/* copy the data of an admin command from or to the guest */
+static uint16_t
+nvme_prp_copy(struct nvme_vdev *nvme, struct nvme_command *cmd, void *buf,
+	      size_t len, bool to_guest)
+{
+	struct iovec iov[2];
+	uint8_t *p = buf;
+	int i, iovcnt;
+
+	if ((cmd->flags & NVME_CMD_PSDT_MASK) ||
+	    nvme_prp_iov(nvme, cmd->prp1, cmd->prp2, len, iov, &iovcnt, 2) < 0)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_DATA_TRANSFER_ERROR);
+
+	for (i = 0; i < iovcnt; i++) {
+		if (to_guest)
+			memcpy(iov[i].iov_base, p, iov[i].iov_len);
+		else
+			memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+/*
+ * Admin commands
+ */
+static void
+nvme_init_queue_reqs(struct nvme_vdev *nvme, struct nvme_sq *sq)
+{
+	int i;
+
+	STAILQ_INIT(&sq->freeq);
+	for (i = 0; i < nvme->ioqsz; i++)
+		STAILQ_INSERT_TAIL(&sq->freeq, &sq->reqs[i], link);
+	sq->inflight = 0;
+}
+
+/* disable an SQ and wait for the commands it has in flight */
+static void
+nvme_disable_sq(struct nvme_vdev *nvme, struct nvme_sq *sq)
+{
+	pthread_mutex_lock(&sq->mtx);
+	sq->enabled = false;
+	while (sq->inflight > 0)
+		pthread_cond_wait(&sq->idle, &sq->mtx);
+	sq->ring = NULL;
+	sq->head = sq->tail = 0;
+	pthread_mutex_unlock(&sq->mtx);
+}
+
+static void
+nvme_disable_cq(struct nvme_cq *cq)
+{
+	pthread_mutex_lock(&cq->mtx);
+	cq->enabled = false;
+	cq->ring = NULL;
+	cq->head = cq->tail = 0;
+	cq->reserved = 0;
+	cq->stalled = false;
+	pthread_mutex_unlock(&cq->mtx);
+}
+
+static uint16_t
+nvme_create_io_cq(struct nvme_vdev *nvme, struct nvme_command *cmd)
+{
+	uint16_t qid = cmd->cdw10 & 0xffff;
+	uint32_t size = (cmd->cdw10 >> 16) + 1;
+	uint16_t iv = cmd->cdw11 >> 16;
+	struct nvme_cq *cq;
+	void *ring;
+
+	if (qid == 0 || qid > nvme->nioq || nvme->cq[qid].enabled)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC, NVME_SC_INVALID_QID);
+	if (size < 2 || size > NVME_MQES)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+				   NVME_SC_MAX_QSIZE_EXCEEDED);
+	if (iv >= nvme->dev->msix.table_count)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+				   NVME_SC_INVALID_VECTOR);
+	/* only physically contiguous queues */
+	if (!(cmd->cdw11 & 0x1) || (cmd->prp1 & (NVME_PAGE_SIZE - 1)))
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+	ring = paddr_guest2host(nvme->ctx, cmd->prp1,
+				size * sizeof(struct nvme_completion));
+	if (ring == NULL)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+
+	cq = &nvme->cq[qid];
+	pthread_mutex_lock(&cq->mtx);
+	cq->ring = ring;
+	cq->gpa = cmd->prp1;
+	cq->size = size;
+	cq->head = cq->tail = 0;
+	cq->phase = NVME_STATUS_PHASE;
+	cq->iv = iv;
+	cq->ien = !!(cmd->cdw11 & 0x2);
+	cq->reserved = 0;
+	cq->stalled = false;
+	cq->enabled = true;
+	if (nvme->dbbuf_db != NULL) {
+		nvme->dbbuf_db[2 * qid + 1] = 0;
+		nvme->dbbuf_ei[2 * qid + 1] = 0;
+		nvme_dbbuf_dirty(nvme);
+	}
+	pthread_mutex_unlock(&cq->mtx);
+
+	DPRINTF("nvme: CQ %u of %u entries, vector %u\n", qid, size, iv);
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+static uint16_t
+nvme_create_io_sq(struct nvme_vdev *nvme, struct nvme_command *cmd)
+{
+	uint16_t qid = cmd->cdw10 & 0xffff;
+	uint32_t size = (cmd->cdw10 >> 16) + 1;
+	uint16_t cqid = cmd->cdw11 >> 16;
+	struct nvme_sq *sq;
+	void *ring;
+
+	if (qid == 0 || qid > nvme->nioq || nvme->sq[qid].enabled)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC, NVME_SC_INVALID_QID);
+	if (size < 2 || size > NVME_MQES)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+				   NVME_SC_MAX_QSIZE_EXCEEDED);
+	if (cqid == 0 || cqid > nvme->nioq || !nvme->cq[cqid].enabled)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC, NVME_SC_INVALID_CQ);
+	if (!(cmd->cdw11 & 0x1) || (cmd->prp1 & (NVME_PAGE_SIZE - 1)))
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+	ring = paddr_guest2host(nvme->ctx, cmd->prp1,
+				size * sizeof(struct nvme_command));
+	if (ring == NULL)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+
+	sq = &nvme->sq[qid];
+	pthread_mutex_lock(&sq->mtx);
+	sq->ring = ring;
+	sq->size = size;
+	sq->cqid = cqid;
+	sq->head = sq->tail = 0;
+	nvme_init_queue_reqs(nvme, sq);
+	sq->enabled = true;
+	if (nvme->dbbuf_db != NULL) {
+		nvme->dbbuf_db[2 * qid] = 0;
+		nvme->dbbuf_ei[2 * qid] = 0;
+		nvme_dbbuf_dirty(nvme);
+	}
+	pthread_mutex_unlock(&sq->mtx);
+
+	DPRINTF("nvme: SQ %u of %u entries on CQ %u\n", qid, size, cqid);
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+static uint16_t
+nvme_delete_io_sq(struct nvme_vdev *nvme, struct nvme_command *cmd)
+{
+	uint16_t qid = cmd->cdw10 & 0xffff;
+
+	if (qid == 0 || qid > nvme->nioq || !nvme->sq[qid].enabled)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC, NVME_SC_INVALID_QID);
+
+	nvme_disable_sq(nvme, &nvme->sq[qid]);
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+static uint16_t
+nvme_delete_io_cq(struct nvme_vdev *nvme, struct nvme_command *cmd)
+{
+	uint16_t qid = cmd->cdw10 & 0xffff;
+	int i;
+
+	if (qid == 0 || qid > nvme->nioq || !nvme->cq[qid].enabled)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC, NVME_SC_INVALID_QID);
+	for (i = 1; i <= nvme->nioq; i++) {
+		if (nvme->sq[i].enabled && nvme->sq[i].cqid == qid)
+			return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+					   NVME_SC_INVALID_QUEUE_DELETION);
+	}
+
+	nvme_disable_cq(&nvme->cq[qid]);
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+static uint16_t
+nvme_identify(struct nvme_vdev *nvme, struct nvme_command *cmd)
+{
+	uint8_t buf[NVME_PAGE_SIZE];
+	uint32_t *nslist;
+
+	memset(buf, 0, sizeof(buf));
+	switch (cmd->cdw10 & 0xff) {
+	case NVME_CNS_NAMESPACE:
+		if (cmd->nsid != NVME_NSID && cmd->nsid != 0xffffffff)
+			return NVME_STATUS(NVME_SCT_GENERIC,
+					   NVME_SC_INVALID_NAMESPACE);
+		memcpy(buf, &nvme->nsdata, sizeof(nvme->nsdata));
+		break;
+	case NVME_CNS_CONTROLLER:
+		memcpy(buf, &nvme->ctrldata, sizeof(nvme->ctrldata));
+		break;
+	case NVME_CNS_ACTIVE_NS_LIST:
+		nslist = (uint32_t *)buf;
+		if (cmd->nsid < NVME_NSID)
+			nslist[0] = NVME_NSID;
+		break;
+	case NVME_CNS_NS_DESCRIPTORS:
+		if (cmd->nsid != NVME_NSID)
+			return NVME_STATUS(NVME_SCT_GENERIC,
+					   NVME_SC_INVALID_NAMESPACE);
+		buf[0] = NVME_NIDT_EUI64;
+		buf[1] = sizeof(nvme->nsdata.eui64);
+		memcpy(&buf[4], nvme->nsdata.eui64, sizeof(nvme->nsdata.eui64));
+		break;
+	default:
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+	}
+
+	return nvme_prp_copy(nvme, cmd, buf, sizeof(buf), true);
+}
+
+static uint16_t
+nvme_get_log_page(struct nvme_vdev *nvme, struct nvme_command *cmd)
+{
+	uint8_t buf[NVME_PAGE_SIZE];
+	struct nvme_health_log *health;
+	struct nvme_firmware_page *fw;
+	uint64_t offset;
+	size_t len;
+
+	/* the number of dwords is 0's based */
+	len = ((((cmd->cdw11 & 0xffff) << 16) | (cmd->cdw10 >> 16)) + 1) * 4;
+	offset = cmd->cdw12 | ((uint64_t)cmd->cdw13 << 32);
+	if (offset >= sizeof(buf) || len > sizeof(buf) - offset || (offset & 0x3))
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+
+	memset(buf, 0, sizeof(buf));
+	switch (cmd->cdw10 & 0xff) {
+	case NVME_LOG_ERROR:
+		break;
+	case NVME_LOG_HEALTH:
+		health = (struct nvme_health_log *)buf;
+		health->temperature = NVME_TEMPERATURE;
+		health->available_spare = 100;
+		health->available_spare_threshold = 10;
+		health->data_units_read[0] =
+			(atomic_load(&nvme->sectors_read) + 999) / 1000;
+		health->data_units_written[0] =
+			(atomic_load(&nvme->sectors_written) + 999) / 1000;
+		health->host_read_commands[0] = atomic_load(&nvme->read_commands);
+		health->host_write_commands[0] =
+			atomic_load(&nvme->write_commands);
+		health->power_cycles[0] = 1;
+		break;
+	case NVME_LOG_FIRMWARE_SLOT:
+		fw = (struct nvme_firmware_page *)buf;
+		fw->afi = 1;
+		nvme_strpad(fw->revision[0], NVME_FW_REV, sizeof(fw->revision[0]));
+		break;
+	default:
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+				   NVME_SC_INVALID_LOG_PAGE);
+	}
+
+	return nvme_prp_copy(nvme, cmd, buf + offset, len, true);
+}
+
+static uint16_t
+nvme_set_features(struct nvme_vdev *nvme, struct nvme_command *cmd,
+		  uint32_t *cdw0)
+{
+	uint8_t fid = cmd->cdw10 & 0xff;
+
+	if (cmd->cdw10 & NVME_FEAT_SAVE)
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+				   NVME_SC_FEATURE_NOT_SAVEABLE);
+
+	switch (fid) {
+	case NVME_FEAT_NUMBER_OF_QUEUES:
+		/* what the guest asks for does not change the allocation */
+		if ((cmd->cdw11 & 0xffff) == 0xffff ||
+		    (cmd->cdw11 >> 16) == 0xffff)
+			return NVME_STATUS(NVME_SCT_GENERIC,
+					   NVME_SC_INVALID_FIELD);
+		*cdw0 = nvme->feat[fid];
+		break;
+	case NVME_FEAT_VOLATILE_WRITE_CACHE:
+		blockif_set_wce(nvme->bc, cmd->cdw11 & 0x1);
+		break;
+	case NVME_FEAT_INTERRUPT_VECTOR_CONF:
+		if ((cmd->cdw11 & 0xffff) >= nvme->dev->msix.table_count)
+			return NVME_STATUS(NVME_SCT_GENERIC,
+					   NVME_SC_INVALID_FIELD);
+		/* fall through */
+	case NVME_FEAT_ARBITRATION:
+	case NVME_FEAT_POWER_MANAGEMENT:
+	case NVME_FEAT_TEMPERATURE_THRESHOLD:
+	case NVME_FEAT_ERROR_RECOVERY:
+	case NVME_FEAT_INTERRUPT_COALESCING:
+	case NVME_FEAT_WRITE_ATOMICITY:
+	case NVME_FEAT_ASYNC_EVENT_CONF:
+		/* kept for the get features, nothing depends on them */
+		nvme->feat[fid] = cmd->cdw11;
+		break;
+	default:
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+	}
+
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+static uint16_t
+nvme_get_features(struct nvme_vdev *nvme, struct nvme_command *cmd,
+		  uint32_t *cdw0)
+{
+	uint8_t fid = cmd->cdw10 & 0xff;
+
+	switch (fid) {
+	case NVME_FEAT_VOLATILE_WRITE_CACHE:
+		*cdw0 = blockif_get_wce(nvme->bc);
+		break;
+	case NVME_FEAT_INTERRUPT_VECTOR_CONF:
+		*cdw0 = cmd->cdw11 & 0xffff;
+		break;
+	case NVME_FEAT_ARBITRATION:
+	case NVME_FEAT_POWER_MANAGEMENT:
+	case NVME_FEAT_TEMPERATURE_THRESHOLD:
+	case NVME_FEAT_ERROR_RECOVERY:
+	case NVME_FEAT_NUMBER_OF_QUEUES:
+	case NVME_FEAT_INTERRUPT_COALESCING:
+	case NVME_FEAT_WRITE_ATOMICITY:
+	case NVME_FEAT_ASYNC_EVENT_CONF:
+		*cdw0 = nvme->feat[fid];
+		break;
+	default:
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+	}
+
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+/*
+ * The guest gives a page of shadow doorbells, laid out as the doorbell
+ * registers, and a page for the event indexes of the controller.
+ */
+static uint16_t
+nvme_doorbell_buffer_config(struct nvme_vdev *nvme, struct nvme_command *cmd)
+{
+	void *db, *ei;
+	int qid;
+
+	if ((cmd->prp1 | cmd->prp2) & (NVME_PAGE_SIZE - 1))
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+	db = paddr_guest2host(nvme->ctx, cmd->prp1, NVME_PAGE_SIZE);
+	ei = paddr_guest2host(nvme->ctx, cmd->prp2, NVME_PAGE_SIZE);
+	if (db == NULL || ei == NULL)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+
+	nvme->dbbuf_ei = ei;
+	nvme->dbbuf_gpa[0] = cmd->prp1;
+	nvme->dbbuf_gpa[1] = cmd->prp2;
+	/* the queues created already carry on from their doorbells */
+	for (qid = 1; qid <= nvme->nioq; qid++) {
+		((uint32_t *)db)[2 * qid] = nvme->sq[qid].tail;
+		((uint32_t *)db)[2 * qid + 1] = nvme->cq[qid].head;
+		nvme->dbbuf_ei[2 * qid] = nvme->sq[qid].tail;
+		nvme->dbbuf_ei[2 * qid + 1] = nvme->cq[qid].head;
+	}
+	nvme_dbbuf_dirty(nvme);
+	atomic_thread_fence();
+	nvme->dbbuf_db = db;
+
+	DPRINTF("nvme: shadow doorbells at 0x%lx, event indexes at 0x%lx\n",
+		cmd->prp1, cmd->prp2);
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+static uint16_t
+nvme_admin_cmd(struct nvme_vdev *nvme, struct nvme_command *cmd,
+	       uint32_t *cdw0)
+{
+	DPRINTF("nvme: admin command 0x%x cid %u\n", cmd->opc, cmd->cid);
+
+	switch (cmd->opc) {
+	case NVME_OPC_DELETE_IO_SQ:
+		return nvme_delete_io_sq(nvme, cmd);
+	case NVME_OPC_CREATE_IO_SQ:
+		return nvme_create_io_sq(nvme, cmd);
+	case NVME_OPC_GET_LOG_PAGE:
+		return nvme_get_log_page(nvme, cmd);
+	case NVME_OPC_DELETE_IO_CQ:
+		return nvme_delete_io_cq(nvme, cmd);
+	case NVME_OPC_CREATE_IO_CQ:
+		return nvme_create_io_cq(nvme, cmd);
+	case NVME_OPC_IDENTIFY:
+		return nvme_identify(nvme, cmd);
+	case NVME_OPC_ABORT:
+		/* the commands are not aborted, bit 0 tells so */
+		*cdw0 = 1;
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+	case NVME_OPC_SET_FEATURES:
+		return nvme_set_features(nvme, cmd, cdw0);
+	case NVME_OPC_GET_FEATURES:
+		return nvme_get_features(nvme, cmd, cdw0);
+	case NVME_OPC_ASYNC_EVENT_REQUEST:
+		/* no event is ever reported, the requests stay pending */
+		if (nvme->aer_count >= NVME_AERL)
+			return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+					   NVME_SC_ASYNC_EVENT_LIMIT);
+		nvme->aer_count++;
+		return NVME_PENDING;
+	case NVME_OPC_DOORBELL_BUFFER_CONFIG:
+		return nvme_doorbell_buffer_config(nvme, cmd);
+	default:
+		WPRINTF("nvme: admin command 0x%x not supported\n", cmd->opc);
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_OPCODE);
+	}
+}
+
+/*
+ * NVM commands
+ */
+static void
+nvme_io_done(struct blockif_req *br, int err)
+{
+	struct nvme_ioreq *req = br->param;
+	struct nvme_sq *sq = req->sq;
+	struct nvme_vdev *nvme = sq->nvme;
+	struct nvme_dsm_range *range;
+	uint16_t status;
+
+	/* the ranges of a dataset management go one after another */
+	if (req->ranges != NULL && !err && ++req->range < req->nranges) {
+		range = &req->ranges[req->range];
+		br->iovcnt = 0;
+		br->offset = range->slba * nvme->sectsz;
+		br->resid = (ssize_t)range->nlb * nvme->sectsz;
+		err = blockif_discard(nvme->bc, br);
+		if (!err)
+			return;
+	}
+
+	if (err) {
+		DPRINTF("nvme: command 0x%x cid %u failed, error %d\n",
+			req->opc, req->cid, err);
+		status = NVME_STATUS(NVME_SCT_GENERIC,
+				     NVME_SC_INTERNAL_DEVICE_ERROR);
+	} else {
+		status = NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+		if (req->opc == NVME_OPC_READ) {
+			atomic_add_fetch(&nvme->read_commands, 1);
+			atomic_add_fetch(&nvme->sectors_read,
+					 (uint64_t)req->nlb * nvme->sectsz / 512);
+		} else if (req->opc == NVME_OPC_WRITE) {
+			atomic_add_fetch(&nvme->write_commands, 1);
+			atomic_add_fetch(&nvme->sectors_written,
+					 (uint64_t)req->nlb * nvme->sectsz / 512);
+		}
+	}
+	nvme_complete(nvme, sq, req->cid, 0, status);
+
+	free(req->ranges);
+	req->ranges = NULL;
+	pthread_mutex_lock(&sq->mtx);
+	STAILQ_INSERT_HEAD(&sq->freeq, req, link);
+	if (--sq->inflight == 0 && !sq->enabled)
+		pthread_cond_broadcast(&sq->idle);
+	pthread_mutex_unlock(&sq->mtx);
+
+	/* pick up what the guest queued meanwhile */
+	nvme_process_sq(nvme, sq);
+}
+
+static uint16_t
+nvme_check_lba(struct nvme_vdev *nvme, uint64_t slba, uint64_t nlb)
+{
+	if (slba >= nvme->nsze || nlb > nvme->nsze - slba)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_LBA_OUT_OF_RANGE);
+	return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+}
+
+static uint16_t
+nvme_rw(struct nvme_vdev *nvme, struct nvme_command *cmd,
+	struct nvme_ioreq *req)
+{
+	struct blockif_req *br = &req->io_req;
+	uint64_t slba = cmd->cdw10 | ((uint64_t)cmd->cdw11 << 32);
+	uint32_t nlb = (cmd->cdw12 & 0xffff) + 1;
+	size_t len = (size_t)nlb * nvme->sectsz;
+	uint16_t status;
+	int err;
+
+	if (cmd->opc == NVME_OPC_WRITE && blockif_is_ro(nvme->bc))
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+				   NVME_SC_WRITE_TO_RO_RANGE);
+	status = nvme_check_lba(nvme, slba, nlb);
+	if (status)
+		return status;
+	if (len > NVME_PAGE_SIZE << NVME_MDTS || (cmd->flags & NVME_CMD_PSDT_MASK))
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_FIELD);
+	if (nvme_prp_iov(nvme, cmd->prp1, cmd->prp2, len, br->iov,
+			 &br->iovcnt, BLOCKIF_IOV_MAX) < 0)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_DATA_TRANSFER_ERROR);
+
+	req->nlb = nlb;
+	br->offset = slba * nvme->sectsz;
+	br->resid = len;
+	err = (cmd->opc == NVME_OPC_READ) ? blockif_read(nvme->bc, br) :
+					    blockif_write(nvme->bc, br);
+	if (err)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INTERNAL_DEVICE_ERROR);
+
+	return NVME_PENDING;
+}
+
+static uint16_t
+nvme_dsm(struct nvme_vdev *nvme, struct nvme_command *cmd,
+	 struct nvme_ioreq *req)
+{
+	struct blockif_req *br = &req->io_req;
+	int i, n = (cmd->cdw10 & 0xff) + 1;
+	uint16_t status;
+
+	/* only deallocation does something */
+	if (!(cmd->cdw11 & NVME_DSM_ATTR_DEALLOCATE))
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_SUCCESS);
+	if (blockif_is_ro(nvme->bc))
+		return NVME_STATUS(NVME_SCT_COMMAND_SPECIFIC,
+				   NVME_SC_WRITE_TO_RO_RANGE);
+
+	req->ranges = calloc(n, sizeof(struct nvme_dsm_range));
+	if (req->ranges == NULL)
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INTERNAL_DEVICE_ERROR);
+	status = nvme_prp_copy(nvme, cmd, req->ranges,
+			       n * sizeof(struct nvme_dsm_range), false);
+	for (i = 0; i < n && !status; i++)
+		status = nvme_check_lba(nvme, req->ranges[i].slba,
+					req->ranges[i].nlb);
+	if (status) {
+		free(req->ranges);
+		req->ranges = NULL;
+		return status;
+	}
+
+	req->nranges = n;
+	req->range = 0;
+	br->iovcnt = 0;
+	br->offset = req->ranges[0].slba * nvme->sectsz;
+	br->resid = (ssize_t)req->ranges[0].nlb * nvme->sectsz;
+	if (blockif_discard(nvme->bc, br)) {
+		free(req->ranges);
+		req->ranges = NULL;
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INTERNAL_DEVICE_ERROR);
+	}
+
+	return NVME_PENDING;
+}
+
+static uint16_t
+nvme_io_cmd(struct nvme_vdev *nvme, struct nvme_sq *sq,
+	    struct nvme_command *cmd)
+{
+	struct nvme_ioreq *req;
+	uint16_t status;
+
+	if (cmd->nsid != NVME_NSID &&
+	    !(cmd->opc == NVME_OPC_FLUSH && cmd->nsid == 0xffffffff))
+		return NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_NAMESPACE);
+
+	req = STAILQ_FIRST(&sq->freeq);
+	STAILQ_REMOVE_HEAD(&sq->freeq, link);
+	sq->inflight++;
+	req->cid = cmd->cid;
+	req->opc = cmd->opc;
+	req->nlb = 0;
+
+	switch (cmd->opc) {
+	case NVME_OPC_FLUSH:
+		status = blockif_flush(nvme->bc, &req->io_req) ?
+			NVME_STATUS(NVME_SCT_GENERIC,
+				    NVME_SC_INTERNAL_DEVICE_ERROR) :
+			NVME_PENDING;
+		break;
+	case NVME_OPC_READ:
+	case NVME_OPC_WRITE:
+		status = nvme_rw(nvme, cmd, req);
+		break;
+	case NVME_OPC_DATASET_MANAGEMENT:
+		if (blockif_candiscard(nvme->bc)) {
+			status = nvme_dsm(nvme, cmd, req);
+			break;
+		}
+		/* fall through */
+	default:
+		WPRINTF("nvme: NVM command 0x%x not supported\n", cmd->opc);
+		status = NVME_STATUS(NVME_SCT_GENERIC, NVME_SC_INVALID_OPCODE);
+		break;
+	}
+
+	if (status != NVME_PENDING) {
+		STAILQ_INSERT_HEAD(&sq->freeq, req, link);
+		sq->inflight--;
+	}
+	return status;
+}
+
+/*
+ * Fetch and execute the commands of an SQ, from the doorbell writes and
+ * from the completions.
+ */
+static void
+nvme_process_sq(struct nvme_vdev *nvme, struct nvme_sq *sq)
+{
+	struct nvme_cq *cq;
+	struct nvme_command cmd;
+	uint32_t cdw0;
+	uint16_t tail, status;
+	bool blocked;
+
+	pthread_mutex_lock(&sq->mtx);
+	if (!sq->enabled) {
+		pthread_mutex_unlock(&sq->mtx);
+		return;
+	}
+	/* a completion within a submission, the outer loop goes on */
+	if (sq->fetching) {
+		sq->kick = true;
+		pthread_mutex_unlock(&sq->mtx);
+		return;
+	}
+	sq->fetching = true;
+	cq = &nvme->cq[sq->cqid];
+
+	if (sq->qid != 0)
+		blockif_plug(nvme->bc, sq->qid - 1);
+	do {
+		sq->kick = false;
+		blocked = false;
+		tail = nvme_sq_tail(nvme, sq);
+		while (sq->head != tail && sq->enabled) {
+			if ((sq->qid != 0 && STAILQ_EMPTY(&sq->freeq)) ||
+			    !nvme_cq_reserve(nvme, cq)) {
+				blocked = true;
+				break;
+			}
+			cmd = sq->ring[sq->head];
+			sq->head = (sq->head + 1) % sq->size;
+
+			cdw0 = 0;
+			if (sq->qid == 0)
+				status = nvme_admin_cmd(nvme, &cmd, &cdw0);
+			else
+				status = nvme_io_cmd(nvme, sq, &cmd);
+
+			if (status != NVME_PENDING)
+				nvme_complete(nvme, sq, cmd.cid, cdw0, status);
+			else if (sq->qid == 0)
+				nvme_cq_unreserve(cq);
+			if (sq->head == tail)
+				tail = nvme_sq_tail(nvme, sq);
+		}
+
+		/*
+		 * Once idle, ask for a doorbell at the next command, then look
+		 * again for the ones submitted before the guest could see it.
+		 * Until then, the completions look for the new commands.
+		 */
+		if (nvme_dbbuf(nvme, sq->qid) && !blocked && sq->inflight == 0) {
+			nvme->dbbuf_ei[2 * sq->qid] = sq->head;
+			nvme_dbbuf_dirty(nvme);
+			atomic_thread_fence();
+			if (nvme_sq_tail(nvme, sq) != sq->head)
+				sq->kick = true;
+		}
+	} while (sq->kick && sq->enabled);
+	if (sq->qid != 0)
+		blockif_unplug(nvme->bc, sq->qid - 1);
+
+	sq->fetching = false;
+	pthread_mutex_unlock(&sq->mtx);
+}
+
+static void
+nvme_sq_doorbell(struct nvme_vdev *nvme, uint16_t qid, uint32_t value)
+{
+	struct nvme_sq *sq = &nvme->sq[qid];
+
+	pthread_mutex_lock(&sq->mtx);
+	if (!sq->enabled || value >= sq->size) {
+		pthread_mutex_unlock(&sq->mtx);
+		DPRINTF("nvme: invalid doorbell %u of SQ %u\n", value, qid);
+		return;
+	}
+	sq->tail = value;
+	pthread_mutex_unlock(&sq->mtx);
+
+	nvme_process_sq(nvme, sq);
+}
+
+static void
+nvme_cq_doorbell(struct nvme_vdev *nvme, uint16_t qid, uint32_t value)
+{
+	struct nvme_cq *cq = &nvme->cq[qid];
+	bool stalled, empty;
+	int i;
+
+	pthread_mutex_lock(&cq->mtx);
+	if (!cq->enabled || value >= cq->size) {
+		pthread_mutex_unlock(&cq->mtx);
+		DPRINTF("nvme: invalid doorbell %u of CQ %u\n", value, qid);
+		return;
+	}
+	cq->head = value;
+	nvme_cq_update_head(nvme, cq);
+	stalled = cq->stalled;
+	cq->stalled = false;
+	empty = (cq->head == cq->tail);
+	pthread_mutex_unlock(&cq->mtx);
+
+	if (empty && nvme->lintr) {
+		nvme->lintr = 0;
+		pci_lintr_deassert(nvme->dev);
+	}
+
+	/* the SQs waiting for entries of the CQ */
+	for (i = 0; stalled && i <= nvme->nioq; i++) {
+		if (nvme->sq[i].enabled && nvme->sq[i].cqid == qid)
+			nvme_process_sq(nvme, &nvme->sq[i]);
+	}
+}
+
+/*
+ * Controller registers
+ */
+static void
+nvme_reset_queues(struct nvme_vdev *nvme)
+{
+	int i;
+
+	for (i = nvme->nioq; i >= 0; i--)
+		nvme_disable_sq(nvme, &nvme->sq[i]);
+	for (i = nvme->nioq; i >= 0; i--)
+		nvme_disable_cq(&nvme->cq[i]);
+
+	nvme->dbbuf_db = NULL;
+	nvme->dbbuf_ei = NULL;
+	nvme->aer_count = 0;
+	if (nvme->lintr) {
+		nvme->lintr = 0;
+		pci_lintr_deassert(nvme->dev);
+	}
+}
+
+static void
+nvme_reset_features(struct nvme_vdev *nvme)
+{
+	memset(nvme->feat, 0, sizeof(nvme->feat));
+	nvme->feat[NVME_FEAT_NUMBER_OF_QUEUES] =
+		(nvme->nioq - 1) | ((nvme->nioq - 1) << 16);
+	nvme->feat[NVME_FEAT_TEMPERATURE_THRESHOLD] = NVME_TEMP_THRESHOLD;
+}
+
+static void
+nvme_reset(struct nvme_vdev *nvme)
+{
+	nvme_reset_queues(nvme);
+	nvme_reset_features(nvme);
+	nvme->cc = 0;
+	nvme->csts = 0;
+	nvme->intms = 0;
+	nvme->aqa = 0;
+	nvme->asq = 0;
+	nvme->acq = 0;
+}
+
+/* CC.EN set: the admin queues start from the registers */
+static int
+nvme_enable(struct nvme_vdev *nvme)
+{
+	struct nvme_sq *sq = &nvme->sq[0];
+	struct nvme_cq *cq = &nvme->cq[0];
+	uint32_t sqsize = (nvme->aqa & NVME_AQA_ASQS_MASK) + 1;
+	uint32_t cqsize = ((nvme->aqa >> NVME_AQA_ACQS_SHIFT) &
+			   NVME_AQA_ASQS_MASK) + 1;
+	void *sring, *cring;
+
+	if (((nvme->cc >> NVME_CC_MPS_SHIFT) & NVME_CC_MPS_MASK) != 0 ||
+	    ((nvme->cc >> NVME_CC_CSS_SHIFT) & NVME_CC_CSS_MASK) != 0 ||
+	    sqsize < 2 || cqsize < 2)
+		return -1;
+	sring = paddr_guest2host(nvme->ctx, nvme->asq,
+				 sqsize * sizeof(struct nvme_command));
+	cring = paddr_guest2host(nvme->ctx, nvme->acq,
+				 cqsize * sizeof(struct nvme_completion));
+	if (sring == NULL || cring == NULL)
+		return -1;
+
+	pthread_mutex_lock(&cq->mtx);
+	cq->ring = cring;
+	cq->gpa = nvme->acq;
+	cq->size = cqsize;
+	cq->head = cq->tail = 0;
+	cq->phase = NVME_STATUS_PHASE;
+	cq->iv = 0;
+	cq->ien = true;
+	cq->reserved = 0;
+	cq->enabled = true;
+	pthread_mutex_unlock(&cq->mtx);
+
+	pthread_mutex_lock(&sq->mtx);
+	sq->ring = sring;
+	sq->size = sqsize;
+	sq->cqid = 0;
+	sq->head = sq->tail = 0;
+	sq->enabled = true;
+	pthread_mutex_unlock(&sq->mtx);
+
+	return 0;
+}
+
+static void
+nvme_write_cc(struct nvme_vdev *nvme, uint32_t value)
+{
+	uint32_t old = nvme->cc;
+
+	nvme->cc = value & NVME_CC_WRITE_MASK;
+
+	if ((old & NVME_CC_EN) && !(value & NVME_CC_EN)) {
+		DPRINTF("nvme: controller reset\n");
+		nvme_reset_queues(nvme);
+		nvme_reset_features(nvme);
+		nvme->csts &= ~(NVME_CSTS_RDY | NVME_CSTS_CFS |
+				NVME_CSTS_SHST_MASK);
+	} else if (!(old & NVME_CC_EN) && (value & NVME_CC_EN)) {
+		if (nvme_enable(nvme) < 0) {
+			WPRINTF("nvme: invalid admin queues or page size\n");
+			nvme->csts |= NVME_CSTS_CFS;
+		} else {
+			nvme->csts &= ~NVME_CSTS_SHST_MASK;
+			nvme->csts |= NVME_CSTS_RDY;
+		}
+	}
+
+	if (((value >> NVME_CC_SHN_SHIFT) & NVME_CC_SHN_MASK) != 0 &&
+	    !(nvme->csts & NVME_CSTS_SHST_MASK)) {
+		DPRINTF("nvme: shutdown\n");
+		if (blockif_flush_all(nvme->bc))
+			WPRINTF("nvme: flush on shutdown failed\n");
+		nvme->csts |= NVME_SHST_COMPLETE << NVME_CSTS_SHST_SHIFT;
+	}
+}
+
+static void
+nvme_write_reg(struct nvme_vdev *nvme, uint64_t offset, uint32_t value)
+{
+	pthread_mutex_lock(&nvme->mtx);
+	switch (offset) {
+	case NVME_CR_INTMS:
+		nvme->intms |= value;
+		break;
+	case NVME_CR_INTMC:
+		nvme->intms &= ~value;
+		break;
+	case NVME_CR_CC:
+		nvme_write_cc(nvme, value);
+		break;
+	case NVME_CR_AQA:
+		nvme->aqa = value & ((NVME_AQA_ASQS_MASK << NVME_AQA_ACQS_SHIFT) |
+				     NVME_AQA_ASQS_MASK);
+		break;
+	case NVME_CR_ASQ:
+		nvme->asq = (nvme->asq & ~0xffffffffUL) | (value & ~0xfffU);
+		break;
+	case NVME_CR_ASQ + 4:
+		nvme->asq = (nvme->asq & 0xffffffffUL) | ((uint64_t)value << 32);
+		break;
+	case NVME_CR_ACQ:
+		nvme->acq = (nvme->acq & ~0xffffffffUL) | (value & ~0xfffU);
+		break;
+	case NVME_CR_ACQ + 4:
+		nvme->acq = (nvme->acq & 0xffffffffUL) | ((uint64_t)value << 32);
+		break;
+	case NVME_CR_NSSR:
+		/* NVM subsystem reset is not supported, CAP.NSSRS is 0 */
+		break;
+	default:
+		DPRINTF("nvme: write to read-only register 0x%lx\n", offset);
+		break;
+	}
+	pthread_mutex_unlock(&nvme->mtx);
+}
+
+static uint32_t
+nvme_read_reg(struct nvme_vdev *nvme, uint64_t offset)
+{
+	uint32_t value;
+
+	pthread_mutex_lock(&nvme->mtx);
+	switch (offset) {
+	case NVME_CR_CAP:
+		value = nvme->cap;
+		break;
+	case NVME_CR_CAP + 4:
+		value = nvme->cap >> 32;
+		break;
+	case NVME_CR_VS:
+		value = nvme->vs;
+		break;
+	case NVME_CR_INTMS:
+	case NVME_CR_INTMC:
+		value = nvme->intms;
+		break;
+	case NVME_CR_CC:
+		value = nvme->cc;
+		break;
+	case NVME_CR_CSTS:
+		value = nvme->csts;
+		break;
+	case NVME_CR_AQA:
+		value = nvme->aqa;
+		break;
+	case NVME_CR_ASQ:
+		value = nvme->asq;
+		break;
+	case NVME_CR_ASQ + 4:
+		value = nvme->asq >> 32;
+		break;
+	case NVME_CR_ACQ:
+		value = nvme->acq;
+		break;
+	case NVME_CR_ACQ + 4:
+		value = nvme->acq >> 32;
+		break;
+	default:
+		value = 0;
+		break;
+	}
+	pthread_mutex_unlock(&nvme->mtx);
+
+	return value;
+}
+
+static void
+pci_nvme_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+	       int baridx, uint64_t offset, int size, uint64_t value)
+{
+	struct nvme_vdev *nvme = dev->arg;
+	uint64_t db;
+
+	if (baridx == pci_msix_table_bar(dev) ||
+	    baridx == pci_msix_pba_bar(dev)) {
+		pci_emul_msix_twrite(dev, offset, size, value);
+		return;
+	}
+	if (baridx != NVME_BAR_REGS || size != 4 || (offset & 0x3)) {
+		WPRINTF("%s: baridx %d, offset 0x%lx, size %d not supported\n",
+			__func__, baridx, offset, size);
+		return;
+	}
+
+	if (offset < NVME_CR_DOORBELL) {
+		nvme_write_reg(nvme, offset, value);
+		return;
+	}
+
+	db = (offset - NVME_CR_DOORBELL) / 4;
+	if (!(nvme->csts & NVME_CSTS_RDY) || db / 2 > nvme->nioq) {
+		DPRINTF("nvme: doorbell 0x%lx ignored\n", offset);
+		return;
+	}
+	if (db & 0x1)
+		nvme_cq_doorbell(nvme, db / 2, value);
+	else
+		nvme_sq_doorbell(nvme, db / 2, value);
+}
+
+static uint64_t
+pci_nvme_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+	      int baridx, uint64_t offset, int size)
+{
+	struct nvme_vdev *nvme = dev->arg;
+	uint32_t value;
+
+	if (baridx == pci_msix_table_bar(dev) ||
+	    baridx == pci_msix_pba_bar(dev))
+		return pci_emul_msix_tread(dev, offset, size);
+	if (baridx != NVME_BAR_REGS || offset >= NVME_CR_DOORBELL)
+		return 0;
+
+	value = nvme_read_reg(nvme, offset & ~0x3UL);
+	value >>= (offset & 0x3) * 8;
+	if (size == 1)
+		value &= 0xff;
+	else if (size == 2)
+		value &= 0xffff;
+	return value;
+}
+
+/*
+ * Initialization
+ */
+static int
+nvme_parse_mq(const char *opts)
+{
+	char *nopt, *xopts, *cp;
+	int nioq = 1;
+
+	nopt = xopts = strdup(opts);
+	if (!nopt)
+		return -1;
+
+	/* skip the pathname */
+	strsep(&xopts, ",");
+	while ((cp = strsep(&xopts, ",")) != NULL) {
+		if (strncmp(cp, "mq=", strlen("mq=")))
+			continue;
+		if (dm_strtoi(cp + strlen("mq="), &cp, 10, &nioq) || *cp != '\0' ||
+				nioq < 1 || nioq > NVME_MAX_IOQ)
+			nioq = -1;
+		break;
+	}
+
+	free(nopt);
+	return nioq;
+}
+
+/* The data buffers are all in the guest memory */
+static void
+nvme_register_mem(struct vmctx *ctx, struct blockif_ctxt *bctxt)
+{
+	struct iovec mem[2];
+	int n = 0;
+
+	mem[n].iov_base = ctx->baseaddr;
+	mem[n++].iov_len = ctx->lowmem;
+	if (ctx->highmem > 0) {
+		mem[n].iov_base = ctx->baseaddr + ctx->highmem_gpa_base;
+		mem[n++].iov_len = ctx->highmem;
+	}
+
+	if (blockif_register_bufs(bctxt, mem, n) < 0)
+		WPRINTF("nvme: guest memory is not registered\n");
+}
+
+static void
+nvme_init_ctrldata(struct nvme_vdev *nvme, const u_char *digest)
+{
+	struct nvme_controller_data *cd = &nvme->ctrldata;
+	char sn[21];
+
+	snprintf(sn, sizeof(sn), "ACRN%02X%02X%02X%02X%02X%02X%02X%02X",
+		 digest[0], digest[1], digest[2], digest[3], digest[4],
+		 digest[5], digest[6], digest[7]);
+
+	cd->vid = NVME_VENDOR;
+	cd->ssvid = NVME_VENDOR;
+	nvme_strpad(cd->sn, sn, sizeof(cd->sn));
+	nvme_strpad(cd->mn, "ACRN NVMe Ctrl", sizeof(cd->mn));
+	nvme_strpad(cd->fr, NVME_FW_REV, sizeof(cd->fr));
+	cd->rab = 4;
+	/* Intel OUI */
+	cd->ieee[0] = 0xe4;
+	cd->ieee[1] = 0xd2;
+	cd->ieee[2] = 0x5c;
+	cd->mdts = NVME_MDTS;
+	cd->ver = nvme->vs;
+	cd->oacs = NVME_OACS_DBBUF;
+	cd->acl = 3;
+	cd->aerl = NVME_AERL - 1;
+	cd->frmw = (1 << 1) | 0x1;	/* 1 slot, read only */
+	cd->elpe = 0;
+	cd->npss = 0;
+	cd->wctemp = NVME_TEMP_THRESHOLD;
+	cd->cctemp = NVME_TEMP_THRESHOLD + 10;
+	cd->sqes = (6 << 4) | 6;	/* 64 bytes */
+	cd->cqes = (4 << 4) | 4;	/* 16 bytes */
+	cd->nn = 1;
+	if (blockif_candiscard(nvme->bc))
+		cd->oncs |= NVME_ONCS_DSM;
+	cd->vwc = 1;
+	snprintf(cd->subnqn, sizeof(cd->subnqn),
+		 "nqn.2021-10.org.projectacrn:nvme:%s", sn);
+	cd->psd[0].mp = 2500;		/* 25 W */
+}
+
+static void
+nvme_init_nsdata(struct nvme_vdev *nvme, const u_char *digest)
+{
+	struct nvme_namespace_data *nd = &nvme->nsdata;
+	int psectsz, psectoff;
+
+	nd->nsze = nd->ncap = nd->nuse = nvme->nsze;
+	nd->nlbaf = 0;
+	nd->flbas = 0;
+	nd->lbaf[0] = (ffs(nvme->sectsz) - 1) << NVME_LBAF_LBADS_SHIFT;
+
+	blockif_psectsz(nvme->bc, &psectsz, &psectoff);
+	if (psectsz > nvme->sectsz && psectoff == 0) {
+		nd->nsfeat |= NVME_NSFEAT_OPTPERF;
+		nd->npwg = nd->npwa = psectsz / nvme->sectsz - 1;
+	}
+	memcpy(nd->eui64, digest + 8, sizeof(nd->eui64));
+}
+
+static int
+pci_nvme_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct nvme_vdev *nvme;
+	struct blockif_ctxt *bctxt;
+	char bident[16];
+	MD5_CTX mdctx;
+	u_char digest[16];
+	int i, j, nioq;
+
+	if (opts == NULL) {
+		WPRINTF("nvme: backing device required\n");
+		return -1;
+	}
+	nioq = nvme_parse_mq(opts);
+	if (nioq < 0) {
+		WPRINTF("nvme: mq shall be between 1 and %d\n", NVME_MAX_IOQ);
+		return -1;
+	}
+
+	snprintf(bident, sizeof(bident), "%d:%d", dev->slot, dev->func);
+	bctxt = blockif_open(opts, bident, nioq);
+	if (bctxt == NULL) {
+		WPRINTF("nvme: could not open backing file\n");
+		return -1;
+	}
+	nvme_register_mem(ctx, bctxt);
+
+	nvme = calloc(1, sizeof(struct nvme_vdev));
+	if (nvme == NULL) {
+		WPRINTF("nvme: calloc returns NULL\n");
+		goto fail;
+	}
+	nvme->dev = dev;
+	nvme->ctx = ctx;
+	nvme->bc = bctxt;
+	nvme->nioq = nioq;
+	nvme->ioqsz = blockif_queuesz(bctxt);
+	nvme->sectsz = blockif_sectsz(bctxt);
+	nvme->nsze = blockif_size(bctxt) / nvme->sectsz;
+	nvme_init_mutex(&nvme->mtx);
+
+	for (i = 0; i <= nioq; i++) {
+		struct nvme_sq *sq = &nvme->sq[i];
+
+		sq->nvme = nvme;
+		sq->qid = i;
+		nvme_init_mutex(&sq->mtx);
+		pthread_cond_init(&sq->idle, NULL);
+		nvme->cq[i].qid = i;
+		nvme_init_mutex(&nvme->cq[i].mtx);
+		if (i == 0)
+			continue;
+
+		sq->reqs = calloc(nvme->ioqsz, sizeof(struct nvme_ioreq));
+		if (sq->reqs == NULL) {
+			WPRINTF("nvme: calloc returns NULL\n");
+			goto fail;
+		}
+		for (j = 0; j < nvme->ioqsz; j++) {
+			sq->reqs[j].sq = sq;
+			sq->reqs[j].io_req.callback = nvme_io_done;
+			sq->reqs[j].io_req.param = &sq->reqs[j];
+			sq->reqs[j].io_req.qidx = i - 1;
+		}
+		nvme_init_queue_reqs(nvme, sq);
+	}
+
+	nvme->cap = (NVME_MQES - 1) | NVME_CAP_CQR |
+		    (2UL << NVME_CAP_TO_SHIFT) | NVME_CAP_CSS_NVM;
+	nvme->vs = 0x00010300;
+
+	MD5_Init(&mdctx);
+	MD5_Update(&mdctx, opts, strnlen(opts, NVME_MAX_OPTS_LEN));
+	MD5_Final(digest, &mdctx);
+	nvme_init_ctrldata(nvme, digest);
+	nvme_init_nsdata(nvme, digest);
+	nvme_reset(nvme);
+	dev->arg = nvme;
+
+	pci_set_cfgdata16(dev, PCIR_DEVICE, NVME_DEVICE);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, NVME_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, NVME_DEVICE);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, NVME_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_STORAGE);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_STORAGE_NVM);
+	pci_set_cfgdata8(dev, PCIR_PROGIF, PCIP_STORAGE_NVM_ENTERPRISE_NVMHCI_1_0);
+
+	/* a vector per queue pair, and the admin one */
+	if (pci_emul_add_msixcap(dev, nioq + 1, NVME_BAR_MSIX)) {
+		WPRINTF("nvme: MSI-X capability failed\n");
+		goto fail;
+	}
+	pci_emul_set_bar_posted(dev, NVME_BAR_REGS, NVME_CR_DOORBELL,
+				NVME_QUEUES * 8);
+	if (pci_emul_alloc_bar(dev, NVME_BAR_REGS, PCIBAR_MEM64,
+			       NVME_REGS_SIZE)) {
+		WPRINTF("nvme: BAR allocation failed\n");
+		goto fail;
+	}
+	pci_lintr_request(dev);
+	(void)pci_msix_irqfd_init(dev);
+
+	return 0;
+
+fail:
+	dev->arg = NULL;
+	if (nvme) {
+		for (i = 1; i <= nioq; i++)
+			free(nvme->sq[i].reqs);
+		free(nvme);
+	}
+	blockif_close(bctxt);
+	return -1;
+}
+
+static void
+pci_nvme_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct nvme_vdev *nvme = dev->arg;
+	int i;
+
+	if (nvme == NULL)
+		return;
+
+	nvme_reset_queues(nvme);
+	if (blockif_flush_all(nvme->bc))
+		WPRINTF("nvme: flush on deinit failed\n");
+	blockif_close(nvme->bc);
+	for (i = 1; i <= nvme->nioq; i++)
+		free(nvme->sq[i].reqs);
+	free(nvme);
+	dev->arg = NULL;
+}
+
+static void
+pci_nvme_reset(struct vmctx *ctx, struct pci_vdev *dev)
+{
+	struct nvme_vdev *nvme = dev->arg;
+
+	pthread_mutex_lock(&nvme->mtx);
+	nvme_reset(nvme);
+	pthread_mutex_unlock(&nvme->mtx);
+}
+
+struct pci_vdev_ops pci_ops_nvme = {
+	.class_name		= "nvme",
+	.vdev_init		= pci_nvme_init,
+	.vdev_deinit		= pci_nvme_deinit,
+	.vdev_reset		= pci_nvme_reset,
+	.vdev_barwrite		= pci_nvme_write,
+	.vdev_barread		= pci_nvme_read,
+};
+DEFINE_PCI_DEVTYPE(pci_ops_nvme);
@@ -528,6 +528,7 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	bool enable_ptm = false;
 	int vrp_sec_bus = 0;
 	int vmsix_on_msi_bar_id = -1;
+	uint32_t wc_bars = 0;
 	struct acrn_assign_pcidev pcidev = {};
 	uint16_t vendor = 0, device = 0;
 
@@ -545,6 +546,18 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -EINVAL;
 	}
 
+	/* the device would DMA to memory not mapped in the IOMMU yet */
+	if (lazy_mem) {
+		pr_err("%s: passthrough is not supported with lazy_mem.", __func__);
+		return -EINVAL;
+	}
+
+	/* nor to memory shared read-only */
+	if (share_image) {
+		pr_err("%s: passthrough is not supported with share_image.", __func__);
+		return -EINVAL;
+	}
+
 	if (is_rtvm && (PCI_BDF(bus, slot, func) == PCI_BDF_GPU)) {
 		pr_err("%s RTVM doesn't support GVT-D.", __func__);
 		return -EINVAL;
@@ -570,6 +583,14 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		} else if (!strncmp(opt, "enable_ptm", 10)) {
 			pr_notice("<PTM>: opt=enable_ptm.\n");
 			enable_ptm = true;
+		} else if (!strncmp(opt, "wc", 2)) {
+			/* "wc" for all the BARs, "wc=<mask>" for some */
+			wc_bars = (1 << (PCI_BARMAX + 1)) - 1;
+			if (opt[2] == '=' && dm_strtoui(opt + 3, NULL, 0,
+						&wc_bars) != 0) {
+				pr_err("Invalid passthru wc mask:%s", opt);
+				return -EINVAL;
+			}
 		} else
 			pr_warn("Invalid passthru options:%s", opt);
 	}
@@ -655,6 +676,12 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pcidev.phys_bdf = ptdev->phys_bdf;
 	for (idx = 0; idx <= PCI_BARMAX; idx++) {
 		pcidev.bar[idx] = pci_get_cfgdata32(dev, PCIR_BAR(idx));
+
+		/* only prefetchable memory BARs may be write-combining */
+		if ((wc_bars & (1 << idx)) && !PCI_BAR_IO(pcidev.bar[idx]) &&
+				(pcidev.bar[idx] & PCIM_BAR_MEM_PREFETCH) &&
+				ptdev->bar[idx].type != PCIBAR_MEMHI64)
+			pcidev.wc_bars |= 1 << idx;
 	}
 
 	/* If ptdev support MSI/MSIX, stop here to skip virtual INTx setup.
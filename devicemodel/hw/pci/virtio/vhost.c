@@ -10,11 +10,15 @@
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <linux/vhost.h>
@@ -24,6 +28,7 @@
 #include "irq.h"
 #include "vmmapi.h"
 #include "vhost.h"
+#include "mevent.h"
 
 static int vhost_debug;
 #define LOG_TAG "vhost: "
@@ -31,6 +36,42 @@ static int vhost_debug;
        do { if (vhost_debug) pr_dbg(LOG_TAG fmt, ##args); } while (0)
 #define WPRINTF(fmt, args...) pr_err(LOG_TAG fmt, ##args)
 
+/*
+ * Operations of a vhost backend: the in-kernel vhost driver, talked to
+ * through ioctls on its chardev, or a vhost-user backend in another
+ * process, talked to through messages on a unix socket.
+ */
+struct vhost_backend_ops {
+	int (*set_mem_table)(struct vhost_dev *vdev);
+	int (*set_vring_addr)(struct vhost_dev *vdev,
+			      struct vhost_vring_addr *addr);
+	int (*set_vring_num)(struct vhost_dev *vdev,
+			     struct vhost_vring_state *ring);
+	int (*set_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*get_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*set_vring_kick)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_call)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_busyloop_timeout)(struct vhost_dev *vdev,
+					  struct vhost_vring_state *s);
+	int (*set_vring_enable)(struct vhost_dev *vdev,
+				struct vhost_vring_state *s);
+	int (*set_features)(struct vhost_dev *vdev, uint64_t features);
+	int (*get_features)(struct vhost_dev *vdev, uint64_t *features);
+	int (*set_owner)(struct vhost_dev *vdev);
+	int (*reset_device)(struct vhost_dev *vdev);
+	int (*net_set_backend)(struct vhost_dev *vdev,
+			       struct vhost_vring_file *file);
+	int (*vsock_set_guest_cid)(struct vhost_dev *vdev, uint64_t cid);
+	int (*vsock_set_running)(struct vhost_dev *vdev, int start);
+	int (*get_config)(struct vhost_dev *vdev, void *config, uint32_t len);
+};
+
+static int vhost_user_open_slave_channel(struct vhost_dev *vdev);
+
 static inline
 int vhost_kernel_ioctl(struct vhost_dev *vdev,
 		       unsigned long int request,
@@ -46,10 +87,14 @@ int vhost_kernel_ioctl(struct vhost_dev *vdev,
 	return rc;
 }
 
+static const struct vhost_backend_ops vhost_kernel_ops;
+static const struct vhost_backend_ops vhost_user_ops;
+
 static void
 vhost_kernel_init(struct vhost_dev *vdev, struct virtio_base *base,
 		  int fd, int vq_idx, uint32_t busyloop_timeout)
 {
+	vdev->ops = vdev->user ? &vhost_user_ops : &vhost_kernel_ops;
 	vdev->base = base;
 	vdev->fd = fd;
 	vdev->vq_idx = vq_idx;
@@ -62,6 +107,10 @@ vhost_kernel_deinit(struct vhost_dev *vdev)
 	vdev->base = NULL;
 	vdev->vq_idx = 0;
 	vdev->busyloop_timeout = 0;
+	if (vdev->slave_mevp) {
+		mevent_delete_close(vdev->slave_mevp);
+		vdev->slave_mevp = NULL;
+	}
 	if (vdev->fd > 0) {
 		close(vdev->fd);
 		vdev->fd = -1;
@@ -69,10 +118,59 @@ vhost_kernel_deinit(struct vhost_dev *vdev)
 }
 
 static int
-vhost_kernel_set_mem_table(struct vhost_dev *vdev,
-			   struct vhost_memory *mem)
+vhost_kernel_set_mem_table(struct vhost_dev *vdev)
 {
-	return vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
+	struct vmctx *ctx;
+	struct vhost_memory *mem;
+	uint32_t nregions = 0;
+	int rc;
+
+	ctx = vdev->base->dev->vmctx;
+	if (ctx->lowmem > 0)
+		nregions++;
+	if (ctx->highmem > 0)
+		nregions++;
+
+	mem = calloc(1, sizeof(struct vhost_memory) +
+		sizeof(struct vhost_memory_region) * nregions);
+	if (!mem) {
+		WPRINTF("out of memory\n");
+		return -1;
+	}
+
+	nregions = 0;
+	if (ctx->lowmem > 0) {
+		mem->regions[nregions].guest_phys_addr = (uintptr_t)0;
+		mem->regions[nregions].memory_size = ctx->lowmem;
+		mem->regions[nregions].userspace_addr =
+			(uintptr_t)ctx->baseaddr;
+		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
+			nregions,
+			mem->regions[nregions].guest_phys_addr,
+			mem->regions[nregions].userspace_addr,
+			mem->regions[nregions].memory_size);
+		nregions++;
+	}
+
+	if (ctx->highmem > 0) {
+		mem->regions[nregions].guest_phys_addr = ctx->highmem_gpa_base;
+		mem->regions[nregions].memory_size = ctx->highmem;
+		mem->regions[nregions].userspace_addr =
+			(uintptr_t)(ctx->baseaddr + ctx->highmem_gpa_base);
+		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
+			nregions,
+			mem->regions[nregions].guest_phys_addr,
+			mem->regions[nregions].userspace_addr,
+			mem->regions[nregions].memory_size);
+		nregions++;
+	}
+
+	mem->nregions = nregions;
+	mem->padding = 0;
+	rc = vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
+	free(mem);
+
+	return rc;
 }
 
 static int
@@ -161,6 +259,631 @@ vhost_kernel_net_set_backend(struct vhost_dev *vdev,
 	return vhost_kernel_ioctl(vdev, VHOST_NET_SET_BACKEND, file);
 }
 
+static int
+vhost_kernel_vsock_set_guest_cid(struct vhost_dev *vdev, uint64_t cid)
+{
+	return vhost_kernel_ioctl(vdev, VHOST_VSOCK_SET_GUEST_CID, &cid);
+}
+
+static int
+vhost_kernel_vsock_set_running(struct vhost_dev *vdev, int start)
+{
+	return vhost_kernel_ioctl(vdev, VHOST_VSOCK_SET_RUNNING, &start);
+}
+
+static const struct vhost_backend_ops vhost_kernel_ops = {
+	.set_mem_table			= vhost_kernel_set_mem_table,
+	.set_vring_addr			= vhost_kernel_set_vring_addr,
+	.set_vring_num			= vhost_kernel_set_vring_num,
+	.set_vring_base			= vhost_kernel_set_vring_base,
+	.get_vring_base			= vhost_kernel_get_vring_base,
+	.set_vring_kick			= vhost_kernel_set_vring_kick,
+	.set_vring_call			= vhost_kernel_set_vring_call,
+	.set_vring_busyloop_timeout	= vhost_kernel_set_vring_busyloop_timeout,
+	.set_features			= vhost_kernel_set_features,
+	.get_features			= vhost_kernel_get_features,
+	.set_owner			= vhost_kernel_set_owner,
+	.reset_device			= vhost_kernel_reset_device,
+	.net_set_backend		= vhost_kernel_net_set_backend,
+	.vsock_set_guest_cid		= vhost_kernel_vsock_set_guest_cid,
+	.vsock_set_running		= vhost_kernel_vsock_set_running,
+};
+
+/*
+ * vhost-user: the same requests sent as messages over a unix socket to
+ * a backend in another process (e.g. DPDK or SPDK).  Guest memory is
+ * shared by passing the hugetlbfs fds along with VHOST_USER_SET_MEM_TABLE,
+ * and the kick/call eventfds along with VHOST_USER_SET_VRING_KICK/CALL.
+ */
+#define VHOST_USER_GET_FEATURES			1
+#define VHOST_USER_SET_FEATURES			2
+#define VHOST_USER_SET_OWNER			3
+#define VHOST_USER_RESET_OWNER			4
+#define VHOST_USER_SET_MEM_TABLE		5
+#define VHOST_USER_SET_VRING_NUM		8
+#define VHOST_USER_SET_VRING_ADDR		9
+#define VHOST_USER_SET_VRING_BASE		10
+#define VHOST_USER_GET_VRING_BASE		11
+#define VHOST_USER_SET_VRING_KICK		12
+#define VHOST_USER_SET_VRING_CALL		13
+#define VHOST_USER_GET_PROTOCOL_FEATURES	15
+#define VHOST_USER_SET_PROTOCOL_FEATURES	16
+#define VHOST_USER_SET_VRING_ENABLE		18
+#define VHOST_USER_SET_SLAVE_REQ_FD		21
+#define VHOST_USER_GET_CONFIG			24
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_REPLY_MASK		(1 << 2)
+#define VHOST_USER_NEED_REPLY_MASK	(1 << 3)
+#define VHOST_USER_VRING_NOFD_MASK	(1 << 8)
+#define VHOST_USER_F_PROTOCOL_FEATURES	30
+#define VHOST_USER_PROTOCOL_F_REPLY_ACK	3
+#define VHOST_USER_PROTOCOL_F_SLAVE_REQ	5
+#define VHOST_USER_PROTOCOL_F_CONFIG	9
+#define VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD	10
+#define VHOST_USER_MAX_REGIONS		8
+#define VHOST_USER_MAX_CONFIG_SIZE	256
+#define VHOST_USER_MAX_SLAVE_PAYLOAD	512
+
+/* optional protocol features we can make use of */
+#define VHOST_USER_PROTOCOL_FEATURES	(1UL << VHOST_USER_PROTOCOL_F_CONFIG)
+
+/* and those of the backend request channel, if the device handles it */
+#define VHOST_USER_SLAVE_PROTOCOL_FEATURES		\
+	((1UL << VHOST_USER_PROTOCOL_F_SLAVE_REQ) |	\
+	(1UL << VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD) |	\
+	(1UL << VHOST_USER_PROTOCOL_F_REPLY_ACK))
+
+struct vhost_user_mem_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_mem_region regions[VHOST_USER_MAX_REGIONS];
+};
+
+struct vhost_user_config {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t flags;
+	uint8_t region[VHOST_USER_MAX_CONFIG_SIZE];
+};
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_memory memory;
+		struct vhost_user_config config;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+/* a request from the backend, on the backend request channel */
+struct vhost_user_slave_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;
+	union {
+		uint64_t u64;
+		uint8_t raw[VHOST_USER_MAX_SLAVE_PAYLOAD];
+	} payload;
+} __attribute__((packed));
+
+static int
+vhost_user_send(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	char control[CMSG_SPACE(VHOST_USER_MAX_REGIONS * sizeof(int))];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+
+	msg->flags = VHOST_USER_VERSION;
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	do {
+		rc = sendmsg(vdev->fd, &mh, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc != iov.iov_len) {
+		WPRINTF("vhost-user request %u failed, errno = %d\n",
+			msg->request, errno);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+vhost_user_recv(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		uint32_t request)
+{
+	size_t off, len;
+	ssize_t rc;
+
+	len = VHOST_USER_HDR_SIZE;
+	for (off = 0; off < len; off += rc) {
+		rc = recv(vdev->fd, (char *)msg + off, len - off, 0);
+		if (rc < 0 && errno == EINTR) {
+			rc = 0;
+			continue;
+		}
+		if (rc <= 0)
+			goto fail;
+		if (off + rc == VHOST_USER_HDR_SIZE) {
+			if (msg->size > sizeof(msg->payload))
+				goto fail;
+			len += msg->size;
+		}
+	}
+
+	if (msg->request != request ||
+	    (msg->flags & VHOST_USER_REPLY_MASK) == 0) {
+		WPRINTF("vhost-user unexpected reply %u to request %u\n",
+			msg->request, request);
+		return -1;
+	}
+	return 0;
+
+fail:
+	WPRINTF("vhost-user reply to request %u failed, errno = %d\n",
+		request, errno);
+	return -1;
+}
+
+static int
+vhost_user_request_u64(struct vhost_dev *vdev, uint32_t request,
+		       uint64_t *val)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = 0;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, request) < 0)
+		return -1;
+	if (msg.size != sizeof(msg.payload.u64))
+		return -1;
+
+	*val = msg.payload.u64;
+	return 0;
+}
+
+static int
+vhost_user_set_u64(struct vhost_dev *vdev, uint32_t request, uint64_t val)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = val;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+/*
+ * The rings of all vhost devs sharing the socket are numbered across
+ * the whole device, so vq_idx is added to the vhost dev's own index.
+ */
+static int
+vhost_user_set_vring_state(struct vhost_dev *vdev, uint32_t request,
+			   struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.state);
+	msg.payload.state.index = ring->index + vdev->vq_idx;
+	msg.payload.state.num = ring->num;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_file(struct vhost_dev *vdev, uint32_t request,
+			  struct vhost_vring_file *file)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = file->index + vdev->vq_idx;
+	if (file->fd < 0) {
+		msg.payload.u64 |= VHOST_USER_VRING_NOFD_MASK;
+		return vhost_user_send(vdev, &msg, NULL, 0);
+	}
+	return vhost_user_send(vdev, &msg, &file->fd, 1);
+}
+
+static int
+vhost_user_set_mem_table(struct vhost_dev *vdev)
+{
+	struct vm_mem_region regions[VHOST_USER_MAX_REGIONS];
+	struct vhost_user_mem_region *ur;
+	struct vhost_user_msg msg;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int i, n;
+
+	n = hugetlb_get_mem_regions(regions, VHOST_USER_MAX_REGIONS);
+	if (n == 0) {
+		WPRINTF("no shareable guest memory for vhost-user\n");
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request = VHOST_USER_SET_MEM_TABLE;
+	msg.size = sizeof(msg.payload.memory);
+	msg.payload.memory.nregions = n;
+	for (i = 0; i < n; i++) {
+		ur = &msg.payload.memory.regions[i];
+		ur->guest_phys_addr = regions[i].gpa;
+		ur->memory_size = regions[i].len;
+		ur->userspace_addr = (uintptr_t)regions[i].hva;
+		ur->mmap_offset = regions[i].fd_offset;
+		fds[i] = regions[i].fd;
+		DPRINTF("[%d][0x%lx -> 0x%lx, 0x%lx]\n", i,
+			ur->guest_phys_addr, ur->userspace_addr,
+			ur->memory_size);
+	}
+
+	return vhost_user_send(vdev, &msg, fds, n);
+}
+
+static int
+vhost_user_set_vring_addr(struct vhost_dev *vdev,
+			  struct vhost_vring_addr *addr)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_SET_VRING_ADDR;
+	msg.size = sizeof(msg.payload.addr);
+	msg.payload.addr = *addr;
+	msg.payload.addr.index += vdev->vq_idx;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_vring_num(struct vhost_dev *vdev,
+			 struct vhost_vring_state *ring)
+{
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_NUM,
+					  ring);
+}
+
+static int
+vhost_user_set_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_BASE,
+					  ring);
+}
+
+/* this also stops the ring in the backend */
+static int
+vhost_user_get_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	struct vhost_user_msg msg;
+
+	if (vhost_user_set_vring_state(vdev, VHOST_USER_GET_VRING_BASE,
+				       ring) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_VRING_BASE) < 0)
+		return -1;
+	if (msg.size != sizeof(msg.payload.state))
+		return -1;
+
+	ring->num = msg.payload.state.num;
+	return 0;
+}
+
+static int
+vhost_user_set_vring_kick(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_KICK,
+					 file);
+}
+
+static int
+vhost_user_set_vring_call(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_CALL,
+					 file);
+}
+
+static int
+vhost_user_set_vring_busyloop_timeout(struct vhost_dev *vdev,
+				      struct vhost_vring_state *s)
+{
+	/* polling is up to the backend */
+	return 0;
+}
+
+/*
+ * Once VHOST_USER_F_PROTOCOL_FEATURES is negotiated the rings start
+ * disabled and have to be enabled explicitly.
+ */
+static int
+vhost_user_set_vring_enable(struct vhost_dev *vdev,
+			    struct vhost_vring_state *s)
+{
+	if (!(vdev->vhost_user_features &
+	      (1UL << VHOST_USER_F_PROTOCOL_FEATURES)))
+		return 0;
+
+	return vhost_user_set_vring_state(vdev, VHOST_USER_SET_VRING_ENABLE,
+					  s);
+}
+
+static int
+vhost_user_set_features(struct vhost_dev *vdev, uint64_t features)
+{
+	features |= vdev->vhost_user_features &
+		(1UL << VHOST_USER_F_PROTOCOL_FEATURES);
+	return vhost_user_set_u64(vdev, VHOST_USER_SET_FEATURES, features);
+}
+
+/*
+ * Serve a request of the backend, and reply to it if asked with the
+ * result of the handler of the device.
+ */
+static void
+vhost_user_slave_read(int fd, enum ev_type t, void *arg)
+{
+	struct vhost_dev *vdev = arg;
+	struct vhost_user_slave_msg msg;
+	char control[CMSG_SPACE(VHOST_USER_MAX_REGIONS * sizeof(int))];
+	int fds[VHOST_USER_MAX_REGIONS];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+	int i, nfds = 0, ret;
+
+	iov.iov_base = &msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+
+	do {
+		rc = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+	} while (rc < 0 && errno == EINTR);
+	if (rc != VHOST_USER_HDR_SIZE)
+		goto fail;
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+	}
+
+	if (msg.size > sizeof(msg.payload) ||
+	    (msg.size && recv(fd, &msg.payload, msg.size, MSG_WAITALL) !=
+	     msg.size))
+		goto fail_fds;
+
+	ret = vdev->slave_handler(vdev->slave_arg, msg.request,
+				  &msg.payload, msg.size, fds, nfds);
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+
+	if (msg.flags & VHOST_USER_NEED_REPLY_MASK) {
+		msg.flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK;
+		msg.size = sizeof(msg.payload.u64);
+		msg.payload.u64 = ret < 0 ? -ret : 0;
+		if (send(fd, &msg, VHOST_USER_HDR_SIZE + msg.size, 0) < 0)
+			WPRINTF("vhost-user reply to backend request %u "
+				"failed, errno = %d\n", msg.request, errno);
+	}
+	return;
+
+fail_fds:
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+fail:
+	/* the backend is gone, or out of sync */
+	WPRINTF("vhost-user backend request channel closed\n");
+	mevent_delete_close(vdev->slave_mevp);
+	vdev->slave_mevp = NULL;
+}
+
+/*
+ * Hand one end of a socketpair to the backend to send us its requests
+ * (e.g. to map files into a shared memory region of the device).
+ */
+static int
+vhost_user_open_slave_channel(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+	int sv[2];
+
+	if (!(vdev->vhost_user_protocol_features &
+	      (1UL << VHOST_USER_PROTOCOL_F_SLAVE_REQ))) {
+		WPRINTF("vhost-user backend sends no requests\n");
+		return 0;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+		WPRINTF("socketpair failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	msg.request = VHOST_USER_SET_SLAVE_REQ_FD;
+	msg.size = 0;
+	if (vhost_user_send(vdev, &msg, &sv[1], 1) < 0)
+		goto fail;
+	close(sv[1]);
+
+	vdev->slave_fd = sv[0];
+	vdev->slave_mevp = mevent_add(sv[0], EVF_READ, vhost_user_slave_read,
+				      vdev, NULL, NULL);
+	if (!vdev->slave_mevp) {
+		WPRINTF("mevent_add for the backend requests failed\n");
+		close(sv[0]);
+		return -1;
+	}
+	return 0;
+
+fail:
+	close(sv[0]);
+	close(sv[1]);
+	return -1;
+}
+
+static int
+vhost_user_get_features(struct vhost_dev *vdev, uint64_t *features)
+{
+	uint64_t protocol_features;
+
+	if (vhost_user_request_u64(vdev, VHOST_USER_GET_FEATURES,
+				   features) < 0)
+		return -1;
+	vdev->vhost_user_features = *features;
+
+	vdev->vhost_user_protocol_features = 0;
+	if (*features & (1UL << VHOST_USER_F_PROTOCOL_FEATURES)) {
+		if (vhost_user_request_u64(vdev,
+					   VHOST_USER_GET_PROTOCOL_FEATURES,
+					   &protocol_features) < 0)
+			return -1;
+		protocol_features &= VHOST_USER_PROTOCOL_FEATURES |
+			(vdev->slave_handler ?
+			 VHOST_USER_SLAVE_PROTOCOL_FEATURES |
+			 vdev->slave_protocol_features : 0);
+		if (vhost_user_set_u64(vdev, VHOST_USER_SET_PROTOCOL_FEATURES,
+				       protocol_features) < 0)
+			return -1;
+		vdev->vhost_user_protocol_features = protocol_features;
+		DPRINTF("protocol features: 0x%lx\n", protocol_features);
+	}
+
+	if (vdev->slave_handler && !vdev->slave_mevp)
+		return vhost_user_open_slave_channel(vdev);
+
+	return 0;
+}
+
+static int
+vhost_user_set_owner(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_SET_OWNER;
+	msg.size = 0;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_reset_device(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg;
+
+	msg.request = VHOST_USER_RESET_OWNER;
+	msg.size = 0;
+	return vhost_user_send(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_net_set_backend(struct vhost_dev *vdev,
+			   struct vhost_vring_file *file)
+{
+	/* a vhost-user backend owns its data path */
+	return 0;
+}
+
+/* the CID is in the config of the backend, which starts on its own */
+static int
+vhost_user_vsock_set_guest_cid(struct vhost_dev *vdev, uint64_t cid)
+{
+	return 0;
+}
+
+static int
+vhost_user_vsock_set_running(struct vhost_dev *vdev, int start)
+{
+	return 0;
+}
+
+/* the device config space is owned by the backend */
+static int
+vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t len)
+{
+	struct vhost_user_msg msg;
+
+	if (!(vdev->vhost_user_protocol_features &
+	      (1UL << VHOST_USER_PROTOCOL_F_CONFIG))) {
+		WPRINTF("vhost-user backend has no config space\n");
+		return -1;
+	}
+	if (len > VHOST_USER_MAX_CONFIG_SIZE)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request = VHOST_USER_GET_CONFIG;
+	msg.size = offsetof(struct vhost_user_config, region) + len;
+	msg.payload.config.offset = 0;
+	msg.payload.config.size = len;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_CONFIG) < 0)
+		return -1;
+	if (msg.size != offsetof(struct vhost_user_config, region) + len ||
+	    msg.payload.config.size != len)
+		return -1;
+
+	memcpy(config, msg.payload.config.region, len);
+	return 0;
+}
+
+static const struct vhost_backend_ops vhost_user_ops = {
+	.set_mem_table			= vhost_user_set_mem_table,
+	.set_vring_addr			= vhost_user_set_vring_addr,
+	.set_vring_num			= vhost_user_set_vring_num,
+	.set_vring_base			= vhost_user_set_vring_base,
+	.get_vring_base			= vhost_user_get_vring_base,
+	.set_vring_kick			= vhost_user_set_vring_kick,
+	.set_vring_call			= vhost_user_set_vring_call,
+	.set_vring_busyloop_timeout	= vhost_user_set_vring_busyloop_timeout,
+	.set_vring_enable		= vhost_user_set_vring_enable,
+	.set_features			= vhost_user_set_features,
+	.get_features			= vhost_user_get_features,
+	.set_owner			= vhost_user_set_owner,
+	.reset_device			= vhost_user_reset_device,
+	.net_set_backend		= vhost_user_net_set_backend,
+	.vsock_set_guest_cid		= vhost_user_vsock_set_guest_cid,
+	.vsock_set_running		= vhost_user_vsock_set_running,
+	.get_config			= vhost_user_get_config,
+};
+
 static int
 vhost_eventfd_test_and_clear(int fd)
 {
@@ -183,12 +906,10 @@ static int
 vhost_vq_register_eventfd(struct vhost_dev *vdev,
 			  int idx, bool is_register)
 {
-	struct acrn_ioeventfd ioeventfd = {0};
 	struct acrn_irqfd irqfd = {0};
 	struct virtio_base *base;
 	struct vhost_vq *vq;
 	struct virtio_vq_info *vqi;
-	struct pcibar *bar;
 	struct msix_table_entry *mte;
 	struct acrn_msi_entry msi;
 	int rc = -1;
@@ -200,51 +921,13 @@ vhost_vq_register_eventfd(struct vhost_dev *vdev,
 	vqi = &vdev->base->queues[vdev->vq_idx + idx];
 	vq = &vdev->vqs[idx];
 
-	if (!is_register) {
-		ioeventfd.flags = ACRN_IOEVENTFD_FLAG_DEASSIGN;
+	if (!is_register)
 		irqfd.flags = ACRN_IRQFD_FLAG_DEASSIGN;
-	}
 
 	/* register ioeventfd for kick */
-	if (base->device_caps & (1UL << VIRTIO_F_VERSION_1)) {
-		/*
-		 * in the current implementation, if virtio 1.0 with pio
-		 * notity, its bar idx should be set to non-zero
-		 */
-		if (base->modern_pio_bar_idx) {
-			bar = &vdev->base->dev->bar[base->modern_pio_bar_idx];
-			ioeventfd.data = vdev->vq_idx + idx;
-			ioeventfd.addr = bar->addr;
-			ioeventfd.len = 2;
-			ioeventfd.flags |= (ACRN_IOEVENTFD_FLAG_DATAMATCH |
-				ACRN_IOEVENTFD_FLAG_PIO);
-		} else if (base->modern_mmio_bar_idx) {
-			bar = &vdev->base->dev->bar[base->modern_mmio_bar_idx];
-			ioeventfd.data = 0;
-			ioeventfd.addr = bar->addr + VIRTIO_CAP_NOTIFY_OFFSET
-				+ (vdev->vq_idx + idx) *
-				VIRTIO_MODERN_NOTIFY_OFF_MULT;
-			ioeventfd.len = 2;
-			/* no additional flag bit should be set for MMIO */
-		} else {
-			WPRINTF("invalid virtio 1.0 parameters, 0x%lx\n",
-				base->device_caps);
-			return -1;
-		}
-	} else {
-		bar = &vdev->base->dev->bar[base->legacy_pio_bar_idx];
-		ioeventfd.data = vdev->vq_idx + idx;
-		ioeventfd.addr = bar->addr + VIRTIO_PCI_QUEUE_NOTIFY;
-		ioeventfd.len = 2;
-		ioeventfd.flags |= (ACRN_IOEVENTFD_FLAG_DATAMATCH |
-			ACRN_IOEVENTFD_FLAG_PIO);
-	}
-
-	ioeventfd.fd = vq->kick_fd;
-	DPRINTF("[ioeventfd: %d][0x%lx@%d][flags: 0x%x][data: 0x%lx]\n",
-		ioeventfd.fd, ioeventfd.addr, ioeventfd.len,
-		ioeventfd.flags, ioeventfd.data);
-	rc = vm_ioeventfd(vdev->base->dev->vmctx, &ioeventfd);
+	DPRINTF("[ioeventfd: %d][queue: %d]\n", vq->kick_fd, vdev->vq_idx + idx);
+	rc = virtio_vq_set_ioeventfd(base, vdev->vq_idx + idx, vq->kick_fd,
+			is_register);
 	if (rc < 0) {
 		WPRINTF("vm_ioeventfd failed rc = %d, errno = %d\n",
 			rc, errno);
@@ -263,10 +946,9 @@ vhost_vq_register_eventfd(struct vhost_dev *vdev,
 	if (rc < 0) {
 		WPRINTF("vm_irqfd failed rc = %d, errno = %d\n", rc, errno);
 		/* unregister ioeventfd */
-		if (is_register) {
-			ioeventfd.flags |= ACRN_IOEVENTFD_FLAG_DEASSIGN;
-			vm_ioeventfd(vdev->base->dev->vmctx, &ioeventfd);
-		}
+		if (is_register)
+			virtio_vq_set_ioeventfd(base, vdev->vq_idx + idx,
+				vq->kick_fd, false);
 		return -1;
 	}
 
@@ -378,7 +1060,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_NUM */
 	ring.index = idx;
 	ring.num = vqi->qsize;
-	rc = vhost_kernel_set_vring_num(vdev, &ring);
+	rc = vdev->ops->set_vring_num(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_num failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -386,7 +1068,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 
 	/* VHOST_SET_VRING_BASE */
 	ring.num = vqi->last_avail;
-	rc = vhost_kernel_set_vring_base(vdev, &ring);
+	rc = vdev->ops->set_vring_base(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_base failed: idx = %d, last_avail = %d\n",
 			idx, vqi->last_avail);
@@ -400,7 +1082,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	addr.used_user_addr = (uintptr_t)vqi->used;
 	addr.log_guest_addr = (uintptr_t)NULL;
 	addr.flags = 0;
-	rc = vhost_kernel_set_vring_addr(vdev, &addr);
+	rc = vdev->ops->set_vring_addr(vdev, &addr);
 	if (rc < 0) {
 		WPRINTF("set_vring_addr failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -409,7 +1091,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_CALL */
 	file.index = idx;
 	file.fd = vq->call_fd;
-	rc = vhost_kernel_set_vring_call(vdev, &file);
+	rc = vdev->ops->set_vring_call(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_call failed\n");
 		goto fail_vring;
@@ -418,18 +1100,28 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_KICK */
 	file.index = idx;
 	file.fd = vq->kick_fd;
-	rc = vhost_kernel_set_vring_kick(vdev, &file);
+	rc = vdev->ops->set_vring_kick(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_kick failed: idx = %d", idx);
 		goto fail_vring_kick;
 	}
 
+	if (vdev->ops->set_vring_enable) {
+		ring.index = idx;
+		ring.num = 1;
+		rc = vdev->ops->set_vring_enable(vdev, &ring);
+		if (rc < 0) {
+			WPRINTF("set_vring_enable failed: idx = %d\n", idx);
+			goto fail_vring_kick;
+		}
+	}
+
 	return 0;
 
 fail_vring_kick:
 	file.index = idx;
 	file.fd = -1;
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 fail_vring:
 	vhost_vq_register_eventfd(vdev, idx, false);
 fail:
@@ -463,14 +1155,14 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 	file.fd = -1;
 
 	/* VHOST_SET_VRING_KICK */
-	vhost_kernel_set_vring_kick(vdev, &file);
+	vdev->ops->set_vring_kick(vdev, &file);
 
 	/* VHOST_SET_VRING_CALL */
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 
 	/* VHOST_GET_VRING_BASE */
 	ring.index = idx;
-	rc = vhost_kernel_get_vring_base(vdev, &ring);
+	rc = vdev->ops->get_vring_base(vdev, &ring);
 	if (rc < 0)
 		WPRINTF("get_vring_base failed: idx = %d", idx);
 	else
@@ -487,66 +1179,6 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 	return rc;
 }
 
-static int
-vhost_set_mem_table(struct vhost_dev *vdev)
-{
-	struct vmctx *ctx;
-	struct vhost_memory *mem;
-	uint32_t nregions = 0;
-	int rc;
-
-	ctx = vdev->base->dev->vmctx;
-	if (ctx->lowmem > 0)
-		nregions++;
-	if (ctx->highmem > 0)
-		nregions++;
-
-	mem = calloc(1, sizeof(struct vhost_memory) +
-		sizeof(struct vhost_memory_region) * nregions);
-	if (!mem) {
-		WPRINTF("out of memory\n");
-		return -1;
-	}
-
-	nregions = 0;
-	if (ctx->lowmem > 0) {
-		mem->regions[nregions].guest_phys_addr = (uintptr_t)0;
-		mem->regions[nregions].memory_size = ctx->lowmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)ctx->baseaddr;
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
-	}
-
-	if (ctx->highmem > 0) {
-		mem->regions[nregions].guest_phys_addr = ctx->highmem_gpa_base;
-		mem->regions[nregions].memory_size = ctx->highmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)(ctx->baseaddr + ctx->highmem_gpa_base);
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
-	}
-
-	mem->nregions = nregions;
-	mem->padding = 0;
-	rc = vhost_kernel_set_mem_table(vdev, mem);
-	free(mem);
-	if (rc < 0) {
-		WPRINTF("set_mem_table failed\n");
-		return -1;
-	}
-
-	return 0;
-}
-
 /**
  * @brief vhost_dev initialization.
  *
@@ -593,7 +1225,7 @@ vhost_dev_init(struct vhost_dev *vdev,
 
 	vhost_kernel_init(vdev, base, fd, vq_idx, busyloop_timeout);
 
-	rc = vhost_kernel_get_features(vdev, &features);
+	rc = vdev->ops->get_features(vdev, &features);
 	if (rc < 0) {
 		WPRINTF("vhost_get_features failed\n");
 		goto fail;
@@ -688,7 +1320,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 		goto fail;
 	}
 
-	rc = vhost_kernel_set_owner(vdev);
+	rc = vdev->ops->set_owner(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_set_owner failed\n");
 		goto fail;
@@ -697,7 +1329,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 	/* set vhost internal features */
 	features = (vdev->base->negotiated_caps & vdev->vhost_features) |
 		vdev->vhost_ext_features;
-	rc = vhost_kernel_set_features(vdev, features);
+	rc = vdev->ops->set_features(vdev, features);
 	if (rc < 0) {
 		WPRINTF("set_features failed\n");
 		goto fail;
@@ -705,7 +1337,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 	DPRINTF("set_features: 0x%lx\n", features);
 
 	/* set memory table */
-	rc = vhost_set_mem_table(vdev);
+	rc = vdev->ops->set_mem_table(vdev);
 	if (rc < 0) {
 		WPRINTF("set_mem_table failed\n");
 		goto fail;
@@ -716,7 +1348,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 		state.num = vdev->busyloop_timeout;
 		for (i = 0; i < vdev->nvqs; i++) {
 			state.index = i;
-			rc = vhost_kernel_set_vring_busyloop_timeout(vdev,
+			rc = vdev->ops->set_vring_busyloop_timeout(vdev,
 				&state);
 			if (rc < 0) {
 				WPRINTF("set_busyloop_timeout failed\n");
@@ -763,7 +1395,7 @@ vhost_dev_stop(struct vhost_dev *vdev)
 	 * 1) resources of the vhost dev are freed
 	 * 2) vhost virtqueues are reset
 	 */
-	rc = vhost_kernel_reset_device(vdev);
+	rc = vdev->ops->reset_device(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_reset_device failed\n");
 		rc = -1;
@@ -793,7 +1425,7 @@ vhost_net_set_backend(struct vhost_dev *vdev, int backend_fd)
 	file.fd = backend_fd;
 	for (i = 0; i < vdev->nvqs; i++) {
 		file.index = i;
-		rc = vhost_kernel_net_set_backend(vdev, &file);
+		rc = vdev->ops->net_set_backend(vdev, &file);
 		if (rc < 0)
 			goto fail;
 	}
@@ -803,8 +1435,106 @@ fail:
 	file.fd = -1;
 	while (--i >= 0) {
 		file.index = i;
-		vhost_kernel_net_set_backend(vdev, &file);
+		vdev->ops->net_set_backend(vdev, &file);
 	}
 
 	return -1;
 }
+
+/**
+ * @brief set the guest CID of vhost vsock.
+ *
+ * This interface is called after vhost_dev_init() to set the context ID
+ * the guest is reached at by the AF_VSOCK sockets of the host.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param cid Guest context ID, greater than 2.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_vsock_set_guest_cid(struct vhost_dev *vdev, uint64_t cid)
+{
+	return vdev->ops->vsock_set_guest_cid(vdev, cid) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief start or stop the vhost vsock data plane.
+ *
+ * This interface is called after vhost_dev_start() to let vhost vsock
+ * run the virtqueues, and before vhost_dev_stop() to stop it.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param start Whether to start the data plane.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_vsock_set_running(struct vhost_dev *vdev, bool start)
+{
+	return vdev->ops->vsock_set_running(vdev, start ? 1 : 0) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief read the device config space from the vhost backend.
+ *
+ * This interface is called after vhost_dev_init() by devices whose
+ * config space is provided by a vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param config Buffer for the config space.
+ * @param len Size of the config space.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_dev_get_config(struct vhost_dev *vdev, void *config, uint32_t len)
+{
+	if (!vdev->ops || !vdev->ops->get_config) {
+		WPRINTF("get_config is not supported\n");
+		return -1;
+	}
+
+	return vdev->ops->get_config(vdev, config, len);
+}
+
+/**
+ * @brief connect to a vhost-user backend.
+ *
+ * This interface is called to connect to the unix socket of a vhost-user
+ * backend. The returned fd is passed to vhost_dev_init() with
+ * vhost_dev.user set.
+ *
+ * @param path Path of the unix socket.
+ *
+ * @return socket fd on success and -1 on failure.
+ */
+int
+vhost_user_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		WPRINTF("vhost-user socket path too long: %s\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		WPRINTF("vhost-user socket failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		WPRINTF("vhost-user connect to %s failed, errno = %d\n",
+			path, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
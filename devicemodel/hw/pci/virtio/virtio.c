@@ -30,11 +30,17 @@
 #include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "timer.h"
+#include "mevent.h"
+#include "vmmapi.h"
 #include <atomic.h>
 
 /*
@@ -52,6 +58,18 @@
 static uint8_t virtio_poll_enabled;
 static size_t virtio_poll_interval;
 
+/*
+ * The rings stay mapped as long as the queue is enabled, so their pages are
+ * recorded for a migration at each write of the device rather than once at
+ * map time.
+ */
+static inline void
+vq_mark_dirty(struct virtio_vq_info *vq)
+{
+	vm_gpa_mark_dirty(vq->dirty_gpa[0], vq->dirty_len[0]);
+	vm_gpa_mark_dirty(vq->dirty_gpa[1], vq->dirty_len[1]);
+}
+
 static void
 virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 {
@@ -92,6 +110,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 		if(!vq_ring_ready(vq))
 			continue;
 		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_mark_dirty(vq);
 		/* TODO: call notify when necessary */
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
@@ -173,9 +192,11 @@ virtio_reset_dev(struct virtio_base *base)
 
 	nvq = base->vops->nvq;
 	for (vq = base->queues, i = 0; i < nvq; vq++, i++) {
+		virtio_vq_kick_stop(vq);
 		vq->flags = 0;
 		vq->last_avail = 0;
 		vq->save_used = 0;
+		vq->used_pending = 0;
 		vq->pfn = 0;
 		vq->msix_idx = VIRTIO_MSI_NO_VECTOR;
 		vq->gpa_desc[0] = 0;
@@ -216,6 +237,8 @@ virtio_set_io_bar(struct virtio_base *base, int barnum)
 	 * is disabled? Existing code did not...
 	 */
 	size = VIRTIO_PCI_CONFIG_OFF(1) + base->vops->cfgsize;
+	/* queue notify register is write-only, no need to stall the guest */
+	pci_emul_set_bar_posted(base->dev, barnum, VIRTIO_PCI_QUEUE_NOTIFY, 2);
 	pci_emul_alloc_bar(base->dev, barnum, PCIBAR_IO, size);
 	base->legacy_pio_bar_idx = barnum;
 }
@@ -247,6 +270,12 @@ virtio_intr_init(struct virtio_base *base, int barnum, int use_msix)
 		nvec = base->vops->nvq + 1;
 		if (pci_emul_add_msixcap(base->dev, nvec, barnum))
 			return -1;
+		/*
+		 * user space backends raise their interrupts from their own
+		 * threads, let them signal eventfds instead of injecting
+		 */
+		if (base->backend_type == BACKEND_VBSU)
+			(void)pci_msix_irqfd_init(base->dev);
 	} else
 		base->flags &= ~VIRTIO_USE_MSIX;
 
@@ -312,15 +341,23 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 
 	/* ... and the last page(s) are the used ring. */
 	vq->used = (struct vring_used *)vb;
+	vq->dirty_gpa[0] = phys + (vb - (char *)vq->desc);
+	vq->dirty_len[0] = sizeof(uint16_t) * 3 +
+		sizeof(struct vring_used_elem) * vq->qsize;
+	vq->dirty_len[1] = 0;
 
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
+	vq->used_pending = 0;
 
 	/* Mark queue as allocated after initialization is complete. */
 	mb();
 	vq->flags = VQ_ALLOC;
 
+	if (base->flags & VIRTIO_KICK_EVENTFD)
+		(void)virtio_vq_kick_start(vq);
+
 	return;
 
 error:
@@ -328,6 +365,69 @@ error:
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * Map a packed virtqueue: the descriptor ring and the driver and
+ * device event suppression areas, which the guest hands over in the
+ * desc, avail and used address registers.
+ */
+static int
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t qsz = vq->qsize;
+	uint16_t *ndesc;
+	uint64_t phys;
+	char *vb;
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			      qsz * sizeof(struct vring_packed_desc));
+	if (!vb)
+		return -1;
+	vq->pdesc = (struct vring_packed_desc *)vb;
+	vq->dirty_gpa[0] = phys;
+	vq->dirty_len[0] = qsz * sizeof(struct vring_packed_desc);
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			      sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		return -1;
+	vq->driver_event = (struct vring_packed_desc_event *)vb;
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			      sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		return -1;
+	vq->device_event = (struct vring_packed_desc_event *)vb;
+	vq->dirty_gpa[1] = phys;
+	vq->dirty_len[1] = sizeof(struct vring_packed_desc_event);
+
+	/* per buffer id and per taken chain descriptor counts */
+	ndesc = realloc(vq->chain_ndesc, 2 * qsz * sizeof(uint16_t));
+	if (!ndesc)
+		return -1;
+	vq->chain_ndesc = ndesc;
+	vq->chain_hist = ndesc + qsz;
+
+	vq->desc = NULL;
+	vq->avail = NULL;
+	memset(&vq->used_shadow, 0, sizeof(vq->used_shadow));
+	vq->used = (struct vring_used *)&vq->used_shadow;
+
+	vq->last_avail = 0;
+	vq->avail_wrap = true;
+	vq->used_idx = 0;
+	vq->save_used_idx = 0;
+	vq->used_wrap = true;
+	vq->nchains = 0;
+	vq->save_used = 0;
+	vq->used_pending = 0;
+	vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+
+	return 0;
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -346,6 +446,12 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (vq_is_packed(vq)) {
+		if (virtio_vq_enable_packed(base, vq))
+			goto error;
+		goto done;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -370,23 +476,40 @@ virtio_vq_enable(struct virtio_base *base)
 	if (!vb)
 		goto error;
 	vq->used = (struct vring_used *)vb;
+	vq->dirty_gpa[0] = phys;
+	vq->dirty_len[0] = size;
+	vq->dirty_len[1] = 0;
 
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
+	vq->used_pending = 0;
 
+done:
 	/* Mark queue as enabled. */
 	vq->enabled = true;
 
 	/* Mark queue as allocated after initialization is complete. */
 	mb();
 	vq->flags = VQ_ALLOC;
+
+	if (base->flags & VIRTIO_KICK_EVENTFD)
+		(void)virtio_vq_kick_start(vq);
 	return;
  error:
 	vq->flags = 0;
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * The guest memory layout is copied from the vmctx once per vq_getchain()
+ * so that translating the buffers of a chain is done inline instead of
+ * calling into vmmapi for every descriptor.  The rings themselves are
+ * translated once, when the queue is set up.  The descriptors are kept one
+ * iovec each, even when adjacent: the devices find their headers and
+ * status bytes by descriptor.
+ */
+
 /*
  * Helper inline for vq_getchain(): record the i'th "real"
  * descriptor.
@@ -394,24 +517,172 @@ virtio_vq_enable(struct virtio_base *base)
  *        fails.
  */
 static inline int
-_vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
-	   struct iovec *iov, int n_iov, uint16_t *flags) {
+_vq_record(int i, volatile struct vring_desc *vd,
+	   const struct vm_gpa_map *mm, struct iovec *iov, int n_iov,
+	   uint16_t *flags) {
 
 	void *host_addr;
+	uint64_t addr;
+	uint32_t len;
 
 	if (i >= n_iov)
 		return -1;
-	host_addr = paddr_guest2host(ctx, vd->addr, vd->len);
+	addr = vd->addr;
+	len = vd->len;
+	host_addr = vm_gpa_map_hva(mm, addr, len);
 	if (!host_addr)
 		return -1;
 	iov[i].iov_base = host_addr;
-	iov[i].iov_len = vd->len;
+	iov[i].iov_len = len;
 	if (flags != NULL)
 		flags[i] = vd->flags;
 	return 0;
 }
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+/*
+ * With VIRTIO_RING_F_EVENT_IDX the driver ignores VRING_USED_F_NO_NOTIFY
+ * and only kicks when its avail index moves past avail_event.  Keep
+ * avail_event on the next chain we will look at while notifications
+ * are wanted, and let it fall behind while the device has them masked
+ * (e.g. during polling or while a worker drains the ring).
+ *
+ * The fence orders the avail_event store before the caller re-reads
+ * avail->idx, otherwise a buffer added in between could be missed by
+ * both sides.
+ */
+static inline void
+vq_update_avail_event(struct virtio_vq_info *vq)
+{
+	uint16_t flags;
+
+	/*
+	 * A packed ring has no use for the event index here, kicks are
+	 * simply enabled or disabled through the device event area.
+	 */
+	if (vq_is_packed(vq)) {
+		flags = (vq->used->flags & VRING_USED_F_NO_NOTIFY) ?
+			VRING_PACKED_EVENT_FLAG_DISABLE :
+			VRING_PACKED_EVENT_FLAG_ENABLE;
+		if (vq->device_event->flags != flags) {
+			vq->device_event->flags = flags;
+			vq_mark_dirty(vq);
+			atomic_thread_fence();
+		}
+		return;
+	}
+
+	if (!(vq->base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX)))
+		return;
+
+	if (vq->used->flags & VRING_USED_F_NO_NOTIFY)
+		return;
+
+	VQ_AVAIL_EVENT_IDX(vq) = vq->last_avail;
+	vq_mark_dirty(vq);
+	atomic_thread_fence();
+}
+
+/*
+ * vq_getchain() for a packed ring.  The chain starts at last_avail and
+ * runs over the following descriptors while VRING_DESC_F_NEXT is set;
+ * an indirect descriptor points at a table of descriptors that is
+ * walked in order.  The buffer id is taken from the last descriptor
+ * and returned in *pidx, and the number of ring slots it used is kept
+ * so vq_relchain() and vq_retchain() can step over them.
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_packed_desc *pd, *vindir;
+	struct vring_desc vd;
+	struct virtio_base *base;
+	struct vm_gpa_map mm;
+	const char *name;
+	uint16_t idx, ndesc, id, dflags;
+	bool wrap;
+	int i, j, n_indir;
+
+	if (!vq_has_descs(vq))
+		return 0;
+
+	base = vq->base;
+	name = base->vops->name;
+	vm_get_gpa_map(base->dev->vmctx, &mm);
+
+	idx = vq->last_avail;
+	wrap = vq->avail_wrap;
+	i = 0;
+	ndesc = 0;
+	for (;;) {
+		if (ndesc == vq->qsize)
+			goto loopy;
+
+		pd = &vq->pdesc[idx];
+		dflags = pd->flags;
+		id = pd->id;
+		ndesc++;
+		if (++idx == vq->qsize) {
+			idx = 0;
+			wrap = !wrap;
+		}
+
+		if (dflags & VRING_DESC_F_INDIRECT) {
+			n_indir = pd->len / sizeof(struct vring_packed_desc);
+			vindir = vm_gpa_map_hva(&mm, pd->addr, pd->len);
+			if (!vindir || n_indir == 0) {
+				pr_err("%s: invalid indirect table\r\n", name);
+				return -1;
+			}
+			for (j = 0; j < n_indir; j++) {
+				vd.addr = vindir[j].addr;
+				vd.len = vindir[j].len;
+				vd.flags = vindir[j].flags;
+				if (_vq_record(i, &vd, &mm, iov, n_iov, flags)) {
+					pr_err("%s: mapping to host failed\r\n",
+						name);
+					return -1;
+				}
+				if (++i > VQ_MAX_DESCRIPTORS)
+					goto loopy;
+			}
+		} else {
+			vd.addr = pd->addr;
+			vd.len = pd->len;
+			vd.flags = dflags;
+			if (_vq_record(i, &vd, &mm, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				return -1;
+			}
+			if (++i > VQ_MAX_DESCRIPTORS)
+				goto loopy;
+		}
+
+		if ((dflags & VRING_DESC_F_NEXT) == 0)
+			break;
+	}
+
+	if (id >= vq->qsize) {
+		pr_err("%s: invalid buffer id %u, driver confused?\r\n",
+			name, (u_int)id);
+		return -1;
+	}
+
+	vq->last_avail = idx;
+	vq->avail_wrap = wrap;
+	vq->chain_ndesc[id] = ndesc;
+	vq->chain_hist[vq->nchains++ % vq->qsize] = ndesc;
+
+	*pidx = id;
+	return i;
+
+loopy:
+	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, i);
+	return -1;
+}
+
 /*
  * Examine the chain of descriptors starting at the "next one" to
  * make sure that they describe a sensible request.  If so, return
@@ -451,18 +722,19 @@ _vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
  * You are assumed to have done a vq_ring_ready() if needed (note
  * that vq_has_descs() does one).
  */
-int
-vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
-	    struct iovec *iov, int n_iov, uint16_t *flags)
+static int
+_vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
+	     struct iovec *iov, int n_iov, uint16_t *flags, uint16_t avail_idx)
 {
 	int i;
 	u_int ndesc, n_indir;
 	u_int idx, next;
 
 	volatile struct vring_desc *vdir, *vindir, *vp;
-	struct vmctx *ctx;
+	struct vm_gpa_map mm;
 	struct virtio_base *base;
 	const char *name;
+	uint16_t mask, dflags;
 
 	base = vq->base;
 	name = base->vops->name;
@@ -481,7 +753,7 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	 * then trim off excess bits.
 	 */
 	idx = vq->last_avail;
-	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
+	ndesc = (uint16_t)((u_int)avail_idx - idx);
 	if (ndesc == 0)
 		return 0;
 	if (ndesc > vq->qsize) {
@@ -499,9 +771,19 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	 * check whether we're re-visiting a previously visited
 	 * index, but we just abort if the count gets excessive.
 	 */
-	ctx = base->dev->vmctx;
-	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
+	vm_get_gpa_map(base->dev->vmctx, &mm);
+	mask = vq->qsize - 1;
+	*pidx = next = vq->avail->ring[idx & mask];
 	vq->last_avail++;
+
+	/*
+	 * Warm up the head descriptor of the next request while this
+	 * one is walked, callers ask for it right after.
+	 */
+	if (ndesc > 1)
+		__builtin_prefetch((const void *)
+			&vq->desc[vq->avail->ring[(idx + 1) & mask] & mask]);
+
 	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
 		if (next >= vq->qsize) {
 			pr_err("%s: descriptor index %u out of range, "
@@ -510,8 +792,9 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 			return -1;
 		}
 		vdir = &vq->desc[next];
-		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
-			if (_vq_record(i, vdir, ctx, iov, n_iov, flags)) {
+		dflags = vdir->flags;
+		if ((dflags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record(i, vdir, &mm, iov, n_iov, flags)) {
 				pr_err("%s: mapping to host failed\r\n", name);
 				return -1;
 			}
@@ -530,8 +813,7 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 				    name, (u_int)vdir->len);
 				return -1;
 			}
-			vindir = paddr_guest2host(ctx,
-			    vdir->addr, vdir->len);
+			vindir = vm_gpa_map_hva(&mm, vdir->addr, vdir->len);
 
 			if (!vindir) {
 				pr_err("%s cannot get host memory\r\n", name);
@@ -543,23 +825,29 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 			 * out.  Each one's indirect flag must be off
 			 * (we don't really have to check, could just
 			 * ignore errors...).
+			 *
+			 * The table is guest memory that was just
+			 * translated in one go; each entry is read once
+			 * and by far most drivers lay it out in order.
 			 */
+			__builtin_prefetch((const void *)vindir);
 			next = 0;
 			for (;;) {
 				vp = &vindir[next];
-				if (vp->flags & VRING_DESC_F_INDIRECT) {
+				dflags = vp->flags;
+				if (dflags & VRING_DESC_F_INDIRECT) {
 					pr_err("%s: indirect desc has INDIR flag,"
 					    " driver confused?\r\n",
 					    name);
 					return -1;
 				}
-				if (_vq_record(i, vp, ctx, iov, n_iov, flags)) {
+				if (_vq_record(i, vp, &mm, iov, n_iov, flags)) {
 					pr_err("%s: mapping to host failed\r\n", name);
 					return -1;
 				}
 				if (++i > VQ_MAX_DESCRIPTORS)
 					goto loopy;
-				if ((vp->flags & VRING_DESC_F_NEXT) == 0)
+				if ((dflags & VRING_DESC_F_NEXT) == 0)
 					break;
 				next = vp->next;
 				if (next >= n_indir) {
@@ -570,7 +858,7 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 				}
 			}
 		}
-		if ((vdir->flags & VRING_DESC_F_NEXT) == 0)
+		if ((dflags & VRING_DESC_F_NEXT) == 0)
 			return i;
 	}
 loopy:
@@ -579,6 +867,68 @@ loopy:
 	return -1;
 }
 
+int
+vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
+	    struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	int n;
+
+	if (vq_is_packed(vq))
+		n = vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+	else
+		n = _vq_getchain(vq, pidx, iov, n_iov, flags, vq->avail->idx);
+	vq_update_avail_event(vq);
+
+	return n;
+}
+
+/*
+ * Take up to nchains request chains in one go.  avail->idx is read
+ * once for the whole batch and the avail event is updated once at
+ * the end.  Chain k gets iov[k * n_iov] (and flags[k * n_iov]) and
+ * may use up to n_iov entries.
+ *
+ * Returns the number of chains taken, or -1 if the first one is
+ * invalid.  A later invalid chain ends the batch early.
+ */
+int
+vq_getchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains,
+		   int nchains, struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	uint16_t avail_idx = 0;
+	uint16_t *cflags;
+	int i, n;
+
+	if (!vq_ring_ready(vq))
+		return 0;
+
+	if (!vq_is_packed(vq))
+		avail_idx = vq->avail->idx;
+
+	for (i = 0; i < nchains; i++) {
+		cflags = flags ? &flags[i * n_iov] : NULL;
+		if (vq_is_packed(vq))
+			n = vq_getchain_packed(vq, &chains[i].idx,
+					       &iov[i * n_iov], n_iov, cflags);
+		else
+			n = _vq_getchain(vq, &chains[i].idx, &iov[i * n_iov],
+					 n_iov, cflags, avail_idx);
+		if (n <= 0) {
+			if (n < 0 && i == 0)
+				i = -1;
+			break;
+		}
+
+		chains[i].iov = &iov[i * n_iov];
+		chains[i].flags = cflags;
+		chains[i].niov = n;
+		chains[i].len = 0;
+	}
+	vq_update_avail_event(vq);
+
+	return i;
+}
+
 /*
  * Return the currently-first request chain back to the available queue.
  *
@@ -588,7 +938,44 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
-	vq->last_avail--;
+	uint16_t ndesc;
+
+	if (vq_is_packed(vq)) {
+		ndesc = vq->chain_hist[--vq->nchains % vq->qsize];
+		if (vq->last_avail < ndesc) {
+			vq->last_avail += vq->qsize - ndesc;
+			vq->avail_wrap = !vq->avail_wrap;
+		} else
+			vq->last_avail -= ndesc;
+	} else
+		vq->last_avail--;
+	vq_update_avail_event(vq);
+}
+
+/*
+ * vq_relchain() for a packed ring: write the used descriptor at
+ * used_idx, flags last so the driver never sees a half written one,
+ * and skip the ring slots the buffer occupied.  used_shadow.idx counts
+ * the used buffers for vq_endchains().
+ */
+static void
+vq_relchain_packed(struct virtio_vq_info *vq, uint16_t id, uint32_t iolen)
+{
+	volatile struct vring_packed_desc *pd;
+
+	pd = &vq->pdesc[vq->used_idx];
+	pd->id = id;
+	pd->len = iolen;
+	pd->flags = vq->used_wrap ? ((1 << VRING_PACKED_DESC_F_AVAIL) |
+				     (1 << VRING_PACKED_DESC_F_USED)) : 0;
+
+	vq->used_idx += vq->chain_ndesc[id];
+	if (vq->used_idx >= vq->qsize) {
+		vq->used_idx -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+	vq->used_shadow.idx++;
+	vq_mark_dirty(vq);
 }
 
 /*
@@ -615,6 +1002,11 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (vq_is_packed(vq)) {
+		vq_relchain_packed(vq, idx, iolen);
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
@@ -623,6 +1015,93 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vue->id = idx;
 	vue->len = iolen;
 	vuh->idx = uidx;
+	vq_mark_dirty(vq);
+}
+
+/*
+ * Like vq_relchain(), but only fill in the used ring entry; the used
+ * index is left alone until vq_relchain_publish() so that a batch of
+ * chains becomes visible to the guest with a single index update.
+ */
+void
+vq_relchain_prepare(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
+{
+	uint16_t uidx, mask;
+	volatile struct vring_used *vuh;
+	volatile struct vring_used_elem *vue;
+
+	/* a packed used descriptor is published by its own flags */
+	if (vq_is_packed(vq)) {
+		vq_relchain_packed(vq, idx, iolen);
+		return;
+	}
+
+	mask = vq->qsize - 1;
+	vuh = vq->used;
+
+	uidx = vuh->idx + vq->used_pending++;
+	vue = &vuh->ring[uidx & mask];
+	vue->id = idx;
+	vue->len = iolen;
+}
+
+/*
+ * Publish the entries filled in by vq_relchain_prepare().
+ */
+void
+vq_relchain_publish(struct virtio_vq_info *vq)
+{
+	if (vq->used_pending == 0)
+		return;
+
+	/* the ring entries must be visible before the new index */
+	atomic_thread_fence();
+	vq->used->idx += vq->used_pending;
+	vq->used_pending = 0;
+	vq_mark_dirty(vq);
+}
+
+/*
+ * Return a batch of chains taken with vq_getchains_batch(), each with
+ * the length in its len field, publishing the used index once.
+ */
+void
+vq_relchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		vq_relchain_prepare(vq, chains[i].idx, chains[i].len);
+	vq_relchain_publish(vq);
+}
+
+/*
+ * Interrupt decision for a packed ring, from the driver event area:
+ * always, never, or once the used descriptors cross the one named by
+ * off_wrap (VIRTIO_RING_F_EVENT_IDX only).
+ */
+static int
+vq_packed_need_intr(struct virtio_vq_info *vq, int used)
+{
+	uint16_t flags, off_wrap, new_idx, old_idx;
+	int off;
+
+	flags = vq->driver_event->flags;
+	off_wrap = vq->driver_event->off_wrap;
+
+	old_idx = vq->save_used_idx;
+	vq->save_used_idx = new_idx = vq->used_idx;
+
+	if (!used || flags == VRING_PACKED_EVENT_FLAG_DISABLE)
+		return 0;
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC)
+		return 1;
+
+	off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if (!!(off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->used_wrap)
+		off -= vq->qsize;
+
+	return (uint16_t)(new_idx - off - 1) < (uint16_t)(new_idx - old_idx);
 }
 
 /*
@@ -665,7 +1144,9 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	base = vq->base;
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
-	if (used_all_avail &&
+	if (vq_is_packed(vq))
+		intr = vq_packed_need_intr(vq, new_idx != old_idx);
+	else if (used_all_avail &&
 	    (base->negotiated_caps & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)))
 		intr = 1;
 	else if (base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX)) {
@@ -706,6 +1187,8 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 		return;
 
 	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	vq_mark_dirty(vq);
+	vq_update_avail_event(vq);
 }
 
 struct config_reg {
@@ -1146,6 +1629,8 @@ virtio_set_modern_mmio_bar(struct virtio_base *base, int barnum)
 	}
 
 	/* allocate and register modern memory bar */
+	pci_emul_set_bar_posted(base->dev, barnum, VIRTIO_CAP_NOTIFY_OFFSET,
+				VIRTIO_CAP_NOTIFY_SIZE);
 	rc = pci_emul_alloc_bar(base->dev, barnum, PCIBAR_MEM64,
 				VIRTIO_MODERN_MEM_BAR_SIZE);
 	if (rc != 0) {
@@ -1191,6 +1676,7 @@ virtio_set_modern_pio_bar(struct virtio_base *base, int barnum)
 	}
 
 	/* allocate and register modern pio bar */
+	pci_emul_set_bar_posted(base->dev, barnum, 0, 4);
 	rc = pci_emul_alloc_bar(base->dev, barnum, PCIBAR_IO, 4);
 	if (rc != 0) {
 		pr_err("allocate and register modern pio bar failed\n");
@@ -1234,6 +1720,137 @@ virtio_set_modern_bar(struct virtio_base *base, bool use_notify_pio)
 	return rc;
 }
 
+int
+virtio_set_shm_region(struct virtio_base *base, int barnum, uint8_t shmid,
+		      uint64_t size)
+{
+	struct virtio_pci_cap64 shm = {
+		.cap.cap_vndr = PCIY_VENDOR,
+		.cap.cap_next = 0,
+		.cap.cap_len = sizeof(shm),
+		.cap.cfg_type = VIRTIO_PCI_CAP_SHARED_MEMORY_CFG,
+		.cap.bar = barnum,
+		.cap.id = shmid,
+		.cap.offset = 0,
+		.cap.length = (uint32_t)size,
+		.offset_hi = 0,
+		.length_hi = (uint32_t)(size >> 32),
+	};
+	int rc;
+
+	if ((base->device_caps & (1UL << VIRTIO_F_VERSION_1)) == 0)
+		return -1;
+
+	rc = pci_emul_add_capability(base->dev, (u_char *)&shm, sizeof(shm));
+	if (rc != 0) {
+		pr_err("pci emulation add shared memory capability failed\n");
+		return -1;
+	}
+
+	rc = pci_emul_alloc_bar(base->dev, barnum, PCIBAR_MEM64, size);
+	if (rc != 0) {
+		pr_err("allocate and register shared memory bar failed\n");
+		return -1;
+	}
+	base->shm_bars |= 1U << barnum;
+
+	return 0;
+}
+
+int
+virtio_shm_init(struct virtio_shm *shm, struct virtio_base *base, int barnum,
+		uint8_t shmid, uint64_t size)
+{
+	shm->addr = mmap(NULL, size, PROT_NONE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (shm->addr == MAP_FAILED) {
+		pr_err("%s: no address space for the shared memory region\n",
+		       base->vops->name);
+		shm->addr = NULL;
+		return -1;
+	}
+	shm->base = base;
+	shm->barnum = barnum;
+	shm->size = size;
+
+	if (virtio_set_shm_region(base, barnum, shmid, size) != 0) {
+		munmap(shm->addr, size);
+		shm->addr = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* of the ranges mapped */
+#define VIRTIO_SHM_ALIGN	4096UL
+
+static bool
+virtio_shm_range_valid(struct virtio_shm *shm, uint64_t offset, uint64_t len)
+{
+	return shm->addr != NULL && offset < shm->size &&
+	       len <= shm->size - offset &&
+	       ((offset | len) & (VIRTIO_SHM_ALIGN - 1)) == 0;
+}
+
+/*
+ * Put the anonymous reservation back at a range and take it out of the
+ * EPT, the guest accesses to it then go to the BAR handlers.
+ */
+int
+virtio_shm_unmap(struct virtio_shm *shm, uint64_t offset, uint64_t len)
+{
+	struct pci_vdev *dev = shm->base->dev;
+	void *addr;
+
+	if (!virtio_shm_range_valid(shm, offset, len))
+		return -EINVAL;
+
+	addr = shm->addr + offset;
+	vm_unmap_memseg_vma(dev->vmctx, len, dev->bar[shm->barnum].addr + offset,
+			    (uint64_t)addr, PROT_RW);
+	if (mmap(addr, len, PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+		 -1, 0) == MAP_FAILED)
+		return -errno;
+	return 0;
+}
+
+int
+virtio_shm_map(struct virtio_shm *shm, int fd, uint64_t fd_offset,
+	       uint64_t offset, uint64_t len, int prot)
+{
+	struct pci_vdev *dev = shm->base->dev;
+	uint64_t gpa;
+	void *addr;
+
+	if (!virtio_shm_range_valid(shm, offset, len))
+		return -EINVAL;
+
+	addr = shm->addr + offset;
+	gpa = dev->bar[shm->barnum].addr + offset;
+	/* the EPT may still have the pages of a previous mapping */
+	vm_unmap_memseg_vma(dev->vmctx, len, gpa, (uint64_t)addr, PROT_RW);
+	if (mmap(addr, len, prot, MAP_SHARED | MAP_FIXED, fd,
+		 fd_offset) == MAP_FAILED)
+		return -errno;
+	if (vm_map_memseg_vma(dev->vmctx, len, gpa, (uint64_t)addr, prot) < 0) {
+		virtio_shm_unmap(shm, offset, len);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+void
+virtio_shm_deinit(struct virtio_shm *shm)
+{
+	if (shm->addr == NULL)
+		return;
+
+	virtio_shm_unmap(shm, 0, shm->size);
+	munmap(shm->addr, shm->size);
+	shm->addr = NULL;
+}
+
 static struct cap_region {
 	uint64_t	cap_offset;	/* offset of capability region */
 	int		cap_size;	/* size of capability region */
@@ -1816,6 +2433,10 @@ virtio_pci_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		return virtio_pci_modern_pio_read(ctx, vcpu, dev, baridx,
 			offset, size);
 
+	/* the pages of a shared memory region not mapped into the guest */
+	if (base->shm_bars & (1U << baridx))
+		return size == 1 ? 0xff : size == 2 ? 0xffff : 0xffffffff;
+
 	pr_err("%s: read unexpected baridx %d\r\n",
 		base->vops->name, baridx);
 	return size == 1 ? 0xff : size == 2 ? 0xffff : 0xffffffff;
@@ -1869,10 +2490,65 @@ virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		return;
 	}
 
+	if (base->shm_bars & (1U << baridx))
+		return;
+
 	pr_err("%s: write unexpected baridx %d\r\n",
 		base->vops->name, baridx);
 }
 
+void
+virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_ops *vops = base->vops;
+
+	if (base->mtx)
+		pthread_mutex_lock(base->mtx);
+
+	base->status = 0;
+	if (vops->set_status)
+		(*vops->set_status)(DEV_STRUCT(base), 0);
+	if (vops->reset)
+		(*vops->reset)(DEV_STRUCT(base));
+	else
+		virtio_reset_dev(base);
+
+	if (base->mtx)
+		pthread_mutex_unlock(base->mtx);
+}
+
+int
+virtio_get_vq_depths(struct pci_vdev *dev, uint16_t *depth, int nr)
+{
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+	int i;
+
+	if (dev->dev_ops->vdev_barread != virtio_pci_read)
+		return -1;
+
+	base = dev->arg;
+	if (nr > base->vops->nvq)
+		nr = base->vops->nvq;
+
+	if (base->mtx)
+		pthread_mutex_lock(base->mtx);
+	for (i = 0; i < nr; i++) {
+		vq = &base->queues[i];
+		if (!vq_ring_ready(vq))
+			depth[i] = 0;
+		else if (vq_is_packed(vq))
+			depth[i] = VQ_DEPTH_UNKNOWN;
+		else
+			depth[i] = (uint16_t)(vq->avail->idx - vq->last_avail);
+	}
+	if (base->mtx)
+		pthread_mutex_unlock(base->mtx);
+
+	return nr;
+}
+
 /**
  * @brief Get the virtio poll parameters
  *
@@ -1895,3 +2571,150 @@ acrn_parse_virtio_poll_interval(const char *optarg)
 
 	return 0;
 }
+
+/**
+ * @brief Bind an eventfd to the notify register of a virtqueue.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param idx Index of the virtqueue.
+ * @param fd The eventfd to be signalled.
+ * @param assign Whether to add or remove the binding.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int
+virtio_vq_set_ioeventfd(struct virtio_base *base, int idx, int fd,
+			bool assign)
+{
+	struct acrn_ioeventfd ioeventfd = {0};
+	struct pcibar *bar;
+	int rc;
+
+	if (!assign)
+		ioeventfd.flags = ACRN_IOEVENTFD_FLAG_DEASSIGN;
+
+	if (base->device_caps & (1UL << VIRTIO_F_VERSION_1)) {
+		/*
+		 * in the current implementation, if virtio 1.0 with pio
+		 * notity, its bar idx should be set to non-zero
+		 */
+		if (base->modern_pio_bar_idx) {
+			bar = &base->dev->bar[base->modern_pio_bar_idx];
+			ioeventfd.data = idx;
+			ioeventfd.addr = bar->addr;
+			ioeventfd.len = 2;
+			ioeventfd.flags |= (ACRN_IOEVENTFD_FLAG_DATAMATCH |
+				ACRN_IOEVENTFD_FLAG_PIO);
+		} else if (base->modern_mmio_bar_idx) {
+			bar = &base->dev->bar[base->modern_mmio_bar_idx];
+			ioeventfd.data = 0;
+			ioeventfd.addr = bar->addr + VIRTIO_CAP_NOTIFY_OFFSET
+				+ idx * VIRTIO_MODERN_NOTIFY_OFF_MULT;
+			ioeventfd.len = 2;
+			/* no additional flag bit should be set for MMIO */
+		} else {
+			pr_err("%s: invalid virtio 1.0 parameters, 0x%lx\n",
+				base->vops->name, base->device_caps);
+			return -1;
+		}
+	} else {
+		bar = &base->dev->bar[base->legacy_pio_bar_idx];
+		ioeventfd.data = idx;
+		ioeventfd.addr = bar->addr + VIRTIO_PCI_QUEUE_NOTIFY;
+		ioeventfd.len = 2;
+		ioeventfd.flags |= (ACRN_IOEVENTFD_FLAG_DATAMATCH |
+			ACRN_IOEVENTFD_FLAG_PIO);
+	}
+	ioeventfd.fd = fd;
+
+	/*
+	 * Ask for the write to be completed in the hypervisor first. Older
+	 * SOS kernels do not know the flag, fall back to the ioreq path then.
+	 */
+	ioeventfd.flags |= ACRN_IOEVENTFD_FLAG_HV_KICK;
+	rc = vm_ioeventfd(base->dev->vmctx, &ioeventfd);
+	if (rc < 0 && errno == EINVAL) {
+		ioeventfd.flags &= ~ACRN_IOEVENTFD_FLAG_HV_KICK;
+		rc = vm_ioeventfd(base->dev->vmctx, &ioeventfd);
+	}
+	if (rc < 0)
+		pr_err("%s: ioeventfd of queue %d failed, errno = %d\n",
+			base->vops->name, idx, errno);
+
+	return rc;
+}
+
+static void
+virtio_vq_kick_handler(int fd, enum ev_type t, void *arg)
+{
+	struct virtio_vq_info *vq = arg;
+	struct virtio_base *base = vq->base;
+	uint64_t cnt;
+
+	if (read(fd, &cnt, sizeof(cnt)) != sizeof(cnt))
+		return;
+
+	/* serialized with the BAR accesses, as a notify by the ioreq path */
+	if (base->mtx)
+		pthread_mutex_lock(base->mtx);
+	if (vq->notify)
+		(*vq->notify)(DEV_STRUCT(base), vq);
+	else if (base->vops->qnotify)
+		(*base->vops->qnotify)(DEV_STRUCT(base), vq);
+	if (base->mtx)
+		pthread_mutex_unlock(base->mtx);
+}
+
+/**
+ * @brief Handle the notifies of a virtqueue through an eventfd.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int
+virtio_vq_kick_start(struct virtio_vq_info *vq)
+{
+	int fd;
+
+	if (vq->kick_mevp)
+		return 0;
+
+	fd = eventfd(0, EFD_NONBLOCK);
+	if (fd < 0)
+		return -1;
+
+	if (virtio_vq_set_ioeventfd(vq->base, vq->num, fd, true) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	vq->kick_fd = fd;
+	vq->kick_mevp = mevent_add(fd, EVF_READ, virtio_vq_kick_handler, vq,
+			NULL, NULL);
+	if (!vq->kick_mevp) {
+		virtio_vq_set_ioeventfd(vq->base, vq->num, fd, false);
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Stop handling the notifies of a virtqueue through an eventfd.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void
+virtio_vq_kick_stop(struct virtio_vq_info *vq)
+{
+	if (!vq->kick_mevp)
+		return;
+
+	virtio_vq_set_ioeventfd(vq->base, vq->num, vq->kick_fd, false);
+	mevent_delete_close(vq->kick_mevp);
+	vq->kick_mevp = NULL;
+}
@@ -27,6 +27,7 @@
 #include "virtio_kernel.h"
 #include "vmmapi.h"			/* for vmctx */
 #include "log.h"
+#include "dm_string.h"
 
 /*
  * Size of queue was chosen experimentaly in a way
@@ -36,6 +37,14 @@
  */
 #define VIRTIO_AUDIO_RINGSZ	1024
 
+/*
+ * The PCM queues may be made deeper with the qsize=<n> option, for the guest
+ * to keep more periods posted ahead: a busy SOS then catches up on them
+ * instead of running into an xrun.
+ */
+#define VIRTIO_AUDIO_MIN_RINGSZ	64
+#define VIRTIO_AUDIO_MAX_RINGSZ	8192
+
 /*
  * Queue definitions.
  * Audio mediator uses two queues: one for interrupt and the other for messages.
@@ -276,14 +285,57 @@ virtio_audio_k_set_status(void *base, uint64_t status)
 	}
 }
 
+static int
+virtio_audio_parse_opts(char *opts, int *pcm_qsize)
+{
+	char *cpy, *vtopts, *opt;
+	int rc = 0;
+
+	if (opts == NULL)
+		return 0;
+
+	cpy = vtopts = strdup(opts);
+	if (cpy == NULL) {
+		WPRINTF(("virtio_audio: strdup returns NULL\n"));
+		return -1;
+	}
+
+	while ((opt = strsep(&vtopts, ",")) != NULL) {
+		if (!strncmp(opt, "qsize=", 6)) {
+			if (dm_strtoi(opt + 6, NULL, 10, pcm_qsize)
+			    || *pcm_qsize < VIRTIO_AUDIO_MIN_RINGSZ
+			    || *pcm_qsize > VIRTIO_AUDIO_MAX_RINGSZ
+			    || (*pcm_qsize & (*pcm_qsize - 1)) != 0) {
+				pr_err("Invalid queue size %s, a power of 2 "
+				       "in %d-%d\n", opt + 6,
+				       VIRTIO_AUDIO_MIN_RINGSZ,
+				       VIRTIO_AUDIO_MAX_RINGSZ);
+				rc = -1;
+				break;
+			}
+		} else if (*opt != '\0') {
+			pr_err("virtio_audio: unknown option %s\n", opt);
+			rc = -1;
+			break;
+		}
+	}
+
+	free(cpy);
+	return rc;
+}
+
 static int
 virtio_audio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_audio *virt_audio;
 
 	pthread_mutexattr_t attr;
+	int pcm_qsize = VIRTIO_AUDIO_RINGSZ;
 	int rc;
 
+	if (virtio_audio_parse_opts(opts, &pcm_qsize) < 0)
+		return -1;
+
 	virt_audio = calloc(1, sizeof(struct virtio_audio));
 	if (!virt_audio) {
 		WPRINTF(("virtio_audio: calloc returns NULL\n"));
@@ -330,11 +382,11 @@ virtio_audio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	virt_audio->vbs_k.kstatus = VIRTIO_DEV_INIT_SUCCESS;
 	virt_audio->base.mtx = &virt_audio->mtx;
 
-	/* vq[0] and vq[1] are for interrupt and messages */
+	/* vq[0] and vq[1] are for interrupt and messages, vq[2] and vq[3] for PCM */
 	virt_audio->vq[0].qsize = VIRTIO_AUDIO_RINGSZ;
 	virt_audio->vq[1].qsize = VIRTIO_AUDIO_RINGSZ;
-	virt_audio->vq[2].qsize = VIRTIO_AUDIO_RINGSZ;
-	virt_audio->vq[3].qsize = VIRTIO_AUDIO_RINGSZ;
+	virt_audio->vq[2].qsize = pcm_qsize;
+	virt_audio->vq[3].qsize = pcm_qsize;
 
 	/* initialize config space */
 	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_AUDIO);
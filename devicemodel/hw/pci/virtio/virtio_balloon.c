@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Virtio memory balloon
+ *
+ * The guest inflates the balloon with the 4K pages it gives up and deflates
+ * it before it uses them again (VIRTIO_BALLOON_F_MUST_TELL_HOST). Once all
+ * the pages of a 2M block are in the balloon, the block is unmapped from the
+ * guest and its huge page is freed in the service OS. With free page
+ * reporting, the guest also reports the 2M blocks it has free, which are
+ * given back the same way and that it may use again without telling: the
+ * hypervisor then sends the faulting access as a REQ_RECLAIMED request and
+ * the block is mapped back to a new huge page before the access is retried.
+ *
+ * The size of the balloon is set by the "acrnctl balloon" command.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vmmapi.h"
+#include "monitor.h"
+#include "dm_string.h"
+
+#define	VIRTIO_BALLOON_RINGSZ	64
+
+/* the reports have up to 32 ranges in Linux */
+#define	VIRTIO_BALLOON_MAXSEGS	32
+
+/*
+ * Host capabilities
+ */
+#define	VIRTIO_BALLOON_F_MUST_TELL_HOST	(1 << 0)
+#define	VIRTIO_BALLOON_F_DEFLATE_ON_OOM	(1 << 2)
+#define	VIRTIO_BALLOON_F_REPORTING	(1 << 5)
+
+#define	VIRTIO_BALLOON_S_HOSTCAPS	(VIRTIO_BALLOON_F_MUST_TELL_HOST | \
+					 VIRTIO_BALLOON_F_DEFLATE_ON_OOM)
+
+/* the balloon always deals with 4K pages, whatever the guest page size */
+#define	VIRTIO_BALLOON_PFN_SHIFT	12
+#define	VIRTIO_BALLOON_BLOCK_PAGES	\
+	(HUGETLB_RECLAIM_SIZE >> VIRTIO_BALLOON_PFN_SHIFT)
+
+enum {
+	VIRTIO_BALLOON_INFLATEQ,
+	VIRTIO_BALLOON_DEFLATEQ,
+	VIRTIO_BALLOON_REPORTQ,	/* only if VIRTIO_BALLOON_F_REPORTING */
+	VIRTIO_BALLOON_MAXQ
+};
+
+struct virtio_balloon_config {
+	uint32_t num_pages;	/* number of pages the host wants */
+	uint32_t actual;	/* number of pages in the balloon */
+} __attribute__((packed));
+
+struct virtio_balloon {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_BALLOON_MAXQ];
+	pthread_mutex_t mtx;
+	struct virtio_balloon_config cfg;
+	struct vmctx *ctx;
+	bool report;		/* offer free page reporting */
+	bool reclaim;		/* give the memory back to the service OS */
+	uint64_t npages;	/* pages of guest physical address space */
+	uint64_t *inflated;	/* one bit per page in the balloon */
+};
+
+static int virtio_balloon_debug;
+#define DPRINTF(params) do { if (virtio_balloon_debug) pr_dbg params; } while (0)
+#define WPRINTF(params) (pr_err params)
+
+/* there is one balloon at most, changed by the monitor */
+static struct virtio_balloon *balloon_dev;
+
+static void virtio_balloon_reset(void *);
+static void virtio_balloon_notify(void *, struct virtio_vq_info *);
+static int virtio_balloon_cfgread(void *, int, int, uint32_t *);
+static int virtio_balloon_cfgwrite(void *, int, int, uint32_t);
+
+static struct virtio_ops virtio_balloon_ops = {
+	"virtio_balloon",		/* our name */
+	VIRTIO_BALLOON_MAXQ,		/* we support 3 virtqueues */
+	sizeof(struct virtio_balloon_config), /* config reg size */
+	virtio_balloon_reset,		/* reset */
+	virtio_balloon_notify,		/* device-wide qnotify */
+	virtio_balloon_cfgread,		/* read virtio config */
+	virtio_balloon_cfgwrite,	/* write virtio config */
+	NULL,				/* apply negotiated features */
+	NULL,				/* called on guest set status */
+};
+
+static struct monitor_vm_ops virtio_balloon_monitor_ops = {
+	.balloon = vm_monitor_balloon,
+};
+
+static int
+is_passthru_dev(struct pci_vdev *dev, void *arg)
+{
+	return strcmp(dev->dev_ops->class_name, "passthru") == 0;
+}
+
+static void
+virtio_balloon_reset(void *vdev)
+{
+	struct virtio_balloon *bln = vdev;
+
+	DPRINTF(("virtio_balloon: device reset requested !\n"));
+	virtio_reset_dev(&bln->base);
+
+	/*
+	 * The guest owns all its memory again. What has been reclaimed is
+	 * mapped back as the guest touches it.
+	 */
+	memset(bln->inflated, 0, roundup2(bln->npages, 64) / 8);
+	bln->cfg.actual = 0;
+
+	/*
+	 * A passthrough device would DMA through the unmapped memory, they are
+	 * all set up by the time the guest driver resets the balloon.
+	 */
+	bln->reclaim = (pci_walk_vdevs(is_passthru_dev, NULL) == 0);
+	if (bln->report && bln->reclaim)
+		bln->base.device_caps |= VIRTIO_BALLOON_F_REPORTING;
+	else
+		bln->base.device_caps &= ~VIRTIO_BALLOON_F_REPORTING;
+}
+
+static bool
+block_is_inflated(struct virtio_balloon *bln, uint64_t block)
+{
+	uint64_t *bits = &bln->inflated[block * VIRTIO_BALLOON_BLOCK_PAGES / 64];
+	int i;
+
+	for (i = 0; i < VIRTIO_BALLOON_BLOCK_PAGES / 64; i++) {
+		if (bits[i] != ~0UL)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+virtio_balloon_reclaim(struct virtio_balloon *bln, vm_paddr_t gpa)
+{
+	/* only RAM is given back, not the high BIOS region */
+	if (!bln->reclaim ||
+	    vm_map_gpa(bln->ctx, gpa, HUGETLB_RECLAIM_SIZE) == NULL)
+		return;
+
+	if (hugetlb_reclaim_memory(bln->ctx, gpa, HUGETLB_RECLAIM_SIZE))
+		DPRINTF(("virtio_balloon: 0x%lx not reclaimed\n", gpa));
+}
+
+static void
+virtio_balloon_pfns(struct virtio_balloon *bln, struct iovec *iov,
+		    bool inflate)
+{
+	uint32_t *pfns = iov->iov_base;
+	uint64_t pfn, block;
+	size_t i;
+
+	for (i = 0; i < iov->iov_len / sizeof(uint32_t); i++) {
+		pfn = pfns[i];
+		if (pfn >= bln->npages) {
+			WPRINTF(("virtio_balloon: invalid pfn 0x%lx\n", pfn));
+			continue;
+		}
+
+		block = pfn / VIRTIO_BALLOON_BLOCK_PAGES;
+		if (inflate) {
+			bln->inflated[pfn / 64] |= 1UL << (pfn % 64);
+			if (block_is_inflated(bln, block))
+				virtio_balloon_reclaim(bln,
+					block * HUGETLB_RECLAIM_SIZE);
+		} else {
+			/* the guest uses the page as soon as it's acked */
+			if (block_is_inflated(bln, block) &&
+			    hugetlb_is_reclaimed(block * HUGETLB_RECLAIM_SIZE) &&
+			    hugetlb_restore_memory(bln->ctx,
+				block * HUGETLB_RECLAIM_SIZE,
+				HUGETLB_RECLAIM_SIZE))
+				WPRINTF(("virtio_balloon: failed to map back "
+					"pfn 0x%lx\n", pfn));
+			bln->inflated[pfn / 64] &= ~(1UL << (pfn % 64));
+		}
+	}
+}
+
+static void
+virtio_balloon_report(struct virtio_balloon *bln, struct iovec *iov)
+{
+	vm_paddr_t gpa, end;
+
+	/* the reported range is mapped at the same offset as guest memory */
+	gpa = (char *)iov->iov_base - (char *)bln->ctx->baseaddr;
+	end = ALIGN_DOWN(gpa + iov->iov_len, HUGETLB_RECLAIM_SIZE);
+
+	for (gpa = roundup2(gpa, HUGETLB_RECLAIM_SIZE); gpa < end;
+	     gpa += HUGETLB_RECLAIM_SIZE)
+		virtio_balloon_reclaim(bln, gpa);
+}
+
+static void
+virtio_balloon_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	struct virtio_balloon *bln = vdev;
+	struct iovec iov[VIRTIO_BALLOON_MAXSEGS];
+	uint16_t idx;
+	int i, n;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_BALLOON_MAXSEGS, NULL);
+		if (n <= 0) {
+			WPRINTF(("virtio_balloon: invalid descriptors\n"));
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (vq == &bln->queues[VIRTIO_BALLOON_REPORTQ])
+				virtio_balloon_report(bln, &iov[i]);
+			else
+				virtio_balloon_pfns(bln, &iov[i],
+					vq == &bln->queues[VIRTIO_BALLOON_INFLATEQ]);
+		}
+
+		vq_relchain(vq, idx, 0);
+	}
+
+	vq_endchains(vq, 1);
+}
+
+static int
+virtio_balloon_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_balloon *bln = vdev;
+	void *ptr;
+
+	/* our caller has already verified offset and size */
+	ptr = (uint8_t *)&bln->cfg + offset;
+	memcpy(retval, ptr, size);
+	return 0;
+}
+
+static int
+virtio_balloon_cfgwrite(void *vdev, int offset, int size, uint32_t value)
+{
+	struct virtio_balloon *bln = vdev;
+	void *ptr;
+
+	if (offset >= offsetof(struct virtio_balloon_config, actual)) {
+		ptr = (uint8_t *)&bln->cfg + offset;
+		memcpy(ptr, &value, size);
+		return 0;
+	}
+
+	DPRINTF(("virtio_balloon: write to readonly reg %d\n", offset));
+	return -1;
+}
+
+/*
+ * Set the size the guest is asked to inflate the balloon to, devargs is
+ * the size in MB.
+ */
+int
+vm_monitor_balloon(void *arg, char *devargs)
+{
+	struct vmctx *ctx = arg;
+	struct virtio_balloon *bln = balloon_dev;
+	unsigned long size;
+
+	if (bln == NULL) {
+		pr_err("No virtio-balloon device\n");
+		return -1;
+	}
+
+	if (dm_strtoul(devargs, NULL, 10, &size) ||
+	    size * MB > ctx->lowmem + ctx->highmem) {
+		pr_err("Invalid balloon size %s\n", devargs);
+		return -1;
+	}
+
+	VIRTIO_BASE_LOCK((&bln->base));
+	bln->cfg.num_pages = size * (MB >> VIRTIO_BALLOON_PFN_SHIFT);
+	VIRTIO_BASE_UNLOCK((&bln->base));
+
+	virtio_config_changed(&bln->base);
+	return 0;
+}
+
+static int
+virtio_balloon_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *bln;
+	pthread_mutexattr_t attr;
+	char *opt;
+	int i, rc;
+
+	if (balloon_dev) {
+		WPRINTF(("virtio_balloon: only one balloon is supported\n"));
+		return -1;
+	}
+
+	bln = calloc(1, sizeof(struct virtio_balloon));
+	if (!bln) {
+		WPRINTF(("virtio_balloon: calloc returns NULL\n"));
+		return -1;
+	}
+
+	bln->report = true;
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strcmp(opt, "noreport"))
+			bln->report = false;
+		else if (*opt)
+			WPRINTF(("virtio_balloon: unknown option %s\n", opt));
+	}
+
+	bln->ctx = ctx;
+	if (ctx->highmem > 0)
+		bln->npages = (ctx->highmem_gpa_base + ctx->highmem) >>
+			VIRTIO_BALLOON_PFN_SHIFT;
+	else
+		bln->npages = ctx->lowmem >> VIRTIO_BALLOON_PFN_SHIFT;
+	bln->inflated = calloc(roundup2(bln->npages, 64) / 64,
+			sizeof(uint64_t));
+	if (!bln->inflated) {
+		WPRINTF(("virtio_balloon: calloc returns NULL\n"));
+		goto fail;
+	}
+
+	/* init mutex attribute properly to avoid deadlock */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		DPRINTF(("mutexattr init failed with erro %d!\n", rc));
+	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (rc)
+		DPRINTF(("mutexattr_settype failed with error %d!\n", rc));
+	rc = pthread_mutex_init(&bln->mtx, &attr);
+	if (rc)
+		DPRINTF(("mutex init failed with error %d!\n", rc));
+
+	virtio_linkup(&bln->base, &virtio_balloon_ops, bln, dev, bln->queues,
+		      BACKEND_VBSU);
+	bln->base.mtx = &bln->mtx;
+	bln->base.device_caps = VIRTIO_BALLOON_S_HOSTCAPS;
+	if (bln->report)
+		bln->base.device_caps |= VIRTIO_BALLOON_F_REPORTING;
+
+	for (i = 0; i < VIRTIO_BALLOON_MAXQ; i++)
+		bln->queues[i].qsize = VIRTIO_BALLOON_RINGSZ;
+
+	/* initialize config space */
+	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+
+	if (virtio_interrupt_init(&bln->base, virtio_uses_msix())) {
+		pthread_mutex_destroy(&bln->mtx);
+		goto fail;
+	}
+
+	virtio_set_io_bar(&bln->base, 0);
+
+	if (monitor_register_vm_ops(&virtio_balloon_monitor_ops, ctx,
+				    "virtio_balloon") < 0)
+		pr_err("Balloon registration to VM monitor failed\n");
+
+	balloon_dev = bln;
+	return 0;
+
+fail:
+	free(bln->inflated);
+	free(bln);
+	return -1;
+}
+
+static void
+virtio_balloon_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *bln;
+
+	bln = dev->arg;
+	if (bln == NULL) {
+		DPRINTF(("%s: bln is NULL\n", __func__));
+		return;
+	}
+
+	balloon_dev = NULL;
+	pthread_mutex_destroy(&bln->mtx);
+	free(bln->inflated);
+	free(bln);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_virtio_balloon = {
+	.class_name	= "virtio-balloon",
+	.vdev_init	= virtio_balloon_init,
+	.vdev_deinit	= virtio_balloon_deinit,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_balloon);
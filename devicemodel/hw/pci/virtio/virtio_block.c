@@ -35,13 +35,17 @@
 #include <openssl/md5.h>
 
 #include "dm.h"
+#include "vmmapi.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "vhost.h"
 #include "block_if.h"
 #include "monitor.h"
+#include "dm_string.h"
 
 #define VIRTIO_BLK_RINGSZ	64
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
+#define VIRTIO_BLK_MAX_QUEUES	16
 
 #define VIRTIO_BLK_S_OK	0
 #define VIRTIO_BLK_S_IOERR	1
@@ -55,6 +59,7 @@
 #define	VIRTIO_BLK_F_BLK_SIZE	(1 << 6)	/* cfg block size valid */
 #define	VIRTIO_BLK_F_FLUSH	(1 << 9)	/* Cache flush support */
 #define	VIRTIO_BLK_F_TOPOLOGY	(1 << 10)	/* Optimal I/O alignment */
+#define	VIRTIO_BLK_F_MQ		(1 << 12)	/* Multiple virtqueues */
 
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
@@ -68,8 +73,19 @@
 	(VIRTIO_BLK_F_SEG_MAX |						    \
 	VIRTIO_BLK_F_BLK_SIZE |						    \
 	VIRTIO_BLK_F_TOPOLOGY |						    \
+	(1 << VIRTIO_RING_F_EVENT_IDX) |	/* event index */	    \
 	(1 << VIRTIO_RING_F_INDIRECT_DESC))	/* indirect descriptors */
 
+/*
+ * Capabilities offered with a vhost-user backend, which also decides
+ * about the writeback cache; WCE toggling is not forwarded.
+ */
+#define VIRTIO_BLK_S_VHOSTCAPS	\
+	(VIRTIO_BLK_S_HOSTCAPS |	\
+	VIRTIO_BLK_F_FLUSH |		\
+	VIRTIO_BLK_F_DISCARD |		\
+	VIRTIO_BLK_F_RO)
+
 /*
  * Writeback cache bits
  */
@@ -98,8 +114,8 @@ struct virtio_blk_config {
 	} topology;
 	uint8_t	writeback;
 	uint8_t unused;
-	/* Reserve for num_queues when VIRTIO_BLK_F_MQ is support*/
-	uint16_t reserve;
+	/* Number of virtqueues, valid when VIRTIO_BLK_F_MQ is negotiated */
+	uint16_t num_queues;
 	/* The maximum discard sectors (in 512-byte sectors) for one segment */
 	uint32_t max_discard_sectors;
 	/* The maximum number of discard segments */
@@ -138,6 +154,7 @@ static bool register_vm_monitor_blkrescan = false;
 
 static struct monitor_vm_ops virtio_blk_rescan_ops = {
 	.rescan	= vm_monitor_blkrescan,
+	.throttle = vm_monitor_blkthrottle,
 };
 
 struct virtio_blk_ioreq {
@@ -147,45 +164,64 @@ struct virtio_blk_ioreq {
 	uint16_t idx;
 };
 
+/*
+ * vhost-user backend, e.g. SPDK, serving the virtqueues directly
+ */
+struct vhost_blk {
+	struct vhost_dev vdev;
+	struct vhost_vq vqs[VIRTIO_BLK_MAX_QUEUES];
+};
+
 /*
  * Per-device struct
  */
 struct virtio_blk {
 	struct virtio_base base;
 	pthread_mutex_t mtx;
-	struct virtio_vq_info vq;
+	struct virtio_ops ops;	/* virtio_blk_ops with the number of virtqueues */
+	int num_vqs;
+	struct virtio_vq_info vqs[VIRTIO_BLK_MAX_QUEUES];
+	/* protects the used ring of each virtqueue against the completions */
+	pthread_mutex_t vq_mtx[VIRTIO_BLK_MAX_QUEUES];
 	struct virtio_blk_config cfg;
 	bool dummy_bctxt; /* Used in blockrescan. Indicate if the bctxt can be used */
 	struct blockif_ctxt *bc;
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+	struct virtio_blk_ioreq *ios;	/* VIRTIO_BLK_RINGSZ per virtqueue */
 	uint8_t original_wce;
+	struct vhost_blk *vhost;	/* vhost_user= backend, no blockif */
 };
 
 static void virtio_blk_reset(void *);
 static void virtio_blk_notify(void *, struct virtio_vq_info *);
 static int virtio_blk_cfgread(void *, int, int, uint32_t *);
 static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
+static void virtio_blk_set_status(void *, uint64_t);
 
 static struct virtio_ops virtio_blk_ops = {
 	"virtio_blk",		/* our name */
-	1,			/* we support 1 virtqueue */
+	1,			/* 1 virtqueue, or the mq= option */
 	sizeof(struct virtio_blk_config), /* config reg size */
 	virtio_blk_reset,	/* reset */
 	virtio_blk_notify,	/* device-wide qnotify */
 	virtio_blk_cfgread,	/* read PCI config */
 	virtio_blk_cfgwrite,	/* write PCI config */
 	NULL,			/* apply negotiated features */
-	NULL,			/* called on guest set status */
+	virtio_blk_set_status,	/* called on guest set status */
 };
 
 static void
 virtio_blk_reset(void *vdev)
 {
 	struct virtio_blk *blk = vdev;
+	int i;
 
 	DPRINTF(("virtio_blk: device reset requested !\n"));
+	for (i = 0; i < blk->num_vqs; i++)
+		pthread_mutex_lock(&blk->vq_mtx[i]);
 	virtio_reset_dev(&blk->base);
+	for (i = blk->num_vqs - 1; i >= 0; i--)
+		pthread_mutex_unlock(&blk->vq_mtx[i]);
 	/* Reset virtio-blk device only on valid bctxt*/
 	if (!blk->dummy_bctxt)
 		blockif_set_wce(blk->bc, blk->original_wce);
@@ -196,6 +232,7 @@ virtio_blk_done(struct blockif_req *br, int err)
 {
 	struct virtio_blk_ioreq *io = br->param;
 	struct virtio_blk *blk = io->blk;
+	struct virtio_vq_info *vq = &blk->vqs[br->qidx];
 
 	if (err)
 		DPRINTF(("virtio_blk: done with error = %d\n\r", err));
@@ -212,10 +249,10 @@ virtio_blk_done(struct blockif_req *br, int err)
 	 * Return the descriptor back to the host.
 	 * We wrote 1 byte (our status) to host.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	vq_relchain(&blk->vq, io->idx, 1);
-	vq_endchains(&blk->vq, !vq_has_descs(&blk->vq));
-	pthread_mutex_unlock(&blk->mtx);
+	pthread_mutex_lock(&blk->vq_mtx[br->qidx]);
+	vq_relchain(vq, io->idx, 1);
+	vq_endchains(vq, !vq_has_descs(vq));
+	pthread_mutex_unlock(&blk->vq_mtx[br->qidx]);
 }
 
 static void
@@ -256,7 +293,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
-	io = &blk->ios[idx];
+	io = &blk->ios[vq->num * VIRTIO_BLK_RINGSZ + idx];
 	if ((flags[0] & VRING_DESC_F_WRITE) != 0) {
 		WPRINTF(("%s: the type for hdr should not be VRING_DESC_F_WRITE\n", __func__));
 		virtio_blk_abort(vq, idx);
@@ -377,8 +414,31 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_blk *blk = vdev;
 
+	/* submit all the available requests at once */
+	if (!blk->dummy_bctxt)
+		blockif_plug(blk->bc, vq->num);
 	while (vq_has_descs(vq))
 		virtio_blk_proc(blk, vq);
+	if (!blk->dummy_bctxt)
+		blockif_unplug(blk->bc, vq->num);
+}
+
+/* The request buffers are all in the guest memory */
+static void
+virtio_blk_register_mem(struct vmctx *ctx, struct blockif_ctxt *bctxt)
+{
+	struct iovec mem[2];
+	int n = 0;
+
+	mem[n].iov_base = ctx->baseaddr;
+	mem[n++].iov_len = ctx->lowmem;
+	if (ctx->highmem > 0) {
+		mem[n].iov_base = ctx->baseaddr + ctx->highmem_gpa_base;
+		mem[n++].iov_len = ctx->highmem;
+	}
+
+	if (blockif_register_bufs(bctxt, mem, n) < 0)
+		WPRINTF(("virtio_blk: guest memory is not registered\n"));
 }
 
 static uint64_t
@@ -396,6 +456,9 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (blockif_is_ro(blk->bc))
 		caps |= VIRTIO_BLK_F_RO;
 
+	if (blk->num_vqs > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+
 	return caps;
 }
 
@@ -432,6 +495,112 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
+/*
+ * Get the number of virtqueues from the "mq=<num>" option, 1 if absent.
+ * Return -1 if the option is invalid.
+ */
+static int
+virtio_blk_parse_mq(const char *opts)
+{
+	char *nopt, *xopts, *cp;
+	int num_vqs = 1;
+
+	nopt = xopts = strdup(opts);
+	if (!nopt)
+		return -1;
+
+	/* skip the pathname */
+	strsep(&xopts, ",");
+	while ((cp = strsep(&xopts, ",")) != NULL) {
+		if (strncmp(cp, "mq=", strlen("mq=")))
+			continue;
+		if (dm_strtoi(cp + strlen("mq="), &cp, 10, &num_vqs) || *cp != '\0' ||
+				num_vqs < 1 || num_vqs > VIRTIO_BLK_MAX_QUEUES)
+			num_vqs = -1;
+		break;
+	}
+
+	free(nopt);
+	return num_vqs;
+}
+
+/*
+ * Connect to the vhost-user backend at path.  The config space and the
+ * features come from the backend, only the number of virtqueues is ours.
+ */
+static int
+virtio_blk_vhost_init(struct virtio_blk *blk, const char *path)
+{
+	struct vhost_blk *vhost;
+	uint64_t caps;
+	int fd;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0)
+		return -1;
+
+	vhost = calloc(1, sizeof(struct vhost_blk));
+	if (!vhost) {
+		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		close(fd);
+		return -1;
+	}
+	vhost->vdev.nvqs = blk->num_vqs;
+	vhost->vdev.vqs = vhost->vqs;
+	vhost->vdev.user = true;
+
+	caps = VIRTIO_BLK_S_VHOSTCAPS;
+	if (blk->num_vqs > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+	blk->base.device_caps = caps;
+
+	/* on failure vhost_dev_init() has closed fd */
+	if (vhost_dev_init(&vhost->vdev, &blk->base, fd, 0, caps, 0, 0) < 0) {
+		WPRINTF(("virtio_blk: vhost_dev_init failed\n"));
+		free(vhost);
+		return -1;
+	}
+
+	if (vhost_dev_get_config(&vhost->vdev, &blk->cfg,
+				 sizeof(blk->cfg)) < 0)
+		goto fail;
+
+	if (blk->num_vqs > 1 && blk->cfg.num_queues < blk->num_vqs) {
+		WPRINTF(("virtio_blk: vhost-user backend has %d queues\n",
+			 blk->cfg.num_queues));
+		goto fail;
+	}
+	blk->cfg.num_queues = blk->num_vqs;
+
+	blk->vhost = vhost;
+	return 0;
+
+fail:
+	vhost_dev_deinit(&vhost->vdev);
+	free(vhost);
+	return -1;
+}
+
+static void
+virtio_blk_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_blk *blk = vdev;
+	struct vhost_dev *vhost;
+
+	if (!blk->vhost)
+		return;
+
+	vhost = &blk->vhost->vdev;
+	if (!vhost->started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(vhost) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_start failed\n"));
+	} else if (vhost->started &&
+		   (status & VIRTIO_CONFIG_S_DRIVER_OK) == 0) {
+		if (vhost_dev_stop(vhost) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_stop failed\n"));
+	}
+}
+
 static int
 virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -443,7 +612,8 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	struct virtio_blk *blk;
 	int i;
 	pthread_mutexattr_t attr;
-	int rc;
+	int rc, num_vqs;
+	char *vhost_path = NULL;
 
 	bctxt = NULL;
 	/* Assume the bctxt is valid, until identified otherwise */
@@ -462,38 +632,68 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		WPRINTF(("bident error, please check slot and func\n"));
 	}
 
+	num_vqs = virtio_blk_parse_mq(opts);
+	if (num_vqs < 0) {
+		WPRINTF(("virtio_blk: mq shall be between 1 and %d\n", VIRTIO_BLK_MAX_QUEUES));
+		return -1;
+	}
+
 	/*
 	 * If "nodisk" keyword is found in opts, this is not a valid backend
-	 * file. Skip blockif_open and set dummy bctxt in virtio_blk struct
+	 * file. Skip blockif_open and set dummy bctxt in virtio_blk struct.
+	 * A vhost-user backend has no blockif either.
 	 */
-	if (strstr(opts, "nodisk") != NULL) {
+	if (strncmp(opts, "vhost_user=", strlen("vhost_user=")) == 0) {
+		vhost_path = strdup(opts + strlen("vhost_user="));
+		if (!vhost_path) {
+			WPRINTF(("virtio_blk: strdup returns NULL\n"));
+			return -1;
+		}
+		vhost_path[strcspn(vhost_path, ",")] = '\0';
+		dummy_bctxt = true;
+	} else if (strstr(opts, "nodisk") != NULL) {
 		dummy_bctxt = true;
 	} else {
-		bctxt = blockif_open(opts, bident);
+		bctxt = blockif_open(opts, bident, num_vqs);
 		if (bctxt == NULL) {
 			pr_err("Could not open backing file");
 			return -1;
 		}
+		virtio_blk_register_mem(ctx, bctxt);
 	}
 
 
 	blk = calloc(1, sizeof(struct virtio_blk));
 	if (!blk) {
 		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		if (bctxt)
+			blockif_close(bctxt);
+		free(vhost_path);
+		return -1;
+	}
+	blk->ios = calloc(num_vqs * VIRTIO_BLK_RINGSZ, sizeof(struct virtio_blk_ioreq));
+	if (!blk->ios) {
+		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		if (bctxt)
+			blockif_close(bctxt);
+		free(blk);
+		free(vhost_path);
 		return -1;
 	}
 
 	blk->bc = bctxt;
 	/* Update virtio-blk device struct of dummy ctxt*/
 	blk->dummy_bctxt = dummy_bctxt;
+	blk->num_vqs = num_vqs;
 
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
+	for (i = 0; i < num_vqs * VIRTIO_BLK_RINGSZ; i++) {
 		struct virtio_blk_ioreq *io = &blk->ios[i];
 
 		io->req.callback = virtio_blk_done;
 		io->req.param = io;
+		io->req.qidx = i / VIRTIO_BLK_RINGSZ;
 		io->blk = blk;
-		io->idx = i;
+		io->idx = i % VIRTIO_BLK_RINGSZ;
 	}
 
 	/* init mutex attribute properly to avoid deadlock */
@@ -510,12 +710,26 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		DPRINTF(("virtio_blk: pthread_mutex_init failed with "
 					"error %d!\n", rc));
 
+	for (i = 0; i < num_vqs; i++)
+		pthread_mutex_init(&blk->vq_mtx[i], NULL);
+
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq, BACKEND_VBSU);
+	blk->ops = virtio_blk_ops;
+	blk->ops.nvq = num_vqs;
+	virtio_linkup(&blk->base, &blk->ops, blk, dev, blk->vqs,
+		      vhost_path ? BACKEND_VHOST : BACKEND_VBSU);
 	blk->base.mtx = &blk->mtx;
+	if (!vhost_path)
+		blk->base.flags |= VIRTIO_KICK_EVENTFD;
 
-	blk->vq.qsize = VIRTIO_BLK_RINGSZ;
-	/* blk->vq.vq_notify = we have no per-queue notify */
+	/*
+	 * Each virtqueue is kicked through its own eventfd, has its own
+	 * MSI-X vector and blockif submission queue.
+	 */
+	for (i = 0; i < num_vqs; i++)
+		blk->vqs[i].qsize = VIRTIO_BLK_RINGSZ;
+	blk->cfg.num_queues = num_vqs;
+	/* blk->vqs[i].vq_notify = we have no per-queue notify */
 
 	/*
 	 * Create an identifier for the backing file. Use parts of the
@@ -531,7 +745,16 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		WPRINTF(("virtio_blk: device name is invalid!\n"));
 
 	/* Setup virtio block config space only for valid backend file*/
-	if (!blk->dummy_bctxt)
+	if (vhost_path) {
+		rc = virtio_blk_vhost_init(blk, vhost_path);
+		free(vhost_path);
+		if (rc < 0) {
+			pr_err("virtio_blk: vhost-user backend setup failed\n");
+			free(blk->ios);
+			free(blk);
+			return -1;
+		}
+	} else if (!blk->dummy_bctxt)
 		virtio_blk_update_config_space(blk);
 
 	/*
@@ -552,6 +775,11 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		/* call close only for valid bctxt */
 		if (!blk->dummy_bctxt)
 			blockif_close(blk->bc);
+		if (blk->vhost) {
+			vhost_dev_deinit(&blk->vhost->vdev);
+			free(blk->vhost);
+		}
+		free(blk->ios);
 		free(blk);
 		return -1;
 	}
@@ -587,6 +815,13 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				WPRINTF(("vrito_blk: Failed to flush before close\n"));
 			blockif_close(bctxt);
 		}
+		if (blk->vhost) {
+			if (blk->vhost->vdev.started)
+				vhost_dev_stop(&blk->vhost->vdev);
+			vhost_dev_deinit(&blk->vhost->vdev);
+			free(blk->vhost);
+		}
+		free(blk->ios);
 		free(blk);
 	}
 }
@@ -679,18 +914,19 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 	 * user has passed empty file during VM launch and wants to update it.
 	 * If this is the case, blk->bc would be null.
 	 */
-	if (blk->bc) {
+	if (blk->bc || blk->vhost) {
 		pr_err("Replacing valid backend file not supported!\n");
 		goto end;
 	}
 
 	pr_err("name=%s, Path=%s, ident=%s\n", dev->name, newpath, bident);
 	/* update the bctxt for the virtio-blk device */
-	bctxt = blockif_open(newpath, bident);
+	bctxt = blockif_open(newpath, bident, blk->num_vqs);
 	if (bctxt == NULL) {
 		pr_err("Error opening backing file\n");
 		goto end;
 	}
+	virtio_blk_register_mem(ctx, bctxt);
 
 	blk->bc = bctxt;
 	blk->dummy_bctxt = false;
@@ -757,10 +993,55 @@ end:
 	return error;
 }
 
+/*
+ * Change the I/O limits of a virtio-blk device, devargs is
+ * "<slot>,<throttling options>", e.g. "3,iops_rd=1000,bps_wr=0".
+ */
+int
+vm_monitor_blkthrottle(void *arg, char *devargs)
+{
+	char *str, *nstr;
+	char *str_slot, *str_opts;
+	int slot;
+	int error = -1;
+	struct pci_vdev *dev;
+	struct virtio_blk *blk;
+
+	nstr = str = strdup(devargs);
+	if (!str)
+		return -1;
+
+	str_slot = strsep(&str, ",");
+	str_opts = strsep(&str, "");
+	if (str_slot == NULL || str_opts == NULL ||
+			dm_strtoi(str_slot, &str_slot, 10, &slot)) {
+		pr_err("Slot info or throttling options not available!\n");
+		goto end;
+	}
+
+	dev = pci_get_vdev_info(slot);
+	if (dev == NULL || strstr(dev->name, "virtio-blk") == NULL) {
+		pr_err("No virtio-blk device at slot %d\n", slot);
+		goto end;
+	}
+
+	blk = (struct virtio_blk *)dev->arg;
+	if (!blk || blk->dummy_bctxt) {
+		pr_err("virtio-blk at slot %d has no backend file\n", slot);
+		goto end;
+	}
+
+	error = blockif_set_throttle(blk->bc, str_opts);
+end:
+	free(nstr);
+	return error;
+}
+
 struct pci_vdev_ops pci_ops_virtio_blk = {
 	.class_name	= "virtio-blk",
 	.vdev_init	= virtio_blk_init,
 	.vdev_deinit	= virtio_blk_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
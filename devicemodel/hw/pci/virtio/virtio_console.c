@@ -51,6 +51,8 @@
 #define	VIRTIO_CONSOLE_RINGSZ	64
 #define	VIRTIO_CONSOLE_MAXPORTS	16
 #define	VIRTIO_CONSOLE_MAXQ	(VIRTIO_CONSOLE_MAXPORTS * 2 + 2)
+#define	VIRTIO_CONSOLE_BATCH	16	/* chains per backend read/write */
+#define	VIRTIO_CONSOLE_SEGS	4	/* iovecs per chain */
 
 #define	VIRTIO_CONSOLE_DEVICE_READY	0
 #define	VIRTIO_CONSOLE_DEVICE_ADD	1
@@ -88,6 +90,7 @@ enum virtio_console_be_type {
 	VIRTIO_CONSOLE_BE_PTY,
 	VIRTIO_CONSOLE_BE_FILE,
 	VIRTIO_CONSOLE_BE_SOCKET,
+	VIRTIO_CONSOLE_BE_NULL,		/* drops the output, for benchmarks */
 	VIRTIO_CONSOLE_BE_MAX,
 	VIRTIO_CONSOLE_BE_INVALID = VIRTIO_CONSOLE_BE_MAX
 };
@@ -179,7 +182,8 @@ static const char *virtio_console_be_table[VIRTIO_CONSOLE_BE_MAX] = {
 	[VIRTIO_CONSOLE_BE_TTY]		= "tty",
 	[VIRTIO_CONSOLE_BE_PTY]		= "pty",
 	[VIRTIO_CONSOLE_BE_FILE]	= "file",
-	[VIRTIO_CONSOLE_BE_SOCKET]	= "socket"
+	[VIRTIO_CONSOLE_BE_SOCKET]	= "socket",
+	[VIRTIO_CONSOLE_BE_NULL]	= "null"
 };
 
 static struct termios virtio_console_saved_tio;
@@ -376,27 +380,62 @@ virtio_console_control_send(struct virtio_console *console,
 	vq_endchains(vq, 1);
 }
 
+/*
+ * Gather the iovecs of a batch of chains into one array, so a single
+ * readv/writev moves the whole batch.
+ */
+static int
+virtio_console_pack_iov(struct vq_chain *chains, int n, struct iovec *iov)
+{
+	int i, j, niov = 0;
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < chains[i].niov; j++)
+			iov[niov++] = chains[i].iov[j];
+
+	return niov;
+}
+
 static void
 virtio_console_notify_tx(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_console *console;
 	struct virtio_console_port *port;
-	struct iovec iov[1];
-	uint16_t idx;
-	uint16_t flags[8];
+	struct vq_chain chains[VIRTIO_CONSOLE_BATCH];
+	struct iovec iov[VIRTIO_CONSOLE_BATCH * VIRTIO_CONSOLE_SEGS];
+	struct iovec wiov[VIRTIO_CONSOLE_BATCH * VIRTIO_CONSOLE_SEGS];
+	int i, n, niov;
 
 	console = vdev;
 	port = virtio_console_vq_to_port(console, vq);
 
 	while (vq_has_descs(vq)) {
-		vq_getchain(vq, &idx, iov, 1, flags);
-		if (port != NULL)
-			port->cb(port, port->arg, iov, 1);
+		n = vq_getchains_batch(vq, chains, VIRTIO_CONSOLE_BATCH, iov,
+				       VIRTIO_CONSOLE_SEGS, NULL);
+		if (n == 0)
+			break;
+		if (n < 0)
+			continue;
+
+		/*
+		 * Control messages are handled one by one, port data
+		 * is a stream and goes to the backend in one write.
+		 */
+		if (port == &console->control_port) {
+			for (i = 0; i < n; i++)
+				port->cb(port, port->arg, chains[i].iov,
+					 chains[i].niov);
+		} else if (port != NULL) {
+			niov = virtio_console_pack_iov(chains, n, wiov);
+			port->cb(port, port->arg, wiov, niov);
+		}
 
 		/*
-		 * Release this chain and handle more
+		 * Release these chains and handle more
 		 */
-		vq_relchain(vq, idx, 0);
+		for (i = 0; i < n; i++)
+			chains[i].len = 0;
+		vq_relchains_batch(vq, chains, n);
 	}
 	vq_endchains(vq, 1);	/* Generate interrupt if appropriate. */
 }
@@ -453,10 +492,12 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 	struct virtio_console_port *port;
 	struct virtio_console_backend *be = arg;
 	struct virtio_vq_info *vq;
-	struct iovec iov;
+	struct vq_chain chains[VIRTIO_CONSOLE_BATCH];
+	struct iovec iov[VIRTIO_CONSOLE_BATCH * VIRTIO_CONSOLE_SEGS];
+	struct iovec riov[VIRTIO_CONSOLE_BATCH * VIRTIO_CONSOLE_SEGS];
 	static char dummybuf[2048];
-	int len, n;
-	uint16_t idx;
+	int len, n, i, j, niov;
+	size_t size;
 
 	port = be->port;
 	vq = virtio_console_port_to_vq(port, true);
@@ -476,11 +517,21 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 		return;
 	}
 
+	/*
+	 * Read into a batch of chains at once; the data is a stream, so
+	 * it fills the chains in order and the unused ones are returned.
+	 */
 	do {
-		n = vq_getchain(vq, &idx, &iov, 1, NULL);
-		len = readv(be->fd, &iov, n);
+		n = vq_getchains_batch(vq, chains, VIRTIO_CONSOLE_BATCH, iov,
+				       VIRTIO_CONSOLE_SEGS, NULL);
+		if (n < 1)
+			break;
+
+		niov = virtio_console_pack_iov(chains, n, riov);
+		len = readv(be->fd, riov, niov);
 		if (len <= 0) {
-			vq_retchain(vq);
+			while (n-- > 0)
+				vq_retchain(vq);
 			vq_endchains(vq, 0);
 
 			/* no data available */
@@ -496,7 +547,19 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 			goto close;
 		}
 
-		vq_relchain(vq, idx, len);
+		for (i = 0; i < n && len > 0; i++) {
+			for (size = 0, j = 0; j < chains[i].niov; j++)
+				size += chains[i].iov[j].iov_len;
+			chains[i].len = MIN(size, (size_t)len);
+			len -= chains[i].len;
+		}
+		for (j = n; j > i; j--)
+			vq_retchain(vq);
+		vq_relchains_batch(vq, chains, i);
+
+		/* a short read means the backend is drained */
+		if (i < n || chains[i - 1].len < size)
+			break;
 	} while (vq_has_descs(vq));
 
 	vq_endchains(vq, 1);
@@ -527,7 +590,8 @@ virtio_console_backend_write(struct virtio_console_port *port, void *arg,
 
 	be = arg;
 
-	if (be->fd == -1)
+	/* not even a system call, only the virtqueue is measured */
+	if (be->fd == -1 || be->be_type == VIRTIO_CONSOLE_BE_NULL)
 		return;
 
 	ret = writev(be->fd, iov, niov);
@@ -573,7 +637,8 @@ virtio_console_restore_stdio(void)
 static bool
 virtio_console_backend_can_read(enum virtio_console_be_type be_type)
 {
-	return (be_type == VIRTIO_CONSOLE_BE_FILE) ? false : true;
+	return (be_type == VIRTIO_CONSOLE_BE_FILE ||
+		be_type == VIRTIO_CONSOLE_BE_NULL) ? false : true;
 }
 
 static int
@@ -623,6 +688,11 @@ virtio_console_open_backend(const char *path,
 		if (fd < 0)
 			WPRINTF(("vtcon: socket open failed \n"));
 		break;
+	case VIRTIO_CONSOLE_BE_NULL:
+		fd = open("/dev/null", O_WRONLY);
+		if (fd < 0)
+			WPRINTF(("vtcon: open failed: /dev/null\n"));
+		break;
 	default:
 		WPRINTF(("not supported backend %d!\n", be_type));
 	}
@@ -858,7 +928,8 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 		if (portpath == NULL
 			&& be_type != VIRTIO_CONSOLE_BE_STDIO
 			&& be_type != VIRTIO_CONSOLE_BE_PTY
-			&& be_type != VIRTIO_CONSOLE_BE_SOCKET) {
+			&& be_type != VIRTIO_CONSOLE_BE_SOCKET
+			&& be_type != VIRTIO_CONSOLE_BE_NULL) {
 			WPRINTF(("vtcon: portpath missing for %s\n",
 				portname));
 			error = -1;
@@ -957,8 +1028,8 @@ virtio_console_add_backends(struct virtio_console *console, char *opts)
 {
 	char *opt;
 
-	/* virtio-console,[@]stdio|tty|pty|file:portname[=portpath]
-	 * [,[@]stdio|tty|pty|file:portname[=portpath][:socket_type]]
+	/* virtio-console,[@]stdio|tty|pty|file|null:portname[=portpath]
+	 * [,[@]stdio|tty|pty|file|null:portname[=portpath][:socket_type]]
 	 */
 	while ((opt = strsep(&opts, ",")) != NULL) {
 		if (virtio_console_add_backend(console, opt))
@@ -1188,6 +1259,7 @@ struct pci_vdev_ops pci_ops_virtio_console = {
 	.class_name	= "virtio-console",
 	.vdev_init	= virtio_console_init,
 	.vdev_deinit	= virtio_console_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio-fs device: a directory of the Service VM shared with the guest,
+ * which mounts it with "mount -t virtiofs <tag> <mount point>".
+ *
+ * The FUSE requests of the virtqueues are served by an external vhost-user
+ * daemon, e.g. virtiofsd, which also owns the shared directory. With
+ * cache_size=<size>, the device has a DAX window: a BAR into which the
+ * daemon maps ranges of the files it serves through its backend requests,
+ * and which the device maps into the EPT of the guest. The guest then reads
+ * and writes the page cache of the Service VM in place, with no copy and
+ * no request for the ranges it has mapped.
+ *
+ * usage: -s <slot>,virtio-fs,vhost_user=<socket path>,tag=<tag>
+ *		[,queues=<n>][,cache_size=<size, e.g. 2G>]
+ */
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "vmmapi.h"
+#include "virtio.h"
+#include "vhost.h"
+#include "dm_string.h"
+
+#define VIRTIO_FS_RINGSZ	128
+#define VIRTIO_FS_MAX_QUEUES	8	/* request queues */
+#define VIRTIO_FS_TAG_LEN	36
+
+#define VIRTIO_FS_S_HOSTCAPS \
+	((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1UL << VIRTIO_RING_F_EVENT_IDX))
+
+/* the DAX window, behind the notify PIO BAR it replaces */
+#define VIRTIO_FS_CACHE_BAR	2
+#define VIRTIO_FS_SHMCAP_ID_CACHE	0
+
+/* backend requests of virtiofsd to map files into the DAX window */
+#define VHOST_USER_SLAVE_FS_MAP		6
+#define VHOST_USER_SLAVE_FS_UNMAP	7
+#define VHOST_USER_SLAVE_FS_SYNC	8
+#define VHOST_USER_SLAVE_FS_IO		9
+
+#define VHOST_USER_FS_SLAVE_ENTRIES	8
+#define VHOST_USER_FS_FLAG_MAP_R	(1UL << 0)
+#define VHOST_USER_FS_FLAG_MAP_W	(1UL << 1)
+
+struct vhost_user_fs_slave_msg {
+	uint64_t fd_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+	uint64_t c_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+	uint64_t len[VHOST_USER_FS_SLAVE_ENTRIES];
+	uint64_t flags[VHOST_USER_FS_SLAVE_ENTRIES];
+};
+
+struct virtio_fs_config {
+	char tag[VIRTIO_FS_TAG_LEN];
+	uint32_t num_request_queues;
+} __attribute__((packed));
+
+/*
+ * Per-device struct
+ */
+struct virtio_fs {
+	struct virtio_base base;
+	struct virtio_vq_info queues[1 + VIRTIO_FS_MAX_QUEUES];
+	struct virtio_ops ops;
+	pthread_mutex_t mtx;
+	struct virtio_fs_config config;
+	struct vhost_dev vdev;
+	struct vhost_vq vqs[1 + VIRTIO_FS_MAX_QUEUES];
+	struct virtio_shm cache;	/* DAX window */
+	uint64_t cache_size;		/* 0 if there is no DAX window */
+};
+
+static int virtio_fs_debug;
+#define DPRINTF(params) do { if (virtio_fs_debug) pr_dbg params; } while (0)
+#define WPRINTF(params) (pr_err params)
+
+static void virtio_fs_reset(void *vdev);
+static void virtio_fs_notify(void *vdev, struct virtio_vq_info *vq);
+static int virtio_fs_cfgread(void *vdev, int offset, int size,
+	uint32_t *retval);
+static int virtio_fs_cfgwrite(void *vdev, int offset, int size,
+	uint32_t value);
+static void virtio_fs_set_status(void *vdev, uint64_t status);
+
+static struct virtio_ops virtio_fs_ops = {
+	"virtio_fs",			/* our name */
+	2,				/* hiprio and 1 request queue, or queues= */
+	sizeof(struct virtio_fs_config), /* config reg size */
+	virtio_fs_reset,		/* reset */
+	virtio_fs_notify,		/* device-wide qnotify */
+	virtio_fs_cfgread,		/* read virtio config */
+	virtio_fs_cfgwrite,		/* write virtio config */
+	NULL,				/* apply negotiated features */
+	virtio_fs_set_status,		/* called on guest set status */
+};
+
+static void
+virtio_fs_reset(void *vdev)
+{
+	struct virtio_fs *fs = vdev;
+
+	DPRINTF(("virtio_fs: device reset requested\n"));
+	virtio_reset_dev(&fs->base);
+}
+
+/* the kicks only get here before the backend is started */
+static void
+virtio_fs_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	DPRINTF(("virtio_fs: notify of vq %ld ignored\n",
+		 vq - ((struct virtio_fs *)vdev)->queues));
+}
+
+static int
+virtio_fs_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_fs *fs = vdev;
+	void *ptr;
+
+	ptr = (uint8_t *)&fs->config + offset;
+	memcpy(retval, ptr, size);
+	return 0;
+}
+
+static int
+virtio_fs_cfgwrite(void *vdev, int offset, int size, uint32_t value)
+{
+	DPRINTF(("virtio_fs: write to readonly reg %d\n", offset));
+	return -1;
+}
+
+/*
+ * The backend requests for the DAX window, from the mevent thread.
+ */
+static int
+virtio_fs_slave_handler(void *arg, uint32_t request, void *payload,
+			uint32_t size, int *fds, int nfds)
+{
+	struct virtio_fs *fs = arg;
+	struct vhost_user_fs_slave_msg *msg = payload;
+	uint64_t offset, len;
+	int i, prot, rc = 0;
+
+	if (fs->cache_size == 0 || size < sizeof(*msg))
+		return -EINVAL;
+
+	for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES && rc == 0; i++) {
+		offset = msg->c_offset[i];
+		len = msg->len[i];
+		/* ~0 unmaps up to the end of the window */
+		if (request == VHOST_USER_SLAVE_FS_UNMAP && len == ~0UL &&
+		    offset < fs->cache_size)
+			len = fs->cache_size - offset;
+		if (len == 0)
+			continue;
+
+		switch (request) {
+		case VHOST_USER_SLAVE_FS_MAP:
+			if (nfds != 1)
+				return -EINVAL;
+			prot = 0;
+			if (msg->flags[i] & VHOST_USER_FS_FLAG_MAP_R)
+				prot |= PROT_READ;
+			if (msg->flags[i] & VHOST_USER_FS_FLAG_MAP_W)
+				prot |= PROT_WRITE;
+			rc = virtio_shm_map(&fs->cache, fds[0],
+					    msg->fd_offset[i], offset, len, prot);
+			break;
+		case VHOST_USER_SLAVE_FS_UNMAP:
+			rc = virtio_shm_unmap(&fs->cache, offset, len);
+			break;
+		case VHOST_USER_SLAVE_FS_SYNC:
+			if (offset >= fs->cache_size ||
+			    len > fs->cache_size - offset)
+				return -EINVAL;
+			if (msync(fs->cache.addr + offset, len, MS_SYNC) < 0)
+				rc = -errno;
+			break;
+		default:
+			/* FS_IO is only needed for the windows of peers */
+			WPRINTF(("virtio_fs: backend request %u unsupported\n",
+				 request));
+			return -ENOSYS;
+		}
+		if (rc < 0)
+			WPRINTF(("virtio_fs: backend request %u of 0x%lx+0x%lx "
+				 "failed\n", request, offset, len));
+	}
+
+	return rc;
+}
+
+static void
+virtio_fs_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_fs *fs = vdev;
+
+	if (!fs->vdev.started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(&fs->vdev) < 0)
+			WPRINTF(("virtio_fs: vhost_dev_start failed\n"));
+	} else if (fs->vdev.started &&
+		   (status & VIRTIO_CONFIG_S_DRIVER_OK) == 0) {
+		if (vhost_dev_stop(&fs->vdev) < 0)
+			WPRINTF(("virtio_fs: vhost_dev_stop failed\n"));
+		/* the mappings of the driver are gone with it */
+		if (fs->cache_size)
+			virtio_shm_unmap(&fs->cache, 0, fs->cache_size);
+	}
+}
+
+static int
+virtio_fs_parse_opts(struct virtio_fs *fs, char *opts, char **path,
+		     int *num_queues)
+{
+	char *cp, *opt;
+	size_t cache_size;
+	int n;
+
+	*path = NULL;
+	*num_queues = 1;
+	cp = opts;
+	while (cp && (opt = strsep(&cp, ",")) != NULL) {
+		if (!strncmp(opt, "vhost_user=", 11)) {
+			*path = opt + 11;
+		} else if (!strncmp(opt, "tag=", 4)) {
+			if (strnlen(opt + 4, VIRTIO_FS_TAG_LEN + 1) >
+			    VIRTIO_FS_TAG_LEN || opt[4] == '\0') {
+				WPRINTF(("virtio_fs: invalid %s\n", opt));
+				return -1;
+			}
+			strncpy(fs->config.tag, opt + 4, VIRTIO_FS_TAG_LEN);
+		} else if (!strncmp(opt, "queues=", 7)) {
+			if (dm_strtoi(opt + 7, NULL, 10, &n) < 0 || n < 1 ||
+			    n > VIRTIO_FS_MAX_QUEUES) {
+				WPRINTF(("virtio_fs: invalid %s\n", opt));
+				return -1;
+			}
+			*num_queues = n;
+		} else if (!strncmp(opt, "cache_size=", 11)) {
+			if (vm_parse_memsize(opt + 11, &cache_size) < 0 ||
+			    (cache_size & (cache_size - 1)) != 0) {
+				WPRINTF(("virtio_fs: invalid %s, a power of 2 "
+					 "from 128M is expected\n", opt));
+				return -1;
+			}
+			fs->cache_size = cache_size;
+		} else if (*opt != '\0') {
+			WPRINTF(("virtio_fs: unknown option %s\n", opt));
+			return -1;
+		}
+	}
+
+	if (!*path || fs->config.tag[0] == '\0') {
+		WPRINTF(("virtio_fs: vhost_user=<socket path> and tag=<tag> "
+			 "are needed\n"));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+virtio_fs_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_fs *fs;
+	pthread_mutexattr_t attr;
+	char *path, *opts_dup = NULL;
+	int fd, i, rc, num_queues;
+
+	fs = calloc(1, sizeof(struct virtio_fs));
+	if (!fs) {
+		WPRINTF(("virtio_fs: calloc returns NULL\n"));
+		return -1;
+	}
+
+	if (opts) {
+		opts_dup = strdup(opts);
+		if (!opts_dup) {
+			WPRINTF(("virtio_fs: strdup failed\n"));
+			goto opts_fail;
+		}
+	}
+	if (virtio_fs_parse_opts(fs, opts_dup, &path, &num_queues) < 0)
+		goto opts_fail;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("virtio_fs: connect to %s failed\n", path));
+		goto opts_fail;
+	}
+
+	/* init mutex attribute properly to avoid deadlock */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		DPRINTF(("mutexattr init failed with erro %d!\n", rc));
+	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (rc)
+		DPRINTF(("virtio_fs: mutexattr_settype failed with "
+			 "error %d!\n", rc));
+	rc = pthread_mutex_init(&fs->mtx, &attr);
+	if (rc)
+		DPRINTF(("virtio_fs: pthread_mutex_init failed with "
+			 "error %d!\n", rc));
+
+	fs->ops = virtio_fs_ops;
+	fs->ops.nvq = 1 + num_queues;
+	virtio_linkup(&fs->base, &fs->ops, fs, dev, fs->queues, BACKEND_VHOST);
+	fs->base.mtx = &fs->mtx;
+	fs->base.device_caps = VIRTIO_FS_S_HOSTCAPS;
+	for (i = 0; i < fs->ops.nvq; i++)
+		fs->queues[i].qsize = VIRTIO_FS_RINGSZ;
+	fs->config.num_request_queues = num_queues;
+
+	/* the hiprio queue is served by the backend too */
+	fs->vdev.nvqs = fs->ops.nvq;
+	fs->vdev.vqs = fs->vqs;
+	fs->vdev.user = true;
+	if (fs->cache_size) {
+		fs->vdev.slave_handler = virtio_fs_slave_handler;
+		fs->vdev.slave_arg = fs;
+	}
+
+	/* on failure vhost_dev_init() has closed fd */
+	if (vhost_dev_init(&fs->vdev, &fs->base, fd, 0, VIRTIO_FS_S_HOSTCAPS,
+			   0, 0) < 0) {
+		WPRINTF(("virtio_fs: vhost_dev_init failed\n"));
+		goto vhost_fail;
+	}
+	if (fs->cache_size && !fs->vdev.slave_mevp) {
+		WPRINTF(("virtio_fs: the backend can't map the cache\n"));
+		goto fail;
+	}
+
+	pci_set_cfgdata16(dev, PCIR_DEVICE, 0x1040 + VIRTIO_TYPE_FS);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_STORAGE);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_STORAGE_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_FS);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_REVID, 1);
+
+	/* vhost only signals through MSI-X */
+	if (virtio_interrupt_init(&fs->base, 1)) {
+		WPRINTF(("virtio_fs: interrupt_init failed\n"));
+		goto fail;
+	}
+	if (virtio_set_modern_bar(&fs->base, false)) {
+		WPRINTF(("virtio_fs: set modern bar failed\n"));
+		goto fail;
+	}
+	if (fs->cache_size &&
+	    virtio_shm_init(&fs->cache, &fs->base, VIRTIO_FS_CACHE_BAR,
+			    VIRTIO_FS_SHMCAP_ID_CACHE, fs->cache_size)) {
+		WPRINTF(("virtio_fs: set cache bar failed\n"));
+		goto fail;
+	}
+
+	free(opts_dup);
+	return 0;
+
+fail:
+	vhost_dev_deinit(&fs->vdev);
+vhost_fail:
+	pthread_mutex_destroy(&fs->mtx);
+	dev->arg = NULL;
+opts_fail:
+	free(opts_dup);
+	free(fs);
+	return -1;
+}
+
+static void
+virtio_fs_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_fs *fs = dev->arg;
+
+	if (!fs)
+		return;
+
+	if (fs->vdev.started)
+		vhost_dev_stop(&fs->vdev);
+	vhost_dev_deinit(&fs->vdev);
+	virtio_shm_deinit(&fs->cache);
+	pthread_mutex_destroy(&fs->mtx);
+	free(fs);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_virtio_fs = {
+	.class_name	= "virtio-fs",
+	.vdev_init	= virtio_fs_init,
+	.vdev_deinit	= virtio_fs_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_fs);
@@ -110,7 +110,14 @@ static int gpio_debug;
 
 /* Virtio GPIO capabilities */
 #define VIRTIO_GPIO_F_CHIP	1
-#define VIRTIO_GPIO_S_HOSTCAPS	VIRTIO_GPIO_F_CHIP
+#define VIRTIO_GPIO_F_MULTI	2	/* GPIO_REQ_{SET,GET}_MULTI_VALUE */
+#define VIRTIO_GPIO_S_HOSTCAPS	(VIRTIO_GPIO_F_CHIP | VIRTIO_GPIO_F_MULTI)
+
+/* lines covered by one multi-line request */
+#define VIRTIO_GPIO_MULTI_LINES	32
+
+/* line events read from a line event fd at once */
+#define GPIO_EVENT_BATCH	16
 
 #define IRQ_TYPE_NONE		0
 #define IRQ_TYPE_EDGE_RISING	(1 << 0)
@@ -161,6 +168,8 @@ enum virtio_gpio_request_command {
 	GPIO_REQ_OUTPUT_DIRECTION	= 3,
 	GPIO_REQ_GET_DIRECTION		= 4,
 	GPIO_REQ_SET_CONFIG		= 5,
+	GPIO_REQ_SET_MULTI_VALUE	= 6,
+	GPIO_REQ_GET_MULTI_VALUE	= 7,
 
 	GPIO_REQ_MAX
 };
@@ -186,6 +195,17 @@ struct virtio_gpio_response {
 	uint8_t	data;
 } __attribute__((packed));
 
+/*
+ * A multi-line request covers VIRTIO_GPIO_MULTI_LINES lines from its offset:
+ * the low 32 bits of its data select the lines and, for a set, the high 32
+ * bits hold their values. The response holds the values of the selected
+ * lines.
+ */
+struct virtio_gpio_multi_response {
+	int8_t	err;
+	uint32_t	data;
+} __attribute__((packed));
+
 struct virtio_gpio_info {
 	struct virtio_gpio_request	req;
 	struct virtio_gpio_response	rsp;
@@ -557,6 +577,49 @@ gpio_request_handler(struct virtio_gpio *gpio, struct virtio_gpio_request *req,
 	print_virtio_gpio_info(req, rsp, false);
 }
 
+static int
+gpio_multi_request_handler(struct virtio_gpio *gpio,
+		struct virtio_gpio_request *req,
+		struct virtio_gpio_multi_response *rsp)
+{
+	uint32_t mask, bits;
+	unsigned int i, offset;
+	int rc;
+
+	mask = req->data & 0xffffffff;
+	bits = req->data >> 32;
+	rsp->data = 0;
+	DPRINTF(("<<<< gpio=%u, cmd=%u, mask=%x, bits=%x\n", req->offset,
+			req->cmd, mask, bits));
+
+	for (i = 0; i < VIRTIO_GPIO_MULTI_LINES; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+
+		offset = req->offset + i;
+		if (offset >= gpio->nvline) {
+			WPRINTF(("discards the gpio request, offset:%u\n",
+					offset));
+			return -1;
+		}
+
+		if (req->cmd == GPIO_REQ_SET_MULTI_VALUE) {
+			rc = gpio_set_value(gpio, offset, (bits >> i) & 1);
+			if (rc < 0)
+				return -1;
+			rc = (bits >> i) & 1;
+		} else {
+			rc = gpio_get_value(gpio, offset);
+			if (rc < 0)
+				return -1;
+		}
+		rsp->data |= (uint32_t)(rc ? 1 : 0) << i;
+	}
+
+	DPRINTF((">>>> gpio=%u, data=%x\n", req->offset, rsp->data));
+	return 0;
+}
+
 static void virtio_gpio_reset(void *vdev)
 {
 	struct virtio_gpio *gpio;
@@ -624,6 +687,7 @@ virtio_gpio_proc(struct virtio_gpio *gpio, struct iovec *iov, int n)
 	struct virtio_gpio_data *data;
 	struct virtio_gpio_request *req;
 	struct virtio_gpio_response *rsp;
+	struct virtio_gpio_multi_response *mrsp;
 	struct gpio_line *line;
 	int i, len, rc;
 
@@ -659,6 +723,20 @@ virtio_gpio_proc(struct virtio_gpio *gpio, struct iovec *iov, int n)
 			return 0;
 		}
 
+		if (req->cmd == GPIO_REQ_SET_MULTI_VALUE ||
+				req->cmd == GPIO_REQ_GET_MULTI_VALUE) {
+			mrsp = iov[1].iov_base;
+			len = iov[1].iov_len;
+			if (len != sizeof(*mrsp)) {
+				WPRINTF(("virtio gpio, invalid rsp size %d\n",
+						len));
+				return 0;
+			}
+
+			mrsp->err = gpio_multi_request_handler(gpio, req, mrsp);
+			return sizeof(*mrsp);
+		}
+
 		rsp = iov[1].iov_base;
 		len = iov[1].iov_len;
 		if (len != sizeof(*rsp)) {
@@ -686,7 +764,9 @@ virtio_gpio_notify(void *vdev, struct virtio_vq_info *vq)
 
 	idx = vq->qsize;
 	gpio = (struct virtio_gpio *)vdev;
-	if (vq_has_descs(vq)) {
+
+	/* handle all the requests posted since the last kick */
+	while (vq_has_descs(vq)) {
 		n = vq_getchain(vq, &idx, iov, 2, NULL);
 		if (n >= 3) {
 			WPRINTF(("virtio gpio, invalid chain number %d\n", n));
@@ -975,45 +1055,53 @@ gpio_irq_set_pin_state(int fd __attribute__((unused)),
 		enum ev_type t __attribute__((unused)),
 		void *arg)
 {
-	struct gpioevent_data data;
+	struct gpioevent_data data[GPIO_EVENT_BATCH];
 	struct virtio_gpio *gpio;
 	struct gpio_irq_desc *desc;
-	int err;
+	bool trigger = false;
+	int i, err;
 
 	desc = (struct gpio_irq_desc *) arg;
 	gpio = (struct virtio_gpio *) desc->data;
 
-	/* get pin state */
-	memset(&data, 0, sizeof(data));
-	err = read(desc->fd, &data, sizeof(data));
-	if (err != sizeof(data)) {
+	/*
+	 * get pin state, the read returns all the events queued up to the
+	 * size of the buffer, so a burst of edges raises one interrupt.
+	 */
+	memset(data, 0, sizeof(data));
+	err = read(desc->fd, data, sizeof(data));
+	if (err < (int)sizeof(data[0]) || err % sizeof(data[0])) {
 		WPRINTF(("virtio gpio, gpio mevent read error %s, len %d\n",
 				strerror(errno), err));
 		return;
 	}
 
-	if (data.id == GPIOEVENT_EVENT_RISING_EDGE) {
+	for (i = 0; i < err / sizeof(data[0]); i++) {
+		if (data[i].id == GPIOEVENT_EVENT_RISING_EDGE) {
 
-		/* pin level is high */
-		desc->level = 1;
+			/* pin level is high */
+			desc->level = 1;
 
-		/* jitter protection */
-		if ((desc->mode & IRQ_TYPE_EDGE_RISING)
-				|| (desc->mode & IRQ_TYPE_LEVEL_HIGH)) {
-			gpio_irq_generate_intr(gpio, desc->pin);
-		}
-	} else if (data.id == GPIOEVENT_EVENT_FALLING_EDGE) {
+			/* jitter protection */
+			if ((desc->mode & IRQ_TYPE_EDGE_RISING)
+					|| (desc->mode & IRQ_TYPE_LEVEL_HIGH))
+				trigger = true;
+		} else if (data[i].id == GPIOEVENT_EVENT_FALLING_EDGE) {
 
-		/* pin level is low */
-		desc->level = 0;
+			/* pin level is low */
+			desc->level = 0;
 
-		/* jitter protection */
-		if ((desc->mode & IRQ_TYPE_EDGE_FALLING)
-				|| (desc->mode & IRQ_TYPE_LEVEL_LOW)) {
-			gpio_irq_generate_intr(gpio, desc->pin);
-		}
-	} else
-		WPRINTF(("virtio gpio, undefined GPIO event id %d\n", data.id));
+			/* jitter protection */
+			if ((desc->mode & IRQ_TYPE_EDGE_FALLING)
+					|| (desc->mode & IRQ_TYPE_LEVEL_LOW))
+				trigger = true;
+		} else
+			WPRINTF(("virtio gpio, undefined GPIO event id %d\n",
+					data[i].id));
+	}
+
+	if (trigger)
+		gpio_irq_generate_intr(gpio, desc->pin);
 }
 
 static void
@@ -1234,12 +1322,16 @@ virtio_irq_notify(void *vdev, struct virtio_vq_info *vq)
 
 	idx = vq->qsize;
 	gpio = (struct virtio_gpio *)vdev;
-	if (vq_has_descs(vq)) {
+	if (!vq_has_descs(vq))
+		return;
+
+	/* handle all the IRQ actions posted, with one interrupt for them */
+	while (vq_has_descs(vq)) {
 		n = vq_getchain(vq, &idx, iov, 1, &flag);
 		if (n != 1) {
 			WPRINTF(("virtio gpio, invalid irq chain %d\n", n));
 			virtio_gpio_abort(vq, idx);
-			return;
+			break;
 		}
 
 		virtio_gpio_irq_proc(gpio, iov, flag);
@@ -1247,10 +1339,10 @@ virtio_irq_notify(void *vdev, struct virtio_vq_info *vq)
 		 * Release this chain and handle more
 		 */
 		vq_relchain(vq, idx, 1);
-
-		/* Generate interrupt if appropriate. */
-		vq_endchains(vq, 1);
 	}
+
+	/* Generate interrupt if appropriate. */
+	vq_endchains(vq, 1);
 }
 
 static void
@@ -1592,6 +1684,8 @@ print_virtio_gpio_info(struct virtio_gpio_request *req,
 		"GPIO_REQ_OUTPUT_DIRECTION",
 		"GPIO_REQ_GET_DIRECTION",
 		"GPIO_REQ_SET_CONFIG",
+		"GPIO_REQ_SET_MULTI_VALUE",
+		"GPIO_REQ_GET_MULTI_VALUE",
 		"GPIO_REQ_MAX",
 	};
 
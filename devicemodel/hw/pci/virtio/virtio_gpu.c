@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio-gpu device, for the platforms without GVT: the control and cursor
+ * queues are served by an external vhost-user GPU backend, which owns the
+ * renderer and the outputs, and which gets the guest memory of the
+ * resources through the memory table rather than through copies.
+ *
+ * With hostmem=<size>, the device has the host visible memory region:
+ * the backend maps the blob resources it allocates, e.g. GEM buffers of the
+ * Service VM GPU, into it with its SHMEM_MAP requests, and the device maps
+ * them into the EPT of the guest, so the display and compute buffers are
+ * shared with no copy in either direction.
+ *
+ * usage: -s <slot>,virtio-gpu,vhost_user=<socket path>
+ *		[,hostmem=<size, e.g. 1G>]
+ */
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "vmmapi.h"
+#include "virtio.h"
+#include "vhost.h"
+
+#define VIRTIO_GPU_RINGSZ	256
+#define VIRTIO_GPU_CONTROLQ	0
+#define VIRTIO_GPU_CURSORQ	1
+#define VIRTIO_GPU_MAXQ		2
+
+/* the feature bits of virtio-gpu */
+#define VIRTIO_GPU_F_VIRGL		0
+#define VIRTIO_GPU_F_EDID		1
+#define VIRTIO_GPU_F_RESOURCE_UUID	2
+#define VIRTIO_GPU_F_RESOURCE_BLOB	3
+#define VIRTIO_GPU_F_CONTEXT_INIT	4
+
+#define VIRTIO_GPU_S_HOSTCAPS \
+	((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1UL << VIRTIO_RING_F_EVENT_IDX) | (1UL << VIRTIO_GPU_F_VIRGL) | \
+	(1UL << VIRTIO_GPU_F_EDID) | (1UL << VIRTIO_GPU_F_RESOURCE_UUID) | \
+	(1UL << VIRTIO_GPU_F_RESOURCE_BLOB) | \
+	(1UL << VIRTIO_GPU_F_CONTEXT_INIT))
+
+/* the host visible memory, behind the notify PIO BAR it replaces */
+#define VIRTIO_GPU_HOSTMEM_BAR		2
+#define VIRTIO_GPU_SHM_ID_HOST_VISIBLE	1
+
+/* backend requests of the shared memory regions */
+#define VHOST_USER_PROTOCOL_F_SHMEM	20
+#define VHOST_USER_BACKEND_SHMEM_MAP	9
+#define VHOST_USER_BACKEND_SHMEM_UNMAP	10
+#define VHOST_USER_FLAG_MAP_RW		(1UL << 0)
+
+struct vhost_user_shmem_msg {
+	uint8_t shmid;
+	uint8_t padding[7];
+	uint64_t fd_offset;
+	uint64_t shm_offset;
+	uint64_t len;
+	uint64_t flags;
+};
+
+struct virtio_gpu_config {
+	uint32_t events_read;
+	uint32_t events_clear;
+	uint32_t num_scanouts;
+	uint32_t num_capsets;
+};
+
+/*
+ * Per-device struct
+ */
+struct virtio_gpu {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_GPU_MAXQ];
+	pthread_mutex_t mtx;
+	struct virtio_gpu_config config;
+	struct vhost_dev vdev;
+	struct vhost_vq vqs[VIRTIO_GPU_MAXQ];
+	struct virtio_shm hostmem;
+	uint64_t hostmem_size;		/* 0 if there is no host visible memory */
+};
+
+static int virtio_gpu_debug;
+#define DPRINTF(params) do { if (virtio_gpu_debug) pr_dbg params; } while (0)
+#define WPRINTF(params) (pr_err params)
+
+static void virtio_gpu_reset(void *vdev);
+static void virtio_gpu_notify(void *vdev, struct virtio_vq_info *vq);
+static int virtio_gpu_cfgread(void *vdev, int offset, int size,
+	uint32_t *retval);
+static int virtio_gpu_cfgwrite(void *vdev, int offset, int size,
+	uint32_t value);
+static void virtio_gpu_set_status(void *vdev, uint64_t status);
+
+static struct virtio_ops virtio_gpu_ops = {
+	"virtio_gpu",			/* our name */
+	VIRTIO_GPU_MAXQ,		/* we support 2 virtqueues */
+	sizeof(struct virtio_gpu_config), /* config reg size */
+	virtio_gpu_reset,		/* reset */
+	virtio_gpu_notify,		/* device-wide qnotify */
+	virtio_gpu_cfgread,		/* read virtio config */
+	virtio_gpu_cfgwrite,		/* write virtio config */
+	NULL,				/* apply negotiated features */
+	virtio_gpu_set_status,		/* called on guest set status */
+};
+
+static void
+virtio_gpu_reset(void *vdev)
+{
+	struct virtio_gpu *gpu = vdev;
+
+	DPRINTF(("virtio_gpu: device reset requested\n"));
+	virtio_reset_dev(&gpu->base);
+}
+
+/* the kicks only get here before the backend is started */
+static void
+virtio_gpu_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	DPRINTF(("virtio_gpu: notify of vq %ld ignored\n",
+		 vq - ((struct virtio_gpu *)vdev)->queues));
+}
+
+static int
+virtio_gpu_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_gpu *gpu = vdev;
+	void *ptr;
+
+	ptr = (uint8_t *)&gpu->config + offset;
+	memcpy(retval, ptr, size);
+	return 0;
+}
+
+static int
+virtio_gpu_cfgwrite(void *vdev, int offset, int size, uint32_t value)
+{
+	struct virtio_gpu *gpu = vdev;
+
+	if (offset != offsetof(struct virtio_gpu_config, events_clear) ||
+	    size != 4) {
+		DPRINTF(("virtio_gpu: write to readonly reg %d\n", offset));
+		return -1;
+	}
+
+	gpu->config.events_read &= ~value;
+	return 0;
+}
+
+/*
+ * The backend requests for the host visible memory, from the mevent thread.
+ */
+static int
+virtio_gpu_slave_handler(void *arg, uint32_t request, void *payload,
+			 uint32_t size, int *fds, int nfds)
+{
+	struct virtio_gpu *gpu = arg;
+	struct vhost_user_shmem_msg *msg = payload;
+	int prot, rc;
+
+	if (gpu->hostmem_size == 0 || size < sizeof(*msg) ||
+	    msg->shmid != VIRTIO_GPU_SHM_ID_HOST_VISIBLE)
+		return -EINVAL;
+
+	switch (request) {
+	case VHOST_USER_BACKEND_SHMEM_MAP:
+		if (nfds != 1)
+			return -EINVAL;
+		prot = PROT_READ;
+		if (msg->flags & VHOST_USER_FLAG_MAP_RW)
+			prot |= PROT_WRITE;
+		rc = virtio_shm_map(&gpu->hostmem, fds[0], msg->fd_offset,
+				    msg->shm_offset, msg->len, prot);
+		break;
+	case VHOST_USER_BACKEND_SHMEM_UNMAP:
+		rc = virtio_shm_unmap(&gpu->hostmem, msg->shm_offset, msg->len);
+		break;
+	default:
+		WPRINTF(("virtio_gpu: backend request %u unsupported\n",
+			 request));
+		return -ENOSYS;
+	}
+
+	if (rc < 0)
+		WPRINTF(("virtio_gpu: backend request %u of 0x%lx+0x%lx "
+			 "failed\n", request, msg->shm_offset, msg->len));
+	return rc;
+}
+
+static void
+virtio_gpu_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_gpu *gpu = vdev;
+
+	if (!gpu->vdev.started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(&gpu->vdev) < 0)
+			WPRINTF(("virtio_gpu: vhost_dev_start failed\n"));
+	} else if (gpu->vdev.started &&
+		   (status & VIRTIO_CONFIG_S_DRIVER_OK) == 0) {
+		if (vhost_dev_stop(&gpu->vdev) < 0)
+			WPRINTF(("virtio_gpu: vhost_dev_stop failed\n"));
+		/* the blobs of the driver are gone with it */
+		if (gpu->hostmem_size)
+			virtio_shm_unmap(&gpu->hostmem, 0, gpu->hostmem_size);
+	}
+}
+
+static int
+virtio_gpu_parse_opts(struct virtio_gpu *gpu, char *opts, char **path)
+{
+	char *cp, *opt;
+	size_t hostmem_size;
+
+	*path = NULL;
+	cp = opts;
+	while (cp && (opt = strsep(&cp, ",")) != NULL) {
+		if (!strncmp(opt, "vhost_user=", 11)) {
+			*path = opt + 11;
+		} else if (!strncmp(opt, "hostmem=", 8)) {
+			if (vm_parse_memsize(opt + 8, &hostmem_size) < 0 ||
+			    (hostmem_size & (hostmem_size - 1)) != 0) {
+				WPRINTF(("virtio_gpu: invalid %s, a power of 2 "
+					 "is expected\n", opt));
+				return -1;
+			}
+			gpu->hostmem_size = hostmem_size;
+		} else if (*opt != '\0') {
+			WPRINTF(("virtio_gpu: unknown option %s\n", opt));
+			return -1;
+		}
+	}
+
+	if (!*path) {
+		WPRINTF(("virtio_gpu: vhost_user=<socket path> is needed\n"));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+virtio_gpu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_gpu *gpu;
+	pthread_mutexattr_t attr;
+	char *path, *opts_dup = NULL;
+	int fd, i, rc;
+
+	gpu = calloc(1, sizeof(struct virtio_gpu));
+	if (!gpu) {
+		WPRINTF(("virtio_gpu: calloc returns NULL\n"));
+		return -1;
+	}
+
+	if (opts) {
+		opts_dup = strdup(opts);
+		if (!opts_dup) {
+			WPRINTF(("virtio_gpu: strdup failed\n"));
+			goto opts_fail;
+		}
+	}
+	if (virtio_gpu_parse_opts(gpu, opts_dup, &path) < 0)
+		goto opts_fail;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("virtio_gpu: connect to %s failed\n", path));
+		goto opts_fail;
+	}
+
+	/* init mutex attribute properly to avoid deadlock */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		DPRINTF(("mutexattr init failed with erro %d!\n", rc));
+	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (rc)
+		DPRINTF(("virtio_gpu: mutexattr_settype failed with "
+			 "error %d!\n", rc));
+	rc = pthread_mutex_init(&gpu->mtx, &attr);
+	if (rc)
+		DPRINTF(("virtio_gpu: pthread_mutex_init failed with "
+			 "error %d!\n", rc));
+
+	virtio_linkup(&gpu->base, &virtio_gpu_ops, gpu, dev, gpu->queues,
+		      BACKEND_VHOST);
+	gpu->base.mtx = &gpu->mtx;
+	gpu->base.device_caps = VIRTIO_GPU_S_HOSTCAPS;
+	for (i = 0; i < VIRTIO_GPU_MAXQ; i++)
+		gpu->queues[i].qsize = VIRTIO_GPU_RINGSZ;
+
+	gpu->vdev.nvqs = VIRTIO_GPU_MAXQ;
+	gpu->vdev.vqs = gpu->vqs;
+	gpu->vdev.user = true;
+	if (gpu->hostmem_size) {
+		gpu->vdev.slave_handler = virtio_gpu_slave_handler;
+		gpu->vdev.slave_arg = gpu;
+		gpu->vdev.slave_protocol_features =
+			1UL << VHOST_USER_PROTOCOL_F_SHMEM;
+	}
+
+	/* on failure vhost_dev_init() has closed fd */
+	if (vhost_dev_init(&gpu->vdev, &gpu->base, fd, 0,
+			   VIRTIO_GPU_S_HOSTCAPS, 0, 0) < 0) {
+		WPRINTF(("virtio_gpu: vhost_dev_init failed\n"));
+		goto vhost_fail;
+	}
+	if (gpu->hostmem_size &&
+	    !(gpu->vdev.vhost_user_protocol_features &
+	      (1UL << VHOST_USER_PROTOCOL_F_SHMEM))) {
+		WPRINTF(("virtio_gpu: the backend can't map the host memory\n"));
+		goto fail;
+	}
+	/* the blobs of host memory need a place to be mapped at */
+	if (!gpu->hostmem_size)
+		gpu->base.device_caps &= ~(1UL << VIRTIO_GPU_F_RESOURCE_BLOB);
+
+	/* the scanouts and the capsets are the ones of the backend */
+	if (vhost_dev_get_config(&gpu->vdev, &gpu->config,
+				 sizeof(gpu->config)) < 0) {
+		WPRINTF(("virtio_gpu: get config from the backend failed\n"));
+		goto fail;
+	}
+	gpu->config.events_read = 0;
+	gpu->config.events_clear = 0;
+
+	pci_set_cfgdata16(dev, PCIR_DEVICE, 0x1040 + VIRTIO_TYPE_GPU);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_DISPLAY);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_DISPLAY_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_GPU);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_REVID, 1);
+
+	/* vhost only signals through MSI-X */
+	if (virtio_interrupt_init(&gpu->base, 1)) {
+		WPRINTF(("virtio_gpu: interrupt_init failed\n"));
+		goto fail;
+	}
+	if (virtio_set_modern_bar(&gpu->base, false)) {
+		WPRINTF(("virtio_gpu: set modern bar failed\n"));
+		goto fail;
+	}
+	if (gpu->hostmem_size &&
+	    virtio_shm_init(&gpu->hostmem, &gpu->base, VIRTIO_GPU_HOSTMEM_BAR,
+			    VIRTIO_GPU_SHM_ID_HOST_VISIBLE, gpu->hostmem_size)) {
+		WPRINTF(("virtio_gpu: set host memory bar failed\n"));
+		goto fail;
+	}
+
+	free(opts_dup);
+	return 0;
+
+fail:
+	vhost_dev_deinit(&gpu->vdev);
+vhost_fail:
+	pthread_mutex_destroy(&gpu->mtx);
+	dev->arg = NULL;
+opts_fail:
+	free(opts_dup);
+	free(gpu);
+	return -1;
+}
+
+static void
+virtio_gpu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_gpu *gpu = dev->arg;
+
+	if (!gpu)
+		return;
+
+	if (gpu->vdev.started)
+		vhost_dev_stop(&gpu->vdev);
+	vhost_dev_deinit(&gpu->vdev);
+	virtio_shm_deinit(&gpu->hostmem);
+	pthread_mutex_destroy(&gpu->mtx);
+	free(gpu);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_virtio_gpu = {
+	.class_name	= "virtio-gpu",
+	.vdev_init	= virtio_gpu_init,
+	.vdev_deinit	= virtio_gpu_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_gpu);
@@ -70,6 +70,9 @@ static int virtio_i2c_debug=0;
 #define I2C_MSG_ERR	1
 #define I2C_NO_DEV	2
 
+/* transfer latency histogram, bucket n counts the ones under 2^n us */
+#define I2C_LAT_BUCKETS	16
+
 static int acpi_i2c_adapter_num = 0;
 static void acpi_add_i2c_adapter(struct pci_vdev *dev, int i2c_bus);
 static void acpi_add_cam1(struct pci_vdev *dev, int i2c_bus);
@@ -100,6 +103,9 @@ struct native_i2c_adapter {
 	int 		fd;
 	int 		bus;
 	bool 		i2cdev_enable[MAX_I2C_VDEV];
+	uint64_t	xfers;
+	uint64_t	msgs;
+	uint64_t	lat_hist[I2C_LAT_BUCKETS];
 };
 
 /*
@@ -390,42 +396,89 @@ native_adapter_find(struct virtio_i2c *vi2c, uint16_t addr)
 	return NULL;
 }
 
+static void
+native_adapter_record_latency(struct native_i2c_adapter *adapter,
+		struct timespec *start, int nmsgs)
+{
+	struct timespec end;
+	uint64_t us;
+	int bucket;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	us = (end.tv_sec - start->tv_sec) * 1000000 +
+		(end.tv_nsec - start->tv_nsec) / 1000;
+	for (bucket = 0; bucket < I2C_LAT_BUCKETS - 1; bucket++)
+		if (us < (1UL << bucket))
+			break;
+
+	adapter->lat_hist[bucket]++;
+	adapter->xfers++;
+	adapter->msgs += nmsgs;
+}
+
+/*
+ * The messages of a batch go in one I2C_RDWR, i.e. one combined transfer
+ * with repeated starts, as the guest sent them in one i2c transfer.
+ */
 static uint8_t
-native_adapter_proc(struct virtio_i2c *vi2c, struct i2c_msg *msg)
+native_adapter_proc(struct native_i2c_adapter *adapter, struct i2c_msg *msgs,
+		int nmsgs)
 {
-	int ret;
-	uint16_t addr;
+	int i, ret;
 	struct i2c_rdwr_ioctl_data work_queue;
-	struct native_i2c_adapter *adapter;
+	struct timespec start;
 	uint8_t status;
 
-	addr = msg->addr;
-	adapter = native_adapter_find(vi2c, addr);
-	if (!adapter)
-		return I2C_NO_DEV;
-
-	work_queue.nmsgs = 1;
-	work_queue.msgs = msg;
+	work_queue.nmsgs = nmsgs;
+	work_queue.msgs = msgs;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	ret = ioctl(adapter->fd, I2C_RDWR, &work_queue);
+	native_adapter_record_latency(adapter, &start, nmsgs);
 	if (ret < 0)
 		status = I2C_MSG_ERR;
 	else
 		status = I2C_MSG_OK;
-	if (msg->len)
-		DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x buf=%x\n",
-				msg->flags,
-				msg->addr,
-				msg->len,
-				msg->buf[0]);
-	else
-		DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x\n",
-				msg->flags,
-				msg->addr,
-				msg->len);
+	for (i = 0; i < nmsgs; i++) {
+		if (msgs[i].len)
+			DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x buf=%x\n",
+					msgs[i].flags,
+					msgs[i].addr,
+					msgs[i].len,
+					msgs[i].buf[0]);
+		else
+			DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x\n",
+					msgs[i].flags,
+					msgs[i].addr,
+					msgs[i].len);
+	}
 	return status;
 }
 
+static void
+native_adapter_print_stats(struct native_i2c_adapter *adapter)
+{
+	char buf[I2C_LAT_BUCKETS * 24];
+	int i, len;
+
+	if (!adapter->xfers)
+		return;
+
+	len = 0;
+	for (i = 0; i < I2C_LAT_BUCKETS; i++) {
+		if (!adapter->lat_hist[i])
+			continue;
+		len += snprintf(buf + len, sizeof(buf) - len, " <%luus:%lu",
+				1UL << i, adapter->lat_hist[i]);
+		if (len >= sizeof(buf))
+			break;
+	}
+	buf[sizeof(buf) - 1] = '\0';
+	pr_info(VIRTIO_I2C_PREF "i2c-%d: %lu transfers, %lu msgs, latency%s\n",
+			adapter->bus, adapter->xfers, adapter->msgs,
+			len ? buf : " n/a");
+}
+
 static struct native_i2c_adapter *
 native_adapter_create(int bus, uint16_t client_addr[], int n_client)
 {
@@ -483,6 +536,7 @@ native_adapter_remove(struct virtio_i2c *vi2c)
 	for (i = 0; i < MAX_NATIVE_I2C_ADAPTER; i++) {
 		native_adapter = vi2c->native_adapter[i];
 		if (native_adapter) {
+			native_adapter_print_stats(native_adapter);
 			if (native_adapter->fd > 0)
 				close(native_adapter->fd);
 			free(native_adapter);
@@ -503,6 +557,23 @@ virtio_i2c_req_stop(struct virtio_i2c *vi2c)
 	pthread_join(vi2c->req_tid, &jval);
 }
 
+static void
+virtio_i2c_flush(struct virtio_i2c *vi2c, struct native_i2c_adapter *adapter,
+		struct i2c_msg *msgs, uint8_t **status, uint16_t *idx, int nmsgs)
+{
+	uint8_t st;
+	int i;
+
+	if (!nmsgs)
+		return;
+
+	st = native_adapter_proc(adapter, msgs, nmsgs);
+	for (i = 0; i < nmsgs; i++) {
+		*status[i] = st;
+		vq_relchain(&vi2c->vq, idx[i], 1);
+	}
+}
+
 static void *
 virtio_i2c_proc_thread(void *arg)
 {
@@ -511,9 +582,11 @@ virtio_i2c_proc_thread(void *arg)
 	struct iovec iov[3];
 	uint16_t idx, flags[3];
 	struct virtio_i2c_hdr *hdr;
-	struct i2c_msg msg;
-	uint8_t *status;
-	int n;
+	struct i2c_msg *msg, msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	uint8_t *status[I2C_RDWR_IOCTL_MAX_MSGS];
+	uint16_t idxs[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct native_i2c_adapter *adapter, *batch_adapter;
+	int n, nmsgs;
 
 	for (;;) {
 		pthread_mutex_lock(&vi2c->req_mtx);
@@ -528,6 +601,14 @@ virtio_i2c_proc_thread(void *arg)
 		}
 		vi2c->in_process = 1;
 		pthread_mutex_unlock(&vi2c->req_mtx);
+
+		/*
+		 * The requests queued at once come from one i2c transfer of
+		 * the guest, the consecutive ones to the same adapter are sent
+		 * to it in one batch.
+		 */
+		nmsgs = 0;
+		batch_adapter = NULL;
 		do {
 			n = vq_getchain(vq, &idx, iov, 3, flags);
 			if (n < 2 || n > 3) {
@@ -535,20 +616,36 @@ virtio_i2c_proc_thread(void *arg)
 				continue;
 			}
 			hdr = iov[0].iov_base;
-			msg.addr = hdr->addr;
-			msg.flags = hdr->flags;
+			adapter = native_adapter_find(vi2c, hdr->addr);
+			if (nmsgs && (adapter != batch_adapter ||
+					nmsgs == I2C_RDWR_IOCTL_MAX_MSGS)) {
+				virtio_i2c_flush(vi2c, batch_adapter, msgs,
+						status, idxs, nmsgs);
+				nmsgs = 0;
+			}
+
+			msg = &msgs[nmsgs];
+			msg->addr = hdr->addr;
+			msg->flags = hdr->flags;
 			if (hdr->len) {
-				msg.buf = iov[1].iov_base;
-				msg.len = iov[1].iov_len;
-				status = iov[2].iov_base;
+				msg->buf = iov[1].iov_base;
+				msg->len = iov[1].iov_len;
+				status[nmsgs] = iov[2].iov_base;
 			} else {
-				msg.buf = NULL;
-				msg.len = 0;
-				status = iov[1].iov_base;
+				msg->buf = NULL;
+				msg->len = 0;
+				status[nmsgs] = iov[1].iov_base;
+			}
+
+			if (!adapter) {
+				*status[nmsgs] = I2C_NO_DEV;
+				vq_relchain(vq, idx, 1);
+				continue;
 			}
-			*status = native_adapter_proc(vi2c, &msg);
-			vq_relchain(vq, idx, 1);
+			idxs[nmsgs++] = idx;
+			batch_adapter = adapter;
 		} while (vq_has_descs(vq));
+		virtio_i2c_flush(vi2c, batch_adapter, msgs, status, idxs, nmsgs);
 		vq_endchains(vq, 0);
 	}
 }
@@ -43,10 +43,16 @@ static int virtio_input_debug;
  */
 #define VIRTIO_INPUT_PACKET_SIZE	10
 
+/*
+ * Number of host events taken by one read
+ */
+#define VIRTIO_INPUT_READ_BATCH		64
+
 /*
  * Host capabilities
  */
-#define VIRTIO_INPUT_S_HOSTCAPS		(1UL << VIRTIO_F_VERSION_1)
+#define VIRTIO_INPUT_S_HOSTCAPS		\
+	((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_F_RING_PACKED))
 
 enum virtio_input_config_select {
 	VIRTIO_INPUT_CFG_UNSET		= 0x00,
@@ -286,7 +292,14 @@ virtio_input_notify_status_vq(void *vdev, struct virtio_vq_info *vq)
 	vq_endchains(vq, 1);	/* Generate interrupt if appropriate. */
 }
 
-static void
+/*
+ * Events are held until the SYN_REPORT closing their frame and the frame is
+ * published at once. The caller raises the interrupt, once for all the frames
+ * published in a row.
+ *
+ * Returns true if a frame was published.
+ */
+static bool
 virtio_input_send_event(struct virtio_input *vi,
 			struct virtio_input_event *event)
 {
@@ -296,23 +309,23 @@ virtio_input_send_event(struct virtio_input *vi,
 	uint16_t idx;
 
 	if (!vi->ready)
-		return;
+		return false;
 
 	if (vi->event_qindex == vi->event_qsize) {
-		vi->event_qsize++;
+		vi->event_qsize *= 2;
 		vi->event_queue = realloc(vi->event_queue,
 			vi->event_qsize *
 			sizeof(struct virtio_input_event_elem));
 		if (!vi->event_queue) {
 			WPRINTF(("virtio_input: realloc memory for vi->event_queue failed!\n"));
-			return;
+			return false;
 		}
 	}
 	vi->event_queue[vi->event_qindex].event = *event;
 	vi->event_qindex++;
 
 	if (event->type != EV_SYN || event->code != SYN_REPORT)
-		return;
+		return false;
 
 	vq = &vi->queues[VIRTIO_INPUT_EVENT_QUEUE];
 	for (i = 0; i < vi->event_qindex; i++) {
@@ -321,21 +334,22 @@ virtio_input_send_event(struct virtio_input *vi,
 				vq_retchain(vq);
 			WPRINTF(("%s: not enough avail descs, dropped:%d\n",
 				__func__, vi->event_qindex));
-			goto out;
+			vi->event_qindex = 0;
+			return false;
 		}
 		n = vq_getchain(vq, &idx, &iov, 1, NULL);
 		if (n < 0) {
 			WPRINTF(("virtio-input: invalid descriptors\n"));
-			return;
+			return false;
 		}
 		if (n == 0) {
 			WPRINTF(("virtio-input: get no available desciptors\n"));
-			return;
+			return false;
 		}
 		if (n != 1) {
 			WPRINTF(("virtio_input: get wrong number of available descriptors\n"));
 			vq_relchain(vq, idx, sizeof(event)); /* Release the chain */
-			return;
+			return true;
 		}
 		vi->event_queue[i].iov = iov;
 		vi->event_queue[i].idx = idx;
@@ -349,9 +363,8 @@ virtio_input_send_event(struct virtio_input *vi,
 			sizeof(struct virtio_input_event));
 	}
 
-out:
 	vi->event_qindex = 0;
-	vq_endchains(vq, 1);
+	return true;
 }
 
 static void
@@ -361,12 +374,17 @@ virtio_input_read_event(int fd __attribute__((unused)),
 {
 	struct virtio_input *vi = arg;
 	struct virtio_input_event event;
-	struct input_event host_event;
-	int len;
+	struct input_event host_events[VIRTIO_INPUT_READ_BATCH];
+	bool published = false;
+	int len, i;
 
+	/*
+	 * All the frames read in one go share one interrupt, so the faster the
+	 * device reports, the more frames each interrupt carries.
+	 */
 	while (1) {
-		len = read(vi->fd, &host_event, sizeof(host_event));
-		if (len != sizeof(host_event)) {
+		len = read(vi->fd, host_events, sizeof(host_events));
+		if (len <= 0 || len % sizeof(host_events[0])) {
 			if (len == -1 && errno != EAGAIN)
 				WPRINTF(("vtinput: host read failed! "
 					"len = %d, errno = %d\n",
@@ -374,11 +392,19 @@ virtio_input_read_event(int fd __attribute__((unused)),
 			break;
 		}
 
-		event.type = host_event.type;
-		event.code = host_event.code;
-		event.value = host_event.value;
-		virtio_input_send_event(vi, &event);
+		for (i = 0; i < len / sizeof(host_events[0]); i++) {
+			event.type = host_events[i].type;
+			event.code = host_events[i].code;
+			event.value = host_events[i].value;
+			if (virtio_input_send_event(vi, &event))
+				published = true;
+		}
+		if (len < sizeof(host_events))
+			break;
 	}
+
+	if (published)
+		vq_endchains(&vi->queues[VIRTIO_INPUT_EVENT_QUEUE], 1);
 }
 
 static int
@@ -755,6 +781,7 @@ struct pci_vdev_ops pci_ops_virtio_input = {
 	.class_name	= "virtio-input",
 	.vdev_init	= virtio_input_init,
 	.vdev_deinit	= virtio_input_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
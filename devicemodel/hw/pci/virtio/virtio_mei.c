@@ -267,6 +267,13 @@ vmei_dbg_client_properties(const struct mei_client_properties *prop)
 #define VMEI_BUF_SZ      (VMEI_BUF_DEPTH * VMEI_SLOT_SZ)
 #define VMEI_RING_SZ     64
 
+/*
+ * A client whose native write would block is retried after a delay doubling
+ * from VMEI_TX_RETRY_MIN_US up to VMEI_TX_RETRY_MAX_US while it does not drain.
+ */
+#define VMEI_TX_RETRY_MIN_US	1000
+#define VMEI_TX_RETRY_MAX_US	2000000
+
 /**
  * VMEI supported HBM version
  */
@@ -357,6 +364,7 @@ struct virtio_mei {
 	pthread_mutex_t                 rx_mutex;
 	pthread_cond_t                  rx_cond;
 	bool                            rx_need_sched;
+	struct vmei_host_client         *rx_last; /* only compared, never used */
 
 	pthread_mutex_t                 list_mutex;
 	LIST_HEAD(clhead, vmei_me_client) active_clients;
@@ -1663,6 +1671,8 @@ static void *vmei_tx_thread(void *param)
 	struct virtio_mei *vmei = param;
 	struct timespec max_wait = {0, 0};
 	int err, pending_cnt = 0;
+	long retry_us = VMEI_TX_RETRY_MIN_US;
+	ssize_t sent;
 
 	pthread_mutex_lock(&vmei->tx_mutex);
 
@@ -1673,13 +1683,16 @@ static void *vmei_tx_thread(void *param)
 		int send_ready;
 
 		if (pending_cnt == 0) {
+			retry_us = VMEI_TX_RETRY_MIN_US;
 			err = pthread_cond_wait(&vmei->tx_cond,
 						&vmei->tx_mutex);
 			if (err)
 				goto out;
 		} else {
-			max_wait.tv_sec = time(NULL) + 2;
-			max_wait.tv_nsec = 0;
+			clock_gettime(CLOCK_REALTIME, &max_wait);
+			max_wait.tv_nsec += retry_us * 1000;
+			max_wait.tv_sec += max_wait.tv_nsec / 1000000000;
+			max_wait.tv_nsec %= 1000000000;
 			err = pthread_cond_timedwait(&vmei->tx_cond,
 						     &vmei->tx_mutex,
 						     &max_wait);
@@ -1689,6 +1702,12 @@ static void *vmei_tx_thread(void *param)
 			pending_cnt = 0;
 		}
 
+		/*
+		 * Each client is written on its own: one whose FW queue is
+		 * full or which failed does not hold back the others.
+		 */
+		sent = 0;
+
 		pthread_mutex_lock(&vmei->list_mutex);
 		LIST_FOREACH(me, &vmei->active_clients, list) {
 			pthread_mutex_lock(&me->list_mutex);
@@ -1697,12 +1716,11 @@ static void *vmei_tx_thread(void *param)
 					continue;
 
 				len = vmei_host_client_native_write(e);
-				if (len < 0 && len != -EAGAIN) {
+				if (len < 0 && len != -EAGAIN)
 					HCL_WARN(e, "TX:send failed %zd\n",
 						 len);
-					pthread_mutex_unlock(&me->list_mutex);
-					goto unlock;
-				}
+				else if (len > 0)
+					sent += len;
 				if (vmei->status == VMEI_STS_RESET) {
 					pthread_mutex_unlock(&me->list_mutex);
 					goto unlock;
@@ -1717,6 +1735,11 @@ static void *vmei_tx_thread(void *param)
 		}
 unlock:
 		pthread_mutex_unlock(&vmei->list_mutex);
+
+		if (sent)
+			retry_us = VMEI_TX_RETRY_MIN_US;
+		else if (pending_cnt && retry_us < VMEI_TX_RETRY_MAX_US)
+			retry_us *= 2;
 	}
 
 out:
@@ -1835,7 +1858,17 @@ vmei_proc_vclient_rx(struct vmei_host_client *hclient,
 	HCL_DBG(hclient, "RX: DM->UOS: off=%d len=%d\n",
 		hclient->recv_handled, len);
 
-	buf_len = VMEI_BUF_SZ - sizeof(*hdr);
+	/*
+	 * Fill the whole buffer the guest gave, a message fits in fewer
+	 * fragments when the FE posts buffers larger than VMEI_BUF_SZ.
+	 */
+	if (iov[0].iov_len <= sizeof(*hdr)) {
+		pr_warn("%s: rx buffer too small %zu!\n", __func__,
+			iov[0].iov_len);
+		vq_relchain(vq, idx, 0);
+		return;
+	}
+	buf_len = iov[0].iov_len - sizeof(*hdr);
 	hdr = (struct mei_msg_hdr *)iov[0].iov_base;
 	buf = (uint8_t *)iov[0].iov_base + sizeof(*hdr);
 
@@ -1881,25 +1914,53 @@ vmei_proc_rx(struct virtio_mei *vmei, struct virtio_vq_info *vq)
 {
 	struct vmei_me_client *me;
 	struct vmei_host_client *e, *hclient = NULL;
+	struct vmei_host_client *first = NULL, *last = NULL;
+	bool passed = !vmei->rx_last;
 
-	/*  Find a client with data */
+	/*
+	 * Find a client with data, the first one after the client served
+	 * last, so that clients streaming at the same time take turns.
+	 */
 	pthread_mutex_lock(&vmei->list_mutex);
 	LIST_FOREACH(me, &vmei->active_clients, list) {
 		pthread_mutex_lock(&me->list_mutex);
 		LIST_FOREACH(e, &me->connections, list) {
-			if (e->recv_offset - e->recv_handled > 0) {
-				if (e->recv_creds) {
-					hclient = vmei_host_client_get(e);
-					pthread_mutex_unlock(&me->list_mutex);
-					goto found;
-				}
+			if (e->recv_offset - e->recv_handled <= 0 ||
+			    !e->recv_creds) {
+				if (e == vmei->rx_last)
+					passed = true;
+				continue;
+			}
+			if (e == vmei->rx_last) {
+				passed = true;
+				last = vmei_host_client_get(e);
+			} else if (passed) {
+				hclient = vmei_host_client_get(e);
+				break;
+			} else if (!first) {
+				first = vmei_host_client_get(e);
 			}
 		}
 		pthread_mutex_unlock(&me->list_mutex);
+		if (hclient)
+			break;
 	}
-found:
+	if (!hclient) {
+		hclient = first ? first : last;
+		if (hclient == first)
+			first = NULL;
+		else
+			last = NULL;
+	}
+	if (hclient)
+		vmei->rx_last = hclient;
 	pthread_mutex_unlock(&vmei->list_mutex);
 
+	if (first)
+		vmei_host_client_put(first);
+	if (last)
+		vmei_host_client_put(last);
+
 	/* no client has data to be processed */
 	if (!hclient) {
 		DPRINTF("RX: No client with data\n");
@@ -50,6 +50,9 @@
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
+#define VIRTIO_NET_RX_BATCH	64	/* frames per used index update */
+#define VIRTIO_NET_TX_BATCH	16	/* chains per avail/used index access */
+#define VIRTIO_NET_MAX_GSO_LEN	(65536 + ETHER_HDR_LEN + 4) /* + vlan tag */
 
 /*
  * Host capabilities.  Note that we only offer a few of these.
@@ -73,12 +76,27 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* host supports multiple queues */
 #define	VHOST_NET_F_VIRTIO_NET_HDR \
 				(1 << 27) /* vhost provides virtio_net_hdr */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
-	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
+	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1 << VIRTIO_RING_F_EVENT_IDX))
+
+/*
+ * Offloads offered when the tap device carries a virtio-net header,
+ * the UFO ones only if the host kernel still accepts TUN_F_UFO.
+ */
+#define VIRTIO_NET_S_OFFLOADCAPS \
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 | \
+	VIRTIO_NET_F_GUEST_ECN | VIRTIO_NET_F_HOST_TSO4 | \
+	VIRTIO_NET_F_HOST_TSO6 | VIRTIO_NET_F_HOST_ECN)
+
+#define VIRTIO_NET_S_UFOCAPS \
+	(VIRTIO_NET_F_GUEST_UFO | VIRTIO_NET_F_HOST_UFO)
 
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
@@ -94,16 +112,33 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions.  Queue pair N uses virtqueue 2N for rx and 2N + 1
+ * for tx; with more than one pair the control queue follows the last
+ * pair.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAX_QPAIRS	8
+#define VIRTIO_NET_MAXQ	(VIRTIO_NET_MAX_QPAIRS * 2 + 1)
+
+/*
+ * Control queue commands
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_MQ		4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET	0
 
 /*
  * Fixed network header size
@@ -130,50 +165,72 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];		/* rx and tx of one queue pair */
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
+/*
+ * Per-queue-pair struct, each pair has its own tap queue
+ */
+struct virtio_net_qpair {
+	struct virtio_net *net;
+	int		idx;
+
+	struct mevent	*mevp;
+	int		tapfd;
+
+	int		rx_ready;
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+
+	struct vhost_net *vhost_net;
+};
+
 /*
  * Per-device struct
  */
 struct virtio_net {
 	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
+	struct virtio_ops ops;		/* per-instance copy, nvq varies */
 	pthread_mutex_t mtx;
-	struct mevent	*mevp;
 
-	int		tapfd;
-
-	int		rx_ready;
+	struct virtio_net_qpair qpairs[VIRTIO_NET_MAX_QPAIRS];
+	int		nqpairs;	/* queue pairs offered */
+	int		curr_qpairs;	/* queue pairs enabled by guest */
+	int		refs;		/* tap fds still to be torn down */
 
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the tx i/o threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	int		rx_gso;		/* guest accepts gso frames */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	bool		tap_vnet_hdr;	/* tap carries the virtio-net header */
+	int		tap_offloads;	/* TUN_F_* accepted by the tap */
+
+	void (*virtio_net_rx)(struct virtio_net_qpair *qp);
+	void (*virtio_net_tx)(struct virtio_net_qpair *qp, struct iovec *iov,
 			     int iovcnt, int len);
 
-	struct vhost_net *vhost_net;
 	bool		use_vhost;
+	bool		loopback;	/* tx frames go to rx, no tap */
 };
 
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_tx_stop(struct virtio_net_qpair *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -181,15 +238,16 @@ static int virtio_net_cfgwrite(void *vdev, int offset, int size,
 static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
+static void virtio_net_tap_set_offloads(struct virtio_net *net);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
-	int tapfd, int vq_idx);
+	bool user, int tapfd, int vq_idx);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
 static int vhost_net_start(struct vhost_net *vhost_net);
 static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* one queue pair by default */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -234,36 +292,65 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
+	}
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Attach the tap queues of the first n pairs and detach the rest, so
+ * that the host only steers traffic to the queues the guest uses.
+ */
+static void
+virtio_net_set_qpairs(struct virtio_net *net, int n)
+{
+	struct virtio_net_qpair *qp;
+	struct ifreq ifr;
+	int i;
+
+	net->curr_qpairs = n;
+	if (net->nqpairs == 1)
+		return;
+
+	for (i = 0; i < net->nqpairs; i++) {
+		qp = &net->qpairs[i];
+		if (qp->tapfd < 0)
+			continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = (i < n) ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+		if (ioctl(qp->tapfd, TUNSETQUEUE, (void *)&ifr) < 0)
+			WPRINTF(("vtnet: TUNSETQUEUE on queue %d failed: %d\n",
+				i, errno));
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -273,12 +360,17 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->nqpairs; i++) {
+		virtio_net_txwait(&net->qpairs[i]);
+		virtio_net_rxwait(&net->qpairs[i]);
+		net->qpairs[i].rx_ready = 0;
+	}
 
-	net->rx_ready = 0;
+	virtio_net_set_qpairs(net, 1);
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	net->features = 0;
+	virtio_net_tap_set_offloads(net);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
@@ -291,29 +383,29 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qpair *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qpair *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
@@ -326,10 +418,73 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
+/*
+ * Loopback backend, for benchmarks: each frame sent is received at once by
+ * the rx queue of the same pair, so the guest exercises both virtqueues
+ * without any host networking.
+ */
+static void
+virtio_net_loop_tx(struct virtio_net_qpair *qp, struct iovec *iov, int iovcnt,
+		   int len)
+{
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[qp->idx * 2 + VIRTIO_NET_RXQ];
+	struct iovec riov[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_rxhdr *vrxh;
+	uint16_t idx;
+	size_t off, n, done;
+	int i, j, cnt;
+
+	pthread_mutex_lock(&qp->rx_mtx);
+	if (!qp->rx_ready || net->resetting || !vq_has_descs(vq)) {
+		/* dropped, like a tap frame without rx buffers */
+		pthread_mutex_unlock(&qp->rx_mtx);
+		return;
+	}
+
+	cnt = vq_getchain(vq, &idx, riov, VIRTIO_NET_MAXSEGS, NULL);
+	if (cnt < 1 || cnt > VIRTIO_NET_MAXSEGS ||
+	    riov[0].iov_len < net->rx_vhdrlen) {
+		WPRINTF(("vtnet: virtio_net_loop_tx: vq_getchain = %d\n", cnt));
+		pthread_mutex_unlock(&qp->rx_mtx);
+		return;
+	}
+
+	vrxh = riov[0].iov_base;
+	memset(vrxh, 0, net->rx_vhdrlen);
+	if (net->rx_merge)
+		vrxh->vrh_bufs = 1;
+
+	/* copy the frame after the rx header, truncated to the chain */
+	done = net->rx_vhdrlen;
+	j = 0;
+	off = net->rx_vhdrlen;
+	for (i = 0; i < iovcnt && j < cnt; i++) {
+		size_t soff = 0;
+
+		while (soff < iov[i].iov_len && j < cnt) {
+			n = MIN(iov[i].iov_len - soff, riov[j].iov_len - off);
+			memcpy((uint8_t *)riov[j].iov_base + off,
+			       (uint8_t *)iov[i].iov_base + soff, n);
+			soff += n;
+			off += n;
+			done += n;
+			if (off == riov[j].iov_len) {
+				j++;
+				off = 0;
+			}
+		}
+	}
+
+	vq_relchain(vq, idx, done);
+	vq_endchains(vq, !vq_has_descs(vq));
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
 /*
  *  Called when there is read activity on the tap file descriptor.
  * Each buffer posted by the guest is assumed to be able to contain
@@ -366,20 +521,165 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
-static void
-virtio_net_tap_rx(struct virtio_net *net)
+/*
+ * Receive one frame into a single chain, the rx header is built here
+ * since the tap device does not supply one.
+ * Returns 1 if a frame was received, 0 if there are no more frames
+ * and -1 on error.
+ */
+static int
+virtio_net_tap_rx_one(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
-	struct virtio_vq_info *vq;
 	void *vrx;
 	int len, n;
 	uint16_t idx;
+
+	/*
+	 * Get descriptor chain.
+	 */
+	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
+	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
+		WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
+		return -1;
+	}
+	/*
+	 * Get a pointer to the rx header, and use the
+	 * data immediately following it for the packet buffer.
+	 */
+	vrx = iov[0].iov_base;
+	riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
+	if (riov == NULL)
+		return -1;
+
+	len = readv(qp->tapfd, riov, n);
+
+	if (len < 0 && errno == EWOULDBLOCK) {
+		vq_retchain(vq);
+		return 0;
+	}
+
+	/*
+	 * The only valid field in the rx packet header is the
+	 * number of buffers if merged rx bufs were negotiated.
+	 */
+	memset(vrx, 0, net->rx_vhdrlen);
+
+	if (net->rx_merge) {
+		struct virtio_net_rxhdr *vrxh;
+
+		vrxh = vrx;
+		vrxh->vrh_bufs = 1;
+	}
+
+	vq_relchain_prepare(vq, idx, len + net->rx_vhdrlen);
+	return 1;
+}
+
+/*
+ * Receive one frame whose rx header is written by the tap device
+ * (IFF_VNET_HDR).  With mergeable rx buffers the frame may span
+ * several chains: enough of them are gathered to hold the largest
+ * frame the guest accepts, and the ones left unused are returned to
+ * the avail ring.  A chain too long for the iovecs left is fetched
+ * into ciov, the avail ring keeps it for the next frame then.
+ * Returns 1 if a frame was received, 0 if there are no more frames
+ * and -1 on error.
+ */
+static int
+virtio_net_tap_rx_vnet(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	struct virtio_net *net = qp->net;
+	struct iovec iov[VIRTIO_NET_MAXSEGS], ciov[VIRTIO_NET_MAXSEGS];
+	uint16_t idx[VIRTIO_NET_MAXSEGS], last_avail;
+	uint32_t clen[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_rxhdr *vrxh;
+	int i, n, cnt, nchains, need, size, len, used;
+
+	need = net->rx_vhdrlen +
+		(net->rx_gso ? VIRTIO_NET_MAX_GSO_LEN : ETHER_MAX_LEN);
+
+	n = 0;
+	size = 0;
+	nchains = 0;
+	do {
+		last_avail = vq->last_avail;
+		cnt = vq_getchain(vq, &idx[nchains], nchains ? ciov : iov,
+				  VIRTIO_NET_MAXSEGS, NULL);
+		if (cnt == 0 && nchains)
+			break;
+		if (cnt < 1) {
+			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n",
+				cnt));
+			/*
+			 * A split ring steps over an invalid chain, return it
+			 * too so the others are returned in order.  It is a
+			 * first chain next time, and dropped then.
+			 */
+			if (nchains && vq->last_avail != last_avail)
+				nchains++;
+			for (i = 0; i < nchains; i++)
+				vq_retchain(vq);
+			return -1;
+		}
+		if (nchains) {
+			if (cnt > VIRTIO_NET_MAXSEGS - n) {
+				/* leave this chain for the next frame */
+				vq_retchain(vq);
+				break;
+			}
+			memcpy(&iov[n], ciov, cnt * sizeof(iov[0]));
+		}
+
+		clen[nchains] = 0;
+		for (i = 0; i < cnt; i++)
+			clen[nchains] += iov[n + i].iov_len;
+		size += clen[nchains];
+		n += cnt;
+		nchains++;
+	} while (net->rx_merge && size < need && n < VIRTIO_NET_MAXSEGS &&
+		 vq_has_descs(vq));
+
+	len = readv(qp->tapfd, iov, n);
+	if (len < 0) {
+		for (i = 0; i < nchains; i++)
+			vq_retchain(vq);
+		return (errno == EWOULDBLOCK) ? 0 : -1;
+	}
+
+	/* hand the frame out to the chains in order */
+	for (used = 0, size = len; used < nchains && size > 0; used++) {
+		cnt = (size < clen[used]) ? size : clen[used];
+		vq_relchain_prepare(vq, idx[used], cnt);
+		size -= cnt;
+	}
+	if (used == 0)
+		vq_relchain_prepare(vq, idx[used++], 0);
+
+	if (net->rx_merge && iov[0].iov_len >= sizeof(*vrxh)) {
+		vrxh = iov[0].iov_base;
+		vrxh->vrh_bufs = used;
+	}
+
+	for (i = used; i < nchains; i++)
+		vq_retchain(vq);
+
+	return 1;
+}
+
+static void
+virtio_net_tap_rx(struct virtio_net_qpair *qp)
+{
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq;
+	int rc, batch;
 	ssize_t ret;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	if (net->tapfd == -1) {
+	if (qp->tapfd == -1) {
 		WPRINTF(("vtnet: tapfd == -1\n"));
 		return;
 	}
@@ -388,11 +688,11 @@ virtio_net_tap_rx(struct virtio_net *net)
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!qp->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		return;
@@ -401,68 +701,51 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
+	vq = &net->queues[qp->idx * 2 + VIRTIO_NET_RXQ];
 	if (!vq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		vq_endchains(vq, 1);
 		return;
 	}
 
+	/*
+	 * Frames are read back to back and their chains are only made
+	 * visible to the guest every VIRTIO_NET_RX_BATCH frames, so a
+	 * burst of small packets costs one used index update per batch
+	 * instead of one per frame, and one interrupt per wakeup.
+	 */
+	batch = 0;
 	do {
-		/*
-		 * Get descriptor chain.
-		 */
-		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
-			return;
-		}
-		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
-		 */
-		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-		if (riov == NULL)
-			return;
-
-		len = readv(net->tapfd, riov, n);
+		if (net->tap_vnet_hdr)
+			rc = virtio_net_tap_rx_vnet(qp, vq);
+		else
+			rc = virtio_net_tap_rx_one(qp, vq);
 
-		if (len < 0 && errno == EWOULDBLOCK) {
+		if (rc <= 0) {
+			vq_relchain_publish(vq);
 			/*
 			 * No more packets, but still some avail ring
 			 * entries.  Interrupt if needed/appropriate.
 			 */
-			vq_retchain(vq);
-			vq_endchains(vq, 0);
+			if (rc == 0)
+				vq_endchains(vq, 0);
 			return;
 		}
 
-		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
-		 */
-		memset(vrx, 0, net->rx_vhdrlen);
-
-		if (net->rx_merge) {
-			struct virtio_net_rxhdr *vrxh;
-
-			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
+		if (++batch == VIRTIO_NET_RX_BATCH) {
+			vq_relchain_publish(vq);
+			batch = 0;
 		}
-
-		/*
-		 * Release this chain and handle more chains.
-		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
 	} while (vq_has_descs(vq));
 
+	vq_relchain_publish(vq);
+
 	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
 	vq_endchains(vq, 1);
 }
@@ -470,13 +753,13 @@ virtio_net_tap_rx(struct virtio_net *net)
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qpair *qp = param;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
 }
 
@@ -484,54 +767,82 @@ static void
 virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->qpairs[vq->num / 2];
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
+	if (qp->rx_ready == 0) {
+		qp->rx_ready = 1;
 		if (vq->used != NULL) {
 			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 		}
 	}
 }
 
+/*
+ * Send up to VIRTIO_NET_TX_BATCH frames: the chains are taken with a
+ * single read of the avail index and returned with a single used index
+ * update.  Each chain gets VIRTIO_NET_MAXSEGS + 1 iovecs, a chain that
+ * fills all of them is too long and is dropped.
+ */
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
-	int i, n;
+	struct iovec iov[VIRTIO_NET_TX_BATCH * (VIRTIO_NET_MAXSEGS + 1)];
+	struct vq_chain chains[VIRTIO_NET_TX_BATCH];
+	struct vq_chain *c;
+	int i, k, n;
 	int plen, tlen;
-	uint16_t idx;
 
-	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
-	 * up two lengths: packet length and transfer length.
-	 */
-	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
+	n = vq_getchains_batch(vq, chains, VIRTIO_NET_TX_BATCH, iov,
+			       VIRTIO_NET_MAXSEGS + 1, NULL);
+	if (n < 1) {
+		WPRINTF(("vtnet: virtio_net_proctx: vq_getchains_batch = %d\n",
+			 n));
 		return;
 	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
-		tlen += iov[i].iov_len;
-	}
 
-	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	for (k = 0; k < n; k++) {
+		c = &chains[k];
+		if (c->niov > VIRTIO_NET_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_proctx: %d segs\n",
+				 c->niov));
+			c->len = 0;
+			continue;
+		}
+
+		/*
+		 * The first descriptor is really the header
+		 * descriptor, so we need to sum up two lengths:
+		 * packet length and transfer length.
+		 */
+		plen = 0;
+		tlen = c->iov[0].iov_len;
+		for (i = 1; i < c->niov; i++) {
+			plen += c->iov[i].iov_len;
+			tlen += c->iov[i].iov_len;
+		}
+
+		DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r",
+			 plen, c->niov));
+		if (qp->net->tap_vnet_hdr)
+			qp->net->virtio_net_tx(qp, c->iov, c->niov, plen);
+		else
+			qp->net->virtio_net_tx(qp, &c->iov[1], c->niov - 1,
+					       plen);
+		c->len = tlen;
+	}
 
-	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+	/* chains are processed, release them with their tlen */
+	vq_relchains_batch(vq, chains, n);
 }
 
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->qpairs[vq->num / 2];
 
 	/*
 	 * Any ring entries to process?
@@ -540,11 +851,11 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -553,27 +864,28 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[qp->idx * 2 + VIRTIO_NET_TXQ];
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -587,18 +899,18 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
 		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
@@ -606,7 +918,7 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(qp, vq);
 		} while (vq_has_descs(vq));
 
 		/*
@@ -614,17 +926,86 @@ virtio_net_tx_thread(void *param)
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
+	}
+}
+
+static uint8_t
+virtio_net_ctrl_mq(struct virtio_net *net, struct virtio_net_ctrl_hdr *hdr,
+		   uint8_t *data, int len)
+{
+	uint16_t pairs;
+
+	if (hdr->cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET ||
+	    len < sizeof(pairs))
+		return VIRTIO_NET_ERR;
+
+	memcpy(&pairs, data, sizeof(pairs));
+	if (pairs < 1 || pairs > net->nqpairs) {
+		WPRINTF(("vtnet: invalid queue pairs %u\n", pairs));
+		return VIRTIO_NET_ERR;
 	}
+
+	DPRINTF(("vtnet: guest enables %u queue pairs\n", pairs));
+	virtio_net_set_qpairs(net, pairs);
+	return VIRTIO_NET_OK;
 }
 
-#ifdef notyet
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct virtio_net_ctrl_hdr *hdr;
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	uint16_t flags[VIRTIO_NET_MAXSEGS];
+	uint8_t buf[64];
+	uint8_t *ack;
+	int i, n, len;
+	uint16_t idx;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, flags);
+		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n",
+				n));
+			return;
+		}
+
+		/*
+		 * The command is made of the readable descriptors and
+		 * the ack byte is the first writable one.
+		 */
+		len = 0;
+		ack = NULL;
+		for (i = 0; i < n; i++) {
+			if (flags[i] & VRING_DESC_F_WRITE) {
+				ack = iov[i].iov_base;
+				break;
+			}
+			if (len + iov[i].iov_len > sizeof(buf))
+				break;
+			memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+			len += iov[i].iov_len;
+		}
+
+		if (ack == NULL || len < sizeof(*hdr)) {
+			WPRINTF(("vtnet: malformed control command\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		hdr = (struct virtio_net_ctrl_hdr *)buf;
+		if (hdr->class == VIRTIO_NET_CTRL_MQ)
+			*ack = virtio_net_ctrl_mq(net, hdr, buf + sizeof(*hdr),
+					len - sizeof(*hdr));
+		else
+			*ack = VIRTIO_NET_ERR;
+
+		vq_relchain(vq, idx, sizeof(*ack));
+	}
+
+	vq_endchains(vq, 1);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -704,10 +1085,11 @@ virtio_net_is_macvtap(char *devname, int *ifindex)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, bool mq, bool *vnet_hdr)
 {
 	char tbuf[IFNAMSIZ];
 	int tunfd, rc, macvtap_index;
+	unsigned int features;
 	struct ifreq ifr;
 
 	/*Check if tun/tap or macvtap interface is used */
@@ -730,6 +1112,15 @@ virtio_net_tap_open(char *devname)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (mq)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	if (*vnet_hdr) {
+		if (ioctl(tunfd, TUNGETFEATURES, &features) == 0 &&
+		    (features & IFF_VNET_HDR))
+			ifr.ifr_flags |= IFF_VNET_HDR;
+		else
+			*vnet_hdr = false;
+	}
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -748,9 +1139,69 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Find out which of the offloads the tap device accepts, newer
+ * kernels refuse TUN_F_UFO.
+ */
+static void
+virtio_net_tap_probe_offloads(struct virtio_net *net, int tapfd)
+{
+	int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+
+	if (ioctl(tapfd, TUNSETOFFLOAD, offloads | TUN_F_UFO) == 0)
+		net->tap_offloads = offloads | TUN_F_UFO;
+	else if (ioctl(tapfd, TUNSETOFFLOAD, offloads) == 0)
+		net->tap_offloads = offloads;
+	else
+		net->tap_offloads = 0;
+
+	ioctl(tapfd, TUNSETOFFLOAD, 0);
+}
+
+/*
+ * Program the tap with the rx header size and the offloads the guest
+ * can receive.  Both are per device, so the first queue is enough.
+ */
+static void
+virtio_net_tap_set_offloads(struct virtio_net *net)
+{
+	int tapfd = net->qpairs[0].tapfd;
+	int offloads = 0;
+
+	if (!net->tap_vnet_hdr || tapfd < 0)
+		return;
+
+	if (ioctl(tapfd, TUNSETVNETHDRSZ, &net->rx_vhdrlen) < 0)
+		WPRINTF(("vtnet: TUNSETVNETHDRSZ failed: %d\n", errno));
+
+	if (net->features & VIRTIO_NET_F_GUEST_CSUM) {
+		offloads |= TUN_F_CSUM;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO4)
+			offloads |= TUN_F_TSO4;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO6)
+			offloads |= TUN_F_TSO6;
+		if (net->features & VIRTIO_NET_F_GUEST_ECN)
+			offloads |= TUN_F_TSO_ECN;
+		if (net->features & VIRTIO_NET_F_GUEST_UFO)
+			offloads |= TUN_F_UFO;
+	}
+	offloads &= net->tap_offloads;
+
+	if (ioctl(tapfd, TUNSETOFFLOAD, offloads) < 0)
+		WPRINTF(("vtnet: TUNSETOFFLOAD %#x failed: %d\n",
+			offloads, errno));
+
+	net->rx_gso = !!(offloads & (TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_UFO));
+}
+
+/*
+ * Open one tap queue for the pair; with multiple pairs every queue is
+ * a separate IFF_MULTI_QUEUE fd on the same interface.
+ */
 static void
-virtio_net_tap_setup(struct virtio_net *net, char *devname)
+virtio_net_tap_setup(struct virtio_net_qpair *qp, char *devname)
 {
+	struct virtio_net *net = qp->net;
 	char tbuf[IFNAMSIZ];
 	int vhost_fd = -1;
 	int rc;
@@ -759,15 +1210,16 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
 		WPRINTF(("Failed to set tap device name %s\n", tbuf));
 
-	net->virtio_net_rx = virtio_net_tap_rx;
-	net->virtio_net_tx = virtio_net_tap_tx;
-
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
+	qp->tapfd = virtio_net_tap_open(tbuf, net->nqpairs > 1,
+					&net->tap_vnet_hdr);
+	if (qp->tapfd == -1) {
 		WPRINTF(("open of tap device %s failed\n", tbuf));
 		return;
 	}
-	DPRINTF(("open of tap device %s success!\n", tbuf));
+	DPRINTF(("open of tap device %s queue %d success!\n", tbuf, qp->idx));
+
+	if (qp->idx == 0 && net->tap_vnet_hdr)
+		virtio_net_tap_probe_offloads(net, qp->tapfd);
 
 	/*
 	 * Set non-blocking and register for read
@@ -775,10 +1227,10 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	 */
 	int opt = 1;
 
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
+	if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
 		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+		close(qp->tapfd);
+		qp->tapfd = -1;
 	}
 
 	if (net->use_vhost) {
@@ -786,9 +1238,9 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 		if (vhost_fd < 0)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
-			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
-			if (!net->vhost_net) {
+			qp->vhost_net = vhost_net_init(&net->base, vhost_fd,
+				false, qp->tapfd, qp->idx * 2);
+			if (!qp->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
 				close(vhost_fd);
@@ -798,17 +1250,40 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	}
 
 	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
+		/* keep rx traffic off the main event loop */
+		qp->mevp = mevent_add_loop(mevent_loop_get("net"), qp->tapfd,
+					   EVF_READ, virtio_net_rx_callback,
+					   qp, virtio_net_teardown, qp);
+		if (qp->mevp == NULL) {
 			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+			close(qp->tapfd);
+			qp->tapfd = -1;
 		}
 	}
 }
 
+/*
+ * Hand the data path of the device over to a vhost-user backend, e.g.
+ * a DPDK switch, listening on the unix socket at path.
+ */
+static void
+virtio_net_vhost_user_setup(struct virtio_net_qpair *qp, const char *path)
+{
+	int fd;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		WPRINTF(("connect to vhost-user backend %s failed\n", path));
+		return;
+	}
+
+	qp->vhost_net = vhost_net_init(&qp->net->base, fd, true, -1, 0);
+	if (!qp->vhost_net) {
+		WPRINTF(("vhost_net_init for vhost-user failed\n"));
+		close(fd);
+	}
+}
+
 static int
 virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -822,7 +1297,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct virtio_net_qpair *qp;
+	int i, nvq, rc;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -848,7 +1324,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 * Read the MAC address if specified
 	 */
 	mac_provided = 0;
-	net->vhost_net = NULL;
+	net->nqpairs = 1;
 	if (opts != NULL) {
 		int err;
 
@@ -864,7 +1340,18 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
 				net->use_vhost = true;
-			else {
+			else if (!strncmp(opt, "mq=", 3)) {
+				if (dm_strtoi(opt + 3, NULL, 10, &net->nqpairs)
+				    || net->nqpairs < 1
+				    || net->nqpairs > VIRTIO_NET_MAX_QPAIRS) {
+					pr_err("Invalid queue pairs %s, "
+					       "range is 1-%d\n", opt + 3,
+					       VIRTIO_NET_MAX_QPAIRS);
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else {
 				err = virtio_net_parsemac(opt,
 					net->config.mac);
 				if (err != 0) {
@@ -875,26 +1362,62 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				mac_provided = 1;
 			}
 		}
+
+		if (!strncmp(devname, "vhost_user=", 11)) {
+			if (net->nqpairs > 1) {
+				pr_err("vhost-user supports one queue pair\n");
+				free(devname);
+				free(net);
+				return -1;
+			}
+			net->use_vhost = true;
+		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	/*
+	 * With more than one queue pair a control queue is appended
+	 * so the guest can tell how many pairs it actually uses.
+	 */
+	nvq = net->nqpairs * 2;
+	if (net->nqpairs > 1)
+		nvq++;
+	net->ops = virtio_net_ops;
+	net->ops.nvq = nvq;
+
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
+	if (!net->use_vhost)
+		net->base.flags |= VIRTIO_KICK_EVENTFD;
 	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
-
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	if (net->nqpairs > 1)
+		net->base.device_caps |= VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ;
+
+	for (i = 0; i < net->nqpairs; i++) {
+		net->queues[i * 2 + VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[i * 2 + VIRTIO_NET_RXQ].notify =
+			virtio_net_ping_rxq;
+		net->queues[i * 2 + VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[i * 2 + VIRTIO_NET_TXQ].notify =
+			virtio_net_ping_txq;
+	}
+	if (net->nqpairs > 1) {
+		net->queues[nvq - 1].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[nvq - 1].notify = virtio_net_ping_ctlq;
+	}
+	net->config.max_virtqueue_pairs = net->nqpairs;
+	net->curr_qpairs = net->nqpairs;
+	net->refs = net->nqpairs;
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
+	for (i = 0; i < net->nqpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->net = net;
+		qp->idx = i;
+		qp->tapfd = -1;
+	}
 
 	if (!devname) {
 		WPRINTF(("virtio_net: devname NULL\n"));
@@ -902,12 +1425,43 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
-	if ((strstr(devname, "tap") != NULL) ||
-	    (strncmp(devname, "vmnet", 5) == 0))
-		virtio_net_tap_setup(net, devname);
+	net->virtio_net_rx = virtio_net_tap_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
+
+	if (!strncmp(devname, "vhost_user=", 11))
+		virtio_net_vhost_user_setup(&net->qpairs[0], devname + 11);
+	else if (!strcmp(devname, "loopback")) {
+		if (net->use_vhost) {
+			pr_err("loopback doesn't support vhost\n");
+			free(devname);
+			free(net);
+			return -1;
+		}
+		net->loopback = true;
+		net->virtio_net_tx = virtio_net_loop_tx;
+	} else if ((strstr(devname, "tap") != NULL) ||
+	    (strncmp(devname, "vmnet", 5) == 0)) {
+		/*
+		 * Let the tap exchange the virtio-net header with us so
+		 * checksum and segmentation offloads can be passed through;
+		 * vhost-net handles the header by itself.
+		 */
+		net->tap_vnet_hdr = !net->use_vhost;
+		for (i = 0; i < net->nqpairs; i++)
+			virtio_net_tap_setup(&net->qpairs[i], devname);
+
+		if (net->tap_vnet_hdr && net->tap_offloads) {
+			net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+			if (net->tap_offloads & TUN_F_UFO)
+				net->base.device_caps |= VIRTIO_NET_S_UFOCAPS;
+		}
+	}
 
 	free(devname);
 
+	/* start with a single pair until the guest asks for more */
+	virtio_net_set_qpairs(net, 1);
+
 	/*
 	 * The default MAC address is the standard NetApp OUI of 00-a0-98,
 	 * followed by an MD5 of the PCI slot/func number and dev name
@@ -938,8 +1492,9 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	else
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
-	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	/* Link is up if we managed to open tap device or vhost-user */
+	net->config.status = (opts == NULL || net->qpairs[0].tapfd >= 0 ||
+			      net->qpairs[0].vhost_net != NULL || net->loopback);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -956,22 +1511,30 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
+	virtio_net_tap_set_offloads(net);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Initialize tx semaphore & spawn one TX processing thread
+	 * per queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->nqpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		if (net->nqpairs == 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx",
+				 dev->slot, dev->func);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d",
+				 dev->slot, dev->func, i);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
 
 	return 0;
 }
@@ -1023,74 +1586,108 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+
+	virtio_net_tap_set_offloads(net);
 }
 
 static void
 virtio_net_set_status(void *vdev, uint64_t status)
 {
 	struct virtio_net *net = vdev;
-	int rc;
-
-	if (!net->vhost_net)
-		return;
-
-	if (!net->vhost_net->vhost_started &&
-		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
-
-		rc = vhost_net_start(net->vhost_net);
-		if (rc < 0) {
-			WPRINTF(("vhost_net_start failed\n"));
-			return;
+	struct virtio_net_qpair *qp;
+	int i, rc;
+
+	for (i = 0; i < net->nqpairs; i++) {
+		qp = &net->qpairs[i];
+		if (!qp->vhost_net)
+			continue;
+
+		if (!qp->vhost_net->vhost_started &&
+			(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+			if (qp->mevp)
+				mevent_disable(qp->mevp);
+
+			rc = vhost_net_start(qp->vhost_net);
+			if (rc < 0) {
+				WPRINTF(("vhost_net_start failed\n"));
+				return;
+			}
+		} else if (qp->vhost_net->vhost_started &&
+			((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
+			rc = vhost_net_stop(qp->vhost_net);
+			if (rc < 0)
+				WPRINTF(("vhost_net_stop failed\n"));
 		}
-	} else if (net->vhost_net->vhost_started &&
-		((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
-		rc = vhost_net_stop(net->vhost_net);
-		if (rc < 0)
-			WPRINTF(("vhost_net_stop failed\n"));
 	}
 }
 
+static void
+virtio_net_put(struct virtio_net *net)
+{
+	if (__sync_sub_and_fetch(&net->refs, 1) == 0)
+		free(net);
+}
+
+/*
+ * Close the tap queue of one pair; the device is freed once the last
+ * queue is gone.
+ */
 static void
 virtio_net_teardown(void *param)
 {
+	struct virtio_net_qpair *qp;
 	struct virtio_net *net;
 
-	net = (struct virtio_net *)param;
-	if (!net)
+	qp = (struct virtio_net_qpair *)param;
+	if (!qp)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
-	} else
-		pr_err("net->tapfd is -1!\n");
+	net = qp->net;
+	if (qp->tapfd >= 0) {
+		close(qp->tapfd);
+		qp->tapfd = -1;
+	} else if (!net->loopback)
+		pr_err("qp->tapfd is -1!\n");
 
-	free(net);
+	virtio_net_put(net);
 }
 
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct virtio_net_qpair *qp;
+	int i, n;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
+		n = net->nqpairs;
 
-		virtio_net_tx_stop(net);
+		for (i = 0; i < n; i++) {
+			qp = &net->qpairs[i];
+			virtio_net_tx_stop(qp);
 
-		if (net->vhost_net) {
-			vhost_net_stop(net->vhost_net);
-			vhost_net_deinit(net->vhost_net);
-			free(net->vhost_net);
-			net->vhost_net = NULL;
+			if (qp->vhost_net) {
+				vhost_net_stop(qp->vhost_net);
+				vhost_net_deinit(qp->vhost_net);
+				free(qp->vhost_net);
+				qp->vhost_net = NULL;
+			}
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
-			virtio_net_teardown(net);
+		/*
+		 * Teardowns run asynchronously from the event loop, hold
+		 * a reference until all of them are queued.
+		 */
+		__sync_add_and_fetch(&net->refs, 1);
+		for (i = 0; i < n; i++) {
+			qp = &net->qpairs[i];
+			if (qp->mevp != NULL)
+				mevent_delete(qp->mevp);
+			else
+				virtio_net_teardown(qp);
+		}
+		virtio_net_put(net);
 
 		DPRINTF(("%s: done\n", __func__));
 	} else
@@ -1098,7 +1695,8 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 }
 
 static struct vhost_net *
-vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
+vhost_net_init(struct virtio_base *base, int vhostfd, bool user, int tapfd,
+	       int vq_idx)
 {
 	struct vhost_net *vhost_net = NULL;
 	uint64_t vhost_features = VIRTIO_NET_S_VHOSTCAPS;
@@ -1115,6 +1713,7 @@ vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
 	/* pre-init before calling vhost_dev_init */
 	vhost_net->vdev.nvqs = ARRAY_SIZE(vhost_net->vqs);
 	vhost_net->vdev.vqs = vhost_net->vqs;
+	vhost_net->vdev.user = user;
 	vhost_net->tapfd = tapfd;
 
 	rc = vhost_dev_init(&vhost_net->vdev, base, vhostfd, vq_idx,
@@ -1198,6 +1797,7 @@ struct pci_vdev_ops pci_ops_virtio_net = {
 	.class_name	= "virtio-net",
 	.vdev_init	= virtio_net_init,
 	.vdev_deinit	= virtio_net_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
@@ -27,8 +27,14 @@
 
 /*
  * virtio entropy device emulation.
+ *
+ * The requests are served from a pool refilled with getrandom(), a page at
+ * a time, so that a guest reseeding at boot doesn't pay a system call per
+ * request, and a batch of chains is returned with one used index update.
  */
 
+#include <sys/param.h>
+#include <sys/random.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,6 +50,9 @@
 #include "vmmapi.h"			/* for vmctx */
 
 #define VIRTIO_RND_RINGSZ	64
+#define VIRTIO_RND_BATCH	16	/* chains served per used index update */
+#define VIRTIO_RND_SEGS		8	/* max descriptors of a chain */
+#define VIRTIO_RND_POOLSZ	4096
 
 /*
  * Per-device struct
@@ -59,6 +68,10 @@ struct virtio_rnd {
 	pthread_t rx_tid;
 	pthread_mutex_t	rx_mtx;
 	pthread_cond_t rx_cond;
+	/* entropy not handed out yet is pool[pool_off, pool_len) */
+	uint8_t pool[VIRTIO_RND_POOLSZ];
+	size_t pool_off;
+	size_t pool_len;
 	/* VBS-K variables */
 	struct {
 		enum VBS_K_STATUS status;
@@ -297,14 +310,66 @@ virtio_rnd_reset(void *base)
 	}
 }
 
+/*
+ * getrandom() only blocks until the kernel CRNG is seeded, the /dev/random
+ * fd is kept for the kernels without it.
+ */
+static int
+virtio_rnd_refill(struct virtio_rnd *rnd)
+{
+	ssize_t len;
+
+	len = getrandom(rnd->pool, sizeof(rnd->pool), 0);
+	if (len < 0 && errno == ENOSYS)
+		len = read(rnd->fd, rnd->pool, sizeof(rnd->pool));
+	if (len <= 0)
+		return -1;
+
+	rnd->pool_off = 0;
+	rnd->pool_len = len;
+	return 0;
+}
+
+/* Fill the buffers of a chain, returns the bytes written */
+static uint32_t
+virtio_rnd_fill(struct virtio_rnd *rnd, struct iovec *iov, int niov)
+{
+	uint32_t len = 0;
+	size_t left, n;
+	uint8_t *buf;
+	int i;
+
+	for (i = 0; i < niov; i++) {
+		buf = iov[i].iov_base;
+		left = iov[i].iov_len;
+		while (left > 0) {
+			if (rnd->pool_off == rnd->pool_len &&
+			    virtio_rnd_refill(rnd) < 0)
+				return len;
+
+			n = MIN(left, rnd->pool_len - rnd->pool_off);
+			memcpy(buf, rnd->pool + rnd->pool_off, n);
+			/* what the guest got is not kept around */
+			memset(rnd->pool + rnd->pool_off, 0, n);
+			rnd->pool_off += n;
+			buf += n;
+			left -= n;
+			len += n;
+		}
+	}
+
+	return len;
+}
+
 static void *
 virtio_rnd_get_entropy(void *param)
 {
 	struct virtio_rnd *rnd = param;
 	struct virtio_vq_info *vq = &rnd->vq;
-	struct iovec iov;
-	uint16_t idx;
-	ssize_t len;
+	struct vq_chain chains[VIRTIO_RND_BATCH];
+	struct iovec iov[VIRTIO_RND_BATCH * VIRTIO_RND_SEGS];
+	int i, n;
+	bool failed;
 
 	for (;;) {
 		pthread_mutex_lock(&rnd->rx_mtx);
@@ -321,26 +386,37 @@ virtio_rnd_get_entropy(void *param)
 		rnd->in_progress = 1;
 		pthread_mutex_unlock(&rnd->rx_mtx);
 
+		failed = false;
 		do {
-			vq_getchain(vq, &idx, &iov, 1, NULL);
-			len = read(rnd->fd, iov.iov_base, iov.iov_len);
-			if (len <= 0) {
-				vq_retchain(vq);
-				vq_endchains(vq, 0);
-
-				/* no data available */
-				if (len == -1 && errno == EAGAIN)
-					return NULL;
+			n = vq_getchains_batch(vq, chains, VIRTIO_RND_BATCH,
+					       iov, VIRTIO_RND_SEGS, NULL);
+			if (n < 1)
 				break;
+
+			/*
+			 * A chain short of entropy is returned with what it
+			 * got, the guest asks again for the rest.
+			 */
+			for (i = 0; i < n; i++) {
+				chains[i].len = virtio_rnd_fill(rnd,
+						chains[i].iov, chains[i].niov);
+				if (chains[i].len == 0)
+					failed = true;
 			}
 
-			/* release this chain and handle more */
-			vq_relchain(vq, idx, len);
-		} while (vq_has_descs(vq));
+			/* release this batch and handle more */
+			vq_relchains_batch(vq, chains, n);
+		} while (!failed && vq_has_descs(vq));
+
+		if (failed)
+			WPRINTF(("virtio_rnd: getrandom failed, errno %d\n",
+				 errno));
 
 		/* at least one avail ring element has been processed */
 		vq_endchains(vq, 1);
 	}
+
+	return NULL;
 }
 
 static void
@@ -519,6 +595,7 @@ struct pci_vdev_ops pci_ops_virtio_rnd = {
 	.class_name	= "virtio-rnd",
 	.vdev_init	= virtio_rnd_init,
 	.vdev_deinit	= virtio_rnd_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
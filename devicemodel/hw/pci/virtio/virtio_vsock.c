@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio vsock device: AF_VSOCK stream sockets between the host and the
+ * guest, with no network configuration on either side.
+ *
+ * The rx and tx virtqueues, and the sockets behind them, are served by
+ * vhost: the vhost-vsock driver of the Service VM kernel by default, or
+ * a vhost-user vsock backend with vhost_user=<socket path>. The device
+ * model only keeps the event virtqueue, used for the transport reset
+ * events the guest never gets from a VM which is not migrated.
+ *
+ * usage: -s <slot>,virtio-vsock,cid=<guest cid>[,vhost_user=<socket path>]
+ */
+
+#include <sys/param.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vhost.h"
+#include "dm_string.h"
+
+#define VIRTIO_VSOCK_RINGSZ	128
+
+#define VIRTIO_VSOCK_RXQ	0
+#define VIRTIO_VSOCK_TXQ	1
+#define VIRTIO_VSOCK_EVTQ	2
+#define VIRTIO_VSOCK_MAXQ	3
+
+/* the rx and tx virtqueues are given to vhost */
+#define VIRTIO_VSOCK_VHOSTQ	2
+
+/* the CIDs up to 2 are reserved for the hypervisor and the host */
+#define VIRTIO_VSOCK_MIN_CID	3UL
+#define VIRTIO_VSOCK_MAX_CID	0xffffffffUL
+
+#define VIRTIO_VSOCK_F_SEQPACKET	1 /* SOCK_SEQPACKET supported */
+
+#define VIRTIO_VSOCK_S_HOSTCAPS \
+	((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1UL << VIRTIO_RING_F_EVENT_IDX) | (1UL << VIRTIO_VSOCK_F_SEQPACKET))
+
+struct virtio_vsock_config {
+	uint64_t guest_cid;
+} __attribute__((packed));
+
+/*
+ * Per-device struct
+ */
+struct virtio_vsock {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_VSOCK_MAXQ];
+	pthread_mutex_t mtx;
+	struct virtio_vsock_config config;
+	struct vhost_dev vdev;
+	struct vhost_vq vqs[VIRTIO_VSOCK_VHOSTQ];
+};
+
+static int virtio_vsock_debug;
+#define DPRINTF(params) do { if (virtio_vsock_debug) pr_dbg params; } while (0)
+#define WPRINTF(params) (pr_err params)
+
+static void virtio_vsock_reset(void *vdev);
+static void virtio_vsock_notify(void *vdev, struct virtio_vq_info *vq);
+static int virtio_vsock_cfgread(void *vdev, int offset, int size,
+	uint32_t *retval);
+static int virtio_vsock_cfgwrite(void *vdev, int offset, int size,
+	uint32_t value);
+static void virtio_vsock_set_status(void *vdev, uint64_t status);
+
+static struct virtio_ops virtio_vsock_ops = {
+	"virtio_vsock",			/* our name */
+	VIRTIO_VSOCK_MAXQ,		/* we support 3 virtqueues */
+	sizeof(struct virtio_vsock_config), /* config reg size */
+	virtio_vsock_reset,		/* reset */
+	virtio_vsock_notify,		/* device-wide qnotify */
+	virtio_vsock_cfgread,		/* read virtio config */
+	virtio_vsock_cfgwrite,		/* write virtio config */
+	NULL,				/* apply negotiated features */
+	virtio_vsock_set_status,	/* called on guest set status */
+};
+
+static void
+virtio_vsock_reset(void *vdev)
+{
+	struct virtio_vsock *vsock = vdev;
+
+	DPRINTF(("virtio_vsock: device reset requested\n"));
+	virtio_reset_dev(&vsock->base);
+}
+
+/*
+ * The kicks of rx and tx only get here before vhost is started, those of
+ * the event virtqueue just post buffers we have no event for.
+ */
+static void
+virtio_vsock_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	DPRINTF(("virtio_vsock: notify of vq %ld ignored\n",
+		 vq - ((struct virtio_vsock *)vdev)->queues));
+}
+
+static int
+virtio_vsock_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_vsock *vsock = vdev;
+	void *ptr;
+
+	ptr = (uint8_t *)&vsock->config + offset;
+	memcpy(retval, ptr, size);
+	return 0;
+}
+
+static int
+virtio_vsock_cfgwrite(void *vdev, int offset, int size, uint32_t value)
+{
+	DPRINTF(("virtio_vsock: write to readonly reg %d\n", offset));
+	return -1;
+}
+
+static void
+virtio_vsock_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_vsock *vsock = vdev;
+
+	if (!vsock->vdev.started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(&vsock->vdev) < 0) {
+			WPRINTF(("virtio_vsock: vhost_dev_start failed\n"));
+			return;
+		}
+		if (vhost_vsock_set_running(&vsock->vdev, true) < 0) {
+			WPRINTF(("virtio_vsock: vhost vsock start failed\n"));
+			vhost_dev_stop(&vsock->vdev);
+		}
+	} else if (vsock->vdev.started &&
+		   (status & VIRTIO_CONFIG_S_DRIVER_OK) == 0) {
+		vhost_vsock_set_running(&vsock->vdev, false);
+		if (vhost_dev_stop(&vsock->vdev) < 0)
+			WPRINTF(("virtio_vsock: vhost_dev_stop failed\n"));
+	}
+}
+
+static int
+virtio_vsock_parse_opts(char *opts, unsigned long *cid, char **path)
+{
+	char *cp, *opt;
+
+	*cid = 0;
+	*path = NULL;
+	cp = opts;
+	while (cp && (opt = strsep(&cp, ",")) != NULL) {
+		if (!strncmp(opt, "cid=", 4)) {
+			if (dm_strtoul(opt + 4, NULL, 10, cid) < 0 ||
+			    *cid < VIRTIO_VSOCK_MIN_CID ||
+			    *cid > VIRTIO_VSOCK_MAX_CID) {
+				WPRINTF(("virtio_vsock: invalid %s\n", opt));
+				return -1;
+			}
+		} else if (!strncmp(opt, "vhost_user=", 11)) {
+			*path = opt + 11;
+		} else if (*opt != '\0') {
+			WPRINTF(("virtio_vsock: unknown option %s\n", opt));
+			return -1;
+		}
+	}
+
+	/* a vhost-user backend has the CID in its own config */
+	if (*cid == 0 && *path == NULL) {
+		WPRINTF(("virtio_vsock: cid=<guest cid> is needed\n"));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+virtio_vsock_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_vsock *vsock;
+	pthread_mutexattr_t attr;
+	unsigned long cid;
+	char *path, *opts_dup = NULL;
+	int fd, i, rc;
+
+	if (opts) {
+		opts_dup = strdup(opts);
+		if (!opts_dup) {
+			WPRINTF(("virtio_vsock: strdup failed\n"));
+			return -1;
+		}
+	}
+	if (virtio_vsock_parse_opts(opts_dup, &cid, &path) < 0)
+		goto opts_fail;
+
+	if (path)
+		fd = vhost_user_connect(path);
+	else
+		fd = open("/dev/vhost-vsock", O_RDWR);
+	if (fd < 0) {
+		WPRINTF(("virtio_vsock: open of %s failed\n",
+			 path ? path : "/dev/vhost-vsock"));
+		goto opts_fail;
+	}
+
+	vsock = calloc(1, sizeof(struct virtio_vsock));
+	if (!vsock) {
+		WPRINTF(("virtio_vsock: calloc returns NULL\n"));
+		close(fd);
+		goto opts_fail;
+	}
+
+	/* init mutex attribute properly to avoid deadlock */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		DPRINTF(("mutexattr init failed with erro %d!\n", rc));
+	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (rc)
+		DPRINTF(("virtio_vsock: mutexattr_settype failed with "
+			 "error %d!\n", rc));
+	rc = pthread_mutex_init(&vsock->mtx, &attr);
+	if (rc)
+		DPRINTF(("virtio_vsock: pthread_mutex_init failed with "
+			 "error %d!\n", rc));
+
+	virtio_linkup(&vsock->base, &virtio_vsock_ops, vsock, dev,
+		      vsock->queues, BACKEND_VHOST);
+	vsock->base.mtx = &vsock->mtx;
+	vsock->base.device_caps = VIRTIO_VSOCK_S_HOSTCAPS;
+	for (i = 0; i < VIRTIO_VSOCK_MAXQ; i++)
+		vsock->queues[i].qsize = VIRTIO_VSOCK_RINGSZ;
+
+	vsock->vdev.nvqs = VIRTIO_VSOCK_VHOSTQ;
+	vsock->vdev.vqs = vsock->vqs;
+	vsock->vdev.user = (path != NULL);
+
+	/* on failure vhost_dev_init() has closed fd */
+	if (vhost_dev_init(&vsock->vdev, &vsock->base, fd, VIRTIO_VSOCK_RXQ,
+			   VIRTIO_VSOCK_S_HOSTCAPS, 0, 0) < 0) {
+		WPRINTF(("virtio_vsock: vhost_dev_init failed\n"));
+		goto vhost_fail;
+	}
+
+	if (path && cid == 0) {
+		if (vhost_dev_get_config(&vsock->vdev, &vsock->config,
+					 sizeof(vsock->config)) < 0) {
+			WPRINTF(("virtio_vsock: no CID from the backend\n"));
+			goto fail;
+		}
+	} else {
+		if (vhost_vsock_set_guest_cid(&vsock->vdev, cid) < 0) {
+			WPRINTF(("virtio_vsock: CID %lu is in use\n", cid));
+			goto fail;
+		}
+		vsock->config.guest_cid = cid;
+	}
+
+	/* vsock has no legacy interface, the device ID is 0x1040 + type */
+	pci_set_cfgdata16(dev, PCIR_DEVICE, 0x1040 + VIRTIO_TYPE_VSOCK);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_SIMPLECOMM);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_SIMPLECOMM_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_VSOCK);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_REVID, 1);
+
+	/* vhost only signals through MSI-X */
+	if (virtio_interrupt_init(&vsock->base, 1)) {
+		WPRINTF(("virtio_vsock: interrupt_init failed\n"));
+		goto fail;
+	}
+	if (virtio_set_modern_bar(&vsock->base, true)) {
+		WPRINTF(("virtio_vsock: set modern bar failed\n"));
+		goto fail;
+	}
+
+	free(opts_dup);
+	return 0;
+
+fail:
+	vhost_dev_deinit(&vsock->vdev);
+vhost_fail:
+	pthread_mutex_destroy(&vsock->mtx);
+	free(vsock);
+	dev->arg = NULL;
+opts_fail:
+	free(opts_dup);
+	return -1;
+}
+
+static void
+virtio_vsock_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_vsock *vsock = dev->arg;
+
+	if (!vsock)
+		return;
+
+	if (vsock->vdev.started) {
+		vhost_vsock_set_running(&vsock->vdev, false);
+		vhost_dev_stop(&vsock->vdev);
+	}
+	vhost_dev_deinit(&vsock->vdev);
+	pthread_mutex_destroy(&vsock->mtx);
+	free(vsock);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_virtio_vsock = {
+	.class_name	= "virtio-vsock",
+	.vdev_init	= virtio_vsock_init,
+	.vdev_deinit	= virtio_vsock_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_vsock);
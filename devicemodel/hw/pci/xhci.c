@@ -211,6 +211,8 @@ struct pci_xhci_dev_ep {
 
 	struct usb_xfer *ep_xfer;	/* transfer chain */
 	struct acrn_timer isoc_timer;
+	struct acrn_timer isoc_batch_timer;
+	bool isoc_batch_armed;
 	struct xhci_ep_timer_data timer_data;
 	pthread_mutex_t mtx;
 };
@@ -385,6 +387,7 @@ struct pci_xhci_vbdp_dev_state {
 struct pci_xhci_vdev {
 	struct pci_vdev *dev;
 	pthread_mutex_t mtx;
+	struct vm_gpa_map gpa_map;	/* for the inline XHCI_GADDR() */
 
 	uint32_t	caplength;	/* caplen & hciversion */
 	uint32_t	hcsparams1;	/* structural parameters 1 */
@@ -429,14 +432,26 @@ struct pci_xhci_vdev {
 	struct pci_xhci_native_port native_ports[XHCI_MAX_VIRT_PORTS];
 	struct timespec init_time;
 	uint32_t	quirks;
+
+	/* isochronous frames sent per libusb transfer, and the longest wait */
+	int		isoc_frames;
+	int		isoc_delay_us;
+
+	/* interrupt moderation of the interrupter */
+	pthread_mutex_t	intr_mtx;
+	struct acrn_timer imod_timer;
+	bool		imod_armed;
+	uint64_t	last_intr_ns;
 };
 
 /* portregs and devices arrays are set up to start from idx=1 */
 #define	XHCI_PORTREG_PTR(x, n)	(&(x)->portregs[(n)])
 #define	XHCI_SLOTDEV_PTR(x, n)	((x)->slots[(n)])
 #define	XHCI_HALTED(xdev)	((xdev)->opregs.usbsts & XHCI_STS_HCH)
-#define	XHCI_GADDR(xdev, a)	paddr_guest2host((xdev)->dev->vmctx, (a), \
+#define	XHCI_GADDR(xdev, a)	vm_gpa_map_hva(&(xdev)->gpa_map, (a), \
 				XHCI_PADDR_SZ - ((a) & (XHCI_PADDR_SZ-1)))
+/* a data buffer, checked over its whole length */
+#define	XHCI_GADDR_LEN(xdev, a, len)	vm_gpa_map_hva(&(xdev)->gpa_map, (a), (len))
 
 /* port mapping status */
 #define VPORT_FREE (0)
@@ -480,15 +495,21 @@ static inline int pci_xhci_is_valid_portnum(int n);
 static int pci_xhci_parse_tablet(struct pci_xhci_vdev *xdev, char *opts);
 static int pci_xhci_parse_log_level(struct pci_xhci_vdev *xdev, char *opts);
 static int pci_xhci_parse_extcap(struct pci_xhci_vdev *xdev, char *opts);
+static int pci_xhci_parse_isoc(struct pci_xhci_vdev *xdev, char *opts);
 static int pci_xhci_convert_speed(int lspeed);
 static void pci_xhci_free_usb_xfer(struct usb_xfer *xfer);
 static void pci_xhci_isoc_handler(void *arg, uint64_t param);
+static void pci_xhci_isoc_batch_handler(void *arg, uint64_t param);
 
 #define XHCI_OPT_MAX_LEN 32
+#define XHCI_ISOC_FRAMES_MAX	256
+#define XHCI_ISOC_DELAY_DEFAULT	1000	/* us */
 static struct pci_xhci_option_elem xhci_option_table[] = {
 	{"tablet", pci_xhci_parse_tablet},
 	{"log", pci_xhci_parse_log_level},
-	{"cap", pci_xhci_parse_extcap}
+	{"cap", pci_xhci_parse_extcap},
+	{"isoc_frames", pci_xhci_parse_isoc},
+	{"isoc_delay", pci_xhci_parse_isoc}
 };
 
 static bool
@@ -1549,7 +1570,7 @@ pci_xhci_trb_next(struct pci_xhci_vdev *xdev,
 }
 
 static void
-pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
+pci_xhci_fire_interrupt(struct pci_xhci_vdev *xdev)
 {
 
 	xdev->rtsregs.intrreg.erdp |= XHCI_ERDP_LO_BUSY;
@@ -1566,6 +1587,64 @@ pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
 	}
 }
 
+static uint64_t
+pci_xhci_now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * NS_PER_SEC + t.tv_nsec;
+}
+
+static void
+pci_xhci_imod_handler(void *arg, uint64_t nexp)
+{
+	struct pci_xhci_vdev *xdev = arg;
+
+	pthread_mutex_lock(&xdev->intr_mtx);
+	xdev->imod_armed = false;
+	xdev->last_intr_ns = pci_xhci_now_ns();
+	pthread_mutex_unlock(&xdev->intr_mtx);
+
+	pci_xhci_fire_interrupt(xdev);
+}
+
+/*
+ * Honour the IMODI interval of the interrupter: an interrupt asserted less
+ * than IMODI * 250ns after the previous one is held back until the interval
+ * is over, so all the events inserted meanwhile are covered by one interrupt.
+ */
+static void
+pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
+{
+	struct itimerspec its;
+	uint64_t now, interval, elapsed;
+
+	interval = XHCI_IMOD_IVAL_GET(xdev->rtsregs.intrreg.imod) * 250UL;
+
+	pthread_mutex_lock(&xdev->intr_mtx);
+	if (xdev->imod_armed) {
+		pthread_mutex_unlock(&xdev->intr_mtx);
+		return;
+	}
+
+	now = pci_xhci_now_ns();
+	elapsed = now - xdev->last_intr_ns;
+	if (interval && elapsed < interval) {
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_nsec = interval - elapsed;
+		if (acrn_timer_settime(&xdev->imod_timer, &its) == 0) {
+			xdev->imod_armed = true;
+			pthread_mutex_unlock(&xdev->intr_mtx);
+			return;
+		}
+	}
+	xdev->last_intr_ns = now;
+	pthread_mutex_unlock(&xdev->intr_mtx);
+
+	pci_xhci_fire_interrupt(xdev);
+}
+
 static void
 pci_xhci_deassert_interrupt(struct pci_xhci_vdev *xdev)
 {
@@ -1745,6 +1824,17 @@ pci_xhci_init_ep(struct pci_xhci_dev_emu *dev, int epid, uint32_t slot)
 		goto errout;
 	}
 
+	devep->isoc_batch_armed = false;
+	devep->isoc_batch_timer.clockid = CLOCK_MONOTONIC;
+	rc = acrn_timer_init(&devep->isoc_batch_timer,
+			pci_xhci_isoc_batch_handler, &devep->timer_data);
+	if (rc < 0) {
+		UPRINTF(LFTL, "ep%d: failed to create isoc batch timer\r\n",
+				epid);
+		acrn_timer_deinit(&devep->isoc_timer);
+		goto errout;
+	}
+
 	return 0;
 
 errout:
@@ -1782,6 +1872,8 @@ pci_xhci_disable_ep(struct pci_xhci_dev_emu *dev, int epid)
 	}
 
 	acrn_timer_deinit(&devep->isoc_timer);
+	acrn_timer_deinit(&devep->isoc_batch_timer);
+	devep->isoc_batch_armed = false;
 	devep->timer_data.dev = NULL;
 	devep->timer_data.slot = 0;
 	devep->timer_data.epnum = 0;
@@ -2925,8 +3017,12 @@ pci_xhci_xfer_complete(struct pci_xhci_vdev *xdev, struct usb_xfer *xfer,
 			edtla = 0;
 		}
 
+		/*
+		 * The caller asserts one interrupt for all the events
+		 * inserted here.
+		 */
 		*do_intr = 1;
-		if (pci_xhci_insert_event(xdev, &evtrb, 1) != 0) {
+		if (pci_xhci_insert_event(xdev, &evtrb, 0) != 0) {
 			UPRINTF(LFTL, "Failed to inject xfer complete event!\r\n");
 			return err;
 		}
@@ -3025,6 +3121,55 @@ pci_xhci_try_usb_xfer(struct pci_xhci_vdev *xdev,
 	return err;
 }
 
+/*
+ * With isoc_frames set, the frames queued on an isochronous endpoint are
+ * held back until that many are pending, or until isoc_delay has passed
+ * since the first one, and then go in one libusb transfer. A larger batch
+ * means fewer transfers, completions and interrupts, at the cost of latency.
+ *
+ * Return true if the frames are held back.
+ */
+static bool
+pci_xhci_isoc_hold(struct pci_xhci_vdev *xdev, struct pci_xhci_dev_ep *devep,
+		struct xhci_endp_ctx *ep_ctx, struct usb_xfer *xfer)
+{
+	struct itimerspec its;
+	uint8_t type;
+	int i, idx, frames;
+
+	type = XHCI_EPCTX_1_EPTYPE_GET(ep_ctx->dwEpCtx1);
+	if (xdev->isoc_frames <= 1 || (type != XHCI_EPTYPE_ISOC_IN &&
+				type != XHCI_EPTYPE_ISOC_OUT))
+		return false;
+
+	frames = 0;
+	for (i = 0, idx = xfer->head; i < xfer->ndata;
+			i++, idx = index_inc(idx, xfer->max_blk_cnt))
+		if (xfer->data[idx].stat == USB_BLOCK_FREE &&
+				xfer->data[idx].type == USB_DATA_FULL)
+			frames++;
+
+	memset(&its, 0, sizeof(its));
+	if (frames >= xdev->isoc_frames) {
+		if (devep->isoc_batch_armed) {
+			acrn_timer_settime(&devep->isoc_batch_timer, &its);
+			devep->isoc_batch_armed = false;
+		}
+		return false;
+	}
+
+	if (!devep->isoc_batch_armed) {
+		its.it_value.tv_sec = xdev->isoc_delay_us / 1000000;
+		its.it_value.tv_nsec = (xdev->isoc_delay_us % 1000000) * 1000;
+		if (acrn_timer_settime(&devep->isoc_batch_timer, &its)) {
+			UPRINTF(LFTL, "isoc batch timer set time failed\n");
+			return false;
+		}
+		devep->isoc_batch_armed = true;
+	}
+	return true;
+}
+
 static int
 pci_xhci_handle_transfer(struct pci_xhci_vdev *xdev,
 			 struct pci_xhci_dev_emu *dev,
@@ -3162,7 +3307,8 @@ retry:
 			xfer_block = usb_block_append(xfer,
 					(void *)(trbflags & XHCI_TRB_3_IDT_BIT ?
 					&trb->qwTrb0 :
-					XHCI_GADDR(xdev, trb->qwTrb0)),
+					XHCI_GADDR_LEN(xdev, trb->qwTrb0,
+						trb->dwTrb2 & 0x1FFFF)),
 					trb->dwTrb2 & 0x1FFFF, &hcb,
 					sizeof(hcb));
 
@@ -3268,7 +3414,9 @@ retry:
 		setup_trb = NULL;
 	} else {
 		/* handle data transfer */
-		pci_xhci_try_usb_xfer(xdev, dev, devep, ep_ctx, slot, epid);
+		if (!pci_xhci_isoc_hold(xdev, devep, ep_ctx, xfer))
+			pci_xhci_try_usb_xfer(xdev, dev, devep, ep_ctx, slot,
+					epid);
 		err = XHCI_TRB_ERROR_SUCCESS;
 		goto errout;
 	}
@@ -4041,11 +4189,13 @@ static void
 pci_xhci_device_usage(char *opt)
 {
 	static const char *usage_str = "usage:\r\n"
-		" -s <n>,xhci,[bus1-port1,bus2-port2]:[tablet]:[log=x]:[cap=x]\r\n"
+		" -s <n>,xhci,[bus1-port1,bus2-port2]:[tablet]:[log=x]:[cap=x]"
+		":[isoc_frames=n]:[isoc_delay=us]\r\n"
 		" eg: -s 8,xhci,1-2,2-2\r\n"
 		" eg: -s 7,xhci,tablet:log=D\r\n"
 		" eg: -s 7,xhci,1-2,2-2:tablet\r\n"
 		" eg: -s 7,xhci,1-2,2-2:tablet:log=D:cap=apl\r\n"
+		" eg: -s 7,xhci,1-2:isoc_frames=8:isoc_delay=2000\r\n"
 		" Note: please follow the board hardware design, assign the "
 		" ports according to the receptacle connection\r\n";
 
@@ -4249,6 +4399,32 @@ errout:
 	return rc;
 }
 
+static int
+pci_xhci_parse_isoc(struct pci_xhci_vdev *xdev, char *opts)
+{
+	char *s;
+	int val, rc = 0;
+
+	s = strchr(opts, '=');
+	if (!s || dm_strtoi(s + 1, NULL, 10, &val) || val < 0) {
+		rc = -1;
+		goto errout;
+	}
+
+	if (!strncmp(opts, "isoc_frames", sizeof("isoc_frames") - 1)) {
+		if (val > XHCI_ISOC_FRAMES_MAX)
+			val = XHCI_ISOC_FRAMES_MAX;
+		xdev->isoc_frames = val;
+	} else
+		/* one second at most, as a guard against typos */
+		xdev->isoc_delay_us = val > 1000000 ? 1000000 : val;
+
+errout:
+	if (rc)
+		pr_err("USB: fail to set isoc batching, rc=%d\r\n", rc);
+	return rc;
+}
+
 static int
 pci_xhci_parse_opts(struct pci_xhci_vdev *xdev, char *opts)
 {
@@ -4384,6 +4560,30 @@ pci_xhci_isoc_handler(void *arg, uint64_t param)
 				? "under" : "over", pdata->slot, pdata->epnum);
 }
 
+static void
+pci_xhci_isoc_batch_handler(void *arg, uint64_t param)
+{
+	struct xhci_ep_timer_data *pdata;
+	struct pci_xhci_dev_emu *dev;
+	struct pci_xhci_dev_ep *devep;
+
+	pdata = arg;
+	dev = pdata->dev;
+	if (!dev || !dev->xdev || !dev->dev_ctx)
+		return;
+
+	/* send the frames held back by pci_xhci_isoc_hold */
+	devep = &dev->eps[pdata->epnum];
+	pthread_mutex_lock(&devep->mtx);
+	if (devep->isoc_batch_armed && devep->ep_xfer) {
+		devep->isoc_batch_armed = false;
+		pci_xhci_try_usb_xfer(dev->xdev, dev, devep,
+				&dev->dev_ctx->ctx_ep[pdata->epnum],
+				pdata->slot, pdata->epnum);
+	}
+	pthread_mutex_unlock(&devep->mtx);
+}
+
 static int
 pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -4405,6 +4605,7 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	dev->arg = xdev;
 	xdev->dev = dev;
+	vm_get_gpa_map(dev->vmctx, &xdev->gpa_map);
 
 	xdev->usb2_port_start = (XHCI_MAX_DEVS/2) + 1;
 	xdev->usb3_port_start = 1;
@@ -4413,6 +4614,7 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	xdev->pid = PCI_ACRN_XHCI_PID;
 	xdev->excapoff = ACRN_XHCI_EXCAP1;
 	xdev->excap_ptr = NULL;
+	xdev->isoc_delay_us = XHCI_ISOC_DELAY_DEFAULT;
 
 	xdev->rtsregs.mfindex = 0;
 	clock_gettime(CLOCK_MONOTONIC, &xdev->init_time);
@@ -4506,6 +4708,15 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	pthread_mutex_init(&xdev->mtx, NULL);
 
+	pthread_mutex_init(&xdev->intr_mtx, NULL);
+	xdev->imod_timer.clockid = CLOCK_MONOTONIC;
+	error = acrn_timer_init(&xdev->imod_timer, pci_xhci_imod_handler,
+			xdev);
+	if (error) {
+		UPRINTF(LFTL, "failed to create interrupt moderation timer\r\n");
+		goto done;
+	}
+
 	/* create vbdp_thread */
 	xdev->vbdp_polling = true;
 	sem_init(&xdev->vbdp_sem, 0, 0);
@@ -4569,6 +4780,8 @@ pci_xhci_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_join(xdev->vbdp_thread, NULL);
 	sem_close(&xdev->vbdp_sem);
 
+	acrn_timer_deinit(&xdev->imod_timer);
+	pthread_mutex_destroy(&xdev->intr_mtx);
 	pthread_mutex_destroy(&xdev->mtx);
 	free(xdev);
 	xhci_in_use = 0;
@@ -34,6 +34,10 @@
  * the tables and the compiling them to AML with the Intel iasl compiler.
  * The AML files are then read into guest memory.
  *
+ * The iasl runs of the tables are done at the same time, and their output is
+ * kept in a cache keyed by the ASL source, so that a VM launched again with
+ * the same configuration loads the AML files without running iasl at all.
+ *
  *  The tables are placed in the guest's ROM area just below 1MB physical,
  * above the MPTable.
  *
@@ -54,6 +58,7 @@
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <errno.h>
 #include <paths.h>
 #include <stdarg.h>
@@ -63,6 +68,7 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <spawn.h>
 
 #include "dm.h"
 #include "acpi.h"
@@ -97,12 +103,16 @@
 #ifndef ASL_COMPILER
 #define ASL_COMPILER	"/usr/sbin/iasl"
 #endif
+#ifndef ASL_CACHE_DIR
+#define ASL_CACHE_DIR	"/var/cache/acrn/acpi"
+#endif
 
 uint64_t audio_nhlt_len = 0;
 
 static int basl_keep_temps;
 static int basl_verbose_iasl;
 static int basl_ncpu;
+static char basl_cache_dir[MAXPATHLEN];
 static uint32_t basl_acpi_base = ACPI_BASE;
 
 /*
@@ -125,6 +135,14 @@ struct basl_fio {
 	char	f_name[MAXPATHLEN];
 };
 
+/* one table being compiled */
+struct basl_job {
+	struct basl_fio	io[2];
+	pid_t		pid;
+	uint64_t	offset;
+	char		cache_name[MAXPATHLEN];
+};
+
 #define EFPRINTF(...) fprintf(__VA_ARGS__)
 #define EFFLUSH(x) fflush(x)
 
@@ -458,7 +476,8 @@ basl_fwrite_fadt(FILE *fp, struct vmctx *ctx)
 	EFPRINTF(fp, "[0001]\t\tPM1 Event Block Length : 04\n");
 	EFPRINTF(fp, "[0001]\t\tPM1 Control Block Length : 02\n");
 	EFPRINTF(fp, "[0001]\t\tPM2 Control Block Length : 00\n");
-	EFPRINTF(fp, "[0001]\t\tPM Timer Block Length : 00\n");
+	EFPRINTF(fp, "[0001]\t\tPM Timer Block Length : %02X\n",
+	    IO_PMTMR_LEN);
 	EFPRINTF(fp, "[0001]\t\tGPE0 Block Length : 00\n");
 	EFPRINTF(fp, "[0001]\t\tGPE1 Block Length : 00\n");
 	EFPRINTF(fp, "[0001]\t\tGPE1 Base Offset : 00\n");
@@ -1040,52 +1059,197 @@ basl_load(struct vmctx *ctx, int fd, uint64_t off)
 	return 0;
 }
 
+/*
+ * Name the cache entry of an ASL file after a FNV-1a hash and the size of
+ * its content.
+ */
 static int
-basl_compile(struct vmctx *ctx,
-		int (*fwrite_section)(FILE *, struct vmctx *),
-		uint64_t offset)
+basl_cache_name(struct basl_job *job)
 {
-	struct basl_fio io[2];
-	static char iaslbuf[3*MAXPATHLEN + 10];
+	uint8_t buf[4096];
+	uint64_t hash = 0xcbf29ce484222325UL;
+	off_t size = 0;
+	ssize_t len, i;
+
+	if (basl_cache_dir[0] == '\0')
+		return -1;
+
+	while ((len = pread(job->io[0].fd, buf, sizeof(buf), size)) > 0) {
+		for (i = 0; i < len; i++) {
+			hash ^= buf[i];
+			hash *= 0x100000001b3UL;
+		}
+		size += len;
+	}
+	if (len < 0)
+		return -1;
+
+	snprintf(job->cache_name, sizeof(job->cache_name), "%s/%016lx-%lx%s",
+		 basl_cache_dir, hash, (uint64_t)size, ASL_SUFFIX);
+	return 0;
+}
+
+static int
+basl_cache_load(struct vmctx *ctx, struct basl_job *job)
+{
+	int fd, err;
+
+	fd = open(job->cache_name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	err = basl_load(ctx, fd, job->offset);
+	close(fd);
+	return err;
+}
+
+/*
+ * Copy a compiled AML file into the cache, through a temporary file renamed
+ * once complete so that a concurrent launch never loads a partial entry.
+ */
+static void
+basl_cache_store(struct basl_job *job)
+{
+	char tmp_name[MAXPATHLEN];
+	char buf[4096];
+	off_t off = 0;
+	ssize_t len;
+	int fd;
+
+	if (snprintf(tmp_name, sizeof(tmp_name), "%s.XXXXXX",
+		     job->cache_name) >= sizeof(tmp_name))
+		return;
+
+	fd = mkstemp(tmp_name);
+	if (fd < 0)
+		return;
+
+	while ((len = pread(job->io[1].fd, buf, sizeof(buf), off)) > 0) {
+		if (write(fd, buf, len) != len) {
+			len = -1;
+			break;
+		}
+		off += len;
+	}
+	close(fd);
+
+	if (len < 0 || rename(tmp_name, job->cache_name) < 0)
+		unlink(tmp_name);
+}
+
+static void
+basl_cache_init(void)
+{
+	const char *dir;
+	size_t i, len;
+
+	basl_cache_dir[0] = '\0';
+
+	/*
+	 * ACPI_CACHEDIR moves the cache, an empty ACPI_CACHEDIR disables
+	 * it. It is not used either when the iasl output is wanted.
+	 */
+	dir = getenv("ACPI_CACHEDIR");
+	if (dir == NULL)
+		dir = ASL_CACHE_DIR;
+	if (*dir == '\0' || basl_verbose_iasl)
+		return;
+
+	len = strnlen(dir, MAXPATHLEN);
+	if (len >= MAXPATHLEN)
+		return;
+	strncpy(basl_cache_dir, dir, MAXPATHLEN);
+
+	for (i = 1; i <= len; i++) {
+		if (basl_cache_dir[i] == '/' || basl_cache_dir[i] == '\0') {
+			basl_cache_dir[i] = '\0';
+			if (mkdir(basl_cache_dir, 0755) < 0 && errno != EEXIST) {
+				pr_warn("ACPI table cache %s disabled\n", dir);
+				basl_cache_dir[0] = '\0';
+				return;
+			}
+			basl_cache_dir[i] = dir[i];
+		}
+	}
+}
+
+/*
+ * Write the ASL file of a table, and load its AML file from the cache or
+ * start iasl on it.
+ */
+static int
+basl_compile_start(struct vmctx *ctx, struct basl_job *job,
+		int (*fwrite_section)(FILE *, struct vmctx *))
+{
+	posix_spawn_file_actions_t actions;
+	char *argv[] = { ASL_COMPILER, "-p", job->io[1].f_name,
+			 job->io[0].f_name, NULL };
 	int err;
 
-	err = basl_start(&io[0], &io[1]);
-	if (!err) {
-		err = (*fwrite_section)(io[0].fp, ctx);
+	err = basl_start(&job->io[0], &job->io[1]);
+	if (err)
+		return err;
+
+	job->pid = 0;
+	job->cache_name[0] = '\0';
+
+	err = (*fwrite_section)(job->io[0].fp, ctx);
+	if (err)
+		goto fail;
+
+	if (basl_cache_name(job) == 0 && basl_cache_load(ctx, job) == 0)
+		return 0;
+
+	/*
+	 * iasl sends the results of the compilation to stdout. Shut this
+	 * down by redirecting stdout to /dev/null, unless the user has
+	 * requested verbose output for debugging purposes
+	 */
+	err = posix_spawn_file_actions_init(&actions);
+	if (!err && !basl_verbose_iasl)
+		err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+				"/dev/null", O_WRONLY, 0);
+	if (!err)
+		err = posix_spawn(&job->pid, ASL_COMPILER, &actions, NULL,
+				argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (!err)
+		return 0;
+
+	pr_err("failed to run %s\n", ASL_COMPILER);
+	err = -1;
+fail:
+	basl_end(&job->io[0], &job->io[1]);
+	job->pid = -1;
+	return err;
+}
 
+/*
+ * Wait for the iasl run of a table if any, copy the aml output file into
+ * guest memory at the specified location and into the cache.
+ */
+static int
+basl_compile_finish(struct vmctx *ctx, struct basl_job *job, int err)
+{
+	int status = -1;
+
+	if (job->pid < 0)
+		return err;
+
+	if (job->pid > 0) {
+		while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR)
+			;
 		if (!err) {
-			/*
-			 * iasl sends the results of the compilation to
-			 * stdout. Shut this down by using the shell to
-			 * redirect stdout to /dev/null, unless the user
-			 * has requested verbose output for debugging
-			 * purposes
-			 */
-			if (basl_verbose_iasl)
-				snprintf(iaslbuf, sizeof(iaslbuf),
-					 "%s -p %s %s",
-					 ASL_COMPILER,
-					 io[1].f_name, io[0].f_name);
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+				err = basl_load(ctx, job->io[1].fd, job->offset);
 			else
-				snprintf(iaslbuf, sizeof(iaslbuf),
-					 "/bin/sh -c \"%s -p %s %s\" 1> /dev/null",
-					 ASL_COMPILER,
-					 io[1].f_name, io[0].f_name);
-
-			err = system(iaslbuf);
-
-			if (!err) {
-				/*
-				 * Copy the aml output file into guest
-				 * memory at the specified location
-				 */
-				err = basl_load(ctx, io[1].fd, offset);
-			} else
 				err = -1;
 		}
-		basl_end(&io[0], &io[1]);
+		if (!err && job->cache_name[0] != '\0')
+			basl_cache_store(job);
 	}
 
+	basl_end(&job->io[0], &job->io[1]);
 	return err;
 }
 
@@ -1257,6 +1421,7 @@ get_acpi_table_length(void)
 int
 acpi_build(struct vmctx *ctx, int ncpu)
 {
+	struct basl_job jobs[ARRAY_SIZE(basl_ftables)];
 	int err;
 	int i;
 
@@ -1278,9 +1443,10 @@ acpi_build(struct vmctx *ctx, int ncpu)
 
 	i = 0;
 	err = basl_make_templates();
+	basl_cache_init();
 
 	/*
-	 * Run through all the ASL files, compiling them and
+	 * Run through all the ASL files, compiling them all at once and
 	 * copying them into guest memory
 	 */
 	while (!err && (i < ARRAY_SIZE(basl_ftables))) {
@@ -1289,12 +1455,19 @@ acpi_build(struct vmctx *ctx, int ncpu)
 				basl_ftables[i].valid = true;
 		}
 
+		jobs[i].pid = -1;
+		jobs[i].offset = basl_ftables[i].offset;
 		if (acpi_table_is_valid(i))
-			err = basl_compile(ctx, basl_ftables[i].wsect,
-					basl_ftables[i].offset);
+			err = basl_compile_start(ctx, &jobs[i],
+					basl_ftables[i].wsect);
 		i++;
 	}
 
+	while (i > 0) {
+		i--;
+		err = basl_compile_finish(ctx, &jobs[i], err);
+	}
+
 	if (pt_rtct) {
 		create_and_inject_vrtct(ctx);
 	}
@@ -39,6 +39,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "dm.h"
 #include "vmmapi.h"
 #include "mem.h"
 #include "timer.h"
@@ -337,7 +338,6 @@ vhpet_timer_handler(void *a, uint64_t nexp)
 	struct vhpet_timer_arg *arg;
 	struct timespec now;
 	struct itimerspec tmrts;
-	uint64_t newexp;
 
 	arg = a;
 	vhpet = arg->vhpet;
@@ -387,10 +387,9 @@ vhpet_timer_handler(void *a, uint64_t nexp)
 
 	/*
 	 * Catch any remaining expirations that happened after being
-	 * last consumed by the mevent_dispatch thread.
+	 * last consumed by the timer thread.
 	 */
-	if (read(vhpet_tmr(vhpet, n)->fd, &newexp, sizeof(newexp)) > 0)
-		nexp += newexp;
+	nexp += acrn_timer_expirations(vhpet_tmr(vhpet, n));
 
 	/*
 	 * Periodic timer updates 'compval' upon expiration.
@@ -963,6 +962,13 @@ vhpet_init(struct vmctx *ctx)
 	struct vhpet_timer_arg *arg;
 	struct acrn_timer *tmr;
 
+	/*
+	 * The hypervisor emulates the registers, only the ACPI table is
+	 * built from here.
+	 */
+	if (hv_hpet)
+		return 0;
+
 	vhpet = vhpet_instance();
 
 	VHPET_LOCK();
@@ -30,6 +30,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
 #include <openssl/hmac.h>
 #include <openssl/opensslv.h>
 
@@ -156,23 +158,24 @@ static void rpmb_sim_close(void)
 	rpmb_fd = NULL;
 }
 
-static int file_write(FILE *fp, const void *buf, size_t size, off_t offset)
+/*
+ * The file is accessed with positioned, unbuffered I/O only, so that the
+ * blocks of a multi-block frame go in one vectored call straight from or to
+ * the data field of the frames.
+ */
+static int file_writev(FILE *fp, const struct iovec *iov, int iovcnt,
+		off_t offset)
 {
-	size_t rc = 0;
-
-	if (fseek(fp, offset, SEEK_SET)) {
-		DPRINTF(("%s:Seek to %ld failed.\n", __func__, offset));
-		return -1;
-	}
+	ssize_t rc;
+	size_t size = 0;
+	int i;
 
-	rc = fwrite(buf, sizeof(char), size, fp);
-	if (rc != size) {
-		return -1;
-	}
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
 
-	/* The flow of file writing sync should be:
-	   C lib caches--->fflush--->disk caches--->fsync--->disk */
-	if (fflush(fp) < 0) {
+	rc = pwritev(fileno(fp), iov, iovcnt, offset);
+	if (rc < 0 || (size_t)rc != size) {
+		DPRINTF(("%s: write at %ld failed.\n", __func__, offset));
 		return -1;
 	}
 
@@ -184,21 +187,37 @@ static int file_write(FILE *fp, const void *buf, size_t size, off_t offset)
 	return rc;
 }
 
-static int file_read(FILE *fp, void *buf, size_t size, off_t offset)
+static int file_readv(FILE *fp, const struct iovec *iov, int iovcnt,
+		off_t offset)
 {
-	size_t rc = 0;
+	ssize_t rc;
+	size_t size = 0;
+	int i;
 
-	if (fseek(fp, offset, SEEK_SET)) {
-		DPRINTF(("%s:Seek to %ld failed.\n", __func__, offset));
-		return -1;
-	}
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
 
-	rc = fread(buf, sizeof(char), size, fp);
-	if (rc == size) {
-		return rc;
-	} else {
+	rc = preadv(fileno(fp), iov, iovcnt, offset);
+	if (rc < 0 || (size_t)rc != size) {
+		DPRINTF(("%s: read at %ld failed.\n", __func__, offset));
 		return -1;
 	}
+
+	return rc;
+}
+
+static int file_write(FILE *fp, const void *buf, size_t size, off_t offset)
+{
+	struct iovec iov = { (void *)buf, size };
+
+	return file_writev(fp, &iov, 1, offset);
+}
+
+static int file_read(FILE *fp, void *buf, size_t size, off_t offset)
+{
+	struct iovec iov = { buf, size };
+
+	return file_readv(fp, &iov, 1, offset);
 }
 
 static int rpmb_sim_open(const char *rpmb_devname)
@@ -356,7 +375,7 @@ static int rpmb_sim_write(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 	uint32_t counter;
 	uint16_t addr;
 	uint16_t block_count;
-	uint8_t data[256*in_cnt];
+	struct iovec iov[in_cnt ? : 1];
 
 	if (in_cnt == 0 || in_frame == NULL)
 		return -EINVAL;
@@ -364,7 +383,7 @@ static int rpmb_sim_write(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 	if (in_frame[0].req_resp != swap16(RPMB_REQ_DATA_WRITE))
 		return -EINVAL;
 
-	if (in_cnt > 2) {
+	if (in_cnt > IOV_MAX) {
 		err = RPMB_RES_GENERAL_FAILURE;
 		goto out;
 	}
@@ -380,7 +399,7 @@ static int rpmb_sim_write(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 	if (addr + block_count > TEEDATA_BLOCK_COUNT)
 		goto out;
 
-	if (block_count == 0 || block_count > in_cnt) {
+	if (block_count == 0 || block_count != in_cnt) {
 		ret = -EINVAL;
 		err = RPMB_RES_GENERAL_FAILURE;
 		goto out;
@@ -420,10 +439,12 @@ static int rpmb_sim_write(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 		goto out;
 	}
 
-	for (i = 0; i < in_cnt; i++)
-		memcpy(data + i * 256, in_frame[i].data, 256);
+	for (i = 0; i < in_cnt; i++) {
+		iov[i].iov_base = (void *)in_frame[i].data;
+		iov[i].iov_len = sizeof(in_frame[i].data);
+	}
 
-	if (file_write(rpmb_fd, data, sizeof(data), 256 * addr) < 0) {
+	if (file_writev(rpmb_fd, iov, in_cnt, 256 * addr) < 0) {
 		DPRINTF(("%s write_with_retry failed.\n", __func__));
 		goto out;
 	}
@@ -460,7 +481,7 @@ static int rpmb_sim_read(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 	uint8_t key[32];
 	uint8_t mac[32];
 	uint16_t addr;
-	uint8_t data[256*out_cnt];
+	struct iovec iov[out_cnt ? : 1];
 
 	if (in_cnt != 1 || in_frame == NULL)
 		return -EINVAL;
@@ -468,6 +489,11 @@ static int rpmb_sim_read(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 	if (in_frame->req_resp != swap16(RPMB_REQ_DATA_READ))
 		return -EINVAL;
 
+	if (out_cnt == 0 || out_frame == NULL || out_cnt > IOV_MAX)
+		return -EINVAL;
+
+	memset(out_frame, 0, out_cnt * sizeof(*out_frame));
+
 	addr = swap16(in_frame->addr);
 
 	if (addr >= TEEDATA_BLOCK_COUNT) {
@@ -483,30 +509,32 @@ static int rpmb_sim_read(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 		goto out;
 	}
 
-	if (file_read(rpmb_fd, data, sizeof(data), 256 * addr) < 0) {
+	for (i = 0; i < out_cnt; i++) {
+		iov[i].iov_base = out_frame[i].data;
+		iov[i].iov_len = sizeof(out_frame[i].data);
+	}
+
+	if (file_readv(rpmb_fd, iov, out_cnt, 256 * addr) < 0) {
 		DPRINTF(("%s read_with_retry failed.\n", __func__));
+		memset(out_frame, 0, out_cnt * sizeof(*out_frame));
 		goto out;
 	}
 
 	err = RPMB_RES_OK;
 
 out:
-	if (out_frame) {
-		memset(out_frame, 0, out_cnt*sizeof(*out_frame));
-		for (i = 0; i < out_cnt; i++) {
-			memcpy(out_frame[i].nonce, in_frame[0].nonce, sizeof(in_frame[0].nonce));
-			out_frame[i].req_resp = swap16(RPMB_RESP_DATA_READ);
-			out_frame[i].block_count = swap16(out_cnt);
-			out_frame[i].addr = in_frame[0].addr;
-			memcpy(out_frame[i].data, data+256*i, 256);
-		}
-		if (get_key(key))
-			DPRINTF(("%s, get_key failed.\n", __func__));
-
-		out_frame[out_cnt - 1].result = swap16(err);
-		rpmb_mac(key, out_frame, out_cnt, mac);
-		memcpy(out_frame[out_cnt - 1].key_mac, mac, sizeof(mac));
+	for (i = 0; i < out_cnt; i++) {
+		memcpy(out_frame[i].nonce, in_frame[0].nonce, sizeof(in_frame[0].nonce));
+		out_frame[i].req_resp = swap16(RPMB_RESP_DATA_READ);
+		out_frame[i].block_count = swap16(out_cnt);
+		out_frame[i].addr = in_frame[0].addr;
 	}
+	if (get_key(key))
+		DPRINTF(("%s, get_key failed.\n", __func__));
+
+	out_frame[out_cnt - 1].result = swap16(err);
+	rpmb_mac(key, out_frame, out_cnt, mac);
+	memcpy(out_frame[out_cnt - 1].key_mac, mac, sizeof(mac));
 
 	return ret;
 }
@@ -621,8 +649,8 @@ static int rpmb_sim_operations(const void *rel_write_data, size_t rel_write_size
 
 	if (rel_write_size) {
 		size_t nframe = rel_write_size/RPMB_FRAME_SIZE;
-		struct rpmb_frame rel_write_frame[nframe];
-		memcpy(rel_write_frame, rel_write_data, sizeof(rel_write_frame));
+		const struct rpmb_frame *rel_write_frame = rel_write_data;
+
 		if (rel_write_frame[0].req_resp == swap16(RPMB_REQ_DATA_WRITE))  {
 			if (write_size/RPMB_FRAME_SIZE &&
 					((struct rpmb_frame*)write_data)->req_resp == swap16(RPMB_REQ_RESULT_READ))
@@ -639,8 +667,8 @@ static int rpmb_sim_operations(const void *rel_write_data, size_t rel_write_size
 		}
 	}
 	else if (write_size) {
-		struct rpmb_frame write_frame[write_size/RPMB_FRAME_SIZE];
-		memcpy(write_frame, write_data, sizeof(write_frame));
+		const struct rpmb_frame *write_frame = write_data;
+
 		if (write_frame[0].req_resp == swap16(RPMB_REQ_DATA_READ)) {
 			ret = rpmb_sim_read(write_frame, 1, read_buf, read_size/RPMB_FRAME_SIZE);
 		}
@@ -861,6 +861,24 @@ vrtc_nvram_write(struct vrtc *vrtc, int offset, uint8_t value)
 	return 0;
 }
 
+int
+vrtc_nvram_read(struct vrtc *vrtc, int offset, uint8_t *value)
+{
+	uint8_t *ptr;
+
+	if (offset < offsetof(struct rtcdev, nvram[0]) ||
+			offset == RTC_CENTURY ||
+			offset >= sizeof(struct rtcdev))
+		return -1;
+
+	pthread_mutex_lock(&vrtc->mtx);
+	ptr = (uint8_t *)(&vrtc->rtcdev);
+	*value = ptr[offset];
+	pthread_mutex_unlock(&vrtc->mtx);
+
+	return 0;
+}
+
 int
 vrtc_addr_handler(struct vmctx *ctx, int vcpu, int in, int port,
 		  int bytes, uint32_t *eax, void *arg)
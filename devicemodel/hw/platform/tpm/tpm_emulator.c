@@ -28,6 +28,19 @@
 #define TPM_ORD_ContinueSelfTest	0x53
 #define TPM_TAG_RSP_COMMAND		0xc4
 #define TPM_FAIL		9
+
+#define TPM2_ST_NO_SESSIONS		0x8001
+#define TPM2_CC_GetCapability		0x17a
+#define TPM2_CC_PCR_Read		0x17e
+#define TPM2_CAP_ALGS			0x0
+#define TPM2_CAP_COMMANDS		0x2
+#define TPM2_CAP_PCRS			0x5
+#define TPM2_CAP_TPM_PROPERTIES		0x6
+#define TPM2_PT_VAR			0x200
+
+/* Responses kept for the read-only commands, see swtpm_cache_lookup() */
+#define SWTPM_CACHE_ENTRIES		16
+#define SWTPM_CACHE_CMD_MAX		64
 #define PTM_INIT_FLAG_DELETE_VOLATILE	(1 << 0)
 
 /* To align with definition in SWTPM */
@@ -136,6 +149,13 @@ typedef struct swtpm_context {
 	uint8_t cur_locty_number; /* last set locality */
 	unsigned int established_flag:1;
 	unsigned int established_flag_cached:1;
+	struct swtpm_cache_entry {
+		uint32_t in_len;
+		uint32_t out_len;	/* 0 if the entry is free */
+		uint8_t in[SWTPM_CACHE_CMD_MAX];
+		uint8_t *out;
+	} cache[SWTPM_CACHE_ENTRIES];
+	unsigned int cache_next; /* entry replaced next */
 } swtpm_context;
 
 /* Align with definition in SWTPM */
@@ -206,6 +226,94 @@ static bool tpm_is_selftest(const uint8_t *in, uint32_t in_len)
 	return false;
 }
 
+/*
+ * Only the commands whose response depends on TPM state that nothing but
+ * another command changes are cached: PCR_Read and getting the algorithms,
+ * the commands, the PCR banks or the fixed properties. Any other command
+ * drops the whole cache, so a response is only reused until the guest does
+ * anything else, e.g. a PCR read until the next extend.
+ */
+static bool tpm_is_cacheable(const uint8_t *in, uint32_t in_len)
+{
+	uint32_t cap, prop, count;
+
+	if (in_len < sizeof(tpm_input_header) || in_len > SWTPM_CACHE_CMD_MAX ||
+		tpm_cmd_get_tag(in) != TPM2_ST_NO_SESSIONS ||
+		tpm_cmd_get_size(in) != in_len)
+		return false;
+
+	switch (tpm_cmd_get_ordinal(in)) {
+	case TPM2_CC_PCR_Read:
+		return true;
+	case TPM2_CC_GetCapability:
+		if (in_len != sizeof(tpm_input_header) + 12)
+			return false;
+		cap = __builtin_bswap32(*(uint32_t *)(in + 10));
+		prop = __builtin_bswap32(*(uint32_t *)(in + 14));
+		count = __builtin_bswap32(*(uint32_t *)(in + 18));
+		if (cap == TPM2_CAP_ALGS || cap == TPM2_CAP_COMMANDS ||
+			cap == TPM2_CAP_PCRS)
+			return true;
+		return cap == TPM2_CAP_TPM_PROPERTIES &&
+			prop < TPM2_PT_VAR && count <= TPM2_PT_VAR - prop;
+	default:
+		return false;
+	}
+}
+
+static void swtpm_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < SWTPM_CACHE_ENTRIES; i++) {
+		free(tpm_context.cache[i].out);
+		tpm_context.cache[i].out = NULL;
+		tpm_context.cache[i].out_len = 0;
+	}
+}
+
+static bool swtpm_cache_lookup(TPMCommBuffer *cmd)
+{
+	struct swtpm_cache_entry *e;
+	int i;
+
+	for (i = 0; i < SWTPM_CACHE_ENTRIES; i++) {
+		e = &tpm_context.cache[i];
+		if (e->out_len && e->in_len == cmd->in_len &&
+			e->out_len <= cmd->out_len &&
+			!memcmp(e->in, cmd->in, cmd->in_len)) {
+			memcpy(cmd->out, e->out, e->out_len);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void swtpm_cache_insert(const TPMCommBuffer *cmd)
+{
+	struct swtpm_cache_entry *e;
+	uint32_t out_len = tpm_cmd_get_size(cmd->out);
+
+	/* failures are not worth keeping */
+	if (tpm_cmd_get_errcode(cmd->out) != 0)
+		return;
+
+	e = &tpm_context.cache[tpm_context.cache_next];
+	tpm_context.cache_next = (tpm_context.cache_next + 1) % SWTPM_CACHE_ENTRIES;
+
+	free(e->out);
+	e->out_len = 0;
+	e->out = malloc(out_len);
+	if (!e->out)
+		return;
+
+	memcpy(e->out, cmd->out, out_len);
+	memcpy(e->in, cmd->in, cmd->in_len);
+	e->in_len = cmd->in_len;
+	e->out_len = out_len;
+}
+
 static int ctrl_chan_conn(const char *servername)
 {
 	int clifd;
@@ -644,6 +752,8 @@ static int swtpm_startup_tpm(size_t buffersize,
 		.u.req.init_flags = 0,
 	};
 
+	swtpm_cache_flush();
+
 	if (swtpm_stop() < 0) {
 		pr_err("swtpm_stop() failed!\n");
 		return -1;
@@ -714,6 +824,7 @@ static void swtpm_write_fatal_error_response(uint8_t *out, uint32_t out_len)
 
 static void swtpm_cleanup(void)
 {
+	swtpm_cache_flush();
 	swtpm_shutdown();
 	close(tpm_context.cmd_chan_fd);
 	close(tpm_context.ctrl_chan_fd);
@@ -726,11 +837,24 @@ int swtpm_startup(size_t buffersize)
 
 int swtpm_handle_request(TPMCommBuffer *cmd)
 {
+	bool cacheable;
+
 	if (!cmd) {
 		pr_err("%s error, invalid input.\n", __func__);
 		return -1;
 	}
 
+	cacheable = tpm_is_cacheable(cmd->in, cmd->in_len) &&
+			cmd->locty == tpm_context.cur_locty_number;
+	if (cacheable) {
+		if (swtpm_cache_lookup(cmd)) {
+			cmd->selftest_done = false;
+			return 0;
+		}
+	} else {
+		swtpm_cache_flush();
+	}
+
 	if (swtpm_set_locality(cmd->locty) < 0 ||
 		swtpm_cmdcmd(tpm_context.cmd_chan_fd, cmd->in, cmd->in_len,
 				cmd->out, cmd->out_len,
@@ -739,6 +863,9 @@ int swtpm_handle_request(TPMCommBuffer *cmd)
 		return -1;
 	}
 
+	if (cacheable)
+		swtpm_cache_insert(cmd);
+
 	return 0;
 }
 
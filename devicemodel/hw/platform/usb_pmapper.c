@@ -366,8 +366,13 @@ errout:
 	return NULL;
 }
 
+/*
+ * Mark the pending blocks of the xfer as handling and return their size. With
+ * one_td set, stop at the end of the first TD: *tail is then the block after
+ * the last one of that TD.
+ */
 static int
-usb_dev_prepare_xfer(struct usb_xfer *xfer, int *head, int *tail)
+usb_dev_prepare_xfer(struct usb_xfer *xfer, int *head, int *tail, int one_td)
 {
 	int i, idx, size, first;
 	struct usb_block *block = NULL;
@@ -400,6 +405,12 @@ usb_dev_prepare_xfer(struct usb_xfer *xfer, int *head, int *tail)
 			UPRINTF(LFTL, "%s error stat %d\r\n",
 					__func__, block->type);
 		}
+
+		if (one_td && block->type == USB_DATA_FULL) {
+			*head = first;
+			*tail = index_inc(idx, xfer->max_blk_cnt);
+			return size;
+		}
 	}
 
 	*head = first;
@@ -746,40 +757,22 @@ usb_dev_reset(void *pdata)
 	return rc;
 }
 
-int
-usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+static int
+usb_dev_submit(struct usb_dev *udev, struct usb_xfer *xfer, int dir,
+		int epctx, uint8_t type, int head, int tail, int size)
 {
-	struct usb_dev *udev;
 	struct usb_dev_req *r;
 	struct usb_native_devinfo *info;
 	int rc = 0, epid;
-	uint8_t type;
-	int i, idx, buf_idx, head, tail, size;
+	int i, idx, buf_idx;
 	struct usb_block *b;
 	static const char * const type_str[] = {"CTRL", "ISO", "BULK", "INT"};
 	static const char * const dir_str[] = {"OUT", "IN"};
 	int framelen = 0, framecnt = 0;
 	uint16_t maxp;
 
-	udev = pdata;
 	info = &udev->info;
-	xfer->status = USB_ERR_NORMAL_COMPLETION;
-	size = usb_dev_prepare_xfer(xfer, &head, &tail);
-	if (size <= 0)
-		goto done;
-
-	type = usb_dev_get_ep_type(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
-	if (type > USB_ENDPOINT_INT) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
-
 	epid = dir ? (0x80 | epctx) : epctx;
-	if (!(dir == USB_XFER_IN || dir == USB_XFER_OUT)) {
-		xfer->status = USB_ERR_IOERROR;
-		goto done;
-	}
-
 	maxp = usb_dev_get_ep_maxp(udev, dir, epctx);
 	if (type == USB_ENDPOINT_ISOC) {
 		/* need to double check it, there might be some non-spec
@@ -894,6 +887,48 @@ done:
 	return xfer->status;
 }
 
+int
+usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
+{
+	struct usb_dev *udev;
+	uint8_t type;
+	int head, tail, size, one_td;
+
+	udev = pdata;
+	xfer->status = USB_ERR_NORMAL_COMPLETION;
+	if (!(dir == USB_XFER_IN || dir == USB_XFER_OUT)) {
+		xfer->status = USB_ERR_IOERROR;
+		goto done;
+	}
+
+	type = usb_dev_get_ep_type(udev, dir ? TOKEN_IN : TOKEN_OUT, epctx);
+	if (type > USB_ENDPOINT_INT) {
+		xfer->status = USB_ERR_IOERROR;
+		goto done;
+	}
+
+	/*
+	 * Each TD of a bulk endpoint goes in a libusb transfer of its own:
+	 * all the TDs the guest queued are then in flight at once, the next
+	 * one starts on the bus without waiting for the completion of the
+	 * previous one, and a short packet only ends its own TD. The other
+	 * endpoints keep one transfer for all the pending blocks.
+	 */
+	one_td = (type == USB_ENDPOINT_BULK);
+	do {
+		size = usb_dev_prepare_xfer(xfer, &head, &tail, one_td);
+		if (size <= 0)
+			break;
+
+		if (usb_dev_submit(udev, xfer, dir, epctx, type, head, tail,
+					size) != USB_ERR_NORMAL_COMPLETION)
+			break;
+	} while (one_td);
+
+done:
+	return xfer->status;
+}
+
 static void
 clear_uas_desc(struct usb_dev *udev, uint8_t *data, int len)
 {
@@ -646,6 +646,24 @@ uart_init(uart_intr_func_t intr_assert, uart_intr_func_t intr_deassert,
 	return uart;
 }
 
+/*
+ * Bring the registers back to their state after uart_init(), the backend
+ * stays connected.
+ */
+void
+uart_warm_reset(struct uart_vdev *uart)
+{
+	pthread_mutex_lock(&uart->mtx);
+	uart->data = 0;
+	uart->lcr = 0;
+	uart->mcr = 0;
+	uart->lsr = 0;
+	uart->fcr = 0;
+	uart->scr = 0;
+	uart_reset(uart);
+	pthread_mutex_unlock(&uart->mtx);
+}
+
 static void
 uart_deinit(struct uart_vdev *uart)
 {
@@ -39,7 +39,9 @@
 
 #define	PM1A_EVT_ADDR		0x400
 
-#define	IO_PMTMR		0x0	/* PM Timer is disabled in ACPI */
+/* PM Timer is disabled in ACPI unless the hypervisor emulates it */
+#define	IO_PMTMR		(hv_pmtmr ? VIRTUAL_PM_TMR_ADDR : 0x0)
+#define	IO_PMTMR_LEN		(hv_pmtmr ? 4 : 0)
 
 struct acpi_table_hdr {
 	/* ASCII table signature */
@@ -71,6 +73,14 @@ uint32_t get_acpi_table_length(void);
 
 struct vmctx;
 
+/* PM1 event and control registers */
+struct pm1_state {
+	uint16_t	status;
+	uint16_t	enable;
+	uint16_t	control;
+	uint16_t	reserved;
+};
+
 int	acpi_build(struct vmctx *ctx, int ncpu);
 void	dsdt_line(const char *fmt, ...);
 void	dsdt_fixed_ioport(uint16_t iobase, uint16_t length);
@@ -81,6 +91,8 @@ void	dsdt_unindent(int levels);
 void	sci_init(struct vmctx *ctx);
 void	pm_write_dsdt(struct vmctx *ctx, int ncpu);
 void	pm_backto_wakeup(struct vmctx *ctx);
+void	pm1_get_state(struct pm1_state *state);
+void	pm1_set_state(const struct pm1_state *state);
 void	inject_power_button_event(struct vmctx *ctx);
 void	power_button_init(struct vmctx *ctx);
 void	power_button_deinit(struct vmctx *ctx);
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Copy-on-write overlay of a read-only base image, used by blockif.
+ */
+
+#ifndef _BLOCK_COW_H_
+#define _BLOCK_COW_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct blockif_cow;
+
+struct blockif_cow *blockif_cow_open(int base_fd, off_t size,
+				     const char *path, int rdonly);
+void	blockif_cow_close(struct blockif_cow *cow);
+int	blockif_cow_fd(struct blockif_cow *cow);
+ssize_t	blockif_cow_preadv(struct blockif_cow *cow, const struct iovec *iov,
+			   int iovcnt, off_t offset);
+ssize_t	blockif_cow_pwritev(struct blockif_cow *cow, const struct iovec *iov,
+			    int iovcnt, off_t offset);
+int	blockif_cow_discard(struct blockif_cow *cow, off_t offset, off_t len);
+
+#endif /* _BLOCK_COW_H_ */
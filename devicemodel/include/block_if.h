@@ -48,10 +48,11 @@ struct blockif_req {
 	ssize_t		resid;
 	void		(*callback)(struct blockif_req *req, int err);
 	void		*param;
+	int		qidx;	/* submission queue, less than the nqueues of blockif_open */
 };
 
 struct blockif_ctxt;
-struct blockif_ctxt *blockif_open(const char *optstr, const char *ident);
+struct blockif_ctxt *blockif_open(const char *optstr, const char *ident, int nqueues);
 off_t	blockif_size(struct blockif_ctxt *bc);
 void	blockif_chs(struct blockif_ctxt *bc, uint16_t *c, uint8_t *h,
 		    uint8_t *s);
@@ -72,5 +73,10 @@ int	blockif_flush_all(struct blockif_ctxt *bc);
 int	blockif_max_discard_sectors(struct blockif_ctxt *bc);
 int	blockif_max_discard_seg(struct blockif_ctxt *bc);
 int	blockif_discard_sector_alignment(struct blockif_ctxt *bc);
+void	blockif_plug(struct blockif_ctxt *bc, int qidx);
+void	blockif_unplug(struct blockif_ctxt *bc, int qidx);
+int	blockif_register_bufs(struct blockif_ctxt *bc, const struct iovec *iov,
+			      int iovcnt);
+int	blockif_set_throttle(struct blockif_ctxt *bc, const char *optstr);
 
 #endif /* _BLOCK_IF_H_ */
@@ -54,6 +54,21 @@ extern bool pt_tpm2;
 extern bool pt_rtct;
 extern bool vtpm2;
 extern bool is_winvm;
+extern bool timer_mux;
+extern bool hv_hpet;
+extern bool hv_pmtmr;
+extern bool hv_rtc;
+extern bool pv_ipi;
+extern bool pv_tlb_flush;
+extern bool pv_steal_time;
+extern bool vpmu;
+extern bool wbinvd_range;
+extern bool mwait_pt;
+extern bool hide_rdrand;
+extern uint32_t vm_tsc_khz;
+extern char *restore_file_name;
+extern bool lazy_mem;
+extern bool share_image;
 
 int vmexit_task_switch(struct vmctx *ctx, struct vhm_request *vhm_req,
 		       int *vcpu);
@@ -72,4 +87,12 @@ int  virtio_uses_msix(void);
 size_t high_bios_size(void);
 void init_debugexit(void);
 void deinit_debugexit(void);
+
+/**
+ * @brief Get the ioreq counts and the TSC cycles spent on them by type
+ *
+ * @param nr Array of VM_EXITCODE_MAX entries for the ioreq counts.
+ * @param cycles Array of VM_EXITCODE_MAX entries for the cycles.
+ */
+void vm_get_ioreq_stats(uint64_t *nr, uint64_t *cycles);
 #endif
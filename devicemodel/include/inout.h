@@ -74,5 +74,6 @@ void	init_inout(void);
 int	emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *req);
 int	register_inout(struct inout_port *iop);
 int	unregister_inout(struct inout_port *iop);
+int	inout_get_stats(char *buf, size_t len, int nr);
 
 #endif	/* _INOUT_H_ */
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _MIGRATE_H_
+#define _MIGRATE_H_
+
+struct vmctx;
+
+/**
+ * @brief Start migrating a running VM to the DM of another host
+ *
+ * The memory is copied while the VM runs, the VM moves once the guest
+ * sleeps in S3: it is then powered off here and wakes up on the
+ * destination. The migration is canceled if the guest doesn't sleep
+ * within 10 minutes.
+ *
+ * @param arg Pointer to struct vmctx representing VM context.
+ * @param dest "host:port" the destination DM listens on.
+ *
+ * @return 0 once started and non-zero on fail.
+ */
+int vm_monitor_migrate(void *arg, char *dest);
+
+/**
+ * @brief Receive a VM migrated by vm_monitor_migrate() instead of loading
+ * its software
+ *
+ * The VM has to be set up with the same memory size and devices as the
+ * source one. It then starts by waking up from S3.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param addr "[host:]port" to listen on.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int vm_migrate_incoming(struct vmctx *ctx, const char *addr);
+
+#endif /* _MIGRATE_H_ */
@@ -26,6 +26,11 @@ struct monitor_vm_ops {
 	int (*unpause) (void *arg);
 	int (*query) (void *arg);
 	int (*rescan)(void *arg, char *devargs);
+	int (*throttle)(void *arg, char *devargs);
+	int (*snapshot)(void *arg, char *path);
+	int (*balloon)(void *arg, char *devargs);
+	int (*start)(void *arg);
+	int (*migrate)(void *arg, char *dest);
 };
 
 int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
@@ -34,6 +39,10 @@ int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
 /* helper functions for vm_ops callback developer */
 unsigned get_wakeup_reason(void);
 int set_wakeup_timer(time_t t);
+void monitor_notify_state(int state);
 int acrn_parse_intr_monitor(const char *opt);
+int acrn_parse_intr_coalesce(const char *opt);
 int vm_monitor_blkrescan(void *arg, char *devargs);
+int vm_monitor_blkthrottle(void *arg, char *devargs);
+int vm_monitor_balloon(void *arg, char *devargs);
 #endif
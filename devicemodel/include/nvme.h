@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * The registers, commands and data structures of the NVM Express 1.3
+ * specification used by the NVMe controller emulation.
+ */
+
+#ifndef _NVME_H_
+#define	_NVME_H_
+
+#include <assert.h>
+#include <stdint.h>
+
+/* controller registers, in BAR 0 */
+#define	NVME_CR_CAP		0x00	/* capabilities, 64 bits */
+#define	NVME_CR_VS		0x08	/* version */
+#define	NVME_CR_INTMS		0x0c	/* interrupt mask set */
+#define	NVME_CR_INTMC		0x10	/* interrupt mask clear */
+#define	NVME_CR_CC		0x14	/* controller configuration */
+#define	NVME_CR_CSTS		0x1c	/* controller status */
+#define	NVME_CR_NSSR		0x20	/* NVM subsystem reset */
+#define	NVME_CR_AQA		0x24	/* admin queue attributes */
+#define	NVME_CR_ASQ		0x28	/* admin SQ base address, 64 bits */
+#define	NVME_CR_ACQ		0x30	/* admin CQ base address, 64 bits */
+#define	NVME_CR_DOORBELL	0x1000	/* SQ y tail at 8y, CQ y head at 8y + 4 */
+
+#define	NVME_CAP_MQES_MASK	0xffffUL	/* max queue entries, 0's based */
+#define	NVME_CAP_CQR		(1UL << 16)	/* contiguous queues required */
+#define	NVME_CAP_TO_SHIFT	24		/* ready timeout, in 500 ms */
+#define	NVME_CAP_DSTRD_SHIFT	32		/* doorbell stride, 4 << DSTRD */
+#define	NVME_CAP_CSS_NVM	(1UL << 37)	/* NVM command set */
+#define	NVME_CAP_MPSMIN_SHIFT	48		/* min page size, 4K << MPSMIN */
+#define	NVME_CAP_MPSMAX_SHIFT	52
+
+#define	NVME_CC_EN		(1U << 0)
+#define	NVME_CC_CSS_SHIFT	4
+#define	NVME_CC_CSS_MASK	0x7U
+#define	NVME_CC_MPS_SHIFT	7
+#define	NVME_CC_MPS_MASK	0xfU
+#define	NVME_CC_SHN_SHIFT	14
+#define	NVME_CC_SHN_MASK	0x3U
+#define	NVME_CC_IOSQES_SHIFT	16
+#define	NVME_CC_IOCQES_SHIFT	20
+#define	NVME_CC_WRITE_MASK	0x00fffff1U
+
+#define	NVME_CSTS_RDY		(1U << 0)
+#define	NVME_CSTS_CFS		(1U << 1)	/* controller fatal status */
+#define	NVME_CSTS_SHST_SHIFT	2
+#define	NVME_CSTS_SHST_MASK	(0x3U << NVME_CSTS_SHST_SHIFT)
+#define	NVME_SHST_COMPLETE	0x2U
+
+#define	NVME_AQA_ASQS_MASK	0xfffU		/* 0's based */
+#define	NVME_AQA_ACQS_SHIFT	16
+
+/* admin commands */
+#define	NVME_OPC_DELETE_IO_SQ		0x00
+#define	NVME_OPC_CREATE_IO_SQ		0x01
+#define	NVME_OPC_GET_LOG_PAGE		0x02
+#define	NVME_OPC_DELETE_IO_CQ		0x04
+#define	NVME_OPC_CREATE_IO_CQ		0x05
+#define	NVME_OPC_IDENTIFY		0x06
+#define	NVME_OPC_ABORT			0x08
+#define	NVME_OPC_SET_FEATURES		0x09
+#define	NVME_OPC_GET_FEATURES		0x0a
+#define	NVME_OPC_ASYNC_EVENT_REQUEST	0x0c
+#define	NVME_OPC_DOORBELL_BUFFER_CONFIG	0x7c
+
+/* NVM commands */
+#define	NVME_OPC_FLUSH			0x00
+#define	NVME_OPC_WRITE			0x01
+#define	NVME_OPC_READ			0x02
+#define	NVME_OPC_DATASET_MANAGEMENT	0x09
+
+#define	NVME_DSM_ATTR_DEALLOCATE	(1U << 2)	/* cdw11 of DSM */
+#define	NVME_MAX_DSM_RANGES		256
+
+/* the CNS of identify */
+#define	NVME_CNS_NAMESPACE		0x00
+#define	NVME_CNS_CONTROLLER		0x01
+#define	NVME_CNS_ACTIVE_NS_LIST		0x02
+#define	NVME_CNS_NS_DESCRIPTORS		0x03
+
+#define	NVME_NIDT_EUI64			0x01
+
+/* log pages */
+#define	NVME_LOG_ERROR			0x01
+#define	NVME_LOG_HEALTH			0x02
+#define	NVME_LOG_FIRMWARE_SLOT		0x03
+
+/* features */
+#define	NVME_FEAT_ARBITRATION		0x01
+#define	NVME_FEAT_POWER_MANAGEMENT	0x02
+#define	NVME_FEAT_TEMPERATURE_THRESHOLD	0x04
+#define	NVME_FEAT_ERROR_RECOVERY	0x05
+#define	NVME_FEAT_VOLATILE_WRITE_CACHE	0x06
+#define	NVME_FEAT_NUMBER_OF_QUEUES	0x07
+#define	NVME_FEAT_INTERRUPT_COALESCING	0x08
+#define	NVME_FEAT_INTERRUPT_VECTOR_CONF	0x09
+#define	NVME_FEAT_WRITE_ATOMICITY	0x0a
+#define	NVME_FEAT_ASYNC_EVENT_CONF	0x0b
+#define	NVME_FEAT_MAX			0x0c
+
+#define	NVME_FEAT_SAVE			(1U << 31)	/* cdw10 of set features */
+
+/* OACS and ONCS of identify controller */
+#define	NVME_OACS_DBBUF			(1U << 8)
+#define	NVME_ONCS_DSM			(1U << 2)
+
+/* status types and codes */
+#define	NVME_SCT_GENERIC		0x0
+#define	NVME_SCT_COMMAND_SPECIFIC	0x1
+
+#define	NVME_SC_SUCCESS			0x00
+#define	NVME_SC_INVALID_OPCODE		0x01
+#define	NVME_SC_INVALID_FIELD		0x02
+#define	NVME_SC_DATA_TRANSFER_ERROR	0x04
+#define	NVME_SC_INTERNAL_DEVICE_ERROR	0x06
+#define	NVME_SC_INVALID_NAMESPACE	0x0b
+#define	NVME_SC_LBA_OUT_OF_RANGE	0x80
+
+#define	NVME_SC_INVALID_CQ		0x00	/* command specific */
+#define	NVME_SC_INVALID_QID		0x01
+#define	NVME_SC_MAX_QSIZE_EXCEEDED	0x02
+#define	NVME_SC_ASYNC_EVENT_LIMIT	0x05
+#define	NVME_SC_INVALID_VECTOR		0x08
+#define	NVME_SC_INVALID_LOG_PAGE	0x09
+#define	NVME_SC_INVALID_QUEUE_DELETION	0x0c
+#define	NVME_SC_FEATURE_NOT_SAVEABLE	0x0d
+#define	NVME_SC_WRITE_TO_RO_RANGE	0x82
+
+#define	NVME_STATUS(sct, sc)		((uint16_t)(((sct) << 9) | ((sc) << 1)))
+#define	NVME_STATUS_PHASE		0x1U
+#define	NVME_STATUS_DNR			(1U << 15)
+
+/* submission queue entry */
+struct nvme_command {
+	uint8_t		opc;
+	uint8_t		flags;		/* fuse in 0..1, psdt in 6..7 */
+	uint16_t	cid;
+	uint32_t	nsid;
+	uint32_t	cdw2;
+	uint32_t	cdw3;
+	uint64_t	mptr;
+	uint64_t	prp1;
+	uint64_t	prp2;
+	uint32_t	cdw10;
+	uint32_t	cdw11;
+	uint32_t	cdw12;
+	uint32_t	cdw13;
+	uint32_t	cdw14;
+	uint32_t	cdw15;
+};
+static_assert(sizeof(struct nvme_command) == 64, "compile-time assertion failed");
+
+#define	NVME_CMD_PSDT_MASK		0xc0U
+
+/* completion queue entry */
+struct nvme_completion {
+	uint32_t	cdw0;
+	uint32_t	rsvd;
+	uint16_t	sqhd;
+	uint16_t	sqid;
+	uint16_t	cid;
+	uint16_t	status;
+};
+static_assert(sizeof(struct nvme_completion) == 16, "compile-time assertion failed");
+
+struct nvme_dsm_range {
+	uint32_t	attributes;
+	uint32_t	nlb;
+	uint64_t	slba;
+};
+
+struct nvme_power_state {
+	uint16_t	mp;		/* max power, in centiwatts */
+	uint8_t		rsvd2;
+	uint8_t		mps_nops;
+	uint32_t	enlat;
+	uint32_t	exlat;
+	uint8_t		rrt;
+	uint8_t		rrl;
+	uint8_t		rwt;
+	uint8_t		rwl;
+	uint8_t		rsvd16[16];
+};
+static_assert(sizeof(struct nvme_power_state) == 32, "compile-time assertion failed");
+
+struct nvme_controller_data {
+	uint16_t	vid;
+	uint16_t	ssvid;
+	char		sn[20];
+	char		mn[40];
+	char		fr[8];
+	uint8_t		rab;
+	uint8_t		ieee[3];
+	uint8_t		cmic;
+	uint8_t		mdts;		/* max transfer, 2^mdts min pages */
+	uint16_t	cntlid;
+	uint32_t	ver;
+	uint32_t	rtd3r;
+	uint32_t	rtd3e;
+	uint32_t	oaes;
+	uint32_t	ctratt;
+	uint8_t		rsvd100[156];
+	uint16_t	oacs;
+	uint8_t		acl;
+	uint8_t		aerl;
+	uint8_t		frmw;
+	uint8_t		lpa;
+	uint8_t		elpe;
+	uint8_t		npss;
+	uint8_t		avscc;
+	uint8_t		apsta;
+	uint16_t	wctemp;
+	uint16_t	cctemp;
+	uint8_t		rsvd270[242];
+	uint8_t		sqes;
+	uint8_t		cqes;
+	uint16_t	maxcmd;
+	uint32_t	nn;
+	uint16_t	oncs;
+	uint16_t	fuses;
+	uint8_t		fna;
+	uint8_t		vwc;
+	uint16_t	awun;
+	uint16_t	awupf;
+	uint8_t		nvscc;
+	uint8_t		rsvd531;
+	uint16_t	acwu;
+	uint16_t	rsvd534;
+	uint32_t	sgls;
+	uint8_t		rsvd540[228];
+	char		subnqn[256];
+	uint8_t		rsvd1024[1024];
+	struct nvme_power_state psd[32];
+	uint8_t		vs[1024];
+} __attribute__((packed));
+static_assert(sizeof(struct nvme_controller_data) == 4096, "compile-time assertion failed");
+
+#define	NVME_LBAF_LBADS_SHIFT		16	/* log2 of the LBA size */
+
+struct nvme_namespace_data {
+	uint64_t	nsze;
+	uint64_t	ncap;
+	uint64_t	nuse;
+	uint8_t		nsfeat;
+	uint8_t		nlbaf;
+	uint8_t		flbas;
+	uint8_t		mc;
+	uint8_t		dpc;
+	uint8_t		dps;
+	uint8_t		nmic;
+	uint8_t		rescap;
+	uint8_t		fpi;
+	uint8_t		dlfeat;
+	uint16_t	nawun;
+	uint16_t	nawupf;
+	uint16_t	nacwu;
+	uint16_t	nabsn;
+	uint16_t	nabo;
+	uint16_t	nabspf;
+	uint16_t	noiob;
+	uint8_t		nvmcap[16];
+	uint16_t	npwg;		/* preferred write granularity */
+	uint16_t	npwa;		/* preferred write alignment */
+	uint16_t	npdg;
+	uint16_t	npda;
+	uint16_t	nows;
+	uint8_t		rsvd74[30];
+	uint8_t		nguid[16];
+	uint8_t		eui64[8];
+	uint32_t	lbaf[16];
+	uint8_t		rsvd192[3904];
+} __attribute__((packed));
+static_assert(sizeof(struct nvme_namespace_data) == 4096, "compile-time assertion failed");
+
+#define	NVME_NSFEAT_OPTPERF		(1U << 4)	/* npwg and npwa valid */
+
+struct nvme_health_log {
+	uint8_t		critical_warning;
+	uint16_t	temperature;	/* in Kelvin */
+	uint8_t		available_spare;
+	uint8_t		available_spare_threshold;
+	uint8_t		percentage_used;
+	uint8_t		rsvd6[26];
+	uint64_t	data_units_read[2];	/* in 1000 * 512 bytes */
+	uint64_t	data_units_written[2];
+	uint64_t	host_read_commands[2];
+	uint64_t	host_write_commands[2];
+	uint64_t	controller_busy_time[2];
+	uint64_t	power_cycles[2];
+	uint64_t	power_on_hours[2];
+	uint64_t	unsafe_shutdowns[2];
+	uint64_t	media_errors[2];
+	uint64_t	num_error_info_log_entries[2];
+	uint8_t		rsvd192[320];
+} __attribute__((packed));
+static_assert(sizeof(struct nvme_health_log) == 512, "compile-time assertion failed");
+
+struct nvme_firmware_page {
+	uint8_t		afi;		/* active firmware slot */
+	uint8_t		rsvd1[7];
+	char		revision[7][8];
+	uint8_t		rsvd64[448];
+} __attribute__((packed));
+static_assert(sizeof(struct nvme_firmware_page) == 512, "compile-time assertion failed");
+
+#endif /* _NVME_H_ */
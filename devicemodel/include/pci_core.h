@@ -71,6 +71,13 @@ struct pci_vdev_ops {
 	void	(*vdev_deinit)(struct vmctx *, struct pci_vdev *,
 			char *opts);
 
+	/*
+	 * warm reset, in place of deinit/init: stop the device and bring its
+	 * state back to the one after init, the config space is restored by
+	 * the caller
+	 */
+	void	(*vdev_reset)(struct vmctx *, struct pci_vdev *);
+
 	/* ACPI DSDT enumeration */
 	void	(*vdev_write_dsdt)(struct pci_vdev *);
 
@@ -113,6 +120,8 @@ struct pcibar {
 	uint64_t		size;
 	uint64_t		addr;
 	bool			sizing;
+	uint64_t		posted_offset;	/* window of posted guest writes */
+	uint64_t		posted_size;	/* 0 if there is no such window */
 };
 
 #define PI_NAMESZ	40
@@ -123,6 +132,19 @@ struct msix_table_entry {
 	uint32_t	vector_control;
 } __attribute__((packed));
 
+/*
+ * eventfd bound to the MSI-X message of a table entry through irqfd.
+ * fd is -1 while no message is bound. bind_failed latches a failure to bind
+ * addr/msg_data, the interrupts then take the ioctl path until the guest
+ * reprograms the entry.
+ */
+struct msix_irqfd {
+	int		fd;
+	uint64_t	addr;
+	uint32_t	msg_data;
+	bool		bind_failed;
+};
+
 /*
  * In case the structure is modified to hold extra information, use a define
  * for the size that should be emulated.
@@ -142,6 +164,7 @@ struct pci_vdev {
 	struct vmctx *vmctx;
 	uint8_t	bus, slot, func;
 	char	name[PI_NAMESZ];
+	uint64_t bar_accesses;		/* trapped BAR accesses */
 	int	bar_getsize;
 	int	prevcap;
 	int	capend;
@@ -152,6 +175,9 @@ struct pci_vdev {
 		int		pirq_pin;
 		int		ioapic_irq;
 		pthread_mutex_t	lock;
+		int		resample_fd;	/* -1 if the line is not resampled */
+		bool		resample_tried;
+		struct mevent	*resample_mevp;
 	} lintr;
 
 	struct {
@@ -171,6 +197,8 @@ struct pci_vdev {
 		int	pba_size;
 		int	function_mask;
 		struct msix_table_entry *table;	/* allocated at runtime */
+		struct msix_irqfd *irqfd;	/* allocated by pci_msix_irqfd_init */
+		pthread_mutex_t irqfd_mtx;
 		void	*pba_page;
 		int	pba_page_offset;
 	} msix;
@@ -178,6 +206,7 @@ struct pci_vdev {
 	void	*arg;		/* devemu-private data */
 
 	uint8_t	cfgdata[PCI_REGMAX + 1];
+	uint8_t	*reset_cfgdata;	/* config space after init, for warm reset */
 	struct pcibar bar[PCI_BARMAX + 1];
 };
 
@@ -304,6 +333,7 @@ uint64_t get_software_sram_size(void);
 
 typedef void (*pci_lintr_cb)(int b, int s, int pin, int pirq_pin,
 			     int ioapic_irq, void *arg);
+typedef int (*pci_vdev_cb)(struct pci_vdev *dev, void *arg);
 
 int	init_pci(struct vmctx *ctx);
 void	deinit_pci(struct vmctx *ctx);
@@ -317,6 +347,8 @@ int	pci_emul_alloc_bar(struct pci_vdev *pdi, int idx,
 int	pci_emul_alloc_pbar(struct pci_vdev *pdi, int idx,
 			    uint64_t hostbase, enum pcibar_type type,
 			    uint64_t size);
+void	pci_emul_set_bar_posted(struct pci_vdev *pdi, int idx,
+				uint64_t offset, uint64_t size);
 void	pci_emul_free_bar(struct pci_vdev *pdi, int idx);
 void	pci_emul_free_bars(struct pci_vdev *pdi);
 int	pci_emul_add_capability(struct pci_vdev *dev, u_char *capdata,
@@ -346,6 +378,19 @@ void	pci_generate_msi(struct pci_vdev *dev, int index);
  */
 void	pci_generate_msix(struct pci_vdev *dev, int index);
 
+/**
+ * @brief Deliver the MSI-X interrupts of a device through eventfds
+ *
+ * Each table entry gets an eventfd bound with irqfd to its current message,
+ * so pci_generate_msix() only signals the eventfd instead of issuing an
+ * injection ioctl. The binding follows the guest's reprogramming of the table.
+ *
+ * @param dev Pointer to struct pci_vdev representing virtual PCI device.
+ *
+ * @return 0 on success, -1 on failure; MSI-X then keeps using the ioctl path.
+ */
+int	pci_msix_irqfd_init(struct pci_vdev *dev);
+
 /**
  * @brief Assert INTx pin of virtual PCI device
  *
@@ -379,6 +424,12 @@ int	pci_emul_msix_twrite(struct pci_vdev *pi, uint64_t offset, int size,
 uint64_t pci_emul_msix_tread(struct pci_vdev *pi, uint64_t offset, int size);
 int	pci_count_lintr(int bus);
 void	pci_walk_lintr(int bus, pci_lintr_cb cb, void *arg);
+int	pci_walk_vdevs(pci_vdev_cb cb, void *arg);
+void	pci_restore_cfgdata(struct vmctx *ctx, struct pci_vdev *dev,
+			    const uint8_t *cfgdata);
+bool	pci_warm_reset_supported(void);
+void	reset_pci(struct vmctx *ctx);
+void	pci_vdev_reset_nop(struct vmctx *ctx, struct pci_vdev *dev);
 void	pci_write_dsdt(void);
 int	pci_bus_configured(int bus);
 int	emulate_pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus,
@@ -5,6 +5,8 @@
 #ifndef	_DM_INCLUDE_PM_
 #define	_DM_INCLUDE_PM_
 
+#include <stdbool.h>
+
 #define	PWR_EVENT_NOTIFY_IOC			0x1
 #define	PWR_EVENT_NOTIFY_PWR_BT			0x2
 #define	PWR_EVENT_NOTIFY_UART			0x3
@@ -14,5 +16,11 @@ int wait_for_resume(struct vmctx *ctx);
 int vm_resume(struct vmctx *ctx);
 int vm_monitor_resume(void *arg);
 int vm_monitor_query(void *arg);
+int vm_monitor_snapshot(void *arg, char *path);
+int wait_for_warm_start(struct vmctx *ctx);
+int vm_monitor_start(void *arg);
+bool vm_stop_warm(void);
+bool vm_hold_suspend(void);
+void vm_release_suspend(bool poweroff);
 
 #endif
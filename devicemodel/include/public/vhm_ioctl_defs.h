@@ -65,6 +65,8 @@
 #define IC_ID_GEN_BASE                  0x0UL
 #define IC_GET_API_VERSION             _IC_ID(IC_ID, IC_ID_GEN_BASE + 0x00)
 #define IC_GET_PLATFORM_INFO           _IC_ID(IC_ID, IC_ID_GEN_BASE + 0x03)
+#define IC_GET_PCPU_STATS              _IC_ID(IC_ID, IC_ID_GEN_BASE + 0x04)
+#define IC_GET_RT_LATENCY              _IC_ID(IC_ID, IC_ID_GEN_BASE + 0x05)
 
 /* VM management */
 #define IC_ID_VM_BASE                  0x10UL
@@ -75,12 +77,14 @@
 #define IC_CREATE_VCPU                 _IC_ID(IC_ID, IC_ID_VM_BASE + 0x04)
 #define IC_RESET_VM                    _IC_ID(IC_ID, IC_ID_VM_BASE + 0x05)
 #define IC_SET_VCPU_REGS               _IC_ID(IC_ID, IC_ID_VM_BASE + 0x06)
+#define IC_VM_RDT_CLOS                 _IC_ID(IC_ID, IC_ID_VM_BASE + 0x08)
 
 /* IRQ and Interrupts */
 #define IC_ID_IRQ_BASE                 0x20UL
 #define IC_INJECT_MSI                  _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x03)
 #define IC_VM_INTR_MONITOR             _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x04)
 #define IC_SET_IRQLINE                 _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x05)
+#define IC_INJECT_INTR_BATCH           _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x08)
 
 /* DM ioreq management */
 #define IC_ID_IOREQ_BASE                0x30UL
@@ -90,6 +94,9 @@
 #define IC_ATTACH_IOREQ_CLIENT          _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x03)
 #define IC_DESTROY_IOREQ_CLIENT         _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x04)
 #define IC_CLEAR_VM_IOREQ               _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x05)
+#define IC_SET_POSTED_IO_RANGE          _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x06)
+#define IC_SET_IOREQ_POLL               _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x07)
+#define IC_SET_PIO_REGION               _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x08)
 
 /* Guest memory management */
 #define IC_ID_MEM_BASE                  0x40UL
@@ -97,6 +104,8 @@
 #define IC_ALLOC_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x00)
 #define IC_SET_MEMSEG                   _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x01)
 #define IC_UNSET_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x02)
+#define IC_VM_DIRTY_LOG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x03)
+#define IC_VM_RECLAIM_MEMORY            _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x04)
 
 /* PCI assignment*/
 #define IC_ID_PCI_BASE                  0x50UL
@@ -123,6 +132,7 @@
 #define IC_ID_EVENT_BASE		0x70UL
 #define IC_EVENT_IOEVENTFD		_IC_ID(IC_ID, IC_ID_EVENT_BASE + 0x00)
 #define IC_EVENT_IRQFD			_IC_ID(IC_ID, IC_ID_EVENT_BASE + 0x01)
+#define IC_EVENT_RESAMPLEFD		_IC_ID(IC_ID, IC_ID_EVENT_BASE + 0x02)
 
 /**
  * @brief EPT memory mapping info for guest
@@ -153,6 +163,62 @@ struct vm_memmap {
 	uint32_t prot;	/* RWX */
 };
 
+#define DIRTY_LOG_START		0U
+#define DIRTY_LOG_SYNC		1U
+#define DIRTY_LOG_STOP		2U
+
+/**
+ * @brief Info to track the guest memory written by a VM, used by IC_VM_DIRTY_LOG
+ */
+struct acrn_dirty_log {
+	/** DIRTY_LOG_START, DIRTY_LOG_SYNC or DIRTY_LOG_STOP */
+	uint32_t op;
+	/** Reserved */
+	uint32_t reserved;
+	/** user OS guest physical start address of the tracked region,
+	 * only for DIRTY_LOG_START
+	 */
+	uint64_t gpa;
+	/** size of the tracked region, only for DIRTY_LOG_START */
+	uint64_t len;
+	/** service OS user virtual address of the dirty bitmap, one bit
+	 * per 4K page of the region, physically contiguous (e.g. in a
+	 * huge page), only for DIRTY_LOG_START. Bits are only set, the
+	 * device model atomically clears those it has consumed.
+	 */
+	uint64_t bitmap;
+};
+
+#define RECLAIM_UNMAP		0U
+#define RECLAIM_REMAP		1U
+#define RECLAIM_UNPOPULATED	2U
+#define RECLAIM_SHARE		3U
+
+/**
+ * @brief Info to give guest memory back to the service OS, or to map it
+ * back, used by IC_VM_RECLAIM_MEMORY
+ */
+struct acrn_reclaim_region {
+	/** RECLAIM_UNMAP, RECLAIM_REMAP, RECLAIM_UNPOPULATED for memory not
+	 * mapped yet, before the VM starts, or RECLAIM_SHARE to map reclaimed
+	 * memory read-only to memory other VMs may map too, before the VM
+	 * starts. A write to shared memory is sent as a REQ_RECLAIMED.
+	 */
+	uint32_t op;
+	/** Reserved */
+	uint32_t reserved;
+	/** user OS guest physical start address of the region, 2M aligned */
+	uint64_t gpa;
+	/** service OS user virtual start address of the memory the region
+	 * is mapped back to, only for RECLAIM_REMAP and RECLAIM_SHARE. The
+	 * pages of a region being unmapped are no longer pinned after
+	 * RECLAIM_UNMAP.
+	 */
+	uint64_t vma_base;
+	/** size of the region, multiple of 2M */
+	uint64_t len;
+};
+
 /**
  * @brief Info to assign or deassign PCI for a VM
  *
@@ -181,8 +247,11 @@ struct acrn_assign_pcidev {
 	/** the base address of the PCI BAR, initialized by ACRN-DM. */
 	uint32_t bar[6];
 
+	/** bit n set to map BAR n write-combining, if it is prefetchable */
+	uint32_t wc_bars;
+
 	/** reserved for extension */
-	uint32_t rsvd2[6];
+	uint32_t rsvd2[5];
 
 } __attribute__((aligned(8)));
 
@@ -386,6 +455,8 @@ struct acrn_ioeventfd {
 #define ACRN_IOEVENTFD_FLAG_PIO		0x01
 #define ACRN_IOEVENTFD_FLAG_DATAMATCH	0x02
 #define ACRN_IOEVENTFD_FLAG_DEASSIGN	0x04
+/* complete the matched write in the hypervisor instead of an ioreq */
+#define ACRN_IOEVENTFD_FLAG_HV_KICK	0x08
        /** file descriptor of the eventfd of this ioeventfd */
        int32_t fd;
        /** flag for ioeventfd ioctl */
@@ -408,4 +479,19 @@ struct acrn_irqfd {
        /** MSI interrupt to be injected */
        struct acrn_msi_entry msi;
 };
+
+/*
+ * The eventfd is signaled after the hypervisor has deasserted the level
+ * triggered line gsi at the guest EOI (HC_SET_INTX_RESAMPLE).
+ */
+struct acrn_resamplefd {
+#define ACRN_RESAMPLEFD_FLAG_DEASSIGN	0x01
+       /** file descriptor of the eventfd of this resamplefd */
+       int32_t fd;
+       /** flag for resamplefd ioctl */
+       uint32_t flags;
+       /** virtual GSI of the IOAPIC line */
+       uint32_t gsi;
+       uint32_t reserved;
+};
 #endif /* VHM_IOCTL_DEFS_H */
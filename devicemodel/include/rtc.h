@@ -47,6 +47,7 @@ void vrtc_enable_localtime(int l_time);
 void vrtc_deinit(struct vmctx *ctx);
 int vrtc_set_time(struct vrtc *vrtc, time_t secs);
 int vrtc_nvram_write(struct vrtc *vrtc, int offset, uint8_t value);
+int vrtc_nvram_read(struct vrtc *vrtc, int offset, uint8_t *value);
 int vrtc_addr_handler(struct vmctx *ctx, int vcpu, int in, int port,
 		      int bytes, uint32_t *eax, void *arg);
 int vrtc_data_handler(struct vmctx *ctx, int vcpu, int in, int port,
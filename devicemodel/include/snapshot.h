@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <sys/types.h>
+
+struct vmctx;
+
+/**
+ * @brief Save a VM sleeping in S3 into a snapshot file
+ *
+ * The snapshot holds the BSP state the VM resumes from, the config
+ * space of the PCI devices, the CMOS RAM and the guest memory, which
+ * is written as a sparse file with the blank pages left out.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param path Path of the snapshot file.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int vm_snapshot_save(struct vmctx *ctx, const char *path);
+
+/**
+ * @brief Restore a snapshot into a VM instead of loading its software
+ *
+ * The VM has to be set up with the same memory size and devices as the
+ * one the snapshot was taken from. It then starts by waking up from S3.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param path Path of the snapshot file.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int vm_snapshot_restore(struct vmctx *ctx, const char *path);
+
+/**
+ * @brief Save the state of a VM sleeping in S3, all but its memory
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param state Set to the state, to be freed by the caller.
+ *
+ * @return the size of the state on success and -1 on fail.
+ */
+ssize_t snapshot_save_state(struct vmctx *ctx, void **state);
+
+/**
+ * @brief Restore a state saved by snapshot_save_state()
+ *
+ * The guest memory is expected to be restored first.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param state The state.
+ * @param len The size of the state.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int snapshot_restore_state(struct vmctx *ctx, void *state, size_t len);
+
+#endif /* _SNAPSHOT_H_ */
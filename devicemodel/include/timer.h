@@ -8,12 +8,20 @@
 
 #include <sys/param.h>
 
+struct acrn_timer_mux;
+
 struct acrn_timer {
 	int32_t fd;
 	int32_t clockid;
 	struct mevent *mevp;
 	void (*callback)(void *, uint64_t);
 	void *callback_param;
+
+	/* only used with --timer_mux */
+	struct acrn_timer_mux *mux;
+	int32_t heap_idx;		/* -1 when disarmed */
+	uint64_t expires;		/* absolute, ns of clockid */
+	uint64_t interval;		/* ns, 0 for one-shot */
 };
 
 int32_t
@@ -27,6 +35,8 @@ acrn_timer_settime_abs(struct acrn_timer *timer,
 		const struct itimerspec *new_value);
 int32_t
 acrn_timer_gettime(struct acrn_timer *timer, struct itimerspec *cur_value);
+uint64_t
+acrn_timer_expirations(struct acrn_timer *timer);
 
 #define NS_PER_SEC	(1000000000ULL)
 
@@ -43,4 +43,5 @@ struct	uart_vdev*
 	uart_set_backend(uart_intr_func_t intr_assert, uart_intr_func_t intr_deassert,
 		void *arg, const char *opts);
 void	uart_release_backend(struct uart_vdev *uart, const char *opts);
+void	uart_warm_reset(struct uart_vdev *uart);
 #endif
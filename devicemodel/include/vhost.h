@@ -30,12 +30,70 @@ struct vhost_vq {
 	struct vhost_dev *dev;	/**< pointer to vhost_dev */
 };
 
+struct vhost_backend_ops;
+struct mevent;
+
+/**
+ * @brief handler of a request of a vhost-user backend.
+ *
+ * @param arg The slave_arg of the vhost_dev.
+ * @param request Request ID.
+ * @param payload Payload of the request.
+ * @param size Size of the payload.
+ * @param fds The fds passed along, closed by the caller on return.
+ * @param nfds Number of fds.
+ *
+ * @return 0 on success, the negative errno on failure.
+ */
+typedef int (*vhost_user_slave_handler)(void *arg, uint32_t request,
+		void *payload, uint32_t size, int *fds, int nfds);
+
 struct vhost_dev {
 	/**
 	 * backpointer to virtio_base
 	 */
 	struct virtio_base *base;
 
+	/**
+	 * backend operations, picked by vhost_dev_init()
+	 */
+	const struct vhost_backend_ops *ops;
+
+	/**
+	 * fd is a vhost-user socket rather than a vhost chardev,
+	 * set before calling vhost_dev_init()
+	 */
+	bool user;
+
+	/**
+	 * features offered by the vhost-user backend
+	 */
+	uint64_t vhost_user_features;
+
+	/**
+	 * vhost-user protocol features in use
+	 */
+	uint64_t vhost_user_protocol_features;
+
+	/**
+	 * handler of the requests of the vhost-user backend, set before
+	 * calling vhost_dev_init() to open the backend request channel
+	 */
+	vhost_user_slave_handler slave_handler;
+	void *slave_arg;
+
+	/**
+	 * protocol features the requests of slave_handler depend on, on top
+	 * of the ones of the channel, e.g. the shared memory mappings
+	 */
+	uint64_t slave_protocol_features;
+
+	/**
+	 * our end of the backend request channel
+	 */
+	int slave_fd;
+	struct mevent *slave_mevp;
+
 	/**
 	 * pointer to vhost_vq array
 	 */
@@ -47,7 +105,7 @@ struct vhost_dev {
 	int nvqs;
 
 	/**
-	 * vhost chardev fd
+	 * vhost chardev fd, or vhost-user socket fd
 	 */
 	int fd;
 
@@ -144,7 +202,60 @@ int vhost_dev_stop(struct vhost_dev *vdev);
  */
 int vhost_net_set_backend(struct vhost_dev *vdev, int backend_fd);
 
+/**
+ * @brief set the guest CID of vhost vsock.
+ *
+ * This interface is called after vhost_dev_init() to set the context ID
+ * the guest is reached at by the AF_VSOCK sockets of the host.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param cid Guest context ID, greater than 2.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_vsock_set_guest_cid(struct vhost_dev *vdev, uint64_t cid);
+
+/**
+ * @brief start or stop the vhost vsock data plane.
+ *
+ * This interface is called after vhost_dev_start() to let vhost vsock
+ * run the virtqueues, and before vhost_dev_stop() to stop it.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param start Whether to start the data plane.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_vsock_set_running(struct vhost_dev *vdev, bool start);
+
 /**
  * @}
  */
+/**
+ * @brief read the device config space from the vhost backend.
+ *
+ * This interface is called after vhost_dev_init() by devices whose
+ * config space is provided by a vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param config Buffer for the config space.
+ * @param len Size of the config space.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_dev_get_config(struct vhost_dev *vdev, void *config, uint32_t len);
+
+/**
+ * @brief connect to a vhost-user backend.
+ *
+ * This interface is called to connect to the unix socket of a vhost-user
+ * backend. The returned fd is passed to vhost_dev_init() with
+ * vhost_dev.user set.
+ *
+ * @param path Path of the unix socket.
+ *
+ * @return socket fd on success and -1 on failure.
+ */
+int vhost_user_connect(const char *path);
+
 #endif
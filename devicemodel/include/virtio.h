@@ -192,7 +192,10 @@ enum {
 #define	VIRTIO_TYPE_RPMSG	7
 #define	VIRTIO_TYPE_SCSI	8
 #define	VIRTIO_TYPE_9P		9
+#define	VIRTIO_TYPE_GPU		16
 #define	VIRTIO_TYPE_INPUT	18
+#define	VIRTIO_TYPE_VSOCK	19
+#define	VIRTIO_TYPE_FS		26
 
 /*
  * ACRN virtio device types
@@ -217,6 +220,7 @@ enum {
 #define	VIRTIO_VENDOR		0x1AF4
 #define	VIRTIO_DEV_NET		0x1000
 #define	VIRTIO_DEV_BLOCK	0x1001
+#define	VIRTIO_DEV_BALLOON	0x1002
 #define	VIRTIO_DEV_CONSOLE	0x1003
 #define	VIRTIO_DEV_RANDOM	0x1005
 
@@ -242,6 +246,10 @@ enum {
 #define VIRTIO_CONFIG_S_NEEDS_RESET	0x40
 #endif
 
+#ifndef VIRTIO_PCI_CAP_SHARED_MEMORY_CFG
+#define VIRTIO_PCI_CAP_SHARED_MEMORY_CFG	8
+#endif
+
 /*
  * Bits in VIRTIO_PCI_ISR.  These apply only if not using MSI-X.
  *
@@ -287,6 +295,7 @@ struct virtio_vq_info;
 #define	VIRTIO_USE_MSIX		0x01
 #define	VIRTIO_EVENT_IDX	0x02	/* use the event-index values */
 #define	VIRTIO_BROKED		0x08	/* ??? */
+#define	VIRTIO_KICK_EVENTFD	0x10	/* take notifies through eventfds */
 
 /*
  * virtio pci device bar layout
@@ -354,6 +363,7 @@ struct virtio_base {
 	uint32_t legacy_pio_bar_idx;	/**< index of legacy pio bar */
 	uint32_t modern_pio_bar_idx;	/**< index of modern pio bar */
 	uint32_t modern_mmio_bar_idx;	/**< index of modern mmio bar */
+	uint8_t shm_bars;		/**< mask of shared memory region bars */
 	uint8_t config_generation;	/**< configuration generation */
 	uint32_t device_feature_select;	/**< current selected device feature */
 	uint32_t driver_feature_select;	/**< current selected guest feature */
@@ -416,6 +426,14 @@ struct virtio_ops {
  * keep a pointer to each one.  The event indices are similarly
  * (but more easily) computable, and this time we'll compute them:
  * they're just XX_ring[N].
+ *
+ * When VIRTIO_F_RING_PACKED is negotiated the queue is a single
+ * descriptor ring (pdesc) plus the two event suppression areas, and
+ * desc and avail are unused.  used then points at used_shadow so that
+ * devices setting VRING_USED_F_NO_NOTIFY keep working; the core turns
+ * that flag into the packed device event flags.  A device on the modern
+ * transport opts in by offering (1UL << VIRTIO_F_RING_PACKED); vhost
+ * backends do not support it.
  */
 struct virtio_vq_info {
 	uint16_t qsize;		/**< size of this queue (a power of 2) */
@@ -429,6 +447,7 @@ struct virtio_vq_info {
 	uint16_t flags;		/**< flags (see above) */
 	uint16_t last_avail;	/**< a recent value of avail->idx */
 	uint16_t save_used;	/**< saved used->idx; see vq_endchains */
+	uint16_t used_pending;	/**< used entries not yet published */
 	uint16_t msix_idx;	/**< MSI-X index, or VIRTIO_MSI_NO_VECTOR */
 
 	uint32_t pfn;		/**< PFN of virt queue (not shifted!) */
@@ -440,18 +459,64 @@ struct virtio_vq_info {
 	volatile struct vring_used *used;
 				/**< the "used" ring */
 
+	volatile struct vring_packed_desc *pdesc;
+				/**< packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< driver event suppression, packed */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< device event suppression, packed */
+	struct {
+		uint16_t flags;
+		uint16_t idx;
+	} used_shadow;		/**< stands in for used, packed */
+	bool avail_wrap;	/**< avail wrap counter, packed */
+	bool used_wrap;		/**< used wrap counter, packed */
+	uint16_t used_idx;	/**< next used descriptor, packed */
+	uint16_t save_used_idx;	/**< saved used_idx; see vq_endchains */
+	uint16_t nchains;	/**< chains taken, indexes chain_hist */
+	uint16_t *chain_ndesc;	/**< descriptors of each buffer id */
+	uint16_t *chain_hist;	/**< descriptors of the last chains taken */
+
 	uint32_t gpa_desc[2];	/**< gpa of descriptors */
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
+	uint64_t dirty_gpa[2];	/**< gpa of the areas the device writes */
+	size_t dirty_len[2];	/**< their sizes, see vq_mark_dirty() */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	int kick_fd;		/**< eventfd signalled on notify */
+	struct mevent *kick_mevp;
+				/**< mevent of kick_fd, if started */
 };
 
-/* as noted above, these are sort of backwards, name-wise */
+/*
+ * As noted above, these are sort of backwards, name-wise.
+ *
+ * A device opts in to event index suppression by offering
+ * (1 << VIRTIO_RING_F_EVENT_IDX) in its device_caps: vq_getchain(),
+ * vq_retchain() and vq_clear_used_ring_flags() then maintain the
+ * avail_event for kicks, and vq_endchains() honours the used_event
+ * for interrupts.  Setting VRING_USED_F_NO_NOTIFY keeps masking kicks
+ * as before.
+ */
 #define VQ_AVAIL_EVENT_IDX(vq) \
 	(*(volatile uint16_t *)&(vq)->used->ring[(vq)->qsize])
 #define VQ_USED_EVENT_IDX(vq) \
 	((vq)->avail->ring[(vq)->qsize])
 
+/**
+ * @brief Does this ring use the packed layout?
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return true if VIRTIO_F_RING_PACKED is negotiated.
+ */
+static inline bool
+vq_is_packed(struct virtio_vq_info *vq)
+{
+	return !!(vq->base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED));
+}
+
 /**
  * @brief Is this ring ready for I/O?
  *
@@ -477,8 +542,20 @@ vq_ring_ready(struct virtio_vq_info *vq)
 static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
-	return (vq_ring_ready(vq) && vq->last_avail !=
-	    vq->avail->idx);
+	uint16_t flags;
+
+	if (!vq_ring_ready(vq))
+		return false;
+
+	if (vq_is_packed(vq)) {
+		flags = vq->pdesc[vq->last_avail].flags;
+		return !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) ==
+			vq->avail_wrap &&
+			!!(flags & (1 << VRING_PACKED_DESC_F_USED)) !=
+			vq->avail_wrap;
+	}
+
+	return vq->last_avail != vq->avail->idx;
 }
 
 /**
@@ -633,6 +710,47 @@ void virtio_set_io_bar(struct virtio_base *base, int barnum);
 int vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		struct iovec *iov, int n_iov, uint16_t *flags);
 
+/**
+ * @brief A request chain taken by vq_getchains_batch().
+ */
+struct vq_chain {
+	uint16_t	idx;	/**< ring position, as returned by vq_getchain() */
+	uint16_t	niov;	/**< number of iovecs of the chain */
+	struct iovec	*iov;	/**< iovecs of the chain */
+	uint16_t	*flags;	/**< descriptor flags, if requested */
+	uint32_t	len;	/**< bytes to return, see vq_relchains_batch() */
+};
+
+/**
+ * @brief Walk up to nchains descriptor chains from the guest with a
+ * single read of the avail index.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Array of nchains struct vq_chain to fill in.
+ * @param nchains Maximum number of chains to take.
+ * @param iov Array of nchains * n_iov iovecs, chain k uses iov[k * n_iov].
+ * @param n_iov Number of iovecs available to each chain.
+ * @param flags Array of nchains * n_iov flags, or NULL.
+ *
+ * @return number of chains taken, or -1 if the first one is invalid.
+ */
+int vq_getchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains,
+		       int nchains, struct iovec *iov, int n_iov,
+		       uint16_t *flags);
+
+/**
+ * @brief Return a batch of chains to the guest with a single used
+ * index update.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Chains from vq_getchains_batch(), with len filled in.
+ * @param n Number of chains.
+ *
+ * @return None
+ */
+void vq_relchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains,
+			int n);
+
 /**
  * @brief Return the currently-first request chain back to the
  * available ring.
@@ -655,6 +773,29 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Fill in the used ring entry of a request chain without
+ * publishing it to the guest.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param idx Pointer to available ring position, returned by vq_getchain().
+ * @param iolen Number of data bytes to be returned to frontend.
+ *
+ * @return None
+ */
+void vq_relchain_prepare(struct virtio_vq_info *vq, uint16_t idx,
+			 uint32_t iolen);
+
+/**
+ * @brief Make the chains filled in by vq_relchain_prepare() visible
+ * to the guest with a single used index update.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_relchain_publish(struct virtio_vq_info *vq);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -719,6 +860,35 @@ uint64_t virtio_pci_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 void virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		      int baridx, uint64_t offset, int size, uint64_t value);
 
+/**
+ * @brief Warm reset of a virtio PCI device.
+ *
+ * Reset the device the way the guest does by writing 0 to the device
+ * status, for the vdev_reset of the virtio devices.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ *
+ * @return None
+ */
+void virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev);
+
+#define VQ_DEPTH_UNKNOWN	0xffff	/* packed rings are not counted */
+
+/**
+ * @brief Get the depths of the virtqueues of a virtio PCI device.
+ *
+ * The depth of a queue is the number of buffers the guest made available
+ * that the device has not taken yet, 0 if the queue is not set up.
+ *
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param depth Array for the queue depths.
+ * @param nr Size of the depth array.
+ *
+ * @return number of queues reported, or -1 if dev is not a virtio device.
+ */
+int virtio_get_vq_depths(struct pci_vdev *dev, uint16_t *depth, int nr);
+
 /**
  * @brief Set modern BAR (usually 4) to map PCI config registers.
  *
@@ -733,6 +903,128 @@ void virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
  */
 int virtio_set_modern_bar(struct virtio_base *base, bool use_notify_pio);
 
+/**
+ * @brief Set a 64-bit memory BAR to be the shared memory region shmid.
+ *
+ * The whole BAR is the region, e.g. the DAX window of virtio-fs. Only
+ * valid for modern virtio, the accesses to the parts of the region the
+ * device has not mapped into the guest go to its BAR handlers.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param barnum Which BAR[0..5] to use, with barnum + 1 for the high bits.
+ * @param shmid ID of the shared memory region.
+ * @param size Size of the region, a power of 2.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int virtio_set_shm_region(struct virtio_base *base, int barnum, uint8_t shmid,
+			  uint64_t size);
+
+/**
+ * @brief A shared memory region whose pages are mapped on demand.
+ *
+ * The region is reserved in the address space of the device model, and the
+ * ranges of it a backend fills with file mappings are mapped into the EPT
+ * of the guest as for ivshmem, so the guest accesses them with no copy.
+ */
+struct virtio_shm {
+	struct virtio_base *base;
+	int barnum;
+	uint8_t *addr;		/**< the region in the device model */
+	uint64_t size;
+};
+
+/**
+ * @brief Reserve a shared memory region and expose it at a BAR.
+ *
+ * @param shm Pointer to struct virtio_shm.
+ * @param base Pointer to struct virtio_base.
+ * @param barnum Which BAR[0..5] to use, see virtio_set_shm_region().
+ * @param shmid ID of the shared memory region.
+ * @param size Size of the region, a power of 2.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int virtio_shm_init(struct virtio_shm *shm, struct virtio_base *base,
+		    int barnum, uint8_t shmid, uint64_t size);
+
+/**
+ * @brief Map a range of a file at a range of the region.
+ *
+ * The mapping is made at the current address of the BAR, as for ivshmem
+ * the guest is not expected to move it.
+ *
+ * @param shm Pointer to struct virtio_shm.
+ * @param fd The file.
+ * @param fd_offset Offset of the range in the file.
+ * @param offset Offset of the range in the region, page aligned.
+ * @param len Size of the range, page aligned.
+ * @param prot PROT_READ and/or PROT_WRITE.
+ *
+ * @return 0 on success, the negative errno on failure.
+ */
+int virtio_shm_map(struct virtio_shm *shm, int fd, uint64_t fd_offset,
+		   uint64_t offset, uint64_t len, int prot);
+
+/**
+ * @brief Take a range of the region back from the guest.
+ *
+ * @param shm Pointer to struct virtio_shm.
+ * @param offset Offset of the range in the region, page aligned.
+ * @param len Size of the range, page aligned.
+ *
+ * @return 0 on success, the negative errno on failure.
+ */
+int virtio_shm_unmap(struct virtio_shm *shm, uint64_t offset, uint64_t len);
+
+/**
+ * @brief Unmap the whole region and release its reservation.
+ *
+ * @param shm Pointer to struct virtio_shm.
+ *
+ * @return None
+ */
+void virtio_shm_deinit(struct virtio_shm *shm);
+
+/**
+ * @brief Bind an eventfd to the notify register of a virtqueue.
+ *
+ * Guest notifies of the virtqueue signal \p fd instead of being delivered
+ * to the device model as I/O requests. The binding is completed in the
+ * hypervisor when the SOS kernel supports it.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param idx Index of the virtqueue.
+ * @param fd The eventfd to be signalled.
+ * @param assign Whether to add or remove the binding.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int virtio_vq_set_ioeventfd(struct virtio_base *base, int idx, int fd,
+			    bool assign);
+
+/**
+ * @brief Handle the notifies of a virtqueue through an eventfd.
+ *
+ * The vq/vops notify callback is called from the mevent thread for every
+ * batch of guest notifies. This saves the vCPU a round trip to the device
+ * model on each notify.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return 0 on success and non-zero on fail.
+ */
+int virtio_vq_kick_start(struct virtio_vq_info *vq);
+
+/**
+ * @brief Stop handling the notifies of a virtqueue through an eventfd.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void virtio_vq_kick_stop(struct virtio_vq_info *vq);
+
 /**
  * @}
  */
@@ -63,6 +63,7 @@ enum vm_suspend_how {
 	VM_SUSPEND_SUSPEND,
 	VM_SUSPEND_HALT,
 	VM_SUSPEND_TRIPLEFAULT,
+	VM_SUSPEND_WARM,	/* set up, waiting for a start request */
 	VM_SUSPEND_LAST
 };
 
@@ -237,6 +238,8 @@ enum vm_exitcode {
 	VM_EXITCODE_INOUT = 0,
 	VM_EXITCODE_MMIO_EMUL,
 	VM_EXITCODE_PCI_CFG,
+	VM_EXITCODE_WP,		/* handled in the VHM */
+	VM_EXITCODE_RECLAIMED,
 	VM_EXITCODE_MAX
 };
 
@@ -30,6 +30,7 @@
 #define	_VMMAPI_H_
 
 #include <sys/param.h>
+#include <sys/uio.h>
 #include <uuid/uuid.h>
 #include "types.h"
 #include "vmm.h"
@@ -74,6 +75,146 @@ struct vmctx {
 	void (*update_gvt_bar)(struct vmctx *ctx);
 };
 
+/*
+ * A piece of guest memory, mapped at hva from fd at fd_offset and backed
+ * by huge pages of pg_size.
+ */
+struct vm_mem_region {
+	uint64_t gpa;
+	size_t len;
+	char *hva;
+	int fd;
+	uint64_t fd_offset;
+	size_t pg_size;
+};
+
+/*
+ * Guest memory layout, for the translations of the DMA buffers done inline
+ * by the devices, see vm_gpa_map_span(). The layout doesn't change once the
+ * memory is set up.
+ */
+struct vm_gpa_map {
+	struct vmctx	*ctx;
+	char		*base;
+	uint64_t	lowmem;
+	uint64_t	highmem_base;
+	uint64_t	highmem_end;
+};
+
+static inline void
+vm_get_gpa_map(struct vmctx *ctx, struct vm_gpa_map *mm)
+{
+	mm->ctx = ctx;
+	mm->base = ctx->baseaddr;
+	mm->lowmem = ctx->lowmem;
+	mm->highmem_base = ctx->highmem_gpa_base;
+	mm->highmem_end = ctx->highmem ?
+		ctx->highmem_gpa_base + ctx->highmem : 0;
+}
+
+/*
+ * Return the host address of gaddr and set *span to the length of guest
+ * memory contiguous from it, for a buffer run to be checked at once;
+ * return NULL if gaddr is not guest memory.
+ */
+static inline void *
+vm_gpa_map_span(const struct vm_gpa_map *mm, vm_paddr_t gaddr, size_t *span)
+{
+	if (gaddr < mm->lowmem) {
+		*span = mm->lowmem - gaddr;
+		return mm->base + gaddr;
+	}
+
+	if (gaddr >= mm->highmem_base && gaddr < mm->highmem_end) {
+		*span = mm->highmem_end - gaddr;
+		return mm->base + gaddr;
+	}
+
+	*span = 0;
+	return NULL;
+}
+
+/*
+ * Set during a migration, one bit per 4K page of the guest memory mapped
+ * by a device model, which may write it behind the dirty log of the EPT.
+ */
+extern uint64_t *vm_dm_dirty;
+
+static inline void
+vm_gpa_mark_dirty(vm_paddr_t gaddr, size_t len)
+{
+	uint64_t *dirty = vm_dm_dirty;
+	uint64_t pg, bit;
+
+	if (dirty == NULL || len == 0)
+		return;
+
+	for (pg = gaddr >> 12; pg <= (gaddr + len - 1) >> 12; pg++) {
+		bit = 1UL << (pg % 64);
+		if (!(dirty[pg / 64] & bit))
+			__atomic_fetch_or(&dirty[pg / 64], bit, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Set while some guest memory is shared read-only with other VMs, one bit
+ * per 2M block still backed by the shared copy, see hugetlb_share_memory().
+ */
+extern uint64_t *vm_shared_blocks;
+
+int	hugetlb_unshare_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+
+/* same checks as vm_map_gpa() */
+static inline void *
+vm_gpa_map_hva(const struct vm_gpa_map *mm, vm_paddr_t gaddr, size_t len)
+{
+	size_t span;
+	char *hva;
+
+	hva = vm_gpa_map_span(mm, gaddr, &span);
+	if (hva == NULL || len > span)
+		return NULL;
+
+	/* a device gets a private copy of a shared block, it may write it */
+	if (vm_shared_blocks && hugetlb_unshare_memory(mm->ctx, gaddr, len))
+		return NULL;
+
+	vm_gpa_mark_dirty(gaddr, len);
+	return hva;
+}
+
+/*
+ * Append the guest buffer [gaddr, gaddr + len) to the niov entries of iov,
+ * merged into the last one if it ends where the buffer starts. Return the
+ * new number of entries, or -1 if the buffer is not guest memory or iov is
+ * full.
+ */
+static inline int
+vm_gpa_map_iov_add(const struct vm_gpa_map *mm, struct iovec *iov, int niov,
+		  int max_iov, vm_paddr_t gaddr, size_t len)
+{
+	char *hva;
+
+	hva = vm_gpa_map_hva(mm, gaddr, len);
+	if (!hva)
+		return -1;
+
+	if (niov > 0 &&
+	    (char *)iov[niov - 1].iov_base + iov[niov - 1].iov_len == hva) {
+		iov[niov - 1].iov_len += len;
+		return niov;
+	}
+
+	if (niov >= max_iov)
+		return -1;
+	iov[niov].iov_base = hva;
+	iov[niov].iov_len = len;
+	return niov + 1;
+}
+
+/* Granularity of the guest memory given back to the host */
+#define	HUGETLB_RECLAIM_SIZE	(2 * MB)
+
 #define	PROT_RW		(PROT_READ | PROT_WRITE)
 #define	PROT_ALL	(PROT_READ | PROT_WRITE | PROT_EXEC)
 
@@ -110,12 +251,23 @@ void	vm_destroy(struct vmctx *ctx);
 int	vm_parse_memsize(const char *optarg, size_t *memsize);
 int	vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	uint64_t vma, int prot);
+int	vm_unmap_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
+	uint64_t vma, int prot);
 int	vm_setup_memory(struct vmctx *ctx, size_t len);
 void	vm_unsetup_memory(struct vmctx *ctx);
 bool	init_hugetlb(void);
 void	uninit_hugetlb(void);
 int	hugetlb_setup_memory(struct vmctx *ctx);
 void	hugetlb_unsetup_memory(struct vmctx *ctx);
+int	hugetlb_get_mem_regions(struct vm_mem_region *regions, int max);
+int	hugetlb_reclaim_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+int	hugetlb_restore_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+bool	hugetlb_is_reclaimed(vm_paddr_t gpa);
+int	hugetlb_share_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+void	*hugetlb_shared_hva(vm_paddr_t gpa);
+int	hugetlb_open_shared(const char *name, int flags);
+int	hugetlb_unlink_shared(const char *name);
+void	*hugetlb_map_shared(int fd, size_t len, int node, bool creator);
 void	*vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len);
 uint32_t vm_get_lowmem_limit(struct vmctx *ctx);
 size_t	vm_get_lowmem_size(struct vmctx *ctx);
@@ -124,6 +276,8 @@ int	vm_run(struct vmctx *ctx);
 int	vm_suspend(struct vmctx *ctx, enum vm_suspend_how how);
 int	vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg);
 int	vm_set_gsi_irq(struct vmctx *ctx, int gsi, uint32_t operation);
+void	vm_intr_batch_begin(void);
+void	vm_intr_batch_end(void);
 int	vm_assign_pcidev(struct vmctx *ctx, struct acrn_assign_pcidev *pcidev);
 int	vm_deassign_pcidev(struct vmctx *ctx, struct acrn_assign_pcidev *pcidev);
 int	vm_assign_mmiodev(struct vmctx *ctx, struct acrn_mmiodev *mmiodev);
@@ -141,6 +295,7 @@ int	vm_remove_hv_vdev(struct vmctx *ctx, struct acrn_emul_dev *dev);
 
 int	acrn_parse_cpu_affinity(char *arg);
 uint64_t vm_get_cpu_affinity_dm(void);
+void	vm_handoff_cpus_start(void);
 int	vm_create_vcpu(struct vmctx *ctx, uint16_t vcpu_id);
 int	vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_set_vcpu_regs *cpu_regs);
 
@@ -149,7 +304,22 @@ int	vm_intr_monitor(struct vmctx *ctx, void *intr_buf);
 void	vm_stop_watchdog(struct vmctx *ctx);
 void	vm_reset_watchdog(struct vmctx *ctx);
 
+int	vm_set_posted_io_range(struct vmctx *ctx, uint32_t type, uint64_t start,
+	uint64_t end, bool assign);
+int	vm_set_ioreq_poll(struct vmctx *ctx, uint64_t max_cycles);
+int	vm_set_pio_region(struct vmctx *ctx, uint16_t base, uint16_t len,
+	bool passthru);
+int	vm_dirty_log_start(struct vmctx *ctx, vm_paddr_t gpa, size_t len,
+	uint64_t *bitmap);
+int	vm_dirty_log_sync(struct vmctx *ctx);
+int	vm_dirty_log_stop(struct vmctx *ctx);
+int	vm_rdt_clos(struct vmctx *ctx, struct acrn_rdt_clos *rdt);
+int	vm_reclaim_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+int	vm_restore_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+int	vm_unpopulate_memory(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+int	vm_share_memory(struct vmctx *ctx, vm_paddr_t gpa, void *hva, size_t len);
 int	vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args);
 int	vm_irqfd(struct vmctx *ctx, struct acrn_irqfd *args);
+int	vm_resamplefd(struct vmctx *ctx, struct acrn_resamplefd *args);
 int	vm_get_config(struct vmctx *ctx, struct acrn_vm_config *vm_cfg, struct platform_info *plat_info);
 #endif	/* _VMMAPI_H_ */
@@ -4,8 +4,17 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+/*
+ * The log lines are queued into a ring by the threads calling pr_*() and
+ * written out by a writer thread, so that logging never waits for the disk:
+ * the writer takes all the lines queued while it was writing in one write,
+ * and rotates the files between two batches. The lines that don't fit into
+ * a full ring are dropped and counted.
+ */
+
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <paths.h>
 #include <stdarg.h>
@@ -17,6 +26,7 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "dm.h"
 #include "log.h"
@@ -43,6 +53,19 @@ static bool disk_log_enabled = false;
 #define DISK_LOG_MAX_LEN    (MAX_ONE_LOG_SIZE + 32)
 #define INDEX_AFTER(a, b) ((short int)b - (short int)a < 0)
 
+#define LOG_RING_SIZE     0x40000 /* power of 2 */
+
+/* the ring holds log_ring[tail, head), both counted from the start */
+static char log_ring[LOG_RING_SIZE];
+static uint64_t ring_head;
+static uint64_t ring_tail;
+static uint64_t ring_dropped;
+static bool writer_started;
+static bool writer_stop;
+static pthread_t writer_tid;
+static pthread_mutex_t ring_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+
 static bool is_disk_log_enabled(void)
 {
 	return disk_log_enabled;
@@ -124,8 +147,123 @@ static int init_disk_logger(bool enable, uint8_t log_level)
 	return 1;
 }
 
+static void rotate_disk_log_file(void)
+{
+	char file_name[FILE_NAME_LENGTH];
+
+	cur_file_index++;
+
+	/* remove the first old log file, to add a new one */
+	snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
+		LOG_PATH_NODE, vmname, (uint16_t)(cur_file_index - LOG_FILES_COUNT));
+	remove(file_name);
+
+	snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
+		LOG_PATH_NODE, vmname, cur_file_index);
+
+	close(disk_fd);
+	disk_fd = open(file_name, O_RDWR | O_CREAT, 0644);
+	if (disk_fd < 0) {
+		pr_err(DISK_PREFIX" open %s failed! Error: %s\n", file_name, strerror(errno));
+		return;
+	}
+	cur_log_size = 0;
+}
+
+/* write out log_ring[tail, head), which may wrap around */
+static void write_batch(uint64_t tail, uint64_t head, uint64_t dropped)
+{
+	struct iovec iov[3];
+	char note[64];
+	uint32_t off = tail & (LOG_RING_SIZE - 1);
+	uint32_t len = head - tail;
+	ssize_t write_cnt;
+	int niov = 0;
+
+	if (dropped) {
+		iov[niov].iov_base = note;
+		iov[niov].iov_len = snprintf(note, sizeof(note),
+			"[%lu log lines dropped]\n", dropped);
+		niov++;
+	}
+	iov[niov].iov_base = log_ring + off;
+	iov[niov].iov_len = MIN(len, LOG_RING_SIZE - off);
+	niov++;
+	if (len > LOG_RING_SIZE - off) {
+		iov[niov].iov_base = log_ring;
+		iov[niov].iov_len = len - (LOG_RING_SIZE - off);
+		niov++;
+	}
+
+	write_cnt = writev(disk_fd, iov, niov);
+	if (write_cnt < 0) {
+		pr_err(DISK_PREFIX"write disk failed");
+		close(disk_fd);
+		disk_fd = -1;
+		return;
+	}
+
+	/* the batches end with complete lines, the files are rotated in between */
+	cur_log_size += write_cnt;
+	if (cur_log_size > LOG_SIZE_LIMIT)
+		rotate_disk_log_file();
+}
+
+static void *disk_log_writer(void *arg)
+{
+	uint64_t tail, head, dropped;
+	bool stop;
+
+	for (;;) {
+		pthread_mutex_lock(&ring_mtx);
+		while (ring_tail == ring_head && !writer_stop)
+			pthread_cond_wait(&ring_cond, &ring_mtx);
+		tail = ring_tail;
+		head = ring_head;
+		dropped = ring_dropped;
+		ring_dropped = 0;
+		stop = writer_stop;
+		pthread_mutex_unlock(&ring_mtx);
+
+		if (tail != head) {
+			if ((disk_fd < 0) && disk_log_enabled) {
+				/**
+				 * usually this probe just be called once in DM whole life; but we need use vmname in
+				 * probe_disk_log_file, it can't be called in init_disk_logger for vmname not inited
+				 * then, so call it here.
+				 */
+				if (probe_disk_log_file() < 0)
+					disk_log_enabled = false;
+			}
+			if (disk_fd >= 0)
+				write_batch(tail, head, dropped);
+
+			/* the lines are copied out of the ring, give their room back */
+			pthread_mutex_lock(&ring_mtx);
+			ring_tail = head;
+			pthread_mutex_unlock(&ring_mtx);
+		}
+
+		if (stop && tail == head)
+			break;
+	}
+
+	return NULL;
+}
+
 static void deinit_disk_logger(void)
 {
+	pthread_mutex_lock(&ring_mtx);
+	writer_stop = true;
+	pthread_cond_signal(&ring_cond);
+	pthread_mutex_unlock(&ring_mtx);
+
+	/* the writer drains the ring first */
+	if (writer_started) {
+		pthread_join(writer_tid, NULL);
+		writer_started = false;
+	}
+
 	if (disk_fd > 0) {
 		disk_log_enabled = false;
 
@@ -138,77 +276,61 @@ static void deinit_disk_logger(void)
 static void write_to_disk(const char *fmt, va_list args)
 {
 	char buffer[DISK_LOG_MAX_LEN];
-	char *file_name = buffer;
-	char *buf;
-	int len;
-	int write_cnt;
+	uint32_t off, len;
+	int ret;
 	struct timespec times = {0, 0};
-	struct tm *lt;
+	struct tm lt;
 	time_t tt;
 
-
-	if ((disk_fd < 0) && disk_log_enabled) {
-		/**
-		 * usually this probe just be called once in DM whole life; but we need use vmname in
-		 * probe_disk_log_file, it can't be called in init_disk_logger for vmname not inited then,
-		 * so call it here.
-		 */
-		if (probe_disk_log_file() < 0) {
-			disk_log_enabled = false;
-			return;
-		}
-	}
-
-	len = vasprintf(&buf, fmt, args);
-	if (len < 0)
-		return;
-
 	time(&tt);
-	lt = localtime(&tt);
+	localtime_r(&tt, &lt);
 	clock_gettime(CLOCK_MONOTONIC, &times);
 
-	len = snprintf(buffer, DISK_LOG_MAX_LEN, "[%4d-%02d-%02d %02d:%02d:%02d][%5lu.%06lu] ",
-		lt->tm_year + 1900, lt->tm_mon + 1, lt->tm_mday, lt->tm_hour, lt->tm_min, lt->tm_sec,
+	ret = snprintf(buffer, DISK_LOG_MAX_LEN, "[%4d-%02d-%02d %02d:%02d:%02d][%5lu.%06lu] ",
+		lt.tm_year + 1900, lt.tm_mon + 1, lt.tm_mday, lt.tm_hour, lt.tm_min, lt.tm_sec,
 		times.tv_sec, times.tv_nsec / 1000);
-	if (len < 0 || len >= DISK_LOG_MAX_LEN) {
-		free(buf);
+	if (ret < 0 || ret >= DISK_LOG_MAX_LEN)
 		return;
-	}
-	len = strnlen(buffer, DISK_LOG_MAX_LEN);
+	len = ret;
 
-	strncpy(buffer + len, buf, DISK_LOG_MAX_LEN - len);
-	buffer[DISK_LOG_MAX_LEN - 1] = '\0';
-	free(buf);
+	ret = vsnprintf(buffer + len, DISK_LOG_MAX_LEN - len, fmt, args);
+	if (ret < 0)
+		return;
+	len = strnlen(buffer, DISK_LOG_MAX_LEN);
 
-	write_cnt = write(disk_fd, buffer, strnlen(buffer, DISK_LOG_MAX_LEN));
-	if (write_cnt < 0) {
-		pr_err(DISK_PREFIX"write disk failed");
-		close(disk_fd);
-		disk_fd = -1;
+	pthread_mutex_lock(&ring_mtx);
+	if (writer_stop) {
+		pthread_mutex_unlock(&ring_mtx);
 		return;
 	}
-
-	cur_log_size += write_cnt;
-	if (cur_log_size > LOG_SIZE_LIMIT) {
-
-		cur_file_index++;
-
-		/* remove the first old log file, to add a new one */
-		snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
-			LOG_PATH_NODE, vmname, (uint16_t)(cur_file_index - LOG_FILES_COUNT));
-		remove(file_name);
-
-		snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
-			LOG_PATH_NODE, vmname, cur_file_index);
-
-		close(disk_fd);
-		disk_fd = open(file_name, O_RDWR | O_CREAT, 0644);
-		if (disk_fd < 0) {
-			pr_err(DISK_PREFIX" open %s failed! Error: %s\n", file_name, strerror(errno));
+	if (!writer_started) {
+		if (pthread_create(&writer_tid, NULL, disk_log_writer, NULL) != 0) {
+			pthread_mutex_unlock(&ring_mtx);
 			return;
 		}
-		cur_log_size = 0;
+		pthread_setname_np(writer_tid, "disk_logger");
+		writer_started = true;
+		/* the lines queued before an exit() are not lost */
+		atexit(deinit_disk_logger);
+	}
+
+	if (LOG_RING_SIZE - (ring_head - ring_tail) < len) {
+		ring_dropped++;
+	} else {
+		off = ring_head & (LOG_RING_SIZE - 1);
+		if (len <= LOG_RING_SIZE - off) {
+			memcpy(log_ring + off, buffer, len);
+		} else {
+			memcpy(log_ring + off, buffer, LOG_RING_SIZE - off);
+			memcpy(log_ring, buffer + LOG_RING_SIZE - off, len - (LOG_RING_SIZE - off));
+		}
+
+		/* the writer only sleeps on an empty ring, the rest joins its next batch */
+		if (ring_head == ring_tail)
+			pthread_cond_signal(&ring_cond);
+		ring_head += len;
 	}
+	pthread_mutex_unlock(&ring_mtx);
 }
 
 static struct logger_ops logger_disk = {
@@ -11,6 +11,8 @@
 #include <asm/mmu.h>
 #include <asm/guest/ept.h>
 #include <asm/guest/vept.h>
+#include <asm/guest/vpmu.h>
+#include <asm/vm_config.h>
 #include <asm/vtd.h>
 #include <asm/lapic.h>
 #include <asm/irq.h>
@@ -43,6 +45,9 @@
 struct per_cpu_region per_cpu_data[MAX_PCPU_NUM] __aligned(PAGE_SIZE);
 static uint16_t phys_cpu_num = 0U;
 static uint64_t pcpu_sync = 0UL;
+/* pCPUs started once the first stage of pCPUs is up, see get_deferred_pcpu_mask() */
+static uint64_t deferred_pcpu_mask = 0UL;
+static uint64_t deferred_pcpu_sync = 0UL;
 static uint64_t startup_paddr = 0UL;
 
 /* physical cpu active bitmap, support up to 64 cpus */
@@ -202,6 +207,33 @@ void init_pcpu_pre(bool is_bsp)
 	pcpu_set_current_state(pcpu_id, PCPU_STATE_INITIALIZING);
 }
 
+/*
+ * @brief Get the pCPUs whose startup is deferred in a staged boot
+ *
+ * With CONFIG_STAGED_BOOT_ENABLED, the BSP first starts the pCPUs of the
+ * pre-launched safety and RT VMs only. Each of those VMs is launched by its
+ * own pCPUs as soon as they are initialized, while the BSP starts the other
+ * pCPUs; the VMs running on these are launched once all of them are up.
+ */
+static uint64_t get_deferred_pcpu_mask(void)
+{
+	uint64_t mask = 0UL;
+#ifdef CONFIG_STAGED_BOOT_ENABLED
+	uint16_t vm_id;
+	struct acrn_vm_config *vm_config;
+
+	mask = AP_MASK;
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm_config = get_vm_config(vm_id);
+		if ((vm_config->load_order == PRE_LAUNCHED_VM) && (vm_config->severity >= (uint8_t)SEVERITY_RTVM)) {
+			mask &= ~vm_config->cpu_affinity;
+		}
+	}
+#endif
+
+	return mask;
+}
+
 void init_pcpu_post(uint16_t pcpu_id)
 {
 #ifdef STACK_PROTECTOR
@@ -259,6 +291,10 @@ void init_pcpu_post(uint16_t pcpu_id)
 			panic("failed to initialize sgx!");
 		}
 
+		init_vmsr_index();
+
+		init_vpmu_cap();
+
 		/*
 		 * Reserve memory from platform E820 for EPT 4K pages for all VMs
 		 */
@@ -269,10 +305,11 @@ void init_pcpu_post(uint16_t pcpu_id)
 		 */
 		reserve_buffer_for_sept_pages();
 
-		pcpu_sync = ALL_CPUS_MASK;
-		/* Start all secondary cores */
+		deferred_pcpu_mask = get_deferred_pcpu_mask();
+		pcpu_sync = ALL_CPUS_MASK & ~deferred_pcpu_mask;
+		/* Start all secondary cores, but the deferred ones */
 		startup_paddr = prepare_trampoline();
-		if (!start_pcpus(AP_MASK)) {
+		if (!start_pcpus(AP_MASK & ~deferred_pcpu_mask)) {
 			panic("Failed to start all secondary cores!");
 		}
 
@@ -295,19 +332,38 @@ void init_pcpu_post(uint16_t pcpu_id)
 
 	init_sched(pcpu_id);
 
+	per_cpu(stats, pcpu_id).pcpu_id = pcpu_id;
+
 #ifdef CONFIG_RDT_ENABLED
 	setup_clos(pcpu_id);
 #endif
 
+	init_pcpu_vpmu();
+
 	enable_smep();
 
 	enable_smap();
 
 	init_keylocker();
 
-	bitmap_clear_lock(pcpu_id, &pcpu_sync);
-	/* Waiting for each pCPU has done its initialization before to continue */
-	wait_sync_change(&pcpu_sync, 0UL);
+	if (bitmap_test(pcpu_id, &deferred_pcpu_mask)) {
+		bitmap_clear_lock(pcpu_id, &deferred_pcpu_sync);
+		/* Waiting for each deferred pCPU has done its initialization before to continue */
+		wait_sync_change(&deferred_pcpu_sync, 0UL);
+	} else {
+		bitmap_clear_lock(pcpu_id, &pcpu_sync);
+		/* Waiting for each pCPU has done its initialization before to continue */
+		wait_sync_change(&pcpu_sync, 0UL);
+	}
+
+	if ((pcpu_id == BSP_CPU_ID) && (deferred_pcpu_mask != 0UL)) {
+		/* the first stage of pCPUs goes on to launch its VMs meanwhile */
+		deferred_pcpu_sync = deferred_pcpu_mask;
+		if (!start_pcpus(deferred_pcpu_mask)) {
+			panic("Failed to start all secondary cores!");
+		}
+		wait_sync_change(&deferred_pcpu_sync, 0UL);
+	}
 }
 
 static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id)
@@ -487,18 +543,6 @@ static void print_hv_banner(void)
 	printf(boot_msg);
 }
 
-static
-inline void asm_monitor(volatile const uint64_t *addr, uint64_t ecx, uint64_t edx)
-{
-	asm volatile("monitor\n" : : "a" (addr), "c" (ecx), "d" (edx));
-}
-
-static
-inline void asm_mwait(uint64_t eax, uint64_t ecx)
-{
-	asm volatile("mwait\n" : : "a" (eax), "c" (ecx));
-}
-
 /* wait until *sync == wake_sync */
 void wait_sync_change(volatile const uint64_t *sync, uint64_t wake_sync)
 {
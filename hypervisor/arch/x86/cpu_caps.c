@@ -15,6 +15,7 @@
 #include <asm/cpu_caps.h>
 #include <errno.h>
 #include <logmsg.h>
+#include <crypto_api.h>
 #include <asm/guest/vmcs.h>
 
 /* TODO: add more capability per requirement */
@@ -34,6 +35,10 @@
 static struct cpu_capability {
 	uint8_t apicv_features;
 	uint8_t ept_features;
+	uint8_t pml_features;
+	uint8_t tsc_scaling_features;
+	uint8_t ptmr_features;
+	uint8_t ptmr_shift;	/* the preemption timer counts every 2^ptmr_shift TSC ticks */
 
 	uint32_t vmx_ept;
 	uint32_t vmx_vpid;
@@ -154,8 +159,17 @@ bool is_ac_enabled(void)
 {
 	bool ac_enabled = false;
 
-	if (has_core_cap(1U << 5U) && (msr_read(MSR_TEST_CTL) & (1U << 29U))) {
+	if (has_core_cap(1U << 5U)) {
+#ifdef CONFIG_ENFORCE_TURNOFF_AC
+		ac_enabled = ((msr_read(MSR_TEST_CTL) & MSR_TEST_CTL_AC_SPLITLOCK) != 0UL);
+#else
+		/*
+		 * Turned on by every pCPU at start up. The MSR is shared by the sibling
+		 * threads of a core and may be cleared while one of them steps a split
+		 * lock of its guest, so it is not read here.
+		 */
 		ac_enabled = true;
+#endif
 	}
 
 	return ac_enabled;
@@ -166,6 +180,7 @@ static void detect_ept_cap(void)
 	uint64_t msr_val;
 
 	cpu_caps.ept_features = 0U;
+	cpu_caps.pml_features = 0U;
 
 	/* Read primary processor based VM control. */
 	msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS);
@@ -190,6 +205,10 @@ static void detect_ept_cap(void)
 		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_EPT)) {
 			cpu_caps.ept_features = 1U;
 		}
+
+		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_PML)) {
+			cpu_caps.pml_features = 1U;
+		}
 	}
 }
 
@@ -227,6 +246,23 @@ static void detect_apicv_cap(void)
 	vlapic_set_apicv_ops();
 }
 
+static void detect_tsc_scaling_cap(void)
+{
+	cpu_caps.tsc_scaling_features = 0U;
+	if (is_ctrl_setting_allowed(msr_read(MSR_IA32_VMX_PROCBASED_CTLS2), VMX_PROCBASED_CTLS2_TSC_SCALING)) {
+		cpu_caps.tsc_scaling_features = 1U;
+	}
+}
+
+static void detect_preemption_timer_cap(void)
+{
+	cpu_caps.ptmr_features = 0U;
+	if (is_ctrl_setting_allowed(msr_read(MSR_IA32_VMX_PINBASED_CTLS), VMX_PINBASED_CTLS_ENABLE_PTMR)) {
+		cpu_caps.ptmr_features = 1U;
+		cpu_caps.ptmr_shift = (uint8_t)(msr_read(MSR_IA32_VMX_MISC) & 0x1FUL);
+	}
+}
+
 static void detect_vmx_mmu_cap(void)
 {
 	uint64_t val;
@@ -269,6 +305,8 @@ static void detect_pcpu_cap(void)
 {
 	detect_apicv_cap();
 	detect_ept_cap();
+	detect_tsc_scaling_cap();
+	detect_preemption_timer_cap();
 	detect_vmx_mmu_cap();
 	detect_xsave_cap();
 	detect_core_caps();
@@ -343,6 +381,8 @@ void init_pcpu_capabilities(void)
 	}
 
 	detect_pcpu_cap();
+	init_fast_string(pcpu_has_cap(X86_FEATURE_FSRM));
+	init_sha256_accel(pcpu_has_cap(X86_FEATURE_SHA_NI));
 }
 
 static bool is_ept_supported(void)
@@ -360,6 +400,27 @@ bool is_apicv_advanced_feature_supported(void)
 	return ((cpu_caps.apicv_features & APICV_ADVANCED_FEATURE) == APICV_ADVANCED_FEATURE);
 }
 
+/* Page Modification Logging, which needs the EPT A/D flags */
+bool is_pml_supported(void)
+{
+	return ((cpu_caps.pml_features != 0U) && pcpu_has_vmx_ept_cap(VMX_EPT_AD));
+}
+
+bool is_tsc_scaling_supported(void)
+{
+	return (cpu_caps.tsc_scaling_features != 0U);
+}
+
+bool is_preemption_timer_supported(void)
+{
+	return (cpu_caps.ptmr_features != 0U);
+}
+
+uint8_t get_preemption_timer_shift(void)
+{
+	return cpu_caps.ptmr_shift;
+}
+
 bool pcpu_has_vmx_ept_cap(uint32_t bit_mask)
 {
 	return ((cpu_caps.vmx_ept & bit_mask) != 0U);
@@ -367,8 +367,7 @@ static struct ptirq_remapping_info *add_intx_remapping(struct acrn_vm *vm, uint3
 		}
 	} else if (entry->vm != vm) {
 		if (is_sos_vm(entry->vm)) {
-			entry->vm = vm;
-			entry->virt_sid.value = virt_sid.value;
+			ptirq_move_entry(entry, vm, &virt_sid);
 			entry->polarity = 0U;
 		} else {
 			pr_err("INTX gsi%d already in vm%d with vgsi%d, not able to add into vm%d with vgsi%d",
@@ -522,7 +521,7 @@ void ptirq_softirq(uint16_t pcpu_id)
 	}
 }
 
-void ptirq_intx_ack(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ctlr vgsi_ctlr)
+bool ptirq_intx_ack(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ctlr vgsi_ctlr)
 {
 	uint32_t phys_irq;
 	struct ptirq_remapping_info *entry;
@@ -559,6 +558,8 @@ void ptirq_intx_ack(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ctlr vgsi_c
 				phys_irq, irq_to_vector(phys_irq));
 		ioapic_gsi_unmask_irq(phys_irq);
 	}
+
+	return (entry != NULL);
 }
 
 /* Main entry for PCI device assignment with MSI and MSI-X
@@ -578,9 +579,9 @@ int32_t ptirq_prepare_msix_remap(struct acrn_vm *vm, uint16_t virt_bdf, uint16_t
 	 * adds the mapping entries at runtime, if the
 	 * entry already be held by others, return error.
 	 */
-	spinlock_obtain(&ptdev_lock);
+	qspinlock_obtain(&ptdev_lock);
 	entry = add_msix_remapping(vm, virt_bdf, phys_bdf, entry_nr);
-	spinlock_release(&ptdev_lock);
+	qspinlock_release(&ptdev_lock);
 
 	if (entry != NULL) {
 		ret = 0;
@@ -692,7 +693,7 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ct
 	/* no remap for vuart intx */
 	if (!is_vuart_intx(vm, virt_sid.intx_id.gsi)) {
 		/* query if we have virt to phys mapping */
-		spinlock_obtain(&ptdev_lock);
+		qspinlock_obtain(&ptdev_lock);
 		entry = find_ptirq_entry(PTDEV_INTR_INTX, &virt_sid, vm);
 		if (entry == NULL) {
 			if (is_sos_vm(vm)) {
@@ -753,7 +754,7 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ct
 				status = -ENODEV;
 			}
 		}
-		spinlock_release(&ptdev_lock);
+		qspinlock_release(&ptdev_lock);
 	} else {
 		status = -EINVAL;
 	}
@@ -778,9 +779,9 @@ int32_t ptirq_add_intx_remapping(struct acrn_vm *vm, uint32_t virt_gsi, uint32_t
 	struct ptirq_remapping_info *entry;
 	enum intx_ctlr vgsi_ctlr = pic_pin ? INTX_CTLR_PIC : INTX_CTLR_IOAPIC;
 
-	spinlock_obtain(&ptdev_lock);
+	qspinlock_obtain(&ptdev_lock);
 	entry = add_intx_remapping(vm, virt_gsi, phys_gsi, vgsi_ctlr);
-	spinlock_release(&ptdev_lock);
+	qspinlock_release(&ptdev_lock);
 
 	return (entry != NULL) ? 0 : -ENODEV;
 }
@@ -792,9 +793,9 @@ void ptirq_remove_intx_remapping(const struct acrn_vm *vm, uint32_t virt_gsi, bo
 {
 	enum intx_ctlr vgsi_ctlr = pic_pin ? INTX_CTLR_PIC : INTX_CTLR_IOAPIC;
 
-	spinlock_obtain(&ptdev_lock);
+	qspinlock_obtain(&ptdev_lock);
 	remove_intx_remapping(vm, virt_gsi, vgsi_ctlr);
-	spinlock_release(&ptdev_lock);
+	qspinlock_release(&ptdev_lock);
 }
 
 /*
@@ -806,9 +807,9 @@ void ptirq_remove_msix_remapping(const struct acrn_vm *vm, uint16_t phys_bdf,
 	uint32_t i;
 
 	for (i = 0U; i < vector_count; i++) {
-		spinlock_obtain(&ptdev_lock);
+		qspinlock_obtain(&ptdev_lock);
 		remove_msix_remapping(vm, phys_bdf, i);
-		spinlock_release(&ptdev_lock);
+		qspinlock_release(&ptdev_lock);
 	}
 }
 
@@ -61,17 +61,33 @@
 #define EPT_PT_PAGE_NUM	(PT_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + MEM_4G) + \
 			CONFIG_MAX_PCI_DEV_NUM * 6U)
 
-/* must be a multiple of 64 */
+/* The most EPT pages a single VM may use, must be a multiple of 64 */
 #define EPT_PAGE_NUM	(roundup((EPT_PML4_PAGE_NUM + EPT_PDPT_PAGE_NUM + \
 			EPT_PD_PAGE_NUM + EPT_PT_PAGE_NUM), 64U))
-#define TOTAL_EPT_4K_PAGES_SIZE (CONFIG_MAX_VM_NUM * (EPT_PAGE_NUM) * PAGE_SIZE)
 
-static struct page *ept_pages[CONFIG_MAX_VM_NUM];
-static uint64_t ept_page_bitmap[CONFIG_MAX_VM_NUM][EPT_PAGE_NUM / 64];
-static struct page ept_dummy_pages[CONFIG_MAX_VM_NUM];
+/* EPT_POOL_PAGE_NUM is shared by all the VMs:
+ * 1) the PML4 and PDPT pages, for each VM
+ * 2) DRAM - it is partitioned among the VMs, but the SOS also maps the memory of
+ *           the post-launched VMs, so all the EPTs map twice the platform RAM at most
+ * 3) low MMIO - MEM_4G at most, for each VM
+ * 4) high MMIO - CONFIG_MAX_PCI_DEV_NUM * 6U PD and PT pages, for each VM
+ */
+#define EPT_POOL_DRAM_MMIO_SIZE	((CONFIG_PLATFORM_RAM_SIZE * 2UL) + (CONFIG_MAX_VM_NUM * MEM_4G))
+#define EPT_POOL_PAGE_NUM	(roundup(((CONFIG_MAX_VM_NUM * (EPT_PML4_PAGE_NUM + EPT_PDPT_PAGE_NUM)) + \
+			PD_PAGE_NUM(EPT_POOL_DRAM_MMIO_SIZE) + PT_PAGE_NUM(EPT_POOL_DRAM_MMIO_SIZE) + \
+			(CONFIG_MAX_VM_NUM * CONFIG_MAX_PCI_DEV_NUM * 12U)), 64U))
+#define TOTAL_EPT_4K_PAGES_SIZE	(((EPT_POOL_PAGE_NUM < (CONFIG_MAX_VM_NUM * EPT_PAGE_NUM)) ? \
+			EPT_POOL_PAGE_NUM : (CONFIG_MAX_VM_NUM * EPT_PAGE_NUM)) * PAGE_SIZE)
 
-/* ept: extended page pool*/
-static struct page_pool ept_page_pool[CONFIG_MAX_VM_NUM];
+static uint64_t ept_page_bitmap[EPT_POOL_PAGE_NUM / 64];
+
+/* ept: extended page pool, the pages of all the VMs come from here */
+static struct page_pool ept_page_pool;
+
+/* the pages each VM holds from ept_page_pool, up to EPT_PAGE_NUM */
+static uint64_t vm_ept_page_bitmap[CONFIG_MAX_VM_NUM][EPT_POOL_PAGE_NUM / 64];
+static struct page ept_dummy_pages[CONFIG_MAX_VM_NUM];
+static struct page_pool vm_ept_page_pool[CONFIG_MAX_VM_NUM];
 
 
 /*
@@ -80,16 +96,17 @@ static struct page_pool ept_page_pool[CONFIG_MAX_VM_NUM];
 void reserve_buffer_for_ept_pages(void)
 {
 	uint64_t page_base;
-	uint16_t vm_id;
-	uint32_t offset = 0U;
 
 	page_base = e820_alloc_memory(TOTAL_EPT_4K_PAGES_SIZE, ~0UL);
 	set_paging_supervisor(page_base, TOTAL_EPT_4K_PAGES_SIZE);
-	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
-		ept_pages[vm_id] = (struct page *)(void *)(page_base + offset);
-		/* assume each VM has same amount of EPT pages */
-		offset += EPT_PAGE_NUM * PAGE_SIZE;
-	}
+
+	ept_page_pool.start_page = (struct page *)(void *)page_base;
+	ept_page_pool.bitmap_size = TOTAL_EPT_4K_PAGES_SIZE / (PAGE_SIZE * 64UL);
+	ept_page_pool.bitmap = ept_page_bitmap;
+	ept_page_pool.dummy_page = NULL;
+	ept_page_pool.parent = NULL;
+	spinlock_init(&ept_page_pool.lock);
+	ept_page_pool.last_hint_id = 0UL;
 }
 
 /* @pre: The PPT and EPT have same page granularity */
@@ -155,16 +172,23 @@ void init_ept_pgtable(struct pgtable *table, uint16_t vm_id)
 {
 	struct acrn_vm *vm = get_vm_from_vmid(vm_id);
 
-	ept_page_pool[vm_id].start_page = ept_pages[vm_id];
-	ept_page_pool[vm_id].bitmap_size = EPT_PAGE_NUM / 64;
-	ept_page_pool[vm_id].bitmap = ept_page_bitmap[vm_id];
-	ept_page_pool[vm_id].dummy_page = &ept_dummy_pages[vm_id];
+	struct page_pool *pool = &vm_ept_page_pool[vm_id];
 
-	spinlock_init(&ept_page_pool[vm_id].lock);
-	memset((void *)ept_page_pool[vm_id].bitmap, 0, ept_page_pool[vm_id].bitmap_size * sizeof(uint64_t));
-	ept_page_pool[vm_id].last_hint_id = 0UL;
+	pool->start_page = ept_page_pool.start_page;
+	pool->bitmap_size = ept_page_pool.bitmap_size;
+	pool->bitmap = vm_ept_page_bitmap[vm_id];
+	pool->dummy_page = &ept_dummy_pages[vm_id];
+	pool->parent = &ept_page_pool;
+	pool->quota = EPT_PAGE_NUM;
 
-	table->pool = &ept_page_pool[vm_id];
+	spinlock_init(&pool->lock);
+	/* the pages left by a VM which was not destroyed, if any */
+	if (pool->used != 0UL) {
+		free_all_pages(pool);
+	}
+	pool->last_hint_id = 0UL;
+
+	table->pool = pool;
 	table->default_access_right = EPT_RWX;
 	table->pgentry_present = ept_pgentry_present;
 	table->clflush_pagewalk = ept_clflush_pagewalk;
@@ -221,8 +245,15 @@ void destroy_ept(struct acrn_vm *vm)
 	if (vm->arch_vm.nworld_eptp != NULL) {
 		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
 	}
+
+	/* Give the EPT pages of the VM back to the shared pool */
+	free_all_pages(vm->arch_vm.ept_pgtable.pool);
+
+	(void)memset(&vm->arch_vm.dirty_log, 0U, sizeof(vm->arch_vm.dirty_log));
+	(void)memset(&vm->arch_vm.reclaim, 0U, sizeof(vm->arch_vm.reclaim));
 }
 
+
 /**
  * @pre: vm != NULL.
  */
@@ -287,13 +318,120 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
-static inline void ept_flush_guest(struct acrn_vm *vm)
+/*
+ * Wait for the vCPUs of the VM to have handled a request: a vCPU out of
+ * the guest handles it before its next VM entry anyway.
+ */
+static void wait_vcpus_request(struct acrn_vm *vm, uint16_t req)
 {
 	uint16_t i;
 	struct acrn_vcpu *vcpu;
-	/* Here doesn't do the real flush, just makes the request which will be handled before vcpu vmenter */
+
 	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+		while (bitmap_test(req, &vcpu->arch.pending_req) && vcpu->arch.in_guest) {
+			asm_pause();
+		}
+	}
+}
+
+static inline void ept_flush_guest(struct acrn_vm *vm)
+{
+	uint16_t i;
+	uint16_t pcpu_id = get_pcpu_id();
+	struct acrn_vcpu *vcpu;
+
+	if (bitmap_test(pcpu_id, &vm->ept_batch_pcpus)) {
+		/* done once by ept_batch_end() */
+		bitmap_set_lock(pcpu_id, &vm->ept_flush_pending);
+	} else {
+		/* Here doesn't do the real flush, just makes the request which will be handled before vcpu vmenter */
+		foreach_vcpu(i, vm, vcpu) {
+			/* a flush still pending covers this change as well */
+			if (!bitmap_test_and_set_lock(ACRN_REQUEST_EPT_FLUSH, &vcpu->arch.pending_req)) {
+				kick_vcpu(vcpu);
+			}
+		}
+	}
+}
+
+/*
+ * The EPT is the translation table of the IOMMU domain of the VM as well, the IOTLB
+ * entries of the changed range are invalidated before the change is complete.
+ */
+static void ept_flush_iommu(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	if ((vm->iommu != NULL) && (size != 0UL)) {
+		if (bitmap_test(get_pcpu_id(), &vm->ept_batch_pcpus)) {
+			/* done once by ept_batch_end() for the range of all the changes */
+			spinlock_obtain(&vm->ept_lock);
+			if (vm->iommu_flush_end == 0UL) {
+				vm->iommu_flush_start = gpa;
+				vm->iommu_flush_end = gpa + size;
+			} else {
+				vm->iommu_flush_start = min(vm->iommu_flush_start, gpa);
+				vm->iommu_flush_end = max(vm->iommu_flush_end, gpa + size);
+			}
+			spinlock_release(&vm->ept_lock);
+		} else {
+			iommu_flush_domain(vm->iommu, gpa, size);
+		}
+	}
+}
+
+/*
+ * Give back the page table pages the merges of this pCPU unlinked, once its
+ * changes are flushed: the IOTLB is already, and a vCPU either handled its
+ * EPT flush request or left the guest since.
+ */
+static void ept_free_stale_pages(struct acrn_vm *vm)
+{
+	if (!bitmap_test(get_pcpu_id(), &vm->ept_batch_pcpus) && has_stale_pages()) {
+		wait_vcpus_request(vm, ACRN_REQUEST_EPT_FLUSH);
+		free_stale_pages();
+	}
+}
+
+void ept_batch_begin(struct acrn_vm *vm)
+{
+	bitmap_set_lock(get_pcpu_id(), &vm->ept_batch_pcpus);
+}
+
+void ept_batch_end(struct acrn_vm *vm)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+	uint64_t start, end;
+
+	bitmap_clear_lock(pcpu_id, &vm->ept_batch_pcpus);
+	if (bitmap_test_and_clear_lock(pcpu_id, &vm->ept_flush_pending)) {
+		ept_flush_guest(vm);
+	}
+
+	/* the range may include the changes of other batches, flushed early then */
+	spinlock_obtain(&vm->ept_lock);
+	start = vm->iommu_flush_start;
+	end = vm->iommu_flush_end;
+	vm->iommu_flush_end = 0UL;
+	spinlock_release(&vm->ept_lock);
+
+	if (end != 0UL) {
+		ept_flush_iommu(vm, start, end - start);
+	}
+	ept_free_stale_pages(vm);
+}
+
+/*
+ * Re-coalesce the 4K/2M pages of a region into large pages once its mapping
+ * is uniform again.
+ *
+ * The secure world EPT shares the PD/PT pages of the normal world, which
+ * therefore are left alone while it is active.
+ *
+ * @pre: the caller holds vm->ept_lock
+ */
+static void ept_merge_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+{
+	if (vm->sworld_control.flag.active == 0UL) {
+		pgtable_merge_map(pml4_page, gpa, size, &vm->arch_vm.ept_pgtable);
 	}
 }
 
@@ -307,11 +445,16 @@ void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 
 	spinlock_obtain(&vm->ept_lock);
 
+	vm->map_gen++;
 	pgtable_add_map(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_pgtable);
+	/* a region deleted from a large page may be mapped back the same */
+	ept_merge_mr(vm, pml4_page, gpa, size);
 
 	spinlock_release(&vm->ept_lock);
 
 	ept_flush_guest(vm);
+	ept_flush_iommu(vm, gpa, size);
+	ept_free_stale_pages(vm);
 }
 
 void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
@@ -325,11 +468,54 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 	spinlock_obtain(&vm->ept_lock);
 
 	pgtable_modify_or_del_map(pml4_page, gpa, size, local_prot, prot_clr, &(vm->arch_vm.ept_pgtable), MR_MODIFY);
+	ept_merge_mr(vm, pml4_page, gpa, size);
 
 	spinlock_release(&vm->ept_lock);
 
 	ept_flush_guest(vm);
+	ept_flush_iommu(vm, gpa, size);
+	ept_free_stale_pages(vm);
+}
+
+/*
+ * Set or clear the write permission of the 4K page at gpa of the normal world.
+ * An unchanged page costs neither a page split nor a flush.
+ *
+ * @pre [gpa,gpa+PAGE_SIZE) has been mapped into host physical memory region
+ */
+void ept_write_protect_page(struct acrn_vm *vm, uint64_t gpa, bool protect)
+{
+	uint64_t *pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
+	const uint64_t *pgentry;
+	uint64_t pg_size = 0UL;
+	bool changed = false;
+
+	spinlock_obtain(&vm->ept_lock);
+
+	pgentry = pgtable_lookup_entry(pml4_page, gpa, &pg_size, &(vm->arch_vm.ept_pgtable));
+	if ((pgentry != NULL) && (((*pgentry & EPT_WR) == 0UL) != protect)) {
+		pgtable_modify_or_del_map(pml4_page, gpa, PAGE_SIZE, protect ? 0UL : EPT_WR,
+				protect ? EPT_WR : 0UL, &(vm->arch_vm.ept_pgtable), MR_MODIFY);
+		ept_merge_mr(vm, pml4_page, gpa, PAGE_SIZE);
+		if (protect) {
+			vm->wp_pages++;
+		} else if (vm->wp_pages != 0UL) {
+			vm->wp_pages--;
+		} else {
+			/* read-only before the SOS tracked it */
+		}
+		changed = true;
+	}
+
+	spinlock_release(&vm->ept_lock);
+
+	if (changed) {
+		ept_flush_guest(vm);
+		ept_flush_iommu(vm, gpa, PAGE_SIZE);
+		ept_free_stale_pages(vm);
+	}
 }
+
 /**
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
@@ -339,11 +525,343 @@ void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t
 
 	spinlock_obtain(&vm->ept_lock);
 
+	vm->map_gen++;
 	pgtable_modify_or_del_map(pml4_page, gpa, size, 0UL, 0UL, &(vm->arch_vm.ept_pgtable), MR_DEL);
 
 	spinlock_release(&vm->ept_lock);
 
 	ept_flush_guest(vm);
+	ept_flush_iommu(vm, gpa, size);
+}
+
+/*
+ * Set the bits of the dirty bitmap for the pages of [gpa, gpa + size)
+ * within the tracked region.
+ */
+static void dirty_log_set_pages(const struct vm_dirty_log *log, uint64_t gpa, uint64_t size)
+{
+	struct acrn_vm *sos_vm = get_sos_vm();
+	uint64_t addr = max(gpa, log->gpa);
+	uint64_t end = min(gpa + size, log->gpa + log->size);
+	uint64_t page, *word;
+
+	for (; addr < end; addr += PAGE_SIZE) {
+		page = (addr - log->gpa) >> PAGE_SHIFT;
+		word = (uint64_t *)gpa2hva(sos_vm, log->bitmap_gpa + ((page >> 6U) << 3U));
+		if (word != NULL) {
+			stac();
+			bitmap_set_lock((uint16_t)(page & 0x3FUL), word);
+			clac();
+		}
+	}
+}
+
+/*
+ * Clear the dirty flags of the tracked region, recording the dirty pages
+ * in the bitmap if mark is true. A large page is dirty as a whole.
+ *
+ * @pre: the caller holds vm->ept_lock
+ */
+static void dirty_log_walk(struct acrn_vm *vm, bool mark)
+{
+	const struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	uint64_t gpa = log->gpa, end = log->gpa + log->size;
+	uint64_t pg_size, base;
+	uint64_t *pgentry;
+
+	while (gpa < end) {
+		pg_size = PAGE_SIZE;
+		pgentry = (uint64_t *)pgtable_lookup_entry((uint64_t *)vm->arch_vm.nworld_eptp,
+				gpa, &pg_size, &vm->arch_vm.ept_pgtable);
+		base = gpa & ~(pg_size - 1UL);
+		if ((pgentry != NULL) && bitmap_test_and_clear_lock(9U, pgentry) && mark) {
+			dirty_log_set_pages(log, base, pg_size);
+		}
+		gpa = base + pg_size;
+	}
+}
+
+static void make_vcpus_request(struct acrn_vm *vm, uint16_t req)
+{
+	uint16_t i;
+	struct acrn_vcpu *vcpu;
+
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, req);
+	}
+}
+
+static inline bool is_reclaimed_block(const struct acrn_vm *vm, uint64_t block)
+{
+	return bitmap_test((uint16_t)(block & 0x3FUL), &vm->arch_vm.reclaim.blocks[block >> 6U]);
+}
+
+static bool is_reclaim_region(uint64_t gpa, uint64_t size)
+{
+	return ((size != 0UL) && mem_aligned_check(gpa, PDE_SIZE) && mem_aligned_check(size, PDE_SIZE) &&
+			(gpa < VM_RECLAIM_MAX_GPA) && (size <= (VM_RECLAIM_MAX_GPA - gpa)));
+}
+
+int32_t ept_reclaim_mr(struct acrn_vm *vm, uint64_t gpa, uint64_t size, bool populated)
+{
+	struct vm_reclaim *reclaim = &vm->arch_vm.reclaim;
+	uint64_t block, addr, end = gpa + size;
+	int32_t ret = -EINVAL;
+
+	if (is_reclaim_region(gpa, size)) {
+		ret = 0;
+		for (addr = gpa; populated && (addr < end); addr += PDE_SIZE) {
+			if (!is_reclaimed_block(vm, addr >> PDE_SHIFT) && !ept_is_valid_mr(vm, addr, PDE_SIZE)) {
+				pr_err("%s: gpa 0x%lx is not mapped", __func__, addr);
+				ret = -EINVAL;
+				break;
+			}
+		}
+	}
+
+	if (ret == 0) {
+		reclaim->used = true;
+		/* the EPT is flushed once all the blocks are unmapped */
+		ept_batch_begin(vm);
+		for (addr = gpa; addr < end; addr += PDE_SIZE) {
+			block = addr >> PDE_SHIFT;
+			if (!is_reclaimed_block(vm, block)) {
+				/* marked first, a vCPU faulting on the block must find it reclaimed */
+				bitmap_set_lock((uint16_t)(block & 0x3FUL), &reclaim->blocks[block >> 6U]);
+				ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, addr, PDE_SIZE);
+			}
+		}
+		ept_batch_end(vm);
+		/* SOS frees the backing once it returns, no TLB entry may still reach it */
+		wait_vcpus_request(vm, ACRN_REQUEST_EPT_FLUSH);
+	}
+
+	return ret;
+}
+
+static inline bool is_shared_block(const struct acrn_vm *vm, uint64_t block)
+{
+	return bitmap_test((uint16_t)(block & 0x3FUL), &vm->arch_vm.reclaim.shared[block >> 6U]);
+}
+
+/* Map the 2M block at gpa to the SOS memory at sos_gpa */
+static void map_sos_block(struct acrn_vm *vm, uint64_t gpa, uint64_t sos_gpa, uint64_t prot)
+{
+	struct acrn_vm *sos_vm = get_sos_vm();
+	uint64_t hpa, len, sos_addr, map_size;
+	uint32_t sz;
+
+	/* the SOS pages backing a block are not contiguous in general */
+	for (len = 0UL; len < PDE_SIZE; len += map_size) {
+		sos_addr = sos_gpa + len;
+		hpa = local_gpa2hpa(sos_vm, sos_addr, &sz);
+		map_size = min((uint64_t)sz - (sos_addr & ((uint64_t)sz - 1UL)), PDE_SIZE - len);
+		ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, hpa, gpa + len, map_size, prot);
+	}
+}
+
+int32_t ept_restore_mr(struct acrn_vm *vm, uint64_t gpa, uint64_t sos_gpa, uint64_t size)
+{
+	struct vm_reclaim *reclaim = &vm->arch_vm.reclaim;
+	uint64_t block, offset;
+	int32_t ret = -EINVAL;
+
+	if (is_reclaim_region(gpa, size) && mem_aligned_check(sos_gpa, PAGE_SIZE) &&
+			ept_is_valid_mr(get_sos_vm(), sos_gpa, size)) {
+		ept_batch_begin(vm);
+		for (offset = 0UL; offset < size; offset += PDE_SIZE) {
+			block = (gpa + offset) >> PDE_SHIFT;
+			if (is_reclaimed_block(vm, block)) {
+				if (is_shared_block(vm, block)) {
+					/* a vCPU faulting on it meanwhile finds it reclaimed */
+					ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa + offset, PDE_SIZE);
+					bitmap_clear_lock((uint16_t)(block & 0x3FUL), &reclaim->shared[block >> 6U]);
+				}
+				map_sos_block(vm, gpa + offset, sos_gpa + offset, EPT_RWX | EPT_WB);
+				bitmap_clear_lock((uint16_t)(block & 0x3FUL), &reclaim->blocks[block >> 6U]);
+			}
+		}
+		ept_batch_end(vm);
+		ret = 0;
+	} else {
+		pr_err("%s: invalid region or backing", __func__);
+	}
+
+	return ret;
+}
+
+int32_t ept_share_mr(struct acrn_vm *vm, uint64_t gpa, uint64_t sos_gpa, uint64_t size)
+{
+	struct vm_reclaim *reclaim = &vm->arch_vm.reclaim;
+	uint64_t block, offset;
+	int32_t ret = -EINVAL;
+
+	if (is_reclaim_region(gpa, size) && mem_aligned_check(sos_gpa, PAGE_SIZE) &&
+			ept_is_valid_mr(get_sos_vm(), sos_gpa, size)) {
+		ept_batch_begin(vm);
+		for (offset = 0UL; offset < size; offset += PDE_SIZE) {
+			block = (gpa + offset) >> PDE_SHIFT;
+			if (is_reclaimed_block(vm, block) && !is_shared_block(vm, block)) {
+				/* marked first, a write faulting on the block must find it shared */
+				bitmap_set_lock((uint16_t)(block & 0x3FUL), &reclaim->shared[block >> 6U]);
+				map_sos_block(vm, gpa + offset, sos_gpa + offset, EPT_RD | EPT_EXE | EPT_WB);
+			}
+		}
+		ept_batch_end(vm);
+		ret = 0;
+	} else {
+		pr_err("%s: invalid region or backing", __func__);
+	}
+
+	return ret;
+}
+
+bool ept_is_shared(struct acrn_vm *vm, uint64_t gpa)
+{
+	const uint64_t *pgentry;
+	uint64_t pg_size = 0UL;
+	bool ret = false;
+
+	if (vm->arch_vm.reclaim.used && (gpa < VM_RECLAIM_MAX_GPA)) {
+		ret = is_shared_block(vm, gpa >> PDE_SHIFT);
+		if (!ret) {
+			pgentry = pgtable_lookup_entry((uint64_t *)vm->arch_vm.nworld_eptp, gpa, &pg_size,
+					&vm->arch_vm.ept_pgtable);
+			ret = (pgentry != NULL) && ((*pgentry & EPT_WR) != 0UL);
+		}
+	}
+
+	return ret;
+}
+
+bool ept_is_shared_block(struct acrn_vm *vm, uint64_t gpa)
+{
+	return vm->arch_vm.reclaim.used && (gpa < VM_RECLAIM_MAX_GPA) && is_shared_block(vm, gpa >> PDE_SHIFT);
+}
+
+bool ept_is_reclaimed(struct acrn_vm *vm, uint64_t gpa)
+{
+	bool ret = false;
+
+	if (vm->arch_vm.reclaim.used && (gpa < VM_RECLAIM_MAX_GPA)) {
+		ret = is_reclaimed_block(vm, gpa >> PDE_SHIFT) || (local_gpa2hpa(vm, gpa, NULL) != INVALID_HPA);
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vcpu == get_running_vcpu(get_pcpu_id())
+ */
+void ept_drain_pml(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint16_t index = exec_vmread16(VMX_GUEST_PML_INDEX);
+	uint64_t pg_size, *pgentry;
+	uint32_t i;
+
+	if (index != (uint16_t)(PML_ENTITY_NUM - 1U)) {
+		/* the index has wrapped around if the log is full */
+		i = (index >= PML_ENTITY_NUM) ? 0U : ((uint32_t)index + 1U);
+
+		spinlock_obtain(&vm->ept_lock);
+		for (; (i < PML_ENTITY_NUM) && vm->arch_vm.dirty_log.enabled; i++) {
+			pg_size = PAGE_SIZE;
+			pgentry = (uint64_t *)pgtable_lookup_entry((uint64_t *)vm->arch_vm.nworld_eptp,
+					vcpu->arch.pml_log[i], &pg_size, &vm->arch_vm.ept_pgtable);
+			if (pgentry != NULL) {
+				/* the page is logged again once the vCPUs flush, see ept_dirty_log_sync() */
+				bitmap_clear_lock(9U, pgentry);
+				dirty_log_set_pages(&vm->arch_vm.dirty_log,
+						vcpu->arch.pml_log[i] & ~(pg_size - 1UL), pg_size);
+			}
+		}
+		spinlock_release(&vm->ept_lock);
+
+		exec_vmwrite16(VMX_GUEST_PML_INDEX, (uint16_t)(PML_ENTITY_NUM - 1U));
+	}
+}
+
+int32_t ept_dirty_log_start(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint64_t bitmap_gpa)
+{
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	uint64_t bitmap_size = ((size >> PAGE_SHIFT) + 63UL) >> 3U;
+	int32_t ret = -EINVAL;
+
+	if (!pcpu_has_vmx_ept_cap(VMX_EPT_AD)) {
+		pr_err("%s: EPT A/D flags are not supported", __func__);
+		ret = -ENODEV;
+	} else if ((vm->sworld_control.flag.supported != 0UL) || log->enabled) {
+		/* the secure world EPTP is loaded without the A/D flags */
+		ret = -EBUSY;
+	} else if ((size != 0UL) && mem_aligned_check(gpa, PAGE_SIZE) && mem_aligned_check(size, PAGE_SIZE) &&
+			mem_aligned_check(bitmap_gpa, 8UL) && ept_is_valid_mr(get_sos_vm(), bitmap_gpa, bitmap_size)) {
+		spinlock_obtain(&vm->ept_lock);
+		log->gpa = gpa;
+		log->size = size;
+		log->bitmap_gpa = bitmap_gpa;
+		/* forget the flags left over from a former tracking */
+		dirty_log_walk(vm, false);
+		log->use_pml = is_pml_supported();
+		log->enabled = true;
+		spinlock_release(&vm->ept_lock);
+
+		make_vcpus_request(vm, ACRN_REQUEST_DIRTY_LOG);
+		wait_vcpus_request(vm, ACRN_REQUEST_DIRTY_LOG);
+		ret = 0;
+	} else {
+		pr_err("%s: invalid region or bitmap", __func__);
+	}
+
+	return ret;
+}
+
+int32_t ept_dirty_log_sync(struct acrn_vm *vm)
+{
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	int32_t ret = -EINVAL;
+
+	if (log->enabled) {
+		if (log->use_pml) {
+			/* the vCPUs drain their log when they leave the guest */
+			ept_flush_guest(vm);
+			wait_vcpus_request(vm, ACRN_REQUEST_EPT_FLUSH);
+		} else {
+			spinlock_obtain(&vm->ept_lock);
+			dirty_log_walk(vm, true);
+			spinlock_release(&vm->ept_lock);
+		}
+
+		/*
+		 * A page written through a TLB entry cached before its dirty flag
+		 * was cleared is reported already; once the vCPUs have flushed, any
+		 * further write sets the flag again.
+		 */
+		ept_flush_guest(vm);
+		wait_vcpus_request(vm, ACRN_REQUEST_EPT_FLUSH);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+int32_t ept_dirty_log_stop(struct acrn_vm *vm)
+{
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	int32_t ret = -EINVAL;
+
+	if (log->enabled) {
+		spinlock_obtain(&vm->ept_lock);
+		log->enabled = false;
+		log->use_pml = false;
+		spinlock_release(&vm->ept_lock);
+
+		make_vcpus_request(vm, ACRN_REQUEST_DIRTY_LOG);
+		wait_vcpus_request(vm, ACRN_REQUEST_DIRTY_LOG);
+		ret = 0;
+	}
+
+	return ret;
 }
 
 /**
@@ -240,11 +240,46 @@ static int32_t local_gva2gpa_pae(struct acrn_vcpu *vcpu, struct page_walk_info *
  * - Return -EFAULT for paging fault, and refer to err_code for paging fault
  *   error code.
  */
+static struct gva_tlb_entry *gva_tlb_entry(struct acrn_vcpu *vcpu, uint64_t gva)
+{
+	return &vcpu->arch.gva_tlb[(gva >> PAGE_SHIFT) & (GVA_TLB_ENTRIES - 1U)];
+}
+
+static bool gva_tlb_lookup(struct acrn_vcpu *vcpu, const struct page_walk_info *pw_info,
+	uint64_t gva, uint32_t access, uint64_t *gpa)
+{
+	const struct gva_tlb_entry *entry = gva_tlb_entry(vcpu, gva);
+	bool hit = false;
+
+	if ((entry->exit == vcpu->arch.nrexits) && (entry->gva_page == (gva >> PAGE_SHIFT))
+			&& (entry->cr3 == pw_info->top_entry) && (entry->access == access)
+			&& (entry->is_user_mode_access == pw_info->is_user_mode_access)) {
+		*gpa = (entry->gpa_page << PAGE_SHIFT) | (gva & (PAGE_SIZE - 1UL));
+		hit = true;
+	}
+
+	return hit;
+}
+
+static void gva_tlb_fill(struct acrn_vcpu *vcpu, const struct page_walk_info *pw_info,
+	uint64_t gva, uint32_t access, uint64_t gpa)
+{
+	struct gva_tlb_entry *entry = gva_tlb_entry(vcpu, gva);
+
+	entry->exit = vcpu->arch.nrexits;
+	entry->cr3 = pw_info->top_entry;
+	entry->gva_page = gva >> PAGE_SHIFT;
+	entry->gpa_page = gpa >> PAGE_SHIFT;
+	entry->access = access;
+	entry->is_user_mode_access = pw_info->is_user_mode_access;
+}
+
 int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 	uint32_t *err_code)
 {
 	enum vm_paging_mode pm = get_vcpu_paging_mode(vcpu);
 	struct page_walk_info pw_info;
+	uint32_t access;
 	int32_t ret = 0;
 
 	if ((gpa == NULL) || (err_code == NULL)) {
@@ -272,20 +307,29 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 		pw_info.is_smep_on = ((vcpu_get_cr4(vcpu) & CR4_SMEP) != 0UL);
 
 		*err_code &=  ~PAGE_FAULT_P_FLAG;
+		access = *err_code & (PAGE_FAULT_WR_FLAG | PAGE_FAULT_ID_FLAG);
 
-		if (pm == PAGING_MODE_4_LEVEL) {
-			pw_info.width = 9U;
-			ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
-		} else if (pm == PAGING_MODE_3_LEVEL) {
-			pw_info.width = 9U;
-			ret = local_gva2gpa_pae(vcpu, &pw_info, gva, gpa, err_code);
-		} else if (pm == PAGING_MODE_2_LEVEL) {
-			pw_info.width = 10U;
-			pw_info.pse = ((vcpu_get_cr4(vcpu) & CR4_PSE) != 0UL);
-			pw_info.nxe = false;
-			ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
-		} else {
+		if (pm == PAGING_MODE_0_LEVEL) {
 			*gpa = gva;
+		} else if (gva_tlb_lookup(vcpu, &pw_info, gva, access, gpa)) {
+			/* translated by an earlier walk during this VM exit */
+		} else {
+			if (pm == PAGING_MODE_4_LEVEL) {
+				pw_info.width = 9U;
+				ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
+			} else if (pm == PAGING_MODE_3_LEVEL) {
+				pw_info.width = 9U;
+				ret = local_gva2gpa_pae(vcpu, &pw_info, gva, gpa, err_code);
+			} else {
+				pw_info.width = 10U;
+				pw_info.pse = ((vcpu_get_cr4(vcpu) & CR4_PSE) != 0UL);
+				pw_info.nxe = false;
+				ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
+			}
+
+			if (ret == 0) {
+				gva_tlb_fill(vcpu, &pw_info, gva, access, *gpa);
+			}
 		}
 
 		if (ret == -EFAULT) {
@@ -299,7 +343,7 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 }
 
 static inline uint32_t local_copy_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa,
-	uint32_t size, uint32_t fix_pg_size, bool cp_from_vm)
+	uint32_t size, uint32_t fix_pg_size, bool cp_from_vm, bool nt)
 {
 	uint64_t hpa;
 	uint32_t offset_in_pg, len, pg_size;
@@ -324,6 +368,8 @@ static inline uint32_t local_copy_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t
 		stac();
 		if (cp_from_vm) {
 			(void)memcpy_s(h_ptr, len, g_ptr, len);
+		} else if (nt) {
+			(void)memcpy_nt_s(g_ptr, len, h_ptr, len);
 		} else {
 			(void)memcpy_s(g_ptr, len, h_ptr, len);
 		}
@@ -334,7 +380,7 @@ static inline uint32_t local_copy_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t
 }
 
 static inline int32_t copy_gpa(struct acrn_vm *vm, void *h_ptr_arg, uint64_t gpa_arg,
-	uint32_t size_arg, bool cp_from_vm)
+	uint32_t size_arg, bool cp_from_vm, bool nt)
 {
 	void *h_ptr = h_ptr_arg;
 	uint32_t len;
@@ -343,7 +389,7 @@ static inline int32_t copy_gpa(struct acrn_vm *vm, void *h_ptr_arg, uint64_t gpa
 	int32_t err = 0;
 
 	while (size > 0U) {
-		len = local_copy_gpa(vm, h_ptr, gpa, size, 0U, cp_from_vm);
+		len = local_copy_gpa(vm, h_ptr, gpa, size, 0U, cp_from_vm, nt);
 		if (len == 0U) {
 			err = -EINVAL;
 			break;
@@ -373,7 +419,7 @@ static inline int32_t copy_gva(struct acrn_vcpu *vcpu, void *h_ptr_arg, uint64_t
 	while ((size > 0U) && (ret == 0)) {
 		ret = gva2gpa(vcpu, gva, &gpa, err_code);
 		if (ret >= 0) {
-			len = local_copy_gpa(vcpu->vm, h_ptr, gpa, size, PAGE_SIZE_4K, cp_from_vm);
+			len = local_copy_gpa(vcpu->vm, h_ptr, gpa, size, PAGE_SIZE_4K, cp_from_vm, false);
 			if (len != 0U) {
 				gva += len;
 				h_ptr += len;
@@ -401,7 +447,7 @@ int32_t copy_from_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t si
 {
 	int32_t ret = 0;
 
-	ret = copy_gpa(vm, h_ptr, gpa, size, 1);
+	ret = copy_gpa(vm, h_ptr, gpa, size, 1, false);
 	if (ret != 0) {
 		pr_err("Unable to copy GPA 0x%llx from VM%d to HPA 0x%llx\n", gpa, vm->vm_id, (uint64_t)h_ptr);
 	}
@@ -420,7 +466,20 @@ int32_t copy_to_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t size
 {
 	int32_t ret = 0;
 
-	ret = copy_gpa(vm, h_ptr, gpa, size, 0);
+	ret = copy_gpa(vm, h_ptr, gpa, size, 0, false);
+	if (ret != 0) {
+		pr_err("Unable to copy HPA 0x%llx to GPA 0x%llx in VM%d\n", (uint64_t)h_ptr, gpa, vm->vm_id);
+	}
+
+	return ret;
+}
+
+/* @pre Pointer vm is non-NULL */
+int32_t copy_to_gpa_nt(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t size)
+{
+	int32_t ret = 0;
+
+	ret = copy_gpa(vm, h_ptr, gpa, size, 0, true);
 	if (ret != 0) {
 		pr_err("Unable to copy HPA 0x%llx to GPA 0x%llx in VM%d\n", (uint64_t)h_ptr, gpa, vm->vm_id);
 	}
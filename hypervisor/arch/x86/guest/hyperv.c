@@ -13,6 +13,9 @@
 #include <asm/vmx.h>
 #include <asm/guest/hyperv.h>
 #include <asm/tsc.h>
+#include <hypercall.h>
+#include <asm/guest/virq.h>
+#include <asm/guest/ept.h>
 
 #define DBG_LEVEL_HYPERV		6U
 
@@ -22,8 +25,118 @@
 #define CPUID3A_HYPERCALL_MSR		(1U << 5U)
 /* Access virtual processor index MSR (HV_X64_MSR_VP_INDEX) */
 #define CPUID3A_VP_INDEX_MSR		(1U << 6U)
+/* SynIC MSRs (HV_X64_MSR_SCONTROL through HV_X64_MSR_EOM and HV_X64_MSR_SINT0-15) */
+#define CPUID3A_SYNIC_MSRS		(1U << 2U)
+/* Synthetic timer MSRs (HV_X64_MSR_STIMER0_CONFIG through HV_X64_MSR_STIMER3_COUNT) */
+#define CPUID3A_SYNTIMER_MSRS		(1U << 3U)
 /* Partition reference TSC MSR (HV_X64_MSR_REFERENCE_TSC) */
 #define CPUID3A_REFERENCE_TSC_MSR	(1U << 9U)
+/* Frequency MSRs (HV_X64_MSR_TSC_FREQUENCY and HV_X64_MSR_APIC_FREQUENCY) */
+#define CPUID3A_FREQUENCY_MSRS		(1U << 11U)
+/* The frequency MSRs are available */
+#define CPUID3D_FREQUENCY_MSRS		(1U << 8U)
+/* The synthetic timers can inject an APIC vector instead of a message */
+#define CPUID3D_STIMER_DIRECT_MODE	(1U << 19U)
+
+/* HV_X64_MSR_SCONTROL, HV_X64_MSR_SIEFP and HV_X64_MSR_SIMP */
+#define HV_SYNIC_ENABLE			(1UL << 0U)
+#define HV_SYNIC_VERSION		1UL
+/* HV_X64_MSR_SINTx */
+#define HV_SINT_VECTOR_MASK		0xFFUL
+#define HV_SINT_MASKED			(1UL << 16U)
+/* HV_X64_MSR_STIMERx_CONFIG */
+#define HV_STIMER_ENABLE		(1UL << 0U)
+#define HV_STIMER_PERIODIC		(1UL << 1U)
+#define HV_STIMER_AUTOENABLE		(1UL << 3U)
+#define HV_STIMER_VECTOR_SHIFT		4U
+#define HV_STIMER_DIRECT_MODE		(1UL << 12U)
+#define HV_STIMER_SINT_SHIFT		16U
+
+/* SynIC messages, one 256 bytes slot per SINT in the SIMP page */
+#define HV_MESSAGE_SIZE			256U
+#define HVMSG_NONE			0x00000000U
+#define HVMSG_TIMER_EXPIRED		0x80000010U
+#define HV_MESSAGE_FLAG_PENDING		(1U << 0U)
+
+/* reference time is in 100ns units */
+#define HV_REF_TIME_PER_MS		10000UL
+
+/* Hypercall call codes */
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE	0x0002U
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST	0x0003U
+#define HVCALL_SEND_IPI			0x000BU
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE_EX	0x0013U
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST_EX	0x0014U
+#define HVCALL_SEND_IPI_EX		0x0015U
+
+/* Reps completed of a rep hypercall, in the result value */
+#define HV_HYPERCALL_REP_COMP_SHIFT	32U
+
+/* Hypercall status codes */
+#define HV_STATUS_SUCCESS		0UL
+#define HV_STATUS_INVALID_HYPERCALL_CODE	2UL
+#define HV_STATUS_INVALID_HYPERCALL_INPUT	3UL
+#define HV_STATUS_INVALID_ALIGNMENT	4UL
+#define HV_STATUS_INVALID_PARAMETER	5UL
+
+/* Formats of HV_VP_SET */
+#define HV_GENERIC_SET_SPARSE_4K	0UL
+#define HV_GENERIC_SET_ALL		1UL
+
+/* Flags of the TLB flush hypercalls */
+#define HV_FLUSH_ALL_PROCESSORS		(1UL << 0U)
+
+/* Guest flags of the hypercalls handled by ACRN */
+#define HYPERV_HYPERCALL_FLAGS		(GUEST_FLAG_PV_IPI | GUEST_FLAG_PV_TLB_FLUSH)
+
+struct hv_send_ipi {
+	uint32_t vector;
+	uint8_t target_vtl;
+	uint8_t reserved[3];
+	uint64_t cpu_mask;
+};
+
+/* HvCallSendSyntheticClusterIpiEx input, with the first bank of its HV_VP_SET */
+struct hv_send_ipi_ex {
+	uint32_t vector;
+	uint8_t target_vtl;
+	uint8_t reserved[3];
+	uint64_t format;
+	uint64_t valid_bank_mask;
+	uint64_t bank_contents[1];
+};
+
+/* HvCallFlushVirtualAddressSpace/List input, the GVA list of the latter follows */
+struct hv_flush_va {
+	uint64_t address_space;
+	uint64_t flags;
+	uint64_t processor_mask;
+};
+
+/* HvCallFlushVirtualAddressSpaceEx/ListEx input, with the first bank of its HV_VP_SET */
+struct hv_flush_va_ex {
+	uint64_t address_space;
+	uint64_t flags;
+	uint64_t format;
+	uint64_t valid_bank_mask;
+	uint64_t bank_contents[1];
+};
+
+struct hv_message_header {
+	uint32_t message_type;
+	uint8_t payload_size;
+	uint8_t message_flags;
+	uint8_t reserved[2];
+	uint64_t sender;
+};
+
+struct hv_timer_message {
+	struct hv_message_header header;
+	uint32_t timer_index;
+	uint32_t reserved;
+	uint64_t expiration_time;
+	uint64_t delivery_time;
+};
 
 struct HV_REFERENCE_TSC_PAGE {
 	uint32_t tsc_sequence;
@@ -84,11 +197,14 @@ hyperv_setup_tsc_page(const struct acrn_vcpu *vcpu, uint64_t val)
 }
 
 static inline uint64_t
-hyperv_scale_tsc(uint64_t scale)
+hyperv_scale_tsc(const struct acrn_vm *vm, uint64_t scale)
 {
-	uint64_t tsc;
+	uint64_t tsc = rdtsc();
 
-	tsc = rdtsc() + exec_vmread64(VMX_TSC_OFFSET_FULL);
+	if (vm->arch_vm.tsc_multiplier != 0UL) {
+		tsc = tsc_scale(tsc, vm->arch_vm.tsc_multiplier);
+	}
+	tsc += exec_vmread64(VMX_TSC_OFFSET_FULL);
 
 	return u64_mul_u64_shr64(tsc, scale);
 }
@@ -96,7 +212,206 @@ hyperv_scale_tsc(uint64_t scale)
 static inline uint64_t
 hyperv_get_ReferenceTime(struct acrn_vm *vm)
 {
-	return hyperv_scale_tsc(vm->arch_vm.hyperv.tsc_scale) - vm->arch_vm.hyperv.tsc_offset;
+	return hyperv_scale_tsc(vm, vm->arch_vm.hyperv.tsc_scale) - vm->arch_vm.hyperv.tsc_offset;
+}
+
+/* CPU ticks in an interval of reference time */
+static uint64_t
+hyperv_ref_to_ticks(uint64_t ref)
+{
+	uint64_t khz = get_tsc_khz();
+
+	/* split so that long intervals don't overflow */
+	return ((ref / HV_REF_TIME_PER_MS) * khz) + (((ref % HV_REF_TIME_PER_MS) * khz) / HV_REF_TIME_PER_MS);
+}
+
+/* runs on the pcpu of the vCPU, which delivers the timer before its next VM entry */
+static void
+hyperv_stimer_expired(void *data)
+{
+	struct hyperv_stimer *stimer = (struct hyperv_stimer *)data;
+	struct acrn_vcpu *vcpu = stimer->vcpu;
+
+	bitmap_set_lock(stimer->index, &vcpu->arch.hyperv.stimer_pending);
+	vcpu_make_request(vcpu, ACRN_REQUEST_HV_STIMER);
+}
+
+/* (re)arm a timer after its configuration or count changed */
+static void
+hyperv_stimer_start(struct acrn_vcpu *vcpu, struct hyperv_stimer *stimer)
+{
+	uint64_t now, deadline, period = 0UL;
+
+	del_timer(&stimer->timer);
+	stimer->migrated = false;
+	stimer->msg_pending = false;
+	bitmap_clear_lock(stimer->index, &vcpu->arch.hyperv.stimer_pending);
+
+	if ((stimer->config & HV_STIMER_ENABLE) != 0UL) {
+		now = hyperv_get_ReferenceTime(vcpu->vm);
+		if ((stimer->config & HV_STIMER_PERIODIC) != 0UL) {
+			/* the count of a periodic timer is its period */
+			stimer->exp_time = now + stimer->count;
+			period = hyperv_ref_to_ticks(stimer->count);
+		} else {
+			stimer->exp_time = stimer->count;
+		}
+
+		deadline = cpu_ticks();
+		if (stimer->exp_time > now) {
+			deadline += hyperv_ref_to_ticks(stimer->exp_time - now);
+		}
+		update_timer(&stimer->timer, deadline, period);
+		if (add_timer(&stimer->timer) != 0) {
+			pr_err("%s: no room for the timer", __func__);
+		}
+	}
+}
+
+static void
+hyperv_stimer_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+{
+	struct hyperv_stimer *stimer = &vcpu->arch.hyperv.stimer[(msr - HV_X64_MSR_STIMER0_CONFIG) >> 1U];
+	uint64_t config;
+
+	if (((msr - HV_X64_MSR_STIMER0_CONFIG) & 1U) == 0U) {
+		config = wval;
+	} else {
+		stimer->count = wval;
+		config = stimer->config;
+		if ((config & HV_STIMER_AUTOENABLE) != 0UL) {
+			config |= HV_STIMER_ENABLE;
+		}
+	}
+
+	/* a timer without a count, or a message timer without a SINT, stays disabled */
+	if ((stimer->count == 0UL) || (((config & HV_STIMER_DIRECT_MODE) == 0UL) &&
+			(((config >> HV_STIMER_SINT_SHIFT) & 0xFUL) == 0UL))) {
+		config &= ~HV_STIMER_ENABLE;
+	}
+	stimer->config = config;
+
+	hyperv_stimer_start(vcpu, stimer);
+}
+
+static uint64_t
+hyperv_stimer_rdmsr(const struct acrn_vcpu *vcpu, uint32_t msr)
+{
+	const struct hyperv_stimer *stimer = &vcpu->arch.hyperv.stimer[(msr - HV_X64_MSR_STIMER0_CONFIG) >> 1U];
+
+	return (((msr - HV_X64_MSR_STIMER0_CONFIG) & 1U) == 0U) ? stimer->config : stimer->count;
+}
+
+/*
+ * Post the expiration message of a message mode timer to the SIMP page.
+ * Returns false if the slot of its SINT still holds a message, it is
+ * then flagged for the guest to write EOM once the slot is free.
+ */
+static bool
+hyperv_stimer_post_msg(struct acrn_vcpu *vcpu, const struct hyperv_stimer *stimer)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	uint32_t sintx = (uint32_t)(stimer->config >> HV_STIMER_SINT_SHIFT) & 0xFU;
+	uint64_t sint = hv->sint[sintx];
+	struct hv_timer_message *msg = NULL;
+	bool done = true, inject = false;
+
+	if (((hv->scontrol & HV_SYNIC_ENABLE) != 0UL) && ((hv->simp & HV_SYNIC_ENABLE) != 0UL) &&
+			((sint & HV_SINT_MASKED) == 0UL)) {
+		msg = (struct hv_timer_message *)gpa2hva(vcpu->vm, (hv->simp & PAGE_MASK) + (sintx * HV_MESSAGE_SIZE));
+	}
+
+	/* the message is lost if the SynIC doesn't take it */
+	if (msg != NULL) {
+		stac();
+		if (msg->header.message_type != HVMSG_NONE) {
+			msg->header.message_flags |= HV_MESSAGE_FLAG_PENDING;
+			done = false;
+		} else {
+			msg->header.payload_size = (uint8_t)(sizeof(struct hv_timer_message) - sizeof(struct hv_message_header));
+			msg->header.message_flags = 0U;
+			msg->header.sender = 0UL;
+			msg->timer_index = stimer->index;
+			msg->reserved = 0U;
+			msg->expiration_time = stimer->exp_time;
+			msg->delivery_time = hyperv_get_ReferenceTime(vcpu->vm);
+			cpu_write_memory_barrier();
+			msg->header.message_type = HVMSG_TIMER_EXPIRED;
+			inject = true;
+		}
+		clac();
+	}
+
+	if (inject) {
+		vlapic_set_intr(vcpu, (uint32_t)(sint & HV_SINT_VECTOR_MASK), LAPIC_TRIG_EDGE);
+	}
+
+	return done;
+}
+
+/* Handle ACRN_REQUEST_HV_STIMER for the timers that expired */
+void
+hyperv_stimer_deliver(struct acrn_vcpu *vcpu)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	struct hyperv_stimer *stimer;
+	uint16_t i;
+	bool done;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &hv->stimer[i];
+		if (bitmap_test_and_clear_lock(i, &hv->stimer_pending) &&
+				((stimer->config & HV_STIMER_ENABLE) != 0UL)) {
+			if ((stimer->config & HV_STIMER_DIRECT_MODE) != 0UL) {
+				vlapic_set_intr(vcpu, (uint32_t)(stimer->config >> HV_STIMER_VECTOR_SHIFT) & 0xFFU,
+					LAPIC_TRIG_EDGE);
+				done = true;
+			} else {
+				done = hyperv_stimer_post_msg(vcpu, stimer);
+			}
+
+			stimer->msg_pending = !done;
+			if (done) {
+				if ((stimer->config & HV_STIMER_PERIODIC) != 0UL) {
+					stimer->exp_time += stimer->count;
+				} else {
+					/* a one-shot timer disables itself */
+					stimer->config &= ~HV_STIMER_ENABLE;
+				}
+			}
+		}
+	}
+}
+
+/* the guest freed a message slot, retry the messages that found it busy */
+static void
+hyperv_synic_eom(struct acrn_vcpu *vcpu)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	uint16_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		if (hv->stimer[i].msg_pending) {
+			bitmap_set_lock(i, &hv->stimer_pending);
+			vcpu_make_request(vcpu, ACRN_REQUEST_HV_STIMER);
+		}
+	}
+}
+
+/* the SIEFP and SIMP pages are cleared when they are enabled */
+static void
+hyperv_synic_setup_page(const struct acrn_vcpu *vcpu, uint64_t val)
+{
+	void *page_hva;
+
+	if ((val & HV_SYNIC_ENABLE) != 0UL) {
+		page_hva = gpa2hva(vcpu->vm, val & PAGE_MASK);
+		if (page_hva != NULL) {
+			stac();
+			(void)memset(page_hva, 0U, PAGE_SIZE);
+			clac();
+		}
+	}
 }
 
 static void
@@ -111,8 +426,9 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 	 * the basis of the recommendations presented by the hypervisor in CPUID.40000004:EAX.
 	 * A conforming hypervisor must return HV_STATUS_INVALID_HYPERCALL_CODE for any
 	 * unimplemented hypercalls.
-	 * ACRN does not wish to handle any hypercalls at moment, the following hypercall 
-	 * code page is implemented for this purpose.
+	 * ACRN only handles the IPI hypercalls of the VMs with GUEST_FLAG_PV_IPI and the TLB
+	 * flush ones of the VMs with GUEST_FLAG_PV_TLB_FLUSH, the other VMs get the following
+	 * hypercall code page that fails all hypercalls.
 	 * inst32[] for 32 bits:
 	 * 	mov eax, 0x02 ; HV_STATUS_INVALID_HYPERCALL_CODE
 	 * 	mov edx, 0
@@ -120,9 +436,13 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 	 * inst64[] for 64 bits:
 	 * 	mov rax, 0x02 ; HV_STATUS_INVALID_HYPERCALL_CODE
 	 * 	ret
+	 * inst_vmcall[] for the VMs with HYPERV_HYPERCALL_FLAGS, in both modes:
+	 * 	vmcall
+	 * 	ret
 	 */
 	const uint8_t inst32[11] = {0xb8U, 0x02U, 0x0U, 0x0U, 0x0U, 0xbaU, 0x0U, 0x0U, 0x0U, 0x0U, 0xc3U};
 	const uint8_t inst64[8] = {0x48U, 0xc7U, 0xc0U, 0x02U, 0x0U, 0x0U, 0x0U, 0xc3U};
+	const uint8_t inst_vmcall[4] = {0x0fU, 0x01U, 0xc1U, 0xc3U};
 
 	hypercall.val64 = val;
 
@@ -132,7 +452,9 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 		if (page_hva != NULL) {
 			stac();
 			(void)memset(page_hva, 0U, PAGE_SIZE);
-			if (get_vcpu_mode(vcpu) == CPU_MODE_64BIT) {
+			if ((get_vm_config(vcpu->vm->vm_id)->guest_flags & HYPERV_HYPERCALL_FLAGS) != 0UL) {
+				(void)memcpy_s(page_hva, 4U, inst_vmcall, 4U);
+			} else if (get_vcpu_mode(vcpu) == CPU_MODE_64BIT) {
 				(void)memcpy_s(page_hva, 8U, inst64, 8U);
 			} else {
 				(void)memcpy_s(page_hva, 11U, inst32, 11U);
@@ -142,45 +464,315 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 	}
 }
 
-int32_t
-hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+/* the guest page the hypervisor writes on an MSR write, INVALID_GPA if none */
+static uint64_t hyperv_msr_page(uint32_t msr, uint64_t wval)
 {
-	int32_t ret = 0;
+	uint64_t gpa = INVALID_GPA;
 
 	switch (msr) {
-	case HV_X64_MSR_GUEST_OS_ID:
-		vcpu->vm->arch_vm.hyperv.guest_os_id.val64 = wval;
-		if (wval == 0UL) {
-			vcpu->vm->arch_vm.hyperv.hypercall_page.enabled = 0UL;
-		}
-		break;
 	case HV_X64_MSR_HYPERCALL:
-		if (vcpu->vm->arch_vm.hyperv.guest_os_id.val64 == 0UL) {
-			pr_warn("hv: %s: guest_os_id is 0", __func__);
-			break;
-		}
-		vcpu->vm->arch_vm.hyperv.hypercall_page.val64 = wval;
-		hyperv_setup_hypercall_page(vcpu, wval);
-		break;
 	case HV_X64_MSR_REFERENCE_TSC:
-		hyperv_setup_tsc_page(vcpu, wval);
+	case HV_X64_MSR_SIEFP:
+	case HV_X64_MSR_SIMP:
+		/* bit 0 enables the page in all of them */
+		if ((wval & 1UL) != 0UL) {
+			gpa = wval & PAGE_MASK;
+		}
 		break;
-	case HV_X64_MSR_VP_INDEX:
-	case HV_X64_MSR_TIME_REF_COUNT:
-		/* read only */
-		/* fallthrough */
 	default:
-		pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
-		ret = -1;
 		break;
 	}
 
+	return gpa;
+}
+
+int32_t
+hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+{
+	int32_t ret = 0;
+
+	/* the WRMSR is retried once a shared guest page is copied */
+	if (!unshare_guest_memory(vcpu, hyperv_msr_page(msr, wval), PAGE_SIZE)) {
+		switch (msr) {
+		case HV_X64_MSR_GUEST_OS_ID:
+			vcpu->vm->arch_vm.hyperv.guest_os_id.val64 = wval;
+			if (wval == 0UL) {
+				vcpu->vm->arch_vm.hyperv.hypercall_page.enabled = 0UL;
+			}
+			break;
+		case HV_X64_MSR_HYPERCALL:
+			if (vcpu->vm->arch_vm.hyperv.guest_os_id.val64 == 0UL) {
+				pr_warn("hv: %s: guest_os_id is 0", __func__);
+				break;
+			}
+			vcpu->vm->arch_vm.hyperv.hypercall_page.val64 = wval;
+			hyperv_setup_hypercall_page(vcpu, wval);
+			break;
+		case HV_X64_MSR_REFERENCE_TSC:
+			hyperv_setup_tsc_page(vcpu, wval);
+			break;
+		case HV_X64_MSR_SCONTROL:
+			vcpu->arch.hyperv.scontrol = wval;
+			break;
+		case HV_X64_MSR_SIEFP:
+			vcpu->arch.hyperv.siefp = wval;
+			hyperv_synic_setup_page(vcpu, wval);
+			break;
+		case HV_X64_MSR_SIMP:
+			vcpu->arch.hyperv.simp = wval;
+			hyperv_synic_setup_page(vcpu, wval);
+			break;
+		case HV_X64_MSR_EOM:
+			hyperv_synic_eom(vcpu);
+			break;
+		case HV_X64_MSR_VP_INDEX:
+		case HV_X64_MSR_TIME_REF_COUNT:
+		case HV_X64_MSR_TSC_FREQUENCY:
+		case HV_X64_MSR_APIC_FREQUENCY:
+		case HV_X64_MSR_SVERSION:
+			/* read only */
+			/* fallthrough */
+		default:
+			if ((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15)) {
+				vcpu->arch.hyperv.sint[msr - HV_X64_MSR_SINT0] = wval;
+			} else if ((msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT)) {
+				hyperv_stimer_wrmsr(vcpu, msr, wval);
+			} else {
+				pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
+				ret = -1;
+			}
+			break;
+		}
+	}
+
 	dev_dbg(DBG_LEVEL_HYPERV, "hv: %s: MSR=0x%x wval=0x%lx vcpuid=%d vmid=%d",
 		__func__, msr, wval, vcpu->vcpu_id, vcpu->vm->vm_id);
 
 	return ret;
 }
 
+bool
+hyperv_is_hypercall(const struct acrn_vcpu *vcpu)
+{
+	const struct acrn_vm *vm = vcpu->vm;
+
+	return (!is_sos_vm(vm) && (vm->arch_vm.hyperv.hypercall_page.enabled != 0UL) &&
+		((get_vm_config(vm->vm_id)->guest_flags & HYPERV_HYPERCALL_FLAGS) != 0UL));
+}
+
+static uint64_t
+hyperv_deliver_ipi(struct acrn_vm *vm, uint32_t vector, uint8_t target_vtl, uint64_t vp_mask)
+{
+	uint64_t status = HV_STATUS_SUCCESS;
+
+	/* the VP index of a vCPU is its vcpu_id */
+	if ((vector < 16U) || (vector > 0xFFU) || (target_vtl != 0U)) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	} else {
+		vlapic_send_fixed_ipi(vm, vp_mask & vm_active_cpus(vm), vector);
+	}
+
+	return status;
+}
+
+/* HvCallSendSyntheticClusterIpi, fast with the input in RDX and R8 or from memory */
+static uint64_t
+hyperv_send_ipi(struct acrn_vcpu *vcpu, const union hyperv_hypercall_input *input,
+		uint64_t input_param, uint64_t output_param)
+{
+	struct hv_send_ipi ipi;
+	uint64_t status;
+
+	if ((input->rep_count != 0UL) || (input->var_hdr_size != 0UL)) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if (input->fast != 0UL) {
+		status = hyperv_deliver_ipi(vcpu->vm, (uint32_t)input_param, (uint8_t)(input_param >> 32U), output_param);
+	} else if ((input_param & 0x7UL) != 0UL) {
+		status = HV_STATUS_INVALID_ALIGNMENT;
+	} else if (copy_from_gpa(vcpu->vm, &ipi, input_param, sizeof(ipi)) != 0) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	} else {
+		status = hyperv_deliver_ipi(vcpu->vm, ipi.vector, ipi.target_vtl, ipi.cpu_mask);
+	}
+
+	return status;
+}
+
+/*
+ * HvCallSendSyntheticClusterIpiEx from memory. A VM has at most 64 vCPUs,
+ * they are all in the first bank of the HV_VP_SET.
+ */
+static uint64_t
+hyperv_send_ipi_ex(struct acrn_vcpu *vcpu, const union hyperv_hypercall_input *input, uint64_t input_param)
+{
+	struct hv_send_ipi_ex ipi;
+	uint64_t vp_mask = 0UL;
+	uint64_t status;
+
+	if ((input->rep_count != 0UL) || (input->fast != 0UL)) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if ((input_param & 0x7UL) != 0UL) {
+		status = HV_STATUS_INVALID_ALIGNMENT;
+	} else if (copy_from_gpa(vcpu->vm, &ipi, input_param, sizeof(ipi)) != 0) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	} else if (ipi.format == HV_GENERIC_SET_ALL) {
+		status = hyperv_deliver_ipi(vcpu->vm, ipi.vector, ipi.target_vtl, ~0UL);
+	} else if (ipi.format == HV_GENERIC_SET_SPARSE_4K) {
+		/* the banks present are packed, bank 0 is the first one if it is there */
+		if ((ipi.valid_bank_mask & 1UL) != 0UL) {
+			vp_mask = ipi.bank_contents[0];
+		}
+		status = hyperv_deliver_ipi(vcpu->vm, ipi.vector, ipi.target_vtl, vp_mask);
+	} else {
+		status = HV_STATUS_INVALID_PARAMETER;
+	}
+
+	return status;
+}
+
+/*
+ * ACRN flushes the whole VPID of the target vCPUs whatever address spaces
+ * and GVAs are given. The calls of the whole list report all its reps done.
+ */
+static uint64_t
+hyperv_deliver_flush(struct acrn_vm *vm, const union hyperv_hypercall_input *input,
+		uint64_t flags, uint64_t vp_mask)
+{
+	uint64_t mask = vp_mask;
+	uint64_t result = HV_STATUS_SUCCESS;
+
+	if ((flags & HV_FLUSH_ALL_PROCESSORS) != 0UL) {
+		mask = ~0UL;
+	}
+	vcpu_flush_guest_tlb(vm, mask & vm_active_cpus(vm));
+
+	if ((input->call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST) ||
+			(input->call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST_EX)) {
+		result |= (uint64_t)input->rep_count << HV_HYPERCALL_REP_COMP_SHIFT;
+	}
+
+	return result;
+}
+
+/* HvCallFlushVirtualAddressSpace/List from memory */
+static uint64_t
+hyperv_flush_va(struct acrn_vcpu *vcpu, const union hyperv_hypercall_input *input, uint64_t input_param)
+{
+	struct hv_flush_va flush;
+	uint64_t status;
+
+	if ((input->fast != 0UL) || (input->var_hdr_size != 0UL) ||
+			((input->call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE) && (input->rep_count != 0UL))) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if ((input_param & 0x7UL) != 0UL) {
+		status = HV_STATUS_INVALID_ALIGNMENT;
+	} else if (copy_from_gpa(vcpu->vm, &flush, input_param, sizeof(flush)) != 0) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	} else {
+		status = hyperv_deliver_flush(vcpu->vm, input, flush.flags, flush.processor_mask);
+	}
+
+	return status;
+}
+
+/* HvCallFlushVirtualAddressSpaceEx/ListEx from memory, only bank 0 of the HV_VP_SET is used */
+static uint64_t
+hyperv_flush_va_ex(struct acrn_vcpu *vcpu, const union hyperv_hypercall_input *input, uint64_t input_param)
+{
+	struct hv_flush_va_ex flush;
+	uint64_t vp_mask = 0UL;
+	uint64_t status;
+
+	if ((input->fast != 0UL) ||
+			((input->call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE_EX) && (input->rep_count != 0UL))) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if ((input_param & 0x7UL) != 0UL) {
+		status = HV_STATUS_INVALID_ALIGNMENT;
+	} else if (copy_from_gpa(vcpu->vm, &flush, input_param, sizeof(flush)) != 0) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	} else if (flush.format == HV_GENERIC_SET_ALL) {
+		status = hyperv_deliver_flush(vcpu->vm, input, flush.flags, ~0UL);
+	} else if (flush.format == HV_GENERIC_SET_SPARSE_4K) {
+		if ((flush.valid_bank_mask & 1UL) != 0UL) {
+			vp_mask = flush.bank_contents[0];
+		}
+		status = hyperv_deliver_flush(vcpu->vm, input, flush.flags, vp_mask);
+	} else {
+		status = HV_STATUS_INVALID_PARAMETER;
+	}
+
+	return status;
+}
+
+/*
+ * Handle the vmcall of the hypercall page. The input value, the input and
+ * output parameters are in RCX, RDX and R8 in 64-bit mode, in EDX:EAX,
+ * EBX:ECX and EDI:ESI otherwise, so is the result in RAX or EDX:EAX.
+ */
+void
+hyperv_hypercall(struct acrn_vcpu *vcpu)
+{
+	union hyperv_hypercall_input input;
+	uint64_t input_param, output_param, status = HV_STATUS_INVALID_HYPERCALL_CODE;
+	uint64_t guest_flags = get_vm_config(vcpu->vm->vm_id)->guest_flags;
+	bool is_64bit = (get_vcpu_mode(vcpu) == CPU_MODE_64BIT);
+
+	if (is_64bit) {
+		input.val64 = vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+		input_param = vcpu_get_gpreg(vcpu, CPU_REG_RDX);
+		output_param = vcpu_get_gpreg(vcpu, CPU_REG_R8);
+	} else {
+		input.val64 = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
+			(vcpu_get_gpreg(vcpu, CPU_REG_RAX) & 0xFFFFFFFFUL);
+		input_param = (vcpu_get_gpreg(vcpu, CPU_REG_RBX) << 32U) |
+			(vcpu_get_gpreg(vcpu, CPU_REG_RCX) & 0xFFFFFFFFUL);
+		output_param = (vcpu_get_gpreg(vcpu, CPU_REG_RDI) << 32U) |
+			(vcpu_get_gpreg(vcpu, CPU_REG_RSI) & 0xFFFFFFFFUL);
+	}
+
+	if (!is_hypercall_from_ring0()) {
+		vcpu_inject_ud(vcpu);
+	} else {
+		switch (input.call_code) {
+		case HVCALL_SEND_IPI:
+			if ((guest_flags & GUEST_FLAG_PV_IPI) != 0UL) {
+				status = hyperv_send_ipi(vcpu, &input, input_param, output_param);
+			}
+			break;
+		case HVCALL_SEND_IPI_EX:
+			if ((guest_flags & GUEST_FLAG_PV_IPI) != 0UL) {
+				status = hyperv_send_ipi_ex(vcpu, &input, input_param);
+			}
+			break;
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE:
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST:
+			if ((guest_flags & GUEST_FLAG_PV_TLB_FLUSH) != 0UL) {
+				status = hyperv_flush_va(vcpu, &input, input_param);
+			}
+			break;
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE_EX:
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST_EX:
+			if ((guest_flags & GUEST_FLAG_PV_TLB_FLUSH) != 0UL) {
+				status = hyperv_flush_va_ex(vcpu, &input, input_param);
+			}
+			break;
+		default:
+			/* keep status as HV_STATUS_INVALID_HYPERCALL_CODE */
+			break;
+		}
+
+		if (is_64bit) {
+			vcpu_set_gpreg(vcpu, CPU_REG_RAX, status);
+		} else {
+			vcpu_set_gpreg(vcpu, CPU_REG_RDX, 0UL);
+			vcpu_set_gpreg(vcpu, CPU_REG_RAX, status);
+		}
+
+		dev_dbg(DBG_LEVEL_HYPERV, "hv: %s: call 0x%x result 0x%lx vcpuid=%d vmid=%d",
+			__func__, input.call_code, status, vcpu->vcpu_id, vcpu->vm->vm_id);
+	}
+}
+
 int32_t
 hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 {
@@ -202,9 +794,36 @@ hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 	case HV_X64_MSR_REFERENCE_TSC:
 		*rval = vcpu->vm->arch_vm.hyperv.ref_tsc_page.val64;
 		break;
+	case HV_X64_MSR_TSC_FREQUENCY:
+	case HV_X64_MSR_APIC_FREQUENCY:
+		/* the vLAPIC timer counts at the TSC rate */
+		*rval = (uint64_t)vcpu->vm->arch_vm.tsc_khz * 1000UL;
+		break;
+	case HV_X64_MSR_SCONTROL:
+		*rval = vcpu->arch.hyperv.scontrol;
+		break;
+	case HV_X64_MSR_SVERSION:
+		*rval = HV_SYNIC_VERSION;
+		break;
+	case HV_X64_MSR_SIEFP:
+		*rval = vcpu->arch.hyperv.siefp;
+		break;
+	case HV_X64_MSR_SIMP:
+		*rval = vcpu->arch.hyperv.simp;
+		break;
+	case HV_X64_MSR_EOM:
+		*rval = 0UL;
+		break;
 	default:
-		pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
-		ret = -1;
+		if ((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15)) {
+			*rval = vcpu->arch.hyperv.sint[msr - HV_X64_MSR_SINT0];
+		} else if ((msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT)) {
+			*rval = hyperv_stimer_rdmsr(vcpu, msr);
+		} else {
+			pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
+			*rval = 0UL;
+			ret = -1;
+		}
 		break;
 	}
 
@@ -217,7 +836,7 @@ hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 void
 hyperv_init_time(struct acrn_vm *vm)
 {
-	uint64_t tsc_scale, tsc_khz = get_tsc_khz();
+	uint64_t tsc_scale, tsc_khz = vm->arch_vm.tsc_khz;
 	uint64_t tsc_offset;
 
 	/*
@@ -226,13 +845,13 @@ hyperv_init_time(struct acrn_vm *vm)
 	 * ReferenceTime is in 100ns units
 	 *
 	 * ReferenceTime =
-	 *     VirtualTsc / (get_tsc_khz() * 1000) * 1000000000 / 100
+	 *     VirtualTsc / (tsc_khz * 1000) * 1000000000 / 100
 	 *     + TscOffset
 	 *
-	 * TscScale = (10000U << 64U) / get_tsc_khz()
+	 * TscScale = (10000U << 64U) / tsc_khz, with the TSC frequency of the VM
 	 */
 	tsc_scale = u64_shl64_div_u64(10000U, tsc_khz);
-	tsc_offset = hyperv_scale_tsc(tsc_scale);
+	tsc_offset = hyperv_scale_tsc(vm, tsc_scale);
 
 	vm->arch_vm.hyperv.tsc_scale = tsc_scale;
 	vm->arch_vm.hyperv.tsc_offset = tsc_offset;
@@ -241,6 +860,75 @@ hyperv_init_time(struct acrn_vm *vm)
 		__func__, tsc_scale, tsc_offset);
 }
 
+/* reset the SynIC and the synthetic timers of a vCPU */
+void
+hyperv_init_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	uint16_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		del_timer(&hv->stimer[i].timer);
+	}
+	(void)memset((void *)hv, 0U, sizeof(struct acrn_hyperv_vcpu));
+
+	for (i = 0U; i < HV_SYNIC_SINT_COUNT; i++) {
+		hv->sint[i] = HV_SINT_MASKED;
+	}
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		hv->stimer[i].vcpu = vcpu;
+		hv->stimer[i].index = i;
+		initialize_timer(&hv->stimer[i].timer, hyperv_stimer_expired, &hv->stimer[i], 0UL, 0UL);
+	}
+}
+
+void
+hyperv_deinit_vcpu(struct acrn_vcpu *vcpu)
+{
+	uint16_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		del_timer(&vcpu->arch.hyperv.stimer[i].timer);
+	}
+}
+
+/*
+ * The timers are kept in the heap of the pcpu they were added on, stop them
+ * before the vCPU leaves the pcpu, like the vLAPIC timer.
+ */
+void
+hyperv_migrate_timers_out(struct acrn_vcpu *vcpu)
+{
+	struct hyperv_stimer *stimer;
+	uint16_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &vcpu->arch.hyperv.stimer[i];
+		if (timer_is_started(&stimer->timer)) {
+			del_timer(&stimer->timer);
+			stimer->migrated = true;
+		}
+	}
+}
+
+void
+hyperv_migrate_timers_in(struct acrn_vcpu *vcpu)
+{
+	struct hyperv_stimer *stimer;
+	uint16_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &vcpu->arch.hyperv.stimer[i];
+		if (stimer->migrated) {
+			stimer->migrated = false;
+			/* an already expired timeout fires right away */
+			if (add_timer(&stimer->timer) != 0) {
+				pr_err("%s: no room for the timer", __func__);
+			}
+		}
+	}
+}
+
 void
 hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 			 struct vcpuid_entry *entry)
@@ -264,10 +952,11 @@ hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 		break;
 	case 0x40000003U: /* HV supported feature */
 		entry->eax = CPUID3A_HYPERCALL_MSR | CPUID3A_VP_INDEX_MSR |
-			CPUID3A_TIME_REF_COUNT_MSR | CPUID3A_REFERENCE_TSC_MSR;
+			CPUID3A_TIME_REF_COUNT_MSR | CPUID3A_REFERENCE_TSC_MSR |
+			CPUID3A_SYNIC_MSRS | CPUID3A_SYNTIMER_MSRS | CPUID3A_FREQUENCY_MSRS;
 		entry->ebx = 0U;
 		entry->ecx = 0U;
-		entry->edx = 0U;
+		entry->edx = CPUID3D_FREQUENCY_MSRS | CPUID3D_STIMER_DIRECT_MODE;
 		break;
 	case 0x40000004U: /* HV Recommended hypercall usage */
 		entry->eax = 0U;
@@ -37,6 +37,8 @@
 #include <asm/per_cpu.h>
 #include <logmsg.h>
 #include <asm/guest/virq.h>
+#include <asm/guest/ept.h>
+#include <asm/guest/vmx_io.h>
 
 #define CPU_REG_FIRST			CPU_REG_RAX
 #define CPU_REG_LAST			CPU_REG_GDTR
@@ -1651,7 +1653,7 @@ static int32_t emulate_bittest(struct acrn_vcpu *vcpu, const struct instr_emul_v
 static __attribute__((noinline)) int32_t emulate_xchg_for_splitlock(struct acrn_vcpu *vcpu, const struct instr_emul_vie *vie)
 {
 	enum cpu_reg_name reg;
-	uint64_t reg_val, data = 0UL;
+	uint64_t reg_val, data = 0UL, gpa = 0UL;
 	uint8_t opsize = vie->opsize;
 	int32_t ret = 0;
 	uint32_t err_code = 0U;
@@ -1663,9 +1665,15 @@ static __attribute__((noinline)) int32_t emulate_xchg_for_splitlock(struct acrn_
 	ret = copy_from_gva(vcpu, &data, vie->gva, opsize, &err_code, &fault_addr);
 	if (ret == 0) {
 		err_code = PAGE_FAULT_WR_FLAG;
-		ret = copy_to_gva(vcpu, &reg_val, vie->gva, opsize, &err_code, &fault_addr);
-		if (ret == 0) {
-			vie_update_register(vcpu, reg, data, opsize);
+		ret = gva2gpa(vcpu, vie->gva, &gpa, &err_code);
+		if (ret < 0) {
+			fault_addr = vie->gva;
+		} else if (!unshare_guest_memory(vcpu, gpa, opsize)) {
+			/* a shared destination is copied first, the xchg is retried then */
+			ret = copy_to_gva(vcpu, &reg_val, vie->gva, opsize, &err_code, &fault_addr);
+			if (ret == 0) {
+				vie_update_register(vcpu, reg, data, opsize);
+			}
 		}
 	}
 
@@ -2237,6 +2245,47 @@ static int32_t local_decode_instruction(enum vm_cpu_mode cpu_mode,
 	return ret;
 }
 
+/*
+ * The decode only depends on the instruction bytes and the mode, a cached
+ * entry with the same ones is an exact copy of what decoding would give.
+ */
+static bool vie_cache_match(const struct instr_emul_cache_entry *entry, const struct instr_emul_vie *vie,
+		enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	uint8_t i;
+	bool match = (entry->vie.num_valid == vie->num_valid) && (entry->cpu_mode == (uint8_t)cpu_mode) &&
+		(entry->cs_d == cs_d);
+
+	for (i = 0U; match && (i < vie->num_valid); i++) {
+		match = (entry->vie.inst[i] == vie->inst[i]);
+	}
+
+	return match;
+}
+
+static int32_t cached_decode_instruction(struct acrn_vcpu *vcpu, enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	struct instr_emul_ctxt *emul_ctxt = &vcpu->inst_ctxt;
+	uint64_t rip = vcpu_get_rip(vcpu);
+	struct instr_emul_cache_entry *entry;
+	int32_t ret = 0;
+
+	entry = &emul_ctxt->cache[(uint32_t)(rip ^ (rip >> 12U)) & (VIE_CACHE_SIZE - 1U)];
+	if (vie_cache_match(entry, &emul_ctxt->vie, cpu_mode, cs_d)) {
+		(void)memcpy_s(&emul_ctxt->vie, sizeof(struct instr_emul_vie), &entry->vie, sizeof(struct instr_emul_vie));
+	} else {
+		ret = local_decode_instruction(cpu_mode, cs_d, &emul_ctxt->vie);
+		if (ret == 0) {
+			(void)memcpy_s(&entry->vie, sizeof(struct instr_emul_vie),
+				&emul_ctxt->vie, sizeof(struct instr_emul_vie));
+			entry->cpu_mode = (uint8_t)cpu_mode;
+			entry->cs_d = cs_d;
+		}
+	}
+
+	return ret;
+}
+
 /* for instruction MOVS/STO, check the gva gotten from DI/SI. */
 static int32_t instr_check_di(struct acrn_vcpu *vcpu)
 {
@@ -2358,7 +2407,7 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu)
 		csar = exec_vmread32(VMX_GUEST_CS_ATTR);
 		cpu_mode = get_vcpu_mode(vcpu);
 
-		retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar), &emul_ctxt->vie);
+		retval = cached_decode_instruction(vcpu, cpu_mode, seg_desc_def32(csar));
 
 		if (retval != 0) {
 			pr_err("decode instruction failed @ 0x%016lx:", vcpu_get_rip(vcpu));
@@ -2462,3 +2511,11 @@ bool is_current_opcode_xchg(struct acrn_vcpu *vcpu)
 	return (vcpu->inst_ctxt.vie.op.op_type == VIE_OP_TYPE_XCHG);
 }
 
+/* the guest memory the decoded MOVS/STOS writes, INVALID_GPA for the others */
+uint64_t get_instr_dst_gpa(const struct acrn_vcpu *vcpu)
+{
+	const struct instr_emul_vie *vie = &vcpu->inst_ctxt.vie;
+
+	return ((vie->op.op_flags & VIE_OP_F_CHECK_GVA_DI) != 0U) ? vie->dst_gpa : INVALID_GPA;
+}
+
@@ -14,6 +14,7 @@
 #include <asm/guest/vmcs.h>
 #include <asm/guest/nested.h>
 #include <asm/guest/vept.h>
+#include <asm/security.h>
 
 /* Cache the content of MSR_IA32_VMX_BASIC */
 static uint32_t vmx_basic;
@@ -234,7 +235,7 @@ int32_t read_vmx_msr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val)
 	return err;
 }
 
-#define MAX_SHADOW_VMCS_FIELDS 114U
+#define MAX_SHADOW_VMCS_FIELDS 113U
 /*
  * VMCS fields included in the dual-purpose VMCS: as shadow for L1 and
  * as hardware VMCS for nested guest (L2).
@@ -249,9 +250,7 @@ int32_t read_vmx_msr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val)
  * for all platforms.
  */
 static const uint32_t vmcs_shadowing_fields[MAX_SHADOW_VMCS_FIELDS] = {
-	/* 16-bits */
-	VMX_VPID,
-
+	/* 16-bits, VMX_VPID is emulated by vpid02 */
 	VMX_GUEST_ES_SEL,
 	VMX_GUEST_CS_SEL,
 	VMX_GUEST_SS_SEL,
@@ -739,6 +738,14 @@ int32_t vmxon_vmexit_handler(struct acrn_vcpu *vcpu)
 				vcpu->arch.nested.vmxon_ptr = vmptr_gpa;
 				vcpu->arch.nested.current_vmcs12_ptr = INVALID_GPA;
 
+				/* unique among all the L0 VPIDs, which are in [1, CONFIG_MAX_VM_NUM * MAX_VCPUS_PER_VM] */
+				if (vcpu->arch.vpid != 0U) {
+					vcpu->arch.nested.vpid02 = vcpu->arch.vpid + (CONFIG_MAX_VM_NUM * MAX_VCPUS_PER_VM);
+				} else {
+					vcpu->arch.nested.vpid02 = 0U;
+				}
+				vcpu->arch.nested.vpid12 = VPID12_NONE;
+
 				nested_vmx_result(VMsucceed, 0);
 			}
 		}
@@ -965,6 +972,9 @@ static void sync_vmcs12_to_vmcs02(struct acrn_vcpu *vcpu)
 
 	/* Sync VMCS fields that are not shadowing. Don't need to sync these fields back to VMCS12. */
 
+	/* L2 guests always run with vpid02, whatever VPID L1 programs in VMCS12 */
+	exec_vmwrite16(VMX_VPID, vcpu->arch.nested.vpid02);
+
 	val64 = vmcs12_read_field(vmcs12, VMX_MSR_BITMAP_FULL);
 	exec_vmwrite(VMX_MSR_BITMAP_FULL, gpa2hpa(vcpu->vm, val64));
 
@@ -1336,23 +1346,17 @@ static void set_vmcs01_guest_state(struct acrn_vcpu *vcpu)
  */
 int32_t nested_vmexit_handler(struct acrn_vcpu *vcpu)
 {
-	struct acrn_vmcs12 *vmcs12 = (struct acrn_vmcs12 *)&vcpu->arch.nested.vmcs12;
 	bool is_l1_vmexit = true;
 
-	if ((exec_vmread(VMX_EXIT_REASON) & 0xFFFFU) == VMX_EXIT_REASON_EPT_VIOLATION) {
+	if ((vcpu->arch.exit_reason & 0xFFFFU) == VMX_EXIT_REASON_EPT_VIOLATION) {
 		is_l1_vmexit = handle_l2_ept_violation(vcpu);
 	}
 
 	if (is_l1_vmexit) {
 		/*
-		 * Currerntly VMX_VPID is shadowing to L1, so we flush L2 VPID before
-		 * L1 VM entry to avoid conflicting with L1 VPID.
+		 * The L2 translations are tagged with vpid02 and can't be used by L1,
+		 * so they are kept for the next L2 VM entry.
 		 *
-		 * TODO: emulate VPID for L2 so that we can save this VPID flush
-		 */
-		flush_vpid_single(vmcs12->vpid);
-
-		/*
 		 * Clear VMCS02 because: ISDM: Before modifying the shadow-VMCS indicator,
 		 * software should execute VMCLEAR for the VMCS to ensure that it is not active.
 		 */
@@ -1436,6 +1440,20 @@ static void nested_vmentry(struct acrn_vcpu *vcpu, bool is_launch)
 			/* Merge L0 settings and L1 settings for VMCS Control fields */
 			merge_and_sync_control_fields(vcpu);
 
+			/*
+			 * The translations tagged with vpid02 belong to the L1 VPID of the last
+			 * L2 VM entry, they have to go when L2 runs with another L1 VPID.
+			 */
+			if ((uint32_t)vmcs12->vpid != vcpu->arch.nested.vpid12) {
+				flush_vpid_single(vcpu->arch.nested.vpid02);
+				vcpu->arch.nested.vpid12 = (uint32_t)vmcs12->vpid;
+			}
+
+			/* L2 must not use the branch predictions of L1, as at the first launch of a vCPU */
+			if (get_ibrs_type() == IBRS_RAW) {
+				msr_write(MSR_IA32_PRED_CMD, PRED_SET_IBPB);
+			}
+
 			/* vCPU is in guest mode from this point */
 			vcpu->arch.nested.in_l2_guest = true;
 
@@ -1444,16 +1462,17 @@ static void nested_vmentry(struct acrn_vcpu *vcpu, bool is_launch)
 			}
 
 			/*
-			 * There are two reasons to set vcpu->launched to false even for VMRESUME:
-			 *
-			 * - the launch state of VMCS02 is clear at this moment.
-			 * - currently VMX_VPID is shadowing to L1, and it could happens that
-			 *   L2 VPID will be conflicted with L1 VPID. We rely on run_vcpu() to
-			 *   flush global vpid in the VMLAUNCH path to resolve this conflict.
-			 *
-			 *  TODO: emulate L2 VPID to avoid VPID flush.
+			 * The launch state of VMCS02 is clear at this moment, so run_vcpu()
+			 * has to VMLAUNCH it even for VMRESUME, as for a migrated VMCS.
 			 */
-			vcpu->launched = false;
+			vcpu->arch.vmcs_migrated = true;
+
+			/*
+			 * That path writes back the cached RIP plus the instruction length,
+			 * make it the GUEST_RIP of VMCS02 which L1 programmed for L2.
+			 */
+			vcpu_retain_rip(vcpu);
+			bitmap_clear_lock(CPU_REG_RIP, &vcpu->reg_cached);
 		}
 	}
 }
@@ -1542,11 +1561,18 @@ int32_t invvpid_vmexit_handler(struct acrn_vcpu *vcpu)
 			nested_vmx_result(VMfailValid, VMXERR_INVEPT_INVVPID_INVALID_OPERAND);
 		} else {
 			/*
-			 * VPIDs are pass-thru. Values programmed by L1 are used by L0.
-			 * INVVPID type, VPID and GLA, operands of INVVPID instruction, are
-			 * passed as is to the pCPU.
+			 * All the L2 translations of this vCPU are tagged with vpid02, and only
+			 * the ones of the L1 VPID in vpid12 are kept in the TLB. Invalidating
+			 * all contexts of L1 is a single-context invalidation of vpid02.
 			 */
-			asm_invvpid(desc, type);
+			if (type == VMX_VPID_TYPE_ALL_CONTEXT) {
+				flush_vpid_single(vcpu->arch.nested.vpid02);
+			} else if (((uint32_t)desc.vpid == vcpu->arch.nested.vpid12) && (vcpu->arch.nested.vpid02 != 0U)) {
+				desc.vpid = vcpu->arch.nested.vpid02;
+				(void)asm_invvpid(desc, type);
+			} else {
+				/* no translation of this L1 VPID is cached */
+			}
 			nested_vmx_result(VMsucceed, 0);
 		}
 	}
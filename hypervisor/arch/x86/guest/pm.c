@@ -12,6 +12,9 @@
 #include <platform_acpi_info.h>
 #include <asm/guest/guest_pm.h>
 #include <asm/per_cpu.h>
+#include <ticks.h>
+
+#define PM_TMR_FREQ		3579545UL	/* ACPI PM timer frequency in Hz */
 
 int32_t validate_pstate(const struct acrn_vm *vm, uint64_t perf_ctl)
 {
@@ -376,6 +379,52 @@ static void register_prelaunched_vm_sleep_handler(struct acrn_vm *vm)
 					&prelaunched_vm_sleep_io_read, &prelaunched_vm_sleep_io_write);
 }
 
+/*
+ * The PM timer is a free running 32-bit counter at 3.579545 MHz, computed
+ * from the TSC so that guest reads, e.g. during TSC calibration, never
+ * leave the hypervisor.
+ *
+ * @pre vcpu != NULL
+ * @pre vcpu->vm != NULL
+ */
+static bool pm_tmr_io_read(struct acrn_vcpu *vcpu, __unused uint16_t addr, size_t width)
+{
+	uint64_t hz = (uint64_t)cpu_tickrate() * 1000UL;
+	uint64_t delta = cpu_ticks() - vcpu->vm->pm_tmr_base_tsc;
+	uint32_t value;
+
+	/* split the conversion so that it can't overflow */
+	value = (uint32_t)(((delta / hz) * PM_TMR_FREQ) + (((delta % hz) * PM_TMR_FREQ) / hz));
+	if (width < 4U) {
+		value &= (1U << (width * 8U)) - 1U;
+	}
+	vcpu->req.reqs.pio.value = value;
+
+	return true;
+}
+
+/*
+ * The PM timer is read-only, writes are ignored.
+ */
+static bool pm_tmr_io_write(__unused struct acrn_vcpu *vcpu, __unused uint16_t addr,
+			   __unused size_t width, __unused uint32_t v)
+{
+	return true;
+}
+
+static void register_pm_tmr_handler(struct acrn_vm *vm)
+{
+	struct vm_io_range io_range;
+
+	vm->pm_tmr_base_tsc = cpu_ticks();
+
+	io_range.base = VIRTUAL_PM_TMR_ADDR;
+	io_range.len = 4U;
+
+	register_pio_emulation_handler(vm, PM_TMR_PIO_IDX, &io_range,
+					&pm_tmr_io_read, &pm_tmr_io_write);
+}
+
 void init_guest_pm(struct acrn_vm *vm)
 {
 	struct pm_s_state_data *sx_data = get_host_sstate_data();
@@ -403,4 +452,9 @@ void init_guest_pm(struct acrn_vm *vm)
 		/* Intercept the virtual sleep control/status registers for pre-launched VM */
 		register_prelaunched_vm_sleep_handler(vm);
 	}
+
+	if (is_postlaunched_vm(vm) && ((get_vm_config(vm->vm_id)->guest_flags & GUEST_FLAG_VPM_TMR) != 0UL)) {
+		/* Emulate the PM timer advertised by the DM in the FADT */
+		register_pm_tmr_handler(vm);
+	}
 }
@@ -12,8 +12,15 @@
 #include <asm/cpu_caps.h>
 #include <logmsg.h>
 #include <errno.h>
+#include <ticks.h>
+#include <schedule.h>
+#include <timer.h>
+#include <asm/lib/atomic.h>
 #include <asm/guest/splitlock.h>
 
+/* Length of the window in which a vCPU may take CONFIG_SPLITLOCK_RATE_LIMIT split locks */
+#define SPLITLOCK_WINDOW_MS	10U
+
 static bool is_guest_ac_enabled(struct acrn_vcpu *vcpu)
 {
 	bool ret = false;
@@ -25,6 +32,75 @@ static bool is_guest_ac_enabled(struct acrn_vcpu *vcpu)
 	return ret;
 }
 
+static void splitlock_throttle_end(void *data)
+{
+	struct acrn_vcpu *vcpu = (struct acrn_vcpu *)data;
+
+	signal_event(&vcpu->events[VCPU_EVENT_SPLIT_LOCK_THROTTLE]);
+}
+
+/*
+ * Count a split lock of the vCPU, and keep the vCPU off the bus until the end
+ * of the rate limiting window once it took more split locks in the window than
+ * allowed. Only the offending vCPU sleeps, the other vCPUs of the VM and the
+ * other threads of the pCPU keep running.
+ */
+static void account_splitlock(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint64_t count, now = cpu_ticks();
+
+	atomic_inc64(&vm->splitlock_count);
+	count = vm->splitlock_count;
+	/* warn on the 1st, 2nd, 4th, 8th... split lock of the VM */
+	if ((count & (count - 1UL)) == 0UL) {
+		pr_warn("VM%u vCPU%u: split lock #%lu at RIP 0x%lx", vm->vm_id, vcpu->vcpu_id,
+			count, vcpu_get_rip(vcpu));
+	}
+
+	if ((now - vcpu->arch.splitlock_window) >= (TICKS_PER_MS * SPLITLOCK_WINDOW_MS)) {
+		vcpu->arch.splitlock_window = now;
+		vcpu->arch.splitlock_nr = 0U;
+	}
+	vcpu->arch.splitlock_nr++;
+
+	if ((CONFIG_SPLITLOCK_RATE_LIMIT != 0U) && (vcpu->arch.splitlock_nr > CONFIG_SPLITLOCK_RATE_LIMIT)) {
+		uint64_t end = vcpu->arch.splitlock_window + (TICKS_PER_MS * SPLITLOCK_WINDOW_MS);
+
+		atomic_inc64(&vm->splitlock_throttled);
+		initialize_timer(&vcpu->arch.splitlock_timer, splitlock_throttle_end, vcpu, end, 0UL);
+		if (add_timer(&vcpu->arch.splitlock_timer) == 0) {
+			wait_event(&vcpu->events[VCPU_EVENT_SPLIT_LOCK_THROTTLE]);
+		} else {
+			/* no timer to wake it up, let the other threads run once at least */
+			yield_current();
+		}
+	}
+}
+
+#ifdef CONFIG_SPLITLOCK_NATIVE_STEP
+/*
+ * Re-execute the split-locked instruction as is, with the split-lock detection
+ * turned off on the core until the next VM exit, MTF making it the very next
+ * one. The bus lock keeps the access atomic, so the other vCPUs of the VM are
+ * not kicked. The detection is shared with the sibling thread, whose guest
+ * just takes its split locks natively meanwhile.
+ */
+static void step_splitlock_natively(struct acrn_vcpu *vcpu)
+{
+	msr_write(MSR_TEST_CTL, msr_read(MSR_TEST_CTL) & ~MSR_TEST_CTL_AC_SPLITLOCK);
+
+	vcpu_retain_rip(vcpu);
+	vcpu->arch.proc_vm_exec_ctrls |= VMX_PROCBASED_CTLS_MON_TRAP;
+	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, vcpu->arch.proc_vm_exec_ctrls);
+	vcpu->arch.emulating_lock = true;
+}
+
+void vcpu_complete_splitlock_emulation(__unused struct acrn_vcpu *cur_vcpu)
+{
+	msr_write(MSR_TEST_CTL, msr_read(MSR_TEST_CTL) | MSR_TEST_CTL_AC_SPLITLOCK);
+}
+#else
 void vcpu_kick_splitlock_emulation(struct acrn_vcpu *cur_vcpu)
 {
 	struct acrn_vcpu *other;
@@ -56,6 +132,7 @@ void vcpu_complete_splitlock_emulation(struct acrn_vcpu *cur_vcpu)
 		put_vm_lock(cur_vcpu->vm);
 	}
 }
+#endif /* CONFIG_SPLITLOCK_NATIVE_STEP */
 
 int32_t emulate_splitlock(struct acrn_vcpu *vcpu, uint32_t exception_vector, bool *queue_exception)
 {
@@ -91,6 +168,15 @@ int32_t emulate_splitlock(struct acrn_vcpu *vcpu, uint32_t exception_vector, boo
 				 * otherwise, inject it back.
 				 */
 				if (inst[0] == 0xf0U) {  /* This is LOCK prefix */
+					account_splitlock(vcpu);
+#ifdef CONFIG_SPLITLOCK_NATIVE_STEP
+					if (vcpu->vm->hw.created_vcpus > 1U) {
+						step_splitlock_natively(vcpu);
+					} else {
+						/* Nothing else of the guest runs meanwhile, just skip the LOCK prefix */
+						vcpu->arch.inst_len = 1U;
+					}
+#else
 					/*
 					 * Kick other vcpus of the guest to stop execution
 					 * until the split-lock emulation being completed.
@@ -107,6 +193,7 @@ int32_t emulate_splitlock(struct acrn_vcpu *vcpu, uint32_t exception_vector, boo
 						exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, vcpu->arch.proc_vm_exec_ctrls);
 						vcpu->arch.emulating_lock = true;
 					}
+#endif
 
 					/* Skip the #AC, we have emulated it. */
 					*queue_exception = false;
@@ -118,6 +205,10 @@ int32_t emulate_splitlock(struct acrn_vcpu *vcpu, uint32_t exception_vector, boo
 						 * inject it back.
 						 */
 						if (is_current_opcode_xchg(vcpu)) {
+							account_splitlock(vcpu);
+#ifdef CONFIG_SPLITLOCK_NATIVE_STEP
+							step_splitlock_natively(vcpu);
+#else
 							/*
 							 * Kick other vcpus of the guest to stop execution
 							 * until the split-lock emulation being completed.
@@ -142,6 +233,7 @@ int32_t emulate_splitlock(struct acrn_vcpu *vcpu, uint32_t exception_vector, boo
 							 * Notify other vcpus of the guest to restart execution.
 							 */
 							vcpu_complete_splitlock_emulation(vcpu);
+#endif
 
 							/* Do not inject #AC, we have emulated it */
 							*queue_exception = false;
@@ -159,7 +159,12 @@ static void save_world_ctx(struct acrn_vcpu *vcpu, struct ext_context *ext_ctx)
 	}
 }
 
-static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext_ctx)
+/*
+ * @pre prev_ctx holds the context just saved, whose MSRs and TSC offset are
+ *      still loaded and are only written again if they differ
+ */
+static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext_ctx,
+		const struct ext_context *prev_ctx)
 {
 	uint32_t i;
 
@@ -172,7 +177,9 @@ static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext
 	bitmap_set_lock(CPU_REG_CR4, &vcpu->reg_updated);
 
 	/* VMCS Execution field */
-	exec_vmwrite64(VMX_TSC_OFFSET_FULL, ext_ctx->tsc_offset);
+	if (prev_ctx->tsc_offset != ext_ctx->tsc_offset) {
+		exec_vmwrite64(VMX_TSC_OFFSET_FULL, ext_ctx->tsc_offset);
+	}
 
 	/* VMCS GUEST field */
 	exec_vmwrite(VMX_GUEST_CR3, ext_ctx->cr3);
@@ -196,14 +203,26 @@ static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext
 	exec_vmwrite32(VMX_GUEST_IDTR_LIMIT, ext_ctx->idtr.limit);
 	exec_vmwrite32(VMX_GUEST_GDTR_LIMIT, ext_ctx->gdtr.limit);
 
-	/* MSRs which not in the VMCS */
-	msr_write(MSR_IA32_STAR, ext_ctx->ia32_star);
-	msr_write(MSR_IA32_LSTAR, ext_ctx->ia32_lstar);
-	msr_write(MSR_IA32_FMASK, ext_ctx->ia32_fmask);
-	msr_write(MSR_IA32_KERNEL_GS_BASE, ext_ctx->ia32_kernel_gs_base);
+	/* MSRs which not in the VMCS, WRMSR being far costlier than the compare */
+	if (prev_ctx->ia32_star != ext_ctx->ia32_star) {
+		msr_write(MSR_IA32_STAR, ext_ctx->ia32_star);
+	}
+	if (prev_ctx->ia32_lstar != ext_ctx->ia32_lstar) {
+		msr_write(MSR_IA32_LSTAR, ext_ctx->ia32_lstar);
+	}
+	if (prev_ctx->ia32_fmask != ext_ctx->ia32_fmask) {
+		msr_write(MSR_IA32_FMASK, ext_ctx->ia32_fmask);
+	}
+	if (prev_ctx->ia32_kernel_gs_base != ext_ctx->ia32_kernel_gs_base) {
+		msr_write(MSR_IA32_KERNEL_GS_BASE, ext_ctx->ia32_kernel_gs_base);
+	}
 
-	/* XSAVE area */
-	rstore_xsave_area(vcpu, ext_ctx);
+	/*
+	 * XSAVE area, switched eagerly: a lazy switch on #NM would leave the
+	 * registers of one world live while the other runs. IA32_XSS is common
+	 * to the worlds and already loaded.
+	 */
+	rstore_xsave_components(ext_ctx);
 
 	/* For MSRs need isolation between worlds */
 	for (i = 0U; i < NUM_WORLD_MSRS; i++) {
@@ -223,12 +242,13 @@ static void copy_smc_param(const struct run_context *prev_ctx,
 void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 {
 	struct acrn_vcpu_arch *arch = &vcpu->arch;
+	uint64_t start = cpu_ticks();
 
 	/* save previous world context */
 	save_world_ctx(vcpu, &arch->contexts[!next_world].ext_ctx);
 
 	/* load next world context */
-	load_world_ctx(vcpu, &arch->contexts[next_world].ext_ctx);
+	load_world_ctx(vcpu, &arch->contexts[next_world].ext_ctx, &arch->contexts[!next_world].ext_ctx);
 
 	/* Copy SMC parameters: RDI, RSI, RDX, RBX */
 	copy_smc_param(&arch->contexts[!next_world].run_ctx,
@@ -251,6 +271,9 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 
 	/* Update world index */
 	arch->cur_context = next_world;
+
+	arch->world_switches[next_world]++;
+	arch->world_switch_ticks += cpu_ticks() - start;
 }
 
 /* Put key_info and trusty_startup_param in the first Page of Trusty
@@ -7,17 +7,50 @@
 #include <types.h>
 #include <errno.h>
 #include <asm/lib/spinlock.h>
+#include <asm/lib/atomic.h>
+#include <asm/lib/bits.h>
 #include <asm/cpu.h>
+#include <asm/cpu_caps.h>
+#include <asm/per_cpu.h>
+#include <asm/notify.h>
 #include <asm/msr.h>
 #include <asm/cpuid.h>
 #include <asm/guest/ucode.h>
 #include <asm/guest/guest_memory.h>
 #include <asm/guest/virq.h>
+#include <asm/guest/vm.h>
+#include <ticks.h>
 #include <logmsg.h>
 
 #define MICRO_CODE_SIZE_MAX    0x40000U
 static uint8_t micro_code[MICRO_CODE_SIZE_MAX];
 
+/* upper bound of each of the two rendezvous of an update */
+#define UCODE_SYNC_TIMEOUT_US	100000U
+
+/*
+ * All the pCPUs taking part in an update meet in ucode_update_one(): none of
+ * them returns to its guest until every core has loaded the new microcode.
+ */
+struct ucode_sync {
+	uint64_t core_mask;	/* the one pCPU of each core that loads the update */
+	uint64_t timeout;	/* in ticks */
+	uint64_t start;		/* last pCPU arrived */
+	uint64_t end;		/* last pCPU done */
+	uint32_t new_rev;
+	int32_t cpus;
+	int32_t arrived;
+	int32_t done;
+	int32_t updated;
+	int32_t failed;
+	int32_t timedout;
+};
+
+static struct ucode_sync ucode_sync;
+/* the revision the last update loaded on all the cores */
+static uint32_t ucode_loaded_rev;
+static spinlock_t ucode_lock = { .head = 0U, .tail = 0U, };
+
 uint64_t get_microcode_version(void)
 {
 	uint64_t val;
@@ -39,8 +72,138 @@ static inline size_t get_ucode_data_size(const struct ucode_header *uhdr)
 	return ((uhdr->data_size != 0U) ? uhdr->data_size : 2000U);
 }
 
+static inline uint32_t get_microcode_rev(void)
+{
+	return (uint32_t)(get_microcode_version() >> 32U);
+}
+
+static bool ucode_sync_wait(const int32_t *count, int32_t total, uint64_t deadline)
+{
+	bool ret = true;
+
+	while (*(const volatile int32_t *)count < total) {
+		if (cpu_ticks() > deadline) {
+			ret = false;
+			break;
+		}
+		asm_pause();
+	}
+
+	return ret;
+}
+
+/* run in the notification IRQ context of each pCPU of the update */
+static void ucode_update_one(void *data)
+{
+	struct ucode_sync *sync = (struct ucode_sync *)data;
+	uint64_t deadline = cpu_ticks() + sync->timeout;
+
+	if (atomic_inc_return(&sync->arrived) == sync->cpus) {
+		sync->start = cpu_ticks();
+	}
+
+	if (!ucode_sync_wait(&sync->arrived, sync->cpus, deadline)) {
+		(void)atomic_inc_return(&sync->timedout);
+	} else if (bitmap_test(get_pcpu_id(), &sync->core_mask)) {
+		/* the sibling threads of a core share its microcode */
+		if (get_microcode_rev() != sync->new_rev) {
+			msr_write(MSR_IA32_BIOS_UPDT_TRIG, (uint64_t)micro_code + sizeof(struct ucode_header));
+		}
+		if (get_microcode_rev() == sync->new_rev) {
+			(void)atomic_inc_return(&sync->updated);
+		} else {
+			(void)atomic_inc_return(&sync->failed);
+		}
+	} else {
+		/* stopped while the cores update */
+	}
+
+	if (atomic_inc_return(&sync->done) == sync->cpus) {
+		sync->end = cpu_ticks();
+	}
+	(void)ucode_sync_wait(&sync->done, sync->cpus, cpu_ticks() + sync->timeout);
+}
+
+/* the APIC ID bits that number the threads of a core, from CPUID.0BH */
+static uint32_t get_smt_shift(void)
+{
+	uint32_t eax = 0U, ebx = 0U, ecx, edx;
+
+	if (get_pcpu_info()->cpuid_level >= CPUID_EXTEND_TOPOLOGY) {
+		cpuid_subleaf(CPUID_EXTEND_TOPOLOGY, 0x0U, &eax, &ebx, &ecx, &edx);
+	}
+
+	return ((ebx & 0xffffU) != 0U) ? (eax & 0x1fU) : 0U;
+}
+
+/*
+ * Load the update in micro_code on every core at once, with all the other
+ * pCPUs held in ucode_update_one() for the duration.
+ *
+ * pCPUs running a vCPU with LAPIC passthrough can't take the notification
+ * IRQ and keep their microcode.
+ */
+static void ucode_update_all(uint32_t new_rev)
+{
+	struct ucode_sync *sync = &ucode_sync;
+	struct acrn_vcpu *vcpu;
+	uint64_t mask = 0UL, active = get_active_pcpu_bitmap();
+	uint32_t smt_shift = get_smt_shift();
+	uint16_t pcpu_id, i;
+	int32_t skipped = 0, cores = 0;
+	bool new_core;
+
+	(void)memset((void *)sync, 0U, sizeof(*sync));
+	sync->new_rev = new_rev;
+	sync->timeout = us_to_ticks(UCODE_SYNC_TIMEOUT_US);
+
+	for (pcpu_id = 0U; pcpu_id < MAX_PCPU_NUM; pcpu_id++) {
+		if (!bitmap_test(pcpu_id, &active)) {
+			continue;
+		}
+
+		vcpu = get_ever_run_vcpu(pcpu_id);
+		if ((vcpu != NULL) && is_lapic_pt_enabled(vcpu)) {
+			skipped++;
+			continue;
+		}
+
+		bitmap_set_nolock(pcpu_id, &mask);
+		sync->cpus++;
+
+		new_core = true;
+		for (i = 0U; i < pcpu_id; i++) {
+			if (bitmap_test(i, &sync->core_mask) &&
+					((per_cpu(lapic_id, i) >> smt_shift) == (per_cpu(lapic_id, pcpu_id) >> smt_shift))) {
+				new_core = false;
+				break;
+			}
+		}
+		if (new_core) {
+			bitmap_set_nolock(pcpu_id, &sync->core_mask);
+			cores++;
+		}
+	}
+
+	/* this pCPU is in the mask too and joins from its notification IRQ */
+	smp_call_function(mask, ucode_update_one, sync);
+
+	if ((sync->updated == cores) && (skipped == 0)) {
+		ucode_loaded_rev = new_rev;
+	}
+
+	pr_info("microcode rev 0x%x loaded on %d of %d cores (%d failed, %d timed out, %d LAPIC passthrough pCPUs skipped)",
+		new_rev, sync->updated, cores, sync->failed, sync->timedout, skipped);
+	if (sync->end > sync->start) {
+		pr_info("microcode update stopped %d pCPUs for %lu us", sync->cpus, ticks_to_us(sync->end - sync->start));
+	}
+}
+
 /* the guest operating system should guarantee it won't issue 2nd micro code update
  * when the 1st micro code update is on-going.
+ *
+ * The SOS usually writes the trigger MSR once per vCPU: the first write loads
+ * the update on all the cores and the following ones find it already there.
  */
 void acrn_update_ucode(struct acrn_vcpu *vcpu, uint64_t v)
 {
@@ -65,18 +228,22 @@ void acrn_update_ucode(struct acrn_vcpu *vcpu, uint64_t v)
 			pr_err("The size of microcode is greater than 0x%x",
 					MICRO_CODE_SIZE_MAX);
 		} else {
-			err_code = 0U;
-			err = copy_from_gva(vcpu, micro_code, gva, data_size, &err_code,
-					&fault_addr);
-			if (err < 0) {
-				if (err == -EFAULT) {
-					vcpu_inject_pf(vcpu, fault_addr, err_code);
-				}
+			spinlock_obtain(&ucode_lock);
+			if (ucode_loaded_rev == uhdr.update_ver) {
+				pr_dbg("microcode rev 0x%x already loaded", uhdr.update_ver);
 			} else {
-				msr_write(MSR_IA32_BIOS_UPDT_TRIG,
-					(uint64_t)micro_code + sizeof(struct ucode_header));
-				(void)get_microcode_version();
+				err_code = 0U;
+				err = copy_from_gva(vcpu, micro_code, gva, data_size, &err_code,
+						&fault_addr);
+				if (err < 0) {
+					if (err == -EFAULT) {
+						vcpu_inject_pf(vcpu, fault_addr, err_code);
+					}
+				} else {
+					ucode_update_all(uhdr.update_ver);
+				}
 			}
+			spinlock_release(&ucode_lock);
 		}
 	}
 }
@@ -21,6 +21,9 @@
 #include <lib/sprintf.h>
 #include <asm/lapic.h>
 #include <asm/irq.h>
+#include <asm/notify.h>
+#include <ticks.h>
+#include <asm/tsc.h>
 
 /* stack_frame is linked with the sequence of stack operation in arch_switch_to() */
 struct stack_frame {
@@ -52,6 +55,25 @@ void vcpu_set_gpreg(struct acrn_vcpu *vcpu, uint32_t reg, uint64_t val)
 	ctx->cpu_regs.longs[reg] = val;
 }
 
+static const uint32_t exit_info_fields[NR_EXIT_INFO] = {
+	[EXIT_INFO_GUEST_PHYSICAL_ADDR] = VMX_GUEST_PHYSICAL_ADDR_FULL,
+	[EXIT_INFO_GUEST_LINEAR_ADDR] = VMX_GUEST_LINEAR_ADDR,
+	[EXIT_INFO_INT_INFO] = VMX_EXIT_INT_INFO,
+	[EXIT_INFO_INT_ERROR_CODE] = VMX_EXIT_INT_ERROR_CODE,
+};
+
+uint64_t vcpu_get_exit_info(struct acrn_vcpu *vcpu, enum vm_exit_info info)
+{
+	uint32_t bit = 1U << (uint32_t)info;
+
+	/* only accessed from the pCPU of the vCPU, between a VM exit and the next VM entry */
+	if ((vcpu->arch.exit_info_cached & bit) == 0U) {
+		vcpu->arch.exit_info[info] = exec_vmread(exit_info_fields[info]);
+		vcpu->arch.exit_info_cached |= bit;
+	}
+	return vcpu->arch.exit_info[info];
+}
+
 uint64_t vcpu_get_rip(struct acrn_vcpu *vcpu)
 {
 	struct run_context *ctx =
@@ -147,6 +169,32 @@ void vcpu_set_guest_msr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val)
 	}
 }
 
+/* the VMCS of the vCPU must be the current one */
+uint64_t vcpu_tsc_from_host(const struct acrn_vcpu *vcpu, uint64_t host_tsc)
+{
+	uint64_t multiplier = vcpu->vm->arch_vm.tsc_multiplier;
+	uint64_t tsc = host_tsc;
+
+	if (multiplier != 0UL) {
+		tsc = tsc_scale(host_tsc, multiplier);
+	}
+
+	return tsc + exec_vmread64(VMX_TSC_OFFSET_FULL);
+}
+
+/* the VMCS of the vCPU must be the current one */
+uint64_t vcpu_tsc_to_host(const struct acrn_vcpu *vcpu, uint64_t guest_tsc)
+{
+	uint64_t multiplier = vcpu->vm->arch_vm.tsc_multiplier;
+	uint64_t tsc = guest_tsc - exec_vmread64(VMX_TSC_OFFSET_FULL);
+
+	if (multiplier != 0UL) {
+		tsc = tsc_unscale(tsc, multiplier);
+	}
+
+	return tsc;
+}
+
 /*
  * Write the eoi_exit_bitmaps to VMCS fields
  */
@@ -246,12 +294,22 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	struct acrn_vlapic *vlapic;
 
 	vcpu->launched = false;
+	vcpu->arch.vmcs_migrated = false;
 	vcpu->arch.nr_sipi = 0U;
 
 	vcpu->arch.exception_info.exception = VECTOR_INVALID;
 	vcpu->arch.cur_context = NORMAL_WORLD;
 	vcpu->arch.irq_window_enabled = false;
 	vcpu->arch.emulating_lock = false;
+	vcpu->arch.splitlock_nr = 0U;
+	vcpu->ioreq_posted = false;
+	vcpu->ioreq_lat_avg = 0UL;
+	vcpu->halt_poll_window = 0UL;
+	vcpu->halt_poll_success = 0UL;
+	vcpu->halt_poll_fail = 0UL;
+	vcpu->arch.pv_state_gpa = 0UL;
+	vcpu->arch.pv_state = NULL;
+	vcpu->arch.preempt_tsc = 0UL;
 	(void)memset((void *)vcpu->arch.vmcs, 0U, PAGE_SIZE);
 
 	for (i = 0; i < NR_WORLD; i++) {
@@ -267,12 +325,17 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 
 	reset_vcpu_regs(vcpu);
 
+	del_timer(&vcpu->arch.splitlock_timer);
 	for (i = 0; i < VCPU_EVENT_NUM; i++) {
 		reset_event(&vcpu->events[i]);
 	}
 
 	init_iwkey(vcpu);
 	vcpu->arch.iwkey_copy_status = 0UL;
+
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_init_vcpu(vcpu);
+#endif
 }
 
 struct acrn_vcpu *get_running_vcpu(uint16_t pcpu_id)
@@ -513,6 +576,7 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 
 		/* Initialize the parent VM reference */
 		vcpu->vm = vm;
+		reset_emul_io_cache(vcpu);
 
 		/* Initialize the virtual ID for this VCPU */
 		/* FIXME:
@@ -580,6 +644,11 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		init_xsave(vcpu);
 		vcpu_reset_internal(vcpu, POWER_ON_RESET);
 		(void)memset((void *)&vcpu->req, 0U, sizeof(struct io_request));
+		(void)memset((void *)&vcpu->exit_stats, 0U, sizeof(struct acrn_vmexit_stats));
+		vcpu->exit_stats.vcpu_id = vcpu_id;
+		(void)memset((void *)vcpu->msr_stats, 0U, sizeof(vcpu->msr_stats));
+		(void)memset((void *)&vcpu->cr_stats, 0U, sizeof(vcpu->cr_stats));
+		(void)memset((void *)vcpu->eoi_exit_stats, 0U, sizeof(vcpu->eoi_exit_stats));
 		vm->hw.created_vcpus++;
 		ret = 0;
 	} else {
@@ -590,18 +659,43 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 	return ret;
 }
 
+#ifdef CONFIG_SCHED_PREEMPTION_TIMER
+/*
+ * Arm the VMX preemption timer for the end of the scheduling slice of the
+ * vCPU, or for as long as it goes if the slice doesn't end.
+ */
+static void arm_slice_timer(const struct acrn_vcpu *vcpu)
+{
+	uint64_t end = sched_get_slice_end(pcpuid_from_vcpu(vcpu));
+	uint64_t now = cpu_ticks();
+	uint64_t value = UINT32_MAX;
+
+	if (end != 0UL) {
+		value = (end > now) ? min((end - now) >> get_preemption_timer_shift(), (uint64_t)UINT32_MAX) : 0UL;
+	}
+	exec_vmwrite32(VMX_GUEST_TIMER, (uint32_t)value);
+}
+#endif
+
 /*
  *  @pre vcpu != NULL
  */
 int32_t run_vcpu(struct acrn_vcpu *vcpu)
 {
-	uint32_t instlen, cs_attr;
-	uint64_t rip, ia32_efer, cr0;
+	uint32_t cs_attr;
+	uint64_t ia32_efer, cr0;
 	struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 	int32_t status = 0;
 	int32_t ibrs_type = get_ibrs_type();
 
+	/*
+	 * Skip the instruction of the last VM exit unless it is to be repeated,
+	 * so that the guest RIP is written once, and only if it changed.
+	 */
+	if (vcpu->launched && (vcpu->arch.inst_len != 0U)) {
+		vcpu_set_rip(vcpu, vcpu_get_rip(vcpu) + (uint64_t)vcpu->arch.inst_len);
+	}
 	if (bitmap_test_and_clear_lock(CPU_REG_RIP, &vcpu->reg_updated)) {
 		exec_vmwrite(VMX_GUEST_RIP, ctx->rip);
 	}
@@ -628,6 +722,12 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		vcpu_set_cr4(vcpu, ctx->cr4);
 	}
 
+#ifdef CONFIG_SCHED_PREEMPTION_TIMER
+	if (sched_use_preemption_timer()) {
+		arm_slice_timer(vcpu);
+	}
+#endif
+
 	/* If this VCPU is not already launched, launch it */
 	if (!vcpu->launched) {
 		pr_info("VM %d Starting VCPU %hu",
@@ -680,13 +780,7 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 			}
 		}
 	} else {
-		/* This VCPU was already launched, check if the last guest
-		 * instruction needs to be repeated and resume VCPU accordingly
-		 */
-		instlen = vcpu->arch.inst_len;
-		rip = vcpu_get_rip(vcpu);
-		exec_vmwrite(VMX_GUEST_RIP, ((rip+(uint64_t)instlen) &
-				0xFFFFFFFFFFFFFFFFUL));
+		/* This VCPU was already launched, resume it */
 #ifdef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
 #endif
@@ -694,11 +788,18 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		/* Mitigation for MDS vulnerability, overwrite CPU internal buffers */
 		cpu_internal_buffers_clear();
 
-		/* Resume the VM */
-		status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
+		if (vcpu->arch.vmcs_migrated) {
+			/* VMCLEAR on the previous pcpu or of VMCS02 reset the launch state */
+			vcpu->arch.vmcs_migrated = false;
+			status = vmx_vmrun(ctx, VM_LAUNCH, ibrs_type);
+		} else {
+			/* Resume the VM */
+			status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
+		}
 	}
 
 	vcpu->reg_cached = 0UL;
+	vcpu->arch.exit_info_cached = 0U;
 
 	/*
 	 * - can not call vcpu_get_xxx() when vmcs02 is current, or it could mess up
@@ -742,6 +843,10 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 void offline_vcpu(struct acrn_vcpu *vcpu)
 {
 	vlapic_free(vcpu);
+	del_timer(&vcpu->arch.splitlock_timer);
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_deinit_vcpu(vcpu);
+#endif
 	per_cpu(ever_run_vcpu, pcpuid_from_vcpu(vcpu)) = NULL;
 
 	/* This operation must be atomic to avoid contention with posted interrupt handler */
@@ -750,11 +855,17 @@ void offline_vcpu(struct acrn_vcpu *vcpu)
 	vcpu_set_state(vcpu, VCPU_OFFLINE);
 }
 
+/*
+ * A vCPU out of the guest handles its requests before its next VM entry: it
+ * sets in_guest and fences before it checks them, so only a vCPU seen in the
+ * guest after the request is made needs an IPI.
+ */
 void kick_vcpu(struct acrn_vcpu *vcpu)
 {
 	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
 
-	if ((get_pcpu_id() != pcpu_id) &&
+	cpu_memory_barrier();
+	if ((get_pcpu_id() != pcpu_id) && vcpu->arch.in_guest &&
 		(per_cpu(vmcs_run, pcpu_id) == vcpu->arch.vmcs)) {
 		if (is_lapic_pt_enabled(vcpu)) {
 			/* For lapic-pt vCPUs */
@@ -765,6 +876,27 @@ void kick_vcpu(struct acrn_vcpu *vcpu)
 	}
 }
 
+void vcpu_flush_guest_tlb(struct acrn_vm *vm, uint64_t vcpu_mask)
+{
+	uint16_t i;
+	struct acrn_vcpu *vcpu;
+
+	foreach_vcpu(i, vm, vcpu) {
+		if (bitmap_test(i, &vcpu_mask)) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
+		}
+	}
+
+	/* a preempted vCPU is out of the guest, it isn't waited for */
+	foreach_vcpu(i, vm, vcpu) {
+		if (bitmap_test(i, &vcpu_mask)) {
+			while (bitmap_test(ACRN_REQUEST_VPID_FLUSH, &vcpu->arch.pending_req) && vcpu->arch.in_guest) {
+				asm_pause();
+			}
+		}
+	}
+}
+
 /*
  * @pre (&vcpu->stack[CONFIG_STACK_SIZE] & (CPU_STACK_ALIGN - 1UL)) == 0
  */
@@ -806,6 +938,20 @@ void reset_vcpu(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	vcpu_set_state(vcpu, VCPU_INIT);
 }
 
+/*
+ * Save the extended state of @data if it is still in the registers of this
+ * pCPU, so that it can be reset or restored elsewhere.
+ */
+static void flush_xsave_area(void *data)
+{
+	struct acrn_vcpu *vcpu = (struct acrn_vcpu *)data;
+
+	if (get_cpu_var(whose_xsave) == vcpu) {
+		save_xsave_area(vcpu, &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx));
+		get_cpu_var(whose_xsave) = NULL;
+	}
+}
+
 void zombie_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 {
 	enum vcpu_state prev_state;
@@ -823,34 +969,70 @@ void zombie_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 			} else {
 				sleep_thread_sync(&vcpu->thread_obj);
 			}
+
+			/* its pCPU may still hold its extended state, see context_switch_in() */
+			if (pcpu_id == get_pcpu_id()) {
+				flush_xsave_area(vcpu);
+			} else if (per_cpu(whose_xsave, pcpu_id) == vcpu) {
+				smp_call_function(1UL << pcpu_id, flush_xsave_area, vcpu);
+			} else {
+				/* nothing to save */
+			}
 		}
 	}
 }
 
+/* XSETBV is costly, XCR0 is only written when it has to change */
 void save_xsave_area(__unused struct acrn_vcpu *vcpu, struct ext_context *ectx)
 {
 	ectx->xcr0 = read_xcr(0);
-	write_xcr(0, ectx->xcr0 | XSAVE_SSE);
+	if ((ectx->xcr0 & XSAVE_SSE) == 0UL) {
+		write_xcr(0, ectx->xcr0 | XSAVE_SSE);
+	}
 	xsaves(&ectx->xs_area, UINT64_MAX);
 }
 
+/*
+ * Restore the XSAVE components of @ectx, with IA32_XSS already holding the
+ * value of the vCPU.
+ */
+void rstore_xsave_components(const struct ext_context *ectx)
+{
+	if (read_xcr(0) != (ectx->xcr0 | XSAVE_SSE)) {
+		write_xcr(0, ectx->xcr0 | XSAVE_SSE);
+	}
+	xrstors(&ectx->xs_area, UINT64_MAX);
+	if ((ectx->xcr0 & XSAVE_SSE) == 0UL) {
+		write_xcr(0, ectx->xcr0);
+	}
+}
+
 void rstore_xsave_area(const struct acrn_vcpu *vcpu, const struct ext_context *ectx)
 {
-	write_xcr(0, ectx->xcr0 | XSAVE_SSE);
 	msr_write(MSR_IA32_XSS, vcpu_get_guest_msr(vcpu, MSR_IA32_XSS));
-	xrstors(&ectx->xs_area, UINT64_MAX);
-	write_xcr(0, ectx->xcr0);
+	rstore_xsave_components(ectx);
+}
+
+/* translated again once the EPT changed, the guest memory behind it may be remapped */
+static struct acrn_pv_vcpu_state *get_pv_state(struct acrn_vcpu *vcpu)
+{
+	uint64_t gen = vcpu->vm->map_gen;
+
+	if ((vcpu->arch.pv_state_gpa != 0UL) && (vcpu->arch.pv_state_gen != gen)) {
+		/* read first: a change during the translation makes it stale */
+		cpu_compiler_barrier();
+		vcpu->arch.pv_state = (struct acrn_pv_vcpu_state *)gpa2hva(vcpu->vm, vcpu->arch.pv_state_gpa);
+		vcpu->arch.pv_state_gen = gen;
+	}
+
+	return (vcpu->arch.pv_state_gpa != 0UL) ? vcpu->arch.pv_state : NULL;
 }
 
-/* TODO:
- * Now we have switch_out and switch_in callbacks for each thread_object, and schedule
- * will call them every thread switch. We can implement lazy context swtich , which
- * only do context swtich when really need.
- */
 static void context_switch_out(struct thread_object *prev)
 {
 	struct acrn_vcpu *vcpu = container_of(prev, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct acrn_pv_vcpu_state *pv_state;
 
 	/* We don't flush TLB as we assume each vcpu has different vpid */
 	ectx->ia32_star = msr_read(MSR_IA32_STAR);
@@ -859,16 +1041,81 @@ static void context_switch_out(struct thread_object *prev)
 	ectx->ia32_fmask = msr_read(MSR_IA32_FMASK);
 	ectx->ia32_kernel_gs_base = msr_read(MSR_IA32_KERNEL_GS_BASE);
 
-	save_xsave_area(vcpu, ectx);
+	/* the extended state is left in the registers, see context_switch_in() */
+
+	vpmu_switch_out(vcpu);
+
+	/*
+	 * A preempted vCPU can't take its interrupts until it runs again, don't
+	 * let the posted interrupts from its passthrough devices kick whatever
+	 * runs on the pcpu in the meantime. A blocked vCPU still needs them to
+	 * be woken up.
+	 */
+	if (is_pi_capable(vcpu->vm) && !prev->be_blocking) {
+		bitmap_set_lock(POSTED_INTR_SN, &(vcpu->arch.pid.control.value));
+	}
+
+	/*
+	 * Tell the guest, which then defers its TLB shootdowns of this vCPU to the
+	 * next VM entry, and account the time until then as stolen.
+	 */
+	pv_state = get_pv_state(vcpu);
+	if ((pv_state != NULL) && !prev->be_blocking) {
+		stac();
+		bitmap32_set_lock(0U, &(pv_state->preempted));
+		clac();
+		vcpu->arch.preempt_tsc = cpu_ticks();
+	}
+}
+
+static void update_steal_time(struct acrn_vcpu *vcpu, struct acrn_pv_vcpu_state *pv_state)
+{
+	uint64_t steal = ticks_to_ns(cpu_ticks() - vcpu->arch.preempt_tsc);
+
+	stac();
+	pv_state->version++;
+	cpu_write_memory_barrier();
+	pv_state->steal += steal;
+	cpu_write_memory_barrier();
+	pv_state->version++;
+	clac();
+
+	vcpu->arch.preempt_tsc = 0UL;
+}
+
+/*
+ * The notifications suppressed while the vCPU was preempted left their
+ * vectors in the PIR with ON clear, have them synced on the next VM entry.
+ */
+static void pi_restore_notification(struct acrn_vcpu *vcpu)
+{
+	struct pi_desc *pid = get_pi_desc(vcpu);
+
+	if (bitmap_test_and_clear_lock(POSTED_INTR_SN, &(pid->control.value))) {
+		if ((pid->pir[0] | pid->pir[1] | pid->pir[2] | pid->pir[3]) != 0UL) {
+			bitmap_set_lock(POSTED_INTR_ON, &(pid->control.value));
+		}
+	}
+
+	if (bitmap_test(POSTED_INTR_ON, &(pid->control.value))) {
+		vcpu_make_request(vcpu, ACRN_REQUEST_EVENT);
+	}
 }
 
 static void context_switch_in(struct thread_object *next)
 {
 	struct acrn_vcpu *vcpu = container_of(next, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct acrn_vcpu *owner = get_cpu_var(whose_xsave);
+	struct acrn_pv_vcpu_state *pv_state;
 	uint64_t vmsr_val;
+	uint32_t pv_flags;
 
 	load_vmcs(vcpu);
+	vlapic_migrate_timer_in(vcpu_vlapic(vcpu));
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_migrate_timers_in(vcpu);
+#endif
 
 	msr_write(MSR_IA32_STAR, ectx->ia32_star);
 	msr_write(MSR_IA32_CSTAR, ectx->ia32_cstar);
@@ -885,10 +1132,99 @@ static void context_switch_in(struct thread_object *next)
 
 	load_iwkey(vcpu);
 
-	rstore_xsave_area(vcpu, ectx);
+	/*
+	 * The hypervisor doesn't use the extended state, which stays in the
+	 * registers until another vCPU runs on the pCPU. A vCPU switching with the
+	 * idle thread only, e.g. halted or waiting for its I/O requests, never
+	 * saves and restores it.
+	 */
+	if (owner != vcpu) {
+		if (owner != NULL) {
+			/* IA32_XSS still holds the value of the owner */
+			save_xsave_area(owner, &(owner->arch.contexts[owner->arch.cur_context].ext_ctx));
+		}
+		rstore_xsave_area(vcpu, ectx);
+		get_cpu_var(whose_xsave) = vcpu;
+	}
+
+	vpmu_switch_in(vcpu);
+
+	if (is_pi_capable(vcpu->vm)) {
+		pi_restore_notification(vcpu);
+	}
+
+	pv_state = get_pv_state(vcpu);
+	if (pv_state != NULL) {
+		if (vcpu->arch.preempt_tsc != 0UL) {
+			update_steal_time(vcpu, pv_state);
+		}
+		stac();
+		pv_flags = atomic_swap32(&(pv_state->preempted), 0U);
+		clac();
+		if ((pv_flags & ACRN_VCPU_FLUSH_TLB) != 0U) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
+		}
+	}
 }
 
 
+#ifdef CONFIG_SCHED_BALANCE
+static bool vcpu_can_migrate(const struct thread_object *obj, uint16_t pcpu_id)
+{
+	const struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
+	const struct acrn_vm *vm = vcpu->vm;
+
+	/*
+	 * Posted interrupt notification vectors are per VM, so a pcpu hosts at
+	 * most one vCPU of each VM. vCPUs not launched yet get their VMCS
+	 * initialized on their pcpu, leave them there.
+	 */
+	return (vcpu->launched && !is_lapic_pt_configured(vm) && !is_rt_vm(vm) &&
+		!is_nvmx_configured(vm) && !vm->arch_vm.vm_mwait_cap &&
+		(per_cpu(vcpu_array, pcpu_id)[vm->vm_id] == NULL));
+}
+
+/*
+ * @pre called on the pcpu the vCPU last ran on, with the schedule locks of
+ * both pcpus held
+ */
+static void vcpu_migrate(struct thread_object *obj, uint16_t pcpu_id)
+{
+	struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
+	uint16_t vm_id = vcpu->vm->vm_id;
+	uint16_t prev_id = get_pcpu_id();
+
+	/* flush the cached VMCS data to memory, only the pcpu it was active on can do it */
+	clear_va_vmcs(vcpu->arch.vmcs);
+	if (per_cpu(vmcs_run, prev_id) == (void *)vcpu->arch.vmcs) {
+		per_cpu(vmcs_run, prev_id) = NULL;
+	}
+	vcpu->arch.vmcs_migrated = true;
+	/* the extended state left in the registers of this pcpu, see context_switch_in() */
+	flush_xsave_area(vcpu);
+
+	vlapic_migrate_timer_out(vcpu_vlapic(vcpu));
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_migrate_timers_out(vcpu);
+#endif
+
+	vcpu->arch.pid.control.bits.ndst = per_cpu(lapic_id, pcpu_id);
+	/* This operation must be atomic to avoid contention with posted interrupt handler */
+	per_cpu(vcpu_array, prev_id)[vm_id] = NULL;
+	per_cpu(vcpu_array, pcpu_id)[vm_id] = vcpu;
+	if (per_cpu(ever_run_vcpu, prev_id) == vcpu) {
+		per_cpu(ever_run_vcpu, prev_id) = NULL;
+	}
+	per_cpu(ever_run_vcpu, pcpu_id) = vcpu;
+
+	/* The new pcpu may hold stale translations of this VPID and EPT */
+	vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
+	vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	/* a notification may have been sent to the previous pcpu */
+	vcpu_make_request(vcpu, ACRN_REQUEST_EVENT);
+}
+#endif
+
 /**
  * @pre vcpu != NULL
  * @pre vcpu->state == VCPU_INIT
@@ -921,6 +1257,15 @@ int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 		vcpu->thread_obj.host_sp = build_stack_frame(vcpu);
 		vcpu->thread_obj.switch_out = context_switch_out;
 		vcpu->thread_obj.switch_in = context_switch_in;
+		vcpu->thread_obj.affinity = get_vm_config(vm->vm_id)->cpu_affinity;
+#ifdef CONFIG_SCHED_BALANCE
+		vcpu->thread_obj.can_migrate = vcpu_can_migrate;
+		vcpu->thread_obj.migrate = vcpu_migrate;
+#else
+		vcpu->thread_obj.can_migrate = NULL;
+		vcpu->thread_obj.migrate = NULL;
+#endif
+		vcpu->thread_obj.last_run_tsc = 0UL;
 		init_thread_data(&vcpu->thread_obj);
 		for (i = 0; i < VCPU_EVENT_NUM; i++) {
 			init_event(&vcpu->events[i]);
@@ -963,11 +1308,6 @@ uint64_t vcpumask2pcpumask(struct acrn_vm *vm, uint64_t vdmask)
  * @return true, if vCPU LAPIC is in x2APIC mode and VM, vCPU belongs to, is configured for
  *				LAPIC Pass-through
  */
-bool is_lapic_pt_enabled(struct acrn_vcpu *vcpu)
-{
-	return ((is_x2apic_enabled(vcpu_vlapic(vcpu))) && (is_lapic_pt_configured(vcpu->vm)));
-}
-
 /*
  * @brief handle posted interrupts
  *
@@ -9,6 +9,7 @@
 #include <asm/lib/bits.h>
 #include <asm/guest/vcpu.h>
 #include <asm/guest/vm.h>
+#include <asm/guest/vpmu.h>
 #include <asm/cpuid.h>
 #include <asm/cpufeatures.h>
 #include <asm/vmx.h>
@@ -16,17 +17,37 @@
 #include <asm/tsc.h>
 #include <logmsg.h>
 
+/* returns VCPUID_INDEX_NR if the leaf is not in vcpuid_index */
+static inline uint32_t vcpuid_index_slot(uint32_t leaf)
+{
+	uint32_t range = leaf >> 30U;
+	uint32_t offset = leaf & 0x3fffffffU;
+	uint32_t slot = VCPUID_INDEX_NR;
+
+	if ((range < 3U) && (offset < VCPUID_INDEX_LEAVES)) {
+		slot = (range * VCPUID_INDEX_LEAVES) + offset;
+	}
+
+	return slot;
+}
+
 static inline const struct vcpuid_entry *local_find_vcpuid_entry(const struct acrn_vcpu *vcpu,
 					uint32_t leaf, uint32_t subleaf)
 {
-	uint32_t i = 0U, nr, half;
+	uint32_t i = 0U, nr, half, slot;
 	const struct vcpuid_entry *found_entry = NULL;
 	struct acrn_vm *vm = vcpu->vm;
 
 	nr = vm->vcpuid_entry_nr;
-	half = nr >> 1U;
-	if (vm->vcpuid_entries[half].leaf < leaf) {
-		i = half;
+	slot = vcpuid_index_slot(leaf);
+	if (slot < VCPUID_INDEX_NR) {
+		/* VCPUID_NO_ENTRY is beyond nr, nothing to search then */
+		i = vm->vcpuid_index[slot];
+	} else {
+		half = nr >> 1U;
+		if (vm->vcpuid_entries[half].leaf < leaf) {
+			i = half;
+		}
 	}
 
 	for (; i < nr; i++) {
@@ -283,19 +304,160 @@ static int32_t set_vcpuid_sgx(struct acrn_vm *vm)
 	return result;
 }
 
+/*
+ * Only the bits that depend on the state of the vCPU are patched in by
+ * guest_cpuid_01h(), the rest of the leaf is the same for all the vCPUs.
+ */
+static int32_t set_vcpuid_01h(struct acrn_vm *vm)
+{
+	struct vcpuid_entry entry;
+	uint64_t cr4_reserved_mask = get_cr4_reserved_bits();
+
+	init_vcpuid_entry(0x1U, 0U, 0U, &entry);
+
+	if (vm_hide_mtrr(vm)) {
+		/* mask mtrr */
+		entry.edx &= ~CPUID_EDX_MTRR;
+	}
+
+	/* mask Debug Store feature */
+	entry.ecx &= ~(CPUID_ECX_DTES64 | CPUID_ECX_DS_CPL);
+
+	/* mask Safer Mode Extension */
+	entry.ecx &= ~CPUID_ECX_SMX;
+
+	/* mask PDCM: Perfmon and Debug Capability */
+	entry.ecx &= ~CPUID_ECX_PDCM;
+
+	/* mask SDBG for silicon debug */
+	entry.ecx &= ~CPUID_ECX_SDBG;
+
+	if (vm_hide_rdrand(vm)) {
+		entry.ecx &= ~CPUID_ECX_RDRAND;
+	}
+
+	/* mask VMX to guest OS */
+	if (!is_nvmx_configured(vm)) {
+		entry.ecx &= ~CPUID_ECX_VMX;
+	}
+
+	/* set Hypervisor Present Bit */
+	entry.ecx |= CPUID_ECX_HV;
+
+	if ((cr4_reserved_mask & CR4_PCIDE) != 0UL) {
+		entry.ecx &= ~CPUID_ECX_PCID;
+	}
+
+	/* set by guest_cpuid_01h() per the guest MSR_IA32_MISC_ENABLE and CR4 */
+	entry.ecx &= ~(CPUID_ECX_MONITOR | CPUID_ECX_OSXSAVE);
+
+	if ((cr4_reserved_mask & CR4_VME) != 0UL) {
+		entry.edx &= ~CPUID_EDX_VME;
+	}
+
+	if ((cr4_reserved_mask & CR4_DE) != 0UL) {
+		entry.edx &= ~CPUID_EDX_DE;
+	}
+
+	if ((cr4_reserved_mask & CR4_PSE) != 0UL) {
+		entry.edx &= ~CPUID_EDX_PSE;
+	}
+
+	if ((cr4_reserved_mask & CR4_PAE) != 0UL) {
+		entry.edx &= ~CPUID_EDX_PAE;
+	}
+
+	if ((cr4_reserved_mask & CR4_PGE) != 0UL) {
+		entry.edx &= ~CPUID_EDX_PGE;
+	}
+
+	if ((cr4_reserved_mask & CR4_OSFXSR) != 0UL) {
+		entry.edx &= ~CPUID_EDX_FXSR;
+	}
+
+	/* mask Debug Store feature */
+	entry.edx &= ~CPUID_EDX_DTES;
+
+	return set_vcpuid_entry(vm, &entry);
+}
+
+static void set_vcpuid_index(struct acrn_vm *vm)
+{
+	uint32_t i, slot;
+
+	(void)memset(vm->vcpuid_index, (uint8_t)VCPUID_NO_ENTRY, sizeof(vm->vcpuid_index));
+	/* the entries are sorted by leaf, the index points to the first one of each leaf */
+	for (i = vm->vcpuid_entry_nr; i > 0U; i--) {
+		slot = vcpuid_index_slot(vm->vcpuid_entries[i - 1U].leaf);
+		if (slot < VCPUID_INDEX_NR) {
+			vm->vcpuid_index[slot] = (uint8_t)(i - 1U);
+		}
+	}
+}
+
+/*
+ * Leaf 0x15: ratio of the TSC to the crystal clock in EBX/EAX, frequency of the
+ * crystal clock in Hz in ECX. The frequency is filled in when the processor
+ * reports 0 and the ratio is the one of a scaled TSC, so that the guest gets
+ * the TSC frequency of the VM without calibrating it. The ratio of the host is
+ * kept otherwise, for the vART of the passthrough devices.
+ */
+static void set_vcpuid_tsc_ratio(const struct acrn_vm *vm, struct vcpuid_entry *entry)
+{
+	uint64_t crystal_hz = entry->ecx;
+
+	if ((crystal_hz == 0UL) && (entry->eax != 0U) && (entry->ebx != 0U)) {
+		crystal_hz = ((uint64_t)get_tsc_khz() * 1000UL * entry->eax) / entry->ebx;
+	}
+	if (crystal_hz < 1000UL) {
+		/* no crystal clock reported, the TSC stands for it */
+		crystal_hz = (uint64_t)vm->arch_vm.tsc_khz * 1000UL;
+	}
+
+	if ((vm->arch_vm.tsc_multiplier != 0UL) || (entry->eax == 0U) || (entry->ebx == 0U)) {
+		entry->eax = (uint32_t)(crystal_hz / 1000UL);
+		entry->ebx = vm->arch_vm.tsc_khz;
+	}
+	entry->ecx = (uint32_t)crystal_hz;
+	entry->edx = 0U;
+}
+
 static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 {
 	uint32_t i, limit;
 	struct vcpuid_entry entry;
+	uint64_t guest_flags = get_vm_config(vm->vm_id)->guest_flags;
+	/*
+	 * With the Hyper-V enlightenments, the leaf of the VMs other than the SOS
+	 * is the Hyper-V one: they get the Hyper-V IPI and TLB flush hints, and
+	 * no PV steal time.
+	 */
+	bool acrn_leaf = true;
 	int32_t result;
 
+#ifdef CONFIG_HYPERV_ENABLED
+	acrn_leaf = is_sos_vm(vm);
+#endif
+
 	init_vcpuid_entry(0x40000000U, 0U, 0U, &entry);
 	result = set_vcpuid_entry(vm, &entry);
 	if (result == 0) {
 		init_vcpuid_entry(0x40000001U, 0U, 0U, &entry);
 		/* EAX: Guest capability flags (e.g. whether it is a privilege VM) */
-		if (is_sos_vm(vm)) {
-			entry.eax |= GUEST_CAPS_PRIVILEGE_VM;
+		if (acrn_leaf) {
+			if (is_sos_vm(vm)) {
+				entry.eax |= GUEST_CAPS_PRIVILEGE_VM;
+			}
+			if ((guest_flags & GUEST_FLAG_PV_IPI) != 0UL) {
+				entry.eax |= GUEST_CAPS_PV_IPI;
+			}
+			if ((guest_flags & GUEST_FLAG_PV_STEAL_TIME) != 0UL) {
+				entry.eax |= GUEST_CAPS_PV_STEAL_TIME;
+				/* the preempted flags are in the state registered for the steal time */
+				if ((guest_flags & GUEST_FLAG_PV_TLB_FLUSH) != 0UL) {
+					entry.eax |= GUEST_CAPS_PV_TLB_FLUSH;
+				}
+			}
 		}
 #ifdef CONFIG_HYPERV_ENABLED
 		else {
@@ -309,6 +471,12 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 	if (result == 0) {
 		for (i = 0x40000002U; i <= 0x40000006U; i++) {
 			hyperv_init_vcpuid_entry(i, 0U, 0U, &entry);
+			if ((i == 0x40000004U) && ((guest_flags & GUEST_FLAG_PV_IPI) != 0UL)) {
+				entry.eax |= CPUID4A_CLUSTER_IPI_RECOMMENDED;
+			}
+			if ((i == 0x40000004U) && ((guest_flags & GUEST_FLAG_PV_TLB_FLUSH) != 0UL)) {
+				entry.eax |= CPUID4A_REMOTE_TLB_FLUSH_RECOMMENDED;
+			}
 			result = set_vcpuid_entry(vm, &entry);
 			if (result != 0) {
 				break;
@@ -319,6 +487,7 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 
 	if (result == 0) {
 		init_vcpuid_entry(0x40000010U, 0U, 0U, &entry);
+		entry.eax = vm->arch_vm.tsc_khz;
 		result = set_vcpuid_entry(vm, &entry);
 	}
 
@@ -330,7 +499,7 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 	if (result == 0) {
 		limit = entry.eax;
 		vm->vcpuid_xlevel = limit;
-		for (i = 0x80000002U; i <= limit; i++) {
+		for (i = 0x80000001U; i <= limit; i++) {
 			init_vcpuid_entry(i, 0U, 0U, &entry);
 			result = set_vcpuid_entry(vm, &entry);
 			if (result != 0) {
@@ -361,12 +530,15 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 		vm->vcpuid_level = limit;
 
 		for (i = 1U; i <= limit; i++) {
-			/* cpuid 1/0xb is percpu related */
-			if ((i == 1U) || (i == 0xbU) || (i == 0xdU) || (i == 0x19U)) {
+			/* cpuid 0xb/0xd/0x19 is percpu related */
+			if ((i == 0xbU) || (i == 0xdU) || (i == 0x19U)) {
 				continue;
 			}
 
 			switch (i) {
+			case 0x01U:
+				result = set_vcpuid_01h(vm);
+				break;
 			case 0x04U:
 				for (j = 0U; ; j++) {
 					init_vcpuid_entry(i, j, CPUID_CHECK_SUBLEAF, &entry);
@@ -389,14 +561,54 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 				if (is_vsgx_supported(vm->vm_id)) {
 					entry.ebx |= CPUID_EBX_SGX;
 				}
+				if (vm_hide_rdrand(vm)) {
+					entry.ebx &= ~CPUID_EBX_RDSEED;
+				}
+				result = set_vcpuid_entry(vm, &entry);
+				break;
+			case 0x05U:
+				/* MONITOR/MWAIT leaf, its sub-C-states are only valid with MWAIT passthrough */
+				init_vcpuid_entry(i, 0U, 0U, &entry);
+				if (!vm->arch_vm.vm_mwait_cap) {
+					entry.eax = 0U;
+					entry.ebx = 0U;
+					entry.ecx = 0U;
+					entry.edx = 0U;
+				}
 				result = set_vcpuid_entry(vm, &entry);
 				break;
 			case 0x12U:
 				result = set_vcpuid_sgx(vm);
 				break;
-			/* These features are disabled */
-			/* PMU is not supported */
+			case 0x15U:
+				init_vcpuid_entry(i, 0U, 0U, &entry);
+				if (cpu_info->cpuid_level < 0x15U) {
+					/* not a leaf of the processor, the data of its highest leaf was read */
+					entry.eax = 0U;
+					entry.ebx = 0U;
+					entry.ecx = 0U;
+				}
+				set_vcpuid_tsc_ratio(vm, &entry);
+				result = set_vcpuid_entry(vm, &entry);
+				break;
+			case 0x16U:
+				init_vcpuid_entry(i, 0U, 0U, &entry);
+				if (vm->arch_vm.tsc_multiplier != 0UL) {
+					/* the base frequency is the one of the TSC */
+					entry.eax = vm->arch_vm.tsc_khz / 1000U;
+					entry.ebx = max(entry.ebx, entry.eax);
+				}
+				result = set_vcpuid_entry(vm, &entry);
+				break;
 			case 0x0aU:
+				/* PMU is only supported by the vPMU */
+				if (is_vpmu_configured(vm)) {
+					init_vcpuid_entry(i, 0U, 0U, &entry);
+					vpmu_init_vcpuid_entry(&entry);
+					result = set_vcpuid_entry(vm, &entry);
+				}
+				break;
+			/* These features are disabled */
 			/* Intel RDT */
 			case 0x0fU:
 			case 0x10U:
@@ -423,6 +635,10 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 		if (result == 0) {
 			result = set_vcpuid_extended_function(vm);
 		}
+
+		if (result == 0) {
+			set_vcpuid_index(vm);
+		}
 	}
 
 	return result;
@@ -435,55 +651,29 @@ static inline bool is_percpu_related(uint32_t leaf)
 
 static void guest_cpuid_01h(struct acrn_vcpu *vcpu, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
 {
+	/* always set up by set_vcpuid_entries() */
+	const struct vcpuid_entry *entry = local_find_vcpuid_entry(vcpu, 0x1U, 0U);
 	uint32_t apicid = vlapic_get_apicid(vcpu_vlapic(vcpu));
 	uint64_t guest_ia32_misc_enable = vcpu_get_guest_msr(vcpu, MSR_IA32_MISC_ENABLE);
-	uint64_t cr4_reserved_mask = get_cr4_reserved_bits();
 
-	cpuid_subleaf(0x1U, 0x0U, eax, ebx, ecx, edx);
+	*eax = entry->eax;
+	*ebx = entry->ebx;
+	*ecx = entry->ecx;
+	*edx = entry->edx;
+
 	/* Patching initial APIC ID */
 	*ebx &= ~APIC_ID_MASK;
 	*ebx |= (apicid <<  APIC_ID_SHIFT);
 
-	if (vm_hide_mtrr(vcpu->vm)) {
-		/* mask mtrr */
-		*edx &= ~CPUID_EDX_MTRR;
-	}
-
-	/* mask Debug Store feature */
-	*ecx &= ~(CPUID_ECX_DTES64 | CPUID_ECX_DS_CPL);
-
-	/* mask Safer Mode Extension */
-	*ecx &= ~CPUID_ECX_SMX;
-
-	/* mask PDCM: Perfmon and Debug Capability */
-	*ecx &= ~CPUID_ECX_PDCM;
-
-	/* mask SDBG for silicon debug */
-	*ecx &= ~CPUID_ECX_SDBG;
-
-	/* mask VMX to guest OS */
-	if (!is_nvmx_configured(vcpu->vm)) {
-		*ecx &= ~CPUID_ECX_VMX;
-	}
-
-	/* set Hypervisor Present Bit */
-	*ecx |= CPUID_ECX_HV;
-
-	if ((cr4_reserved_mask & CR4_PCIDE) != 0UL) {
-		*ecx &= ~CPUID_ECX_PCID;
-	}
-
 	/* guest monitor/mwait is supported only if it is allowed('vm_mwait_cap' is true)
 	 * and MSR_IA32_MISC_ENABLE_MONITOR_ENA bit of guest MSR_IA32_MISC_ENABLE is set,
 	 * else clear cpuid.01h[3].
 	 */
-	*ecx &= ~CPUID_ECX_MONITOR;
 	if (vcpu->vm->arch_vm.vm_mwait_cap &&
 		((guest_ia32_misc_enable & MSR_IA32_MISC_ENABLE_MONITOR_ENA) != 0UL)) {
 		*ecx |= CPUID_ECX_MONITOR;
 	}
 
-	*ecx &= ~CPUID_ECX_OSXSAVE;
 	if ((*ecx & CPUID_ECX_XSAVE) != 0U) {
 		uint64_t cr4;
 		/*read guest CR4*/
@@ -492,33 +682,6 @@ static void guest_cpuid_01h(struct acrn_vcpu *vcpu, uint32_t *eax, uint32_t *ebx
 			*ecx |= CPUID_ECX_OSXSAVE;
 		}
 	}
-
-	if ((cr4_reserved_mask & CR4_VME) != 0UL) {
-		*edx &= ~CPUID_EDX_VME;
-	}
-
-	if ((cr4_reserved_mask & CR4_DE) != 0UL) {
-		*edx &= ~CPUID_EDX_DE;
-	}
-
-	if ((cr4_reserved_mask & CR4_PSE) != 0UL) {
-		*edx &= ~CPUID_EDX_PSE;
-	}
-
-	if ((cr4_reserved_mask & CR4_PAE) != 0UL) {
-		*edx &= ~CPUID_EDX_PAE;
-	}
-
-	if ((cr4_reserved_mask & CR4_PGE) != 0UL) {
-		*edx &= ~CPUID_EDX_PGE;
-	}
-
-	if ((cr4_reserved_mask & CR4_OSFXSR) != 0UL) {
-		*edx &= ~CPUID_EDX_FXSR;
-	}
-
-	/* mask Debug Store feature */
-	*edx &= ~CPUID_EDX_DTES;
 }
 
 static void guest_cpuid_0bh(struct acrn_vcpu *vcpu, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
@@ -585,12 +748,15 @@ static void guest_cpuid_19h(struct acrn_vcpu *vcpu, uint32_t *eax, uint32_t *ebx
 static void guest_cpuid_80000001h(const struct acrn_vcpu *vcpu,
 	uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
 {
-	const struct vcpuid_entry *entry_check = find_vcpuid_entry(vcpu, 0x80000000U, 0);
+	/* only set up if cpuid.80000000h reports the leaf */
+	const struct vcpuid_entry *entry = local_find_vcpuid_entry(vcpu, 0x80000001U, 0U);
 	uint64_t guest_ia32_misc_enable = vcpu_get_guest_msr(vcpu, MSR_IA32_MISC_ENABLE);
-	uint32_t leaf = 0x80000001U;
 
-	if ((entry_check != NULL) && (entry_check->eax >= leaf)) {
-		cpuid_subleaf(leaf, 0x0U, eax, ebx, ecx, edx);
+	if (entry != NULL) {
+		*eax = entry->eax;
+		*ebx = entry->ebx;
+		*ecx = entry->ecx;
+		*edx = entry->edx;
 		/* SDM Vol4 2.1, XD Bit Disable of MSR_IA32_MISC_ENABLE
 		 * When set to 1, the Execute Disable Bit feature (XD Bit) is disabled and the XD Bit
 		 * extended feature flag will be clear (CPUID.80000001H: EDX[20]=0)
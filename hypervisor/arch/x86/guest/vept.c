@@ -15,9 +15,10 @@
 #include <asm/guest/nested.h>
 
 #define VETP_LOG_LEVEL			LOG_DEBUG
-#define CONFIG_MAX_GUEST_EPT_NUM	4
 static struct nept_desc nept_desc_bucket[CONFIG_MAX_GUEST_EPT_NUM];
 static spinlock_t nept_desc_bucket_lock;
+/* Stamps nept_desc.last_used, protected by nept_desc_bucket_lock */
+static uint64_t nept_desc_clock;
 
 /*
  * For simplicity, total platform RAM size is considered to calculate the
@@ -35,6 +36,12 @@ static spinlock_t nept_desc_bucket_lock;
 static struct page_pool sept_page_pool;
 static struct page *sept_pages;
 static uint64_t sept_page_bitmap[TOTAL_SEPT_4K_PAGES_NUM / 64U];
+/*
+ * The GPA of the guest EPT page each shadow EPT page mirrors and the number
+ * of shadow EPT pages in use, both protected by nept_desc_bucket_lock.
+ */
+static uint64_t sept_page_guest_gpa[TOTAL_SEPT_4K_PAGES_NUM];
+static uint64_t sept_pages_used;
 
 /*
  * @brief Reserve space for SEPT 4K pages from platform E820 table
@@ -59,54 +66,288 @@ static bool is_leaf_ept_entry(uint64_t ept_entry, enum _page_table_level pt_leve
 	return (((ept_entry & PAGE_PSE) != 0U) || (pt_level == IA32E_PT));
 }
 
+static inline uint64_t sept_page_index(const uint64_t *sept_page)
+{
+	return (uint64_t)((const struct page *)sept_page - sept_pages);
+}
+
+static void free_sept_page(uint64_t *sept_page)
+{
+	free_page(&sept_page_pool, (struct page *)sept_page);
+	sept_pages_used--;
+}
+
+/*
+ * @brief Release the shadow EPT pages referenced by the non-leaf entries of a PD
+ */
+static void free_sept_pd(uint64_t *shadow_pd)
+{
+	uint64_t i;
+
+	for (i = 0UL; i < PTRS_PER_PDE; i++) {
+		if (is_present_ept_entry(shadow_pd[i]) && !is_leaf_ept_entry(shadow_pd[i], IA32E_PD)) {
+			free_sept_page(hpa2hva(shadow_pd[i] & EPT_ENTRY_PFN_MASK));
+		}
+	}
+}
+
+/*
+ * @brief Release the shadow EPT pages under the non-leaf entries of a PDPT
+ */
+static void free_sept_pdpt(uint64_t *shadow_pdpt)
+{
+	uint64_t *shadow_pd;
+	uint64_t i;
+
+	for (i = 0UL; i < PTRS_PER_PDPTE; i++) {
+		if (is_present_ept_entry(shadow_pdpt[i]) && !is_leaf_ept_entry(shadow_pdpt[i], IA32E_PDPT)) {
+			shadow_pd = hpa2hva(shadow_pdpt[i] & EPT_ENTRY_PFN_MASK);
+			free_sept_pd(shadow_pd);
+			free_sept_page(shadow_pd);
+		}
+	}
+}
+
+/*
+ * @brief Clear a shadow EPT entry and release the shadow EPT pages under it
+ */
+static void free_sept_entry(uint64_t *shadow_entry, enum _page_table_level pt_level)
+{
+	uint64_t *shadow_table;
+
+	if (is_present_ept_entry(*shadow_entry) && !is_leaf_ept_entry(*shadow_entry, pt_level)) {
+		shadow_table = hpa2hva((*shadow_entry) & EPT_ENTRY_PFN_MASK);
+		if (pt_level == IA32E_PML4) {
+			free_sept_pdpt(shadow_table);
+		} else if (pt_level == IA32E_PDPT) {
+			free_sept_pd(shadow_table);
+		} else {
+			/* The PT referenced by a PDE has only leaf entries */
+		}
+		free_sept_page(shadow_table);
+	}
+	*shadow_entry = 0UL;
+}
+
 /*
  * @brief Release all pages except the PML4E page of a shadow EPT
  */
 static void free_sept_table(uint64_t *shadow_eptp)
 {
-	uint64_t *shadow_pml4e, *shadow_pdpte, *shadow_pde;
-	uint64_t i, j, k;
+	uint64_t i;
 
 	if (shadow_eptp) {
 		for (i = 0UL; i < PTRS_PER_PML4E; i++) {
-			shadow_pml4e = pml4e_offset(shadow_eptp, i << PML4E_SHIFT);
-			if (!is_present_ept_entry(*shadow_pml4e)) {
-				continue;
+			free_sept_entry(&shadow_eptp[i], IA32E_PML4);
+		}
+	}
+}
+
+/*
+ * @brief Check whether a shadow EPT entry still mirrors its guest EPT entry
+ *
+ * The accessed and dirty flags are set by the processor on either side and
+ * are not compared. A shadow leaf entry is stale once the guest page is
+ * remapped, a shadow non-leaf entry once the guest points it to another table.
+ */
+static bool is_stale_sept_entry(struct acrn_vm *vm, uint64_t shadow_entry, uint64_t guest_entry,
+		enum _page_table_level pt_level)
+{
+	const uint64_t attr_mask = ~(EPT_ENTRY_PFN_MASK | EPT_ACCESSED | EPT_DIRTY);
+	uint64_t guest_gpa = guest_entry & EPT_ENTRY_PFN_MASK;
+	uint64_t *shadow_table;
+	bool is_stale;
+
+	if (!is_present_ept_entry(guest_entry) ||
+			(is_leaf_ept_entry(guest_entry, pt_level) != is_leaf_ept_entry(shadow_entry, pt_level)) ||
+			((guest_entry & attr_mask) != (shadow_entry & attr_mask))) {
+		is_stale = true;
+	} else if (is_leaf_ept_entry(guest_entry, pt_level)) {
+		is_stale = ((shadow_entry & EPT_ENTRY_PFN_MASK) != (gpa2hpa(vm, guest_gpa) & EPT_ENTRY_PFN_MASK));
+	} else {
+		shadow_table = hpa2hva(shadow_entry & EPT_ENTRY_PFN_MASK);
+		is_stale = (sept_page_guest_gpa[sept_page_index(shadow_table)] != guest_gpa) ||
+				(gpa2hva(vm, guest_gpa) == NULL);
+	}
+
+	return is_stale;
+}
+
+/*
+ * @brief Drop the shadow EPT entries which no longer match the guest EPT
+ *
+ * Walks the shadow EPT depth first and compares each present entry with the
+ * guest EPT entry it was created from. Only the stale entries and the pages
+ * under them are released, the rest of the shadow EPT is kept, so L2 does
+ * not have to fault all its memory in again after each INVEPT.
+ *
+ * @pre stac() is done and nept_desc_bucket_lock is held
+ */
+static void sync_sept_table(struct acrn_vm *vm, const struct nept_desc *desc)
+{
+	uint64_t *shadow_tables[IA32E_PT + 1U];
+	const uint64_t *guest_tables[IA32E_PT + 1U];
+	uint64_t offsets[IA32E_PT + 1U];
+	enum _page_table_level pt_level = IA32E_PML4;
+	uint64_t *shadow_entry, guest_entry;
+	bool walk_done = false;
+
+	shadow_tables[IA32E_PML4] = (uint64_t *)(desc->shadow_eptp & PAGE_MASK);
+	guest_tables[IA32E_PML4] = gpa2hva(vm, desc->guest_eptp & PAGE_MASK);
+	offsets[IA32E_PML4] = 0UL;
+
+	if (guest_tables[IA32E_PML4] == NULL) {
+		free_sept_table(shadow_tables[IA32E_PML4]);
+		walk_done = true;
+	}
+
+	while (!walk_done) {
+		if (offsets[pt_level] == PTRS_PER_PTE) {
+			/* This table is done, go on with the next entry of its parent */
+			if (pt_level == IA32E_PML4) {
+				walk_done = true;
+			} else {
+				pt_level -= 1;
+				offsets[pt_level]++;
 			}
-			for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
-				shadow_pdpte = pdpte_offset(shadow_pml4e, j << PDPTE_SHIFT);
-				if (!is_present_ept_entry(*shadow_pdpte) ||
-				    is_leaf_ept_entry(*shadow_pdpte, IA32E_PDPT)) {
-					continue;
-				}
-				for (k = 0UL; k < PTRS_PER_PDE; k++) {
-					shadow_pde = pde_offset(shadow_pdpte, k << PDE_SHIFT);
-					if (!is_present_ept_entry(*shadow_pde) ||
-					    is_leaf_ept_entry(*shadow_pde, IA32E_PD)) {
-						continue;
-					}
-					free_page(&sept_page_pool, (struct page *)((*shadow_pde) & EPT_ENTRY_PFN_MASK));
-				}
-				free_page(&sept_page_pool, (struct page *)((*shadow_pdpte) & EPT_ENTRY_PFN_MASK));
+			continue;
+		}
+
+		shadow_entry = &shadow_tables[pt_level][offsets[pt_level]];
+		guest_entry = guest_tables[pt_level][offsets[pt_level]];
+		if (is_present_ept_entry(*shadow_entry)) {
+			if (is_stale_sept_entry(vm, *shadow_entry, guest_entry, pt_level)) {
+				free_sept_entry(shadow_entry, pt_level);
+			} else if (!is_leaf_ept_entry(*shadow_entry, pt_level)) {
+				/* Descend into the next level table */
+				shadow_tables[pt_level + 1] = hpa2hva((*shadow_entry) & EPT_ENTRY_PFN_MASK);
+				guest_tables[pt_level + 1] = gpa2hva(vm, guest_entry & EPT_ENTRY_PFN_MASK);
+				pt_level += 1;
+				offsets[pt_level] = 0UL;
+				continue;
+			} else {
+				/* The shadow leaf entry is up to date */
 			}
-			free_page(&sept_page_pool, (struct page *)((*shadow_pml4e) & EPT_ENTRY_PFN_MASK));
-			*shadow_pml4e = 0UL;
 		}
+		offsets[pt_level]++;
+	}
+}
+
+/*
+ * @brief Release the shadow EPT of a nept_desc and make the nept_desc empty
+ *
+ * @pre nept_desc_bucket_lock is held
+ */
+static void release_nept_desc(struct nept_desc *desc)
+{
+	dev_dbg(VETP_LOG_LEVEL, "[%s], nept_desc[%llx] ref[%d] shadow_eptp[%llx] guest_eptp[%llx]",
+			__func__, desc, desc->ref_count, desc->shadow_eptp, desc->guest_eptp);
+	free_sept_table((void *)(desc->shadow_eptp & PAGE_MASK));
+	free_sept_page((void *)(desc->shadow_eptp & PAGE_MASK));
+	/* Flush the hardware TLB */
+	invept((void *)(desc->shadow_eptp & PAGE_MASK));
+	desc->shadow_eptp = 0UL;
+	desc->guest_eptp = 0UL;
+	desc->last_used = 0UL;
+}
+
+/*
+ * @brief Find the least recently used nept_desc which caches a shadow EPT
+ *	  but is not referenced any more
+ *
+ * @return NULL if there is no such nept_desc
+ *
+ * @pre nept_desc_bucket_lock is held
+ */
+static struct nept_desc *find_lru_nept_desc(void)
+{
+	uint32_t i;
+	struct nept_desc *desc = NULL;
+
+	for (i = 0U; i < CONFIG_MAX_GUEST_EPT_NUM; i++) {
+		if ((nept_desc_bucket[i].ref_count == 0U) && (nept_desc_bucket[i].shadow_eptp != 0UL) &&
+				((desc == NULL) || (nept_desc_bucket[i].last_used < desc->last_used))) {
+			desc = &nept_desc_bucket[i];
+		}
+	}
+
+	return desc;
+}
+
+/*
+ * @brief Find the nept_desc to cache a new guest EPTP in
+ *
+ * An empty nept_desc is preferred, else the least recently used nept_desc
+ * which is not referenced any more is taken.
+ *
+ * @return NULL if all nept_desc are referenced
+ *
+ * @pre nept_desc_bucket_lock is held
+ */
+static struct nept_desc *find_free_nept_desc(void)
+{
+	uint32_t i;
+	struct nept_desc *desc = NULL;
+
+	for (i = 0U; i < CONFIG_MAX_GUEST_EPT_NUM; i++) {
+		if ((nept_desc_bucket[i].ref_count == 0U) && (nept_desc_bucket[i].shadow_eptp == 0UL)) {
+			desc = &nept_desc_bucket[i];
+			break;
+		}
+	}
+
+	return (desc != NULL) ? desc : find_lru_nept_desc();
+}
+
+/*
+ * @brief Allocate a shadow EPT page to mirror a guest EPT page
+ *
+ * The cached shadow EPTs which are not referenced are dropped, least
+ * recently used first, when the shadow EPT pages run out.
+ *
+ * @return NULL if all the shadow EPT pages are used by referenced shadow EPTs
+ *
+ * @pre nept_desc_bucket_lock is held
+ */
+static uint64_t *alloc_sept_page(uint64_t guest_gpa)
+{
+	struct nept_desc *desc;
+	uint64_t *sept_page = NULL;
+
+	while (sept_pages_used >= TOTAL_SEPT_4K_PAGES_NUM) {
+		desc = find_lru_nept_desc();
+		if (desc == NULL) {
+			break;
+		}
+		release_nept_desc(desc);
 	}
+
+	/* The pool has no dummy page, alloc_page() would panic once it is empty */
+	if (sept_pages_used < TOTAL_SEPT_4K_PAGES_NUM) {
+		sept_page = (uint64_t *)alloc_page(&sept_page_pool);
+	}
+
+	if (sept_page != NULL) {
+		sept_pages_used++;
+		sept_page_guest_gpa[sept_page_index(sept_page)] = guest_gpa;
+	}
+
+	return sept_page;
 }
 
 /*
  * @brief Convert a guest EPTP to the associated nept_desc.
  * @return struct nept_desc * if existed.
  * @return NULL if non-existed.
+ *
+ * @pre nept_desc_bucket_lock is held
  */
-static struct nept_desc *find_nept_desc(uint64_t guest_eptp)
+static struct nept_desc *lookup_nept_desc(uint64_t guest_eptp)
 {
 	uint32_t i;
 	struct nept_desc *desc = NULL;
 
 	if (guest_eptp) {
-		spinlock_obtain(&nept_desc_bucket_lock);
 		for (i = 0L; i < CONFIG_MAX_GUEST_EPT_NUM; i++) {
 			/* Find an existed nept_desc of the guest EPTP */
 			if (nept_desc_bucket[i].guest_eptp == guest_eptp) {
@@ -114,12 +355,22 @@ static struct nept_desc *find_nept_desc(uint64_t guest_eptp)
 				break;
 			}
 		}
-		spinlock_release(&nept_desc_bucket_lock);
 	}
 
 	return desc;
 }
 
+static struct nept_desc *find_nept_desc(uint64_t guest_eptp)
+{
+	struct nept_desc *desc;
+
+	spinlock_obtain(&nept_desc_bucket_lock);
+	desc = lookup_nept_desc(guest_eptp);
+	spinlock_release(&nept_desc_bucket_lock);
+
+	return desc;
+}
+
 /*
  * @brief Convert a guest EPTP to a shadow EPTP.
  * @return 0 if non-existed.
@@ -136,40 +387,50 @@ uint64_t get_shadow_eptp(uint64_t guest_eptp)
  * @brief Get a nept_desc to cache a guest EPTP
  *
  * If there is already an existed nept_desc associated with given guest_eptp,
- * increase its ref_count and return it. If there is not existed nept_desc
- * for guest_eptp, create one and initialize it.
+ * even one kept in the cache after its last reference was put, increase its
+ * ref_count and return it. Otherwise take an empty nept_desc, or recycle the
+ * least recently used one, for guest_eptp and initialize it.
  *
  * @return a nept_desc which associate the guest EPTP with a shadow EPTP
+ * @return NULL if there is no shadow EPT page left for a new nept_desc
  */
 struct nept_desc *get_nept_desc(uint64_t guest_eptp)
 {
-	uint32_t i;
 	struct nept_desc *desc = NULL;
+	uint64_t *sept_page;
 
 	if (guest_eptp != 0UL) {
 		spinlock_obtain(&nept_desc_bucket_lock);
-		for (i = 0L; i < CONFIG_MAX_GUEST_EPT_NUM; i++) {
-			/* Find an existed nept_desc of the guest EPTP address bits */
-			if (nept_desc_bucket[i].guest_eptp == guest_eptp) {
-				desc = &nept_desc_bucket[i];
-				desc->ref_count++;
-				break;
+		desc = lookup_nept_desc(guest_eptp);
+		if (desc == NULL) {
+			desc = find_free_nept_desc();
+			ASSERT(desc != NULL, "Get nept_desc failed!");
+
+			/* Recycle the least recently used shadow EPT */
+			if (desc->shadow_eptp != 0UL) {
+				release_nept_desc(desc);
 			}
-			/* Get the first empty nept_desc for the guest EPTP */
-			if (!desc && (nept_desc_bucket[i].ref_count == 0UL)) {
-				desc = &nept_desc_bucket[i];
+
+			/* A new nept_desc, initialize it */
+			sept_page = alloc_sept_page(guest_eptp & PAGE_MASK);
+			if (sept_page != NULL) {
+				desc->shadow_eptp = (uint64_t)sept_page | (guest_eptp & ~PAGE_MASK);
+				desc->guest_eptp = guest_eptp;
+				desc->ref_count = 0U;
+
+				dev_dbg(VETP_LOG_LEVEL, "[%s], nept_desc[%llx] shadow_eptp[%llx] guest_eptp[%llx]",
+						__func__, desc, desc->shadow_eptp, desc->guest_eptp);
+			} else {
+				/* get_shadow_eptp() gives 0 then, the VM entry to L2 VM fails */
+				pr_err("%s: no shadow EPT page for guest EPTP 0x%llx", __func__, guest_eptp);
+				desc = NULL;
 			}
 		}
-		ASSERT(desc != NULL, "Get nept_desc failed!");
-
-		/* A new nept_desc, initialize it */
-		if (desc->shadow_eptp == 0UL) {
-			desc->shadow_eptp = (uint64_t)alloc_page(&sept_page_pool) | (guest_eptp & ~PAGE_MASK);
-			desc->guest_eptp = guest_eptp;
-			desc->ref_count = 1UL;
 
-			dev_dbg(VETP_LOG_LEVEL, "[%s], nept_desc[%llx] ref[%d] shadow_eptp[%llx] guest_eptp[%llx]",
-					__func__, desc, desc->ref_count, desc->shadow_eptp, desc->guest_eptp);
+		if (desc != NULL) {
+			desc->ref_count++;
+			nept_desc_clock++;
+			desc->last_used = nept_desc_clock;
 		}
 
 		spinlock_release(&nept_desc_bucket_lock);
@@ -181,27 +442,19 @@ struct nept_desc *get_nept_desc(uint64_t guest_eptp)
 /*
  * @brief Put a nept_desc who associate with a guest_eptp
  *
- * If ref_count of the nept_desc, then release all resources used by it.
+ * The shadow EPT is kept when the ref_count of the nept_desc drops to 0, so
+ * it can be reused if L1 VM switches back to the guest EPTP. It is released
+ * once the nept_desc is recycled for another guest EPTP.
  */
 void put_nept_desc(uint64_t guest_eptp)
 {
 	struct nept_desc *desc = NULL;
 
 	if (guest_eptp != 0UL) {
-		desc = find_nept_desc(guest_eptp);
 		spinlock_obtain(&nept_desc_bucket_lock);
-		if (desc) {
+		desc = lookup_nept_desc(guest_eptp);
+		if ((desc != NULL) && (desc->ref_count > 0U)) {
 			desc->ref_count--;
-			if (desc->ref_count == 0UL) {
-				dev_dbg(VETP_LOG_LEVEL, "[%s], nept_desc[%llx] ref[%d] shadow_eptp[%llx] guest_eptp[%llx]",
-						__func__, desc, desc->ref_count, desc->shadow_eptp, desc->guest_eptp);
-				free_sept_table((void *)(desc->shadow_eptp & PAGE_MASK));
-				free_page(&sept_page_pool, (struct page *)(desc->shadow_eptp & PAGE_MASK));
-				/* Flush the hardware TLB */
-				invept((void *)(desc->shadow_eptp & PAGE_MASK));
-				desc->shadow_eptp = 0UL;
-				desc->guest_eptp = 0UL;
-			}
 		}
 		spinlock_release(&nept_desc_bucket_lock);
 	}
@@ -245,6 +498,7 @@ static uint64_t generate_shadow_ept_entry(struct acrn_vcpu *vcpu, uint64_t guest
 {
 	uint64_t shadow_ept_entry = 0UL;
 	uint64_t ept_entry;
+	uint64_t *sept_page;
 	enum _page_table_level ept_level;
 
 	/*
@@ -277,9 +531,12 @@ static uint64_t generate_shadow_ept_entry(struct acrn_vcpu *vcpu, uint64_t guest
 			shadow_ept_entry |= gpa2hpa(vcpu->vm, (guest_ept_entry & EPT_ENTRY_PFN_MASK));
 		}
 	} else {
-		/* Use a HPA of a new page in shadow EPT entry */
-		shadow_ept_entry = guest_ept_entry & ~EPT_ENTRY_PFN_MASK;
-		shadow_ept_entry |= hva2hpa((void *)alloc_page(&sept_page_pool)) & EPT_ENTRY_PFN_MASK;
+		/* Use a HPA of a new page in shadow EPT entry, none if the shadow EPT pages run out */
+		sept_page = alloc_sept_page(guest_ept_entry & EPT_ENTRY_PFN_MASK);
+		if (sept_page != NULL) {
+			shadow_ept_entry = guest_ept_entry & ~EPT_ENTRY_PFN_MASK;
+			shadow_ept_entry |= hva2hpa((void *)sept_page) & EPT_ENTRY_PFN_MASK;
+		}
 	}
 
 	return shadow_ept_entry;
@@ -429,6 +686,8 @@ bool handle_l2_ept_violation(struct acrn_vcpu *vcpu)
 			p_shadow_ept_page[offset] = shadow_ept_entry;
 			if (shadow_ept_entry == 0UL) {
 				/*
+				 * Out of shadow EPT pages, reflect the violation to L1 VM.
+				 *
 				 * TODO:
 				 * For invalid GPA in guest EPT entries, now reflect the violation to L1 VM.
 				 * Need to revisit this and evaluate if need to emulate the invalid GPA
@@ -475,36 +734,34 @@ int32_t invept_vmexit_handler(struct acrn_vcpu *vcpu)
 			nested_vmx_result(VMfailValid, VMXERR_INVEPT_INVVPID_INVALID_OPERAND);
 		} else if (type == 1 && (ept_cap_vmsr & VMX_EPT_INVEPT_SINGLE_CONTEXT) != 0UL) {
 			/* Single-context invalidation */
-			/* Find corresponding nept_desc of the invalidated EPTP */
-			desc = get_nept_desc(operand_gla_ept.eptp);
-			if (desc) {
-				spinlock_obtain(&nept_desc_bucket_lock);
-				if (desc->shadow_eptp != 0UL) {
-					/*
-					 * Since ACRN does not know which paging entries are changed,
-					 * Remove all the shadow EPT entries that ACRN created for L2 VM
-					 */
-					free_sept_table((void *)(desc->shadow_eptp & PAGE_MASK));
-					invept((void *)(desc->shadow_eptp & PAGE_MASK));
-				}
-				spinlock_release(&nept_desc_bucket_lock);
-				put_nept_desc(operand_gla_ept.eptp);
+			spinlock_obtain(&nept_desc_bucket_lock);
+			/* Find corresponding nept_desc of the invalidated EPTP, nothing to do if it is not shadowed */
+			desc = lookup_nept_desc(operand_gla_ept.eptp);
+			if ((desc != NULL) && (desc->shadow_eptp != 0UL)) {
+				/* Only drop the shadow EPT entries that L1 VM changed in the guest EPT */
+				stac();
+				sync_sept_table(vcpu->vm, desc);
+				clac();
+				invept((void *)(desc->shadow_eptp & PAGE_MASK));
 			}
+			spinlock_release(&nept_desc_bucket_lock);
 			nested_vmx_result(VMsucceed, 0);
 		} else if ((type == 2) && (ept_cap_vmsr & VMX_EPT_INVEPT_GLOBAL_CONTEXT) != 0UL) {
 			/* Global invalidation */
 			spinlock_obtain(&nept_desc_bucket_lock);
 			/*
-			 * Invalidate all shadow EPTPs of L1 VM
+			 * Invalidate all shadow EPTPs of L1 VM, the cached ones included
 			 * TODO: Invalidating all L2 vCPU associated EPTPs is enough. How?
 			 */
+			stac();
 			for (i = 0L; i < CONFIG_MAX_GUEST_EPT_NUM; i++) {
 				if (nept_desc_bucket[i].guest_eptp != 0UL) {
 					desc = &nept_desc_bucket[i];
-					free_sept_table((void *)(desc->shadow_eptp & PAGE_MASK));
+					sync_sept_table(vcpu->vm, desc);
 					invept((void *)(desc->shadow_eptp & PAGE_MASK));
 				}
 			}
+			clac();
 			spinlock_release(&nept_desc_bucket_lock);
 			nested_vmx_result(VMsucceed, 0);
 		} else {
@@ -524,6 +781,8 @@ void init_vept(void)
 	spinlock_init(&sept_page_pool.lock);
 	memset((void *)sept_page_pool.bitmap, 0, sept_page_pool.bitmap_size * sizeof(uint64_t));
 	sept_page_pool.last_hint_id = 0UL;
+	sept_pages_used = 0UL;
+	nept_desc_clock = 0UL;
 
 	spinlock_init(&nept_desc_bucket_lock);
 }
@@ -343,7 +343,7 @@ int32_t external_interrupt_vmexit_handler(struct acrn_vcpu *vcpu)
 	struct intr_excp_ctx ctx;
 	int32_t ret;
 
-	intr_info = exec_vmread32(VMX_EXIT_INT_INFO);
+	intr_info = (uint32_t)vcpu_get_exit_info(vcpu, EXIT_INFO_INT_INFO);
 	if (((intr_info & VMX_INT_INFO_VALID) == 0U) ||
 		(((intr_info & VMX_INT_TYPE_MASK) >> 8U)
 		!= VMX_INT_TYPE_EXT_INT)) {
@@ -393,6 +393,12 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 			wait_event(&vcpu->events[VCPU_EVENT_SPLIT_LOCK]);
 		}
 
+		if (bitmap_test_and_clear_lock(ACRN_REQUEST_DIRTY_LOG, pending_req_bits)) {
+			update_dirty_log_ctrl(vcpu);
+			/* TLB entries cached while the A/D flags were off won't set them */
+			invept(vcpu->vm->arch_vm.nworld_eptp);
+		}
+
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH, pending_req_bits)) {
 			invept(vcpu->vm->arch_vm.nworld_eptp);
 			if (vcpu->vm->sworld_control.flag.active != 0UL) {
@@ -408,6 +414,16 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 			vcpu_set_vmcs_eoi_exit(vcpu);
 		}
 
+		if (bitmap_test_and_clear_lock(ACRN_REQUEST_VHPET_UPDATE, pending_req_bits)) {
+			vhpet_update_timers(vcpu);
+		}
+
+#ifdef CONFIG_HYPERV_ENABLED
+		if (bitmap_test_and_clear_lock(ACRN_REQUEST_HV_STIMER, pending_req_bits)) {
+			hyperv_stimer_deliver(vcpu);
+		}
+#endif
+
 		/*
 		 * Inject pending exception prior pending interrupt to complete the previous instruction.
 		 */
@@ -514,7 +530,7 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 	pr_dbg(" Handling guest exception");
 
 	/* Obtain VM-Exit information field pg 2912 */
-	intinfo = exec_vmread32(VMX_EXIT_INT_INFO);
+	intinfo = (uint32_t)vcpu_get_exit_info(vcpu, EXIT_INFO_INT_INFO);
 	if ((intinfo & VMX_INT_INFO_VALID) != 0U) {
 		exception_vector = intinfo & 0xFFU;
 		/* Check if exception caused by the guest is a HW exception.
@@ -522,7 +538,7 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 		 * error code to be conveyed to get via the stack
 		 */
 		if ((intinfo & VMX_INT_INFO_ERR_CODE_VALID) != 0U) {
-			int_err_code = exec_vmread32(VMX_EXIT_INT_ERROR_CODE);
+			int_err_code = (uint32_t)vcpu_get_exit_info(vcpu, EXIT_INFO_INT_ERROR_CODE);
 
 			/* get current privilege level and fault address */
 			cpl = exec_vmread32(VMX_GUEST_CS_ATTR);
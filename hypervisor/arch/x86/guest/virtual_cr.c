@@ -109,6 +109,15 @@ static uint64_t cr0_rsv_bits_guest_value;
 static uint64_t initial_guest_cr0;		/* Initial value of GUEST_CR0 */
 static uint64_t cr0_reserved_bits_mask;
 
+/*
+ * Bits of CR*_TRAP_AND_PASSTHRU_BITS passed through too with VCR_PROFILE_RELAXED,
+ * for the guests toggling them often. The hypervisor keeps no state of its own
+ * for them and, with EPT, the TLB invalidation a MOV to CR implies for them is
+ * done by the processor in VMX non-root operation.
+ */
+#define CR0_RELAXED_PASSTHRU_BITS	CR0_WP
+#define CR4_RELAXED_PASSTHRU_BITS	(CR4_SMAP | CR4_PKE | CR4_PKS)
+
 /* PAE PDPTE bits 1 ~ 2, 5 ~ 8 are always reserved */
 #define PAE_PDPTE_FIXED_RESVD_BITS	0x00000000000001E6UL
 
@@ -211,6 +220,22 @@ static bool is_cr0_write_valid(struct acrn_vcpu *vcpu, uint64_t cr0)
 	return ret;
 }
 
+/*
+ * Count the exit once for each bit it changes, for the cr_stat shell command to
+ * show which bits the guest toggles and pick the vcr_profile of the VM.
+ */
+static void account_cr_exit(uint32_t *bits, uint64_t changed_bits)
+{
+	uint64_t mask = changed_bits & 0xffffffffUL;
+	uint16_t bit;
+
+	while (mask != 0UL) {
+		bit = ffs64(mask);
+		bitmap_clear_nolock(bit, &mask);
+		bits[bit]++;
+	}
+}
+
 /*
  * Handling of CR0:
  * Assume "unrestricted guest" feature is supported by vmx.
@@ -249,6 +274,8 @@ static void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t value)
 		uint32_t entry_ctrls;
 		uint64_t cr0_changed_bits = vcpu_get_cr0(vcpu) ^ effective_cr0;
 
+		account_cr_exit(vcpu->cr_stats.cr0_bits, cr0_changed_bits & ~vcpu->vm->arch_vm.cr0_passthru_mask);
+
 		if ((cr0_changed_bits & CR0_PG) != 0UL) {
 			/* PG bit changes */
 			if ((effective_cr0 & CR0_PG) != 0UL) {
@@ -311,7 +338,7 @@ static void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t value)
 				vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
 			}
 
-			mask = cr0_trap_and_passthru_mask | cr0_passthru_mask;
+			mask = cr0_trap_and_passthru_mask | vcpu->vm->arch_vm.cr0_passthru_mask;
 			tmp = (initial_guest_cr0 & ~mask) | (effective_cr0 & mask);
 
 			exec_vmwrite(VMX_GUEST_CR0, tmp);
@@ -368,6 +395,8 @@ static void vmx_write_cr4(struct acrn_vcpu *vcpu, uint64_t cr4)
 		uint64_t mask, tmp;
 		uint64_t cr4_changed_bits = vcpu_get_cr4(vcpu) ^ cr4;
 
+		account_cr_exit(vcpu->cr_stats.cr4_bits, cr4_changed_bits & ~vcpu->vm->arch_vm.cr4_passthru_mask);
+
 		if ((cr4_changed_bits & CR4_TRAP_AND_PASSTHRU_BITS) != 0UL) {
 			if (((cr4 & CR4_PAE) != 0UL) && (is_paging_enabled(vcpu)) && (!is_long_mode(vcpu))) {
 				if (load_pdptrs(vcpu) != 0) {
@@ -409,7 +438,7 @@ static void vmx_write_cr4(struct acrn_vcpu *vcpu, uint64_t cr4)
 			/*
 			 * Update the passthru bits.
 			 */
-			mask = cr4_trap_and_passthru_mask | cr4_passthru_mask;
+			mask = cr4_trap_and_passthru_mask | vcpu->vm->arch_vm.cr4_passthru_mask;
 			tmp = (initial_guest_cr4 & ~mask) | (cr4 & mask);
 
 			/*
@@ -505,25 +534,43 @@ void init_cr0_cr4_flexible_bits(void)
 		cr4_reserved_bits_mask, cr4_rsv_bits_guest_value, initial_guest_cr4);
 }
 
-void init_cr0_cr4_host_guest_mask(void)
+/*
+ * The passthru bits of a VM are the ones of its vcr_profile which are flexible,
+ * the relaxed ones are taken out of the trap and passthru ones.
+ */
+void init_vcr_masks(struct acrn_vm *vm)
+{
+	vm->arch_vm.cr0_passthru_mask = cr0_passthru_mask;
+	vm->arch_vm.cr4_passthru_mask = cr4_passthru_mask;
+
+	if (get_vm_config(vm->vm_id)->vcr_profile == VCR_PROFILE_RELAXED) {
+		vm->arch_vm.cr0_passthru_mask |= (cr0_trap_and_passthru_mask & CR0_RELAXED_PASSTHRU_BITS);
+		vm->arch_vm.cr4_passthru_mask |= (cr4_trap_and_passthru_mask & CR4_RELAXED_PASSTHRU_BITS);
+	}
+}
+
+void init_cr0_cr4_host_guest_mask(const struct acrn_vm *vm)
 {
+	uint64_t cr0_mask = ~vm->arch_vm.cr0_passthru_mask;
+	uint64_t cr4_mask = ~vm->arch_vm.cr4_passthru_mask;
+
 	/*
 	 * "1" means the bit is trapped by host, and "0" means passthru to guest..
 	 */
-	exec_vmwrite(VMX_CR0_GUEST_HOST_MASK, ~cr0_passthru_mask); /* all bits except passthrubits are trapped */
-	pr_dbg("CR0 guest-host mask value: 0x%016lx", ~cr0_passthru_mask);
+	exec_vmwrite(VMX_CR0_GUEST_HOST_MASK, cr0_mask); /* all bits except passthrubits are trapped */
+	pr_dbg("CR0 guest-host mask value: 0x%016lx", cr0_mask);
 
-	exec_vmwrite(VMX_CR4_GUEST_HOST_MASK, ~cr4_passthru_mask); /* all bits except passthru bits are trapped */
-	pr_dbg("CR4 guest-host mask value: 0x%016lx", ~cr4_passthru_mask);
+	exec_vmwrite(VMX_CR4_GUEST_HOST_MASK, cr4_mask); /* all bits except passthru bits are trapped */
+	pr_dbg("CR4 guest-host mask value: 0x%016lx", cr4_mask);
 }
 
 uint64_t vcpu_get_cr0(struct acrn_vcpu *vcpu)
 {
 	struct run_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
+	uint64_t mask = vcpu->vm->arch_vm.cr0_passthru_mask;
 
 	if (bitmap_test_and_set_lock(CPU_REG_CR0, &vcpu->reg_cached) == 0) {
-		ctx->cr0 = (exec_vmread(VMX_CR0_READ_SHADOW) & ~cr0_passthru_mask) |
-			(exec_vmread(VMX_GUEST_CR0) & cr0_passthru_mask);
+		ctx->cr0 = (exec_vmread(VMX_CR0_READ_SHADOW) & ~mask) | (exec_vmread(VMX_GUEST_CR0) & mask);
 	}
 	return ctx->cr0;
 }
@@ -548,10 +595,10 @@ void vcpu_set_cr2(struct acrn_vcpu *vcpu, uint64_t val)
 uint64_t vcpu_get_cr4(struct acrn_vcpu *vcpu)
 {
 	struct run_context *ctx = &vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
+	uint64_t mask = vcpu->vm->arch_vm.cr4_passthru_mask;
 
 	if (bitmap_test_and_set_lock(CPU_REG_CR4, &vcpu->reg_cached) == 0) {
-		ctx->cr4 = (exec_vmread(VMX_CR4_READ_SHADOW) & ~cr4_passthru_mask) |
-			(exec_vmread(VMX_GUEST_CR4) & cr4_passthru_mask);
+		ctx->cr4 = (exec_vmread(VMX_CR4_READ_SHADOW) & ~mask) | (exec_vmread(VMX_GUEST_CR4) & mask);
 	}
 	return ctx->cr4;
 }
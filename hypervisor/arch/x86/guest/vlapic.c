@@ -256,11 +256,13 @@ vlapic_lvtt_masked(const struct acrn_vlapic *vlapic)
 static void vlapic_init_timer(struct acrn_vlapic *vlapic)
 {
 	struct vlapic_timer *vtimer;
+	const struct acrn_vm_config *vm_config = get_vm_config(vlapic2vcpu(vlapic)->vm->vm_id);
 
 	vtimer = &vlapic->vtimer;
 	(void)memset(vtimer, 0U, sizeof(struct vlapic_timer));
 
 	initialize_timer(&vtimer->timer, vlapic_timer_expired, vlapic2vcpu(vlapic), 0UL, 0UL);
+	set_timer_slack(&vtimer->timer, us_to_ticks(vm_config->timer_slack_us));
 }
 
 /**
@@ -359,12 +361,8 @@ static void vlapic_write_icrtmr(struct acrn_vlapic *vlapic)
 		vtimer->tmicr = lapic->icr_timer.v;
 
 		del_timer(&vtimer->timer);
-		if (set_expiration(vlapic)) {
-			/* vlapic_init_timer has been called,
-			 * and timer->fire_tsc is not 0, here
-			 * add_timer should not return error
-			 */
-			(void)add_timer(&vtimer->timer);
+		if (set_expiration(vlapic) && (add_timer(&vtimer->timer) != 0)) {
+			pr_err("%s: no room for the timer", __func__);
 		}
 	}
 }
@@ -410,7 +408,7 @@ void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic, uint64_t val_arg)
 		 * we disarm the physical timer.
 		 */
 		if (val != 0UL) {
-			val -= exec_vmread64(VMX_TSC_OFFSET_FULL);
+			val = vcpu_tsc_to_host(vcpu, val);
 			if (val == 0UL) {
 				val += 1UL;
 			}
@@ -426,13 +424,11 @@ void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic, uint64_t val_arg)
 
 		if (val != 0UL) {
 			/* transfer guest tsc to host tsc */
-			val -= exec_vmread64(VMX_TSC_OFFSET_FULL);
+			val = vcpu_tsc_to_host(vcpu, val);
 			update_timer(timer, val, 0UL);
-			/* vlapic_init_timer has been called,
-			 * and timer->fire_tsc is not 0,here
-			 * add_timer should not return error
-			 */
-			(void)add_timer(timer);
+			if (add_timer(timer) != 0) {
+				pr_err("%s: no room for the timer", __func__);
+			}
 		} else {
 			update_timer(timer, 0UL, 0UL);
 		}
@@ -451,6 +447,18 @@ vlapic_write_esr(struct acrn_vlapic *vlapic)
 	vlapic->esr_pending = 0U;
 }
 
+static inline bool
+vlapic_is_level_vector(const struct acrn_vlapic *vlapic, uint32_t vector)
+{
+	return bitmap_test((uint16_t)(vector & 0x3fU), &vlapic->level_vectors[(vector & 0xffU) >> 6U]);
+}
+
+static inline bool
+vlapic_test_tmr(const struct acrn_vlapic *vlapic, uint32_t vector)
+{
+	return bitmap32_test((uint16_t)(vector & 0x1fU), &vlapic->apic_page.tmr[(vector & 0xffU) >> 5U].v);
+}
+
 static void
 vlapic_set_tmr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
@@ -461,11 +469,61 @@ vlapic_set_tmr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 		}
 	} else {
 		if (bitmap32_test_and_clear_lock((uint16_t)(vector & 0x1fU), &tmrptr[(vector & 0xffU) >> 5U].v)) {
-			vcpu_clear_eoi_exit_bitmap(vlapic2vcpu(vlapic), vector);
+			/* a level RTE still routed here keeps the vector in the EOI-exit bitmap */
+			if (!vlapic_is_level_vector(vlapic, vector)) {
+				vcpu_clear_eoi_exit_bitmap(vlapic2vcpu(vlapic), vector);
+			}
 		}
 	}
 }
 
+/*
+ * Make the EOI-exit bitmap match the level-triggered vectors routed to this
+ * vLAPIC. A vector that is no longer level keeps its bit while its TMR bit is
+ * set, so the EOI of an in-service level interrupt still reaches the vIOAPIC.
+ */
+static void
+vlapic_apply_level_vectors(struct acrn_vlapic *vlapic)
+{
+	struct acrn_vcpu *vcpu = vlapic2vcpu(vlapic);
+	uint32_t i, vector;
+	uint64_t bits;
+
+	for (i = 0U; i < 4U; i++) {
+		bits = vlapic->level_vectors[i] | vcpu->arch.eoi_exit_bitmap[i];
+		while (bits != 0UL) {
+			vector = (i << 6U) + ffs64(bits);
+			bitmap_clear_nolock((uint16_t)(vector & 0x3fU), &bits);
+
+			if (vlapic_is_level_vector(vlapic, vector)) {
+				vcpu_set_eoi_exit_bitmap(vcpu, vector);
+			} else if (!vlapic_test_tmr(vlapic, vector)) {
+				vcpu_clear_eoi_exit_bitmap(vcpu, vector);
+				/* raced with a level accept of the vector */
+				if (vlapic_test_tmr(vlapic, vector)) {
+					vcpu_set_eoi_exit_bitmap(vcpu, vector);
+				}
+			} else {
+				/* in service as level, dropped at its EOI */
+			}
+		}
+	}
+}
+
+/*
+ * @pre vlapic != NULL
+ */
+void
+vlapic_set_level_vectors(struct acrn_vlapic *vlapic, const uint64_t level_vectors[4])
+{
+	uint32_t i;
+
+	for (i = 0U; i < 4U; i++) {
+		vlapic->level_vectors[i] = level_vectors[i];
+	}
+	vlapic_apply_level_vectors(vlapic);
+}
+
 static void
 vlapic_reset_tmr(struct acrn_vlapic *vlapic)
 {
@@ -481,6 +539,7 @@ vlapic_reset_tmr(struct acrn_vlapic *vlapic)
 	}
 
 	vcpu_reset_eoi_exit_bitmaps(vlapic2vcpu(vlapic));
+	vlapic_apply_level_vectors(vlapic);
 }
 
 static void apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
@@ -501,8 +560,13 @@ static void apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector,
 	}
 }
 
-static void apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+/*
+ * @return true if the vCPU runs on another pCPU and has to be notified.
+ */
+static bool apicv_advanced_post_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
+	bool notify = false;
+
 	/* update TMR if interrupt trigger mode has changed */
 	vlapic_set_tmr(vlapic, vector, level);
 
@@ -520,7 +584,21 @@ static void apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vect
 		 */
 		bitmap_set_lock(ACRN_REQUEST_EVENT, &vcpu->arch.pending_req);
 
-		if (get_pcpu_id() != pcpuid_from_vcpu(vcpu)) {
+		notify = (get_pcpu_id() != pcpuid_from_vcpu(vcpu));
+	}
+
+	return notify;
+}
+
+static void apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+{
+	struct acrn_vcpu *vcpu = vlapic2vcpu(vlapic);
+	uint16_t pcpu_id = get_pcpu_id();
+
+	if (apicv_advanced_post_intr(vlapic, vector, level)) {
+		if (per_cpu(pi_batch_vm, pcpu_id) == vcpu->vm) {
+			bitmap_set_nolock(pcpuid_from_vcpu(vcpu), &per_cpu(pi_batch_pcpus, pcpu_id));
+		} else {
 			apicv_trigger_pi_anv(pcpuid_from_vcpu(vcpu), (uint32_t)vcpu->arch.pid.control.bits.nv);
 		}
 	}
@@ -993,6 +1071,44 @@ static inline bool is_dest_field_matched(const struct acrn_vlapic *vlapic, uint3
 	return ret;
 }
 
+/*
+ * x2APIC logical IDs are derived from the APIC IDs, which never change, so
+ * the vCPU of each logical ID is recorded once when the vCPU is created.
+ */
+static void vlapic_map_x2apic_ldr(struct acrn_vlapic *vlapic)
+{
+	struct acrn_vm *vm = vlapic2vcpu(vlapic)->vm;
+	uint32_t cluster_id = (vlapic->vapic_id & CLUSTER_ID_MASK) >> 4U;
+
+	if (cluster_id < VLAPIC_X2APIC_CLUSTERS) {
+		vm->arch_vm.x2apic_ldr_map[cluster_id][vlapic->vapic_id & LOGICAL_ID_MASK] = vlapic2vcpu(vlapic)->vcpu_id;
+	}
+}
+
+/*
+ * @pre all the vLAPICs of the VM are in x2APIC mode
+ * @pre ((dest >> 16U) & 0xFFFFU) < VLAPIC_X2APIC_CLUSTERS
+ */
+static uint64_t vlapic_x2apic_logical_dest(const struct acrn_vm *vm, uint32_t dest)
+{
+	const uint16_t *map = vm->arch_vm.x2apic_ldr_map[(dest >> 16U) & 0xFFFFU];
+	uint64_t dmask = 0UL;
+	uint32_t logical_ids = dest & 0xFFFFU;
+	uint16_t bit, vcpu_id;
+
+	bit = ffs64(logical_ids);
+	while (bit < 16U) {
+		bitmap32_clear_nolock(bit, &logical_ids);
+		vcpu_id = map[bit];
+		if (vcpu_id < vm->hw.created_vcpus) {
+			bitmap_set_nolock(vcpu_id, &dmask);
+		}
+		bit = ffs64(logical_ids);
+	}
+
+	return dmask;
+}
+
 /*
  * This function populates 'dmask' with the set of vcpus that match the
  * addressing specified by the (dest, phys, lowprio) tuple.
@@ -1012,6 +1128,23 @@ vlapic_calc_dest_noshort(struct acrn_vm *vm, bool is_broadcast,
 	} else if (phys) {
 		/* Physical mode: "dest" is local APIC ID. */
 		set_dest_mask_phys(vm, &dmask, dest);
+	} else if ((vm->arch_vm.vlapic_mode == VM_VLAPIC_X2APIC) &&
+			(((dest >> 16U) & 0xFFFFU) < VLAPIC_X2APIC_CLUSTERS)) {
+		/* x2APIC cluster mode: look the logical IDs up */
+		dmask = vlapic_x2apic_logical_dest(vm, dest);
+		if (lowprio && (dmask != 0UL)) {
+			vcpu_id = ffs64(dmask);
+			lowprio_dest = vm_lapic_from_vcpu_id(vm, vcpu_id);
+			foreach_vcpu(vcpu_id, vm, vcpu) {
+				vlapic = vcpu_vlapic(vcpu);
+				if (((dmask & (1UL << vcpu_id)) != 0UL) &&
+						(lowprio_dest->apic_page.ppr.v > vlapic->apic_page.ppr.v)) {
+					lowprio_dest = vlapic;
+				}
+			}
+			dmask = 0UL;
+			bitmap_set_nolock(vlapic2vcpu(lowprio_dest)->vcpu_id, &dmask);
+		}
 	} else {
 		/*
 		 * Logical mode: "dest" is message destination addr
@@ -1130,6 +1263,45 @@ vlapic_process_init_sipi(struct acrn_vcpu* target_vcpu, uint32_t mode, uint32_t
 	return;
 }
 
+/*
+ * Post the vector to all the targets before notifying any of them, so that
+ * the targets running on other pCPUs get one notification each once all
+ * the vectors are pending.
+ */
+void vlapic_send_fixed_ipi(struct acrn_vm *vm, uint64_t dmask, uint32_t vec)
+{
+	uint64_t notify_mask = 0UL;
+	uint16_t vcpu_id, pcpu_id;
+	struct acrn_vcpu *target_vcpu;
+	struct acrn_vlapic *target;
+
+	for (vcpu_id = 0U; vcpu_id < vm->hw.created_vcpus; vcpu_id++) {
+		if ((dmask & (1UL << vcpu_id)) != 0UL) {
+			target_vcpu = vcpu_from_vid(vm, vcpu_id);
+			target = vcpu_vlapic(target_vcpu);
+
+			if ((target->ops->accept_intr == apicv_advanced_accept_intr) &&
+					((target->apic_page.svr.v & APIC_SVR_ENABLE) != 0U)) {
+				signal_event(&target_vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+				if (apicv_advanced_post_intr(target, vec, LAPIC_TRIG_EDGE)) {
+					bitmap_set_nolock(pcpuid_from_vcpu(target_vcpu), &notify_mask);
+				}
+			} else {
+				vlapic_set_intr(target_vcpu, vec, LAPIC_TRIG_EDGE);
+			}
+			dev_dbg(DBG_LEVEL_VLAPIC, "vlapic sending ipi %u to vcpu_id %hu", vec, vcpu_id);
+		}
+	}
+
+	/* the notification vector is per VM */
+	pcpu_id = ffs64(notify_mask);
+	while (pcpu_id < MAX_PCPU_NUM) {
+		bitmap_clear_nolock(pcpu_id, &notify_mask);
+		apicv_trigger_pi_anv(pcpu_id, POSTED_INTR_VECTOR + vm->vm_id);
+		pcpu_id = ffs64(notify_mask);
+	}
+}
+
 static void vlapic_write_icrlo(struct acrn_vlapic *vlapic)
 {
 	uint16_t vcpu_id;
@@ -1173,16 +1345,16 @@ static void vlapic_write_icrlo(struct acrn_vlapic *vlapic)
 
 		dmask = vlapic_calc_dest(vcpu, shorthand, is_broadcast, dest, phys, false);
 
+		if (mode == APIC_DELMODE_FIXED) {
+			vlapic_send_fixed_ipi(vcpu->vm, dmask, vec);
+			dmask = 0UL;
+		}
+
 		for (vcpu_id = 0U; vcpu_id < vcpu->vm->hw.created_vcpus; vcpu_id++) {
 			if ((dmask & (1UL << vcpu_id)) != 0UL) {
 				target_vcpu = vcpu_from_vid(vcpu->vm, vcpu_id);
 
-				if (mode == APIC_DELMODE_FIXED) {
-					vlapic_set_intr(target_vcpu, vec, LAPIC_TRIG_EDGE);
-					dev_dbg(DBG_LEVEL_VLAPIC,
-						"vlapic sending ipi %u to vcpu_id %hu",
-						vec, vcpu_id);
-				} else if (mode == APIC_DELMODE_NMI) {
+				if (mode == APIC_DELMODE_NMI) {
 					vcpu_inject_nmi(target_vcpu);
 					dev_dbg(DBG_LEVEL_VLAPIC,
 						"vlapic send ipi nmi to vcpu_id %hu", vcpu_id);
@@ -1333,12 +1505,8 @@ vlapic_write_svr(struct acrn_vlapic *vlapic)
 			 */
 			dev_dbg(DBG_LEVEL_VLAPIC, "vlapic is software-enabled");
 			if (vlapic_lvtt_period(vlapic)) {
-				if (set_expiration(vlapic)) {
-					/* vlapic_init_timer has been called,
-					 * and timer->fire_tsc is not 0,here
-					 *  add_timer should not return error
-					 */
-					(void)add_timer(&vlapic->vtimer.timer);
+				if (set_expiration(vlapic) && (add_timer(&vlapic->vtimer.timer) != 0)) {
+					pr_err("%s: no room for the timer", __func__);
 				}
 			}
 		}
@@ -1593,6 +1761,10 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum
 	lapic->dfr.v = 0xffffffffU;
 	lapic->svr.v = APIC_SVR_VECTOR;
 	vlapic_mask_lvts(vlapic);
+	if (mode == POWER_ON_RESET) {
+		/* the vIOAPIC routes are recomputed on its next RTE write */
+		(void)memset((void *)vlapic->level_vectors, 0U, sizeof(vlapic->level_vectors));
+	}
 	vlapic_reset_tmr(vlapic);
 
 	lapic->icr_timer.v = 0U;
@@ -1980,6 +2152,41 @@ int32_t vlapic_inject_msi(struct acrn_vm *vm, uint64_t addr, uint64_t data)
 	return ret;
 }
 
+void vlapic_begin_intr_batch(struct acrn_vm *vm)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+
+	per_cpu(pi_batch_pcpus, pcpu_id) = 0UL;
+	per_cpu(pi_batch_vm, pcpu_id) = vm;
+}
+
+/*
+ * Send the notifications deferred since vlapic_begin_intr_batch(). A vCPU
+ * which takes a vector of the batch after its notification was recorded finds
+ * the outstanding-notification bit set and records none, so each pCPU is
+ * notified once even if the vCPU synced its PIR in between.
+ */
+void vlapic_end_intr_batch(void)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+	struct acrn_vm *vm = per_cpu(pi_batch_vm, pcpu_id);
+	uint64_t notify_mask = per_cpu(pi_batch_pcpus, pcpu_id);
+	uint16_t dest;
+
+	per_cpu(pi_batch_vm, pcpu_id) = NULL;
+	per_cpu(pi_batch_pcpus, pcpu_id) = 0UL;
+
+	if (vm != NULL) {
+		/* the notification vector is per VM */
+		dest = ffs64(notify_mask);
+		while (dest < MAX_PCPU_NUM) {
+			bitmap_clear_nolock(dest, &notify_mask);
+			apicv_trigger_pi_anv(dest, POSTED_INTR_VECTOR + vm->vm_id);
+			dest = ffs64(notify_mask);
+		}
+	}
+}
+
 /* interrupt context */
 static void vlapic_timer_expired(void *data)
 {
@@ -2199,6 +2406,7 @@ void vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id)
 
 	/* Set vLAPIC ID to be same as pLAPIC ID */
 	vlapic->vapic_id = per_cpu(lapic_id, pcpu_id);
+	vlapic_map_x2apic_ldr(vlapic);
 
 	dev_dbg(DBG_LEVEL_VLAPIC, "vlapic APIC ID : 0x%04x", vlapic->vapic_id);
 }
@@ -2214,6 +2422,40 @@ void vlapic_free(struct acrn_vcpu *vcpu)
 
 }
 
+/*
+ * The timer is kept in the heap of the pcpu it was added on, stop it
+ * before the vCPU leaves the pcpu so that it is never touched remotely.
+ *
+ * @pre vlapic != NULL
+ * @pre called on the pcpu the vCPU last ran on
+ */
+void vlapic_migrate_timer_out(struct acrn_vlapic *vlapic)
+{
+	struct vlapic_timer *vtimer = &vlapic->vtimer;
+
+	if (timer_is_started(&vtimer->timer)) {
+		del_timer(&vtimer->timer);
+		vtimer->migrated = true;
+	}
+}
+
+/*
+ * @pre vlapic != NULL
+ * @pre called on the new pcpu of the vCPU
+ */
+void vlapic_migrate_timer_in(struct acrn_vlapic *vlapic)
+{
+	struct vlapic_timer *vtimer = &vlapic->vtimer;
+
+	if (vtimer->migrated) {
+		vtimer->migrated = false;
+		/* an already expired timeout fires right away */
+		if (add_timer(&vtimer->timer) != 0) {
+			pr_err("%s: no room for the timer", __func__);
+		}
+	}
+}
+
 /**
  * APIC-v functions
  * @pre get_pi_desc(vlapic2vcpu(vlapic)) != NULL
@@ -2450,9 +2692,21 @@ int32_t veoi_vmexit_handler(struct acrn_vcpu *vcpu)
 	tmrptr = &lapic->tmr[0];
 	idx = vector >> 5U;
 
+	vcpu->eoi_exit_stats[vector]++;
+
 	if (bitmap32_test((uint16_t)(vector & 0x1fU), &tmrptr[idx].v)) {
 		/* hook to vIOAPIC */
 		vioapic_broadcast_eoi(vcpu->vm, vector);
+
+		/*
+		 * The RTE that raised it was re-routed, masked or made edge while
+		 * in service: stop exiting on the vector once nothing is pending.
+		 */
+		if (!vlapic_is_level_vector(vlapic, vector) &&
+				!bitmap32_test((uint16_t)(vector & 0x1fU), &lapic->irr[idx].v)) {
+			bitmap32_clear_lock((uint16_t)(vector & 0x1fU), &tmrptr[idx].v);
+			vcpu_clear_eoi_exit_bitmap(vcpu, vector);
+		}
 	}
 
 	TRACE_2L(TRACE_VMEXIT_APICV_VIRT_EOI, vector, 0UL);
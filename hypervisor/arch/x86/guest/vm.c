@@ -39,6 +39,8 @@
 #include <asm/rtcm.h>
 #include <asm/irq.h>
 #include <uart16550.h>
+#include <asm/idle.h>
+#include <asm/tsc.h>
 
 /* Local variables */
 
@@ -91,11 +93,6 @@ bool is_paused_vm(const struct acrn_vm *vm)
 	return (vm->state == VM_PAUSED);
 }
 
-bool is_sos_vm(const struct acrn_vm *vm)
-{
-	return (vm != NULL)  && (get_vm_config(vm->vm_id)->load_order == SOS_VM);
-}
-
 /**
  * @pre vm != NULL
  * @pre vm->vmid < CONFIG_MAX_VM_NUM
@@ -118,16 +115,6 @@ bool is_prelaunched_vm(const struct acrn_vm *vm)
 	return (vm_config->load_order == PRE_LAUNCHED_VM);
 }
 
-/**
- * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
- */
-bool is_lapic_pt_configured(const struct acrn_vm *vm)
-{
-	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
-
-	return ((vm_config->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) != 0U);
-}
-
 /**
  * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
  */
@@ -141,11 +128,11 @@ bool is_rt_vm(const struct acrn_vm *vm)
 /**
  * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
  */
-bool is_nvmx_configured(const struct acrn_vm *vm)
+bool is_vhpet_configured(const struct acrn_vm *vm)
 {
 	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
 
-	return ((vm_config->guest_flags & GUEST_FLAG_NVMX_ENABLED) != 0U);
+	return (is_postlaunched_vm(vm) && ((vm_config->guest_flags & GUEST_FLAG_VHPET) != 0U));
 }
 
 /**
@@ -190,6 +177,16 @@ bool vm_hide_mtrr(const struct acrn_vm *vm)
 	return ((vm_config->guest_flags & GUEST_FLAG_HIDE_MTRR) != 0U);
 }
 
+/**
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ */
+bool vm_hide_rdrand(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	return ((vm_config->guest_flags & GUEST_FLAG_HIDE_RDRAND) != 0U);
+}
+
 /**
  * @brief Initialize the I/O bitmap for \p vm
  *
@@ -290,15 +287,15 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 		}
 	}
 
-	for (i = 0U; i < MAX_MMIO_DEV_NUM; i++) {
-		(void)assign_mmio_dev(vm, &vm_config->mmiodevs[i]);
+	(void)assign_mmio_devs(vm, vm_config->mmiodevs, MAX_MMIO_DEV_NUM);
 
 #ifdef P2SB_VGPIO_DM_ENABLED
+	for (i = 0U; i < MAX_MMIO_DEV_NUM; i++) {
 		if ((vm_config->pt_p2sb_bar) && (vm_config->mmiodevs[i].base_hpa == P2SB_BAR_ADDR)) {
 			register_vgpio_handler(vm, &vm_config->mmiodevs[i]);
 		}
-#endif
 	}
+#endif
 }
 
 static void deny_pci_bar_access(struct acrn_vm *sos, const struct pci_pdev *pdev)
@@ -436,9 +433,7 @@ static void prepare_sos_vm_memmap(struct acrn_vm *vm)
 			deny_pdevs(vm, vm_config->pci_devs, vm_config->pci_dev_num);
 		}
 
-		for (i = 0U; i < MAX_MMIO_DEV_NUM; i++) {
-			(void)deassign_mmio_dev(vm, &vm_config->mmiodevs[i]);
-		}
+		(void)deassign_mmio_devs(vm, vm_config->mmiodevs, MAX_MMIO_DEV_NUM);
 	}
 
 	/* unmap AP trampoline code for security
@@ -503,16 +498,72 @@ static uint64_t lapic_pt_enabled_pcpu_bitmap(struct acrn_vm *vm)
  * @pre vm_id < CONFIG_MAX_VM_NUM && vm_config != NULL && rtn_vm != NULL
  * @pre vm->state == VM_POWERED_OFF
  */
+/*
+ * A vCPU in MWAIT keeps its pCPU until an interrupt or a write to the
+ * monitored line, so MONITOR/MWAIT are only passed through to a VM asking for
+ * it whose pCPUs host no vCPU of another VM.
+ */
+static bool is_mwait_passthru_allowed(uint16_t vm_id, uint64_t pcpu_bitmap, const struct acrn_vm_config *vm_config)
+{
+	bool ret = has_monitor_cap() && ((vm_config->guest_flags & GUEST_FLAG_MWAIT_PASSTHRU) != 0UL);
+	uint64_t mask = pcpu_bitmap;
+	uint16_t pcpu_id, i;
+
+	while (ret && (mask != 0UL)) {
+		pcpu_id = ffs64(mask);
+		bitmap_clear_nolock(pcpu_id, &mask);
+		for (i = 0U; i < CONFIG_MAX_VM_NUM; i++) {
+			if ((i != vm_id) && (per_cpu(vcpu_array, pcpu_id)[i] != NULL)) {
+				pr_warn("VM%u: pCPU%u is shared with VM%u, MWAIT is not passed through", vm_id, pcpu_id, i);
+				ret = false;
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * A VM asking for a TSC frequency of its own, e.g. the one of the host it was
+ * saved on, gets it by VMX TSC scaling; CPUID leaves 0x15, 0x16 and 0x40000010
+ * report the frequency so that the guest need not calibrate it. The TSC of a
+ * nested VM is not scaled, the multiplier of its own guests would have to be
+ * combined with it.
+ */
+static void init_vm_tsc(struct acrn_vm *vm, const struct acrn_vm_config *vm_config)
+{
+	uint32_t host_khz = get_tsc_khz();
+
+	vm->arch_vm.tsc_khz = host_khz;
+	vm->arch_vm.tsc_multiplier = 0UL;
+	if ((vm_config->tsc_khz != 0U) && (vm_config->tsc_khz != host_khz)) {
+		if (!is_tsc_scaling_supported() || ((vm_config->guest_flags & GUEST_FLAG_NVMX_ENABLED) != 0UL)) {
+			pr_warn("VM%u: TSC can't be scaled to %u kHz, it runs at %u kHz",
+				vm->vm_id, vm_config->tsc_khz, host_khz);
+		} else {
+			vm->arch_vm.tsc_khz = vm_config->tsc_khz;
+			/* (tsc_khz << 48) / host_khz */
+			vm->arch_vm.tsc_multiplier = tsc_unscale(vm_config->tsc_khz, host_khz);
+		}
+	}
+}
+
 int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *vm_config, struct acrn_vm **rtn_vm)
 {
 	struct acrn_vm *vm = NULL;
 	int32_t status = 0;
 	uint16_t pcpu_id;
 
+	/* the memory of the VM which had vm_id before must not leak into this one */
+	wait_vm_memory_scrubbed(vm_id);
+
 	/* Allocate memory for virtual machine */
 	vm = &vm_array[vm_id];
 	vm->vm_id = vm_id;
 	vm->hw.created_vcpus = 0U;
+	vm->wp_pages = 0UL;
+	vm->wp_exits = 0UL;
 
 	init_ept_pgtable(&vm->arch_vm.ept_pgtable, vm->vm_id);
 	vm->arch_vm.nworld_eptp = pgtable_create_root(&vm->arch_vm.ept_pgtable);
@@ -553,15 +604,28 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 
 	if (status == 0) {
 		prepare_epc_vm_memmap(vm);
-		spinlock_init(&vm->vlapic_mode_lock);
+		qspinlock_init(&vm->vlapic_mode_lock);
 		spinlock_init(&vm->ept_lock);
-		spinlock_init(&vm->emul_mmio_lock);
+		qspinlock_init(&vm->emul_mmio_lock);
 		spinlock_init(&vm->arch_vm.iwkey_backup_lock);
+		spinlock_init(&vm->wbinvd_lock);
+		vm->wbinvd_seq = 0U;
+		vm->vmtrr_non_wb = false;
 
 		vm->arch_vm.vlapic_mode = VM_VLAPIC_XAPIC;
-		vm->arch_vm.vm_mwait_cap = has_monitor_cap();
+		/* all INVALID_CPU_ID */
+		(void)memset(vm->arch_vm.x2apic_ldr_map, 0xFFU, sizeof(vm->arch_vm.x2apic_ldr_map));
+		vm->arch_vm.vm_mwait_cap = is_mwait_passthru_allowed(vm_id, pcpu_bitmap, vm_config);
+		init_vm_tsc(vm, vm_config);
+		init_vcr_masks(vm);
 		vm->intr_inject_delay_delta = 0UL;
+		(void)memset(&vm->intr_coalesce, 0U, sizeof(vm->intr_coalesce));
+		vm->last_boosted_vcpu = 0U;
+		vm->splitlock_count = 0UL;
+		vm->splitlock_throttled = 0UL;
 		vm->nr_emul_mmio_regions = 0U;
+		vm->nr_emul_mmio_sorted = 0U;
+		vm->emul_mmio_gen = 0U;
 		vm->vcpuid_entry_nr = 0U;
 
 		/* Set up IO bit-mask such that VM exit occurs on
@@ -579,7 +643,8 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 			vpic_init(vm);
 		}
 
-		if (is_rt_vm(vm) || !is_postlaunched_vm(vm)) {
+		if (is_rt_vm(vm) || !is_postlaunched_vm(vm) ||
+				((vm_config->guest_flags & GUEST_FLAG_VRTC) != 0UL)) {
 			vrtc_init(vm);
 		}
 
@@ -605,9 +670,15 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 		 */
 		vioapic_init(vm);
 
+		if (is_vhpet_configured(vm)) {
+			vhpet_init(vm);
+		}
+
 		/* Populate return VM handle */
 		*rtn_vm = vm;
 		vm->sw.io_shared_page = NULL;
+		vm->sw.iokick_page = NULL;
+		vm->sw.ioreq_poll_max = 0UL;
 		if ((vm_config->load_order == POST_LAUNCHED_VM) && ((vm_config->guest_flags & GUEST_FLAG_IO_COMPLETION_POLLING) != 0U)) {
 			/* enable IO completion polling mode per its guest flags in vm_config. */
 			vm->sw.is_polling_ioreq = true;
@@ -648,6 +719,10 @@ int32_t create_vm(uint16_t vm_id, uint64_t pcpu_bitmap, struct acrn_vm_config *v
 		}
 	}
 
+	if (status == 0) {
+		update_idle_policy();
+	}
+
 	if ((status != 0) && (vm->arch_vm.nworld_eptp != NULL)) {
 		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
 	}
@@ -737,6 +812,8 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 
 	deinit_legacy_vuarts(vm);
 
+	vhpet_deinit(vm);
+
 	deinit_vpci(vm);
 
 	deinit_emul_io(vm);
@@ -757,11 +834,17 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 	vm_config = get_vm_config(vm->vm_id);
 	vm_config->guest_flags &= ~DM_OWNED_GUEST_FLAG_MASK;
 
+	update_idle_policy();
+
 	if (is_ready_for_system_shutdown()) {
 		/* If no any guest running, shutdown system */
 		shutdown_system();
 	}
 
+	if (is_prelaunched_vm(vm)) {
+		scrub_vm_memory(vm);
+	}
+
 	/* Return status to caller */
 	return ret;
 }
@@ -813,6 +896,9 @@ int32_t reset_vm(struct acrn_vm *vm)
 
 	reset_vm_ioreqs(vm);
 	reset_vioapics(vm);
+	if (vm->arch_vm.vhpet.enabled) {
+		vhpet_reset(vm);
+	}
 	destroy_secure_world(vm, false);
 	vm->sworld_control.flag.active = 0UL;
 	vm->arch_vm.iwkey_backup_status = 0UL;
@@ -882,7 +968,8 @@ void resume_vm_from_s3(struct acrn_vm *vm, uint32_t wakeup_vec)
 	launch_vcpu(bsp);
 }
 
-static uint8_t loaded_pre_vm_nr = 0U;
+/* incremented by the BSPs of the pre-launched VMs, which load them in parallel */
+static uint32_t loaded_pre_vm_nr = 0U;
 /**
  * Prepare to create vm/vcpu for vm
  *
@@ -911,7 +998,7 @@ void prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config)
 			 */
 			uint64_t start_tick = cpu_ticks();
 
-			while (loaded_pre_vm_nr != PRE_VM_NUM) {
+			while (*(volatile uint32_t *)&loaded_pre_vm_nr != PRE_VM_NUM) {
 				uint64_t timeout = ticks_to_ms(cpu_ticks() - start_tick);
 
 				if (timeout > 10000U) {
@@ -924,7 +1011,7 @@ void prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config)
 		err = vm_sw_loader(vm);
 
 		if (is_prelaunched_vm(vm)) {
-			loaded_pre_vm_nr++;
+			atomic_inc32(&loaded_pre_vm_nr);
 		}
 
 		if (err == 0) {
@@ -943,6 +1030,10 @@ void prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config)
  * @pre vm_config != NULL
  * @Application constraint: The validity of vm_config->cpu_affinity should be guaranteed before run-time.
  */
+/*
+ * Each pCPU prepares the VMs it is the BSP of, the VMs being prepared in
+ * parallel, and helps the BSP copy the images of the VM it is an AP of.
+ */
 void launch_vms(uint16_t pcpu_id)
 {
 	uint16_t vm_id;
@@ -956,6 +1047,11 @@ void launch_vms(uint16_t pcpu_id)
 					sos_vm_ptr = &vm_array[vm_id];
 				}
 				prepare_vm(vm_id, vm_config);
+				end_sw_loading(vm_id);
+			} else if (bitmap_test(pcpu_id, &vm_config->cpu_affinity)) {
+				assist_sw_loading(vm_id);
+			} else {
+				/* not a pCPU of this VM */
 			}
 		}
 	}
@@ -988,7 +1084,7 @@ void update_vm_vlapic_state(struct acrn_vm *vm)
 
 	vcpus_in_x2apic = 0U;
 	vcpus_in_xapic = 0U;
-	spinlock_obtain(&vm->vlapic_mode_lock);
+	qspinlock_obtain(&vm->vlapic_mode_lock);
 	foreach_vcpu(i, vm, vcpu) {
 		/* Skip vCPU in state outside of VCPU_RUNNING as it may be offline. */
 		if (vcpu->state == VCPU_RUNNING) {
@@ -1031,7 +1127,7 @@ void update_vm_vlapic_state(struct acrn_vm *vm)
 	}
 
 	vm->arch_vm.vlapic_mode = vlapic_mode;
-	spinlock_release(&vm->vlapic_mode_lock);
+	qspinlock_release(&vm->vlapic_mode_lock);
 }
 
 /*
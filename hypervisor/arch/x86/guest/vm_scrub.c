@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <rtl.h>
+#include <asm/lib/atomic.h>
+#include <asm/lib/bits.h>
+#include <asm/cpu.h>
+#include <asm/per_cpu.h>
+#include <asm/pgtable.h>
+#include <asm/lapic.h>
+#include <asm/irq.h>
+#include <asm/vm_config.h>
+#include <asm/guest/vm.h>
+#include <schedule.h>
+
+/*
+ * The memory of a pre-launched VM is scrubbed once the VM is shut down, by
+ * the pCPUs it ran on: they are idle from then on, and claim 2M chunks of the
+ * memory from their idle loop until all are cleared. The shutdown does not
+ * wait for it, a VM created with the same ID does.
+ */
+#define SCRUB_CHUNK_SIZE	MEM_2M
+
+struct vm_scrub_job {
+	uint64_t next;		/* next chunk to claim */
+	uint64_t done;		/* chunks cleared */
+	uint64_t nr;		/* chunks to clear, 0 if there is no job */
+	uint64_t nr_hpa1;	/* chunks in the first HPA range, the others are in the second */
+	uint64_t hpa1;
+	uint64_t hpa2;
+};
+
+static struct vm_scrub_job scrub_jobs[CONFIG_MAX_VM_NUM];
+
+static void make_scrub_mem_request(uint16_t pcpu_id)
+{
+	bitmap_set_lock(NEED_SCRUB_MEM, &per_cpu(pcpu_flag, pcpu_id));
+	if (get_pcpu_id() != pcpu_id) {
+		send_single_ipi(pcpu_id, NOTIFY_VCPU_VECTOR);
+	}
+}
+
+bool need_scrub_mem(uint16_t pcpu_id)
+{
+	return bitmap_test_and_clear_lock(NEED_SCRUB_MEM, &per_cpu(pcpu_flag, pcpu_id));
+}
+
+/*
+ * Return true if a chunk was claimed and cleared.
+ */
+static bool scrub_one_chunk(struct vm_scrub_job *job)
+{
+	uint64_t idx, hpa;
+	bool claimed = false;
+
+	idx = *(volatile uint64_t *)&job->next;
+	if ((idx < job->nr) && (atomic_cmpxchg64(&job->next, idx, idx + 1UL) == idx)) {
+		if (idx < job->nr_hpa1) {
+			hpa = job->hpa1 + (idx * SCRUB_CHUNK_SIZE);
+		} else {
+			hpa = job->hpa2 + ((idx - job->nr_hpa1) * SCRUB_CHUNK_SIZE);
+		}
+		(void)memset_nt(hpa2hva(hpa), 0U, SCRUB_CHUNK_SIZE);
+		atomic_inc64(&job->done);
+		claimed = true;
+	}
+
+	return claimed;
+}
+
+/*
+ * @pre vm != NULL && is_prelaunched_vm(vm)
+ * @pre the vCPUs of vm are offline
+ */
+void scrub_vm_memory(const struct acrn_vm *vm)
+{
+	struct vm_scrub_job *job = &scrub_jobs[vm->vm_id];
+	const struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+	uint64_t pcpus = vm->hw.cpu_affinity & get_active_pcpu_bitmap();
+	uint16_t pcpu_id;
+
+	job->hpa1 = vm_config->memory.start_hpa;
+	job->nr_hpa1 = vm_config->memory.size / SCRUB_CHUNK_SIZE;
+	job->hpa2 = vm_config->memory.start_hpa2;
+	job->done = 0UL;
+	job->next = 0UL;
+	/* the helpers read the job once they see nr */
+	cpu_write_memory_barrier();
+	job->nr = job->nr_hpa1 + (vm_config->memory.size_hpa2 / SCRUB_CHUNK_SIZE);
+
+	/* with no pCPU left, the next create_vm() of vm_id does it all */
+	for (pcpu_id = ffs64(pcpus); pcpu_id < MAX_PCPU_NUM; pcpu_id = ffs64(pcpus)) {
+		make_scrub_mem_request(pcpu_id);
+		bitmap_clear_nolock(pcpu_id, &pcpus);
+	}
+}
+
+/*
+ * Run from the idle loop on a scrub request, give the pCPU back as soon as a
+ * thread needs it and carry on later.
+ */
+void scrub_mem_from_idle(uint16_t pcpu_id)
+{
+	uint16_t vm_id;
+	struct vm_scrub_job *job;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		job = &scrub_jobs[vm_id];
+		while (scrub_one_chunk(job)) {
+			if (need_reschedule(pcpu_id)) {
+				make_scrub_mem_request(pcpu_id);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Wait for the memory of the VM which had vm_id before to be scrubbed.
+ */
+void wait_vm_memory_scrubbed(uint16_t vm_id)
+{
+	struct vm_scrub_job *job = &scrub_jobs[vm_id];
+
+	if (job->nr != 0UL) {
+		/* help rather than wait, the VM's pCPUs may have gone */
+		while (scrub_one_chunk(job)) {
+		}
+		wait_sync_change(&job->done, job->nr);
+		job->nr = 0UL;
+	}
+}
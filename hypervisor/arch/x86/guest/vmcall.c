@@ -37,6 +37,10 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_set_callback_vector},
 	[HC_IDX(HC_GET_PLATFORM_INFO)] = {
 		.handler = hcall_get_platform_info},
+	[HC_IDX(HC_GET_PCPU_STATS)] = {
+		.handler = hcall_get_pcpu_stats},
+	[HC_IDX(HC_GET_RT_LATENCY)] = {
+		.handler = hcall_get_rt_latency},
 	[HC_IDX(HC_CREATE_VM)] = {
 		.handler = hcall_create_vm},
 	[HC_IDX(HC_DESTROY_VM)] = {
@@ -51,20 +55,52 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_set_vcpu_regs},
 	[HC_IDX(HC_CREATE_VCPU)] = {
 		.handler = hcall_create_vcpu},
+	[HC_IDX(HC_VM_RDT_CLOS)] = {
+		.handler = hcall_vm_rdt_clos},
+	[HC_IDX(HC_SET_VCPU_PV_STATE)] = {
+		.handler = hcall_set_vcpu_pv_state,
+		.permission_flags = GUEST_FLAG_PV_STEAL_TIME},
 	[HC_IDX(HC_SET_IRQLINE)] = {
 		.handler = hcall_set_irqline},
 	[HC_IDX(HC_INJECT_MSI)] = {
 		.handler = hcall_inject_msi},
+	[HC_IDX(HC_INJECT_MSI_BATCH)] = {
+		.handler = hcall_inject_msi_batch},
+	[HC_IDX(HC_INJECT_INTR_BATCH)] = {
+		.handler = hcall_inject_intr_batch},
+	[HC_IDX(HC_SEND_IPI)] = {
+		.handler = hcall_send_ipi,
+		.permission_flags = GUEST_FLAG_PV_IPI},
 	[HC_IDX(HC_SET_IOREQ_BUFFER)] = {
 		.handler = hcall_set_ioreq_buffer},
 	[HC_IDX(HC_NOTIFY_REQUEST_FINISH)] = {
 		.handler = hcall_notify_ioreq_finish},
+	[HC_IDX(HC_SET_POSTED_IO_RANGE)] = {
+		.handler = hcall_set_posted_io_range},
+	[HC_IDX(HC_SET_IOKICK_BUFFER)] = {
+		.handler = hcall_set_iokick_buffer},
+	[HC_IDX(HC_SET_IOKICK)] = {
+		.handler = hcall_set_iokick},
+	[HC_IDX(HC_SET_IOREQ_POLL)] = {
+		.handler = hcall_set_ioreq_poll},
+	[HC_IDX(HC_SET_PIO_REGION)] = {
+		.handler = hcall_set_pio_region},
+	[HC_IDX(HC_SET_INTX_RESAMPLE)] = {
+		.handler = hcall_set_intx_resample},
 	[HC_IDX(HC_VM_SET_MEMORY_REGIONS)] = {
 		.handler = hcall_set_vm_memory_regions},
 	[HC_IDX(HC_VM_WRITE_PROTECT_PAGE)] = {
 		.handler = hcall_write_protect_page},
+	[HC_IDX(HC_VM_WRITE_PROTECT_PAGES)] = {
+		.handler = hcall_write_protect_pages},
+	[HC_IDX(HC_VM_DIRTY_LOG)] = {
+		.handler = hcall_vm_dirty_log},
+	[HC_IDX(HC_VM_RECLAIM_MEMORY)] = {
+		.handler = hcall_vm_reclaim_memory},
 	[HC_IDX(HC_VM_GPA2HPA)] = {
 		.handler = hcall_gpa_to_hpa},
+	[HC_IDX(HC_VM_GPA2HPA_BATCH)] = {
+		.handler = hcall_gpa_to_hpa_batch},
 	[HC_IDX(HC_ASSIGN_PCIDEV)] = {
 		.handler = hcall_assign_pcidev},
 	[HC_IDX(HC_DEASSIGN_PCIDEV)] = {
@@ -73,6 +109,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_assign_mmiodev},
 	[HC_IDX(HC_DEASSIGN_MMIODEV)] = {
 		.handler = hcall_deassign_mmiodev},
+	[HC_IDX(HC_ASSIGN_MMIODEVS)] = {
+		.handler = hcall_assign_mmiodevs},
 	[HC_IDX(HC_ADD_VDEV)] = {
 		.handler = hcall_add_vdev},
 	[HC_IDX(HC_REMOVE_VDEV)] = {
@@ -93,6 +131,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_profiling_ops},
 	[HC_IDX(HC_GET_HW_INFO)] = {
 		.handler = hcall_get_hw_info},
+	[HC_IDX(HC_GET_VMEXIT_STATS)] = {
+		.handler = hcall_get_vmexit_stats},
 	[HC_IDX(HC_INITIALIZE_TRUSTY)] = {
 		.handler = hcall_initialize_trusty,
 		.permission_flags = GUEST_FLAG_SECURE_WORLD_ENABLED},
@@ -104,7 +144,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.permission_flags = GUEST_FLAG_SECURE_WORLD_ENABLED},
 };
 
-#define GUEST_FLAGS_ALLOWING_HYPERCALLS GUEST_FLAG_SECURE_WORLD_ENABLED
+#define GUEST_FLAGS_ALLOWING_HYPERCALLS (GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_PV_IPI | \
+		GUEST_FLAG_PV_TLB_FLUSH | GUEST_FLAG_PV_STEAL_TIME)
 
 struct acrn_vm *parse_target_vm(struct acrn_vm *sos_vm, uint64_t hcall_id, uint64_t param1, __unused uint64_t param2)
 {
@@ -135,6 +176,8 @@ struct acrn_vm *parse_target_vm(struct acrn_vm *sos_vm, uint64_t hcall_id, uint6
 	case HC_SOS_OFFLINE_CPU:
 	case HC_SET_CALLBACK_VECTOR:
 	case HC_GET_PLATFORM_INFO:
+	case HC_GET_PCPU_STATS:
+	case HC_GET_RT_LATENCY:
 	case HC_SETUP_SBUF:
 	case HC_SETUP_HV_NPK_LOG:
 	case HC_PROFILING_OPS:
@@ -199,10 +242,8 @@ static int32_t dispatch_hypercall(struct acrn_vcpu *vcpu)
 
 /*
  * Pass return value to SOS by register rax.
- * This function should always return 0 since we shouldn't
- * deal with hypercall error in hypervisor.
  */
-int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
+static void handle_acrn_hypercall(struct acrn_vcpu *vcpu)
 {
 	int32_t ret;
 	struct acrn_vm *vm = vcpu->vm;
@@ -238,6 +279,24 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		pr_err("ret=%d hypercall=0x%lx failed in %s\n", ret, hypcall_id, __func__);
 	}
 	TRACE_2L(TRACE_VMEXIT_VMCALL, vm->vm_id, hypcall_id);
+}
+
+/*
+ * This function should always return 0 since we shouldn't
+ * deal with hypercall error in hypervisor.
+ */
+int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+#ifdef CONFIG_HYPERV_ENABLED
+	/* the VM set up the Hyper-V hypercall page for its vmcalls */
+	if (hyperv_is_hypercall(vcpu)) {
+		hyperv_hypercall(vcpu);
+	} else {
+		handle_acrn_hypercall(vcpu);
+	}
+#else
+	handle_acrn_hypercall(vcpu);
+#endif
 
 	return 0;
 }
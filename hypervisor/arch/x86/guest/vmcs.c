@@ -261,6 +261,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	uint32_t value32;
 	uint64_t value64;
 	struct acrn_vm *vm = vcpu->vm;
+	const struct acrn_vm_config *vm_config;
 
 	/* Log messages to show initializing VMX execution controls */
 	pr_dbg("Initialize execution control ");
@@ -275,6 +276,11 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 		value32 |= VMX_PINBASED_CTLS_POST_IRQ;
 	}
 
+	/* the VMX preemption timer ends the scheduling slices, armed on each VM entry */
+	if (sched_use_preemption_timer()) {
+		value32 |= VMX_PINBASED_CTLS_ENABLE_PTMR;
+	}
+
 	exec_vmwrite32(VMX_PIN_VM_EXEC_CONTROLS, value32);
 	pr_dbg("VMX_PIN_VM_EXEC_CONTROLS: 0x%x ", value32);
 
@@ -308,6 +314,14 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	 * Enable VM_EXIT for rdpmc execution.
 	 */
 	value32 |= VMX_PROCBASED_CTLS_RDPMC;
+
+	/*
+	 * MONITOR/MWAIT run natively in the VMs they are passed through to,
+	 * the other VMs don't see them in CPUID and get #UD.
+	 */
+	if (!vcpu->vm->arch_vm.vm_mwait_cap) {
+		value32 |= VMX_PROCBASED_CTLS_MWAIT | VMX_PROCBASED_CTLS_MONITOR;
+	}
 	vcpu->arch.proc_vm_exec_ctrls = value32;
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS: 0x%x ", value32);
@@ -352,6 +366,19 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 
 	value32 |= VMX_PROCBASED_CTLS2_WBINVD;
 
+	/* the VMs RDRAND/RDSEED are hidden from get #UD for them, as for MONITOR/MWAIT */
+	if (vm_hide_rdrand(vm)) {
+		value32 |= check_vmx_ctrl(MSR_IA32_VMX_PROCBASED_CTLS2,
+				VMX_PROCBASED_CTLS2_RDRAND | VMX_PROCBASED_CTLS2_RDSEED) &
+				(VMX_PROCBASED_CTLS2_RDRAND | VMX_PROCBASED_CTLS2_RDSEED);
+	}
+
+	/* checked by init_vm_tsc(), the multiplier also applies to RDMSR of IA32_TIME_STAMP_COUNTER */
+	if (vm->arch_vm.tsc_multiplier != 0UL) {
+		value32 |= VMX_PROCBASED_CTLS2_TSC_SCALING;
+		exec_vmwrite64(VMX_TSC_MULTIPLIER_FULL, vm->arch_vm.tsc_multiplier);
+	}
+
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS2: 0x%x ", value32);
 
@@ -394,6 +421,15 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	exec_vmwrite64(VMX_EPT_POINTER_FULL, value64);
 	pr_dbg("VMX_EPT_POINTER: 0x%016lx ", value64);
 
+	if (is_pml_supported()) {
+		exec_vmwrite64(VMX_PML_ADDR_FULL, hva2hpa(vcpu->arch.pml_log));
+	}
+	/* The VMCS may be re-initialized while the VM is dirty logging */
+	vcpu->arch.pml_armed = false;
+	if (vm->arch_vm.dirty_log.enabled) {
+		update_dirty_log_ctrl(vcpu);
+	}
+
 	/* Set up guest exception mask bitmap setting a bit * causes a VM exit
 	 * on corresponding guest * exception - pg 2902 24.6.3
 	 * enable VM exit on MC always
@@ -449,7 +485,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	/* Natural-width */
 	pr_dbg("Natural-width*********");
 
-	init_cr0_cr4_host_guest_mask();
+	init_cr0_cr4_host_guest_mask(vcpu->vm);
 
 	/* The CR3 target registers work in concert with VMX_CR3_TARGET_COUNT
 	 * field. Using these registers guest CR3 access can be managed. i.e.,
@@ -462,8 +498,9 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	exec_vmwrite(VMX_CR3_TARGET_3, 0UL);
 
 	/* Setup PAUSE-loop exiting - 24.6.13 */
-	exec_vmwrite(VMX_PLE_GAP, 128U);
-	exec_vmwrite(VMX_PLE_WINDOW, 4096U);
+	vm_config = get_vm_config(vm->vm_id);
+	exec_vmwrite(VMX_PLE_GAP, (vm_config->ple_gap != 0U) ? vm_config->ple_gap : 128U);
+	exec_vmwrite(VMX_PLE_WINDOW, (vm_config->ple_window != 0U) ? vm_config->ple_window : 4096U);
 }
 
 static void init_entry_ctrl(const struct acrn_vcpu *vcpu)
@@ -484,6 +521,11 @@ static void init_entry_ctrl(const struct acrn_vcpu *vcpu)
 		value32 |= (VMX_ENTRY_CTLS_IA32E_MODE);
 	}
 
+	/* vPMU: the guest IA32_PERF_GLOBAL_CTRL starts its counters */
+	if (is_vpmu_configured(vcpu->vm)) {
+		value32 |= VMX_ENTRY_CTLS_LOAD_PERF;
+	}
+
 	value32 = check_vmx_ctrl(MSR_IA32_VMX_ENTRY_CTLS, value32);
 
 	exec_vmwrite32(VMX_ENTRY_CONTROLS, value32);
@@ -520,10 +562,16 @@ static void init_exit_ctrl(const struct acrn_vcpu *vcpu)
 	 * Enable saving and loading of IA32_PAT and IA32_EFER on VMEXIT Enable
 	 * saving of pre-emption timer on VMEXIT
 	 */
-	value32 = check_vmx_ctrl(MSR_IA32_VMX_EXIT_CTLS,
-			 VMX_EXIT_CTLS_ACK_IRQ | VMX_EXIT_CTLS_SAVE_PAT |
+	value32 = VMX_EXIT_CTLS_ACK_IRQ | VMX_EXIT_CTLS_SAVE_PAT |
 			 VMX_EXIT_CTLS_LOAD_PAT | VMX_EXIT_CTLS_LOAD_EFER |
-			 VMX_EXIT_CTLS_SAVE_EFER | VMX_EXIT_CTLS_HOST_ADDR64);
+			 VMX_EXIT_CTLS_SAVE_EFER | VMX_EXIT_CTLS_HOST_ADDR64;
+
+	/* vPMU: the host IA32_PERF_GLOBAL_CTRL stops the guest counters */
+	if (is_vpmu_configured(vcpu->vm)) {
+		value32 |= VMX_EXIT_CTLS_LOAD_PERF;
+	}
+
+	value32 = check_vmx_ctrl(MSR_IA32_VMX_EXIT_CTLS, value32);
 
 	exec_vmwrite32(VMX_EXIT_CONTROLS, value32);
 	pr_dbg("VMX_EXIT_CONTROL: 0x%x ", value32);
@@ -580,9 +628,45 @@ void load_vmcs(const struct acrn_vcpu *vcpu)
 	if (vcpu->launched && (*vmcs_ptr != (void *)vcpu->arch.vmcs)) {
 		load_va_vmcs(vcpu->arch.vmcs);
 		*vmcs_ptr = (void *)vcpu->arch.vmcs;
+		/* TR, GDTR, IDTR... of the host state belong to the previous pcpu */
+		if (vcpu->arch.vmcs_migrated) {
+			init_host_state();
+		}
 	}
 }
 
+/**
+ * @brief Apply the dirty logging state of the VM to the VMCS of the vcpu
+ *
+ * The A/D flags of the EPT are enabled while the VM is dirty logging,
+ * along with Page Modification Logging if the processor supports it.
+ *
+ * @pre vcpu != NULL
+ * @pre vcpu is running on its pcpu, with its VMCS loaded
+ */
+void update_dirty_log_ctrl(struct acrn_vcpu *vcpu)
+{
+	const struct vm_dirty_log *log = &vcpu->vm->arch_vm.dirty_log;
+	uint64_t eptp = hva2hpa(vcpu->vm->arch_vm.nworld_eptp) | (3UL << 3U) | 6UL;
+	uint32_t value32 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS2);
+
+	if (log->enabled) {
+		eptp |= VMX_EPTP_AD_ENABLE;
+	}
+
+	if (log->use_pml) {
+		exec_vmwrite16(VMX_GUEST_PML_INDEX, (uint16_t)(PML_ENTITY_NUM - 1U));
+		value32 |= VMX_PROCBASED_CTLS2_PML;
+	} else {
+		value32 &= ~VMX_PROCBASED_CTLS2_PML;
+	}
+
+	exec_vmwrite64(VMX_EPT_POINTER_FULL, eptp);
+	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
+	vcpu->arch.pml_armed = log->use_pml;
+	pr_dbg("%s: VMX_EPT_POINTER: 0x%016lx VMX_PROC_VM_EXEC_CONTROLS2: 0x%x", __func__, eptp, value32);
+}
+
 void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu)
 {
 	uint32_t value32;
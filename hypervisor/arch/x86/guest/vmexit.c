@@ -25,19 +25,22 @@
 
 /*
  * According to "SDM APPENDIX C VMX BASIC EXIT REASONS",
- * there are 65 Basic Exit Reasons.
+ * there are 65 Basic Exit Reasons. Keep the dispatch table in line with the
+ * exit reasons reported by HC_GET_VMEXIT_STATS.
  */
-#define NR_VMX_EXIT_REASONS	70U
+#define NR_VMX_EXIT_REASONS	VMEXIT_STATS_NR_REASONS
 
 static int32_t triple_fault_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t xsetbv_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t wbinvd_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t undefined_vmexit_handler(struct acrn_vcpu *vcpu);
-static int32_t pause_vmexit_handler(__unused struct acrn_vcpu *vcpu);
+static int32_t pause_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t hlt_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t mtf_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t loadiwkey_vmexit_handler(struct acrn_vcpu *vcpu);
+static int32_t pml_full_vmexit_handler(struct acrn_vcpu *vcpu);
+static int32_t preemption_timer_vmexit_handler(struct acrn_vcpu *vcpu);
 
 /* VM Dispatch table for Exit condition handling */
 static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
@@ -149,11 +152,11 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_ENTRY_FAILURE_MSR_LOADING] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_MWAIT] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = undefined_vmexit_handler},
 	[VMX_EXIT_REASON_MONITOR_TRAP] = {
 		.handler = mtf_vmexit_handler},
 	[VMX_EXIT_REASON_MONITOR] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = undefined_vmexit_handler},
 	[VMX_EXIT_REASON_PAUSE] = {
 		.handler = pause_vmexit_handler},
 	[VMX_EXIT_REASON_ENTRY_FAILURE_MACHINE_CHECK] = {
@@ -179,7 +182,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_RDTSCP] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_VMX_PREEMPTION_TIMER_EXPIRED] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = preemption_timer_vmexit_handler},
 	[VMX_EXIT_REASON_WBINVD] = {
 		.handler = wbinvd_vmexit_handler},
 	[VMX_EXIT_REASON_XSETBV] = {
@@ -188,7 +191,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 		.handler = apic_write_vmexit_handler,
 		.need_exit_qualification = 1},
 	[VMX_EXIT_REASON_RDRAND] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = undefined_vmexit_handler},
 	[VMX_EXIT_REASON_INVPCID] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_VMFUNC] = {
@@ -196,9 +199,9 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_ENCLS] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_RDSEED] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = undefined_vmexit_handler},
 	[VMX_EXIT_REASON_PAGE_MODIFICATION_LOG_FULL] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = pml_full_vmexit_handler},
 	[VMX_EXIT_REASON_XSAVES] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_XRSTORS] = {
@@ -207,16 +210,47 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 		.handler = loadiwkey_vmexit_handler}
 };
 
+/*
+ * Account one exit of basic_exit_reason whose handler took delta TSC cycles.
+ * Only the vCPU's own pCPU updates the statistics, readers may see them torn
+ * across reasons, which is acceptable for a debug aid.
+ */
+static void account_vmexit(struct acrn_vcpu *vcpu, uint16_t basic_exit_reason, uint64_t delta)
+{
+	struct acrn_vmexit_stats *stats = &vcpu->exit_stats;
+	uint64_t scaled = delta >> VMEXIT_STATS_BUCKET_SHIFT;
+	uint32_t bucket = 0U;
+
+	if (scaled != 0UL) {
+		bucket = min((uint32_t)fls64(scaled) + 1U, VMEXIT_STATS_NR_BUCKETS - 1U);
+	}
+
+	stats->count[basic_exit_reason]++;
+	stats->cycles[basic_exit_reason] += delta;
+	stats->hist[basic_exit_reason][bucket]++;
+
+	per_cpu(stats, pcpuid_from_vcpu(vcpu)).vmexits[basic_exit_reason]++;
+}
+
 int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	struct vm_exit_dispatch *dispatch = NULL;
 	uint16_t basic_exit_reason;
+	uint64_t start;
 	int32_t ret;
 
+#ifdef CONFIG_SPLITLOCK_NATIVE_STEP
+	/* the split-lock detection is only off from the VM entry stepping a split lock to the next VM exit */
+	if (vcpu->arch.emulating_lock) {
+		vcpu->arch.emulating_lock = false;
+		vcpu_complete_splitlock_emulation(vcpu);
+	}
+#endif
+
 	if (get_pcpu_id() != pcpuid_from_vcpu(vcpu)) {
 		pr_fatal("vcpu is not running on its pcpu!");
 		ret = -EINVAL;
-	} else if (is_vcpu_in_l2_guest(vcpu)) {
+	} else if ((MAX_NVMX_VM_NUM != 0U) && is_vcpu_in_l2_guest(vcpu)) {
 		ret = nested_vmexit_handler(vcpu);
 	} else {
 		/* Obtain interrupt info */
@@ -275,6 +309,7 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 			}
 
 			/* exit dispatch handling */
+			start = cpu_ticks();
 			if (basic_exit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) {
 				/* Handling external_interrupt should disable intr */
 				if (!is_lapic_pt_enabled(vcpu)) {
@@ -289,6 +324,7 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 			} else {
 				ret = dispatch->handler(vcpu);
 			}
+			account_vmexit(vcpu, basic_exit_reason, cpu_ticks() - start);
 		}
 	}
 
@@ -310,6 +346,14 @@ static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
+/* The log has been drained after the VM exit by vcpu_thread(), the guest access is retried */
+static int32_t pml_full_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	vcpu_retain_rip(vcpu);
+
+	return 0;
+}
+
 /* MTF is currently only used for split-lock emulation */
 static int32_t mtf_vmexit_handler(struct acrn_vcpu *vcpu)
 {
@@ -335,16 +379,106 @@ static int32_t triple_fault_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
-static int32_t pause_vmexit_handler(__unused struct acrn_vcpu *vcpu)
+/*
+ * A PAUSE-loop exit means the vCPU spins on a lock, likely held by a sibling
+ * vCPU that is preempted on its pCPU. Boost the next runnable sibling, in
+ * round robin so that all of them get a chance, then yield this pCPU.
+ */
+static int32_t pause_vmexit_handler(struct acrn_vcpu *vcpu)
 {
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vcpu *target;
+	uint16_t i, vcpu_id;
+
+	for (i = 1U; i <= vm->hw.created_vcpus; i++) {
+		vcpu_id = (vm->last_boosted_vcpu + i) % vm->hw.created_vcpus;
+		target = vcpu_from_vid(vm, vcpu_id);
+		if ((target != vcpu) && (target->state == VCPU_RUNNING) && boost_thread(&target->thread_obj)) {
+			vm->last_boosted_vcpu = vcpu_id;
+			break;
+		}
+	}
+
 	yield_current();
 	return 0;
 }
 
+/* The slice of the vCPU may have ended, see sched_use_preemption_timer() */
+static int32_t preemption_timer_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	sched_check_slice_end(pcpuid_from_vcpu(vcpu));
+	vcpu_retain_rip(vcpu);
+	return 0;
+}
+
+/* first window tried once blocking showed that polling would have paid off */
+#define HALT_POLL_START_US	10U
+
+static bool has_wakeup_event(struct acrn_vcpu *vcpu)
+{
+	return ((vcpu->arch.pending_req != 0UL) || vlapic_has_pending_intr(vcpu) ||
+		bitmap_test(POSTED_INTR_ON, &(get_pi_desc(vcpu)->control.value)));
+}
+
+/*
+ * Poll for a wakeup event for up to the current halt-poll window, as long
+ * as no other thread wants this pCPU.
+ *
+ * return true if an event arrived in time
+ */
+static bool halt_poll(struct acrn_vcpu *vcpu)
+{
+	uint64_t start = cpu_ticks();
+	bool woken = false;
+
+	if (vcpu->halt_poll_window != 0UL) {
+		while (((cpu_ticks() - start) < vcpu->halt_poll_window) &&
+				!need_reschedule(pcpuid_from_vcpu(vcpu))) {
+			if (has_wakeup_event(vcpu)) {
+				woken = true;
+				break;
+			}
+			asm_pause();
+		}
+
+		if (woken) {
+			vcpu->halt_poll_success++;
+		} else {
+			vcpu->halt_poll_fail++;
+		}
+	}
+
+	return woken;
+}
+
+/*
+ * Grow the window if the vCPU was woken up within the max window after it
+ * blocked, i.e. a longer poll would have caught the event; shrink it if it
+ * slept longer than that.
+ */
+static void halt_poll_adjust(struct acrn_vcpu *vcpu, uint64_t blocked)
+{
+	uint64_t max = us_to_ticks(get_vm_config(vcpu->vm->vm_id)->halt_poll_us);
+
+	if (blocked <= max) {
+		if (vcpu->halt_poll_window == 0UL) {
+			vcpu->halt_poll_window = min(us_to_ticks(HALT_POLL_START_US), max);
+		} else {
+			vcpu->halt_poll_window = min(vcpu->halt_poll_window << 1U, max);
+		}
+	} else {
+		vcpu->halt_poll_window >>= 1U;
+	}
+}
+
 static int32_t hlt_vmexit_handler(struct acrn_vcpu *vcpu)
 {
-	if ((vcpu->arch.pending_req == 0UL) && (!vlapic_has_pending_intr(vcpu))) {
+	uint64_t start;
+
+	if (!has_wakeup_event(vcpu) && !halt_poll(vcpu)) {
+		start = cpu_ticks();
 		wait_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+		halt_poll_adjust(vcpu, cpu_ticks() - start);
 	}
 	return 0;
 }
@@ -435,34 +569,65 @@ static int32_t xsetbv_vmexit_handler(struct acrn_vcpu *vcpu)
 	return ret;
 }
 
-static int32_t wbinvd_vmexit_handler(struct acrn_vcpu *vcpu)
+static void flush_vm_cache(struct acrn_vcpu *vcpu)
 {
 	uint16_t i;
 	struct acrn_vcpu *other;
+	struct acrn_vm *vm = vcpu->vm;
 
 	/* GUEST_FLAG_RT has not set in post-launched RTVM before it has been created */
-	if ((!is_software_sram_enabled()) && (!has_rt_vm())) {
+	if ((!is_software_sram_enabled()) && (!has_rt_vm()) &&
+			((get_vm_config(vm->vm_id)->guest_flags & GUEST_FLAG_WBINVD_RANGE) == 0UL)) {
 		flush_invalidate_all_cache();
 	} else {
-		if (is_rt_vm(vcpu->vm)) {
-			walk_ept_table(vcpu->vm, ept_flush_leaf_page);
+		if (is_rt_vm(vm)) {
+			walk_ept_table(vm, ept_flush_leaf_page);
 		} else {
 			/* Pause other vcpus and let them wait for the wbinvd completion */
-			foreach_vcpu(i, vcpu->vm, other) {
+			foreach_vcpu(i, vm, other) {
 				if (other != vcpu) {
 					vcpu_make_request(other, ACRN_REQUEST_WAIT_WBINVD);
 				}
 			}
 
-			walk_ept_table(vcpu->vm, ept_flush_leaf_page);
+			walk_ept_table(vm, ept_flush_leaf_page);
 
-			foreach_vcpu(i, vcpu->vm, other) {
+			foreach_vcpu(i, vm, other) {
 				if (other != vcpu) {
 					signal_event(&other->events[VCPU_EVENT_SYNC_WBINVD]);
 				}
 			}
 		}
 	}
+}
+
+/*
+ * Only the devices passed through to a VM may access its memory without
+ * snooping the caches, and only its vMTRRs may map its memory with another
+ * type than WB: a VM with neither gets nothing from a flush.
+ *
+ * The WBINVDs of several vCPUs of a VM are served by one flush, as long as it
+ * started after the last of them: a guest typically flushes on all its vCPUs
+ * at once when it changes its MTRRs, which would otherwise be as many
+ * flushes in a row.
+ */
+static int32_t wbinvd_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint32_t target;
+
+	if (vpci_has_ptdev(&vm->vpci) || vm->vmtrr_non_wb) {
+		/* wbinvd_seq once a flush starting after this WBINVD is complete */
+		target = (*(volatile uint32_t *)&vm->wbinvd_seq + 3U) & ~1U;
+
+		spinlock_obtain(&vm->wbinvd_lock);
+		if ((vm->wbinvd_seq - target) >= 0x80000000U) {
+			vm->wbinvd_seq++;
+			flush_vm_cache(vcpu);
+			vm->wbinvd_seq++;
+		}
+		spinlock_release(&vm->wbinvd_lock);
+	}
 
 	return 0;
 }
@@ -496,6 +661,7 @@ static int32_t loadiwkey_vmexit_handler(struct acrn_vcpu *vcpu)
 /*
  * vmexit handler for just injecting a #UD exception
  * ACRN doesn't enable VMFUNC, VMFUNC treated as undefined.
+ * MONITOR/MWAIT only exit in the VMs whose CPUID hides them.
  */
 static int32_t undefined_vmexit_handler(struct acrn_vcpu *vcpu)
 {
@@ -17,6 +17,7 @@
 #include <asm/guest/guest_pm.h>
 #include <asm/guest/ucode.h>
 #include <asm/guest/nested.h>
+#include <asm/guest/vpmu.h>
 #include <asm/cpufeatures.h>
 #include <asm/rdt.h>
 #include <asm/tsc.h>
@@ -243,13 +244,39 @@ static const uint32_t unsupported_msrs[NUM_UNSUPPORTED_MSRS] = {
 	MSR_IA32_INTERRUPT_SSP_TABLE_ADDR,
 };
 
+/* indexes of emulated_guest_msrs[] sorted by the MSR, for the binary search of vmsr_get_guest_msr_index() */
+static uint32_t sorted_guest_msrs[NUM_GUEST_MSRS];
+
+/**
+ * @pre Called once by the BSP before any vCPU is created
+ */
+void init_vmsr_index(void)
+{
+	uint32_t i, j, index;
+
+	for (i = 0U; i < NUM_GUEST_MSRS; i++) {
+		index = i;
+		for (j = i; (j > 0U) && (emulated_guest_msrs[sorted_guest_msrs[j - 1U]] > emulated_guest_msrs[index]); j--) {
+			sorted_guest_msrs[j] = sorted_guest_msrs[j - 1U];
+		}
+		sorted_guest_msrs[j] = index;
+	}
+}
+
 /* emulated_guest_msrs[] shares same indexes with array vcpu->arch->guest_msrs[] */
 uint32_t vmsr_get_guest_msr_index(uint32_t msr)
 {
-	uint32_t index;
-
-	for (index = 0U; index < NUM_GUEST_MSRS; index++) {
-		if (emulated_guest_msrs[index] == msr) {
+	uint32_t low = 0U, high = NUM_GUEST_MSRS, mid;
+	uint32_t index = NUM_GUEST_MSRS;
+
+	while (low < high) {
+		mid = (low + high) >> 1U;
+		if (emulated_guest_msrs[sorted_guest_msrs[mid]] < msr) {
+			low = mid + 1U;
+		} else if (emulated_guest_msrs[sorted_guest_msrs[mid]] > msr) {
+			high = mid;
+		} else {
+			index = sorted_guest_msrs[mid];
 			break;
 		}
 	}
@@ -261,6 +288,34 @@ uint32_t vmsr_get_guest_msr_index(uint32_t msr)
 	return index;
 }
 
+/*
+ * Count the RDMSR/WRMSR exits of each MSR in an open addressing table, so that
+ * the MSRs which are intercepted but exit often for nothing can be spotted with
+ * the msr_stat shell command. MSRs beyond VMSR_STATS_NR different ones are not
+ * accounted.
+ */
+static void vmsr_account_exit(struct acrn_vcpu *vcpu, uint32_t msr, bool is_write)
+{
+	struct vmsr_stats_entry *entry;
+	uint32_t i, slot = (msr * 0x9e3779b1U) >> (32U - VMSR_STATS_SHIFT);
+
+	for (i = 0U; i < VMSR_STATS_NR; i++) {
+		entry = &vcpu->msr_stats[(slot + i) & (VMSR_STATS_NR - 1U)];
+		if ((entry->rdmsr == 0U) && (entry->wrmsr == 0U)) {
+			entry->msr = msr;
+		}
+
+		if (entry->msr == msr) {
+			if (is_write) {
+				entry->wrmsr++;
+			} else {
+				entry->rdmsr++;
+			}
+			break;
+		}
+	}
+}
+
 static void enable_msr_interception(uint8_t *bitmap, uint32_t msr_arg, uint32_t mode)
 {
 	uint32_t read_offset = 0U;
@@ -389,6 +444,21 @@ void init_msr_emulation(struct acrn_vcpu *vcpu)
 	enable_msr_interception(msr_bitmap, MSR_IA32_TIME_STAMP_COUNTER, INTERCEPT_WRITE);
 	enable_msr_interception(msr_bitmap, MSR_IA32_XSS, INTERCEPT_WRITE);
 
+	/*
+	 * vPMU: the counters are passed through, the writes to the event selects are
+	 * checked and the global control and status registers are emulated.
+	 */
+	if (is_vpmu_configured(vcpu->vm)) {
+		for (i = 0U; i < vpmu_num_gp_counters(); i++) {
+			enable_msr_interception(msr_bitmap, MSR_IA32_PMC0 + i, INTERCEPT_DISABLE);
+			enable_msr_interception(msr_bitmap, MSR_IA32_PERFEVTSEL0 + i, INTERCEPT_WRITE);
+		}
+		for (i = 0U; i < vpmu_num_fixed_counters(); i++) {
+			enable_msr_interception(msr_bitmap, MSR_IA32_FIXED_CTR0 + i, INTERCEPT_DISABLE);
+		}
+		enable_msr_interception(msr_bitmap, MSR_IA32_FIXED_CTR_CTL, INTERCEPT_WRITE);
+	}
+
 	/* Setup MSR bitmap - Intel SDM Vol3 24.6.9 */
 	value64 = hva2hpa(vcpu->arch.msr_bitmap);
 	exec_vmwrite64(VMX_MSR_BITMAP_FULL, value64);
@@ -402,6 +472,8 @@ void init_msr_emulation(struct acrn_vcpu *vcpu)
 
 	/* Initialize VMX MSRs for nested virtualization */
 	init_vmx_msrs(vcpu);
+
+	vpmu_init_vcpu(vcpu);
 }
 
 static int32_t write_pat_msr(struct acrn_vcpu *vcpu, uint64_t value)
@@ -456,20 +528,10 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Read the msr value */
 	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	vmsr_account_exit(vcpu, msr, false);
 
 	/* Do the required processing for each msr case */
 	switch (msr) {
-#ifdef CONFIG_HYPERV_ENABLED
-	case HV_X64_MSR_GUEST_OS_ID:
-	case HV_X64_MSR_HYPERCALL:
-	case HV_X64_MSR_VP_INDEX:
-	case HV_X64_MSR_REFERENCE_TSC:
-	case HV_X64_MSR_TIME_REF_COUNT:
-	{
-		err = hyperv_rdmsr(vcpu, msr, &v);
-		break;
-	}
-#endif
 	case MSR_IA32_TSC_DEADLINE:
 	{
 		v = vlapic_get_tsc_deadline_msr(vcpu_vlapic(vcpu));
@@ -600,6 +662,12 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	{
 		if (is_x2apic_msr(msr)) {
 			err = vlapic_x2apic_read(vcpu, msr, &v);
+#ifdef CONFIG_HYPERV_ENABLED
+		} else if (is_hyperv_msr(msr)) {
+			err = hyperv_rdmsr(vcpu, msr, &v);
+#endif
+		} else if (is_vpmu_msr(msr)) {
+			err = vpmu_rdmsr(vcpu, msr, &v);
 		} else if (is_vmx_msr(msr)) {
 			/*
 			 * TODO: after the switch statement in this function, there is another
@@ -629,12 +697,14 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 /*
  * If VMX_TSC_OFFSET_FULL is 0, no need to trap the write of IA32_TSC_DEADLINE because there is
  * no offset between vTSC and pTSC, in this case, only write to vTSC_ADJUST is trapped.
+ * A scaled vTSC always needs the conversion of IA32_TSC_DEADLINE.
  */
-static void set_tsc_msr_interception(struct acrn_vcpu *vcpu, bool interception)
+static void set_tsc_msr_interception(struct acrn_vcpu *vcpu, bool need_interception)
 {
 	uint8_t *msr_bitmap = vcpu->arch.msr_bitmap;
 	bool is_intercepted =
 		((msr_bitmap[MSR_IA32_TSC_DEADLINE >> 3U] & (1U << (MSR_IA32_TSC_DEADLINE & 0x7U))) != 0U);
+	bool interception = need_interception || (vcpu->vm->arch_vm.tsc_multiplier != 0UL);
 
 	if (!interception && is_intercepted) {
 		enable_msr_interception(msr_bitmap, MSR_IA32_TSC_DEADLINE, INTERCEPT_DISABLE);
@@ -665,7 +735,7 @@ static void set_tsc_msr_interception(struct acrn_vcpu *vcpu, bool interception)
  * the IA32_TSC_ADJUST MSR.
  *
  * So, here we should update VMCS.OFFSET and vAdjust accordingly.
- *   - VMCS.OFFSET = vTSC - pTSC
+ *   - VMCS.OFFSET = vTSC - pTSC, pTSC being scaled with TSC scaling
  *   - vAdjust += VMCS.OFFSET's delta
  */
 
@@ -676,10 +746,9 @@ static void set_guest_tsc(struct acrn_vcpu *vcpu, uint64_t guest_tsc)
 {
 	uint64_t tsc_delta, tsc_offset_delta, tsc_adjust;
 
-	tsc_delta = guest_tsc - rdtsc();
-
 	/* the delta between new and existing TSC_OFFSET */
-	tsc_offset_delta = tsc_delta - exec_vmread64(VMX_TSC_OFFSET_FULL);
+	tsc_offset_delta = guest_tsc - vcpu_tsc_from_host(vcpu, rdtsc());
+	tsc_delta = exec_vmread64(VMX_TSC_OFFSET_FULL) + tsc_offset_delta;
 
 	/* apply this delta to TSC_ADJUST */
 	tsc_adjust = vcpu_get_guest_msr(vcpu, MSR_IA32_TSC_ADJUST);
@@ -793,6 +862,7 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Read the MSR ID */
 	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	vmsr_account_exit(vcpu, msr, true);
 
 	/* Get the MSR contents */
 	v = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
@@ -800,17 +870,6 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Do the required processing for each msr case */
 	switch (msr) {
-#ifdef CONFIG_HYPERV_ENABLED
-	case HV_X64_MSR_GUEST_OS_ID:
-	case HV_X64_MSR_HYPERCALL:
-	case HV_X64_MSR_VP_INDEX:
-	case HV_X64_MSR_REFERENCE_TSC:
-	case HV_X64_MSR_TIME_REF_COUNT:
-	{
-		err = hyperv_wrmsr(vcpu, msr, v);
-		break;
-	}
-#endif
 	case MSR_IA32_TSC_DEADLINE:
 	{
 		vlapic_set_tsc_deadline_msr(vcpu_vlapic(vcpu), v);
@@ -971,6 +1030,12 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	{
 		if (is_x2apic_msr(msr)) {
 			err = vlapic_x2apic_write(vcpu, msr, v);
+#ifdef CONFIG_HYPERV_ENABLED
+		} else if (is_hyperv_msr(msr)) {
+			err = hyperv_wrmsr(vcpu, msr, v);
+#endif
+		} else if (is_vpmu_msr(msr)) {
+			err = vpmu_wrmsr(vcpu, msr, v);
 		} else {
 			pr_warn("%s(): vm%d vcpu%d writing MSR %lx not supported",
 				__func__, vcpu->vm->vm_id, vcpu->vcpu_id, msr);
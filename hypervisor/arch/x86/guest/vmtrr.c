@@ -160,6 +160,10 @@ static void update_ept(struct acrn_vm *vm, uint64_t start,
 		break;
 	}
 
+	if (attr != EPT_WB) {
+		/* its WBINVDs have to flush from now on, see wbinvd_vmexit_handler() */
+		vm->vmtrr_non_wb = true;
+	}
 	ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, start, size, attr, EPT_MT_MASK);
 }
 
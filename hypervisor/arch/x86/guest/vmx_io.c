@@ -57,6 +57,32 @@ emulate_pio_complete(struct acrn_vcpu *vcpu, const struct io_request *io_req)
 	}
 }
 
+/*
+ * Count an I/O instruction exit on port in the per vCPU table of the ports
+ * trapping the most, only updated by the pCPU of the vCPU.
+ */
+static void account_pio_exit(struct acrn_vcpu *vcpu, uint16_t port)
+{
+	struct acrn_vmexit_stats *stats = &vcpu->exit_stats;
+	uint32_t i, victim = 0U;
+
+	for (i = 0U; i < VMEXIT_STATS_NR_PORTS; i++) {
+		if ((stats->pio[i].port == port) && (stats->pio[i].count != 0U)) {
+			break;
+		}
+		if (stats->pio[i].count < stats->pio[victim].count) {
+			victim = i;
+		}
+	}
+
+	if (i < VMEXIT_STATS_NR_PORTS) {
+		stats->pio[i].count++;
+	} else {
+		/* the new port takes the count of the entry it evicts over */
+		stats->pio[victim].port = port;
+		stats->pio[victim].count++;
+	}
+}
 
 /**
  * @brief The handler of VM exits on I/O instructions
@@ -91,11 +117,47 @@ int32_t pio_instr_vmexit_handler(struct acrn_vcpu *vcpu)
 		(uint32_t)pio_req->size,
 		(uint32_t)cur_context_idx);
 
+	account_pio_exit(vcpu, (uint16_t)pio_req->address);
 	status = emulate_io(vcpu, io_req);
 
 	return status;
 }
 
+/* the access, retried once the DM has mapped the block of gpa back */
+static int32_t emulate_reclaimed_access(struct acrn_vcpu *vcpu, uint64_t gpa, uint32_t direction)
+{
+	struct io_request *io_req = &vcpu->req;
+	struct mmio_request *mmio_req = &io_req->reqs.mmio;
+
+	io_req->io_type = REQ_RECLAIMED;
+	mmio_req->direction = direction;
+	mmio_req->address = gpa;
+	mmio_req->size = 0UL;
+	mmio_req->value = 0UL;
+
+	vcpu_retain_rip(vcpu);
+	return emulate_io(vcpu, io_req);
+}
+
+bool unshare_guest_memory(struct acrn_vcpu *vcpu, uint64_t gpa, uint64_t size)
+{
+	uint64_t addr;
+	bool shared = false;
+
+	for (addr = gpa & PDE_MASK; addr < (gpa + size); addr += PDE_SIZE) {
+		if (ept_is_shared_block(vcpu->vm, addr)) {
+			/* even if the request fails, the shared block must not be written */
+			if (emulate_reclaimed_access(vcpu, addr, REQUEST_WRITE) != 0) {
+				pr_err("%s: vm%hu gpa 0x%lx not unshared", __func__, vcpu->vm->vm_id, addr);
+			}
+			shared = true;
+			break;
+		}
+	}
+
+	return shared;
+}
+
 int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	int32_t status = -EINVAL, ret;
@@ -107,12 +169,19 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 	/* Handle page fault from guest */
 	exit_qual = vcpu->arch.exit_qualification;
 	/* Get the guest physical address */
-	gpa = exec_vmread64(VMX_GUEST_PHYSICAL_ADDR_FULL);
+	gpa = vcpu_get_exit_info(vcpu, EXIT_INFO_GUEST_PHYSICAL_ADDR);
 
 	TRACE_2L(TRACE_VMEXIT_EPT_VIOLATION, exit_qual, gpa);
 
-	/*caused by instruction fetch */
-	if ((exit_qual & 0x4UL) != 0UL) {
+	/* not-present fault on guest memory given back to SOS */
+	if (((exit_qual & 0x38UL) == 0UL) && ept_is_reclaimed(vcpu->vm, gpa)) {
+		status = emulate_reclaimed_access(vcpu, gpa,
+				((exit_qual & 0x2UL) != 0UL) ? REQUEST_WRITE : REQUEST_READ);
+	} else if (((exit_qual & 0x2UL) != 0UL) && ept_is_shared(vcpu->vm, gpa)) {
+		/* write fault on guest memory shared read-only, the DM copies it */
+		status = emulate_reclaimed_access(vcpu, gpa, REQUEST_WRITE);
+	} else if ((exit_qual & 0x4UL) != 0UL) {
+		/*caused by instruction fetch */
 		/* TODO: check wehther the gpa is not a MMIO address. */
 		if (vcpu->arch.cur_context == NORMAL_WORLD) {
 			ept_modify_mr(vcpu->vm, (uint64_t *)vcpu->vm->arch_vm.nworld_eptp,
@@ -136,6 +205,7 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 			/* XXX: write access while EPT perm RX -> WP */
 			if ((exit_qual & 0x38UL) == 0x28UL) {
 				io_req->io_type = REQ_WP;
+				atomic_inc64(&vcpu->vm->wp_exits);
 			}
 		} else {
 			/* Read operation */
@@ -151,7 +221,10 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 		mmio_req->address = gpa;
 
 		ret = decode_instruction(vcpu);
-		if (ret > 0) {
+		if ((ret > 0) && unshare_guest_memory(vcpu, get_instr_dst_gpa(vcpu), (uint64_t)ret)) {
+			/* a MOVS to shared guest memory, retried once it's copied */
+			status = 0;
+		} else if (ret > 0) {
 			mmio_req->size = (uint64_t)ret;
 			/*
 			 * For MMIO write, ask DM to run MMIO emulation after
@@ -177,7 +250,7 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 			}
 		}
 		if (ret <= 0) {
-			pr_acrnlog("Guest Linear Address: 0x%016lx", exec_vmread(VMX_GUEST_LINEAR_ADDR));
+			pr_acrnlog("Guest Linear Address: 0x%016lx", vcpu_get_exit_info(vcpu, EXIT_INFO_GUEST_LINEAR_ADDR));
 			pr_acrnlog("Guest Physical Address address: 0x%016lx", gpa);
 		}
 	}
@@ -222,3 +295,23 @@ void deny_guest_pio_access(struct acrn_vm *vm, uint16_t port_address,
 		address++;
 	}
 }
+
+bool is_guest_pio_allowed(const struct acrn_vm *vm, uint16_t port_address,
+		uint32_t nbytes)
+{
+	uint16_t address = port_address;
+	const uint32_t *b;
+	uint32_t i;
+	bool allowed = true;
+
+	b = (const uint32_t *)vm->arch_vm.io_bitmap;
+	for (i = 0U; i < nbytes; i++) {
+		if ((b[address >> 5U] & (1U << (address & 0x1fU))) != 0U) {
+			allowed = false;
+			break;
+		}
+		address++;
+	}
+
+	return allowed;
+}
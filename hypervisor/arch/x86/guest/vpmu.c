@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <irq.h>
+#include <asm/cpu.h>
+#include <asm/cpuid.h>
+#include <asm/cpu_caps.h>
+#include <asm/cpufeatures.h>
+#include <asm/msr.h>
+#include <asm/vmx.h>
+#include <asm/irq.h>
+#include <asm/apicreg.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/vcpu.h>
+#include <asm/guest/vlapic.h>
+#include <asm/guest/vpmu.h>
+#include <lib/util.h>
+#include <logmsg.h>
+
+/*
+ * The architectural PMU of a vCPU with GUEST_FLAG_VPMU runs in the hardware:
+ * the counters are passed through, the event selects are written to the
+ * hardware after their reserved bits are checked and IA32_PERF_GLOBAL_CTRL
+ * is switched by the VM entries and exits, so that nothing counts once the
+ * vCPU exits. The vCPUs sharing a pCPU save and restore the PMU state when
+ * they are switched, and the PMIs of the counters are injected into the
+ * local APIC of the vCPU running when they arrive.
+ *
+ * The host PMU belongs to the profiling collector in the PROFILING_ON builds,
+ * the vPMU is not supported there.
+ */
+
+#define CPUID_0AH_EAX_VERSION_MASK	0xffU
+#define CPUID_0AH_EAX_NUM_GP_SHIFT	8U
+#define CPUID_0AH_EAX_NUM_GP_MASK	(0xffU << CPUID_0AH_EAX_NUM_GP_SHIFT)
+#define CPUID_0AH_EDX_NUM_FIXED_MASK	0x1fU
+
+/* the guests are told about version 2 whatever the processor supports */
+#define VPMU_VERSION			2U
+
+/* IA32_PERFEVTSELx bits 0-31, but the AnyThread bit 21 of version 3 */
+#define VPMU_EVTSEL_VALID_BITS		0xffdfffffUL
+/* EN, bits 1:0, and PMI, bit 3, of each fixed counter in IA32_FIXED_CTR_CTL */
+#define VPMU_FIXED_CTL_VALID_BITS	0xbUL
+/* OvfBuf and CondChgd of IA32_PERF_GLOBAL_STATUS and IA32_PERF_GLOBAL_OVF_CTRL */
+#define VPMU_GLOBAL_STATUS_EXTRA_BITS	(3UL << 62U)
+
+/* IA32_PERF_CAPABILITIES.FW_WRITE: the counters can be written in full width through IA32_A_PMCx */
+#define PERF_CAP_FW_WRITE		(1UL << 13U)
+
+static struct vpmu_cap {
+	bool supported;
+	bool fw_write;
+	uint32_t num_gp;
+	uint32_t num_fixed;
+	uint64_t global_ctrl_mask;
+} vpmu_cap;
+
+#ifndef PROFILING_ON
+static void vpmu_pmi_handler(__unused uint32_t irq, __unused void *data)
+{
+	struct acrn_vcpu *vcpu = get_running_vcpu(get_pcpu_id());
+
+	if ((vcpu != NULL) && vcpu->arch.vpmu.enabled) {
+		(void)vlapic_set_local_intr(vcpu->vm, vcpu->vcpu_id, APIC_LVT_PMC);
+	}
+
+	/* the delivery of the PMI masked the LVT entry of the pCPU */
+	msr_write(MSR_IA32_EXT_APIC_LVT_PMI, PMI_VECTOR);
+}
+#endif
+
+/*
+ * Called on the BSP before the APs are started
+ */
+void init_vpmu_cap(void)
+{
+#ifndef PROFILING_ON
+	uint32_t eax, ebx, ecx, edx;
+	uint32_t entry_ctls, exit_ctls;
+
+	if (get_pcpu_info()->cpuid_level >= 0xaU) {
+		cpuid_subleaf(0xaU, 0U, &eax, &ebx, &ecx, &edx);
+		entry_ctls = (uint32_t)(msr_read(MSR_IA32_VMX_ENTRY_CTLS) >> 32U);
+		exit_ctls = (uint32_t)(msr_read(MSR_IA32_VMX_EXIT_CTLS) >> 32U);
+
+		if (((eax & CPUID_0AH_EAX_VERSION_MASK) >= VPMU_VERSION) &&
+				((entry_ctls & VMX_ENTRY_CTLS_LOAD_PERF) != 0U) &&
+				((exit_ctls & VMX_EXIT_CTLS_LOAD_PERF) != 0U)) {
+			vpmu_cap.num_gp = min((eax & CPUID_0AH_EAX_NUM_GP_MASK) >> CPUID_0AH_EAX_NUM_GP_SHIFT,
+					VPMU_MAX_GP_COUNTERS);
+			vpmu_cap.num_fixed = min(edx & CPUID_0AH_EDX_NUM_FIXED_MASK, VPMU_MAX_FIXED_COUNTERS);
+			vpmu_cap.global_ctrl_mask = ((1UL << vpmu_cap.num_gp) - 1UL) |
+					(((1UL << vpmu_cap.num_fixed) - 1UL) << 32U);
+			vpmu_cap.fw_write = pcpu_has_cap(X86_FEATURE_PDCM) &&
+					((msr_read(MSR_IA32_PERF_CAPABILITIES) & PERF_CAP_FW_WRITE) != 0UL);
+
+			if (request_irq(PMI_IRQ, vpmu_pmi_handler, NULL, IRQF_NONE) < 0) {
+				pr_err("%s: failed to add the PMI isr", __func__);
+			} else {
+				vpmu_cap.supported = true;
+				pr_acrnlog("vPMU: %u general purpose and %u fixed counters",
+					vpmu_cap.num_gp, vpmu_cap.num_fixed);
+			}
+		}
+	}
+#endif
+}
+
+/*
+ * Called on each pCPU, routes the PMIs of the counters to the vPMU handler
+ */
+void init_pcpu_vpmu(void)
+{
+	if (vpmu_cap.supported) {
+		msr_write(MSR_IA32_PERF_GLOBAL_CTRL, 0UL);
+		msr_write(MSR_IA32_EXT_APIC_LVT_PMI, PMI_VECTOR);
+	}
+}
+
+/**
+ * @pre vm != NULL
+ */
+bool is_vpmu_configured(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	/* with the LAPIC passed through, the PMIs couldn't be injected */
+	return (vpmu_cap.supported && ((vm_config->guest_flags & GUEST_FLAG_VPMU) != 0UL) &&
+		!is_lapic_pt_configured(vm));
+}
+
+uint32_t vpmu_num_gp_counters(void)
+{
+	return vpmu_cap.num_gp;
+}
+
+uint32_t vpmu_num_fixed_counters(void)
+{
+	return vpmu_cap.num_fixed;
+}
+
+/**
+ * @pre entry != NULL && entry->leaf == 0xaU
+ */
+void vpmu_init_vcpuid_entry(struct vcpuid_entry *entry)
+{
+	/* the events available in EBX and the counter widths are the ones of the processor */
+	entry->eax = (entry->eax & ~(CPUID_0AH_EAX_VERSION_MASK | CPUID_0AH_EAX_NUM_GP_MASK)) |
+			VPMU_VERSION | (vpmu_cap.num_gp << CPUID_0AH_EAX_NUM_GP_SHIFT);
+	entry->ecx = 0U;
+	entry->edx = (entry->edx & ~CPUID_0AH_EDX_NUM_FIXED_MASK) | vpmu_cap.num_fixed;
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre the VMCS of the vCPU is loaded
+ */
+void vpmu_init_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+
+	(void)memset((void *)vpmu, 0U, sizeof(struct acrn_vpmu));
+	if (is_vpmu_configured(vcpu->vm)) {
+		vpmu->enabled = true;
+		/* power-up value, the general purpose counters are enabled as in version 1 */
+		vpmu->global_ctrl = (1UL << vpmu_cap.num_gp) - 1UL;
+		exec_vmwrite64(VMX_GUEST_IA32_PERF_CTL_FULL, vpmu->global_ctrl);
+		exec_vmwrite64(VMX_HOST_IA32_PERF_CTL_FULL, 0UL);
+		/* the vCPU is initialized on its pcpu, the state it left in the hardware is stale */
+		vpmu_switch_in(vcpu);
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre called on the pcpu of the vCPU, after its VM exit stopped the counters
+ */
+void vpmu_switch_out(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	uint64_t status;
+	uint32_t i;
+
+	if (vpmu->enabled) {
+		for (i = 0U; i < vpmu_cap.num_gp; i++) {
+			vpmu->pmc[i] = msr_read(MSR_IA32_PMC0 + i);
+		}
+		for (i = 0U; i < vpmu_cap.num_fixed; i++) {
+			vpmu->fixed_ctr[i] = msr_read(MSR_IA32_FIXED_CTR0 + i);
+		}
+
+		/* the overflows can't be set back in the hardware, they are kept until the guest clears them */
+		status = msr_read(MSR_IA32_PERF_GLOBAL_STATUS);
+		if (status != 0UL) {
+			vpmu->global_status |= status;
+			msr_write(MSR_IA32_PERF_GLOBAL_OVF_CTRL, status);
+		}
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre called on the pcpu of the vCPU before its VM entry
+ */
+void vpmu_switch_in(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	uint32_t i;
+
+	if (vpmu->enabled) {
+		for (i = 0U; i < vpmu_cap.num_gp; i++) {
+			msr_write(MSR_IA32_PERFEVTSEL0 + i, vpmu->evtsel[i]);
+			/* without full width writes, only the low 32 bits are restored, sign extended */
+			msr_write((vpmu_cap.fw_write ? MSR_IA32_A_PMC0 : MSR_IA32_PMC0) + i, vpmu->pmc[i]);
+		}
+		for (i = 0U; i < vpmu_cap.num_fixed; i++) {
+			msr_write(MSR_IA32_FIXED_CTR0 + i, vpmu->fixed_ctr[i]);
+		}
+		msr_write(MSR_IA32_FIXED_CTR_CTL, vpmu->fixed_ctr_ctl);
+	}
+}
+
+/**
+ * @pre vcpu != NULL && rval != NULL
+ */
+int32_t vpmu_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
+{
+	struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	int32_t ret = 0;
+
+	if (!vpmu->enabled) {
+		ret = -EACCES;
+	} else if ((msr >= MSR_IA32_PMC0) && (msr < (MSR_IA32_PMC0 + vpmu_cap.num_gp))) {
+		*rval = msr_read(msr);
+	} else if ((msr >= MSR_IA32_PERFEVTSEL0) && (msr < (MSR_IA32_PERFEVTSEL0 + vpmu_cap.num_gp))) {
+		*rval = vpmu->evtsel[msr - MSR_IA32_PERFEVTSEL0];
+	} else if ((msr >= MSR_IA32_FIXED_CTR0) && (msr < (MSR_IA32_FIXED_CTR0 + vpmu_cap.num_fixed))) {
+		*rval = msr_read(msr);
+	} else if (msr == MSR_IA32_FIXED_CTR_CTL) {
+		*rval = vpmu->fixed_ctr_ctl;
+	} else if (msr == MSR_IA32_PERF_GLOBAL_STATUS) {
+		*rval = msr_read(msr) | vpmu->global_status;
+	} else if (msr == MSR_IA32_PERF_GLOBAL_CTRL) {
+		*rval = vpmu->global_ctrl;
+	} else if (msr == MSR_IA32_PERF_GLOBAL_OVF_CTRL) {
+		*rval = 0UL;
+	} else {
+		ret = -EACCES;
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+int32_t vpmu_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+{
+	struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	uint64_t fixed_ctl_mask = 0UL;
+	uint32_t i;
+	int32_t ret = 0;
+
+	for (i = 0U; i < vpmu_cap.num_fixed; i++) {
+		fixed_ctl_mask |= VPMU_FIXED_CTL_VALID_BITS << (i * 4U);
+	}
+
+	if (!vpmu->enabled) {
+		ret = -EACCES;
+	} else if ((msr >= MSR_IA32_PMC0) && (msr < (MSR_IA32_PMC0 + vpmu_cap.num_gp))) {
+		msr_write(msr, wval);
+	} else if ((msr >= MSR_IA32_PERFEVTSEL0) && (msr < (MSR_IA32_PERFEVTSEL0 + vpmu_cap.num_gp))) {
+		if ((wval & ~VPMU_EVTSEL_VALID_BITS) != 0UL) {
+			ret = -EACCES;
+		} else {
+			vpmu->evtsel[msr - MSR_IA32_PERFEVTSEL0] = wval;
+			msr_write(msr, wval);
+		}
+	} else if ((msr >= MSR_IA32_FIXED_CTR0) && (msr < (MSR_IA32_FIXED_CTR0 + vpmu_cap.num_fixed))) {
+		msr_write(msr, wval);
+	} else if (msr == MSR_IA32_FIXED_CTR_CTL) {
+		if ((wval & ~fixed_ctl_mask) != 0UL) {
+			ret = -EACCES;
+		} else {
+			vpmu->fixed_ctr_ctl = wval;
+			msr_write(msr, wval);
+		}
+	} else if (msr == MSR_IA32_PERF_GLOBAL_CTRL) {
+		if ((wval & ~vpmu_cap.global_ctrl_mask) != 0UL) {
+			ret = -EACCES;
+		} else {
+			vpmu->global_ctrl = wval;
+			exec_vmwrite64(VMX_GUEST_IA32_PERF_CTL_FULL, wval);
+		}
+	} else if (msr == MSR_IA32_PERF_GLOBAL_OVF_CTRL) {
+		if ((wval & ~(vpmu_cap.global_ctrl_mask | VPMU_GLOBAL_STATUS_EXTRA_BITS)) != 0UL) {
+			ret = -EACCES;
+		} else {
+			vpmu->global_status &= ~wval;
+			msr_write(msr, wval);
+		}
+	} else {
+		/* IA32_PERF_GLOBAL_STATUS is read-only */
+		ret = -EACCES;
+	}
+
+	return ret;
+}
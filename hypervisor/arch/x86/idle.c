@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <util.h>
+#include <ticks.h>
+#include <timer.h>
+#include <schedule.h>
+#include <asm/cpu.h>
+#include <asm/cpu_caps.h>
+#include <asm/io.h>
+#include <asm/per_cpu.h>
+#include <asm/host_pm.h>
+#include <asm/guest/vm.h>
+#include <asm/idle.h>
+
+/* a C-state saves power once the idle period is this many times its exit latency */
+#define CX_RESIDENCY_FACTOR	3U
+/* the last idle period weighs 1/2^IDLE_AVG_SHIFT in the moving average */
+#define IDLE_AVG_SHIFT		3U
+
+/*
+ * The pCPUs of an RT VM poll, for the wakeup latency of its vCPUs: with
+ * LAPIC passthrough they seldom reach the idle thread anyway. The other
+ * pCPUs sleep as deep as their idle time allows.
+ *
+ * @pre called by the pCPU creating or shutting down a VM
+ */
+void update_idle_policy(void)
+{
+	enum idle_policy sleep = IDLE_POLICY_POLL;
+	struct acrn_vm *vm;
+	uint64_t rt_mask = 0UL;
+	uint16_t vm_id, pcpu_id;
+
+#ifdef CONFIG_IDLE_CSTATE
+	sleep = has_monitor_cap() ? IDLE_POLICY_CSTATE : IDLE_POLICY_HALT;
+#endif
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm) && is_rt_vm(vm)) {
+			rt_mask |= vm->hw.cpu_affinity;
+		}
+	}
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		per_cpu(idle_ctl, pcpu_id).policy = bitmap_test(pcpu_id, &rt_mask) ? IDLE_POLICY_POLL : sleep;
+	}
+}
+
+/*
+ * The deepest host Cx entry whose exit latency pays off for an idle period
+ * of predicted ticks, entry 0 (C1) being the shallowest.
+ */
+static uint32_t select_cx(uint64_t predicted)
+{
+	const struct cpu_state_info *info = get_cpu_pm_state_info();
+	const struct cpu_cx_data *cx;
+	uint32_t i, ret = 0U;
+
+	for (i = info->cx_cnt; i > 1U; i--) {
+		cx = &info->cx_data[i - 1U];
+		if (((cx->cx_reg.space_id == SPACE_FFixedHW) || (cx->cx_reg.space_id == SPACE_SYSTEM_IO)) &&
+				(us_to_ticks(cx->latency * CX_RESIDENCY_FACTOR) <= predicted)) {
+			ret = i - 1U;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * HLT and the chipset C-states entered by an I/O read are only woken by an
+ * interrupt: the remote reschedule requests must send an IPI meanwhile.
+ */
+static void wait_for_interrupt(uint16_t pcpu_id, const struct cpu_cx_data *cx)
+{
+	set_reschedule_polling(pcpu_id, false);
+	cpu_memory_barrier();
+	if (!need_reschedule(pcpu_id)) {
+		if (cx == NULL) {
+			asm_sti_hlt();
+		} else {
+			/* the pending interrupt wakes the CPU, it is taken below */
+			(void)pio_read8((uint16_t)cx->cx_reg.address);
+			CPU_IRQ_ENABLE();
+		}
+		CPU_IRQ_DISABLE();
+	}
+	set_reschedule_polling(pcpu_id, true);
+}
+
+/*
+ * A write to the scheduler flags ends MWAIT as well as an interrupt does, so
+ * the pCPU keeps polling for the reschedule requests, which send no IPI.
+ */
+static void wait_for_resched(uint16_t pcpu_id, uint32_t hint)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+
+	asm_monitor(&ctl->flags, 0UL, 0UL);
+	if (!need_reschedule(pcpu_id)) {
+		asm_sti_mwait((uint64_t)hint, 0UL);
+		CPU_IRQ_DISABLE();
+	}
+}
+
+/*
+ * Wait for an event in the idle thread of pcpu_id, as its policy says.
+ *
+ * The C-state is picked from the time to the next hypervisor timer and the
+ * average of the last idle periods. The P-state is left as it is, the one
+ * the guest asked for and validate_pstate() let through stays in effect.
+ *
+ * @pre pcpu_id == get_pcpu_id() and the interrupts are disabled
+ */
+void cpu_idle(uint16_t pcpu_id)
+{
+	struct pcpu_idle *ctl = &per_cpu(idle_ctl, pcpu_id);
+	const struct cpu_state_info *info = get_cpu_pm_state_info();
+	const struct cpu_cx_data *cx = NULL;
+	uint64_t start, deadline, predicted, idle_ticks;
+	uint32_t idx = 0U;
+
+	if (ctl->policy == IDLE_POLICY_POLL) {
+		CPU_IRQ_ENABLE();
+		cpu_do_idle();
+		CPU_IRQ_DISABLE();
+	} else {
+		start = cpu_ticks();
+		predicted = ctl->avg_ticks;
+		deadline = next_timer_deadline(pcpu_id);
+		if (deadline != 0UL) {
+			predicted = (deadline > start) ? min(predicted, deadline - start) : 0UL;
+		}
+
+		if (ctl->policy == IDLE_POLICY_CSTATE) {
+			idx = select_cx(predicted);
+			if (info->cx_cnt != 0U) {
+				cx = &info->cx_data[idx];
+			}
+		}
+
+		if ((cx != NULL) && (cx->cx_reg.space_id == SPACE_SYSTEM_IO)) {
+			wait_for_interrupt(pcpu_id, cx);
+		} else if (ctl->policy == IDLE_POLICY_CSTATE) {
+			/* the address of a functional fixed hardware Cx entry is its MWAIT hint */
+			wait_for_resched(pcpu_id, ((cx != NULL) && (cx->cx_reg.space_id == SPACE_FFixedHW)) ?
+					(uint32_t)cx->cx_reg.address : 0U);
+		} else {
+			wait_for_interrupt(pcpu_id, NULL);
+		}
+
+		idle_ticks = cpu_ticks() - start;
+		ctl->entries[idx]++;
+		ctl->ticks[idx] += idle_ticks;
+		ctl->avg_ticks = (ctl->avg_ticks - (ctl->avg_ticks >> IDLE_AVG_SHIFT)) + (idle_ticks >> IDLE_AVG_SHIFT);
+	}
+}
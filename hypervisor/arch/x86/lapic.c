@@ -257,6 +257,7 @@ void send_single_ipi(uint16_t pcpu_id, uint32_t vector)
 	union apic_icr icr;
 
 	if (is_pcpu_active(pcpu_id)) {
+		get_cpu_var(stats).ipis++;
 		if (get_pcpu_id() == pcpu_id) {
 			msr_write(MSR_IA32_EXT_APIC_SELF_IPI, vector);
 		} else {
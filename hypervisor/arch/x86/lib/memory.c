@@ -4,6 +4,22 @@
  */
 #include <types.h>
 
+/*
+ * Below this length REP MOVSB does not pay for its startup cost unless the
+ * CPU has fast short REP MOV (FSRM).
+ */
+#define MEMCPY_SHORT_LEN	64U
+
+static bool fsrm_enabled;
+
+/*
+ * @brief Tell the string functions whether the CPU has fast short REP MOV
+ */
+void init_fast_string(bool fsrm)
+{
+	fsrm_enabled = fsrm;
+}
+
 static inline void memset_erms(void *base, uint8_t v, size_t n)
 {
 	asm volatile("rep ; stosb"
@@ -32,6 +48,107 @@ static inline void memcpy_erms(void *d, const void *s, size_t slen)
 		: "memory");
 }
 
+/* the volatile accesses keep the compiler from turning the loops into a memcpy() call */
+static inline void memcpy_short(void *d, const void *s, size_t slen)
+{
+	volatile uint8_t *dst = (uint8_t *)d;
+	const volatile uint8_t *src = (const uint8_t *)s;
+	size_t n = slen;
+
+	while (n >= 8U) {
+		*(volatile uint64_t *)dst = *(const volatile uint64_t *)src;
+		dst += 8U;
+		src += 8U;
+		n -= 8U;
+	}
+	while (n > 0U) {
+		*dst = *src;
+		dst++;
+		src++;
+		n--;
+	}
+}
+
+/*
+ * Copy with non-temporal stores, which write around the cache: the 8-byte
+ * aligned part of the destination with MOVNTI, the rest with REP MOVSB.
+ */
+static inline void memcpy_nt(void *d, const void *s, size_t slen)
+{
+	uint8_t *dst = (uint8_t *)d;
+	const uint8_t *src = (const uint8_t *)s;
+	size_t head = (8U - ((uint64_t)dst & 7UL)) & 7UL;
+	size_t n = slen;
+	uint64_t v;
+
+	if (head > n) {
+		head = n;
+	}
+	if (head != 0U) {
+		memcpy_erms(dst, src, head);
+		dst += head;
+		src += head;
+		n -= head;
+	}
+
+	while (n >= 8U) {
+		v = *(const volatile uint64_t *)src;
+		asm volatile ("movnti %1, %0"
+			: "=m" (*(uint64_t *)dst)
+			: "r" (v));
+		dst += 8U;
+		src += 8U;
+		n -= 8U;
+	}
+
+	/* order the weakly-ordered stores before the ones that follow */
+	asm volatile ("sfence" : : : "memory");
+
+	if (n != 0U) {
+		memcpy_erms(dst, src, n);
+	}
+}
+
+/*
+ * @brief  Same as memset(), but the memory is written with non-temporal stores.
+ *
+ * For large areas nobody reads right after, such as the memory of a VM being
+ * scrubbed.
+ */
+void *memset_nt(void *base, uint8_t v, size_t n)
+{
+	uint8_t *dst = (uint8_t *)base;
+	size_t head = (8U - ((uint64_t)dst & 7UL)) & 7UL;
+	size_t len = n;
+	uint64_t v64 = (uint64_t)v * 0x0101010101010101UL;
+
+	if (head > len) {
+		head = len;
+	}
+	if (head != 0U) {
+		memset_erms(dst, v, head);
+		dst += head;
+		len -= head;
+	}
+
+	while (len >= 8U) {
+		asm volatile ("movnti %1, %0"
+			: "=m" (*(uint64_t *)dst)
+			: "r" (v64));
+		dst += 8U;
+		len -= 8U;
+	}
+
+	/* order the weakly-ordered stores before the ones that follow */
+	asm volatile ("sfence" : : : "memory");
+
+	if (len != 0U) {
+		memset_erms(dst, v, len);
+	}
+
+	return base;
+}
+
 /*
  * @brief  Copies at most slen bytes from src address to dest address, up to dmax.
  *
@@ -49,7 +166,9 @@ int32_t memcpy_s(void *d, size_t dmax, const void *s, size_t slen)
 	int32_t ret = -1;
 
 	if ((d != NULL) && (s != NULL) && (dmax >= slen) && ((d > (s + slen)) || (s > (d + dmax)))) {
-		if (slen != 0U) {
+		if ((slen < MEMCPY_SHORT_LEN) && !fsrm_enabled) {
+			memcpy_short(d, s, slen);
+		} else {
 			memcpy_erms(d, s, slen);
 		}
 		ret = 0;
@@ -59,3 +178,27 @@ int32_t memcpy_s(void *d, size_t dmax, const void *s, size_t slen)
 
 	return ret;
 }
+
+/*
+ * @brief  Same as memcpy_s(), but the destination is written with non-temporal
+ *	   stores.
+ *
+ * For large copies whose destination the hypervisor does not read back, such
+ * as the guest images it loads: these do not evict the working set from the
+ * cache.
+ *
+ * @return 0 for success and -1 for runtime-constraint violation.
+ */
+int32_t memcpy_nt_s(void *d, size_t dmax, const void *s, size_t slen)
+{
+	int32_t ret = -1;
+
+	if ((d != NULL) && (s != NULL) && (dmax >= slen) && ((d > (s + slen)) || (s > (d + dmax)))) {
+		memcpy_nt(d, s, slen);
+		ret = 0;
+	} else {
+		(void)memset(d, 0U, dmax);
+	}
+
+	return ret;
+}
@@ -107,6 +107,7 @@ static void handle_pi_notification(uint32_t irq, __unused void *data)
 	uint32_t vcpu_index = irq - POSTED_INTR_IRQ;
 
 	ASSERT(vcpu_index < CONFIG_MAX_VM_NUM, "");
+	get_cpu_var(stats).pi_notifications++;
 	vcpu_handle_pi_notification(vcpu_index);
 }
 
@@ -6,10 +6,14 @@
 #include <types.h>
 #include <asm/lib/bits.h>
 #include <asm/page.h>
+#include <asm/per_cpu.h>
 #include <logmsg.h>
 
 
-struct page *alloc_page(struct page_pool *pool)
+/*
+ * @pre pool->parent == NULL
+ */
+static struct page *take_free_page(struct page_pool *pool)
 {
 	struct page *page = NULL;
 	uint64_t loop_idx, idx, bit;
@@ -29,6 +33,30 @@ struct page *alloc_page(struct page_pool *pool)
 	}
 	spinlock_release(&pool->lock);
 
+	return page;
+}
+
+struct page *alloc_page(struct page_pool *pool)
+{
+	struct page *page = NULL;
+	uint64_t idx, bit;
+
+	if (pool->parent == NULL) {
+		page = take_free_page(pool);
+	} else {
+		spinlock_obtain(&pool->lock);
+		if (pool->used < pool->quota) {
+			page = take_free_page(pool->parent);
+			if (page != NULL) {
+				idx = (page - pool->parent->start_page) >> 6U;
+				bit = (page - pool->parent->start_page) & 0x3fUL;
+				bitmap_set_nolock(bit, pool->bitmap + idx);
+				pool->used++;
+			}
+		}
+		spinlock_release(&pool->lock);
+	}
+
 	ASSERT(page != NULL, "no page aviable!");
 	page = (page != NULL) ? page : pool->dummy_page;
 	if (page == NULL) {
@@ -49,11 +77,85 @@ struct page *alloc_page(struct page_pool *pool)
  */
 void free_page(struct page_pool *pool, struct page *page)
 {
+	struct page_pool *owner = (pool->parent != NULL) ? pool->parent : pool;
 	uint64_t idx, bit;
 
+	idx = (page - owner->start_page) >> 6U;
+	bit = (page - owner->start_page) & 0x3fUL;
+
+	if (pool->parent != NULL) {
+		spinlock_obtain(&pool->lock);
+		bitmap_clear_nolock(bit, pool->bitmap + idx);
+		pool->used--;
+		spinlock_release(&pool->lock);
+	}
+
+	spinlock_obtain(&owner->lock);
+	bitmap_clear_nolock(bit, owner->bitmap + idx);
+	spinlock_release(&owner->lock);
+}
+
+/* the link of a page waiting in the stale_pages of a pCPU, in the page itself */
+struct stale_page {
+	struct page *next;
+	struct page_pool *pool;
+};
+
+/*
+ * A page unlinked from a page table may still be walked through the TLBs
+ * and the IOTLB until they are flushed. It waits in the stale pages of the
+ * pCPU which flushes the change, and is given back by free_stale_pages().
+ */
+void free_page_deferred(struct page_pool *pool, struct page *page)
+{
+	struct stale_page *stale = (struct stale_page *)page;
+
+	stale->pool = pool;
+	stale->next = get_cpu_var(stale_pages);
+	get_cpu_var(stale_pages) = page;
+}
+
+bool has_stale_pages(void)
+{
+	return (get_cpu_var(stale_pages) != NULL);
+}
+
+/*
+ * Give back the stale pages of this pCPU.
+ *
+ * @pre: the changes which unlinked them are flushed
+ */
+void free_stale_pages(void)
+{
+	struct page *page = get_cpu_var(stale_pages);
+	struct stale_page *stale;
+
+	get_cpu_var(stale_pages) = NULL;
+	while (page != NULL) {
+		stale = (struct stale_page *)page;
+		page = stale->next;
+		free_page(stale->pool, (struct page *)stale);
+	}
+}
+
+/*
+ * Give all the pages held by a pool back to its parent.
+ *
+ *@pre: pool->parent != NULL
+ *@pre: pool->bitmap_size == pool->parent->bitmap_size
+ */
+void free_all_pages(struct page_pool *pool)
+{
+	struct page_pool *parent = pool->parent;
+	uint64_t idx;
+
 	spinlock_obtain(&pool->lock);
-	idx = (page - pool->start_page) >> 6U;
-	bit = (page - pool->start_page) & 0x3fUL;
-	bitmap_clear_nolock(bit, pool->bitmap + idx);
+	spinlock_obtain(&parent->lock);
+	for (idx = 0UL; idx < pool->bitmap_size; idx++) {
+		*(parent->bitmap + idx) &= ~(*(pool->bitmap + idx));
+		*(pool->bitmap + idx) = 0UL;
+	}
+	spinlock_release(&parent->lock);
+	pool->used = 0UL;
 	spinlock_release(&pool->lock);
 }
@@ -101,6 +101,61 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 	/* TODO: flush the TLB */
 }
 
+/*
+ * Merge a next level page table back into a large page, if its entries map
+ * one contiguous, size aligned region with the same attributes.
+ *
+ * @pre: level could only IA32E_PDPT or IA32E_PD
+ */
+static void try_to_merge_large_page(uint64_t *pte, enum _page_table_level level,
+		const struct pgtable *table)
+{
+	uint64_t *pbase = pde_page_vaddr(*pte);
+	uint64_t ref_paddr, paddrinc, large_size;
+	uint64_t i, ref_prot;
+	bool mergeable;
+
+	switch (level) {
+	case IA32E_PDPT:
+		paddrinc = PDE_SIZE;
+		large_size = PDPTE_SIZE;
+		/* the entries must be 2M pages themselves */
+		mergeable = (pde_large(*pbase) != 0UL);
+		break;
+	default:	/* IA32E_PD */
+		paddrinc = PTE_SIZE;
+		large_size = PDE_SIZE;
+		mergeable = true;
+		break;
+	}
+
+	ref_paddr = (*pbase) & PDE_PFN_MASK;
+	ref_prot = (*pbase) & ~PDE_PFN_MASK;
+	mergeable = mergeable && (table->pgentry_present(*pbase) != 0UL) &&
+			mem_aligned_check(ref_paddr, large_size);
+
+	if (mergeable) {
+		for (i = 1UL; i < PTRS_PER_PTE; i++) {
+			if (*(pbase + i) != ((ref_paddr + (i * paddrinc)) | ref_prot)) {
+				mergeable = false;
+				break;
+			}
+		}
+	}
+
+	if (mergeable && table->large_page_support(level, ref_prot)) {
+		if (level == IA32E_PD) {
+			table->tweak_exe_right(&ref_prot);
+			ref_prot |= PAGE_PSE;
+		}
+		dev_dbg(DBG_LEVEL_MMU, "%s, paddr: 0x%lx, pbase: 0x%lx\n", __func__, ref_paddr, pbase);
+
+		set_pgentry(pte, ref_paddr | ref_prot, table);
+		/* the caller flushes the change before the page is reused */
+		free_page_deferred(table->pool, (void *)pbase);
+	}
+}
+
 static inline void local_modify_or_del_pte(uint64_t *pte,
 		uint64_t prot_set, uint64_t prot_clr, uint32_t type, const struct pgtable *table)
 {
@@ -292,6 +347,84 @@ void pgtable_modify_or_del_map(uint64_t *pml4_page, uint64_t vaddr_base, uint64_
 	}
 }
 
+/*
+ * In PD level,
+ * merge the PT pages of [vaddr_start, vaddr_end), then the PD page itself
+ */
+static void merge_pde(uint64_t *pdpte, uint64_t vaddr_start, uint64_t vaddr_end,
+		const struct pgtable *table)
+{
+	uint64_t *pd_page = pdpte_page_vaddr(*pdpte);
+	uint64_t vaddr = vaddr_start;
+	uint64_t index = pde_index(vaddr);
+
+	for (; index < PTRS_PER_PDE; index++) {
+		uint64_t *pde = pd_page + index;
+		uint64_t vaddr_next = (vaddr & PDE_MASK) + PDE_SIZE;
+
+		if ((table->pgentry_present(*pde) != 0UL) && (pde_large(*pde) == 0UL)) {
+			try_to_merge_large_page(pde, IA32E_PD, table);
+		}
+		if (vaddr_next >= vaddr_end) {
+			break;	/* done */
+		}
+		vaddr = vaddr_next;
+	}
+
+	try_to_merge_large_page(pdpte, IA32E_PDPT, table);
+}
+
+/*
+ * In PDPT level,
+ * merge the PD pages of [vaddr_start, vaddr_end)
+ */
+static void merge_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, uint64_t vaddr_end,
+		const struct pgtable *table)
+{
+	uint64_t *pdpt_page = pml4e_page_vaddr(*pml4e);
+	uint64_t vaddr = vaddr_start;
+	uint64_t index = pdpte_index(vaddr);
+
+	for (; index < PTRS_PER_PDPTE; index++) {
+		uint64_t *pdpte = pdpt_page + index;
+		uint64_t vaddr_next = (vaddr & PDPTE_MASK) + PDPTE_SIZE;
+
+		if ((table->pgentry_present(*pdpte) != 0UL) && (pdpte_large(*pdpte) == 0UL)) {
+			merge_pde(pdpte, vaddr, vaddr_end, table);
+		}
+		if (vaddr_next >= vaddr_end) {
+			break;	/* done */
+		}
+		vaddr = vaddr_next;
+	}
+}
+
+/*
+ * Promote back into large pages the page tables covering [vaddr_base,
+ * vaddr_base + size) which map contiguous regions with uniform attributes,
+ * as left after the attributes split by pgtable_modify_or_del_map are
+ * restored, or a deleted region is mapped again.
+ */
+void pgtable_merge_map(uint64_t *pml4_page, uint64_t vaddr_base, uint64_t size,
+		const struct pgtable *table)
+{
+	uint64_t vaddr = round_page_up(vaddr_base);
+	uint64_t vaddr_next, vaddr_end;
+	uint64_t *pml4e;
+
+	vaddr_end = vaddr + round_page_down(size);
+	dev_dbg(DBG_LEVEL_MMU, "%s, vaddr: 0x%lx, size: 0x%lx\n", __func__, vaddr, size);
+
+	while (vaddr < vaddr_end) {
+		vaddr_next = (vaddr & PML4E_MASK) + PML4E_SIZE;
+		pml4e = pml4e_offset(pml4_page, vaddr);
+		if (table->pgentry_present(*pml4e) != 0UL) {
+			merge_pdpte(pml4e, vaddr, vaddr_end, table);
+		}
+		vaddr = vaddr_next;
+	}
+}
+
 /*
  * In PT level,
  * add [vaddr_start, vaddr_end) to [paddr_base, ...) MT PT mapping
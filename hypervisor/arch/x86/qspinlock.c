@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <asm/lib/qspinlock.h>
+#include <asm/cpu.h>
+#include <asm/per_cpu.h>
+#include <asm/tsc.h>
+
+static inline uint32_t encode_tail(uint16_t pcpu_id, uint32_t idx)
+{
+	return ((((uint32_t)pcpu_id + 1U) << 2U) | idx) << QSPINLOCK_TAIL_SHIFT;
+}
+
+static inline struct qspinlock_node *decode_tail(uint32_t val)
+{
+	uint32_t tail = (val & QSPINLOCK_TAIL_MASK) >> QSPINLOCK_TAIL_SHIFT;
+
+	return &per_cpu(qspin_nodes, (uint16_t)((tail >> 2U) - 1U))[tail & 3U];
+}
+
+/*
+ * Slow path of qspinlock_obtain(), the lock was not free.
+ *
+ * The pCPU appends its node to the queue and spins on it until its
+ * predecessor hands it the head of the queue. The head alone spins on the lock
+ * word, for the holder to release the lock. No pCPU takes the lock past the
+ * queue meanwhile: the tail keeps the lock word non-zero.
+ */
+void qspinlock_obtain_slow(qspinlock_t *lock)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+	uint32_t idx = per_cpu(qspin_nesting, pcpu_id);
+	struct qspinlock_node *node, *prev;
+	uint32_t tail, old, new;
+
+	if (idx >= QSPINLOCK_MAX_NESTING) {
+		/* out of nodes, spin on the lock word itself */
+		while (!qspinlock_trylock(lock)) {
+			asm_pause();
+		}
+	} else {
+		per_cpu(qspin_nesting, pcpu_id) = idx + 1U;
+		node = &per_cpu(qspin_nodes, pcpu_id)[idx];
+		node->next = NULL;
+		node->locked = 0U;
+		tail = encode_tail(pcpu_id, idx);
+
+		/* the locked cmpxchg publishes the node initialized above */
+		do {
+			old = lock->val;
+			new = (old & QSPINLOCK_LOCKED) | tail;
+		} while (atomic_cmpxchg32(&lock->val, old, new) != old);
+
+		if ((old & QSPINLOCK_TAIL_MASK) != 0U) {
+			prev = decode_tail(old);
+			prev->next = node;
+			while (node->locked == 0U) {
+				asm_pause();
+			}
+		}
+
+		while ((lock->val & QSPINLOCK_LOCKED) != 0U) {
+			asm_pause();
+		}
+
+		/* take the lock, and empty the queue if this pCPU is the last waiter */
+		do {
+			old = lock->val;
+			if ((old & QSPINLOCK_TAIL_MASK) == tail) {
+				new = QSPINLOCK_LOCKED;
+			} else {
+				new = old | QSPINLOCK_LOCKED;
+			}
+		} while (atomic_cmpxchg32(&lock->val, old, new) != old);
+
+		if ((old & QSPINLOCK_TAIL_MASK) != tail) {
+			/* a successor may not have linked its node yet */
+			while (node->next == NULL) {
+				asm_pause();
+			}
+			node->next->locked = 1U;
+		}
+
+		per_cpu(qspin_nesting, pcpu_id) = idx;
+	}
+}
+
+#ifdef CONFIG_LOCK_STATS
+void qspinlock_obtain(qspinlock_t *lock)
+{
+	uint64_t start = rdtsc();
+	uint64_t wait;
+	bool contended = false;
+
+	if (!qspinlock_trylock(lock)) {
+		contended = true;
+		qspinlock_obtain_slow(lock);
+	}
+
+	lock->stats.obtain_tsc = rdtsc();
+	lock->stats.nr_obtain++;
+	if (contended) {
+		wait = lock->stats.obtain_tsc - start;
+		lock->stats.nr_contended++;
+		lock->stats.wait_ticks += wait;
+		if (wait > lock->stats.max_wait_ticks) {
+			lock->stats.max_wait_ticks = wait;
+		}
+	}
+}
+
+void qspinlock_release(qspinlock_t *lock)
+{
+	uint64_t hold = rdtsc() - lock->stats.obtain_tsc;
+
+	lock->stats.hold_ticks += hold;
+	if (hold > lock->stats.max_hold_ticks) {
+		lock->stats.max_hold_ticks = hold;
+	}
+	bitmap32_clear_lock((uint16_t)QSPINLOCK_LOCKED_BIT, &lock->val);
+}
+#endif
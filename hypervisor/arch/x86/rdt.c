@@ -16,6 +16,8 @@
 #include <asm/board.h>
 #include <asm/vm_config.h>
 #include <asm/msr.h>
+#include <asm/lib/spinlock.h>
+#include <acrn_common.h>
 
 const uint16_t hv_clos = 0U;
 /* RDT features can support different numbers of CLOS. Set the lowers numerical
@@ -60,6 +62,24 @@ static struct rdt_info res_cap_info[RDT_NUM_RESOURCES] = {
 	},
 };
 
+/* L3 cache monitoring capability, max_rmid == 0 indicates it is not supported */
+static struct {
+	uint32_t max_rmid;	/* Maximum RMID of the L3 monitoring */
+	uint32_t upscale;	/* Bytes each unit of IA32_QM_CTR stands for */
+	uint32_t events;	/* Bitmap of the supported events, RDT_MON_EVENT_* */
+} mon_cap_info;
+
+#define RDT_MON_EVENT_L3_OCCUPANCY	1U
+#define RDT_MON_EVENT_MBM_TOTAL		2U
+#define RDT_MON_EVENT_MBM_LOCAL		3U
+
+#define QM_CTR_ERROR			(1UL << 63U)
+#define QM_CTR_UNAVAILABLE		(1UL << 62U)
+#define QM_CTR_MASK			((1UL << 62U) - 1UL)
+
+/* Serializes the runtime changes of the CLOS settings */
+static spinlock_t rdt_clos_lock = { .head = 0U, .tail = 0U };
+
 /*
  * @pre res == RDT_RESOURCE_L3 || res == RDT_RESOURCE_L2
  */
@@ -106,6 +126,24 @@ static void init_mba_capability(int res)
 	res_cap_info[res].clos_max = (uint16_t)(edx & 0xffffU) + 1U;
 }
 
+static void init_mon_capability(void)
+{
+	uint32_t eax = 0U, ebx = 0U, ecx = 0U, edx = 0U;
+
+	/* CPUID.(EAX=0xF,ECX=0):EDX[1] reports if L3 cache monitoring is supported */
+	cpuid_subleaf(CPUID_RDT_MONITORING, 0U, &eax, &ebx, &ecx, &edx);
+	if ((edx & 0x2U) != 0U) {
+		/* CPUID.(EAX=0xF,ECX=1):EBX reports the conversion factor of IA32_QM_CTR to bytes
+		 * CPUID.(EAX=0xF,ECX=1):ECX reports the maximum RMID of L3 monitoring
+		 * CPUID.(EAX=0xF,ECX=1):EDX[2:0] reports occupancy, total and local bandwidth monitoring
+		 */
+		cpuid_subleaf(CPUID_RDT_MONITORING, 1U, &eax, &ebx, &ecx, &edx);
+		mon_cap_info.upscale = ebx;
+		mon_cap_info.max_rmid = ecx;
+		mon_cap_info.events = (edx & 0x7U) << 1U;
+	}
+}
+
 /*
  * @pre valid_clos_num > 0U
  */
@@ -132,6 +170,10 @@ void init_rdt_info(void)
 			init_mba_capability(RDT_RESOURCE_MBA);
 		}
 
+		if (pcpu_has_cap(X86_FEATURE_RDT_M)) {
+			init_mon_capability();
+		}
+
 		for (i = 0U; i < RDT_NUM_RESOURCES; i++) {
 			/* If clos_max == 0, the resource is not supported. Set the
 			 * valid_clos_num as the minimal clos_max of all support rdt resource.
@@ -193,16 +235,180 @@ void setup_clos(uint16_t pcpu_id)
 	msr_write_pcpu(MSR_IA32_PQR_ASSOC, clos2pqr_msr(hv_clos), pcpu_id);
 }
 
+/*
+ * With L3 monitoring, the RMID is set to the CLOS so that the monitoring
+ * counters can be read per CLOS.
+ */
 uint64_t clos2pqr_msr(uint16_t clos)
 {
 	uint64_t pqr_assoc;
 
 	pqr_assoc = msr_read(MSR_IA32_PQR_ASSOC);
+	if ((mon_cap_info.events != 0U) && ((uint32_t)clos <= mon_cap_info.max_rmid)) {
+		pqr_assoc = (pqr_assoc & 0xfffffc00UL) | (uint64_t)clos;
+	}
 	pqr_assoc = (pqr_assoc & 0xffffffffUL) | ((uint64_t)clos << 32U);
 
 	return pqr_assoc;
 }
 
+/*
+ * @pre res < RDT_NUM_RESOURCES
+ */
+static bool is_valid_clos_value(uint16_t res, uint32_t value)
+{
+	uint32_t lowest_bit = value & (~value + 1U);
+	bool valid;
+
+	if (res == RDT_RESOURCE_MBA) {
+		valid = (value <= res_cap_info[res].res.membw.mba_max);
+	} else {
+		/* The set bits of a capacity bitmask shall be contiguous and within cbm_len */
+		valid = (value != 0U) && (((value + lowest_bit) & value) == 0U) &&
+			(fls32(value) < res_cap_info[res].res.cache.cbm_len);
+	}
+
+	return valid;
+}
+
+/*
+ * @pre res < RDT_NUM_RESOURCES && res_cap_info[res].clos_max > 0U
+ * @pre clos < valid_clos_num
+ */
+static void set_clos_value(uint16_t res, uint16_t clos, uint32_t value)
+{
+	uint16_t i, pcpu_id, nr_entries = 1U, index = clos;
+	uint64_t mask = get_active_pcpu_bitmap();
+
+	/* With CDP, the data and the code mask of a CLOS are set alike */
+	if ((res != RDT_RESOURCE_MBA) && res_cap_info[res].res.cache.is_cdp_enabled) {
+		index = clos << 1U;
+		nr_entries = 2U;
+	}
+	for (i = index; i < (index + nr_entries); i++) {
+		if (res == RDT_RESOURCE_MBA) {
+			res_cap_info[res].platform_clos_array[i].value.mba_delay = (uint16_t)value;
+		} else {
+			res_cap_info[res].platform_clos_array[i].value.clos_mask = value;
+		}
+		/* The MSRs are per core or per package, the same value is written on each pCPU for simplicity */
+		for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+			if (bitmap_test(pcpu_id, &mask)) {
+				msr_write_pcpu(res_cap_info[res].msr_base + i, (uint64_t)value, pcpu_id);
+			}
+		}
+	}
+}
+
+/*
+ * @pre res < RDT_NUM_RESOURCES && res_cap_info[res].clos_max > 0U
+ * @pre clos < valid_clos_num
+ */
+static uint32_t get_clos_value(uint16_t res, uint16_t clos)
+{
+	uint16_t index = clos;
+	uint32_t value;
+
+	if (res == RDT_RESOURCE_MBA) {
+		value = (uint32_t)res_cap_info[res].platform_clos_array[index].value.mba_delay;
+	} else {
+		if (res_cap_info[res].res.cache.is_cdp_enabled) {
+			index = clos << 1U;
+		}
+		value = res_cap_info[res].platform_clos_array[index].value.clos_mask;
+	}
+
+	return value;
+}
+
+/*
+ * Read a monitoring counter of the RMID on the current pCPU, which reports
+ * for the L3 cache of its package.
+ *
+ * @return false if the counter is not available
+ */
+static bool read_mon_counter(uint32_t event, uint16_t rmid, uint64_t *bytes)
+{
+	uint64_t ctr = QM_CTR_UNAVAILABLE;
+
+	if (((mon_cap_info.events & (1U << event)) != 0U) && ((uint32_t)rmid <= mon_cap_info.max_rmid)) {
+		msr_write(MSR_IA32_QM_EVTSEL, ((uint64_t)rmid << 32U) | (uint64_t)event);
+		ctr = msr_read(MSR_IA32_QM_CTR);
+		*bytes = (ctr & QM_CTR_MASK) * mon_cap_info.upscale;
+	}
+
+	return ((ctr & (QM_CTR_ERROR | QM_CTR_UNAVAILABLE)) == 0UL);
+}
+
+/*
+ * @brief Change the allocation of a CLOS and read its settings and counters
+ *
+ * The settings flagged in rdt->set_flags are checked and programmed on all
+ * pCPUs. They are not taken back on failure, the returned values tell what
+ * is in effect.
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if a setting is invalid, unsupported or for the CLOS of the hypervisor
+ * @retval -ENODEV if the platform does not support RDT
+ */
+int32_t rdt_clos_config(uint16_t clos, struct acrn_rdt_clos *rdt)
+{
+	static const uint32_t res_flags[RDT_NUM_RESOURCES] = {
+		[RDT_RESOURCE_L3] = ACRN_RDT_L3_MASK,
+		[RDT_RESOURCE_L2] = ACRN_RDT_L2_MASK,
+		[RDT_RESOURCE_MBA] = ACRN_RDT_MBA_DELAY,
+	};
+	uint32_t *values[RDT_NUM_RESOURCES] = {
+		[RDT_RESOURCE_L3] = &rdt->l3_mask,
+		[RDT_RESOURCE_L2] = &rdt->l2_mask,
+		[RDT_RESOURCE_MBA] = &rdt->mba_delay,
+	};
+	uint16_t res;
+	int32_t ret = 0;
+
+	if (!is_platform_rdt_capable() || (clos >= valid_clos_num)) {
+		ret = -ENODEV;
+	} else if ((rdt->set_flags != 0U) && (clos == hv_clos)) {
+		pr_err("%s: CLOS %u is used by the hypervisor", __func__, clos);
+		ret = -EINVAL;
+	} else {
+		spinlock_obtain(&rdt_clos_lock);
+		rdt->clos = clos;
+		rdt->flags = 0U;
+		for (res = 0U; res < RDT_NUM_RESOURCES; res++) {
+			if (res_cap_info[res].clos_max == 0U) {
+				if ((rdt->set_flags & res_flags[res]) != 0U) {
+					ret = -EINVAL;
+				}
+				continue;
+			}
+			if ((rdt->set_flags & res_flags[res]) != 0U) {
+				if (is_valid_clos_value(res, *values[res])) {
+					set_clos_value(res, clos, *values[res]);
+				} else {
+					pr_err("%s: invalid value 0x%x of resource %u", __func__, *values[res], res);
+					ret = -EINVAL;
+				}
+			}
+			*values[res] = get_clos_value(res, clos);
+			rdt->flags |= res_flags[res];
+		}
+		spinlock_release(&rdt_clos_lock);
+
+		if (read_mon_counter(RDT_MON_EVENT_L3_OCCUPANCY, clos, &rdt->l3_occupancy)) {
+			rdt->flags |= ACRN_RDT_L3_OCCUPANCY;
+		}
+		if (read_mon_counter(RDT_MON_EVENT_MBM_TOTAL, clos, &rdt->mbm_total)) {
+			rdt->flags |= ACRN_RDT_MBM_TOTAL;
+		}
+		if (read_mon_counter(RDT_MON_EVENT_MBM_LOCAL, clos, &rdt->mbm_local)) {
+			rdt->flags |= ACRN_RDT_MBM_LOCAL;
+		}
+	}
+
+	return ret;
+}
+
 bool is_platform_rdt_capable(void)
 {
 	bool ret = false;
@@ -221,6 +427,11 @@ uint64_t clos2pqr_msr(__unused uint16_t clos)
 	return 0UL;
 }
 
+int32_t rdt_clos_config(__unused uint16_t clos, __unused struct acrn_rdt_clos *rdt)
+{
+	return -ENODEV;
+}
+
 bool is_platform_rdt_capable(void)
 {
 	return false;
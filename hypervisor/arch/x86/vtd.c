@@ -88,6 +88,8 @@ static inline uint64_t dmar_set_bitslice(uint64_t var, uint64_t mask, uint32_t p
 
 #define DMAR_INVALIDATION_QUEUE_SIZE	4096U
 #define DMAR_QI_INV_ENTRY_SIZE		16U
+/* invalidation descriptors submitted at once, one more entry is left for the wait descriptor */
+#define DMAR_QI_MAX_BATCH		(DMAR_INVALIDATION_QUEUE_SIZE / DMAR_QI_INV_ENTRY_SIZE)
 #define DMAR_NUM_IR_ENTRIES_PER_PAGE	256U
 
 #define DMAR_INV_STATUS_WRITE_SHIFT	5U
@@ -259,8 +261,8 @@ static inline void dmar_wait_completion(const struct dmar_drhd_rt *dmar_unit, ui
 }
 
 /* Flush CPU cache when root table, context table or second-level translation teable updated
- * In the context of ACRN, GPA to HPA mapping relationship is not changed after VM created,
- * skip flushing iotlb to avoid performance penalty.
+ * The IOTLB is flushed separately, by iommu_flush_domain() once the second-level translation
+ * table of a domain with devices has changed.
  */
 void iommu_flush_cache(const void *p, uint32_t size)
 {
@@ -541,22 +543,31 @@ static struct dmar_drhd_rt *device_to_dmaru(uint8_t bus, uint8_t devfun)
 	return dmaru;
 }
 
-static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+/*
+ * Submit a batch of invalidation descriptors followed by a single wait descriptor,
+ * and wait for the hardware to complete them all.
+ *
+ * @pre num < DMAR_QI_MAX_BATCH
+ */
+static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, const struct dmar_entry *invalidate_desc,
+	uint32_t num)
 {
 	struct dmar_entry *invalidate_desc_ptr;
 	uint32_t qi_status = 0U;
+	uint32_t i;
 	uint64_t start;
 
 	spinlock_obtain(&(dmar_unit->lock));
 
-	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
-
-	invalidate_desc_ptr->hi_64 = invalidate_desc.hi_64;
-	invalidate_desc_ptr->lo_64 = invalidate_desc.lo_64;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
-
-	invalidate_desc_ptr++;
+	/* the queue is drained by each request, so it doesn't fill up */
+	for (i = 0U; i < num; i++) {
+		invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+		invalidate_desc_ptr->hi_64 = invalidate_desc[i].hi_64;
+		invalidate_desc_ptr->lo_64 = invalidate_desc[i].lo_64;
+		dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+	}
 
+	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
 	invalidate_desc_ptr->hi_64 = hva2hpa(&qi_status);
 	invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
 	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
@@ -582,8 +593,7 @@ static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_en
  * fm: function mask
  * cirg: cache-invalidation request granularity
  */
-static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
-	uint16_t did, uint16_t sid, uint8_t fm, enum dmar_cirg_type cirg)
+static struct dmar_entry dmar_context_cache_desc(uint16_t did, uint16_t sid, uint8_t fm, enum dmar_cirg_type cirg)
 {
 	struct dmar_entry invalidate_desc;
 
@@ -605,18 +615,11 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 		break;
 	}
 
-	if (invalidate_desc.lo_64 != 0UL) {
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-	}
+	return invalidate_desc;
 }
 
-static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
-}
-
-static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t address, uint8_t am,
-			       bool hint, enum dmar_iirg_type iirg)
+static struct dmar_entry dmar_iotlb_desc(uint16_t did, uint64_t address, uint8_t am, bool hint,
+	enum dmar_iirg_type iirg)
 {
 	/* set Drain Reads & Drain Writes,
 	 * if hardware doesn't support it, will be ignored by hardware
@@ -648,19 +651,7 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 		pr_err("unknown IIRG type");
 	}
 
-	if (invalidate_desc.lo_64 != 0UL) {
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-	}
-}
-
-/* Invalidate IOTLB globally,
- * all iotlb entries are invalidated,
- * all PASID-cache entries are invalidated,
- * all paging-structure-cache entries are invalidated.
- */
-static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
+	return invalidate_desc;
 }
 
 /* @pre dmar_unit->ir_table_addr != NULL */
@@ -685,8 +676,7 @@ static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 	spinlock_release(&(dmar_unit->lock));
 }
 
-static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index,
-				uint8_t index_mask, bool is_global)
+static struct dmar_entry dmar_iec_desc(uint16_t intr_index, uint8_t index_mask, bool is_global)
 {
 	struct dmar_entry invalidate_desc;
 
@@ -699,14 +689,58 @@ static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index
 		invalidate_desc.lo_64 |= DMAR_IECI_INDEXED | dma_iec_index(intr_index, index_mask);
 	}
 
-	if (invalidate_desc.lo_64 != 0UL) {
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-	}
+	return invalidate_desc;
+}
+
+static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index, uint8_t index_mask)
+{
+	struct dmar_entry invalidate_desc = dmar_iec_desc(intr_index, index_mask, false);
+
+	dmar_issue_qi_request(dmar_unit, &invalidate_desc, 1U);
+}
+
+/* Invalidate the context cache, the IOTLB and the interrupt entry cache globally,
+ * all iotlb entries are invalidated,
+ * all PASID-cache entries are invalidated,
+ * all paging-structure-cache entries are invalidated.
+ */
+static void dmar_invalid_all(struct dmar_drhd_rt *dmar_unit)
+{
+	struct dmar_entry invalidate_desc[3];
+
+	invalidate_desc[0] = dmar_context_cache_desc(0U, 0U, 0U, DMAR_CIRG_GLOBAL);
+	invalidate_desc[1] = dmar_iotlb_desc(0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
+	invalidate_desc[2] = dmar_iec_desc(0U, 0U, true);
+	dmar_issue_qi_request(dmar_unit, invalidate_desc, 3U);
 }
 
-static void dmar_invalid_iec_global(struct dmar_drhd_rt *dmar_unit)
+/*
+ * Invalidate the IOTLB entries of a domain for [gpa, gpa + size), by a page-selective
+ * invalidation of the smallest naturally aligned block covering the range if the unit
+ * supports it, by a domain-selective one otherwise.
+ *
+ * @pre size != 0
+ */
+static struct dmar_entry dmar_iotlb_range_desc(const struct dmar_drhd_rt *dmar_unit, uint16_t did,
+	uint64_t gpa, uint64_t size)
 {
-	dmar_invalid_iec(dmar_unit, 0U, 0U, true);
+	uint64_t first = gpa >> PAGE_SHIFT, last = (gpa + size - 1UL) >> PAGE_SHIFT;
+	uint8_t am = 0U;
+	struct dmar_entry invalidate_desc;
+
+	while ((first >> am) != (last >> am)) {
+		am++;
+	}
+
+	if ((iommu_cap_pgsel_inv(dmar_unit->cap) != 0U) && (am <= iommu_cap_max_amask_val(dmar_unit->cap))) {
+		/* the paging-structure entries may have changed as well, no invalidation hint */
+		invalidate_desc = dmar_iotlb_desc(did, (first >> am) << (am + PAGE_SHIFT), am, false,
+			DMAR_IIRG_PAGE);
+	} else {
+		invalidate_desc = dmar_iotlb_desc(did, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+	}
+
+	return invalidate_desc;
 }
 
 /* @pre dmar_unit->root_table_addr != NULL */
@@ -932,9 +966,7 @@ static void prepare_dmar(struct dmar_drhd_rt *dmar_unit)
 static void enable_dmar(struct dmar_drhd_rt *dmar_unit)
 {
 	dev_dbg(DBG_LEVEL_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_all(dmar_unit);
 	dmar_enable_translation(dmar_unit);
 }
 
@@ -950,9 +982,7 @@ static void suspend_dmar(struct dmar_drhd_rt *dmar_unit)
 {
 	uint32_t i;
 
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_all(dmar_unit);
 
 	disable_dmar(dmar_unit);
 
@@ -1089,6 +1119,7 @@ static int32_t iommu_detach_device(const struct iommu_domain *domain, uint8_t bu
 	struct dmar_entry *context;
 	struct dmar_entry *root_entry;
 	struct dmar_entry *context_entry;
+	struct dmar_entry invalidate_desc[2];
 	/* source id */
 	union pci_bdf sid;
 	int32_t ret = -EINVAL;
@@ -1123,10 +1154,11 @@ static int32_t iommu_detach_device(const struct iommu_domain *domain, uint8_t bu
 			context_entry->hi_64 = 0UL;
 			iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
 
-			dmar_invalid_context_cache(dmar_unit, vmid_to_domainid(domain->vm_id), sid.value, 0U,
+			invalidate_desc[0] = dmar_context_cache_desc(vmid_to_domainid(domain->vm_id), sid.value, 0U,
 							DMAR_CIRG_DEVICE);
-			dmar_invalid_iotlb(dmar_unit, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
+			invalidate_desc[1] = dmar_iotlb_desc(vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
 							DMAR_IIRG_DOMAIN);
+			dmar_issue_qi_request(dmar_unit, invalidate_desc, 2U);
 		}
 	} else if (is_dmar_unit_ignored(dmar_unit)) {
 	       ret = 0;
@@ -1196,7 +1228,7 @@ void destroy_iommu_domain(struct iommu_domain *domain)
  * @pre (from_domain != NULL) || (to_domain != NULL)
  */
 
-int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun)
+int32_t move_pt_device(struct iommu_domain *from_domain, struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun)
 {
 	int32_t status = 0;
 	uint16_t bus_local = bus;
@@ -1206,10 +1238,16 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iomm
 	if (bus_local < CONFIG_IOMMU_BUS_NUM) {
 		if (from_domain != NULL) {
 			status = iommu_detach_device(from_domain, bus, devfun);
+			if (status == 0) {
+				from_domain->dev_num--;
+			}
 		}
 
 		if ((status == 0) && (to_domain != NULL)) {
 			status = iommu_attach_device(to_domain, bus, devfun);
+			if (status == 0) {
+				to_domain->dev_num++;
+			}
 		}
 	} else {
 		status = -EINVAL;
@@ -1218,6 +1256,29 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iomm
 	return status;
 }
 
+/*
+ * @pre domain != NULL
+ * @pre size != 0
+ */
+void iommu_flush_domain(const struct iommu_domain *domain, uint64_t gpa, uint64_t size)
+{
+	struct dmar_drhd_rt *dmar_unit;
+	struct dmar_entry invalidate_desc;
+	uint32_t i;
+
+	/* nothing can have cached the translations of a domain without devices */
+	if (domain->dev_num != 0U) {
+		for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			if (!dmar_unit->drhd->ignore) {
+				invalidate_desc = dmar_iotlb_range_desc(dmar_unit, vmid_to_domainid(domain->vm_id),
+					gpa, size);
+				dmar_issue_qi_request(dmar_unit, &invalidate_desc, 1U);
+			}
+		}
+	}
+}
+
 void enable_iommu(void)
 {
 	do_action_for_iommus(enable_dmar);
@@ -1378,7 +1439,7 @@ int32_t dmar_assign_irte(const struct intr_source *intr_src, union dmar_ir_entry
 				*ir_entry = *irte;
 			}
 			iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
-			dmar_invalid_iec(dmar_unit, *idx_out, 0U, false);
+			dmar_invalid_iec(dmar_unit, *idx_out, 0U);
 		}
 		ret = 0;
 	}
@@ -1404,7 +1465,7 @@ void dmar_free_irte(const struct intr_source *intr_src, uint16_t index)
 		ir_entry->bits.remap.present = 0x0UL;
 
 		iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
-		dmar_invalid_iec(dmar_unit, index, 0U, false);
+		dmar_invalid_iec(dmar_unit, index, 0U);
 
 		if (!is_irte_reserved(dmar_unit, index)) {
 			spinlock_obtain(&dmar_unit->lock);
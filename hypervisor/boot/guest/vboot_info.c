@@ -30,6 +30,44 @@
 
 #define PRE_VM_MAX_RAM_ADDR_BELOW_4GB		(VIRT_ACPI_DATA_ADDR - 1U)
 
+/**
+ * @brief Find the GPA of a pre-launched VM memory which is backed by a given HPA range
+ *
+ * Each RAM entry of the ve820 of a pre-launched VM is backed by a contiguous HPA
+ * range, so a module the bootloader happened to put inside the memory of the VM
+ * can be used where it is instead of being copied.
+ *
+ * @return The GPA of the range, or INVALID_GPA if the range is not in a single
+ *	RAM entry within [min_addr, max_addr).
+ *
+ * @pre vm != NULL
+ */
+static uint64_t pre_vm_hpa2gpa(struct acrn_vm *vm, uint64_t hpa, uint64_t size, uint64_t min_addr, uint64_t max_addr)
+{
+	uint32_t i;
+	uint64_t gpa = INVALID_GPA;
+
+	for (i = 0U; i < vm->e820_entry_num; i++) {
+		const struct e820_entry *entry = vm->e820_entries + i;
+		uint64_t entry_hpa;
+
+		if ((entry->type == E820_TYPE_RAM) && (entry->length >= size)) {
+			entry_hpa = gpa2hpa(vm, entry->baseaddr);
+			if ((entry_hpa != INVALID_HPA) && (hpa >= entry_hpa)
+					&& ((hpa - entry_hpa) <= (entry->length - size))) {
+				gpa = entry->baseaddr + (hpa - entry_hpa);
+				break;
+			}
+		}
+	}
+
+	if ((gpa != INVALID_GPA) && ((gpa < min_addr) || ((gpa + size) > max_addr))) {
+		gpa = INVALID_GPA;
+	}
+
+	return gpa;
+}
+
 /**
  * @pre vm != NULL && mod != NULL
  */
@@ -92,11 +130,23 @@ static void init_vm_ramdisk_info(struct acrn_vm *vm, const struct abi_module *mo
 			}
 		}
 	} else {
-		/* For pre-launched VM, the ramdisk would be put by searching ve820 table.
+		/* For pre-launched VM, the ramdisk is used in place if the bootloader put it,
+		 * page aligned, in the memory of the VM and away from the kernel. Otherwise
+		 * it would be put by searching ve820 table.
 		 */
 		ramdisk_gpa_max = min(PRE_VM_MAX_RAM_ADDR_BELOW_4GB, ramdisk_gpa_max);
 
-		if (kernel_end < ramdisk_gpa_max) {
+		if ((vm->sw.ramdisk_info.src_addr != NULL) && mem_aligned_check(
+				hva2hpa(vm->sw.ramdisk_info.src_addr), PAGE_SIZE)) {
+			ramdisk_load_gpa = pre_vm_hpa2gpa(vm, hva2hpa(vm->sw.ramdisk_info.src_addr),
+					vm->sw.ramdisk_info.size, MEM_1M, ramdisk_gpa_max);
+			if ((ramdisk_load_gpa != INVALID_GPA) && (ramdisk_load_gpa < kernel_end)
+					&& ((ramdisk_load_gpa + vm->sw.ramdisk_info.size) > kernel_start)) {
+				ramdisk_load_gpa = INVALID_GPA;
+			}
+		}
+
+		if ((ramdisk_load_gpa == INVALID_GPA) && (kernel_end < ramdisk_gpa_max)) {
 			ramdisk_load_gpa = find_space_from_ve820(vm, vm->sw.ramdisk_info.size,
 					kernel_end, ramdisk_gpa_max);
 		}
@@ -7,6 +7,7 @@
 #include <asm/guest/vm.h>
 #include <asm/guest/vm_reset.h>
 #include <asm/guest/vmcs.h>
+#include <asm/guest/ept.h>
 #include <asm/guest/vmexit.h>
 #include <asm/guest/virq.h>
 #include <schedule.h>
@@ -14,11 +15,36 @@
 #include <sprintf.h>
 #include <trace.h>
 #include <logmsg.h>
+#include <ticks.h>
+#include <rt_latency.h>
+#include <asm/msr.h>
+#include <asm/idle.h>
+
+/*
+ * The time a vCPU with the LAPIC passed through spent out of the guest since
+ * its VM exit at exit_tsc, and the delay of its TSC deadline timer if it fired
+ * meanwhile: the interrupt stays pending in the LAPIC until the VM entry.
+ */
+static void account_rt_entry(uint64_t exit_tsc, uint64_t tsc_deadline)
+{
+	struct acrn_rt_latency *lat = &get_cpu_var(rt_latency);
+	uint64_t entry_tsc = cpu_ticks();
+
+	account_latency(&lat->entry_delay, entry_tsc - exit_tsc);
+
+	/* an expired deadline reads 0, unlike one the guest rewrote meanwhile */
+	if ((tsc_deadline != 0UL) && (tsc_deadline <= entry_tsc) &&
+			(msr_read(MSR_IA32_TSC_DEADLINE) == 0UL)) {
+		account_latency(&lat->timer_delay, entry_tsc - max(tsc_deadline, exit_tsc));
+	}
+}
 
 void vcpu_thread(struct thread_object *obj)
 {
 	struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
+	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
 	uint32_t basic_exit_reason = 0U;
+	uint64_t exit_tsc = 0UL, tsc_deadline = 0UL;
 	int32_t ret = 0;
 
 	do {
@@ -27,14 +53,32 @@ void vcpu_thread(struct thread_object *obj)
 		}
 
 		/* Don't open interrupt window between here and vmentry */
-		if (need_reschedule(pcpuid_from_vcpu(vcpu))) {
+		if (need_reschedule(pcpu_id)) {
 			schedule();
+			/* switched out, e.g. paused: not a delay of the hypervisor */
+			exit_tsc = 0UL;
+			/* it may have been migrated meanwhile, see vcpu_migrate() */
+			pcpu_id = pcpuid_from_vcpu(vcpu);
+		}
+
+		/* Requests made from now on until the VM exit need a kick */
+		vcpu->arch.in_guest = true;
+		set_reschedule_polling(pcpu_id, false);
+		cpu_memory_barrier();
+
+		/* a reschedule request made while polling was not kicked */
+		if (need_reschedule(pcpu_id)) {
+			vcpu->arch.in_guest = false;
+			set_reschedule_polling(pcpu_id, true);
+			continue;
 		}
 
 		/* Check and process pending requests(including interrupt) */
 		ret = acrn_handle_pending_request(vcpu);
 		if (ret < 0) {
 			pr_fatal("vcpu handling pending request fail");
+			vcpu->arch.in_guest = false;
+			set_reschedule_polling(pcpu_id, true);
 			get_vm_lock(vcpu->vm);
 			zombie_vcpu(vcpu, VCPU_ZOMBIE);
 			put_vm_lock(vcpu->vm);
@@ -45,8 +89,27 @@ void vcpu_thread(struct thread_object *obj)
 		reset_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
 		profiling_vmenter_handler(vcpu);
 
+		if (exit_tsc != 0UL) {
+			account_rt_entry(exit_tsc, tsc_deadline);
+		}
+
 		TRACE_2L(TRACE_VM_ENTER, 0UL, 0UL);
 		ret = run_vcpu(vcpu);
+		exit_tsc = 0UL;
+		if ((ret == 0) && is_lapic_pt_enabled(vcpu)) {
+			/* the TSC deadline of the guest, in the physical LAPIC */
+			exit_tsc = cpu_ticks();
+			tsc_deadline = msr_read(MSR_IA32_TSC_DEADLINE);
+		}
+		/*
+		 * drained before in_guest turns false, see ept_dirty_log_sync(), and
+		 * only once the vCPU enabled its PML: the index holds nothing before
+		 */
+		if (vcpu->arch.pml_armed) {
+			ept_drain_pml(vcpu);
+		}
+		vcpu->arch.in_guest = false;
+		set_reschedule_polling(pcpu_id, true);
 		if (ret != 0) {
 			pr_fatal("vcpu resume failed");
 			get_vm_lock(vcpu->vm);
@@ -82,6 +145,8 @@ void default_idle(__unused struct thread_object *obj)
 {
 	uint16_t pcpu_id = get_pcpu_id();
 
+	/* cpu_idle() also polls while it sleeps, unless it asks for an IPI */
+	set_reschedule_polling(pcpu_id, true);
 	while (1) {
 		if (need_reschedule(pcpu_id)) {
 			schedule();
@@ -89,10 +154,10 @@ void default_idle(__unused struct thread_object *obj)
 			cpu_dead();
 		} else if (need_shutdown_vm(pcpu_id)) {
 			shutdown_vm_from_idle(pcpu_id);
+		} else if (need_scrub_mem(pcpu_id)) {
+			scrub_mem_from_idle(pcpu_id);
 		} else {
-			CPU_IRQ_ENABLE();
-			cpu_do_idle();
-			CPU_IRQ_DISABLE();
+			cpu_idle(pcpu_id);
 		}
 	}
 }
@@ -25,8 +25,10 @@
 #include <asm/rtcm.h>
 #include <asm/irq.h>
 #include <ticks.h>
+#include <asm/tsc.h>
 #include <asm/cpuid.h>
 #include <vroot_port.h>
+#include <asm/rdt.h>
 
 #define DBG_LEVEL_HYCALL	6U
 
@@ -231,6 +233,82 @@ int32_t hcall_get_platform_info(struct acrn_vcpu *vcpu, __unused struct acrn_vm
 	return ret;
 }
 
+/**
+ * @brief Get the event counters of a physical CPU
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 guest physical address pointing to struct acrn_pcpu_stats,
+ *               whose pcpu_id selects the physical CPU
+ * @param param2 not used
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, -1 in case of error.
+ */
+int32_t hcall_get_pcpu_stats(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, __unused uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint16_t pcpu_id;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vm, &pcpu_id, param1, sizeof(pcpu_id)) == 0) {
+		if (pcpu_id < get_pcpu_nums()) {
+			ret = copy_to_gpa(vm, &per_cpu(stats, pcpu_id), param1, sizeof(struct acrn_pcpu_stats));
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Get the latencies the hypervisor adds on a physical CPU
+ *
+ * The histograms are copied from the memory of the pCPU, which is not
+ * interrupted.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 guest physical address pointing to struct acrn_rt_latency,
+ *               whose pcpu_id selects the physical CPU
+ * @param param2 not used
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, -1 in case of error.
+ */
+int32_t hcall_get_rt_latency(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, __unused uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_rt_latency lat;
+	struct acrn_vcpu *running;
+	uint16_t pcpu_id;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vm, &pcpu_id, param1, sizeof(pcpu_id)) == 0) {
+		if (pcpu_id < get_pcpu_nums()) {
+			lat = per_cpu(rt_latency, pcpu_id);
+			lat.pcpu_id = pcpu_id;
+			lat.tsc_khz = get_tsc_khz();
+			lat.vm_id = 0xffffU;
+			lat.flags = 0U;
+			running = get_running_vcpu(pcpu_id);
+			if (running != NULL) {
+				lat.vm_id = running->vm->vm_id;
+				if (is_lapic_pt_enabled(running)) {
+					lat.flags |= RT_LATENCY_LAPIC_PT;
+				}
+				if (is_rt_vm(running->vm)) {
+					lat.flags |= RT_LATENCY_RT_VM;
+				}
+			}
+			ret = copy_to_gpa(vm, &lat, param1, sizeof(lat));
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief create virtual machine
  *
@@ -263,6 +341,7 @@ int32_t hcall_create_vm(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint6
 
 			/* Filter out the bits should not set by DM and then assign it to guest_flags */
 			vm_config->guest_flags |= (cv.vm_flag & DM_OWNED_GUEST_FLAG_MASK);
+			vm_config->tsc_khz = cv.tsc_khz;
 
 			/* post-launched VM is allowed to choose pCPUs from vm_config->cpu_affinity only */
 			if ((cv.cpu_affinity & ~(vm_config->cpu_affinity)) == 0UL) {
@@ -448,6 +527,42 @@ int32_t hcall_create_vcpu(__unused struct acrn_vcpu *vcpu, __unused struct acrn_
 	return 0;
 }
 
+/**
+ * @brief change and read the RDT allocation of the CLOS of a vCPU
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_rdt_clos
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_rdt_clos(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_rdt_clos rdt;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &rdt, param2, sizeof(rdt)) != 0) {
+		} else if (rdt.vcpu_id >= target_vm->hw.created_vcpus) {
+			pr_err("%s: invalid vcpu_id %u", __func__, rdt.vcpu_id);
+		} else {
+			ret = rdt_clos_config(get_vm_config(target_vm->vm_id)->clos[rdt.vcpu_id], &rdt);
+			/* Report the settings in effect also when some could not be applied */
+			if ((ret != -ENODEV) && (copy_to_gpa(vm, &rdt, param2, sizeof(rdt)) != 0)) {
+				ret = -EINVAL;
+			}
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
 /**
  * @brief set or clear IRQ line
  *
@@ -462,29 +577,37 @@ int32_t hcall_create_vcpu(__unused struct acrn_vcpu *vcpu, __unused struct acrn_
  * @pre is_sos_vm(vcpu->vm)
  * @return 0 on success, non-zero on error.
  */
-int32_t hcall_set_irqline(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, __unused uint64_t param1, uint64_t param2)
+static int32_t set_vm_irqline(struct acrn_vm *vm, struct acrn_vm *target_vm, const struct acrn_irqline_ops *ops)
 {
-	struct acrn_vm *vm = vcpu->vm;
 	uint32_t irq_pic;
 	int32_t ret = -1;
+
+	if (ops->gsi < get_vm_gsicount(vm)) {
+		if (ops->gsi < vpic_pincount()) {
+			/*
+			 * IRQ line for 8254 timer is connected to
+			 * I/O APIC pin #2 but PIC pin #0,route GSI
+			 * number #2 to PIC IRQ #0.
+			 */
+			irq_pic = (ops->gsi == 2U) ? 0U : ops->gsi;
+			vpic_set_irqline(vm_pic(target_vm), irq_pic, ops->op);
+		}
+
+		/* handle IOAPIC irqline */
+		vioapic_set_irqline_lock(target_vm, ops->gsi, ops->op);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+int32_t hcall_set_irqline(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, __unused uint64_t param1, uint64_t param2)
+{
+	int32_t ret = -1;
 	struct acrn_irqline_ops *ops = (struct acrn_irqline_ops *)&param2;
 
 	if (is_severity_pass(target_vm->vm_id) && !is_poweroff_vm(target_vm)) {
-		if (ops->gsi < get_vm_gsicount(vm)) {
-			if (ops->gsi < vpic_pincount()) {
-				/*
-				 * IRQ line for 8254 timer is connected to
-				 * I/O APIC pin #2 but PIC pin #0,route GSI
-				 * number #2 to PIC IRQ #0.
-				 */
-				irq_pic = (ops->gsi == 2U) ? 0U : ops->gsi;
-				vpic_set_irqline(vm_pic(target_vm), irq_pic, ops->op);
-			}
-
-			/* handle IOAPIC irqline */
-			vioapic_set_irqline_lock(target_vm, ops->gsi, ops->op);
-			ret = 0;
-		}
+		ret = set_vm_irqline(vcpu->vm, target_vm, ops);
 	}
 
 	return ret;
@@ -519,6 +642,156 @@ int32_t hcall_inject_msi(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, __un
 	return ret;
 }
 
+/**
+ * @brief inject several MSI interrupts
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to struct acrn_msi_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_inject_msi_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_msi_batch batch;
+	uint32_t i;
+	int32_t ret = -1;
+
+	if (is_severity_pass(target_vm->vm_id) && !is_poweroff_vm(target_vm)) {
+		if ((copy_from_gpa(vcpu->vm, &batch, param2, sizeof(batch)) == 0) &&
+				(batch.count <= ACRN_MSI_BATCH_MAX)) {
+			ret = 0;
+			vlapic_begin_intr_batch(target_vm);
+			for (i = 0U; i < batch.count; i++) {
+				if (vlapic_inject_msi(target_vm, batch.msi[i].msi_addr, batch.msi[i].msi_data) != 0) {
+					ret = -1;
+				}
+			}
+			vlapic_end_intr_batch();
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief inject several MSIs and irqline operations
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to struct acrn_intr_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_inject_intr_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_intr_batch batch;
+	const struct acrn_intr_op *op;
+	uint32_t i;
+	int32_t ret = -1;
+
+	if (is_severity_pass(target_vm->vm_id) && !is_poweroff_vm(target_vm)) {
+		if ((copy_from_gpa(vcpu->vm, &batch, param2, sizeof(batch)) == 0) &&
+				(batch.count <= ACRN_INTR_BATCH_MAX)) {
+			ret = 0;
+			vlapic_begin_intr_batch(target_vm);
+			for (i = 0U; i < batch.count; i++) {
+				op = &batch.ops[i];
+				if (op->type == ACRN_INTR_OP_MSI) {
+					if (vlapic_inject_msi(target_vm, op->msi.msi_addr, op->msi.msi_data) != 0) {
+						ret = -1;
+					}
+				} else if (op->type == ACRN_INTR_OP_IRQLINE) {
+					if (set_vm_irqline(vcpu->vm, target_vm, &op->irqline) != 0) {
+						ret = -1;
+					}
+				} else {
+					ret = -1;
+				}
+			}
+			vlapic_end_intr_batch();
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Send a fixed IPI to several vCPUs of the calling VM
+ *
+ * @param vcpu not used
+ * @param target_vm Pointer to the VM of the vCPU
+ * @param param1 bitmap of the target vCPU ids
+ * @param param2 vector of the IPI
+ *
+ * @pre (get_vm_config(vcpu->vm->vm_id)->guest_flags & GUEST_FLAG_PV_IPI) != 0UL
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_send_ipi(__unused struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		uint64_t param1, uint64_t param2)
+{
+	int32_t ret = -EINVAL;
+
+	if (!is_lapic_pt_configured(target_vm) && (param2 >= 16UL) && (param2 <= 0xFFUL)) {
+		vlapic_send_fixed_ipi(target_vm, param1 & vm_active_cpus(target_vm), (uint32_t)param2);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Register the state of the calling vCPU shared with the guest
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 guest physical address of a struct acrn_pv_vcpu_state,
+ *              0 to unregister it
+ * @param param2 not used
+ *
+ * @pre (get_vm_config(vcpu->vm->vm_id)->guest_flags & GUEST_FLAG_PV_STEAL_TIME) != 0UL
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_vcpu_pv_state(struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		uint64_t param1, __unused uint64_t param2)
+{
+	struct acrn_pv_vcpu_state *pv_state = NULL;
+	uint64_t gen;
+	int32_t ret = -EINVAL;
+
+	if (param1 == 0UL) {
+		vcpu->arch.pv_state_gpa = 0UL;
+		ret = 0;
+	} else if (!mem_aligned_check(param1, sizeof(struct acrn_pv_vcpu_state))) {
+		/* keep ret as -EINVAL */
+	} else if (unshare_guest_memory(vcpu, param1, sizeof(struct acrn_pv_vcpu_state))) {
+		/* the hypercall is retried once the shared guest memory is copied */
+		ret = 0;
+	} else {
+		/* aligned on its size, the state doesn't cross a page */
+		gen = vcpu->vm->map_gen;
+		cpu_compiler_barrier();
+		pv_state = (struct acrn_pv_vcpu_state *)gpa2hva(vcpu->vm, param1);
+		if (pv_state != NULL) {
+			stac();
+			pv_state->preempted = 0U;
+			pv_state->version = 0U;
+			pv_state->steal = 0UL;
+			clac();
+			vcpu->arch.pv_state = pv_state;
+			vcpu->arch.pv_state_gen = gen;
+			vcpu->arch.pv_state_gpa = param1;
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief set ioreq shared buffer
  *
@@ -605,6 +878,213 @@ int32_t hcall_notify_ioreq_finish(__unused struct acrn_vcpu *vcpu, struct acrn_v
 	return ret;
 }
 
+/**
+ * @brief add or remove a posted I/O range
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_posted_io_range
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_io_range(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_posted_io_range range;
+	int32_t ret = -1;
+
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm)) {
+		if (copy_from_gpa(vcpu->vm, &range, param2, sizeof(range)) == 0) {
+			dev_dbg(DBG_LEVEL_HYCALL, "[%d] POSTED_IO type %u [0x%lx, 0x%lx) flags 0x%x",
+				target_vm->vm_id, range.type, range.start, range.end, range.flags);
+			ret = set_posted_io_range(target_vm, &range);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief set the notification buffer of the kick bindings
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_set_iokick_buffer
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_iokick_buffer(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_set_iokick_buffer kickbuf;
+	uint64_t hpa;
+	int32_t ret = -1;
+
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vcpu->vm, &kickbuf, param2, sizeof(kickbuf)) == 0) {
+			dev_dbg(DBG_LEVEL_HYCALL, "[%d] SET KICK BUFFER=0x%lx",
+					target_vm->vm_id, kickbuf.kick_buf);
+
+			hpa = gpa2hpa(vcpu->vm, kickbuf.kick_buf);
+			if ((hpa == INVALID_HPA) || ((kickbuf.kick_buf & PAGE_MASK) != kickbuf.kick_buf)) {
+				pr_err("%s,vm[%hu] gpa 0x%lx,GPA is unmapping or unaligned.",
+					__func__, vcpu->vm->vm_id, kickbuf.kick_buf);
+				target_vm->sw.iokick_page = NULL;
+			} else {
+				target_vm->sw.iokick_page = hpa2hva(hpa);
+				ret = 0;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief add or remove a kick binding
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_iokick
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_iokick(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_iokick kick;
+	int32_t ret = -1;
+
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm)) {
+		if (copy_from_gpa(vcpu->vm, &kick, param2, sizeof(kick)) == 0) {
+			dev_dbg(DBG_LEVEL_HYCALL, "[%d] IOKICK addr 0x%lx len %u slot %u flags 0x%x",
+				target_vm->vm_id, kick.addr, kick.len, kick.slot, kick.flags);
+			ret = set_iokick(target_vm, &kick);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief set the polling budget of I/O request completion
+ *
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 max polling budget in TSC cycles, 0 to disable polling
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioreq_poll(__unused struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	int32_t ret = -1;
+
+	/* The polling I/O completion mode of the VM always polls */
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm) && !target_vm->sw.is_polling_ioreq) {
+		dev_dbg(DBG_LEVEL_HYCALL, "[%d] IOREQ_POLL %lu cycles", target_vm->vm_id, param2);
+		target_vm->sw.ioreq_poll_max = param2;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * A port range may be passed through to a post-launched VM if no emulation of
+ * the hypervisor claims it for the VM and SOS accesses it natively, so the VM
+ * gets no port SOS could not touch itself.
+ */
+static bool is_pio_region_passthru_allowed(const struct acrn_vm *sos_vm, const struct acrn_vm *vm,
+		uint16_t base, uint16_t len)
+{
+	uint32_t end = (uint32_t)base + (uint32_t)len;
+	uint32_t idx;
+	bool allowed = is_guest_pio_allowed(sos_vm, base, len);
+
+	for (idx = 0U; allowed && (idx < EMUL_PIO_IDX_MAX); idx++) {
+		const struct vm_io_handler_desc *handler = &vm->emul_pio[idx];
+
+		if ((handler->port_start < handler->port_end) && ((uint32_t)handler->port_start < end) &&
+				(base < handler->port_end)) {
+			allowed = false;
+		}
+	}
+
+	return allowed;
+}
+
+/**
+ * @brief pass a port I/O range through to a VM or trap it again
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_pio_region
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_pio_region(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_pio_region region;
+	int32_t ret = -1;
+
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm) &&
+			(copy_from_gpa(vcpu->vm, &region, param2, sizeof(region)) == 0) &&
+			(region.len != 0U) && (((uint32_t)region.base + (uint32_t)region.len) <= 0x10000U)) {
+		dev_dbg(DBG_LEVEL_HYCALL, "[%d] PIO_REGION 0x%x len %u flags 0x%x",
+			target_vm->vm_id, region.base, region.len, region.flags);
+		if ((region.flags & ACRN_PIO_REGION_FLAG_PASSTHRU) == 0U) {
+			deny_guest_pio_access(target_vm, region.base, region.len);
+			ret = 0;
+		} else if (is_pio_region_passthru_allowed(vcpu->vm, target_vm, region.base, region.len)) {
+			allow_guest_pio_access(target_vm, region.base, region.len);
+			ret = 0;
+		} else {
+			pr_err("%s: VM%u cannot access ports 0x%x-0x%x natively", __func__, target_vm->vm_id,
+				region.base, (uint32_t)region.base + region.len - 1U);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief bind or unbind the EOI of a level-triggered GSI to a notification slot
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_intx_resample
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_intx_resample(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_intx_resample resample;
+	int32_t ret = -1;
+
+	if (is_postlaunched_vm(target_vm) && !is_poweroff_vm(target_vm)) {
+		if (copy_from_gpa(vcpu->vm, &resample, param2, sizeof(resample)) == 0) {
+			dev_dbg(DBG_LEVEL_HYCALL, "[%d] INTX_RESAMPLE gsi %u slot %u flags 0x%x",
+				target_vm->vm_id, resample.gsi, resample.slot, resample.flags);
+			ret = vioapic_set_resample(target_vm, &resample);
+		}
+	}
+
+	return ret;
+}
+
 /**
  *@pre is_sos_vm(vm)
  *@pre gpa2hpa(vm, region->sos_vm_gpa) != INVALID_HPA
@@ -714,6 +1194,8 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 		if (!is_poweroff_vm(target_vm) &&
 		    (is_severity_pass(target_vm->vm_id) || (target_vm->state != VM_RUNNING))) {
 			idx = 0U;
+			/* the target VM is flushed once, after all the regions are set */
+			ept_batch_begin(target_vm);
 			while (idx < regions.mr_num) {
 				if (copy_from_gpa(vm, &mr, regions.regions_gpa + idx * sizeof(mr), sizeof(mr)) != 0) {
 					pr_err("%s: Copy mr entry fail from vm\n", __func__);
@@ -726,6 +1208,7 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 				}
 				idx++;
 			}
+			ept_batch_end(target_vm);
 		} else {
 			pr_err("%p %s:target_vm is invalid or Targeting to service vm", target_vm, __func__);
 		}
@@ -740,8 +1223,6 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 static int32_t write_protect_page(struct acrn_vm *vm,const struct wp_data *wp)
 {
 	uint64_t hpa, base_paddr;
-	uint64_t prot_set;
-	uint64_t prot_clr;
 	int32_t ret = -EINVAL;
 
 	if (is_severity_pass(vm->vm_id)) {
@@ -764,11 +1245,7 @@ static int32_t write_protect_page(struct acrn_vm *vm,const struct wp_data *wp)
 						 (hpa < (base_paddr + CONFIG_HV_RAM_SIZE)))) {
 					pr_err("%s: overlap the HV memory region.", __func__);
 				} else {
-					prot_set = (wp->set != 0U) ? 0UL : EPT_WR;
-					prot_clr = (wp->set != 0U) ? EPT_WR : 0UL;
-
-					ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
-							wp->gpa, PAGE_SIZE, prot_set, prot_clr);
+					ept_write_protect_page(vm, wp->gpa, (wp->set != 0U));
 					ret = 0;
 				}
 			}
@@ -809,6 +1286,153 @@ int32_t hcall_write_protect_page(struct acrn_vcpu *vcpu, struct acrn_vm *target_
 	return ret;
 }
 
+#define WP_BATCH_ENTRIES	32U	/* entries copied in at once */
+#define WP_BATCH_MAX_ENTRIES	4096U	/* entries per hypercall, to bound its duration */
+
+/**
+ * @brief change the write permission of a batch of guest memory pages
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to struct wp_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_write_protect_pages(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct wp_batch batch;
+	struct wp_data wps[WP_BATCH_ENTRIES];
+	uint32_t i = 0U, j, nr, nr_max;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && (copy_from_gpa(vm, &batch, param2, sizeof(batch)) == 0)) {
+		ret = 0;
+		nr_max = min(batch.nr_entries, WP_BATCH_MAX_ENTRIES);
+		/* the target VM is flushed once, after all the pages are changed */
+		ept_batch_begin(target_vm);
+		while ((ret == 0) && (i < nr_max)) {
+			nr = min(nr_max - i, WP_BATCH_ENTRIES);
+			if (copy_from_gpa(vm, wps, batch.wp_gpa + ((uint64_t)i * sizeof(wps[0])),
+					nr * sizeof(wps[0])) != 0) {
+				ret = -EFAULT;
+				break;
+			}
+
+			for (j = 0U; j < nr; j++) {
+				ret = write_protect_page(target_vm, &wps[j]);
+				if (ret != 0) {
+					break;
+				}
+				i++;
+			}
+		}
+		ept_batch_end(target_vm);
+
+		batch.nr_done = i;
+		if (copy_to_gpa(vm, &batch, param2, sizeof(batch)) != 0) {
+			ret = -EFAULT;
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief track the guest memory pages written by a VM
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to struct dirty_log
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_dirty_log(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct dirty_log log;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &log, param2, sizeof(log)) == 0) {
+			switch (log.op) {
+			case DIRTY_LOG_START:
+				ret = ept_dirty_log_start(target_vm, log.gpa, log.size, log.bitmap_gpa);
+				break;
+			case DIRTY_LOG_SYNC:
+				ret = ept_dirty_log_sync(target_vm);
+				break;
+			case DIRTY_LOG_STOP:
+				ret = ept_dirty_log_stop(target_vm);
+				break;
+			default:
+				pr_err("%s: invalid op %u", __func__, log.op);
+				break;
+			}
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief give guest memory of a VM back to SOS, or map it back
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to struct reclaim_region
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_reclaim_memory(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct reclaim_region region;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &region, param2, sizeof(region)) == 0) {
+			switch (region.op) {
+			case RECLAIM_UNMAP:
+				ret = ept_reclaim_mr(target_vm, region.gpa, region.size, true);
+				break;
+			case RECLAIM_UNPOPULATED:
+				/* the DM populates the memory of a VM on demand from its start */
+				if (is_created_vm(target_vm)) {
+					ret = ept_reclaim_mr(target_vm, region.gpa, region.size, false);
+				}
+				break;
+			case RECLAIM_REMAP:
+				ret = ept_restore_mr(target_vm, region.gpa, region.sos_vm_gpa, region.size);
+				break;
+			case RECLAIM_SHARE:
+				/* shared at load time, the DM copies the blocks written since */
+				if (is_created_vm(target_vm)) {
+					ret = ept_share_mr(target_vm, region.gpa, region.sos_vm_gpa, region.size);
+				}
+				break;
+			default:
+				pr_err("%s: invalid op %u", __func__, region.op);
+				break;
+			}
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -845,6 +1469,118 @@ int32_t hcall_gpa_to_hpa(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, __un
 	return ret;
 }
 
+#define GPA2HPA_BATCH_EXTENTS		32U	/* extents copied out at once */
+#define GPA2HPA_BATCH_MAX_LOOKUPS	4096U	/* EPT lookups per hypercall, to bound its duration */
+
+/**
+ * @brief translate guest physical ranges to host physical extents
+ *
+ * The extent being merged into counts in nr_extents as soon as it starts, so
+ * that it is always copied out with all the bytes reported as translated.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to struct vm_gpa2hpa_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_gpa_to_hpa_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct vm_gpa2hpa_batch batch;
+	struct acrn_mem_extent range, cur, extents[GPA2HPA_BATCH_EXTENTS];
+	uint32_t i = 0U, nr_buffered = 0U, nr_copied = 0U, nr_extents = 0U, lookups = 0U, pg_size = 0U;
+	uint64_t gpa, hpa, len, offset = 0UL;
+	bool full = false;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && (copy_from_gpa(vm, &batch, param2, sizeof(batch)) == 0)
+			&& (batch.nr_extents != 0U)) {
+		ret = 0;
+		/* read first: a change during the translation makes the extents stale */
+		batch.map_gen = target_vm->map_gen;
+		cpu_compiler_barrier();
+		cur.addr = 0UL;
+		cur.size = 0UL;
+		while ((ret == 0) && !full && (i < batch.nr_ranges)) {
+			if (copy_from_gpa(vm, &range, batch.ranges_gpa + ((uint64_t)i * sizeof(range)), sizeof(range)) != 0) {
+				ret = -EFAULT;
+				break;
+			}
+
+			offset = 0UL;
+			while (offset < range.size) {
+				gpa = range.addr + offset;
+				hpa = INVALID_HPA;
+				if (lookups < GPA2HPA_BATCH_MAX_LOOKUPS) {
+					lookups++;
+					hpa = local_gpa2hpa(target_vm, gpa, &pg_size);
+				} else {
+					full = true;
+					break;
+				}
+				if (hpa == INVALID_HPA) {
+					pr_err("%s, vm[%hu] gpa 0x%lx is not mapped", __func__, target_vm->vm_id, gpa);
+					ret = -EFAULT;
+					break;
+				}
+
+				len = min((uint64_t)pg_size - (gpa & ((uint64_t)pg_size - 1UL)), range.size - offset);
+				if ((cur.size != 0UL) && ((cur.addr + cur.size) == hpa)) {
+					cur.size += len;
+				} else if (nr_extents == batch.nr_extents) {
+					full = true;
+					break;
+				} else {
+					if (cur.size != 0UL) {
+						extents[nr_buffered] = cur;
+						nr_buffered++;
+						if (nr_buffered == GPA2HPA_BATCH_EXTENTS) {
+							ret = copy_to_gpa(vm, extents, batch.extents_gpa +
+								((uint64_t)nr_copied * sizeof(cur)), sizeof(extents));
+							nr_copied += nr_buffered;
+							nr_buffered = 0U;
+							if (ret != 0) {
+								break;
+							}
+						}
+					}
+					nr_extents++;
+					cur.addr = hpa;
+					cur.size = len;
+				}
+				offset += len;
+			}
+
+			if ((ret == 0) && !full) {
+				i++;
+			}
+		}
+
+		if (cur.size != 0UL) {
+			extents[nr_buffered] = cur;
+			nr_buffered++;
+		}
+		if ((nr_buffered != 0U) && (copy_to_gpa(vm, extents, batch.extents_gpa +
+				((uint64_t)nr_copied * sizeof(cur)), nr_buffered * sizeof(cur)) != 0)) {
+			ret = -EFAULT;
+		}
+
+		batch.nr_extents = nr_extents;
+		batch.nr_done = i;
+		batch.partial_size = (i < batch.nr_ranges) ? offset : 0UL;
+		if (copy_to_gpa(vm, &batch, param2, sizeof(batch)) != 0) {
+			ret = -EFAULT;
+		}
+	} else {
+		pr_err("target_vm is invalid or HCALL gpa2hpa batch: Unable copy param from vm\n");
+	}
+
+	return ret;
+}
+
 /**
  * @brief Assign one PCI dev to a VM.
  *
@@ -940,6 +1676,65 @@ int32_t hcall_assign_mmiodev(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 	return ret;
 }
 
+#define MMIODEV_LIST_ENTRIES	4U	/* devices copied in at once */
+
+/**
+ * @brief Assign a list of MMIO devs to a VM.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to struct
+ *              acrn_mmiodev_list
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_assign_mmiodevs(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_mmiodev_list list;
+	struct acrn_mmiodev mmiodevs[MMIODEV_LIST_ENTRIES];
+	uint32_t i = 0U, j, nr;
+	int32_t ret = -EINVAL;
+
+	/* We should only assign a device to a post-launched VM at creating time for safety, not runtime or other cases*/
+	if (is_created_vm(target_vm) && (copy_from_gpa(vm, &list, param2, sizeof(list)) == 0)) {
+		ret = 0;
+		while ((ret == 0) && (i < list.nr_mmiodevs)) {
+			nr = min(list.nr_mmiodevs - i, MMIODEV_LIST_ENTRIES);
+			if (copy_from_gpa(vm, mmiodevs, list.mmiodevs_gpa + ((uint64_t)i * sizeof(mmiodevs[0])),
+					nr * sizeof(mmiodevs[0])) != 0) {
+				ret = -EFAULT;
+				break;
+			}
+
+			/* the devices up to the first invalid one are moved */
+			for (j = 0U; j < nr; j++) {
+				if (!is_valid_mmio_dev(&mmiodevs[j]) ||
+						!ept_is_valid_mr(vm, mmiodevs[j].base_hpa, mmiodevs[j].size)) {
+					ret = -EINVAL;
+					break;
+				}
+			}
+			if (j != 0U) {
+				(void)deassign_mmio_devs(vm, mmiodevs, j);
+				(void)assign_mmio_devs(target_vm, mmiodevs, j);
+				i += j;
+			}
+		}
+
+		list.nr_done = i;
+		if (copy_to_gpa(vm, &list, param2, sizeof(list)) != 0) {
+			ret = -EFAULT;
+		}
+	} else {
+		pr_err("vm[%d] %s failed!\n",target_vm->vm_id,  __func__);
+	}
+
+	return ret;
+}
+
 /**
  * @brief Deassign one MMIO dev from a VM.
  *
@@ -1159,7 +1954,7 @@ int32_t hcall_get_cpu_pm_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
 }
 
 /**
- * @brief Get VCPU a VM's interrupt count data.
+ * @brief Get VCPU a VM's interrupt count data, or set how its ptdev interrupts are delayed.
  *
  * @param vcpu Pointer to vCPU that initiates the hypercall
  * @param target_vm Pointer to target VM data structure
@@ -1175,6 +1970,7 @@ int32_t hcall_vm_intr_monitor(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 	struct acrn_vm *vm = vcpu->vm;
 	int32_t status = -EINVAL;
 	struct acrn_intr_monitor *intr_hdr;
+	struct ptirq_coalesce_policy policy;
 	uint64_t hpa;
 
 	if (!is_poweroff_vm(target_vm)) {
@@ -1190,12 +1986,24 @@ int32_t hcall_vm_intr_monitor(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
 						intr_hdr->buffer, intr_hdr->buf_cnt);
 					break;
 
+				case INTR_CMD_GET_DELTA:
+					intr_hdr->buf_cnt = ptirq_get_intr_delta(target_vm,
+						intr_hdr->buffer, intr_hdr->buf_cnt, intr_hdr->buffer[0]);
+					break;
+
 				case INTR_CMD_DELAY_INT:
 					/* buffer[0] is the delay time (in MS), if 0 to cancel delay */
 					target_vm->intr_inject_delay_delta =
 						intr_hdr->buffer[0] * TICKS_PER_MS;
 					break;
 
+				case INTR_CMD_COALESCE_INT:
+					policy.window = us_to_ticks((uint32_t)intr_hdr->buffer[1]);
+					policy.threshold = (uint32_t)intr_hdr->buffer[2];
+					policy.max_merged = (uint32_t)intr_hdr->buffer[3];
+					ptirq_set_intr_coalesce(target_vm, intr_hdr->buffer[0], &policy);
+					break;
+
 				default:
 					/* if cmd wrong it goes here should not happen */
 					break;
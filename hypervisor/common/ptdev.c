@@ -20,11 +20,32 @@
 #define PTIRQ_BITMAP_ARRAY_SIZE	INT_DIV_ROUNDUP(CONFIG_MAX_PT_IRQ_ENTRIES, 64U)
 struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
 static uint64_t ptirq_entry_bitmaps[PTIRQ_BITMAP_ARRAY_SIZE];
-spinlock_t ptdev_lock = { .head = 0U, .tail = 0U, };
+qspinlock_t ptdev_lock = { .val = 0U, };
 
-static struct ptirq_entry_head {
+struct ptirq_entry_head {
 	struct hlist_head list;
-} ptirq_entry_heads[PTIRQ_ENTRY_HASHSIZE];
+};
+
+/*
+ * The physical and virtual links of the entries are kept in tables of their
+ * own, a bucket only ever holds one kind of link to be walked with.
+ */
+static struct ptirq_entry_head ptirq_phys_heads[PTIRQ_ENTRY_HASHSIZE];
+static struct ptirq_entry_head ptirq_virt_heads[PTIRQ_ENTRY_HASHSIZE];
+
+static inline struct ptirq_entry_head *ptirq_phys_head(const union source_id *sid)
+{
+	return &ptirq_phys_heads[hash64(sid->value, PTIRQ_ENTRY_HASHBITS)];
+}
+
+/*
+ * VMs tend to use the same virtual BDFs and GSIs, mix the VM id into the key
+ * so that their entries don't all end up in the same buckets.
+ */
+static inline struct ptirq_entry_head *ptirq_virt_head(const struct acrn_vm *vm, const union source_id *sid)
+{
+	return &ptirq_virt_heads[hash64(sid->value ^ ((uint64_t)vm->vm_id << 48U), PTIRQ_ENTRY_HASHBITS)];
+}
 
 static inline uint16_t ptirq_alloc_entry_id(void)
 {
@@ -45,8 +66,7 @@ struct ptirq_remapping_info *find_ptirq_entry(uint32_t intr_type,
 {
 	struct hlist_node *p;
 	struct ptirq_remapping_info *n, *entry = NULL;
-	uint64_t key = hash64(sid->value, PTIRQ_ENTRY_HASHBITS);
-	struct ptirq_entry_head *b = &ptirq_entry_heads[key];
+	struct ptirq_entry_head *b = (vm == NULL) ? ptirq_phys_head(sid) : ptirq_virt_head(vm, sid);
 
 	hlist_for_each(p, &b->list) {
 		if (vm == NULL) {
@@ -106,9 +126,11 @@ struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
 		/* if sos vm, just dequeue, if uos, check delay timer */
 		if (is_sos_vm(entry->vm) || timer_expired(&entry->intr_delay_timer, cpu_ticks(), NULL)) {
 			break;
+		} else if (add_timer(&entry->intr_delay_timer) != 0) {
+			/* nothing would deliver it later, deliver it now */
+			break;
 		} else {
-			/* add it into timer list; dequeue next one */
-			(void)add_timer(&entry->intr_delay_timer);
+			/* added into timer list; dequeue next one */
 			entry = NULL;
 		}
 	}
@@ -130,6 +152,8 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 		entry->vm = vm;
 		entry->intr_count = 0UL;
 		entry->irte_idx = INVALID_IRTE_ID;
+		spinlock_init(&entry->coalesce_lock);
+		entry->coalesce = vm->intr_coalesce;
 
 		INIT_LIST_HEAD(&entry->softirq_node);
 
@@ -157,11 +181,67 @@ void ptirq_release_entry(struct ptirq_remapping_info *entry)
 	(void)memset((void *)entry, 0U, sizeof(struct ptirq_remapping_info));
 }
 
+/*
+ * Start a new window once the current one is over. An entry only coalesces
+ * while it is busy: it turns on when a window reaches the threshold and off
+ * after a window below it, so a quiet device keeps its latency.
+ */
+static bool ptirq_coalesce_active(struct ptirq_remapping_info *entry)
+{
+	const struct ptirq_coalesce_policy *policy = &entry->coalesce;
+	uint64_t now = cpu_ticks();
+
+	if (policy->window != 0UL) {
+		if ((now - entry->coalesce_start) >= policy->window) {
+			entry->coalescing = (entry->coalesce_cnt >= policy->threshold);
+			entry->coalesce_start = now;
+			entry->coalesce_cnt = 0U;
+		}
+
+		entry->coalesce_cnt++;
+		if (entry->coalesce_cnt >= policy->threshold) {
+			entry->coalescing = true;
+		}
+	} else {
+		entry->coalescing = false;
+	}
+
+	return entry->coalescing;
+}
+
+/*
+ * The first interrupt of a window arms the delay timer to its end, the
+ * following ones are merged into that injection until max_merged is hit.
+ *
+ * @return true when the interrupt has to be injected right away.
+ */
+static bool ptirq_coalesce_intr(struct ptirq_remapping_info *entry)
+{
+	const struct ptirq_coalesce_policy *policy = &entry->coalesce;
+	bool to_enqueue = true;
+
+	if (timer_is_started(&entry->intr_delay_timer)) {
+		entry->coalesce_merged++;
+		if ((policy->max_merged != 0U) && (entry->coalesce_merged >= policy->max_merged)) {
+			del_timer(&entry->intr_delay_timer);
+			update_timer(&entry->intr_delay_timer, 0UL, 0UL);
+			entry->coalesce_merged = 0U;
+		} else {
+			to_enqueue = false;
+		}
+	} else {
+		update_timer(&entry->intr_delay_timer, entry->coalesce_start + policy->window, 0UL);
+		entry->coalesce_merged = 1U;
+	}
+
+	return to_enqueue;
+}
+
 /* interrupt context */
 static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 {
 	struct ptirq_remapping_info *entry = (struct ptirq_remapping_info *) data;
-	bool to_enqueue = true;
+	bool to_enqueue = true, coalescing;
 
 	/*
 	 * "interrupt storm" detection & delay intr injection just for UOS
@@ -170,18 +250,28 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 	if (!is_sos_vm(entry->vm)) {
 		entry->intr_count++;
 
-		/* if delta > 0, set the delay TSC, dequeue to handle */
-		if (entry->vm->intr_inject_delay_delta > 0UL) {
-
-			/* if the timer started (entry is in timer-list), not need enqueue again */
-			if (timer_is_started(&entry->intr_delay_timer)) {
-				to_enqueue = false;
+		/* interrupts are off already, the policy and the window don't change under it */
+		spinlock_obtain(&entry->coalesce_lock);
+		coalescing = ptirq_coalesce_active(entry);
+		if (coalescing) {
+			to_enqueue = ptirq_coalesce_intr(entry);
+		}
+		spinlock_release(&entry->coalesce_lock);
+
+		if (!coalescing) {
+			if (entry->vm->intr_inject_delay_delta > 0UL) {
+				/* if delta > 0, set the delay TSC, dequeue to handle */
+
+				/* if the timer started (entry is in timer-list), not need enqueue again */
+				if (timer_is_started(&entry->intr_delay_timer)) {
+					to_enqueue = false;
+				} else {
+					update_timer(&entry->intr_delay_timer,
+						     cpu_ticks() + entry->vm->intr_inject_delay_delta, 0UL);
+				}
 			} else {
-				update_timer(&entry->intr_delay_timer,
-					     cpu_ticks() + entry->vm->intr_inject_delay_delta, 0UL);
+				update_timer(&entry->intr_delay_timer, 0UL, 0UL);
 			}
-		} else {
-			update_timer(&entry->intr_delay_timer, 0UL, 0UL);
 		}
 	}
 
@@ -194,7 +284,6 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_irq)
 {
 	int32_t retval;
-	uint64_t key;
 
 	/* register and allocate host vector/irq */
 	retval = request_irq(phys_irq, ptirq_interrupt_handler, (void *)entry, IRQF_PT);
@@ -205,10 +294,8 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 		entry->allocated_pirq = (uint32_t)retval;
 		entry->active = true;
 
-		key = hash64(entry->phys_sid.value, PTIRQ_ENTRY_HASHBITS);
-		hlist_add_head(&entry->phys_link, &(ptirq_entry_heads[key].list));
-		key = hash64(entry->virt_sid.value, PTIRQ_ENTRY_HASHBITS);
-		hlist_add_head(&entry->virt_link, &(ptirq_entry_heads[key].list));
+		hlist_add_head(&entry->phys_link, &(ptirq_phys_head(&entry->phys_sid)->list));
+		hlist_add_head(&entry->virt_link, &(ptirq_virt_head(entry->vm, &entry->virt_sid)->list));
 	}
 
 	return retval;
@@ -222,6 +309,29 @@ void ptirq_deactivate_entry(struct ptirq_remapping_info *entry)
 	free_irq(entry->allocated_pirq);
 }
 
+/* the interrupt handler of the entry may run on another pcpu meanwhile */
+static void ptirq_set_entry_coalesce(struct ptirq_remapping_info *entry,
+		const struct ptirq_coalesce_policy *policy)
+{
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&entry->coalesce_lock, &rflags);
+	entry->coalesce = *policy;
+	entry->coalesce_cnt = 0U;
+	entry->coalescing = false;
+	spinlock_irqrestore_release(&entry->coalesce_lock, rflags);
+}
+
+void ptirq_move_entry(struct ptirq_remapping_info *entry, struct acrn_vm *vm, const union source_id *virt_sid)
+{
+	/* the virtual link is hashed on the VM and virtual source */
+	hlist_del(&entry->virt_link);
+	entry->vm = vm;
+	entry->virt_sid.value = virt_sid->value;
+	ptirq_set_entry_coalesce(entry, &vm->intr_coalesce);
+	hlist_add_head(&entry->virt_link, &(ptirq_virt_head(vm, virt_sid)->list));
+}
+
 void ptdev_init(void)
 {
 	if (get_pcpu_id() == BSP_CPU_ID) {
@@ -239,13 +349,13 @@ void ptdev_release_all_entries(const struct acrn_vm *vm)
 	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
 		entry = &ptirq_entries[idx];
 		if ((entry->vm == vm) && is_entry_active(entry)) {
-			spinlock_obtain(&ptdev_lock);
+			qspinlock_obtain(&ptdev_lock);
 			if (entry->release_cb != NULL) {
 				entry->release_cb(entry);
 			}
 			ptirq_deactivate_entry(entry);
 			ptirq_release_entry(entry);
-			spinlock_release(&ptdev_lock);
+			qspinlock_release(&ptdev_lock);
 		}
 	}
 
@@ -275,3 +385,56 @@ uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer,
 
 	return index;
 }
+
+uint32_t ptirq_get_intr_delta(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt,
+		uint64_t threshold)
+{
+	uint32_t index = 0U;
+	uint16_t i;
+	uint64_t count, delta;
+	struct ptirq_remapping_info *entry;
+
+	for (i = 0U; i < CONFIG_MAX_PT_IRQ_ENTRIES; i++) {
+		entry = &ptirq_entries[i];
+		if (!is_entry_active(entry) || (entry->vm != target_vm)) {
+			continue;
+		}
+
+		/* the interrupts of the ptdev keep counting meanwhile */
+		count = entry->intr_count;
+		delta = count - entry->intr_count_reported;
+		if (delta < threshold) {
+			entry->intr_count_reported = count;
+		} else if ((index + 2U) <= buffer_cnt) {
+			buffer[index] = entry->allocated_pirq;
+			buffer[index + 1U] = delta;
+			index += 2U;
+			entry->intr_count_reported = count;
+		} else {
+			/* no room, reported by a later call */
+		}
+	}
+
+	return index;
+}
+
+void ptirq_set_intr_coalesce(struct acrn_vm *target_vm, uint64_t phys_irq,
+		const struct ptirq_coalesce_policy *policy)
+{
+	struct ptirq_remapping_info *entry;
+	uint16_t i;
+
+	qspinlock_obtain(&ptdev_lock);
+	if (phys_irq == INTR_COALESCE_ALL_IRQS) {
+		target_vm->intr_coalesce = *policy;
+	}
+
+	for (i = 0U; i < CONFIG_MAX_PT_IRQ_ENTRIES; i++) {
+		entry = &ptirq_entries[i];
+		if (is_entry_active(entry) && (entry->vm == target_vm) &&
+				((phys_irq == INTR_COALESCE_ALL_IRQS) || (entry->allocated_pirq == phys_irq))) {
+			ptirq_set_entry_coalesce(entry, policy);
+		}
+	}
+	qspinlock_release(&ptdev_lock);
+}
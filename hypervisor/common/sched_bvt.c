@@ -5,16 +5,32 @@
  */
 
 #include <list.h>
+#include <rtl.h>
 #include <asm/per_cpu.h>
+#include <asm/vm_config.h>
+#include <asm/lib/bits.h>
 #include <schedule.h>
 #include <ticks.h>
 
 #define BVT_MCU_MS	1U
 /* context switch allowance */
 #define BVT_CSA_MCU 5U
+/* virtual time borrowed by a boosted thread */
+#define BVT_WARP_MCU	(2U * BVT_CSA_MCU)
+
+/* a pcpu runs at most one vCPU of each VM */
+#define BVT_RUNQUEUE_MAX	CONFIG_MAX_VM_NUM
+
+/* slot 0 is unused so that parent/child indexes are plain shifts */
+static struct thread_object *bvt_heap[MAX_PCPU_NUM][BVT_RUNQUEUE_MAX + 1U];
+
 struct sched_bvt_data {
 	/* keep list as the first item */
 	struct list_head list;
+	/* index in the evt ordered heap of the runqueue, 0 if not queued */
+	uint32_t heap_idx;
+	/* number of runs by virtual time advance, in power of 2 mcu buckets */
+	uint32_t vt_hist[BVT_VT_HIST_BUCKETS];
 	/* minimum charging unit in cycles */
 	uint64_t mcu;
 	/* a thread receives a share of cpu in proportion to its weight */
@@ -27,6 +43,8 @@ struct sched_bvt_data {
 	int64_t avt;
 	/* effective virtual time in units of mcu */
 	int64_t evt;
+	/* mcu the evt is pushed back by from the next vt update, after a yield */
+	int64_t defer_mcu;
 	uint64_t residual;
 
 	uint64_t start_tsc;
@@ -42,40 +60,74 @@ static bool is_inqueue(struct thread_object *obj)
 	return !list_empty(&data->list);
 }
 
+static inline struct sched_bvt_data *heap_data(const struct sched_bvt_control *bvt_ctl, uint32_t idx)
+{
+	return (struct sched_bvt_data *)bvt_ctl->heap[idx]->data;
+}
+
+static inline void heap_set(struct sched_bvt_control *bvt_ctl, uint32_t idx, struct thread_object *obj)
+{
+	bvt_ctl->heap[idx] = obj;
+	((struct sched_bvt_data *)obj->data)->heap_idx = idx;
+}
+
+static void heap_sift_up(struct sched_bvt_control *bvt_ctl, uint32_t idx)
+{
+	struct thread_object *obj = bvt_ctl->heap[idx];
+	int64_t evt = ((struct sched_bvt_data *)obj->data)->evt;
+	uint32_t pos = idx, parent;
+
+	/* equal evt keeps the earlier queued thread on top */
+	while ((pos > 1U) && (heap_data(bvt_ctl, pos >> 1U)->evt > evt)) {
+		parent = pos >> 1U;
+		heap_set(bvt_ctl, pos, bvt_ctl->heap[parent]);
+		pos = parent;
+	}
+	heap_set(bvt_ctl, pos, obj);
+}
+
+static void heap_sift_down(struct sched_bvt_control *bvt_ctl, uint32_t idx)
+{
+	struct thread_object *obj = bvt_ctl->heap[idx];
+	int64_t evt = ((struct sched_bvt_data *)obj->data)->evt;
+	uint32_t pos = idx, child;
+
+	while ((pos << 1U) <= bvt_ctl->nr_queued) {
+		child = pos << 1U;
+		if ((child < bvt_ctl->nr_queued) && (heap_data(bvt_ctl, child + 1U)->evt < heap_data(bvt_ctl, child)->evt)) {
+			child++;
+		}
+		if (evt <= heap_data(bvt_ctl, child)->evt) {
+			break;
+		}
+		heap_set(bvt_ctl, pos, bvt_ctl->heap[child]);
+		pos = child;
+	}
+	heap_set(bvt_ctl, pos, obj);
+}
+
 /*
+ * The runqueue is a min-heap on evt, the earliest evt has highest priority.
+ * data->list links the queued threads in no particular order for walkers
+ * like sched_pick_migrate().
+ *
  * @pre obj != NULL
  * @pre obj->data != NULL
  * @pre obj->sched_ctl != NULL
  * @pre obj->sched_ctl->priv != NULL
+ * @pre bvt_ctl->nr_queued < BVT_RUNQUEUE_MAX
  */
 static void runqueue_add(struct thread_object *obj)
 {
 	struct sched_bvt_control *bvt_ctl =
 		(struct sched_bvt_control *)obj->sched_ctl->priv;
 	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
-	struct list_head *pos;
-	struct thread_object *iter_obj;
-	struct sched_bvt_data *iter_data;
 
-	/*
-	 * the earliest evt has highest priority,
-	 * the runqueue is ordered by priority.
-	 */
-
-	if (list_empty(&bvt_ctl->runqueue)) {
-		list_add(&data->list, &bvt_ctl->runqueue);
-	} else {
-		list_for_each(pos, &bvt_ctl->runqueue) {
-			iter_obj = container_of(pos, struct thread_object, data);
-			iter_data = (struct sched_bvt_data *)iter_obj->data;
-			if (iter_data->evt > data->evt) {
-				list_add_node(&data->list, pos->prev, pos);
-				break;
-			}
-		}
-		if (!is_inqueue(obj)) {
-			list_add_tail(&data->list, &bvt_ctl->runqueue);
-		}
+	if (!is_inqueue(obj)) {
+		list_add_tail(&data->list, &bvt_ctl->runqueue);
+		bvt_ctl->nr_queued++;
+		heap_set(bvt_ctl, bvt_ctl->nr_queued, obj);
+		heap_sift_up(bvt_ctl, bvt_ctl->nr_queued);
 	}
 }
 
@@ -85,9 +137,41 @@ static void runqueue_add(struct thread_object *obj)
  */
 static void runqueue_remove(struct thread_object *obj)
 {
+	struct sched_bvt_control *bvt_ctl;
 	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
+	struct thread_object *last;
+	uint32_t idx = data->heap_idx;
 
-	list_del_init(&data->list);
+	if (is_inqueue(obj)) {
+		bvt_ctl = (struct sched_bvt_control *)obj->sched_ctl->priv;
+		list_del_init(&data->list);
+
+		last = bvt_ctl->heap[bvt_ctl->nr_queued];
+		bvt_ctl->heap[bvt_ctl->nr_queued] = NULL;
+		bvt_ctl->nr_queued--;
+		data->heap_idx = 0U;
+
+		/* fill the hole with the last thread and restore the heap order */
+		if (last != obj) {
+			heap_set(bvt_ctl, idx, last);
+			heap_sift_up(bvt_ctl, idx);
+			heap_sift_down(bvt_ctl, ((struct sched_bvt_data *)last->data)->heap_idx);
+		}
+	}
+}
+
+/*
+ * Move a queued thread to its new place after its evt changed.
+ *
+ * @pre is_inqueue(obj)
+ */
+static void runqueue_update(struct thread_object *obj)
+{
+	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)obj->sched_ctl->priv;
+	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
+
+	heap_sift_up(bvt_ctl, data->heap_idx);
+	heap_sift_down(bvt_ctl, data->heap_idx);
 }
 
 /*
@@ -106,8 +190,8 @@ static int64_t get_svt(struct thread_object *obj)
 	struct thread_object *tmp_obj;
 	int64_t svt = 0;
 
-	if (!list_empty(&bvt_ctl->runqueue)) {
-		tmp_obj = get_first_item(&bvt_ctl->runqueue, struct thread_object, data);
+	if (bvt_ctl->nr_queued != 0U) {
+		tmp_obj = bvt_ctl->heap[1];
 		obj_data = (struct sched_bvt_data *)tmp_obj->data;
 		svt = obj_data->avt;
 	}
@@ -135,7 +219,7 @@ static void sched_tick_handler(void *param)
 				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
 			}
 		} else {
-			if (!list_empty(&bvt_ctl->runqueue)) {
+			if (bvt_ctl->nr_queued != 0U) {
 				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
 			}
 		}
@@ -156,12 +240,14 @@ static int sched_bvt_init(struct sched_control *ctl)
 
 	ctl->priv = bvt_ctl;
 	INIT_LIST_HEAD(&bvt_ctl->runqueue);
+	bvt_ctl->heap = bvt_heap[ctl->pcpu_id];
+	bvt_ctl->nr_queued = 0U;
 
-	/* The tick_timer is periodically */
+	/* The tick_timer is periodically, unless the slices end on preemption timer exits */
 	initialize_timer(&bvt_ctl->tick_timer, sched_tick_handler, ctl,
 			cpu_ticks() + tick_period, tick_period);
 
-	if (add_timer(&bvt_ctl->tick_timer) < 0) {
+	if (!sched_use_preemption_timer() && (add_timer(&bvt_ctl->tick_timer) < 0)) {
 		pr_err("Failed to add schedule tick timer!");
 		ret = -1;
 	}
@@ -181,6 +267,9 @@ static void sched_bvt_init_data(struct thread_object *obj)
 
 	data = (struct sched_bvt_data *)obj->data;
 	INIT_LIST_HEAD(&data->list);
+	data->heap_idx = 0U;
+	data->defer_mcu = 0;
+	(void)memset(data->vt_hist, 0U, sizeof(data->vt_hist));
 	data->mcu = BVT_MCU_MS * TICKS_PER_MS;
 	/* TODO: virtual time advance ratio should be proportional to weight. */
 	data->vt_ratio = 1U;
@@ -198,6 +287,18 @@ static uint64_t p2v(uint64_t phy_time, uint64_t ratio)
 	return (uint64_t)(phy_time * ratio);
 }
 
+/* bucket 0 counts runs of no full mcu, bucket i runs of [2^(i-1), 2^i) mcu */
+static uint32_t vt_hist_bucket(uint64_t delta_mcu)
+{
+	uint32_t bucket = 0U;
+
+	if (delta_mcu != 0UL) {
+		bucket = min((uint32_t)fls64(delta_mcu) + 1U, BVT_VT_HIST_BUCKETS - 1U);
+	}
+
+	return bucket;
+}
+
 static void update_vt(struct thread_object *obj)
 {
 	struct sched_bvt_data *data;
@@ -214,11 +315,13 @@ static void update_vt(struct thread_object *obj)
 	}
 	data->avt += delta_mcu;
 	/* TODO: evt = avt - (warp ? warpback : 0U) */
-	data->evt = data->avt;
+	data->evt = data->avt + data->defer_mcu;
+	data->defer_mcu = 0;
+
+	data->vt_hist[vt_hist_bucket(delta_mcu)]++;
 
 	if (is_inqueue(obj)) {
-		runqueue_remove(obj);
-		runqueue_add(obj);
+		runqueue_update(obj);
 	}
 }
 
@@ -227,7 +330,6 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)ctl->priv;
 	struct thread_object *first_obj = NULL, *second_obj = NULL;
 	struct sched_bvt_data *first_data = NULL, *second_data = NULL;
-	struct list_head *first, *sec;
 	struct thread_object *next = NULL;
 	struct thread_object *current = ctl->curr_obj;
 	uint64_t now_tsc = cpu_ticks();
@@ -237,13 +339,20 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 		update_vt(current);
 	}
 
-	if (!list_empty(&bvt_ctl->runqueue)) {
-		first = bvt_ctl->runqueue.next;
-		sec = (first->next == &bvt_ctl->runqueue) ? NULL : first->next;
-
-		first_obj = container_of(first, struct thread_object, data);
+	if (bvt_ctl->nr_queued != 0U) {
+		first_obj = bvt_ctl->heap[1];
 		first_data = (struct sched_bvt_data *)first_obj->data;
 
+		/* the runner-up is one of the children of the heap top */
+		if (bvt_ctl->nr_queued >= 3U) {
+			second_obj = (heap_data(bvt_ctl, 3U)->evt < heap_data(bvt_ctl, 2U)->evt) ?
+				bvt_ctl->heap[3] : bvt_ctl->heap[2];
+		} else if (bvt_ctl->nr_queued == 2U) {
+			second_obj = bvt_ctl->heap[2];
+		} else {
+			second_obj = NULL;
+		}
+
 		/* The run_countdown is used to store how may mcu the next thread
 		 * can run for. It is set in pick_next handler, and decreases in
 		 * tick handler. Normally, the next thread can run until its AVT
@@ -253,11 +362,11 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 		 * number to it so that it can run for a long time. Here,
 		 * UINT64_MAX can make it run for >100 years before rescheduled.
 		 */
-		if (sec != NULL) {
-			second_obj = container_of(sec, struct thread_object, data);
+		if (second_obj != NULL) {
 			second_data = (struct sched_bvt_data *)second_obj->data;
 			delta_mcu = second_data->evt - first_data->evt;
 			first_data->run_countdown = v2p(delta_mcu, first_data->vt_ratio) + BVT_CSA_MCU;
+			ctl->slice_end_tsc = now_tsc + (first_data->run_countdown * first_data->mcu);
 		} else {
 			first_data->run_countdown = UINT64_MAX;
 		}
@@ -292,6 +401,52 @@ static void sched_bvt_wake(struct thread_object *obj)
 
 }
 
+static struct thread_object *sched_bvt_pick_migrate(struct sched_control *ctl, uint16_t pcpu_id, bool cold_only)
+{
+	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)ctl->priv;
+
+	return sched_pick_migrate(ctl, &bvt_ctl->runqueue, pcpu_id, cold_only);
+}
+
+/*
+ * Let the other runnable threads of the runqueue go before the current one,
+ * it is charged one CSA more at its next vt update.
+ */
+static void sched_bvt_yield(struct sched_control *ctl)
+{
+	struct thread_object *current = ctl->curr_obj;
+
+	if ((current != NULL) && !is_idle_thread(current)) {
+		((struct sched_bvt_data *)current->data)->defer_mcu = BVT_CSA_MCU;
+	}
+}
+
+/*
+ * Borrow virtual time so that the thread runs ahead of its turn. The boost
+ * lasts until it has run, its next vt update sets evt back to avt.
+ */
+static void sched_bvt_prioritize(struct thread_object *obj)
+{
+	struct sched_bvt_data *data = (struct sched_bvt_data *)obj->data;
+
+	data->evt = data->avt - BVT_WARP_MCU;
+	if (is_inqueue(obj)) {
+		runqueue_update(obj);
+	}
+}
+
+/*
+ * @pre obj is a thread of the BVT scheduler
+ */
+void sched_bvt_get_stats(const struct thread_object *obj, struct sched_bvt_stats *stats)
+{
+	const struct sched_bvt_data *data = (const struct sched_bvt_data *)obj->data;
+
+	stats->avt = data->avt;
+	stats->evt = data->evt;
+	(void)memcpy_s(stats->vt_hist, sizeof(stats->vt_hist), data->vt_hist, sizeof(data->vt_hist));
+}
+
 struct acrn_scheduler sched_bvt = {
 	.name		= "sched_bvt",
 	.init		= sched_bvt_init,
@@ -299,5 +454,8 @@ struct acrn_scheduler sched_bvt = {
 	.pick_next	= sched_bvt_pick_next,
 	.sleep		= sched_bvt_sleep,
 	.wake		= sched_bvt_wake,
+	.yield		= sched_bvt_yield,
+	.prioritize	= sched_bvt_prioritize,
+	.pick_migrate	= sched_bvt_pick_migrate,
 	.deinit		= sched_bvt_deinit,
 };
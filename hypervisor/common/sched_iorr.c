@@ -115,11 +115,11 @@ int sched_iorr_init(struct sched_control *ctl)
 	ctl->priv = iorr_ctl;
 	INIT_LIST_HEAD(&iorr_ctl->runqueue);
 
-	/* The tick_timer is periodically */
+	/* The tick_timer is periodically, unless the slices end on preemption timer exits */
 	initialize_timer(&iorr_ctl->tick_timer, sched_tick_handler, ctl,
 			cpu_ticks() + tick_period, tick_period);
 
-	if (add_timer(&iorr_ctl->tick_timer) < 0) {
+	if (!sched_use_preemption_timer() && (add_timer(&iorr_ctl->tick_timer) < 0)) {
 		pr_err("Failed to add schedule tick timer!");
 		ret = -1;
 	}
@@ -176,6 +176,10 @@ static struct thread_object *sched_iorr_pick_next(struct sched_control *ctl)
 		while (data->left_cycles <= 0) {
 			data->left_cycles += data->slice_cycles;
 		}
+		/* the slice only ends if another thread waits for the pcpu */
+		if (data->list.next != &iorr_ctl->runqueue) {
+			ctl->slice_end_tsc = now + (uint64_t)data->left_cycles;
+		}
 	} else {
 		next = &get_cpu_var(idle);
 	}
@@ -193,6 +197,20 @@ static void sched_iorr_wake(struct thread_object *obj)
 	runqueue_add_head(obj);
 }
 
+static void sched_iorr_prioritize(struct thread_object *obj)
+{
+	/* run it right after the current thread object */
+	runqueue_remove(obj);
+	runqueue_add_head(obj);
+}
+
+static struct thread_object *sched_iorr_pick_migrate(struct sched_control *ctl, uint16_t pcpu_id, bool cold_only)
+{
+	struct sched_iorr_control *iorr_ctl = (struct sched_iorr_control *)ctl->priv;
+
+	return sched_pick_migrate(ctl, &iorr_ctl->runqueue, pcpu_id, cold_only);
+}
+
 struct acrn_scheduler sched_iorr = {
 	.name		= "sched_iorr",
 	.init		= sched_iorr_init,
@@ -200,5 +218,7 @@ struct acrn_scheduler sched_iorr = {
 	.pick_next	= sched_iorr_pick_next,
 	.sleep		= sched_iorr_sleep,
 	.wake		= sched_iorr_wake,
+	.prioritize	= sched_iorr_prioritize,
+	.pick_migrate	= sched_iorr_pick_migrate,
 	.deinit		= sched_iorr_deinit,
 };
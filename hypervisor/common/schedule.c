@@ -13,6 +13,13 @@
 #include <schedule.h>
 #include <sprintf.h>
 #include <asm/irq.h>
+#include <asm/cpu_caps.h>
+#include <asm/vm_config.h>
+#include <ticks.h>
+
+/* a thread switched out more recently than this still has a warm cache */
+#define SCHED_CACHE_HOT_US		1000U
+#define SCHED_BALANCE_PERIOD_MS		10U
 
 bool is_idle_thread(const struct thread_object *obj)
 {
@@ -32,6 +39,16 @@ static inline bool is_running(const struct thread_object *obj)
 
 static inline void set_thread_status(struct thread_object *obj, enum thread_object_state status)
 {
+	/* account the runqueue length, the idle thread doesn't count */
+	if (!is_idle_thread(obj)) {
+		if ((obj->status == THREAD_STS_RUNNABLE) && (status != THREAD_STS_RUNNABLE)) {
+			obj->sched_ctl->nr_runnable--;
+		} else if ((obj->status != THREAD_STS_RUNNABLE) && (status == THREAD_STS_RUNNABLE)) {
+			obj->sched_ctl->nr_runnable++;
+		} else {
+			/* runqueue length unchanged */
+		}
+	}
 	obj->status = status;
 }
 
@@ -53,6 +70,28 @@ static struct acrn_scheduler *get_scheduler(uint16_t pcpu_id)
 	return ctl->scheduler;
 }
 
+/*
+ * Take the schedule lock of the pcpu the thread is on. The thread may be
+ * migrated while we wait for the lock, so check it is still there.
+ */
+static uint16_t obtain_thread_schedule_lock(const struct thread_object *obj, uint64_t *rflag)
+{
+	uint16_t pcpu_id;
+	bool locked = false;
+
+	do {
+		pcpu_id = obj->pcpu_id;
+		obtain_schedule_lock(pcpu_id, rflag);
+		if (obj->pcpu_id == pcpu_id) {
+			locked = true;
+		} else {
+			release_schedule_lock(pcpu_id, *rflag);
+		}
+	} while (!locked);
+
+	return pcpu_id;
+}
+
 /**
  * @pre obj != NULL
  */
@@ -69,6 +108,11 @@ void init_sched(uint16_t pcpu_id)
 	ctl->flags = 0UL;
 	ctl->curr_obj = NULL;
 	ctl->pcpu_id = pcpu_id;
+	ctl->nr_runnable = 0U;
+	ctl->nr_migrations = 0UL;
+	ctl->pull_mask = 0UL;
+	ctl->next_balance_tsc = 0UL;
+	ctl->slice_end_tsc = 0UL;
 #ifdef CONFIG_SCHED_NOOP
 	ctl->scheduler = &sched_noop;
 #endif
@@ -121,6 +165,207 @@ struct thread_object *sched_get_current(uint16_t pcpu_id)
 	return ctl->curr_obj;
 }
 
+/*
+ * Whether the slices of the vCPUs end on VMX preemption timer exits, which
+ * replace the periodic tick timers of the schedulers.
+ */
+bool sched_use_preemption_timer(void)
+{
+#ifdef CONFIG_SCHED_PREEMPTION_TIMER
+	/* the VMCS02 of the L2 guests is set up from the controls of their L1 hypervisor */
+	return (MAX_NVMX_VM_NUM == 0U) && is_preemption_timer_supported();
+#else
+	return false;
+#endif
+}
+
+uint64_t sched_get_slice_end(uint16_t pcpu_id)
+{
+	return per_cpu(sched_ctl, pcpu_id).slice_end_tsc;
+}
+
+/*
+ * Request the reschedule the tick timer would have if the slice of the
+ * current thread is over.
+ */
+void sched_check_slice_end(uint16_t pcpu_id)
+{
+	uint64_t end = per_cpu(sched_ctl, pcpu_id).slice_end_tsc;
+
+	if ((end != 0UL) && (cpu_ticks() >= end)) {
+		make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+	}
+}
+
+uint32_t sched_get_nr_runnable(uint16_t pcpu_id)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+	return ctl->nr_runnable;
+}
+
+/*
+ * Pick the thread of the runqueue that is the best one to leave its pcpu
+ * for pcpu_id: it must be runnable but not running, allow pcpu_id in its
+ * affinity and agree to move. The one switched out the longest time ago
+ * is picked since its cache footprint is the coldest, threads that ran
+ * very recently are skipped if cold_only is set.
+ *
+ * @pre the runqueue keeps the list as the first item of thread_object->data
+ * @pre the schedule lock of ctl->pcpu_id is held
+ */
+struct thread_object *sched_pick_migrate(const struct sched_control *ctl, const struct list_head *runqueue,
+		uint16_t pcpu_id, bool cold_only)
+{
+	struct thread_object *obj, *picked = NULL;
+	const struct list_head *pos;
+	uint64_t now = cpu_ticks();
+
+	list_for_each(pos, runqueue) {
+		obj = container_of(pos, struct thread_object, data);
+		if ((obj == ctl->curr_obj) || (obj->status != THREAD_STS_RUNNABLE) ||
+				((obj->affinity & (1UL << pcpu_id)) == 0UL) || (obj->can_migrate == NULL)) {
+			continue;
+		}
+		if (cold_only && ((now - obj->last_run_tsc) < us_to_ticks(SCHED_CACHE_HOT_US))) {
+			continue;
+		}
+		if (((picked == NULL) || (obj->last_run_tsc < picked->last_run_tsc)) &&
+				obj->can_migrate(obj, pcpu_id)) {
+			picked = obj;
+		}
+	}
+
+	return picked;
+}
+
+#ifdef CONFIG_SCHED_BALANCE
+static uint32_t pcpu_load(uint16_t pcpu_id)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+	uint32_t load = ctl->nr_runnable;
+
+	if ((ctl->curr_obj != NULL) && !is_idle_thread(ctl->curr_obj)) {
+		load++;
+	}
+
+	return load;
+}
+
+/*
+ * Move one runnable thread from the current pcpu to pcpu_id.
+ *
+ * It has to run on the pcpu the thread leaves: the architecture hook
+ * (e.g. VMCLEAR of a vCPU's VMCS) must be done by the pcpu it last ran on.
+ */
+static void migrate_one_thread(uint16_t pcpu_id, bool cold_only)
+{
+	uint16_t src_id = get_pcpu_id();
+	struct sched_control *src = &per_cpu(sched_ctl, src_id);
+	struct sched_control *dst = &per_cpu(sched_ctl, pcpu_id);
+	struct thread_object *obj = NULL;
+	uint64_t rflag, dst_rflag;
+
+	/* take both locks in pcpu id order */
+	if (src_id < pcpu_id) {
+		obtain_schedule_lock(src_id, &rflag);
+		obtain_schedule_lock(pcpu_id, &dst_rflag);
+	} else {
+		obtain_schedule_lock(pcpu_id, &rflag);
+		obtain_schedule_lock(src_id, &dst_rflag);
+	}
+
+	if (src->scheduler->pick_migrate != NULL) {
+		obj = src->scheduler->pick_migrate(src, pcpu_id, cold_only);
+	}
+	if (obj != NULL) {
+		src->scheduler->sleep(obj);
+		src->nr_runnable--;
+
+		obj->migrate(obj, pcpu_id);
+		obj->pcpu_id = pcpu_id;
+		obj->sched_ctl = dst;
+
+		dst->scheduler->wake(obj);
+		dst->nr_runnable++;
+		src->nr_migrations++;
+		make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+	}
+
+	if (src_id < pcpu_id) {
+		release_schedule_lock(pcpu_id, dst_rflag);
+		release_schedule_lock(src_id, rflag);
+	} else {
+		release_schedule_lock(src_id, dst_rflag);
+		release_schedule_lock(pcpu_id, rflag);
+	}
+}
+
+/*
+ * Serve the pull requests of idle pcpus, and periodically push one thread
+ * to the least loaded pcpu if this one has at least two threads more.
+ */
+static void sched_balance(uint16_t pcpu_id)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+	uint64_t now = cpu_ticks();
+	uint64_t mask = get_active_pcpu_bitmap();
+	uint16_t i, target = INVALID_CPU_ID;
+	uint32_t load, min_load;
+
+	while (ctl->pull_mask != 0UL) {
+		i = ffs64(ctl->pull_mask);
+		bitmap_clear_lock(i, &ctl->pull_mask);
+		if ((ctl->nr_runnable != 0U) && (pcpu_load(i) == 0U)) {
+			migrate_one_thread(i, false);
+		}
+	}
+
+	if ((ctl->nr_runnable != 0U) && (now >= ctl->next_balance_tsc)) {
+		ctl->next_balance_tsc = now + (SCHED_BALANCE_PERIOD_MS * TICKS_PER_MS);
+
+		min_load = pcpu_load(pcpu_id);
+		for (i = 0U; i < get_pcpu_nums(); i++) {
+			if ((i != pcpu_id) && ((mask & (1UL << i)) != 0UL)) {
+				load = pcpu_load(i);
+				if ((load + 1U) < min_load) {
+					min_load = load;
+					target = i;
+				}
+			}
+		}
+		if (target != INVALID_CPU_ID) {
+			migrate_one_thread(target, true);
+		}
+	}
+}
+
+/*
+ * Called when pcpu_id is about to go idle: ask the busiest pcpu to push a
+ * waiting thread here. The request is served in the next schedule() there.
+ */
+static void sched_request_pull(uint16_t pcpu_id)
+{
+	uint64_t mask = get_active_pcpu_bitmap();
+	uint16_t i, busiest = INVALID_CPU_ID;
+	uint32_t nr, max_nr = 0U;
+
+	for (i = 0U; i < get_pcpu_nums(); i++) {
+		if ((i != pcpu_id) && ((mask & (1UL << i)) != 0UL)) {
+			nr = sched_get_nr_runnable(i);
+			if (nr > max_nr) {
+				max_nr = nr;
+				busiest = i;
+			}
+		}
+	}
+
+	if ((busiest != INVALID_CPU_ID) &&
+			!bitmap_test_and_set_lock(pcpu_id, &per_cpu(sched_ctl, busiest).pull_mask)) {
+		make_reschedule_request(busiest, DEL_MODE_IPI);
+	}
+}
+#endif
+
 /**
  * @pre delmode == DEL_MODE_IPI || delmode == DEL_MODE_NMI
  */
@@ -129,7 +374,11 @@ void make_reschedule_request(uint16_t pcpu_id, uint16_t delmode)
 	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
 
 	bitmap_set_lock(NEED_RESCHEDULE, &ctl->flags);
-	if (get_pcpu_id() != pcpu_id) {
+	/*
+	 * The locked set above orders the flag before the read of polling, the
+	 * pcpu clears polling and fences before it checks the flag a last time.
+	 */
+	if ((get_pcpu_id() != pcpu_id) && !ctl->polling) {
 		switch (delmode) {
 		case DEL_MODE_IPI:
 			send_single_ipi(pcpu_id, NOTIFY_VCPU_VECTOR);
@@ -151,6 +400,14 @@ bool need_reschedule(uint16_t pcpu_id)
 	return bitmap_test(NEED_RESCHEDULE, &ctl->flags);
 }
 
+/**
+ * @pre pcpu_id == get_pcpu_id()
+ */
+void set_reschedule_polling(uint16_t pcpu_id, bool polling)
+{
+	per_cpu(sched_ctl, pcpu_id).polling = polling;
+}
+
 void schedule(void)
 {
 	uint16_t pcpu_id = get_pcpu_id();
@@ -159,20 +416,34 @@ void schedule(void)
 	struct thread_object *prev = ctl->curr_obj;
 	uint64_t rflag;
 
+#ifdef CONFIG_SCHED_BALANCE
+	sched_balance(pcpu_id);
+#endif
+
 	obtain_schedule_lock(pcpu_id, &rflag);
+	/* set by pick_next for a thread whose slice ends */
+	ctl->slice_end_tsc = 0UL;
 	if (ctl->scheduler->pick_next != NULL) {
 		next = ctl->scheduler->pick_next(ctl);
 	}
 	bitmap_clear_lock(NEED_RESCHEDULE, &ctl->flags);
 
+#ifdef CONFIG_SCHED_BALANCE
+	if (is_idle_thread(next)) {
+		sched_request_pull(pcpu_id);
+	}
+#endif
+
 	/* If we picked different sched object, switch context */
 	if (prev != next) {
+		per_cpu(stats, pcpu_id).sched_switches++;
 		if (prev != NULL) {
 			if (prev->switch_out != NULL) {
 				prev->switch_out(prev);
 			}
 			set_thread_status(prev, prev->be_blocking ? THREAD_STS_BLOCKED : THREAD_STS_RUNNABLE);
 			prev->be_blocking = false;
+			prev->last_run_tsc = cpu_ticks();
 		}
 
 		if (next->switch_in != NULL) {
@@ -190,11 +461,12 @@ void schedule(void)
 
 void sleep_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
-	struct acrn_scheduler *scheduler = get_scheduler(pcpu_id);
+	uint16_t pcpu_id;
+	struct acrn_scheduler *scheduler;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_schedule_lock(obj, &rflag);
+	scheduler = get_scheduler(pcpu_id);
 	if (scheduler->sleep != NULL) {
 		scheduler->sleep(obj);
 	}
@@ -221,11 +493,11 @@ void sleep_thread_sync(struct thread_object *obj)
 
 void wake_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
+	uint16_t pcpu_id;
 	struct acrn_scheduler *scheduler;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_schedule_lock(obj, &rflag);
 	if (is_blocked(obj) || obj->be_blocking) {
 		scheduler = get_scheduler(pcpu_id);
 		if (scheduler->wake != NULL) {
@@ -242,7 +514,41 @@ void wake_thread(struct thread_object *obj)
 
 void yield_current(void)
 {
-	make_reschedule_request(get_pcpu_id(), DEL_MODE_IPI);
+	uint16_t pcpu_id = get_pcpu_id();
+	struct acrn_scheduler *scheduler = get_scheduler(pcpu_id);
+	uint64_t rflag;
+
+	if (scheduler->yield != NULL) {
+		obtain_schedule_lock(pcpu_id, &rflag);
+		scheduler->yield(&per_cpu(sched_ctl, pcpu_id));
+		release_schedule_lock(pcpu_id, rflag);
+	}
+	make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+}
+
+/*
+ * Let a runnable thread preempt the one running on its pcpu, e.g. a vCPU
+ * preempted while holding a lock its siblings spin on.
+ *
+ * return true if the thread was runnable and got prioritized
+ */
+bool boost_thread(struct thread_object *obj)
+{
+	uint16_t pcpu_id;
+	struct acrn_scheduler *scheduler;
+	uint64_t rflag;
+	bool boosted = false;
+
+	pcpu_id = obtain_thread_schedule_lock(obj, &rflag);
+	scheduler = get_scheduler(pcpu_id);
+	if ((obj->status == THREAD_STS_RUNNABLE) && (scheduler->prioritize != NULL)) {
+		scheduler->prioritize(obj);
+		make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+		boosted = true;
+	}
+	release_schedule_lock(pcpu_id, rflag);
+
+	return boosted;
 }
 
 void run_thread(struct thread_object *obj)
@@ -25,6 +25,19 @@ uint64_t ticks_to_us(uint64_t ticks)
 	return us;
 }
 
+uint64_t ticks_to_ns(uint64_t ticks)
+{
+	uint64_t ns = 0UL;
+	uint64_t khz = cpu_tickrate();
+
+	if (khz != 0U) {
+		/* split so that long intervals don't overflow */
+		ns = ((ticks / khz) * 1000000UL) + (((ticks % khz) * 1000000UL) / khz);
+	}
+
+	return ns;
+}
+
 uint64_t ticks_to_ms(uint64_t ticks)
 {
 	return ticks / (uint64_t)cpu_tickrate();
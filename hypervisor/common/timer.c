@@ -16,10 +16,32 @@
 #include <asm/irq.h>
 #include <ticks.h>
 #include <hw/hw_timer.h>
+#include <asm/per_cpu.h>
+#include <asm/vm_config.h>
+#include <rt_latency.h>
+#include <asm/guest/hyperv.h>
+#include <dm/vhpet.h>
 
 #define MAX_TIMER_ACTIONS	32U
 #define MIN_TIMER_PERIOD_US	500U
 
+/*
+ * Timers a vcpu may arm on its pcpu: the vlapic timer, the SynIC stimers and
+ * the split lock throttle timer.
+ */
+#define MAX_TIMERS_PER_VCPU	(1U + HV_SYNIC_STIMER_COUNT + 1U)
+
+/*
+ * Timers armed on a pcpu, at most: one ptdev delay timer per entry; per VM,
+ * its vHPET timers and those of the one vcpu it runs there; the scheduler
+ * tick, the console and console TX timers and the profiling sample timer.
+ */
+#define MAX_TIMERS_PER_CPU	(CONFIG_MAX_PT_IRQ_ENTRIES + \
+				(CONFIG_MAX_VM_NUM * (VHPET_NUM_TIMERS + MAX_TIMERS_PER_VCPU)) + 4U)
+
+/* slot 0 is unused so that parent/child indexes are plain shifts */
+static struct hv_timer *timer_heap[MAX_PCPU_NUM][MAX_TIMERS_PER_CPU + 1U];
+
 bool timer_expired(const struct hv_timer *timer, uint64_t now, uint64_t *delta)
 {
 	bool ret = true;
@@ -39,56 +61,121 @@ bool timer_expired(const struct hv_timer *timer, uint64_t now, uint64_t *delta)
 
 bool timer_is_started(const struct hv_timer *timer)
 {
-	return (!list_empty(&timer->node));
+	return (timer->heap_idx != 0U);
 }
 
 static void run_timer(const struct hv_timer *timer)
 {
+	uint64_t now;
+
 	/* deadline = 0 means stop timer, we should skip */
 	if ((timer->func != NULL) && (timer->timeout != 0UL)) {
+		/* the slack is a delay asked for, the lateness is past the deadline */
+		now = cpu_ticks();
+		account_latency(&get_cpu_var(rt_latency).hv_timer_delay,
+				(now > timer->deadline) ? (now - timer->deadline) : 0UL);
+		get_cpu_var(stats).timer_fires++;
 		timer->func(timer->priv_data);
 	}
 
 	TRACE_2L(TRACE_TIMER_ACTION_PCKUP, timer->timeout, 0UL);
 }
 
-static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
+static inline void update_physical_timer(const struct per_cpu_timers *cpu_timer)
 {
-	struct hv_timer *timer = NULL;
-
 	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
-		timer = container_of((&cpu_timer->timer_list)->next,
-			struct hv_timer, node);
-
+	if (cpu_timer->nr_timers != 0U) {
 		/* it is okay to program a expired time */
-		msr_write(MSR_IA32_TSC_DEADLINE, timer->timeout);
+		msr_write(MSR_IA32_TSC_DEADLINE, cpu_timer->heap[1]->deadline);
 	}
 }
 
+static inline void heap_set(struct per_cpu_timers *cpu_timer, uint32_t idx, struct hv_timer *timer)
+{
+	cpu_timer->heap[idx] = timer;
+	timer->heap_idx = idx;
+}
+
 /*
- * return true if we add the timer on the timer_list head
+ * Move the timer at idx towards the root while it expires earlier than its
+ * parent.
  */
-static bool local_add_timer(struct per_cpu_timers *cpu_timer,
-			struct hv_timer *timer)
+static void heap_sift_up(struct per_cpu_timers *cpu_timer, uint32_t idx)
 {
-	struct list_head *pos, *prev;
-	struct hv_timer *tmp;
-	uint64_t tsc = timer->timeout;
+	struct hv_timer *timer = cpu_timer->heap[idx];
+	uint32_t pos = idx, parent;
 
-	prev = &cpu_timer->timer_list;
-	list_for_each(pos, &cpu_timer->timer_list) {
-		tmp = container_of(pos, struct hv_timer, node);
-		if (tmp->timeout < tsc) {
-			prev = &tmp->node;
-		} else {
+	while (pos > 1U) {
+		parent = pos >> 1U;
+		if (cpu_timer->heap[parent]->deadline <= timer->deadline) {
 			break;
 		}
+		heap_set(cpu_timer, pos, cpu_timer->heap[parent]);
+		pos = parent;
 	}
+	heap_set(cpu_timer, pos, timer);
+}
 
-	list_add(&timer->node, prev);
+/*
+ * Move the timer at idx towards the leaves while one of its children
+ * expires earlier.
+ */
+static void heap_sift_down(struct per_cpu_timers *cpu_timer, uint32_t idx)
+{
+	struct hv_timer *timer = cpu_timer->heap[idx];
+	uint32_t pos = idx, child;
+
+	while ((pos << 1U) <= cpu_timer->nr_timers) {
+		child = pos << 1U;
+		if ((child < cpu_timer->nr_timers) &&
+				(cpu_timer->heap[child + 1U]->deadline < cpu_timer->heap[child]->deadline)) {
+			child++;
+		}
+		if (timer->deadline <= cpu_timer->heap[child]->deadline) {
+			break;
+		}
+		heap_set(cpu_timer, pos, cpu_timer->heap[child]);
+		pos = child;
+	}
+	heap_set(cpu_timer, pos, timer);
+}
 
-	return (prev == &cpu_timer->timer_list);
+/*
+ * the new head is checked by the caller
+ *
+ * @pre cpu_timer->nr_timers < MAX_TIMERS_PER_CPU
+ */
+static void local_add_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	/* the heap is ordered by the latest tsc the timer may fire at */
+	timer->deadline = timer->timeout + timer->slack;
+	cpu_timer->nr_timers++;
+	heap_set(cpu_timer, cpu_timer->nr_timers, timer);
+
+	heap_sift_up(cpu_timer, cpu_timer->nr_timers);
+}
+
+/*
+ * @pre timer->heap_idx != 0U
+ */
+static void local_del_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	uint32_t idx = timer->heap_idx;
+	struct hv_timer *last;
+
+	last = cpu_timer->heap[cpu_timer->nr_timers];
+	cpu_timer->heap[cpu_timer->nr_timers] = NULL;
+	cpu_timer->nr_timers--;
+	timer->heap_idx = 0U;
+
+	/* fill the hole with the last timer and restore the heap order */
+	if (last != timer) {
+		heap_set(cpu_timer, idx, last);
+		heap_sift_up(cpu_timer, idx);
+		heap_sift_down(cpu_timer, last->heap_idx);
+	}
 }
 
 int32_t add_timer(struct hv_timer *timer)
@@ -101,7 +188,7 @@ int32_t add_timer(struct hv_timer *timer)
 	if ((timer == NULL) || (timer->func == NULL) || (timer->timeout == 0UL)) {
 		ret = -EINVAL;
 	} else {
-		ASSERT(list_empty(&timer->node), "add timer again!\n");
+		ASSERT(timer->heap_idx == 0U, "add timer again!\n");
 
 		/* limit minimal periodic timer cycle period */
 		if (timer->mode == TICK_MODE_PERIODIC) {
@@ -112,13 +199,21 @@ int32_t add_timer(struct hv_timer *timer)
 		cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
 		CPU_INT_ALL_DISABLE(&rflags);
-		/* update the physical timer if we're on the timer_list head */
-		if (local_add_timer(cpu_timer, timer)) {
-			update_physical_timer(cpu_timer);
+		if (cpu_timer->nr_timers < MAX_TIMERS_PER_CPU) {
+			timer->pcpu_id = pcpu_id;
+			local_add_timer(cpu_timer, timer);
+			/* update the physical timer if we're on the heap top */
+			if (timer->heap_idx == 1U) {
+				update_physical_timer(cpu_timer);
+			}
+		} else {
+			ret = -ENOMEM;
 		}
 		CPU_INT_ALL_RESTORE(rflags);
 
-		TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->timeout, 0UL);
+		if (ret == 0) {
+			TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->timeout, 0UL);
+		}
 	}
 
 	return ret;
@@ -140,7 +235,10 @@ void initialize_timer(struct hv_timer *timer,
 			timer->mode = TICK_MODE_ONESHOT;
 			timer->period_in_cycle = 0UL;
 		}
-		INIT_LIST_HEAD(&timer->node);
+		timer->slack = 0UL;
+		timer->deadline = 0UL;
+		timer->heap_idx = 0U;
+		timer->pcpu_id = INVALID_CPU_ID;
 	}
 }
 
@@ -158,32 +256,50 @@ void update_timer(struct hv_timer *timer, uint64_t timeout, uint64_t period)
 	}
 }
 
+void set_timer_slack(struct hv_timer *timer, uint64_t slack)
+{
+	if (timer != NULL) {
+		timer->slack = slack;
+	}
+}
+
 void del_timer(struct hv_timer *timer)
 {
 	uint64_t rflags;
 
 	CPU_INT_ALL_DISABLE(&rflags);
-	if ((timer != NULL) && !list_empty(&timer->node)) {
-		list_del_init(&timer->node);
+	if ((timer != NULL) && (timer->heap_idx != 0U)) {
+		local_del_timer(&per_cpu(cpu_timers, timer->pcpu_id), timer);
 	}
 	CPU_INT_ALL_RESTORE(rflags);
 }
 
+/**
+ * @pre pcpu_id == get_pcpu_id() and the interrupts are disabled
+ */
+uint64_t next_timer_deadline(uint16_t pcpu_id)
+{
+	const struct per_cpu_timers *cpu_timer = &per_cpu(cpu_timers, pcpu_id);
+
+	return (cpu_timer->nr_timers != 0U) ? cpu_timer->heap[1]->deadline : 0UL;
+}
+
 static void init_percpu_timer(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	cpu_timer->heap = timer_heap[pcpu_id];
+	cpu_timer->nr_timers = 0U;
 }
 
 static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	const struct list_head *pos, *n;
 	uint32_t tries = MAX_TIMER_ACTIONS;
 	uint64_t current_tsc = cpu_ticks();
+	uint64_t rflags;
 
 	/* handle passed timer */
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
@@ -193,20 +309,27 @@ static void timer_softirq(uint16_t pcpu_id)
 	 * caller used to local_add_timer() for periodic timer, if there is a delay
 	 * inside func(), it will infinitely loop here, because new added timer
 	 * already passed due to previously func()'s delay.
+	 *
+	 * The physical timer is programmed for the heap top's deadline, every
+	 * timer whose timeout already passed is serviced in the same pass so
+	 * that timers with overlapping slack windows share one interrupt.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = container_of(pos, struct hv_timer, node);
+	CPU_INT_ALL_DISABLE(&rflags);
+	while (cpu_timer->nr_timers != 0U) {
+		timer = cpu_timer->heap[1];
 		/* timer expried */
 		tries--;
 		if ((timer->timeout <= current_tsc) && (tries != 0U)) {
-			del_timer(timer);
+			local_del_timer(cpu_timer, timer);
 
+			CPU_INT_ALL_RESTORE(rflags);
 			run_timer(timer);
+			CPU_INT_ALL_DISABLE(&rflags);
 
 			if (timer->mode == TICK_MODE_PERIODIC) {
 				/* update periodic timer fire tsc */
 				timer->timeout += timer->period_in_cycle;
-				(void)local_add_timer(cpu_timer, timer);
+				local_add_timer(cpu_timer, timer);
 			} else {
 				timer->timeout = 0UL;
 			}
@@ -217,6 +340,7 @@ static void timer_softirq(uint16_t pcpu_id)
 
 	/* update nearest timer */
 	update_physical_timer(cpu_timer);
+	CPU_INT_ALL_RESTORE(rflags);
 }
 
 void timer_init(void)
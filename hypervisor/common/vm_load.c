@@ -9,6 +9,7 @@
 #include <asm/zeropage.h>
 #include <asm/guest/ept.h>
 #include <asm/mmu.h>
+#include <asm/lib/atomic.h>
 #include <boot.h>
 #include <efi_mmap.h>
 #include <errno.h>
@@ -32,6 +33,30 @@
 #define BZIMG_CMDLINE_GPA(load_params_gpa)	(load_params_gpa + MEM_1K + MEM_4K)
 #define BZIMG_EFIMMAP_GPA(load_params_gpa)	(load_params_gpa + MEM_1K + MEM_4K + MEM_2K)
 
+/*
+ * Images of two chunks or more are copied by all the pCPUs of the VM: its
+ * BSP publishes the image as a job and the other pCPUs, waiting in
+ * assist_sw_loading() until the VM is loaded, claim chunks of it.
+ */
+#define SW_LOAD_CHUNK_SIZE	MEM_2M
+
+/* the cursor holds the job generation, its number of chunks and the next chunk to claim */
+#define SW_LOAD_GEN_SHIFT	48U
+#define SW_LOAD_NR_SHIFT	24U
+#define SW_LOAD_IDX_MASK	((1UL << SW_LOAD_NR_SHIFT) - 1UL)
+
+struct sw_load_job {
+	uint64_t cursor;
+	uint64_t done;		/* chunks copied */
+	void *src;
+	uint64_t gpa;
+	uint32_t size;
+	uint16_t gen;
+	bool finished;		/* the BSP is done with loading, the helpers leave */
+};
+
+static struct sw_load_job sw_load_jobs[CONFIG_MAX_VM_NUM];
+
 /**
  * @pre vm != NULL && efi_mmap_desc != NULL
  */
@@ -223,16 +248,84 @@ static void prepare_loading_rawimage(struct acrn_vm *vm)
 	sw_kernel->kernel_entry_addr = (void *)vm_config->os_config.kernel_entry_addr;
 }
 
+/*
+ * Claim and copy one chunk of the current job of the VM.
+ *
+ * @return false if no chunk is left to claim
+ */
+static bool copy_sw_load_chunk(struct acrn_vm *vm, struct sw_load_job *job)
+{
+	uint64_t cursor, idx, nr, offset;
+	bool claimed = false;
+
+	cursor = *(volatile uint64_t *)&job->cursor;
+	idx = cursor & SW_LOAD_IDX_MASK;
+	nr = (cursor >> SW_LOAD_NR_SHIFT) & SW_LOAD_IDX_MASK;
+
+	if ((idx < nr) && (atomic_cmpxchg64(&job->cursor, cursor, cursor + 1UL) == cursor)) {
+		/* the job can't change until its claimed chunks are copied */
+		offset = idx * SW_LOAD_CHUNK_SIZE;
+		(void)copy_to_gpa_nt(vm, (void *)((char *)job->src + offset), job->gpa + offset,
+			(uint32_t)min((uint64_t)job->size - offset, SW_LOAD_CHUNK_SIZE));
+		atomic_inc64(&job->done);
+		claimed = true;
+	}
+
+	return claimed || (idx < nr);
+}
+
+static void load_sw_data(struct acrn_vm *vm, void *src, uint64_t gpa, uint32_t size)
+{
+	struct sw_load_job *job = &sw_load_jobs[vm->vm_id];
+	uint64_t nr = ((uint64_t)size + SW_LOAD_CHUNK_SIZE - 1UL) / SW_LOAD_CHUNK_SIZE;
+
+	if (nr < 2UL) {
+		(void)copy_to_gpa(vm, src, gpa, size);
+	} else {
+		job->src = src;
+		job->gpa = gpa;
+		job->size = size;
+		job->done = 0UL;
+		job->gen++;
+		(void)atomic_swap64(&job->cursor, ((uint64_t)job->gen << SW_LOAD_GEN_SHIFT) | (nr << SW_LOAD_NR_SHIFT));
+
+		while (copy_sw_load_chunk(vm, job)) {
+		}
+		wait_sync_change(&job->done, nr);
+	}
+}
+
 /**
  * @pre sw_module != NULL
  */
 static void load_sw_module(struct acrn_vm *vm, struct sw_module_info *sw_module)
 {
 	if (sw_module->size != 0) {
-		(void)copy_to_gpa(vm, sw_module->src_addr, (uint64_t)sw_module->load_addr, sw_module->size);
+		load_sw_data(vm, sw_module->src_addr, (uint64_t)sw_module->load_addr, sw_module->size);
+	}
+}
+
+/*
+ * Run by the pCPUs of a pre-launched or SOS VM other than its BSP, to copy
+ * chunks of its images until the BSP calls end_sw_loading().
+ */
+void assist_sw_loading(uint16_t vm_id)
+{
+	struct sw_load_job *job = &sw_load_jobs[vm_id];
+	struct acrn_vm *vm = get_vm_from_vmid(vm_id);
+
+	while (!*(volatile bool *)&job->finished) {
+		if (!copy_sw_load_chunk(vm, job)) {
+			asm_pause();
+		}
 	}
 }
 
+void end_sw_loading(uint16_t vm_id)
+{
+	sw_load_jobs[vm_id].finished = true;
+}
+
 /**
  * @pre vm != NULL
  */
@@ -246,7 +339,7 @@ static void load_sw_modules(struct acrn_vm *vm, uint64_t load_params_gpa)
 	pr_dbg("Loading guest to run-time location");
 
 	/* Copy the guest kernel image to its run-time location */
-	(void)copy_to_gpa(vm, sw_kernel->kernel_src_addr,
+	load_sw_data(vm, sw_kernel->kernel_src_addr,
 		(uint64_t)sw_kernel->kernel_load_addr, sw_kernel->kernel_size);
 
 	if (vm->sw.kernel_type == KERNEL_BZIMAGE) {
@@ -19,8 +19,13 @@
 #include <dbg_cmd.h>
 
 struct hv_timer console_timer;
+/* one-shot, drains the UART TX ring while it holds output */
+static struct hv_timer console_tx_timer;
+static bool console_tx_buffered;
 
 #define CONSOLE_KICK_TIMER_TIMEOUT  40UL /* timeout is 40ms*/
+#define CONSOLE_TX_TIMER_PERIOD_US  1000UL	/* about a 16-byte TX FIFO at 115200 baud */
+#define CONSOLE_TX_TIMER_SLACK_US   500UL
 /* Switching key combinations for shell and uart console */
 #define GUEST_CONSOLE_TO_HV_SWITCH_KEY      0       /* CTRL + SPACE */
 uint16_t console_vmid = ACRN_INVALID_VMID;
@@ -62,15 +67,59 @@ void console_init(void)
 	uart16550_init(true);
 }
 
+/*
+ * @pre the caller runs on the BSP, which owns console_tx_timer
+ */
+static void console_arm_tx_timer(void)
+{
+	uint64_t rflags;
+
+	/* interrupts off: a print from an interrupt handler may arm it as well */
+	CPU_INT_ALL_DISABLE(&rflags);
+	if (!timer_is_started(&console_tx_timer)) {
+		update_timer(&console_tx_timer, cpu_ticks() + us_to_ticks(CONSOLE_TX_TIMER_PERIOD_US), 0UL);
+		/* not logged, it would print from here: a full heap delays the output to the next print */
+		(void)add_timer(&console_tx_timer);
+	}
+	CPU_INT_ALL_RESTORE(rflags);
+}
+
+static void console_tx_timer_callback(__unused void *data)
+{
+	if (uart16550_tx_kick()) {
+		console_arm_tx_timer();
+	}
+}
+
+/*
+ * The output of the other pCPUs waits for the next console timer to start
+ * draining the ring.
+ */
+static void console_kick_tx(void)
+{
+	if (console_tx_buffered && (get_pcpu_id() == BSP_CPU_ID)) {
+		console_arm_tx_timer();
+	}
+}
+
 void console_putc(const char *ch)
 {
 	(void)uart16550_puts(ch, 1U);
+	console_kick_tx();
 }
 
 
 size_t console_write(const char *s, size_t len)
 {
-	return  uart16550_puts(s, len);
+	size_t ret = uart16550_puts(s, len);
+
+	console_kick_tx();
+	return ret;
+}
+
+void console_flush(void)
+{
+	uart16550_flush();
 }
 
 char console_getc(void)
@@ -144,6 +193,10 @@ static void console_timer_callback(__unused void *data)
 {
 	struct acrn_vuart *vu;
 
+	if (uart16550_tx_kick()) {
+		console_arm_tx_timer();
+	}
+
 	/* Kick HV-Shell and Uart-Console tasks */
 	vu = vuart_console_active();
 	if (vu != NULL) {
@@ -169,11 +222,20 @@ void console_setup_timer(void)
 	/* Start an periodic timer */
 	if (add_timer(&console_timer) != 0) {
 		pr_err("Failed to add console kick timer");
+	} else {
+		/* the timers run from now on, stop polling the UART for each character */
+		initialize_timer(&console_tx_timer, console_tx_timer_callback, NULL, 0UL, 0UL);
+		set_timer_slack(&console_tx_timer, us_to_ticks(CONSOLE_TX_TIMER_SLACK_US));
+		uart16550_buffer_tx(true);
+		console_tx_buffered = true;
 	}
 }
 
 void suspend_console(void)
 {
+	console_tx_buffered = false;
+	del_timer(&console_tx_timer);
+	uart16550_buffer_tx(false);
 	del_timer(&console_timer);
 }
 
@@ -13,6 +13,7 @@
 #include <asm/init.h>
 #include <logmsg.h>
 #include <dump.h>
+#include <console.h>
 #include <reloc.h>
 
 #define CALL_TRACE_HIERARCHY_MAX    20U
@@ -198,6 +199,7 @@ void asm_assert(int32_t line, const char *file, const char *txt)
 			file, line, txt);
 	show_host_call_trace(rsp, rbp, pcpu_id);
 	dump_guest_context(pcpu_id);
+	console_flush();
 	do {
 		asm_pause();
 	} while (1);
@@ -252,6 +254,7 @@ void dump_exception(struct intr_excp_ctx *ctx, uint16_t pcpu_id)
 	show_host_call_trace(ctx->gp_regs.rsp, ctx->gp_regs.rbp, pcpu_id);
 	/* Dump guest context */
 	dump_guest_context(pcpu_id);
+	console_flush();
 
 	/* Save registers*/
 	crash_ctx = ctx;
@@ -146,3 +146,35 @@ int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, __unused struct acrn_vm *targe
 	hw_info.cpu_num = get_pcpu_nums();
 	return copy_to_gpa(vcpu->vm, &hw_info, param1, sizeof(hw_info));
 }
+
+/**
+ * @brief Get the VM exit statistics of a vCPU
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to sos
+ * @param param2 Guest physical address pointing to struct acrn_vmexit_stats,
+ *               whose vcpu_id selects the vCPU of target_vm
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @pre param2 shall be a valid physical address
+ *
+ * @retval 0 on success
+ * @retval -1 in case of error
+ */
+int32_t hcall_get_vmexit_stats(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint16_t vcpu_id;
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && (copy_from_gpa(vm, &vcpu_id, param2, sizeof(vcpu_id)) == 0)) {
+		if (vcpu_id < target_vm->hw.created_vcpus) {
+			ret = copy_to_gpa(vm, &vcpu_from_vid(target_vm, vcpu_id)->exit_stats,
+					param2, sizeof(struct acrn_vmexit_stats));
+		}
+	}
+
+	return ret;
+}
@@ -12,6 +12,7 @@
 #include <npk_log.h>
 #include <logmsg.h>
 #include <ticks.h>
+#include <reloc.h>
 
 /* buf size should be identical to the size in hvlog option, which is
  * transfered to SOS:
@@ -26,6 +27,30 @@ struct acrn_logmsg_ctl {
 
 static struct acrn_logmsg_ctl logmsg_ctl;
 
+/*
+ * Unformatted message for the SOS log, with LOG_FLAG_MEMORY_BINARY. acrnlog
+ * formats it with the format string it looks up in the hypervisor image.
+ * The integer arguments take 8 bytes each, the string ones are copied in,
+ * NUL-terminated and padded to 8 bytes. As the formatted messages start with
+ * '[', the magic tells the two apart; keep in sync with acrnlog.
+ */
+#define LOG_BIN_MAGIC		0x01U
+#define LOG_BIN_HDR_SIZE	48U
+
+struct log_bin_record {
+	uint8_t magic;
+	uint8_t severity;
+	uint16_t pcpu_id;
+	uint16_t len;		/* header included */
+	uint16_t reserved;
+	uint32_t seq;
+	uint32_t reserved1;
+	uint64_t usec;
+	uint64_t fmt;		/* link address of the format string */
+	char thread[16];
+	uint8_t args[LOG_MESSAGE_MAX_SIZE - LOG_BIN_HDR_SIZE];
+};
+
 void init_logmsg(uint32_t flags)
 {
 	logmsg_ctl.flags = flags;
@@ -34,16 +59,126 @@ void init_logmsg(uint32_t flags)
 	spinlock_init(&(logmsg_ctl.lock));
 }
 
+static uint32_t log_bin_put_arg(uint8_t *args, uint32_t len, uint64_t v)
+{
+	uint32_t ret = len;
+
+	if ((len + sizeof(v)) <= (LOG_MESSAGE_MAX_SIZE - LOG_BIN_HDR_SIZE)) {
+		(void)memcpy_s(args + len, sizeof(v), &v, sizeof(v));
+		ret = len + (uint32_t)sizeof(v);
+	}
+
+	return ret;
+}
+
+static uint32_t log_bin_put_str(uint8_t *args, uint32_t len, const char *s_arg)
+{
+	const char *s = (s_arg != NULL) ? s_arg : "(null)";
+	uint32_t room = (LOG_MESSAGE_MAX_SIZE - LOG_BIN_HDR_SIZE) - len;
+	uint32_t n, ret = len;
+
+	if (room >= 8U) {
+		n = (uint32_t)strnlen_s(s, room - 1U);
+		(void)memcpy_s(args + len, room, s, n);
+		(void)memset(args + len + n, 0U, ((n + 8U) & ~7U) - n);
+		ret = len + ((n + 8U) & ~7U);
+	}
+
+	return ret;
+}
+
+/*
+ * Collect the arguments the way vsnprintf() consumes them: 'l' and 'll'
+ * arguments are 64-bit, the others 32-bit, and unknown conversions take none.
+ *
+ * @return the length of the arguments in the record
+ */
+static uint32_t log_bin_args(uint8_t *args, const char *fmt, va_list ap)
+{
+	const char *p = fmt;
+	uint32_t len = 0U;
+	bool is_long;
+
+	while (*p != '\0') {
+		if (*p == '%') {
+			p++;
+			while ((*p == '#') || (*p == '-') || (*p == ' ') || (*p == '+') || (*p == '.') ||
+					((*p >= '0') && (*p <= '9'))) {
+				p++;
+			}
+			is_long = false;
+			while ((*p == 'h') || (*p == 'l')) {
+				is_long = is_long || (*p == 'l');
+				p++;
+			}
+
+			if ((*p == 'd') || (*p == 'i')) {
+				if (is_long) {
+					len = log_bin_put_arg(args, len, (uint64_t)__builtin_va_arg(ap, int64_t));
+				} else {
+					len = log_bin_put_arg(args, len, (uint64_t)(int64_t)__builtin_va_arg(ap, int32_t));
+				}
+			} else if ((*p == 'u') || (*p == 'x') || (*p == 'X')) {
+				if (is_long) {
+					len = log_bin_put_arg(args, len, __builtin_va_arg(ap, uint64_t));
+				} else {
+					len = log_bin_put_arg(args, len, (uint64_t)__builtin_va_arg(ap, uint32_t));
+				}
+			} else if (*p == 'c') {
+				len = log_bin_put_arg(args, len, (uint64_t)(int64_t)__builtin_va_arg(ap, int32_t));
+			} else if (*p == 's') {
+				len = log_bin_put_str(args, len, __builtin_va_arg(ap, const char *));
+			} else {
+				/* "%%" or a conversion vsnprintf() prints as is */
+			}
+
+			if (*p != '\0') {
+				p++;
+			}
+		} else {
+			p++;
+		}
+	}
+
+	return len;
+}
+
+/* No formatting here: the record goes to the per-CPU sbuf as is */
+static void log_bin_record(struct shared_buf *sbuf, uint32_t severity, uint16_t pcpu_id, uint64_t usec,
+		uint32_t seq, const char *thread, const char *fmt, va_list ap)
+{
+	struct log_bin_record rec;
+	uint32_t len;
+
+	rec.magic = (uint8_t)LOG_BIN_MAGIC;
+	rec.severity = (uint8_t)severity;
+	rec.pcpu_id = pcpu_id;
+	rec.reserved = 0U;
+	rec.seq = seq;
+	rec.reserved1 = 0U;
+	rec.usec = usec;
+	rec.fmt = (uint64_t)fmt - get_hv_image_delta();
+	(void)memset(rec.thread, 0U, sizeof(rec.thread));
+	(void)strncpy_s(rec.thread, sizeof(rec.thread), thread, sizeof(rec.thread) - 1U);
+
+	len = LOG_BIN_HDR_SIZE + log_bin_args(rec.args, fmt, ap);
+	rec.len = (uint16_t)len;
+
+	(void)sbuf_put_many(sbuf, (uint8_t *)&rec, ((len - 1U) / LOG_ENTRY_SIZE) + 1U);
+}
+
 void do_logmsg(uint32_t severity, const char *fmt, ...)
 {
 	va_list args;
 	uint64_t timestamp, rflags;
 	uint16_t pcpu_id;
+	uint32_t seq;
 	bool do_console_log;
 	bool do_mem_log;
 	bool do_npk_log;
 	char *buffer;
 	struct thread_object *current;
+	struct shared_buf *sbuf;
 
 	do_console_log = (((logmsg_ctl.flags & LOG_FLAG_STDOUT) != 0U) && (severity <= console_loglevel));
 	do_mem_log = (((logmsg_ctl.flags & LOG_FLAG_MEMORY) != 0U) && (severity <= mem_loglevel));
@@ -63,11 +198,26 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	pcpu_id = get_pcpu_id();
 	buffer = per_cpu(logbuf, pcpu_id);
 	current = sched_get_current(pcpu_id);
+	seq = (uint32_t)atomic_inc_return(&logmsg_ctl.seq);
+
+	if (do_mem_log && ((logmsg_ctl.flags & LOG_FLAG_MEMORY_BINARY) != 0U)) {
+		sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
+		/* If sbuf is not ready, we just drop the massage */
+		if (sbuf != NULL) {
+			va_start(args, fmt);
+			log_bin_record(sbuf, severity, pcpu_id, timestamp, seq, current->name, fmt, args);
+			va_end(args);
+		}
+		do_mem_log = false;
+		if (!do_console_log && !do_npk_log) {
+			return;
+		}
+	}
 
 	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
 	/* Put time-stamp, CPU ID and severity into buffer */
 	snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%luus][cpu=%hu][%s][sev=%u][seq=%u]:",
-			timestamp, pcpu_id, current->name, severity, atomic_inc_return(&logmsg_ctl.seq));
+			timestamp, pcpu_id, current->name, severity, seq);
 
 	/* Put message into remaining portion of local buffer */
 	va_start(args, fmt);
@@ -93,18 +243,15 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 
 	/* Check if flags specify to output to memory */
 	if (do_mem_log) {
-		uint32_t i, msg_len;
-		struct shared_buf *sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
+		uint32_t msg_len;
+
+		sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
 
 		/* If sbuf is not ready, we just drop the massage */
 		if (sbuf != NULL) {
 			msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
 
-			for (i = 0U; i < (((msg_len - 1U) / LOG_ENTRY_SIZE) + 1U);
-					i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)buffer +
-							(i * LOG_ENTRY_SIZE));
-			}
+			(void)sbuf_put_many(sbuf, (uint8_t *)buffer, ((msg_len - 1U) / LOG_ENTRY_SIZE) + 1U);
 		}
 	}
 }
@@ -16,6 +16,7 @@
 #include <sprintf.h>
 #include <logmsg.h>
 #include <ticks.h>
+#include <trace.h>
 
 #define DBG_LEVEL_PROFILING		5U
 #define DBG_LEVEL_ERR_PROFILING		3U
@@ -35,6 +36,9 @@ static bool in_pmu_profiling;
 
 static uint32_t profiling_pmi_irq = IRQ_INVALID;
 
+/* period in TSC cycles of the guest RIP sampling timers, 0 if off */
+static uint64_t guest_sample_period;
+
 extern struct irq_desc irq_desc_array[NR_IRQS];
 
 static void profiling_initialize_vmsw(void)
@@ -303,7 +307,6 @@ static int32_t profiling_sbuf_put_variable(struct shared_buf *sbuf,
  */
 static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 {
-	uint64_t i;
 	uint32_t remaining_space = 0U;
 	int32_t 	ret = 0;
 	struct data_header pkt_header;
@@ -380,13 +383,10 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 				return 0;
 			}
 
-			for (i = 0U; i < (((DATA_HEADER_SIZE - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)&pkt_header + i * SEP_BUF_ENTRY_SIZE);
-			}
-
-			for (i = 0U; i < (((payload_size - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)payload + i * SEP_BUF_ENTRY_SIZE);
-			}
+			(void)sbuf_put_many(sbuf, (uint8_t *)&pkt_header,
+					((DATA_HEADER_SIZE - 1U) / SEP_BUF_ENTRY_SIZE) + 1U);
+			(void)sbuf_put_many(sbuf, (uint8_t *)payload,
+					(uint32_t)(((payload_size - 1U) / SEP_BUF_ENTRY_SIZE) + 1U));
 
 			ss->samples_logged++;
 		}
@@ -805,6 +805,58 @@ static void profiling_stop_pmu(void)
 
 }
 
+/*
+ * Record the guest RIP and CR3 of the vCPU running on this CPU
+ */
+static void profiling_guest_sample(__unused void *data)
+{
+	struct acrn_vcpu *vcpu = get_running_vcpu(get_pcpu_id());
+
+	/* the VMCS of the running vCPU is the current one */
+	if ((vcpu != NULL) && vcpu->launched) {
+		TRACE_2L(TRACE_GUEST_SAMPLE | ((uint32_t)vcpu->vm->vm_id << 8U) | (uint32_t)vcpu->vcpu_id,
+			exec_vmread(VMX_GUEST_RIP), exec_vmread(VMX_GUEST_CR3));
+	}
+}
+
+/*
+ * Start or stop the guest RIP sampling timer of this CPU
+ */
+static void profiling_config_guest_sample(void)
+{
+	struct hv_timer *timer = &get_cpu_var(profiling_info.sample_timer);
+
+	del_timer(timer);
+	if (guest_sample_period != 0UL) {
+		initialize_timer(timer, profiling_guest_sample, NULL,
+			cpu_ticks() + guest_sample_period, guest_sample_period);
+		if (add_timer(timer) != 0) {
+			pr_err("%s: no room for the timer", __func__);
+		}
+	}
+}
+
+/*
+ * Sample the guest RIP of all the CPUs every period_us, into their trace
+ * buffers; 0 stops the sampling.
+ */
+int32_t profiling_set_guest_sampling(uint32_t period_us)
+{
+	uint16_t i;
+	uint16_t pcpu_nums = get_pcpu_nums();
+
+	guest_sample_period = (period_us != 0U) ? us_to_ticks(period_us) : 0UL;
+
+	for (i = 0U; i < pcpu_nums; i++) {
+		per_cpu(profiling_info.ipi_cmd, i) = IPI_GUEST_SAMPLE;
+	}
+
+	smp_call_function(get_active_pcpu_bitmap(), profiling_ipi_handler, NULL);
+
+	dev_dbg(DBG_LEVEL_PROFILING, "%s: period %u us", __func__, period_us);
+
+	return 0;
+}
 
 /*
  * Performs MSR operations on all the CPU's
@@ -1288,6 +1340,9 @@ void profiling_ipi_handler(__unused void *data)
 	case IPI_VMSW_CONFIG:
 		profiling_initialize_vmsw();
 		break;
+	case IPI_GUEST_SAMPLE:
+		profiling_config_guest_sample();
+		break;
 	default:
 		pr_err("%s: unknown IPI command %d on cpu %d",
 		__func__, get_cpu_var(profiling_info.ipi_cmd), get_pcpu_id());
@@ -1329,7 +1384,7 @@ void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu)
 			= exit_reason;
 		if (exit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) {
 			get_cpu_var(profiling_info.vm_info).external_vector
-				= (int32_t)(exec_vmread(VMX_EXIT_INT_INFO) & 0xFFUL);
+				= (int32_t)(vcpu_get_exit_info(vcpu, EXIT_INFO_INT_INFO) & 0xFFUL);
 		} else {
 			get_cpu_var(profiling_info.vm_info).external_vector = -1;
 		}
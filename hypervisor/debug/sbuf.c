@@ -14,6 +14,8 @@
 #include <errno.h>
 #include <asm/cpu.h>
 #include <asm/per_cpu.h>
+#include <asm/guest/vmx_io.h>
+#include <util.h>
 
 uint32_t sbuf_next_ptr(uint32_t pos_arg,
 		uint32_t span, uint32_t scope)
@@ -24,59 +26,112 @@ uint32_t sbuf_next_ptr(uint32_t pos_arg,
 	return pos;
 }
 
+static inline uint32_t sbuf_used(const struct shared_buf *sbuf)
+{
+	return (sbuf->tail >= sbuf->head) ? (sbuf->tail - sbuf->head) : (sbuf->size - sbuf->head + sbuf->tail);
+}
+
+/* copy len bytes from data to the ring at offset pos, wrapping at sbuf->size */
+static void sbuf_copy_in(struct shared_buf *sbuf, uint32_t pos, const uint8_t *data, uint32_t len)
+{
+	void *base = (void *)sbuf + SBUF_HEAD_SIZE;
+	uint32_t first = min(len, sbuf->size - pos);
+
+	(void)memcpy_s(base + pos, first, data, first);
+	if (first < len) {
+		(void)memcpy_s(base, len - first, data + first, len - first);
+	}
+}
+
 /**
- * The high caller should guarantee each time there must have
- * sbuf->ele_size data can be write form data and this function
- * should guarantee execution atomically.
+ * Write ele_cnt elements of sbuf->ele_size bytes from data with at most two
+ * copies and a single update of sbuf->tail, the reader never sees a
+ * partially written batch.
+ *
+ * Interrupts are disabled while the buffer is updated, so that an interrupt
+ * handler logging or tracing on the same pCPU can not interleave with the
+ * interrupted producer. That makes the per pCPU buffer safe for all the
+ * producers of a pCPU without a lock.
  *
  * flag:
- * If OVERWRITE_EN set, buf can store (ele_num - 1) elements at most.
- * Should use lock to guarantee that only one read or write at
- * the same time.
- * if OVERWRITE_EN not set, buf can store (ele_num - 1) elements
- * at most. Shouldn't modify the sbuf->head.
+ * If OVERWRITE_EN set, the oldest elements are dropped to make room, the
+ * buffer behaves as a flight recorder holding the latest (ele_num - 1)
+ * elements. The reader shall not consume the buffer while it is written.
+ * if OVERWRITE_EN not set, only the elements which fit are written and the
+ * rest of the batch is dropped. Shouldn't modify the sbuf->head.
+ * In both cases the dropped elements are counted if OVERRUN_CNT_EN set.
+ *
+ * If sbuf->wakeup_thres is not 0, the SOS is notified once the number of
+ * buffered elements reaches it, so that the reader could sleep until then
+ * instead of polling.
  *
  * return:
- * ele_size:	write succeeded.
- * 0:		no write, buf is full
- * negative:	failed.
+ * number of bytes written, 0 if the buffer is full.
  */
-
-uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
+uint32_t sbuf_put_many(struct shared_buf *sbuf, uint8_t *data, uint32_t ele_cnt)
 {
-	void *to;
-	uint32_t next_tail;
-	uint32_t ele_size;
-	bool trigger_overwrite = false;
+	const uint8_t *from = data;
+	uint32_t ele_size, free, len, used, drop_cnt;
+	uint64_t rflags;
+	bool notify = false;
 
+	CPU_INT_ALL_DISABLE(&rflags);
 	stac();
-	next_tail = sbuf_next_ptr(sbuf->tail, sbuf->ele_size, sbuf->size);
-	/* if this write would trigger overrun */
-	if (next_tail == sbuf->head) {
-		/* accumulate overrun count if necessary */
-		sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
+	ele_size = sbuf->ele_size;
+	used = sbuf_used(sbuf);
+	free = (sbuf->size - ele_size - used) / ele_size;
+	len = ele_cnt * ele_size;
+
+	if (ele_cnt > free) {
+		drop_cnt = ele_cnt - free;
 		if ((sbuf->flags & OVERWRITE_EN) == 0U) {
-			/* if not enable over write, return here. */
-			clac();
-			return 0;
+			len = free * ele_size;
+		} else if (ele_cnt >= sbuf->ele_num) {
+			/* only the latest (ele_num - 1) elements of the batch survive */
+			from += (ele_cnt - (sbuf->ele_num - 1U)) * ele_size;
+			len = sbuf->size - ele_size;
+			sbuf->head = sbuf->tail;
+			used = 0U;
+		} else {
+			sbuf->head = sbuf_next_ptr(sbuf->head, drop_cnt * ele_size, sbuf->size);
+			used -= drop_cnt * ele_size;
 		}
-		trigger_overwrite = true;
+		/* accumulate overrun count if necessary */
+		sbuf->overrun_cnt += drop_cnt * (sbuf->flags & OVERRUN_CNT_EN);
 	}
 
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
+	if (len != 0U) {
+		sbuf_copy_in(sbuf, sbuf->tail, from, len);
+		/* make the data visible before the reader sees the new tail */
+		cpu_write_memory_barrier();
+		sbuf->tail = sbuf_next_ptr(sbuf->tail, len, sbuf->size);
 
-	(void)memcpy_s(to, sbuf->ele_size, data, sbuf->ele_size);
+		if ((sbuf->wakeup_thres != 0U) && (used < (sbuf->wakeup_thres * ele_size)) &&
+				((used + len) >= (sbuf->wakeup_thres * ele_size))) {
+			notify = true;
+		}
+	}
+	clac();
+	CPU_INT_ALL_RESTORE(rflags);
 
-	if (trigger_overwrite) {
-		sbuf->head = sbuf_next_ptr(sbuf->head,
-				sbuf->ele_size, sbuf->size);
+	if (notify) {
+		arch_fire_vhm_interrupt();
 	}
-	sbuf->tail = next_tail;
 
-	ele_size = sbuf->ele_size;
-	clac();
+	return len;
+}
 
-	return ele_size;
+/**
+ * The high caller should guarantee each time there must have
+ * sbuf->ele_size data can be write form data.
+ *
+ * return:
+ * ele_size:	write succeeded.
+ * 0:		no write, buf is full
+ */
+uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
+{
+	return sbuf_put_many(sbuf, data, 1U);
 }
 
 int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva)
@@ -39,6 +39,19 @@ static int32_t shell_cmd_help(__unused int32_t argc, __unused char **argv);
 static int32_t shell_version(__unused int32_t argc, __unused char **argv);
 static int32_t shell_list_vm(__unused int32_t argc, __unused char **argv);
 static int32_t shell_list_vcpu(__unused int32_t argc, __unused char **argv);
+static int32_t shell_sched_stat(__unused int32_t argc, __unused char **argv);
+static int32_t shell_vmexit_stat(int32_t argc, char **argv);
+static int32_t shell_msr_stat(int32_t argc, char **argv);
+static int32_t shell_cr_stat(int32_t argc, char **argv);
+static int32_t shell_eoi_stat(int32_t argc, char **argv);
+static int32_t shell_wp_stat(int32_t argc, char **argv);
+static int32_t shell_halt_stat(int32_t argc, char **argv);
+static int32_t shell_world_stat(int32_t argc, char **argv);
+static int32_t shell_hv_stat(__unused int32_t argc, __unused char **argv);
+static int32_t shell_idle_stat(__unused int32_t argc, __unused char **argv);
+#ifdef CONFIG_LOCK_STATS
+static int32_t shell_lock_stat(__unused int32_t argc, __unused char **argv);
+#endif
 static int32_t shell_vcpu_dumpreg(int32_t argc, char **argv);
 static int32_t shell_dump_host_mem(int32_t argc, char **argv);
 static int32_t shell_dump_guest_mem(int32_t argc, char **argv);
@@ -52,6 +65,9 @@ static int32_t shell_cpuid(int32_t argc, char **argv);
 static int32_t shell_reboot(int32_t argc, char **argv);
 static int32_t shell_rdmsr(int32_t argc, char **argv);
 static int32_t shell_wrmsr(int32_t argc, char **argv);
+#ifdef PROFILING_ON
+static int32_t shell_guest_sample(int32_t argc, char **argv);
+#endif
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -78,6 +94,74 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_VCPU_LIST_HELP,
 		.fcn		= shell_list_vcpu,
 	},
+	{
+		.str		= SHELL_CMD_SCHED_STAT,
+		.cmd_param	= SHELL_CMD_SCHED_STAT_PARAM,
+		.help_str	= SHELL_CMD_SCHED_STAT_HELP,
+		.fcn		= shell_sched_stat,
+	},
+	{
+		.str		= SHELL_CMD_VMEXIT_STAT,
+		.cmd_param	= SHELL_CMD_VMEXIT_STAT_PARAM,
+		.help_str	= SHELL_CMD_VMEXIT_STAT_HELP,
+		.fcn		= shell_vmexit_stat,
+	},
+	{
+		.str		= SHELL_CMD_MSR_STAT,
+		.cmd_param	= SHELL_CMD_MSR_STAT_PARAM,
+		.help_str	= SHELL_CMD_MSR_STAT_HELP,
+		.fcn		= shell_msr_stat,
+	},
+	{
+		.str		= SHELL_CMD_CR_STAT,
+		.cmd_param	= SHELL_CMD_CR_STAT_PARAM,
+		.help_str	= SHELL_CMD_CR_STAT_HELP,
+		.fcn		= shell_cr_stat,
+	},
+	{
+		.str		= SHELL_CMD_EOI_STAT,
+		.cmd_param	= SHELL_CMD_EOI_STAT_PARAM,
+		.help_str	= SHELL_CMD_EOI_STAT_HELP,
+		.fcn		= shell_eoi_stat,
+	},
+	{
+		.str		= SHELL_CMD_WP_STAT,
+		.cmd_param	= SHELL_CMD_WP_STAT_PARAM,
+		.help_str	= SHELL_CMD_WP_STAT_HELP,
+		.fcn		= shell_wp_stat,
+	},
+	{
+		.str		= SHELL_CMD_HALT_STAT,
+		.cmd_param	= SHELL_CMD_HALT_STAT_PARAM,
+		.help_str	= SHELL_CMD_HALT_STAT_HELP,
+		.fcn		= shell_halt_stat,
+	},
+	{
+		.str		= SHELL_CMD_WORLD_STAT,
+		.cmd_param	= SHELL_CMD_WORLD_STAT_PARAM,
+		.help_str	= SHELL_CMD_WORLD_STAT_HELP,
+		.fcn		= shell_world_stat,
+	},
+	{
+		.str		= SHELL_CMD_HV_STAT,
+		.cmd_param	= SHELL_CMD_HV_STAT_PARAM,
+		.help_str	= SHELL_CMD_HV_STAT_HELP,
+		.fcn		= shell_hv_stat,
+	},
+	{
+		.str		= SHELL_CMD_IDLE_STAT,
+		.cmd_param	= SHELL_CMD_IDLE_STAT_PARAM,
+		.help_str	= SHELL_CMD_IDLE_STAT_HELP,
+		.fcn		= shell_idle_stat,
+	},
+#ifdef CONFIG_LOCK_STATS
+	{
+		.str		= SHELL_CMD_LOCK_STAT,
+		.cmd_param	= SHELL_CMD_LOCK_STAT_PARAM,
+		.help_str	= SHELL_CMD_LOCK_STAT_HELP,
+		.fcn		= shell_lock_stat,
+	},
+#endif
 	{
 		.str		= SHELL_CMD_VCPU_DUMPREG,
 		.cmd_param	= SHELL_CMD_VCPU_DUMPREG_PARAM,
@@ -156,6 +240,14 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_WRMSR_HELP,
 		.fcn		= shell_wrmsr,
 	},
+#ifdef PROFILING_ON
+	{
+		.str		= SHELL_CMD_GUEST_SAMPLE,
+		.cmd_param	= SHELL_CMD_GUEST_SAMPLE_PARAM,
+		.help_str	= SHELL_CMD_GUEST_SAMPLE_HELP,
+		.fcn		= shell_guest_sample,
+	},
+#endif
 };
 
 /* The initial log level*/
@@ -696,6 +788,487 @@ static int32_t shell_list_vcpu(__unused int32_t argc, __unused char **argv)
 	return 0;
 }
 
+#ifdef CONFIG_SCHED_BVT
+static void shell_bvt_stat(char *temp_str)
+{
+	struct sched_bvt_stats stats;
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t i, idx;
+	uint32_t bucket;
+	size_t len;
+
+	shell_puts("\r\nTHREAD           AVT          EVT          RUNS BY VT ADVANCE (0, 1, 2-3 ... >=64 MCU)"
+		"\r\n======           ===          ===          ===========================================\r\n");
+
+	for (idx = 0U; idx < CONFIG_MAX_VM_NUM; idx++) {
+		vm = get_vm_from_vmid(idx);
+		if (is_poweroff_vm(vm)) {
+			continue;
+		}
+		foreach_vcpu(i, vm, vcpu) {
+			sched_bvt_get_stats(&vcpu->thread_obj, &stats);
+			len = snprintf(temp_str, MAX_STR_SIZE, "  %-14s %-12ld %-12ld",
+					vcpu->thread_obj.name, stats.avt, stats.evt);
+			for (bucket = 0U; (bucket < BVT_VT_HIST_BUCKETS) && (len < MAX_STR_SIZE); bucket++) {
+				len += snprintf(temp_str + len, MAX_STR_SIZE - len, " %u", stats.vt_hist[bucket]);
+			}
+			shell_puts(temp_str);
+			shell_puts("\r\n");
+		}
+	}
+}
+#endif
+
+static int32_t shell_sched_stat(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct sched_control *ctl;
+	struct thread_object *curr;
+	uint16_t pcpu_id;
+
+	shell_puts("\r\nPCPU ID    RUNQUEUE    MIGRATIONS    CURRENT"
+		"\r\n=======    ========    ==========    =======\r\n");
+
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		if (!is_pcpu_active(pcpu_id)) {
+			continue;
+		}
+		ctl = &per_cpu(sched_ctl, pcpu_id);
+		curr = ctl->curr_obj;
+		snprintf(temp_str, MAX_STR_SIZE, "  %-9hu %-11u %-13lu %-16s\r\n",
+				pcpu_id, ctl->nr_runnable, ctl->nr_migrations,
+				(curr != NULL) ? curr->name : "-");
+		shell_puts(temp_str);
+	}
+
+#ifdef CONFIG_SCHED_BVT
+	shell_bvt_stat(temp_str);
+#endif
+
+	return 0;
+}
+
+static int32_t shell_vmexit_stat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	const struct acrn_vmexit_stats *stats;
+	uint16_t i, vm_id;
+	uint32_t reason, bucket, entry;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	vm_id = sanitize_vmid((uint16_t)strtol_deci(argv[1]));
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("VM is not valid\r\n");
+		return -EINVAL;
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\nVM %hu split locks: %lu, throttled: %lu\r\n",
+			vm_id, vm->splitlock_count, vm->splitlock_throttled);
+	shell_puts(temp_str);
+
+	foreach_vcpu(i, vm, vcpu) {
+		stats = &vcpu->exit_stats;
+		snprintf(temp_str, MAX_STR_SIZE, "\r\nVM %hu VCPU %hu, bucket n counts exits of [2^%u, 2^%u) cycles"
+				"\r\nREASON    COUNT           AVG CYCLES    BUCKET:COUNT"
+				"\r\n======    =====           ==========    ============\r\n",
+				vm_id, i, VMEXIT_STATS_BUCKET_SHIFT - 1U, VMEXIT_STATS_BUCKET_SHIFT);
+		shell_puts(temp_str);
+
+		for (reason = 0U; reason < VMEXIT_STATS_NR_REASONS; reason++) {
+			if (stats->count[reason] == 0UL) {
+				continue;
+			}
+			snprintf(temp_str, MAX_STR_SIZE, "  %-7u %-15lu %-13lu", reason, stats->count[reason],
+					stats->cycles[reason] / stats->count[reason]);
+			shell_puts(temp_str);
+
+			for (bucket = 0U; bucket < VMEXIT_STATS_NR_BUCKETS; bucket++) {
+				if (stats->hist[reason][bucket] != 0U) {
+					snprintf(temp_str, MAX_STR_SIZE, " %u:%u", bucket, stats->hist[reason][bucket]);
+					shell_puts(temp_str);
+				}
+			}
+			shell_puts("\r\n");
+		}
+
+		shell_puts("  PORT:IO EXITS");
+		for (entry = 0U; entry < VMEXIT_STATS_NR_PORTS; entry++) {
+			if (stats->pio[entry].count != 0U) {
+				snprintf(temp_str, MAX_STR_SIZE, " 0x%x:%u", stats->pio[entry].port,
+						stats->pio[entry].count);
+				shell_puts(temp_str);
+			}
+		}
+		shell_puts("\r\n");
+	}
+
+	return 0;
+}
+
+static int32_t shell_hv_stat(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	const struct acrn_pcpu_stats *stats;
+	uint64_t exits, sum;
+	uint16_t pcpu_id, pcpu_nums = get_pcpu_nums();
+	uint32_t i;
+
+	shell_puts("\r\nCPU    VMEXITS         EPT_VIOL        IOREQS          IPIS            "
+			"PI_NOTIFY       TIMER_FIRES     SCHED_SWITCHES"
+			"\r\n===    =======         ========        ======          ====            "
+			"=========       ===========     ==============\r\n");
+	for (pcpu_id = 0U; pcpu_id < pcpu_nums; pcpu_id++) {
+		stats = &per_cpu(stats, pcpu_id);
+		exits = 0UL;
+		for (i = 0U; i < PCPU_STATS_NR_EXIT_REASONS; i++) {
+			exits += stats->vmexits[i];
+		}
+		sum = 0UL;
+		for (i = 0U; i < PCPU_STATS_NR_VMS; i++) {
+			sum += stats->ioreqs[i];
+		}
+		snprintf(temp_str, MAX_STR_SIZE, "%-6hu %-15lu %-15lu %-15lu %-15lu %-15lu %-15lu %lu\r\n",
+				pcpu_id, exits, stats->vmexits[VMX_EXIT_REASON_EPT_VIOLATION], sum, stats->ipis,
+				stats->pi_notifications, stats->timer_fires, stats->sched_switches);
+		shell_puts(temp_str);
+	}
+
+	shell_puts("\r\nREASON    VMEXITS\r\n======    =======\r\n");
+	for (i = 0U; i < PCPU_STATS_NR_EXIT_REASONS; i++) {
+		sum = 0UL;
+		for (pcpu_id = 0U; pcpu_id < pcpu_nums; pcpu_id++) {
+			sum += per_cpu(stats, pcpu_id).vmexits[i];
+		}
+		if (sum != 0UL) {
+			snprintf(temp_str, MAX_STR_SIZE, "  %-7u %lu\r\n", i, sum);
+			shell_puts(temp_str);
+		}
+	}
+
+	shell_puts("\r\nVM ID    IOREQS\r\n=====    ======\r\n");
+	for (i = 0U; i < PCPU_STATS_NR_VMS; i++) {
+		sum = 0UL;
+		for (pcpu_id = 0U; pcpu_id < pcpu_nums; pcpu_id++) {
+			sum += per_cpu(stats, pcpu_id).ioreqs[i];
+		}
+		if (sum != 0UL) {
+			snprintf(temp_str, MAX_STR_SIZE, "  %-6u %lu\r\n", i, sum);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_idle_stat(__unused int32_t argc, __unused char **argv)
+{
+	static const char *const policy_str[] = {
+		[IDLE_POLICY_POLL] = "poll",
+		[IDLE_POLICY_HALT] = "halt",
+		[IDLE_POLICY_CSTATE] = "cstate",
+	};
+	char temp_str[MAX_STR_SIZE];
+	const struct cpu_state_info *info = get_cpu_pm_state_info();
+	const struct pcpu_idle *ctl;
+	uint16_t pcpu_id, pcpu_nums = get_pcpu_nums();
+	uint32_t i;
+
+	shell_puts("\r\nCPU    POLICY  AVG_IDLE_US  Cx:ENTRIES:US\r\n"
+			"===    ======  ===========  =============\r\n");
+	for (pcpu_id = 0U; pcpu_id < pcpu_nums; pcpu_id++) {
+		ctl = &per_cpu(idle_ctl, pcpu_id);
+		snprintf(temp_str, MAX_STR_SIZE, "%-6hu %-7s %-12lu", pcpu_id, policy_str[ctl->policy],
+				ticks_to_us(ctl->avg_ticks));
+		shell_puts(temp_str);
+		for (i = 0U; i < MAX_CX_ENTRY; i++) {
+			if (ctl->entries[i] != 0UL) {
+				snprintf(temp_str, MAX_STR_SIZE, " C%u:%lu:%lu",
+						(info->cx_cnt != 0U) ? info->cx_data[i].type : 1U,
+						ctl->entries[i], ticks_to_us(ctl->ticks[i]));
+				shell_puts(temp_str);
+			}
+		}
+		shell_puts("\r\n");
+	}
+
+	return 0;
+}
+
+static int32_t shell_msr_stat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	const struct vmsr_stats_entry *entry;
+	uint16_t i, vm_id;
+	uint32_t j;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	vm_id = sanitize_vmid((uint16_t)strtol_deci(argv[1]));
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("VM is not valid\r\n");
+		return -EINVAL;
+	}
+
+	foreach_vcpu(i, vm, vcpu) {
+		snprintf(temp_str, MAX_STR_SIZE, "\r\nVM %hu VCPU %hu"
+				"\r\nMSR           RDMSR         WRMSR"
+				"\r\n===           =====         =====\r\n", vm_id, i);
+		shell_puts(temp_str);
+
+		for (j = 0U; j < VMSR_STATS_NR; j++) {
+			entry = &vcpu->msr_stats[j];
+			if ((entry->rdmsr != 0U) || (entry->wrmsr != 0U)) {
+				snprintf(temp_str, MAX_STR_SIZE, "  0x%-10x %-13u %-13u\r\n",
+						entry->msr, entry->rdmsr, entry->wrmsr);
+				shell_puts(temp_str);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_cr_stat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t i, vm_id;
+	uint32_t j;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	vm_id = sanitize_vmid((uint16_t)strtol_deci(argv[1]));
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("VM is not valid\r\n");
+		return -EINVAL;
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "VM %hu profile %u, guest owned CR0 bits 0x%lx, CR4 bits 0x%lx\r\n",
+			vm_id, get_vm_config(vm_id)->vcr_profile,
+			vm->arch_vm.cr0_passthru_mask, vm->arch_vm.cr4_passthru_mask);
+	shell_puts(temp_str);
+
+	foreach_vcpu(i, vm, vcpu) {
+		snprintf(temp_str, MAX_STR_SIZE, "\r\nVM %hu VCPU %hu"
+				"\r\nBIT           CR0 EXITS     CR4 EXITS"
+				"\r\n===           =========     =========\r\n", vm_id, i);
+		shell_puts(temp_str);
+
+		for (j = 0U; j < 32U; j++) {
+			if ((vcpu->cr_stats.cr0_bits[j] != 0U) || (vcpu->cr_stats.cr4_bits[j] != 0U)) {
+				snprintf(temp_str, MAX_STR_SIZE, "  %-11u %-13u %-13u\r\n",
+						j, vcpu->cr_stats.cr0_bits[j], vcpu->cr_stats.cr4_bits[j]);
+				shell_puts(temp_str);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_wp_stat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	uint16_t vm_id;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	vm_id = sanitize_vmid((uint16_t)strtol_deci(argv[1]));
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("VM is not valid\r\n");
+		return -EINVAL;
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "VM %hu: %lu write-protected pages, %lu write-protect exits\r\n",
+			vm_id, vm->wp_pages, vm->wp_exits);
+	shell_puts(temp_str);
+
+	return 0;
+}
+
+static int32_t shell_halt_stat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t vm_id, i;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	vm_id = sanitize_vmid((uint16_t)strtol_deci(argv[1]));
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("VM is not valid\r\n");
+		return -EINVAL;
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "VM %hu: halt_poll_us %u\r\n", vm_id, get_vm_config(vm_id)->halt_poll_us);
+	shell_puts(temp_str);
+	shell_puts("VCPU ID    POLL WINDOW (US)    POLL SUCCESS        POLL FAIL\r\n"
+		"=======    ================    ============        =========\r\n");
+	foreach_vcpu(i, vm, vcpu) {
+		snprintf(temp_str, MAX_STR_SIZE, "  %-8hu %-19lu %-19lu %lu\r\n", vcpu->vcpu_id,
+				ticks_to_us(vcpu->halt_poll_window), vcpu->halt_poll_success, vcpu->halt_poll_fail);
+		shell_puts(temp_str);
+	}
+
+	return 0;
+}
+
+static int32_t shell_eoi_stat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	struct acrn_vlapic *vlapic;
+	uint16_t i, vm_id;
+	uint32_t j;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	vm_id = sanitize_vmid((uint16_t)strtol_deci(argv[1]));
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("VM is not valid\r\n");
+		return -EINVAL;
+	}
+
+	foreach_vcpu(i, vm, vcpu) {
+		vlapic = vcpu_vlapic(vcpu);
+		snprintf(temp_str, MAX_STR_SIZE, "\r\nVM %hu VCPU %hu"
+				"\r\nEOI-exit bitmap: 0x%016lx%016lx%016lx%016lx"
+				"\r\nlevel vectors:   0x%016lx%016lx%016lx%016lx", vm_id, i,
+				vcpu->arch.eoi_exit_bitmap[3], vcpu->arch.eoi_exit_bitmap[2],
+				vcpu->arch.eoi_exit_bitmap[1], vcpu->arch.eoi_exit_bitmap[0],
+				vlapic->level_vectors[3], vlapic->level_vectors[2],
+				vlapic->level_vectors[1], vlapic->level_vectors[0]);
+		shell_puts(temp_str);
+		shell_puts("\r\nVECTOR        LEVEL  EOI EXITS"
+				"\r\n======        =====  =========\r\n");
+
+		for (j = 0U; j < EOI_EXIT_BITMAP_SIZE; j++) {
+			if (vcpu->eoi_exit_stats[j] != 0U) {
+				snprintf(temp_str, MAX_STR_SIZE, "  0x%-10x %-6s %-13u\r\n", j,
+						bitmap_test((uint16_t)(j & 0x3fU), &vlapic->level_vectors[j >> 6U]) ?
+						"yes" : "no", vcpu->eoi_exit_stats[j]);
+				shell_puts(temp_str);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_world_stat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t i, vm_id;
+	uint64_t nr_switches;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+
+	vm_id = sanitize_vmid((uint16_t)strtol_deci(argv[1]));
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("VM is not valid\r\n");
+		return -EINVAL;
+	}
+
+	shell_puts("\r\nVCPU    TO SECURE     TO NORMAL     AVG SWITCH(ns)"
+		"\r\n====    =========     =========     ==============\r\n");
+	foreach_vcpu(i, vm, vcpu) {
+		nr_switches = vcpu->arch.world_switches[SECURE_WORLD] + vcpu->arch.world_switches[NORMAL_WORLD];
+		snprintf(temp_str, MAX_STR_SIZE, "  %-5hu %-13lu %-13lu %-13lu\r\n", i,
+				vcpu->arch.world_switches[SECURE_WORLD], vcpu->arch.world_switches[NORMAL_WORLD],
+				(nr_switches == 0UL) ? 0UL :
+				((ticks_to_us(vcpu->arch.world_switch_ticks * 1000UL)) / nr_switches));
+		shell_puts(temp_str);
+	}
+
+	return 0;
+}
+
+#ifdef CONFIG_LOCK_STATS
+static void shell_print_lock_stat(char *temp_str, const char *name, const qspinlock_t *lock)
+{
+	const struct qspinlock_stats *stats = &lock->stats;
+
+	if (stats->nr_obtain != 0UL) {
+		snprintf(temp_str, MAX_STR_SIZE, "%-20s %-12lu %-12lu %-10lu %-10lu %-10lu %lu\r\n", name,
+				stats->nr_obtain, stats->nr_contended,
+				ticks_to_us(stats->wait_ticks / max(stats->nr_contended, 1UL)),
+				ticks_to_us(stats->max_wait_ticks),
+				ticks_to_us(stats->hold_ticks / stats->nr_obtain),
+				ticks_to_us(stats->max_hold_ticks));
+		shell_puts(temp_str);
+	}
+}
+
+static int32_t shell_lock_stat(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	char name[32];
+	struct acrn_vm *vm;
+	uint16_t vm_id;
+	uint8_t i;
+
+	shell_puts("\r\nLOCK                 OBTAINED     CONTENDED    WAIT(us)   MAX_WAIT   HOLD(us)   MAX_HOLD"
+			"\r\n====                 ========     =========    ========   ========   ========   ========\r\n");
+	shell_print_lock_stat(temp_str, "ptdev", &ptdev_lock);
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			snprintf(name, 32U, "vm%hu emul_mmio", vm_id);
+			shell_print_lock_stat(temp_str, name, &vm->emul_mmio_lock);
+			snprintf(name, 32U, "vm%hu vlapic_mode", vm_id);
+			shell_print_lock_stat(temp_str, name, &vm->vlapic_mode_lock);
+			for (i = 0U; i < vm->arch_vm.vioapics.ioapic_num; i++) {
+				snprintf(name, 32U, "vm%hu vioapic%hhu", vm_id, i);
+				shell_print_lock_stat(temp_str, name, &vm->arch_vm.vioapics.vioapic_array[i].lock);
+			}
+		}
+	}
+
+	return 0;
+}
+#endif
+
 #define DUMPREG_SP_SIZE	32
 /* the input 'data' must != NULL and indicate a vcpu structure pointer */
 static void dump_vcpu_reg(void *data)
@@ -1446,3 +2019,20 @@ static int32_t shell_wrmsr(int32_t argc, char **argv)
 
 	return ret;
 }
+
+#ifdef PROFILING_ON
+static int32_t shell_guest_sample(int32_t argc, char **argv)
+{
+	int32_t period_us;
+	int32_t ret = -EINVAL;
+
+	if (argc == 2) {
+		period_us = strtol_deci(argv[1]);
+		if (period_us >= 0) {
+			ret = profiling_set_guest_sampling((uint32_t)period_us);
+		}
+	}
+
+	return ret;
+}
+#endif
@@ -52,6 +52,50 @@ struct shell {
 #define SHELL_CMD_VCPU_LIST_PARAM	NULL
 #define SHELL_CMD_VCPU_LIST_HELP	"List all vCPUs in all VMs"
 
+#define SHELL_CMD_SCHED_STAT		"sched_stat"
+#define SHELL_CMD_SCHED_STAT_PARAM	NULL
+#define SHELL_CMD_SCHED_STAT_HELP	"Show the runqueue length and migrations of each pCPU, and BVT virtual time stats of each vCPU"
+
+#define SHELL_CMD_VMEXIT_STAT		"vmexit_stat"
+#define SHELL_CMD_VMEXIT_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_VMEXIT_STAT_HELP	"Show the VM exit count and log2 handling latency histogram per exit reason of each vCPU"
+
+#define SHELL_CMD_MSR_STAT		"msr_stat"
+#define SHELL_CMD_MSR_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_MSR_STAT_HELP		"Show the RDMSR/WRMSR exit count per intercepted MSR of each vCPU"
+
+#define SHELL_CMD_CR_STAT		"cr_stat"
+#define SHELL_CMD_CR_STAT_PARAM		"<vm id>"
+#define SHELL_CMD_CR_STAT_HELP		"Show the CR0/CR4 guest-host masks and the MOV to CR exit count per changed bit of each vCPU"
+
+#define SHELL_CMD_EOI_STAT		"eoi_stat"
+#define SHELL_CMD_EOI_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_EOI_STAT_HELP		"Show the EOI-exit bitmap, the level-triggered vIOAPIC vectors and the EOI exit count per vector of each vCPU"
+
+#define SHELL_CMD_WP_STAT		"wp_stat"
+#define SHELL_CMD_WP_STAT_PARAM		"<vm id>"
+#define SHELL_CMD_WP_STAT_HELP		"Show the pages write-protected by the SOS and the writes to them forwarded to the SOS"
+
+#define SHELL_CMD_HALT_STAT		"halt_stat"
+#define SHELL_CMD_HALT_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_HALT_STAT_HELP	"Show the HLT polling window of each vCPU and the HLT exits resumed or blocked after polling"
+
+#define SHELL_CMD_WORLD_STAT		"world_stat"
+#define SHELL_CMD_WORLD_STAT_PARAM	"<vm id>"
+#define SHELL_CMD_WORLD_STAT_HELP	"Show the secure/normal world switch count and average switch time of each vCPU"
+
+#define SHELL_CMD_HV_STAT		"hv_stat"
+#define SHELL_CMD_HV_STAT_PARAM		NULL
+#define SHELL_CMD_HV_STAT_HELP		"Show the event counters of each pCPU, the exits per reason and the I/O requests per VM"
+
+#define SHELL_CMD_IDLE_STAT		"idle_stat"
+#define SHELL_CMD_IDLE_STAT_PARAM	NULL
+#define SHELL_CMD_IDLE_STAT_HELP	"Show the idle policy of each pCPU and the time it spent in each C-state"
+
+#define SHELL_CMD_LOCK_STAT		"lock_stat"
+#define SHELL_CMD_LOCK_STAT_PARAM	NULL
+#define SHELL_CMD_LOCK_STAT_HELP	"Show how often the queued spinlocks were contended, and their wait and hold times"
+
 #define SHELL_CMD_VCPU_DUMPREG		"vcpu_dumpreg"
 #define SHELL_CMD_VCPU_DUMPREG_PARAM	"<vm id, vcpu id>"
 #define SHELL_CMD_VCPU_DUMPREG_HELP	"Dump registers for a specific vCPU"
@@ -106,4 +150,9 @@ struct shell {
 #define SHELL_CMD_WRMSR_PARAM		"[-p<pcpu_id>]	<msr_index> <value>"
 #define SHELL_CMD_WRMSR_HELP		"Write value (in hexadecimal) to the MSR at msr_index (in hexadecimal) for CPU"\
 					" ID pcpu_id"
+
+#define SHELL_CMD_GUEST_SAMPLE		"guest_sample"
+#define SHELL_CMD_GUEST_SAMPLE_PARAM	"<period_us>"
+#define SHELL_CMD_GUEST_SAMPLE_HELP	"Sample the guest RIP and CR3 of each pCPU every period_us into the acrntrace"\
+					" buffers, 0 to stop"
 #endif /* SHELL_PRIV_H */
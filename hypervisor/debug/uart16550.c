@@ -14,6 +14,16 @@
 
 #define MAX_BDF_LEN 8
 
+/*
+ * Once the timers run, the output is queued in a ring and moved to the UART a
+ * TX FIFO at a time, the FIFO being empty whenever THRE is set. The writers
+ * only poll the UART when the ring is full.
+ */
+#define UART_TX_FIFO_SIZE	16U
+#define UART_TX_RING_SIZE	0x4000U
+
+static char tx_ring[UART_TX_RING_SIZE];
+
 struct console_uart {
 	bool enabled;
 
@@ -26,6 +36,10 @@ struct console_uart {
 	spinlock_t tx_lock;
 
 	uint32_t reg_width;
+
+	bool tx_buffered;
+	uint32_t tx_head;	/* free running index in tx_ring */
+	uint32_t tx_tail;
 };
 
 #if defined(CONFIG_SERIAL_PIO_BASE)
@@ -224,6 +238,61 @@ static void uart16550_putc(char c)
 	uart16550_write_reg(uart, (uint32_t)temp, UART16550_THR);
 }
 
+/**
+ * @pre uart->enabled == true
+ */
+static inline bool uart16550_thr_empty(void)
+{
+	return ((uart16550_read_reg(uart, UART16550_LSR) & LSR_THRE) != 0U);
+}
+
+/**
+ * Fill the TX FIFO from the ring.
+ *
+ * @pre uart->enabled == true
+ * @pre uart16550_thr_empty() == true and uart->tx_lock is held
+ */
+static void uart16550_tx_burst(void)
+{
+	uint32_t n = 0U;
+
+	while ((uart.tx_tail != uart.tx_head) && (n < UART_TX_FIFO_SIZE)) {
+		uart16550_write_reg(uart, (uint32_t)(uint8_t)tx_ring[uart.tx_tail & (UART_TX_RING_SIZE - 1U)],
+				UART16550_THR);
+		uart.tx_tail++;
+		n++;
+	}
+}
+
+/**
+ * @pre uart->enabled == true and uart->tx_lock is held
+ */
+static void uart16550_tx_drain(void)
+{
+	while (uart.tx_tail != uart.tx_head) {
+		while (!uart16550_thr_empty()) {
+			asm_pause();
+		}
+		uart16550_tx_burst();
+	}
+}
+
+/**
+ * @pre uart->enabled == true and uart->tx_lock is held
+ */
+static void uart16550_tx_push(char c)
+{
+	if ((uart.tx_head - uart.tx_tail) == UART_TX_RING_SIZE) {
+		/* ring full, make room the slow way */
+		while (!uart16550_thr_empty()) {
+			asm_pause();
+		}
+		uart16550_tx_burst();
+	}
+	tx_ring[uart.tx_head & (UART_TX_RING_SIZE - 1U)] = c;
+	uart.tx_head++;
+}
+
 size_t uart16550_puts(const char *buf, uint32_t len)
 {
 	uint32_t i;
@@ -235,18 +304,72 @@ size_t uart16550_puts(const char *buf, uint32_t len)
 
 	spinlock_irqsave_obtain(&uart.tx_lock, &rflags);
 	for (i = 0U; i < len; i++) {
-		/* Transmit character */
-		uart16550_putc(*buf);
-		if (*buf == '\n') {
-			/* Append '\r', no need change the len */
-			uart16550_putc('\r');
+		if (uart.tx_buffered) {
+			uart16550_tx_push(*buf);
+			if (*buf == '\n') {
+				uart16550_tx_push('\r');
+			}
+		} else {
+			/* Transmit character */
+			uart16550_putc(*buf);
+			if (*buf == '\n') {
+				/* Append '\r', no need change the len */
+				uart16550_putc('\r');
+			}
 		}
 		buf++;
 	}
+
+	/* start the transmission if the UART is idle, without waiting for it */
+	if (uart.tx_buffered && uart16550_thr_empty()) {
+		uart16550_tx_burst();
+	}
 	spinlock_irqrestore_release(&uart.tx_lock, rflags);
 	return len;
 }
 
+bool uart16550_tx_kick(void)
+{
+	bool pending = false;
+	uint64_t rflags;
+
+	if (uart.enabled) {
+		spinlock_irqsave_obtain(&uart.tx_lock, &rflags);
+		if ((uart.tx_tail != uart.tx_head) && uart16550_thr_empty()) {
+			uart16550_tx_burst();
+		}
+		pending = (uart.tx_tail != uart.tx_head);
+		spinlock_irqrestore_release(&uart.tx_lock, rflags);
+	}
+
+	return pending;
+}
+
+void uart16550_flush(void)
+{
+	uint64_t rflags;
+
+	if (uart.enabled) {
+		spinlock_irqsave_obtain(&uart.tx_lock, &rflags);
+		uart16550_tx_drain();
+		spinlock_irqrestore_release(&uart.tx_lock, rflags);
+	}
+}
+
+void uart16550_buffer_tx(bool enable)
+{
+	uint64_t rflags;
+
+	if (uart.enabled) {
+		spinlock_irqsave_obtain(&uart.tx_lock, &rflags);
+		if (!enable) {
+			uart16550_tx_drain();
+		}
+		uart.tx_buffered = enable;
+		spinlock_irqrestore_release(&uart.tx_lock, rflags);
+	}
+}
+
 void uart16550_set_property(bool enabled, enum serial_dev_type uart_type, uint64_t data)
 {
 	uart.enabled = enabled;
@@ -5,8 +5,10 @@
 
 #include <asm/guest/vm.h>
 #include <asm/irq.h>
+#include <asm/per_cpu.h>
 #include <errno.h>
 #include <logmsg.h>
+#include <ticks.h>
 
 #define DBG_LEVEL_IOREQ	6U
 
@@ -58,10 +60,15 @@ __unused static void acrn_print_request(uint16_t vcpu_id, const struct vhm_reque
 void reset_vm_ioreqs(struct acrn_vm *vm)
 {
 	uint16_t i;
+	struct acrn_vcpu *vcpu;
 
 	for (i = 0U; i < VHM_REQUEST_MAX; i++) {
 		set_vhm_req_state(vm, i, REQ_STATE_FREE);
 	}
+
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu->ioreq_posted = false;
+	}
 }
 
 static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
@@ -69,22 +76,183 @@ static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
 	return (get_vhm_req_state(vcpu->vm, vcpu->vcpu_id) == REQ_STATE_COMPLETE);
 }
 
+static void complete_ioreq(struct acrn_vcpu *vcpu, struct io_request *io_req);
+
+static inline bool is_outstanding_ioreq(const struct acrn_vcpu *vcpu)
+{
+	uint32_t state = get_vhm_req_state(vcpu->vm, vcpu->vcpu_id);
+
+	return ((state == REQ_STATE_PENDING) || (state == REQ_STATE_PROCESSING));
+}
+
 /**
- * @brief Deliver \p io_req to SOS and suspend \p vcpu till its completion
+ * @brief Poll for the completion of the VHM request of \p vcpu, then wait for the notification
  *
- * @param vcpu The virtual CPU that triggers the MMIO access
- * @param io_req The I/O request holding the details of the MMIO access
+ * The vCPU first spins for up to twice the average completion latency it saw
+ * recently. When that average exceeds the half of the max polling budget of
+ * the VM, polling would mostly be wasted and the vCPU goes to wait at once.
+ * Latencies of notified completions are accounted too, so the budget comes
+ * back when the device model becomes fast again.
+ */
+static void wait_ioreq_hybrid(struct acrn_vcpu *vcpu)
+{
+	uint64_t max = vcpu->vm->sw.ioreq_poll_max;
+	uint64_t budget, elapsed, start = cpu_ticks();
+
+	if (vcpu->ioreq_lat_avg == 0UL) {
+		budget = max;
+	} else if (vcpu->ioreq_lat_avg <= (max >> 1U)) {
+		budget = vcpu->ioreq_lat_avg << 1U;
+	} else {
+		budget = 0UL;
+	}
+
+	while (!has_complete_ioreq(vcpu) && ((cpu_ticks() - start) < budget)) {
+		if (need_reschedule(pcpuid_from_vcpu(vcpu))) {
+			break;
+		}
+		asm_pause();
+	}
+
+	/*
+	 * The notification of a completion found by polling still comes later
+	 * and may wake this wait up early, so re-check the state on wakeup.
+	 */
+	while (is_outstanding_ioreq(vcpu)) {
+		wait_event(&vcpu->events[VCPU_EVENT_IOREQ]);
+	}
+
+	/* Clamp the sample, so an idle period does not disable polling for long */
+	elapsed = min((cpu_ticks() - start), (max << 1U));
+	vcpu->ioreq_lat_avg = vcpu->ioreq_lat_avg - (vcpu->ioreq_lat_avg >> 3U) + (elapsed >> 3U);
+}
+
+/**
+ * @brief Wait for the completion of the VHM request of \p vcpu
+ *
+ * @pre The state of the VHM request of \p vcpu is not REQ_STATE_FREE
+ */
+static void wait_ioreq_completion(struct acrn_vcpu *vcpu)
+{
+	/* Polling completion of the request in polling mode */
+	if (vcpu->vm->sw.is_polling_ioreq) {
+		while (true) {
+			if (has_complete_ioreq(vcpu)) {
+				/* we have completed ioreq pending */
+				break;
+			}
+			asm_pause();
+			if (need_reschedule(pcpuid_from_vcpu(vcpu))) {
+				schedule();
+			}
+		}
+	} else if (vcpu->vm->sw.ioreq_poll_max != 0UL) {
+		wait_ioreq_hybrid(vcpu);
+	} else {
+		wait_event(&vcpu->events[VCPU_EVENT_IOREQ]);
+	}
+}
+
+/**
+ * @brief Wait for the outstanding posted write of \p vcpu, if any, and free its VHM request
+ */
+static void wait_posted_ioreq(struct acrn_vcpu *vcpu)
+{
+	if (vcpu->ioreq_posted) {
+		wait_ioreq_completion(vcpu);
+		complete_ioreq(vcpu, NULL);
+		vcpu->ioreq_posted = false;
+	}
+}
+
+/**
+ * @brief Check whether \p io_req is a guest write falling in a posted I/O range
+ *
+ * @pre io_req->io_type == REQ_PORTIO || io_req->io_type == REQ_MMIO || io_req->io_type == REQ_WP
+ *      || io_req->io_type == REQ_RECLAIMED
+ */
+static bool is_posted_ioreq(const struct acrn_vm *vm, const struct io_request *io_req)
+{
+	bool ret = false;
+	uint32_t i;
+	uint64_t start, end;
+	/* here for both IO & MMIO, the direction, address, size definition is same */
+	const struct pio_request *pio_req = &io_req->reqs.pio;
+
+	if ((pio_req->direction == REQUEST_WRITE) && (io_req->io_type != REQ_WP)) {
+		for (i = 0U; i < MAX_POSTED_IO_RANGES; i++) {
+			end = vm->posted_io[i].end;
+			start = vm->posted_io[i].start;
+			if ((end != 0UL) && (vm->posted_io[i].type == io_req->io_type) &&
+					(pio_req->address >= start) && ((pio_req->address + pio_req->size) <= end)) {
+				ret = true;
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Complete a guest write bound to a notification slot in the hypervisor
+ *
+ * The bit of the matched slot is set in the notification buffer of the VM and
+ * the upcall is injected to SOS. The vCPU resumes without an I/O request.
+ *
+ * @retval 0 \p io_req is completed.
+ * @retval -ENODEV No kick binding matches \p io_req.
+ *
+ * @pre io_req->io_type == REQ_PORTIO || io_req->io_type == REQ_MMIO || io_req->io_type == REQ_WP
+ *      || io_req->io_type == REQ_RECLAIMED
+ */
+static int32_t hv_emulate_iokick(struct acrn_vm *vm, const struct io_request *io_req)
+{
+	int32_t ret = -ENODEV;
+	uint32_t i, len;
+	uint64_t value;
+	const struct iokick_entry *entry;
+	union acrn_iokick_buffer *kick_buf = (union acrn_iokick_buffer *)vm->sw.iokick_page;
+	/* here for both IO & MMIO, the direction, address, size definition is same */
+	const struct pio_request *pio_req = &io_req->reqs.pio;
+
+	if ((kick_buf != NULL) && (pio_req->direction == REQUEST_WRITE) && (io_req->io_type != REQ_WP)) {
+		if (io_req->io_type == REQ_PORTIO) {
+			value = (uint64_t)pio_req->value;
+		} else {
+			value = io_req->reqs.mmio.value;
+		}
+
+		for (i = 0U; i < MAX_IOKICKS; i++) {
+			entry = &(vm->iokick[i]);
+			len = entry->len;
+			if ((len != 0U) && (entry->type == io_req->io_type) && (entry->addr == pio_req->address) &&
+					((uint64_t)len == pio_req->size) && (!entry->datamatch || (entry->data == value))) {
+				signal_iokick(vm, entry->slot);
+				ret = 0;
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Deliver \p io_req to SOS and optionally suspend \p vcpu till its completion
  *
  * @pre vcpu != NULL && io_req != NULL
  */
-int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+static int32_t insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_req, bool posted)
 {
 	union vhm_request_buffer *req_buf = NULL;
 	struct vhm_request *vhm_req;
-	bool is_polling = false;
 	int32_t ret = 0;
 	uint16_t cur;
 
+	/* Requests from one vCPU are delivered in order */
+	wait_posted_ioreq(vcpu);
+
 	if ((vcpu->vm->sw.io_shared_page != NULL)
 		 && (get_vhm_req_state(vcpu->vm, vcpu->vcpu_id) == REQ_STATE_FREE)) {
 
@@ -99,8 +267,8 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 			&io_req->reqs, sizeof(union vhm_io_request));
 		if (vcpu->vm->sw.is_polling_ioreq) {
 			vhm_req->completion_polling = 1U;
-			is_polling = true;
 		}
+		bitmap_set_lock(cur, &req_buf->req_queue[0].pending_bitmap);
 		clac();
 
 		/* Before updating the vhm_req state, enforce all fill vhm_req operations done */
@@ -116,20 +284,15 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 		/* signal VHM */
 		arch_fire_vhm_interrupt();
 
-		/* Polling completion of the request in polling mode */
-		if (is_polling) {
-			while (true) {
-				if (has_complete_ioreq(vcpu)) {
-					/* we have completed ioreq pending */
-					break;
-				}
-				asm_pause();
-				if (need_reschedule(pcpuid_from_vcpu(vcpu))) {
-					schedule();
-				}
-			}
+		if (vcpu->vm->vm_id < PCPU_STATS_NR_VMS) {
+			get_cpu_var(stats).ioreqs[vcpu->vm->vm_id]++;
+		}
+
+		if (posted) {
+			/* Resume the vCPU at once, the request is reaped before the next one */
+			vcpu->ioreq_posted = true;
 		} else {
-			wait_event(&vcpu->events[VCPU_EVENT_IOREQ]);
+			wait_ioreq_completion(vcpu);
 		}
 	} else {
 		ret = -EINVAL;
@@ -138,6 +301,19 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 	return ret;
 }
 
+/**
+ * @brief Deliver \p io_req to SOS and suspend \p vcpu till its completion
+ *
+ * @param vcpu The virtual CPU that triggers the MMIO access
+ * @param io_req The I/O request holding the details of the MMIO access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ */
+int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+{
+	return insert_request(vcpu, io_req, false);
+}
+
 uint32_t get_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id)
 {
 	uint32_t state;
@@ -173,6 +349,9 @@ void set_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id, uint32_t state)
 		 * It won't lead wrong processing.
 		 */
 		vhm_req->processed = state;
+		if (state == REQ_STATE_FREE) {
+			bitmap_clear_lock(vhm_req_id, &req_buf->req_queue[0].pending_bitmap);
+		}
 		clac();
 	}
 }
@@ -313,7 +492,8 @@ static void dm_emulate_io_complete(struct acrn_vcpu *vcpu)
 			default:
 				/*
 				 * REQ_WP can only be triggered on writes which do not need
-				 * post-work. Just mark the ioreq done.
+				 * post-work, and REQ_RECLAIMED retries the access. Just mark
+				 * the ioreq done.
 				 */
 				complete_ioreq(vcpu, NULL);
 				break;
@@ -400,6 +580,7 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	struct acrn_vm *vm = vcpu->vm;
 	struct pio_request *pio_req = &io_req->reqs.pio;
 	struct vm_io_handler_desc *handler;
+	struct emul_io_cache *cache = &vcpu->io_cache;
 	io_read_fn_t io_read = NULL;
 	io_write_fn_t io_write = NULL;
 
@@ -411,20 +592,28 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	port = (uint16_t)pio_req->address;
 	size = (uint16_t)pio_req->size;
 
-	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
-		handler = &(vm->emul_pio[idx]);
+	idx = cache->pio_idx;
+	if ((cache->pio_gen != vm->emul_pio_gen) || (idx >= EMUL_PIO_IDX_MAX) ||
+			(port < vm->emul_pio[idx].port_start) || (port >= vm->emul_pio[idx].port_end)) {
+		for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+			handler = &(vm->emul_pio[idx]);
 
-		if ((port < handler->port_start) || (port >= handler->port_end)) {
-			continue;
+			if ((port >= handler->port_start) && (port < handler->port_end)) {
+				cache->pio_idx = (uint16_t)idx;
+				cache->pio_gen = vm->emul_pio_gen;
+				break;
+			}
 		}
+	}
 
+	if (idx < EMUL_PIO_IDX_MAX) {
+		handler = &(vm->emul_pio[idx]);
 		if (handler->io_read != NULL) {
 			io_read = handler->io_read;
 		}
 		if (handler->io_write != NULL) {
 			io_write = handler->io_write;
 		}
-		break;
 	}
 
 	if ((pio_req->direction == REQUEST_WRITE) && (io_write != NULL)) {
@@ -445,10 +634,193 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	return status;
 }
 
+/**
+ * @brief Start a lockless walk of the sorted MMIO index of \p vm
+ *
+ * @return The generation of the index, which must be passed to
+ * mmio_index_read_retry() once the walk is done.
+ */
+static inline uint32_t mmio_index_read_begin(const struct acrn_vm *vm)
+{
+	uint32_t gen;
+
+	gen = *(const volatile uint32_t *)&vm->emul_mmio_gen;
+	while ((gen & 1U) != 0U) {
+		/* An update is in progress, wait for it to finish */
+		asm_pause();
+		gen = *(const volatile uint32_t *)&vm->emul_mmio_gen;
+	}
+	cpu_compiler_barrier();
+
+	return gen;
+}
+
+/**
+ * @brief Check whether the sorted MMIO index was updated during a lockless walk
+ *
+ * @return true if the walk started at \p gen has to be redone, false otherwise.
+ */
+static inline bool mmio_index_read_retry(const struct acrn_vm *vm, uint32_t gen)
+{
+	cpu_compiler_barrier();
+
+	return (*(const volatile uint32_t *)&vm->emul_mmio_gen != gen);
+}
+
+/**
+ * @pre spinlock emul_mmio_lock of \p vm is held
+ */
+static inline void mmio_index_write_begin(struct acrn_vm *vm)
+{
+	vm->emul_mmio_gen++;
+	cpu_write_memory_barrier();
+}
+
+/**
+ * @pre spinlock emul_mmio_lock of \p vm is held
+ */
+static inline void mmio_index_write_end(struct acrn_vm *vm)
+{
+	cpu_write_memory_barrier();
+	vm->emul_mmio_gen++;
+}
+
+/**
+ * @brief Insert emul_mmio[node_idx] to the sorted MMIO index of \p vm
+ *
+ * @pre spinlock emul_mmio_lock of \p vm is held
+ * @pre vm->nr_emul_mmio_sorted < CONFIG_MAX_EMULATED_MMIO_REGIONS
+ */
+static void mmio_index_insert(struct acrn_vm *vm, uint16_t node_idx)
+{
+	uint16_t i = vm->nr_emul_mmio_sorted;
+	uint64_t start = vm->emul_mmio[node_idx].range_start;
+
+	while ((i > 0U) && (vm->emul_mmio[vm->emul_mmio_sorted[i - 1U]].range_start > start)) {
+		vm->emul_mmio_sorted[i] = vm->emul_mmio_sorted[i - 1U];
+		i--;
+	}
+	vm->emul_mmio_sorted[i] = node_idx;
+	vm->nr_emul_mmio_sorted++;
+}
+
+/**
+ * @brief Remove emul_mmio[node_idx] from the sorted MMIO index of \p vm
+ *
+ * @pre spinlock emul_mmio_lock of \p vm is held
+ */
+static void mmio_index_remove(struct acrn_vm *vm, uint16_t node_idx)
+{
+	uint16_t i;
+	bool found = false;
+
+	for (i = 0U; i < vm->nr_emul_mmio_sorted; i++) {
+		if (found) {
+			vm->emul_mmio_sorted[i - 1U] = vm->emul_mmio_sorted[i];
+		} else if (vm->emul_mmio_sorted[i] == node_idx) {
+			found = true;
+		} else {
+			/* keep searching */
+		}
+	}
+
+	if (found) {
+		vm->nr_emul_mmio_sorted--;
+	}
+}
+
+/**
+ * @brief Binary search the sorted MMIO index for the region covering an access
+ *
+ * The registered regions never overlap, so the only candidate is the last
+ * region starting below \p address + \p size.
+ *
+ * @retval 0 The access falls in the region emul_mmio[*node_idx].
+ * @retval -ENODEV No registered region overlaps with the access.
+ * @retval -EIO The access spans multiple regions or beyond a region.
+ */
+static int32_t mmio_index_search(const struct acrn_vm *vm, uint64_t address, uint64_t size,
+	uint16_t *node_idx)
+{
+	int32_t status = -ENODEV;
+	uint16_t lo = 0U, mid, hi;
+	const struct mem_io_node *candidate;
+
+	hi = *(const volatile uint16_t *)&vm->nr_emul_mmio_sorted;
+
+	while (lo < hi) {
+		mid = lo + ((hi - lo) >> 1U);
+		if (vm->emul_mmio[vm->emul_mmio_sorted[mid]].range_start
+				< (address + size)) {
+			lo = mid + 1U;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo > 0U) {
+		candidate = &(vm->emul_mmio[vm->emul_mmio_sorted[lo - 1U]]);
+		if (address < candidate->range_end) {
+			if ((address >= candidate->range_start) && ((address + size) <= candidate->range_end)) {
+				*node_idx = vm->emul_mmio_sorted[lo - 1U];
+				status = 0;
+			} else {
+				status = -EIO;
+			}
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief Look up the MMIO region covering an access, trying the vCPU cache first
+ *
+ * Most trapped accesses of a vCPU hit the same region as the previous one, so
+ * the region cached in \p vcpu is checked before the binary search. The cache
+ * is refreshed on a successful search.
+ *
+ * @pre The caller is walking the sorted MMIO index started at generation \p gen
+ *
+ * @return The same as mmio_index_search()
+ */
+static int32_t mmio_cached_search(struct acrn_vcpu *vcpu, uint32_t gen, uint64_t address, uint64_t size,
+	uint16_t *node_idx)
+{
+	int32_t status;
+	const struct acrn_vm *vm = vcpu->vm;
+	struct emul_io_cache *cache = &vcpu->io_cache;
+	const struct mem_io_node *cached;
+
+	if ((cache->mmio_gen == gen) && (cache->mmio_idx < CONFIG_MAX_EMULATED_MMIO_REGIONS)) {
+		cached = &(vm->emul_mmio[cache->mmio_idx]);
+		if ((address >= cached->range_start) && ((address + size) <= cached->range_end)) {
+			*node_idx = cache->mmio_idx;
+			status = 0;
+		} else {
+			status = mmio_index_search(vm, address, size, node_idx);
+		}
+	} else {
+		status = mmio_index_search(vm, address, size, node_idx);
+	}
+
+	/* A stale entry is harmless, it is re-validated against the generation */
+	if (status == 0) {
+		cache->mmio_idx = *node_idx;
+		cache->mmio_gen = gen;
+	}
+
+	return status;
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
  *
+ * The registered regions are looked up locklessly in the sorted MMIO index, so
+ * vCPUs of the same VM do not serialize on emul_mmio_lock. The lock is only
+ * taken around handlers registered with hold_lock set.
+ *
  * @pre io_req->io_type == REQ_MMIO
  *
  * @retval 0 Successfully emulated by registered handlers.
@@ -459,58 +831,55 @@ static int32_t
 hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
-	bool hold_lock = true;
-	uint16_t idx;
-	uint64_t address, size, base, end;
+	bool done = false;
+	uint32_t gen;
+	uint16_t node_idx = INVALID_EMUL_IO_IDX;
+	uint64_t address, size;
+	struct acrn_vm *vm = vcpu->vm;
 	struct mmio_request *mmio_req = &io_req->reqs.mmio;
-	struct mem_io_node *mmio_handler = NULL;
-	hv_mem_io_handler_t read_write = NULL;
-	void *handler_private_data = NULL;
-
-	if (is_sos_vm(vcpu->vm) || is_prelaunched_vm(vcpu->vm)) {
-		read_write = mmio_default_access_handler;
-	}
+	struct mem_io_node mmio_node;
 
 	address = mmio_req->address;
 	size = mmio_req->size;
 
-	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
-	for (idx = 0U; idx <= vcpu->vm->nr_emul_mmio_regions; idx++) {
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		if (mmio_handler->read_write != NULL) {
-			base = mmio_handler->range_start;
-			end = mmio_handler->range_end;
+	while (!done) {
+		gen = mmio_index_read_begin(vm);
+		status = mmio_cached_search(vcpu, gen, address, size, &node_idx);
+		if (status == 0) {
+			mmio_node = vm->emul_mmio[node_idx];
+		}
+		if (mmio_index_read_retry(vm, gen)) {
+			continue;
+		}
 
-			if (((address + size) <= base) || (address >= end)) {
-				continue;
-			} else {
-				 if ((address >= base) && ((address + size) <= end)) {
-					hold_lock = mmio_handler->hold_lock;
-					read_write = mmio_handler->read_write;
-					handler_private_data = mmio_handler->handler_private_data;
-				} else {
-					pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
-					status = -EIO;
+		if (status == 0) {
+			if (mmio_node.hold_lock) {
+				qspinlock_obtain(&vm->emul_mmio_lock);
+				/* The node may be unregistered before we get the lock */
+				if (vm->emul_mmio_gen == gen) {
+					status = mmio_node.read_write(io_req, mmio_node.handler_private_data);
+					done = true;
 				}
-				break;
+				qspinlock_release(&vm->emul_mmio_lock);
+			} else {
+				/* This mmio_handler will never modify once register, so we don't
+				 * need to hold the lock when handling the MMIO access.
+				 */
+				status = mmio_node.read_write(io_req, mmio_node.handler_private_data);
+				done = true;
 			}
+		} else {
+			if (status == -EIO) {
+				pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
+			} else if (is_sos_vm(vm) || is_prelaunched_vm(vm)) {
+				status = mmio_default_access_handler(io_req, NULL);
+			} else {
+				/* No handler from HV side */
+			}
+			done = true;
 		}
 	}
 
-	if ((status == -ENODEV) && (read_write != NULL)) {
-		/* This mmio_handler will never modify once register, so we don't
-		 * need to hold the lock when handling the MMIO access.
-		 */
-		if (!hold_lock) {
-			spinlock_release(&vcpu->vm->emul_mmio_lock);
-		}
-		status = read_write(io_req, handler_private_data);
-		if (!hold_lock) {
-			spinlock_obtain(&vcpu->vm->emul_mmio_lock);
-		}
-	}
-	spinlock_release(&vcpu->vm->emul_mmio_lock);
-
 	return status;
 }
 
@@ -555,6 +924,10 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 			emulate_mmio_complete(vcpu, io_req);
 		}
 		break;
+	case REQ_RECLAIMED:
+		/* only the DM can map the memory back */
+		status = -ENODEV;
+		break;
 	default:
 		/* Unknown I/O request io_type */
 		status = -EINVAL;
@@ -567,10 +940,19 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		 *
 		 * ACRN insert request to VHM and inject upcall.
 		 */
-		status = acrn_insert_request(vcpu, io_req);
-		if (status == 0) {
-			dm_emulate_io_complete(vcpu);
+		if (hv_emulate_iokick(vcpu->vm, io_req) == 0) {
+			/* Signalled to SOS, nothing to complete for a write */
+			status = 0;
+		} else if (is_posted_ioreq(vcpu->vm, io_req)) {
+			/* Nothing to complete for a write, the guest resumes at once */
+			status = insert_request(vcpu, io_req, true);
 		} else {
+			status = acrn_insert_request(vcpu, io_req);
+			if (status == 0) {
+				dm_emulate_io_complete(vcpu);
+			}
+		}
+		if (status != 0) {
 			/* here for both IO & MMIO, the direction, address,
 			 * size definition is same
 			 */
@@ -606,6 +988,9 @@ void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 	vm->emul_pio[pio_idx].port_end = range->base + range->len;
 	vm->emul_pio[pio_idx].io_read = io_read_fn_ptr;
 	vm->emul_pio[pio_idx].io_write = io_write_fn_ptr;
+	/* Invalidate the PIO handler cache of all vCPUs */
+	cpu_write_memory_barrier();
+	vm->emul_pio_gen++;
 }
 
 /**
@@ -686,17 +1071,20 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 
 	/* Ensure both a read/write handler and range check function exist */
 	if ((read_write != NULL) && (end > start)) {
-		spinlock_obtain(&vm->emul_mmio_lock);
+		qspinlock_obtain(&vm->emul_mmio_lock);
 		mmio_node = find_free_mmio_node(vm);
 		if (mmio_node != NULL) {
+			mmio_index_write_begin(vm);
 			/* Fill in information for this node */
 			mmio_node->hold_lock = hold_lock;
 			mmio_node->read_write = read_write;
 			mmio_node->handler_private_data = handler_private_data;
 			mmio_node->range_start = start;
 			mmio_node->range_end = end;
+			mmio_index_insert(vm, (uint16_t)(uint64_t)(mmio_node - &(vm->emul_mmio[0U])));
+			mmio_index_write_end(vm);
 		}
-		spinlock_release(&vm->emul_mmio_lock);
+		qspinlock_release(&vm->emul_mmio_lock);
 	}
 
 }
@@ -717,16 +1105,132 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 {
 	struct mem_io_node *mmio_node;
 
-	spinlock_obtain(&vm->emul_mmio_lock);
+	qspinlock_obtain(&vm->emul_mmio_lock);
 	mmio_node = find_match_mmio_node(vm, start, end);
 	if (mmio_node != NULL) {
+		mmio_index_write_begin(vm);
+		mmio_index_remove(vm, (uint16_t)(uint64_t)(mmio_node - &(vm->emul_mmio[0U])));
 		(void)memset(mmio_node, 0U, sizeof(struct mem_io_node));
+		mmio_index_write_end(vm);
+	}
+	qspinlock_release(&vm->emul_mmio_lock);
+}
+
+/**
+ * @pre vm != NULL && range != NULL
+ */
+int32_t set_posted_io_range(struct acrn_vm *vm, const struct acrn_posted_io_range *range)
+{
+	int32_t ret = -EINVAL;
+	uint32_t i;
+	struct posted_io_range *entry;
+
+	if (((range->type == REQ_PORTIO) || (range->type == REQ_MMIO)) && (range->end > range->start)) {
+		for (i = 0U; i < MAX_POSTED_IO_RANGES; i++) {
+			entry = &(vm->posted_io[i]);
+			if ((range->flags & POSTED_IO_RANGE_DEASSIGN) != 0U) {
+				if ((entry->end == range->end) && (entry->start == range->start) &&
+						(entry->type == range->type)) {
+					/* Clear end first, lockless readers stop matching it */
+					entry->end = 0UL;
+					cpu_write_memory_barrier();
+					entry->start = 0UL;
+					ret = 0;
+					break;
+				}
+			} else if (entry->end == 0UL) {
+				entry->type = range->type;
+				entry->start = range->start;
+				cpu_write_memory_barrier();
+				entry->end = range->end;
+				ret = 0;
+				break;
+			} else {
+				ret = -EBUSY;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vm != NULL && kick != NULL
+ */
+int32_t set_iokick(struct acrn_vm *vm, const struct acrn_iokick *kick)
+{
+	int32_t ret = -EINVAL;
+	uint32_t i, type;
+	struct iokick_entry *entry;
+	bool datamatch = ((kick->flags & ACRN_IOKICK_FLAG_DATAMATCH) != 0U);
+
+	type = ((kick->flags & ACRN_IOKICK_FLAG_PIO) != 0U) ? REQ_PORTIO : REQ_MMIO;
+	if (((kick->len == 1U) || (kick->len == 2U) || (kick->len == 4U) || (kick->len == 8U)) &&
+			(kick->slot < ACRN_IOKICK_SLOT_MAX) && ((type == REQ_MMIO) || (kick->len <= 4U))) {
+		for (i = 0U; i < MAX_IOKICKS; i++) {
+			entry = &(vm->iokick[i]);
+			if ((kick->flags & ACRN_IOKICK_FLAG_DEASSIGN) != 0U) {
+				if ((entry->len == kick->len) && (entry->addr == kick->addr) && (entry->type == type) &&
+						(entry->datamatch == datamatch) && (!datamatch || (entry->data == kick->data))) {
+					/* Clear len first, lockless readers stop matching it */
+					entry->len = 0U;
+					cpu_write_memory_barrier();
+					entry->addr = 0UL;
+					ret = 0;
+					break;
+				}
+			} else if (entry->len == 0U) {
+				entry->type = type;
+				entry->addr = kick->addr;
+				entry->data = kick->data;
+				entry->datamatch = datamatch;
+				entry->slot = (uint16_t)kick->slot;
+				cpu_write_memory_barrier();
+				entry->len = kick->len;
+				ret = 0;
+				break;
+			} else {
+				ret = -EBUSY;
+			}
+		}
+	}
+
+	return ret;
+}
+
+void signal_iokick(struct acrn_vm *vm, uint32_t slot)
+{
+	union acrn_iokick_buffer *kick_buf = (union acrn_iokick_buffer *)vm->sw.iokick_page;
+
+	if (kick_buf != NULL) {
+		stac();
+		bitmap_set_lock((uint16_t)(slot & 0x3FU), &kick_buf->pending[(slot >> 6U) & 0x3U]);
+		clac();
+		arch_fire_vhm_interrupt();
 	}
-	spinlock_release(&vm->emul_mmio_lock);
 }
 
 void deinit_emul_io(struct acrn_vm *vm)
 {
+	qspinlock_obtain(&vm->emul_mmio_lock);
+	mmio_index_write_begin(vm);
+	vm->nr_emul_mmio_sorted = 0U;
 	(void)memset(vm->emul_mmio, 0U, sizeof(vm->emul_mmio));
+	mmio_index_write_end(vm);
+	qspinlock_release(&vm->emul_mmio_lock);
 	(void)memset(vm->emul_pio, 0U, sizeof(vm->emul_pio));
+	vm->emul_pio_gen++;
+	(void)memset(vm->posted_io, 0U, sizeof(vm->posted_io));
+	(void)memset(vm->iokick, 0U, sizeof(vm->iokick));
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+void reset_emul_io_cache(struct acrn_vcpu *vcpu)
+{
+	vcpu->io_cache.mmio_idx = INVALID_EMUL_IO_IDX;
+	vcpu->io_cache.mmio_gen = 0U;
+	vcpu->io_cache.pio_idx = INVALID_EMUL_IO_IDX;
+	vcpu->io_cache.pio_gen = 0U;
 }
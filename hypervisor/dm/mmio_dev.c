@@ -10,34 +10,94 @@
 #include <asm/pgtable.h>
 #include <asm/guest/vm.h>
 #include <asm/guest/ept.h>
+#include <mmio_dev.h>
 
-int32_t assign_mmio_dev(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodev)
-{
-	int32_t ret = -EINVAL;
+/*
+ * A run of MMIO regions contiguous in both the guest and the host physical
+ * spaces, mapped as one region so that large pages can cross the boundaries
+ * of the devices.
+ */
+struct mmio_run {
+	uint64_t gpa;
+	uint64_t hpa;
+	uint64_t size;
+};
 
-	if (mem_aligned_check(mmiodev->base_gpa, PAGE_SIZE) &&
+bool is_valid_mmio_dev(const struct acrn_mmiodev *mmiodev)
+{
+	return (mem_aligned_check(mmiodev->base_gpa, PAGE_SIZE) &&
 			mem_aligned_check(mmiodev->base_hpa, PAGE_SIZE) &&
-			mem_aligned_check(mmiodev->size, PAGE_SIZE)) {
-		ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, mmiodev->base_hpa,
-				is_sos_vm(vm) ? mmiodev->base_hpa : mmiodev->base_gpa,
-				mmiodev->size, EPT_RWX | EPT_UNCACHED);
-		ret = 0;
-	}
+			mem_aligned_check(mmiodev->size, PAGE_SIZE));
+}
 
-	return ret;
+static void end_mmio_run(struct acrn_vm *vm, struct mmio_run *run, bool assign)
+{
+	if (run->size != 0UL) {
+		if (assign) {
+			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, run->hpa, run->gpa,
+					run->size, EPT_RWX | EPT_UNCACHED);
+		} else {
+			ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, run->gpa, run->size);
+		}
+		run->size = 0UL;
+	}
 }
 
-int32_t deassign_mmio_dev(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodev)
+/*
+ * Map or unmap the valid ones of mmiodevs[0, nr), the EPT of vm is flushed
+ * once for all of them.
+ *
+ * @return 0 if all of them are valid, -EINVAL otherwise.
+ */
+static int32_t map_mmio_devs(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodevs, uint32_t nr, bool assign)
 {
-	int32_t ret = -EINVAL;
+	const struct acrn_mmiodev *mmiodev;
+	struct mmio_run run = { 0UL, 0UL, 0UL };
+	uint64_t gpa;
+	uint32_t i;
+	int32_t ret = 0;
 
-	if (mem_aligned_check(mmiodev->base_gpa, PAGE_SIZE) &&
-			mem_aligned_check(mmiodev->base_hpa, PAGE_SIZE) &&
-			mem_aligned_check(mmiodev->size, PAGE_SIZE)) {
-		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
-				is_sos_vm(vm) ? mmiodev->base_hpa : mmiodev->base_gpa, mmiodev->size);
-		ret = 0;
+	ept_batch_begin(vm);
+	for (i = 0U; i < nr; i++) {
+		mmiodev = &mmiodevs[i];
+		if (!is_valid_mmio_dev(mmiodev)) {
+			end_mmio_run(vm, &run, assign);
+			ret = -EINVAL;
+			continue;
+		}
+
+		gpa = is_sos_vm(vm) ? mmiodev->base_hpa : mmiodev->base_gpa;
+		if (((run.gpa + run.size) != gpa) || ((run.hpa + run.size) != mmiodev->base_hpa)) {
+			end_mmio_run(vm, &run, assign);
+		}
+		if (run.size == 0UL) {
+			run.gpa = gpa;
+			run.hpa = mmiodev->base_hpa;
+		}
+		run.size += mmiodev->size;
 	}
+	end_mmio_run(vm, &run, assign);
+	ept_batch_end(vm);
 
 	return ret;
 }
+
+int32_t assign_mmio_devs(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodevs, uint32_t nr)
+{
+	return map_mmio_devs(vm, mmiodevs, nr, true);
+}
+
+int32_t deassign_mmio_devs(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodevs, uint32_t nr)
+{
+	return map_mmio_devs(vm, mmiodevs, nr, false);
+}
+
+int32_t assign_mmio_dev(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodev)
+{
+	return assign_mmio_devs(vm, mmiodev, 1U);
+}
+
+int32_t deassign_mmio_dev(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodev)
+{
+	return deassign_mmio_devs(vm, mmiodev, 1U);
+}
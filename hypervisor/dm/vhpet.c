@@ -0,0 +1,715 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Emulate the HPET of a post-launched VM in the hypervisor.
+ *
+ * The model is the one of the device model (devicemodel/hw/platform/hpet.c):
+ * a 32-bit main counter running at 2^24 Hz and VHPET_NUM_TIMERS comparators
+ * with ioapic or FSB (MSI) interrupts, no LegacyReplacement routing. Reading
+ * the main counter, which guests using the HPET as clocksource do all the
+ * time, is then served without leaving the hypervisor.
+ *
+ * The main counter is derived from the TSC. An armed comparator is backed by
+ * a periodic hv_timer; a one-shot comparator is re-armed every 2^32 ticks as
+ * the counter wraps around, just like the hardware. The hv_timers are kept
+ * in the timer heap of vCPU0's pcpu: an access from another pcpu only
+ * updates the comparator state and asks vCPU0 to reprogram them through
+ * ACRN_REQUEST_VHPET_UPDATE.
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <asm/guest/vm.h>
+#include <asm/guest/virq.h>
+#include <asm/per_cpu.h>
+#include <ticks.h>
+#include <logmsg.h>
+
+#define DBG_LEVEL_VHPET		6U
+
+#define HPET_FREQ		(1UL << 24U)	/* 16.7 (2^24) Mhz */
+#define FS_PER_S		1000000000000000UL
+
+/* General registers */
+#define HPET_CAPABILITIES	0x0U	/* General capabilities and ID */
+#define HPET_CAP_COUNT_SIZE	0x00002000UL /* 1 = 64-bit, 0 = 32-bit */
+#define HPET_CONFIG		0x10U	/* General configuration register */
+#define HPET_CNF_ENABLE		0x00000001UL
+#define HPET_ISR		0x20U	/* General interrupt status register */
+#define HPET_MAIN_COUNTER	0xf0U	/* Main counter register */
+
+/* Timer registers */
+#define HPET_TIMER_CAP_CNF(x)	((x) * 0x20U + 0x100U)
+#define HPET_TCAP_INT_ROUTE	0xffffffff00000000UL
+#define HPET_TCAP_FSB_INT_DEL	0x00008000UL
+#define HPET_TCNF_FSB_EN	0x00004000UL
+#define HPET_TCNF_INT_ROUTE	0x00003e00UL
+#define HPET_TCNF_32MODE	0x00000100UL
+#define HPET_TCNF_VAL_SET	0x00000040UL
+#define HPET_TCAP_SIZE		0x00000020UL /* 1 = 64-bit, 0 = 32-bit */
+#define HPET_TCAP_PER_INT	0x00000010UL /* Supports periodic interrupts */
+#define HPET_TCNF_TYPE		0x00000008UL /* 1 = periodic, 0 = one-shot */
+#define HPET_TCNF_INT_ENB	0x00000004UL
+#define HPET_TCNF_INT_TYPE	0x00000002UL /* 1 = level triggered, 0 = edge */
+#define HPET_TIMER_COMPARATOR(x) ((x) * 0x20U + 0x108U)
+#define HPET_TIMER_FSB_VAL(x)	((x) * 0x20U + 0x110U)
+#define HPET_TIMER_FSB_ADDR(x)	((x) * 0x20U + 0x114U)
+
+#define HPET_TCAP_RO_MASK	(HPET_TCAP_INT_ROUTE |	\
+				 HPET_TCAP_FSB_INT_DEL |	\
+				 HPET_TCAP_SIZE |	\
+				 HPET_TCAP_PER_INT)
+
+static inline uint64_t tsc_hz(void)
+{
+	return (uint64_t)cpu_tickrate() * 1000UL;
+}
+
+/* TSC cycles to HPET ticks, split so that it can't overflow */
+static uint64_t tsc_to_hpet_ticks(uint64_t tsc)
+{
+	uint64_t hz = tsc_hz();
+
+	return ((tsc / hz) * HPET_FREQ) + (((tsc % hz) * HPET_FREQ) / hz);
+}
+
+/* HPET ticks to TSC cycles */
+static uint64_t hpet_ticks_to_tsc(uint64_t ticks)
+{
+	uint64_t hz = tsc_hz();
+
+	return ((ticks >> 24U) * hz) + (((ticks & (HPET_FREQ - 1UL)) * hz) >> 24U);
+}
+
+static uint64_t vhpet_capabilities(void)
+{
+	uint64_t cap = 0UL;
+
+	cap |= 0x8086UL << 16U;				/* vendor id */
+	cap |= ((uint64_t)VHPET_NUM_TIMERS - 1UL) << 8U;	/* number of timers */
+	cap |= 1UL;					/* revision */
+	cap &= ~HPET_CAP_COUNT_SIZE;			/* 32-bit timer */
+	cap |= (FS_PER_S / HPET_FREQ) << 32U;		/* tick period in fs */
+
+	return cap;
+}
+
+static inline bool vhpet_counter_enabled(const struct acrn_vhpet *vhpet)
+{
+	return ((vhpet->config & HPET_CNF_ENABLE) != 0UL);
+}
+
+static inline bool vhpet_timer_msi_enabled(const struct vhpet_timer *t)
+{
+	const uint64_t msi_enable = HPET_TCAP_FSB_INT_DEL | HPET_TCNF_FSB_EN;
+
+	return ((t->cap_config & msi_enable) == msi_enable);
+}
+
+static inline uint32_t vhpet_timer_ioapic_pin(const struct vhpet_timer *t)
+{
+	uint32_t pin = 0U;
+
+	/*
+	 * If the timer is configured to use MSI then treat it as if the
+	 * timer is not connected to the ioapic.
+	 */
+	if (!vhpet_timer_msi_enabled(t)) {
+		pin = (uint32_t)((t->cap_config & HPET_TCNF_INT_ROUTE) >> 9U);
+	}
+
+	return pin;
+}
+
+static inline bool vhpet_periodic_timer(const struct vhpet_timer *t)
+{
+	return ((t->cap_config & HPET_TCNF_TYPE) != 0UL);
+}
+
+static inline bool vhpet_timer_interrupt_enabled(const struct vhpet_timer *t)
+{
+	return ((t->cap_config & HPET_TCNF_INT_ENB) != 0UL);
+}
+
+static inline bool vhpet_timer_enabled(const struct vhpet_timer *t)
+{
+	/* The timer is enabled when at least one of the two bits is set */
+	return (vhpet_timer_interrupt_enabled(t) || vhpet_periodic_timer(t));
+}
+
+static inline bool vhpet_timer_edge_trig(const struct vhpet_timer *t)
+{
+	return (!vhpet_timer_msi_enabled(t) && ((t->cap_config & HPET_TCNF_INT_TYPE) == 0UL));
+}
+
+static uint32_t vhpet_counter(const struct acrn_vhpet *vhpet, uint64_t now)
+{
+	uint32_t val = vhpet->countbase;
+
+	if (vhpet_counter_enabled(vhpet)) {
+		val += (uint32_t)tsc_to_hpet_ticks(now - vhpet->countbase_tsc);
+	}
+
+	return val;
+}
+
+static void vhpet_timer_clear_isr(struct acrn_vhpet *vhpet, uint32_t n)
+{
+	uint32_t pin;
+
+	if ((vhpet->isr & (1UL << n)) != 0UL) {
+		pin = vhpet_timer_ioapic_pin(&vhpet->timer[n]);
+		if (pin != 0U) {
+			vioapic_set_irqline_lock(vhpet->vm, pin, GSI_SET_LOW);
+		}
+		vhpet->isr &= ~(1UL << n);
+	}
+}
+
+static void vhpet_timer_interrupt(struct acrn_vhpet *vhpet, uint32_t n)
+{
+	struct vhpet_timer *t = &vhpet->timer[n];
+	uint32_t pin;
+
+	/* If interrupts are not enabled for this timer then just return. */
+	if (vhpet_timer_interrupt_enabled(t)) {
+		/* If a level triggered interrupt is already asserted then just return. */
+		if (((vhpet->isr & (1UL << n)) != 0UL) && !vhpet_timer_msi_enabled(t) && !vhpet_timer_edge_trig(t)) {
+			dev_dbg(DBG_LEVEL_VHPET, "hpet t%u intr is already asserted", n);
+		} else {
+			vhpet->isr &= ~(1UL << n);
+
+			if (vhpet_timer_msi_enabled(t)) {
+				(void)vlapic_inject_msi(vhpet->vm, t->msireg >> 32U, t->msireg & 0xFFFFFFFFUL);
+			} else {
+				pin = vhpet_timer_ioapic_pin(t);
+				if (pin == 0U) {
+					dev_dbg(DBG_LEVEL_VHPET, "hpet t%u intr is not routed to ioapic", n);
+				} else if (vhpet_timer_edge_trig(t)) {
+					vioapic_set_irqline_lock(vhpet->vm, pin, GSI_RAISING_PULSE);
+				} else {
+					vhpet->isr |= 1UL << n;
+					vioapic_set_irqline_lock(vhpet->vm, pin, GSI_SET_HIGH);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * hv_timer callback, runs on the pcpu of vCPU0.
+ */
+static void vhpet_timer_expired(void *data)
+{
+	struct vhpet_timer *t = (struct vhpet_timer *)data;
+	struct acrn_vhpet *vhpet = t->vhpet;
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+	/* a stopped or reprogrammed comparator: vhpet_update_timers() takes care */
+	if (((vhpet->pending & (1U << t->num)) == 0U) && (t->expire_tsc != 0UL)) {
+		/* Periodic timer updates 'compval' upon expiration */
+		if (vhpet_periodic_timer(t)) {
+			t->compval += t->comprate;
+		}
+		t->expire_tsc += t->period_tsc;
+		vhpet_timer_interrupt(vhpet, t->num);
+	}
+	spinlock_irqrestore_release(&vhpet->lock, rflags);
+}
+
+static void vhpet_adjust_compval(struct vhpet_timer *t, uint64_t now)
+{
+	uint64_t delta_ticks;
+
+	if ((t->comprate != 0U) && (t->expire_tsc < now)) {
+		/*
+		 * The counter is ahead of 'compval', round it up in 'comprate'
+		 * sized units so that it stays ahead of the counter.
+		 */
+		delta_ticks = tsc_to_hpet_ticks(now - t->expire_tsc);
+		t->compval += (uint32_t)(((delta_ticks / t->comprate) + 1UL) * t->comprate);
+	}
+}
+
+static void vhpet_stop_timer(struct acrn_vhpet *vhpet, uint32_t n, uint64_t now, bool adj_compval)
+{
+	struct vhpet_timer *t = &vhpet->timer[n];
+
+	if (t->expire_tsc != 0UL) {
+		/*
+		 * If the timer was scheduled to expire in the past but hasn't
+		 * had a chance to execute yet then trigger the timer interrupt
+		 * here. Failing to do so will result in a missed timer interrupt
+		 * in the guest.
+		 */
+		if (t->expire_tsc < now) {
+			if (adj_compval) {
+				vhpet_adjust_compval(t, now);
+			}
+			vhpet_timer_interrupt(vhpet, n);
+		}
+
+		t->expire_tsc = 0UL;
+		vhpet->pending |= 1U << n;
+	}
+}
+
+static void vhpet_start_timer(struct acrn_vhpet *vhpet, uint32_t n, uint32_t counter, uint64_t now, bool adj_compval)
+{
+	struct vhpet_timer *t = &vhpet->timer[n];
+	uint64_t period;
+
+	vhpet_stop_timer(vhpet, n, now, adj_compval);
+
+	/*
+	 * It is the guest's responsibility to make sure that the
+	 * comparator value is not in the "past".
+	 */
+	t->expire_tsc = now + hpet_ticks_to_tsc((uint64_t)(t->compval - counter));
+
+	/* It takes 2^32 ticks to wrap around */
+	period = (t->comprate != 0U) ? t->comprate : (1UL << 32U);
+	t->period_tsc = hpet_ticks_to_tsc(period);
+
+	vhpet->pending |= 1U << n;
+}
+
+static void vhpet_restart_timer(struct acrn_vhpet *vhpet, uint32_t n, bool adj_compval)
+{
+	uint64_t now = cpu_ticks();
+
+	vhpet_start_timer(vhpet, n, vhpet_counter(vhpet, now), now, adj_compval);
+}
+
+static void vhpet_start_counting(struct acrn_vhpet *vhpet)
+{
+	uint32_t i;
+
+	vhpet->countbase_tsc = cpu_ticks();
+
+	/* Restart the timers based on the main counter base value */
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		if (vhpet_timer_enabled(&vhpet->timer[i])) {
+			vhpet_start_timer(vhpet, i, vhpet->countbase, vhpet->countbase_tsc, true);
+		} else {
+			vhpet_stop_timer(vhpet, i, 0UL, false);
+		}
+	}
+}
+
+static void vhpet_stop_counting(struct acrn_vhpet *vhpet, uint32_t counter, uint64_t now)
+{
+	uint32_t i;
+
+	/* Update the main counter base value */
+	vhpet->countbase = counter;
+
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		if (vhpet_timer_enabled(&vhpet->timer[i])) {
+			vhpet_stop_timer(vhpet, i, now, true);
+		} else {
+			vhpet_stop_timer(vhpet, i, 0UL, false);
+		}
+	}
+}
+
+static inline void update_register(uint64_t *regptr, uint64_t data, uint64_t mask)
+{
+	*regptr &= ~mask;
+	*regptr |= (data & mask);
+}
+
+static void vhpet_timer_update_config(struct acrn_vhpet *vhpet, uint32_t n, uint64_t data, uint64_t mask)
+{
+	struct vhpet_timer *t = &vhpet->timer[n];
+	uint32_t old_pin, new_pin, allowed_irqs;
+	uint64_t oldval, newval;
+
+	if (vhpet_timer_msi_enabled(t) || vhpet_timer_edge_trig(t)) {
+		vhpet->isr &= ~(1UL << n);
+	}
+
+	old_pin = vhpet_timer_ioapic_pin(t);
+	oldval = t->cap_config;
+
+	newval = oldval;
+	update_register(&newval, data, mask);
+	newval &= ~(HPET_TCAP_RO_MASK | HPET_TCNF_32MODE);
+	newval |= oldval & HPET_TCAP_RO_MASK;
+
+	if (newval != oldval) {
+		t->cap_config = newval;
+
+		if (((oldval ^ newval) & (HPET_TCNF_TYPE | HPET_TCNF_INT_ENB)) != 0UL) {
+			if (!vhpet_periodic_timer(t)) {
+				t->comprate = 0U;
+			}
+
+			if (vhpet_counter_enabled(vhpet)) {
+				/*
+				 * Stop the timer if both bits are now cleared, restart it
+				 * if it was stopped or HPET_TCNF_TYPE is being toggled.
+				 */
+				if (!vhpet_timer_enabled(t)) {
+					vhpet_stop_timer(vhpet, n, cpu_ticks(), true);
+				} else if (((oldval & (HPET_TCNF_TYPE | HPET_TCNF_INT_ENB)) == 0UL) ||
+						(((oldval ^ newval) & HPET_TCNF_TYPE) != 0UL)) {
+					vhpet_restart_timer(vhpet, n, true);
+				} else {
+					/* Timer remains in periodic mode */
+				}
+			}
+		}
+
+		/*
+		 * Validate the interrupt routing in the HPET_TCNF_INT_ROUTE field.
+		 * If it does not match the bits set in HPET_TCAP_INT_ROUTE then set
+		 * it to the default value of 0.
+		 */
+		allowed_irqs = (uint32_t)(t->cap_config >> 32U);
+		new_pin = vhpet_timer_ioapic_pin(t);
+		if ((new_pin != 0U) && ((allowed_irqs & (1U << new_pin)) == 0U)) {
+			pr_warn("hpet t%u configured invalid irq %u, allowed_irqs 0x%08x", n, new_pin, allowed_irqs);
+			new_pin = 0U;
+			t->cap_config &= ~HPET_TCNF_INT_ROUTE;
+		}
+
+		/*
+		 * If the timer's ISR bit is set then clear it in the following cases:
+		 * - interrupt is disabled
+		 * - interrupt type is changed from level to edge or fsb.
+		 * - interrupt routing is changed
+		 *
+		 * This is to ensure that this timer's level triggered interrupt does
+		 * not remain asserted forever.
+		 */
+		if ((vhpet->isr & (1UL << n)) != 0UL) {
+			if (old_pin == 0U) {
+				vhpet->isr &= ~(1UL << n);
+			} else if (!vhpet_timer_interrupt_enabled(t) || vhpet_timer_msi_enabled(t) ||
+					vhpet_timer_edge_trig(t) || (new_pin != old_pin)) {
+				vioapic_set_irqline_lock(vhpet->vm, old_pin, GSI_SET_LOW);
+				vhpet->isr &= ~(1UL << n);
+			} else {
+				/* keep it asserted */
+			}
+		}
+	}
+}
+
+static void vhpet_comparator_write(struct acrn_vhpet *vhpet, uint32_t n, uint64_t data, uint64_t mask)
+{
+	struct vhpet_timer *t = &vhpet->timer[n];
+	uint32_t old_compval = t->compval;
+	uint32_t old_comprate = t->comprate;
+	uint64_t val64;
+
+	if (vhpet_periodic_timer(t)) {
+		/*
+		 * In periodic mode, writes to the comparator change the 'compval'
+		 * register only if the HPET_TCNF_VAL_SET bit is set in the
+		 * config register.
+		 */
+		val64 = t->comprate;
+		update_register(&val64, data, mask);
+		t->comprate = (uint32_t)val64;
+		if ((t->cap_config & HPET_TCNF_VAL_SET) != 0UL) {
+			t->compval = (uint32_t)val64;
+		}
+	} else {
+		t->comprate = 0U;
+		val64 = t->compval;
+		update_register(&val64, data, mask);
+		t->compval = (uint32_t)val64;
+	}
+
+	t->cap_config &= ~HPET_TCNF_VAL_SET;
+
+	if (((t->compval != old_compval) || (t->comprate != old_comprate)) &&
+			vhpet_counter_enabled(vhpet) && vhpet_timer_enabled(t)) {
+		vhpet_restart_timer(vhpet, n, false);
+	}
+}
+
+static void vhpet_mmio_write(struct acrn_vhpet *vhpet, uint32_t offset, uint64_t wval, size_t size)
+{
+	uint64_t data = wval, mask, oldval, val64, now;
+	uint32_t counter, i;
+
+	if (size == 8U) {
+		mask = ~0UL;
+	} else {
+		mask = 0xFFFFFFFFUL;
+		if ((offset & 0x4U) != 0U) {
+			mask <<= 32U;
+			data <<= 32U;
+		}
+	}
+
+	if ((offset & ~0x4U) == HPET_CONFIG) {
+		/*
+		 * Get the most recent value of the counter before updating
+		 * the 'config' register. If the HPET is going to be disabled
+		 * then 'countbase' is updated with the value right before.
+		 */
+		now = cpu_ticks();
+		counter = vhpet_counter(vhpet, now);
+		oldval = vhpet->config;
+		update_register(&vhpet->config, data, mask);
+
+		/*
+		 * LegacyReplacement Routing is not supported so clear the
+		 * bit along with the reserved bits explicitly.
+		 */
+		vhpet->config &= HPET_CNF_ENABLE;
+
+		if (((oldval ^ vhpet->config) & HPET_CNF_ENABLE) != 0UL) {
+			if (vhpet_counter_enabled(vhpet)) {
+				vhpet_start_counting(vhpet);
+			} else {
+				vhpet_stop_counting(vhpet, counter, now);
+			}
+		}
+	} else if ((offset & ~0x4U) == HPET_ISR) {
+		/* Top 32 bits are reserved */
+		for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+			if (((vhpet->isr & data) & (1UL << i)) != 0UL) {
+				vhpet_timer_clear_isr(vhpet, i);
+			}
+		}
+	} else if ((offset & ~0x4U) == HPET_MAIN_COUNTER) {
+		/* Zero-extend the counter to 64-bits before updating it */
+		val64 = vhpet_counter(vhpet, cpu_ticks());
+		update_register(&val64, data, mask);
+		vhpet->countbase = (uint32_t)val64;
+		if (vhpet_counter_enabled(vhpet)) {
+			vhpet_start_counting(vhpet);
+		}
+	} else {
+		for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+			if ((offset & ~0x4U) == HPET_TIMER_CAP_CNF(i)) {
+				vhpet_timer_update_config(vhpet, i, data, mask);
+				break;
+			}
+
+			if ((offset & ~0x4U) == HPET_TIMER_COMPARATOR(i)) {
+				vhpet_comparator_write(vhpet, i, data, mask);
+				break;
+			}
+
+			if ((offset & ~0x4U) == HPET_TIMER_FSB_VAL(i)) {
+				update_register(&vhpet->timer[i].msireg, data, mask);
+				break;
+			}
+		}
+
+		if (i >= VHPET_NUM_TIMERS) {
+			pr_warn("hpet invalid mmio write: offset 0x%08x, size %lu", offset, size);
+		}
+	}
+}
+
+static uint64_t vhpet_mmio_read(const struct acrn_vhpet *vhpet, uint32_t offset, size_t size)
+{
+	uint64_t data = 0UL;
+	uint32_t i;
+
+	if ((offset & ~0x4U) == HPET_CAPABILITIES) {
+		data = vhpet_capabilities();
+	} else if ((offset & ~0x4U) == HPET_CONFIG) {
+		data = vhpet->config;
+	} else if ((offset & ~0x4U) == HPET_ISR) {
+		data = vhpet->isr;
+	} else if ((offset & ~0x4U) == HPET_MAIN_COUNTER) {
+		data = vhpet_counter(vhpet, cpu_ticks());
+	} else {
+		for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+			if ((offset & ~0x4U) == HPET_TIMER_CAP_CNF(i)) {
+				data = vhpet->timer[i].cap_config;
+				break;
+			}
+
+			if ((offset & ~0x4U) == HPET_TIMER_COMPARATOR(i)) {
+				data = vhpet->timer[i].compval;
+				break;
+			}
+
+			if ((offset & ~0x4U) == HPET_TIMER_FSB_VAL(i)) {
+				data = vhpet->timer[i].msireg;
+				break;
+			}
+		}
+
+		if (i >= VHPET_NUM_TIMERS) {
+			pr_warn("hpet invalid mmio read: offset 0x%08x, size %lu", offset, size);
+		}
+	}
+
+	if ((size == 4U) && ((offset & 0x4U) != 0U)) {
+		data >>= 32U;
+	}
+
+	return data;
+}
+
+/*
+ * Reprogram the comparator timers from the pcpu of vCPU0, directly or
+ * through a request when the access was emulated on another pcpu.
+ */
+static void vhpet_kick_timers(struct acrn_vhpet *vhpet)
+{
+	struct acrn_vcpu *bsp = vcpu_from_vid(vhpet->vm, BSP_CPU_ID);
+
+	if (vhpet->pending != 0U) {
+		if (pcpuid_from_vcpu(bsp) == get_pcpu_id()) {
+			vhpet_update_timers(bsp);
+		} else {
+			vcpu_make_request(bsp, ACRN_REQUEST_VHPET_UPDATE);
+			signal_event(&bsp->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+		}
+	}
+}
+
+/*
+ * @pre handler_private_data != NULL
+ */
+static int32_t vhpet_mmio_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct acrn_vhpet *vhpet = (struct acrn_vhpet *)handler_private_data;
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	uint32_t offset = (uint32_t)(mmio->address - VHPET_BASE);
+	uint64_t rflags;
+	int32_t ret = 0;
+
+	/*
+	 * Accesses to the HPET should be:
+	 *   - 4 or 8 bytes wide
+	 *   - naturally aligned to its width
+	 */
+	if (((mmio->size != 4UL) && (mmio->size != 8UL)) || ((offset & (mmio->size - 1UL)) != 0U)) {
+		pr_warn("hpet invalid mmio access: offset 0x%08x, size %lu", offset, mmio->size);
+		if (mmio->direction == REQUEST_READ) {
+			mmio->value = 0UL;
+		}
+	} else {
+		spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+		if (mmio->direction == REQUEST_READ) {
+			mmio->value = vhpet_mmio_read(vhpet, offset, mmio->size);
+		} else if (mmio->direction == REQUEST_WRITE) {
+			vhpet_mmio_write(vhpet, offset, mmio->value, mmio->size);
+		} else {
+			ret = -EINVAL;
+		}
+		spinlock_irqrestore_release(&vhpet->lock, rflags);
+
+		vhpet_kick_timers(vhpet);
+	}
+
+	return ret;
+}
+
+/*
+ * @pre vcpu->vcpu_id == BSP_CPU_ID
+ * @pre called on the pcpu of vcpu
+ */
+void vhpet_update_timers(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vhpet *vhpet = &vcpu->vm->arch_vm.vhpet;
+	struct vhpet_timer *t;
+	uint64_t rflags;
+	uint32_t i;
+
+	spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		if ((vhpet->pending & (1U << i)) != 0U) {
+			t = &vhpet->timer[i];
+			del_timer(&t->timer);
+			if (t->expire_tsc != 0UL) {
+				update_timer(&t->timer, t->expire_tsc, t->period_tsc);
+				if (add_timer(&t->timer) != 0) {
+					pr_err("%s: no room for the timer", __func__);
+				}
+			}
+		}
+	}
+	vhpet->pending = 0U;
+	spinlock_irqrestore_release(&vhpet->lock, rflags);
+}
+
+void vhpet_reset(struct acrn_vm *vm)
+{
+	struct acrn_vhpet *vhpet = &vm->arch_vm.vhpet;
+	struct vhpet_timer *t;
+	uint32_t i, pincount;
+	uint64_t allowed_irqs, rflags;
+
+	spinlock_irqsave_obtain(&vhpet->lock, &rflags);
+
+	pincount = get_vm_gsicount(vm);
+	if (pincount >= 32U) {
+		allowed_irqs = 0xff000000UL;	/* irqs 24-31 */
+	} else if (pincount >= 20U) {
+		allowed_irqs = 0xfUL << (pincount - 4U);	/* 4 upper irqs */
+	} else {
+		allowed_irqs = 0UL;
+	}
+
+	vhpet->config = 0UL;
+	vhpet->isr = 0UL;
+	vhpet->countbase = 0U;
+	vhpet->countbase_tsc = 0UL;
+	vhpet->pending = 0U;
+
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		t = &vhpet->timer[i];
+		/* the vCPUs are paused, see vlapic_free() */
+		del_timer(&t->timer);
+		t->cap_config = (allowed_irqs << 32U) | HPET_TCAP_PER_INT | HPET_TCAP_FSB_INT_DEL;
+		t->msireg = 0UL;
+		t->compval = 0xffffffffU;
+		t->comprate = 0U;
+		t->expire_tsc = 0UL;
+		t->period_tsc = 0UL;
+	}
+
+	spinlock_irqrestore_release(&vhpet->lock, rflags);
+}
+
+void vhpet_init(struct acrn_vm *vm)
+{
+	struct acrn_vhpet *vhpet = &vm->arch_vm.vhpet;
+	struct vhpet_timer *t;
+	uint32_t i;
+
+	vhpet->vm = vm;
+	spinlock_init(&vhpet->lock);
+	for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+		t = &vhpet->timer[i];
+		t->vhpet = vhpet;
+		t->num = i;
+		initialize_timer(&t->timer, vhpet_timer_expired, t, 0UL, 0UL);
+	}
+	vhpet_reset(vm);
+	vhpet->enabled = true;
+
+	register_mmio_emulation_handler(vm, vhpet_mmio_access_handler, VHPET_BASE,
+			VHPET_BASE + VHPET_SIZE, (void *)vhpet, false);
+}
+
+void vhpet_deinit(struct acrn_vm *vm)
+{
+	struct acrn_vhpet *vhpet = &vm->arch_vm.vhpet;
+	uint32_t i;
+
+	if (vhpet->enabled) {
+		for (i = 0U; i < VHPET_NUM_TIMERS; i++) {
+			del_timer(&vhpet->timer[i].timer);
+		}
+		vhpet->enabled = false;
+	}
+}
@@ -83,34 +83,49 @@ vioapic_generate_intr(struct acrn_single_vioapic *vioapic, uint32_t pin)
 	}
 }
 
-/**
- * @pre pin < vioapic->chipinfo.nr_pins
+/*
+ * Update the level of a pin, @return true if the change asserts the pin
+ * according to its polarity.
+ *
+ * This may run without the lock: pin_state is only changed by locked
+ * operations and the RTE is read in one load after it, while the RTE writers
+ * store the RTE, fence and read pin_state under the lock.
  */
-static void
-vioapic_set_pinstate(struct acrn_single_vioapic *vioapic, uint32_t pin, uint32_t level)
+static bool
+vioapic_update_pinstate(struct acrn_single_vioapic *vioapic, uint32_t pin, uint32_t level)
 {
-	uint32_t old_lvl;
+	bool old_lvl, ret = false;
 	union ioapic_rte rte;
 
 	if (pin < vioapic->chipinfo.nr_pins) {
-		rte = vioapic->rtbl[pin];
-		old_lvl = (uint32_t)bitmap_test((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
 		if (level == 0U) {
-			/* clear pin_state and deliver interrupt according to polarity */
-			bitmap_clear_nolock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
-			if ((rte.bits.intr_polarity == IOAPIC_RTE_INTPOL_ALO)
-				&& old_lvl != level) {
-				vioapic_generate_intr(vioapic, pin);
-			}
+			old_lvl = bitmap_test_and_clear_lock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
 		} else {
-			/* set pin_state and deliver intrrupt according to polarity */
-			bitmap_set_nolock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
-			if ((rte.bits.intr_polarity == IOAPIC_RTE_INTPOL_AHI)
-				&& old_lvl != level) {
-				vioapic_generate_intr(vioapic, pin);
+			old_lvl = bitmap_test_and_set_lock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
+		}
+		rte.full = *(volatile const uint64_t *)&vioapic->rtbl[pin].full;
+
+		if (old_lvl != (level != 0U)) {
+			if (level == 0U) {
+				ret = (rte.bits.intr_polarity == IOAPIC_RTE_INTPOL_ALO);
+			} else {
+				ret = (rte.bits.intr_polarity == IOAPIC_RTE_INTPOL_AHI);
 			}
 		}
 	}
+
+	return ret;
+}
+
+/**
+ * @pre pin < vioapic->chipinfo.nr_pins
+ */
+static void
+vioapic_set_pinstate(struct acrn_single_vioapic *vioapic, uint32_t pin, uint32_t level)
+{
+	if (vioapic_update_pinstate(vioapic, pin, level)) {
+		vioapic_generate_intr(vioapic, pin);
+	}
 }
 
 
@@ -186,6 +201,10 @@ vioapic_set_irqline_nolock(const struct acrn_vm *vm, uint32_t vgsi, uint32_t ope
 /**
  * @brief Set vIOAPIC IRQ line status.
  *
+ * Setting a line high or low only takes the lock when the pin gets asserted,
+ * so that the repeated assertions of a shared level-triggered line run in
+ * parallel with one another and with the EOIs.
+ *
  * @param[in] vm        Pointer to target VM
  * @param[in] vgsi  	Target GSI number
  * @param[in] operation Action options: GSI_SET_HIGH/GSI_SET_LOW/
@@ -201,11 +220,20 @@ vioapic_set_irqline_lock(const struct acrn_vm *vm, uint32_t vgsi, uint32_t opera
 {
 	uint64_t rflags;
 	struct acrn_single_vioapic *vioapic;
+	uint32_t pin;
 
-	vioapic = vgsi_to_vioapic_and_vpin(vm, vgsi, NULL);
-	spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
-	vioapic_set_irqline_nolock(vm, vgsi, operation);
-	spinlock_irqrestore_release(&(vioapic->lock), rflags);
+	vioapic = vgsi_to_vioapic_and_vpin(vm, vgsi, &pin);
+	if ((operation == GSI_SET_HIGH) || (operation == GSI_SET_LOW)) {
+		if (vioapic_update_pinstate(vioapic, pin, (operation == GSI_SET_HIGH) ? 1U : 0U)) {
+			qspinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+			vioapic_generate_intr(vioapic, pin);
+			qspinlock_irqrestore_release(&(vioapic->lock), rflags);
+		}
+	} else {
+		qspinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+		vioapic_set_irqline_nolock(vm, vgsi, operation);
+		qspinlock_irqrestore_release(&(vioapic->lock), rflags);
+	}
 }
 
 static uint32_t
@@ -269,9 +297,57 @@ static inline bool vioapic_need_intr(const struct acrn_single_vioapic *vioapic,
 
 /*
  * Due to the race between vcpus and vioapic->lock could be accessed from softirq, ensure to do
- * spinlock_irqsave_obtain(&(vioapic->lock), &rflags) & spinlock_irqrestore_release(&(vioapic->lock), rflags)
+ * qspinlock_irqsave_obtain(&(vioapic->lock), &rflags) & qspinlock_irqrestore_release(&(vioapic->lock), rflags)
  * by caller.
  */
+/*
+ * Recompute, for each vCPU, the vectors of the unmasked level-triggered RTEs
+ * that may be delivered to it, so only those stay in its EOI-exit bitmap.
+ */
+static void vioapic_update_level_vectors(struct acrn_vm *vm)
+{
+	struct acrn_vioapics *vioapics = vm_ioapics(vm);
+	struct acrn_single_vioapic *vioapic;
+	struct acrn_vcpu *vcpu;
+	union ioapic_rte rte;
+	uint64_t level_vectors[4], dmask, rflags;
+	uint32_t pin, vector;
+	uint16_t i;
+	uint8_t vioapic_index;
+
+	qspinlock_irqsave_obtain(&vioapics->eoi_exit_lock, &rflags);
+	foreach_vcpu(i, vm, vcpu) {
+		(void)memset((void *)level_vectors, 0U, sizeof(level_vectors));
+		for (vioapic_index = 0U; vioapic_index < vioapics->ioapic_num; vioapic_index++) {
+			vioapic = &vioapics->vioapic_array[vioapic_index];
+			for (pin = 0U; pin < vioapic->chipinfo.nr_pins; pin++) {
+				rte = vioapic->rtbl[pin];
+				if ((rte.bits.intr_mask == IOAPIC_RTE_MASK_CLR) &&
+						(rte.bits.trigger_mode == IOAPIC_RTE_TRGRMODE_LEVEL) &&
+						((rte.bits.delivery_mode == IOAPIC_RTE_DELMODE_FIXED) ||
+						(rte.bits.delivery_mode == IOAPIC_RTE_DELMODE_LOPRI))) {
+					/* any lowest priority candidate may receive it */
+					dmask = vlapic_calc_dest_noshort(vm, false, (uint32_t)rte.bits.dest_field,
+						(rte.bits.dest_mode == IOAPIC_RTE_DESTMODE_PHY), false);
+					if (bitmap_test(i, &dmask)) {
+						vector = rte.bits.vector;
+						bitmap_set_nolock((uint16_t)(vector & 0x3fU), &level_vectors[vector >> 6U]);
+					}
+				}
+			}
+		}
+		vlapic_set_level_vectors(vcpu_vlapic(vcpu), level_vectors);
+	}
+	qspinlock_irqrestore_release(&vioapics->eoi_exit_lock, rflags);
+}
+
+static inline bool vioapic_rte_route_changed(union ioapic_rte changed)
+{
+	return ((changed.bits.vector != 0U) || (changed.bits.delivery_mode != 0UL) ||
+		(changed.bits.dest_mode != 0UL) || (changed.bits.trigger_mode != 0UL) ||
+		(changed.bits.intr_mask != 0UL) || (changed.bits.dest_field != 0U));
+}
+
 static void vioapic_indirect_write(struct acrn_single_vioapic *vioapic, uint32_t addr, uint32_t data)
 {
 	union ioapic_rte last, new, changed;
@@ -346,10 +422,17 @@ static void vioapic_indirect_write(struct acrn_single_vioapic *vioapic, uint32_t
 		}
 
 		if (wire_mode_valid) {
-			vioapic->rtbl[pin] = new;
+			/* one store, read locklessly by vioapic_update_pinstate() */
+			vioapic->rtbl[pin].full = new.full;
+			/* order it before the read of pin_state in vioapic_need_intr() */
+			cpu_memory_barrier();
 			dev_dbg(DBG_LEVEL_VIOAPIC, "ioapic pin%hhu: redir table entry %#lx",
 				pin, vioapic->rtbl[pin].full);
 
+			if (vioapic_rte_route_changed(changed)) {
+				vioapic_update_level_vectors(vioapic->vm);
+			}
+
 			/* remap for ptdev */
 			if ((new.bits.intr_mask == IOAPIC_RTE_MASK_CLR) || (last.bits.intr_mask  == IOAPIC_RTE_MASK_CLR)) {
 				/* VM enable intr */
@@ -383,7 +466,7 @@ vioapic_mmio_rw(struct acrn_single_vioapic *vioapic, uint64_t gpa,
 
 	offset = (uint32_t)(gpa - vioapic->chipinfo.addr);
 
-	spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+	qspinlock_irqsave_obtain(&(vioapic->lock), &rflags);
 
 	/* The IOAPIC specification allows 32-bit wide accesses to the
 	 * IOAPIC_REGSEL (offset 0) and IOAPIC_WINDOW (offset 16) registers.
@@ -412,7 +495,7 @@ vioapic_mmio_rw(struct acrn_single_vioapic *vioapic, uint64_t gpa,
 		break;
 	}
 
-	spinlock_irqrestore_release(&(vioapic->lock), rflags);
+	qspinlock_irqrestore_release(&(vioapic->lock), rflags);
 }
 
 /*
@@ -439,14 +522,18 @@ vioapic_process_eoi(struct acrn_single_vioapic *vioapic, uint32_t vector)
 			continue;
 		}
 
-		ptirq_intx_ack(vioapic->vm, vioapic->chipinfo.gsi_base + pin, INTX_CTLR_IOAPIC);
+		if (!ptirq_intx_ack(vioapic->vm, vioapic->chipinfo.gsi_base + pin, INTX_CTLR_IOAPIC) &&
+				bitmap_test((uint16_t)(pin & 0x3FU), &vioapic->resample_pins[pin >> 6U])) {
+			/* like the GSI_SET_LOW of the device model, raised again by it if still pending */
+			(void)vioapic_update_pinstate(vioapic, pin, 0U);
+		}
 	}
 
 	/*
 	 * XXX keep track of the pins associated with this vector instead
 	 * of iterating on every single pin each time.
 	 */
-	spinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+	qspinlock_irqsave_obtain(&(vioapic->lock), &rflags);
 	for (pin = 0U; pin < pincount; pin++) {
 		rte = vioapic->rtbl[pin];
 		if ((rte.bits.vector != vector) ||
@@ -460,8 +547,39 @@ vioapic_process_eoi(struct acrn_single_vioapic *vioapic, uint32_t vector)
 				"ioapic pin%hhu: asserted at eoi", pin);
 			vioapic_generate_intr(vioapic, pin);
 		}
+
+		if (bitmap_test((uint16_t)(pin & 0x3FU), &vioapic->resample_pins[pin >> 6U])) {
+			signal_iokick(vioapic->vm, vioapic->resample_slot[pin]);
+		}
 	}
-	spinlock_irqrestore_release(&(vioapic->lock), rflags);
+	qspinlock_irqrestore_release(&(vioapic->lock), rflags);
+}
+
+/**
+ * @pre vm != NULL && resample != NULL
+ */
+int32_t vioapic_set_resample(struct acrn_vm *vm, const struct acrn_intx_resample *resample)
+{
+	struct acrn_single_vioapic *vioapic;
+	uint32_t pin;
+	uint64_t rflags;
+	int32_t ret = -EINVAL;
+
+	if ((resample->gsi < get_vm_gsicount(vm)) && (resample->slot < ACRN_IOKICK_SLOT_MAX)) {
+		vioapic = vgsi_to_vioapic_and_vpin(vm, resample->gsi, &pin);
+
+		qspinlock_irqsave_obtain(&(vioapic->lock), &rflags);
+		if ((resample->flags & ACRN_INTX_RESAMPLE_FLAG_DEASSIGN) != 0U) {
+			bitmap_clear_nolock((uint16_t)(pin & 0x3FU), &vioapic->resample_pins[pin >> 6U]);
+		} else {
+			vioapic->resample_slot[pin] = (uint8_t)resample->slot;
+			bitmap_set_nolock((uint16_t)(pin & 0x3FU), &vioapic->resample_pins[pin >> 6U]);
+		}
+		qspinlock_irqrestore_release(&(vioapic->lock), rflags);
+		ret = 0;
+	}
+
+	return ret;
 }
 
 void vioapic_broadcast_eoi(const struct acrn_vm *vm, uint32_t vector)
@@ -501,6 +619,11 @@ void reset_vioapics(const struct acrn_vm *vm)
 	for (vioapic_index = 0U; vioapic_index < vioapics->ioapic_num; vioapic_index++) {
 		reset_one_vioapic(&vioapics->vioapic_array[vioapic_index]);
 	}
+
+	if (vioapics->ioapic_num > 0U) {
+		/* all pins masked: no vector needs an EOI exit any more */
+		vioapic_update_level_vectors(vioapics->vioapic_array[0].vm);
+	}
 }
 
 void
@@ -515,6 +638,7 @@ vioapic_init(struct acrn_vm *vm)
 	uint8_t vioapic_index;
 	struct acrn_single_vioapic *vioapic = NULL;
 
+	qspinlock_init(&(vm->arch_vm.vioapics.eoi_exit_lock));
 	if (is_sos_vm(vm)) {
 		vm->arch_vm.vioapics.ioapic_num = get_platform_ioapic_info(&vioapic_info);
 	} else {
@@ -524,11 +648,13 @@ vioapic_init(struct acrn_vm *vm)
 
 	for (vioapic_index = 0U; vioapic_index < vm->arch_vm.vioapics.ioapic_num; vioapic_index++) {
 		vioapic = &vm->arch_vm.vioapics.vioapic_array[vioapic_index];
-		spinlock_init(&(vioapic->lock));
+		qspinlock_init(&(vioapic->lock));
 		vioapic->chipinfo = vioapic_info[vioapic_index];
 
 		vioapic->vm = vm;
 		reset_one_vioapic(vioapic);
+		/* resample bindings are kept across a VM reset, dropped when it is created */
+		(void)memset((void *)vioapic->resample_pins, 0U, sizeof(vioapic->resample_pins));
 
 		register_mmio_emulation_handler(vm, vioapic_mmio_access_handler, (uint64_t)vioapic->chipinfo.addr,
 					(uint64_t)vioapic->chipinfo.addr + VIOAPIC_SIZE, (void *)vioapic, false);
@@ -64,6 +64,9 @@ struct ivshmem_device {
 		} regs;
 	} mmio;
 	struct ivshmem_shm_region *region;
+	/* doorbells rung while their MSI-X vector was masked */
+	uint64_t pending;
+	spinlock_t lock;
 };
 
 /* IVSHMEM_SHM_SIZE is provided by offline tool */
@@ -71,14 +74,33 @@ static uint8_t ivshmem_base[IVSHMEM_SHM_SIZE] __aligned(PDE_SIZE);
 static struct ivshmem_device ivshmem_dev[IVSHMEM_DEV_NUM];
 static spinlock_t ivshmem_dev_lock = { .head = 0U, .tail = 0U, };
 
+/*
+ * The region sizes are powers of 2 of at least 2MB, laying them out from the
+ * largest one keeps each region aligned to its size within ivshmem_base, so
+ * that the EPT maps them with the largest pages their BARs allow.
+ */
 void init_ivshmem_shared_memory()
 {
-	uint32_t i;
+	uint32_t i, j;
+	uint64_t size, max_size = ~0UL;
 	uint64_t addr = hva2hpa(&ivshmem_base);
 
 	for (i = 0U; i < ARRAY_SIZE(mem_regions); i++) {
-		mem_regions[i].hpa = addr;
-		addr += mem_regions[i].size;
+		/* the largest size below the one placed last */
+		size = 0UL;
+		for (j = 0U; j < ARRAY_SIZE(mem_regions); j++) {
+			if ((mem_regions[j].size < max_size) && (mem_regions[j].size > size)) {
+				size = mem_regions[j].size;
+			}
+		}
+
+		for (j = 0U; j < ARRAY_SIZE(mem_regions); j++) {
+			if ((size != 0UL) && (mem_regions[j].size == size)) {
+				mem_regions[j].hpa = addr;
+				addr += size;
+			}
+		}
+		max_size = size;
 	}
 }
 
@@ -147,15 +169,17 @@ static void ivshmem_server_notify_peer(struct ivshmem_device *src_ivs_dev, uint1
 		if ((dest_ivs_dev != NULL) && vpci_vmsix_enabled(dest_ivs_dev->pcidev)
 			&& (vector_index < dest_ivs_dev->pcidev->msix.table_count)) {
 
+			spinlock_obtain(&dest_ivs_dev->lock);
 			entry = &(dest_ivs_dev->pcidev->msix.table_entries[vector_index]);
 			if ((entry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) {
 
 				dest_vm = vpci2vm(dest_ivs_dev->pcidev->vpci);
 				vlapic_inject_msi(dest_vm, entry->addr, entry->data);
 			} else {
-				pr_err("%s,target msix entry [%d] is masked.\n",
-					__func__, vector_index);
+				/* the peer polls with the vector masked, it gets the MSI on unmask */
+				bitmap_set_nolock(vector_index, &dest_ivs_dev->pending);
 			}
+			spinlock_release(&dest_ivs_dev->lock);
 		} else {
 			pr_err("%s,Invalid peer, ID = %d, vector index [%d] or MSI-X is disabled.\n",
 				__func__, dest_peer_id, vector_index);
@@ -174,6 +198,7 @@ static void create_ivshmem_device(struct pci_vdev *vdev)
 	for (i = 0U; i < IVSHMEM_DEV_NUM; i++) {
 		if (ivshmem_dev[i].pcidev == NULL) {
 			ivshmem_dev[i].pcidev = vdev;
+			ivshmem_dev[i].pending = 0UL;
 			vdev->priv_data = &ivshmem_dev[i];
 			break;
 		}
@@ -221,6 +246,43 @@ static int32_t ivshmem_mmio_handler(struct io_request *io_req, void *data)
 	return 0;
 }
 
+/*
+ * @brief Access the MSI-X table and PBA of an ivshmem device
+ *
+ * A doorbell rung while its vector was masked is kept pending, shown in the PBA,
+ * and delivered when the guest unmasks the vector.
+ *
+ * @pre vdev->priv_data != NULL
+ */
+static int32_t ivshmem_msix_mmio_handler(struct io_request *io_req, void *data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct pci_vdev *vdev = (struct pci_vdev *) data;
+	struct ivshmem_device *ivs_dev = (struct ivshmem_device *) vdev->priv_data;
+	uint64_t offset = mmio->address - vdev->msix.mmio_gpa;
+	struct msix_table_entry *entry;
+	uint32_t index;
+
+	spinlock_obtain(&ivs_dev->lock);
+	if ((mmio->direction == REQUEST_READ) && (offset == VMSIX_MAX_ENTRY_TABLE_SIZE) &&
+			((mmio->size == 4U) || (mmio->size == 8U))) {
+		mmio->value = ivs_dev->pending;
+	} else {
+		index = rw_vmsix_table(vdev, io_req);
+		if ((mmio->direction == REQUEST_WRITE) && (index < vdev->msix.table_count)) {
+			entry = &vdev->msix.table_entries[index];
+			if (((entry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) &&
+					bitmap_test_and_clear_nolock((uint16_t)index, &ivs_dev->pending) &&
+					vpci_vmsix_enabled(vdev)) {
+				vlapic_inject_msi(vpci2vm(vdev->vpci), entry->addr, entry->data);
+			}
+		}
+	}
+	spinlock_release(&ivs_dev->lock);
+
+	return 0;
+}
+
 static int32_t read_ivshmem_vdev_cfg(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t *val)
 {
 	*val = pci_vdev_read_vcfg(vdev, offset, bytes);
@@ -251,6 +313,10 @@ static void ivshmem_vbar_map(struct pci_vdev *vdev, uint32_t idx)
 	struct ivshmem_device *ivs_dev = (struct ivshmem_device *) vdev->priv_data;
 
 	if ((idx == IVSHMEM_SHM_BAR) && (vbar->base_hpa != INVALID_HPA) && (vbar->base_gpa != 0UL)) {
+		if (((vbar->base_gpa | vbar->base_hpa) & (PDE_SIZE - 1UL)) != 0UL) {
+			pr_warn("%s: region of %x:%x.%x not 2MB aligned, mapped with 4KB pages", __func__,
+				vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f);
+		}
 		ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vbar->base_hpa,
 				vbar->base_gpa, vbar->size, EPT_RD | EPT_WR | EPT_WB);
 	} else if ((idx == IVSHMEM_MMIO_BAR) && (vbar->base_gpa != 0UL)) {
@@ -259,7 +325,7 @@ static void ivshmem_vbar_map(struct pci_vdev *vdev, uint32_t idx)
 				(vbar->base_gpa + vbar->size), vdev, false);
 		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vbar->base_gpa, round_page_up(vbar->size));
 	} else if ((idx == IVSHMEM_MSIX_BAR) && (vbar->base_gpa != 0UL)) {
-		register_mmio_emulation_handler(vm, vmsix_handle_table_mmio_access, vbar->base_gpa,
+		register_mmio_emulation_handler(vm, ivshmem_msix_mmio_handler, vbar->base_gpa,
 			(vbar->base_gpa + vbar->size), vdev, false);
 		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vbar->base_gpa, vbar->size);
 		vdev->msix.mmio_gpa = vbar->base_gpa;
@@ -83,20 +83,35 @@ static void mask_one_msix_vector(const struct pci_vdev *vdev, uint32_t index)
 
 
 /**
+ * @brief Update the physical MSI-X entry after the guest wrote its virtual entry
+ *
+ * The IRTE is only updated when the address or data of the entry changed since it was
+ * last programmed. A guest masking and unmasking a vector, as some drivers do around
+ * each interrupt, just has its vector control written to the device.
+ *
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
  * @pre vdev->pdev != NULL
  */
-static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
+static void remap_one_vmsix_entry(struct pci_vdev *vdev, uint32_t index)
 {
 	const struct msix_table_entry *ventry;
 	struct msix_table_entry *pentry;
 	struct msi_info info = {};
 	int32_t ret;
 
-	mask_one_msix_vector(vdev, index);
 	ventry = &vdev->msix.table_entries[index];
-	if ((ventry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) {
+	if (bitmap_test((uint16_t)(index & 0x3fU), &vdev->msix.programmed[index >> 6U])) {
+		pentry = get_msix_table_entry(vdev, index);
+		stac();
+		mmio_write32(ventry->vector_control, (void *)&(pentry->vector_control));
+		clac();
+	} else {
+		mask_one_msix_vector(vdev, index);
+	}
+
+	if (((ventry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) &&
+			!bitmap_test((uint16_t)(index & 0x3fU), &vdev->msix.programmed[index >> 6U])) {
 		info.addr.full = vdev->msix.table_entries[index].addr;
 		info.data.full = vdev->msix.table_entries[index].data;
 
@@ -118,11 +133,34 @@ static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
 			mmio_write32(info.data.full, (void *)&(pentry->data));
 			mmio_write32(vdev->msix.table_entries[index].vector_control, (void *)&(pentry->vector_control));
 			clac();
+
+			bitmap_set_nolock((uint16_t)(index & 0x3fU), &vdev->msix.programmed[index >> 6U]);
 		}
 	}
 
 }
 
+/**
+ * @brief Access the PBA or the registers of the device sharing the pages of the MSI-X table
+ *
+ * @pre vdev != NULL
+ * @pre (mmio->size == 4U) || (mmio->size == 8U)
+ */
+static void rw_pt_msix_page(const struct pci_vdev *vdev, struct mmio_request *mmio, uint64_t offset)
+{
+	void *hva = hpa2hva(vdev->msix.mmio_hpa + offset);
+
+	stac();
+	if (mmio->direction == REQUEST_READ) {
+		mmio->value = (mmio->size == 4U) ? (uint64_t)mmio_read32(hva) : mmio_read64(hva);
+	} else if (mmio->size == 4U) {
+		mmio_write32((uint32_t)mmio->value, hva);
+	} else {
+		mmio_write64(mmio->value, hva);
+	}
+	clac();
+}
+
 /**
  * @pre io_req != NULL
  * @pre priv_data != NULL
@@ -131,18 +169,31 @@ static int32_t pt_vmsix_handle_table_mmio_access(struct io_request *io_req, void
 {
 	struct mmio_request *mmio = &io_req->reqs.mmio;
 	struct pci_vdev *vdev;
+	uint64_t offset;
 	uint32_t index;
 	int32_t ret = 0;
 
 	vdev = (struct pci_vdev *)priv_data;
 	if (vdev->user == vdev) {
-		index = rw_vmsix_table(vdev, io_req);
+		offset = mmio->address - vdev->msix.mmio_gpa;
 
-		if ((mmio->direction == REQUEST_WRITE) && (index < vdev->msix.table_count)) {
-			if (vdev->msix.is_vmsix_on_msi) {
-				remap_one_vmsix_entry_on_msi(vdev, index);
-			} else {
-				remap_one_vmsix_entry(vdev, index);
+		if (!vdev->msix.is_vmsix_on_msi && !msixtable_access(vdev, (uint32_t)offset) &&
+				((mmio->size == 4U) || (mmio->size == 8U)) && (offset < vdev->msix.mmio_size)) {
+			rw_pt_msix_page(vdev, mmio, offset);
+		} else {
+			index = rw_vmsix_table(vdev, io_req);
+
+			if ((mmio->direction == REQUEST_WRITE) && (index < vdev->msix.table_count)) {
+				if (vdev->msix.is_vmsix_on_msi) {
+					remap_one_vmsix_entry_on_msi(vdev, index);
+				} else {
+					/* a new address or data has to go through the IRTE on the next unmask */
+					if (((offset - vdev->msix.table_offset) % MSIX_TABLE_ENTRY_SIZE) < 12U) {
+						bitmap_clear_nolock((uint16_t)(index & 0x3fU),
+							&vdev->msix.programmed[index >> 6U]);
+					}
+					remap_one_vmsix_entry(vdev, index);
+				}
 			}
 		}
 	} else {
@@ -168,6 +219,7 @@ static void vdev_pt_unmap_msix(struct pci_vdev *vdev)
 		msix->table_entries[i].addr = 0U;
 		msix->table_entries[i].data = 0U;
 	}
+	reset_vmsix_programmed(vdev);
 
 	if (msix->mmio_gpa != 0UL) {
 		addr_lo = msix->mmio_gpa + msix->table_offset;
@@ -232,15 +284,25 @@ static void vdev_pt_unmap_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
 static void vdev_pt_map_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
 {
 	struct pci_vbar *vbar = &vdev->vbars[idx];
+	uint64_t mem_type = EPT_UNCACHED;
 
 	if (vbar->base_gpa != 0UL) {
 		struct acrn_vm *vm = vpci2vm(vdev->vpci);
 
+		/*
+		 * A prefetchable BAR may be mapped write-combining when the DM asks for it:
+		 * guest mappings with a UC PAT type stay UC, the others become WC.
+		 * ept_add_mr() uses 2M/1G pages wherever the BAR alignment allows.
+		 */
+		if (((vdev->wc_bars & (1U << idx)) != 0U) && (vbar->bar_type.mem_space.prefetchable == 1U)) {
+			mem_type = EPT_WC;
+		}
+
 		ept_add_mr(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
 			vbar->base_hpa, /* HPA (pbar) */
 			vbar->base_gpa, /* GPA (new vbar) */
 			vbar->size,
-			EPT_WR | EPT_RD | EPT_UNCACHED);
+			EPT_WR | EPT_RD | mem_type);
 	}
 
 	if (has_msix_cap(vdev) && (idx == vdev->msix.table_bar)) {
@@ -467,6 +529,7 @@ void deinit_vmsix_pt(struct pci_vdev *vdev)
 		if (vdev->msix.table_count != 0U) {
 			ptirq_remove_msix_remapping(vpci2vm(vdev->vpci), vdev->pdev->bdf.value, vdev->msix.table_count);
 			(void)memset((void *)&vdev->msix.table_entries, 0U, sizeof(vdev->msix.table_entries));
+			reset_vmsix_programmed(vdev);
 			vdev->msix.is_vmsix_on_msi_programmed = false;
 		}
 	}
@@ -487,6 +550,78 @@ void vdev_pt_hide_sriov_cap(struct pci_vdev *vdev)
 
 	pr_acrnlog("Hide sriov cap for %02x:%02x.%x", vdev->pdev->bdf.bits.b, vdev->pdev->bdf.bits.d, vdev->pdev->bdf.bits.f);
 }
+/*
+ * @pre vdev != NULL
+ * @pre vdev->pdev != NULL
+ * @pre offset < PCIE_CONFIG_SPACE_SIZE
+ */
+static void shadow_pt_cfg_dword(struct pci_vdev *vdev, uint32_t offset)
+{
+	pci_vdev_write_vcfg(vdev, offset, 4U, pci_pdev_read_cfg(vdev->pdev->bdf, offset, 4U));
+	bitmap32_set_nolock((uint16_t)((offset >> 2U) & 0x1fU), &vdev->cfg_shadow[offset >> 7U]);
+}
+
+/*
+ * @brief Copy the read-only registers of the capabilities of a passthrough device
+ *
+ * Outside the header, MSI, MSI-X and SR-IOV capabilities, which are emulated, the config
+ * accesses of a passthrough device go to the device. Only the dwords made of read-only,
+ * hardware initialized fields are copied here and then read from the vdev: the capability
+ * headers of Power Management, PCI Express and Advanced Features, the capability registers
+ * of PCI Express and the extended capability headers. The control and status registers,
+ * which the guests poll, still go to the device, as do writes.
+ *
+ * @pre vdev != NULL
+ * @pre vdev->pdev != NULL
+ */
+static void init_vdev_pt_cfg_shadow(struct pci_vdev *vdev)
+{
+	union pci_bdf pbdf = vdev->pdev->bdf;
+	uint32_t pos, hdr, cap, loops, version;
+
+	(void)memset((void *)vdev->cfg_shadow, 0U, sizeof(vdev->cfg_shadow));
+
+	/* a capability is at least 4 bytes long, it bounds the walk of a broken list */
+	pos = pci_pdev_read_cfg(pbdf, PCIR_CAP_PTR, 1U) & PCI_REGMASK;
+	for (loops = 0U; (loops < ((PCI_CONFIG_SPACE_SIZE - PCI_CFG_HEADER_LENGTH) >> 2U)) &&
+			(pos >= PCI_CFG_HEADER_LENGTH); loops++) {
+		hdr = pci_pdev_read_cfg(pbdf, pos, 4U);
+		cap = hdr & 0xffU;
+
+		if ((cap == PCIY_PMC) || (cap == PCIY_AF)) {
+			shadow_pt_cfg_dword(vdev, pos);
+		} else if (cap == PCIY_PCIE) {
+			shadow_pt_cfg_dword(vdev, pos);
+			shadow_pt_cfg_dword(vdev, pos + PCIR_PCIE_DEVCAP);
+			shadow_pt_cfg_dword(vdev, pos + PCIR_PCIE_LINKCAP);
+			shadow_pt_cfg_dword(vdev, pos + PCIR_PCIE_SLOTCAP);
+			version = (hdr >> 16U) & PCIEM_FLAGS_VERSION;
+			if (version >= 2U) {
+				shadow_pt_cfg_dword(vdev, pos + PCIR_PCIE_DEVCAP2);
+				shadow_pt_cfg_dword(vdev, pos + PCIR_PCIE_LINKCAP2);
+				shadow_pt_cfg_dword(vdev, pos + PCIR_PCIE_SLOTCAP2);
+			}
+		} else {
+			/* the other capabilities are emulated or have writable fields in their first dword */
+		}
+
+		pos = (hdr >> 8U) & PCI_REGMASK;
+	}
+
+	if (vdev->pdev->pcie_capoff != 0U) {
+		pos = PCI_ECAP_BASE_PTR;
+		for (loops = 0U; (loops < ((PCIE_CONFIG_SPACE_SIZE - PCI_ECAP_BASE_PTR) >> 2U)) &&
+				(pos >= PCI_ECAP_BASE_PTR); loops++) {
+			hdr = pci_pdev_read_cfg(pbdf, pos, 4U);
+			if ((hdr == 0U) || (hdr == ~0U)) {
+				break;
+			}
+			shadow_pt_cfg_dword(vdev, pos);
+			pos = PCI_ECAP_NEXT(hdr);
+		}
+	}
+}
+
 /*
  * @brief Initialize a specified passthrough vdev structure.
  *
@@ -546,6 +681,8 @@ void init_vdev_pt(struct pci_vdev *vdev, bool is_pf_vdev)
 		}
 	}
 
+	init_vdev_pt_cfg_shadow(vdev);
+
 	if (!is_sos_vm(vpci2vm(vdev->vpci)) && (has_sriov_cap(vdev))) {
 		vdev_pt_hide_sriov_cap(vdev);
 	}
@@ -17,8 +17,10 @@
 
 /*
  * @pre vdev != NULL
+ *
+ * @return true if the MSI was injected
  */
-void trigger_vmcs9900_msix(struct pci_vdev *vdev)
+bool trigger_vmcs9900_msix(struct pci_vdev *vdev)
 {
 	struct acrn_vm *vm = vpci2vm(vdev->vpci);
 	int32_t ret = -1;
@@ -30,6 +32,8 @@ void trigger_vmcs9900_msix(struct pci_vdev *vdev)
 		pr_warn("%2x:%2x.%dfaild injecting msi msi_addr:0x%lx msi_data:0x%x",
 				vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f, entry->addr, entry->data);
 	}
+
+	return (ret == 0);
 }
 
 static int32_t read_vmcs9900_cfg(const struct pci_vdev *vdev,
@@ -51,7 +55,13 @@ static int32_t vmcs9900_mmio_handler(struct io_request *io_req, void *data)
 
 	offset = mmio->address - vbar->base_gpa;
 
-	if (mmio->direction == REQUEST_READ) {
+	if (offset >= VUART_BURST_ID_REG) {
+		if (mmio->direction == REQUEST_READ) {
+			mmio->value = vuart_read_burst_reg(vu, offset);
+		} else {
+			vuart_write_burst_reg(vu, offset, (uint32_t)mmio->value);
+		}
+	} else if (mmio->direction == REQUEST_READ) {
 		mmio->value = vuart_read_reg(vu, offset);
 	} else {
 		vuart_write_reg(vu, offset, (uint8_t) mmio->value);
@@ -69,6 +79,12 @@ static void map_vmcs9900_vbar(struct pci_vdev *vdev, uint32_t idx)
 		register_mmio_emulation_handler(vm, vmcs9900_mmio_handler,
 			vbar->base_gpa, vbar->base_gpa + vbar->size, vdev, false);
 		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vbar->base_gpa, vbar->size);
+		/* only the register page traps, the burst window is memory */
+		if (vu->burst != NULL) {
+			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, hva2hpa(vu->burst),
+				vbar->base_gpa + VUART_BURST_CTRL_OFFSET, sizeof(struct vuart_burst_window),
+				EPT_RD | EPT_WR | EPT_WB);
+		}
 		vu->active = true;
 	} else if ((idx == MCS9900_MSIX_BAR) && (vbar->base_gpa != 0UL)) {
 		register_mmio_emulation_handler(vm, vmsix_handle_table_mmio_access, vbar->base_gpa,
@@ -87,6 +103,10 @@ static void unmap_vmcs9900_vbar(struct pci_vdev *vdev, uint32_t idx)
 
 	if ((idx == MCS9900_MMIO_BAR) && (vbar->base_gpa != 0UL)) {
 		vu->active = false;
+		if (vu->burst != NULL) {
+			ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+				vbar->base_gpa + VUART_BURST_CTRL_OFFSET, sizeof(struct vuart_burst_window));
+		}
 	}
 	unregister_mmio_emulation_handler(vm, vbar->base_gpa, vbar->base_gpa + vbar->size);
 }
@@ -125,9 +145,12 @@ static void init_vmcs9900(struct pci_vdev *vdev)
 
 	add_vmsix_capability(vdev, 1, MCS9900_MSIX_BAR);
 
-	/* initialize vuart-pci mem bar */
+	/* initialize vuart-pci mem bar, with a burst window if its base allows one */
 	mmio_vbar->size = 0x1000U;
 	mmio_vbar->base_gpa = pci_cfg->vbar_base[MCS9900_MMIO_BAR];
+	if (((mmio_vbar->base_gpa & (VUART_BURST_BAR_SIZE - 1UL)) == 0UL) && (vuart_alloc_burst(vu) != NULL)) {
+		mmio_vbar->size = VUART_BURST_BAR_SIZE;
+	}
 	mmio_vbar->mask = (uint32_t) (~(mmio_vbar->size - 1UL));
 	mmio_vbar->bar_type.bits = PCIM_BAR_MEM_32;
 
@@ -152,7 +175,17 @@ static void init_vmcs9900(struct pci_vdev *vdev)
 
 static void deinit_vmcs9900(struct pci_vdev *vdev)
 {
+	struct acrn_vuart *vu = vdev->priv_data;
+	struct acrn_vm *vm = vpci2vm(vdev->vpci);
+	struct pci_vbar *vbar = &vdev->vbars[MCS9900_MMIO_BAR];
+
 	deinit_pci_vuart(vdev);
+	/* the window may be given to another VM next */
+	if ((vu->burst != NULL) && (vbar->base_gpa != 0UL)) {
+		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+			vbar->base_gpa + VUART_BURST_CTRL_OFFSET, sizeof(struct vuart_burst_window));
+	}
+	vuart_free_burst(vu);
 	vdev->user = NULL;
 }
 
@@ -42,9 +42,11 @@
 
 
 static void vpci_init_vdevs(struct acrn_vm *vm);
-static int32_t vpci_read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf, uint32_t offset, uint32_t bytes, uint32_t *val);
-static int32_t vpci_write_cfg(struct acrn_vpci *vpci, union pci_bdf bdf, uint32_t offset, uint32_t bytes, uint32_t val);
-static struct pci_vdev *find_available_vdev(struct acrn_vpci *vpci, union pci_bdf bdf);
+static int32_t vpci_read_cfg(struct acrn_vpci *vpci, struct vpci_cfg_cache *cache, union pci_bdf bdf,
+	uint32_t offset, uint32_t bytes, uint32_t *val);
+static int32_t vpci_write_cfg(struct acrn_vpci *vpci, struct vpci_cfg_cache *cache, union pci_bdf bdf,
+	uint32_t offset, uint32_t bytes, uint32_t val);
+static struct pci_vdev *find_available_vdev(struct acrn_vpci *vpci, struct vpci_cfg_cache *cache, union pci_bdf bdf);
 
 /**
  * @pre vcpu != NULL
@@ -88,7 +90,7 @@ static bool vpci_pio_cfgaddr_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t
 			const struct pci_vdev *vdev;
 
 			vbdf.value = cfg_addr->bits.bdf;
-			vdev = find_available_vdev(vpci, vbdf);
+			vdev = find_available_vdev(vpci, &vpci->cfg_cache[vcpu->vcpu_id], vbdf);
 			/* For post-launched VM, ACRN HV will only handle PT device,
 			 * all virtual PCI device and QUIRK PT device
 			 * still need to deliver to ACRN DM to handle.
@@ -127,7 +129,8 @@ static bool vpci_pio_cfgdata_read(struct acrn_vcpu *vcpu, uint16_t addr, size_t
 	if (cfg_addr.bits.enable != 0U) {
 		if (pci_is_valid_access(cfg_addr.bits.reg_num + offset, bytes)) {
 			bdf.value = cfg_addr.bits.bdf;
-			ret = vpci_read_cfg(vpci, bdf, cfg_addr.bits.reg_num + offset, bytes, &val);
+			ret = vpci_read_cfg(vpci, &vpci->cfg_cache[vcpu->vcpu_id], bdf,
+				cfg_addr.bits.reg_num + offset, bytes, &val);
 		}
 	}
 
@@ -158,7 +161,8 @@ static bool vpci_pio_cfgdata_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t
 	if (cfg_addr.bits.enable != 0U) {
 		if (pci_is_valid_access(cfg_addr.bits.reg_num + offset, bytes)) {
 			bdf.value = cfg_addr.bits.bdf;
-			ret = vpci_write_cfg(vpci, bdf, cfg_addr.bits.reg_num + offset, bytes, val);
+			ret = vpci_write_cfg(vpci, &vpci->cfg_cache[vcpu->vcpu_id], bdf,
+				cfg_addr.bits.reg_num + offset, bytes, val);
 		}
 	}
 
@@ -193,9 +197,9 @@ static int32_t vpci_mmio_cfg_access(struct io_request *io_req, void *private_dat
 	bdf.value = (uint16_t)((address - pci_mmcofg_base) >> 12U);
 
 	if (mmio->direction == REQUEST_READ) {
-		ret = vpci_read_cfg(vpci, bdf, reg_num, (uint32_t)mmio->size, (uint32_t *)&mmio->value);
+		ret = vpci_read_cfg(vpci, NULL, bdf, reg_num, (uint32_t)mmio->size, (uint32_t *)&mmio->value);
 	} else {
-		ret = vpci_write_cfg(vpci, bdf, reg_num, (uint32_t)mmio->size, (uint32_t)mmio->value);
+		ret = vpci_write_cfg(vpci, NULL, bdf, reg_num, (uint32_t)mmio->size, (uint32_t)mmio->value);
 	}
 
 	return ret;
@@ -241,6 +245,9 @@ void init_vpci(struct acrn_vm *vm)
 		vm->vpci.res64.end = UOS_VIRT_PCI_MEMLIMIT64;
 	}
 
+	/* a zeroed cfg_cache entry never matches */
+	vm->vpci.gen = 1U;
+
 	/* Build up vdev list for vm */
 	vpci_init_vdevs(vm);
 
@@ -340,16 +347,34 @@ static void remove_vdev_pt_iommu_domain(const struct pci_vdev *vdev)
  *        If the vdev's vpci is NULL, the vdev is a orphan/zombie instance, it can't
  *        be accessed by any vpci.
  *
- * @param vpci Pointer to a specified vpci structure
- * @param bdf  Indicate the vdev's BDF
+ *        The BDF lookup is skipped when the vCPU addresses the same BDF again and
+ *        no vdev was added or moved since, as for the CFCh accesses following a
+ *        CF8h write or the config space of a device being read dword by dword.
+ *
+ * @param vpci  Pointer to a specified vpci structure
+ * @param cache Pointer to the lookup cache of the accessing vCPU, NULL for none
+ * @param bdf   Indicate the vdev's BDF
  *
  * @pre vpci != NULL
  *
  * @return Return a available vdev instance, otherwise return NULL
  */
-static struct pci_vdev *find_available_vdev(struct acrn_vpci *vpci, union pci_bdf bdf)
+static struct pci_vdev *find_available_vdev(struct acrn_vpci *vpci, struct vpci_cfg_cache *cache, union pci_bdf bdf)
 {
-	struct pci_vdev *vdev = pci_find_vdev(vpci, bdf);
+	struct pci_vdev *vdev;
+	uint32_t gen = vpci->gen;
+
+	if ((cache != NULL) && (cache->gen == gen) && (cache->bdf.value == bdf.value)) {
+		vdev = cache->vdev;
+	} else {
+		vdev = pci_find_vdev(vpci, bdf);
+		if (cache != NULL) {
+			cache->bdf = bdf;
+			cache->vdev = vdev;
+			/* the gen read before the lookup, so a concurrent change drops the entry */
+			cache->gen = gen;
+		}
+	}
 
 	if ((vdev != NULL) && (vdev->user != vdev)) {
 		if (vdev->user != NULL) {
@@ -507,6 +532,8 @@ static int32_t write_pt_dev_cfg(struct pci_vdev *vdev, uint32_t offset,
 			if (!is_quirk_ptdev(vdev)) {
 				/* passthru to physical device */
 				pci_pdev_write_cfg(vdev->pdev->bdf, offset, bytes, val);
+				/* it may be an FLR or a power state change, which reset the MSI-X table */
+				reset_vmsix_programmed(vdev);
 			} else {
 				ret = -ENODEV;
 			}
@@ -531,8 +558,13 @@ static int32_t read_pt_dev_cfg(const struct pci_vdev *vdev, uint32_t offset,
 		if ((offset == vdev->pdev->sriov.pre_pos) && (vdev->pdev->sriov.hide_sriov)) {
 			*val = pci_vdev_read_vcfg(vdev, offset, bytes);
 		} else if (!is_quirk_ptdev(vdev)) {
-			/* passthru to physical device */
-			*val = pci_pdev_read_cfg(vdev->pdev->bdf, offset, bytes);
+			if (is_cfg_shadowed(vdev, offset)) {
+				/* read-only register of the physical device, copied at init */
+				*val = pci_vdev_read_vcfg(vdev, offset, bytes);
+			} else {
+				/* passthru to physical device */
+				*val = pci_pdev_read_cfg(vdev->pdev->bdf, offset, bytes);
+			}
 		} else {
 			ret = -ENODEV;
 		}
@@ -549,16 +581,43 @@ static const struct pci_vdev_ops pci_pt_dev_ops = {
 };
 
 /**
+ * @brief Check whether a physical device is passed through to the VM
+ *
+ * Read without the vPCI lock: a device assigned meanwhile may be missed.
+ *
  * @pre vpci != NULL
  */
-static int32_t vpci_read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
+bool vpci_has_ptdev(const struct acrn_vpci *vpci)
+{
+	const struct pci_vdev *vdev;
+	uint32_t i;
+	bool found = false;
+
+	for (i = 0U; i < vpci->pci_vdev_cnt; i++) {
+		vdev = &vpci->pci_vdevs[i];
+		if ((vdev->vdev_ops == &pci_pt_dev_ops) && (vdev->user == vdev)) {
+			found = true;
+			break;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * @pre vpci != NULL
+ */
+static int32_t vpci_read_cfg(struct acrn_vpci *vpci, struct vpci_cfg_cache *cache, union pci_bdf bdf,
 	uint32_t offset, uint32_t bytes, uint32_t *val)
 {
 	int32_t ret = 0;
 	struct pci_vdev *vdev;
 
 	spinlock_obtain(&vpci->lock);
-	vdev = find_available_vdev(vpci, bdf);
+	vdev = find_available_vdev(vpci, cache, bdf);
+	if ((vdev == NULL) && (vpci->nr_lazy_vf_pfs != 0U)) {
+		vdev = vsriov_get_lazy_vf(vpci, bdf);
+	}
 	if (vdev != NULL) {
 		ret = vdev->vdev_ops->read_vdev_cfg(vdev, offset, bytes, val);
 	} else {
@@ -578,14 +637,17 @@ static int32_t vpci_read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 /**
  * @pre vpci != NULL
  */
-static int32_t vpci_write_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
+static int32_t vpci_write_cfg(struct acrn_vpci *vpci, struct vpci_cfg_cache *cache, union pci_bdf bdf,
 	uint32_t offset, uint32_t bytes, uint32_t val)
 {
 	int32_t ret = 0;
 	struct pci_vdev *vdev;
 
 	spinlock_obtain(&vpci->lock);
-	vdev = find_available_vdev(vpci, bdf);
+	vdev = find_available_vdev(vpci, cache, bdf);
+	if ((vdev == NULL) && (vpci->nr_lazy_vf_pfs != 0U)) {
+		vdev = vsriov_get_lazy_vf(vpci, bdf);
+	}
 	if (vdev != NULL) {
 		ret = vdev->vdev_ops->write_vdev_cfg(vdev, offset, bytes, val);
 	} else {
@@ -633,6 +695,7 @@ struct pci_vdev *vpci_init_vdev(struct acrn_vpci *vpci, struct acrn_vm_pci_dev_c
 	vdev->phyfun = parent_pf_vdev;
 
 	hlist_add_head(&vdev->link, &vpci->vdevs_hlist_heads[hash64(dev_config->vbdf.value, VDEV_LIST_HASHBITS)]);
+	vpci->gen++;
 	if (dev_config->vdev_ops != NULL) {
 		vdev->vdev_ops = dev_config->vdev_ops;
 	} else {
@@ -683,6 +746,10 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_assign_pcidev *pc
 	sos_vm = get_sos_vm();
 	spinlock_obtain(&sos_vm->vpci.lock);
 	vdev_in_sos = pci_find_vdev(&sos_vm->vpci, bdf);
+	if (((vdev_in_sos == NULL) || is_zombie_vf(vdev_in_sos)) && (sos_vm->vpci.nr_lazy_vf_pfs != 0U)) {
+		/* a VF SOS has not accessed yet */
+		vdev_in_sos = vsriov_get_lazy_vf(&sos_vm->vpci, bdf);
+	}
 	if ((vdev_in_sos != NULL) && (vdev_in_sos->user == vdev_in_sos) &&
 			(vdev_in_sos->pdev != NULL) &&
 			!is_host_bridge(vdev_in_sos->pdev) && !is_bridge(vdev_in_sos->pdev)) {
@@ -718,10 +785,12 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_assign_pcidev *pc
 		}
 
 		vdev->flags |= pcidev->type;
+		vdev->wc_bars = pcidev->wc_bars;
 		vdev->bdf.value = pcidev->virt_bdf;
 		/*We should re-add the vdev to hashlist since its vbdf has changed */
 		hlist_del(&vdev->link);
 		hlist_add_head(&vdev->link, &vpci->vdevs_hlist_heads[hash64(vdev->bdf.value, VDEV_LIST_HASHBITS)]);
+		vpci->gen++;
 		vdev->parent_user = vdev_in_sos;
 		spinlock_release(&tgt_vm->vpci.lock);
 		vdev_in_sos->user = vdev;
@@ -129,6 +129,25 @@ static inline bool msicap_access(const struct pci_vdev *vdev, uint32_t offset)
 	return (has_msi_cap(vdev) && in_range(offset, vdev->msi.capoff, vdev->msi.caplen));
 }
 
+/**
+ * @brief Make the next unmask of each MSI-X entry program the IRTE and the device again
+ *
+ * @pre vdev != NULL
+ */
+static inline void reset_vmsix_programmed(struct pci_vdev *vdev)
+{
+	(void)memset((void *)vdev->msix.programmed, 0U, sizeof(vdev->msix.programmed));
+}
+
+/**
+ * @pre vdev != NULL
+ */
+static inline bool is_cfg_shadowed(const struct pci_vdev *vdev, uint32_t offset)
+{
+	return ((offset < PCIE_CONFIG_SPACE_SIZE) &&
+		bitmap32_test((uint16_t)((offset >> 2U) & 0x1fU), &vdev->cfg_shadow[offset >> 7U]));
+}
+
 /**
  * @brief Check if the specified vdev is a zombie VF instance
  *
@@ -169,6 +188,7 @@ void init_vsriov(struct pci_vdev *vdev);
 void read_sriov_cap_reg(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t *val);
 void write_sriov_cap_reg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val);
 uint32_t sriov_bar_offset(const struct pci_vdev *vdev, uint32_t bar_idx);
+struct pci_vdev *vsriov_get_lazy_vf(struct acrn_vpci *vpci, union pci_bdf bdf);
 
 uint32_t pci_vdev_read_vcfg(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes);
 void pci_vdev_write_vcfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val);
@@ -33,6 +33,7 @@
 #include <asm/pci_dev.h>
 #include <logmsg.h>
 #include <delay.h>
+#include <ticks.h>
 
 #include "vpci_priv.h"
 
@@ -148,11 +149,6 @@ static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t v
  */
 static void enable_vfs(struct pci_vdev *pf_vdev)
 {
-	union pci_bdf vf_bdf;
-	uint16_t idx;
-	uint16_t sub_vid = 0U;
-	uint16_t num_vfs, stride, fst_off;
-
 	/* Confirm that the physical VF_ENABLE register has been set successfully */
 	ASSERT(is_vf_enabled(pf_vdev), "VF_ENABLE was not set successfully on the hardware");
 
@@ -175,52 +171,150 @@ static void enable_vfs(struct pci_vdev *pf_vdev)
 	 *    by system software/firmware.
 	 *
 	 * Curerntly, we use the first way to wait for VF physical devices to be ready.
+	 *
+	 * Creating all the VFs here would hold the vCPU writing VF Enable for the
+	 * 100ms and then for the init of every VF. Instead, each VF vdev is
+	 * created on the first config access to it, which any driver of the VF
+	 * does before it touches its BARs; this also finds the MSI-X table
+	 * before the guest can program it. The guest has to wait for the VFs
+	 * anyway, so the first access seldom waits.
 	 */
-	udelay (100U * 1000U);
+	pf_vdev->sriov.fst_vf_off = read_sriov_reg(pf_vdev, PCIR_SRIOV_FST_VF_OFF);
+	pf_vdev->sriov.vf_stride = read_sriov_reg(pf_vdev, PCIR_SRIOV_VF_STRIDE);
+	pf_vdev->sriov.vf_ready_tsc = cpu_ticks() + us_to_ticks(100U * 1000U);
+	pf_vdev->sriov.vfs_checked = false;
+	if (pf_vdev->sriov.num_vfs == 0U) {
+		pf_vdev->vpci->nr_lazy_vf_pfs++;
+	}
+	pf_vdev->sriov.num_vfs = read_sriov_reg(pf_vdev, PCIR_SRIOV_NUMVFS);
+}
 
-	/*
-	 * Due to VF's DEVICE ID and VENDOR ID are 0xFFFF, so check if VF physical
-	 * device has been created by the value of SUBSYSTEM VENDOR ID.
-	 * To check if all enabled VFs are ready, just check the first VF already exists,
-	 * do not need to check all.
-	 */
-	fst_off = read_sriov_reg(pf_vdev, PCIR_SRIOV_FST_VF_OFF);
-	stride = read_sriov_reg(pf_vdev, PCIR_SRIOV_VF_STRIDE);
-	vf_bdf.fields.bus = get_vf_bus(pf_vdev, fst_off, stride, 0U);
-	vf_bdf.fields.devfun = get_vf_devfun(pf_vdev, fst_off, stride, 0U);
-	sub_vid = (uint16_t) pci_pdev_read_cfg(vf_bdf, PCIV_SUB_VENDOR_ID, 2U);
-	if ((sub_vid != 0xFFFFU) && (sub_vid != 0U)) {
-		struct pci_vdev *vf_vdev;
+/**
+ * @pre pf_vdev != NULL
+ */
+static void stop_lazy_vfs(struct pci_vdev *pf_vdev)
+{
+	if (pf_vdev->sriov.num_vfs != 0U) {
+		pf_vdev->sriov.num_vfs = 0U;
+		pf_vdev->vpci->nr_lazy_vf_pfs--;
+	}
+}
+
+/**
+ * @pre pf_vdev != NULL
+ *
+ * @return true if the VF physical devices are ready.
+ */
+static bool wait_vfs_ready(struct pci_vdev *pf_vdev)
+{
+	union pci_bdf vf_bdf;
+	uint16_t sub_vid;
+	uint64_t now = cpu_ticks();
+
+	if (!pf_vdev->sriov.vfs_checked) {
+		if (now < pf_vdev->sriov.vf_ready_tsc) {
+			udelay((uint32_t)ticks_to_us(pf_vdev->sriov.vf_ready_tsc - now));
+		}
+
+		/*
+		 * Due to VF's DEVICE ID and VENDOR ID are 0xFFFF, so check if VF physical
+		 * device has been created by the value of SUBSYSTEM VENDOR ID.
+		 * To check if all enabled VFs are ready, just check the first VF already exists,
+		 * do not need to check all.
+		 */
+		vf_bdf.fields.bus = get_vf_bus(pf_vdev, pf_vdev->sriov.fst_vf_off, pf_vdev->sriov.vf_stride, 0U);
+		vf_bdf.fields.devfun = get_vf_devfun(pf_vdev, pf_vdev->sriov.fst_vf_off, pf_vdev->sriov.vf_stride, 0U);
+		sub_vid = (uint16_t) pci_pdev_read_cfg(vf_bdf, PCIV_SUB_VENDOR_ID, 2U);
+		if ((sub_vid != 0xFFFFU) && (sub_vid != 0U)) {
+			pf_vdev->sriov.vfs_checked = true;
+		} else {
+			/*
+			 * If the VF physical device was not created successfully, the pdev/vdev
+			 * will also not be created so that SOS can aware of VF creation failure,
+			 */
+			pr_err("PF %x:%x.%x can't create VFs after 100 ms",
+				pf_vdev->bdf.bits.b, pf_vdev->bdf.bits.d, pf_vdev->bdf.bits.f);
+			stop_lazy_vfs(pf_vdev);
+		}
+	}
+
+	return pf_vdev->sriov.vfs_checked;
+}
 
-		num_vfs = read_sriov_reg(pf_vdev, PCIR_SRIOV_NUMVFS);
-		for (idx = 0U; idx < num_vfs; idx++) {
-			vf_bdf.fields.bus = get_vf_bus(pf_vdev, fst_off, stride, idx);
-			vf_bdf.fields.devfun = get_vf_devfun(pf_vdev, fst_off, stride, idx);
+/**
+ * @pre pf_vdev != NULL
+ *
+ * @return the index of the VF of @p pf_vdev at @p bdf, num_vfs if none.
+ */
+static uint16_t get_vf_id(const struct pci_vdev *pf_vdev, union pci_bdf bdf)
+{
+	uint32_t first = (uint32_t)pf_vdev->bdf.value + pf_vdev->sriov.fst_vf_off;
+	uint32_t stride = pf_vdev->sriov.vf_stride;
+	uint32_t off;
+	uint16_t vf_id = pf_vdev->sriov.num_vfs;
+
+	if ((uint32_t)bdf.value >= first) {
+		off = (uint32_t)bdf.value - first;
+		if (off == 0U) {
+			vf_id = 0U;
+		} else if ((stride != 0U) && ((off % stride) == 0U) && ((off / stride) < pf_vdev->sriov.num_vfs)) {
+			vf_id = (uint16_t)(off / stride);
+		} else {
+			/* not a VF of this PF */
+		}
+	}
+
+	return vf_id;
+}
+
+/**
+ * @brief Create the vdev of a VF enabled but not accessed yet
+ *
+ * @pre vpci != NULL
+ * @pre vpci->lock is held
+ *
+ * @return the VF vdev at @p bdf, NULL if @p bdf is not such a VF.
+ */
+struct pci_vdev *vsriov_get_lazy_vf(struct acrn_vpci *vpci, union pci_bdf bdf)
+{
+	struct pci_vdev *pf_vdev, *vf_vdev = NULL;
+	uint32_t idx;
+	uint16_t vf_id;
+
+	for (idx = 0U; (vpci->nr_lazy_vf_pfs != 0U) && (idx < vpci->pci_vdev_cnt); idx++) {
+		pf_vdev = &vpci->pci_vdevs[idx];
+		if ((pf_vdev->phyfun != NULL) || !has_sriov_cap(pf_vdev) || (pf_vdev->sriov.num_vfs == 0U)) {
+			continue;
+		}
 
+		vf_id = get_vf_id(pf_vdev, bdf);
+		if ((vf_id < pf_vdev->sriov.num_vfs) && wait_vfs_ready(pf_vdev)) {
 			/*
 			 * If one VF has never been created then create new one including pdev/vdev structures.
 			 *
 			 * The VF maybe have already existed but it is a zombie instance that vf_vdev->vpci
 			 * is NULL, in this case, we need to make the vf_vdev available again in here.
 			 */
-			vf_vdev = pci_find_vdev(&vpci2vm(pf_vdev->vpci)->vpci, vf_bdf);
+			vf_vdev = pci_find_vdev(vpci, bdf);
 			if (vf_vdev == NULL) {
-				create_vf(pf_vdev, vf_bdf, idx);
-			} else {
-				/* Re-activate a zombie VF */
-				if (is_zombie_vf(vf_vdev)) {
-					vf_vdev->vdev_ops->init_vdev(vf_vdev);
+				create_vf(pf_vdev, bdf, vf_id);
+				vf_vdev = pci_find_vdev(vpci, bdf);
+				if (!is_vf_enabled(pf_vdev)) {
+					/* create_vf() failed and cleared VF_ENABLE */
+					stop_lazy_vfs(pf_vdev);
 				}
+			} else if (is_zombie_vf(vf_vdev)) {
+				/* Re-activate a zombie VF */
+				vf_vdev->vdev_ops->init_vdev(vf_vdev);
+			} else {
+				/* in use, e.g. assigned to a UOS */
+				vf_vdev = NULL;
 			}
+			break;
 		}
-	} else {
-		/*
-		 * If the VF physical device was not created successfully, the pdev/vdev
-		 * will also not be created so that SOS can aware of VF creation failure,
-		 */
-		pr_err("PF %x:%x.%x can't create VFs after 100 ms",
-			pf_vdev->bdf.bits.b, pf_vdev->bdf.bits.d, pf_vdev->bdf.bits.f);
 	}
+
+	return vf_vdev;
 }
 
 /**
@@ -254,6 +348,9 @@ static void disable_vfs(struct pci_vdev *pf_vdev)
 			vf_vdev->vdev_ops->deinit_vdev(vf_vdev);
 		}
 	}
+
+	/* the VFs never accessed have no vdev to disable */
+	stop_lazy_vfs(pf_vdev);
 }
 
 /**
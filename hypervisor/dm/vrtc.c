@@ -6,12 +6,31 @@
 
 #include <asm/guest/vm.h>
 #include <asm/io.h>
+#include <ticks.h>
+#include <logmsg.h>
 
 #define CMOS_ADDR_PORT		0x70U
 #define CMOS_DATA_PORT		0x71U
 
+#define RTC_SEC			0x00U   /* seconds */
+#define RTC_MIN			0x02U   /* minutes */
+#define RTC_HRS			0x04U   /* hours */
+#define RTC_WDAY		0x06U   /* week day */
+#define RTC_DAY			0x07U   /* day of month */
+#define RTC_MONTH		0x08U   /* month of year */
+#define RTC_YEAR		0x09U   /* year of century */
 #define RTC_STATUSA		0x0AU   /* status register A */
 #define RTCSA_TUP		0x80U   /* time update, don't look now */
+#define RTC_STATUSB		0x0BU   /* status register B */
+#define RTCSB_HALT		0x80U   /* stop clock updates */
+#define RTCSB_BIN		0x04U   /* 0 = BCD, 1 = Binary coded time */
+#define RTCSB_24HR		0x02U   /* 0 = 12 hours, 1 = 24 hours */
+#define RTC_STATUSD		0x0DU   /* status register D */
+#define RTCSD_PWR		0x80U   /* clock power OK */
+#define RTC_CENTURY		0x32U   /* current century */
+
+#define SECS_PER_DAY		86400UL
+#define POSIX_BASE_YEAR		1970U
 
 static spinlock_t cmos_lock = { .head = 0U, .tail = 0U };
 
@@ -79,13 +98,292 @@ static bool vrtc_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t width,
 	return true;
 }
 
+static inline bool is_leap_year(uint32_t year)
+{
+	return ((((year % 4U) == 0U) && ((year % 100U) != 0U)) || ((year % 400U) == 0U));
+}
+
+static uint32_t days_in_month(uint32_t year, uint32_t month)
+{
+	static const uint32_t days[12] = { 31U, 28U, 31U, 30U, 31U, 30U, 31U, 31U, 30U, 31U, 30U, 31U };
+
+	return days[month - 1U] + (((month == 2U) && is_leap_year(year)) ? 1U : 0U);
+}
+
+static inline uint32_t bcd2bin(uint8_t val)
+{
+	return (((uint32_t)val >> 4U) * 10U) + ((uint32_t)val & 0xFU);
+}
+
+static inline uint8_t bin2bcd(uint32_t val)
+{
+	return (uint8_t)(((val / 10U) << 4U) | (val % 10U));
+}
+
+/* register value in the format selected by status register B */
+static inline uint32_t rtc_reg_to_bin(uint8_t reg_b, uint8_t val)
+{
+	return ((reg_b & RTCSB_BIN) != 0U) ? (uint32_t)val : bcd2bin(val);
+}
+
+static inline uint8_t rtc_bin_to_reg(uint8_t reg_b, uint32_t val)
+{
+	return ((reg_b & RTCSB_BIN) != 0U) ? (uint8_t)val : bin2bcd(val);
+}
+
+static uint32_t rtc_reg_to_hour(uint8_t reg_b, uint8_t val)
+{
+	uint32_t hour = rtc_reg_to_bin(reg_b, val & 0x7FU);
+
+	if ((reg_b & RTCSB_24HR) == 0U) {
+		/* 12 is 12AM in the morning, bit 7 tells PM */
+		hour %= 12U;
+		if ((val & 0x80U) != 0U) {
+			hour += 12U;
+		}
+	}
+
+	return hour;
+}
+
+/*
+ * Seconds since the epoch of a date, 0 if it isn't a valid one.
+ */
+static uint64_t date_to_secs(uint32_t year, uint32_t month, uint32_t day,
+		uint32_t hour, uint32_t min, uint32_t sec)
+{
+	uint64_t days = 0UL, secs = 0UL;
+	uint32_t i;
+
+	if ((year >= POSIX_BASE_YEAR) && (month >= 1U) && (month <= 12U) && (day >= 1U) &&
+			(day <= days_in_month(year, month)) && (hour < 24U) && (min < 60U) && (sec < 60U)) {
+		for (i = POSIX_BASE_YEAR; i < year; i++) {
+			days += is_leap_year(i) ? 366UL : 365UL;
+		}
+		for (i = 1U; i < month; i++) {
+			days += days_in_month(year, i);
+		}
+		days += (uint64_t)day - 1UL;
+
+		secs = (((((days * 24UL) + hour) * 60UL) + min) * 60UL) + sec;
+	}
+
+	return secs;
+}
+
+/*
+ * Read the host RTC once, the guest time is then kept from the TSC.
+ */
+static uint64_t host_rtc_secs(void)
+{
+	uint8_t reg_b = cmos_get_reg_val(RTC_STATUSB);
+	uint32_t sec, min, hour, day, month, year;
+
+	do {
+		sec = rtc_reg_to_bin(reg_b, cmos_get_reg_val(RTC_SEC));
+		min = rtc_reg_to_bin(reg_b, cmos_get_reg_val(RTC_MIN));
+		hour = rtc_reg_to_hour(reg_b, cmos_get_reg_val(RTC_HRS));
+		day = rtc_reg_to_bin(reg_b, cmos_get_reg_val(RTC_DAY));
+		month = rtc_reg_to_bin(reg_b, cmos_get_reg_val(RTC_MONTH));
+		year = rtc_reg_to_bin(reg_b, cmos_get_reg_val(RTC_YEAR)) + 2000U;
+		/* read again if the seconds turned over in between */
+	} while (sec != rtc_reg_to_bin(reg_b, cmos_get_reg_val(RTC_SEC)));
+
+	return date_to_secs(year, month, day, hour, min, sec);
+}
+
+static uint64_t vrtc_guest_secs(const struct vm_rtc_info *rtc)
+{
+	uint64_t host = rtc->base_secs + ((cpu_ticks() - rtc->base_tsc) / ((uint64_t)cpu_tickrate() * 1000UL));
+
+	return (uint64_t)((int64_t)host + rtc->offset);
+}
+
+/* latch the current guest time into the time registers */
+static void vrtc_latch_time(struct vm_rtc_info *rtc)
+{
+	uint64_t secs = vrtc_guest_secs(rtc);
+	uint64_t days = secs / SECS_PER_DAY;
+	uint32_t rsec = (uint32_t)(secs % SECS_PER_DAY);
+	uint32_t year = POSIX_BASE_YEAR, month = 1U, hour;
+	uint8_t pm = 0U;
+
+	/* 1970-01-01 was a Thursday, the register counts Sunday as 1 */
+	rtc->regs[RTC_WDAY] = rtc_bin_to_reg(rtc->reg_b, (uint32_t)((days + 4UL) % 7UL) + 1U);
+
+	while (days >= (is_leap_year(year) ? 366UL : 365UL)) {
+		days -= is_leap_year(year) ? 366UL : 365UL;
+		year++;
+	}
+	while (days >= days_in_month(year, month)) {
+		days -= days_in_month(year, month);
+		month++;
+	}
+
+	hour = rsec / 3600U;
+	if ((rtc->reg_b & RTCSB_24HR) == 0U) {
+		if (hour >= 12U) {
+			hour -= 12U;
+			pm = 0x80U;
+		}
+		if (hour == 0U) {
+			hour = 12U;
+		}
+	}
+
+	rtc->regs[RTC_SEC] = rtc_bin_to_reg(rtc->reg_b, rsec % 60U);
+	rtc->regs[RTC_MIN] = rtc_bin_to_reg(rtc->reg_b, (rsec % 3600U) / 60U);
+	rtc->regs[RTC_HRS] = rtc_bin_to_reg(rtc->reg_b, hour) | pm;
+	rtc->regs[RTC_DAY] = rtc_bin_to_reg(rtc->reg_b, (uint32_t)days + 1U);
+	rtc->regs[RTC_MONTH] = rtc_bin_to_reg(rtc->reg_b, month);
+	rtc->regs[RTC_YEAR] = rtc_bin_to_reg(rtc->reg_b, year % 100U);
+	rtc->century = rtc_bin_to_reg(rtc->reg_b, year / 100U);
+}
+
+/* the guest has set the time registers, take them as the new guest time */
+static void vrtc_set_time(struct vm_rtc_info *rtc)
+{
+	uint64_t secs, host;
+
+	secs = date_to_secs((rtc_reg_to_bin(rtc->reg_b, rtc->century) * 100U) +
+				rtc_reg_to_bin(rtc->reg_b, rtc->regs[RTC_YEAR]),
+			rtc_reg_to_bin(rtc->reg_b, rtc->regs[RTC_MONTH]),
+			rtc_reg_to_bin(rtc->reg_b, rtc->regs[RTC_DAY]),
+			rtc_reg_to_hour(rtc->reg_b, rtc->regs[RTC_HRS]),
+			rtc_reg_to_bin(rtc->reg_b, rtc->regs[RTC_MIN]),
+			rtc_reg_to_bin(rtc->reg_b, rtc->regs[RTC_SEC]));
+	if (secs != 0UL) {
+		host = rtc->base_secs + ((cpu_ticks() - rtc->base_tsc) / ((uint64_t)cpu_tickrate() * 1000UL));
+		rtc->offset = (int64_t)secs - (int64_t)host;
+	} else {
+		pr_warn("vrtc: guest set an invalid time");
+	}
+}
+
+static inline bool is_rtc_time_reg(uint8_t offset)
+{
+	return ((offset == RTC_SEC) || (offset == RTC_MIN) || (offset == RTC_HRS) ||
+		((offset >= RTC_WDAY) && (offset <= RTC_YEAR)) || (offset == RTC_CENTURY));
+}
+
+/*
+ * Post-launched VM: reads of the time and status registers are served
+ * here from the TSC, the rest (alarms, status C and its interrupts, NVRAM)
+ * is left to the device model.
+ *
+ * @pre vcpu != NULL
+ * @pre vcpu->vm != NULL
+ */
+static bool vrtc_post_read(struct acrn_vcpu *vcpu, uint16_t addr, __unused size_t width)
+{
+	struct pio_request *pio_req = &vcpu->req.reqs.pio;
+	struct vm_rtc_info *rtc = &vcpu->vm->vrtc;
+	uint8_t offset = vcpu->vm->vrtc_offset;
+	bool handled = true;
+
+	if (addr == CMOS_ADDR_PORT) {
+		pio_req->value = offset;
+	} else {
+		spinlock_obtain(&rtc->lock);
+		if (is_rtc_time_reg(offset)) {
+			/* the registers hold the time set by the guest while halted */
+			if ((rtc->reg_b & RTCSB_HALT) == 0U) {
+				vrtc_latch_time(rtc);
+			}
+			pio_req->value = (offset == RTC_CENTURY) ? rtc->century : rtc->regs[offset];
+		} else if (offset == RTC_STATUSA) {
+			pio_req->value = rtc->reg_a;
+		} else if (offset == RTC_STATUSB) {
+			pio_req->value = rtc->reg_b;
+		} else if (offset == RTC_STATUSD) {
+			pio_req->value = RTCSD_PWR;
+		} else {
+			handled = false;
+		}
+		spinlock_release(&rtc->lock);
+	}
+
+	return handled;
+}
+
+/*
+ * Post-launched VM: all writes go on to the device model, which keeps the
+ * rest of the CMOS and persists the time; the ones to the time and status
+ * registers are tracked here as well.
+ *
+ * @pre vcpu != NULL
+ * @pre vcpu->vm != NULL
+ */
+static bool vrtc_post_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t width,
+			uint32_t value)
+{
+	struct vm_rtc_info *rtc = &vcpu->vm->vrtc;
+	uint8_t offset = vcpu->vm->vrtc_offset;
+	uint8_t val = (uint8_t)value;
+
+	if (width == 1U) {
+		if (addr == CMOS_ADDR_PORT) {
+			vcpu->vm->vrtc_offset = val & 0x7FU;
+		} else {
+			spinlock_obtain(&rtc->lock);
+			if (offset == RTC_STATUSA) {
+				rtc->reg_a = val & ~RTCSA_TUP;
+			} else if (offset == RTC_STATUSB) {
+				if (((rtc->reg_b & RTCSB_HALT) == 0U) && ((val & RTCSB_HALT) != 0U)) {
+					rtc->reg_b = val;
+					vrtc_latch_time(rtc);
+				} else if (((rtc->reg_b & RTCSB_HALT) != 0U) && ((val & RTCSB_HALT) == 0U)) {
+					vrtc_set_time(rtc);
+					rtc->reg_b = val;
+				} else {
+					rtc->reg_b = val;
+				}
+			} else if (is_rtc_time_reg(offset)) {
+				if ((rtc->reg_b & RTCSB_HALT) != 0U) {
+					if (offset == RTC_CENTURY) {
+						rtc->century = val;
+					} else {
+						/* High order bit of 'seconds' is readonly */
+						rtc->regs[offset] = (offset == RTC_SEC) ? (val & 0x7FU) : val;
+					}
+				} else if (offset == RTC_CENTURY) {
+					/* some guests write the century byte outside of RTCSB_HALT */
+					vrtc_latch_time(rtc);
+					rtc->century = val;
+					vrtc_set_time(rtc);
+				} else {
+					/* ignored, as the clock overwrites it */
+				}
+			} else {
+				/* nothing to track */
+			}
+			spinlock_release(&rtc->lock);
+		}
+	}
+
+	return false;
+}
+
 void vrtc_init(struct acrn_vm *vm)
 {
 	struct vm_io_range range = {
 	.base = CMOS_ADDR_PORT, .len = 2U};
+	struct vm_rtc_info *rtc = &vm->vrtc;
 
 	/* Initializing the CMOS RAM offset to 0U */
 	vm->vrtc_offset = 0U;
 
-	register_pio_emulation_handler(vm, RTC_PIO_IDX, &range, vrtc_read, vrtc_write);
+	if (is_postlaunched_vm(vm) && !is_rt_vm(vm)) {
+		/* Same initial state as the device model's RTC */
+		spinlock_init(&rtc->lock);
+		rtc->reg_a = 0x20U;
+		rtc->reg_b = RTCSB_24HR;
+		rtc->offset = 0L;
+		rtc->base_tsc = cpu_ticks();
+		rtc->base_secs = host_rtc_secs();
+
+		register_pio_emulation_handler(vm, RTC_PIO_IDX, &range, vrtc_post_read, vrtc_post_write);
+	} else {
+		register_pio_emulation_handler(vm, RTC_PIO_IDX, &range, vrtc_read, vrtc_write);
+	}
 }
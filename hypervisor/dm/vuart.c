@@ -41,6 +41,15 @@
 #define obtain_vuart_lock(vu, flags)	spinlock_irqsave_obtain(&((vu)->lock), &(flags))
 #define release_vuart_lock(vu, flags)	spinlock_irqrestore_release(&((vu)->lock), (flags))
 
+/* receive room kept for a 16550 driver that sends without checking LSR */
+#define VUART_RX_MARGIN		256U
+/* bytes of a transmit ring moved to the peer at a time */
+#define VUART_BURST_CHUNK	64U
+
+static struct vuart_burst_window burst_windows[VUART_BURST_NUM];
+static struct acrn_vuart *burst_owners[VUART_BURST_NUM];
+static spinlock_t burst_lock = { .head = 0U, .tail = 0U, };
+
 static inline void reset_fifo(struct vuart_fifo *fifo)
 {
 	fifo->rindex = 0U;
@@ -77,22 +86,42 @@ static inline uint32_t fifo_numchars(const struct vuart_fifo *fifo)
 	return fifo->num;
 }
 
-static inline bool fifo_isfull(const struct vuart_fifo *fifo)
+/* free bytes of the receive FIFO, or of the receive ring of the burst window */
+static uint32_t vuart_rx_free(const struct acrn_vuart *vu)
 {
-	bool ret = false;
-	/* When the FIFO has less than 16 empty bytes, it should be
-	 * mask as full. As when the 16550 driver in OS receive the
-	 * THRE interrupt, it will directly send 16 bytes without
+	uint32_t used, free_bytes = 0U;
+
+	if (vu->burst_enabled) {
+		used = vu->rx_prod - vu->burst->ctrl.rx_cons;
+		if (used <= VUART_BURST_DATA_SIZE) {
+			free_bytes = VUART_BURST_DATA_SIZE - used;
+		}
+	} else {
+		free_bytes = vu->rxfifo.size - vu->rxfifo.num;
+	}
+
+	return free_bytes;
+}
+
+static uint32_t vuart_rx_space(const struct acrn_vuart *vu)
+{
+	uint32_t free_bytes = vuart_rx_free(vu);
+
+	/* When the FIFO has less than 64 empty bytes, it should be
+	 * mask as full. As when the 16750 driver in OS receive the
+	 * THRE interrupt, it will directly send 64 bytes without
 	 * checking the LSR(THRE) */
 
-	/* Desired value should be 16 bytes, but to improve
-	 * fault-tolerant, enlarge 16 to 64. So that even the THRE
+	/* Desired value should be 64 bytes, but to improve
+	 * fault-tolerant, enlarge 64 to 256. So that even the THRE
 	 * interrupt is raised by mistake, only if it less than 4
 	 * times, data in FIFO will not be overwritten. */
-	if ((fifo->size - fifo->num) < 64U) {
-		ret = true;
-	}
-	return ret;
+	return (free_bytes > VUART_RX_MARGIN) ? (free_bytes - VUART_RX_MARGIN) : 0U;
+}
+
+static inline bool vuart_rx_isfull(const struct acrn_vuart *vu)
+{
+	return (vuart_rx_space(vu) == 0U);
 }
 
 void vuart_putchar(struct acrn_vuart *vu, char ch)
@@ -194,16 +223,24 @@ static void vuart_trigger_level_intr(const struct acrn_vuart *vu, bool assert)
 /*
  * Toggle the COM port's intr pin depending on whether or not we have an
  * interrupt condition to report to the processor.
+ *
+ * The MSI of a PCI vuart is only sent when the reason changes, rather than
+ * on each register access, so that a burst of bytes costs one interrupt: the
+ * guest drains the FIFO until the reason goes back to IIR_NOPEND.
  */
-void vuart_toggle_intr(const struct acrn_vuart *vu)
+void vuart_toggle_intr(struct acrn_vuart *vu)
 {
 	uint8_t intr_reason;
 
 	intr_reason = vuart_intr_reason(vu);
 
-	if ((vu->vdev != NULL) && (intr_reason != IIR_NOPEND)) {
-		/* FIXME: Toggle is for level trigger interrupt, for edge trigger need refine the logic later. */
-		trigger_vmcs9900_msix(vu->vdev);
+	if (vu->vdev != NULL) {
+		if ((intr_reason != IIR_NOPEND) && (intr_reason != vu->intr_reason)
+				&& !trigger_vmcs9900_msix(vu->vdev)) {
+			/* not delivered, try again on the next access */
+			intr_reason = IIR_NOPEND;
+		}
+		vu->intr_reason = intr_reason;
 	} else if (intr_reason != IIR_NOPEND) {
 		vuart_trigger_level_intr(vu, true);
 	} else {
@@ -211,6 +248,59 @@ void vuart_toggle_intr(const struct acrn_vuart *vu)
 	}
 }
 
+/*
+ * Raise the MSI of a burst window if the guest asked for it. The caller
+ * fences between its update of the ring and this check.
+ */
+static void vuart_burst_intr(struct acrn_vuart *vu, uint32_t *intr)
+{
+	if (*intr != 0U) {
+		*intr = 0U;
+		(void)trigger_vmcs9900_msix(vu->vdev);
+	}
+}
+
+/*
+ * @pre vu->lock is held
+ */
+static void vuart_rx_put(struct acrn_vuart *vu, const uint8_t *buf, uint32_t len)
+{
+	struct vuart_burst_window *win = vu->burst;
+	uint32_t i, n;
+
+	if (vu->burst_enabled) {
+		n = min(len, vuart_rx_free(vu));
+		for (i = 0U; i < n; i++) {
+			win->rx[(vu->rx_prod + i) & (VUART_BURST_DATA_SIZE - 1U)] = buf[i];
+		}
+		vu->rx_prod += n;
+		cpu_write_memory_barrier();
+		win->ctrl.rx_prod = vu->rx_prod;
+		cpu_memory_barrier();
+		vuart_burst_intr(vu, &win->ctrl.rx_intr);
+	} else {
+		for (i = 0U; i < len; i++) {
+			fifo_putchar(&vu->rxfifo, (char)buf[i]);
+		}
+		vuart_toggle_intr(vu);
+	}
+}
+
+/* receive as much of buf as there is room for, return the bytes taken */
+static uint32_t vuart_recv(struct acrn_vuart *vu, const uint8_t *buf, uint32_t len)
+{
+	uint64_t rflags;
+	uint32_t n = 0U;
+
+	obtain_vuart_lock(vu, rflags);
+	if (vu->active) {
+		n = min(len, vuart_rx_space(vu));
+		vuart_rx_put(vu, buf, n);
+	}
+	release_vuart_lock(vu, rflags);
+	return n;
+}
+
 static bool send_to_target(struct acrn_vuart *vu, uint8_t value_u8)
 {
 	uint64_t rflags;
@@ -218,11 +308,10 @@ static bool send_to_target(struct acrn_vuart *vu, uint8_t value_u8)
 
 	obtain_vuart_lock(vu, rflags);
 	if (vu->active) {
-		fifo_putchar(&vu->rxfifo, (char)value_u8);
-		if (fifo_isfull(&vu->rxfifo)) {
+		vuart_rx_put(vu, &value_u8, 1U);
+		if (vuart_rx_isfull(vu)) {
 			ret = true;
 		}
-		vuart_toggle_intr(vu);
 	}
 	release_vuart_lock(vu, rflags);
 	return ret;
@@ -334,7 +423,16 @@ static void write_reg(struct acrn_vuart *vu, uint16_t reg, uint8_t value_u8)
 				if ((value_u8 & FCR_RFR) != 0U) {
 					reset_fifo(&vu->rxfifo);
 				}
-				vu->fcr = value_u8 & (FCR_FIFOE | FCR_DMA | FCR_RX_MASK);
+				/*
+				 * As on a 16750, the 64-byte FIFO bit is only written with
+				 * DLAB set, so that Linux detects a 16750 and loads 64 bytes
+				 * per THRE interrupt instead of 16.
+				 */
+				if ((vu->lcr & LCR_DLAB) != 0U) {
+					vu->fcr = value_u8 & (FCR_FIFOE | FCR_DMA | FCR_RX_MASK | FCR_FIFO64);
+				} else {
+					vu->fcr = (value_u8 & (FCR_FIFOE | FCR_DMA | FCR_RX_MASK)) | (vu->fcr & FCR_FIFO64);
+				}
 			}
 			break;
 		case UART16550_LCR:
@@ -419,6 +517,61 @@ static bool vuart_write(struct acrn_vcpu *vcpu, uint16_t offset_arg,
 	return true;
 }
 
+/*
+ * Move the transmit ring of a burst window to the peer, or to the tx FIFO of
+ * a vuart without peer, as far as there is room. The bytes are copied out in
+ * chunks so that no two vuart locks are held at once; a vCPU ringing while
+ * another one moves the ring leaves the work to it.
+ */
+static void vuart_burst_tx(struct acrn_vuart *vu)
+{
+	struct vuart_burst_window *win = vu->burst;
+	struct acrn_vuart *t_vu = vu->target_vu;
+	uint8_t buf[VUART_BURST_CHUNK];
+	uint32_t i, used, len, sent;
+	uint64_t rflags;
+	bool stop = false;
+
+	obtain_vuart_lock(vu, rflags);
+	if (vu->tx_pumping) {
+		vu->tx_pump_again = true;
+	} else if (vu->burst_enabled) {
+		vu->tx_pumping = true;
+		while (!stop) {
+			vu->tx_pump_again = false;
+			used = win->ctrl.tx_prod - vu->tx_cons;
+			len = (used <= VUART_BURST_DATA_SIZE) ? min(used, VUART_BURST_CHUNK) : 0U;
+			cpu_compiler_barrier();
+			for (i = 0U; i < len; i++) {
+				buf[i] = win->tx[(vu->tx_cons + i) & (VUART_BURST_DATA_SIZE - 1U)];
+			}
+
+			if (t_vu != NULL) {
+				release_vuart_lock(vu, rflags);
+				sent = vuart_recv(t_vu, buf, len);
+				obtain_vuart_lock(vu, rflags);
+			} else {
+				for (i = 0U; i < len; i++) {
+					fifo_putchar(&vu->txfifo, (char)buf[i]);
+				}
+				sent = len;
+			}
+
+			if (sent != 0U) {
+				vu->tx_cons += sent;
+				win->ctrl.tx_cons = vu->tx_cons;
+				cpu_memory_barrier();
+				vuart_burst_intr(vu, &win->ctrl.tx_intr);
+			}
+			stop = !vu->tx_pump_again && ((len == 0U) || (sent < len));
+		}
+		vu->tx_pumping = false;
+	} else {
+		/* the burst window is not in use */
+	}
+	release_vuart_lock(vu, rflags);
+}
+
 static void notify_target(const struct acrn_vuart *vu)
 {
 	struct acrn_vuart *t_vu;
@@ -426,7 +579,9 @@ static void notify_target(const struct acrn_vuart *vu)
 
 	if (vu != NULL) {
 		t_vu = vu->target_vu;
-		if ((t_vu != NULL) && !fifo_isfull(&vu->rxfifo)) {
+		if ((t_vu != NULL) && t_vu->burst_enabled) {
+			vuart_burst_tx(t_vu);
+		} else if ((t_vu != NULL) && !vuart_rx_isfull(vu)) {
 			obtain_vuart_lock(t_vu, rflags);
 			t_vu->thre_int_pending = true;
 			vuart_toggle_intr(t_vu);
@@ -449,14 +604,10 @@ uint8_t vuart_read_reg(struct acrn_vuart *vu, uint16_t offset)
 	/*
 	 * Take care of the special case DLAB accesses first
 	 */
-	if ((vu->lcr & LCR_DLAB) != 0U) {
-		if (offset == UART16550_DLL) {
-			reg = vu->dll;
-		} else if (offset == UART16550_DLM) {
-			reg = vu->dlh;
-		} else {
-			reg = 0U;
-		}
+	if (((vu->lcr & LCR_DLAB) != 0U) && (offset == UART16550_DLL)) {
+		reg = vu->dll;
+	} else if (((vu->lcr & LCR_DLAB) != 0U) && (offset == UART16550_DLM)) {
+		reg = vu->dlh;
 	} else {
 		switch (offset) {
 		case UART16550_RBR:
@@ -468,6 +619,9 @@ uint8_t vuart_read_reg(struct acrn_vuart *vu, uint16_t offset)
 			break;
 		case UART16550_IIR:
 			iir = ((vu->fcr & FCR_FIFOE) != 0U) ? IIR_FIFO_MASK : 0U;
+			if ((vu->fcr & FCR_FIFO64) != 0U) {
+				iir |= IIR_FIFO64;
+			}
 			intr_reason = vuart_intr_reason(vu);
 			/*
 			 * Deal with side effects of reading the IIR register
@@ -486,7 +640,7 @@ uint8_t vuart_read_reg(struct acrn_vuart *vu, uint16_t offset)
 			break;
 		case UART16550_LSR:
 			if (t_vu != NULL) {
-				if (!fifo_isfull(&t_vu->rxfifo)) {
+				if (!vuart_rx_isfull(t_vu)) {
 					vu->lsr |= LSR_TEMT | LSR_THRE;
 				}
 			} else {
@@ -547,6 +701,96 @@ static bool vuart_read(struct acrn_vcpu *vcpu, uint16_t offset_arg, __unused siz
 	return true;
 }
 
+/**
+ * @pre vu != NULL
+ */
+uint32_t vuart_read_burst_reg(struct acrn_vuart *vu, uint16_t offset)
+{
+	uint32_t reg = 0U;
+
+	if (vu->burst != NULL) {
+		if (offset == VUART_BURST_ID_REG) {
+			reg = VUART_BURST_MAGIC;
+		} else if ((offset == VUART_BURST_CTRL_REG) && vu->burst_enabled) {
+			reg = VUART_BURST_CTRL_ENABLE;
+		} else {
+			/* write-only or reserved register */
+		}
+	}
+
+	return reg;
+}
+
+/**
+ * @pre vu != NULL
+ */
+void vuart_write_burst_reg(struct acrn_vuart *vu, uint16_t offset, uint32_t value)
+{
+	uint64_t rflags;
+	bool enable = ((value & VUART_BURST_CTRL_ENABLE) != 0U);
+
+	if (vu->burst != NULL) {
+		if (offset == VUART_BURST_CTRL_REG) {
+			obtain_vuart_lock(vu, rflags);
+			if (enable != vu->burst_enabled) {
+				(void)memset(&vu->burst->ctrl, 0U, sizeof(vu->burst->ctrl));
+				vu->tx_cons = 0U;
+				vu->rx_prod = 0U;
+				vu->burst_enabled = enable;
+			}
+			release_vuart_lock(vu, rflags);
+		} else if (offset == VUART_BURST_DOORBELL_REG) {
+			if ((value & VUART_BURST_KICK_TX) != 0U) {
+				vuart_burst_tx(vu);
+			}
+			/* room was made in the receive ring */
+			if ((value & VUART_BURST_KICK_RX) != 0U) {
+				notify_target(vu);
+			}
+		} else {
+			/* read-only or reserved register */
+		}
+	}
+}
+
+void vuart_free_burst(struct acrn_vuart *vu)
+{
+	uint32_t i;
+
+	spinlock_obtain(&burst_lock);
+	for (i = 0U; i < VUART_BURST_NUM; i++) {
+		if (burst_owners[i] == vu) {
+			burst_owners[i] = NULL;
+		}
+	}
+	vu->burst = NULL;
+	vu->burst_enabled = false;
+	spinlock_release(&burst_lock);
+}
+
+/*
+ * Give a burst window to a PCI vuart, NULL if all of them are in use.
+ */
+struct vuart_burst_window *vuart_alloc_burst(struct acrn_vuart *vu)
+{
+	uint32_t i;
+
+	vuart_free_burst(vu);
+
+	spinlock_obtain(&burst_lock);
+	for (i = 0U; i < VUART_BURST_NUM; i++) {
+		if (burst_owners[i] == NULL) {
+			burst_owners[i] = vu;
+			(void)memset(&burst_windows[i], 0U, sizeof(burst_windows[i]));
+			vu->burst = &burst_windows[i];
+			break;
+		}
+	}
+	spinlock_release(&burst_lock);
+
+	return vu->burst;
+}
+
 /*
  * @pre: vuart_idx = 0 or 1
  */
@@ -589,6 +833,10 @@ static void setup_vuart(struct acrn_vm *vm, uint16_t vuart_idx)
 	init_fifo(vu);
 	init_vuart_lock(vu);
 	vu->thre_int_pending = true;
+	vu->intr_reason = IIR_NOPEND;
+	vu->burst_enabled = false;
+	vu->tx_pumping = false;
+	vu->tx_pump_again = false;
 	vu->ier = 0U;
 	vuart_toggle_intr(vu);
 	vu->target_vu = NULL;
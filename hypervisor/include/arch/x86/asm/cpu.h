@@ -320,6 +320,7 @@ enum pcpu_boot_state {
 
 #define	NEED_OFFLINE		(1U)
 #define	NEED_SHUTDOWN_VM	(2U)
+#define	NEED_SCRUB_MEM		(3U)
 void make_pcpu_offline(uint16_t pcpu_id);
 bool need_offline(uint16_t pcpu_id);
 
@@ -519,6 +520,30 @@ static inline void asm_hlt(void)
 	asm volatile ("hlt");
 }
 
+static inline void asm_monitor(volatile const uint64_t *addr, uint64_t ecx, uint64_t edx)
+{
+	asm volatile("monitor\n" : : "a" (addr), "c" (ecx), "d" (edx));
+}
+
+static inline void asm_mwait(uint64_t eax, uint64_t ecx)
+{
+	asm volatile("mwait\n" : : "a" (eax), "c" (ecx));
+}
+
+/*
+ * Enable the interrupts and halt, or wait: the STI shadow keeps an interrupt
+ * from being taken before the CPU sleeps, and then missing the wakeup.
+ */
+static inline void asm_sti_hlt(void)
+{
+	asm volatile ("sti\n\thlt\n" : : : "cc", "memory");
+}
+
+static inline void asm_sti_mwait(uint64_t eax, uint64_t ecx)
+{
+	asm volatile ("sti\n\tmwait\n" : : "a" (eax), "c" (ecx) : "cc", "memory");
+}
+
 /* Disables interrupts on the current CPU */
 #define CPU_IRQ_DISABLE()                                   \
 {                                                           \
@@ -539,6 +564,12 @@ static inline void cpu_sp_write(uint64_t *stack_ptr)
 	asm volatile ("movq %0, %%rsp" : : "r"(rsp));
 }
 
+/* Prevents the compiler from reordering memory accesses across this point */
+static inline void cpu_compiler_barrier(void)
+{
+	asm volatile ("" : : : "memory");
+}
+
 /* Synchronizes all write accesses to memory */
 static inline void cpu_write_memory_barrier(void)
 {
@@ -50,6 +50,10 @@ bool disable_host_monitor_wait(void);
 bool is_apl_platform(void);
 bool is_apicv_advanced_feature_supported(void);
 bool pcpu_has_cap(uint32_t bit);
+bool is_pml_supported(void);
+bool is_tsc_scaling_supported(void);
+bool is_preemption_timer_supported(void);
+uint8_t get_preemption_timer_shift(void);
 bool pcpu_has_vmx_ept_cap(uint32_t bit_mask);
 bool pcpu_has_vmx_vpid_cap(uint32_t bit_mask);
 bool is_apl_platform(void);
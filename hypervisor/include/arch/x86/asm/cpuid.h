@@ -41,6 +41,7 @@
 #define CPUID_ECX_XSAVE         (1U<<26U)
 #define CPUID_ECX_OSXSAVE       (1U<<27U)
 #define CPUID_ECX_AVX           (1U<<28U)
+#define CPUID_ECX_RDRAND        (1U<<30U)
 #define CPUID_ECX_HV            (1U<<31U)
 #define CPUID_EDX_FPU           (1U<<0U)
 #define CPUID_EDX_VME           (1U<<1U)
@@ -82,6 +83,8 @@
 #define CPUID_EBX_SMEP          (1U<<7U)
 /* CPUID.07H:EBX.MPX */
 #define CPUID_EBX_MPX           (1U<<14U)
+/* CPUID.07H:EBX.RDSEED */
+#define CPUID_EBX_RDSEED        (1U<<18U)
 /* CPUID.07H:EBX.SMAP*/
 #define CPUID_EBX_SMAP          (1U<<20U)
 /* CPUID.07H:ECX.UMIP */
@@ -143,7 +146,9 @@
 #define CPUID_TLB               2U
 #define CPUID_SERIALNUM         3U
 #define CPUID_EXTEND_FEATURE    7U
+#define CPUID_EXTEND_TOPOLOGY   0xBU
 #define CPUID_XSAVE_FEATURES   0xDU
+#define CPUID_RDT_MONITORING   0xFU
 #define CPUID_RDT_ALLOCATION   0x10U
 #define CPUID_MAX_EXTENDED_FUNCTION  0x80000000U
 #define CPUID_EXTEND_FUNCTION_1      0x80000001U
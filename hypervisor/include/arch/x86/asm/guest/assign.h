@@ -32,12 +32,12 @@
  * @param[in] virt_gsi virtual GSI number associated with the passthrough device
  * @param[in] vgsi_ctlr INTX_CTLR_IOAPIC or INTX_CTLR_PIC
  *
- * @return None
+ * @return true if \p virt_gsi is a passthrough line, false otherwise
  *
  * @pre vm != NULL
  *
  */
-void ptirq_intx_ack(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ctlr vgsi_ctlr);
+bool ptirq_intx_ack(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ctlr vgsi_ctlr);
 
 /**
  * @brief MSI/MSI-x remapping for passthrough device.
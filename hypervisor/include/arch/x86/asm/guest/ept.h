@@ -105,6 +105,20 @@ void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
  */
 void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size, uint64_t prot_set, uint64_t prot_clr);
+/**
+ * @brief Guest-physical memory page write protection
+ *
+ * Clear or set the write permission of one 4K page of the normal world and
+ * keep count of the write-protected pages in vm->wp_pages. Within an
+ * ept_batch_begin()/ept_batch_end() section the flush is deferred to the end.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The 4K aligned guest physical address of the page
+ * @param[in] protect true to write-protect the page, false to make it writable
+ *
+ * @return None
+ */
+void ept_write_protect_page(struct acrn_vm *vm, uint64_t gpa, bool protect);
 /**
  * @brief Guest-physical memory region unmapping
  *
@@ -121,6 +135,177 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
 
+/**
+ * @brief Start a batch of EPT changes
+ *
+ * Until ept_batch_end() is called on the same pcpu, the EPT changes of the
+ * VM made from this pcpu don't flush the guest: the flush requests to its
+ * vCPUs are made once, at the end of the batch.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @return None
+ */
+void ept_batch_begin(struct acrn_vm *vm);
+
+/**
+ * @brief End a batch of EPT changes, flushing the guest if needed
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @return None
+ *
+ * @pre ept_batch_begin(vm) was called on the current pcpu
+ */
+void ept_batch_end(struct acrn_vm *vm);
+
+/**
+ * @brief Start tracking the pages written by the VM in a region
+ *
+ * The EPT A/D flags are enabled and, if supported, Page Modification Logging.
+ * The pages found dirty are recorded in a bitmap of the SOS by
+ * ept_dirty_log_sync().
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the region, 4K aligned
+ * @param[in] size The size of the region, multiple of 4K
+ * @param[in] bitmap_gpa The SOS guest physical address of the bitmap
+ *
+ * @retval 0 on success
+ * @retval -ENODEV if the EPT A/D flags are not supported
+ * @retval -EBUSY if the VM is already tracked or has a secure world
+ * @retval -EINVAL if the region or the bitmap is invalid
+ */
+int32_t ept_dirty_log_start(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint64_t bitmap_gpa);
+
+/**
+ * @brief Record the pages written since the last sync in the dirty bitmap
+ *
+ * When it returns, no vCPU runs with a TLB entry that could write a page
+ * without it being reported by the next sync.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if the VM is not tracked
+ */
+int32_t ept_dirty_log_sync(struct acrn_vm *vm);
+
+/**
+ * @brief Stop tracking the pages written by the VM
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if the VM is not tracked
+ */
+int32_t ept_dirty_log_stop(struct acrn_vm *vm);
+
+/**
+ * @brief Give guest memory of a post-launched VM back to SOS
+ *
+ * The 2M blocks of the region are unmapped from the EPT and recorded as
+ * reclaimed, the blocks already reclaimed are skipped. Once it returns, SOS
+ * can free the memory that was backing them.
+ *
+ * A region which is not populated yet is recorded the same way, so that its
+ * blocks are mapped on their first access.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the region, 2M aligned
+ * @param[in] size The size of the region, multiple of 2M
+ * @param[in] populated Whether the region has to be mapped in the EPT
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if the region is invalid or, if populated, not fully mapped
+ */
+int32_t ept_reclaim_mr(struct acrn_vm *vm, uint64_t gpa, uint64_t size, bool populated);
+
+/**
+ * @brief Map reclaimed guest memory of a post-launched VM back
+ *
+ * The reclaimed 2M blocks of the region are mapped to the SOS memory at
+ * sos_gpa, the blocks which are not reclaimed are skipped.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the region, 2M aligned
+ * @param[in] sos_gpa The SOS guest physical address of the new backing
+ * @param[in] size The size of the region, multiple of 2M
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if the region or the backing is invalid
+ */
+int32_t ept_restore_mr(struct acrn_vm *vm, uint64_t gpa, uint64_t sos_gpa, uint64_t size);
+
+/**
+ * @brief Map reclaimed guest memory of a post-launched VM read-only to SOS memory
+ *
+ * The reclaimed 2M blocks of the region are mapped read-only to the SOS
+ * memory at sos_gpa, which other VMs may map the same. A write to them is
+ * sent to the device model, which maps a private copy back with
+ * ept_restore_mr(). The blocks which are not reclaimed, or already shared,
+ * are skipped.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the region, 2M aligned
+ * @param[in] sos_gpa The SOS guest physical address of the shared memory
+ * @param[in] size The size of the region, multiple of 2M
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if the region or the backing is invalid
+ */
+int32_t ept_share_mr(struct acrn_vm *vm, uint64_t gpa, uint64_t sos_gpa, uint64_t size);
+
+/**
+ * @brief Check if an EPT violation write fault hit shared memory
+ *
+ * This is also true for a block which has been mapped back writable since
+ * the fault, the access has just to be retried then.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The guest physical address of the fault
+ *
+ * @return true if the access is to be retried once the block is mapped back
+ */
+bool ept_is_shared(struct acrn_vm *vm, uint64_t gpa);
+
+/**
+ * @brief Check if guest memory is still mapped read-only to shared memory
+ *
+ * The hypervisor writes the guest memory through its own mapping, it must
+ * have the device model copy such a block first, see unshare_guest_memory().
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The guest physical address
+ *
+ * @return true if the 2M block of gpa is shared
+ */
+bool ept_is_shared_block(struct acrn_vm *vm, uint64_t gpa);
+
+/**
+ * @brief Check if an EPT violation not-present fault hit reclaimed memory
+ *
+ * This is also true for a block which has been mapped back since the
+ * fault, the access has just to be retried then.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The guest physical address of the fault
+ *
+ * @return true if the access is to be retried once the block is mapped back
+ */
+bool ept_is_reclaimed(struct acrn_vm *vm, uint64_t gpa);
+
+/**
+ * @brief Record the pages logged in the PML of the vCPU and reset it
+ *
+ * @param[in] vcpu the vCPU running on the current pcpu
+ *
+ * @return None
+ *
+ * @pre vcpu->arch.pml_armed
+ */
+void ept_drain_pml(struct acrn_vcpu *vcpu);
+
 /**
  * @brief Flush address space from the page entry
  *
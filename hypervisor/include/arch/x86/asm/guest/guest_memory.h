@@ -26,6 +26,22 @@ enum vm_paging_mode {
 	PAGING_MODE_NUM,
 };
 
+#define GVA_TLB_ENTRIES		4U
+
+/*
+ * A successful gva2gpa translation. The entries are only used during the VM
+ * exit they were filled in, since neither CR3 loads nor INVLPG cause a VM exit
+ * the guest paging structures may have changed once the vCPU has run again.
+ */
+struct gva_tlb_entry {
+	uint64_t exit;		/* nrexits of the vCPU when the entry was filled */
+	uint64_t cr3;
+	uint64_t gva_page;
+	uint64_t gpa_page;
+	uint32_t access;	/* PAGE_FAULT_WR_FLAG/PAGE_FAULT_ID_FLAG of the walk */
+	bool is_user_mode_access;
+};
+
 /*
  * VM related APIs
  */
@@ -80,6 +96,12 @@ int32_t copy_from_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t si
  * @pre Pointer vm is non-NULL
  */
 int32_t copy_to_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t size);
+/**
+ * @brief Same as copy_to_gpa(), with non-temporal stores into the VM memory
+ *
+ * For large copies the hypervisor does not read back, like guest images.
+ */
+int32_t copy_to_gpa_nt(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t size);
 /**
  * @brief Copy data from VM GVA space to HV address space
  *
@@ -8,6 +8,7 @@
 #define HYPERV_H
 
 #include <asm/guest/vcpuid.h>
+#include <timer.h>
 
 /* Hyper-V MSR numbers */
 #define HV_X64_MSR_GUEST_OS_ID		0x40000000U
@@ -16,6 +17,29 @@
 
 #define HV_X64_MSR_TIME_REF_COUNT	0x40000020U
 #define HV_X64_MSR_REFERENCE_TSC	0x40000021U
+#define HV_X64_MSR_TSC_FREQUENCY	0x40000022U
+#define HV_X64_MSR_APIC_FREQUENCY	0x40000023U
+
+/* SynIC MSRs */
+#define HV_X64_MSR_SCONTROL		0x40000080U
+#define HV_X64_MSR_SVERSION		0x40000081U
+#define HV_X64_MSR_SIEFP		0x40000082U
+#define HV_X64_MSR_SIMP			0x40000083U
+#define HV_X64_MSR_EOM			0x40000084U
+#define HV_X64_MSR_SINT0		0x40000090U
+#define HV_X64_MSR_SINT15		0x4000009FU
+
+/* Synthetic timer MSRs, a CONFIG and COUNT pair per timer */
+#define HV_X64_MSR_STIMER0_CONFIG	0x400000B0U
+#define HV_X64_MSR_STIMER3_COUNT	0x400000B7U
+
+#define HV_SYNIC_SINT_COUNT		16U
+#define HV_SYNIC_STIMER_COUNT		4U
+
+/* CPUID 0x40000004 EAX: use HvCallSendSyntheticClusterIpi instead of the ICR for IPIs */
+#define CPUID4A_CLUSTER_IPI_RECOMMENDED	(1U << 10U)
+/* CPUID 0x40000004 EAX: use HvCallFlushVirtualAddressSpace/List instead of IPIs for TLB shootdowns */
+#define CPUID4A_REMOTE_TLB_FLUSH_RECOMMENDED	(1U << 2U)
 
 union hyperv_ref_tsc_page_msr {
 	uint64_t val64;
@@ -36,6 +60,21 @@ union hyperv_hypercall_msr {
 	};
 };
 
+/* Hypercall input value, in RCX or EDX:EAX */
+union hyperv_hypercall_input {
+	uint64_t val64;
+	struct {
+		uint64_t call_code:16;
+		uint64_t fast:1;
+		uint64_t var_hdr_size:10;
+		uint64_t rsvdz0:5;
+		uint64_t rep_count:12;
+		uint64_t rsvdz1:4;
+		uint64_t rep_start:12;
+		uint64_t rsvdz2:4;
+	};
+};
+
 union hyperv_guest_os_id_msr {
 	uint64_t val64;
 	struct {
@@ -49,6 +88,30 @@ union hyperv_guest_os_id_msr {
 	};
 };
 
+struct acrn_vcpu;
+struct acrn_vm;
+
+struct hyperv_stimer {
+	struct hv_timer timer;		/* in the heap of the pcpu the vCPU runs on */
+	struct acrn_vcpu *vcpu;
+	uint16_t index;
+	uint64_t config;
+	uint64_t count;
+	uint64_t exp_time;		/* reference time of the next expiration */
+	bool msg_pending;		/* the message slot was busy, resent on EOM */
+	bool migrated;			/* stopped to be re-armed on the new pcpu of the vCPU */
+};
+
+/* SynIC and synthetic timers of a vCPU */
+struct acrn_hyperv_vcpu {
+	uint64_t scontrol;
+	uint64_t siefp;
+	uint64_t simp;
+	uint64_t sint[HV_SYNIC_SINT_COUNT];
+	struct hyperv_stimer stimer[HV_SYNIC_STIMER_COUNT];
+	uint64_t stimer_pending;	/* expired timers to be delivered by the vCPU */
+};
+
 struct acrn_hyperv {
 	union hyperv_hypercall_msr	hypercall_page;
 	union hyperv_guest_os_id_msr	guest_os_id;
@@ -57,9 +120,22 @@ struct acrn_hyperv {
 	uint64_t			tsc_offset;
 };
 
+/* the MSRs handled by hyperv_rdmsr() and hyperv_wrmsr() */
+static inline bool is_hyperv_msr(uint32_t msr)
+{
+	return ((msr >= HV_X64_MSR_GUEST_OS_ID) && (msr <= HV_X64_MSR_STIMER3_COUNT));
+}
+
 int32_t hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval);
+bool hyperv_is_hypercall(const struct acrn_vcpu *vcpu);
+void hyperv_hypercall(struct acrn_vcpu *vcpu);
 int32_t hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval);
 void hyperv_init_time(struct acrn_vm *vm);
+void hyperv_init_vcpu(struct acrn_vcpu *vcpu);
+void hyperv_deinit_vcpu(struct acrn_vcpu *vcpu);
+void hyperv_stimer_deliver(struct acrn_vcpu *vcpu);
+void hyperv_migrate_timers_out(struct acrn_vcpu *vcpu);
+void hyperv_migrate_timers_in(struct acrn_vcpu *vcpu);
 void hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 	struct vcpuid_entry *entry);
 #endif
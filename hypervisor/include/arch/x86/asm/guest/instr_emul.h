@@ -87,12 +87,26 @@ struct instr_emul_vie {
 	uint64_t	gva;		/* saved gva for instruction emulation */
 };
 
+/*
+ * Instructions decoded before, indexed by RIP. Drivers polling device registers
+ * run the same few instructions over and over, a hit costs a compare of their
+ * bytes instead of a decode.
+ */
+#define VIE_CACHE_SIZE	8U
+struct instr_emul_cache_entry {
+	struct instr_emul_vie vie;	/* num_valid is 0 if the entry is free */
+	uint8_t		cpu_mode;	/* enum vm_cpu_mode of the decode */
+	bool		cs_d;		/* CS.D of the decode */
+};
+
 struct instr_emul_ctxt {
 	struct instr_emul_vie vie;
+	struct instr_emul_cache_entry cache[VIE_CACHE_SIZE];
 };
 
 int32_t emulate_instruction(struct acrn_vcpu *vcpu);
 int32_t decode_instruction(struct acrn_vcpu *vcpu);
 bool is_current_opcode_xchg(struct acrn_vcpu *vcpu);
+uint64_t get_instr_dst_gpa(const struct acrn_vcpu *vcpu);
 
 #endif
@@ -104,6 +104,9 @@ union value_64 {
 #define VMCS12_LAUNCH_STATE_CLEAR		(0U)
 #define VMCS12_LAUNCH_STATE_LAUNCHED		(1U)
 
+/* no L2 translation is tagged with vpid02 */
+#define VPID12_NONE		0xFFFFFFFFU
+
 /*
  * struct acrn_vmcs12 describes the emulated VMCS for the nested guest (L2).
  */
@@ -341,6 +344,8 @@ struct acrn_nested {
 	bool host_state_dirty;	/* To indicate need to merge VMCS12 host-state fields to VMCS01 */
 	bool gpa_field_dirty;
 	bool control_field_dirty;	/* for VM-execution, VM-exit, VM-entry control fields */
+	uint16_t vpid02;	/* L0 VPID the L2 guests of this vCPU run with */
+	uint32_t vpid12;	/* L1 VPID the translations tagged with vpid02 belong to */
 } __aligned(PAGE_SIZE);
 
 void init_nested_vmx(__unused struct acrn_vm *vm);
@@ -17,6 +17,7 @@
 #ifndef ASSEMBLER
 
 #include <acrn_common.h>
+#include <acrn_hv_defs.h>
 #include <asm/guest/guest_memory.h>
 #include <asm/guest/virtual_cr.h>
 #include <asm/guest/vlapic.h>
@@ -28,7 +29,11 @@
 #include <asm/cpu.h>
 #include <asm/guest/instr_emul.h>
 #include <asm/guest/nested.h>
+#include <asm/guest/vpmu.h>
 #include <asm/vmx.h>
+#ifdef CONFIG_HYPERV_ENABLED
+#include <asm/guest/hyperv.h>
+#endif
 
 /**
  * @brief vcpu
@@ -104,6 +109,21 @@
  */
 #define ACRN_REQUEST_SPLIT_LOCK			10U
 
+/**
+ * @brief Request for reprogramming the vHPET comparator timers
+ */
+#define ACRN_REQUEST_VHPET_UPDATE		11U
+
+/**
+ * @brief Request for applying the dirty logging state of the VM to the VMCS
+ */
+#define ACRN_REQUEST_DIRTY_LOG			12U
+
+/**
+ * @brief Request for delivering the expired Hyper-V synthetic timers
+ */
+#define ACRN_REQUEST_HV_STIMER			13U
+
 /**
  * @}
  */
@@ -161,7 +181,8 @@ enum vm_cpu_mode {
 #define	VCPU_EVENT_VIRTUAL_INTERRUPT	1
 #define	VCPU_EVENT_SYNC_WBINVD		2
 #define VCPU_EVENT_SPLIT_LOCK		3
-#define	VCPU_EVENT_NUM			4
+#define VCPU_EVENT_SPLIT_LOCK_THROTTLE	4
+#define	VCPU_EVENT_NUM			5
 
 
 enum reset_mode;
@@ -208,6 +229,15 @@ struct msr_store_area {
 	uint32_t count;	/* actual count of entries to be loaded/restored during VMEntry/VMExit */
 };
 
+/* VM exit information fields read on demand, once per VM exit, see vcpu_get_exit_info() */
+enum vm_exit_info {
+	EXIT_INFO_GUEST_PHYSICAL_ADDR = 0,
+	EXIT_INFO_GUEST_LINEAR_ADDR,
+	EXIT_INFO_INT_INFO,
+	EXIT_INFO_INT_ERROR_CODE,
+	NR_EXIT_INFO,
+};
+
 struct iwkey {
 	/* 256bit encryption key */
 	uint64_t encryption_key[4];
@@ -225,6 +255,9 @@ struct acrn_vcpu_arch {
 	/* MSR bitmap region for this vcpu, MUST be 4-Kbyte aligned */
 	uint8_t msr_bitmap[PAGE_SIZE];
 
+	/* Page Modification Log of this vcpu, MUST be 4-Kbyte aligned */
+	uint64_t pml_log[PML_ENTITY_NUM] __aligned(PAGE_SIZE);
+
 	/* per vcpu lapic */
 	struct acrn_vlapic vlapic;
 
@@ -235,12 +268,20 @@ struct acrn_vcpu_arch {
 
 	int32_t cur_context;
 	struct guest_cpu_context contexts[NR_WORLD];
+	uint64_t world_switches[NR_WORLD];	/* switches into each world */
+	uint64_t world_switch_ticks;		/* time spent in switch_world() */
 
 	/* common MSRs, world_msrs[] is a subset of it */
 	uint64_t guest_msrs[NUM_GUEST_MSRS];
 
 	uint16_t vpid;
 
+	/* VMCS was cleared, on the previous pcpu or as VMCS02, and must be launched again */
+	bool vmcs_migrated;
+
+	/* PML is enabled in the VMCS, see update_dirty_log_ctrl() */
+	bool pml_armed;
+
 	/* Holds the information needed for IRQ/exception handling. */
 	struct {
 		/* The number of the exception to raise. */
@@ -253,7 +294,11 @@ struct acrn_vcpu_arch {
 	uint8_t lapic_mask;
 	bool irq_window_enabled;
 	bool emulating_lock;
-	uint32_t nrexits;
+	uint32_t splitlock_nr;		/* split locks taken in the current rate limiting window */
+	uint64_t splitlock_window;	/* TSC at the start of that window */
+	struct hv_timer splitlock_timer;	/* ends the window of a throttled vCPU */
+	uint64_t nrexits;
+	struct gva_tlb_entry gva_tlb[GVA_TLB_ENTRIES];
 
 	/* VCPU context state information */
 	uint32_t exit_reason;
@@ -261,6 +306,8 @@ struct acrn_vcpu_arch {
 	uint64_t exit_qualification;
 	uint32_t proc_vm_exec_ctrls;
 	uint32_t inst_len;
+	uint64_t exit_info[NR_EXIT_INFO];
+	uint32_t exit_info_cached;	/* bitmap of the exit_info[] read since the VM exit */
 
 	/* Information related to secondary / AP VCPU start-up */
 	enum vm_cpu_mode cpu_mode;
@@ -268,6 +315,23 @@ struct acrn_vcpu_arch {
 
 	/* interrupt injection information */
 	uint64_t pending_req;
+	/* true from the check of pending_req before VM entry until the VM exit */
+	volatile bool in_guest;
+
+	/* GPA of the struct acrn_pv_vcpu_state registered by HC_SET_VCPU_PV_STATE, 0 if none */
+	uint64_t pv_state_gpa;
+	/* its translation, valid while the map_gen of the VM is pv_state_gen */
+	struct acrn_pv_vcpu_state *pv_state;
+	uint64_t pv_state_gen;
+	/* ticks when the vCPU was preempted, 0 if it wasn't */
+	uint64_t preempt_tsc;
+
+#ifdef CONFIG_HYPERV_ENABLED
+	struct acrn_hyperv_vcpu hyperv;
+#endif
+
+	/* architectural PMU of the vCPU, GUEST_FLAG_VPMU */
+	struct acrn_vpmu vpmu;
 
 	/* List of MSRS to be stored and loaded on VM exits or VM entries */
 	struct msr_store_area msr_area;
@@ -302,6 +366,16 @@ struct acrn_vcpu {
 
 	struct instr_emul_ctxt inst_ctxt;
 	struct io_request req; /* used by io/ept emulation */
+	struct emul_io_cache io_cache; /* last matched I/O emulation handlers */
+	bool ioreq_posted; /* a posted write is outstanding in the vhm_request slot */
+	uint64_t ioreq_lat_avg; /* average completion latency of VHM requests in cycles, for hybrid polling */
+	uint64_t halt_poll_window; /* cycles to poll for a wakeup event on HLT before blocking, adaptive */
+	uint64_t halt_poll_success; /* HLT exits resumed by polling */
+	uint64_t halt_poll_fail; /* HLT exits that polled and blocked anyway */
+	struct acrn_vmexit_stats exit_stats; /* per exit reason count and handling latency */
+	struct vmsr_stats_entry msr_stats[VMSR_STATS_NR]; /* RDMSR/WRMSR exits per MSR */
+	struct vcr_stats cr_stats; /* MOV to CR0/CR4 exits per bit */
+	uint32_t eoi_exit_stats[EOI_EXIT_BITMAP_SIZE]; /* EOI-induced exits per vector */
 
 	uint64_t reg_cached;
 	uint64_t reg_updated;
@@ -400,6 +474,21 @@ void vcpu_set_gpreg(struct acrn_vcpu *vcpu, uint32_t reg, uint64_t val);
  */
 uint64_t vcpu_get_rip(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief get a VM exit information field
+ *
+ * Read the field from the VMCS on the first call after a VM exit, and return
+ * the cached value afterwards.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ * @param[in] info the VM exit information field
+ *
+ * @return the value of the field.
+ *
+ * @pre the VMCS the VM exit happened in is current
+ */
+uint64_t vcpu_get_exit_info(struct acrn_vcpu *vcpu, enum vm_exit_info info);
+
 /**
  * @brief set vcpu RIP value
  *
@@ -506,6 +595,29 @@ uint64_t vcpu_get_guest_msr(const struct acrn_vcpu *vcpu, uint32_t msr);
  */
 void vcpu_set_guest_msr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val);
 
+/**
+ * @brief convert a host TSC value to the TSC of the vCPU
+ *
+ * The TSC of the vCPU is the host one scaled by the TSC multiplier of its VM,
+ * if any, plus the TSC offset of its VMCS.
+ *
+ * @param[in] vcpu pointer to vcpu data structure, its VMCS is the current one
+ * @param[in] host_tsc host TSC value
+ *
+ * @return the TSC value of the vCPU
+ */
+uint64_t vcpu_tsc_from_host(const struct acrn_vcpu *vcpu, uint64_t host_tsc);
+
+/**
+ * @brief convert a TSC value of the vCPU to the host TSC
+ *
+ * @param[in] vcpu pointer to vcpu data structure, its VMCS is the current one
+ * @param[in] guest_tsc TSC value of the vCPU
+ *
+ * @return the host TSC value
+ */
+uint64_t vcpu_tsc_to_host(const struct acrn_vcpu *vcpu, uint64_t guest_tsc);
+
 /**
  * @brief write eoi_exit_bitmap to VMCS fields
  *
@@ -616,6 +728,7 @@ struct acrn_vcpu *get_ever_run_vcpu(uint16_t pcpu_id);
 
 void save_xsave_area(struct acrn_vcpu *vcpu, struct ext_context *ectx);
 void rstore_xsave_area(const struct acrn_vcpu *vcpu, const struct ext_context *ectx);
+void rstore_xsave_components(const struct ext_context *ectx);
 void load_iwkey(struct acrn_vcpu *vcpu);
 
 /**
@@ -705,6 +818,19 @@ void launch_vcpu(struct acrn_vcpu *vcpu);
  */
 void kick_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief flush the guest TLB of several vCPUs of a VM
+ *
+ * The vCPUs in the guest are kicked and waited for, the others flush
+ * their TLB before their next VM entry.
+ *
+ * @param[in] vm pointer to vm data structure
+ * @param[in] vcpu_mask bitmap of the vCPU ids
+ *
+ * @return None
+ */
+void vcpu_flush_guest_tlb(struct acrn_vm *vm, uint64_t vcpu_mask);
+
 /**
  * @brief create a vcpu for the vm and mapped to the pcpu.
  *
@@ -729,7 +855,6 @@ int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id);
  * @return The physical destination CPU mask
  */
 uint64_t vcpumask2pcpumask(struct acrn_vm *vm, uint64_t vdmask);
-bool is_lapic_pt_enabled(struct acrn_vcpu *vcpu);
 
 /**
  * @brief handle posted interrupts
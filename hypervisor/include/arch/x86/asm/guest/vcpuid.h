@@ -10,8 +10,19 @@
 #define CPUID_CHECK_SUBLEAF	(1U << 0U)
 #define MAX_VM_VCPUID_ENTRIES	64U
 
+/*
+ * The first entry of leaf 0x0-0x3f, 0x40000000-0x4000003f and
+ * 0x80000000-0x8000003f is found directly through vcpuid_index of the VM.
+ */
+#define VCPUID_INDEX_LEAVES	0x40U
+#define VCPUID_INDEX_NR		(3U * VCPUID_INDEX_LEAVES)
+#define VCPUID_NO_ENTRY		0xffU
+
 /* Guest capability flags reported by CPUID */
 #define GUEST_CAPS_PRIVILEGE_VM	(1U << 0U)
+#define GUEST_CAPS_PV_IPI	(1U << 1U)	/* HC_SEND_IPI can be used */
+#define GUEST_CAPS_PV_TLB_FLUSH	(1U << 2U)	/* ACRN_VCPU_FLUSH_TLB can be used */
+#define GUEST_CAPS_PV_STEAL_TIME	(1U << 3U)	/* HC_SET_VCPU_PV_STATE can be used */
 
 struct vcpuid_entry {
 	uint32_t eax;
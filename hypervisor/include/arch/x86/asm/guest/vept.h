@@ -36,6 +36,12 @@ struct nept_desc {
 	 */
 	uint64_t guest_eptp;
 	uint32_t ref_count;
+	/*
+	 * When the nept_desc was last got. A nept_desc whose ref_count dropped
+	 * to 0 keeps its shadow EPT until it is the least recently used one
+	 * and is recycled for another guest EPTP.
+	 */
+	uint64_t last_used;
 };
 
 void reserve_buffer_for_sept_pages(void);
@@ -12,8 +12,17 @@
  *
  * @brief public APIs for vCR operations
  */
+struct acrn_vm;
+
+/* MOV to CR0/CR4 exits per bit changed with it, the bits owned by the guest aside */
+struct vcr_stats {
+	uint32_t cr0_bits[32];
+	uint32_t cr4_bits[32];
+};
+
 uint64_t get_cr4_reserved_bits(void);
-void init_cr0_cr4_host_guest_mask(void);
+void init_vcr_masks(struct acrn_vm *vm);
+void init_cr0_cr4_host_guest_mask(const struct acrn_vm *vm);
 
 /**
  * @brief vCR from vcpu
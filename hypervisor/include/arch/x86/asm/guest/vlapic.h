@@ -43,11 +43,15 @@
 
 #define VLAPIC_MAXLVT_INDEX	APIC_LVT_CMCI
 
+/* x2APIC clusters covered by the logical destination table of a VM, APIC IDs below 256 */
+#define VLAPIC_X2APIC_CLUSTERS	16U
+
 struct vlapic_timer {
 	struct hv_timer timer;
 	uint32_t mode;
 	uint32_t tmicr;
 	uint32_t divisor_shift;
+	bool migrated;		/* stopped to be re-armed on the new pcpu of the vCPU */
 };
 
 struct acrn_vlapic {
@@ -84,6 +88,13 @@ struct acrn_vlapic {
 	 */
 	uint32_t	svr_last;
 	uint32_t	lvt_last[VLAPIC_MAXLVT_INDEX + 1];
+
+	/*
+	 * Vectors of the unmasked level-triggered vIOAPIC RTEs routed to this
+	 * vLAPIC, recomputed by the vIOAPIC on every RTE change. Only these
+	 * vectors keep their bit in the EOI-exit bitmap.
+	 */
+	uint64_t	level_vectors[4];
 } __aligned(PAGE_SIZE);
 
 
@@ -178,6 +189,8 @@ void vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id);
  *  @pre vcpu != NULL
  */
 void vlapic_free(struct acrn_vcpu *vcpu);
+void vlapic_migrate_timer_out(struct acrn_vlapic *vlapic);
+void vlapic_migrate_timer_in(struct acrn_vlapic *vlapic);
 
 void vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum reset_mode mode);
 void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs);
@@ -186,10 +199,32 @@ uint64_t vlapic_apicv_get_apic_page_addr(struct acrn_vlapic *vlapic);
 int32_t apic_access_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t apic_write_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t veoi_vmexit_handler(struct acrn_vcpu *vcpu);
+void vlapic_set_level_vectors(struct acrn_vlapic *vlapic, const uint64_t level_vectors[4]);
 void vlapic_update_tpr_threshold(const struct acrn_vlapic *vlapic);
 int32_t tpr_below_threshold_vmexit_handler(struct acrn_vcpu *vcpu);
 uint64_t vlapic_calc_dest_noshort(struct acrn_vm *vm, bool is_broadcast,
 		uint32_t dest, bool phys, bool lowprio);
+/**
+ * @brief Send a fixed IPI to a set of vCPUs
+ *
+ * @param[in] vm Pointer to the VM of the vCPUs
+ * @param[in] dmask bitmap of the target vCPU ids
+ * @param[in] vec vector of the IPI
+ *
+ * @pre vec >= 16U
+ */
+void vlapic_send_fixed_ipi(struct acrn_vm *vm, uint64_t dmask, uint32_t vec);
+/**
+ * @brief Start a batch of interrupts injected to a VM
+ *
+ * Until vlapic_end_intr_batch(), the posted interrupt notifications this pCPU
+ * sends to the vCPUs of @p vm are deferred, and sent once per target pCPU at
+ * the end of the batch.
+ *
+ * @param[in] vm Pointer to the VM the interrupts are injected to
+ */
+void vlapic_begin_intr_batch(struct acrn_vm *vm);
+void vlapic_end_intr_batch(void);
 bool is_x2apic_enabled(const struct acrn_vlapic *vlapic);
 bool is_xapic_enabled(const struct acrn_vlapic *vlapic);
 /**
@@ -15,15 +15,18 @@
 
 #include <asm/lib/bits.h>
 #include <asm/lib/spinlock.h>
+#include <asm/lib/qspinlock.h>
 #include <asm/pgtable.h>
 #include <asm/guest/vcpu.h>
 #include <vioapic.h>
 #include <vpic.h>
+#include <vhpet.h>
 #include <asm/guest/vmx_io.h>
 #include <vuart.h>
 #include <asm/guest/trusty.h>
 #include <asm/guest/vcpuid.h>
 #include <vpci.h>
+#include <ptdev.h>
 #include <asm/cpu_caps.h>
 #include <asm/e820.h>
 #include <asm/vm_config.h>
@@ -69,8 +72,12 @@ struct vm_sw_info {
 	struct sw_module_info acpi_info;
 	/* HVA to IO shared page */
 	void *io_shared_page;
+	/* HVA to the notification buffer of the kick bindings */
+	void *iokick_page;
 	/* If enable IO completion polling mode */
 	bool is_polling_ioreq;
+	/* Max cycles to poll for IO completion before waiting for the notification, 0 to disable */
+	uint64_t ioreq_poll_max;
 };
 
 struct vm_pm_info {
@@ -97,6 +104,32 @@ enum vm_vlapic_mode {
 	VM_VLAPIC_TRANSITION
 };
 
+/*
+ * Tracking of the guest memory written by a VM, from the EPT dirty flags
+ * and, if the processor supports it, the PML log of each vCPU.
+ */
+struct vm_dirty_log {
+	bool enabled;
+	bool use_pml;		/* the vCPUs log the pages they dirty */
+	uint64_t gpa;		/* tracked region */
+	uint64_t size;
+	uint64_t bitmap_gpa;	/* SOS GPA of the bitmap, one bit per 4K page */
+};
+
+/*
+ * Guest memory of a post-launched VM given back to SOS and unmapped from
+ * the EPT, one bit per 2M block below VM_RECLAIM_MAX_GPA. An access to such
+ * a block is sent to the device model, which maps it back. A shared block is
+ * a reclaimed one mapped read-only to SOS memory, only its writes are sent.
+ */
+#define VM_RECLAIM_MAX_GPA	(128UL << 30U)
+
+struct vm_reclaim {
+	bool used;		/* some memory has been given back once */
+	uint64_t blocks[VM_RECLAIM_MAX_GPA >> (PDE_SHIFT + 6U)];
+	uint64_t shared[VM_RECLAIM_MAX_GPA >> (PDE_SHIFT + 6U)];
+};
+
 struct vm_arch {
 	/* I/O bitmaps A and B for this VM, MUST be 4-Kbyte aligned */
 	uint8_t io_bitmap[PAGE_SIZE*2];
@@ -109,13 +142,18 @@ struct vm_arch {
 	 */
 	void *sworld_eptp;
 	struct pgtable ept_pgtable;
+	struct vm_dirty_log dirty_log;	/* protected by ept_lock */
+	struct vm_reclaim reclaim;
 
 	struct acrn_vioapics vioapics;	/* Virtual IOAPIC/s */
 	struct acrn_vpic vpic;      /* Virtual PIC */
+	struct acrn_vhpet vhpet;	/* Virtual HPET, if GUEST_FLAG_VHPET */
 #ifdef CONFIG_HYPERV_ENABLED
 	struct acrn_hyperv hyperv;
 #endif
 	enum vm_vlapic_mode vlapic_mode; /* Represents vLAPIC mode across vCPUs*/
+	/* vCPU id of each x2APIC logical ID, [cluster][bit in the cluster] */
+	uint16_t x2apic_ldr_map[VLAPIC_X2APIC_CLUSTERS][16];
 
 	/*
 	 * Keylocker spec 4.5:
@@ -129,10 +167,31 @@ struct vm_arch {
 	spinlock_t iwkey_backup_lock;	/* Spin-lock used to protect internal key backup/restore */
 	struct iwkey iwkey_backup;
 
+	uint64_t cr0_passthru_mask;	/* CR0 bits owned by the guest, per vcr_profile of the config */
+	uint64_t cr4_passthru_mask;	/* CR4 bits owned by the guest, per vcr_profile of the config */
+	uint32_t tsc_khz;		/* TSC frequency the VM sees */
+	uint64_t tsc_multiplier;	/* VMX TSC multiplier, 0 if the TSC of the VM is not scaled */
+
 	/* reference to virtual platform to come here (as needed) */
-	bool vm_mwait_cap;
+	bool vm_mwait_cap;	/* MONITOR/MWAIT passed through, see GUEST_FLAG_MWAIT_PASSTHRU */
 } __aligned(PAGE_SIZE);
 
+/*
+ * State of the vRTC of a post-launched VM with GUEST_FLAG_VRTC: the time
+ * and status registers are served by the hypervisor, everything else and
+ * all writes go on to the device model.
+ */
+struct vm_rtc_info {
+	spinlock_t lock;
+	uint8_t reg_a;
+	uint8_t reg_b;
+	uint8_t regs[10];		/* time registers latched while updates are halted */
+	uint8_t century;
+	int64_t offset;			/* guest time - host RTC time, in seconds */
+	uint64_t base_secs;		/* host RTC time at base_tsc */
+	uint64_t base_tsc;
+};
+
 struct acrn_vm {
 	struct vm_arch arch_vm; /* Reference to this VM's arch information */
 	struct vm_hw_info hw;	/* Reference to this VM's HW information */
@@ -149,13 +208,31 @@ struct acrn_vm {
 	 * the initialization depends on the clear BSS section
 	 */
 	spinlock_t vm_state_lock;
-	spinlock_t vlapic_mode_lock;	/* Spin-lock used to protect vlapic_mode modifications for a VM */
+	qspinlock_t vlapic_mode_lock;	/* Spin-lock used to protect vlapic_mode modifications for a VM */
 	spinlock_t ept_lock;	/* Spin-lock used to protect ept add/modify/remove for a VM */
-	spinlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
+	uint64_t map_gen;	/* bumped under ept_lock when a GPA may map to another HPA */
+	uint64_t ept_batch_pcpus;	/* pcpus batching their changes to the EPT of this VM */
+	uint64_t ept_flush_pending;	/* pcpus with an EPT flush deferred to the end of their batch */
+	uint64_t iommu_flush_start;	/* start of the batched EPT changes to flush from the IOTLB */
+	uint64_t iommu_flush_end;	/* end of that range, 0 if there are none */
+	uint64_t wp_pages;	/* 4K pages write-protected by the SOS, protected by ept_lock */
+	uint64_t wp_exits;	/* writes to those pages forwarded as REQ_WP */
+	qspinlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
 	uint16_t nr_emul_mmio_regions;	/* the emulated mmio_region number */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	/*
+	 * Indexes of the registered nodes in emul_mmio[], sorted by range_start.
+	 * Updated under emul_mmio_lock; readers walk it locklessly and use
+	 * emul_mmio_gen (odd while an update is in progress) to detect races.
+	 */
+	uint32_t emul_mmio_gen;
+	uint16_t nr_emul_mmio_sorted;
+	uint16_t emul_mmio_sorted[CONFIG_MAX_EMULATED_MMIO_REGIONS];
 
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
+	uint32_t emul_pio_gen;	/* Bumped whenever emul_pio[] is updated */
+	struct posted_io_range posted_io[MAX_POSTED_IO_RANGES];	/* Updated with the VM lock held */
+	struct iokick_entry iokick[MAX_IOKICKS];	/* Updated with the VM lock held */
 
 	uint8_t uuid[16];
 	struct secure_world_control sworld_control;
@@ -169,10 +246,20 @@ struct acrn_vm {
 
 	uint32_t vcpuid_entry_nr, vcpuid_level, vcpuid_xlevel;
 	struct vcpuid_entry vcpuid_entries[MAX_VM_VCPUID_ENTRIES];
+	uint8_t vcpuid_index[VCPUID_INDEX_NR];
 	struct acrn_vpci vpci;
 	uint8_t vrtc_offset;
+	struct vm_rtc_info vrtc;
+	uint64_t pm_tmr_base_tsc;	/* TSC when the virtual PM timer read 0 */
 
 	uint64_t intr_inject_delay_delta; /* delay of intr injection */
+	struct ptirq_coalesce_policy intr_coalesce;	/* for the ptdevs set up later */
+	uint16_t last_boosted_vcpu;	/* where the next PAUSE-loop exit starts looking for a vCPU to boost */
+	uint64_t splitlock_count;	/* split-locked accesses of the guest */
+	uint64_t splitlock_throttled;	/* times a vCPU was held back for exceeding CONFIG_SPLITLOCK_RATE_LIMIT */
+	spinlock_t wbinvd_lock;		/* serializes the cache flushes of the VM */
+	uint32_t wbinvd_seq;		/* odd while a flush is running, bumped at its start and end */
+	bool vmtrr_non_wb;		/* a vMTRR put a type other than WB in the EPT, never cleared */
 } __aligned(PAGE_SIZE);
 
 /*
@@ -227,6 +314,10 @@ static inline uint16_t vmid_2_rel_vmid(uint16_t sos_vmid, uint16_t vmid) {
 
 void make_shutdown_vm_request(uint16_t pcpu_id);
 bool need_shutdown_vm(uint16_t pcpu_id);
+void scrub_vm_memory(const struct acrn_vm *vm);
+bool need_scrub_mem(uint16_t pcpu_id);
+void scrub_mem_from_idle(uint16_t pcpu_id);
+void wait_vm_memory_scrubbed(uint16_t vm_id);
 int32_t shutdown_vm(struct acrn_vm *vm);
 void poweroff_if_rt_vm(struct acrn_vm *vm);
 void pause_vm(struct acrn_vm *vm);
@@ -239,9 +330,45 @@ void launch_vms(uint16_t pcpu_id);
 bool is_poweroff_vm(const struct acrn_vm *vm);
 bool is_created_vm(const struct acrn_vm *vm);
 bool is_paused_vm(const struct acrn_vm *vm);
-bool is_sos_vm(const struct acrn_vm *vm);
 bool is_postlaunched_vm(const struct acrn_vm *vm);
 bool is_prelaunched_vm(const struct acrn_vm *vm);
+
+/*
+ * The predicates below are on the exit paths. The scenario tells at build time
+ * whether any VM may have the feature (see vm_configurations.h): when none
+ * may, they are constant false and the branches they guard are compiled out.
+ */
+static inline bool is_sos_vm(const struct acrn_vm *vm)
+{
+	return (SOS_VM_NUM != 0U) && (vm != NULL) && (get_vm_config(vm->vm_id)->load_order == SOS_VM);
+}
+
+/**
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ */
+static inline bool is_lapic_pt_configured(const struct acrn_vm *vm)
+{
+	return (MAX_LAPIC_PT_VM_NUM != 0U) &&
+		((get_vm_config(vm->vm_id)->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) != 0UL);
+}
+
+/**
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ */
+static inline bool is_nvmx_configured(const struct acrn_vm *vm)
+{
+	return (MAX_NVMX_VM_NUM != 0U) &&
+		((get_vm_config(vm->vm_id)->guest_flags & GUEST_FLAG_NVMX_ENABLED) != 0UL);
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+static inline bool is_lapic_pt_enabled(struct acrn_vcpu *vcpu)
+{
+	return is_lapic_pt_configured(vcpu->vm) && is_x2apic_enabled(vcpu_vlapic(vcpu));
+}
+
 uint16_t get_vmid_by_uuid(const uint8_t *uuid);
 struct acrn_vm *get_vm_from_vmid(uint16_t vm_id);
 struct acrn_vm *get_sos_vm(void);
@@ -251,16 +378,18 @@ void create_prelaunched_vm_e820(struct acrn_vm *vm);
 uint64_t find_space_from_ve820(struct acrn_vm *vm, uint32_t size, uint64_t min_addr, uint64_t max_addr);
 
 int32_t vm_sw_loader(struct acrn_vm *vm);
+void assist_sw_loading(uint16_t vm_id);
+void end_sw_loading(uint16_t vm_id);
 
 void vrtc_init(struct acrn_vm *vm);
 
-bool is_lapic_pt_configured(const struct acrn_vm *vm);
 bool is_rt_vm(const struct acrn_vm *vm);
-bool is_nvmx_configured(const struct acrn_vm *vm);
+bool is_vhpet_configured(const struct acrn_vm *vm);
 bool is_pi_capable(const struct acrn_vm *vm);
 bool has_rt_vm(void);
 struct acrn_vm *get_highest_severity_vm(bool runtime);
 bool vm_hide_mtrr(const struct acrn_vm *vm);
+bool vm_hide_rdrand(const struct acrn_vm *vm);
 void update_vm_vlapic_state(struct acrn_vm *vm);
 enum vm_vlapic_mode check_vm_vlapic_mode(const struct acrn_vm *vm);
 /*
@@ -45,6 +45,7 @@ void load_vmcs(const struct acrn_vcpu *vcpu);
 void init_host_state(void);
 
 void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu);
+void update_dirty_log_ctrl(struct acrn_vcpu *vcpu);
 #endif /* ASSEMBLER */
 
 #endif /* VMCS_H_ */
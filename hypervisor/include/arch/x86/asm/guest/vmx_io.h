@@ -28,7 +28,8 @@
 #define CF9_PIO_IDX			(KB_PIO_IDX + 1U)
 #define PIO_RESET_REG_IDX		(CF9_PIO_IDX + 1U)
 #define SLEEP_CTL_PIO_IDX		(PIO_RESET_REG_IDX + 1U)
-#define EMUL_PIO_IDX_MAX		(SLEEP_CTL_PIO_IDX + 1U)
+#define PM_TMR_PIO_IDX			(SLEEP_CTL_PIO_IDX + 1U)
+#define EMUL_PIO_IDX_MAX		(PM_TMR_PIO_IDX + 1U)
 /**
  * @brief The handler of VM exits on I/O instructions
  *
@@ -46,6 +47,22 @@ int32_t pio_instr_vmexit_handler(struct acrn_vcpu *vcpu);
  */
 int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief Have the device model copy the shared guest memory the hypervisor writes
+ *
+ * A write of the hypervisor to guest memory shared read-only with other VMs
+ * bypasses the EPT. The device model is asked to map a private copy of the
+ * first shared block of [gpa, gpa + size) back, and the current instruction
+ * of the vCPU is retried, which finds the next one.
+ *
+ * @param[in] vcpu the vCPU on behalf of which the hypervisor writes
+ * @param[in] gpa The guest physical address written
+ * @param[in] size The size written
+ *
+ * @return true if the write must not be done, the instruction is retried
+ */
+bool unshare_guest_memory(struct acrn_vcpu *vcpu, uint64_t gpa, uint64_t size);
+
 /**
  * @brief General complete-work for port I/O emulation
  *
@@ -81,6 +98,17 @@ void   allow_guest_pio_access(struct acrn_vm *vm, uint16_t port_address, uint32_
  */
 void deny_guest_pio_access(struct acrn_vm *vm, uint16_t port_address, uint32_t nbytes);
 
+/**
+ * @brief Check whether a VM accesses a port I/O range natively
+ *
+ * @param vm The VM whose port I/O access permissions are checked
+ * @param port_address The start address of the port I/O range
+ * @param nbytes The size of the range, in bytes
+ *
+ * @return true if none of the ports of the range traps.
+ */
+bool is_guest_pio_allowed(const struct acrn_vm *vm, uint16_t port_address, uint32_t nbytes);
+
 /**
  * @brief Fire VHM interrupt to SOS
  *
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VPMU_H
+#define VPMU_H
+
+#include <types.h>
+#include <asm/msr.h>
+
+/* the counters exposed to the guests, whatever the processor has more of */
+#define VPMU_MAX_GP_COUNTERS		4U
+#define VPMU_MAX_FIXED_COUNTERS		3U
+
+struct acrn_vcpu;
+struct acrn_vm;
+struct vcpuid_entry;
+
+/* architectural PMU state of a vCPU, in the hardware while it runs */
+struct acrn_vpmu {
+	bool enabled;
+	uint64_t global_ctrl;		/* loaded on VM entries from the VMCS */
+	uint64_t global_status;		/* overflows cleared from the hardware when switched out */
+	uint64_t fixed_ctr_ctl;
+	uint64_t evtsel[VPMU_MAX_GP_COUNTERS];
+	uint64_t pmc[VPMU_MAX_GP_COUNTERS];
+	uint64_t fixed_ctr[VPMU_MAX_FIXED_COUNTERS];
+};
+
+/* the MSRs handled by vpmu_rdmsr() and vpmu_wrmsr() */
+static inline bool is_vpmu_msr(uint32_t msr)
+{
+	return (((msr >= MSR_IA32_PMC0) && (msr < (MSR_IA32_PMC0 + VPMU_MAX_GP_COUNTERS))) ||
+		((msr >= MSR_IA32_PERFEVTSEL0) && (msr < (MSR_IA32_PERFEVTSEL0 + VPMU_MAX_GP_COUNTERS))) ||
+		((msr >= MSR_IA32_FIXED_CTR0) && (msr < (MSR_IA32_FIXED_CTR0 + VPMU_MAX_FIXED_COUNTERS))) ||
+		((msr >= MSR_IA32_FIXED_CTR_CTL) && (msr <= MSR_IA32_PERF_GLOBAL_OVF_CTRL)));
+}
+
+void init_vpmu_cap(void);
+void init_pcpu_vpmu(void);
+bool is_vpmu_configured(const struct acrn_vm *vm);
+uint32_t vpmu_num_gp_counters(void);
+uint32_t vpmu_num_fixed_counters(void);
+void vpmu_init_vcpuid_entry(struct vcpuid_entry *entry);
+void vpmu_init_vcpu(struct acrn_vcpu *vcpu);
+void vpmu_switch_out(struct acrn_vcpu *vcpu);
+void vpmu_switch_in(struct acrn_vcpu *vcpu);
+int32_t vpmu_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval);
+int32_t vpmu_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval);
+
+#endif /* VPMU_H */
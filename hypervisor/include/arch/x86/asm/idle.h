@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <types.h>
+#include <asm/cpu_caps.h>
+
+/* How the idle thread of a pCPU waits */
+enum idle_policy {
+	IDLE_POLICY_POLL = 0,	/* pause loop: the fastest wakeup, for the pCPUs of RT VMs */
+	IDLE_POLICY_HALT,	/* HLT, C1 without MONITOR/MWAIT */
+	IDLE_POLICY_CSTATE,	/* the deepest C-state the predicted idle time pays for */
+};
+
+struct pcpu_idle {
+	volatile enum idle_policy policy;	/* written by the pCPU creating or shutting down a VM */
+	uint64_t avg_ticks;			/* moving average of the idle periods */
+	uint64_t entries[MAX_CX_ENTRY];		/* C-state entries, per host Cx entry */
+	uint64_t ticks[MAX_CX_ENTRY];		/* time spent idle, per host Cx entry */
+	uint64_t polls;				/* idle periods of IDLE_POLICY_POLL */
+};
+
+void update_idle_policy(void);
+void cpu_idle(uint16_t pcpu_id);
+
+#endif /* IDLE_H */
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef QSPINLOCK_H
+#define QSPINLOCK_H
+
+#include <types.h>
+#include <rtl.h>
+#include <asm/lib/atomic.h>
+#include <asm/lib/bits.h>
+
+/*
+ * Queued (MCS) spinlock, for the locks many pCPUs contend for.
+ *
+ * An uncontended lock is taken by one compare-and-swap on the lock word. A
+ * pCPU finding the lock taken appends a node of its own to the queue of
+ * waiters and spins on that node only, so each release touches the cache line
+ * of the next waiter alone instead of the one all the waiters spin on.
+ *
+ * The nodes are per pCPU, one per nesting level of the locks waited for at
+ * once, e.g. in a thread and in the interrupt handler preempting it.
+ */
+
+#define QSPINLOCK_LOCKED_BIT	0U
+#define QSPINLOCK_LOCKED	(1U << QSPINLOCK_LOCKED_BIT)
+#define QSPINLOCK_TAIL_SHIFT	16U	/* bits 16-31: (pcpu_id + 1) << 2 | nesting of the last waiter */
+#define QSPINLOCK_TAIL_MASK	(0xffffU << QSPINLOCK_TAIL_SHIFT)
+#define QSPINLOCK_MAX_NESTING	4U
+
+#ifdef CONFIG_LOCK_STATS
+/* only updated by the lock holder */
+struct qspinlock_stats {
+	uint64_t nr_obtain;
+	uint64_t nr_contended;
+	uint64_t wait_ticks;
+	uint64_t max_wait_ticks;
+	uint64_t hold_ticks;
+	uint64_t max_hold_ticks;
+	uint64_t obtain_tsc;
+};
+#endif
+
+typedef struct _qspinlock {
+	volatile uint32_t val;
+#ifdef CONFIG_LOCK_STATS
+	struct qspinlock_stats stats;
+#endif
+} qspinlock_t;
+
+struct qspinlock_node {
+	struct qspinlock_node *volatile next;
+	volatile uint32_t locked;
+};
+
+static inline void qspinlock_init(qspinlock_t *lock)
+{
+	(void)memset(lock, 0U, sizeof(qspinlock_t));
+}
+
+static inline bool qspinlock_trylock(qspinlock_t *lock)
+{
+	return (atomic_cmpxchg32(&lock->val, 0U, QSPINLOCK_LOCKED) == 0U);
+}
+
+void qspinlock_obtain_slow(qspinlock_t *lock);
+
+#ifdef CONFIG_LOCK_STATS
+void qspinlock_obtain(qspinlock_t *lock);
+void qspinlock_release(qspinlock_t *lock);
+#else
+static inline void qspinlock_obtain(qspinlock_t *lock)
+{
+	if (!qspinlock_trylock(lock)) {
+		qspinlock_obtain_slow(lock);
+	}
+}
+
+static inline void qspinlock_release(qspinlock_t *lock)
+{
+	/* atomic, the waiters keep updating the tail */
+	bitmap32_clear_lock((uint16_t)QSPINLOCK_LOCKED_BIT, &lock->val);
+}
+#endif
+
+#define qspinlock_irqsave_obtain(lock, p_rflags)	\
+	do {						\
+		CPU_INT_ALL_DISABLE(p_rflags);		\
+		qspinlock_obtain(lock);			\
+	} while (0)
+
+#define qspinlock_irqrestore_release(lock, rflags)	\
+	do {						\
+		qspinlock_release(lock);		\
+		CPU_INT_ALL_RESTORE(rflags);		\
+	} while (0)
+
+#endif /* QSPINLOCK_H */
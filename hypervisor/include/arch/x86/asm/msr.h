@@ -19,6 +19,7 @@
 #define MSR_IA32_PLATFORM_ID			0x00000017U
 #define MSR_IA32_APIC_BASE			0x0000001BU
 #define MSR_TEST_CTL				0x00000033U
+#define MSR_TEST_CTL_AC_SPLITLOCK		(1UL << 29U)
 #define MSR_IA32_FEATURE_CONTROL		0x0000003AU
 #define MSR_IA32_TSC_ADJUST			0x0000003BU
 /* Speculation Control */
@@ -612,7 +613,18 @@ static inline bool is_x2apic_msr(uint32_t msr)
 
 struct acrn_vcpu;
 
+#define VMSR_STATS_SHIFT	6U
+#define VMSR_STATS_NR		(1U << VMSR_STATS_SHIFT)
+
+/* RDMSR/WRMSR exits of one MSR, the entry is free as long as both are 0 */
+struct vmsr_stats_entry {
+	uint32_t msr;
+	uint32_t rdmsr;
+	uint32_t wrmsr;
+};
+
 void init_msr_emulation(struct acrn_vcpu *vcpu);
+void init_vmsr_index(void);
 uint32_t vmsr_get_guest_msr_index(uint32_t msr);
 void update_msr_bitmap_x2apic_apicv(struct acrn_vcpu *vcpu);
 void update_msr_bitmap_x2apic_passthru(struct acrn_vcpu *vcpu);
@@ -32,6 +32,11 @@ struct page {
 	uint8_t contents[PAGE_SIZE];
 } __aligned(PAGE_SIZE);
 
+/*
+ * A pool either owns its pages or, when parent is not NULL, takes them
+ * from its parent: the bitmap then tracks the pages of the parent it
+ * holds, at most quota of them.
+ */
 struct page_pool {
 	struct page *start_page;
 	spinlock_t lock;
@@ -40,8 +45,16 @@ struct page_pool {
 	uint64_t last_hint_id;
 
 	struct page *dummy_page;
+
+	struct page_pool *parent;
+	uint64_t quota;
+	uint64_t used;
 };
 
 struct page *alloc_page(struct page_pool *pool);
 void free_page(struct page_pool *pool, struct page *page);
+void free_all_pages(struct page_pool *pool);
+void free_page_deferred(struct page_pool *pool, struct page *page);
+bool has_stale_pages(void);
+void free_stale_pages(void);
 #endif /* PAGE_H */
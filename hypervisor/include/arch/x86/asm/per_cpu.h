@@ -16,51 +16,65 @@
 #include <schedule.h>
 #include <asm/notify.h>
 #include <asm/page.h>
+#include <asm/mmu.h>
+#include <asm/lib/qspinlock.h>
 #include <asm/gdt.h>
 #include <asm/security.h>
 #include <asm/vm_config.h>
+#include <asm/idle.h>
 
+/*
+ * The fields are grouped by who accesses them, so that the ones other pCPUs
+ * write do not share a cache line with the ones this pCPU keeps using: each
+ * group starts on its own cache line.
+ */
 struct per_cpu_region {
+	/* Cold: used by the hardware, on exceptions or for debugging */
 	/* vmxon_region MUST be 4KB-aligned */
 	uint8_t vmxon_region[PAGE_SIZE];
-	void *vmcs_run;
+	uint8_t mc_stack[CONFIG_STACK_SIZE] __aligned(16);
+	uint8_t df_stack[CONFIG_STACK_SIZE] __aligned(16);
+	uint8_t sf_stack[CONFIG_STACK_SIZE] __aligned(16);
+	uint8_t stack[CONFIG_STACK_SIZE] __aligned(16);
+	struct host_gdt gdt;
+	struct tss_64 tss;
 #ifdef HV_DEBUG
 	struct shared_buf *sbuf[ACRN_SBUF_ID_MAX];
 	char logbuf[LOG_MESSAGE_MAX_SIZE];
 	uint32_t npk_log_ref;
 #endif
-	uint64_t irq_count[NR_IRQS];
+#ifdef PROFILING_ON
+	struct profiling_info_wrapper profiling_info;
+#endif
+	uint64_t tsc_suspend;
+
+	/* Hot, only accessed by this pCPU */
+	void *vmcs_run __aligned(CACHE_LINE_SIZE);
+	struct acrn_vcpu *ever_run_vcpu;
+	struct acrn_vcpu *whose_iwkey;
+	struct acrn_vcpu *whose_xsave;	/* vCPU whose extended state is in the registers */
 	uint64_t softirq_pending;
+	uint32_t softirq_servicing;
+	uint32_t qspin_nesting;		/* queued spinlocks this pCPU waits for */
+	struct acrn_vm *pi_batch_vm;	/* VM whose posted interrupt notifications are deferred */
+	uint64_t pi_batch_pcpus;	/* pCPUs to notify at the end of the batch */
+	struct page *stale_pages;	/* unlinked from a page table, freed after the flush */
 	uint64_t spurious;
-	struct acrn_vcpu *ever_run_vcpu;
 #ifdef STACK_PROTECTOR
 	struct stack_canary stk_canary;
 #endif
+	struct list_head softirq_dev_entry_list;
 	struct per_cpu_timers cpu_timers;
-	struct sched_control sched_ctl;
-	struct sched_noop_control sched_noop_ctl;
-	struct sched_iorr_control sched_iorr_ctl;
-	struct sched_bvt_control sched_bvt_ctl;
 	struct thread_object idle;
-	struct host_gdt gdt;
-	struct tss_64 tss;
-	enum pcpu_boot_state boot_state;
-	uint64_t pcpu_flag;
-	uint8_t mc_stack[CONFIG_STACK_SIZE] __aligned(16);
-	uint8_t df_stack[CONFIG_STACK_SIZE] __aligned(16);
-	uint8_t sf_stack[CONFIG_STACK_SIZE] __aligned(16);
-	uint8_t stack[CONFIG_STACK_SIZE] __aligned(16);
-	uint32_t lapic_id;
+	struct pcpu_idle idle_ctl;
+	uint64_t irq_count[NR_IRQS];
+	struct acrn_pcpu_stats stats;	/* cacheline aligned, only updated by this pcpu */
+	struct acrn_rt_latency rt_latency;	/* the same */
+
+	/* Read by other pCPUs, seldom written */
+	uint32_t lapic_id __aligned(CACHE_LINE_SIZE);
 	uint32_t lapic_ldr;
-	uint32_t softirq_servicing;
-	struct smp_call_info_data smp_call_info;
-	struct list_head softirq_dev_entry_list;
-#ifdef PROFILING_ON
-	struct profiling_info_wrapper profiling_info;
-#endif
-	uint64_t shutdown_vm_bitmap;
-	uint64_t tsc_suspend;
-	struct acrn_vcpu *whose_iwkey;
+	enum pcpu_boot_state boot_state;
 	/*
 	 * We maintain a per-pCPU array of vCPUs. vCPUs of a VM won't
 	 * share same pCPU. So the maximum possible # of vCPUs that can
@@ -69,6 +83,19 @@ struct per_cpu_region {
 	 * to avoid contention between offline_vcpu and posted interrupt handler
 	 */
 	struct acrn_vcpu *vcpu_array[CONFIG_MAX_VM_NUM] __aligned(8);
+
+	/* Written by other pCPUs to notify this one */
+	uint64_t pcpu_flag __aligned(CACHE_LINE_SIZE);
+	uint64_t shutdown_vm_bitmap;
+	struct smp_call_info_data smp_call_info __aligned(CACHE_LINE_SIZE);
+	/* linked and handed the lock by the neighbours in the lock queues */
+	struct qspinlock_node qspin_nodes[QSPINLOCK_MAX_NESTING] __aligned(CACHE_LINE_SIZE);
+
+	/* Written by the pCPUs waking up, migrating or balancing threads to this one */
+	struct sched_control sched_ctl __aligned(CACHE_LINE_SIZE);
+	struct sched_noop_control sched_noop_ctl;
+	struct sched_iorr_control sched_iorr_ctl;
+	struct sched_bvt_control sched_bvt_ctl;
 } __aligned(PAGE_SIZE); /* per_cpu_region size aligned with PAGE_SIZE */
 
 extern struct per_cpu_region per_cpu_data[MAX_PCPU_NUM];
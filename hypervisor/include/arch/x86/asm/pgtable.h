@@ -61,6 +61,16 @@
  */
 #define EPT_RWX			(EPT_RD | EPT_WR | EPT_EXE)
 
+/**
+ * @brief EPT accessed flag, set by the processor if A/D flags are enabled in the EPTP.
+ */
+#define EPT_ACCESSED		(1UL << 8U)
+
+/**
+ * @brief EPT dirty flag of a leaf entry, set by the processor if A/D flags are enabled in the EPTP.
+ */
+#define EPT_DIRTY		(1UL << 9U)
+
 /**
  * @}
  */
@@ -325,6 +335,8 @@ void pgtable_add_map(uint64_t *pml4_page, uint64_t paddr_base,
 void pgtable_modify_or_del_map(uint64_t *pml4_page, uint64_t vaddr_base,
 		uint64_t size, uint64_t prot_set, uint64_t prot_clr,
 		const struct pgtable *table, uint32_t type);
+void pgtable_merge_map(uint64_t *pml4_page, uint64_t vaddr_base,
+		uint64_t size, const struct pgtable *table);
 /**
  * @}
  */
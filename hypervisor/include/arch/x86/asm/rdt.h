@@ -44,9 +44,12 @@ struct rdt_info {
 	struct platform_clos_info *platform_clos_array; /* user configured mask and MSR info for each CLOS*/
 };
 
+struct acrn_rdt_clos;
+
 void init_rdt_info(void);
 void setup_clos(uint16_t pcpu_id);
 uint64_t clos2pqr_msr(uint16_t clos);
 bool is_platform_rdt_capable(void);
+int32_t rdt_clos_config(uint16_t clos, struct acrn_rdt_clos *rdt);
 
 #endif	/* RDT_H */
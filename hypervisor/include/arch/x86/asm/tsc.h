@@ -24,6 +24,38 @@ static inline uint64_t rdtsc(void)
 	return ((uint64_t)hi << 32U) | lo;
 }
 
+/* TSC multiplier of VMX TSC scaling, a fixed point number with 48 fractional bits */
+#define TSC_MULTIPLIER_SHIFT	48U
+
+/**
+ * @brief Scale a TSC value: (tsc * multiplier) >> TSC_MULTIPLIER_SHIFT, as VMX TSC scaling does.
+ */
+static inline uint64_t tsc_scale(uint64_t tsc, uint64_t multiplier)
+{
+	uint64_t lo, hi;
+
+	asm volatile ("mulq %3" : "=a" (lo), "=d" (hi) : "a" (tsc), "rm" (multiplier));
+	return (hi << (64U - TSC_MULTIPLIER_SHIFT)) | (lo >> TSC_MULTIPLIER_SHIFT);
+}
+
+/**
+ * @brief Reverse of tsc_scale(): (tsc << TSC_MULTIPLIER_SHIFT) / multiplier,
+ * saturated to ~0UL when it doesn't fit in 64 bits.
+ *
+ * @pre multiplier != 0UL
+ */
+static inline uint64_t tsc_unscale(uint64_t tsc, uint64_t multiplier)
+{
+	uint64_t quot = ~0UL, rem;
+	uint64_t hi = tsc >> (64U - TSC_MULTIPLIER_SHIFT);
+
+	if (hi < multiplier) {
+		asm volatile ("divq %4" : "=a" (quot), "=d" (rem)
+			: "0" (tsc << TSC_MULTIPLIER_SHIFT), "1" (hi), "rm" (multiplier));
+	}
+	return quot;
+}
+
 /**
  * @brief Get Time Stamp Counter (TSC) frequency in KHz.
  *
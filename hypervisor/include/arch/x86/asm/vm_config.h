@@ -19,6 +19,14 @@
 
 #define CONFIG_MAX_VM_NUM	(PRE_VM_NUM + SOS_VM_NUM + MAX_POST_VM_NUM)
 
+/* for the configurations generated before the scenario counted them: any VM may have the feature */
+#ifndef MAX_LAPIC_PT_VM_NUM
+#define MAX_LAPIC_PT_VM_NUM	CONFIG_MAX_VM_NUM
+#endif
+#ifndef MAX_NVMX_VM_NUM
+#define MAX_NVMX_VM_NUM		CONFIG_MAX_VM_NUM
+#endif
+
 #define AFFINITY_CPU(n)		(1UL << (n))
 #define MAX_VCPUS_PER_VM	MAX_PCPU_NUM
 #define MAX_VUART_NUM_PER_VM	8U
@@ -80,6 +88,12 @@ enum acrn_vm_load_order {
 	MAX_LOAD_ORDER
 };
 
+/* which CR0/CR4 bits the guest writes without a VM exit */
+enum acrn_vcr_profile {
+	VCR_PROFILE_DEFAULT = 0,	/* the bits the hypervisor never tracks */
+	VCR_PROFILE_RELAXED,		/* also CR0.WP, CR4.SMAP, CR4.PKE and CR4.PKS */
+};
+
 /* ACRN guest severity */
 enum acrn_vm_severity {
 	SEVERITY_SAFETY_VM = 0x40U,
@@ -207,6 +221,13 @@ struct acrn_vm_config {
 
 	uint16_t pt_intx_num; /* number of pt_intx_config entries pointed by pt_intx */
 	struct pt_intx_config *pt_intx; /* stores the base address of struct pt_intx_config array */
+
+	uint32_t timer_slack_us; /* how long vLAPIC timers may be delayed to coalesce expirations, 0 to disable */
+	uint32_t ple_gap;	/* PAUSE-loop exiting gap in TSC ticks, 0 for the default (128) */
+	uint32_t ple_window;	/* PAUSE-loop exiting window in TSC ticks, 0 for the default (4096) */
+	uint32_t halt_poll_us;	/* max time to poll for a wakeup event on HLT before blocking, 0 to disable */
+	uint32_t tsc_khz;	/* TSC frequency of the VM in kHz, 0 for the host one; set by the DM for a post-launched VM */
+	enum acrn_vcr_profile vcr_profile;	/* CR0/CR4 guest-host masks, see cr_stat in the shell to pick one */
 } __aligned(8);
 
 struct acrn_vm_config *get_vm_config(uint16_t vm_id);
@@ -353,6 +353,12 @@
 #define VMX_EPT_INVEPT_SINGLE_CONTEXT	(1U << 25U)
 #define VMX_EPT_INVEPT_GLOBAL_CONTEXT	(1U << 26U)
 
+/* EPTP bit 6: enable the accessed and dirty flags of the EPT */
+#define VMX_EPTP_AD_ENABLE		(1UL << 6U)
+
+/* the PML index counts down from PML_ENTITY_NUM - 1 as GPAs are logged */
+#define PML_ENTITY_NUM			512U
+
 #define VMX_VPID_TYPE_INDIVIDUAL_ADDR	0UL
 #define VMX_VPID_TYPE_SINGLE_CONTEXT	1UL
 #define VMX_VPID_TYPE_ALL_CONTEXT	2UL
@@ -465,4 +471,5 @@ void init_cr0_cr4_flexible_bits(void);
 bool is_valid_cr0_cr4(uint64_t cr0, uint64_t cr4);
 
 #define POSTED_INTR_ON  0U
+#define POSTED_INTR_SN  1U
 #endif /* VMX_H_ */
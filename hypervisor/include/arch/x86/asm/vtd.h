@@ -57,6 +57,7 @@ struct iommu_domain {
 	uint16_t vm_id;
 	uint32_t addr_width;   /* address width of the domain */
 	uint64_t trans_table_ptr;
+	uint32_t dev_num;      /* number of devices attached to the domain */
 };
 
 union source {
@@ -600,7 +601,7 @@ struct iommu_domain;
  * @pre domain != NULL
  *
  */
-int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun);
+int32_t move_pt_device(struct iommu_domain *from_domain, struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun);
 
 /**
  * @brief Create a iommu domain for a VM specified by vm_id.
@@ -622,6 +623,23 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iomm
  */
 struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_table, uint32_t addr_width);
 
+/**
+ * @brief Flush the IOTLB of an iommu domain for a range of its address space.
+ *
+ * Invalidate the IOTLB entries of [gpa, gpa + size) after the translation table of the domain
+ * has changed, page-selectively where the IOMMU supports it. The submission waits for the
+ * invalidation to complete. Nothing is done if no device is attached to the domain.
+ *
+ * @param[in] domain iommu domain whose translation table has changed
+ * @param[in] gpa start guest physical address of the range
+ * @param[in] size size of the range
+ *
+ * @pre domain != NULL
+ * @pre size != 0
+ *
+ */
+void iommu_flush_domain(const struct iommu_domain *domain, uint64_t gpa, uint64_t size);
+
 /**
  * @brief Destroy the specific iommu domain.
  *
@@ -69,6 +69,42 @@ int32_t hcall_get_api_version(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
  */
 int32_t hcall_get_platform_info(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Get the event counters of a physical CPU
+ *
+ * The counters of the exits per reason, the I/O requests per VM, the
+ * IPIs, the posted interrupt notifications, the timer expirations and
+ * the scheduler switches of the pCPU are copied to the SOS.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 GPA pointer to struct acrn_pcpu_stats, its pcpu_id selects
+ *               the physical CPU
+ * @param param2 not used
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, -1 in case of error.
+ */
+int32_t hcall_get_pcpu_stats(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Get the latencies the hypervisor adds on a physical CPU
+ *
+ * The histograms of the VM exit to VM entry time and of the TSC deadline
+ * timer delays of the vCPUs with the LAPIC passed through, and of the
+ * hypervisor timer delays of the pCPU are copied to the SOS.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 GPA pointer to struct acrn_rt_latency, its pcpu_id selects
+ *               the physical CPU
+ * @param param2 not used
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, -1 in case of error.
+ */
+int32_t hcall_get_rt_latency(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief create virtual machine
  *
@@ -168,6 +204,24 @@ int32_t hcall_pause_vm(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64
  */
 int32_t hcall_set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief change and read the RDT allocation of the CLOS of a vCPU
+ *
+ * Program the cache masks and the MBA delay flagged in set_flags for the
+ * CLOS the vCPU is configured with, on all pCPUs, then return the current
+ * settings and the cache and memory bandwidth monitoring counters of it.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to sos
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_rdt_clos
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_rdt_clos(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief set or clear IRQ line
  *
@@ -201,6 +255,40 @@ int32_t hcall_set_irqline(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uin
  */
 int32_t hcall_inject_msi(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief inject several MSI interrupts
+ *
+ * Inject a batch of MSI interrupts for a VM. While the posted interrupt of
+ * a target vCPU is outstanding, further vectors only update its PIR, so the
+ * whole batch is notified once per vCPU.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to struct acrn_msi_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_inject_msi_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief inject several MSIs and irqline operations
+ *
+ * Do a batch of MSI injections and irqline operations for a VM in order. The
+ * posted interrupt notifications of the batch are sent at its end, once per
+ * target pCPU.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to struct acrn_intr_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero if any of the operations failed.
+ */
+int32_t hcall_inject_intr_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief set ioreq shared buffer
  *
@@ -233,6 +321,111 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
  */
 int32_t hcall_notify_ioreq_finish(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief add or remove a posted I/O range
+ *
+ * Guest writes to a posted I/O range are delivered to SOS without suspending
+ * the vCPU until the request is completed.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_posted_io_range
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_io_range(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief set the notification buffer of the kick bindings
+ *
+ * Set the buffer in which the hypervisor signals the guest writes completed
+ * by the kick bindings of a VM.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_set_iokick_buffer
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_iokick_buffer(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief add or remove a kick binding
+ *
+ * A guest write matching a kick binding is completed by the hypervisor, which
+ * only sets the bound slot in the notification buffer and notifies SOS.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_iokick
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_iokick(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief set the polling budget of I/O request completion
+ *
+ * A vCPU of the VM polls for the completion of its I/O request for up to
+ * the given number of TSC cycles, adapted to the observed completion latency,
+ * before it waits for the notification from SOS.
+ *
+ * @param vcpu not used
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 max polling budget in TSC cycles, 0 to disable polling
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioreq_poll(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief pass a port I/O range through to a VM or trap it again
+ *
+ * The guest accesses the ports of a passed through range natively, without a
+ * VM exit. A range can only be passed through if SOS accesses all its ports
+ * natively and no emulation of the hypervisor claims them for the VM, so that
+ * the device model can give up the emulation of a port it only forwards.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_pio_region
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_pio_region(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief bind or unbind the EOI of a level-triggered GSI to a notification slot
+ *
+ * On the guest EOI of a bound line, the hypervisor deasserts it and notifies
+ * SOS through the notification buffer set by HC_SET_IOKICK_BUFFER, so the
+ * device model neither deasserts the line nor waits for the EOI synchronously.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_intx_resample
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_intx_resample(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -262,6 +455,59 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vcpu *vcpu, struct acrn_vm *targ
  */
 int32_t hcall_write_protect_page(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief change the write permission of a batch of guest memory pages
+ *
+ * Apply an array of struct wp_data at once, with a single EPT flush of the
+ * target VM. The hypercall may return before applying all of the entries,
+ * see struct wp_batch.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to struct wp_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, -EINVAL on an invalid page, non-zero on other errors.
+ */
+int32_t hcall_write_protect_pages(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief track the guest memory pages written by a VM
+ *
+ * Start, sync or stop the tracking of a region of the VM: on a sync, the pages
+ * written since the previous one are set in the dirty bitmap given at start.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct dirty_log
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_dirty_log(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief give guest memory of a VM back to SOS, or map it back
+ *
+ * The reclaimed memory is unmapped from the VM, an access to it is sent to
+ * the device model as a REQ_RECLAIMED request so that it is mapped back.
+ * Before the VM starts, memory which is not populated yet can be recorded
+ * the same way to be mapped on first access.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to
+ *              struct reclaim_region
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_reclaim_memory(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -278,6 +524,24 @@ int32_t hcall_write_protect_page(struct acrn_vcpu *vcpu, struct acrn_vm *target_
  */
 int32_t hcall_gpa_to_hpa(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief translate guest physical ranges to host physical extents
+ *
+ * Translate an array of guest physical ranges of a VM, e.g. the pages of a
+ * scatter list, into host physical extents at once, merged where the host
+ * memory is contiguous. The hypercall may return before translating all of
+ * the ranges, see struct vm_gpa2hpa_batch.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to struct vm_gpa2hpa_batch
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, -EFAULT if a range is not mapped, non-zero on other errors.
+ */
+int32_t hcall_gpa_to_hpa_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief Assign one PCI dev to VM.
  *
@@ -334,6 +598,25 @@ int32_t hcall_assign_mmiodev(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
  */
 int32_t hcall_deassign_mmiodev(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Assign a list of MMIO devs to VM.
+ *
+ * The devices contiguous in both the guest and the host physical spaces are
+ * mapped as one region, and each EPT is flushed once per few devices rather
+ * than per device. The hypercall stops at an invalid device, see struct
+ * acrn_mmiodev_list.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 guest physical address. This gpa points to struct
+ *              acrn_mmiodev_list
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_assign_mmiodevs(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief Add an emulated device in hypervisor.
  *
@@ -405,7 +688,11 @@ int32_t hcall_reset_ptdev_intr_info(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 int32_t hcall_get_cpu_pm_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
 /**
- * @brief Get VCPU a VM's interrupt count data.
+ * @brief Get VCPU a VM's interrupt count data, or set how its ptdev interrupts are delayed.
+ *
+ * The count data is either a snapshot of the counts of all the ptdevs, or
+ * only the ptdevs above a threshold with their counts since the last query,
+ * cheap enough to be polled often.
  *
  * @param vcpu Pointer to vCPU that initiates the hypercall
  * @param target_vm Pointer to target VM data structure
@@ -418,6 +705,40 @@ int32_t hcall_get_cpu_pm_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
  */
 int32_t hcall_vm_intr_monitor(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Send a fixed IPI to several vCPUs of the calling VM
+ *
+ * One hypercall replaces the ICR writes of the targets one by one.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to the VM of the vCPU
+ * @param param1 bitmap of the target vCPU ids
+ * @param param2 vector of the IPI
+ *
+ * @pre (get_vm_config(vcpu->vm->vm_id)->guest_flags & GUEST_FLAG_PV_IPI) != 0UL
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_send_ipi(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Register the state of the calling vCPU shared with the guest
+ *
+ * The hypervisor accounts the steal time of the vCPU in it and flags the
+ * vCPU as preempted while it is scheduled out, the guest then asks for a
+ * TLB flush at its next VM entry in place of a TLB shootdown IPI.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm not used
+ * @param param1 guest physical address of a struct acrn_pv_vcpu_state,
+ *              0 to unregister it
+ * @param param2 not used
+ *
+ * @pre (get_vm_config(vcpu->vm->vm_id)->guest_flags & GUEST_FLAG_PV_STEAL_TIME) != 0UL
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_vcpu_pv_state(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		uint64_t param1, uint64_t param2);
+
 /**
  * @defgroup trusty_hypercall Trusty Hypercalls
  *
@@ -544,6 +865,26 @@ int32_t hcall_setup_hv_npk_log(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
  */
 int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Get the VM exit statistics of a vCPU
+ *
+ * Copy the per exit reason count, cycles and log2 latency histogram of one
+ * vCPU of the target VM to the SOS.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to sos
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vmexit_stats, the vcpu_id of which is an input
+ *
+ * @pre is_sos_vm(vcpu->vm)
+ * @pre param2 shall be a valid physical address
+ *
+ * @retval 0 on success
+ * @retval -1 in case of error
+ */
+int32_t hcall_get_vmexit_stats(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 /**
  * @brief Execute profiling operation
  *
@@ -8,6 +8,7 @@
 #define PTDEV_H
 #include <list.h>
 #include <asm/lib/spinlock.h>
+#include <asm/lib/qspinlock.h>
 #include <timer.h>
 
 
@@ -27,6 +28,13 @@ union source_id (name) = {.msi_id = {.bdf = (a), .entry_nr = (b)} }
 #define DEFINE_INTX_SID(name, a, b)	\
 union source_id (name) = {.intx_id = {.gsi = (a), .ctlr = (b)} }
 
+/* interrupt coalescing policy of a ptdev, see INTR_CMD_COALESCE_INT */
+struct ptirq_coalesce_policy {
+	uint64_t window;	/* in TSC ticks, 0 if coalescing is off */
+	uint32_t threshold;	/* interrupts in a window that turn coalescing on */
+	uint32_t max_merged;	/* most interrupts merged into one injection, 0 for no limit */
+};
+
 union irte_index {
 	uint16_t index;
 	struct {
@@ -136,7 +144,14 @@ struct ptirq_remapping_info {
 	uint16_t irte_idx;
 
 	uint64_t intr_count;
+	uint64_t intr_count_reported;	/* intr_count at the last delta reported */
 	struct hv_timer intr_delay_timer; /* used for delay intr injection */
+	spinlock_t coalesce_lock;	/* the interrupt handler takes it for the fields below */
+	struct ptirq_coalesce_policy coalesce;
+	uint64_t coalesce_start;	/* TSC the current window started at */
+	uint32_t coalesce_cnt;		/* interrupts in the current window */
+	uint32_t coalesce_merged;	/* interrupts merged into the pending injection */
+	bool coalescing;
 	ptirq_arch_release_fn_t release_cb;
 };
 
@@ -146,7 +161,7 @@ static inline bool is_entry_active(const struct ptirq_remapping_info *entry)
 }
 
 extern struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
-extern spinlock_t ptdev_lock;
+extern qspinlock_t ptdev_lock;
 
 /**
  * @file ptdev.h
@@ -270,6 +285,15 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
  *
  */
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry);
+/**
+ * @brief Hand an active entry over to another VM.
+ *
+ * @param[in]    entry the active ptirq_remapping_info entry.
+ * @param[in]    vm the VM the entry is handed over to.
+ * @param[in]    virt_sid the virtual source id of the entry in that VM.
+ *
+ */
+void ptirq_move_entry(struct ptirq_remapping_info *entry, struct acrn_vm *vm, const union source_id *virt_sid);
 /**
  * @brief Get the interrupt information and store to the buffer provided.
  *
@@ -282,6 +306,35 @@ void ptirq_deactivate_entry(struct ptirq_remapping_info *entry);
  */
 uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt);
 
+/**
+ * @brief Get the ptdevs that took many interrupts since the last call.
+ *
+ * Store the physical IRQ and the interrupt count since the last call of the
+ * ptdevs of the VM which took at least @p threshold interrupts since. The
+ * count of a ptdev left out for lack of room keeps accumulating.
+ *
+ * @param[in]    target_vm the VM to get the interrupt information.
+ * @param[out]   buffer where interrupt information is stored.
+ * @param[in]    buffer_cnt the size of the buffer.
+ * @param[in]    threshold the fewest interrupts of a ptdev reported.
+ *
+ * @retval the actual size the buffer filled with the interrupt information
+ */
+uint32_t ptirq_get_intr_delta(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt,
+		uint64_t threshold);
+
+/**
+ * @brief Set the interrupt coalescing policy of ptdevs.
+ *
+ * @param[in]    target_vm the VM the ptdevs are assigned to.
+ * @param[in]    phys_irq physical IRQ of the ptdev, INTR_COALESCE_ALL_IRQS
+ *               for all the ptdevs of the VM, including the ones set up later.
+ * @param[in]    policy the coalescing policy.
+ *
+ */
+void ptirq_set_intr_coalesce(struct acrn_vm *target_vm, uint64_t phys_irq,
+		const struct ptirq_coalesce_policy *policy);
+
 /**
   * @}
   */
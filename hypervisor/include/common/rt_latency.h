@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2021 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef COMMON_RT_LATENCY_H
+#define COMMON_RT_LATENCY_H
+
+#include <types.h>
+#include <util.h>
+#include <acrn_common.h>
+#include <asm/lib/bits.h>
+
+/*
+ * Account a delay of delta TSC cycles. Only the pCPU owning the histogram
+ * updates it, a reader may see the count and the buckets one delay apart.
+ */
+static inline void account_latency(struct acrn_latency_hist *hist, uint64_t delta)
+{
+	uint64_t scaled = delta >> RT_LATENCY_BUCKET_SHIFT;
+	uint32_t bucket = 0U;
+
+	if (scaled != 0UL) {
+		bucket = min((uint32_t)fls64(scaled) + 1U, RT_LATENCY_NR_BUCKETS - 1U);
+	}
+
+	hist->count++;
+	hist->total += delta;
+	if (delta > hist->max) {
+		hist->max = delta;
+	}
+	hist->hist[bucket]++;
+}
+
+#endif /* COMMON_RT_LATENCY_H */
@@ -31,6 +31,8 @@ enum sched_notify_mode {
 struct thread_object;
 typedef void (*thread_entry_t)(struct thread_object *obj);
 typedef void (*switch_t)(struct thread_object *obj);
+typedef bool (*can_migrate_t)(const struct thread_object *obj, uint16_t pcpu_id);
+typedef void (*migrate_t)(struct thread_object *obj, uint16_t pcpu_id);
 struct thread_object {
 	char name[16];
 	uint16_t pcpu_id;
@@ -44,6 +46,11 @@ struct thread_object {
 	switch_t switch_out;
 	switch_t switch_in;
 
+	uint64_t affinity;		/* pcpus the thread may be migrated to */
+	uint64_t last_run_tsc;		/* when the thread was switched out last time */
+	can_migrate_t can_migrate;	/* NULL if the thread can't leave its pcpu */
+	migrate_t migrate;		/* called on the old pcpu with both schedule locks held */
+
 	uint8_t data[THREAD_DATA_SIZE];
 };
 
@@ -54,6 +61,18 @@ struct sched_control {
 	spinlock_t scheduler_lock;	/* to protect sched_control and thread_object */
 	struct acrn_scheduler *scheduler;
 	void *priv;
+
+	uint32_t nr_runnable;		/* runnable threads waiting for this pcpu */
+	uint64_t nr_migrations;		/* threads migrated away from this pcpu */
+	uint64_t pull_mask;		/* idle pcpus asking this pcpu for work */
+	uint64_t next_balance_tsc;
+	uint64_t slice_end_tsc;		/* when the slice of curr_obj ends, 0 if it doesn't */
+
+	/*
+	 * Set while the pcpu runs hypervisor code which checks NEED_RESCHEDULE
+	 * before it next enters a guest, so reschedule requests need no IPI.
+	 */
+	volatile bool polling;
 };
 
 #define SCHEDULER_MAX_NUMBER 4U
@@ -74,6 +93,8 @@ struct acrn_scheduler {
 	void	(*yield)(struct sched_control *ctl);
 	/* prioritize the thread object */
 	void	(*prioritize)(struct thread_object *obj);
+	/* pick a runnable thread object to migrate to another pcpu */
+	struct thread_object* (*pick_migrate)(struct sched_control *ctl, uint16_t pcpu_id, bool cold_only);
 	/* deinit private data of scheduler */
 	void	(*deinit_data)(struct thread_object *obj);
 	/* deinit scheduler */
@@ -94,12 +115,28 @@ struct sched_iorr_control {
 extern struct acrn_scheduler sched_bvt;
 struct sched_bvt_control {
 	struct list_head runqueue;
+	struct thread_object **heap;	/* runqueue ordered by evt, 1-based */
+	uint32_t nr_queued;
 	struct hv_timer tick_timer;
 };
 
+#define BVT_VT_HIST_BUCKETS	8U
+struct sched_bvt_stats {
+	int64_t avt;
+	int64_t evt;
+	uint32_t vt_hist[BVT_VT_HIST_BUCKETS];
+};
+void sched_bvt_get_stats(const struct thread_object *obj, struct sched_bvt_stats *stats);
+
 bool is_idle_thread(const struct thread_object *obj);
 uint16_t sched_get_pcpuid(const struct thread_object *obj);
 struct thread_object *sched_get_current(uint16_t pcpu_id);
+uint32_t sched_get_nr_runnable(uint16_t pcpu_id);
+bool sched_use_preemption_timer(void);
+uint64_t sched_get_slice_end(uint16_t pcpu_id);
+void sched_check_slice_end(uint16_t pcpu_id);
+struct thread_object *sched_pick_migrate(const struct sched_control *ctl, const struct list_head *runqueue,
+		uint16_t pcpu_id, bool cold_only);
 
 void init_sched(uint16_t pcpu_id);
 void deinit_sched(uint16_t pcpu_id);
@@ -111,12 +148,14 @@ void deinit_thread_data(struct thread_object *obj);
 
 void make_reschedule_request(uint16_t pcpu_id, uint16_t delmode);
 bool need_reschedule(uint16_t pcpu_id);
+void set_reschedule_polling(uint16_t pcpu_id, bool polling);
 
 void run_thread(struct thread_object *obj);
 void sleep_thread(struct thread_object *obj);
 void sleep_thread_sync(struct thread_object *obj);
 void wake_thread(struct thread_object *obj);
 void yield_current(void);
+bool boost_thread(struct thread_object *obj);
 void schedule(void);
 
 void arch_switch_to(void *prev_sp, void *next_sp);
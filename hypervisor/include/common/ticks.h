@@ -45,6 +45,14 @@ uint64_t us_to_ticks(uint32_t us);
  */
 uint64_t ticks_to_us(uint64_t ticks);
 
+/**
+ * @brief Convert CPU cycles to nano seconds.
+ *
+ * @param[in] ticks CPU ticks to convert
+ * @return nanosecond
+ */
+uint64_t ticks_to_ns(uint64_t ticks);
+
 /**
  * @brief Convert CPU cycles to milli seconds.
  *
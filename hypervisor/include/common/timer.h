@@ -27,21 +27,27 @@ enum tick_mode {
 	TICK_MODE_PERIODIC,	/**< periodic mode */
 };
 
+struct hv_timer;
+
 /**
  * @brief Definition of timers for per-cpu
  */
 struct per_cpu_timers {
-	struct list_head timer_list;	/**< it's for runtime active timer list */
+	struct hv_timer **heap;		/**< min-heap of active timers, 1-based, ordered by timeout */
+	uint32_t nr_timers;		/**< number of timers in the heap */
 };
 
 /**
  * @brief Definition of timer
  */
 struct hv_timer {
-	struct list_head node;		/**< link all timers */
+	uint32_t heap_idx;		/**< index in the per-cpu timer heap, 0 if not started */
+	uint16_t pcpu_id;		/**< pcpu whose heap holds the timer */
 	enum tick_mode mode;		/**< timer mode: one-shot or periodic */
 	uint64_t timeout;		/**< tsc deadline to interrupt */
 	uint64_t period_in_cycle;	/**< period of the periodic timer in CPU ticks */
+	uint64_t slack;			/**< CPU ticks the timer may be delayed to coalesce with others */
+	uint64_t deadline;		/**< timeout + slack when the timer was added */
 	timer_handle_t func;		/**< callback if time reached */
 	void *priv_data;		/**< func private data */
 };
@@ -97,6 +103,21 @@ bool timer_is_started(const struct hv_timer *timer);
  */
 void update_timer(struct hv_timer *timer, uint64_t timeout, uint64_t period);
 
+/**
+ * @brief Set the slack of a timer.
+ *
+ * The timer may fire up to slack CPU ticks after its timeout, so that
+ * timers expiring close to each other are handled by one interrupt.
+ *
+ * @param[in] timer Pointer to timer.
+ * @param[in] slack slack of the timer in unit of CPU ticks.
+ *
+ * @return None
+ *
+ * @remark Takes effect the next time the timer is added.
+ */
+void set_timer_slack(struct hv_timer *timer, uint64_t slack);
+
 /**
  * @brief Add a timer.
  *
@@ -104,6 +125,7 @@ void update_timer(struct hv_timer *timer, uint64_t timeout, uint64_t period);
  *
  * @retval 0 on success
  * @retval -EINVAL timer has an invalid value
+ * @retval -ENOMEM the timer heap of this pcpu is full
  *
  * @remark Don't call it in the timer callback function or interrupt content.
  */
@@ -120,6 +142,17 @@ int32_t add_timer(struct hv_timer *timer);
  */
 void del_timer(struct hv_timer *timer);
 
+/**
+ * @brief Get the TSC the physical timer of the current pCPU is armed for.
+ *
+ * @param[in] pcpu_id ID of the current pCPU.
+ *
+ * @return The deadline of the earliest timer, 0 if no timer is started.
+ *
+ * @remark Call it with the interrupts disabled.
+ */
+uint64_t next_timer_deadline(uint16_t pcpu_id);
+
 /**
  * @brief Initialize timer.
  *
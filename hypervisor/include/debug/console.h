@@ -34,6 +34,13 @@ size_t console_write(const char *s, size_t len);
 void console_putc(const char *ch);
 char console_getc(void);
 
+/** Waits for the pending console output to be sent.
+ *
+ *  The output is queued once the console timer runs, the fatal paths flush it
+ *  before stopping the pCPU.
+ */
+void console_flush(void);
+
 void console_setup_timer(void);
 
 void suspend_console(void);
@@ -48,6 +48,7 @@ typedef enum IPI_COMMANDS {
 	IPI_PMU_START,
 	IPI_PMU_STOP,
 	IPI_VMSW_CONFIG,
+	IPI_GUEST_SAMPLE,
 	IPI_UNKNOWN,
 } ipi_commands;
 
@@ -298,6 +299,7 @@ struct profiling_info_wrapper {
 	socwatch_state soc_state;
 	struct sw_msr_op_info sw_msr_info;
 	spinlock_t sw_lock;
+	struct hv_timer sample_timer;
 } __aligned(8);
 
 int32_t profiling_get_version_info(struct acrn_vm *vm, uint64_t addr);
@@ -310,6 +312,7 @@ int32_t profiling_configure_pmi(struct acrn_vm *vm, uint64_t addr);
 int32_t profiling_configure_vmsw(struct acrn_vm *vm, uint64_t addr);
 void profiling_ipi_handler(void *data);
 int32_t profiling_get_status_info(struct acrn_vm *vm, uint64_t addr);
+int32_t profiling_set_guest_sampling(uint32_t period_us);
 
 #endif
 
@@ -55,7 +55,8 @@ struct shared_buf {
 	uint32_t reserved;
 	uint32_t overrun_cnt;	/* count of overrun */
 	uint32_t size;		/* ele_num * ele_size */
-	uint32_t padding[6];
+	uint32_t wakeup_thres;	/* notify the SOS when this many elements are buffered, 0 to disable */
+	uint32_t padding[5];
 };
 
 
@@ -64,6 +65,11 @@ struct shared_buf {
  *@pre data != NULL
  */
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data);
+/**
+ *@pre sbuf != NULL
+ *@pre data != NULL
+ */
+uint32_t sbuf_put_many(struct shared_buf *sbuf, uint8_t *data, uint32_t ele_cnt);
 int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva);
 void sbuf_reset(void);
 uint32_t sbuf_next_ptr(uint32_t pos, uint32_t span, uint32_t scope);
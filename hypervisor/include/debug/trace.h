@@ -41,6 +41,9 @@
 
 #define TRACE_VMEXIT_UNHANDLED		0x20000U
 
+/* guest RIP sample, the low 16 bits are (vm_id << 8) | vcpu_id */
+#define TRACE_GUEST_SAMPLE		0x30000U
+
 void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f);
 void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
 void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uint8_t b1, uint8_t b2);
@@ -35,6 +35,7 @@
 
 /* value definitions for IIR */
 #define IIR_FIFO_MASK		0xc0U /* set if FIFOs are enabled */
+#define IIR_FIFO64		0x20U /* set if the 64-byte FIFO is enabled, 16750 */
 #define IIR_RXTOUT		0x0cU
 #define IER_EMSC		0x08U
 #define IIR_RLS			0x06U
@@ -113,6 +114,7 @@
 
 /* definition for FCR */
 #define FCR_RX_MASK	0xc0U
+#define FCR_FIFO64	(1U << 5U) /* 64-byte FIFO, 16750, written with DLAB set */
 #define FCR_DMA		(1U << 3U)
 #define FCR_TFR		(1U << 2U) /* Reset Transmit Fifo */
 #define FCR_RFR		(1U << 1U) /* Reset Receive Fifo */
@@ -137,6 +139,12 @@ enum serial_dev_type {
 void uart16550_init(bool early_boot);
 char uart16550_getc(void);
 size_t uart16550_puts(const char *buf, uint32_t len);
+/* queue the output in a ring drained by uart16550_tx_kick() instead of polling the UART */
+void uart16550_buffer_tx(bool enable);
+/* move the next TX FIFO worth of output, return whether some is left */
+bool uart16550_tx_kick(void);
+/* wait for all the queued output to be sent */
+void uart16550_flush(void);
 void uart16550_set_property(bool enabled, enum serial_dev_type uart_type, uint64_t base_addr);
 bool is_pci_dbg_uart(union pci_bdf bdf_value);
 bool get_pio_dbg_uart_cfg(uint16_t *pio_address, uint32_t *nbytes);
@@ -165,6 +165,51 @@ struct mem_io_node {
 	uint64_t range_end;
 };
 
+#define INVALID_EMUL_IO_IDX	0xFFFFU
+
+#define MAX_POSTED_IO_RANGES	16U
+
+/**
+ * @brief Range of guest writes which are delivered to SOS without suspending the vCPU
+ *
+ * An entry is free when \p end is 0.
+ */
+struct posted_io_range {
+	uint32_t type;		/**< REQ_PORTIO or REQ_MMIO */
+	uint64_t start;		/**< start of the range (inclusive) */
+	uint64_t end;		/**< end of the range (exclusive) */
+};
+
+#define MAX_IOKICKS		64U
+
+/**
+ * @brief Guest write which is completed by the hypervisor and signalled to SOS
+ *
+ * An entry is free when \p len is 0.
+ */
+struct iokick_entry {
+	uint32_t type;		/**< REQ_PORTIO or REQ_MMIO */
+	uint32_t len;		/**< width of the write in bytes */
+	uint64_t addr;		/**< guest physical address or port */
+	uint64_t data;		/**< value to match if \p datamatch */
+	bool datamatch;		/**< whether \p data has to match */
+	uint16_t slot;		/**< bit to set in the notification buffer */
+};
+
+/**
+ * @brief Per-vCPU cache of the last matched I/O emulation handlers
+ *
+ * Trapped accesses in a loop tend to hit the same device, so the index of the
+ * last matched handler is checked before the full search. An entry is only
+ * valid while the registration generation of the VM is unchanged.
+ */
+struct emul_io_cache {
+	uint32_t mmio_gen;	/**< emul_mmio_gen of the VM when mmio_idx was cached */
+	uint16_t mmio_idx;	/**< index in emul_mmio[] of the VM */
+	uint16_t pio_idx;	/**< index in emul_pio[] of the VM */
+	uint32_t pio_gen;	/**< emul_pio_gen of the VM when pio_idx was cached */
+};
+
 /* External Interfaces */
 
 /**
@@ -287,6 +332,49 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 					uint64_t start, uint64_t end);
 void deinit_emul_io(struct acrn_vm *vm);
+
+/**
+ * @brief Add or remove a posted I/O range of \p vm
+ *
+ * @param vm The VM whose posted I/O ranges are updated
+ * @param range The range to be added or removed
+ *
+ * @retval 0 on success
+ * @retval -EINVAL \p range is invalid or not found
+ * @retval -EBUSY No free entry to add \p range
+ */
+int32_t set_posted_io_range(struct acrn_vm *vm, const struct acrn_posted_io_range *range);
+
+/**
+ * @brief Add or remove a kick binding of \p vm
+ *
+ * @param vm The VM whose kick bindings are updated
+ * @param kick The binding to be added or removed
+ *
+ * @retval 0 on success
+ * @retval -EINVAL \p kick is invalid or not found
+ * @retval -EBUSY No free entry to add \p kick
+ */
+int32_t set_iokick(struct acrn_vm *vm, const struct acrn_iokick *kick);
+
+/**
+ * @brief Set the bit \p slot in the notification buffer of \p vm and notify SOS
+ *
+ * @param vm The VM whose notification buffer is updated
+ * @param slot The notification slot, less than ACRN_IOKICK_SLOT_MAX
+ *
+ * @return None
+ */
+void signal_iokick(struct acrn_vm *vm, uint32_t slot);
+
+/**
+ * @brief Invalidate the I/O emulation handler cache of \p vcpu
+ *
+ * @param vcpu The vCPU whose cache is invalidated
+ *
+ * @return None
+ */
+void reset_emul_io_cache(struct acrn_vcpu *vcpu);
 /**
  * @}
  */
@@ -7,7 +7,17 @@
 #ifndef MMIO_DEV_H
 #define MMIO_DEV_H
 
+bool is_valid_mmio_dev(const struct acrn_mmiodev *mmiodev);
 int32_t assign_mmio_dev(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodev);
 int32_t deassign_mmio_dev(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodev);
 
+/*
+ * Assign or deassign the MMIO devices of an array at once. The devices
+ * contiguous in both the guest and the host physical spaces are mapped as one
+ * region, and the EPT of the VM is flushed once. An invalid device is skipped
+ * and makes it return -EINVAL, after the others are done.
+ */
+int32_t assign_mmio_devs(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodevs, uint32_t nr);
+int32_t deassign_mmio_devs(struct acrn_vm *vm, const struct acrn_mmiodev *mmiodevs, uint32_t nr);
+
 #endif /* MMIO_DEV_H */
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VHPET_H
+#define VHPET_H
+
+/**
+ * @file vhpet.h
+ *
+ * @brief public APIs for virtual HPET
+ */
+
+#include <types.h>
+#include <timer.h>
+#include <asm/lib/spinlock.h>
+
+#define VHPET_BASE		0xFED00000UL
+#define VHPET_SIZE		0x400UL
+#define VHPET_NUM_TIMERS	8U
+
+struct acrn_vm;
+struct acrn_vcpu;
+struct acrn_vhpet;
+
+struct vhpet_timer {
+	struct acrn_vhpet *vhpet;
+	uint32_t num;
+	uint64_t cap_config;		/* Configuration */
+	uint64_t msireg;		/* FSB interrupt routing */
+	uint32_t compval;		/* Comparator */
+	uint32_t comprate;
+	uint64_t expire_tsc;		/* TSC when counter == compval, 0 if stopped */
+	uint64_t period_tsc;		/* TSC cycles between two expirations */
+	struct hv_timer timer;		/* only ever added on the pcpu of vCPU0 */
+};
+
+struct acrn_vhpet {
+	struct acrn_vm *vm;
+	spinlock_t lock;
+	bool enabled;			/* emulated by the hypervisor */
+
+	uint64_t config;		/* Configuration */
+	uint64_t isr;			/* Interrupt Status */
+	uint32_t countbase;		/* HPET counter base value */
+	uint64_t countbase_tsc;		/* TSC corresponding to base value */
+	uint32_t pending;		/* timers whose hv_timer is to be reprogrammed */
+
+	struct vhpet_timer timer[VHPET_NUM_TIMERS];
+};
+
+/**
+ * @brief Initialize the virtual HPET of a VM
+ *
+ * The main counter and the comparators are emulated in the hypervisor
+ * and the MMIO region is no longer forwarded to the device model.
+ *
+ * @param[in] vm Pointer to the VM
+ *
+ * @return None
+ */
+void vhpet_init(struct acrn_vm *vm);
+
+/**
+ * @brief Reset the virtual HPET of a VM to its power-on state
+ *
+ * @param[in] vm Pointer to the VM
+ *
+ * @return None
+ */
+void vhpet_reset(struct acrn_vm *vm);
+
+/**
+ * @brief Stop the virtual HPET of a VM
+ *
+ * @param[in] vm Pointer to the VM
+ *
+ * @return None
+ */
+void vhpet_deinit(struct acrn_vm *vm);
+
+/**
+ * @brief Reprogram the comparator timers of the virtual HPET
+ *
+ * Handles ACRN_REQUEST_VHPET_UPDATE, the hv_timers of the comparators are
+ * kept in the timer heap of vCPU0's pcpu and only touched from there.
+ *
+ * @param[in] vcpu Pointer to vCPU0 of the VM
+ *
+ * @return None
+ */
+void vhpet_update_timers(struct acrn_vcpu *vcpu);
+
+#endif /* VHPET_H */
@@ -40,6 +40,7 @@
 #include <asm/apicreg.h>
 #include <asm/ioapic.h>
 #include <util.h>
+#include <asm/lib/qspinlock.h>
 
 #define	VIOAPIC_BASE	0xFEC00000UL
 #define	VIOAPIC_SIZE	4096UL
@@ -54,13 +55,16 @@
  */
 
 struct acrn_single_vioapic {
-	spinlock_t	lock;
+	qspinlock_t	lock;
 	struct acrn_vm  *vm;
 	struct ioapic_info chipinfo;
 	uint32_t	ioregsel;
 	union ioapic_rte rtbl[REDIR_ENTRIES_HW];
 	/* pin_state status bitmap: 1 - high, 0 - low */
 	uint64_t pin_state[STATE_BITMAP_SIZE];
+	/* pins deasserted at EOI and notified to SOS in resample_slot[] */
+	uint64_t resample_pins[STATE_BITMAP_SIZE];
+	uint8_t resample_slot[REDIR_ENTRIES_HW];
 };
 
 /*
@@ -70,6 +74,8 @@ struct acrn_single_vioapic {
 struct acrn_vioapics {
 	uint8_t ioapic_num;
 	uint32_t nr_gsi;
+	/* serializes the recomputation of the per vCPU level-triggered vectors */
+	qspinlock_t eoi_exit_lock;
 	struct acrn_single_vioapic vioapic_array[CONFIG_MAX_IOAPIC_NUM];
 };
 
@@ -117,6 +123,18 @@ void	vioapic_set_irqline_nolock(const struct acrn_vm *vm, uint32_t vgsi, uint32_
 
 uint32_t get_vm_gsicount(const struct acrn_vm *vm);
 void	vioapic_broadcast_eoi(const struct acrn_vm *vm, uint32_t vector);
+
+struct acrn_intx_resample;
+/**
+ * @brief Bind or unbind the EOI of a vIOAPIC line to a notification slot.
+ *
+ * @param[in] vm        Pointer to target VM
+ * @param[in] resample  The binding to be added or removed
+ *
+ * @retval 0 on success
+ * @retval -EINVAL the GSI or the slot is invalid
+ */
+int32_t	vioapic_set_resample(struct acrn_vm *vm, const struct acrn_intx_resample *resample);
 void	vioapic_get_rte(const struct acrn_vm *vm, uint32_t vgsi, union ioapic_rte *rte);
 int32_t	vioapic_mmio_access_handler(struct io_request *io_req, void *handler_private_data);
 struct acrn_single_vioapic *vgsi_to_vioapic_and_vpin(const struct acrn_vm *vm, uint32_t vgsi, uint32_t *vpin);
@@ -11,7 +11,7 @@
 #define MCS9900_DEV		0x9900U
 
 extern const struct pci_vdev_ops vmcs9900_ops;
-void trigger_vmcs9900_msix(struct pci_vdev *vdev);
+bool trigger_vmcs9900_msix(struct pci_vdev *vdev);
 int32_t create_vmcs9900_vdev(struct acrn_vm *vm, struct acrn_emul_dev *dev);
 int32_t destroy_vmcs9900_vdev(struct pci_vdev *vdev);
 
@@ -33,6 +33,7 @@
 #include <asm/lib/spinlock.h>
 #include <pci.h>
 #include <list.h>
+#include <board_info.h>
 
 #define VDEV_LIST_HASHBITS 4U
 #define VDEV_LIST_HASHSIZE (1U << VDEV_LIST_HASHBITS)
@@ -70,6 +71,8 @@ struct msixcap {
 
 struct pci_msix {
 	struct msix_table_entry table_entries[CONFIG_MAX_MSIX_TABLE_NUM];
+	/* entries whose address and data are programmed in the IRTE and the device */
+	uint64_t  programmed[(CONFIG_MAX_MSIX_TABLE_NUM + 63U) >> 6U];
 	uint64_t  mmio_gpa;
 	uint64_t  mmio_hpa;
 	uint64_t  mmio_size;
@@ -92,6 +95,17 @@ struct pci_cap_sriov {
 	 * the bar information that is using to initialize SRIOV VF vdev bar.
 	 */
 	struct pci_vbar vbars[PCI_BAR_COUNT];
+
+	/*
+	 * If the vdev is a SRIOV PF vdev with VF Enable set, the VFs are
+	 * created on their first config access, from the routing ID layout
+	 * latched when VF Enable was set.
+	 */
+	uint16_t  num_vfs;
+	uint16_t  fst_vf_off;
+	uint16_t  vf_stride;
+	bool	  vfs_checked;	/* the VF physical devices were found ready */
+	uint64_t  vf_ready_tsc;	/* TSC the VFs may be accessed from */
 };
 
 union pci_cfgdata {
@@ -116,12 +130,15 @@ struct pci_vdev {
 	struct pci_pdev *pdev;
 
 	union pci_cfgdata cfgdata;
+	/* one bit per dword of a passthrough device read from cfgdata instead of the device */
+	uint32_t cfg_shadow[PCIE_CONFIG_SPACE_SIZE >> 7U];
 
 	uint32_t flags;
 
 	/* The bar info of the virtual PCI device. */
 	uint32_t nr_bars; /* 6 for normal device, 2 for bridge, 1 for cardbus */
 	struct pci_vbar vbars[PCI_BAR_COUNT];
+	uint32_t wc_bars; /* one bit per BAR to map write-combining, from the DM */
 
 	uint8_t	prev_capoff; /* Offset of previous vPCI capability */
 	uint8_t	free_capoff; /* Next free offset to add vPCI capability */
@@ -169,11 +186,21 @@ struct pci_mmio_res {
 	uint64_t end;
 };
 
+/* the vdev a vCPU last addressed, valid as long as the vpci gen is unchanged */
+struct vpci_cfg_cache {
+	uint32_t gen;		/* 0 means nothing cached */
+	union pci_bdf bdf;
+	struct pci_vdev *vdev;	/* NULL for a BDF without vdev */
+};
+
 struct acrn_vpci {
 	spinlock_t lock;
 	union pci_cfg_addr_reg addr;
+	uint32_t gen;		/* bumped whenever a vdev is added or its vBDF changes */
+	struct vpci_cfg_cache cfg_cache[MAX_PCPU_NUM];	/* indexed by vcpu_id */
 	struct pci_mmcfg_region pci_mmcfg;
 	uint32_t pci_vdev_cnt;
+	uint32_t nr_lazy_vf_pfs;	/* PFs whose VFs are created on first access */
 	struct pci_mmio_res res32; 	/* 32-bit mmio start/end address */
 	struct pci_mmio_res res64; 	/* 64-bit mmio start/end address */
 	struct pci_vdev pci_vdevs[CONFIG_MAX_PCI_DEV_NUM];
@@ -186,6 +213,7 @@ extern const struct pci_vdev_ops vhostbridge_ops;
 extern const struct pci_vdev_ops vpci_bridge_ops;
 void init_vpci(struct acrn_vm *vm);
 void deinit_vpci(struct acrn_vm *vm);
+bool vpci_has_ptdev(const struct acrn_vpci *vpci);
 struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf);
 struct acrn_assign_pcidev;
 int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_assign_pcidev *pcidev);
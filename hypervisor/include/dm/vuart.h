@@ -32,11 +32,16 @@
 #include <types.h>
 #include <asm/lib/spinlock.h>
 #include <asm/vm_config.h>
+#include <asm/page.h>
+#include <vuart_burst.h>
 
-#define RX_BUF_SIZE		256U
+#define RX_BUF_SIZE		1024U
 #define TX_BUF_SIZE		8192U
 #define INVAILD_VUART_IDX	0xFFU
 
+/* burst windows shared by the PCI vuarts of all the VMs */
+#define VUART_BURST_NUM		8U
+
 #define COM1_BASE		0x3F8U
 #define COM2_BASE		0x2F8U
 #define COM3_BASE		0x3E8U
@@ -56,6 +61,14 @@ struct vuart_fifo {
 	uint32_t size;		/* size of the fifo */
 };
 
+/* the pages mapped after the register page of a PCI vuart BAR0 */
+struct vuart_burst_window {
+	struct vuart_burst_ctrl ctrl;
+	uint8_t reserved[PAGE_SIZE - sizeof(struct vuart_burst_ctrl)];
+	uint8_t tx[VUART_BURST_DATA_SIZE];
+	uint8_t rx[VUART_BURST_DATA_SIZE];
+} __aligned(PAGE_SIZE);
+
 struct acrn_vuart {
 	uint8_t data;		/* Data register (R/W) */
 	uint8_t ier;		/* Interrupt enable register (R/W) */
@@ -75,10 +88,17 @@ struct acrn_vuart {
 	char vuart_rx_buf[RX_BUF_SIZE];
 	char vuart_tx_buf[TX_BUF_SIZE];
 	bool thre_int_pending;	/* THRE interrupt pending */
+	uint8_t intr_reason;	/* last reason reported, a PCI vuart raises an MSI on changes only */
 	bool active;
 	struct acrn_vuart *target_vu; /* Pointer to target vuart */
 	struct acrn_vm *vm;
 	struct pci_vdev *vdev;	/* pci vuart */
+	struct vuart_burst_window *burst;	/* NULL if the pci vuart has no burst window */
+	bool burst_enabled;
+	bool tx_pumping;	/* a vCPU is moving the transmit ring */
+	bool tx_pump_again;	/* and has to look at it once more */
+	uint32_t tx_cons;	/* the copies the guest can't change */
+	uint32_t rx_prod;
 	spinlock_t lock;	/* protects all softc elements */
 };
 
@@ -89,10 +109,15 @@ void deinit_pci_vuart(struct pci_vdev *vdev);
 
 void vuart_putchar(struct acrn_vuart *vu, char ch);
 char vuart_getchar(struct acrn_vuart *vu);
-void vuart_toggle_intr(const struct acrn_vuart *vu);
+void vuart_toggle_intr(struct acrn_vuart *vu);
 
 bool is_vuart_intx(const struct acrn_vm *vm, uint32_t intx_gsi);
 
+struct vuart_burst_window *vuart_alloc_burst(struct acrn_vuart *vu);
+void vuart_free_burst(struct acrn_vuart *vu);
+uint32_t vuart_read_burst_reg(struct acrn_vuart *vu, uint16_t offset);
+void vuart_write_burst_reg(struct acrn_vuart *vu, uint16_t offset, uint32_t value);
+
 uint8_t vuart_read_reg(struct acrn_vuart *vu, uint16_t offset);
 void vuart_write_reg(struct acrn_vuart *vu, uint16_t offset, uint8_t value);
 #endif /* VUART_H */
@@ -61,4 +61,11 @@ int32_t hmac_sha256(uint8_t *out_key,
 		const uint8_t *secret, size_t secret_len,
 		const uint8_t *salt, size_t salt_len);
 
+/**
+ * @brief Tell SHA-256 whether it may use the SHA extensions of the CPU
+ *
+ * @param   sha_ni      The CPU has the SHA extensions
+ */
+void init_sha256_accel(bool sha_ni);
+
 #endif  /* CRYPTO_API_H */
@@ -35,6 +35,7 @@
 #define REQ_MMIO	1U
 #define REQ_PCICFG	2U
 #define REQ_WP		3U
+#define REQ_RECLAIMED	4U
 
 #define REQUEST_READ	0U
 #define REQUEST_WRITE	1U
@@ -53,10 +54,21 @@
 #define GUEST_FLAG_HIDE_MTRR			(1UL << 3U)  	/* Whether hide MTRR from VM */
 #define GUEST_FLAG_RT				(1UL << 4U)     /* Whether the vm is RT-VM */
 #define GUEST_FLAG_NVMX_ENABLED			(1UL << 5U)	/* Whether this VM supports nested virtualization */
+#define GUEST_FLAG_VHPET			(1UL << 6U)	/* Whether the HPET is emulated by hypervisor */
+#define GUEST_FLAG_VPM_TMR			(1UL << 7U)	/* Whether the ACPI PM timer is emulated by hypervisor */
+#define GUEST_FLAG_VRTC				(1UL << 8U)	/* Whether the RTC time is emulated by hypervisor */
+#define GUEST_FLAG_PV_IPI			(1UL << 9U)	/* Whether the vm can send IPIs with a hypercall */
+#define GUEST_FLAG_PV_TLB_FLUSH			(1UL << 10U)	/* Whether the vm can skip the TLB shootdowns of preempted vCPUs */
+#define GUEST_FLAG_PV_STEAL_TIME		(1UL << 11U)	/* Whether the vm is told the time and preemptions of its vCPUs */
+#define GUEST_FLAG_VPMU				(1UL << 12U)	/* Whether the vm can use the architectural PMU */
+#define GUEST_FLAG_WBINVD_RANGE			(1UL << 13U)	/* Whether the WBINVDs of the vm only flush its own memory */
+#define GUEST_FLAG_MWAIT_PASSTHRU		(1UL << 14U)	/* Whether the vm runs MONITOR/MWAIT natively on its own pCPUs */
+#define GUEST_FLAG_HIDE_RDRAND			(1UL << 15U)	/* Whether RDRAND/RDSEED are hidden from the vm */
 
 /* TODO: We may need to get this addr from guest ACPI instead of hardcode here */
 #define VIRTUAL_SLEEP_CTL_ADDR		0x400U /* Pre-launched VM uses ACPI reduced HW mode and sleep control register */
 #define VIRTUAL_PM1A_CNT_ADDR		0x404U
+#define VIRTUAL_PM_TMR_ADDR		0x408U /* Post-launched VM PM timer, if GUEST_FLAG_VPM_TMR */
 #define	VIRTUAL_PM1A_SCI_EN		0x0001
 #define VIRTUAL_PM1A_SLP_TYP		0x1c00U
 #define VIRTUAL_PM1A_SLP_EN		0x2000U
@@ -299,7 +311,10 @@ struct vhm_request {
 	 *
 	 * For REQ_PORTIO, this has type
 	 * pio_request. For REQ_MMIO and REQ_WP, this has type mmio_request. For
-	 * REQ_PCICFG, this has type pci_request.
+	 * REQ_PCICFG, this has type pci_request. For REQ_RECLAIMED, an access to
+	 * guest memory given back to SOS, this has type mmio_request with a size
+	 * of 0: the memory at address is to be mapped back before completion and
+	 * the access is then retried.
 	 *
 	 * Byte offset: 64.
 	 */
@@ -329,6 +344,25 @@ struct vhm_request {
 	 * Byte offset: 136.
 	 */
 	uint32_t processed;
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 140.
+	 */
+	uint32_t reserved2;
+
+	/**
+	 * @brief Bitmap of the vCPUs whose request may need handling.
+	 *
+	 * Only valid in the first request of the buffer. The hypervisor
+	 * atomically sets bit N before request N becomes PENDING and clears it
+	 * when the request becomes FREE, so SOS can look for the requests to
+	 * be handled without scanning every request.
+	 *
+	 * Byte offset: 144.
+	 */
+	uint64_t pending_bitmap;
 } __aligned(256);
 
 union vhm_request_buffer {
@@ -369,8 +403,11 @@ struct acrn_create_vm {
 	*/
 	uint64_t cpu_affinity;
 
+	/** TSC frequency of the VM in kHz, 0 for the one of the host */
+	uint32_t tsc_khz;
+
 	/** Reserved for future use*/
-	uint8_t  reserved2[8];
+	uint8_t  reserved2[4];
 } __aligned(8);
 
 /**
@@ -478,6 +515,143 @@ struct acrn_set_ioreq_buffer {
 	uint64_t req_buf;
 } __aligned(8);
 
+/** The posted I/O range is removed rather than added */
+#define POSTED_IO_RANGE_DEASSIGN	(1U << 0U)
+
+/**
+ * @brief Info to add or remove a posted I/O range of a VM
+ *
+ * the parameter for HC_SET_POSTED_IO_RANGE hypercall
+ *
+ * Guest writes falling in a posted range are delivered to SOS without
+ * suspending the vCPU. The vCPU only waits for such a request when it issues
+ * its next one, so the order of the requests from one vCPU is kept.
+ */
+struct acrn_posted_io_range {
+	/** REQ_PORTIO or REQ_MMIO */
+	uint32_t type;
+
+	/** POSTED_IO_RANGE_xxx */
+	uint32_t flags;
+
+	/** start of the range (inclusive) */
+	uint64_t start;
+
+	/** end of the range (exclusive) */
+	uint64_t end;
+} __aligned(8);
+
+/** Max number of notification slots of a VM */
+#define ACRN_IOKICK_SLOT_MAX		256U
+
+/** The kick is triggered by a port I/O write rather than a MMIO write */
+#define ACRN_IOKICK_FLAG_PIO		(1U << 0U)
+/** The kick is only triggered when the written value equals \p data */
+#define ACRN_IOKICK_FLAG_DATAMATCH	(1U << 1U)
+/** The kick binding is removed rather than added */
+#define ACRN_IOKICK_FLAG_DEASSIGN	(1U << 2U)
+
+/**
+ * @brief Info to bind a guest write to a notification slot of a VM
+ *
+ * the parameter for HC_SET_IOKICK hypercall
+ *
+ * A guest write exactly matching \p addr and \p len (and \p data if
+ * ACRN_IOKICK_FLAG_DATAMATCH is set) is completed by the hypervisor. It only
+ * sets the bit \p slot in the notification buffer of the VM and injects the
+ * upcall to SOS.
+ */
+struct acrn_iokick {
+	/** ACRN_IOKICK_FLAG_xxx */
+	uint32_t flags;
+
+	/** width of the write in bytes: 1, 2, 4 or 8 */
+	uint32_t len;
+
+	/** guest physical address or port of the register */
+	uint64_t addr;
+
+	/** value to match if ACRN_IOKICK_FLAG_DATAMATCH is set */
+	uint64_t data;
+
+	/** notification slot, less than ACRN_IOKICK_SLOT_MAX */
+	uint32_t slot;
+
+	/** reserved, must be 0 */
+	uint32_t reserved;
+} __aligned(8);
+
+/** The ports of the region are accessed natively, rather than trapped again */
+#define ACRN_PIO_REGION_FLAG_PASSTHRU	(1U << 0U)
+
+/**
+ * @brief Info to change the trapping of a port I/O range of a VM
+ *
+ * the parameter for HC_SET_PIO_REGION hypercall
+ *
+ * Only the ports which SOS may access itself and which no emulation of the
+ * hypervisor claims for the VM can be passed through.
+ */
+struct acrn_pio_region {
+	/** ACRN_PIO_REGION_FLAG_xxx */
+	uint32_t flags;
+
+	/** first port of the range */
+	uint16_t base;
+
+	/** number of ports in the range */
+	uint16_t len;
+} __aligned(8);
+
+/**
+ * @brief Notification buffer shared between the hypervisor and SOS
+ *
+ * The hypervisor atomically sets bit N of \p pending when a write bound to
+ * slot N is completed. SOS atomically clears the bits it consumes.
+ */
+union acrn_iokick_buffer {
+	uint64_t pending[ACRN_IOKICK_SLOT_MAX / 64U];
+	int8_t reserved[4096];
+} __aligned(4096);
+
+/**
+ * @brief Info to set the notification buffer of a created VM
+ *
+ * the parameter for HC_SET_IOKICK_BUFFER hypercall
+ */
+struct acrn_set_iokick_buffer {
+	/** guest physical address of union acrn_iokick_buffer */
+	uint64_t kick_buf;
+} __aligned(8);
+
+/** The resample binding of the GSI is removed rather than added */
+#define ACRN_INTX_RESAMPLE_FLAG_DEASSIGN	(1U << 0U)
+
+/**
+ * @brief Info to bind the EOI of a level-triggered GSI to a notification slot
+ *
+ * the parameter for HC_SET_INTX_RESAMPLE hypercall
+ *
+ * When the guest EOIs an interrupt of \p gsi, the hypervisor deasserts the
+ * line by itself (a passthrough line is unmasked as well, as before), then
+ * sets the bit \p slot in the notification buffer of the VM and injects the
+ * upcall to SOS. The device model asserts the line again if its source still
+ * needs service, instead of deasserting it with a hypercall of its own.
+ */
+struct acrn_intx_resample {
+	/** ACRN_INTX_RESAMPLE_FLAG_xxx */
+	uint32_t flags;
+
+	/** virtual GSI of the IOAPIC line */
+	uint32_t gsi;
+
+	/** notification slot, less than ACRN_IOKICK_SLOT_MAX */
+	uint32_t slot;
+
+	/** reserved, must be 0 */
+	uint32_t reserved;
+} __aligned(8);
+
 /** Operation types for setting IRQ line */
 #define GSI_SET_HIGH		0U
 #define GSI_SET_LOW		1U
@@ -507,6 +681,281 @@ struct acrn_msi_entry {
 	uint64_t msi_data;
 } __aligned(8);
 
+/** Max number of MSIs in one HC_INJECT_MSI_BATCH hypercall */
+#define ACRN_MSI_BATCH_MAX	16U
+
+/**
+ * @brief Info to inject several MSI interrupts to VM at once
+ *
+ * the parameter for HC_INJECT_MSI_BATCH hypercall
+ *
+ * SOS collects the signals raised by the device model backends in this
+ * batch, so that a burst of interrupts costs one hypercall.
+ */
+struct acrn_msi_batch {
+	/** number of valid entries in \p msi */
+	uint32_t count;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** the MSIs to inject */
+	struct acrn_msi_entry msi[ACRN_MSI_BATCH_MAX];
+} __aligned(8);
+
+/** Max number of operations in one HC_INJECT_INTR_BATCH hypercall */
+#define ACRN_INTR_BATCH_MAX	16U
+
+/** types of struct acrn_intr_op */
+#define ACRN_INTR_OP_MSI	0U
+#define ACRN_INTR_OP_IRQLINE	1U
+
+/**
+ * @brief One interrupt operation of a batch
+ */
+struct acrn_intr_op {
+	/** ACRN_INTR_OP_MSI or ACRN_INTR_OP_IRQLINE */
+	uint32_t type;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** the MSI to inject, for ACRN_INTR_OP_MSI */
+	struct acrn_msi_entry msi;
+
+	/** the irqline operation, for ACRN_INTR_OP_IRQLINE */
+	struct acrn_irqline_ops irqline;
+} __aligned(8);
+
+/**
+ * @brief Info to inject several MSIs and irqline operations to VM at once
+ *
+ * the parameter for HC_INJECT_INTR_BATCH hypercall
+ *
+ * The operations are done in order, so an irqline raised and then lowered
+ * in the same batch pulses its line.
+ */
+struct acrn_intr_batch {
+	/** number of valid entries in \p ops */
+	uint32_t count;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** the operations to do */
+	struct acrn_intr_op ops[ACRN_INTR_BATCH_MAX];
+} __aligned(8);
+
+/** the vCPU is preempted, set and cleared by the hypervisor */
+#define ACRN_VCPU_PREEMPTED	(1U << 0U)
+/** set by the guest on a preempted vCPU, which flushes its TLB before it runs again */
+#define ACRN_VCPU_FLUSH_TLB	(1U << 1U)
+
+/**
+ * @brief State of a vCPU shared with the guest
+ *
+ * the parameter for HC_SET_VCPU_PV_STATE hypercall
+ *
+ * The hypervisor accounts in it the time the vCPU was runnable while
+ * another thread ran on its pCPU. Guest spinlocks can check
+ * ACRN_VCPU_PREEMPTED to not spin on the lock of a preempted holder and,
+ * instead of an IPI for a TLB shootdown, the guest atomically adds
+ * ACRN_VCPU_FLUSH_TLB to a vCPU that has ACRN_VCPU_PREEMPTED set.
+ */
+struct acrn_pv_vcpu_state {
+	/** ACRN_VCPU_PREEMPTED and ACRN_VCPU_FLUSH_TLB */
+	uint32_t preempted;
+
+	/** odd while the hypervisor updates \p steal */
+	uint32_t version;
+
+	/** time in ns the vCPU was preempted since the state was registered */
+	uint64_t steal;
+
+	/** Reserved */
+	uint32_t reserved[12];
+} __aligned(64);
+
+/** L3 capacity bitmask of struct acrn_rdt_clos */
+#define ACRN_RDT_L3_MASK	(1U << 0U)
+/** L2 capacity bitmask of struct acrn_rdt_clos */
+#define ACRN_RDT_L2_MASK	(1U << 1U)
+/** memory bandwidth allocation delay of struct acrn_rdt_clos */
+#define ACRN_RDT_MBA_DELAY	(1U << 2U)
+/** L3 cache occupancy counter of struct acrn_rdt_clos */
+#define ACRN_RDT_L3_OCCUPANCY	(1U << 3U)
+/** total memory bandwidth counter of struct acrn_rdt_clos */
+#define ACRN_RDT_MBM_TOTAL	(1U << 4U)
+/** local memory bandwidth counter of struct acrn_rdt_clos */
+#define ACRN_RDT_MBM_LOCAL	(1U << 5U)
+
+/**
+ * @brief RDT allocation and monitoring of the CLOS of a vCPU
+ *
+ * the parameter for HC_VM_RDT_CLOS hypercall
+ *
+ * The values flagged in \p set_flags are programmed for the CLOS the vCPU
+ * is configured with, then the current values of that CLOS are returned,
+ * \p flags telling which ones the platform supports. A CLOS can be shared
+ * by several VMs, the change applies to all of them.
+ *
+ * The monitoring counters are those of the RMID equal to the CLOS. The
+ * memory bandwidth counters accumulate bytes and wrap around, so the
+ * bandwidth is the difference of two reads divided by the time in between.
+ */
+struct acrn_rdt_clos {
+	/** virtual CPU ID, filled by the caller */
+	uint16_t vcpu_id;
+
+	/** CLOS of the vCPU */
+	uint16_t clos;
+
+	/** ACRN_RDT_L3_MASK, ACRN_RDT_L2_MASK and ACRN_RDT_MBA_DELAY
+	 *  values to set, filled by the caller
+	 */
+	uint32_t set_flags;
+
+	/** ACRN_RDT_* of the values returned */
+	uint32_t flags;
+
+	/** L3 capacity bitmask, contiguous set bits */
+	uint32_t l3_mask;
+
+	/** L2 capacity bitmask, contiguous set bits */
+	uint32_t l2_mask;
+
+	/** memory bandwidth allocation delay value */
+	uint32_t mba_delay;
+
+	/** L3 cache occupancy in bytes */
+	uint64_t l3_occupancy;
+
+	/** bytes transferred from and to all memory */
+	uint64_t mbm_total;
+
+	/** bytes transferred from and to the local memory */
+	uint64_t mbm_local;
+} __aligned(8);
+
+/** Number of VMX basic exit reasons accounted in struct acrn_pcpu_stats */
+#define PCPU_STATS_NR_EXIT_REASONS	70U
+/** Number of VM ids whose I/O requests are accounted in struct acrn_pcpu_stats */
+#define PCPU_STATS_NR_VMS		32U
+
+/**
+ * @brief Event counters of a physical CPU
+ *
+ * the parameter for HC_GET_PCPU_STATS hypercall
+ *
+ * Each pCPU increments its own counters from its boot on, without locks,
+ * and never resets them. The rates are the difference of two reads
+ * divided by the time in between. The EPT violations are the VM exits of
+ * basic reason 48.
+ */
+struct acrn_pcpu_stats {
+	/** physical CPU ID, filled by the caller */
+	uint16_t pcpu_id;
+
+	/** Reserved */
+	uint16_t reserved[3];
+
+	/** VM exits per basic exit reason */
+	uint64_t vmexits[PCPU_STATS_NR_EXIT_REASONS];
+
+	/** I/O requests sent to the device model, per VM id */
+	uint64_t ioreqs[PCPU_STATS_NR_VMS];
+
+	/** IPIs sent to the other pCPUs or to itself */
+	uint64_t ipis;
+
+	/** posted interrupt notifications received for the vCPUs */
+	uint64_t pi_notifications;
+
+	/** expirations of the hypervisor timers */
+	uint64_t timer_fires;
+
+	/** thread switches of the scheduler */
+	uint64_t sched_switches;
+
+	/** Reserved */
+	uint64_t reserved1[4];
+} __aligned(64);
+
+/** Number of log2 buckets of struct acrn_latency_hist */
+#define RT_LATENCY_NR_BUCKETS		16U
+/** Bucket 0 collects the delays shorter than 2^RT_LATENCY_BUCKET_SHIFT TSC cycles */
+#define RT_LATENCY_BUCKET_SHIFT		8U
+
+/** struct acrn_rt_latency flags: a vCPU with the LAPIC passed through runs on the pCPU */
+#define RT_LATENCY_LAPIC_PT		(1U << 0U)
+/** struct acrn_rt_latency flags: the vCPU running on the pCPU belongs to an RTVM */
+#define RT_LATENCY_RT_VM		(1U << 1U)
+
+/**
+ * @brief Histogram of the delays of one kind, in TSC cycles
+ *
+ * Bucket n (0 < n < RT_LATENCY_NR_BUCKETS - 1) counts the delays of
+ * [2^(n + RT_LATENCY_BUCKET_SHIFT - 1), 2^(n + RT_LATENCY_BUCKET_SHIFT))
+ * cycles, the last bucket counts all the longer ones.
+ */
+struct acrn_latency_hist {
+	/** number of delays measured */
+	uint64_t count;
+
+	/** sum of the delays */
+	uint64_t total;
+
+	/** longest delay since the boot of the hypervisor */
+	uint64_t max;
+
+	/** log2 histogram of the delays */
+	uint64_t hist[RT_LATENCY_NR_BUCKETS];
+} __aligned(8);
+
+/**
+ * @brief Latencies the hypervisor adds on a physical CPU
+ *
+ * the parameter for HC_GET_RT_LATENCY hypercall
+ *
+ * The delays are measured by the pCPU itself at each VM exit and timer
+ * expiration, not by a probe of their own, so that a pCPU whose LAPIC is
+ * passed through to an RTVM takes no extra interrupt, and are read from
+ * memory without interrupting the pCPU. They only grow from the boot of the
+ * hypervisor, the distribution over a period is the difference of two reads.
+ */
+struct acrn_rt_latency {
+	/** physical CPU ID, filled by the caller */
+	uint16_t pcpu_id;
+
+	/** VM id of the vCPU running on the pCPU at the read, 0xffff if none */
+	uint16_t vm_id;
+
+	/** RT_LATENCY_* of the vCPU running on the pCPU at the read */
+	uint32_t flags;
+
+	/** TSC frequency, to convert the cycles */
+	uint32_t tsc_khz;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/**
+	 * VM exit to VM entry of the vCPUs with the LAPIC passed through: the
+	 * time the RTVM vCPU did not run
+	 */
+	struct acrn_latency_hist entry_delay;
+
+	/**
+	 * TSC deadline of a vCPU with the LAPIC passed through to the VM entry,
+	 * for the deadlines passed while in the hypervisor: the delay added to
+	 * the guest timer interrupt
+	 */
+	struct acrn_latency_hist timer_delay;
+
+	/** deadline of a hypervisor timer to its handler */
+	struct acrn_latency_hist hv_timer_delay;
+} __aligned(64);
+
 /**
  * @brief Info to inject a NMI interrupt for a VM
  */
@@ -662,6 +1111,28 @@ struct acrn_intr_monitor {
 /** cmd for intr monitor **/
 #define INTR_CMD_GET_DATA 0U
 #define INTR_CMD_DELAY_INT 1U
+#define INTR_CMD_COALESCE_INT 2U
+#define INTR_CMD_GET_DELTA 3U
+
+/*
+ * buffer layout of INTR_CMD_GET_DELTA:
+ * buffer[0]: in, the fewest interrupts a ptdev took since the last
+ *            INTR_CMD_GET_DELTA to be reported
+ * on return, buf_cnt / 2 pairs of the physical IRQ of a ptdev and the
+ * interrupts it took since the last INTR_CMD_GET_DELTA
+ */
+
+/*
+ * buffer layout of INTR_CMD_COALESCE_INT:
+ * buffer[0]: physical IRQ of the ptdev as reported by INTR_CMD_GET_DATA,
+ *            or INTR_COALESCE_ALL_IRQS for all the ptdevs of the VM
+ * buffer[1]: window in us, interrupts within a window are merged into one
+ *            injection at its end, 0 to stop coalescing
+ * buffer[2]: interrupts in a window that turn coalescing on, coalescing
+ *            goes off again after a window below it
+ * buffer[3]: most interrupts merged into one injection, 0 for no limit
+ */
+#define INTR_COALESCE_ALL_IRQS 0xFFFFFFFFUL
 
 /**
  * @brief Info to configure virtual root port
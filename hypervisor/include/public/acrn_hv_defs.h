@@ -30,6 +30,8 @@
 #define HC_SOS_OFFLINE_CPU          BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x01UL)
 #define HC_SET_CALLBACK_VECTOR      BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x02UL)
 #define HC_GET_PLATFORM_INFO        BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x03UL)
+#define HC_GET_PCPU_STATS           BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x04UL)
+#define HC_GET_RT_LATENCY           BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x05UL)
 
 /* VM management */
 #define HC_ID_VM_BASE               0x10UL
@@ -40,23 +42,38 @@
 #define HC_CREATE_VCPU              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x04UL)
 #define HC_RESET_VM                 BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x05UL)
 #define HC_SET_VCPU_REGS            BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x06UL)
+#define HC_SET_VCPU_PV_STATE        BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x07UL)
+#define HC_VM_RDT_CLOS              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x08UL)
 
 /* IRQ and Interrupts */
 #define HC_ID_IRQ_BASE              0x20UL
 #define HC_INJECT_MSI               BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x03UL)
 #define HC_VM_INTR_MONITOR          BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x04UL)
 #define HC_SET_IRQLINE              BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x05UL)
+#define HC_INJECT_MSI_BATCH         BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x06UL)
+#define HC_SEND_IPI                 BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x07UL)
+#define HC_INJECT_INTR_BATCH        BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x08UL)
 
 /* DM ioreq management */
 #define HC_ID_IOREQ_BASE            0x30UL
 #define HC_SET_IOREQ_BUFFER         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x00UL)
 #define HC_NOTIFY_REQUEST_FINISH    BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x01UL)
+#define HC_SET_POSTED_IO_RANGE      BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x02UL)
+#define HC_SET_IOKICK_BUFFER        BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x03UL)
+#define HC_SET_IOKICK               BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x04UL)
+#define HC_SET_IOREQ_POLL           BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x05UL)
+#define HC_SET_PIO_REGION           BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x06UL)
+#define HC_SET_INTX_RESAMPLE        BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x07UL)
 
 /* Guest memory management */
 #define HC_ID_MEM_BASE              0x40UL
 #define HC_VM_GPA2HPA               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x01UL)
 #define HC_VM_SET_MEMORY_REGIONS    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x02UL)
 #define HC_VM_WRITE_PROTECT_PAGE    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x03UL)
+#define HC_VM_DIRTY_LOG             BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x04UL)
+#define HC_VM_RECLAIM_MEMORY        BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x05UL)
+#define HC_VM_GPA2HPA_BATCH         BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x06UL)
+#define HC_VM_WRITE_PROTECT_PAGES   BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x07UL)
 
 /* PCI assignment*/
 #define HC_ID_PCI_BASE              0x50UL
@@ -71,6 +88,7 @@
 #define HC_DEASSIGN_MMIODEV         BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x08UL)
 #define HC_ADD_VDEV                 BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x09UL)
 #define HC_REMOVE_VDEV              BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x0AUL)
+#define HC_ASSIGN_MMIODEVS          BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x0BUL)
 
 /* DEBUG */
 #define HC_ID_DBG_BASE              0x60UL
@@ -78,6 +96,7 @@
 #define HC_SETUP_HV_NPK_LOG         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x01UL)
 #define HC_PROFILING_OPS            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x02UL)
 #define HC_GET_HW_INFO              BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x03UL)
+#define HC_GET_VMEXIT_STATS         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x04UL)
 
 /* Trusty */
 #define HC_ID_TRUSTY_BASE           0x70UL
@@ -179,6 +198,91 @@ struct wp_data {
 	uint64_t gpa;
 } __aligned(8);
 
+/**
+ * Batched page write protection, the parameter for HC_VM_WRITE_PROTECT_PAGES
+ * hypercall
+ *
+ * The struct wp_data entries are applied in turn and the EPT of the VM is
+ * flushed once, after the last one. The hypercall stops at an invalid entry or
+ * when it has done its share of work: the entries from nr_done on are left to
+ * apply with another call.
+ */
+struct wp_batch {
+	/** SOS guest physical address of the array of struct wp_data */
+	uint64_t wp_gpa;
+
+	/** number of entries of the array */
+	uint32_t nr_entries;
+
+	/** on return, number of entries applied */
+	uint32_t nr_done;
+} __aligned(8);
+
+#define DIRTY_LOG_START		0U
+#define DIRTY_LOG_SYNC		1U
+#define DIRTY_LOG_STOP		2U
+
+/**
+ * @brief Info to track the guest memory written by a VM
+ *
+ * the parameter for HC_VM_DIRTY_LOG hypercall
+ */
+struct dirty_log {
+	/** DIRTY_LOG_START, DIRTY_LOG_SYNC or DIRTY_LOG_STOP */
+	uint32_t op;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** start guest physical address of the tracked region, 4K aligned,
+	 *  only for DIRTY_LOG_START
+	 */
+	uint64_t gpa;
+
+	/** size of the tracked region, multiple of 4K, only for DIRTY_LOG_START */
+	uint64_t size;
+
+	/** SOS guest physical address of the dirty bitmap, contiguous and 8 bytes
+	 *  aligned, one bit per 4K page of the region, only for DIRTY_LOG_START.
+	 *  The hypervisor only sets bits, the SOS clears those it has consumed.
+	 */
+	uint64_t bitmap_gpa;
+} __aligned(8);
+
+#define RECLAIM_UNMAP		0U
+#define RECLAIM_REMAP		1U
+#define RECLAIM_UNPOPULATED	2U
+#define RECLAIM_SHARE		3U
+
+/**
+ * @brief Info to give guest memory of a VM back to SOS, or to map it back
+ *
+ * the parameter for HC_VM_RECLAIM_MEMORY hypercall
+ *
+ * RECLAIM_SHARE maps reclaimed memory of a VM which isn't started yet to
+ * SOS memory read-only, which other VMs may map too. A write to it is then
+ * sent to the device model as for reclaimed memory, which maps a private
+ * copy back with RECLAIM_REMAP.
+ */
+struct reclaim_region {
+	/** RECLAIM_UNMAP, RECLAIM_REMAP, RECLAIM_UNPOPULATED or RECLAIM_SHARE */
+	uint32_t op;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** start guest physical address of the region, 2M aligned */
+	uint64_t gpa;
+
+	/** SOS guest physical address the region is mapped back to,
+	 *  only for RECLAIM_REMAP and RECLAIM_SHARE
+	 */
+	uint64_t sos_vm_gpa;
+
+	/** size of the region, multiple of 2M */
+	uint64_t size;
+} __aligned(8);
+
 /**
  * Setup parameter for share buffer, used for HC_SETUP_SBUF hypercall
  */
@@ -226,6 +330,51 @@ struct acrn_hw_info {
 	uint16_t reserved[3];
 } __aligned(8);
 
+/** Number of VMX basic exit reasons accounted in struct acrn_vmexit_stats */
+#define VMEXIT_STATS_NR_REASONS		70U
+/** Number of log2 latency buckets per exit reason */
+#define VMEXIT_STATS_NR_BUCKETS		16U
+/** Bucket 0 collects exits handled in less than 2^VMEXIT_STATS_BUCKET_SHIFT TSC cycles */
+#define VMEXIT_STATS_BUCKET_SHIFT	8U
+/** Number of ports whose I/O instruction exits are counted per vCPU */
+#define VMEXIT_STATS_NR_PORTS		16U
+
+/**
+ * VM exit statistics of one vCPU, the parameter for HC_GET_VMEXIT_STATS hypercall
+ *
+ * Bucket n (0 < n < VMEXIT_STATS_NR_BUCKETS - 1) of hist[] counts the exits
+ * whose handling took [2^(n + VMEXIT_STATS_BUCKET_SHIFT - 1),
+ * 2^(n + VMEXIT_STATS_BUCKET_SHIFT)) TSC cycles, the last bucket counts all
+ * the longer ones.
+ *
+ * pio[] keeps the ports which trap the most: a port missing from it replaces
+ * the entry with the lowest count and takes that count over, so the count of
+ * an entry may exceed the exits the port really took by the count it inherited.
+ */
+struct acrn_vmexit_stats {
+	/** vCPU id, filled by the caller */
+	uint16_t vcpu_id;
+
+	/** Reserved */
+	uint16_t reserved[3];
+
+	/** number of exits per basic exit reason */
+	uint64_t count[VMEXIT_STATS_NR_REASONS];
+
+	/** TSC cycles spent in the exit handler per basic exit reason */
+	uint64_t cycles[VMEXIT_STATS_NR_REASONS];
+
+	/** log2 histogram of the handling latency per basic exit reason */
+	uint32_t hist[VMEXIT_STATS_NR_REASONS][VMEXIT_STATS_NR_BUCKETS];
+
+	/** I/O instruction exits of the ports which trap the most */
+	struct {
+		uint16_t port;
+		uint16_t reserved;
+		uint32_t count;		/* 0 for an unused entry */
+	} pio[VMEXIT_STATS_NR_PORTS];
+} __aligned(8);
+
 /**
  * Gpa to hpa translation parameter, used for HC_VM_GPA2HPA hypercall
  */
@@ -237,6 +386,62 @@ struct vm_gpa2hpa {
 	uint64_t hpa;
 } __aligned(8);
 
+/**
+ * A range of guest or host physical memory, used for HC_VM_GPA2HPA_BATCH hypercall
+ */
+struct acrn_mem_extent {
+	/** start address */
+	uint64_t addr;
+
+	/** size in bytes */
+	uint64_t size;
+} __aligned(8);
+
+/**
+ * Batched gpa to hpa translation parameter, used for HC_VM_GPA2HPA_BATCH hypercall
+ *
+ * The guest physical ranges are translated in turn into host physical
+ * extents, the ones following each other in host memory are merged. When the
+ * extent array is full or the hypercall has done its share of work, it returns
+ * early: the ranges from nr_done on, less partial_size bytes of that one, are
+ * left to translate with another call.
+ *
+ * map_gen changes whenever a guest physical page of the VM may come to map
+ * to another host page or to none. The extents of a buffer shared for its
+ * lifetime, e.g. a frame buffer exported to another VM, can be cached with
+ * the map_gen they were translated at and reused while it is unchanged;
+ * a call with nr_ranges 0 just reads it.
+ */
+struct vm_gpa2hpa_batch {
+	/** SOS guest physical address of the array of struct acrn_mem_extent
+	 *  to translate, guest physical ranges of the target VM
+	 */
+	uint64_t ranges_gpa;
+
+	/** SOS guest physical address of the array of struct acrn_mem_extent
+	 *  filled in with the host physical extents
+	 */
+	uint64_t extents_gpa;
+
+	/** number of ranges to translate */
+	uint32_t nr_ranges;
+
+	/** capacity of the extent array, the number of extents filled on return */
+	uint32_t nr_extents;
+
+	/** on return, number of ranges fully translated */
+	uint32_t nr_done;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** on return, bytes translated of the range nr_done */
+	uint64_t partial_size;
+
+	/** on return, generation of the EPT mappings of the VM the extents are valid for */
+	uint64_t map_gen;
+} __aligned(8);
+
 /**
  * Intr mapping info per ptdev, the parameter for HC_SET_PTDEV_INTR_INFO
  * hypercall
@@ -300,8 +505,11 @@ struct acrn_assign_pcidev {
 	/** the base address of the PCI BAR, initialized by ACRN-DM. */
 	uint32_t bar[6];
 
+	/** bit n set to map BAR n write-combining, if it is prefetchable */
+	uint32_t wc_bars;
+
 	/** reserved for extension */
-	uint32_t rsvd2[6];
+	uint32_t rsvd2[5];
 
 } __attribute__((aligned(8)));
 
@@ -325,6 +533,27 @@ struct acrn_mmiodev {
 
 } __attribute__((aligned(8)));
 
+/**
+ * @brief Info to assign a list of MMIO devices to a VM
+ *
+ * the parameter for HC_ASSIGN_MMIODEVS hypercall
+ *
+ * The devices are moved from the SOS in turn, those contiguous in both the
+ * guest and the host physical spaces are mapped as one region. The hypercall
+ * stops at an invalid device: the devices from nr_done on are not assigned.
+ */
+struct acrn_mmiodev_list {
+	/** SOS guest physical address of the array of struct acrn_mmiodev */
+	uint64_t mmiodevs_gpa;
+
+	/** number of devices of the array */
+	uint32_t nr_mmiodevs;
+
+	/** on return, number of devices assigned */
+	uint32_t nr_done;
+
+} __attribute__((aligned(8)));
+
 /**
  * @brief Info to create or destroy a virtual PCI or legacy device for a VM
  *
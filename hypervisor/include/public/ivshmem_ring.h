@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file ivshmem_ring.h
+ *
+ * @brief Layout of the notification rings kept in an ivshmem shared region
+ *
+ * The hypervisor does not access these rings. It only defines the layout so
+ * that the VMs sharing a region agree on it. Each peer owns one inbound ring,
+ * indexed by its peer ID (its VM ID), which any other peer may produce into.
+ *
+ * A producer reserves a slot by a compare-and-swap on @c reserve, as long as
+ * @c reserve - @c cons is below @c nr_slots. It fills slot @c reserve modulo
+ * @c nr_slots and then publishes it by storing the slot index plus one into @c seq of the
+ * slot with release semantics. The consumer reads the slot at @c cons once its
+ * @c seq equals @c cons + 1, then stores @c cons + 1 into @c cons.
+ *
+ * Doorbells are rung only when the consumer asked for one. While it polls, the
+ * consumer leaves @c event_idx behind @c cons and no doorbell is rung at all.
+ * Before it sleeps, it stores @c cons into @c event_idx, fences, and checks the
+ * ring once more. A producer that published slot @c idx fences, reads
+ * @c event_idx and rings the doorbell of the ring owner when
+ * ivshmem_ring_need_doorbell(event_idx, idx) is true. As the consumer takes the
+ * slots in order, only the producer of the slot it waits for has to ring.
+ *
+ * A consumer may also mask its MSI-X vector while it polls. The hypervisor
+ * keeps the doorbells rung meanwhile pending and delivers them once the vector
+ * is unmasked, so a wakeup racing the unmask is not lost.
+ */
+
+#ifndef IVSHMEM_RING_H
+#define IVSHMEM_RING_H
+
+#include <types.h>
+
+#define IVSHMEM_RING_MAGIC	0x474e5249U	/* "IRNG" */
+#define IVSHMEM_RING_VERSION	1U
+#define IVSHMEM_RING_ALIGN	64U
+
+/* at offset 0 of the shared region, written by whichever peer sets the region up */
+struct ivshmem_ring_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nr_rings;	/* one inbound ring per peer ID */
+	uint32_t nr_slots;	/* per ring, a power of 2 */
+	uint32_t slot_size;	/* in bytes, header included, a multiple of IVSHMEM_RING_ALIGN */
+	uint64_t ring_offset;	/* offset of ring 0 in the region, a multiple of IVSHMEM_RING_ALIGN */
+	uint64_t ring_stride;	/* distance between two rings, ring control included */
+} __aligned(64);
+
+/* at the start of each ring, followed by its slots; each side writes its own cache line only */
+struct ivshmem_ring_ctrl {
+	/* written by the producers */
+	uint32_t reserve;	/* next slot index to reserve, free running */
+	uint32_t reserved0[15];
+
+	/* written by the consumer */
+	uint32_t cons;		/* next slot index to consume, free running */
+	uint32_t event_idx;	/* doorbell wanted once this slot index is published */
+	uint32_t reserved1[14];
+} __aligned(64);
+
+struct ivshmem_ring_slot {
+	uint32_t seq;		/* slot index plus one once published */
+	uint32_t len;		/* bytes used in data */
+	uint8_t data[];
+};
+
+/**
+ * @brief Check whether publishing a slot needs a doorbell
+ *
+ * @param event_idx The event_idx of the ring, read after the slot was published.
+ * @param idx The index of the slot just published.
+ *
+ * @return true if the consumer asked to be woken up for this slot.
+ */
+static inline bool ivshmem_ring_need_doorbell(uint32_t event_idx, uint32_t idx)
+{
+	return (event_idx == idx);
+}
+
+#endif /* IVSHMEM_RING_H */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * @file vuart_burst.h
+ *
+ * @brief Burst window of the PCI vUART
+ *
+ * Besides the 16550 registers, BAR0 of a PCI vUART may hold a burst window
+ * which moves the data through memory instead of one register access per
+ * byte. The window is present when the register at VUART_BURST_ID_REG reads
+ * VUART_BURST_MAGIC; its pages are mapped into the VM, only the registers of
+ * the first page trap.
+ *
+ * The transmit and receive rings are VUART_BURST_DATA_SIZE bytes each, with
+ * free running indices. The guest writes the bytes to send into the transmit
+ * ring, advances @c tx_prod and writes VUART_BURST_KICK_TX to the doorbell: the
+ * bytes the peer can take are moved at once and @c tx_cons is advanced. The
+ * hypervisor writes the bytes received into the receive ring and advances
+ * @c rx_prod; the guest reads them, advances @c rx_cons and writes
+ * VUART_BURST_KICK_RX to the doorbell if the peer was waiting for room.
+ *
+ * No interrupt is raised unless asked for: the guest sets @c tx_intr or
+ * @c rx_intr to 1, fences, checks the ring once more and waits. The hypervisor clears
+ * the field and raises the MSI-X vector of the vUART on the next transmit
+ * progress or received bytes, so a driver that keeps up takes no interrupt.
+ */
+
+#ifndef VUART_BURST_H
+#define VUART_BURST_H
+
+#include <types.h>
+
+#define VUART_BURST_MAGIC		0x57425556U	/* "VUBW" */
+
+/* registers in the first page of BAR0, after the 16550 ones */
+#define VUART_BURST_ID_REG		0x10U
+#define VUART_BURST_CTRL_REG		0x14U
+#define VUART_BURST_DOORBELL_REG	0x18U
+
+#define VUART_BURST_CTRL_ENABLE		(1U << 0U)	/* the rings replace the 16550 data path */
+#define VUART_BURST_KICK_TX		(1U << 0U)
+#define VUART_BURST_KICK_RX		(1U << 1U)
+
+/* layout of BAR0 */
+#define VUART_BURST_BAR_SIZE		0x4000UL
+#define VUART_BURST_CTRL_OFFSET		0x1000UL
+#define VUART_BURST_TX_OFFSET		0x2000UL
+#define VUART_BURST_RX_OFFSET		0x3000UL
+#define VUART_BURST_DATA_SIZE		0x1000U
+
+/* at VUART_BURST_CTRL_OFFSET; each side writes its own fields only */
+struct vuart_burst_ctrl {
+	uint32_t tx_prod;	/* written by the guest */
+	uint32_t tx_cons;	/* written by the hypervisor */
+	uint32_t tx_intr;	/* set by the guest, cleared by the hypervisor */
+	uint32_t reserved0[13];
+
+	uint32_t rx_prod;	/* written by the hypervisor */
+	uint32_t rx_cons;	/* written by the guest */
+	uint32_t rx_intr;	/* set by the guest, cleared by the hypervisor */
+	uint32_t reserved1[13];
+} __aligned(64);
+
+#endif /* VUART_BURST_H */
@@ -25,6 +25,7 @@
  *  http://csrc.nist.gov/publications/fips/fips180-2/fips180-2.pdf
  */
 
+#include <crypto_api.h>
 #include "md.h"
 #include "sha256.h"
 
@@ -190,7 +191,15 @@ int32_t mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int32_t is224)
     return 0;
 }
 
-int32_t mbedtls_internal_sha256_process(mbedtls_sha256_context *ctx, const uint8_t data[64])
+/* set once at boot, when the CPU has the SHA extensions */
+static bool sha256_ni_enabled;
+
+void init_sha256_accel(bool sha_ni)
+{
+    sha256_ni_enabled = sha_ni;
+}
+
+static void sha256_process_generic(mbedtls_sha256_context *ctx, const uint8_t data[64])
 {
     uint32_t w[64];
     uint32_t a[8];
@@ -244,6 +253,24 @@ int32_t mbedtls_internal_sha256_process(mbedtls_sha256_context *ctx, const uint8
     for (i = 0U; i < 8U; i++) {
         ctx->state[i] += a[i];
     }
+}
+
+static void sha256_process_blocks(mbedtls_sha256_context *ctx, const uint8_t *data, size_t nr_blocks)
+{
+    size_t i;
+
+    if (sha256_ni_enabled) {
+        sha256_ni_process_blocks(ctx->state, data, (uint64_t)nr_blocks);
+    } else {
+        for (i = 0U; i < nr_blocks; i++) {
+            sha256_process_generic(ctx, &data[i * 64U]);
+        }
+    }
+}
+
+int32_t mbedtls_internal_sha256_process(mbedtls_sha256_context *ctx, const uint8_t data[64])
+{
+    sha256_process_blocks(ctx, data, 1U);
 
     return 0;
 }
@@ -282,19 +309,15 @@ int32_t mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const uint8_t *in
         }
 
         if (ret == 0) {
-             while (len >= 64U) {
-                ret = mbedtls_internal_sha256_process(ctx, data);
-                if (ret == 0) {
-                    data += 64;
-                    len  -= 64U;
-                    break;
-                }
+            /* all the full blocks at once */
+            if (len >= 64U) {
+                sha256_process_blocks(ctx, data, len / 64U);
+                data += len & ~(size_t)0x3FU;
+                len  &= 0x3FU;
             }
 
-            if (ret == 0) {
-                if (len > 0U) {
-                    (void)memcpy_s((void *)&ctx->buffer[left], len, data, len);
-                }
+            if (len > 0U) {
+                (void)memcpy_s((void *)&ctx->buffer[left], len, data, len);
             }
         }
     }
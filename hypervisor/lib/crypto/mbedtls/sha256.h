@@ -121,6 +121,17 @@ int32_t mbedtls_sha256_finish_ret( mbedtls_sha256_context *ctx,
 int32_t mbedtls_internal_sha256_process( mbedtls_sha256_context *ctx,
                                      const uint8_t data[64] );
 
+/**
+ * \brief          Block transform using the SHA extensions of the CPU,
+ *                 only called when init_sha256_accel() was told they exist.
+ *
+ * \param state    The SHA-256 state words, a..h.
+ * \param data     The buffer holding \p nr_blocks blocks of data.
+ * \param nr_blocks The number of 64-byte blocks, at least 1.
+ */
+void sha256_ni_process_blocks( uint32_t state[8], const uint8_t *data,
+                               uint64_t nr_blocks );
+
 /**
  * \brief          This function calculates the SHA-224 or SHA-256
  *                 checksum of a buffer.
@@ -19,6 +19,7 @@ char console_getc(void)
 }
 
 void console_putc(__unused const char *ch) {}
+void console_flush(void) {}
 
 void console_init(void) {}
 void console_setup_timer(void) {}
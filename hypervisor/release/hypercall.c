@@ -26,6 +26,12 @@ int32_t hcall_get_hw_info(__unused struct acrn_vcpu *vcpu, __unused struct acrn_
 	return -EPERM;
 }
 
+int32_t hcall_get_vmexit_stats(__unused struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	return -EPERM;
+}
+
 int32_t hcall_profiling_ops(__unused struct acrn_vcpu *vcpu, __unused struct acrn_vm *target_vm,
 		__unused uint64_t param1, __unused uint64_t param2)
 {
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2021 Intel Corporation. All rights reserved.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+"""
+Generate the list of hot functions placed first in .text (make HOT_TEXT=<list>).
+
+The profile is the output of the "vmexit" command of the hypervisor shell,
+captured in a debug build while the benchmarks (e.g. acrnbench) run in the VMs.
+The VM exit handlers are ordered by the cycles spent in their exits, and
+followed by the functions of the base list which are not handlers.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+hv_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+def read_exit_reasons():
+    reasons = {}
+    with open(os.path.join(hv_dir, "include", "arch", "x86", "asm", "vmx.h")) as f:
+        for m in re.finditer(r"#define\s+(VMX_EXIT_REASON_\w+)\s+(0x[0-9a-fA-F]+)U", f.read()):
+            reasons[m.group(1)] = int(m.group(2), 16)
+    return reasons
+
+def read_dispatch_table():
+    """
+    Return {exit reason: handler} from the dispatch table of vmexit.c.
+    """
+    reasons = read_exit_reasons()
+    handlers = {}
+    with open(os.path.join(hv_dir, "arch", "x86", "guest", "vmexit.c")) as f:
+        for m in re.finditer(r"\[(VMX_EXIT_REASON_\w+)\]\s*=\s*\{\s*\.handler\s*=\s*(\w+)", f.read()):
+            if m.group(1) in reasons:
+                handlers[reasons[m.group(1)]] = m.group(2)
+    return handlers
+
+def read_profile(path):
+    """
+    Return {exit reason: cycles} summed over all the vCPUs in the shell output.
+    """
+    cycles = {}
+    regex = re.compile(r"^\s+(\d+)\s+(\d+)\s+(\d+)(\s+\d+:\d+)*\s*$")
+    with open(path, errors="ignore") as f:
+        for line in f:
+            m = regex.match(line.rstrip("\r\n"))
+            if m:
+                reason = int(m.group(1))
+                cycles[reason] = cycles.get(reason, 0) + int(m.group(2)) * int(m.group(3))
+    return cycles
+
+def read_list(path):
+    with open(path) as f:
+        return [line.strip() for line in f if line.strip() and not line.startswith("#")]
+
+def main(args):
+    handlers = read_dispatch_table()
+    cycles = read_profile(args.profile)
+    if not cycles:
+        sys.exit(f"{args.profile}: no VM exit statistics found")
+
+    hot = []
+    for reason in sorted(cycles, key=lambda r: cycles[r], reverse=True):
+        handler = handlers.get(reason)
+        if handler is not None and handler not in hot:
+            hot.append(handler)
+    for fn in read_list(args.base):
+        if fn not in hot and fn not in handlers.values():
+            hot.append(fn)
+
+    out = open(args.out, "w") if args.out else sys.stdout
+    print(f"# Generated by gen_hot_text.py from {os.path.basename(args.profile)}", file=out)
+    for fn in hot:
+        print(fn, file=out)
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("profile", help="output of the 'vmexit' shell command of all the VMs benchmarked")
+    parser.add_argument("--base", default=os.path.join(hv_dir, "bsp", "ld", "hot_text.lst"),
+                        help="list of the other hot functions, appended after the exit handlers")
+    parser.add_argument("--out", help="the list generated, printed if not given")
+    main(parser.parse_args())
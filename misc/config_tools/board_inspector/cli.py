@@ -11,18 +11,78 @@ import subprocess
 import lxml.etree
 import argparse
 from importlib import import_module
+from concurrent.futures import ProcessPoolExecutor
 
 script_dir = os.path.dirname(os.path.realpath(__file__))
 sys.path.append(os.path.join(script_dir))
 
+from extractors import cache
+
+def load_extractors(args):
+    extractors_path = os.path.join(script_dir, "extractors")
+    extractors = [f for f in os.listdir(extractors_path) if f[:2].isdigit()]
+    modules = []
+    for extractor in sorted(extractors):
+        module_name = os.path.splitext(extractor)[0]
+        module = import_module(f"extractors.{module_name}")
+        if not args.advanced and getattr(module, "advanced", False):
+            continue
+        modules.append(module)
+    return modules
+
+def run_group(group, module_names, cache_dir, advanced):
+    """
+    Run the extractors of a group, in a worker process, on a board XML of its own and return its nodes serialized.
+    """
+    if cache_dir:
+        key = cache.group_key(group, script_dir, advanced)
+        nodes = cache.load(cache_dir, group, key)
+        if nodes is not None:
+            logging.info(f"Reuse the cached {group} information")
+            return [lxml.etree.tostring(node) for node in nodes]
+
+    root_node = lxml.etree.Element("acrn-config")
+    for tag in ["processors", "caches", "memory", "devices"]:
+        root_node.append(lxml.etree.Element(tag))
+    board_etree = lxml.etree.ElementTree(root_node)
+    for module_name in module_names:
+        import_module(f"extractors.{module_name}").extract(board_etree)
+
+    nodes = [root_node.find(tag) for tag in cache.group_nodes[group]]
+    result = [lxml.etree.tostring(node) for node in nodes]
+    if cache_dir:
+        cache.save(cache_dir, group, key, nodes)
+    return result
+
 def main(board_name, board_xml, args):
     try:
-        # First invoke the legacy board parser to create the board XML ...
+        # The extractors of a group only touch the nodes of the group, so the groups are run in parallel, along
+        # with the legacy board parser ...
+        groups = {}
+        late_modules = []
+        for module in load_extractors(args):
+            group = getattr(module, "group", None)
+            if group:
+                groups.setdefault(group, []).append(module.__name__.split(".")[-1])
+            else:
+                late_modules.append(module)
+        cache_dir = None if args.no_cache else args.cache_dir
+
         legacy_parser = os.path.join(script_dir, "legacy", "board_parser.py")
         env = { "PYTHONPATH": script_dir }
-        subprocess.run([sys.executable, legacy_parser, args.board_name, "--out", board_xml], check=True, env=env)
+        legacy = subprocess.Popen([sys.executable, legacy_parser, args.board_name, "--out", board_xml], env=env)
 
-        # ... then load the created board XML and append it with additional data by invoking the extractors.
+        with ProcessPoolExecutor(max_workers=len(groups)) as executor:
+            futures = [executor.submit(run_group, group, module_names, cache_dir, args.advanced) for group, module_names in groups.items()]
+            if legacy.wait() != 0:
+                raise subprocess.CalledProcessError(legacy.returncode, legacy.args)
+            group_nodes = {}
+            for future in futures:
+                for node in future.result():
+                    node = lxml.etree.fromstring(node)
+                    group_nodes[node.tag] = node
+
+        # ... then load the board XML created by the legacy board parser and append it with the data extracted.
         board_etree = lxml.etree.parse(board_xml)
         root_node = board_etree.getroot()
 
@@ -32,18 +92,11 @@ def main(board_name, board_xml, args):
             elem.tail = None
 
         # Create nodes for each kind of resource
-        root_node.append(lxml.etree.Element("processors"))
-        root_node.append(lxml.etree.Element("caches"))
-        root_node.append(lxml.etree.Element("memory"))
-        root_node.append(lxml.etree.Element("devices"))
-
-        extractors_path = os.path.join(script_dir, "extractors")
-        extractors = [f for f in os.listdir(extractors_path) if f[:2].isdigit()]
-        for extractor in sorted(extractors):
-            module_name = os.path.splitext(extractor)[0]
-            module = import_module(f"extractors.{module_name}")
-            if not args.advanced and getattr(module, "advanced", False):
-                continue
+        for tag in ["processors", "caches", "memory", "devices"]:
+            root_node.append(group_nodes.get(tag, lxml.etree.Element(tag)))
+
+        # The remaining extractors work on the whole board XML
+        for module in late_modules:
             module.extract(board_etree)
 
         # Finally overwrite the output with the updated XML
@@ -59,6 +112,9 @@ if __name__ == "__main__":
     parser.add_argument("board_name", help="the name of the board that runs the ACRN hypervisor")
     parser.add_argument("--out", help="the name of board info file")
     parser.add_argument("--advanced", action="store_true", default=False, help="extract advanced information such as ACPI namespace")
+    parser.add_argument("--cache-dir", default=os.path.join(os.path.expanduser("~"), ".cache", "acrn-board-inspector"),
+                        help="the directory where the information extracted is kept for later runs on the same board")
+    parser.add_argument("--no-cache", action="store_true", default=False, help="extract all the information again and do not keep it")
     args = parser.parse_args()
 
     board_xml = args.out if args.out else f"{args.board_name}.xml"
@@ -23,15 +23,17 @@ class cpuid_result(namedtuple('cpuid_result', ['eax', 'ebx', 'ecx', 'edx'])):
     def __repr__(self):
         return "cpuid_result(eax={eax:#010x}, ebx={ebx:#010x}, ecx={ecx:#010x}, edx={edx:#010x})".format(**self._asdict())
 
+# Raw results of the cpuid tool, which prints a (leaf, subleaf) of all the CPUs at once: {"leaf,subleaf": {cpu_id: regs}}
+cpuid_cache = {}
+
 def cpuid(cpu_id, leaf, subleaf):
-    result = subprocess.run(["cpuid", "-l", str(leaf), "-s", str(subleaf), "-r"], stdout=subprocess.PIPE, check=True)
-    stdout = result.stdout.decode("ascii").replace("\n", "")
-    regex = re.compile(f"CPU {cpu_id}:[^:]*: eax=({regex_hex}) ebx=({regex_hex}) ecx=({regex_hex}) edx=({regex_hex})")
-    m = regex.search(stdout)
-    if m:
-        regs = list(map(lambda idx: int(m.group(idx), base=16), range(1, 5)))
-    else:
-        regs = [0] * 4
+    key = f"{leaf},{subleaf}"
+    if key not in cpuid_cache:
+        result = subprocess.run(["cpuid", "-l", str(leaf), "-s", str(subleaf), "-r"], stdout=subprocess.PIPE, check=True)
+        stdout = result.stdout.decode("ascii").replace("\n", "")
+        regex = re.compile(f"CPU ([0-9]+):[^:]*: eax=({regex_hex}) ebx=({regex_hex}) ecx=({regex_hex}) edx=({regex_hex})")
+        cpuid_cache[key] = {m.group(1): list(map(lambda idx: int(m.group(idx), base=16), range(2, 6))) for m in regex.finditer(stdout)}
+    regs = cpuid_cache[key].get(str(cpu_id), [0] * 4)
     return cpuid_result(*regs)
 
 class CPUID(object):
@@ -126,3 +126,5 @@ def extract_topology(processors_node):
 def extract(board_etree):
     processors_node = get_node(board_etree, "//processors")
     extract_topology(processors_node)
+
+group = "cpu"
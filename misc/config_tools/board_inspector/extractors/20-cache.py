@@ -100,3 +100,5 @@ def extract(board_etree):
     caches_node = get_node(board_etree, "//caches")
     extract_topology(root_node, caches_node)
     extract_tcc_capabilities(caches_node)
+
+group = "cpu"
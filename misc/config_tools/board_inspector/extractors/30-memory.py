@@ -21,3 +21,5 @@ def extract_layout(memory_node):
 def extract(board_etree):
     memory_node = get_node(board_etree, "//memory")
     extract_layout(memory_node)
+
+group = "memory"
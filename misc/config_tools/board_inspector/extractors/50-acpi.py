@@ -200,3 +200,4 @@ def extract(board_etree):
             logging.info(f"Fetch information about device object {device.name} failed: {str(e)}")
 
 advanced = True
+group = "devices"
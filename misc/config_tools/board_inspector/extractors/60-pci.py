@@ -148,3 +148,5 @@ def extract(board_etree):
             bus_node.set("address", "0x0")
 
     enum_devices(bus_node, PCI_ROOT_PATH)
+
+group = "devices"
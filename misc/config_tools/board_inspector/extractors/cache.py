@@ -0,0 +1,107 @@
+# Copyright (C) 2021 Intel Corporation. All rights reserved.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+import os
+import re
+import glob
+import hashlib
+import logging
+import lxml.etree
+
+# The extractors of a group only fill in the nodes of the group, from the inputs below. The output of a group is reused
+# as is by later runs as long as these inputs and the sources of the board inspector are unchanged.
+group_nodes = {
+    "cpu": ["processors", "caches"],
+    "memory": ["memory"],
+    "devices": ["devices"],
+}
+
+group_inputs = {
+    "cpu": [
+        "/proc/cpuinfo",
+        "/sys/devices/system/cpu/online",
+        "/sys/firmware/acpi/tables/RTCT",
+        "/sys/firmware/acpi/tables/PTCT",
+    ],
+    "memory": [
+        "/sys/firmware/memmap/*/start",
+        "/sys/firmware/memmap/*/end",
+        "/sys/firmware/memmap/*/type",
+    ],
+    "devices": [
+        "/sys/firmware/acpi/tables/DSDT",
+        "/sys/firmware/acpi/tables/SSDT*",
+        "/proc/iomem",
+    ],
+}
+
+# The PCI hierarchy is walked rather than globbed: sysfs is full of symlinks looping back up the tree
+group_trees = {
+    "devices": ("/sys/devices/pci0000:00", ["config", "resource"]),
+}
+
+# Lines of /proc/cpuinfo which change from one read to the next
+volatile_cpuinfo_regex = re.compile(rb"^(cpu MHz|bogomips)\s*:.*$", re.MULTILINE)
+
+def read_input(path):
+    try:
+        with open(path, "rb") as f:
+            data = f.read()
+    except OSError:
+        return b""
+    if path == "/proc/cpuinfo":
+        data = volatile_cpuinfo_regex.sub(b"", data)
+    return data
+
+def update_with_sources(h, script_dir):
+    for path in sorted(glob.glob(os.path.join(script_dir, "**", "*.py"), recursive=True)):
+        h.update(os.path.relpath(path, script_dir).encode())
+        h.update(read_input(path))
+
+def group_key(group, script_dir, advanced):
+    h = hashlib.sha256()
+    h.update(f"{group},{advanced}".encode())
+    update_with_sources(h, script_dir)
+    for pattern in group_inputs[group]:
+        for path in sorted(glob.glob(pattern, recursive=True)):
+            h.update(path.encode())
+            h.update(read_input(path))
+    if group in group_trees:
+        top, names = group_trees[group]
+        for dirpath, dirnames, filenames in os.walk(top):
+            dirnames.sort()
+            for name in names:
+                if name in filenames:
+                    path = os.path.join(dirpath, name)
+                    h.update(path.encode())
+                    h.update(read_input(path))
+    return h.hexdigest()
+
+def cache_path(cache_dir, group, key):
+    return os.path.join(cache_dir, f"{group}-{key}.xml")
+
+def load(cache_dir, group, key):
+    path = cache_path(cache_dir, group, key)
+    if not os.path.exists(path):
+        return None
+    try:
+        root = lxml.etree.parse(path).getroot()
+    except lxml.etree.XMLSyntaxError:
+        logging.info(f"Ignore corrupted cache {path}")
+        return None
+    return [root.find(tag) for tag in group_nodes[group]]
+
+def save(cache_dir, group, key, nodes):
+    os.makedirs(cache_dir, exist_ok=True)
+    root = lxml.etree.Element("cache", group=group)
+    root.extend(nodes)
+    path = cache_path(cache_dir, group, key)
+    # Write to a temporary file first so that an interrupted run never leaves a partial cache behind
+    tmp_path = f"{path}.{os.getpid()}"
+    lxml.etree.ElementTree(root).write(tmp_path)
+    os.replace(tmp_path, path)
+    for stale in glob.glob(os.path.join(cache_dir, f"{group}-*.xml")):
+        if stale != path:
+            os.remove(stale)
@@ -15,10 +15,16 @@
 #define SOS_VM_NUM 1U
 #define MAX_POST_VM_NUM 1U
 #define CONFIG_MAX_KATA_VM_NUM 0U
+/* Number of VMs which may have LAPIC passthrough or nested virtualization, the post-launched VMs get their guest
+ * flags from the device model. When 0U, the checks of the feature are settled at build time. */
+#define MAX_LAPIC_PT_VM_NUM 1U
+#define MAX_NVMX_VM_NUM 0U
 /* Bitmask of guest flags that can be programmed by device model. Other bits are set by hypervisor only. */
 #define DM_OWNED_GUEST_FLAG_MASK                                                                                       \
 	(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | GUEST_FLAG_RT |                              \
-		GUEST_FLAG_IO_COMPLETION_POLLING)
+		GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_VHPET | GUEST_FLAG_VPM_TMR | GUEST_FLAG_VRTC | GUEST_FLAG_PV_IPI | \
+		GUEST_FLAG_PV_TLB_FLUSH | GUEST_FLAG_PV_STEAL_TIME | GUEST_FLAG_VPMU | GUEST_FLAG_WBINVD_RANGE | \
+		GUEST_FLAG_MWAIT_PASSTHRU | GUEST_FLAG_HIDE_RDRAND)
 #define VM0_CONFIG_MEM_START_HPA 0x100000000UL
 #define VM0_CONFIG_MEM_SIZE 0x20000000UL
 #define VM0_CONFIG_MEM_START_HPA2 0x0UL
@@ -15,6 +15,10 @@
 #define SOS_VM_NUM 0U
 #define MAX_POST_VM_NUM 0U
 #define CONFIG_MAX_KATA_VM_NUM 0U
+/* Number of VMs which may have LAPIC passthrough or nested virtualization, the post-launched VMs get their guest
+ * flags from the device model. When 0U, the checks of the feature are settled at build time. */
+#define MAX_LAPIC_PT_VM_NUM 0U
+#define MAX_NVMX_VM_NUM 0U
 #define DM_OWNED_GUEST_FLAG_MASK 0UL
 #define VM0_CONFIG_MEM_START_HPA 0x100000000UL
 #define VM0_CONFIG_MEM_SIZE 0x20000000UL
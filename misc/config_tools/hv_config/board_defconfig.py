@@ -146,8 +146,15 @@ def get_miscfg(hv_info, config):
 def get_features(hv_info, config):
 
     print("CONFIG_{}=y".format(hv_info.features.scheduler), file=config)
+    if hv_info.features.scheduler != "SCHED_NOOP":
+        print("CONFIG_SCHED_BALANCE={}".format(hv_info.features.sched_balance or 'n'), file=config)
+        print("CONFIG_SCHED_PREEMPTION_TIMER={}".format(hv_info.features.sched_preemption_timer or 'n'), file=config)
     print("CONFIG_RELOC={}".format(hv_info.features.reloc), file=config)
     print("CONFIG_MULTIBOOT2={}".format(hv_info.features.multiboot2), file=config)
+    print("CONFIG_STAGED_BOOT_ENABLED={}".format(hv_info.features.staged_boot_enabled or 'n'), file=config)
+    print("CONFIG_IDLE_CSTATE={}".format(hv_info.features.idle_cstate or 'y'), file=config)
+    print("CONFIG_SPLITLOCK_NATIVE_STEP={}".format(hv_info.features.splitlock_native_step or 'n'), file=config)
+    print("CONFIG_SPLITLOCK_RATE_LIMIT={}".format(hv_info.features.splitlock_rate_limit or 0), file=config)
     print("CONFIG_RDT_ENABLED={}".format(hv_info.features.rdt_enabled), file=config)
     if hv_info.features.rdt_enabled == 'y':
         print("CONFIG_CDP_ENABLED={}".format(hv_info.features.cdp_enabled), file=config)
@@ -178,6 +185,8 @@ def get_capacities(hv_info, config):
         max_msix_table_num = hv_info.cap.max_msix_table_num
     print("CONFIG_MAX_MSIX_TABLE_NUM={}".format(max_msix_table_num), file=config)
     print("CONFIG_MAX_EMULATED_MMIO_REGIONS={}".format(hv_info.cap.max_emu_mmio_regions), file=config)
+    max_guest_ept_num = hv_info.cap.max_guest_ept_num if hv_info.cap.max_guest_ept_num else 4
+    print("CONFIG_MAX_GUEST_EPT_NUM={}".format(max_guest_ept_num), file=config)
 
 
 def get_log_opt(hv_info, config):
@@ -187,6 +196,8 @@ def get_log_opt(hv_info, config):
     print("CONFIG_MEM_LOGLEVEL_DEFAULT={}".format(hv_info.log.level.mem), file=config)
     print("CONFIG_LOG_DESTINATION={}".format(hv_info.log.dest), file=config)
     print("CONFIG_CONSOLE_LOGLEVEL_DEFAULT={}".format(hv_info.log.level.console), file=config)
+    if hv_info.log.release != 'y':
+        print("CONFIG_LOCK_STATS={}".format(hv_info.log.lock_stats or 'n'), file=config)
 
 
 def generate_file(hv_info, config):
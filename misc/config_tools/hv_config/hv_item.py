@@ -32,18 +32,22 @@ class LogOpt:
         self.dest = 0
         self.release = ''
         self.buf_size = 0
+        self.lock_stats = ''
         self.level = LogLevel(self.hv_file)
 
     def get_info(self):
         self.release = common.get_hv_item_tag(self.hv_file, "DEBUG_OPTIONS", "RELEASE")
         self.dest = common.get_hv_item_tag(self.hv_file, "DEBUG_OPTIONS", "LOG_DESTINATION")
         self.buf_size = common.get_hv_item_tag(self.hv_file, "DEBUG_OPTIONS", "LOG_BUF_SIZE")
+        self.lock_stats = common.get_hv_item_tag(self.hv_file, "DEBUG_OPTIONS", "LOCK_STATS")
         self.level.get_info()
 
     def check_item(self):
         hv_cfg_lib.release_check(self.release, "DEBUG_OPTIONS", "RELEASE")
         hv_cfg_lib.hv_range_check(self.dest, "DEBUG_OPTIONS", "LOG_DESTINATION", hv_cfg_lib.RANGE_DB['LOG_DESTINATION_BITMAP'])
         hv_cfg_lib.hv_size_check(self.buf_size, "DEBUG_OPTIONS", "LOG_BUF_SIZE")
+        if self.lock_stats:
+            hv_cfg_lib.ny_support_check(self.lock_stats, "DEBUG_OPTIONS", "LOCK_STATS")
         self.level.check_item()
 
 
@@ -59,6 +63,7 @@ class CapHv:
         self.iommu_bus_num = 0
         self.max_pci_dev_num = 0
         self.max_msix_table_num = 0
+        self.max_guest_ept_num = 0
 
     def get_info(self):
         self.max_emu_mmio_regions = common.get_hv_item_tag(self.hv_file, "CAPACITIES", "MAX_EMULATED_MMIO")
@@ -69,6 +74,7 @@ class CapHv:
         self.iommu_bus_num = common.get_hv_item_tag(self.hv_file, "CAPACITIES", "IOMMU_BUS_NUM")
         self.max_pci_dev_num = common.get_hv_item_tag(self.hv_file, "CAPACITIES", "MAX_PCI_DEV_NUM")
         self.max_msix_table_num = common.get_hv_item_tag(self.hv_file, "CAPACITIES", "MAX_MSIX_TABLE_NUM")
+        self.max_guest_ept_num = common.get_hv_item_tag(self.hv_file, "CAPACITIES", "MAX_GUEST_EPT_NUM")
 
     def check_item(self):
         hv_cfg_lib.hv_range_check(self.max_emu_mmio_regions, "CAPACITIES", "MAX_EMULATED_MMIO", hv_cfg_lib.RANGE_DB['EMULATED_MMIO_REGIONS'])
@@ -79,6 +85,8 @@ class CapHv:
         hv_cfg_lib.hv_size_check(self.iommu_bus_num, "CAPACITIES", "IOMMU_BUS_NUM")
         hv_cfg_lib.hv_range_check(self.max_pci_dev_num, "CAPACITIES", "MAX_PCI_DEV_NUM", hv_cfg_lib.RANGE_DB['PCI_DEV_NUM'])
         hv_cfg_lib.max_msix_table_num_check(self.max_msix_table_num, "CAPACITIES", "MAX_MSIX_TABLE_NUM")
+        if self.max_guest_ept_num:
+            hv_cfg_lib.hv_range_check(self.max_guest_ept_num, "CAPACITIES", "MAX_GUEST_EPT_NUM", hv_cfg_lib.RANGE_DB['GUEST_EPT_NUM'])
 
 
 class MisCfg:
@@ -99,11 +107,17 @@ class Features:
         self.hv_file = hv_file
         self.reloc = ''
         self.multiboot2 = ''
+        self.staged_boot_enabled = ''
+        self.idle_cstate = ''
+        self.splitlock_native_step = ''
+        self.splitlock_rate_limit = ''
         self.rdt_enabled = ''
         self.cdp_enabled = ''
         self.cat_max_mask = []
         self.mba_delay = []
         self.scheduler = ''
+        self.sched_balance = ''
+        self.sched_preemption_timer = ''
         self.hyperv_enabled = ''
         self.iommu_enforce_snp = ''
         self.acpi_parse_enabled = ''
@@ -113,11 +127,17 @@ class Features:
 
     def get_info(self):
         self.multiboot2 = common.get_hv_item_tag(self.hv_file, "FEATURES", "MULTIBOOT2")
+        self.staged_boot_enabled = common.get_hv_item_tag(self.hv_file, "FEATURES", "STAGED_BOOT_ENABLED")
+        self.idle_cstate = common.get_hv_item_tag(self.hv_file, "FEATURES", "IDLE_CSTATE")
+        self.splitlock_native_step = common.get_hv_item_tag(self.hv_file, "FEATURES", "SPLITLOCK_NATIVE_STEP")
+        self.splitlock_rate_limit = common.get_hv_item_tag(self.hv_file, "FEATURES", "SPLITLOCK_RATE_LIMIT")
         self.rdt_enabled = common.get_hv_item_tag(self.hv_file, "FEATURES", "RDT", "RDT_ENABLED")
         self.cdp_enabled = common.get_hv_item_tag(self.hv_file, "FEATURES", "RDT", "CDP_ENABLED")
         self.cat_max_mask = common.get_hv_item_tag(self.hv_file, "FEATURES", "RDT", "CLOS_MASK")
         self.mba_delay = common.get_hv_item_tag(self.hv_file, "FEATURES", "RDT", "MBA_DELAY")
         self.scheduler = common.get_hv_item_tag(self.hv_file, "FEATURES", "SCHEDULER")
+        self.sched_balance = common.get_hv_item_tag(self.hv_file, "FEATURES", "SCHED_BALANCE")
+        self.sched_preemption_timer = common.get_hv_item_tag(self.hv_file, "FEATURES", "SCHED_PREEMPTION_TIMER")
         self.reloc = common.get_hv_item_tag(self.hv_file, "FEATURES", "RELOC")
         self.hyperv_enabled = common.get_hv_item_tag(self.hv_file, "FEATURES", "HYPERV_ENABLED")
         self.acpi_parse_enabled = common.get_hv_item_tag(self.hv_file, "FEATURES", "ACPI_PARSE_ENABLED")
@@ -128,11 +148,23 @@ class Features:
 
     def check_item(self):
         hv_cfg_lib.ny_support_check(self.multiboot2, "FEATURES", "MULTIBOOT2")
+        if self.staged_boot_enabled:
+            hv_cfg_lib.ny_support_check(self.staged_boot_enabled, "FEATURES", "STAGED_BOOT_ENABLED")
+        if self.idle_cstate:
+            hv_cfg_lib.ny_support_check(self.idle_cstate, "FEATURES", "IDLE_CSTATE")
+        if self.splitlock_native_step:
+            hv_cfg_lib.ny_support_check(self.splitlock_native_step, "FEATURES", "SPLITLOCK_NATIVE_STEP")
+        if self.splitlock_rate_limit:
+            hv_cfg_lib.hv_range_check(self.splitlock_rate_limit, "FEATURES", "SPLITLOCK_RATE_LIMIT", hv_cfg_lib.RANGE_DB['SPLITLOCK_RATE_LIMIT'])
         hv_cfg_lib.ny_support_check(self.rdt_enabled, "FEATURES", "RDT", "RDT_ENABLED")
         hv_cfg_lib.ny_support_check(self.cdp_enabled, "FEATURES", "RDT", "CDP_ENABLED")
         hv_cfg_lib.cat_max_mask_check(self.cat_max_mask, "FEATURES", "RDT", "CLOS_MASK")
         hv_cfg_lib.mba_delay_check(self.mba_delay, "FEATURES", "RDT", "MBA_DELAY")
         hv_cfg_lib.scheduler_check(self.scheduler, "FEATURES", "SCHEDULER")
+        if self.sched_balance:
+            hv_cfg_lib.ny_support_check(self.sched_balance, "FEATURES", "SCHED_BALANCE")
+        if self.sched_preemption_timer:
+            hv_cfg_lib.ny_support_check(self.sched_preemption_timer, "FEATURES", "SCHED_PREEMPTION_TIMER")
         hv_cfg_lib.ny_support_check(self.reloc, "FEATURES", "RELOC")
         hv_cfg_lib.ny_support_check(self.hyperv_enabled, "FEATURES", "HYPERV_ENABLED")
         hv_cfg_lib.ny_support_check(self.acpi_parse_enabled, "FEATURES", "ACPI_PARSE_ENABLED")
@@ -16,13 +16,15 @@ SCHEDULER_TYPE = ['SCHED_NOOP', 'SCHED_IORR', 'SCHED_BVT']
 
 RANGE_DB = {
     'LOG_LEVEL':{'min':0,'max':6},
-    'LOG_DESTINATION_BITMAP':{'min':0,'max':7},
+    'LOG_DESTINATION_BITMAP':{'min':0,'max':15},
     'EMULATED_MMIO_REGIONS':{'min':0,'max':128},
     'PT_IRQ_ENTRIES':{'min':0,'max':256},
     'IOAPIC_NUM':{'min':1,'max':10},
     'IOAPIC_LINES':{'min':1,'max':120},
     'PCI_DEV_NUM':{'min':1,'max':1024},
     'MSIX_TABLE_NUM':{'min':1,'max':2048},
+    'GUEST_EPT_NUM':{'min':1,'max':64},
+    'SPLITLOCK_RATE_LIMIT':{'min':0,'max':10000},
 }
 
 
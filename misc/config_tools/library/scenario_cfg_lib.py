@@ -16,6 +16,8 @@ START_HPA_LIST = ['0', '0x100000000', '0x120000000']
 KERN_TYPE_LIST = ['KERNEL_BZIMAGE', 'KERNEL_ZEPHYR']
 KERN_BOOT_ADDR_LIST = ['0x100000']
 
+VCR_PROFILES = ['VCR_PROFILE_DEFAULT', 'VCR_PROFILE_RELAXED']
+
 VUART_TYPE = ['VUART_LEGACY_PIO', 'VUART_PCI']
 INVALID_COM_BASE = 'INVALID_COM_BASE'
 VUART_BASE = ['SOS_COM1_BASE', 'SOS_COM2_BASE', 'COM1_BASE',
@@ -239,6 +241,35 @@ def vm_name_check(vm_names, item):
             ERR_LIST[key] = "VM name length should be in range [1,32] bytes"
 
 
+def vm_uint_check(vm_values, item, range_val):
+    """
+    Check an optional integer of the VMs
+    :param vm_values: dictionary of the values per vm id
+    :param item: the item in xml
+    :param range_val: dictionary of the 'min' and 'max' values
+    :return: None
+    """
+    for vm_i, val in vm_values.items():
+        if not val:
+            continue
+        if not val.isdigit() or int(val) < range_val['min'] or int(val) > range_val['max']:
+            key = "vm:id={},{}".format(vm_i, item)
+            ERR_LIST[key] = "{} should be an integer in range [{},{}]".format(item, range_val['min'], range_val['max'])
+
+
+def vcr_profile_check(vcr_profiles, item):
+    """
+    Check the CR0/CR4 profile of the VMs
+    :param vcr_profiles: dictionary of the profiles per vm id
+    :param item: the item in xml
+    :return: None
+    """
+    for vm_i, profile in vcr_profiles.items():
+        if profile and profile not in VCR_PROFILES:
+            key = "vm:id={},{}".format(vm_i, item)
+            ERR_LIST[key] = "{} should be one of {}".format(item, ', '.join(VCR_PROFILES))
+
+
 def load_vm_check(load_vms, item):
     """
     Check load order type
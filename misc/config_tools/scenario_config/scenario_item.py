@@ -359,6 +359,11 @@ class VmInfo:
             self.scenario_info, "cpu_affinity", "pcpu_id")
         self.clos_per_vm = common.get_leaf_tag_map(
             self.scenario_info, "clos", "vcpu_clos")
+        self.timer_slack_us = common.get_leaf_tag_map(self.scenario_info, "timer_slack_us")
+        self.ple_gap = common.get_leaf_tag_map(self.scenario_info, "ple_gap")
+        self.ple_window = common.get_leaf_tag_map(self.scenario_info, "ple_window")
+        self.halt_poll_us = common.get_leaf_tag_map(self.scenario_info, "halt_poll_us")
+        self.vcr_profile = common.get_leaf_tag_map(self.scenario_info, "vcr_profile")
 
         self.epc_section.get_info()
         self.mem_info.get_info()
@@ -401,6 +406,11 @@ class VmInfo:
         scenario_cfg_lib.guest_flag_check(self.guest_flags, "guest_flags", "guest_flag")
         err_dic = scenario_cfg_lib.vm_cpu_affinity_check(self.scenario_info, self.cpus_per_vm, "pcpu_id")
         scenario_cfg_lib.vcpu_clos_check(self.cpus_per_vm, self.clos_per_vm, "clos", "vcpu_clos")
+        scenario_cfg_lib.vm_uint_check(self.timer_slack_us, "timer_slack_us", {'min':0, 'max':10000})
+        scenario_cfg_lib.vm_uint_check(self.ple_gap, "ple_gap", {'min':0, 'max':0xFFFFFFFF})
+        scenario_cfg_lib.vm_uint_check(self.ple_window, "ple_window", {'min':0, 'max':0xFFFFFFFF})
+        scenario_cfg_lib.vm_uint_check(self.halt_poll_us, "halt_poll_us", {'min':0, 'max':10000})
+        scenario_cfg_lib.vcr_profile_check(self.vcr_profile, "vcr_profile")
 
         self.mem_info.check_item()
         self.os_cfg.check_item()
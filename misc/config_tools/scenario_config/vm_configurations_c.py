@@ -200,6 +200,35 @@ def clos_output(scenario_items, i, config):
     print("\t\t.clos = VM{}_VCPU_CLOS,".format(i), file=config)
     print("#endif", file=config)
 
+def vm_uint_output(vm_values, i, member, config):
+    """
+    Output an optional integer member of the VM configuration
+    :param vm_values: dictionary of the values per vm id
+    :param i: vm id number
+    :param member: the member of struct acrn_vm_config
+    :param config: it is the pointer which file write to
+    :return: None
+    """
+    if vm_values.get(i):
+        print("\t\t.{} = {}U,".format(member, vm_values[i]), file=config)
+
+
+def tuning_output(vm_info, i, config):
+    """
+    Output the timing knobs of the VM
+    :param vm_info: it is the class which contain all user setting information
+    :param i: vm id number
+    :param config: it is the pointer which file write to
+    :return: None
+    """
+    vm_uint_output(vm_info.timer_slack_us, i, "timer_slack_us", config)
+    vm_uint_output(vm_info.ple_gap, i, "ple_gap", config)
+    vm_uint_output(vm_info.ple_window, i, "ple_window", config)
+    vm_uint_output(vm_info.halt_poll_us, i, "halt_poll_us", config)
+    if vm_info.vcr_profile.get(i):
+        print("\t\t.vcr_profile = {},".format(vm_info.vcr_profile[i]), file=config)
+
+
 def get_guest_flag(flags):
     """
     This is get flag index list
@@ -278,6 +307,7 @@ def gen_sos_vm(vm_type, vm_i, scenario_items, config):
     sos_dev_num = scenario_cfg_lib.get_pci_dev_num_per_vm()[vm_i]
     print("\t\t.pci_dev_num = {}U,".format(sos_dev_num), file=config)
     print("\t\t.pci_devs = sos_pci_devs,", file=config)
+    tuning_output(vm_info, vm_i, config)
 
     print("\t},", file=config)
 
@@ -355,6 +385,7 @@ def gen_pre_launch_vm(vm_type, vm_i, scenario_items, config):
         print("\t\t\t.size = P2SB_BAR_SIZE,", file=config)
         print("\t\t},", file=config)
         print("#endif", file=config)
+    tuning_output(vm_info, vm_i, config)
 
     if vm_i == 0:
         print("\t\t.pt_intx_num = VM0_PT_INTX_NUM,", file=config)
@@ -380,6 +411,7 @@ def gen_post_launch_vm(vm_type, vm_i, scenario_items, config):
     err_dic = vuart_output(vm_type, vm_i, vm_info, config)
     if err_dic:
         return err_dic
+    tuning_output(vm_info, vm_i, config)
 
     print("\t},", file=config)
 
@@ -38,6 +38,29 @@ def scenario_vm_num(scenario_items, config):
     print("#define CONFIG_MAX_KATA_VM_NUM\t\t{}U".format(scenario_cfg_lib.KATA_VM_COUNT), file=config)
 
 
+def scenario_feature_vm_num(scenario_items, config):
+
+    vm_info = scenario_items['vm']
+    lapic_pt_vm_num = 0
+    nvmx_vm_num = 0
+    nvmx_enabled = common.get_hv_item_tag(common.SCENARIO_INFO_FILE, "FEATURES", "NVMX_ENABLED") == 'y'
+    for vm_i, vm_type in common.VM_TYPES.items():
+        flags = vm_info.guest_flags.get(vm_i, [])
+        # the post-launched VMs get their guest flags from the device model
+        if "GUEST_FLAG_LAPIC_PASSTHROUGH" in flags or ("SOS_VM" in common.VM_TYPES.values() and
+                scenario_cfg_lib.VM_DB[vm_type]['load_type'] == "POST_LAUNCHED_VM"):
+            lapic_pt_vm_num += 1
+        if nvmx_enabled and "GUEST_FLAG_NVMX_ENABLED" in flags:
+            nvmx_vm_num += 1
+
+    print("", file=config)
+    print("/* Number of VMs which may have LAPIC passthrough or nested virtualization;", file=config)
+    print(" * When 0U, the checks of the feature are settled at build time.", file=config)
+    print(" */", file=config)
+    print("#define MAX_LAPIC_PT_VM_NUM		{}U".format(lapic_pt_vm_num), file=config)
+    print("#define MAX_NVMX_VM_NUM			{}U".format(nvmx_vm_num), file=config)
+
+
 def gen_pre_launch_vm(scenario_items, config):
 
     vm_info = scenario_items['vm']
@@ -94,7 +117,10 @@ def get_dm_owned_guest_flag_mask(vm_info, config):
               " Other bits are set by hypervisor only */", file=config)
         print("#define DM_OWNED_GUEST_FLAG_MASK        " +
               "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
-              "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+              "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_VHPET | \\\n" +
+              "\t\t\t\t\t\tGUEST_FLAG_VPM_TMR | GUEST_FLAG_VRTC | GUEST_FLAG_PV_IPI | \\\n" +
+              "\t\t\t\t\t\tGUEST_FLAG_PV_TLB_FLUSH | GUEST_FLAG_PV_STEAL_TIME | GUEST_FLAG_VPMU | \\\n" +
+              "\t\t\t\t\t\tGUEST_FLAG_WBINVD_RANGE | GUEST_FLAG_MWAIT_PASSTHRU | GUEST_FLAG_HIDE_RDRAND)", file=config)
     print("", file=config)
 
 
@@ -110,6 +136,7 @@ def generate_file(scenario_items, config):
     print("#include <misc_cfg.h>", file=config)
     print("#include <pci_devices.h>", file=config)
     scenario_vm_num(scenario_items, config)
+    scenario_feature_vm_num(scenario_items, config)
     get_dm_owned_guest_flag_mask(vm_info, config)
 
     gen_header_file(scenario_items, config)
@@ -7,7 +7,7 @@
 
 import sys, os, re
 sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'library'))
-import common, lib.error, lib.lib
+import common, lib.error, lib.lib, lib.model
 from collections import namedtuple
 
 # Constants for device name prefix
@@ -57,10 +57,10 @@ class BusDevFunc(namedtuple(
 
 def find_unused_bdf(used_bdf):
     # never assign 0:00.0 to any emulated devices, it's reserved for pci hostbridge
+    used_dev = set(in_use_bdf.dev for in_use_bdf in used_bdf)
     for dev in range(0x1, 0x20):
-        bdf = BusDevFunc(bus=0x00, dev=dev, func=0x0)
-        if all((bdf.dev != in_use_bdf.dev for in_use_bdf in used_bdf)):
-            return bdf
+        if dev not in used_dev:
+            return BusDevFunc(bus=0x00, dev=dev, func=0x0)
     raise lib.error.ResourceError(f"Cannot find free bdf, used bdf: {sorted(used_bdf)}")
 
 def insert_vuart_to_dev_dict(scenario_etree, devdict, used):
@@ -75,8 +75,8 @@ def insert_vuart_to_dev_dict(scenario_etree, devdict, used):
         devdict[f"{VUART}_{vuart_id}"] = free_bdf
         used.append(free_bdf)
 
-def insert_ivsheme_to_dev_dict(scenario_etree, devdict, vm_id, used):
-    shmem_regions = lib.lib.get_shmem_regions(scenario_etree)
+def insert_ivsheme_to_dev_dict(model, devdict, vm_id, used):
+    shmem_regions = model.shmem_regions
     if vm_id not in shmem_regions:
         return
     shmems = shmem_regions.get(vm_id)
@@ -112,41 +112,32 @@ def insert_pt_devs_to_dev_dict(vm_node_etree, devdict, used):
         devdict[dev_name] = free_bdf
         used.append(free_bdf)
 
-def get_devs_bdf_native(board_etree):
+def get_devs_bdf_native(model):
     """
     Get all pci devices' bdf in native environment.
     return: list of pci devices' bdf
     """
-    nodes = board_etree.xpath(f"//bus[@type = 'pci' and @id]/device[@address]")
     dev_list = []
-    for node in nodes:
-        address = node.get('address')
-        bus = int(common.get_node("../@address", node), 16)
-        dev = int(address, 16) >> 16
-        func = int(address, 16) & 0xffff
+    for (bus, address), node in model.pci_devs.items():
+        if node.getparent().get('id') is None:
+            continue
+        dev = address >> 16
+        func = address & 0xffff
         dev_list.append(BusDevFunc(bus = bus, dev = dev, func = func))
     return dev_list
 
-def get_devs_bdf_passthrough(scenario_etree):
+def get_devs_bdf_passthrough(model):
     """
     Get all pre-launched vms' passthrough devices' bdf in native environment.
     return: list of passtrhough devices' bdf.
     """
-    dev_list = []
-    for vm_type in lib.lib.PRE_LAUNCHED_VMS_TYPE:
-        pt_devs = scenario_etree.xpath(f"//vm[vm_type = '{vm_type}']/pci_devs/pci_dev/text()")
-        for pt_dev in pt_devs:
-            bdf = BusDevFunc.from_str(pt_dev.split()[0])
-            dev_list.append(bdf)
-    return dev_list
+    return [BusDevFunc.from_str(bdf) for bdf in model.pre_launched_pt_devs()]
 
-def create_device_node(allocation_etree, vm_id, devdict):
+def create_device_node(model, allocation_etree, vm_id, devdict):
+    vm_node = model.alloc_vm_node(allocation_etree, vm_id)
     for dev in devdict:
         dev_name = dev
         bdf = devdict.get(dev)
-        vm_node = common.get_node(f"/acrn-config/vm[@id = '{vm_id}']", allocation_etree)
-        if vm_node is None:
-            vm_node = common.append_node("/acrn-config/vm", None, allocation_etree, id = vm_id)
         dev_node = common.get_node(f"./device[@name = '{dev_name}']", vm_node)
         if dev_node is None:
             dev_node = common.append_node("./device", None, vm_node, name = dev_name)
@@ -158,23 +149,22 @@ def create_device_node(allocation_etree, vm_id, devdict):
             common.append_node(f"./func", f"{bdf.func:#04x}".upper(), dev_node)
 
 def fn(board_etree, scenario_etree, allocation_etree):
-    vm_nodes = scenario_etree.xpath("//vm")
-    for vm_node in vm_nodes:
-        vm_id = vm_node.get('id')
+    model = lib.model.get_model(board_etree, scenario_etree)
+    for vm_id, vm_node in model.vms.items():
         devdict = {}
         used = []
-        vm_type = common.get_node("./vm_type/text()", vm_node)
+        vm_type = model.vm_types[vm_id]
         if vm_type is not None and lib.lib.is_post_launched_vm(vm_type):
             continue
 
         if vm_type is not None and lib.lib.is_sos_vm(vm_type):
-            native_used = get_devs_bdf_native(board_etree)
-            passthrough_used = get_devs_bdf_passthrough(scenario_etree)
+            native_used = get_devs_bdf_native(model)
+            passthrough_used = set(get_devs_bdf_passthrough(model))
             used = [bdf for bdf in native_used if bdf not in passthrough_used]
             if common.get_node("//@board", scenario_etree) == "tgl-rvp":
                 used.append(BusDevFunc(bus = 0, dev = 1, func = 0))
 
         insert_vuart_to_dev_dict(vm_node, devdict, used)
-        insert_ivsheme_to_dev_dict(scenario_etree, devdict, vm_id, used)
+        insert_ivsheme_to_dev_dict(model, devdict, vm_id, used)
         insert_pt_devs_to_dev_dict(vm_node, devdict, used)
-        create_device_node(allocation_etree, vm_id, devdict)
+        create_device_node(model, allocation_etree, vm_id, devdict)
@@ -7,7 +7,7 @@
 
 import sys, os, re
 sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'library'))
-import common, lib.error, lib.lib
+import common, lib.error, lib.lib, lib.model
 from collections import namedtuple
 
 # VMSIX devices list
@@ -47,13 +47,22 @@ PRE_LAUNCHED_VM_LOW_MEM_END = 3.5 * SIZE_G
 PRE_LAUNCHED_VM_HIGH_MEM_START = 256 * SIZE_G
 PRE_LAUNCHED_VM_HIGH_MEM_END = 512 * SIZE_G
 
+# Layout of the RAM of a pre-launched VM in its ve820, see create_prelaunched_vm_e820() in the hypervisor
+PRE_RTVM_SW_SRAM_BASE_GPA = 0x40080000
+PRE_RTVM_SW_SRAM_MAX_SIZE = 8 * SIZE_M
+PRE_LAUNCHED_VM_LOW_RAM_MAX = 2 * SIZE_G - PRE_RTVM_SW_SRAM_MAX_SIZE
+PRE_LAUNCHED_VM_HIGH_RAM_START = 4 * SIZE_G
+
+# Large pages of the EPT
+EPT_LARGE_PAGES = [(SIZE_G, "1G"), (2 * SIZE_M, "2M")]
+
 # Constants for ivshmem
 BAR0_SHEMEM_SIZE = 4 * SIZE_K
 BAR1_SHEMEM_SIZE = 4 * SIZE_K
 BAR2_SHEMEM_ALIGNMENT = 2 * common.SIZE_M
 
 # Constants for pci vuart
-PCI_VUART_VBAR0_SIZE = 4 * SIZE_K
+PCI_VUART_VBAR0_SIZE = 16 * SIZE_K
 PCI_VUART_VBAR1_SIZE = 4 * SIZE_K
 
 # Constants for vmsix bar
@@ -88,6 +97,61 @@ class MmioWindow(namedtuple(
             return False
         return True
 
+class MmioAllocator:
+    """
+    Allocate the BARs of a VM from its MMIO windows.
+
+    The free ranges of each window are kept as a sorted list of disjoint intervals. Every BAR is naturally aligned,
+    so those of 2M and more land on EPT large pages, and goes to the smallest free range of the first window which
+    fits it. Allocating the BARs from the largest down keeps the layout contiguous instead of scattering the small BARs
+    over the large gaps.
+    """
+    def __init__(self, windows, used):
+        self.free = []
+        for w in windows:
+            ranges = [(w.start, w.end)]
+            for u in used:
+                ranges = self.subtract(ranges, u.start, u.end)
+            self.free.append(ranges)
+
+    @staticmethod
+    def subtract(ranges, start, end):
+        result = []
+        for (s, e) in ranges:
+            if end < s or e < start:
+                result.append((s, e))
+                continue
+            if s < start:
+                result.append((s, start - 1))
+            if end < e:
+                result.append((end + 1, e))
+        return result
+
+    def allocate(self, size, limit = None):
+        """
+        Return the window of a BAR of size bytes, below limit if given.
+        """
+        if not size:
+            raise ValueError(f"allocate size cannot be: {size}")
+        if not self.free:
+            raise ValueError(f"No mmio range is specified")
+
+        alignment = max(VBAR_ALIGNMENT, 1 << (size - 1).bit_length())
+        for idx, ranges in enumerate(self.free):
+            best = None
+            for (s, e) in ranges:
+                base = common.round_up(s, alignment)
+                end = base + size - 1
+                if end > e or (limit is not None and end >= limit):
+                    continue
+                if best is None or (e - s) < best[0]:
+                    best = (e - s, base)
+            if best is not None:
+                base = best[1]
+                self.free[idx] = self.subtract(ranges, base, base + size - 1)
+                return MmioWindow(start = base, end = base + size - 1)
+        raise lib.error.ResourceError(f"Not enough mmio window for a device size: {size}, free mmio ranges: {self.free}")
+
 def insert_vuart_to_dev_dict(scenario_etree, devdict_32bits):
     console_vuart =  scenario_etree.xpath(f"./console_vuart[base != 'INVALID_PCI_BASE']/@id")
     communication_vuarts = scenario_etree.xpath(f".//communication_vuart[base != 'INVALID_PCI_BASE']/@id")
@@ -98,8 +162,8 @@ def insert_vuart_to_dev_dict(scenario_etree, devdict_32bits):
         devdict_32bits[(f"{VUART}_{vuart_id}", "bar0")] = PCI_VUART_VBAR0_SIZE
         devdict_32bits[(f"{VUART}_{vuart_id}", "bar1")] = PCI_VUART_VBAR1_SIZE
 
-def insert_ivsheme_to_dev_dict(scenario_etree, devdict_32bits, devdict_64bits, vm_id):
-    shmem_regions = lib.lib.get_shmem_regions(scenario_etree)
+def insert_ivsheme_to_dev_dict(model, devdict_32bits, devdict_64bits, vm_id):
+    shmem_regions = model.shmem_regions
     if vm_id not in shmem_regions:
         return
     shmems = shmem_regions.get(vm_id)
@@ -113,14 +177,12 @@ def insert_ivsheme_to_dev_dict(scenario_etree, devdict_32bits, devdict_64bits, v
         devdict_32bits[(f"{IVSHMEM}_{idx}", "bar1")] = BAR1_SHEMEM_SIZE
         devdict_64bits[(f"{IVSHMEM}_{idx}", "bar2")] = int_size
 
-def insert_pt_devs_to_dev_dict(board_etree, vm_node_etree, devdict_32bits, devdict_64bits):
-    pt_devs = vm_node_etree.xpath(f".//pci_dev/text()")
-    for pt_dev in pt_devs:
-        bdf = pt_dev.split()[0]
+def insert_pt_devs_to_dev_dict(model, vm_id, devdict_32bits, devdict_64bits):
+    for bdf in model.pt_devs[vm_id]:
         bus = int(bdf.split(':')[0], 16)
         dev = int(bdf.split(":")[1].split('.')[0], 16)
         func = int(bdf.split(":")[1].split('.')[1], 16)
-        pt_dev_node = common.get_node(f"//bus[@type = 'pci' and @address = '{hex(bus)}']/device[@address = '{hex((dev << 16) | func)}']", board_etree)
+        pt_dev_node = model.pci_dev(bdf)
         if pt_dev_node is not None:
             insert_vmsix_to_dev_dict(pt_dev_node, devdict_32bits)
             pt_dev_resources = pt_dev_node.xpath(".//resource[@type = 'memory' and @len != '0x0' and @id and @width]")
@@ -181,25 +243,21 @@ def get_devs_mem_native(board_etree, mems):
                     break
     return sorted(dev_list)
 
-def get_devs_mem_passthrough(board_etree, scenario_etree):
+def get_devs_mem_passthrough(model):
     """
     Get all pre-launched vms' passthrough devices' mmio windows in native environment.
     return: list of passtrhough devices' mmio windows.
     """
     dev_list = []
-    for vm_type in lib.lib.PRE_LAUNCHED_VMS_TYPE:
-        pt_devs = scenario_etree.xpath(f"//vm[vm_type = '{vm_type}']/pci_devs/pci_dev/text()")
-        for pt_dev in pt_devs:
-            bdf = pt_dev.split()[0]
-            bus = int(bdf.split(':')[0], 16)
-            dev = int(bdf.split(":")[1].split('.')[0], 16)
-            func = int(bdf.split(":")[1].split('.')[1], 16)
-            resources = board_etree.xpath(f"//bus[@address = '{hex(bus)}']/device[@address = '{hex((dev << 16) | func)}'] \
-                            /resource[@type = 'memory' and @len != '0x0' and @width]")
-            for resource in resources:
-                start = resource.get('min')
-                end = resource.get('max')
-                dev_list.append(MmioWindow(int(start, 16), int(end, 16)))
+    for bdf in model.pre_launched_pt_devs():
+        pt_dev_node = model.pci_dev(bdf)
+        if pt_dev_node is None:
+            continue
+        resources = pt_dev_node.xpath("./resource[@type = 'memory' and @len != '0x0' and @width]")
+        for resource in resources:
+            start = resource.get('min')
+            end = resource.get('max')
+            dev_list.append(MmioWindow(int(start, 16), int(end, 16)))
     return dev_list
 
 def get_pci_hole_native(board_etree):
@@ -223,15 +281,13 @@ def get_pci_hole_native(board_etree):
                         break
     return list(sorted(low_mem)), list(sorted(high_mem))
 
-def create_device_node(allocation_etree, vm_id, devdict):
+def create_device_node(model, allocation_etree, vm_id, devdict):
+    vm_node = model.alloc_vm_node(allocation_etree, vm_id)
     for dev in devdict:
         dev_name = dev[0]
         bar_region = dev[1].split('bar')[-1]
         bar_base = devdict.get(dev)
 
-        vm_node = common.get_node(f"/acrn-config/vm[@id = '{vm_id}']", allocation_etree)
-        if vm_node is None:
-            vm_node = common.append_node("/acrn-config/vm", None, allocation_etree, id = vm_id)
         dev_node = common.get_node(f"./device[@name = '{dev_name}']", vm_node)
         if dev_node is None:
             dev_node = common.append_node("./device", None, vm_node, name = dev_name)
@@ -254,38 +310,59 @@ def create_native_pci_hole_node(allocation_etree, low_mem, high_mem):
         common.append_node("/acrn-config/hv/MMIO/HI_MMIO_START", "~0".upper(), allocation_etree)
         common.append_node("/acrn-config/hv/MMIO/HI_MMIO_END", "0", allocation_etree)
 
-def get_free_mmio(windowslist, used, size):
-    if not size:
-        raise ValueError(f"allocate size cannot be: {size}")
-    if not windowslist:
-        raise ValueError(f"No mmio range is specified:{windowslist}")
-
-    alignment = max(VBAR_ALIGNMENT, size)
-    for w in windowslist:
-        new_w_start = common.round_up(w.start, alignment)
-        window = MmioWindow(start = new_w_start, end = new_w_start + size - 1)
-        for u in used:
-            if window.overlaps(u):
-                new_u_end = common.round_up(u.end + 1, alignment)
-                window = MmioWindow(start = new_u_end, end = new_u_end + size - 1)
-                continue
-        if window.overlaps(w):
-            return window
-    raise lib.error.ResourceError(f"Not enough mmio window for a device size: {size}, free mmio windows: {windowslist}, used mmio windos{used}")
-
-def alloc_mmio(mems, devdict, used_mem):
+def alloc_mmio(allocator, devdict, limit = None):
     devdict_list = sorted(devdict.items(), key = lambda t : t[1], reverse = True)
     devdict_base = {}
     for dev_bar in devdict_list:
         bar_name = dev_bar[0]
         bar_length = dev_bar[1]
-        bar_window = get_free_mmio(mems, used_mem, bar_length)
-        bar_end_addr = bar_window.start + bar_length - 1
-        used_mem.append(MmioWindow(bar_window.start, bar_end_addr))
-        used_mem.sort()
+        bar_window = allocator.allocate(bar_length, limit)
         devdict_base[bar_name] = bar_window.start
     return devdict_base
 
+def get_ram_ranges(vm_node):
+    """
+    Return the (gpa, hpa, size) of the RAM ranges of a pre-launched VM, each mapped linearly; the holes of the
+    lowmem are not counted as they shift the GPA of hpa1 by multiples of 2M.
+    """
+    start_hpa = common.num2int(common.get_node("./memory/start_hpa/text()", vm_node) or "0")
+    size = common.num2int(common.get_node("./memory/size/text()", vm_node) or "0")
+    start_hpa2 = common.num2int(common.get_node("./memory/start_hpa2/text()", vm_node) or "0")
+    size_hpa2 = common.num2int(common.get_node("./memory/size_hpa2/text()", vm_node) or "0")
+
+    ranges = []
+    if size != 0:
+        ranges.append((0, start_hpa, size))
+    if size_hpa2 != 0:
+        if size > PRE_LAUNCHED_VM_LOW_RAM_MAX:
+            gpa = common.round_up(PRE_LAUNCHED_VM_HIGH_RAM_START + size - PRE_LAUNCHED_VM_LOW_RAM_MAX, 2 * SIZE_M)
+        elif size_hpa2 > PRE_LAUNCHED_VM_LOW_RAM_MAX - size:
+            gpa = PRE_LAUNCHED_VM_HIGH_RAM_START
+        elif size <= PRE_RTVM_SW_SRAM_BASE_GPA + SIZE_M:
+            gpa = size - SIZE_M
+        else:
+            gpa = size + PRE_RTVM_SW_SRAM_MAX_SIZE - SIZE_M
+        ranges.append((gpa, start_hpa2, size_hpa2))
+    return ranges
+
+def check_ram_alignment(vm_id, vm_node):
+    """
+    Warn of the RAM of a pre-launched VM which the EPT cannot map with large pages: a range whose GPA and HPA differ
+    by a multiple of the page size only.
+    """
+    for gpa, hpa, size in get_ram_ranges(vm_node):
+        for page_size, name in EPT_LARGE_PAGES:
+            if size < page_size:
+                continue
+            offset = gpa % page_size
+            if (hpa - offset) % page_size == 0:
+                break
+            suggested = common.round_up(hpa - offset, page_size) + offset
+            common.print_yel(f"VM {vm_id}: the RAM at HPA {hex(hpa)} is mapped at GPA {hex(gpa)} and cannot use {name} pages, "
+                             f"e.g. a HPA of {hex(suggested)} could", warn=True)
+        if size % (2 * SIZE_M) != 0:
+            common.print_yel(f"VM {vm_id}: the RAM size {hex(size)} at HPA {hex(hpa)} is not a multiple of 2M, its tail is mapped with 4K pages", warn=True)
+
 def allocate_ssram_region(board_etree, scenario_etree, allocation_etree):
     # Guest physical address of the SW SRAM allocated to a pre-launched VM
     enabled = common.get_node("//PSRAM_ENABLED/text()", scenario_etree)
@@ -310,29 +387,30 @@ def fn(board_etree, scenario_etree, allocation_etree):
     native_low_mem, native_high_mem = get_pci_hole_native(board_etree)
     create_native_pci_hole_node(allocation_etree, native_low_mem, native_high_mem)
 
-    vm_nodes = scenario_etree.xpath("//vm")
-    for vm_node in vm_nodes:
-        vm_id = vm_node.get('id')
-
+    model = lib.model.get_model(board_etree, scenario_etree)
+    mem_passthrough = None
+    for vm_id, vm_node in model.vms.items():
         devdict_32bits = {}
         devdict_64bits = {}
         insert_vuart_to_dev_dict(vm_node, devdict_32bits)
-        insert_ivsheme_to_dev_dict(scenario_etree, devdict_32bits, devdict_64bits, vm_id)
-        insert_pt_devs_to_dev_dict(board_etree, vm_node, devdict_32bits, devdict_64bits)
+        insert_ivsheme_to_dev_dict(model, devdict_32bits, devdict_64bits, vm_id)
+        insert_pt_devs_to_dev_dict(model, vm_id, devdict_32bits, devdict_64bits)
 
         low_mem = []
         high_mem = []
         used_low_mem = []
         used_high_mem = []
 
-        vm_type = common.get_node("./vm_type/text()", vm_node)
+        vm_type = model.vm_types[vm_id]
         if vm_type is not None and lib.lib.is_pre_launched_vm(vm_type):
+            check_ram_alignment(vm_id, vm_node)
             low_mem = [MmioWindow(start = PRE_LAUNCHED_VM_LOW_MEM_START, end = PRE_LAUNCHED_VM_LOW_MEM_END - 1)]
             high_mem = [MmioWindow(start = PRE_LAUNCHED_VM_HIGH_MEM_START, end = PRE_LAUNCHED_VM_HIGH_MEM_END - 1)]
         elif vm_type is not None and lib.lib.is_sos_vm(vm_type):
             low_mem = native_low_mem
             high_mem = native_high_mem
-            mem_passthrough = get_devs_mem_passthrough(board_etree, scenario_etree)
+            if mem_passthrough is None:
+                mem_passthrough = set(get_devs_mem_passthrough(model))
             used_low_mem_native = get_devs_mem_native(board_etree, low_mem)
             used_high_mem_native = get_devs_mem_native(board_etree, high_mem)
             # release the passthrough devices mmio windows from SOS
@@ -342,7 +420,9 @@ def fn(board_etree, scenario_etree, allocation_etree):
             # fall into else when the vm_type is post-launched vm, no mmio allocation is needed
             continue
 
-        devdict_base_32_bits = alloc_mmio(low_mem, devdict_32bits, used_low_mem)
-        devdict_base_64_bits = alloc_mmio(low_mem + high_mem, devdict_64bits, used_low_mem + used_high_mem)
-        create_device_node(allocation_etree, vm_id, devdict_base_32_bits)
-        create_device_node(allocation_etree, vm_id, devdict_base_64_bits)
+        # The 32-bit BARs are placed first, the 64-bit ones take the rest of the 32-bit windows before the 64-bit ones
+        allocator = MmioAllocator(low_mem + high_mem, used_low_mem + used_high_mem)
+        devdict_base_32_bits = alloc_mmio(allocator, devdict_32bits, 4 * SIZE_G)
+        devdict_base_64_bits = alloc_mmio(allocator, devdict_64bits)
+        create_device_node(model, allocation_etree, vm_id, devdict_base_32_bits)
+        create_device_node(model, allocation_etree, vm_id, devdict_base_64_bits)
@@ -41,6 +41,8 @@ def fn(board_etree, scenario_etree, allocation_etree):
                 except Exception as e:
                     print(e)
     hv_ram_size += 2 * max(total_shm_size, 0x200000)
+    # end the HV RAM on a 2M boundary too, so that the SOS RAM around it keeps the large pages of its EPT
+    hv_ram_size = common.round_up(hv_ram_size, MEM_ALIGN)
     assert(hv_ram_size <= HV_RAM_SIZE_MAX)
 
     # reseve 16M memory for hv sbuf, ramoops, etc.
@@ -48,7 +50,8 @@ def fn(board_etree, scenario_etree, allocation_etree):
     # We recommend to put hv ram start address high than 0x10000000 to
     # reduce memory conflict with GRUB/SOS Kernel.
     hv_start_offset = 0x10000000
-    total_size = reserved_ram + hv_ram_size
+    # leave room to round the start up to MEM_ALIGN
+    total_size = reserved_ram + hv_ram_size + MEM_ALIGN
     for start_addr in list(board_cfg_lib.USED_RAM_RANGE):
         if hv_start_offset <= start_addr < 0x80000000:
             del board_cfg_lib.USED_RAM_RANGE[start_addr]
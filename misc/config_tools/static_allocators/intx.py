@@ -7,7 +7,7 @@
 
 import sys, os
 sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'library'))
-import common, board_cfg_lib, lib.error, lib.lib
+import common, board_cfg_lib, lib.error, lib.lib, lib.model
 
 LEGACY_IRQ_MAX = 16
 
@@ -53,9 +53,10 @@ def fn(board_etree, scenario_etree, allocation_etree):
     native_ttys = lib.lib.get_native_ttys()
     vuart_valid = ['ttyS0', 'ttyS1', 'ttyS2', 'ttyS3']
 
-    scenario_sos_vm_node = common.get_node("//vm[vm_type = 'SOS_VM']", scenario_etree)
-    if scenario_sos_vm_node is not None:
-        vm_id = common.get_node("./@id", scenario_sos_vm_node)
+    model = lib.model.get_model(board_etree, scenario_etree)
+    vm_id = model.sos_vm_id()
+    if vm_id is not None:
+        scenario_sos_vm_node = model.vms[vm_id]
         if common.get_node("./legacy_vuart[@id = '0']/base/text()", scenario_sos_vm_node) != "INVALID_COM_BASE":
             vuart0_irq = -1
             if hv_debug_console in vuart_valid and hv_debug_console in native_ttys.keys() and native_ttys[hv_debug_console]['irq'] < LEGACY_IRQ_MAX:
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2021 Intel Corporation.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+import sys, os
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'library'))
+import common, lib.lib
+
+class Model:
+    """
+    Index of the board and scenario XML, built once and shared by all the allocators instead of each of them
+    searching the whole trees again for every VM and device.
+    """
+    def __init__(self, board_etree, scenario_etree):
+        self.vms = {}
+        self.vm_types = {}
+        self.pt_devs = {}
+        for vm_node in scenario_etree.xpath("//vm"):
+            vm_id = vm_node.get('id')
+            self.vms[vm_id] = vm_node
+            self.vm_types[vm_id] = common.get_node("./vm_type/text()", vm_node)
+            self.pt_devs[vm_id] = [pt_dev.split()[0] for pt_dev in vm_node.xpath("./pci_devs/pci_dev/text()")]
+        self.shmem_regions = lib.lib.get_shmem_regions(scenario_etree)
+
+        # {(bus, (dev << 16) | func): device node}
+        self.pci_devs = {}
+        for dev_node in board_etree.xpath("//bus[@type = 'pci']/device[@address]"):
+            bus = int(dev_node.getparent().get('address', '0x0'), 16)
+            self.pci_devs[(bus, int(dev_node.get('address'), 16))] = dev_node
+
+        self._alloc_vm_nodes = {}
+
+    def vms_of_type(self, vm_types):
+        return [vm_id for vm_id, vm_type in self.vm_types.items() if vm_type in vm_types]
+
+    def sos_vm_id(self):
+        vm_ids = self.vms_of_type(lib.lib.SOS_VM_TYPE)
+        return vm_ids[0] if vm_ids else None
+
+    def pre_launched_pt_devs(self):
+        """
+        Return the BDF strings of the devices passed through to the pre-launched VMs.
+        """
+        return [bdf for vm_id in self.vms_of_type(lib.lib.PRE_LAUNCHED_VMS_TYPE) for bdf in self.pt_devs[vm_id]]
+
+    def pci_dev(self, bdf):
+        """
+        Return the board node of the PCI device at a BDF string, e.g. "00:1f.2".
+        """
+        bus = int(bdf.split(':')[0], 16)
+        dev = int(bdf.split(":")[1].split('.')[0], 16)
+        func = int(bdf.split(":")[1].split('.')[1], 16)
+        return self.pci_devs.get((bus, (dev << 16) | func))
+
+    def alloc_vm_node(self, allocation_etree, vm_id):
+        vm_node = self._alloc_vm_nodes.get(vm_id)
+        if vm_node is None:
+            vm_node = common.get_node(f"/acrn-config/vm[@id = '{vm_id}']", allocation_etree)
+            if vm_node is None:
+                vm_node = common.append_node("/acrn-config/vm", None, allocation_etree, id = vm_id)
+            self._alloc_vm_nodes[vm_id] = vm_node
+        return vm_node
+
+_models = {}
+
+def get_model(board_etree, scenario_etree):
+    key = (id(board_etree), id(scenario_etree))
+    if key not in _models:
+        _models[key] = Model(board_etree, scenario_etree)
+    return _models[key]
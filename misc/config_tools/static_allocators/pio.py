@@ -7,7 +7,7 @@
 
 import sys, os
 sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'library'))
-import common, lib.lib
+import common, lib.lib, lib.model
 
 VALID_PIO = ['0x3F8', '0x2F8', '0x3E8', '0x2E8']
 
@@ -50,9 +50,10 @@ def fn(board_etree, scenario_etree, allocation_etree):
     vuart_valid = ['ttyS0', 'ttyS1', 'ttyS2', 'ttyS3']
     hv_debug_console = lib.lib.parse_hv_console(scenario_etree)
 
-    scenario_sos_vm_node = common.get_node("//vm[vm_type = 'SOS_VM']", scenario_etree)
-    if scenario_sos_vm_node is not None:
-        vm_id = common.get_node("./@id", scenario_sos_vm_node)
+    model = lib.model.get_model(board_etree, scenario_etree)
+    vm_id = model.sos_vm_id()
+    if vm_id is not None:
+        scenario_sos_vm_node = model.vms[vm_id]
         if common.get_node("./legacy_vuart[@id = '0']/base/text()", scenario_sos_vm_node) != "INVALID_COM_BASE":
             vuart0_base = ""
             if hv_debug_console in vuart_valid and hv_debug_console in native_ttys.keys() and native_ttys[hv_debug_console]['type'] == "portio":
@@ -58,6 +58,12 @@
       <xsl:with-param name="key" select="'LOG_BUF_SIZE'" />
     </xsl:call-template>
 
+    <xsl:if test="RELEASE != 'y'">
+      <xsl:call-template name="boolean-by-key">
+	<xsl:with-param name="key" select="'LOCK_STATS'" />
+      </xsl:call-template>
+    </xsl:if>
+
     <xsl:apply-templates select="SERIAL_CONSOLE" />
   </xsl:template>
 
@@ -67,6 +73,16 @@
       <xsl:with-param name="value" select="'y'" />
     </xsl:call-template>
 
+    <xsl:if test="SCHEDULER != 'SCHED_NOOP'">
+      <xsl:call-template name="boolean-by-key">
+	<xsl:with-param name="key" select="'SCHED_BALANCE'" />
+      </xsl:call-template>
+
+      <xsl:call-template name="boolean-by-key">
+	<xsl:with-param name="key" select="'SCHED_PREEMPTION_TIMER'" />
+      </xsl:call-template>
+    </xsl:if>
+
     <xsl:call-template name="boolean-by-key">
       <xsl:with-param name="key" select="'RELOC'" />
     </xsl:call-template>
@@ -75,10 +91,28 @@
       <xsl:with-param name="key" select="'MULTIBOOT2'" />
     </xsl:call-template>
 
+    <xsl:call-template name="boolean-by-key">
+      <xsl:with-param name="key" select="'STAGED_BOOT_ENABLED'" />
+    </xsl:call-template>
+
+    <xsl:call-template name="boolean-by-key">
+      <xsl:with-param name="key" select="'IDLE_CSTATE'" />
+      <xsl:with-param name="default" select="'y'" />
+    </xsl:call-template>
+
     <xsl:call-template name="boolean-by-key">
       <xsl:with-param name="key" select="'ENFORCE_TURNOFF_AC'" />
     </xsl:call-template>
 
+    <xsl:call-template name="boolean-by-key">
+      <xsl:with-param name="key" select="'SPLITLOCK_NATIVE_STEP'" />
+    </xsl:call-template>
+
+    <xsl:call-template name="integer-by-key">
+      <xsl:with-param name="key" select="'SPLITLOCK_RATE_LIMIT'" />
+      <xsl:with-param name="default" select="'0'" />
+    </xsl:call-template>
+
     <xsl:call-template name="boolean-by-key-value">
       <xsl:with-param name="key" select="'RDT_ENABLED'" />
       <xsl:with-param name="value" select="RDT/RDT_ENABLED" />
@@ -173,6 +207,11 @@
       <xsl:with-param name="key" select="'MAX_PT_IRQ_ENTRIES'" />
     </xsl:call-template>
 
+    <xsl:call-template name="integer-by-key">
+      <xsl:with-param name="key" select="'MAX_GUEST_EPT_NUM'" />
+      <xsl:with-param name="default" select="'4'" />
+    </xsl:call-template>
+
     <xsl:call-template name="integer-by-key">
       <xsl:with-param name="key" select="'MAX_MSIX_TABLE_NUM'" />
       <xsl:with-param name="default" select="normalize-space(/acrn-offline-data/board-data/acrn-config/MAX_MSIX_TABLE_NUM)" />
@@ -317,11 +356,22 @@
 
   <xsl:template name="boolean-by-key">
     <xsl:param name="key" />
+    <xsl:param name="default" />
 
-    <xsl:call-template name="boolean-by-key-value">
-      <xsl:with-param name="key" select="$key" />
-      <xsl:with-param name="value" select="./*[name() = $key]" />
-    </xsl:call-template>
+    <xsl:choose>
+      <xsl:when test="./*[name() = $key]">
+	<xsl:call-template name="boolean-by-key-value">
+	  <xsl:with-param name="key" select="$key" />
+	  <xsl:with-param name="value" select="./*[name() = $key]" />
+	</xsl:call-template>
+      </xsl:when>
+      <xsl:otherwise>
+	<xsl:call-template name="boolean-by-key-value">
+	  <xsl:with-param name="key" select="$key" />
+	  <xsl:with-param name="value" select="$default" />
+	</xsl:call-template>
+      </xsl:otherwise>
+    </xsl:choose>
   </xsl:template>
 
   <xsl:template name="integer-by-key">
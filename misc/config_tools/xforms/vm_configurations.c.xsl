@@ -77,6 +77,7 @@
     <xsl:if test="acrn:is-pre-launched-vm(vm_type)">
       <xsl:call-template name="pre_launched" />
     </xsl:if>
+    <xsl:apply-templates select="timer_slack_us | ple_gap | ple_window | halt_poll_us | vcr_profile" />
 
     <!-- End of the initializer -->
     <xsl:text>},</xsl:text>
@@ -94,6 +95,14 @@
     <xsl:value-of select="$newline" />
   </xsl:template>
 
+  <xsl:template match="timer_slack_us | ple_gap | ple_window | halt_poll_us">
+    <xsl:value-of select="acrn:initializer(name(), concat(current(), 'U'))" />
+  </xsl:template>
+
+  <xsl:template match="vcr_profile">
+    <xsl:value-of select="acrn:initializer(name(), current())" />
+  </xsl:template>
+
   <xsl:template match="name">
     <xsl:value-of select="acrn:initializer('name', concat($quot, current(), $quot))" />
   </xsl:template>
@@ -31,6 +31,7 @@
 
   <xsl:template match="config-data/acrn-config">
     <xsl:call-template name="vm_count" />
+    <xsl:call-template name="feature_vm_count" />
     <xsl:call-template name="dm_guest_flag" />
     <xsl:call-template name="pre_launched_vm_hpa" />
     <xsl:call-template name="sos_vm_bootarges" />
@@ -45,12 +46,33 @@
     <xsl:value-of select="acrn:define('CONFIG_MAX_KATA_VM_NUM', count(vm[acrn:is-kata-vm(vm_type)]), 'U')" />
   </xsl:template>
 
+  <xsl:template name ="feature_vm_count">
+    <xsl:value-of select="acrn:comment('Number of VMs which may have LAPIC passthrough or nested virtualization, the post-launched VMs get their guest flags from the device model. When 0U, the checks of the feature are settled at build time.')" />
+    <xsl:value-of select="$newline" />
+    <xsl:choose>
+      <xsl:when test="count(vm[acrn:is-sos-vm(vm_type)])">
+        <xsl:value-of select="acrn:define('MAX_LAPIC_PT_VM_NUM', count(vm[guest_flags/guest_flag = 'GUEST_FLAG_LAPIC_PASSTHROUGH' or acrn:is-post-launched-vm(vm_type)]), 'U')" />
+      </xsl:when>
+      <xsl:otherwise>
+        <xsl:value-of select="acrn:define('MAX_LAPIC_PT_VM_NUM', count(vm[guest_flags/guest_flag = 'GUEST_FLAG_LAPIC_PASSTHROUGH']), 'U')" />
+      </xsl:otherwise>
+    </xsl:choose>
+    <xsl:choose>
+      <xsl:when test="hv/FEATURES/NVMX_ENABLED = 'y'">
+        <xsl:value-of select="acrn:define('MAX_NVMX_VM_NUM', count(vm[guest_flags/guest_flag = 'GUEST_FLAG_NVMX_ENABLED']), 'U')" />
+      </xsl:when>
+      <xsl:otherwise>
+        <xsl:value-of select="acrn:define('MAX_NVMX_VM_NUM', 0, 'U')" />
+      </xsl:otherwise>
+    </xsl:choose>
+  </xsl:template>
+
   <xsl:template name ="dm_guest_flag">
     <xsl:choose>
       <xsl:when test="count(vm[vm_type='SOS_VM'])">
         <xsl:value-of select="acrn:comment('Bitmask of guest flags that can be programmed by device model. Other bits are set by hypervisor only.')" />
         <xsl:value-of select="$newline" />
-        <xsl:value-of select="acrn:define('DM_OWNED_GUEST_FLAG_MASK', '(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)', '')" />
+        <xsl:value-of select="acrn:define('DM_OWNED_GUEST_FLAG_MASK', '(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_VHPET | GUEST_FLAG_VPM_TMR | GUEST_FLAG_VRTC | GUEST_FLAG_PV_IPI | GUEST_FLAG_PV_TLB_FLUSH | GUEST_FLAG_PV_STEAL_TIME | GUEST_FLAG_VPMU | GUEST_FLAG_WBINVD_RANGE | GUEST_FLAG_MWAIT_PASSTHRU | GUEST_FLAG_HIDE_RDRAND)', '')" />
       </xsl:when>
       <xsl:otherwise>
       <xsl:value-of select="acrn:define('DM_OWNED_GUEST_FLAG_MASK', '0', 'UL')" />
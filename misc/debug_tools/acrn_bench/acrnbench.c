@@ -0,0 +1,1008 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Microbenchmarks of the virtualization hot paths, run in a User VM:
+ * the exits handled by the hypervisor, the I/O requests completed by the
+ * device model, interrupt and IPI delivery, and timer jitter.
+ *
+ * Each benchmark prints one JSON object per line on stdout, so that the
+ * results of two releases can be compared by a script.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <limits.h>
+#include <dirent.h>
+#include <time.h>
+#include <cpuid.h>
+#include <x86intrin.h>
+#include <sys/io.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/futex.h>
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+/* the benchmark device of the DM, keep in sync with devicemodel/hw/pci/bench.c */
+#define BENCH_VENDOR		0x8086
+#define BENCH_DEV		0x86f0
+#define BENCH_MAGIC		0x48434e42
+#define BENCH_REG_ID		0x0
+#define BENCH_REG_SCRATCH	0x4
+#define BENCH_REG_DOORBELL	0x8
+#define BENCH_REG_ACK		0xc
+#define BENCH_MMIO_BAR_SIZE	0x1000
+
+#define MSR_IA32_APIC_BASE	0x1b
+#define PCI_CONFIG_ADDR_PORT	0xcf8
+#define IOAPIC_BASE		0xfec00000UL
+
+#define NSEC_PER_USEC		1000ULL
+#define NSEC_PER_SEC		1000000000ULL
+
+#define VBENCH_MAX_QD		256
+#define VBENCH_ETH_P		0x88b5	/* local experimental ethertype */
+
+static unsigned int iterations = 10000;
+static int cpu;
+static int peer_cpu = 1;
+static char pci_dev[PATH_MAX];
+static const char *uio_dev;
+static unsigned int msr = MSR_IA32_APIC_BASE;
+static unsigned long hv_mmio = IOAPIC_BASE;
+static unsigned long timer_period_us = 1000;
+static const char *bench_list;
+
+/* the virtio benchmarks, for the null/loopback backends of the DM */
+static unsigned int queue_depth = 32;
+static unsigned int io_size = 4096;
+static unsigned int duration_s = 5;
+static const char *blk_dev = "/dev/vdb";
+static const char *net_if = "eth1";
+static const char *con_port = "/dev/vport0p1";
+static const char *intr_match = "virtio";
+
+static uint64_t *samples;
+
+/* the bench device, mapped by bench_dev_open() */
+static volatile uint32_t *dm_mmio;
+static uint16_t dm_port;
+
+static inline uint64_t tsc_start(void)
+{
+	uint64_t t;
+
+	_mm_lfence();
+	t = __rdtsc();
+	_mm_lfence();
+	return t;
+}
+
+static inline uint64_t tsc_end(void)
+{
+	unsigned int aux;
+	uint64_t t;
+
+	t = __rdtscp(&aux);
+	_mm_lfence();
+	return t;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, const char *unit, uint64_t *s,
+		   unsigned int n)
+{
+	unsigned long long sum = 0;
+	unsigned int i;
+
+	if (!n)
+		return;
+
+	qsort(s, n, sizeof(*s), cmp_u64);
+	for (i = 0; i < n; i++)
+		sum += s[i];
+
+	printf("{\"bench\":\"%s\",\"unit\":\"%s\",\"iterations\":%u,"
+	       "\"min\":%llu,\"median\":%llu,\"p99\":%llu,\"max\":%llu,"
+	       "\"mean\":%llu}\n", name, unit, n,
+	       (unsigned long long)s[0], (unsigned long long)s[n / 2],
+	       (unsigned long long)s[(uint64_t)n * 99 / 100],
+	       (unsigned long long)s[n - 1], sum / n);
+	fflush(stdout);
+}
+
+/* why must not need JSON escaping */
+static void report_skip(const char *name, const char *why)
+{
+	printf("{\"bench\":\"%s\",\"skipped\":\"%s\"}\n", name, why);
+	fflush(stdout);
+}
+
+/* CPUID always exits, handled by the hypervisor */
+static void bench_cpuid(void)
+{
+	unsigned int a, b, c, d;
+	uint64_t t0;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = tsc_start();
+		__cpuid(0, a, b, c, d);
+		samples[i] = tsc_end() - t0;
+	}
+	(void)a; (void)b; (void)c; (void)d;
+	report("cpuid", "cycles", samples, iterations);
+}
+
+/* the cost of a pread() that does not exit, to subtract from "msr" */
+static void bench_syscall(void)
+{
+	uint64_t t0, val;
+	unsigned int i;
+	int fd;
+
+	fd = open("/dev/zero", O_RDONLY);
+	if (fd < 0) {
+		report_skip("syscall", "no /dev/zero");
+		return;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		t0 = tsc_start();
+		if (pread(fd, &val, sizeof(val), 0) != sizeof(val))
+			break;
+		samples[i] = tsc_end() - t0;
+	}
+	close(fd);
+	report("syscall", "cycles", samples, i);
+}
+
+/* RDMSR of an intercepted MSR, through the msr driver of the guest */
+static void bench_msr(void)
+{
+	char path[64];
+	uint64_t t0, val;
+	unsigned int i;
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		report_skip("msr", "no msr device, modprobe msr");
+		return;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		t0 = tsc_start();
+		if (pread(fd, &val, sizeof(val), msr) != sizeof(val))
+			break;
+		samples[i] = tsc_end() - t0;
+	}
+	close(fd);
+	if (!i)
+		report_skip("msr", "rdmsr failed");
+	else
+		report("msr", "cycles", samples, i);
+}
+
+static void bench_pio(const char *name, uint16_t port)
+{
+	uint64_t t0;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = tsc_start();
+		(void)inl(port);
+		samples[i] = tsc_end() - t0;
+	}
+	report(name, "cycles", samples, iterations);
+}
+
+static void bench_mmio_read(const char *name, volatile uint32_t *reg)
+{
+	uint64_t t0;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = tsc_start();
+		(void)*reg;
+		samples[i] = tsc_end() - t0;
+	}
+	report(name, "cycles", samples, iterations);
+}
+
+static void bench_mmio_write(const char *name, volatile uint32_t *reg)
+{
+	uint64_t t0;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = tsc_start();
+		*reg = i;
+		samples[i] = tsc_end() - t0;
+	}
+	report(name, "cycles", samples, iterations);
+}
+
+/* the PCI config address port, emulated by the hypervisor */
+static void bench_pio_hv(void)
+{
+	if (iopl(3)) {
+		report_skip("pio_hv", "iopl failed");
+		return;
+	}
+	bench_pio("pio_hv", PCI_CONFIG_ADDR_PORT);
+}
+
+/* the vIOAPIC by default, emulated by the hypervisor */
+static void bench_mmio_hv(void)
+{
+	volatile uint32_t *reg;
+	int fd;
+
+	fd = open("/dev/mem", O_RDWR | O_SYNC);
+	if (fd < 0) {
+		report_skip("mmio_hv", "no /dev/mem");
+		return;
+	}
+	reg = mmap(NULL, 0x1000, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		   hv_mmio);
+	close(fd);
+	if (reg == MAP_FAILED) {
+		report_skip("mmio_hv", "mmap of /dev/mem failed, try -a");
+		return;
+	}
+
+	/* IOREGSEL of the vIOAPIC, reading it has no side effect */
+	bench_mmio_read("mmio_hv", reg);
+	munmap((void *)reg, 0x1000);
+}
+
+static int read_sysfs_hex(const char *dir, const char *name,
+			  unsigned long *val)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	ret = fscanf(f, "%lx", val) == 1 ? 0 : -1;
+	fclose(f);
+	return ret;
+}
+
+static int find_bench_dev(void)
+{
+	const char *base = "/sys/bus/pci/devices";
+	unsigned long vendor, device;
+	struct dirent *d;
+	char dir[PATH_MAX];
+	DIR *dp;
+	int ret = -1;
+
+	dp = opendir(base);
+	if (!dp)
+		return -1;
+
+	while ((d = readdir(dp))) {
+		if (d->d_name[0] == '.')
+			continue;
+		snprintf(dir, sizeof(dir), "%s/%s", base, d->d_name);
+		if (read_sysfs_hex(dir, "vendor", &vendor) ||
+		    read_sysfs_hex(dir, "device", &device))
+			continue;
+		if (vendor == BENCH_VENDOR && device == BENCH_DEV) {
+			snprintf(pci_dev, sizeof(pci_dev), "%s", dir);
+			ret = 0;
+			break;
+		}
+	}
+	closedir(dp);
+
+	return ret;
+}
+
+/* map BAR0 and find the port of BAR1 of the bench device */
+static int bench_dev_open(void)
+{
+	unsigned long long start, end, flags;
+	char path[PATH_MAX];
+	FILE *f;
+	int fd;
+
+	if (dm_mmio)
+		return 0;
+	if (!pci_dev[0] && find_bench_dev())
+		return -1;
+
+	if (snprintf(path, sizeof(path), "%s/resource", pci_dev) >= sizeof(path))
+		return -1;
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	/* line 0 is BAR0, line 1 is BAR1 */
+	if (fscanf(f, "%llx %llx %llx", &start, &end, &flags) != 3 ||
+	    fscanf(f, "%llx %llx %llx", &start, &end, &flags) != 3) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	dm_port = (uint16_t)start;
+
+	if (snprintf(path, sizeof(path), "%s/resource0", pci_dev) >= sizeof(path))
+		return -1;
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0)
+		return -1;
+	dm_mmio = mmap(NULL, BENCH_MMIO_BAR_SIZE, PROT_READ | PROT_WRITE,
+		       MAP_SHARED, fd, 0);
+	close(fd);
+	if (dm_mmio == MAP_FAILED) {
+		dm_mmio = NULL;
+		return -1;
+	}
+
+	if (dm_mmio[BENCH_REG_ID / 4] != BENCH_MAGIC) {
+		munmap((void *)dm_mmio, BENCH_MMIO_BAR_SIZE);
+		dm_mmio = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the full round trip of an I/O request, hypervisor to DM and back */
+static void bench_mmio_dm(void)
+{
+	if (bench_dev_open()) {
+		report_skip("mmio_dm", "no bench device, add -s <slot>,bench to acrn-dm");
+		return;
+	}
+	bench_mmio_read("mmio_dm_read", &dm_mmio[BENCH_REG_ID / 4]);
+	bench_mmio_write("mmio_dm_write", &dm_mmio[BENCH_REG_SCRATCH / 4]);
+}
+
+static void bench_pio_dm(void)
+{
+	if (bench_dev_open()) {
+		report_skip("pio_dm", "no bench device, add -s <slot>,bench to acrn-dm");
+		return;
+	}
+	if (iopl(3)) {
+		report_skip("pio_dm", "iopl failed");
+		return;
+	}
+	bench_pio("pio_dm", dm_port + BENCH_REG_ID);
+}
+
+/*
+ * A doorbell write to the interrupt reaching this thread: the I/O request,
+ * the INTx assertion by the DM and its injection, and the wakeup through
+ * uio_pci_generic bound to the bench device.
+ */
+static void bench_intr(void)
+{
+	uint32_t one = 1, count;
+	uint64_t t0;
+	unsigned int i;
+	int fd;
+
+	if (bench_dev_open()) {
+		report_skip("intr", "no bench device, add -s <slot>,bench to acrn-dm");
+		return;
+	}
+	if (!uio_dev) {
+		report_skip("intr", "no uio device, bind uio_pci_generic and give -u");
+		return;
+	}
+	fd = open(uio_dev, O_RDWR);
+	if (fd < 0) {
+		report_skip("intr", "cannot open the uio device");
+		return;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		if (write(fd, &one, sizeof(one)) != sizeof(one))
+			break;
+		t0 = tsc_start();
+		dm_mmio[BENCH_REG_DOORBELL / 4] = 1;
+		if (read(fd, &count, sizeof(count)) != sizeof(count))
+			break;
+		samples[i] = tsc_end() - t0;
+		dm_mmio[BENCH_REG_ACK / 4] = 1;
+	}
+	close(fd);
+	report("intr", "cycles", samples, i);
+}
+
+static volatile int ping, pong;
+
+static void futex_wait(volatile int *addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(volatile int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static int pin_cpu(int c)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(c, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void *ipi_peer(void *arg)
+{
+	unsigned int i;
+	int v;
+
+	if (pin_cpu(peer_cpu))
+		return NULL;
+
+	for (i = 1; i <= iterations; i++) {
+		while ((v = ping) != (int)i)
+			futex_wait(&ping, v);
+		pong = i;
+		futex_wake(&pong);
+	}
+
+	return NULL;
+}
+
+/*
+ * Wake a thread sleeping on another CPU and get woken back: two IPIs
+ * through the vLAPIC, and the HLT exits of the idle CPUs.
+ */
+static void bench_ipi(void)
+{
+	pthread_t peer;
+	uint64_t t0;
+	unsigned int i;
+	int v;
+
+	if (peer_cpu == cpu || sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+		report_skip("ipi", "needs two CPUs, see -C");
+		return;
+	}
+
+	ping = pong = 0;
+	if (pthread_create(&peer, NULL, ipi_peer, NULL)) {
+		report_skip("ipi", "pthread_create failed");
+		return;
+	}
+	/* let the peer go to sleep */
+	usleep(10000);
+
+	for (i = 1; i <= iterations; i++) {
+		t0 = tsc_start();
+		ping = i;
+		futex_wake(&ping);
+		while ((v = pong) != (int)i)
+			futex_wait(&pong, v);
+		samples[i - 1] = tsc_end() - t0;
+	}
+	pthread_join(peer, NULL);
+	report("ipi_rtt", "cycles", samples, iterations);
+}
+
+/* lateness of a periodic absolute timer, through the vLAPIC timer */
+static void bench_timer(void)
+{
+	struct timespec next, now;
+	uint64_t n, t;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (i = 0; i < iterations; i++) {
+		n = next.tv_sec * NSEC_PER_SEC + next.tv_nsec +
+		    timer_period_us * NSEC_PER_USEC;
+		next.tv_sec = n / NSEC_PER_SEC;
+		next.tv_nsec = n % NSEC_PER_SEC;
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		t = now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+		samples[i] = t > n ? t - n : 0;
+	}
+	report("timer_jitter", "ns", samples, iterations);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* busy time of all the CPUs of the guest, in ns */
+static uint64_t busy_cpu_ns(void)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq;
+	long hz = sysconf(_SC_CLK_TCK);
+	FILE *f;
+	int n;
+
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return 0;
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+		   &sys, &idle, &iowait, &irq, &softirq);
+	fclose(f);
+	if (n != 7 || hz <= 0)
+		return 0;
+
+	return (user + nice + sys + irq + softirq) * NSEC_PER_SEC / hz;
+}
+
+/* interrupts taken so far by the lines whose name has intr_match */
+static uint64_t intr_count(void)
+{
+	char line[4096], *p, *end;
+	unsigned long long v;
+	uint64_t sum = 0;
+	FILE *f;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!strstr(line, intr_match))
+			continue;
+		p = strchr(line, ':');
+		if (!p)
+			continue;
+		/* the per-CPU counts follow the IRQ number */
+		for (p++;; p = end) {
+			v = strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			sum += v;
+		}
+	}
+	fclose(f);
+
+	return sum;
+}
+
+struct vbench_stat {
+	uint64_t start_ns;
+	uint64_t cpu_ns;
+	uint64_t intrs;
+};
+
+static void vbench_start(struct vbench_stat *st)
+{
+	st->intrs = intr_count();
+	st->cpu_ns = busy_cpu_ns();
+	st->start_ns = now_ns();
+}
+
+static void vbench_report(const char *name, struct vbench_stat *st,
+			  uint64_t ops, unsigned int qd)
+{
+	uint64_t elapsed = now_ns() - st->start_ns;
+	uint64_t cpu = busy_cpu_ns() - st->cpu_ns;
+	uint64_t intrs = intr_count() - st->intrs;
+
+	if (!ops || !elapsed)
+		return;
+
+	printf("{\"bench\":\"%s\",\"qd\":%u,\"size\":%u,\"ops\":%llu,"
+	       "\"ops_per_s\":%llu,\"cpu_ns_per_op\":%llu,"
+	       "\"intr_per_s\":%llu,\"intr_per_op\":%.3f}\n", name, qd,
+	       io_size, (unsigned long long)ops,
+	       (unsigned long long)(ops * NSEC_PER_SEC / elapsed),
+	       (unsigned long long)(cpu / ops),
+	       (unsigned long long)(intrs * NSEC_PER_SEC / elapsed),
+	       (double)intrs / ops);
+	fflush(stdout);
+}
+
+/*
+ * Direct random reads kept queue_depth deep through Linux AIO, against a
+ * virtio-blk device such as -s <slot>,virtio-blk,null.
+ */
+static void bench_vblk(void)
+{
+	struct iocb iocbs[VBENCH_MAX_QD], *piocb[VBENCH_MAX_QD];
+	struct io_event events[VBENCH_MAX_QD];
+	struct vbench_stat st;
+	aio_context_t aio = 0;
+	unsigned long long size, blocks;
+	uint64_t ops = 0, end;
+	unsigned int i;
+	void *buf;
+	int fd, n;
+
+	fd = open(blk_dev, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		report_skip("vblk_read", "cannot open the block device, see -k");
+		return;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size) || size < io_size) {
+		report_skip("vblk_read", "cannot get the size of the block device");
+		close(fd);
+		return;
+	}
+	blocks = size / io_size;
+
+	if (posix_memalign(&buf, 4096, (size_t)io_size * queue_depth)) {
+		close(fd);
+		return;
+	}
+	if (syscall(SYS_io_setup, queue_depth, &aio)) {
+		report_skip("vblk_read", "io_setup failed");
+		free(buf);
+		close(fd);
+		return;
+	}
+
+	for (i = 0; i < queue_depth; i++) {
+		memset(&iocbs[i], 0, sizeof(iocbs[i]));
+		iocbs[i].aio_fildes = fd;
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+		iocbs[i].aio_buf = (uintptr_t)buf + (size_t)i * io_size;
+		iocbs[i].aio_nbytes = io_size;
+		iocbs[i].aio_offset = (random() % blocks) * io_size;
+		iocbs[i].aio_data = i;
+		piocb[i] = &iocbs[i];
+	}
+
+	vbench_start(&st);
+	end = st.start_ns + duration_s * NSEC_PER_SEC;
+	if (syscall(SYS_io_submit, aio, queue_depth, piocb) != queue_depth)
+		goto out;
+
+	while (now_ns() < end) {
+		n = syscall(SYS_io_getevents, aio, 1, queue_depth, events, NULL);
+		if (n <= 0)
+			break;
+		for (i = 0; i < n; i++) {
+			struct iocb *cb = &iocbs[events[i].data];
+
+			cb->aio_offset = (random() % blocks) * io_size;
+			piocb[i] = cb;
+		}
+		ops += n;
+		if (syscall(SYS_io_submit, aio, n, piocb) != n)
+			break;
+	}
+	vbench_report("vblk_read", &st, ops, queue_depth);
+
+out:
+	syscall(SYS_io_destroy, aio);
+	free(buf);
+	close(fd);
+}
+
+/*
+ * Frames kept queue_depth in flight through a virtio-net device whose
+ * backend sends them back, -s <slot>,virtio-net,loopback.
+ */
+static void bench_vnet(void)
+{
+	struct sockaddr_ll addr;
+	struct vbench_stat st;
+	struct timeval tv = { 0, 100000 };
+	uint8_t frame[ETH_FRAME_LEN], rbuf[ETH_FRAME_LEN];
+	uint64_t ops = 0, lost = 0, end;
+	unsigned int i, inflight;
+	ssize_t len;
+	int fd, one = 1;
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(VBENCH_ETH_P));
+	if (fd < 0) {
+		report_skip("vnet", "no packet socket, run as root");
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(VBENCH_ETH_P);
+	addr.sll_ifindex = if_nametoindex(net_if);
+	addr.sll_halen = ETH_ALEN;
+	memset(addr.sll_addr, 0xff, ETH_ALEN);
+	if (!addr.sll_ifindex || bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		report_skip("vnet", "cannot bind to the interface, see -i");
+		close(fd);
+		return;
+	}
+#ifdef PACKET_IGNORE_OUTGOING
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+	(void)one;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	/* broadcast, so the looped back frame is taken by the guest */
+	len = io_size < ETH_ZLEN ? ETH_ZLEN :
+	      (io_size > ETH_FRAME_LEN ? ETH_FRAME_LEN : io_size);
+	memset(frame, 0, sizeof(frame));
+	memset(frame, 0xff, ETH_ALEN);
+	frame[12] = VBENCH_ETH_P >> 8;
+	frame[13] = VBENCH_ETH_P & 0xff;
+
+	vbench_start(&st);
+	end = st.start_ns + duration_s * NSEC_PER_SEC;
+	inflight = 0;
+	while (now_ns() < end) {
+		for (i = inflight; i < queue_depth; i++) {
+			if (sendto(fd, frame, len, 0, (struct sockaddr *)&addr,
+				   sizeof(addr)) == len)
+				inflight++;
+		}
+
+		socklen_t alen = sizeof(addr);
+		struct sockaddr_ll from;
+
+		if (recvfrom(fd, rbuf, sizeof(rbuf), 0, (struct sockaddr *)&from,
+			     &alen) < 0) {
+			/* dropped for lack of rx buffers, send them again */
+			lost += inflight;
+			inflight = 0;
+			continue;
+		}
+		if (from.sll_pkttype == PACKET_OUTGOING)
+			continue;
+		inflight--;
+		ops++;
+	}
+	vbench_report("vnet_loopback", &st, ops, queue_depth);
+	if (lost)
+		fprintf(stderr, "vnet: %llu frames lost\n", (unsigned long long)lost);
+	close(fd);
+}
+
+/* writes to a virtio-console port, -s <slot>,virtio-console,null:<name> */
+static void bench_vcon(void)
+{
+	struct vbench_stat st;
+	uint64_t ops = 0, end;
+	char *buf;
+	int fd;
+
+	fd = open(con_port, O_WRONLY);
+	if (fd < 0) {
+		report_skip("vcon_write", "cannot open the port, see -o");
+		return;
+	}
+	buf = calloc(1, io_size);
+	if (!buf) {
+		close(fd);
+		return;
+	}
+
+	vbench_start(&st);
+	end = st.start_ns + duration_s * NSEC_PER_SEC;
+	while (now_ns() < end) {
+		if (write(fd, buf, io_size) <= 0)
+			break;
+		ops++;
+	}
+	/* a port write has a single buffer in flight */
+	vbench_report("vcon_write", &st, ops, 1);
+	free(buf);
+	close(fd);
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} benches[] = {
+	{ "cpuid", bench_cpuid },
+	{ "syscall", bench_syscall },
+	{ "msr", bench_msr },
+	{ "pio_hv", bench_pio_hv },
+	{ "mmio_hv", bench_mmio_hv },
+	{ "pio_dm", bench_pio_dm },
+	{ "mmio_dm", bench_mmio_dm },
+	{ "intr", bench_intr },
+	{ "ipi", bench_ipi },
+	{ "timer", bench_timer },
+	{ "vblk", bench_vblk },
+	{ "vnet", bench_vnet },
+	{ "vcon", bench_vcon },
+};
+
+static int bench_selected(const char *name)
+{
+	const char *p = bench_list;
+	size_t len = strlen(name);
+
+	if (!p)
+		return 1;
+
+	while (p) {
+		if (!strncmp(p, name, len) && (p[len] == ',' || !p[len]))
+			return 1;
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+	return 0;
+}
+
+static void display_usage(void)
+{
+	unsigned int i;
+
+	printf("acrnbench - microbenchmarks of the ACRN hot paths\n"
+	       "[Usage] acrnbench [-n iterations] [-c cpu] [-C peer_cpu] [-b bench,...]\n"
+	       "                  [-d pci_dev] [-u uio_dev] [-m msr] [-a addr] [-p period]\n"
+	       "                  [-q depth] [-s size] [-D seconds] [-k blk_dev] [-i ifname]\n"
+	       "                  [-o port] [-I irq_name]\n\n"
+	       "[options]\n"
+	       "\t-h: print this message\n"
+	       "\t-n: iterations of each benchmark, default 10000\n"
+	       "\t-c: CPU to run on, default 0\n"
+	       "\t-C: CPU of the peer thread of the IPI benchmark, default 1\n"
+	       "\t-b: benchmarks to run, default all of:\n\t   ");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		printf(" %s", benches[i].name);
+	printf("\n"
+	       "\t-d: sysfs dir of the bench device, found by its ID by default\n"
+	       "\t-u: uio device bound to the bench device, e.g. /dev/uio0\n"
+	       "\t-m: MSR read by the msr benchmark, default 0x1b\n"
+	       "\t-a: physical address read by mmio_hv, default 0xfec00000\n"
+	       "\t-p: period of the timer benchmark in us, default 1000\n"
+	       "\t-q: queue depth of vblk and vnet, default 32\n"
+	       "\t-s: bytes per I/O, frame or write of vblk, vnet and vcon, default 4096\n"
+	       "\t-D: duration of vblk, vnet and vcon in seconds, default 5\n"
+	       "\t-k: block device of vblk, default /dev/vdb\n"
+	       "\t-i: network interface of vnet, default eth1\n"
+	       "\t-o: virtio-console port of vcon, default /dev/vport0p1\n"
+	       "\t-I: interrupts counted by vblk, vnet and vcon, those whose\n"
+	       "\t    name in /proc/interrupts has this, default virtio\n");
+}
+
+static const char optString[] = "n:c:C:b:d:u:m:a:p:q:s:D:k:i:o:I:h";
+
+static int parse_opt(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, optString)) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			if (!iterations) {
+				printf("'-n' requires at least one iteration\n");
+				return -EINVAL;
+			}
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'C':
+			peer_cpu = atoi(optarg);
+			break;
+		case 'b':
+			bench_list = optarg;
+			break;
+		case 'd':
+			snprintf(pci_dev, sizeof(pci_dev), "%s", optarg);
+			break;
+		case 'u':
+			uio_dev = optarg;
+			break;
+		case 'm':
+			msr = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			hv_mmio = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			timer_period_us = strtoul(optarg, NULL, 0);
+			if (!timer_period_us) {
+				printf("'-p' requires a period\n");
+				return -EINVAL;
+			}
+			break;
+		case 'q':
+			queue_depth = strtoul(optarg, NULL, 0);
+			if (!queue_depth || queue_depth > VBENCH_MAX_QD) {
+				printf("'-q' requires a depth of 1 to %d\n", VBENCH_MAX_QD);
+				return -EINVAL;
+			}
+			break;
+		case 's':
+			io_size = strtoul(optarg, NULL, 0);
+			if (!io_size || io_size % 512) {
+				printf("'-s' requires a multiple of 512\n");
+				return -EINVAL;
+			}
+			break;
+		case 'D':
+			duration_s = strtoul(optarg, NULL, 0);
+			if (!duration_s) {
+				printf("'-D' requires a duration\n");
+				return -EINVAL;
+			}
+			break;
+		case 'k':
+			blk_dev = optarg;
+			break;
+		case 'i':
+			net_if = optarg;
+			break;
+		case 'o':
+			con_port = optarg;
+			break;
+		case 'I':
+			intr_match = optarg;
+			break;
+		case 'h':
+			display_usage();
+			return -EINVAL;
+		default:
+			/* Undefined operation. */
+			display_usage();
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	if (parse_opt(argc, argv))
+		return -1;
+
+	samples = calloc(iterations, sizeof(*samples));
+	if (!samples) {
+		printf("Failed to allocate the samples\n");
+		return -1;
+	}
+
+	/* no migration nor page fault in the middle of a sample */
+	if (pin_cpu(cpu)) {
+		perror("sched_setaffinity");
+		return -1;
+	}
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		perror("mlockall");
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (bench_selected(benches[i].name))
+			benches[i].fn();
+	}
+
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2021 Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * The event handler hands the logs of an event to the collector and goes on
+ * with the next event, a pool of workers copies them. All the logs of an
+ * event make up a group; once the last one is copied, the done callback of
+ * the group accounts for the size of its dir.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "load_conf.h"
+#include "channels.h"
+#include "probeutils.h"
+#include "collector.h"
+#include "log_sys.h"
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+#define NS_PER_S		1000000000ULL
+
+struct collect_group {
+	char *dir;
+	size_t dlen;
+	int pending;	/* jobs left, plus one until submitted */
+	void (*done)(char *dir, size_t dlen);
+};
+
+struct collect_job {
+	struct log_t *log;
+	struct collect_group *grp;
+	TAILQ_ENTRY(collect_job) entries;
+};
+
+static pthread_mutex_t cq_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cq_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cq_idle = PTHREAD_COND_INITIALIZER;
+static TAILQ_HEAD(, collect_job) collect_q =
+		TAILQ_HEAD_INITIALIZER(collect_q);
+static int busy_groups;
+
+static void group_put(struct collect_group *grp)
+{
+	int last;
+
+	pthread_mutex_lock(&cq_mtx);
+	last = !--grp->pending;
+	pthread_mutex_unlock(&cq_mtx);
+	if (!last)
+		return;
+
+	if (grp->done)
+		grp->done(grp->dir, grp->dlen);
+	free(grp->dir);
+	free(grp);
+
+	pthread_mutex_lock(&cq_mtx);
+	if (!--busy_groups)
+		pthread_cond_broadcast(&cq_idle);
+	pthread_mutex_unlock(&cq_mtx);
+}
+
+/**
+ * Start a group of logs to copy into dir.
+ *
+ * @param dir The dir of the event, copied.
+ * @param done Called from a worker once all the logs are copied.
+ *
+ * @return the group, or NULL on out of memory.
+ */
+struct collect_group *collect_group_new(const char *dir, size_t dlen,
+				void (*done)(char *dir, size_t dlen))
+{
+	struct collect_group *grp;
+
+	grp = calloc(1, sizeof(*grp));
+	if (!grp)
+		return NULL;
+
+	grp->dir = strndup(dir, dlen);
+	if (!grp->dir) {
+		free(grp);
+		return NULL;
+	}
+	grp->dlen = dlen;
+	grp->done = done;
+	grp->pending = 1;
+
+	pthread_mutex_lock(&cq_mtx);
+	busy_groups++;
+	pthread_mutex_unlock(&cq_mtx);
+
+	return grp;
+}
+
+/**
+ * Queue a log of the group, log->get() is called from a worker.
+ */
+void collect_log(struct collect_group *grp, struct log_t *log)
+{
+	struct collect_job *job;
+
+	job = malloc(sizeof(*job));
+	if (!job) {
+		/* copy it here rather than lose it */
+		LOGE("out of memory, get (%s) synchronously\n", log->name);
+		log->get(log, (void *)grp->dir);
+		return;
+	}
+	job->log = log;
+	job->grp = grp;
+
+	pthread_mutex_lock(&cq_mtx);
+	grp->pending++;
+	TAILQ_INSERT_TAIL(&collect_q, job, entries);
+	pthread_cond_signal(&cq_cond);
+	pthread_mutex_unlock(&cq_mtx);
+}
+
+/**
+ * No more logs for the group, the caller must not touch it afterwards.
+ */
+void collect_group_submit(struct collect_group *grp)
+{
+	group_put(grp);
+}
+
+/**
+ * Wait for all the groups to complete, e.g. before a reboot.
+ */
+void collect_drain(void)
+{
+	pthread_mutex_lock(&cq_mtx);
+	while (busy_groups)
+		pthread_cond_wait(&cq_idle, &cq_mtx);
+	pthread_mutex_unlock(&cq_mtx);
+}
+
+static void *collect_worker(void *unused __attribute__((unused)))
+{
+	struct collect_job *job;
+
+	/*
+	 * The logs are collected while the VMs recover from the crash, keep
+	 * off their way: idle I/O class, inherited by the commands run for
+	 * the "cmd" logs, and a lower CPU priority.
+	 */
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1)
+		LOGW("failed to set idle I/O priority, error (%s)\n",
+		     strerror(errno));
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10) == -1)
+		LOGW("failed to set nice, error (%s)\n", strerror(errno));
+
+	while (1) {
+		pthread_mutex_lock(&cq_mtx);
+		while (TAILQ_EMPTY(&collect_q))
+			pthread_cond_wait(&cq_cond, &cq_mtx);
+		job = TAILQ_FIRST(&collect_q);
+		TAILQ_REMOVE(&collect_q, job, entries);
+		pthread_mutex_unlock(&cq_mtx);
+
+		job->log->get(job->log, (void *)job->grp->dir);
+		group_put(job->grp);
+		free(job);
+	}
+
+	return NULL;
+}
+
+/* only called from the event handler */
+static struct {
+	unsigned long long hash;
+	unsigned long long uptime;
+} dedup_slots[COLLECT_DEDUP_SLOTS];
+
+static unsigned long long fnv1a(unsigned long long h, const char *s,
+				size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/**
+ * Check whether a crash with the same signature got its logs recently.
+ *
+ * @param name The class of the crash.
+ * @param data The reclassify result of the crash, may be NULL.
+ *
+ * @return 1 if duplicate, 0 otherwise (and it is recorded).
+ */
+int collect_dedup(const char *name, size_t nlen, const char *data,
+		size_t dlen)
+{
+	unsigned long long now = get_uptime();
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	int i, oldest = 0;
+
+	h = fnv1a(h, name, nlen);
+	if (data)
+		h = fnv1a(h, data, dlen);
+
+	for (i = 0; i < COLLECT_DEDUP_SLOTS; i++) {
+		if (dedup_slots[i].uptime &&
+		    dedup_slots[i].hash == h &&
+		    now - dedup_slots[i].uptime <
+		    COLLECT_DEDUP_WINDOW * NS_PER_S)
+			return 1;
+		if (dedup_slots[i].uptime < dedup_slots[oldest].uptime)
+			oldest = i;
+	}
+
+	dedup_slots[oldest].hash = h;
+	dedup_slots[oldest].uptime = now;
+	return 0;
+}
+
+/**
+ * Take a token for a new log dir, COLLECT_RATE_BURST of them are refilled
+ * every COLLECT_RATE_PERIOD.
+ *
+ * @return 1 if over the limit, 0 otherwise.
+ */
+int collect_rate_limit(void)
+{
+	static unsigned long long last;
+	static unsigned long long tokens = COLLECT_RATE_BURST * NS_PER_S;
+	unsigned long long now = get_uptime();
+
+	/* tokens in ns units, one token is NS_PER_S */
+	tokens += (now - last) * COLLECT_RATE_BURST / COLLECT_RATE_PERIOD;
+	if (tokens > COLLECT_RATE_BURST * NS_PER_S)
+		tokens = COLLECT_RATE_BURST * NS_PER_S;
+	last = now;
+
+	if (tokens < NS_PER_S)
+		return 1;
+	tokens -= NS_PER_S;
+	return 0;
+}
+
+/**
+ * Start the workers.
+ */
+int init_collector(void)
+{
+	pthread_t pid;
+	int i;
+	int ret;
+
+	for (i = 0; i < COLLECT_WORKERS; i++) {
+		ret = create_detached_thread(&pid, &collect_worker, NULL);
+		if (ret) {
+			LOGE("create collect worker failed (%s)\n",
+			     strerror(ret));
+			return -1;
+		}
+	}
+
+	return 0;
+}
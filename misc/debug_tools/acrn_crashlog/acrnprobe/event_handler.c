@@ -18,6 +18,7 @@
 #include "event_handler.h"
 #include "startupreason.h"
 #include "android_events.h"
+#include "collector.h"
 
 /* Watchdog timeout in second*/
 #define WDT_TIMEOUT 300
@@ -170,9 +171,12 @@ static void *event_handle(void *unused __attribute__((unused)))
 
 			read_startupreason(reason, sizeof(reason));
 			if (!strcmp(reason, "WARM") ||
-			    !strcmp(reason, "WATCHDOG"))
+			    !strcmp(reason, "WATCHDOG")) {
+				/* let the logs being copied land first */
+				collect_drain();
 				if (exec_out2file(NULL, "reboot") == -1)
 					break;
+			}
 		}
 
 		if (e->event_type == VM) {
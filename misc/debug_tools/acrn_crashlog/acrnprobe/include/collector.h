@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2021 Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef __COLLECTOR_H__
+#define __COLLECTOR_H__
+
+#include "load_conf.h"
+
+/* threads copying the logs, at idle I/O priority */
+#define COLLECT_WORKERS		4
+
+/* the same crash again within this window gets no new logs */
+#define COLLECT_DEDUP_WINDOW	60 /* s */
+#define COLLECT_DEDUP_SLOTS	16
+
+/* at most COLLECT_RATE_BURST log dirs per COLLECT_RATE_PERIOD */
+#define COLLECT_RATE_BURST	10
+#define COLLECT_RATE_PERIOD	60 /* s */
+
+struct collect_group;
+
+struct collect_group *collect_group_new(const char *dir, size_t dlen,
+				void (*done)(char *dir, size_t dlen));
+void collect_log(struct collect_group *grp, struct log_t *log);
+void collect_group_submit(struct collect_group *grp);
+void collect_drain(void);
+int collect_dedup(const char *name, size_t nlen, const char *data,
+		size_t dlen);
+int collect_rate_limit(void);
+int init_collector(void);
+
+#endif
@@ -16,6 +16,7 @@
 #include "fsutils.h"
 #include "crash_reclassify.h"
 #include "sender.h"
+#include "collector.h"
 #include "event_queue.h"
 #include "event_handler.h"
 #include "channels.h"
@@ -119,6 +120,10 @@ int main(int argc, char *argv[])
 	if (ret)
 		return -1;
 
+	ret = init_collector();
+	if (ret)
+		return -1;
+
 	init_event_queue();
 	ret = init_event_handler();
 	if (ret)
@@ -24,13 +24,17 @@
 #include "startupreason.h"
 #include "log_sys.h"
 #include "loop.h"
+#include "collector.h"
+
+/* outdir_blocks_size is updated by the collector workers */
+static pthread_mutex_t outdir_size_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 static int crashlog_check_space(void)
 {
 	struct sender_t *crashlog = get_sender_by_name("crashlog");
 	int quota;
 	int cfg_size;
-
+	size_t size;
 
 	if (!crashlog)
 		return -1;
@@ -46,9 +50,12 @@ static int crashlog_check_space(void)
 		     &cfg_size) == -1)
 		return -1;
 
-	if (crashlog->outdir_blocks_size/MB >= (size_t)cfg_size) {
+	pthread_mutex_lock(&outdir_size_mtx);
+	size = crashlog->outdir_blocks_size;
+	pthread_mutex_unlock(&outdir_size_mtx);
+	if (size/MB >= (size_t)cfg_size) {
 		LOGD("the total blocks size (%zu) meets the quota (%zu)\n",
-		     crashlog->outdir_blocks_size/MB, (size_t)cfg_size);
+		     size/MB, (size_t)cfg_size);
 		return -1;
 	}
 	return 0;
@@ -68,11 +75,41 @@ static int log_grows(char *dir, size_t len)
 	}
 
 	add += 4 * KB;
+	pthread_mutex_lock(&outdir_size_mtx);
 	crashlog->outdir_blocks_size += add;
 	LOGD("log size + %zu = %zu\n", add, crashlog->outdir_blocks_size);
+	pthread_mutex_unlock(&outdir_size_mtx);
 	return 0;
 }
 
+static void crashlog_logs_done(char *dir, size_t len)
+{
+	log_grows(dir, len);
+}
+
+/*
+ * Hand the logs of the event over to the collector workers, the size of
+ * e->dir is accounted once they are all copied. Without memory for it, copy
+ * them here.
+ */
+static struct collect_group *crashlog_collect_logs(struct event_t *e,
+					struct log_t **logs)
+{
+	struct collect_group *grp;
+	int id;
+	struct log_t *log;
+
+	grp = collect_group_new(e->dir, e->dlen, crashlog_logs_done);
+	for (id = 0; id < LOG_MAX && (log = logs[id]); id++) {
+		if (grp)
+			collect_log(grp, log);
+		else
+			log->get(log, (void *)e->dir);
+	}
+
+	return grp;
+}
+
 static int cal_log_filepath(char **out, const struct log_t *log,
 				const char *srcname, const char *desdir)
 {
@@ -284,8 +321,7 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 	size_t d1len;
 	size_t d2len;
 	struct crash_t *crash = (struct crash_t *)e->private;
-	int id;
-	struct log_t *log;
+	struct collect_group *grp;
 
 	hist_raise_event(etype_str[e->event_type], crash->name, e->dir, "",
 			 eid);
@@ -303,11 +339,7 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 			   SHORT_KEY_LENGTH, crash->name, crash->name_len,
 			   data0, d0len, data1, d1len, data2, d2len);
 
-	for_each_log_collect(id, log, crash) {
-		if (!log)
-			continue;
-		log->get(log, (void *)e->dir);
-	}
+	grp = crashlog_collect_logs(e, crash->log);
 	if (!strcmp(e->channel, "inotify")) {
 		/* get the trigger file */
 		char *src;
@@ -315,14 +347,14 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 
 		if (asprintf(&des, "%s/%s", e->dir, e->path) == -1) {
 			LOGE("out of memory\n");
-			return;
+			goto submit;
 		}
 
 		if (asprintf(&src, "%s/%s", crash->trigger->path,
 			     e->path) == -1) {
 			LOGE("out of memory\n");
 			free(des);
-			return;
+			goto submit;
 		}
 
 		if (do_copy_tail(src, des, 0) < 0)
@@ -331,21 +363,28 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 		free(src);
 		free(des);
 	}
+submit:
+	if (grp) {
+		collect_group_submit(grp);
+		/* accounted by the collector */
+		free(e->dir);
+		e->dir = NULL;
+	}
 }
 
 static void crashlog_send_info(struct event_t *e, char *eid)
 {
-	int id;
 	struct info_t *info = (struct info_t *)e->private;
-	struct log_t *log;
+	struct collect_group *grp;
 
 	hist_raise_event(etype_str[e->event_type], info->name, e->dir, "", eid);
 	if (!e->dir)
 		return;
-	for_each_log_collect(id, log, info) {
-		if (!log)
-			continue;
-		log->get(log, (void *)e->dir);
+	grp = crashlog_collect_logs(e, info->log);
+	if (grp) {
+		collect_group_submit(grp);
+		free(e->dir);
+		e->dir = NULL;
 	}
 }
 
@@ -567,6 +606,26 @@ static int crashlog_new_event(struct event_t *e, char *result, size_t rsize,
 		return 0;
 	}
 
+	/* a crash storm must not flood the disk nor the collector */
+	if (e->event_type == CRASH) {
+		if (collect_dedup(e_subtype, e_subtype_len, result, rsize)) {
+			LOGW("(%s) happened again, skipping its logs\n",
+			     e_subtype);
+			hist_raise_event(estr, e_subtype, "DUPLICATE", "",
+					 key);
+			free(key);
+			goto fail;
+		}
+		if (collect_rate_limit()) {
+			LOGW("too many crashes, skipping the logs of (%s)\n",
+			     e_subtype);
+			hist_raise_event(estr, e_subtype, "RATE_LIMITED", "",
+					 key);
+			free(key);
+			goto fail;
+		}
+	}
+
 	if (crashlog_check_space() == -1) {
 		hist_raise_event(estr, e_subtype, "SPACE_FULL", "", key);
 		free(key);
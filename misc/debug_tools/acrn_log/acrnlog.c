@@ -16,6 +16,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <pthread.h>
+#include <elf.h>
 
 #define LOG_ELEMENT_SIZE        80
 #define LOG_MSG_SIZE		480
@@ -23,6 +24,33 @@
 #define LOG_INCOMPLETE_WARNING	"WARNING: logs missing here! "\
 				"Try reducing polling interval"
 
+/*
+ * Unformatted message, logged by a hypervisor built with bit 3 of
+ * LOG_DESTINATION set; keep in sync with struct log_bin_record of the
+ * hypervisor. The formatted messages start with '[' instead of the magic.
+ */
+#define LOG_BIN_MAGIC		0x01
+#define LOG_BIN_HDR_SIZE	48
+#define LOG_BIN_MAX_SIZE	(4 * LOG_ELEMENT_SIZE)
+
+struct hvlog_bin_record {
+	__u8 magic;
+	__u8 severity;
+	__u16 pcpu_id;
+	__u16 len;		/* header included */
+	__u16 reserved;
+	__u32 seq;
+	__u32 reserved1;
+	__u64 usec;
+	__u64 fmt;		/* link address of the format string */
+	char thread[16];
+	__u8 args[LOG_BIN_MAX_SIZE - LOG_BIN_HDR_SIZE];
+};
+
+/* the hypervisor ELF image given by -e, to look the format strings up */
+static char *hv_elf;
+static size_t hv_elf_size;
+
 /* Count of /dev/acrn_hvlog_cur_xxx */
 static int cur_cnt,last_cnt;
 static unsigned long interval = DEFAULT_POLL_INTERVAL;
@@ -36,12 +64,31 @@ static unsigned short hvlog_log_num = LOG_FILE_NUM;
 struct hvlog_file {
 	const char *path;
 	int fd;
+	FILE *pipe;		/* to the compressor, instead of fd */
 
 	size_t left_space;
 	unsigned short index;
 	unsigned short num;
 };
 
+/* -z: stream the log files through a compressor */
+struct log_compressor {
+	const char *name;
+	const char *suffix;
+	const char *compress;	/* stdin to stdout */
+	const char *decompress;	/* the file given to stdout */
+};
+
+static const struct log_compressor compressors[] = {
+	{ "zstd", ".zst", "zstd -q -c", "zstd -q -d -c" },
+	{ "lz4", ".lz4", "lz4 -q -c", "lz4 -q -d -c" },
+};
+
+static const struct log_compressor *compressor;
+
+/* -p: one writer thread and set of files per CPU, merged by -M later */
+static int per_cpu_files;
+
 static struct hvlog_file cur_log = {
 	.path = "/tmp/acrnlog/acrnlog_cur",
 	.fd = -1,
@@ -83,6 +130,198 @@ struct hvlog_dev {
 
 size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len);
 
+static int load_hv_elf(const char *path)
+{
+	struct stat st;
+	Elf64_Ehdr *ehdr;
+	ssize_t ret;
+	size_t done = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	hv_elf = malloc(st.st_size);
+	if (!hv_elf) {
+		close(fd);
+		return -1;
+	}
+	while (done < (size_t)st.st_size) {
+		ret = read(fd, hv_elf + done, st.st_size - done);
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+	close(fd);
+
+	ehdr = (Elf64_Ehdr *)hv_elf;
+	if (done < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(Elf64_Phdr) > done) {
+		printf("%s is not the 64-bit ELF image of the hypervisor\n", path);
+		free(hv_elf);
+		hv_elf = NULL;
+		return -1;
+	}
+	hv_elf_size = done;
+
+	return 0;
+}
+
+/* the NUL-terminated string at link address addr of the hypervisor, or NULL */
+static const char *hv_elf_string(__u64 addr)
+{
+	Elf64_Ehdr *ehdr = (Elf64_Ehdr *)hv_elf;
+	Elf64_Phdr *phdr;
+	size_t off;
+	int i;
+
+	if (!hv_elf)
+		return NULL;
+
+	phdr = (Elf64_Phdr *)(hv_elf + ehdr->e_phoff);
+	for (i = 0; i < ehdr->e_phnum; i++, phdr++) {
+		if (phdr->p_type != PT_LOAD || addr < phdr->p_vaddr ||
+		    addr >= phdr->p_vaddr + phdr->p_filesz)
+			continue;
+
+		off = phdr->p_offset + (addr - phdr->p_vaddr);
+		if (off < hv_elf_size &&
+		    memchr(hv_elf + off, 0, hv_elf_size - off))
+			return hv_elf + off;
+	}
+
+	return NULL;
+}
+
+/* format the arguments of rec the way the hypervisor's vsnprintf() does */
+static int hvlog_format_args(char *buf, size_t size,
+			     const struct hvlog_bin_record *rec, const char *fmt)
+{
+	const __u8 *arg = rec->args;
+	const __u8 *end = (const __u8 *)rec + rec->len;
+	char spec[32];
+	const char *p = fmt, *start;
+	size_t n = 0, speclen;
+	int is_long, ret;
+	__u64 v;
+
+	while (*p && n < size - 1) {
+		if (*p != '%') {
+			buf[n++] = *p++;
+			continue;
+		}
+
+		start = p++;
+		while (*p && strchr("#-+ .0123456789", *p))
+			p++;
+		is_long = 0;
+		while (*p == 'h' || *p == 'l') {
+			if (*p == 'l')
+				is_long = 1;
+			p++;
+		}
+		if (!*p)
+			break;
+
+		speclen = p - start + 1;
+		if (speclen >= sizeof(spec))
+			speclen = sizeof(spec) - 1;
+		memcpy(spec, start, speclen);
+		spec[speclen] = 0;
+		p++;
+
+		ret = 0;
+		if (spec[speclen - 1] == '%') {
+			ret = snprintf(buf + n, size - n, "%%");
+		} else if (strchr("diuxXcs", spec[speclen - 1])) {
+			if (arg >= end) {
+				ret = snprintf(buf + n, size - n, "<?>");
+			} else if (spec[speclen - 1] == 's') {
+				ret = snprintf(buf + n, size - n, spec, (const char *)arg);
+				arg += (strnlen((const char *)arg, end - arg) + 8) & ~7UL;
+			} else {
+				memcpy(&v, arg, sizeof(v));
+				arg += sizeof(v);
+				if (is_long) {
+					/* "%lx" and "%llx" alike */
+					ret = snprintf(buf + n, size - n, spec, (unsigned long long)v);
+				} else {
+					ret = snprintf(buf + n, size - n, spec, (unsigned int)v);
+				}
+			}
+		} else {
+			/* printed as is, like the hypervisor does */
+			ret = snprintf(buf + n, size - n, "%s", spec);
+		}
+
+		if (ret > 0)
+			n += ((size_t)ret < size - n) ? (size_t)ret : size - n - 1;
+	}
+	buf[n] = 0;
+
+	return n;
+}
+
+/*
+ * Read the rest of the binary record whose first sbuf element is first, and
+ * format it into dev->msg as the hypervisor would have.
+ */
+static struct hvlog_msg *hvlog_read_bin(struct hvlog_dev *dev, const char *first)
+{
+	struct hvlog_bin_record rec;
+	struct hvlog_msg *msg = dev->msg;
+	const char *fmt;
+	int i, nr, ret;
+
+	memcpy(&rec, first, LOG_ELEMENT_SIZE);
+	if (rec.len < LOG_BIN_HDR_SIZE || rec.len > LOG_BIN_MAX_SIZE)
+		return NULL;
+
+	nr = (rec.len + LOG_ELEMENT_SIZE - 1) / LOG_ELEMENT_SIZE;
+	for (i = 1; i < nr; i++) {
+		/* the hypervisor publishes a record at once */
+		ret = read(dev->fd, (char *)&rec + i * LOG_ELEMENT_SIZE,
+			   LOG_ELEMENT_SIZE);
+		if (ret != LOG_ELEMENT_SIZE)
+			return NULL;
+	}
+	rec.thread[sizeof(rec.thread) - 1] = 0;
+
+	memset(msg, 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
+	msg->usec = rec.usec;
+	msg->cpu = rec.pcpu_id;
+	msg->sev = rec.severity;
+	msg->seq = rec.seq;
+
+	ret = snprintf(msg->raw, LOG_MSG_SIZE, "[%lluus][cpu=%hu][%s][sev=%u][seq=%u]:",
+		       (unsigned long long)rec.usec, rec.pcpu_id, rec.thread,
+		       rec.severity, rec.seq);
+	if (ret < 0 || ret >= LOG_MSG_SIZE - 2)
+		return NULL;
+	msg->len = ret;
+
+	fmt = hv_elf_string(rec.fmt);
+	if (fmt)
+		msg->len += hvlog_format_args(&msg->raw[msg->len],
+					      LOG_MSG_SIZE - 2 - msg->len, &rec, fmt);
+	else
+		msg->len += snprintf(&msg->raw[msg->len], LOG_MSG_SIZE - 2 - msg->len,
+				     "<format at 0x%llx, see -e>",
+				     (unsigned long long)rec.fmt);
+
+	msg->raw[msg->len] = '\n';
+	msg->raw[msg->len + 1] = 0;
+	msg->len++;
+
+	return msg;
+}
+
 static int get_dev_cnt(char *prefix)
 {
 	struct dirent *pdir;
@@ -129,7 +368,10 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 	msg_num = 0;
 
 	do {
-		if (dev->latched) {
+		if (dev->latched && dev->entry_latch[0] == LOG_BIN_MAGIC) {
+			dev->latched = 0;
+			return hvlog_read_bin(dev, dev->entry_latch);
+		} else if (dev->latched) {
 			/* handle the latched msg first */
 			dev->latched = 0;
 			memcpy(&msg[0]->raw[msg[0]->len], dev->entry_latch,
@@ -142,6 +384,18 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 				 LOG_ELEMENT_SIZE);
 			if (!ret)
 				break;
+			if (msg[0]->raw[msg[0]->len] == LOG_BIN_MAGIC) {
+				if (msg_num == 0)
+					return hvlog_read_bin(dev,
+						&msg[0]->raw[msg[0]->len]);
+				/* ends the text msg, latch it for next time */
+				dev->latched = 1;
+				memcpy(dev->entry_latch,
+				       &msg[0]->raw[msg[0]->len],
+				       LOG_ELEMENT_SIZE);
+				msg[0]->raw[msg[0]->len] = 0;
+				break;
+			}
 			/* do we read a new meaasge?
 			 * msg[0]->raw[msg[0]->len format: [%lluus][cpu=%d][sev=%d][seq=%llu]: */
 			p = strstr(&msg[0]->raw[msg[0]->len], "][seq=");
@@ -300,31 +554,55 @@ static struct hvlog_msg *get_min_seq_msg(struct hvlog_data *data, int num_dev)
 
 static int new_log_file(struct hvlog_file *log)
 {
-	char file_name[32] = { };
+	const char *suffix = compressor ? compressor->suffix : "";
+	char file_name[64] = { };
+	char cmd[128];
 
-	if (log->fd >= 0) {
+	if (log->fd >= 0 || log->pipe) {
 		if (!hvlog_log_size)
 			return 0;
-		close(log->fd);
-		log->fd = -1;
+		if (log->pipe) {
+			/* waits for the compressor to finish the file */
+			pclose(log->pipe);
+			log->pipe = NULL;
+		} else {
+			close(log->fd);
+			log->fd = -1;
+		}
 	}
 
-	if (snprintf(file_name, sizeof(file_name), "%s.%hu", log->path,
-		 log->index + 1) >= sizeof(file_name)) {
+	if (snprintf(file_name, sizeof(file_name), "%s.%hu%s", log->path,
+		 log->index + 1, suffix) >= sizeof(file_name)) {
 		printf("WARN: log path is truncated\n");
 	} else
 		remove(file_name);
 
-	log->fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
-	if (log->fd < 0) {
-		perror(file_name);
-		return -1;
+	if (compressor) {
+		if (snprintf(cmd, sizeof(cmd), "%s > '%s'", compressor->compress,
+			     file_name) >= sizeof(cmd)) {
+			printf("ERROR: compressor command is truncated\n");
+			return -1;
+		}
+		log->pipe = popen(cmd, "w");
+		if (!log->pipe) {
+			perror(cmd);
+			return -1;
+		}
+		/* nothing left behind in acrnlog if it gets killed */
+		setvbuf(log->pipe, NULL, _IOLBF, 0);
+	} else {
+		log->fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (log->fd < 0) {
+			perror(file_name);
+			return -1;
+		}
 	}
 
+	/* the size limit applies to the uncompressed log */
 	log->left_space = hvlog_log_size;
 	log->index++;
-	if (snprintf(file_name, sizeof(file_name), "%s.%hu", log->path,
-			log->index - hvlog_log_num) >= sizeof(file_name)) {
+	if (snprintf(file_name, sizeof(file_name), "%s.%hu%s", log->path,
+			log->index - hvlog_log_num, suffix) >= sizeof(file_name)) {
 		printf("WARN: log path is truncated\n");
 	} else
 		remove(file_name);
@@ -340,7 +618,12 @@ size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len)
 		if (new_log_file(log))
 			return 0;
 
-	ret = write(log->fd, buf, len);
+	if (log->pipe)
+		ret = fwrite(buf, 1, len, log->pipe);
+	else
+		ret = write(log->fd, buf, len);
+	if (ret < 0)
+		return 0;
 	log->left_space -= ret;
 
 	return ret;
@@ -379,6 +662,174 @@ static void *cur_read_func(void *arg)
 	return NULL;
 }
 
+/* -p: each CPU has its writer thread and files, no ordering across them */
+struct cpu_writer {
+	struct hvlog_dev *dev;
+	struct hvlog_file log;
+	pthread_t thread;
+};
+
+static struct cpu_writer *cpu_writers;
+
+static void *cpu_read_func(void *arg)
+{
+	struct cpu_writer *w = arg;
+	struct hvlog_msg *msg;
+
+	while (1) {
+		msg = hvlog_read_dev(w->dev);
+		if (!msg) {
+			usleep(interval);
+			continue;
+		}
+
+		/* the seq is global, a gap here is another CPU's message */
+		write_log_file(&w->log, msg->raw, msg->len);
+	}
+
+	return NULL;
+}
+
+static int start_cpu_writers(struct hvlog_data *data, int num_dev)
+{
+	struct cpu_writer *w;
+	char *path;
+	int i, started = 0;
+
+	cpu_writers = calloc(num_dev, sizeof(*cpu_writers));
+	if (!cpu_writers)
+		return 0;
+
+	for (i = 0; i < num_dev; i++) {
+		if (!data[i].dev)
+			continue;
+
+		w = &cpu_writers[i];
+		if (asprintf(&path, "%s_cpu%d", cur_log.path, i) < 0)
+			continue;
+		w->dev = data[i].dev;
+		w->log.path = path;
+		w->log.fd = -1;
+		w->log.index = ~0;
+		w->log.num = hvlog_log_num;
+
+		if (pthread_create(&w->thread, NULL, cpu_read_func, w)) {
+			printf("%s %d\n", __FUNCTION__, __LINE__);
+			free(path);
+			w->dev = NULL;
+			continue;
+		}
+		started++;
+	}
+
+	return started;
+}
+
+/* -M: one input of the merge, a file of messages in seq order */
+struct merge_src {
+	FILE *f;
+	int is_pipe;
+	char *line;
+	size_t cap;
+	__u64 seq;
+	int valid;
+};
+
+static void merge_src_next(struct merge_src *src)
+{
+	char *p;
+
+	src->valid = getline(&src->line, &src->cap, src->f) > 0;
+	if (!src->valid)
+		return;
+
+	/* the lines without a seq, like the warnings, keep their place */
+	p = strstr(src->line, "][seq=");
+	if (p)
+		src->seq = strtoull(p + strlen("][seq="), NULL, 10);
+}
+
+static int merge_src_open(struct merge_src *src, const char *path)
+{
+	const struct log_compressor *c = NULL;
+	size_t i, len = strlen(path), slen;
+	char cmd[PATH_MAX + 32];
+
+	for (i = 0; i < sizeof(compressors) / sizeof(compressors[0]); i++) {
+		slen = strlen(compressors[i].suffix);
+		if (len > slen && !strcmp(path + len - slen, compressors[i].suffix))
+			c = &compressors[i];
+	}
+
+	if (c) {
+		if (snprintf(cmd, sizeof(cmd), "%s '%s'", c->decompress, path)
+		    >= sizeof(cmd))
+			return -1;
+		src->f = popen(cmd, "r");
+		src->is_pipe = 1;
+	} else {
+		src->f = fopen(path, "r");
+	}
+	if (!src->f) {
+		perror(path);
+		return -1;
+	}
+
+	merge_src_next(src);
+	return 0;
+}
+
+/*
+ * Merge the log files written with -p, in any order and compressed or not,
+ * into a single log in seq order on stdout.
+ */
+static int merge_log_files(int num, char *const paths[])
+{
+	struct merge_src *src;
+	__u64 last_seq = 0;
+	int i, min;
+
+	src = calloc(num, sizeof(*src));
+	if (!src)
+		return -1;
+
+	for (i = 0; i < num; i++)
+		merge_src_open(&src[i], paths[i]);
+
+	while (1) {
+		min = -1;
+		for (i = 0; i < num; i++) {
+			if (src[i].valid && (min < 0 || src[i].seq < src[min].seq))
+				min = i;
+		}
+		if (min < 0)
+			break;
+
+		if (last_seq && last_seq + 1 < src[min].seq)
+			printf("\n\n\t%s[seq %llu to %llu]\n\n\n", LOG_INCOMPLETE_WARNING,
+			       (unsigned long long)last_seq + 1,
+			       (unsigned long long)src[min].seq - 1);
+		if (src[min].seq > last_seq)
+			last_seq = src[min].seq;
+
+		fputs(src[min].line, stdout);
+		merge_src_next(&src[min]);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (!src[i].f)
+			continue;
+		if (src[i].is_pipe)
+			pclose(src[i].f);
+		else
+			fclose(src[i].f);
+		free(src[i].line);
+	}
+	free(src);
+
+	return 0;
+}
+
 /* If dir *path does't exist, create a new one.
  * Otherwise, remove all the old acrnlog files in the dir.
  */
@@ -420,14 +871,26 @@ static int mk_dir(const char *path)
 }
 
 /* for user optinal args */
-static const char optString[] = "s:n:t:h";
+static const char optString[] = "s:n:t:e:z:pMh";
+
+/* -M: merge the files given after the options instead of collecting logs */
+static int merge_mode;
 
 static void display_usage(void)
 {
 	printf("acrnlog - tool to collect ACRN hypervisor log\n"
-	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-h]\n\n"
+	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-e hv_elf]\n"
+	       "               [-p] [-z zstd|lz4] [-h]\n"
+	       "        acrnlog -M file...\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
+	       "\t-e: the ELF image of the running hypervisor (acrn.out),\n"
+	       "\t    to format the messages it logs unformatted\n"
+	       "\t-p: write the log of each CPU to its own files, from its\n"
+	       "\t    own thread, merge them with -M\n"
+	       "\t-z: compress the log files with zstd or lz4 while writing\n"
+	       "\t-M: merge the given log files, written with -p and maybe\n"
+	       "\t    compressed, into one log on stdout\n"
 	       "\t-t: polling interval to collect logs, in ms\n"
 	       "\t-s: size limitation for each log file, in MB.\n"
 	       "\t    0 means no limitation.\n"
@@ -438,6 +901,7 @@ static void display_usage(void)
 static int parse_opt(int argc, char *argv[])
 {
 	int opt, ret;
+	char cmd[64];
 
 	while ((opt = getopt(argc, argv, optString)) != -1) {
 		switch (opt) {
@@ -470,6 +934,33 @@ static int parse_opt(int argc, char *argv[])
 			interval = ret * 1000;
 			printf("Polling interval is %u ms\n", ret);
 			break;
+		case 'e':
+			if (load_hv_elf(optarg))
+				return -EINVAL;
+			break;
+		case 'z':
+			for (ret = 0; ret < sizeof(compressors) / sizeof(compressors[0]); ret++) {
+				if (!strcmp(optarg, compressors[ret].name))
+					compressor = &compressors[ret];
+			}
+			if (!compressor) {
+				printf("'-z' requires zstd or lz4\n");
+				return -EINVAL;
+			}
+			snprintf(cmd, sizeof(cmd), "command -v %s > /dev/null 2>&1",
+				 compressor->name);
+			if (system(cmd)) {
+				printf("'-z %s': %s is not installed\n", optarg,
+				       compressor->name);
+				return -EINVAL;
+			}
+			break;
+		case 'p':
+			per_cpu_files = 1;
+			break;
+		case 'M':
+			merge_mode = 1;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -494,6 +985,9 @@ int main(int argc, char *argv[])
 	if (parse_opt(argc, argv))
 		return -1;
 
+	if (merge_mode)
+		return merge_log_files(argc - optind, &argv[optind]);
+
 	ret = mk_dir("/tmp/acrnlog");
 	if (ret) {
 		printf("Cannot create /tmp/acrnlog. Error: %s\n",
@@ -557,8 +1051,16 @@ int main(int argc, char *argv[])
 
 	printf("open cur:%d last:%d\n", num_cur, num_last);
 
-	/* create thread to read cur log */
-	if (num_cur) {
+	/* create threads to read cur log */
+	if (num_cur && per_cpu_files) {
+		if (!start_cpu_writers(cur, cur_cnt)) {
+			free(cpu_writers);
+			cpu_writers = NULL;
+			per_cpu_files = 0;
+		}
+	}
+
+	if (num_cur && !per_cpu_files) {
 		ret = pthread_create(&cur_thread, NULL, cur_read_func, cur);
 		if (ret) {
 			printf("%s %d\n", __FUNCTION__, __LINE__);
@@ -579,6 +1081,11 @@ int main(int argc, char *argv[])
 	if (cur_thread)
 		pthread_join(cur_thread, NULL);
 
+	for (i = 0; cpu_writers && i < cur_cnt; i++) {
+		if (cpu_writers[i].dev)
+			pthread_join(cpu_writers[i].thread, NULL);
+	}
+
 	for (i = 0; i < cur_cnt; i++) {
 		hvlog_close_dev(cur[i].dev);
 	}
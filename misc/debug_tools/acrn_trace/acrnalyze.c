@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrnalyze - streaming analyzer of the binary trace files of acrntrace
+ *
+ * It produces the same vm_exit and irq reports as scripts/acrnalyze.py, plus
+ * the latency percentiles of each exit reason. The trace files are read in
+ * fixed size chunks, so the memory used doesn't depend on the trace size,
+ * and the files of each pCPU are processed by their own thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "acrntrace.h"
+
+#define VM_EXIT			0x10
+#define VM_ENTER		0x11
+#define VMEXIT_ENTRY		0x10000
+#define VMEXIT_UNHANDLED	0x20000
+
+/* exit reasons traced as VMEXIT_ENTRY + reason, the last slot for UNHANDLED */
+#define NR_REASONS		0x41
+#define REASON_UNHANDLED	(NR_REASONS - 1)
+#define NO_REASON		(-1)
+
+/*
+ * Latency histogram with 16 linear sub-buckets per power of 2, the error of
+ * a percentile is below 1/16 of its value, whatever the range of latencies.
+ */
+#define HIST_SUB_SHIFT		4
+#define HIST_SUB		(1 << HIST_SUB_SHIFT)
+#define HIST_BUCKETS		((64 - HIST_SUB_SHIFT + 1) * HIST_SUB)
+
+#define NR_VECTORS		256
+#define READ_CHUNK		65536	/* trace entries per read */
+#define MAX_INPUTS		64
+
+#define ANALYZE_VMEXIT		(1U << 0)
+#define ANALYZE_IRQ		(1U << 1)
+
+struct exit_stat {
+	uint64_t nr;
+	uint64_t cycles;
+	uint64_t hist[HIST_BUCKETS];
+};
+
+struct analysis {
+	const char *ifile;
+	pthread_t thrd;
+	int err;
+	/* run time of the vm_exit report, from the first vmexit to the last vmenter */
+	uint64_t tsc_begin;
+	uint64_t tsc_end;
+	/* run time of the irq report, from the first to the last event */
+	uint64_t tsc_first;
+	uint64_t tsc_last;
+	uint64_t nr_exits;
+	struct exit_stat exits[NR_REASONS];
+	uint64_t irqs[NR_VECTORS];
+	uint64_t irqs_other;
+};
+
+static const struct {
+	const char *name;
+	int reason;
+} reason_names[] = {
+	{ "VMEXIT_EXCEPTION_OR_NMI",		0x00 },
+	{ "VMEXIT_EXTERNAL_INTERRUPT",		0x01 },
+	{ "VMEXIT_INTERRUPT_WINDOW",		0x02 },
+	{ "VMEXIT_CPUID",			0x04 },
+	{ "VMEXIT_RDTSC",			0x10 },
+	{ "VMEXIT_VMCALL",			0x12 },
+	{ "VMEXIT_CR_ACCESS",			0x1C },
+	{ "VMEXIT_IO_INSTRUCTION",		0x1E },
+	{ "VMEXIT_RDMSR",			0x1F },
+	{ "VMEXIT_WRMSR",			0x20 },
+	{ "VMEXIT_EPT_VIOLATION",		0x30 },
+	{ "VMEXIT_EPT_MISCONFIGURATION",	0x31 },
+	{ "VMEXIT_RDTSCP",			0x33 },
+	{ "VMEXIT_APICV_WRITE",			0x38 },
+	{ "VMEXIT_APICV_ACCESS",		0x39 },
+	{ "VMEXIT_APICV_VIRT_EOI",		0x3A },
+	{ "VMEXIT_UNHANDLED",			REASON_UNHANDLED },
+};
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+static void display_usage(void)
+{
+	printf("acrnalyze - streaming analyzer of acrntrace data\n"
+	       "[Usage] acrnalyze -i ifile [-i ifile ...] -o ofile [-f freq] [--vm_exit] [--irq]\n\n"
+	       "[Options]\n"
+	       "\t-h: print this message\n"
+	       "\t-i, --ifile=[string]: input file, repeat for the files of each cpu\n"
+	       "\t-o, --ofile=[string]: output file, the report is appended to ofile.csv\n"
+	       "\t-f, --frequency=[double]: TSC frequency in MHz\n"
+	       "\t--vm_exit: to generate vm_exit report\n"
+	       "\t--irq: to generate irq related report\n");
+}
+
+static inline int hist_bucket(uint64_t val)
+{
+	int msb;
+
+	if (val < HIST_SUB)
+		return (int)val;
+
+	msb = 63 - __builtin_clzl(val);
+	return ((msb - HIST_SUB_SHIFT + 1) << HIST_SUB_SHIFT) +
+		(int)((val >> (msb - HIST_SUB_SHIFT)) & (HIST_SUB - 1));
+}
+
+/* the upper bound of the values a bucket counts */
+static inline uint64_t hist_value(int bucket)
+{
+	int exp = bucket >> HIST_SUB_SHIFT;
+	uint64_t sub = bucket & (HIST_SUB - 1);
+
+	if (exp == 0)
+		return sub;
+
+	return ((HIST_SUB + sub + 1) << (exp - 1)) - 1;
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t nr, double pct)
+{
+	uint64_t rank = (uint64_t)((double)nr * pct / 100.0);
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > rank)
+			return hist_value(i);
+	}
+
+	return 0;
+}
+
+static int event_to_reason(uint64_t event)
+{
+	if (event == VMEXIT_UNHANDLED)
+		return REASON_UNHANDLED;
+	if ((event >= VMEXIT_ENTRY) && (event < VMEXIT_ENTRY + REASON_UNHANDLED))
+		return (int)(event - VMEXIT_ENTRY);
+	return NO_REASON;
+}
+
+static inline void account_event(struct analysis *a, const trace_ev_t *ev,
+		uint64_t *tsc_exit, int *last_reason)
+{
+	uint64_t event = ev->id & TRACE_ID_MASK;
+	struct exit_stat *stat;
+	uint64_t delta;
+	int reason;
+
+	if (a->tsc_first == 0)
+		a->tsc_first = ev->tsc;
+	a->tsc_last = ev->tsc;
+
+	reason = event_to_reason(event);
+	if (reason == 0x01) {
+		if (ev->e < NR_VECTORS)
+			a->irqs[ev->e]++;
+		else
+			a->irqs_other++;
+	}
+
+	/* the entries on top of the first vmexit are ignored by the vm_exit report */
+	if (a->tsc_begin == 0) {
+		if (event != VM_EXIT)
+			return;
+		a->tsc_begin = ev->tsc;
+	}
+
+	if (event == VM_ENTER) {
+		a->tsc_end = ev->tsc;
+		if (*last_reason != NO_REASON) {
+			/* the duration of one vmexit is tsc_enter - tsc_exit */
+			delta = ev->tsc - *tsc_exit;
+			stat = &a->exits[*last_reason];
+			stat->cycles += delta;
+			stat->hist[hist_bucket(delta)]++;
+		}
+	} else if (event == VM_EXIT) {
+		*tsc_exit = ev->tsc;
+		a->nr_exits++;
+	} else if (reason != NO_REASON) {
+		a->exits[reason].nr++;
+		*last_reason = reason;
+	}
+}
+
+/* function executed in each analyzer thread, one per input file */
+static void *analyze_fn(void *arg)
+{
+	struct analysis *a = arg;
+	trace_ev_t *buf;
+	uint64_t tsc_exit = 0;
+	int last_reason = NO_REASON;
+	size_t i, n;
+	FILE *fp;
+
+	fp = fopen(a->ifile, "rb");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", a->ifile, strerror(errno));
+		a->err = -errno;
+		return NULL;
+	}
+
+	buf = malloc(sizeof(trace_ev_t) * READ_CHUNK);
+	if (!buf) {
+		a->err = -ENOMEM;
+		fclose(fp);
+		return NULL;
+	}
+
+	while ((n = fread(buf, sizeof(trace_ev_t), READ_CHUNK, fp)) > 0) {
+		for (i = 0; i < n; i++)
+			account_event(a, &buf[i], &tsc_exit, &last_reason);
+	}
+
+	if (ferror(fp)) {
+		fprintf(stderr, "Failed to read %s\n", a->ifile);
+		a->err = -EIO;
+	}
+
+	free(buf);
+	fclose(fp);
+
+	return NULL;
+}
+
+static void merge_analysis(struct analysis *all, const struct analysis *a)
+{
+	int i, j;
+
+	if ((all->tsc_begin == 0) || ((a->tsc_begin != 0) && (a->tsc_begin < all->tsc_begin)))
+		all->tsc_begin = a->tsc_begin;
+	if (a->tsc_end > all->tsc_end)
+		all->tsc_end = a->tsc_end;
+	if ((all->tsc_first == 0) || ((a->tsc_first != 0) && (a->tsc_first < all->tsc_first)))
+		all->tsc_first = a->tsc_first;
+	if (a->tsc_last > all->tsc_last)
+		all->tsc_last = a->tsc_last;
+
+	all->nr_exits += a->nr_exits;
+	for (i = 0; i < NR_REASONS; i++) {
+		all->exits[i].nr += a->exits[i].nr;
+		all->exits[i].cycles += a->exits[i].cycles;
+		for (j = 0; j < HIST_BUCKETS; j++)
+			all->exits[i].hist[j] += a->exits[i].hist[j];
+	}
+
+	for (i = 0; i < NR_VECTORS; i++)
+		all->irqs[i] += a->irqs[i];
+	all->irqs_other += a->irqs_other;
+}
+
+static const char *reason_name(int reason, char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(reason_names) / sizeof(reason_names[0]); i++) {
+		if (reason_names[i].reason == reason)
+			return reason_names[i].name;
+	}
+
+	snprintf(buf, len, "VMEXIT_0x%02X", reason);
+	return buf;
+}
+
+static int is_listed_reason(int reason)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(reason_names) / sizeof(reason_names[0]); i++) {
+		if (reason_names[i].reason == reason)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void report_exit(FILE *csv, const char *name, const struct exit_stat *stat,
+		uint64_t rt_cycle, double rt_sec)
+{
+	double ev_freq = (double)stat->nr / rt_sec;
+	double pct = (double)stat->cycles * 100 / (double)rt_cycle;
+	uint64_t lat[sizeof(percentiles) / sizeof(percentiles[0])];
+	uint64_t nr_timed = 0;
+	size_t i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		nr_timed += stat->hist[i];
+	for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+		lat[i] = hist_percentile(stat->hist, nr_timed, percentiles[i]);
+
+	printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\t%-10lu\t%-10lu\t%-10lu\t%-10lu\n",
+		name, stat->nr, ev_freq, stat->cycles, pct, lat[0], lat[1], lat[2], lat[3]);
+	fprintf(csv, "%s,%lu,%.2f,%lu,%.2f,%lu,%lu,%lu,%lu\n",
+		name, stat->nr, ev_freq, stat->cycles, pct, lat[0], lat[1], lat[2], lat[3]);
+}
+
+static void report_vm_exit(FILE *csv, const struct analysis *all, double freq)
+{
+	uint64_t rt_cycle = all->tsc_end - all->tsc_begin;
+	double rt_sec = (double)rt_cycle / (freq * 1000 * 1000);
+	uint64_t total_exit_time = 0;
+	char name[32];
+	size_t i;
+	int r;
+
+	printf("Total run time: %lu cycles\n", rt_cycle);
+	printf("TSC Freq: %.1f MHz\n", freq);
+	printf("Total run time: %.6f sec\n", rt_sec);
+
+	fprintf(csv, "Run time(cycles),Run time(Sec),Freq(MHz)\n");
+	fprintf(csv, "%lu,%.3f,%.1f\n", rt_cycle, rt_sec, freq);
+
+	printf("%-28s\t%-12s\t%-12s\t%-24s\t%-16s\t%-10s\t%-10s\t%-10s\t%-10s\n", "Event",
+		"NR_Exit", "NR_Exit/Sec", "Time Consumed(cycles)", "Time percentage",
+		"P50", "P90", "P99", "P99.9");
+	fprintf(csv, "Exit_Reason,NR_Exit,NR_Exit/Sec,Time Consumed(cycles),Time Percentage,"
+		"P50(cycles),P90(cycles),P99(cycles),P99.9(cycles)\n");
+
+	/* the exit reasons of the python report first, then the other ones seen */
+	for (i = 0; i < sizeof(reason_names) / sizeof(reason_names[0]); i++) {
+		r = reason_names[i].reason;
+		report_exit(csv, reason_names[i].name, &all->exits[r], rt_cycle, rt_sec);
+		total_exit_time += all->exits[r].cycles;
+	}
+	for (r = 0; r < NR_REASONS; r++) {
+		if (is_listed_reason(r) || (all->exits[r].nr == 0))
+			continue;
+		report_exit(csv, reason_name(r, name, sizeof(name)), &all->exits[r], rt_cycle, rt_sec);
+		total_exit_time += all->exits[r].cycles;
+	}
+
+	printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\n", "Total", all->nr_exits,
+		(double)all->nr_exits / rt_sec, total_exit_time,
+		(double)total_exit_time * 100 / (double)rt_cycle);
+	fprintf(csv, "Total,%lu,%.2f,%lu,%.2f\n", all->nr_exits,
+		(double)all->nr_exits / rt_sec, total_exit_time,
+		(double)total_exit_time * 100 / (double)rt_cycle);
+}
+
+static void report_irq(FILE *csv, const struct analysis *all, double freq)
+{
+	uint64_t rt_cycle = all->tsc_last - all->tsc_first;
+	double rt_sec = (double)rt_cycle / (freq * 1000 * 1000);
+	int vec;
+
+	printf("%-8s\t%-8s\t%-8s\n", "Vector", "Count", "NR_Exit/Sec");
+	fprintf(csv, "Vector,NR_Exit,NR_Exit/Sec\n");
+	for (vec = 0; vec < NR_VECTORS; vec++) {
+		if (all->irqs[vec] == 0)
+			continue;
+		printf("0x%08x\t%-8lu\t%-8.2f\n", vec, all->irqs[vec], (double)all->irqs[vec] / rt_sec);
+		fprintf(csv, "0x%08x,%lu,%.2f\n", vec, all->irqs[vec], (double)all->irqs[vec] / rt_sec);
+	}
+	if (all->irqs_other != 0)
+		printf("invalid vectors: %lu\n", all->irqs_other);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{ "ifile",	required_argument,	NULL, 'i' },
+		{ "ofile",	required_argument,	NULL, 'o' },
+		{ "frequency",	required_argument,	NULL, 'f' },
+		{ "vm_exit",	no_argument,		NULL, 'v' },
+		{ "irq",	no_argument,		NULL, 'q' },
+		{ NULL,		0,			NULL, 0 }
+	};
+	/* Default TSC frequency of MRB in MHz */
+	double freq = 1881.6;
+	const char *ofile = NULL;
+	struct analysis *inputs, *all;
+	char csv_name[256];
+	uint32_t analyzer = 0;
+	int i, opt, nr_inputs = 0, err = 0;
+	FILE *csv;
+
+	inputs = calloc(MAX_INPUTS, sizeof(struct analysis));
+	all = calloc(1, sizeof(struct analysis));
+	if (!inputs || !all) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return EXIT_FAILURE;
+	}
+
+	while ((opt = getopt_long(argc, argv, "hi:o:f:", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			if (nr_inputs >= MAX_INPUTS) {
+				fprintf(stderr, "at most %d input files\n", MAX_INPUTS);
+				return EXIT_FAILURE;
+			}
+			inputs[nr_inputs++].ifile = optarg;
+			break;
+		case 'o':
+			ofile = optarg;
+			break;
+		case 'f':
+			freq = strtod(optarg, NULL);
+			if (freq <= 0) {
+				fprintf(stderr, "'-f' require a TSC frequency in MHz\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'v':
+			analyzer |= ANALYZE_VMEXIT;
+			break;
+		case 'q':
+			analyzer |= ANALYZE_IRQ;
+			break;
+		case 'h':
+		default:
+			display_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((nr_inputs == 0) || (ofile == NULL) || (analyzer == 0)) {
+		display_usage();
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < nr_inputs; i++) {
+		if (pthread_create(&inputs[i].thrd, NULL, analyze_fn, &inputs[i])) {
+			fprintf(stderr, "failed to create analyzer thread for %s\n", inputs[i].ifile);
+			/* analyze it in place instead */
+			analyze_fn(&inputs[i]);
+			inputs[i].thrd = 0;
+		}
+	}
+
+	for (i = 0; i < nr_inputs; i++) {
+		if (inputs[i].thrd)
+			pthread_join(inputs[i].thrd, NULL);
+		if (inputs[i].err)
+			err = inputs[i].err;
+		merge_analysis(all, &inputs[i]);
+	}
+
+	if (err)
+		return EXIT_FAILURE;
+
+	if (((analyzer & ANALYZE_VMEXIT) && (all->tsc_end <= all->tsc_begin)) ||
+			((analyzer & ANALYZE_IRQ) && (all->tsc_last <= all->tsc_first))) {
+		fprintf(stderr, "Total run time in cycle is 0, tsc_end %lu, tsc_begin %lu\n",
+			all->tsc_end, all->tsc_begin);
+		return EXIT_FAILURE;
+	}
+
+	if (snprintf(csv_name, sizeof(csv_name), "%s.csv", ofile) >= (int)sizeof(csv_name)) {
+		fprintf(stderr, "output file name is too long\n");
+		return EXIT_FAILURE;
+	}
+	csv = fopen(csv_name, "a");
+	if (!csv) {
+		fprintf(stderr, "Output File Error: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (analyzer & ANALYZE_VMEXIT) {
+		printf("VM exits analysis of %d file(s)\n\toutput file: %s\n", nr_inputs, csv_name);
+		report_vm_exit(csv, all, freq);
+	}
+	if (analyzer & ANALYZE_IRQ) {
+		printf("IRQ analysis of %d file(s)\n\toutput file: %s\n", nr_inputs, csv_name);
+		report_irq(csv, all, freq);
+	}
+
+	fclose(csv);
+	free(all);
+	free(inputs);
+
+	return EXIT_SUCCESS;
+}
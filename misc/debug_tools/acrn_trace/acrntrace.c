@@ -30,10 +30,12 @@ static int exiting = 0;
 
 /* for opt */
 static uint64_t period = 10000;
-static const char optString[] = "i:hcrt:a:";
+static const char optString[] = "i:hcrt:a:sT:";
 static const char dev_prefix[] = "acrn_trace_";
 
 static uint32_t flags = FLAG_CLEAR_BUF;
+static uint64_t trigger_id;
+static uint32_t trigger_post = TRACE_ELEMENT_NUM / 2;
 static char trace_file_dir[TRACE_FILE_DIR_LEN];
 
 static reader_struct *reader;
@@ -44,14 +46,16 @@ static struct bitmask *cpu_bitmask = NULL;
 static void display_usage(void)
 {
 	printf("acrntrace - tool to collect ACRN trace data\n"
-	       "[Usage] acrntrace [-i period] [-t max_time] [-ch]\n\n"
+	       "[Usage] acrntrace [-i period] [-t max_time] [-s] [-T event_id[,post]] [-ch]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-i: period_in_ms: specify polling interval [1-999]\n"
 	       "\t-t: max time to capture trace data (in second)\n"
 	       "\t-c: clear the buffered old data (deprecated)\n"
 	       "\t-r: capture the buffered old data instead of clearing it\n"
-	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n");
+	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n"
+	       "\t-s: snapshot: keep the latest events in the ring and dump it on exit\n"
+	       "\t-T: event_id[,post]: snapshot, frozen after post events following event_id\n");
 }
 
 static void timer_handler(union sigval sv)
@@ -97,6 +101,7 @@ static int init_timer(int timeout)
 static int parse_opt(int argc, char *argv[])
 {
 	int opt, ret;
+	char *end;
 
 	while ((opt = getopt(argc, argv, optString)) != -1) {
 		switch (opt) {
@@ -130,6 +135,24 @@ static int parse_opt(int argc, char *argv[])
 		case 'a':
 			cpu_bitmask = numa_parse_cpustring_all(optarg);
 			break;
+		case 's':
+			flags |= FLAG_SNAPSHOT;
+			break;
+		case 'T':
+			trigger_id = strtoul(optarg, &end, 0);
+			if (*end == ',') {
+				trigger_post = strtoul(end + 1, &end, 0);
+				if (trigger_post >= TRACE_ELEMENT_NUM) {
+					pr_err("'-T' post events shall be less than %d\n", TRACE_ELEMENT_NUM);
+					return -EINVAL;
+				}
+			}
+			if (*end != '\0' || (trigger_id & ~TRACE_ID_MASK)) {
+				pr_err("'-T' require event_id[,post]\n");
+				return -EINVAL;
+			}
+			flags |= FLAG_SNAPSHOT | FLAG_TRIGGER;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -217,6 +240,60 @@ static int create_trace_file_dir(char *dir)
 	return err;
 }
 
+static void snapshot_dump(param_t *param)
+{
+	if (param->dumped)
+		return;
+
+	if (sbuf_dump(param->trace_fd, param->sbuf) < 0)
+		pr_err("Failed to dump the snapshot of sbuf %u\n", param->devid);
+	sbuf_set_flags(param->sbuf, param->sbuf_flags);
+	param->dumped = 1;
+}
+
+/*
+ * Flight recorder mode: the hypervisor overwrites the oldest events so the
+ * ring always holds the latest ones, nothing is copied until the ring is
+ * dumped, either on exit or once trigger_post events followed trigger_id.
+ */
+static void snapshot_fn(param_t *param)
+{
+	shared_buf_t *sbuf = param->sbuf;
+	trace_ev_t *ev;
+	uint32_t pos, post = trigger_post;
+	int triggered = 0;
+
+	sbuf_add_flags(sbuf, OVERWRITE_EN);
+
+	if (!(flags & FLAG_TRIGGER)) {
+		while (1)
+			usleep(period);
+	}
+
+	pos = sbuf->tail;
+	while (1) {
+		while ((ev = sbuf_peek(sbuf, &pos)) != NULL) {
+			if (!triggered) {
+				triggered = ((ev->id & TRACE_ID_MASK) == trigger_id);
+				if (triggered)
+					pr_info("trigger event 0x%lx hit on cpu %u at tsc %lu\n",
+						trigger_id, param->devid, ev->tsc);
+			} else if (post > 0) {
+				post--;
+			}
+
+			if (triggered && (post == 0)) {
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+				snapshot_dump(param);
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+				return;
+			}
+		}
+
+		usleep(period);
+	}
+}
+
 /* function executed in each consumer thread */
 static void reader_fn(param_t * param)
 {
@@ -234,6 +311,11 @@ static void reader_fn(param_t * param)
 	if (flags & FLAG_CLEAR_BUF)
 		sbuf_clear_buffered(sbuf);
 
+	if (flags & FLAG_SNAPSHOT) {
+		snapshot_fn(param);
+		return;
+	}
+
 	while (1) {
 		do {
 			ret = sbuf_write(fd, sbuf);
@@ -268,6 +350,7 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 		reader->param.sbuf = NULL;
 		return -2;
 	}
+	reader->param.sbuf_flags = reader->param.sbuf->flags;
 
 	pr_dbg("sbuf[%d]:\nmagic_num: %lx\nele_num: %u\n ele_size: %u\n",
 	       dev_id, reader->param.sbuf->magic, reader->param.sbuf->ele_num,
@@ -306,6 +389,8 @@ static void destory_reader(reader_struct * reader)
 	}
 
 	if (reader->param.sbuf) {
+		if (flags & FLAG_SNAPSHOT)
+			snapshot_dump(&reader->param);
 		munmap(reader->param.sbuf, MMAP_SIZE);
 		reader->param.sbuf = NULL;
 	}
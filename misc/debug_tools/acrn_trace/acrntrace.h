@@ -38,9 +38,16 @@
  * flags:
  * FLAG_TO_REL   - resources need to be release
  * FLAG_CLEAR_BUF - to clear buffered old data
+ * FLAG_SNAPSHOT - keep the latest events in the ring, dump it on exit
+ * FLAG_TRIGGER  - dump the ring once the trigger event has been seen
  */
 #define FLAG_TO_REL		(1UL << 0)
 #define FLAG_CLEAR_BUF		(1UL << 1)
+#define FLAG_SNAPSHOT		(1UL << 2)
+#define FLAG_TRIGGER		(1UL << 3)
+
+/* event id of trace_ev_t, the upper 16 bits are n_data and cpu */
+#define TRACE_ID_MASK		((1UL << 48) - 1)
 
 #define foreach_dev(dev_id)                                       \
         for ((dev_id) = 0; (dev_id) < (dev_cnt); (dev_id)++)
@@ -76,6 +83,8 @@ typedef struct {
 	int trace_fd;
 	shared_buf_t *sbuf;
 	pthread_mutex_t *sbuf_lock;
+	uint64_t sbuf_flags;	/* sbuf flags to restore after a snapshot */
+	int dumped;		/* snapshot already written to trace_fd */
 } param_t;
 
 typedef struct {
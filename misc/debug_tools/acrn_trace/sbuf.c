@@ -46,29 +46,97 @@ int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 	return sbuf->ele_size;
 }
 
-int sbuf_write(int fd, shared_buf_t *sbuf)
+static inline uint32_t sbuf_used(shared_buf_t *sbuf, uint32_t from, uint32_t to)
+{
+	return (to >= from) ? (to - from) : (sbuf->size - from + to);
+}
+
+/*
+ * Write the elements from head up to end, or up to the end of the ring if
+ * they wrap, straight from the mapped sbuf with as few write() as possible.
+ */
+static int sbuf_write_to(int fd, shared_buf_t *sbuf, uint32_t end)
 {
 	const void *start;
+	uint32_t len;
 	int written;
 
-	if (sbuf == NULL)
-		return -EINVAL;
-
-	if (sbuf_is_empty(sbuf)) {
+	if (sbuf->head == end)
 		return 0;
-	}
 
 	start = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
-        written = write(fd, start, sbuf->ele_size);
-	if (written != sbuf->ele_size) {
-		printf("Failed to write: ret %d (ele_size %d), errno %d\n",
-			written, sbuf->ele_size, (written == -1) ? errno : 0);
+	len = (end > sbuf->head) ? (end - sbuf->head) : (sbuf->size - sbuf->head);
+
+	do {
+		written = write(fd, start, len);
+	} while ((written == -1) && (errno == EINTR));
+
+	if (written <= 0) {
+		printf("Failed to write: ret %d (len %u), errno %d\n",
+			written, len, (written == -1) ? errno : 0);
 		return -1;
 	}
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+	/* a short write still consumes the whole elements it covered */
+	written -= written % sbuf->ele_size;
+	if (written == 0) {
+		printf("Failed to write: short write of less than one element\n");
+		return -1;
+	}
 
-	return sbuf->ele_size;
+	sbuf->head = sbuf_next_ptr(sbuf->head, written, sbuf->size);
+
+	return written;
+}
+
+int sbuf_write(int fd, shared_buf_t *sbuf)
+{
+	if (sbuf == NULL)
+		return -EINVAL;
+
+	return sbuf_write_to(fd, sbuf, sbuf->tail);
+}
+
+int sbuf_dump(int fd, shared_buf_t *sbuf)
+{
+	uint32_t end;
+	int ret;
+
+	if (sbuf == NULL)
+		return -EINVAL;
+
+	/*
+	 * Freeze the ring first: without OVERWRITE_EN the hypervisor stops
+	 * moving head and drops new events once the ring is full, so the
+	 * elements up to the tail seen here stay intact while written out.
+	 */
+	sbuf_clear_flags(sbuf, OVERWRITE_EN);
+	__sync_synchronize();
+	end = sbuf->tail;
+
+	do {
+		ret = sbuf_write_to(fd, sbuf, end);
+	} while (ret > 0);
+
+	return ret;
+}
+
+void *sbuf_peek(shared_buf_t *sbuf, uint32_t *pos)
+{
+	uint32_t tail = sbuf->tail;
+	void *ele;
+
+	/* in overwrite mode the element at pos may have been dropped already */
+	if (sbuf_used(sbuf, sbuf->head, *pos) > sbuf_used(sbuf, sbuf->head, tail))
+		*pos = sbuf->head;
+
+	if (*pos == tail)
+		return NULL;
+
+	ele = (void *)sbuf + SBUF_HEAD_SIZE + *pos;
+	*pos = sbuf_next_ptr(*pos, sbuf->ele_size, sbuf->size);
+
+	return ele;
 }
 
 int sbuf_clear_buffered(shared_buf_t *sbuf)
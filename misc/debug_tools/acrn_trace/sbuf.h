@@ -47,7 +47,8 @@ typedef struct shared_buf {
         uint64_t flags;
         uint32_t overrun_cnt;   /* count of overrun */
         uint32_t size;          /* ele_num * ele_size */
-        uint32_t padding[6];
+        uint32_t wakeup_thres;  /* elements buffered before the SOS is notified, 0 to disable */
+        uint32_t padding[5];
 } shared_buf_t;
 
 static inline void sbuf_clear_flags(shared_buf_t *sbuf, uint64_t flags)
@@ -67,5 +68,7 @@ static inline void sbuf_add_flags(shared_buf_t *sbuf, uint64_t flags)
 
 int sbuf_get(shared_buf_t *sbuf, uint8_t *data);
 int sbuf_write(int fd, shared_buf_t *sbuf);
+int sbuf_dump(int fd, shared_buf_t *sbuf);
+void *sbuf_peek(shared_buf_t *sbuf, uint32_t *pos);
 int sbuf_clear_buffered(shared_buf_t *sbuf);
 #endif /* SHARED_BUF_H */
@@ -0,0 +1,193 @@
+#!/usr/bin/python3
+# -*- coding: UTF-8 -*-
+#
+# Copyright (C) 2021 Intel Corporation. All rights reserved.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+"""
+Symbolize the guest RIP samples taken by the "guest_sample <period_us>" command
+of the hypervisor shell and captured by acrntrace, and fold them into stacks.
+
+The folded stacks, one "vm<id>;vcpu<id>;<process>;<function> <count>" per line,
+are the input of flamegraph.pl; --svg also renders a flame graph directly.
+The RIPs of a VM are looked up in the System.map or /proc/kallsyms of its
+kernel given by --symbols; the user space samples are grouped by CR3.
+"""
+
+import argparse
+import bisect
+import html
+import io
+import struct
+import sys
+
+GUEST_SAMPLE = 0x30000
+GUEST_SAMPLE_MASK = 0xffff0000
+
+# 4 * 64bit per trace entry: TSC, event id, then the two 64bit data
+TRCREC = "QQQQ"
+TRCREC_SIZE = struct.calcsize(TRCREC)
+
+# the canonical kernel half of the address space
+KERNEL_BASE = 0xffff800000000000
+
+class SymbolTable:
+    def __init__(self, path):
+        syms = []
+        with open(path, errors="ignore") as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) < 3 or fields[1] not in "tTwW":
+                    continue
+                addr = int(fields[0], 16)
+                if addr != 0:
+                    syms.append((addr, fields[2]))
+        syms.sort()
+        self.addrs = [addr for addr, _ in syms]
+        self.names = [name for _, name in syms]
+
+    def lookup(self, rip):
+        i = bisect.bisect_right(self.addrs, rip) - 1
+        return self.names[i] if i >= 0 else None
+
+def decode_samples(f):
+    """
+    Yield (vm_id, vcpu_id, rip, cr3) of the samples in the raw trace file f.
+    """
+    while True:
+        rec = f.read(TRCREC_SIZE)
+        if len(rec) < TRCREC_SIZE:
+            break
+        _, event, rip, cr3 = struct.unpack(TRCREC, rec)
+        # the upper 16 bits hold the number of data and the pCPU
+        event = event & 0xffffffffffff
+        if (event & GUEST_SAMPLE_MASK) == GUEST_SAMPLE:
+            yield ((event >> 8) & 0xff, event & 0xff, rip, cr3)
+
+def read_samples(paths):
+    """
+    Yield (vm_id, vcpu_id, rip, cr3) of the samples in the raw trace files.
+    """
+    for path in paths:
+        with open(path, "rb") as f:
+            yield from decode_samples(f)
+
+def self_test():
+    """
+    Decode a fixture of ten guest samples of vm1 vcpu2 on pCPU 3 between other
+    events, as the hypervisor writes them.
+    """
+    hdr = (2 << 48) | (3 << 56)
+    data = io.BytesIO()
+    for i in range(10):
+        data.write(struct.pack(TRCREC, 1000 + i, hdr | 0x1, 0, 0))
+        data.write(struct.pack(TRCREC, 2000 + i, hdr | GUEST_SAMPLE | (1 << 8) | 2,
+                               KERNEL_BASE + i, 0x1000 * i))
+    data.seek(0)
+    samples = list(decode_samples(data))
+    expected = [(1, 2, KERNEL_BASE + i, 0x1000 * i) for i in range(10)]
+    if samples != expected:
+        sys.exit(f"self test failed: decoded {samples}")
+    print("self test passed")
+
+def fold(samples, symbols):
+    stacks = {}
+    for vm_id, vcpu_id, rip, cr3 in samples:
+        if rip >= KERNEL_BASE:
+            process = "[kernel]"
+            table = symbols.get(vm_id)
+            func = table.lookup(rip) if table is not None else None
+            if func is None:
+                func = f"0x{rip:x}"
+        else:
+            process = f"[user cr3=0x{cr3 & ~0xfff:x}]"
+            func = f"0x{rip:x}"
+        stack = f"vm{vm_id};vcpu{vcpu_id};{process};{func}"
+        stacks[stack] = stacks.get(stack, 0) + 1
+    return stacks
+
+def write_svg(stacks, out, width=1200, height=16):
+    """
+    Render the folded stacks as a flame graph, the roots at the bottom.
+    """
+    root = {}
+    for stack, count in stacks.items():
+        node = root
+        for frame in stack.split(";"):
+            entry = node.setdefault(frame, [0, {}])
+            entry[0] += count
+            node = entry[1]
+
+    total = sum(stacks.values())
+    depth = max(len(stack.split(";")) for stack in stacks)
+    rects = []
+
+    def walk(node, level, x):
+        for frame in sorted(node):
+            count, children = node[frame]
+            w = count * width / total
+            rects.append((x, level, w, frame, count))
+            walk(children, level + 1, x)
+            x += w
+
+    walk(root, 0, 0.0)
+
+    svg_height = (depth + 1) * height
+    print(f'<svg xmlns="http://www.w3.org/2000/svg" width="{width}" height="{svg_height}" '
+          f'font-family="monospace" font-size="11">', file=out)
+    for x, level, w, frame, count in rects:
+        y = svg_height - (level + 1) * height
+        hue = 20 + (hash(frame) % 40)
+        label = html.escape(frame)
+        print(f'<g><title>{label} ({count} samples, {count * 100.0 / total:.2f}%)</title>'
+              f'<rect x="{x:.1f}" y="{y}" width="{w:.1f}" height="{height - 1}" fill="hsl({hue},90%,60%)"/>',
+              end="", file=out)
+        # about 7 pixels per character
+        chars = int(w / 7)
+        if chars >= 3:
+            text = frame if len(frame) <= chars else frame[:chars - 2] + ".."
+            print(f'<text x="{x + 2:.1f}" y="{y + height - 4}">{html.escape(text)}</text>', end="", file=out)
+        print('</g>', file=out)
+    print('</svg>', file=out)
+
+def parse_symbols(specs):
+    symbols = {}
+    for spec in specs:
+        vm_id, sep, path = spec.partition(":")
+        if not sep or not vm_id.isdigit():
+            sys.exit(f"{spec}: expected <vm id>:<System.map or kallsyms>")
+        symbols[int(vm_id)] = SymbolTable(path)
+    return symbols
+
+def main(args):
+    if args.self_test:
+        self_test()
+        return
+    if not args.trace:
+        sys.exit("no raw trace data file given")
+
+    symbols = parse_symbols(args.symbols)
+    stacks = fold(read_samples(args.trace), symbols)
+    if not stacks:
+        sys.exit("no guest samples found in the trace data")
+
+    out = open(args.out, "w") if args.out else sys.stdout
+    for stack in sorted(stacks, key=lambda s: stacks[s], reverse=True):
+        print(f"{stack} {stacks[stack]}", file=out)
+
+    if args.svg:
+        with open(args.svg, "w") as f:
+            write_svg(stacks, f)
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("trace", nargs="*", help="raw trace data files of acrntrace, e.g. trace_data/0")
+    parser.add_argument("--symbols", action="append", default=[], metavar="VMID:FILE",
+                        help="System.map or /proc/kallsyms of the kernel of a VM, may be repeated")
+    parser.add_argument("--out", help="file of the folded stacks, printed if not given")
+    parser.add_argument("--svg", help="also render a flame graph to this file")
+    parser.add_argument("--self-test", action="store_true",
+                        help="check the decoding of the trace records on a built-in fixture")
+    main(parser.parse_args())
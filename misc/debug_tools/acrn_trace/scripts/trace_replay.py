@@ -0,0 +1,552 @@
+#!/usr/bin/python3
+# -*- coding: UTF-8 -*-
+#
+# Copyright (C) 2021 Intel Corporation. All rights reserved.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+"""
+Record the I/O and interrupt pattern of a VM from acrntrace data, and replay
+it offline against a model of a configuration: scheduler, pCPU sharing,
+device model and guest stub loads.
+
+"record" turns the raw trace files, one per pCPU running a vCPU of the VM,
+into a workload file: per vCPU, the guest runs between the exits which block
+the vCPU (I/O requests to the device model, HLT), and the external interrupts
+taken. The exits handled by the hypervisor are folded into the runs.
+
+"replay" runs the workload through a discrete event model of the BVT, IORR
+or noop scheduler, with the vCPUs spread over --pcpus pCPUs shared with
+--stub-load CPU bound guests, and the I/O requests served by --dm-workers
+device model threads. It reports the percentiles of:
+  sched  the time from a vCPU wakeup to it running
+  ioreq  the time from an I/O request exit to the vCPU running again
+  irq    the time from an interrupt to the vCPU running to take it
+Compared to --baseline or to --max limits, a regression exits with 1.
+"""
+
+import argparse
+import collections
+import heapq
+import json
+import math
+import struct
+import sys
+
+# 4 * 64bit per trace entry
+TRCREC = "QQQQ"
+TRCREC_SIZE = struct.calcsize(TRCREC)
+
+VM_EXIT = 0x10
+VM_ENTER = 0x11
+VMEXIT_ENTRY = 0x10000
+VMEXIT_EXTERNAL_INTERRUPT = VMEXIT_ENTRY + 0x01
+VMEXIT_IO_INSTRUCTION = VMEXIT_ENTRY + 0x1E
+VMEXIT_EPT_VIOLATION = VMEXIT_ENTRY + 0x30
+
+EXIT_REASON_EXTERNAL_INTERRUPT = 0x01
+EXIT_REASON_HLT = 0x0C
+EXIT_REASON_IO_INSTRUCTION = 0x1E
+EXIT_REASON_EPT_VIOLATION = 0x30
+
+WORKLOAD_VERSION = 1
+
+# as in hypervisor/common/sched_iorr.c and sched_bvt.c, in us
+IORR_SLICE = 10000.0
+BVT_MCU = 1000.0
+BVT_CSA = 5 * BVT_MCU
+BVT_WARP = 2 * BVT_CSA
+
+PERCENTILES = (50, 90, 99, 99.9)
+METRICS = ("sched", "ioreq", "irq")
+
+def read_trace(path):
+    """
+    Yield (tsc, event, d1, d2) of the raw trace file.
+    """
+    with open(path, "rb") as f:
+        while True:
+            rec = f.read(TRCREC_SIZE)
+            if len(rec) < TRCREC_SIZE:
+                break
+            tsc, event, d1, d2 = struct.unpack(TRCREC, rec)
+            yield tsc, event & 0xffffffffffff, d1, d2
+
+def record_vcpu(path, freq, ioreq_us):
+    """
+    Return the first VM entry TSC, the blocking events and the interrupt TSCs
+    of the trace file of a pCPU.
+
+    An event is [run_us, kind, key, service_us]: the vCPU runs for run_us,
+    then blocks for service_us on an I/O request to key, or in HLT. An I/O
+    exit is taken as an I/O request if it lasts ioreq_us or more, as it then
+    went to the device model; the shorter ones are handled by the hypervisor.
+    """
+    start = None
+    last_enter = None
+    exit_ = None
+    run = 0.0
+    events = []
+    irqs = []
+
+    for tsc, event, d1, d2 in read_trace(path):
+        if event == VM_EXIT:
+            exit_ = {"tsc": tsc, "reason": d1 & 0xffff, "key": None}
+        elif exit_ is None:
+            continue
+        elif event == VMEXIT_IO_INSTRUCTION:
+            exit_["key"] = "pio:0x%x" % (d1 & 0xffff)
+        elif event == VMEXIT_EPT_VIOLATION:
+            exit_["key"] = "mmio:0x%x" % (d2 & ~0xfff)
+        elif event == VM_ENTER:
+            if last_enter is None:
+                start = tsc
+            else:
+                run += (exit_["tsc"] - last_enter) / freq
+                service = (tsc - exit_["tsc"]) / freq
+                reason = exit_["reason"]
+                if reason == EXIT_REASON_EXTERNAL_INTERRUPT:
+                    irqs.append(exit_["tsc"])
+                if reason == EXIT_REASON_HLT:
+                    events.append([round(run, 3), "hlt", None, round(service, 3)])
+                    run = 0.0
+                elif reason in (EXIT_REASON_IO_INSTRUCTION, EXIT_REASON_EPT_VIOLATION) \
+                        and service >= ioreq_us:
+                    events.append([round(run, 3), "ioreq", exit_["key"], round(service, 3)])
+                    run = 0.0
+                else:
+                    run += service
+            last_enter = tsc
+            exit_ = None
+
+    if run > 0:
+        events.append([round(run, 3), "end", None, 0.0])
+    return start, events, irqs
+
+def do_record(args):
+    freq = float(args.frequency)
+    vcpus = []
+    for path in args.trace:
+        start, events, irqs = record_vcpu(path, freq, args.ioreq_us)
+        if start is None:
+            print("%s: no VM entry, skipped" % path, file=sys.stderr)
+            continue
+        vcpus.append({"name": path, "start": start, "events": events, "irqs": irqs})
+    if not vcpus:
+        print("no vCPU activity in the trace", file=sys.stderr)
+        return 1
+
+    # the TSCs are synchronized among the pCPUs
+    t0 = min(v["start"] for v in vcpus)
+    workload = {"version": WORKLOAD_VERSION, "frequency": freq, "ioreq_us": args.ioreq_us,
+                "vcpus": [], "irqs": []}
+    for i, v in enumerate(vcpus):
+        workload["vcpus"].append({"name": v["name"], "start_us": round((v["start"] - t0) / freq, 3),
+                                  "events": v["events"]})
+        workload["irqs"] += [[round((tsc - t0) / freq, 3), i] for tsc in v["irqs"]]
+    workload["irqs"].sort()
+
+    with open(args.out, "w") as f:
+        json.dump(workload, f, indent=1)
+    nr_ioreqs = sum(e[1] == "ioreq" for v in vcpus for e in v["events"])
+    print("%d vCPUs, %d I/O requests, %d interrupts recorded in %s"
+          % (len(vcpus), nr_ioreqs, len(workload["irqs"]), args.out))
+    return 0
+
+class Thread:
+    """
+    A vCPU, running the events of the workload, or a stub load.
+    """
+    def __init__(self, name, events, traced, loops):
+        self.name = name
+        self.events = events
+        self.traced = traced
+        self.loops = loops
+        self.idx = 0
+        self.event = None
+        self.run_left = 0.0
+        self.state = "blocked"
+        self.pcpu = None
+        # BVT virtual times, IORR slice
+        self.avt = 0.0
+        self.evt = 0.0
+        self.slice_left = IORR_SLICE
+        # when it was woken up, the I/O request blocking it was sent
+        self.woken = None
+        self.ioreq_sent = None
+        self.hlt_token = 0
+        self.pending_irqs = []
+
+    def next_event(self):
+        """Load the next event, return False at the end of the workload."""
+        if self.idx == len(self.events):
+            self.loops -= 1
+            if self.loops == 0:
+                return False
+            self.idx = 0
+        self.event = self.events[self.idx]
+        self.idx += 1
+        self.run_left = self.event[0]
+        return True
+
+class NoopSched:
+    """Run to block, in wakeup order."""
+    def __init__(self):
+        self.queue = collections.deque()
+
+    def wake(self, pcpu, th):
+        self.queue.append(th)
+        return pcpu.cur is None
+
+    def pick(self, pcpu, cur):
+        if cur is not None:
+            return cur, math.inf
+        return (self.queue.popleft(), math.inf) if self.queue else (None, math.inf)
+
+class IorrSched:
+    """Round robin in slices, a woken up thread goes first."""
+    def __init__(self):
+        self.queue = collections.deque()
+
+    def wake(self, pcpu, th):
+        self.queue.appendleft(th)
+        return True
+
+    def pick(self, pcpu, cur):
+        if cur is not None:
+            self.queue.append(cur)
+        if not self.queue:
+            return None, math.inf
+        th = self.queue.popleft()
+        while th.slice_left <= 0:
+            th.slice_left += IORR_SLICE
+        return th, (th.slice_left if self.queue else math.inf)
+
+class BvtSched:
+    """Lowest effective virtual time first, for CSA past the runner-up."""
+    def __init__(self, warp):
+        self.queue = []
+        self.warp = warp
+
+    def wake(self, pcpu, th):
+        avts = [t.avt for t in self.queue]
+        if pcpu.cur is not None:
+            avts.append(pcpu.cur.avt)
+        if avts:
+            # adjusting AVT for a thread after a long sleep
+            th.avt = max(th.avt, min(avts) - BVT_CSA)
+        th.evt = th.avt - (BVT_WARP if self.warp else 0.0)
+        self.queue.append(th)
+        return True
+
+    def pick(self, pcpu, cur):
+        if cur is not None:
+            self.queue.append(cur)
+        if not self.queue:
+            return None, math.inf
+        self.queue.sort(key=lambda t: t.evt)
+        th = self.queue.pop(0)
+        if not self.queue:
+            return th, math.inf
+        return th, self.queue[0].evt - th.evt + BVT_CSA
+
+class PCpu:
+    def __init__(self, sched):
+        self.sched = sched
+        self.cur = None
+        self.since = 0.0
+        self.gen = 0
+
+class Sim:
+    def __init__(self, args, workload):
+        self.args = args
+        self.now = 0.0
+        self.heap = []
+        self.seq = 0
+        self.pcpus = [PCpu(self.new_sched()) for _ in range(args.pcpus)]
+        self.dm_free = args.dm_workers
+        self.dm_queue = collections.deque()
+        self.stats = {m: [] for m in METRICS}
+        self.nr_traced = 0
+
+        self.vcpus = []
+        for i, v in enumerate(workload["vcpus"]):
+            th = Thread(v["name"], v["events"], True, args.loops)
+            self.add_thread(th, i, v["start_us"])
+            self.vcpus.append(th)
+        for i in range(args.stub_load):
+            run = args.stub_duty * IORR_SLICE
+            th = Thread("stub%d" % i, [[run, "hlt", None, IORR_SLICE - run]], False, 0)
+            self.add_thread(th, len(self.vcpus) + i, 0.0)
+
+        # the interrupts come in at the same pace on each loop
+        span = max([v["start_us"] + sum(e[0] + e[3] for e in v["events"])
+                    for v in workload["vcpus"]] + [0.0])
+        for loop in range(args.loops):
+            for t, i in workload["irqs"]:
+                self.at(loop * span + t, self.irq, self.vcpus[i])
+
+    def new_sched(self):
+        if self.args.sched == "iorr":
+            return IorrSched()
+        if self.args.sched == "bvt":
+            return BvtSched(self.args.bvt_warp)
+        return NoopSched()
+
+    def add_thread(self, th, i, start):
+        th.pcpu = self.pcpus[i % len(self.pcpus)]
+        if th.traced:
+            self.nr_traced += 1
+        self.at(start, self.start, th)
+
+    def at(self, t, fn, *args):
+        self.seq += 1
+        heapq.heappush(self.heap, (t, self.seq, fn, args))
+
+    def run(self):
+        while self.heap and self.nr_traced > 0:
+            t, _, fn, args = heapq.heappop(self.heap)
+            self.now = t
+            fn(*args)
+
+    def start(self, th):
+        if th.next_event():
+            self.wake(th)
+        else:
+            self.done(th)
+
+    def done(self, th):
+        th.state = "done"
+        if th.traced:
+            self.nr_traced -= 1
+
+    def wake(self, th):
+        th.state = "runnable"
+        th.woken = self.now
+        if th.pcpu.sched.wake(th.pcpu, th):
+            self.resched(th.pcpu)
+
+    def account(self, pcpu):
+        th = pcpu.cur
+        dt = self.now - pcpu.since
+        th.run_left -= dt
+        th.slice_left -= dt
+        th.avt += dt
+        th.evt = th.avt
+        pcpu.since = self.now
+
+    def resched(self, pcpu):
+        cur = pcpu.cur
+        if cur is not None:
+            self.account(pcpu)
+        th, quantum = pcpu.sched.pick(pcpu, cur)
+        pcpu.cur = th
+        pcpu.since = self.now
+        pcpu.gen += 1
+        if th is None:
+            return
+
+        if th is not cur:
+            if cur is not None:
+                cur.state = "runnable"
+            th.state = "running"
+            if th.traced:
+                self.took_cpu(th)
+        end = self.now + min(max(th.run_left, 0.0), quantum)
+        if end < math.inf:
+            self.at(end, self.timer, pcpu, pcpu.gen)
+
+    def took_cpu(self, th):
+        if th.woken is not None:
+            self.stats["sched"].append(self.now - th.woken)
+            th.woken = None
+        if th.ioreq_sent is not None:
+            self.stats["ioreq"].append(self.now - th.ioreq_sent)
+            th.ioreq_sent = None
+        for t in th.pending_irqs:
+            self.stats["irq"].append(self.now - t)
+        th.pending_irqs = []
+
+    def timer(self, pcpu, gen):
+        if gen != pcpu.gen:
+            return
+        th = pcpu.cur
+        self.account(pcpu)
+        if th.run_left > 1e-6:
+            # end of the slice
+            self.resched(pcpu)
+            return
+
+        pcpu.cur = None
+        th.state = "blocked"
+        _, kind, _, service = th.event
+        if kind == "ioreq":
+            th.ioreq_sent = self.now
+            self.dm_submit(th, service)
+        elif kind == "hlt":
+            th.hlt_token += 1
+            self.at(self.now + service, self.hlt_end, th, th.hlt_token)
+        elif not th.next_event():
+            self.done(th)
+        else:
+            th.state = "runnable"
+            pcpu.sched.wake(pcpu, th)
+        self.resched(pcpu)
+
+    def resume(self, th):
+        """The blocking event is over, go on with the next one."""
+        if th.next_event():
+            self.wake(th)
+        else:
+            self.done(th)
+
+    def hlt_end(self, th, token):
+        if th.state == "blocked" and token == th.hlt_token:
+            self.resume(th)
+
+    def irq(self, th):
+        if th.state == "done":
+            return
+        if th.state == "running":
+            self.stats["irq"].append(0.0)
+            return
+        th.pending_irqs.append(self.now)
+        # an interrupt ends the HLT
+        if th.state == "blocked" and th.event is not None and th.event[1] == "hlt":
+            th.hlt_token += 1
+            self.resume(th)
+
+    def dm_submit(self, th, service):
+        if self.dm_free > 0:
+            self.dm_free -= 1
+            self.dm_start(th, service)
+        else:
+            self.dm_queue.append((th, service))
+
+    def dm_start(self, th, service):
+        self.at(self.now + service * self.args.dm_scale + self.args.ioreq_overhead_us,
+                self.dm_done, th)
+
+    def dm_done(self, th):
+        self.resume(th)
+        if self.dm_queue:
+            self.dm_start(*self.dm_queue.popleft())
+        else:
+            self.dm_free += 1
+
+def percentile(values, pct):
+    """Nearest rank percentile of the sorted values."""
+    return values[max(int(math.ceil(pct / 100.0 * len(values))) - 1, 0)]
+
+def summarize(stats):
+    report = {}
+    for metric in METRICS:
+        values = sorted(stats[metric])
+        entry = {"count": len(values)}
+        for pct in PERCENTILES:
+            entry["p%g" % pct] = round(percentile(values, pct), 3) if values else 0.0
+        entry["max"] = round(values[-1], 3) if values else 0.0
+        report[metric] = entry
+    return report
+
+def check(report, args):
+    """Return the regressions against the baseline and the limits."""
+    failures = []
+    if args.baseline:
+        with open(args.baseline) as f:
+            base = json.load(f)["metrics"]
+        for metric in METRICS:
+            for key, old in base.get(metric, {}).items():
+                if key == "count" or key not in report[metric]:
+                    continue
+                new = report[metric][key]
+                if new > old * (1 + args.tolerance / 100.0) and new - old > args.min_delta_us:
+                    failures.append("%s.%s %.3f us > %.3f us in the baseline" % (metric, key, new, old))
+    for limit in args.max or []:
+        name, value = limit.split("=")
+        metric, key = name.split(".")
+        if report[metric][key] > float(value):
+            failures.append("%s %.3f us > %s us" % (name, report[metric][key], value))
+    return failures
+
+def do_replay(args):
+    with open(args.workload) as f:
+        workload = json.load(f)
+    if workload.get("version") != WORKLOAD_VERSION:
+        print("%s: unsupported workload version" % args.workload, file=sys.stderr)
+        return 1
+    if args.pcpus is None:
+        args.pcpus = len(workload["vcpus"])
+
+    sim = Sim(args, workload)
+    sim.run()
+    report = summarize(sim.stats)
+
+    print("sched %s, %d vCPUs and %d stub loads on %d pCPUs, %d DM workers"
+          % (args.sched, len(workload["vcpus"]), args.stub_load, args.pcpus, args.dm_workers))
+    print("%-8s%10s" % ("(us)", "count") + "".join("%10s" % ("p%g" % p) for p in PERCENTILES)
+          + "%10s" % "max")
+    for metric in METRICS:
+        entry = report[metric]
+        print("%-8s%10d" % (metric, entry["count"])
+              + "".join("%10.1f" % entry["p%g" % p] for p in PERCENTILES) + "%10.1f" % entry["max"])
+
+    if args.json:
+        config = {k: v for k, v in vars(args).items()
+                  if k in ("sched", "pcpus", "stub_load", "stub_duty", "dm_workers", "dm_scale",
+                           "ioreq_overhead_us", "bvt_warp", "loops")}
+        with open(args.json, "w") as f:
+            json.dump({"config": config, "metrics": report}, f, indent=1)
+
+    failures = check(report, args)
+    for failure in failures:
+        print("regression: " + failure)
+    return 1 if failures else 0
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd")
+    sub.required = True
+
+    rec = sub.add_parser("record", help="build a workload from raw trace files")
+    rec.add_argument("trace", nargs="+", help="raw trace file of a pCPU running a vCPU of the VM")
+    rec.add_argument("-f", "--frequency", default=1881.6, help="TSC frequency in MHz")
+    rec.add_argument("--ioreq-us", type=float, default=5.0,
+                     help="shortest I/O exit taken as a request to the device model, in us")
+    rec.add_argument("-o", "--out", required=True, help="workload file")
+
+    rep = sub.add_parser("replay", help="replay a workload against a configuration")
+    rep.add_argument("workload", help="workload file")
+    rep.add_argument("--sched", choices=("noop", "iorr", "bvt"), default="bvt")
+    rep.add_argument("--bvt-warp", action="store_true",
+                     help="the woken up vCPUs borrow virtual time, as sched_bvt_prioritize()")
+    rep.add_argument("--pcpus", type=int, help="pCPUs the vCPUs share, one per vCPU by default")
+    rep.add_argument("--stub-load", type=int, default=0, help="CPU bound guests sharing the pCPUs")
+    rep.add_argument("--stub-duty", type=float, default=1.0,
+                     help="share of the time a stub load runs, in (0, 1]")
+    rep.add_argument("--dm-workers", type=int, default=1, help="device model threads serving the I/O")
+    rep.add_argument("--dm-scale", type=float, default=1.0,
+                     help="factor of the recorded I/O request service times")
+    rep.add_argument("--ioreq-overhead-us", type=float, default=0.0,
+                     help="added to each I/O request, e.g. for a slower notification")
+    rep.add_argument("--loops", type=int, default=1, help="times the workload is replayed")
+    rep.add_argument("--json", help="write the report to this file")
+    rep.add_argument("--baseline", help="report to compare to")
+    rep.add_argument("--tolerance", type=float, default=10.0,
+                     help="increase over the baseline taken as a regression, in percent")
+    rep.add_argument("--min-delta-us", type=float, default=1.0,
+                     help="smallest increase over the baseline taken as a regression")
+    rep.add_argument("--max", action="append", metavar="METRIC.PCT=US",
+                     help="limit, e.g. ioreq.p99=200")
+
+    args = parser.parse_args()
+    if args.cmd == "record":
+        return do_record(args)
+    if not 0 < args.stub_duty <= 1 or args.loops < 1 or args.dm_workers < 1:
+        parser.error("invalid replay parameters")
+    return do_replay(args)
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -13,6 +13,7 @@
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 #include <dirent.h>
 #include "mevent.h"
 #include "acrn_mngr.h"
@@ -46,7 +47,9 @@ int check_dir(const char *path, int flags)
 
 #define MNGR_SOCK_FMT		"/run/acrn/mngr/%s.%d.socket"
 #define MNGR_MAX_HANDLER	8
-#define MNGR_MAX_CLIENT		4
+#define MNGR_MAX_CLIENT		64	/* a manager has a client per DM */
+#define MNGR_MAX_EVENTS		16
+#define MNGR_POLL_TIMEOUT	1000	/* ms, to notice close_server() */
 
 #define CLIENT_BUF_LEN  4096
 
@@ -79,10 +82,9 @@ struct mngr_fd {
 	socklen_t addr_len;
 
 	/* for servet */
-	int listening;
 	int polling;
-	pthread_t listen_thread;	/* for connect/disconnect */
-	pthread_t poll_thread;	/* poll requests */
+	int epfd;		/* the socket and all the client connections */
+	pthread_t poll_thread;	/* connect/disconnect and poll requests */
 
 	/* a server can have many client connection */
 	LIST_HEAD(client_list, mngr_client) client_head;	/* clients for this server */
@@ -155,31 +157,6 @@ static void mngr_client_free(struct mngr_fd *mfd, struct mngr_client *client)
 static LIST_HEAD(mngr_fd_list, mngr_fd) mngr_fd_head;
 static pthread_mutex_t mngr_fd_mtx = PTHREAD_MUTEX_INITIALIZER;
 
-static void *server_listen_func(void *arg)
-{
-	struct mngr_fd *mfd = arg;
-	struct mngr_client *client;
-
-	printf("Listening %d...\n", mfd->desc);
-	while (mfd->listening) {
-		/* wait connection */
-		if (mfd->num_client >= MNGR_MAX_CLIENT) {
-			usleep(500000);
-			continue;
-		}
-
-		client = mngr_client_new(mfd);
-		if (!client) {
-			usleep(500000);
-			continue;
-		}
-		printf("Connected:%d\n", client->fd);
-		mfd->num_client++;
-	}
-	printf("Stop listening %d...\n", mfd->desc);
-	return NULL;
-}
-
 static int server_parse_buf(struct mngr_fd *mfd, struct mngr_client *client)
 {
 	struct mngr_msg *msg;
@@ -218,44 +195,62 @@ static int server_parse_buf(struct mngr_fd *mfd, struct mngr_client *client)
 	return 0;
 }
 
+static void server_accept(struct mngr_fd *mfd)
+{
+	struct mngr_client *client;
+	struct epoll_event ev;
+
+	client = mngr_client_new(mfd);
+	if (!client)
+		return;
+
+	if (mfd->num_client >= MNGR_MAX_CLIENT) {
+		fprintf(stderr, "Too many clients, drop %d\n", client->fd);
+		mngr_client_free(mfd, client);
+		return;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = client;
+	if (epoll_ctl(mfd->epfd, EPOLL_CTL_ADD, client->fd, &ev) < 0) {
+		printf("%s: Failed to poll fd %d, err: %s\n", __func__, client->fd, strerror(errno));
+		mngr_client_free(mfd, client);
+		return;
+	}
+
+	printf("Connected:%d\n", client->fd);
+	mfd->num_client++;
+}
+
+/*
+ * One thread waits for the connections and the requests of all the clients
+ * at once, and handles the requests as they come.
+ */
 static void *server_poll_func(void *arg)
 {
 	struct mngr_fd *mfd = arg;
 	struct mngr_client *client;
-	fd_set rfd;
-	int max_fd = 0;
-	struct timeval timeout;
-	struct mngr_client *poll_client[MNGR_MAX_CLIENT];
+	struct epoll_event events[MNGR_MAX_EVENTS];
 	int nfd, i;
 
 	printf("polling %d...\n", mfd->desc);
 	while (mfd->polling) {
-		max_fd = 0;
-		nfd = 0;
-		pthread_mutex_lock(&mfd->client_mtx);
-		FD_ZERO(&rfd);
-		LIST_FOREACH(client, &mfd->client_head, list) {
-			FD_SET(client->fd, &rfd);
-			poll_client[nfd] = client;
-			nfd++;
-			if (client->fd > max_fd)
-				max_fd = client->fd;
-		}
-		pthread_mutex_unlock(&mfd->client_mtx);
+		nfd = epoll_wait(mfd->epfd, events, MNGR_MAX_EVENTS, MNGR_POLL_TIMEOUT);
 
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 10000;
-		select(max_fd + 1, &rfd, NULL, NULL, &timeout);
-
-		for (i = 0; i < nfd; i++) {
-			client = poll_client[i];
-			if (!FD_ISSET(client->fd, &rfd))
+		for (i = 0; i < nfd && mfd->polling; i++) {
+			client = events[i].data.ptr;
+			if (!client) {
+				/* the server socket */
+				server_accept(mfd);
 				continue;
+			}
+
 			client->len =
 			    read(client->fd, client->buf, CLIENT_BUF_LEN);
 			if (client->len <= 0) {
 				fprintf(stderr, "Disconnect(%d)!\r\n",
 					client->fd);
+				epoll_ctl(mfd->epfd, EPOLL_CTL_DEL, client->fd, NULL);
 				mngr_client_free(mfd, client);
 				mfd->num_client--;
 				continue;
@@ -304,6 +299,7 @@ static int create_new_server(const char *name)
 	struct mngr_fd *mfd;
 	int ret;
 	char path[128] = { };
+	struct epoll_event ev;
 
 	if (snprintf(path, sizeof(path), MNGR_SOCK_FMT, name, getpid()) >= sizeof(path)) {
 		printf("WARN: the path is truncated\n");
@@ -335,17 +331,21 @@ static int create_new_server(const char *name)
 		printf("%s: Failed to bind fd %d, err: %s\n", __func__, mfd->fd, strerror(errno));
 		goto bind_err;
 	}
-	listen(mfd->fd, 1);
+	listen(mfd->fd, MNGR_MAX_CLIENT);
 
-	/* create a listen_thread */
-	mfd->listening = 1;
-	ret =
-	    pthread_create(&mfd->listen_thread, NULL, server_listen_func, mfd);
-	if (ret < 0) {
-		printf("%s: Failed to create listen_thread, err: %s\n", __func__, strerror(errno));
+	mfd->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (mfd->epfd < 0) {
+		printf("%s: Failed to create epoll fd, err: %s\n", __func__, strerror(errno));
+		ret = mfd->epfd;
 		goto listen_err;
 	}
-	pthread_setname_np(mfd->listen_thread, "mngr_listen");
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	ret = epoll_ctl(mfd->epfd, EPOLL_CTL_ADD, mfd->fd, &ev);
+	if (ret < 0) {
+		printf("%s: Failed to poll fd %d, err: %s\n", __func__, mfd->fd, strerror(errno));
+		goto poll_err;
+	}
 
 	/* create a poll_thread */
 	mfd->polling = 1;
@@ -365,8 +365,7 @@ static int create_new_server(const char *name)
 	return mfd->desc;
 
  poll_err:
-	mfd->listening = 0;
-	pthread_join(mfd->listen_thread, NULL);
+	close(mfd->epfd);
  listen_err:
 	unlink(path);
  bind_err:
@@ -382,13 +381,10 @@ static void close_server(struct mngr_fd *mfd)
 	struct mngr_client *client, *tclient;
 	struct mngr_handler *handler, *thandler;
 
-	shutdown(mfd->fd, SHUT_RDWR);
-
-	mfd->listening = 0;
-	pthread_join(mfd->listen_thread, NULL);
-
 	mfd->polling = 0;
+	shutdown(mfd->fd, SHUT_RDWR);
 	pthread_join(mfd->poll_thread, NULL);
+	close(mfd->epfd);
 
 	pthread_mutex_lock(&mfd->client_mtx);
 	list_foreach_safe(client, &mfd->client_head, list, tclient) {
@@ -23,6 +23,7 @@ header file.
 #define ACRN_CONF_PATH			"/usr/share/acrn/conf"
 #define ACRN_CONF_PATH_ADD		ACRN_CONF_PATH "/add"
 #define ACRN_CONF_TIMER_LIST	ACRN_CONF_PATH "/timer_list"
+#define ACRN_CONF_WARM_LIST	ACRN_CONF_PATH "/warm_list"
 
 #define ACRN_DM_BASE_PATH	"/run/acrn"
 #define ACRN_DM_SOCK_PATH	"/run/acrn/mngr"
@@ -36,11 +37,17 @@ struct mngr_msg {
 	unsigned long timestamp;
 	union {
 
-		/* Arguments to rescan virtio-blk device */
+		/* Arguments to rescan or throttle virtio-blk device,
+		   the snapshot file of DM_SNAPSHOT,
+		   the host:port of the destination of DM_MIGRATE,
+		   the balloon size of DM_BALLOON,
+		   the CLOS settings of DM_RDT and its ack,
+		   the disk image to attach on DM_START,
+		   or the ack of DM_PIOSTAT */
 		char devargs[PARAM_LEN];
 
-		/* ack of DM_STOP, DM_SUSPEND, DM_RESUME,
-		   ACRND_TIMER, ACRND_STOP, ACRND_RESUME, RTC_TIMER */
+		/* ack of DM_STOP, DM_SUSPEND, DM_RESUME, DM_START, DM_SUBSCRIBE,
+		   DM_MIGRATE, ACRND_TIMER, ACRND_STOP, ACRND_RESUME, RTC_TIMER */
 		int err;
 
 		/* ack of WAKEUP_REASON */
@@ -79,6 +86,13 @@ struct mngr_msg {
 			time_t t;
 		} rtc_timer;
 
+		/* req of DM_NOTIFY, no ack */
+		struct req_dm_notify {
+			char name[MAX_VMNAME_LEN];
+			int pid;
+			int state;	/* as the ack of DM_QUERY */
+		} dm_notify;
+
 	} data;
 };
 
@@ -96,11 +110,70 @@ enum dm_msgid {
 	DM_RESUME,		/* Resume this UOS from suspend state */
 	DM_QUERY,		/* Ask power state of this UOS */
 	DM_BLKRESCAN,		/* Rescan virtio-blk device for any changes in UOS */
+	DM_BLKTHROTTLE,		/* Change the I/O limits of a virtio-blk device */
+	DM_SNAPSHOT,		/* Save this UOS from suspend state into a file */
+	DM_BALLOON,		/* Set the size of the virtio-balloon of this UOS */
+	DM_RDT,			/* Change and show the RDT CLOS of a vCPU of this UOS */
+	DM_START,		/* Start this warm UOS */
+	DM_PIOSTAT,		/* Show the most accessed I/O ports of this UOS */
+	DM_SUBSCRIBE,		/* Stream the DM statistics of this UOS */
+	DM_MIGRATE,		/* Move this UOS to the DM of another host */
 	DM_MAX,
 };
 
 /* DM handled message req/ack pairs */
 
+/*
+ * Once DM_SUBSCRIBE is acked with err 0, the DM writes a statistics frame to
+ * the connection every DM_STATS_PERIOD_MS, until it is closed. All the
+ * subscribers get the same frame, built once per period. A frame is a
+ * struct dm_stats_hdr followed by nr_recs records, each starting with a
+ * struct dm_stats_rec, all in host byte order. The counters are cumulative,
+ * rates come from the deltas of two frames over their timestamps. A client
+ * skips the records of unknown type by their len.
+ */
+#define DM_STATS_MAGIC		0x54534d44	/* that is char[4] "DMST" */
+#define DM_STATS_VERSION	1
+#define DM_STATS_PERIOD_MS	1000
+
+struct dm_stats_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nr_recs;
+	uint32_t len;		/* bytes of the frame, header included */
+	uint32_t seq;		/* frame number, a gap means frames dropped */
+	uint64_t timestamp;	/* ns of CLOCK_MONOTONIC */
+} __attribute__((packed));
+
+enum dm_stats_type {
+	DM_STATS_IOREQ = 1,	/* id: ioreq type, struct dm_stats_ioreq */
+	DM_STATS_DEV,		/* id: PCI bdf, struct dm_stats_dev */
+	DM_STATS_VQ,		/* id: PCI bdf, struct dm_stats_vq */
+};
+
+struct dm_stats_rec {
+	uint8_t type;		/* enum dm_stats_type */
+	uint8_t len;		/* bytes of the record, header included */
+	uint16_t id;
+} __attribute__((packed));
+
+struct dm_stats_ioreq {
+	struct dm_stats_rec rec;
+	uint64_t count;		/* ioreqs handled */
+	uint64_t cycles;	/* TSC cycles from their fetch to completion */
+} __attribute__((packed));
+
+struct dm_stats_dev {
+	struct dm_stats_rec rec;
+	uint64_t accesses;	/* trapped BAR accesses */
+} __attribute__((packed));
+
+struct dm_stats_vq {
+	struct dm_stats_rec rec;
+	uint16_t nr_vqs;
+	uint16_t depth[];	/* available buffers not taken, 0xffff unknown */
+} __attribute__((packed));
+
 /* Acrnd handled message event types */
 enum acrnd_msgid {
 	/* DM -> Acrnd */
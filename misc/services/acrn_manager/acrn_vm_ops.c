@@ -13,10 +13,14 @@
 #include <pthread.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <unistd.h>
 #include "acrnctl.h"
 #include "acrn_mngr.h"
 #include "mevent.h"
 #include "vmm.h"
+#include "vhm_ioctl_defs.h"
 
 const char *state_str[] = {
 	[VM_STATE_UNKNOWN] = "unknown",
@@ -24,6 +28,7 @@ const char *state_str[] = {
 	[VM_STARTED] = "started",
 	[VM_SUSPENDED] = "suspended",
 	[VM_UNTRACKED] = "untracked",
+	[VM_WARM] = "warm",
 };
 
 /* List head of all vm */
@@ -41,31 +46,6 @@ struct vmmngr_struct *vmmngr_find(const char *name)
 	return NULL;
 }
 
-static int send_msg(const char *vmname, struct mngr_msg *req, struct mngr_msg *ack);
-
-static int query_state(const char *name)
-{
-	struct mngr_msg req;
-	struct mngr_msg ack;
-	int ret;
-
-	req.magic = MNGR_MSG_MAGIC;
-	req.msgid = DM_QUERY;
-	req.timestamp = time(NULL);
-
-	ret = send_msg(name, &req, &ack);
-	if (ret) {
-		printf("%s: Error to quary %s state, err: %d\n", __func__, name, ret);
-		return ret;
-	}
-
-	if (ack.data.state < 0) {
-		fprintf(stderr, "%s ack.data.state:%d\n", __FUNCTION__, ack.data.state);
-	}
-
-	return ack.data.state;
-}
-
 /*
  * get vmname and pid from /run/acrn/mngr/[vmname].monitor.[pid].socket
  */
@@ -102,6 +82,152 @@ static inline int _get_vmname_pid(const char *src, char *p_vmname,
 	return 0;
 }
 
+/*
+ * States the DMs launched by acrnd push to it on change, so that acrnd need
+ * not query them. The pid tells a new DM of the VM from the one that pushed.
+ */
+struct vm_state_cache {
+	char name[MAX_VMNAME_LEN];
+	int pid;
+	int state;
+	LIST_ENTRY(vm_state_cache) list;
+};
+
+static LIST_HEAD(vm_state_cache_list, vm_state_cache) state_cache_head;
+static pthread_mutex_t state_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void vmmngr_cache_state(const char *name, int pid, int state)
+{
+	struct vm_state_cache *c;
+
+	pthread_mutex_lock(&state_cache_mutex);
+	LIST_FOREACH(c, &state_cache_head, list)
+		if (!strcmp(name, c->name))
+			break;
+
+	if (!c) {
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			printf("%s: Failed to alloc mem for %s\n", __func__, name);
+			pthread_mutex_unlock(&state_cache_mutex);
+			return;
+		}
+		strncpy(c->name, name, sizeof(c->name) - 1);
+		LIST_INSERT_HEAD(&state_cache_head, c, list);
+	}
+
+	c->pid = pid;
+	c->state = state;
+	pthread_mutex_unlock(&state_cache_mutex);
+}
+
+static int get_cached_state(const char *name, int pid, int *state)
+{
+	struct vm_state_cache *c;
+	int ret = -1;
+
+	pthread_mutex_lock(&state_cache_mutex);
+	LIST_FOREACH(c, &state_cache_head, list)
+		if (!strcmp(name, c->name) && c->pid == pid) {
+			*state = c->state;
+			ret = 0;
+			break;
+		}
+	pthread_mutex_unlock(&state_cache_mutex);
+
+	return ret;
+}
+
+#define SEND_ALL_TIMEOUT	2	/* seconds to wait for all the acks */
+
+/*
+ * Send @req to the monitors of @n VMs at once, then collect the acks as they
+ * come: the requests take about one round trip in all, not one per VM.
+ * The ack of a VM which did not answer is left with data.err at -1.
+ */
+static void send_msg_all(char *const names[], int n, struct mngr_msg *req,
+			 struct mngr_msg *acks)
+{
+	struct pollfd *pfds;
+	time_t deadline;
+	int i, ret, pending = 0;
+
+	if (n <= 0)
+		return;
+
+	pfds = calloc(n, sizeof(*pfds));
+	if (!pfds) {
+		printf("%s: Failed to alloc mem for %d VMs\n", __func__, n);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		memset(&acks[i], 0, sizeof(acks[i]));
+		acks[i].data.err = -1;
+
+		pfds[i].events = POLLIN;
+		pfds[i].fd = mngr_open_un(names[i], MNGR_CLIENT);
+		if (pfds[i].fd < 0) {
+			printf("Unable to open vm %s socket. It may have been shutdown\n", names[i]);
+			continue;
+		}
+		if (mngr_send_msg(pfds[i].fd, req, NULL, 1) < 0) {
+			printf("Unable to send msg to vm %s socket. It may have been shutdown\n", names[i]);
+			mngr_close(pfds[i].fd);
+			pfds[i].fd = -1;
+			continue;
+		}
+		pending++;
+	}
+
+	deadline = time(NULL) + SEND_ALL_TIMEOUT;
+	while (pending > 0 && time(NULL) <= deadline) {
+		ret = poll(pfds, n, 100);
+		if (ret < 0 && errno != EINTR)
+			break;
+
+		for (i = 0; i < n && ret > 0; i++) {
+			if (pfds[i].fd < 0 || !pfds[i].revents)
+				continue;
+
+			if (read(pfds[i].fd, &acks[i], sizeof(acks[i])) != sizeof(acks[i])) {
+				memset(&acks[i], 0, sizeof(acks[i]));
+				acks[i].data.err = -1;
+			}
+			mngr_close(pfds[i].fd);
+			pfds[i].fd = -1;
+			pending--;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (pfds[i].fd >= 0) {
+			printf("No answer from vm %s\n", names[i]);
+			mngr_close(pfds[i].fd);
+		}
+	}
+	free(pfds);
+}
+
+static unsigned long dm_state_to_vm_state(int state)
+{
+	if (state < 0)
+		/* unsupport query */
+		return VM_STARTED;
+
+	switch (state) {
+	case VM_SUSPEND_NONE:
+		return VM_STARTED;
+	case VM_SUSPEND_SUSPEND:
+		return VM_SUSPENDED;
+	case VM_SUSPEND_WARM:
+		return VM_WARM;
+	default:
+		fprintf(stderr, "Warnning: unknow vm state:0x%x\n", state);
+		return VM_STATE_UNKNOWN;
+	}
+}
+
 /* find all the running DM process, which has */
 /* /run/acrn/mngr/[vmname].monitor.[pid].socket */
 static void _scan_alive_vm(void)
@@ -109,8 +235,11 @@ static void _scan_alive_vm(void)
 	DIR *dir;
 	struct dirent *entry;
 	struct vmmngr_struct *vm;
+	struct mngr_msg req, *acks;
 	char name[PATH_LEN];
-	int pid;
+	char **query = NULL, **tmp;
+	int nr_query = 0, max_query = 0;
+	int pid, state, i;
 	int ret;
 
 	ret = check_dir(ACRN_DM_SOCK_PATH, CHK_ONLY);
@@ -148,29 +277,48 @@ static void _scan_alive_vm(void)
 			memcpy(vm->name, name, sizeof(vm->name) - 1);
 			LIST_INSERT_HEAD(&vmmngr_head, vm, list);
 		}
+		vm->update = update_count;
 
-		ret = query_state(name);
+		if (!get_cached_state(vm->name, pid, &state)) {
+			vm->state_tmp = dm_state_to_vm_state(state);
+			continue;
+		}
 
-		if (ret < 0)
-			/* unsupport query */
-			vm->state_tmp = VM_STARTED;
-		else
-			switch (ret) {
-			case VM_SUSPEND_NONE:
-				vm->state_tmp = VM_STARTED;
-				break;
-			case VM_SUSPEND_SUSPEND:
-				vm->state_tmp = VM_SUSPENDED;
-				break;
-			default:
-				fprintf(stderr, "Warnning: unknow vm state:0x%lx\n",
-										vm->state);
+		/* the others are queried all at once below */
+		if (nr_query == max_query) {
+			max_query = max_query ? max_query * 2 : 16;
+			tmp = realloc(query, max_query * sizeof(*query));
+			if (!tmp) {
+				printf("%s: Failed to alloc mem for %s\n", __func__, name);
 				vm->state_tmp = VM_STATE_UNKNOWN;
+				max_query = nr_query;
+				continue;
 			}
-		vm->update = update_count;
+			query = tmp;
+		}
+		query[nr_query++] = vm->name;
 	}
 
 	closedir(dir);
+
+	if (nr_query == 0)
+		return;
+
+	acks = calloc(nr_query, sizeof(*acks));
+	if (acks) {
+		req.magic = MNGR_MSG_MAGIC;
+		req.msgid = DM_QUERY;
+		req.timestamp = time(NULL);
+		send_msg_all(query, nr_query, &req, acks);
+	}
+
+	for (i = 0; i < nr_query; i++) {
+		vm = vmmngr_find(query[i]);
+		vm->state_tmp = dm_state_to_vm_state(acks ? acks[i].data.state : -1);
+	}
+
+	free(acks);
+	free(query);
 }
 
 /*
@@ -339,6 +487,52 @@ static int send_msg(const char *vmname, struct mngr_msg *req,
 	return 0;
 }
 
+/*
+ * Send @req to all the VMs whose state is one of @states (bits of enum
+ * vm_state) at once. Return how many VMs failed it.
+ */
+int vmmngr_send_all(unsigned int states, struct mngr_msg *req)
+{
+	struct vmmngr_struct *vm;
+	struct mngr_msg *acks;
+	char **names;
+	int i, n = 0, failed = 0;
+
+	LIST_FOREACH(vm, &vmmngr_head, list)
+		if (states & (1U << vm->state))
+			n++;
+	if (n == 0)
+		return 0;
+
+	names = calloc(n, sizeof(*names));
+	acks = calloc(n, sizeof(*acks));
+	if (!names || !acks) {
+		printf("%s: Failed to alloc mem for %d VMs\n", __func__, n);
+		free(names);
+		free(acks);
+		return n;
+	}
+
+	i = 0;
+	LIST_FOREACH(vm, &vmmngr_head, list)
+		if (states & (1U << vm->state))
+			names[i++] = vm->name;
+
+	send_msg_all(names, n, req, acks);
+
+	for (i = 0; i < n; i++) {
+		if (acks[i].data.err) {
+			printf("vm %s failed msg %u, errno(%d)\n", names[i],
+				req->msgid, acks[i].data.err);
+			failed++;
+		}
+	}
+
+	free(names);
+	free(acks);
+	return failed;
+}
+
 int list_vm()
 {
 	struct vmmngr_struct *s;
@@ -355,6 +549,190 @@ int list_vm()
 	return 0;
 }
 
+static const char *rt_latency_names[] = {
+	"entry_delay",
+	"timer_delay",
+	"hv_timer_delay",
+};
+
+/* upper bound of bucket i, in TSC cycles; the last one has none */
+static uint64_t rt_latency_bound(int i)
+{
+	return 1ULL << (i + RT_LATENCY_BUCKET_SHIFT);
+}
+
+/* the upper bound of the bucket holding the permille-th delay, in ns */
+static uint64_t rt_latency_pct(const struct acrn_latency_hist *h, uint32_t tsc_khz,
+		unsigned int permille)
+{
+	uint64_t sum = 0, rank = (h->count * permille + 999) / 1000;
+	int i;
+
+	for (i = 0; i < RT_LATENCY_NR_BUCKETS - 1; i++) {
+		sum += h->hist[i];
+		if (sum >= rank)
+			return rt_latency_bound(i) * 1000000 / tsc_khz;
+	}
+
+	return h->max * 1000000 / tsc_khz;
+}
+
+static void rt_latency_print(const struct acrn_rt_latency *lat,
+		const struct acrn_latency_hist *h, const char *name)
+{
+	uint32_t khz = lat->tsc_khz;
+
+	printf("cpu%u %s count %lu avg_ns %lu p50_ns %lu p99_ns %lu p999_ns %lu max_ns %lu\n",
+		lat->pcpu_id, name, h->count,
+		h->count ? h->total / h->count * 1000000 / khz : 0,
+		rt_latency_pct(h, khz, 500), rt_latency_pct(h, khz, 990),
+		rt_latency_pct(h, khz, 999), h->max * 1000000 / khz);
+}
+
+/* Prometheus text format, cumulative buckets in seconds */
+static void rt_latency_prom(const struct acrn_rt_latency *lat,
+		const struct acrn_latency_hist *h, const char *name)
+{
+	double khz = lat->tsc_khz * 1000.0;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < RT_LATENCY_NR_BUCKETS - 1; i++) {
+		sum += h->hist[i];
+		printf("acrn_rt_latency_seconds_bucket{cpu=\"%u\",kind=\"%s\",le=\"%g\"} %lu\n",
+			lat->pcpu_id, name, rt_latency_bound(i) / khz, sum);
+	}
+	printf("acrn_rt_latency_seconds_bucket{cpu=\"%u\",kind=\"%s\",le=\"+Inf\"} %lu\n",
+		lat->pcpu_id, name, h->count);
+	printf("acrn_rt_latency_seconds_sum{cpu=\"%u\",kind=\"%s\"} %g\n",
+		lat->pcpu_id, name, h->total / khz);
+	printf("acrn_rt_latency_seconds_count{cpu=\"%u\",kind=\"%s\"} %lu\n",
+		lat->pcpu_id, name, h->count);
+	printf("acrn_rt_latency_max_seconds{cpu=\"%u\",kind=\"%s\"} %g\n",
+		lat->pcpu_id, name, h->max / khz);
+}
+
+/* the latency histograms of each pCPU, as text or for Prometheus */
+int rt_latency(int prom)
+{
+	struct acrn_rt_latency lat;
+	const struct acrn_latency_hist *h;
+	int fd, i;
+	uint16_t pcpu_id;
+
+	fd = open("/dev/acrn_hsm", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		fd = open("/dev/acrn_vhm", O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		printf("Failed to open the ACRN device: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (prom) {
+		printf("# HELP acrn_rt_latency_seconds Delays the hypervisor adds, per pCPU\n"
+			"# TYPE acrn_rt_latency_seconds histogram\n"
+			"# HELP acrn_rt_latency_max_seconds Longest delay since the hypervisor boot\n"
+			"# TYPE acrn_rt_latency_max_seconds gauge\n"
+			"# HELP acrn_rt_latency_lapic_pt pCPU running a vCPU with the LAPIC passed through\n"
+			"# TYPE acrn_rt_latency_lapic_pt gauge\n");
+	}
+
+	for (pcpu_id = 0; ; pcpu_id++) {
+		memset(&lat, 0, sizeof(lat));
+		lat.pcpu_id = pcpu_id;
+		/* fails past the last pCPU */
+		if (ioctl(fd, IC_GET_RT_LATENCY, &lat) < 0)
+			break;
+		if (!lat.tsc_khz)
+			continue;
+
+		if (prom) {
+			printf("acrn_rt_latency_lapic_pt{cpu=\"%u\"} %d\n", pcpu_id,
+				!!(lat.flags & RT_LATENCY_LAPIC_PT));
+		} else if (lat.vm_id != 0xffff) {
+			printf("cpu%u vm%u%s%s\n", pcpu_id, lat.vm_id,
+				(lat.flags & RT_LATENCY_LAPIC_PT) ? " lapic_pt" : "",
+				(lat.flags & RT_LATENCY_RT_VM) ? " rtvm" : "");
+		}
+
+		for (i = 0; i < 3; i++) {
+			h = (i == 0) ? &lat.entry_delay :
+				((i == 1) ? &lat.timer_delay : &lat.hv_timer_delay);
+			if (!h->count)
+				continue;
+			if (prom)
+				rt_latency_prom(&lat, h, rt_latency_names[i]);
+			else
+				rt_latency_print(&lat, h, rt_latency_names[i]);
+		}
+	}
+	close(fd);
+
+	if (pcpu_id == 0) {
+		printf("Failed to get the pCPU latencies: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* one line of counters per pCPU and per VM, in the /proc/stat fashion */
+int hv_stats(void)
+{
+	struct acrn_pcpu_stats stats;
+	uint64_t exits, ioreqs[PCPU_STATS_NR_VMS];
+	int fd, i;
+	uint16_t pcpu_id;
+
+	fd = open("/dev/acrn_hsm", O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		fd = open("/dev/acrn_vhm", O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		printf("Failed to open the ACRN device: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(ioreqs, 0, sizeof(ioreqs));
+	for (pcpu_id = 0; ; pcpu_id++) {
+		memset(&stats, 0, sizeof(stats));
+		stats.pcpu_id = pcpu_id;
+		/* fails past the last pCPU */
+		if (ioctl(fd, IC_GET_PCPU_STATS, &stats) < 0)
+			break;
+
+		exits = 0;
+		for (i = 0; i < PCPU_STATS_NR_EXIT_REASONS; i++)
+			exits += stats.vmexits[i];
+		printf("cpu%u vmexits %lu ept_violations %lu ipis %lu pi_notifications %lu"
+			" timer_fires %lu sched_switches %lu\n", pcpu_id, exits,
+			stats.vmexits[48], stats.ipis, stats.pi_notifications,
+			stats.timer_fires, stats.sched_switches);
+
+		printf("cpu%u exit_reasons", pcpu_id);
+		for (i = 0; i < PCPU_STATS_NR_EXIT_REASONS; i++) {
+			if (stats.vmexits[i])
+				printf(" %d:%lu", i, stats.vmexits[i]);
+		}
+		printf("\n");
+
+		for (i = 0; i < PCPU_STATS_NR_VMS; i++)
+			ioreqs[i] += stats.ioreqs[i];
+	}
+	close(fd);
+
+	if (pcpu_id == 0) {
+		printf("Failed to get the pCPU counters: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < PCPU_STATS_NR_VMS; i++) {
+		if (ioreqs[i])
+			printf("vm%d ioreqs %lu\n", i, ioreqs[i]);
+	}
+
+	return 0;
+}
+
 int start_vm(const char *vmname)
 {
 	char cmd[PATH_LEN + sizeof(ACRN_CONF_PATH_ADD) * 2 + MAX_VMNAME_LEN * 2];
@@ -368,6 +746,37 @@ int start_vm(const char *vmname)
 	return system(cmd);
 }
 
+/*
+ * Run the launch script of a VM with ACRN_DM_WARM set, so that its acrn-dm
+ * sets the VM up and then waits for start_warm_vm().
+ */
+int warm_vm(const char *vmname)
+{
+	if (setenv("ACRN_DM_WARM", "1", 1) < 0)
+		return -1;
+
+	return start_vm(vmname);
+}
+
+int start_warm_vm(const char *vmname, const char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_START;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+	if (ack.data.err) {
+		printf("Unable to start warm vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
 int stop_vm(const char *vmname, int force)
 {
 	struct mngr_msg req;
@@ -425,6 +834,124 @@ int resume_vm(const char *vmname, unsigned reason)
 	return ack.data.err;
 }
 
+int blkthrottle_vm(const char *vmname, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BLKTHROTTLE;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to throttle virtio-blk device in vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int snapshot_vm(const char *vmname, char *path)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_SNAPSHOT;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, path, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to save snapshot of vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int migrate_vm(const char *vmname, char *dest)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_MIGRATE;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, dest, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to migrate vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int balloon_vm(const char *vmname, char *size)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BALLOON;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, size, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to set the balloon size of vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int rdt_vm(const char *vmname, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_RDT;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	if (send_msg(vmname, &req, &ack))
+		return -1;
+
+	ack.data.devargs[PARAM_LEN - 1] = '\0';
+	printf("%s\n", ack.data.devargs);
+
+	return strncmp(ack.data.devargs, "error", 5) ? 0 : -1;
+}
+
+int piostat_vm(const char *vmname)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_PIOSTAT;
+	req.timestamp = time(NULL);
+
+	if (send_msg(vmname, &req, &ack))
+		return -1;
+
+	ack.data.devargs[PARAM_LEN - 1] = '\0';
+	printf("%s\n", ack.data.devargs);
+
+	return strncmp(ack.data.devargs, "error", 5) ? 0 : -1;
+}
+
 int blkrescan_vm(const char *vmname, char *devargs)
 {
 	struct mngr_msg req;
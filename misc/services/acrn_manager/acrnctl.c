@@ -28,7 +28,8 @@
 
 /* vm life cycle cmd description */
 #define LIST_DESC      "List all the virtual machines added"
-#define START_DESC     "Start virtual machine VM_NAME"
+#define START_DESC     "Start virtual machine VM_NAME, [slot,newpath, disk image to attach to a warm VM]"
+#define WARM_DESC      "Set virtual machine VM_NAME up, to be started later at once"
 #define STOP_DESC      "Stop virtual machine VM_NAME, [--force/-f, force to stop VM]"
 #define DEL_DESC       "Delete virtual machine VM_NAME"
 #define ADD_DESC       "Add one virtual machine with SCRIPTS and OPTIONS"
@@ -36,6 +37,14 @@
 #define RESUME_DESC    "Resume virtual machine from suspend state"
 #define RESET_DESC     "Stop and then start virtual machine VM_NAME"
 #define BLKRESCAN_DESC  "Rescan virtio-blk device attached to a virtual machine"
+#define BLKTHROTTLE_DESC  "Change the I/O limits of a virtio-blk device of a virtual machine"
+#define SNAPSHOT_DESC  "Save a suspended virtual machine into a snapshot file"
+#define MIGRATE_DESC  "Move a running virtual machine to acrn-dm on another host"
+#define BALLOON_DESC  "Set the memory a virtual machine gives back through its virtio-balloon"
+#define RDT_DESC  "Change and show the cache and memory bandwidth allocation of a vCPU of a virtual machine"
+#define PIOSTAT_DESC  "Show the most accessed I/O ports of a virtual machine"
+#define HVSTAT_DESC  "Show the event counters of the hypervisor per physical CPU and the I/O requests per VM"
+#define RTLAT_DESC  "Show the latencies the hypervisor adds per physical CPU, for RTVMs with the LAPIC passed through"
 
 #define VM_NAME (1)
 #define CMD_ARGS (2)
@@ -57,6 +66,16 @@ static int acrnctl_do_list(int argc, char *argv[])
 	return list_vm();
 }
 
+static int acrnctl_do_hvstat(int argc, char *argv[])
+{
+	return hv_stats();
+}
+
+static int acrnctl_do_rtlat(int argc, char *argv[])
+{
+	return rt_latency(argc == 2);
+}
+
 static int check_name(const char *name)
 {
 	int i = 0, j = 0;
@@ -429,6 +448,125 @@ static int acrnctl_do_blkrescan(int argc, char *argv[])
 	return 0;
 }
 
+static int acrnctl_do_blkthrottle(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for blkthrottle\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return blkthrottle_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_snapshot(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_SUSPENDED) {
+		printf("%s is in %s state but should be in %s state for snapshot\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_SUSPENDED]);
+		return -1;
+	}
+
+	return snapshot_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_migrate(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for migrate\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return migrate_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_balloon(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for balloon\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return balloon_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_piostat(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED && s->state != VM_PAUSED) {
+		printf("%s is in %s state but should be in %s state for piostat\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return piostat_vm(argv[VM_NAME]);
+}
+
+static int acrnctl_do_rdt(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	char devargs[PARAM_LEN];
+	int i, n;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for rdt\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	/* vcpu_id and the settings are passed to the DM as one comma separated string */
+	n = snprintf(devargs, sizeof(devargs), "%s", argv[CMD_ARGS]);
+	for (i = CMD_ARGS + 1; i < argc && n < sizeof(devargs); i++)
+		n += snprintf(devargs + n, sizeof(devargs) - n, ",%s", argv[i]);
+	if (n >= sizeof(devargs)) {
+		printf("Too long arguments for rdt\n");
+		return -1;
+	}
+
+	return rdt_vm(argv[VM_NAME], devargs);
+}
+
 static int acrnctl_do_stop(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
@@ -553,7 +691,10 @@ static int acrnctl_do_start(int argc, char *argv[])
 		return -1;
 	}
 
-	if (s->state != VM_CREATED) {
+	if (s->state == VM_WARM)
+		return start_warm_vm(argv[1], (argc > 2) ? argv[2] : "");
+
+	if (s->state != VM_CREATED || argc > 2) {
 		printf("can't start %s(%s)\n", argv[1], state_str[s->state]);
 		return -1;
 	}
@@ -562,6 +703,24 @@ static int acrnctl_do_start(int argc, char *argv[])
 
 }
 
+static int acrnctl_do_warm(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[1]);
+	if (!s) {
+		printf("can't find %s\n", argv[1]);
+		return -1;
+	}
+
+	if (s->state != VM_CREATED) {
+		printf("can't warm %s(%s)\n", argv[1], state_str[s->state]);
+		return -1;
+	}
+
+	return warm_vm(argv[1]);
+}
+
 static int acrnctl_do_suspend(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
@@ -696,6 +855,67 @@ static int valid_blkrescan_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 	return 0;
 }
 
+static int valid_blkthrottle_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME slot,iops_rd=<rate>[/<burst>],...";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_snapshot_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME /path/to/snapshot_file";
+
+	/* the file is opened by acrn-dm, which has a different cwd */
+	if (argc != 3 || argv[2][0] != '/') {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_migrate_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME host:port";
+
+	if (argc != 3 || strchr(argv[2], ':') == NULL) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_balloon_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME size_in_MB";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_rdt_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME vcpu_id [l3=mask] [l2=mask] [mba=delay]";
+
+	if (argc < 3 || argc > 6 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int valid_add_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	char df_opt[32] = "launch_scripts options";
@@ -710,9 +930,21 @@ static int valid_add_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 
 static int valid_start_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
-	char df_opt[16] = "VM_NAME";
+	char df_opt[32] = "VM_NAME [slot,newpath]";
+
+	if (argc < 2 || argc > 3 || ((argv + 1) && !strcmp(argv[1], "help"))) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_rtlat_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "[prom]";
 
-	if (argc != 2 || ((argv + 1) && !strcmp(argv[1], "help"))) {
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "prom"))) {
 		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
 		return -1;
 	}
@@ -733,6 +965,7 @@ static int valid_list_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 struct acrnctl_cmd acmds[] = {
 	ACMD("list", acrnctl_do_list, LIST_DESC, valid_list_args),
 	ACMD("start", acrnctl_do_start, START_DESC, valid_start_args),
+	ACMD("warm", acrnctl_do_warm, WARM_DESC, df_valid_args),
 	ACMD("stop", acrnctl_do_stop, STOP_DESC, df_valid_args),
 	ACMD("del", acrnctl_do_del, DEL_DESC, df_valid_args),
 	ACMD("add", acrnctl_do_add, ADD_DESC, valid_add_args),
@@ -740,6 +973,14 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("resume", acrnctl_do_resume, RESUME_DESC, df_valid_args),
 	ACMD("reset", acrnctl_do_reset, RESET_DESC, df_valid_args),
 	ACMD("blkrescan", acrnctl_do_blkrescan, BLKRESCAN_DESC, valid_blkrescan_args),
+	ACMD("blkthrottle", acrnctl_do_blkthrottle, BLKTHROTTLE_DESC, valid_blkthrottle_args),
+	ACMD("snapshot", acrnctl_do_snapshot, SNAPSHOT_DESC, valid_snapshot_args),
+	ACMD("migrate", acrnctl_do_migrate, MIGRATE_DESC, valid_migrate_args),
+	ACMD("balloon", acrnctl_do_balloon, BALLOON_DESC, valid_balloon_args),
+	ACMD("rdt", acrnctl_do_rdt, RDT_DESC, valid_rdt_args),
+	ACMD("hvstat", acrnctl_do_hvstat, HVSTAT_DESC, valid_list_args),
+	ACMD("rtlat", acrnctl_do_rtlat, RTLAT_DESC, valid_rtlat_args),
+	ACMD("piostat", acrnctl_do_piostat, PIOSTAT_DESC, df_valid_args),
 };
 
 #define NCMD	(sizeof(acmds)/sizeof(struct acrnctl_cmd))
@@ -16,6 +16,7 @@ enum vm_state {
 	VM_PAUSED,		/* VM paused */
 	VM_SUSPENDED,		/* VM suspended */
 	VM_UNTRACKED,		/* VM not created by acrnctl, or its launch script can change vm name */
+	VM_WARM,		/* VM set up by its acrn-dm, awaiting a start request */
 };
 
 extern const char *state_str[];
@@ -45,6 +46,12 @@ int shell_cmd(const char *cmd, char *outbuf, int len);
  */
 void vmmngr_update(void);
 
+/* record the state a DM pushed with DM_NOTIFY, used by vmmngr_update() */
+void vmmngr_cache_state(const char *name, int pid, int state);
+
+/* send a request to all the VMs in some states at once, see enum vm_state */
+int vmmngr_send_all(unsigned int states, struct mngr_msg *req);
+
 struct vmmngr_list_struct {
 	struct vmmngr_struct *lh_first;
 };
@@ -54,10 +61,20 @@ extern struct vmmngr_list_struct vmmngr_head;
 int list_vm(void);
 int stop_vm(const char *vmname, int force);
 int start_vm(const char *vmname);
+int warm_vm(const char *vmname);
+int start_warm_vm(const char *vmname, const char *devargs);
 int pause_vm(const char *vmname);
 int continue_vm(const char *vmname);
 int suspend_vm(const char *vmname);
 int resume_vm(const char *vmname, unsigned reason);
 int blkrescan_vm(const char *vmname, char *devargs);
+int blkthrottle_vm(const char *vmname, char *devargs);
+int snapshot_vm(const char *vmname, char *path);
+int migrate_vm(const char *vmname, char *dest);
+int balloon_vm(const char *vmname, char *size);
+int rdt_vm(const char *vmname, char *devargs);
+int piostat_vm(const char *vmname);
+int hv_stats(void);
+int rt_latency(int prom);
 
 #endif				/* _ACRNCTL_H_ */
@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -26,6 +27,8 @@
 #define HW_IOC_PATH		"/dev/cbc-early-signals"
 #define VMS_STOP_TIMEOUT	20U /* Time to wait VMs to stop */
 #define SOCK_TIMEOUT		2U
+#define WARM_POOL_MAX		16	/* VMs kept warm at most */
+#define WARM_POOL_INTERVAL	5	/* Seconds between two checks of the warm pool */
 
 /* acrnd worker timer */
 
@@ -43,6 +46,15 @@ struct acrnd_work {
 };
 
 static LIST_HEAD(acrnd_work_list, acrnd_work) work_head;
+
+/* VMs of ACRN_CONF_WARM_LIST, whose acrn-dm is kept set up and waiting */
+struct warm_vm {
+	char name[MAX_VMNAME_LEN];
+	pid_t pid;		/* acrnd child running its launch script */
+};
+
+static struct warm_vm warm_pool[WARM_POOL_MAX];
+static int warm_pool_size;
 static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_mutex_t acrnd_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -157,6 +169,9 @@ void acrnd_vm_timer_func(struct work_arg *arg)
 	case VM_SUSPENDED:
 		resume_vm(arg->name, CBC_WK_RSN_RTC);
 		break;
+	case VM_WARM:
+		start_warm_vm(arg->name, "");
+		break;
 	default:
 		printf("%s: Unknown vm state %ld\n", __func__, vm->state);
 	}
@@ -235,6 +250,10 @@ static int load_timer_list(void)
 
 static void acrnd_run_vm(char *name)
 {
+	/* have the acrn-dm push its state changes to acrnd */
+	if (setenv("ACRN_DM_NOTIFY", "1", 1) < 0)
+		exit(1);
+
 	/*If do not use logfile, then output to stdout,
 	 so that it can be redirected to journal by systemd */
 	if (logfile) {
@@ -251,66 +270,172 @@ static void acrnd_run_vm(char *name)
 	exit(0);
 }
 
+static void acrnd_warm_vm(char *name)
+{
+	if (setenv("ACRN_DM_WARM", "1", 1) < 0)
+		exit(1);
+	acrnd_run_vm(name);
+}
+
+/* load the names of the VMs to keep warm, one per line */
+static void load_warm_list(void)
+{
+	FILE *fp;
+	char l[256];
+	size_t len;
+
+	warm_pool_size = 0;
+
+	fp = fopen(ACRN_CONF_WARM_LIST, "r");
+	if (!fp)
+		return;
+
+	while (warm_pool_size < WARM_POOL_MAX && fgets(l, sizeof(l), fp)) {
+		len = strcspn(l, " \t\r\n");
+		if (len == 0)
+			continue;
+		if (len >= MAX_VMNAME_LEN) {
+			fprintf(stderr, "Invalid vmname %s from warm list file\n", l);
+			continue;
+		}
+
+		memcpy(warm_pool[warm_pool_size].name, l, len);
+		warm_pool[warm_pool_size].name[len] = '\0';
+		warm_pool[warm_pool_size].pid = 0;
+		warm_pool_size++;
+	}
+
+	fclose(fp);
+	printf("%d vms to keep warm\n", warm_pool_size);
+}
+
+static bool is_warm_vm(const char *name)
+{
+	int i;
+
+	for (i = 0; i < warm_pool_size; i++) {
+		if (!strcmp(warm_pool[i].name, name))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Set up again the warm VMs that were started and have exited, or whose
+ * acrn-dm failed, so that the next start of each is instant.
+ */
+static void keep_warm_pool(void)
+{
+	struct vmmngr_struct *vm;
+	pid_t pid;
+	int i;
+
+	if (warm_pool_size == 0)
+		return;
+
+	vmmngr_update();
+
+	for (i = 0; i < warm_pool_size; i++) {
+		if (warm_pool[i].pid > 0) {
+			/* still being set up, waiting or running */
+			if (waitpid(warm_pool[i].pid, NULL, WNOHANG) == 0)
+				continue;
+			warm_pool[i].pid = 0;
+		}
+
+		vm = vmmngr_find(warm_pool[i].name);
+		if (!vm || vm->state != VM_CREATED)
+			continue;
+
+		pid = fork();
+		if (!pid)
+			acrnd_warm_vm(warm_pool[i].name);
+		else if (pid > 0)
+			warm_pool[i].pid = pid;
+	}
+}
+
+/* resume all the suspended VMs at once */
+static int resume_suspended_vms(unsigned wakeup_reason)
+{
+	struct mngr_msg req;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_RESUME;
+	req.timestamp = time(NULL);
+	req.data.reason = wakeup_reason;
+
+	return vmmngr_send_all(1U << VM_SUSPENDED, &req) ? -1 : 0;
+}
+
 static int active_all_vms(void)
 {
 	struct vmmngr_struct *vm;
-	int ret = 0;
 	pid_t pid;
 	unsigned reason = 0;
+	int suspended = 0;
 
 	vmmngr_update();
 
+	/* each VM is launched by a child of its own, all at once */
 	LIST_FOREACH(vm, &vmmngr_head, list) {
 		switch (vm->state) {
 		case VM_CREATED:
+			/* warm VMs are set up by keep_warm_pool() instead */
+			if (is_warm_vm(vm->name))
+				break;
 			pid = fork();
 			if (!pid)
 				acrnd_run_vm(vm->name);
 			break;
 		case VM_SUSPENDED:
-			if (platform_has_hw_ioc) {
-				reason = get_sos_wakeup_reason();
-			}
-			ret += resume_vm(vm->name, reason);
+			suspended++;
 			break;
 		default:
 			printf("%s: Unkown vm state %ld\n", __func__, vm->state);
 		}
 	}
 
-	return ret ? -1 : 0;
+	if (!suspended)
+		return 0;
+
+	if (platform_has_hw_ioc) {
+		reason = get_sos_wakeup_reason();
+	}
+
+	return resume_suspended_vms(reason);
 }
 
 static void stop_all_vms(void)
 {
-	struct vmmngr_struct *vm;
-	int err;
+	struct mngr_msg req;
+	int failed;
 
 	vmmngr_update();
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		err = stop_vm(vm->name, 0);
-		if (err != 0) {
-			fprintf(stderr, "Fail to send stop cmd to vm %s\n", vm->name);
-		} else {
-			printf("Send stop cmd to vm %s successfully\n", vm->name);
-		}
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_STOP;
+	req.timestamp = time(NULL);
+	req.data.acrnd_stop.force = 0;
+
+	/* all the VMs a DM runs, at once */
+	failed = vmmngr_send_all((1U << VM_STATE_UNKNOWN) | (1U << VM_STARTED) |
+			(1U << VM_SUSPENDED) | (1U << VM_WARM), &req);
+	if (failed) {
+		fprintf(stderr, "Fail to send stop cmd to %d vms\n", failed);
+	} else {
+		printf("Send stop cmd to vms successfully\n");
 	}
 }
 
 static int wakeup_suspended_vms(unsigned wakeup_reason)
 {
-	struct vmmngr_struct *vm;
-	int ret = 0;
-
 	vmmngr_update();
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		if (vm->state == VM_SUSPENDED)
-			ret += resume_vm(vm->name, wakeup_reason);
-	}
-
-	return ret ? -1 : 0;
+	return resume_suspended_vms(wakeup_reason);
 }
 
 static int acrnd_fd = -1;
@@ -627,6 +752,14 @@ reply_ack:
 		mngr_send_msg(client_fd, &ack, NULL, 0);
 }
 
+/* a DM launched by acrnd pushed its new state */
+static void handle_dm_notify(struct mngr_msg *msg, int client_fd, void *param)
+{
+	msg->data.dm_notify.name[MAX_VMNAME_LEN - 1] = '\0';
+	vmmngr_cache_state(msg->data.dm_notify.name, msg->data.dm_notify.pid,
+			msg->data.dm_notify.state);
+}
+
 static void handle_on_exit(void)
 {
 	printf("Exiting from acrnd\n");
@@ -648,6 +781,10 @@ int init_vm(void)
 	sleep(autostart_delay);
 #endif
 
+	/* the warm VMs are set up in any case, and not auto started */
+	load_warm_list();
+	keep_warm_pool();
+
 	/* init all UOSs, according wakeup_reason */
 	if (platform_has_hw_ioc) {
 		wakeup_reason = get_sos_wakeup_reason();
@@ -735,6 +872,7 @@ static int parse_opt(int argc, char *argv[])
 
 int main(int argc, char *argv[])
 {
+	time_t warm_pool_check = 0;
 	int ret;
 
        if (getuid() != 0) {
@@ -771,6 +909,9 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* before init_vm(), for the DMs it launches */
+	mngr_add_handler(acrnd_fd, DM_NOTIFY, handle_dm_notify, NULL);
+
 	if (init_vm()) {
 		printf("%s: Failed to init_vm\n", __func__);
 		return -1;
@@ -788,9 +929,13 @@ int main(int argc, char *argv[])
 	mngr_add_handler(acrnd_fd, ACRND_STOP, handle_acrnd_stop, NULL);
 	mngr_add_handler(acrnd_fd, ACRND_RESUME, handle_acrnd_resume, NULL);
 
-	/* Last thing, run our timer works */
+	/* Last thing, run our timer works and keep the warm VMs up */
 	while (!sigterm) {
 		try_do_works();
+		if (time(NULL) - warm_pool_check >= WARM_POOL_INTERVAL) {
+			keep_warm_pool();
+			warm_pool_check = time(NULL);
+		}
 		sleep(1);
 	}
 
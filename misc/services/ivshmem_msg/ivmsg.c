@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ivmsg.h"
+#include "types.h"
+#include "ivshmem_ring.h"
+
+#define IVMSG_POOL_MAGIC	0x4c4f4f50U	/* "POOL" */
+#define IVMSG_SLOT_SIZE		64U
+#define IVMSG_DEFAULT_SPIN	1000U
+#define IVMSG_IDLE_US		100U
+
+/* the ivshmem device registers in BAR0 */
+#define IVMSG_IV_POS_REG	0x8U
+#define IVMSG_DOORBELL_REG	0xcU
+
+#define IVMSG_ALIGN(x)	(((x) + IVSHMEM_RING_ALIGN - 1) & ~((uint64_t)IVSHMEM_RING_ALIGN - 1))
+
+/* right after the ring header, offsets are from the start of the region */
+struct ivmsg_pool {
+	uint32_t magic;
+	uint32_t nr_bufs;
+	uint32_t buf_size;
+	uint32_t reserved;
+	uint64_t refs_offset;	/* uint32_t reference count per buffer */
+	uint64_t next_offset;	/* uint32_t next free buffer per buffer */
+	uint64_t bufs_offset;
+	uint64_t reserved1[3];
+
+	/* tag in the upper half against ABA, index of the first free buffer in the lower */
+	uint64_t free_head __aligned(64);
+	uint64_t reserved2[7];
+} __aligned(64);
+
+/* the data of a ring slot */
+struct ivmsg_desc {
+	uint32_t buf;
+	uint16_t src_peer;
+	uint16_t reserved;
+};
+
+static inline void *shm_at(const struct ivmsg_ctx *ctx, uint64_t offset)
+{
+	return (char *)ctx->shm + offset;
+}
+
+static inline uint32_t *buf_refs(const struct ivmsg_ctx *ctx)
+{
+	return shm_at(ctx, ctx->pool->refs_offset);
+}
+
+static inline uint32_t *buf_next(const struct ivmsg_ctx *ctx)
+{
+	return shm_at(ctx, ctx->pool->next_offset);
+}
+
+static inline struct ivshmem_ring_ctrl *ring_ctrl(const struct ivmsg_ctx *ctx,
+		uint16_t peer)
+{
+	return shm_at(ctx, ctx->hdr->ring_offset +
+			(uint64_t)peer * ctx->hdr->ring_stride);
+}
+
+static inline struct ivshmem_ring_slot *ring_slot(const struct ivmsg_ctx *ctx,
+		uint16_t peer, uint32_t idx)
+{
+	return (struct ivshmem_ring_slot *)((char *)(ring_ctrl(ctx, peer) + 1) +
+			(uint64_t)(idx & (ctx->hdr->nr_slots - 1)) *
+			ctx->hdr->slot_size);
+}
+
+int ivmsg_format(struct ivmsg_ctx *ctx, uint16_t nr_peers, uint32_t nr_slots,
+		uint32_t nr_bufs, uint32_t buf_size)
+{
+	struct ivshmem_ring_hdr *hdr = ctx->shm;
+	struct ivmsg_pool *pool = (struct ivmsg_pool *)(hdr + 1);
+	uint64_t ring_offset, ring_stride, refs_offset, next_offset, bufs_offset;
+	uint32_t *next;
+	uint32_t i;
+
+	if ((nr_peers == 0) || (nr_slots == 0) ||
+			((nr_slots & (nr_slots - 1)) != 0) ||
+			(nr_bufs == 0) || (nr_bufs >= IVMSG_NIL) || (buf_size == 0))
+		return -EINVAL;
+
+	buf_size = IVMSG_ALIGN(buf_size);
+	ring_offset = sizeof(*hdr) + sizeof(*pool);
+	ring_stride = sizeof(struct ivshmem_ring_ctrl) +
+			(uint64_t)nr_slots * IVMSG_SLOT_SIZE;
+	refs_offset = ring_offset + nr_peers * ring_stride;
+	next_offset = refs_offset + IVMSG_ALIGN((uint64_t)nr_bufs * sizeof(uint32_t));
+	bufs_offset = next_offset + IVMSG_ALIGN((uint64_t)nr_bufs * sizeof(uint32_t));
+	if ((bufs_offset + (uint64_t)nr_bufs * buf_size) > ctx->shm_size)
+		return -EINVAL;
+
+	/* peers only use the region once the magic is set */
+	__atomic_store_n(&hdr->magic, 0, __ATOMIC_RELEASE);
+	memset((char *)ctx->shm + sizeof(hdr->magic), 0,
+			bufs_offset - sizeof(hdr->magic));
+
+	pool->magic = IVMSG_POOL_MAGIC;
+	pool->nr_bufs = nr_bufs;
+	pool->buf_size = buf_size;
+	pool->refs_offset = refs_offset;
+	pool->next_offset = next_offset;
+	pool->bufs_offset = bufs_offset;
+	next = (uint32_t *)((char *)ctx->shm + next_offset);
+	for (i = 0; i < nr_bufs; i++)
+		next[i] = (i + 1 < nr_bufs) ? i + 1 : IVMSG_NIL;
+	pool->free_head = 0;
+
+	hdr->version = IVSHMEM_RING_VERSION;
+	hdr->nr_rings = nr_peers;
+	hdr->nr_slots = nr_slots;
+	hdr->slot_size = IVMSG_SLOT_SIZE;
+	hdr->ring_offset = ring_offset;
+	hdr->ring_stride = ring_stride;
+	__atomic_store_n(&hdr->magic, IVSHMEM_RING_MAGIC, __ATOMIC_RELEASE);
+
+	return ivmsg_join(ctx);
+}
+
+int ivmsg_join(struct ivmsg_ctx *ctx)
+{
+	struct ivshmem_ring_hdr *hdr = ctx->shm;
+	struct ivmsg_pool *pool = (struct ivmsg_pool *)(hdr + 1);
+
+	if (ctx->shm_size < sizeof(*hdr) + sizeof(*pool))
+		return -EINVAL;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != IVSHMEM_RING_MAGIC)
+		return -EAGAIN;
+
+	/* the other peers are trusted, this only catches a mismatched layout */
+	if ((hdr->version != IVSHMEM_RING_VERSION) ||
+			(pool->magic != IVMSG_POOL_MAGIC) ||
+			(ctx->peer_id >= hdr->nr_rings) ||
+			(hdr->nr_slots == 0) ||
+			((hdr->nr_slots & (hdr->nr_slots - 1)) != 0) ||
+			(hdr->slot_size < sizeof(struct ivshmem_ring_slot) +
+				sizeof(struct ivmsg_desc)) ||
+			((hdr->ring_offset + hdr->nr_rings * hdr->ring_stride) >
+				ctx->shm_size) ||
+			((pool->bufs_offset + (uint64_t)pool->nr_bufs *
+				pool->buf_size) > ctx->shm_size))
+		return -EINVAL;
+
+	ctx->hdr = hdr;
+	ctx->pool = pool;
+	return 0;
+}
+
+int ivmsg_attach(struct ivmsg_ctx *ctx, void *shm, size_t shm_size,
+		volatile uint32_t *regs, uint16_t peer_id, int wait_fd)
+{
+	if ((shm == NULL) || (shm_size == 0))
+		return -EINVAL;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->shm = shm;
+	ctx->shm_size = shm_size;
+	ctx->regs = regs;
+	ctx->peer_id = peer_id;
+	ctx->wait_fd = wait_fd;
+	ctx->spin = IVMSG_DEFAULT_SPIN;
+	ctx->shm_fd = -1;
+	ctx->regs_fd = -1;
+	return 0;
+}
+
+static void *map_resource(const char *pci_dev, int bar, size_t *size, int *fd)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	void *addr;
+
+	snprintf(path, sizeof(path), "%s/resource%d", pci_dev, bar);
+	*fd = open(path, O_RDWR);
+	if (*fd < 0)
+		return NULL;
+
+	if ((fstat(*fd, &st) < 0) || (st.st_size == 0)) {
+		close(*fd);
+		*fd = -1;
+		return NULL;
+	}
+
+	/* the register BAR is smaller than a page, which is what mmap takes */
+	*size = (st.st_size < getpagesize()) ? getpagesize() : st.st_size;
+	addr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (addr == MAP_FAILED) {
+		close(*fd);
+		*fd = -1;
+		return NULL;
+	}
+	return addr;
+}
+
+int ivmsg_open(struct ivmsg_ctx *ctx, const char *pci_dev, int wait_fd)
+{
+	size_t shm_size, regs_size;
+	int shm_fd, regs_fd;
+	void *shm, *regs;
+
+	regs = map_resource(pci_dev, 0, &regs_size, &regs_fd);
+	if (regs == NULL)
+		return -errno;
+
+	shm = map_resource(pci_dev, 2, &shm_size, &shm_fd);
+	if (shm == NULL) {
+		munmap(regs, regs_size);
+		close(regs_fd);
+		return -errno;
+	}
+
+	/* the peer ID of the device, that is the VM ID for HV-land ivshmem */
+	ivmsg_attach(ctx, shm, shm_size, regs,
+			(uint16_t)((volatile uint32_t *)regs)[IVMSG_IV_POS_REG >> 2],
+			wait_fd);
+	ctx->shm_fd = shm_fd;
+	ctx->regs_fd = regs_fd;
+	return 0;
+}
+
+void ivmsg_close(struct ivmsg_ctx *ctx)
+{
+	if (ctx->shm_fd >= 0) {
+		munmap(ctx->shm, ctx->shm_size);
+		close(ctx->shm_fd);
+	}
+	if (ctx->regs_fd >= 0) {
+		munmap((void *)ctx->regs, getpagesize());
+		close(ctx->regs_fd);
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->wait_fd = -1;
+	ctx->shm_fd = -1;
+	ctx->regs_fd = -1;
+}
+
+int ivmsg_buf_alloc(struct ivmsg_ctx *ctx, uint32_t *buf)
+{
+	uint64_t *head = &ctx->pool->free_head;
+	uint64_t old, new;
+	uint32_t idx;
+
+	old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+	do {
+		idx = (uint32_t)old;
+		if (idx == IVMSG_NIL)
+			return -ENOMEM;
+		if (idx >= ctx->pool->nr_bufs)
+			return -EINVAL;
+		new = (((old >> 32) + 1) << 32) |
+			__atomic_load_n(&buf_next(ctx)[idx], __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(head, &old, new, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	__atomic_store_n(&buf_refs(ctx)[idx], 1, __ATOMIC_RELAXED);
+	*buf = idx;
+	return 0;
+}
+
+void *ivmsg_buf_addr(const struct ivmsg_ctx *ctx, uint32_t buf)
+{
+	if (buf >= ctx->pool->nr_bufs)
+		return NULL;
+	return shm_at(ctx, ctx->pool->bufs_offset +
+			(uint64_t)buf * ctx->pool->buf_size);
+}
+
+uint32_t ivmsg_buf_size(const struct ivmsg_ctx *ctx)
+{
+	return ctx->pool->buf_size;
+}
+
+void ivmsg_buf_get(struct ivmsg_ctx *ctx, uint32_t buf)
+{
+	if (buf < ctx->pool->nr_bufs)
+		__atomic_add_fetch(&buf_refs(ctx)[buf], 1, __ATOMIC_RELAXED);
+}
+
+void ivmsg_buf_put(struct ivmsg_ctx *ctx, uint32_t buf)
+{
+	uint64_t *head = &ctx->pool->free_head;
+	uint64_t old, new;
+
+	if ((buf >= ctx->pool->nr_bufs) ||
+			(__atomic_sub_fetch(&buf_refs(ctx)[buf], 1,
+					    __ATOMIC_ACQ_REL) != 0))
+		return;
+
+	old = __atomic_load_n(head, __ATOMIC_RELAXED);
+	do {
+		__atomic_store_n(&buf_next(ctx)[buf], (uint32_t)old,
+				__ATOMIC_RELAXED);
+		new = (((old >> 32) + 1) << 32) | buf;
+	} while (!__atomic_compare_exchange_n(head, &old, new, false,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void ring_doorbell(const struct ivmsg_ctx *ctx, uint16_t peer)
+{
+	if (ctx->regs != NULL)
+		ctx->regs[IVMSG_DOORBELL_REG >> 2] =
+			((uint32_t)peer << 16) | ctx->vector;
+}
+
+int ivmsg_send(struct ivmsg_ctx *ctx, uint16_t peer, uint32_t buf, uint32_t len)
+{
+	struct ivshmem_ring_ctrl *ring;
+	struct ivshmem_ring_slot *slot;
+	struct ivmsg_desc *desc;
+	uint32_t r, c;
+
+	if ((peer >= ctx->hdr->nr_rings) || (buf >= ctx->pool->nr_bufs) ||
+			(len > ctx->pool->buf_size))
+		return -EINVAL;
+
+	ring = ring_ctrl(ctx, peer);
+	r = __atomic_load_n(&ring->reserve, __ATOMIC_RELAXED);
+	do {
+		c = __atomic_load_n(&ring->cons, __ATOMIC_ACQUIRE);
+		if (r - c >= ctx->hdr->nr_slots)
+			return -EAGAIN;
+	} while (!__atomic_compare_exchange_n(&ring->reserve, &r, r + 1, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	slot = ring_slot(ctx, peer, r);
+	desc = (struct ivmsg_desc *)slot->data;
+	desc->buf = buf;
+	desc->src_peer = ctx->peer_id;
+	slot->len = len;
+	__atomic_store_n(&slot->seq, r + 1, __ATOMIC_RELEASE);
+
+	/* against the consumer storing event_idx and checking the ring again */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (ivshmem_ring_need_doorbell(__atomic_load_n(&ring->event_idx,
+					__ATOMIC_RELAXED), r))
+		ring_doorbell(ctx, peer);
+
+	return 0;
+}
+
+static bool ring_pop(struct ivmsg_ctx *ctx, struct ivmsg_msg *msg)
+{
+	struct ivshmem_ring_ctrl *ring = ring_ctrl(ctx, ctx->peer_id);
+	struct ivshmem_ring_slot *slot;
+	struct ivmsg_desc *desc;
+	uint32_t c;
+
+	c = __atomic_load_n(&ring->cons, __ATOMIC_RELAXED);
+	slot = ring_slot(ctx, ctx->peer_id, c);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != c + 1)
+		return false;
+
+	desc = (struct ivmsg_desc *)slot->data;
+	msg->buf = desc->buf;
+	msg->len = slot->len;
+	msg->src_peer = desc->src_peer;
+	__atomic_store_n(&ring->cons, c + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int ivmsg_recv(struct ivmsg_ctx *ctx, struct ivmsg_msg *msg, int timeout_ms)
+{
+	struct ivshmem_ring_ctrl *ring = ring_ctrl(ctx, ctx->peer_id);
+	struct pollfd pfd;
+	int64_t deadline = 0, left = -1;
+	uint64_t count;
+	uint32_t i;
+
+	for (i = 0; i <= ctx->spin; i++) {
+		if (ring_pop(ctx, msg))
+			return 0;
+		__builtin_ia32_pause();
+	}
+	if (timeout_ms == 0)
+		return -EAGAIN;
+	if (timeout_ms > 0)
+		deadline = now_ms() + timeout_ms;
+
+	for (;;) {
+		/* ask for a doorbell on the next slot, then look again */
+		__atomic_store_n(&ring->event_idx,
+				__atomic_load_n(&ring->cons, __ATOMIC_RELAXED),
+				__ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ring_pop(ctx, msg))
+			return 0;
+
+		if (timeout_ms > 0) {
+			left = deadline - now_ms();
+			if (left <= 0)
+				return -EAGAIN;
+		}
+
+		if (ctx->wait_fd >= 0) {
+			pfd.fd = ctx->wait_fd;
+			pfd.events = POLLIN;
+			if ((poll(&pfd, 1, (int)left) > 0) &&
+					((pfd.revents & POLLIN) != 0)) {
+				/* an eventfd takes 8 bytes, a UIO device 4 */
+				if ((read(ctx->wait_fd, &count, sizeof(count)) < 0) &&
+						(errno == EINVAL) &&
+						(read(ctx->wait_fd, &count, sizeof(uint32_t)) < 0))
+					usleep(IVMSG_IDLE_US);
+			}
+		} else {
+			usleep(IVMSG_IDLE_US);
+		}
+	}
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2021 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef IVMSG_H
+#define IVMSG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Zero-copy messages between VMs sharing an ivshmem region.
+ *
+ * The region holds the rings of ivshmem_ring.h, one inbound ring per peer,
+ * and a pool of fixed-size buffers. A sender allocates a buffer, fills it in
+ * place and sends its handle; the receiver reads the same memory and puts the
+ * buffer back when done. Buffers are reference counted, so one buffer can be
+ * sent to several peers.
+ */
+
+#define IVMSG_NIL	0xffffffffU
+
+struct ivmsg_pool;
+struct ivshmem_ring_hdr;
+
+struct ivmsg_ctx {
+	void *shm;			/* the shared region */
+	size_t shm_size;
+	volatile uint32_t *regs;	/* ivshmem registers, NULL without doorbell */
+	int wait_fd;			/* readable on the vector interrupt, -1 to only poll */
+	uint16_t peer_id;
+	uint16_t vector;		/* MSI-X vector the peers ring, 0 by default */
+	uint32_t spin;			/* polls before blocking in ivmsg_recv() */
+	struct ivshmem_ring_hdr *hdr;
+	struct ivmsg_pool *pool;
+	int shm_fd;
+	int regs_fd;
+};
+
+struct ivmsg_msg {
+	uint32_t buf;			/* buffer handle, owned by the receiver */
+	uint32_t len;
+	uint16_t src_peer;
+};
+
+/**
+ * @brief Use a region mapped by the caller
+ *
+ * @param regs The ivshmem registers (BAR0), or NULL for the DM-land ivshmem,
+ *	which has no doorbell.
+ * @param peer_id The peer ID of this VM, its VM ID for HV-land ivshmem.
+ * @param wait_fd A file descriptor readable when the vector of the device
+ *	fires, such as an eventfd set up through VFIO or a UIO device, or -1
+ *	to only poll.
+ *
+ * @return 0 on success, -EINVAL on a bad argument.
+ */
+int ivmsg_attach(struct ivmsg_ctx *ctx, void *shm, size_t shm_size,
+		volatile uint32_t *regs, uint16_t peer_id, int wait_fd);
+
+/**
+ * @brief Map the BARs of an ivshmem device through sysfs and attach its region
+ *
+ * @param pci_dev The sysfs directory of the device, e.g.
+ *	/sys/bus/pci/devices/0000:00:06.0. The peer ID is read from the
+ *	IVPosition register.
+ *
+ * @return 0 on success, a negative errno otherwise.
+ */
+int ivmsg_open(struct ivmsg_ctx *ctx, const char *pci_dev, int wait_fd);
+void ivmsg_close(struct ivmsg_ctx *ctx);
+
+/**
+ * @brief Lay the rings and the buffer pool out in an attached region
+ *
+ * Run by one peer, before the other peers join.
+ *
+ * @return 0 on success, -EINVAL if the region is too small.
+ */
+int ivmsg_format(struct ivmsg_ctx *ctx, uint16_t nr_peers, uint32_t nr_slots,
+		uint32_t nr_bufs, uint32_t buf_size);
+
+/**
+ * @brief Start using an attached region formatted by another peer
+ *
+ * @return 0 on success, -EAGAIN if the region is not formatted yet,
+ *	-EINVAL if its layout is not usable.
+ */
+int ivmsg_join(struct ivmsg_ctx *ctx);
+
+int ivmsg_buf_alloc(struct ivmsg_ctx *ctx, uint32_t *buf);
+void *ivmsg_buf_addr(const struct ivmsg_ctx *ctx, uint32_t buf);
+uint32_t ivmsg_buf_size(const struct ivmsg_ctx *ctx);
+void ivmsg_buf_get(struct ivmsg_ctx *ctx, uint32_t buf);
+void ivmsg_buf_put(struct ivmsg_ctx *ctx, uint32_t buf);
+
+/**
+ * @brief Send a buffer to a peer, the caller's reference goes with it
+ *
+ * @return 0 on success, -EAGAIN if the ring of the peer is full.
+ */
+int ivmsg_send(struct ivmsg_ctx *ctx, uint16_t peer, uint32_t buf, uint32_t len);
+
+/**
+ * @brief Receive a message
+ *
+ * Polls the ring ctx->spin times, then asks for a doorbell and blocks on
+ * ctx->wait_fd, or sleeps a little between polls without one.
+ *
+ * @param timeout_ms 0 to return at once, -1 to wait forever.
+ *
+ * @return 0 on success, -EAGAIN on timeout.
+ */
+int ivmsg_recv(struct ivmsg_ctx *ctx, struct ivmsg_msg *msg, int timeout_ms);
+
+#endif /* IVMSG_H */
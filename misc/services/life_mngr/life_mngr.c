@@ -11,8 +11,11 @@
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <pthread.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -27,6 +30,13 @@
 #define SOS_SOCKET_PORT		(0x2000U)
 #define UOS_SOCKET_PORT		(SOS_SOCKET_PORT + 1U)
 
+#define MAX_PRE_VMS		8U	/* vUARTs to pre-launched VMs */
+#define MAX_POST_VMS		64U
+#define VM_NAME_SIZE		32U
+#define S5_DEADLINE_MS		20000U	/* default time for all the VMs to shut down */
+#define S5_RESEND_MS		1000U	/* default time to resend shutdown to a VM */
+#define S5_POLL_MS		100U
+
 /* life_mngr process run in SOS or UOS */
 enum process_env {
 	PROCESS_UNKNOWN = 0,
@@ -157,6 +167,188 @@ static int setup_socket_listen(unsigned short port)
 	return listen_fd;
 }
 
+/*
+ * S5 of the whole system, run by the Service VM: the shutdown requests go
+ * to all the VMs at once, each VM is tracked until it acks or stops, and
+ * the Service VM powers off as soon as they all have, or at the deadline.
+ */
+static char *pre_vm_ttys[MAX_PRE_VMS];
+static unsigned int nr_pre_vms;
+static unsigned int s5_deadline_ms = S5_DEADLINE_MS;
+static unsigned int s5_resend_ms = S5_RESEND_MS;
+static bool s5_force;	/* power off at the deadline even if a VM is still up */
+
+struct pre_vm {
+	int fd;
+	bool acked;
+	uint64_t sent_ms;
+	int len;
+	unsigned char buf[BUFF_SIZE];
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000UL + (uint64_t)ts.tv_nsec / 1000000UL;
+}
+
+/* names of the post-launched VMs acrnctl shows in a state other than @state */
+static int list_post_vms(char names[][VM_NAME_SIZE], int max, const char *state)
+{
+	FILE *fp;
+	char name[VM_NAME_SIZE], s[16];
+	int n = 0;
+
+	fp = popen("acrnctl list", "r");
+	if (fp == NULL) {
+		LOG_PRINTF("Cannot run acrnctl: %s\n", strerror(errno));
+		return -1;
+	}
+
+	while (n < max && fscanf(fp, "%31s %15s", name, s) == 2) {
+		if (strcmp(s, state) == 0)
+			continue;
+		/* "There are no VMs" */
+		if (strcmp(name, "There") == 0)
+			break;
+		memcpy(names[n], name, sizeof(name));
+		n++;
+	}
+
+	pclose(fp);
+	return n;
+}
+
+/* send stop to all the running post-launched VMs at once */
+static int stop_post_vms(void)
+{
+	char names[MAX_POST_VMS][VM_NAME_SIZE];
+	pid_t pids[MAX_POST_VMS];
+	int i, n;
+
+	n = list_post_vms(names, MAX_POST_VMS, "stopped");
+	for (i = 0; i < n; i++) {
+		LOG_PRINTF("Shutting down: %s\n", names[i]);
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			execlp("acrnctl", "acrnctl", "stop", names[i], NULL);
+			_exit(1);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (pids[i] > 0)
+			waitpid(pids[i], NULL, 0);
+	}
+
+	return n;
+}
+
+static void send_pre_vm_shutdown(struct pre_vm *vm, const char *tty)
+{
+	if (send_message(vm->fd, SHUTDOWN_CMD, sizeof(SHUTDOWN_CMD)) != 0)
+		LOG_PRINTF("Send shutdown command to %s fail\n", tty);
+	vm->sent_ms = now_ms();
+}
+
+/* feed what the VM sent, return true once it acked */
+static bool read_pre_vm_ack(struct pre_vm *vm)
+{
+	int rc;
+
+	rc = read(vm->fd, vm->buf + vm->len, sizeof(vm->buf) - vm->len);
+	if (rc > 0)
+		vm->len += rc;
+
+	if (vm->len > 0 && (vm->buf[vm->len - 1] == '\0' || vm->buf[vm->len - 1] == '\n'
+			|| vm->len == (int)sizeof(vm->buf))) {
+		if (strncmp(ACK_CMD, (const char *)vm->buf, strlen(ACK_CMD)) == 0)
+			vm->acked = true;
+		vm->len = 0;
+	}
+
+	return vm->acked;
+}
+
+static void sos_shutdown_all(void)
+{
+	struct pre_vm pre_vms[MAX_PRE_VMS];
+	struct pollfd pfds[MAX_PRE_VMS];
+	char names[MAX_POST_VMS][VM_NAME_SIZE];
+	uint64_t start, deadline, post_check = 0;
+	unsigned int i, pending_pre = 0;
+	int pending_post;
+
+	start = now_ms();
+	deadline = start + s5_deadline_ms;
+
+	memset(pre_vms, 0, sizeof(pre_vms));
+	for (i = 0; i < nr_pre_vms; i++) {
+		pre_vms[i].fd = open(pre_vm_ttys[i], O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (pre_vms[i].fd < 0 || set_tty_attr(pre_vms[i].fd, B115200) != 0) {
+			LOG_PRINTF("Error opening %s: %s\n", pre_vm_ttys[i], strerror(errno));
+			if (pre_vms[i].fd >= 0)
+				close(pre_vms[i].fd);
+			pre_vms[i].fd = -1;
+			continue;
+		}
+		send_pre_vm_shutdown(&pre_vms[i], pre_vm_ttys[i]);
+		pending_pre++;
+	}
+
+	pending_post = stop_post_vms();
+
+	while ((pending_pre > 0 || pending_post > 0) && now_ms() < deadline) {
+		for (i = 0; i < nr_pre_vms; i++) {
+			pfds[i].fd = pre_vms[i].acked ? -1 : pre_vms[i].fd;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		(void)poll(pfds, nr_pre_vms, S5_POLL_MS);
+
+		for (i = 0; i < nr_pre_vms; i++) {
+			if (pfds[i].fd < 0)
+				continue;
+			if ((pfds[i].revents & POLLIN) && read_pre_vm_ack(&pre_vms[i])) {
+				LOG_PRINTF("%s acked after %lu ms\n", pre_vm_ttys[i],
+						(unsigned long)(now_ms() - start));
+				pending_pre--;
+			} else if (now_ms() - pre_vms[i].sent_ms >= s5_resend_ms) {
+				send_pre_vm_shutdown(&pre_vms[i], pre_vm_ttys[i]);
+			}
+		}
+
+		if (pending_post > 0 && now_ms() - post_check >= 5U * S5_POLL_MS) {
+			pending_post = list_post_vms(names, MAX_POST_VMS, "stopped");
+			post_check = now_ms();
+			if (pending_post == 0)
+				LOG_PRINTF("post-launched VMs stopped after %lu ms\n",
+						(unsigned long)(now_ms() - start));
+		}
+	}
+
+	for (i = 0; i < nr_pre_vms; i++) {
+		if (pre_vms[i].fd < 0)
+			continue;
+		if (!pre_vms[i].acked)
+			LOG_PRINTF("No acked message from %s\n", pre_vm_ttys[i]);
+		close(pre_vms[i].fd);
+	}
+
+	if (pending_pre > 0 || pending_post > 0) {
+		LOG_PRINTF("S5 timed out after %u ms, %u pre-launched and %d post-launched VMs up\n",
+				s5_deadline_ms, pending_pre, pending_post);
+		if (!s5_force)
+			return;
+	}
+
+	LOG_WRITE("Shutting down the Service VM itself...\n");
+	if (system("poweroff") != 0)
+		LOG_WRITE("poweroff failed\n");
+}
+
 /* this thread runs on Service VM:
  * communiate between lifecycle-mngr and acrn-dm process in Service VM side
  */
@@ -223,8 +415,7 @@ static void *sos_socket_thread(void *arg)
 					LOG_WRITE("Send acked message to acrn-dm VM fail\n");
 				}
 				LOG_WRITE("Receive shutdown command from User VM\r\n");
-				ret = system("~/s5_trigger.sh sos");
-				LOG_PRINTF("call s5_trigger.sh ret=0x%x\r\n", ret);
+				sos_shutdown_all();
 				break;
 			}
 		}
@@ -258,6 +449,7 @@ static void *listener_fn_to_sos(void *arg)
 	int retry = TRY_SEND_CNT;
 	bool shutdown_self = false;
 	unsigned char buf[BUFF_SIZE];
+	struct pollfd pfd = { .fd = tty_dev_fd, .events = POLLIN };
 
 	/* UOS-server wait for message from SOS */
 	do {
@@ -314,7 +506,8 @@ static void *listener_fn_to_sos(void *arg)
 			break;
 		}
 
-		sleep(1);
+		/* up to a second, not to wait when the Service VM sent something */
+		(void)poll(&pfd, 1, 1000);
 
 	} while (1);
 
@@ -393,7 +586,7 @@ static void *listener_fn_to_operator(void *arg)
 int main(int argc, char *argv[])
 {
 
-	int ret = 0;
+	int ret = 0, i;
 	char *devname_uos = "";
 	enum process_env env = PROCESS_UNKNOWN;
 	pthread_t sos_socket_pid;
@@ -409,7 +602,7 @@ int main(int argc, char *argv[])
 	}
 
 	if (argc <= 2) {
-		LOG_WRITE("Too few options. Example: [./life_mngr uos /dev/ttyS1] or ./life_mngr sos /dev/ttyS1]\n");
+		LOG_WRITE("Too few options. Example: [./life_mngr uos /dev/ttyS1] or ./life_mngr sos [-d ms] [-r ms] [-f] /dev/ttyS1...]\n");
 		fclose(log_fd);
 		return -EINVAL;
 	}
@@ -432,6 +625,18 @@ int main(int argc, char *argv[])
 
 	} else if (strncmp("sos", argv[1], NODE_SIZE) == 0) {
 		env = PROCESS_RUN_IN_SOS;
+		/* [-d deadline_ms] [-r resend_ms] [-f] then the vUARTs to the pre-launched VMs */
+		for (i = 2; i < argc; i++) {
+			if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+				s5_deadline_ms = strtoul(argv[++i], NULL, 0);
+			} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+				s5_resend_ms = strtoul(argv[++i], NULL, 0);
+			} else if (strcmp(argv[i], "-f") == 0) {
+				s5_force = true;
+			} else if (nr_pre_vms < MAX_PRE_VMS) {
+				pre_vm_ttys[nr_pre_vms++] = argv[i];
+			}
+		}
 		ret = pthread_create(&sos_socket_pid, NULL, sos_socket_thread, NULL);
 	} else {
 		LOG_WRITE("Invalid param. Example: [./life_mngr uos /dev/ttyS1] or ./life_mngr sos /dev/ttyS1]\n");